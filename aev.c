@@ -12,34 +12,48 @@
 
 #include "str.h"
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <sys/types.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
 
 /*
  * sz is the total length of all the strings in aev including terminating
- * zeroes.
+ * zeroes.  The strings of exec arg and exec env tokens are stored back to
+ * back in the audit record; in that case they are copied in one go and only
+ * the pointers need rebasing.
  */
 static char **
-aev_new_internal(size_t aec, char **aev, size_t sz) {
+aev_new_internal(size_t aec, char **aev, size_t sz, bool contiguous) {
 	char **buf;
-	char *sp, *dp;
+	char *dp;
+	size_t len;
 
-	sz += sizeof(char *) * (aec + 1);
-	buf = malloc(sz);
+	buf = malloc(sizeof(char *) * (aec + 1) + sz);
 	if (!buf)
 		return NULL;
 	buf[aec] = NULL;
 	dp = (char *)&buf[aec+1];
+	if (contiguous) {
+		memcpy(dp, aev[0], sz);
+		for (size_t i = 0; i < aec; i++)
+			buf[i] = dp + (aev[i] - aev[0]);
+		return buf;
+	}
 	for (size_t i = 0; i < aec; i++) {
 		buf[i] = dp;
-		sp = aev[i];
-		while (*sp)
-			*(dp++) = *(sp++);
-		*(dp++) = '\0';
+		len = strlen(aev[i]) + 1;
+		memcpy(dp, aev[i], len);
+		dp += len;
 	}
-	assert(dp == ((char *)buf) + sz);
+	assert(dp == ((char *)&buf[aec+1]) + sz);
 	return buf;
 }
 
@@ -54,14 +68,18 @@ aev_new_internal(size_t aec, char **aev, size_t sz) {
  */
 char **
 aev_new(size_t aec, char **aev) {
+	bool contiguous = true;
 	size_t sz = 0;
 
 	errno = 0;
 	if (aec == 0 || !aev)
 		return NULL;
-	for (size_t i = 0; i < aec; i++)
+	for (size_t i = 0; i < aec; i++) {
+		if (aev[i] != aev[0] + sz)
+			contiguous = false;
 		sz += strlen(aev[i]) + 1;
-	return aev_new_internal(aec, aev, sz);
+	}
+	return aev_new_internal(aec, aev, sz, contiguous);
 }
 
 /*
@@ -88,6 +106,230 @@ aev_new_prefix(size_t aec, char **aev, const char *prefix) {
 	}
 	if (sz == 0)
 		return NULL;
-	return aev_new_internal(filtered_aec, filtered_aev, sz);
+	return aev_new_internal(filtered_aec, filtered_aev, sz, false);
+}
+
+
+/*
+ * Handle a string beginning with the first byte of prefix at offset off in
+ * the scan of aev_scan.  If the string matches, adds its size including the
+ * terminating zero to *msz if vec is NULL, otherwise copies it to the next
+ * slot of vec and to *dp.  Returns the number of matches, 0 or 1.
+ */
+static inline size_t
+aev_scan_match(const char *buf, size_t sz, size_t off,
+               const char *prefix, size_t plen,
+               size_t *msz, char **vec, char **dp) {
+	size_t len;
+
+	if (sz - off < plen || memcmp(buf + off, prefix, plen) != 0)
+		return 0;
+	len = strnlen(buf + off, sz - off) + 1;
+	if (!vec) {
+		*msz += len;
+		return 1;
+	}
+	if (len > sz - off)
+		return 0;
+	*vec = *dp;
+	memcpy(*dp, buf + off, len);
+	*dp += len;
+	return 1;
+}
+
+/*
+ * Scan the n strings stored back to back in the sz bytes at buf for those
+ * beginning with prefix, without indexing all the strings.  Matches are
+ * counted and their size accumulated in *msz if vec is NULL, or copied to
+ * vec and *dp otherwise.  The string index and the offset of the first match
+ * are stored in *first and *firstoff if first is non-NULL.
+ *
+ * Returns the number of matches and stores the size of all n strings
+ * including terminating zeroes in *len, or returns -1 if buf does not hold
+ * n strings.
+ *
+ * The SSE2 version tests 16 bytes at a time for zeroes and the first byte
+ * of prefix; only candidates at the beginning of a string, i.e. at offset 0
+ * or following a zero, are compared to the full prefix.  Loads are
+ * unaligned and stay within buf; the remaining bytes are scanned one by one.
+ */
+static inline ssize_t
+aev_scan(const char *buf, size_t sz, size_t n, const char *prefix,
+         size_t *len, size_t *msz, char **vec, char *dp,
+         size_t *first, size_t *firstoff) {
+	size_t plen = strlen(prefix);
+	size_t seen = 0;        /* strings terminated so far */
+	size_t matches = 0;
+	size_t pos = 0;
+	bool start = true;      /* buf[pos] begins a string */
+
+	assert(plen > 0);
+	if (n == 0) {
+		*len = 0;
+		return 0;
+	}
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i head = _mm_set1_epi8(prefix[0]);
+	__m128i v;
+	unsigned int nuls, cand, bit, m;
+	size_t before;
+
+	for (; sz - pos >= 16; pos += 16) {
+		v = _mm_loadu_si128((const __m128i *)(buf + pos));
+		nuls = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+		cand = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, head));
+		cand &= (nuls << 1) | (start ? 1 : 0);
+		start = !!(nuls & 0x8000);
+		if (!(nuls | cand))
+			continue;
+		/* zeroes are sparse, count them bit by bit and drop the
+		 * candidates beyond the end of the nth string */
+		before = seen;
+		for (m = nuls; m; m &= m - 1) {
+			if (++seen == n) {
+				bit = (unsigned int)__builtin_ctz(m);
+				cand &= (1U << bit) - 1;
+				*len = pos + bit + 1;
+				break;
+			}
+		}
+		while (cand) {
+			bit = (unsigned int)__builtin_ctz(cand);
+			cand &= cand - 1;
+			if (!aev_scan_match(buf, sz, pos + bit, prefix, plen,
+			                    msz, vec ? vec + matches : NULL,
+			                    &dp))
+				continue;
+			if (matches == 0 && first) {
+				*first = before + (size_t)__builtin_popcount(
+				         nuls & ((1U << bit) - 1));
+				*firstoff = pos + bit;
+			}
+			matches++;
+		}
+		if (seen == n)
+			return (ssize_t)matches;
+	}
+#endif /* __SSE2__ */
+	for (; pos < sz; pos++) {
+		if (start && buf[pos] == prefix[0] &&
+		    aev_scan_match(buf, sz, pos, prefix, plen,
+		                   msz, vec ? vec + matches : NULL, &dp)) {
+			if (matches == 0 && first) {
+				*first = seen;
+				*firstoff = pos;
+			}
+			matches++;
+		}
+		start = buf[pos] == '\0';
+		if (start && ++seen == n) {
+			*len = pos + 1;
+			return (ssize_t)matches;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Like aev_new_prefix, but for the n strings stored back to back in the sz
+ * bytes at buf, as in the raw exec arg and exec env tokens.  The strings are
+ * scanned in place and only the matching ones are copied.  Stores the size
+ * of all n strings including terminating zeroes in *len.
+ *
+ * Returns NULL if no string begins with prefix, on memory allocation
+ * failure, in which case errno is set to ENOMEM, or if buf does not hold n
+ * strings, in which case errno is set to EINVAL.
+ */
+char **
+aev_new_prefix_buf(const char *buf, size_t sz, size_t n, const char *prefix,
+                   size_t *len) {
+	char **vec;
+	ssize_t aec;
+	size_t msz = 0;
+	size_t first = 0, firstoff = 0;
+	size_t restlen;
+
+	errno = 0;
+	aec = aev_scan(buf, sz, n, prefix, len, &msz, NULL, NULL,
+	               &first, &firstoff);
+	if (aec == -1) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (aec == 0)
+		return NULL;
+	vec = malloc(sizeof(char *) * ((size_t)aec + 1) + msz);
+	if (!vec) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	vec[aec] = NULL;
+	/* copying pass resumes at the first match */
+	if (aev_scan(buf + firstoff, *len - firstoff, n - first, prefix,
+	             &restlen, &msz, vec, (char *)&vec[aec+1],
+	             NULL, NULL) != aec) {
+		assert(0);
+		free(vec);
+		errno = EINVAL;
+		return NULL;
+	}
+	return vec;
+}
+
+/*
+ * Construct a newly allocated copy of the vector aev holding at most `sz'
+ * bytes of strings including their terminating zeroes; the string that
+ * does not fit anymore is cut short and the ones after it are left out.
+ *
+ * Returns NULL if sz is 0, aev is NULL, or on memory allocation failure, in
+ * which case errno is set to ENOMEM.
+ */
+char **
+aev_new_trunc(char **aev, size_t sz) {
+	char **buf;
+	char *dp, *end;
+	size_t aec, len, total = 0;
+
+	errno = 0;
+	if (sz == 0 || !aev)
+		return NULL;
+	for (aec = 0; aev[aec] && total < sz; aec++)
+		total += strlen(aev[aec]) + 1;
+	if (total > sz)
+		total = sz;
+	buf = malloc(sizeof(char *) * (aec + 1) + total);
+	if (!buf)
+		return NULL;
+	buf[aec] = NULL;
+	dp = (char *)&buf[aec+1];
+	end = dp + total;
+	for (size_t i = 0; i < aec; i++) {
+		buf[i] = dp;
+		len = strlen(aev[i]);
+		if (len > (size_t)(end - dp) - 1)
+			len = (size_t)(end - dp) - 1;
+		memcpy(dp, aev[i], len);
+		dp[len] = '\0';
+		dp += len + 1;
+	}
+	assert(dp == end);
+	return buf;
 }
 
+/*
+ * Size of the single allocation holding a vector constructed by any of the
+ * functions above, including the pointers and the strings stored back to
+ * back after them.  Returns 0 if aev is NULL.
+ */
+size_t
+aev_size(char **aev) {
+	size_t n;
+
+	if (!aev)
+		return 0;
+	for (n = 0; aev[n]; n++);
+	if (n == 0)
+		return sizeof(char *);
+	return (size_t)(aev[n - 1] + strlen(aev[n - 1]) + 1 - (char *)aev);
+}
@@ -17,6 +17,10 @@
 
 char ** aev_new(size_t, char **) MALLOC;
 char ** aev_new_prefix(size_t, char **, const char *) MALLOC;
+char ** aev_new_prefix_buf(const char *, size_t, size_t, const char *,
+                           size_t *) MALLOC NONNULL(1,4,5);
+char ** aev_new_trunc(char **, size_t) MALLOC;
+size_t aev_size(char **) WUNRES;
 
 #endif
 
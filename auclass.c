@@ -97,7 +97,6 @@ const uint16_t auclass_xnumon_events_filemon[] = {
 	AUE_MMAP,       /* mmap */
 	AUE_MUNMAP,     /* munmap */
 #endif
-	AUE_CLOSE,      /* close, close_nocancel, guarded_close_np */
 	AUE_RENAME,     /* rename */
 	AUE_RENAMEAT,   /* renameat, renameatx_np */
 	AUE_LINK,       /* link */
@@ -121,6 +120,15 @@ const uint16_t auclass_xnumon_events_filemon[] = {
 	0
 };
 
+/*
+ * File descriptor tracking, for both file modification and socket tracking.
+ * By far the hottest of all events; only needed if either is enabled.
+ */
+const uint16_t auclass_xnumon_events_fdtrack[] = {
+	AUE_CLOSE,      /* close, close_nocancel, guarded_close_np */
+	0
+};
+
 /* Socket tracking, TCP only for now. */
 const uint16_t auclass_xnumon_events_sockmon[] = {
 	AUE_SOCKET,
@@ -142,6 +150,18 @@ const uint16_t auclass_xnumon_events_sockmon[] = {
 	0
 };
 
+/*
+ * Audit policy changes, such that the policy flags needed by xnumon can be
+ * re-applied as soon as another tool such as auditd(8) clobbers them,
+ * instead of only on the next audit policy check.
+ */
+const uint16_t auclass_xnumon_events_aupol[] = {
+#ifdef AUE_AUDITON_SPOLICY
+	AUE_AUDITON_SPOLICY,    /* auditon A_SETPOLICY, A_OLDSETPOLICY */
+#endif
+	0
+};
+
 /*
  * Add *classmask* to the classmask of all events in NULL-terminated array of
  * event IDs *aues*.  This global kernel configuration affects all consumers of
@@ -211,6 +231,8 @@ class_t classes[] = {
 	/* non-standard */
 	{"xm",      AC_XNUMON},
 	{"xnumon",  AC_XNUMON},
+	{"xp",      AC_XNUMON_PROC},
+	{"xnumon_proc", AC_XNUMON_PROC},
 	/* standard */
 	{"fr",      AC_FREAD},
 	{"fread",   AC_FREAD},
@@ -50,6 +50,7 @@
 #define AC_AUTH         0x00002000
 #define AC_APP          0x00004000
 #define AC_XNUMON       0x00400000	/* non-standard */
+#define AC_XNUMON_PROC  0x00800000	/* non-standard, see aupipe_lean */
 #define AC_IOCTL        0x20000000
 #define AC_EXEC         0x40000000
 #define AC_MISC         0x80000000
@@ -62,6 +63,8 @@ extern const uint16_t auclass_xnumon_events_procmon[];
 extern const uint16_t auclass_xnumon_events_hackmon[];
 extern const uint16_t auclass_xnumon_events_filemon[];
 extern const uint16_t auclass_xnumon_events_sockmon[];
+extern const uint16_t auclass_xnumon_events_fdtrack[];
+extern const uint16_t auclass_xnumon_events_aupol[];
 int auclass_addmask(unsigned int, const uint16_t[]) NONNULL(2);
 int auclass_removemask(unsigned int, const uint16_t[]) NONNULL(2);
 
@@ -12,14 +12,23 @@
  * Test utility for easy access to customized auditpipe audit event feeds;
  * similar to piping /dev/auditpipe through praudit, but with configuration
  * of /dev/auditpipe in-kernel via the respective ioctl calls.
+ *
+ * In throughput mode (-t), no records are printed.  Instead, records are
+ * read using the same buffered reader and header-only type filter as the
+ * xnumon event loop, and a table of the busiest audit event types with
+ * their record and byte rates is printed every interval, together with the
+ * auditpipe queue length and drops, for finding out which event types are
+ * flooding the pipe.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <poll.h>
 #include <bsm/libbsm.h>
 
 #ifndef __BSD__
@@ -30,11 +39,23 @@
 #include "aupolicy.h"
 #include "auclass.h"
 #include "auevent.h"
+#include "time.h"
+
+#define TOPTYPES 20                     /* rows per throughput table */
+
+typedef struct {
+	uint64_t count;                 /* since start */
+	uint64_t bytes;                 /* since start */
+	uint64_t icount;                /* since previous table */
+	uint64_t ibytes;                /* since previous table */
+} typestat_t;
+
+static typestat_t typestats[UINT16_MAX + 1];
 
 static void
 fusage(FILE *f, const char *argv0) {
 	fprintf(f,
-"Usage: %s [-dnrsxb] [-c classes]\n"
+"Usage: %s [-dnrsxb] [-c classes] [-t secs]\n"
 " -c classes     request only the comma-separated audit-classes: xnumon (xm),\n"
 "                fread (fr), fwrite (fw), fattra (fa), fattrm (fm),\n"
 "                fcreat (fc), fdelet (fd), fclose (cl), proc (pc), net (nt),\n"
@@ -47,6 +68,9 @@ fusage(FILE *f, const char *argv0) {
 " -s             output short format\n"
 " -x             output XML format\n"
 " -b             output binary format for piping into auditreduce|praudit\n"
+" -t secs        throughput mode: print no records, but a table of records\n"
+"                and bytes per audit event type every secs seconds; with -b,\n"
+"                capture binary format on stdout and print tables on stderr\n"
 " -v             print auditpipe statistics before and after\n"
 , argv0);
 }
@@ -63,10 +87,141 @@ dump_aupipe_stats(FILE *f) {
 	aupipe_stat_t st;
 
 	aupipe_stats(fileno(f), &st);
-	fprintf(stderr, "aupipe: q=%u/%u insert=%u read=%u drop=%u\n",
+	fprintf(stderr, "aupipe: q=%u/%u insert=%"PRIu64" read=%"PRIu64" "
+	                "drop=%"PRIu64"\n",
 	        st.qlen, st.qlimit, st.inserts, st.reads, st.drops);
 }
 
+static int
+typestat_cmp(const void *a, const void *b) {
+	uint64_t ca = typestats[*(const uint16_t *)a].icount;
+	uint64_t cb = typestats[*(const uint16_t *)b].icount;
+
+	return (ca < cb) - (ca > cb);
+}
+
+/*
+ * Print the table of the busiest event types since the previous table and
+ * reset the interval counters.
+ */
+static void
+throughput_report(FILE *out, int fd, aubuf_t *ab, uint64_t nsec,
+                  uint64_t *drops) {
+	static uint16_t types[UINT16_MAX + 1];
+	struct au_event_ent *aue_ent;
+	aupipe_stat_t st;
+	uint64_t count = 0, bytes = 0;
+	double secs = (double)nsec / 1000000000.0;
+	size_t n = 0;
+
+	for (unsigned int t = 0; t <= UINT16_MAX; t++) {
+		if (typestats[t].icount == 0)
+			continue;
+		count += typestats[t].icount;
+		bytes += typestats[t].ibytes;
+		types[n++] = (uint16_t)t;
+	}
+	qsort(types, n, sizeof(uint16_t), typestat_cmp);
+
+	aupipe_stats(fd, &st);
+	fprintf(out, "records=%.0f/s bytes=%.0f/s "
+	             "aupipe: q=%u/%u drop=%"PRIu64" (+%"PRIu64") "
+	             "resync=%"PRIu64"\n",
+	        (double)count / secs, (double)bytes / secs,
+	        st.qlen, st.qlimit, st.drops, st.drops - *drops,
+	        ab->resyncs);
+	*drops = st.drops;
+	fprintf(out, "%-24s %6s %10s %12s %12s %14s\n",
+	        "type", "id", "records/s", "records", "bytes/s", "bytes");
+	for (size_t i = 0; i < n && i < TOPTYPES; i++) {
+		typestat_t *ts = &typestats[types[i]];
+
+		aue_ent = getauevnum(types[i]);
+		fprintf(out, "%-24s %6u %10.0f %12"PRIu64" "
+		             "%12.0f %14"PRIu64"\n",
+		        aue_ent ? aue_ent->ae_name : "?", types[i],
+		        (double)ts->icount / secs, ts->count,
+		        (double)ts->ibytes / secs, ts->bytes);
+	}
+	if (n > TOPTYPES)
+		fprintf(out, "(%zu more types)\n", n - TOPTYPES);
+	fprintf(out, "\n");
+	fflush(out);
+
+	for (size_t i = 0; i < n; i++) {
+		typestats[types[i]].icount = 0;
+		typestats[types[i]].ibytes = 0;
+	}
+}
+
+/*
+ * Count records per event type without decoding them.  An empty typeset
+ * makes the reader reject every record based on its header, which leaves
+ * only the type and the raw record to look at.
+ */
+static int
+throughput(FILE *f, unsigned int interval, bool binary) {
+	auevent_typeset_t none;
+	audit_event_t ev;
+	aubuf_t ab;
+	struct pollfd pfd;
+	FILE *out = binary ? stderr : stdout;
+	uint64_t now, last, next, drops;
+	aupipe_stat_t st;
+	ssize_t rv;
+
+	auevent_typeset_init(&none);
+	if (aubuf_init(&ab, fileno(f), AUBUF_SIZE) == -1) {
+		fprintf(stderr, "aubuf_init(): %s (%i)\n",
+		        strerror(errno), errno);
+		return -1;
+	}
+	pfd.fd = fileno(f);
+	pfd.events = POLLIN;
+	aupipe_stats(fileno(f), &st);
+	drops = st.drops;
+	last = timespec_mononsec();
+	next = last + (uint64_t)interval * 1000000000;
+
+	while (active) {
+		auevent_create(&ev);
+		rv = auevent_read(&ev, &none, 0, &ab);
+		if (rv == -1) {
+			auevent_destroy(&ev);
+			aubuf_destroy(&ab);
+			return -1;
+		}
+		if (ev.flags & AEFLAG_REJECTED) {
+			typestat_t *ts = &typestats[ev.type];
+			ts->count++;
+			ts->icount++;
+			ts->bytes += ev.rawlen;
+			ts->ibytes += ev.rawlen;
+			if (binary)
+				fwrite(ev.raw, ev.rawlen, 1, stdout);
+		}
+		auevent_destroy(&ev);
+
+		now = timespec_mononsec();
+		if (now >= next) {
+			if (binary)
+				fflush(stdout);
+			throughput_report(out, fileno(f), &ab, now - last,
+			                  &drops);
+			last = now;
+			next += (uint64_t)interval * 1000000000;
+			if (next <= now)
+				next = now + (uint64_t)interval * 1000000000;
+		}
+		if (rv == 0 && !(ev.flags & AEFLAG_REJECTED) && ab.empty)
+			(void)poll(&pfd, 1, (int)((next - now) / 1000000) + 1);
+	}
+	if (binary)
+		fflush(stdout);
+	aubuf_destroy(&ab);
+	return 0;
+}
+
 int
 main(int argc, char *argv[]) {
 	FILE *f;
@@ -77,9 +232,10 @@ main(int argc, char *argv[]) {
 	unsigned int classmask = AC_ALL;
 	bool clearmask = false;
 	bool verbose = false;
+	unsigned int interval = 0;
 	const char *argv0 = argv[0];
 
-	while ((ch = getopt(argc, argv, "c:Cd:hnrsxbv")) != -1) {
+	while ((ch = getopt(argc, argv, "c:Cd:hnrsxbt:v")) != -1) {
 		switch (ch) {
 			case 'b':
 				binary = true;
@@ -108,6 +264,14 @@ main(int argc, char *argv[]) {
 			case 'x':
 				oflags |= AU_OFLAG_XML;
 				break;
+			case 't':
+				interval = (unsigned int)atoi(optarg);
+				if (interval == 0) {
+					fprintf(stderr, "%s: invalid "
+					                "interval\n", argv0);
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 'v':
 				verbose = true;
 				break;
@@ -143,7 +307,9 @@ main(int argc, char *argv[]) {
 		    auclass_addmask(AC_XNUMON,
 		                    auclass_xnumon_events_filemon) == -1 ||
 		    auclass_addmask(AC_XNUMON,
-		                    auclass_xnumon_events_sockmon) == -1) {
+		                    auclass_xnumon_events_sockmon) == -1 ||
+		    auclass_addmask(AC_XNUMON,
+		                    auclass_xnumon_events_fdtrack) == -1) {
 			fprintf(stderr, "%s: addmask(AC_XNUMON) failed\n",
 			                argv0);
 			exit(EXIT_FAILURE);
@@ -155,7 +321,7 @@ main(int argc, char *argv[]) {
 		exit(EXIT_FAILURE);
 	}
 
-	if ((f = aupipe_fopen(classmask)) == NULL) {
+	if ((f = aupipe_fopen(classmask, AUPIPE_QLIMIT_MAX)) == NULL) {
 		exit(EXIT_FAILURE);
 	}
 
@@ -163,6 +329,12 @@ main(int argc, char *argv[]) {
 		dump_aupipe_stats(f);
 	}
 
+	if (interval > 0) {
+		if (throughput(f, interval, binary) == -1)
+			exit(EXIT_FAILURE);
+		active = 0;
+	}
+
 	while (active) {
 		int reclen;
 		u_char *recbuf;
@@ -213,7 +385,11 @@ main(int argc, char *argv[]) {
 		    auclass_removemask(AC_XNUMON,
 		                       auclass_xnumon_events_hackmon) == -1 ||
 		    auclass_removemask(AC_XNUMON,
-		                       auclass_xnumon_events_filemon) == -1) {
+		                       auclass_xnumon_events_filemon) == -1 ||
+		    auclass_removemask(AC_XNUMON,
+		                       auclass_xnumon_events_sockmon) == -1 ||
+		    auclass_removemask(AC_XNUMON,
+		                       auclass_xnumon_events_fdtrack) == -1) {
 			fprintf(stderr, "%s: removemask(AC_XNUMON) failed\n",
 			                argv0);
 			exit(EXIT_FAILURE);
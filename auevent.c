@@ -15,7 +15,9 @@
 #include "sys.h"
 #include "aev.h"
 #include "logutl.h"
+#include "thrstat.h"
 
+#include <stddef.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include <stdlib.h>
@@ -24,6 +26,9 @@
 #include <errno.h>
 #include <assert.h>
 #include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <arpa/inet.h>
 
 #include <bsm/libbsm.h>
@@ -76,63 +81,501 @@ auevent_init(void) {
 	}
 
 /*
- * While this functionality is still present, it is not currently being used
- * by xnumon, so the linear search is not an issue.
+ * Set of event types to be decoded; records of all other types are rejected
+ * based on the header token alone, before decoding any other tokens.
  */
-static bool
-auevent_type_in_typelist(const uint16_t type, const uint16_t typelist[]) {
-	int i = 0;
-	if (!typelist)
-		return true;
-	while (typelist[i]) {
-		if (type == typelist[i])
-			return true;
-		i++;
+void
+auevent_typeset_init(auevent_typeset_t *set) {
+	bzero(set, sizeof(auevent_typeset_t));
+}
+
+/*
+ * Add all event types in NULL-terminated array of event IDs *aues*.
+ */
+void
+auevent_typeset_add(auevent_typeset_t *set, const uint16_t aues[]) {
+	for (int i = 0; aues[i]; i++) {
+		set->bits[aues[i] >> 6] |= (uint64_t)1 << (aues[i] & 63);
 	}
-	return false;
 }
 
+#define REJECT_TYPE(EV, SET) \
+	if ((SET) && !AUEVENT_TYPESET_CONTAINS((SET), (EV)->type)) { \
+		(EV)->flags |= AEFLAG_REJECTED; \
+		goto skip_rec; \
+	}
+
 /*
- * ev must be created using auevent_create before every call to
- * auevent_fread and destroyed after using the results.
+ * Socket records that sockmon would discard anyway are skipped as soon as
+ * the first token classifying them is decoded, before the rest of the
+ * record is decoded and before the record reaches the handlers and the
+ * file descriptor state in the process table:  socket(2) with a domain
+ * other than PF_INET and PF_INET6, bind(2), connect(2) and accept(2) with
+ * an AF_UNIX address, and, with AUEVENT_FLAG_SKIP_LOOPBACK, connect(2) and
+ * accept(2) with a loopback peer.  Binds to loopback addresses are not
+ * skipped, as they change the state kept for the socket.
+ */
+#define SKIP_LOCAL(EV) { \
+		(EV)->flags |= AEFLAG_LOCAL; \
+		goto skip_rec; \
+	}
+
+static inline bool
+auevent_is_sockop(uint16_t type) {
+	return type == AUE_BIND || type == AUE_CONNECT || type == AUE_ACCEPT;
+}
+
+static inline bool
+auevent_is_local_domain(int flags, uint16_t type, uint64_t no, uint64_t val) {
+	int domain;
+
+	if (type != AUE_SOCKET || no != 1 || !(flags & AUEVENT_FLAG_SKIP_UNIX))
+		return false;
+	domain = auevent_sock_domain((int)val);
+	return domain != PF_INET && domain != PF_INET6;
+}
+
+static inline bool
+auevent_is_local_peer(int flags, audit_event_t *ev) {
+	return (flags & AUEVENT_FLAG_SKIP_LOOPBACK) &&
+	       (ev->type == AUE_CONNECT || ev->type == AUE_ACCEPT) &&
+	       ipaddr_is_localhost(&ev->sockinet_addr);
+}
+
+/*
+ * Initialize the args between the ones initialized so far and no, so that
+ * all args below args_count are valid after no is set.
+ */
+static inline void
+auevent_args_extend(audit_event_t *ev, size_t no) {
+	size_t from = max(ev->args_count, (size_t)AUEVENT_ARGS_INIT);
+
+	if (no >= from)
+		bzero(&ev->args[from], (no + 1 - from) * sizeof(audit_arg_t));
+}
+
+/*
+ * Specialized decoding for the record types handled by the event loop that
+ * carry neither text nor exec arguments nor socket addresses.  XNU emits a
+ * fixed set of tokens for each of them, see kaudit_to_bsm():  the header,
+ * the event specific tokens, the subject, the return value and the trailer.
+ * For each type, spec lists the event specific tokens that may appear, and
+ * the subset of those that the handler uses and that are decoded; tokens
+ * not in the subset are only skipped.  The header, subject and return
+ * tokens are always decoded.  Tokens are decoded in place from their
+ * big-endian wire format instead of through au_fetch_tok(3).  Records with
+ * any other token, duplicate tokens or malformed tokens are left to the
+ * generic decoder, as are all records of types not listed here.
+ */
+#define AUSPEC_ARG      0x01
+#define AUSPEC_PATH     0x02
+#define AUSPEC_ATTR     0x04
+#define AUSPEC_PROCESS  0x08
+#define AUSPEC_EXIT     0x10
+
+typedef struct {
+	uint8_t allowed;
+	uint8_t decoded;
+} auevent_spec_t;
+
+static inline auevent_spec_t
+auevent_spec(uint16_t type) {
+	auevent_spec_t spec = {0, 0};
+
+	switch (type) {
+	case AUE_FORK:
+	case AUE_VFORK:
+	case AUE_WAIT4:
+		spec.allowed = AUSPEC_ARG;
+		break;
+	case AUE_EXIT:
+		spec.allowed = AUSPEC_EXIT;
+		break;
+	case AUE_TASKFORPID:
+	case AUE_PTRACE:
+		spec.allowed = AUSPEC_ARG|AUSPEC_PROCESS;
+		spec.decoded = AUSPEC_ARG|AUSPEC_PROCESS;
+		break;
+	case AUE_CLOSE:
+		spec.allowed = AUSPEC_ARG|AUSPEC_PATH|AUSPEC_ATTR;
+		spec.decoded = AUSPEC_ARG|AUSPEC_PATH;
+		break;
+	case AUE_UNLINK:
+	case AUE_UNLINKAT:
+		spec.allowed = AUSPEC_ARG|AUSPEC_PATH|AUSPEC_ATTR;
+		spec.decoded = AUSPEC_PATH|AUSPEC_ATTR;
+		break;
+	case AUE_CHDIR:
+	case AUE_FCHDIR:
+	case AUE_UTIMES:
+	case AUE_FUTIMES:
+	case AUE_OPEN_W: case AUE_OPEN_WC: case AUE_OPEN_WT: case AUE_OPEN_WTC:
+	case AUE_OPEN_RW: case AUE_OPEN_RWC: case AUE_OPEN_RWT:
+	case AUE_OPEN_RWTC:
+	case AUE_OPEN_EXTENDED_W: case AUE_OPEN_EXTENDED_WC:
+	case AUE_OPEN_EXTENDED_WT: case AUE_OPEN_EXTENDED_WTC:
+	case AUE_OPEN_EXTENDED_RW: case AUE_OPEN_EXTENDED_RWC:
+	case AUE_OPEN_EXTENDED_RWT: case AUE_OPEN_EXTENDED_RWTC:
+	case AUE_OPENAT_W: case AUE_OPENAT_WC: case AUE_OPENAT_WT:
+	case AUE_OPENAT_WTC:
+	case AUE_OPENAT_RW: case AUE_OPENAT_RWC: case AUE_OPENAT_RWT:
+	case AUE_OPENAT_RWTC:
+	case AUE_OPENBYID_W: case AUE_OPENBYID_WT: case AUE_OPENBYID_RW:
+	case AUE_OPENBYID_RWT:
+		spec.allowed = AUSPEC_ARG|AUSPEC_PATH|AUSPEC_ATTR;
+		spec.decoded = AUSPEC_PATH;
+		break;
+	default:
+		break;
+	}
+	return spec;
+}
+
+static inline uint16_t
+aurd16(const u_char *p) {
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return ntohs(v);
+}
+
+static inline uint32_t
+aurd32(const u_char *p) {
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return ntohl(v);
+}
+
+static inline uint64_t
+aurd64(const u_char *p) {
+	return (uint64_t)aurd32(p) << 32 | aurd32(p + 4);
+}
+
+/*
+ * Decode a subject or process token at p with avail bytes into proc the
+ * same way as the generic decoder.  Returns the length of the token or -1
+ * if it is malformed.
+ */
+static ssize_t
+auevent_spec_proc(audit_proc_t *proc, const u_char *p, size_t avail,
+                  bool is64, bool ex) {
+	size_t portsz = is64 ? 8 : 4;
+	size_t off = 1 + 28 + portsz;
+	uint64_t port;
+	uint32_t adlen = 4;
+
+	if (avail < off + 4)
+		return -1;
+	if (ex) {
+		adlen = aurd32(p + off);
+		off += 4;
+		if (adlen != AU_IPv4 && adlen != AU_IPv6)
+			return -1;
+	}
+	if (avail < off + adlen)
+		return -1;
+	proc->auid = aurd32(p + 1);
+	proc->euid = aurd32(p + 5);
+	proc->egid = aurd32(p + 9);
+	proc->ruid = aurd32(p + 13);
+	proc->rgid = aurd32(p + 17);
+	proc->pid = (pid_t)aurd32(p + 21);
+	proc->sid = aurd32(p + 25);
+	port = is64 ? aurd64(p + 29) : aurd32(p + 29);
+	proc->dev = (dev_t)port == devnull ? (dev_t)-1 : (dev_t)port;
+	if (adlen == AU_IPv6) {
+		proc->addr.family = AF_INET6;
+		memcpy(proc->addr.ev6_addr, p + off, 16);
+	} else {
+		memcpy(&proc->addr.ev_addr, p + off, 4);
+		if (proc->addr.ev_addr != 0)
+			proc->addr.family = AF_INET;
+	}
+	return (ssize_t)(off + adlen);
+}
+
+/*
+ * Specialized decoder, see auevent_spec.  Same return values as
+ * auevent_parse, plus -2 to indicate that the record needs to be decoded by
+ * the generic decoder, in which case ev is left partially decoded.
+ */
+static ssize_t
+auevent_parse_spec(audit_event_t *ev, const auevent_typeset_t *types,
+                   const u_char *recbuf, size_t reclen) {
+	const u_char *p = recbuf, *end = recbuf + reclen;
+	auevent_spec_t spec;
+	audit_attr_t *attr;
+	size_t avail, pathc = 0;
+	ssize_t len;
+	uint32_t adlen;
+	uint16_t n;
+	int cls;
+
+	if (reclen < 18)
+		return -2;
+	switch (*p) {
+	case AUT_HEADER32:
+	case AUT_HEADER64:
+		len = 10;
+		break;
+	case AUT_HEADER32_EX:
+	case AUT_HEADER64_EX:
+		adlen = aurd32(p + 10);
+		if (adlen != AU_IPv4 && adlen != AU_IPv6)
+			return -2;
+		len = 14 + (ssize_t)adlen;
+		break;
+	default:
+		return -2;
+	}
+	ev->type = aurd16(p + 6);
+	if (types && !AUEVENT_TYPESET_CONTAINS(types, ev->type)) {
+		ev->flags |= AEFLAG_REJECTED;
+		return 0;
+	}
+	spec = auevent_spec(ev->type);
+	if (!spec.allowed)
+		return -2;
+	ev->mod = aurd16(p + 8);
+	if (*p == AUT_HEADER32 || *p == AUT_HEADER32_EX) {
+		if ((size_t)len + 8 > reclen)
+			return -2;
+		ev->tv.tv_sec = (time_t)aurd32(p + len);
+		ev->tv.tv_nsec = (long)aurd32(p + len + 4) * 1000000;
+		p += len + 8;
+	} else {
+		if ((size_t)len + 16 > reclen)
+			return -2;
+		ev->tv.tv_sec = (time_t)aurd64(p + len);
+		ev->tv.tv_nsec = (long)aurd64(p + len + 8);
+		p += len + 16;
+	}
+	ev->raw = recbuf;
+	ev->rawlen = reclen;
+
+	while (p < end) {
+		avail = (size_t)(end - p);
+		switch (*p) {
+		case AUT_TRAILER:
+			if (avail != 7)
+				return -2;
+			p += 7;
+			continue;
+		case AUT_SUBJECT32:
+		case AUT_SUBJECT32_EX:
+		case AUT_SUBJECT64:
+		case AUT_SUBJECT64_EX:
+			if (ev->subject_present)
+				return -2;
+			len = auevent_spec_proc(&ev->subject, p, avail,
+			                        *p == AUT_SUBJECT64 ||
+			                        *p == AUT_SUBJECT64_EX,
+			                        *p == AUT_SUBJECT32_EX ||
+			                        *p == AUT_SUBJECT64_EX);
+			if (len == -1)
+				return -2;
+			ev->subject_present = true;
+			p += len;
+			continue;
+		case AUT_RETURN32:
+			if (ev->return_present || avail < 6)
+				return -2;
+			ev->return_present = true;
+			ev->return_error = p[1];
+			ev->return_value = aurd32(p + 2);
+			p += 6;
+			continue;
+		case AUT_RETURN64:
+			if (ev->return_present || avail < 10)
+				return -2;
+			ev->return_present = true;
+			ev->return_error = p[1];
+			ev->return_value = (uint32_t)aurd64(p + 2);
+			p += 10;
+			continue;
+		case AUT_ARG32:
+		case AUT_ARG64:
+			cls = AUSPEC_ARG;
+			break;
+		case AUT_PATH:
+			cls = AUSPEC_PATH;
+			break;
+		case AUT_ATTR32:
+		case AUT_ATTR64:
+			cls = AUSPEC_ATTR;
+			break;
+		case AUT_PROCESS32:
+		case AUT_PROCESS32_EX:
+		case AUT_PROCESS64:
+		case AUT_PROCESS64_EX:
+			cls = AUSPEC_PROCESS;
+			break;
+		case AUT_EXIT:
+			cls = AUSPEC_EXIT;
+			break;
+		default:
+			return -2;
+		}
+		if (!(spec.allowed & cls))
+			return -2;
+
+		switch (*p) {
+		case AUT_ARG32:
+			if (avail < 8)
+				return -2;
+			len = 8 + aurd16(p + 6);
+			if ((size_t)len > avail)
+				return -2;
+			if (!(spec.decoded & AUSPEC_ARG))
+				break;
+			auevent_args_extend(ev, p[1]);
+			if (ev->args[p[1]].present)
+				return -2;
+			ev->args[p[1]].present = true;
+			ev->args[p[1]].value = aurd32(p + 2);
+			ev->args_count = max(ev->args_count, (size_t)p[1] + 1);
+			break;
+		case AUT_ARG64:
+			if (avail < 12)
+				return -2;
+			len = 12 + aurd16(p + 10);
+			if ((size_t)len > avail)
+				return -2;
+			if (!(spec.decoded & AUSPEC_ARG))
+				break;
+			auevent_args_extend(ev, p[1]);
+			if (ev->args[p[1]].present)
+				return -2;
+			ev->args[p[1]].present = true;
+			ev->args[p[1]].value = aurd64(p + 2);
+			ev->args_count = max(ev->args_count, (size_t)p[1] + 1);
+			break;
+		case AUT_PATH:
+			if (avail < 3)
+				return -2;
+			n = aurd16(p + 1);
+			len = 3 + n;
+			if ((size_t)len > avail || n == 0 || p[len - 1] != '\0')
+				return -2;
+			if (!(spec.decoded & AUSPEC_PATH))
+				break;
+			if (!(pathc < sizeof(ev->path)/sizeof(ev->path[0])))
+				return -2;
+			ev->path[pathc++] = (const char *)p + 3;
+			break;
+		case AUT_ATTR32:
+		case AUT_ATTR64:
+			len = *p == AUT_ATTR32 ? 29 : 33;
+			if ((size_t)len > avail)
+				return -2;
+			if (!(spec.decoded & AUSPEC_ATTR))
+				break;
+			if (!(ev->attr_count <
+			      sizeof(ev->attr)/sizeof(ev->attr[0])))
+				return -2;
+			attr = &ev->attr[ev->attr_count++];
+			attr->mode = (mode_t)aurd32(p + 1);
+			attr->uid = aurd32(p + 5);
+			attr->gid = aurd32(p + 9);
+			attr->dev = (dev_t)aurd32(p + 13);
+			attr->ino = aurd64(p + 17);
+			break;
+		case AUT_PROCESS32:
+		case AUT_PROCESS32_EX:
+		case AUT_PROCESS64:
+		case AUT_PROCESS64_EX:
+			if (ev->process_present)
+				return -2;
+			len = auevent_spec_proc(&ev->process, p, avail,
+			                        *p == AUT_PROCESS64 ||
+			                        *p == AUT_PROCESS64_EX,
+			                        *p == AUT_PROCESS32_EX ||
+			                        *p == AUT_PROCESS64_EX);
+			if (len == -1)
+				return -2;
+			if (spec.decoded & AUSPEC_PROCESS)
+				ev->process_present = true;
+			break;
+		case AUT_EXIT:
+			if (avail < 9)
+				return -2;
+			len = 9;
+			break;
+		}
+		p += len;
+	}
+	return 1;
+}
+
+/*
+ * Decode the tokens of the record in recbuf into ev.  Pointers in ev refer
+ * to memory in recbuf, which must remain valid until ev is destroyed.
  *
  * returns 0 to indicate that a record was skipped
  * returns 1 to indicate that a record was read into ev
  * returns -1 on errors
  */
-ssize_t
-auevent_fread(audit_event_t *ev, const uint16_t aues[], int flags, FILE *f) {
+static ssize_t
+auevent_parse(audit_event_t *ev, const auevent_typeset_t *types, int flags,
+              u_char *recbuf, int reclen) {
 	int rv;
-	int reclen;
 	tokenstr_t tok;
 	size_t textc;
 	size_t pathc;
 
-	assert(ev);
+#ifndef DEBUG_AUDITPIPE
+	if (flags & AUEVENT_FLAG_HANDLERS) {
+		u_char *owned = ev->recbuf;
 
-	/*
-	 * https://github.com/openbsm/openbsm/blob/master/libbsm/bsm_io.c
-	 *
-	 * au_read_rec always reads a whole record.  On read errors or short
-	 * reads due to non-blocking I/O, it returns an error and leaves the
-	 * file pointer dangling where it was without returning the partially
-	 * read buffer.  While using blocking file descriptors on a sane
-	 * kernel, this should work for us and read exactly one event from
-	 * the file descriptor per call.
-	 */
-	reclen = au_read_rec(f, &ev->recbuf);
-	if (reclen == -1) {
-		fprintf(stderr, "au_read_rec(): %s (%i)\n",
-		                strerror(errno), errno);
-		return -1;
+		rv = (int)auevent_parse_spec(ev, types, recbuf,
+		                             (size_t)reclen);
+		if (rv != -2)
+			return rv;
+		auevent_create(ev);
+		ev->recbuf = owned;
 	}
-	if (reclen == 0)
-		goto skip_rec;
+#endif /* !DEBUG_AUDITPIPE */
 
+	ev->raw = recbuf;
+	ev->rawlen = (size_t)reclen;
 	textc = 0;
 	pathc = 0;
 	for (int recpos = 0; recpos < reclen;) {
-		rv = au_fetch_tok(&tok, ev->recbuf+recpos, reclen-recpos);
+		/*
+		 * With env level dyld, scan the raw exec env token for the
+		 * DYLD_ entries in place instead of having au_fetch_tok(3)
+		 * walk and index all strings of the environment, which is
+		 * also limited to the first AUDIT_MAX_ENV entries.  The token
+		 * is the token ID, a 32 bit big endian count of strings and
+		 * the strings stored back to back.
+		 */
+		if (recbuf[recpos] == AUT_EXEC_ENV &&
+		    (flags & AUEVENT_FLAG_ENV_DYLD) && reclen - recpos >= 5) {
+			uint32_t count;
+			size_t len;
+
+			memcpy(&count, recbuf + recpos + 1, sizeof(count));
+			assert(ev->execenv == NULL);
+			if (ev->execenv)
+				free(ev->execenv);
+			ev->execenv = aev_new_prefix_buf(
+			              (const char *)recbuf + recpos + 5,
+			              (size_t)(reclen - recpos - 5),
+			              ntohl(count), "DYLD_", &len);
+			if (!ev->execenv && errno == EINVAL) {
+				fprintf(stderr, "Truncated exec env token, "
+				                "skipping partial record\n");
+				ev->flags |= AEFLAG_PARTIAL;
+				goto skip_rec;
+			}
+			if (!ev->execenv && errno == ENOMEM)
+				ev->flags |= AEFLAG_ENOMEM;
+			recpos += 5 + (int)len;
+			continue;
+		}
+
+		rv = au_fetch_tok(&tok, recbuf+recpos, reclen-recpos);
 		if (rv == -1) {
 			/* partial record; libbsm's current implementation
 			 * of au_read_rec never reads a partial record.
@@ -140,6 +583,7 @@ auevent_fread(audit_event_t *ev, const uint16_t aues[], int flags, FILE *f) {
 			 * partial records gracefully (praudit does not). */
 			fprintf(stderr, "au_fetch_tok() returns error,"
 			                " skipping partial record\n");
+			ev->flags |= AEFLAG_PARTIAL;
 			goto skip_rec;
 		}
 
@@ -157,8 +601,7 @@ auevent_fread(audit_event_t *ev, const uint16_t aues[], int flags, FILE *f) {
 		/* record header and trailer */
 		case AUT_HEADER32:
 			ev->type = tok.tt.hdr32.e_type;
-			if (aues && !auevent_type_in_typelist(ev->type, aues))
-				goto skip_rec;
+			REJECT_TYPE(ev, types);
 			ev->mod = tok.tt.hdr32.e_mod;
 			ev->tv.tv_sec = (time_t)tok.tt.hdr32.s;
 			ev->tv.tv_nsec = (long)tok.tt.hdr32.ms*1000000;
@@ -166,8 +609,7 @@ auevent_fread(audit_event_t *ev, const uint16_t aues[], int flags, FILE *f) {
 			break;
 		case AUT_HEADER32_EX:
 			ev->type = tok.tt.hdr32_ex.e_type;
-			if (aues && !auevent_type_in_typelist(ev->type, aues))
-				goto skip_rec;
+			REJECT_TYPE(ev, types);
 			ev->mod = tok.tt.hdr32_ex.e_mod;
 			ev->tv.tv_sec = (time_t)tok.tt.hdr32_ex.s;
 			ev->tv.tv_nsec = (long)tok.tt.hdr32_ex.ms*1000000;
@@ -175,8 +617,7 @@ auevent_fread(audit_event_t *ev, const uint16_t aues[], int flags, FILE *f) {
 			break;
 		case AUT_HEADER64:
 			ev->type = tok.tt.hdr64.e_type;
-			if (aues && !auevent_type_in_typelist(ev->type, aues))
-				goto skip_rec;
+			REJECT_TYPE(ev, types);
 			ev->mod = tok.tt.hdr64.e_mod;
 			ev->tv.tv_sec = (time_t)tok.tt.hdr64.s;
 			ev->tv.tv_nsec = (long)tok.tt.hdr64.ms;
@@ -184,8 +625,7 @@ auevent_fread(audit_event_t *ev, const uint16_t aues[], int flags, FILE *f) {
 			break;
 		case AUT_HEADER64_EX:
 			ev->type = tok.tt.hdr64_ex.e_type;
-			if (aues && !auevent_type_in_typelist(ev->type, aues))
-				goto skip_rec;
+			REJECT_TYPE(ev, types);
 			ev->mod = tok.tt.hdr64_ex.e_mod;
 			ev->tv.tv_sec = (time_t)tok.tt.hdr64_ex.s;
 			ev->tv.tv_nsec = (long)tok.tt.hdr64_ex.ms;
@@ -303,6 +743,7 @@ auevent_fread(audit_event_t *ev, const uint16_t aues[], int flags, FILE *f) {
 		/* syscall arguments */
 		case AUT_ARG32:
 			/* tok.tt.arg32.no is zero-based */
+			auevent_args_extend(ev, tok.tt.arg32.no);
 			assert(!ev->args[tok.tt.arg32.no].present);
 			ev->args[tok.tt.arg32.no].present = true;
 			ev->args[tok.tt.arg32.no].value = tok.tt.arg32.val;
@@ -314,9 +755,14 @@ auevent_fread(audit_event_t *ev, const uint16_t aues[], int flags, FILE *f) {
 #endif /* DEBUG_AUDITPIPE */
 			ev->args_count = max(ev->args_count,
 			                     (size_t)tok.tt.arg32.no + 1);
+			if (auevent_is_local_domain(flags, ev->type,
+			                            tok.tt.arg32.no,
+			                            tok.tt.arg32.val))
+				SKIP_LOCAL(ev);
 			break;
 		case AUT_ARG64:
 			/* tok.tt.arg64.no is zero-based */
+			auevent_args_extend(ev, tok.tt.arg64.no);
 			assert(!ev->args[tok.tt.arg64.no].present);
 			ev->args[tok.tt.arg64.no].present = true;
 			ev->args[tok.tt.arg64.no].value = tok.tt.arg64.val;
@@ -328,6 +774,10 @@ auevent_fread(audit_event_t *ev, const uint16_t aues[], int flags, FILE *f) {
 #endif /* DEBUG_AUDITPIPE */
 			ev->args_count = max(ev->args_count,
 			                     (size_t)tok.tt.arg64.no + 1);
+			if (auevent_is_local_domain(flags, ev->type,
+			                            tok.tt.arg64.no,
+			                            tok.tt.arg64.val))
+				SKIP_LOCAL(ev);
 			break;
 		/* syscall return value */
 		case AUT_RETURN32:
@@ -418,22 +868,14 @@ auevent_fread(audit_event_t *ev, const uint16_t aues[], int flags, FILE *f) {
 			break;
 		/* exec env */
 		case AUT_EXEC_ENV:
-			if (!(flags & (AUEVENT_FLAG_ENV_DYLD |
-			               AUEVENT_FLAG_ENV_FULL)))
+			/* env level dyld is handled above */
+			if (!(flags & AUEVENT_FLAG_ENV_FULL))
 				break;
 			assert(ev->execenv == NULL);
 			if (ev->execenv)
 				free(ev->execenv);
-			if (flags & AUEVENT_FLAG_ENV_DYLD) {
-				ev->execenv = aev_new_prefix(
-				              tok.tt.execenv.count,
-				              tok.tt.execenv.text,
-				              "DYLD_");
-			} else {
-				assert(flags & AUEVENT_FLAG_ENV_FULL);
-				ev->execenv = aev_new(tok.tt.execenv.count,
-				                      tok.tt.execenv.text);
-			}
+			ev->execenv = aev_new(tok.tt.execenv.count,
+			                      tok.tt.execenv.text);
 			if (!ev->execenv && errno == ENOMEM)
 				ev->flags |= AEFLAG_ENOMEM;
 			break;
@@ -451,6 +893,8 @@ auevent_fread(audit_event_t *ev, const uint16_t aues[], int flags, FILE *f) {
 			ev->sockinet_addr.ev_addr =
 				tok.tt.sockinet_ex32.addr[0];
 			ev->sockinet_port = ntohs(tok.tt.sockinet_ex32.port);
+			if (auevent_is_local_peer(flags, ev))
+				SKIP_LOCAL(ev);
 			break;
 		case AUT_SOCKINET128: /* Darwin */
 			if (tok.tt.sockinet_ex32.family != BSM_PF_INET6)
@@ -478,9 +922,13 @@ auevent_fread(audit_event_t *ev, const uint16_t aues[], int flags, FILE *f) {
 					ntohs(tok.tt.sockinet_ex32.port);
 			}
 #endif
+			if (auevent_is_local_peer(flags, ev))
+				SKIP_LOCAL(ev);
 			break;
 		case AUT_SOCKUNIX: /* Darwin */
-			/* ignore for now */
+			if ((flags & AUEVENT_FLAG_SKIP_UNIX) &&
+			    auevent_is_sockop(ev->type))
+				SKIP_LOCAL(ev);
 			break;
 		/* unhandled tokens */
 		default:
@@ -489,6 +937,8 @@ auevent_fread(audit_event_t *ev, const uint16_t aues[], int flags, FILE *f) {
 					break;
 				if (ev->unk_tokids[i] == 0) {
 					ev->unk_tokids[i] = tok.id;
+					if (i + 1 < 256)
+						ev->unk_tokids[i + 1] = 0;
 					break;
 				}
 			}
@@ -507,13 +957,485 @@ auevent_fread(audit_event_t *ev, const uint16_t aues[], int flags, FILE *f) {
 skip_rec:
 	return 0;
 }
+#undef REJECT_TYPE
+#undef SKIP_LOCAL
+
+/*
+ * ev must be created using auevent_create before every call to
+ * auevent_fread and destroyed after using the results.
+ *
+ * returns 0 to indicate that a record was skipped
+ * returns 1 to indicate that a record was read into ev
+ * returns -1 on errors
+ */
+ssize_t
+auevent_fread(audit_event_t *ev, const auevent_typeset_t *types, int flags,
+              FILE *f) {
+	int reclen;
+
+	assert(ev);
+
+	/*
+	 * https://github.com/openbsm/openbsm/blob/master/libbsm/bsm_io.c
+	 *
+	 * au_read_rec always reads a whole record.  On read errors or short
+	 * reads due to non-blocking I/O, it returns an error and leaves the
+	 * file pointer dangling where it was without returning the partially
+	 * read buffer.  While using blocking file descriptors on a sane
+	 * kernel, this should work for us and read exactly one event from
+	 * the file descriptor per call.
+	 */
+	reclen = au_read_rec(f, &ev->recbuf);
+	if (reclen == -1) {
+		fprintf(stderr, "au_read_rec(): %s (%i)\n",
+		                strerror(errno), errno);
+		return -1;
+	}
+	if (reclen == 0)
+		return 0;
+	return auevent_parse(ev, types, flags, ev->recbuf, reclen);
+}
+
+/*
+ * Buffered zero-copy reader as an alternative to auevent_fread.  Reads as
+ * many records as available with a single read(2) into a reusable buffer and
+ * decodes records in place, avoiding the per-record malloc and stdio copy of
+ * au_read_rec.  Since the buffer can hold more than one complete record, the
+ * caller must keep calling auevent_read as long as aubuf_pending returns
+ * true, because the file descriptor will not become readable again for
+ * records that have already been read into the buffer.  The file descriptor
+ * is switched to non-blocking mode, so that the caller can also keep calling
+ * auevent_read to drain the kernel queue until the empty flag is set.
+ */
+
+int
+aubuf_init(aubuf_t *ab, int fd, size_t size) {
+	assert(ab);
+	assert(size >= AUBUF_SIZE_MIN);
+
+	bzero(ab, sizeof(aubuf_t));
+	ab->buf = malloc(size);
+	if (!ab->buf)
+		return -1;
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+		free(ab->buf);
+		ab->buf = NULL;
+		return -1;
+	}
+	ab->fd = fd;
+	ab->size = size;
+	return 0;
+}
+
+void
+aubuf_destroy(aubuf_t *ab) {
+	if (ab->buf) {
+		free(ab->buf);
+		ab->buf = NULL;
+	}
+}
+
+/*
+ * All record header tokens start with a one byte token id followed by the
+ * four byte record length in network byte order, including the header.
+ * Returns the length of the record at the head of the buffer, 0 if more data
+ * is needed, or -1 if the buffer does not start with a record header.
+ */
+static ssize_t
+aurec_len(const u_char *p, size_t avail, size_t max) {
+	uint32_t len;
+
+	if (avail < 5)
+		return 0;
+	switch (p[0]) {
+	case AUT_HEADER32:
+	case AUT_HEADER32_EX:
+	case AUT_HEADER64:
+	case AUT_HEADER64_EX:
+		break;
+	default:
+		return -1;
+	}
+	memcpy(&len, p + 1, sizeof(len));
+	len = ntohl(len);
+	if (len < 5 || len > max)
+		return -1;
+	if (avail < len)
+		return 0;
+	return (ssize_t)len;
+}
+
+static ssize_t
+aubuf_reclen(aubuf_t *ab) {
+	return aurec_len(ab->buf + ab->head, ab->tail - ab->head, ab->size);
+}
+
+/*
+ * Apply the type filter to the record at rec and decode it in place.
+ * Rejected records have only type, raw and rawlen set.
+ */
+static ssize_t
+auevent_read_rec(audit_event_t *ev, const auevent_typeset_t *types, int flags,
+                 u_char *rec, ssize_t reclen) {
+	/* all header token variants have the event type at the same offset */
+	if (types && reclen >= 8) {
+		uint16_t type;
+		memcpy(&type, rec + 6, sizeof(type));
+		ev->type = ntohs(type);
+		if (!AUEVENT_TYPESET_CONTAINS(types, ev->type)) {
+			ev->flags |= AEFLAG_REJECTED;
+			ev->raw = rec;
+			ev->rawlen = (size_t)reclen;
+			return 0;
+		}
+	}
+	return auevent_parse(ev, types, flags, rec, (int)reclen);
+}
+
+bool
+aubuf_pending(aubuf_t *ab) {
+	return aubuf_reclen(ab) > 0;
+}
+
+/*
+ * ev must be created using auevent_create before every call to
+ * auevent_read and destroyed after using the results and before the next
+ * call to auevent_read, since ev refers to memory in the reader buffer.
+ *
+ * returns 0 to indicate that a record was skipped or not complete yet
+ * returns 1 to indicate that a record was read into ev
+ * returns -1 on errors
+ */
+ssize_t
+auevent_read(audit_event_t *ev, const auevent_typeset_t *types, int flags,
+             aubuf_t *ab) {
+	ssize_t reclen;
+	ssize_t n;
+	u_char *rec;
+
+	assert(ev);
+	assert(ab);
+
+	reclen = aubuf_reclen(ab);
+	if (reclen == 0) {
+		if (ab->head > 0) {
+			memmove(ab->buf, ab->buf + ab->head,
+			        ab->tail - ab->head);
+			ab->tail -= ab->head;
+			ab->head = 0;
+		}
+		do {
+			n = read(ab->fd, ab->buf + ab->tail,
+			         ab->size - ab->tail);
+		} while (n == -1 && errno == EINTR);
+		if (n == -1 && errno == EAGAIN) {
+			ab->empty = true;
+			return 0;
+		}
+		ab->empty = false;
+		if (n == -1) {
+			fprintf(stderr, "read(auditpipe): %s (%i)\n",
+			                strerror(errno), errno);
+			return -1;
+		}
+		if (n == 0) {
+			/* end of file, only when replaying a trace */
+			errno = EPIPE;
+			return -1;
+		}
+		ab->tail += (size_t)n;
+		reclen = aubuf_reclen(ab);
+		if (reclen == 0)
+			return 0;
+	}
+	if (reclen == -1) {
+		/* lost record boundary; discard everything read so far */
+		fprintf(stderr, "Lost audit record boundary, "
+		                "discarding %zu bytes\n",
+		                ab->tail - ab->head);
+		ab->resyncs++;
+		ab->head = 0;
+		ab->tail = 0;
+		return 0;
+	}
+	rec = ab->buf + ab->head;
+	ab->head += (size_t)reclen;
+	return auevent_read_rec(ev, types, flags, rec, reclen);
+}
+
+/*
+ * Threaded reader as an alternative to aubuf.  A dedicated reader thread
+ * does nothing but read(2) raw records off the auditpipe into a ring of
+ * AURING_CHUNKS chunks, so that the kernel queue keeps being drained while
+ * the dispatching thread is busy with slow work such as path lookups in
+ * procmon.  Each chunk passed to the dispatcher contains only complete,
+ * validated records; an incomplete record at the end of a read is carried
+ * over into the next chunk.  Free chunks and chunks full of records are
+ * handed back and forth through two queues.  The reader wakes the
+ * dispatcher by writing a byte to a pipe, and the dispatcher watches the
+ * read end of that pipe instead of the auditpipe itself.  After draining the
+ * pipe using auring_ack, the dispatcher must keep calling auevent_read_ring
+ * as long as auring_pending returns true.
+ *
+ * If the dispatcher falls behind and all chunks are in use, the reader
+ * stalls until a chunk is returned and the kernel auditpipe queue fills
+ * up, as it would without the reader thread.
+ */
+
+static void *
+auring_thread(void *arg) {
+	auring_t *ar = arg;
+	struct pollfd pfd[2];
+	auchunk_t *ch;
+	size_t tail, off;
+	ssize_t n, len;
+
+	thrstat_register(THRSTAT_AURING);
+	pfd[0].fd = ar->fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = ar->stop[0];
+	pfd[1].events = POLLIN;
+	for (;;) {
+		ch = queue_dequeue_nowait(&ar->free);
+		if (!ch) {
+			atomic_fetch_add_explicit(&ar->stalls, 1,
+			                          memory_order_relaxed);
+			ch = queue_dequeue(&ar->free);
+		}
+		if (ch == (auchunk_t *)ar)
+			break; /* sentinel */
+		memcpy(ch->buf, ar->carry, ar->carrylen);
+		tail = ar->carrylen;
+		ch->head = 0;
+		ch->error = 0;
+		off = 0;
+		while (off == 0) {
+			if (poll(pfd, 2, -1) == -1) {
+				if (errno == EINTR)
+					continue;
+				ch->error = errno;
+				break;
+			}
+			if (pfd[1].revents)
+				goto out;
+			do {
+				n = read(ar->fd, ch->buf + tail,
+				         ar->chunksz - tail);
+			} while (n == -1 && errno == EINTR);
+			if (n == -1 && errno == EAGAIN)
+				continue;
+			if (n <= 0) {
+				ch->error = (n == 0) ? EPIPE : errno;
+				break;
+			}
+			tail += (size_t)n;
+			while ((len = aurec_len(ch->buf + off, tail - off,
+			                        AUBUF_SIZE_MIN)) > 0)
+				off += (size_t)len;
+			if (len == -1) {
+				/* lost record boundary; discard everything */
+				fprintf(stderr, "Lost audit record boundary, "
+				                "discarding %zu bytes\n",
+				                tail);
+				atomic_fetch_add_explicit(&ar->resyncs, 1,
+				                          memory_order_relaxed);
+				off = 0;
+				tail = 0;
+			}
+		}
+		ch->len = off;
+		ar->carrylen = tail - off;
+		memcpy(ar->carry, ch->buf + off, ar->carrylen);
+		/* full queue capacity exceeds the number of chunks */
+		(void)queue_enqueue(&ar->full, ch);
+		(void)write(ar->notify[1], "", 1);
+		if (ch->error)
+			break;
+	}
+out:
+	return NULL;
+}
+
+static int
+auring_pipe(int fds[2]) {
+	if (pipe(fds) == -1)
+		return -1;
+	if (fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1 ||
+	    fcntl(fds[1], F_SETFL, O_NONBLOCK) == -1) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	return 0;
+}
+
+int
+auring_init(auring_t *ar, int fd) {
+	size_t i;
+
+	assert(ar);
+
+	bzero(ar, sizeof(auring_t));
+	ar->fd = fd;
+	ar->chunksz = AURING_CHUNK;
+	atomic_init(&ar->stalls, 0);
+	atomic_init(&ar->resyncs, 0);
+	ar->carry = malloc(AUBUF_SIZE_MIN);
+	if (!ar->carry)
+		return -1;
+	for (i = 0; i < AURING_CHUNKS; i++) {
+		ar->chunks[i] = malloc(sizeof(auchunk_t) + ar->chunksz);
+		if (!ar->chunks[i])
+			goto errout1;
+	}
+	/* leave room for the sentinel in the free queue */
+	if (queue_init(&ar->free, AURING_CHUNKS + 1, QUEUE_BLOCK, NULL) == -1)
+		goto errout1;
+	if (queue_init(&ar->full, AURING_CHUNKS + 1, QUEUE_BLOCK, NULL) == -1)
+		goto errout2;
+	for (i = 0; i < AURING_CHUNKS; i++)
+		(void)queue_enqueue(&ar->free, ar->chunks[i]);
+	if (auring_pipe(ar->notify) == -1)
+		goto errout3;
+	if (auring_pipe(ar->stop) == -1)
+		goto errout4;
+	if (pthread_create(&ar->thr, NULL, auring_thread, ar) != 0)
+		goto errout5;
+	return 0;
+
+errout5:
+	close(ar->stop[0]);
+	close(ar->stop[1]);
+errout4:
+	close(ar->notify[0]);
+	close(ar->notify[1]);
+errout3:
+	queue_destroy(&ar->full);
+errout2:
+	queue_destroy(&ar->free);
+errout1:
+	for (i = 0; i < AURING_CHUNKS; i++)
+		free(ar->chunks[i]);
+	free(ar->carry);
+	bzero(ar, sizeof(auring_t));
+	return -1;
+}
+
+/*
+ * Stop the reader thread and release all chunks.  Must be called before
+ * closing the auditpipe.  Records not yet decoded are lost.
+ */
+void
+auring_destroy(auring_t *ar) {
+	assert(ar);
+
+	if (!ar->carry)
+		return;
+	(void)write(ar->stop[1], "", 1);
+	queue_enqueue_wait(&ar->free, ar);
+	(void)pthread_join(ar->thr, NULL);
+	close(ar->stop[0]);
+	close(ar->stop[1]);
+	close(ar->notify[0]);
+	close(ar->notify[1]);
+	queue_destroy(&ar->full);
+	queue_destroy(&ar->free);
+	for (size_t i = 0; i < AURING_CHUNKS; i++)
+		free(ar->chunks[i]);
+	free(ar->carry);
+	bzero(ar, sizeof(auring_t));
+}
+
+/*
+ * Drain the notification pipe.  Must be called before processing the
+ * pending records, so that records arriving later trigger a new
+ * notification.
+ */
+void
+auring_ack(auring_t *ar) {
+	char buf[64];
+
+	while (read(ar->notify[0], buf, sizeof(buf)) > 0);
+}
+
+/*
+ * Make the notification pipe readable again, for when the dispatcher stops
+ * processing pending records before auring_pending returns false.
+ */
+void
+auring_kick(auring_t *ar) {
+	(void)write(ar->notify[1], "", 1);
+}
+
+bool
+auring_pending(auring_t *ar) {
+	return (ar->cur && ar->cur->head < ar->cur->len) ||
+	       queue_size(&ar->full) > 0;
+}
+
+/*
+ * Number of chunks currently held by the dispatcher or waiting for it.
+ */
+size_t
+auring_used(auring_t *ar) {
+	size_t n = queue_size(&ar->free);
+
+	return n < AURING_CHUNKS ? AURING_CHUNKS - n : 0;
+}
+
+/*
+ * Same contract as auevent_read: ev refers to memory in the current chunk,
+ * which is only returned to the reader on the next call.
+ *
+ * returns 0 to indicate that a record was skipped or none is pending
+ * returns 1 to indicate that a record was read into ev
+ * returns -1 on errors
+ */
+ssize_t
+auevent_read_ring(audit_event_t *ev, const auevent_typeset_t *types,
+                  int flags, auring_t *ar) {
+	auchunk_t *ch;
+	ssize_t reclen;
+	u_char *rec;
+
+	assert(ev);
+	assert(ar);
+
+	ch = ar->cur;
+	if (ch && ch->head >= ch->len) {
+		(void)queue_enqueue(&ar->free, ch);
+		ar->cur = ch = NULL;
+	}
+	if (!ch) {
+		ch = queue_dequeue_nowait(&ar->full);
+		if (!ch)
+			return 0;
+		if (ch->error) {
+			fprintf(stderr, "read(auditpipe): %s (%i)\n",
+			                strerror(ch->error), ch->error);
+			errno = ch->error;
+			(void)queue_enqueue(&ar->free, ch);
+			return -1;
+		}
+		ar->cur = ch;
+		if (ch->len == 0)
+			return 0;
+	}
+	rec = ch->buf + ch->head;
+	reclen = aurec_len(rec, ch->len - ch->head, AUBUF_SIZE_MIN);
+	assert(reclen > 0);
+	ch->head += (size_t)reclen;
+	return auevent_read_rec(ev, types, flags, rec, reclen);
+}
 
 void
 auevent_fprint(FILE *f, audit_event_t *ev) {
 	struct au_event_ent *aue_ent;
+	logutl_tscache_t tsc;
 
 	assert(ev);
-	logutl_fwrite_timespec(f, &ev->tv);
+	logutl_tscache_init(&tsc);
+	logutl_fwrite_timespec(f, &ev->tv, &tsc);
 	aue_ent = getauevnum(ev->type);
 	fprintf(f, " %s [%i:%i]", aue_ent->ae_name, ev->type, ev->mod);
 	if (ev->subject_present) {
@@ -629,7 +1551,9 @@ auevent_fprint(FILE *f, audit_event_t *ev) {
 void
 auevent_create(audit_event_t *ev) {
 	assert(ev);
-	bzero(ev, sizeof(audit_event_t));
+	bzero(ev, offsetof(audit_event_t, args));
+	bzero(ev->args, AUEVENT_ARGS_INIT * sizeof(audit_arg_t));
+	ev->unk_tokids[0] = 0;
 }
 
 void
@@ -12,6 +12,7 @@
 #define AUEVENT_H
 
 #include "ipaddr.h"
+#include "queue.h"
 #include "attrib.h"
 
 #include <stdbool.h>
@@ -20,6 +21,7 @@
 #include <limits.h>
 #include <time.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include <bsm/audit_kevents.h> /* auevent_* take lists of event types */
 
@@ -56,16 +58,18 @@ typedef struct {
 
 typedef struct {
 	u_char *        recbuf;                 /* free */
+	const u_char *  raw;                    /* undecoded record */
+	size_t          rawlen;
 	int             flags;
 #define AEFLAG_ENOMEM 1                         /* ENOMEM encountered */
+#define AEFLAG_REJECTED 2                       /* type not in typeset */
+#define AEFLAG_PARTIAL 4                        /* partial record skipped */
+#define AEFLAG_LOCAL 8                          /* local socket op skipped */
 
 	uint16_t        type;
 	uint16_t        mod;
 	struct timespec tv;                     /* nanotime(endtime) */
 
-	size_t          args_count;
-	audit_arg_t     args[UCHAR_MAX+1];
-
 	bool            return_present;
 	unsigned char   return_error;
 	uint32_t        return_value;
@@ -96,14 +100,89 @@ typedef struct {
 	ipaddr_t        sockinet_addr;
 	uint16_t        sockinet_port;
 
+	/* The large arrays go last; auevent_create only initializes the
+	 * fields before args, the first AUEVENT_ARGS_INIT args, and the
+	 * terminator of unk_tokids.  Args beyond those are only valid below
+	 * args_count. */
+	size_t          args_count;
+	audit_arg_t     args[UCHAR_MAX+1];
 	unsigned char   unk_tokids[UCHAR_MAX+1]; /* zero-terminated list */
 } audit_event_t;
 
+#define AUEVENT_ARGS_INIT 8
+
+typedef struct {
+	int             fd;
+	u_char *        buf;                    /* malloc/free */
+	size_t          size;
+	size_t          head;                   /* start of unconsumed data */
+	size_t          tail;                   /* end of valid data */
+	uint64_t        resyncs;                /* lost record boundaries */
+	bool            empty;                  /* last read found no data */
+} aubuf_t;
+
+#define AUBUF_SIZE_MIN  (64*1024)               /* > MAXAUDITDATA */
+#define AUBUF_SIZE      (1024*1024)
+
+int aubuf_init(aubuf_t *, int, size_t) NONNULL(1) WUNRES;
+void aubuf_destroy(aubuf_t *) NONNULL(1);
+bool aubuf_pending(aubuf_t *) NONNULL(1) WUNRES;
+
+typedef struct {
+	size_t          len;                    /* complete records */
+	size_t          head;                   /* next record to decode */
+	int             error;                  /* reader failed with errno */
+	u_char          buf[];
+} auchunk_t;
+
+#define AURING_CHUNKS   16
+#define AURING_CHUNK    (256*1024)              /* > AUBUF_SIZE_MIN */
+
+typedef struct {
+	int             fd;
+	int             notify[2];              /* reader wakes dispatcher */
+	int             stop[2];                /* dispatcher stops reader */
+	pthread_t       thr;
+	size_t          chunksz;
+	queue_t         free;
+	queue_t         full;
+	auchunk_t *     cur;                    /* being decoded */
+	auchunk_t *     chunks[AURING_CHUNKS];
+	u_char *        carry;                  /* incomplete record */
+	size_t          carrylen;
+	atomic_uint_fast64_t stalls;            /* reader waited for a chunk */
+	atomic_uint_fast64_t resyncs;           /* lost record boundaries */
+} auring_t;
+
+int auring_init(auring_t *, int) NONNULL(1) WUNRES;
+void auring_destroy(auring_t *) NONNULL(1);
+void auring_ack(auring_t *) NONNULL(1);
+void auring_kick(auring_t *) NONNULL(1);
+bool auring_pending(auring_t *) NONNULL(1) WUNRES;
+size_t auring_used(auring_t *) NONNULL(1) WUNRES;
+
+typedef struct {
+	uint64_t        bits[(UINT16_MAX + 1) / 64];
+} auevent_typeset_t;
+
+#define AUEVENT_TYPESET_CONTAINS(S,T) \
+	(((S)->bits[(uint16_t)(T) >> 6] >> ((T) & 63)) & 1)
+
+void auevent_typeset_init(auevent_typeset_t *) NONNULL(1);
+void auevent_typeset_add(auevent_typeset_t *, const uint16_t[]) NONNULL(1,2);
+
 void auevent_create(audit_event_t *) NONNULL(1);
-ssize_t auevent_fread(audit_event_t *ev, const uint16_t[], int, FILE *)
-        NONNULL(1,4);
+ssize_t auevent_fread(audit_event_t *ev, const auevent_typeset_t *, int,
+                      FILE *) NONNULL(1,4);
+ssize_t auevent_read(audit_event_t *ev, const auevent_typeset_t *, int,
+                     aubuf_t *) NONNULL(1,4);
+ssize_t auevent_read_ring(audit_event_t *ev, const auevent_typeset_t *, int,
+                          auring_t *) NONNULL(1,4);
 #define AUEVENT_FLAG_ENV_DYLD 1
 #define AUEVENT_FLAG_ENV_FULL 2
+#define AUEVENT_FLAG_SKIP_UNIX 4                /* skip non-inet socket ops */
+#define AUEVENT_FLAG_SKIP_LOOPBACK 8            /* skip loopback peers */
+#define AUEVENT_FLAG_HANDLERS 16                /* handler fields only */
 void auevent_destroy(audit_event_t *) NONNULL(1);
 void auevent_fprint(FILE *, audit_event_t *) NONNULL(1,2);
 
@@ -10,8 +10,11 @@
 
 #include "aupipe.h"
 
+#include "minmax.h"
+
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 #include <unistd.h>
 #include <sys/fcntl.h>
@@ -20,10 +23,42 @@
 #include <bsm/libbsm.h>
 #include <security/audit/audit_ioctl.h>
 
+/*
+ * Adaptive queue limit:  aupipe_tune is called once per second.  The queue
+ * limit is doubled, up to the kernel maximum, whenever the kernel dropped
+ * records or the queue was at least three quarters full, and halved, down
+ * to the initial queue limit, after AUPIPE_IDLE_TICKS consecutive calls with
+ * the queue at most one eighth full.  Whether adapting or not, the highest qlen
+ * and qlimit and the number of drops are recorded per sample period of
+ * tune.period seconds into a ring of the last AUPIPE_SERIES samples.
+ *
+ * There is only one tuned auditpipe per process.
+ */
+#define AUPIPE_IDLE_TICKS       300
+
+static struct {
+	bool adapt;
+	unsigned int qlimit_min;
+	unsigned int qlimit_max;
+	uint64_t drops;                 /* at last tick */
+	unsigned int qlimit;            /* at last tick */
+	unsigned int idle;              /* consecutive idle ticks */
+	unsigned int grows;
+	unsigned int shrinks;
+	unsigned int period;
+	unsigned int ticks;             /* into current sample */
+	aupipe_sample_t cur;
+	aupipe_sample_t series[AUPIPE_SERIES];
+	unsigned int next;
+	unsigned int samples;
+} tune;
+
+static unsigned int leans;
+
 static int
-aupipe_config(int fd, unsigned int classmask) {
+aupipe_config(int fd, unsigned int classmask, unsigned int qlimit) {
 	int i;
-	unsigned int ui;
+	unsigned int ui, qmin;
 
 	i = AUDITPIPE_PRESELECT_MODE_LOCAL;
 	if (ioctl(fd, AUDITPIPE_SET_PRESELECT_MODE, &i) == -1) {
@@ -34,18 +69,27 @@ aupipe_config(int fd, unsigned int classmask) {
 		return -1;
 	}
 
-	if (ioctl(fd, AUDITPIPE_GET_QLIMIT_MAX, &i) == -1) {
-		fprintf(stderr, "ioctl(AUDITPIPE_GET_QLIMIT_MAX): "
-		                "%s (%i)\n",
-		                strerror(errno), errno);
-		return -1;
-	}
-
-	if (ioctl(fd, AUDITPIPE_SET_QLIMIT, &i) == -1) {
-			fprintf(stderr, "ioctl(AUDITPIPE_SET_QLIMIT, %i): "
+	/* with AUPIPE_QLIMIT_AUTO, start out with the kernel default */
+	if (qlimit != AUPIPE_QLIMIT_AUTO) {
+		if (ioctl(fd, AUDITPIPE_GET_QLIMIT_MAX, &ui) == -1) {
+			fprintf(stderr, "ioctl(AUDITPIPE_GET_QLIMIT_MAX): "
 			                "%s (%i)\n",
-			                i, strerror(errno), errno);
-		return -1;
+			                strerror(errno), errno);
+			return -1;
+		}
+		if (ioctl(fd, AUDITPIPE_GET_QLIMIT_MIN, &qmin) == -1) {
+			fprintf(stderr, "ioctl(AUDITPIPE_GET_QLIMIT_MIN): "
+			                "%s (%i)\n",
+			                strerror(errno), errno);
+			return -1;
+		}
+		ui = max(qmin, min(ui, qlimit));
+		if (ioctl(fd, AUDITPIPE_SET_QLIMIT, &ui) == -1) {
+			fprintf(stderr, "ioctl(AUDITPIPE_SET_QLIMIT, %u): "
+			                "%s (%i)\n",
+			                ui, strerror(errno), errno);
+			return -1;
+		}
 	}
 
 	ui = classmask;
@@ -74,7 +118,7 @@ aupipe_config(int fd, unsigned int classmask) {
 }
 
 FILE *
-aupipe_fopen(unsigned int classmask) {
+aupipe_fopen(unsigned int classmask, unsigned int qlimit) {
 	FILE *f;
 	int fd;
 
@@ -90,7 +134,7 @@ aupipe_fopen(unsigned int classmask) {
 		return NULL;
 	}
 
-	if (aupipe_config(fd, classmask) == -1) {
+	if (aupipe_config(fd, classmask, qlimit) == -1) {
 		fclose(f);
 		return NULL;
 	}
@@ -99,7 +143,7 @@ aupipe_fopen(unsigned int classmask) {
 }
 
 int
-aupipe_open(unsigned int classmask) {
+aupipe_open(unsigned int classmask, unsigned int qlimit) {
 	int fd;
 
 	if ((fd = open("/dev/auditpipe", O_RDONLY)) == -1) {
@@ -108,7 +152,7 @@ aupipe_open(unsigned int classmask) {
 		return -1;
 	}
 
-	if (aupipe_config(fd, classmask) == -1) {
+	if (aupipe_config(fd, classmask, qlimit) == -1) {
 		close(fd);
 		return -1;
 	}
@@ -116,6 +160,85 @@ aupipe_open(unsigned int classmask) {
 	return fd;
 }
 
+/*
+ * Per-auid preselection:  for the processes of the n audit user IDs in
+ * auids, select only the records of the events in classmask instead of the
+ * pipe's global preselection flags.  Requires the local preselection mode
+ * set up by aupipe_open and aupipe_fopen.  This lets the kernel drop the
+ * file and socket records of subjects that are not of interest before they
+ * are queued, which the preselection by event class alone cannot do, as it
+ * applies to all processes alike.  The kernel can only tell subjects apart
+ * by audit user ID, not by image path or signing identity.
+ */
+int
+aupipe_lean(int fd, unsigned int classmask, const uint32_t *auids, size_t n) {
+	struct auditpipe_ioctl_preselect aip;
+
+	leans = 0;
+	for (size_t i = 0; i < n; i++) {
+		bzero(&aip, sizeof(aip));
+		aip.aip_auid = (au_id_t)auids[i];
+		aip.aip_mask.am_success = classmask;
+		aip.aip_mask.am_failure = classmask;
+		if (ioctl(fd, AUDITPIPE_SET_PRESELECT_AUID, &aip) == -1) {
+			fprintf(stderr, "ioctl(AUDITPIPE_SET_PRESELECT_AUID, "
+			                "%u): %s (%i)\n", auids[i],
+			                strerror(errno), errno);
+			return -1;
+		}
+		leans++;
+	}
+	return 0;
+}
+
+/*
+ * Parse a string of comma-separated audit user IDs into auids, which has
+ * room for n entries; unset stands for processes without an audit user ID,
+ * such as system daemons.  Returns the number of auids or -1 on errors.
+ */
+int
+aupipe_parse_auids(uint32_t *auids, size_t n, const char *spec) {
+	const char *p;
+	char *end;
+	size_t sz, count;
+	unsigned long ul;
+
+	count = 0;
+	p = spec;
+	for (;;) {
+		while (*p == ' ')
+			p++;
+		sz = 0;
+		while ((p[sz] != '\0') && (p[sz] != ',') && (p[sz] != ' '))
+			sz++;
+		if (count == n || sz == 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (sz == 5 && !memcmp(p, "unset", sz)) {
+			auids[count++] = (uint32_t)AU_DEFAUDITID;
+		} else {
+			ul = strtoul(p, &end, 10);
+			if (end != p + sz || ul >= (uint32_t)AU_DEFAUDITID) {
+				errno = EINVAL;
+				return -1;
+			}
+			auids[count++] = (uint32_t)ul;
+		}
+		p += sz;
+		while (*p == ' ')
+			p++;
+		if (!*p)
+			break;
+		if (*p != ',') {
+			errno = EINVAL;
+			return -1;
+		}
+		p++;
+	}
+	return (int)count;
+}
+
 void
 aupipe_stats(int fd, aupipe_stat_t *st) {
 	if (ioctl(fd, AUDITPIPE_GET_QLEN, &st->qlen) == -1) {
@@ -133,5 +256,102 @@ aupipe_stats(int fd, aupipe_stat_t *st) {
 	if (ioctl(fd, AUDITPIPE_GET_DROPS, &st->drops) == -1) {
 		st->drops = 0;
 	}
+	st->lean = leans;
+	st->grows = tune.grows;
+	st->shrinks = tune.shrinks;
+	st->period = tune.period;
+	st->samples = tune.samples;
+	for (unsigned int i = 0; i < tune.samples; i++) {
+		st->series[i] = tune.series[(tune.next + AUPIPE_SERIES -
+		                             tune.samples + i) % AUPIPE_SERIES];
+	}
+}
+
+/*
+ * Start tuning the queue limit of fd if adapt is set, and recording qlen
+ * and qlimit every period seconds.
+ */
+void
+aupipe_tune_init(int fd, bool adapt, unsigned int period) {
+	bzero(&tune, sizeof(tune));
+	tune.period = period > 0 ? period : 1;
+	/* never shrink below the initial queue limit, the kernel default */
+	if (adapt &&
+	    ioctl(fd, AUDITPIPE_GET_QLIMIT, &tune.qlimit_min) != -1 &&
+	    ioctl(fd, AUDITPIPE_GET_QLIMIT_MAX, &tune.qlimit_max) != -1)
+		tune.adapt = true;
+	if (ioctl(fd, AUDITPIPE_GET_DROPS, &tune.drops) == -1)
+		tune.drops = 0;
+	if (ioctl(fd, AUDITPIPE_GET_QLIMIT, &tune.qlimit) == -1)
+		tune.qlimit = 0;
+}
+
+/*
+ * Current queue length in permille of the queue limit as of the last tick,
+ * or 0 if unknown.  Cheap enough to be called after every drain.
+ */
+unsigned int
+aupipe_fill(int fd) {
+	unsigned int qlen;
+
+	if (tune.qlimit == 0 || ioctl(fd, AUDITPIPE_GET_QLEN, &qlen) == -1)
+		return 0;
+	return (unsigned int)((uint64_t)min(qlen, tune.qlimit) * 1000 /
+	                      tune.qlimit);
+}
+
+/*
+ * Called once per second.
+ */
+void
+aupipe_tune(int fd) {
+	unsigned int qlen, qlimit, ui;
+	uint64_t drops, dropped;
+
+	if (ioctl(fd, AUDITPIPE_GET_QLEN, &qlen) == -1 ||
+	    ioctl(fd, AUDITPIPE_GET_QLIMIT, &qlimit) == -1 ||
+	    ioctl(fd, AUDITPIPE_GET_DROPS, &drops) == -1)
+		return;
+	dropped = drops - tune.drops;
+	tune.drops = drops;
+	tune.qlimit = qlimit;
+
+	tune.cur.qlen = max(tune.cur.qlen, qlen);
+	tune.cur.qlimit = max(tune.cur.qlimit, qlimit);
+	tune.cur.drops += dropped;
+	if (++tune.ticks >= tune.period) {
+		tune.series[tune.next] = tune.cur;
+		tune.next = (tune.next + 1) % AUPIPE_SERIES;
+		if (tune.samples < AUPIPE_SERIES)
+			tune.samples++;
+		bzero(&tune.cur, sizeof(tune.cur));
+		tune.ticks = 0;
+	}
+
+	if (!tune.adapt)
+		return;
+	if (dropped > 0 || qlen >= qlimit - qlimit / 4) {
+		tune.idle = 0;
+		if (qlimit >= tune.qlimit_max)
+			return;
+		ui = min(tune.qlimit_max, qlimit * 2);
+		if (ioctl(fd, AUDITPIPE_SET_QLIMIT, &ui) != -1) {
+			tune.qlimit = ui;
+			tune.grows++;
+		}
+	} else if (qlen <= qlimit / 8) {
+		if (++tune.idle < AUPIPE_IDLE_TICKS)
+			return;
+		tune.idle = 0;
+		if (qlimit <= tune.qlimit_min)
+			return;
+		ui = max(tune.qlimit_min, qlimit / 2);
+		if (ioctl(fd, AUDITPIPE_SET_QLIMIT, &ui) != -1) {
+			tune.qlimit = ui;
+			tune.shrinks++;
+		}
+	} else {
+		tune.idle = 0;
+	}
 }
 
@@ -14,18 +14,45 @@
 #include "attrib.h"
 
 #include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+
+#define AUPIPE_QLIMIT_AUTO      0               /* adapt to load */
+#define AUPIPE_QLIMIT_MAX       UINT_MAX        /* kernel maximum */
+
+#define AUPIPE_SERIES           60
+
+#define AUPIPE_LEAN_MAX         16              /* auids, see aupipe_lean */
+
+typedef struct {
+	unsigned int qlen;      /* highest sampled */
+	unsigned int qlimit;    /* highest sampled */
+	uint64_t drops;         /* during sample period */
+} aupipe_sample_t;
 
 typedef struct {
 	unsigned int qlen;
 	unsigned int qlimit;
-	unsigned int inserts;
-	unsigned int reads;
-	unsigned int drops;
+	uint64_t inserts;
+	uint64_t reads;
+	uint64_t drops;
 	/* truncates not implemented by OpenBSM */
+	unsigned int grows;
+	unsigned int shrinks;
+	unsigned int lean;      /* auids with lean preselection */
+	unsigned int period;    /* seconds per sample */
+	unsigned int samples;
+	aupipe_sample_t series[AUPIPE_SERIES]; /* oldest first */
 } aupipe_stat_t;
 
-FILE * aupipe_fopen(unsigned int) MALLOC;
-int aupipe_open(unsigned int);
+FILE * aupipe_fopen(unsigned int, unsigned int) MALLOC;
+int aupipe_open(unsigned int, unsigned int);
+int aupipe_lean(int, unsigned int, const uint32_t *, size_t) WUNRES;
+int aupipe_parse_auids(uint32_t *, size_t, const char *) NONNULL(1,3) WUNRES;
 void aupipe_stats(int, aupipe_stat_t *) NONNULL(2);
+void aupipe_tune_init(int, bool, unsigned int);
+void aupipe_tune(int);
+unsigned int aupipe_fill(int);
 
 #endif
@@ -0,0 +1,215 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "blake3.h"
+
+#include <string.h>
+#include <strings.h>
+
+/*
+ * Portable implementation of BLAKE3 following the reference implementation
+ * in the BLAKE3 specification.  The chunks are compressed one after the
+ * other; hashing runs on a digest thread of its own next to the other
+ * algorithms with hash_parallel.
+ */
+
+#define CHUNK_START     (1 << 0)
+#define CHUNK_END       (1 << 1)
+#define PARENT          (1 << 2)
+#define ROOT            (1 << 3)
+
+static const uint32_t iv[8] = {
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+	0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const uint8_t permutation[16] = {
+	2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8
+};
+
+#define ROTR(X,B)       (((X) >> (B)) | ((X) << (32 - (B))))
+
+#define G(A,B,C,D,X,Y)                                          \
+	do {                                                    \
+		s[A] = s[A] + s[B] + (X);                       \
+		s[D] = ROTR(s[D] ^ s[A], 16);                   \
+		s[C] = s[C] + s[D];                             \
+		s[B] = ROTR(s[B] ^ s[C], 12);                   \
+		s[A] = s[A] + s[B] + (Y);                       \
+		s[D] = ROTR(s[D] ^ s[A], 8);                    \
+		s[C] = s[C] + s[D];                             \
+		s[B] = ROTR(s[B] ^ s[C], 7);                    \
+	} while (0)
+
+static uint32_t
+blake3_load32(const unsigned char *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	       ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void
+blake3_store32(unsigned char *p, uint32_t w) {
+	p[0] = (unsigned char)w;
+	p[1] = (unsigned char)(w >> 8);
+	p[2] = (unsigned char)(w >> 16);
+	p[3] = (unsigned char)(w >> 24);
+}
+
+/*
+ * Compress block into out, the first 8 words of which are the chaining
+ * value and all 16 of which are the extended output.
+ */
+static void
+blake3_compress(uint32_t out[16], const uint32_t cv[8],
+                const unsigned char block[BLAKE3_BLOCKSZ], uint64_t counter,
+                uint32_t blocklen, uint32_t flags) {
+	uint32_t s[16], m[16], t[16];
+
+	for (int i = 0; i < 16; i++)
+		m[i] = blake3_load32(block + 4 * i);
+	memcpy(s, cv, 8 * sizeof(uint32_t));
+	memcpy(s + 8, iv, 4 * sizeof(uint32_t));
+	s[12] = (uint32_t)counter;
+	s[13] = (uint32_t)(counter >> 32);
+	s[14] = blocklen;
+	s[15] = flags;
+	for (int r = 0; r < 7; r++) {
+		G(0, 4,  8, 12, m[0],  m[1]);
+		G(1, 5,  9, 13, m[2],  m[3]);
+		G(2, 6, 10, 14, m[4],  m[5]);
+		G(3, 7, 11, 15, m[6],  m[7]);
+		G(0, 5, 10, 15, m[8],  m[9]);
+		G(1, 6, 11, 12, m[10], m[11]);
+		G(2, 7,  8, 13, m[12], m[13]);
+		G(3, 4,  9, 14, m[14], m[15]);
+		if (r == 6)
+			break;
+		for (int i = 0; i < 16; i++)
+			t[i] = m[permutation[i]];
+		memcpy(m, t, sizeof(m));
+	}
+	for (int i = 0; i < 8; i++) {
+		out[i] = s[i] ^ s[i + 8];
+		out[i + 8] = s[i + 8] ^ cv[i];
+	}
+}
+
+#undef G
+#undef ROTR
+
+static void
+blake3_parent(uint32_t cv[8], const uint32_t left[8], const uint32_t right[8],
+              uint32_t flags) {
+	unsigned char block[BLAKE3_BLOCKSZ];
+	uint32_t out[16];
+
+	for (int i = 0; i < 8; i++) {
+		blake3_store32(block + 4 * i, left[i]);
+		blake3_store32(block + 32 + 4 * i, right[i]);
+	}
+	blake3_compress(out, iv, block, 0, BLAKE3_BLOCKSZ, PARENT | flags);
+	memcpy(cv, out, 8 * sizeof(uint32_t));
+}
+
+static uint32_t
+blake3_chunk_start(blake3_ctx_t *ctx) {
+	return ctx->blocks == 0 ? CHUNK_START : 0;
+}
+
+/*
+ * Merge the chaining value of a completed chunk into the stack of subtree
+ * chaining values; every trailing zero bit of the number of chunks so far
+ * completes a subtree.
+ */
+static void
+blake3_push_chunk(blake3_ctx_t *ctx, uint32_t cv[8], uint64_t chunks) {
+	while ((chunks & 1) == 0) {
+		ctx->stacklen--;
+		blake3_parent(cv, ctx->stack[ctx->stacklen], cv, 0);
+		chunks >>= 1;
+	}
+	memcpy(ctx->stack[ctx->stacklen], cv, 8 * sizeof(uint32_t));
+	ctx->stacklen++;
+}
+
+void
+blake3_init(blake3_ctx_t *ctx) {
+	bzero(ctx, sizeof(blake3_ctx_t));
+	memcpy(ctx->cv, iv, sizeof(iv));
+}
+
+void
+blake3_update(blake3_ctx_t *ctx, const void *data, size_t size) {
+	const unsigned char *p = data;
+	uint32_t out[16];
+	size_t n;
+
+	while (size > 0) {
+		/* the current chunk is full and more input follows */
+		if (ctx->blocks == BLAKE3_CHUNKSZ / BLAKE3_BLOCKSZ - 1 &&
+		    ctx->blocklen == BLAKE3_BLOCKSZ) {
+			blake3_compress(out, ctx->cv, ctx->block, ctx->chunk,
+			                BLAKE3_BLOCKSZ, CHUNK_END);
+			ctx->chunk++;
+			blake3_push_chunk(ctx, out, ctx->chunk);
+			memcpy(ctx->cv, iv, sizeof(iv));
+			ctx->blocks = 0;
+			ctx->blocklen = 0;
+		}
+		/* the current block is full and more input follows */
+		if (ctx->blocklen == BLAKE3_BLOCKSZ) {
+			blake3_compress(out, ctx->cv, ctx->block, ctx->chunk,
+			                BLAKE3_BLOCKSZ,
+			                blake3_chunk_start(ctx));
+			memcpy(ctx->cv, out, 8 * sizeof(uint32_t));
+			ctx->blocks++;
+			ctx->blocklen = 0;
+		}
+		n = BLAKE3_BLOCKSZ - ctx->blocklen;
+		if (n > size)
+			n = size;
+		memcpy(ctx->block + ctx->blocklen, p, n);
+		ctx->blocklen += (uint8_t)n;
+		p += n;
+		size -= n;
+	}
+}
+
+void
+blake3_final(unsigned char *md, blake3_ctx_t *ctx) {
+	unsigned char block[BLAKE3_BLOCKSZ];
+	uint32_t out[16], cv[8];
+	uint32_t flags;
+	uint64_t counter;
+
+	/* output node of the last chunk */
+	memcpy(cv, ctx->cv, sizeof(cv));
+	memcpy(block, ctx->block, ctx->blocklen);
+	bzero(block + ctx->blocklen, BLAKE3_BLOCKSZ - ctx->blocklen);
+	flags = blake3_chunk_start(ctx) | CHUNK_END;
+	counter = ctx->chunk;
+	if (ctx->stacklen > 0) {
+		blake3_compress(out, cv, block, counter, ctx->blocklen, flags);
+		/* fold the right edge of the tree into parent output nodes */
+		for (size_t i = ctx->stacklen - 1; i > 0; i--)
+			blake3_parent(out, ctx->stack[i], out, 0);
+		for (int i = 0; i < 8; i++) {
+			blake3_store32(block + 4 * i, ctx->stack[0][i]);
+			blake3_store32(block + 32 + 4 * i, out[i]);
+		}
+		memcpy(cv, iv, sizeof(iv));
+		flags = PARENT;
+		counter = 0;
+		ctx->blocklen = BLAKE3_BLOCKSZ;
+	}
+	blake3_compress(out, cv, block, counter, ctx->blocklen, flags | ROOT);
+	for (int i = 0; i < 8; i++)
+		blake3_store32(md + 4 * i, out[i]);
+}
@@ -0,0 +1,43 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+#include "attrib.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLAKE3SZ                32
+#define BLAKE3_BLOCKSZ          64
+#define BLAKE3_CHUNKSZ          1024
+#define BLAKE3_STACK_MAX        54      /* 2^64 bytes in 2^10 byte chunks */
+
+/*
+ * Incremental BLAKE3 in default hash mode with 32 bytes of output, with the
+ * same calling convention as the CommonCrypto digests.
+ */
+typedef struct {
+	uint32_t cv[8];                 /* of the current chunk */
+	uint64_t chunk;                 /* counter of the current chunk */
+	unsigned char block[BLAKE3_BLOCKSZ];
+	uint8_t blocklen;
+	uint8_t blocks;                 /* compressed in current chunk */
+	uint8_t stacklen;
+	uint32_t stack[BLAKE3_STACK_MAX][8]; /* subtree chaining values */
+} blake3_ctx_t;
+
+void blake3_init(blake3_ctx_t *) NONNULL(1);
+void blake3_update(blake3_ctx_t *, const void *, size_t) NONNULL(1);
+void blake3_final(unsigned char *, blake3_ctx_t *) NONNULL(1,2);
+
+#endif
+
@@ -0,0 +1,171 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "cachebuild.h"
+
+#include "tommyhash.h"
+
+#include <sys/param.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <pthread.h>
+
+/*
+ * Cache of build output trees known to contain unsigned executables.  A
+ * build output tree is the part of a path up to and including the first
+ * directory whose name is listed in codesign_build_dirs, such as DerivedData
+ * or build.  Freshly built binaries have new inodes and new contents, so
+ * they miss all other caches; once full verification found one binary in
+ * a tree to be unsigned, later binaries in the same tree are only checked
+ * for the presence of a signature, see codesign_present().  Objects are
+ * keyed by a hash of the root directory, which is compared in full on hits.
+ */
+
+typedef struct {
+	uint64_t hash;                  /* key */
+	char *root;                     /* free */
+	size_t len;
+	lrucache_node_t node;
+} cachebuild_obj_t;
+
+static void
+cachebuild_obj_free(void *vobj) {
+	cachebuild_obj_t *obj = vobj;
+
+	assert(obj);
+	free(obj->root);
+	free(obj);
+}
+
+static lrucache_t lrucache;
+static pthread_mutex_t mutex;
+static bool enabled = false;
+
+/*
+ * The cache starts out with `buckets' buckets and uses the replacement policy
+ * given by LRUCACHE_FLAG_* `policy'.  A size of 0 disables the cache.
+ */
+void
+cachebuild_init(size_t buckets, int policy) {
+	if (buckets == 0)
+		return;
+	pthread_mutex_init(&mutex, NULL);
+	lrucache_init(&lrucache, buckets, sizeof(cachebuild_obj_t),
+	              sizeof(uint64_t), sizeof(uint64_t), 0, policy,
+	              lrucache_hash_digest, cachebuild_obj_free);
+	enabled = true;
+}
+
+void
+cachebuild_fini(void) {
+	if (!enabled)
+		return;
+	lrucache_destroy(&lrucache);
+	pthread_mutex_destroy(&mutex);
+	enabled = false;
+}
+
+/*
+ * Drop all cached entries, for shedding memory.  Thread-safe.
+ */
+void
+cachebuild_flush(void) {
+	if (!enabled)
+		return;
+	pthread_mutex_lock(&mutex);
+	lrucache_flush(&lrucache);
+	pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * Return the length of the root of the build output tree containing the
+ * absolute path, including the trailing slash, or 0 if path is not within a
+ * directory named in dirs.  The last path component, the file itself, is
+ * never considered.
+ */
+size_t
+cachebuild_root(setstr_t *dirs, const char *path) {
+	char name[MAXPATHLEN];
+	const char *p, *q;
+	size_t len;
+
+	if (setstr_size(dirs) == 0 || path[0] != '/')
+		return 0;
+	for (p = path + 1; (q = strchr(p, '/')); p = q + 1) {
+		len = (size_t)(q - p);
+		if (len == 0 || len >= sizeof(name))
+			continue;
+		memcpy(name, p, len);
+		name[len] = '\0';
+		if (setstr_contains(dirs, name))
+			return (size_t)(q - path) + 1;
+	}
+	return 0;
+}
+
+/*
+ * Return true if the tree at the first `len' bytes of root is known to
+ * contain unsigned executables.  Thread-safe.
+ */
+bool
+cachebuild_get(const char *root, size_t len) {
+	cachebuild_obj_t *obj;
+	uint64_t hash;
+	bool hit;
+
+	if (!enabled)
+		return false;
+	hash = tommy_hash_u64(0, root, len);
+	pthread_mutex_lock(&mutex);
+	obj = lrucache_get(&lrucache, &hash);
+	hit = obj && obj->len == len && !memcmp(obj->root, root, len);
+	pthread_mutex_unlock(&mutex);
+	return hit;
+}
+
+/*
+ * Record that the tree at the first `len' bytes of root contains unsigned
+ * executables.  Thread-safe.
+ */
+void
+cachebuild_put(const char *root, size_t len) {
+	cachebuild_obj_t *obj;
+
+	if (!enabled)
+		return;
+	obj = malloc(sizeof(cachebuild_obj_t));
+	if (!obj)
+		return;
+	bzero(obj, sizeof(cachebuild_obj_t));
+	obj->root = strndup(root, len);
+	if (!obj->root) {
+		free(obj);
+		return;
+	}
+	obj->len = len;
+	obj->hash = tommy_hash_u64(0, root, len);
+	pthread_mutex_lock(&mutex);
+	lrucache_put(&lrucache, &obj->node, obj);
+	pthread_mutex_unlock(&mutex);
+}
+
+void
+cachebuild_stats(lrucache_stat_t *st) {
+	if (!enabled) {
+		bzero(st, sizeof(lrucache_stat_t));
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	lrucache_stats(&lrucache, st);
+	pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,32 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef CACHEBUILD_H
+#define CACHEBUILD_H
+
+#include "lrucache.h"
+#include "setstr.h"
+#include "attrib.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define CACHEBUILD_BUCKETS      256     /* default initial size */
+
+void cachebuild_init(size_t, int);
+void cachebuild_fini(void);
+void cachebuild_flush(void);
+size_t cachebuild_root(setstr_t *, const char *) NONNULL(1,2) WUNRES;
+bool cachebuild_get(const char *, size_t) NONNULL(1) WUNRES;
+void cachebuild_put(const char *, size_t) NONNULL(1);
+void cachebuild_stats(lrucache_stat_t *) NONNULL(1);
+
+#endif
+
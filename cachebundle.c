@@ -0,0 +1,216 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "cachebundle.h"
+
+#include "intern.h"
+#include "sys.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <stdio.h>
+#include <assert.h>
+#include <pthread.h>
+
+/*
+ * Cache of the origin of code signatures within app bundles, keyed by the
+ * CodeResources file of the outermost bundle the image resides in and the
+ * digest of the certificate chain of the image's signature.  Multi-binary
+ * apps such as browsers and Electron apps ship many helper executables in
+ * nested bundles inside one app, all signed with the same certificates.
+ * codesign_new still fully verifies the signature of every image against
+ * its designated requirement, but for images whose signature carries the
+ * same certificate chain as an image already evaluated in the same bundle,
+ * it skips matching the signature against the origin requirements and
+ * extracting the certificate CN.  Both only depend on the chain.
+ *
+ * Replacing, updating or re-signing the bundle replaces or modifies the
+ * CodeResources file, so that entries of stale bundles are never hit and
+ * age out of the cache.  Nothing is saved to disk.
+ */
+
+#define CACHEBUNDLE_OBJSZ       (sizeof(cachebundle_obj_t) + 64)
+
+typedef struct {
+	cachebundle_key_t key;
+	int origin;
+	char *certcn;                   /* interned, may be NULL */
+
+	lrucache_node_t node;
+} cachebundle_obj_t;
+
+static void
+cachebundle_obj_free(void *vobj) {
+	cachebundle_obj_t *obj = vobj;
+
+	assert(obj);
+	if (obj->certcn)
+		intern_free(obj->certcn);
+	free(obj);
+}
+
+static lrucache_t lrucache;
+static pthread_mutex_t mutex;
+static bool enabled = false;
+
+/*
+ * The cache starts out with `buckets' buckets and uses the replacement policy
+ * given by LRUCACHE_FLAG_* `policy'.  A size of 0 disables the cache.
+ */
+void
+cachebundle_init(size_t buckets, int policy) {
+	if (buckets == 0)
+		return;
+	pthread_mutex_init(&mutex, NULL);
+	lrucache_init(&lrucache, buckets, CACHEBUNDLE_OBJSZ,
+	              sizeof(dev_t) + sizeof(ino_t),
+	              sizeof(cachebundle_key_t), sizeof(cachebundle_key_t),
+	              policy|LRUCACHE_FLAG_DEFER, lrucache_hash_mix,
+	              cachebundle_obj_free);
+	enabled = true;
+}
+
+void
+cachebundle_fini(void) {
+	if (!enabled)
+		return;
+	lrucache_destroy(&lrucache);
+	pthread_mutex_destroy(&mutex);
+	enabled = false;
+}
+
+/*
+ * Drop all cached entries, for shedding memory.  Thread-safe.
+ */
+void
+cachebundle_flush(void) {
+	if (!enabled)
+		return;
+	pthread_mutex_lock(&mutex);
+	lrucache_flush(&lrucache);
+	pthread_mutex_unlock(&mutex);
+}
+
+static bool
+cachebundle_obj_on_dev(void *vobj, void *arg) {
+	return ((cachebundle_obj_t *)vobj)->key.dev == *(dev_t *)arg;
+}
+
+/*
+ * Drop all cached entries for bundles on device `dev', such as after it was
+ * unmounted.  Returns the number of dropped entries.  Thread-safe.
+ */
+size_t
+cachebundle_purge_dev(dev_t dev) {
+	tommy_node *garbage;
+	size_t n;
+
+	if (!enabled)
+		return 0;
+	pthread_mutex_lock(&mutex);
+	n = lrucache_purge(&lrucache, cachebundle_obj_on_dev, &dev);
+	garbage = lrucache_garbage(&lrucache);
+	pthread_mutex_unlock(&mutex);
+	lrucache_reclaim(&lrucache, garbage);
+	return n;
+}
+
+bool
+cachebundle_enabled(void) {
+	return enabled;
+}
+
+/*
+ * Fill in the bundle part of key for the image at path, leaving the chain
+ * digest to the caller.  Returns -1 if path is not within an app bundle or
+ * the bundle has no CodeResources.
+ */
+int
+cachebundle_key(cachebundle_key_t *key, const char *path) {
+	char crpath[PATH_MAX];
+	stat_attr_t st;
+	const char *p;
+
+	p = strstr(path, ".app/");
+	if (!p)
+		return -1;
+	if (snprintf(crpath, sizeof(crpath),
+	             "%.*s/Contents/_CodeSignature/CodeResources",
+	             (int)(p + 4 - path), path) >= (int)sizeof(crpath))
+		return -1;
+	if (sys_pathattr(&st, crpath) == -1)
+		return -1;
+	bzero(key, sizeof(cachebundle_key_t));
+	key->ino = st.ino;
+	key->dev = st.dev;
+	key->mtime_sec = st.mtime.tv_sec;
+	key->mtime_nsec = st.mtime.tv_nsec;
+	key->ctime_sec = st.ctime.tv_sec;
+	key->ctime_nsec = st.ctime.tv_nsec;
+	return 0;
+}
+
+/*
+ * Returns true and fills in the origin and a new reference to the interned
+ * certificate CN, or NULL, on hits.
+ */
+bool
+cachebundle_get(cachebundle_key_t *key, int *origin, char **certcn) {
+	cachebundle_obj_t *obj;
+
+	if (!enabled)
+		return false;
+	pthread_mutex_lock(&mutex);
+	obj = lrucache_get(&lrucache, key);
+	if (!obj) {
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+	*origin = obj->origin;
+	*certcn = obj->certcn ? intern_ref(obj->certcn) : NULL;
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+void
+cachebundle_put(cachebundle_key_t *key, int origin, char *certcn) {
+	cachebundle_obj_t *obj;
+	tommy_node *garbage;
+
+	if (!enabled)
+		return;
+	obj = malloc(sizeof(cachebundle_obj_t));
+	if (!obj)
+		return;
+	bzero(obj, sizeof(cachebundle_obj_t));
+	memcpy(&obj->key, key, sizeof(cachebundle_key_t));
+	obj->origin = origin;
+	if (certcn)
+		obj->certcn = intern_ref(certcn);
+	pthread_mutex_lock(&mutex);
+	lrucache_put(&lrucache, &obj->node, obj);
+	garbage = lrucache_garbage(&lrucache);
+	pthread_mutex_unlock(&mutex);
+	lrucache_reclaim(&lrucache, garbage);
+}
+
+void
+cachebundle_stats(lrucache_stat_t *st) {
+	if (!enabled) {
+		bzero(st, sizeof(lrucache_stat_t));
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	lrucache_stats(&lrucache, st);
+	pthread_mutex_unlock(&mutex);
+}
+
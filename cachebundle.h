@@ -0,0 +1,45 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef CACHEBUNDLE_H
+#define CACHEBUNDLE_H
+
+#include "lrucache.h"
+#include "hashes.h"
+#include "attrib.h"
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+#define CACHEBUNDLE_BUCKETS     1024    /* default initial size */
+
+typedef struct __attribute__((packed)) {
+	ino_t ino;                      /* of CodeResources */
+	dev_t dev;
+	time_t mtime_sec;
+	long   mtime_nsec;
+	time_t ctime_sec;
+	long   ctime_nsec;
+	unsigned char chain[SHA256SZ];  /* certificate chain digest */
+} cachebundle_key_t;
+
+void cachebundle_init(size_t, int);
+void cachebundle_fini(void);
+void cachebundle_flush(void);
+size_t cachebundle_purge_dev(dev_t);
+bool cachebundle_enabled(void);
+int cachebundle_key(cachebundle_key_t *, const char *) NONNULL(1,2) WUNRES;
+bool cachebundle_get(cachebundle_key_t *, int *, char **)
+     NONNULL(1,2,3) WUNRES;
+void cachebundle_put(cachebundle_key_t *, int, char *) NONNULL(1);
+void cachebundle_stats(lrucache_stat_t *) NONNULL(1);
+
+#endif
+
@@ -0,0 +1,175 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "cachecdhash.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <pthread.h>
+
+/*
+ * Second tier behind the hashes cache, keyed by the cdhash the kernel
+ * reports for a running process instead of by inode, mapping to the file
+ * hashes and the codesign result of the first image seen with that cdhash.
+ * A copy of a known signed binary, such as after an app update, then needs
+ * neither hashing nor code signature verification, even though it has a
+ * new inode.
+ *
+ * The cdhash covers the code and the signed metadata of the executing
+ * architecture, but not the signature's CMS blob nor the other slices of a
+ * universal binary.  To keep the file hashes honest for the common case,
+ * objects also need to match in file size, and only objects with a good
+ * signature over the same cdhash are ever put.  Nothing is saved to disk;
+ * the hashes cache covers restarts.
+ */
+
+#define CACHECDHASH_OBJSZ       (sizeof(cachecdhash_obj_t) + \
+                                 sizeof(codesign_t) + 128)
+
+typedef struct __attribute__((packed)) {
+	unsigned char cdhash[CDHASHSZ];
+	uint64_t size;                  /* must match, see above */
+} cachecdhash_key_t;
+
+typedef struct {
+	cachecdhash_key_t key;
+	hashes_t hashes;
+	codesign_t *codesign;
+
+	lrucache_node_t node;
+} cachecdhash_obj_t;
+
+static void
+cachecdhash_obj_free(void *vobj) {
+	cachecdhash_obj_t *obj = vobj;
+
+	assert(obj);
+	if (obj->codesign)
+		codesign_free(obj->codesign);
+	free(obj);
+}
+
+static lrucache_t lrucache;
+static pthread_mutex_t mutex;
+static bool enabled = false;
+
+/*
+ * The cache starts out with `buckets' buckets and uses the replacement policy
+ * given by LRUCACHE_FLAG_* `policy'.  A size of 0 disables the cache.
+ */
+void
+cachecdhash_init(size_t buckets, int policy) {
+	if (buckets == 0)
+		return;
+	pthread_mutex_init(&mutex, NULL);
+	lrucache_init(&lrucache, buckets, CACHECDHASH_OBJSZ,
+	              CDHASHSZ, CDHASHSZ, sizeof(cachecdhash_key_t),
+	              policy|LRUCACHE_FLAG_DEFER, lrucache_hash_digest, cachecdhash_obj_free);
+	enabled = true;
+}
+
+void
+cachecdhash_fini(void) {
+	if (!enabled)
+		return;
+	lrucache_destroy(&lrucache);
+	pthread_mutex_destroy(&mutex);
+	enabled = false;
+}
+
+/*
+ * Drop all cached entries, for shedding memory.  Thread-safe.
+ */
+void
+cachecdhash_flush(void) {
+	if (!enabled)
+		return;
+	pthread_mutex_lock(&mutex);
+	lrucache_flush(&lrucache);
+	pthread_mutex_unlock(&mutex);
+}
+
+bool
+cachecdhash_enabled(void) {
+	return enabled;
+}
+
+/*
+ * Returns true and fills in hashes and a reference to the codesign result
+ * in *codesign on hits.
+ */
+bool
+cachecdhash_get(const unsigned char *cdhash, off_t size, hashes_t *hashes,
+                codesign_t **codesign) {
+	cachecdhash_obj_t *obj;
+	cachecdhash_key_t key;
+	tommy_node *garbage;
+
+	assert(cdhash && hashes && codesign);
+
+	if (!enabled)
+		return false;
+	memcpy(key.cdhash, cdhash, CDHASHSZ);
+	key.size = (uint64_t)size;
+	pthread_mutex_lock(&mutex);
+	obj = lrucache_get(&lrucache, &key);
+	if (!obj) {
+		garbage = lrucache_garbage(&lrucache);
+		pthread_mutex_unlock(&mutex);
+		lrucache_reclaim(&lrucache, garbage);
+		return false;
+	}
+	*codesign = codesign_ref(obj->codesign);
+	memcpy(hashes, &obj->hashes, sizeof(hashes_t));
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+void
+cachecdhash_put(const unsigned char *cdhash, off_t size, hashes_t *hashes,
+                codesign_t *codesign) {
+	cachecdhash_obj_t *obj;
+	tommy_node *garbage;
+
+	assert(cdhash && hashes && codesign);
+
+	if (!enabled || !codesign_is_good(codesign) ||
+	    codesign->cdhashsz != CDHASHSZ ||
+	    memcmp(codesign->cdhash, cdhash, CDHASHSZ))
+		return;
+	obj = malloc(sizeof(cachecdhash_obj_t));
+	if (!obj)
+		return;
+	bzero(obj, sizeof(cachecdhash_obj_t));
+	memcpy(obj->key.cdhash, cdhash, CDHASHSZ);
+	obj->key.size = (uint64_t)size;
+	memcpy(&obj->hashes, hashes, sizeof(hashes_t));
+	obj->codesign = codesign_ref(codesign);
+	pthread_mutex_lock(&mutex);
+	lrucache_put(&lrucache, &obj->node, obj);
+	garbage = lrucache_garbage(&lrucache);
+	pthread_mutex_unlock(&mutex);
+	lrucache_reclaim(&lrucache, garbage);
+}
+
+void
+cachecdhash_stats(lrucache_stat_t *st) {
+	if (!enabled) {
+		bzero(st, sizeof(lrucache_stat_t));
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	lrucache_stats(&lrucache, st);
+	pthread_mutex_unlock(&mutex);
+}
+
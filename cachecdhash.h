@@ -0,0 +1,35 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef CACHECDHASH_H
+#define CACHECDHASH_H
+
+#include "lrucache.h"
+#include "hashes.h"
+#include "codesign.h"
+#include "attrib.h"
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+#define CDHASHSZ                20
+
+void cachecdhash_init(size_t, int);
+void cachecdhash_fini(void);
+void cachecdhash_flush(void);
+bool cachecdhash_enabled(void);
+bool cachecdhash_get(const unsigned char *, off_t, hashes_t *,
+                     codesign_t **) NONNULL(1,3,4) WUNRES;
+void cachecdhash_put(const unsigned char *, off_t, hashes_t *,
+                     codesign_t *) NONNULL(1,3,4);
+void cachecdhash_stats(lrucache_stat_t *) NONNULL(1);
+
+#endif
+
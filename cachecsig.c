@@ -10,18 +10,42 @@
 
 #include "cachecsig.h"
 
+#include "cachefile.h"
+#include "intern.h"
+#include "time.h"
+
 #include <string.h>
 #include <assert.h>
 #include <pthread.h>
-#ifdef DEBUG_CACHE
+#include <limits.h>
 #include <stdio.h>
+#ifdef DEBUG_CACHE
+#include <errno.h>
 #endif
 
-#define CACHECSIG_BUCKETS       LRUCACHE_BUCKETS
+#define CACHECSIG_MAGIC         "xncsigs\0"
+
+/*
+ * Estimated size of a cached object including its codesign_t and the strings
+ * it references, for memory accounting.
+ */
+#define CACHECSIG_OBJSZ         (sizeof(cachecsig_obj_t) + \
+                                 sizeof(codesign_t) + 128)
+
+/*
+ * Verification errors can be transient, so CODESIGN_RESULT_ERROR results are
+ * only cached for a short time as negative entries, and never saved.  This
+ * avoids re-verifying broken binaries on every exec without pinning errors
+ * forever.
+ */
+#define CACHECSIG_NEGATIVE_TTL  60 /* seconds */
 
 typedef struct {
 	hashes_t hashes;
 	codesign_t *codesign;
+	struct timespec expiry;         /* monotonic, negative entries only */
+	char *path;                     /* last put for, NULL if loaded */
+	time_t validated;               /* monotonic sec of last evaluation */
 
 	lrucache_node_t node;
 } cachecsig_obj_t;
@@ -43,25 +67,216 @@ cachecsig_obj_free(void *vobj) {
 	assert(obj);
 	if (obj->codesign)
 		codesign_free(obj->codesign);
+	if (obj->path)
+		free(obj->path);
 	free(obj);
 }
 
 static lrucache_t lrucache;
 static pthread_mutex_t mutex;
+static char cachepath[PATH_MAX];
+static int cachehflags;
+
+/*
+ * Cache file records are variable-length:  hashes, result and origin,
+ * followed by cdhash, ident, teamid and certcn, each as a 32 bit length
+ * plus one, or zero for NULL, followed by the bytes without terminator.
+ */
+
+static int
+cachecsig_load_blob(unsigned char **dst, size_t *dstsz,
+                    const unsigned char **p, const unsigned char *end) {
+	uint32_t len;
+
+	if (cachefile_read(&len, sizeof(len), p, end) == -1)
+		return -1;
+	if (len == 0)
+		return 0;
+	len--;
+	*dst = malloc(len);
+	if (!*dst)
+		return -1;
+	if (cachefile_read(*dst, len, p, end) == -1)
+		return -1;
+	*dstsz = len;
+	return 0;
+}
+
+/*
+ * Like cachecsig_load_blob, but for strings, which are interned.
+ */
+static int
+cachecsig_load_str(char **dst,
+                   const unsigned char **p, const unsigned char *end) {
+	uint32_t len;
+
+	if (cachefile_read(&len, sizeof(len), p, end) == -1)
+		return -1;
+	if (len == 0)
+		return 0;
+	len--;
+	if ((size_t)(end - *p) < len)
+		return -1;
+	if (memchr(*p, '\0', len))
+		return -1;
+	*dst = intern_strn((const char *)*p, len);
+	if (!*dst)
+		return -1;
+	*p += len;
+	return 0;
+}
+
+static int
+cachecsig_load(const unsigned char *p, size_t sz, uint64_t count,
+               UNUSED void *arg) {
+	const unsigned char *end = p + sz;
+	cachecsig_obj_t *obj;
+	codesign_t *cs;
+	int32_t i32;
 
+	for (uint64_t i = 0; i < count; i++) {
+		obj = cachecsig_obj_new();
+		if (!obj)
+			return -1;
+		cs = codesign_alloc();
+		if (!cs) {
+			cachecsig_obj_free(obj);
+			return -1;
+		}
+		obj->codesign = cs;
+		if (cachefile_read(&obj->hashes, sizeof(hashes_t),
+		                   &p, end) == -1)
+			goto errout;
+		if (cachefile_read(&i32, sizeof(i32), &p, end) == -1)
+			goto errout;
+		cs->result = i32;
+		if (cachefile_read(&i32, sizeof(i32), &p, end) == -1)
+			goto errout;
+		cs->origin = i32;
+		if (cachecsig_load_blob(&cs->cdhash, &cs->cdhashsz,
+		                        &p, end) == -1 ||
+		    cachecsig_load_str(&cs->ident, &p, end) == -1 ||
+		    cachecsig_load_str(&cs->teamid, &p, end) == -1 ||
+		    cachecsig_load_str(&cs->certcn, &p, end) == -1)
+			goto errout;
+		/* negative entries are not persistent */
+		if (cs->result == CODESIGN_RESULT_ERROR) {
+			cachecsig_obj_free(obj);
+			continue;
+		}
+		lrucache_put(&lrucache, &obj->node, obj);
+		lrucache_reclaim(&lrucache, lrucache_garbage(&lrucache));
+	}
+	return 0;
+errout:
+	cachecsig_obj_free(obj);
+	return -1;
+}
+
+static void
+cachecsig_save_blob(cachefile_t *cf, const void *buf, size_t sz) {
+	uint32_t len;
+
+	if (!buf || sz >= UINT32_MAX) {
+		len = 0;
+		cachefile_write(cf, &len, sizeof(len));
+		return;
+	}
+	len = (uint32_t)sz + 1;
+	cachefile_write(cf, &len, sizeof(len));
+	if (sz > 0)
+		cachefile_write(cf, buf, sz);
+}
+
+static void
+cachecsig_save_obj(void *vobj, void *arg) {
+	cachecsig_obj_t *obj = vobj;
+	cachefile_t *cf = arg;
+	codesign_t *cs = obj->codesign;
+	int32_t i32;
+
+	if (!cs || obj->expiry.tv_sec != 0)
+		return;
+	cachefile_write(cf, &obj->hashes, sizeof(hashes_t));
+	i32 = cs->result;
+	cachefile_write(cf, &i32, sizeof(i32));
+	i32 = cs->origin;
+	cachefile_write(cf, &i32, sizeof(i32));
+	cachecsig_save_blob(cf, cs->cdhash, cs->cdhashsz);
+	cachecsig_save_blob(cf, cs->ident,
+	                    cs->ident ? strlen(cs->ident) : 0);
+	cachecsig_save_blob(cf, cs->teamid,
+	                    cs->teamid ? strlen(cs->teamid) : 0);
+	cachecsig_save_blob(cf, cs->certcn,
+	                    cs->certcn ? strlen(cs->certcn) : 0);
+	cachefile_record(cf);
+}
+
+/*
+ * If `path' is not NULL, the cache is populated from the cache file at
+ * `path' if one exists that was written with the same `hflags', and
+ * cachecsig_save will write the cache to `path'.  The cache starts out with
+ * `buckets' buckets and uses the replacement policy given by LRUCACHE_FLAG_*
+ * `policy'.
+ */
 void
-cachecsig_init(void) {
+cachecsig_init(const char *path, int hflags, size_t buckets, int policy) {
 	pthread_mutex_init(&mutex, NULL);
 	/* we could use only MD5SZ if we were sure that MD5 is present */
-	lrucache_init(&lrucache, CACHECSIG_BUCKETS,
+	lrucache_init(&lrucache, buckets, CACHECSIG_OBJSZ,
 	              sizeof(hashes_t), sizeof(hashes_t), 0,
-	              cachecsig_obj_free);
+	              policy|LRUCACHE_FLAG_DEFER,
+	              lrucache_hash_digest, cachecsig_obj_free);
+	cachepath[0] = '\0';
+	cachehflags = hflags;
+	if (!path || snprintf(cachepath, sizeof(cachepath), "%s", path) >=
+	             (int)sizeof(cachepath)) {
+		cachepath[0] = '\0';
+		return;
+	}
+	if (cachefile_load(cachepath, CACHECSIG_MAGIC, cachehflags, 0,
+	                   cachecsig_load, NULL) == -1) {
+#ifdef DEBUG_CACHE
+		fprintf(stderr, "DEBUG_CACHE: codesig load %s failed: "
+		                "%s (%i)\n",
+		                cachepath, strerror(errno), errno);
+#endif
+	}
+}
+
+/*
+ * Write the cache to the cache file, if one was configured.
+ */
+int
+cachecsig_save(void) {
+	cachefile_t cf;
+
+	if (!cachepath[0])
+		return 0;
+	if (cachefile_save_begin(&cf, cachepath, CACHECSIG_MAGIC, cachehflags,
+	                         0) == -1)
+		return -1;
+	pthread_mutex_lock(&mutex);
+	lrucache_foreach(&lrucache, cachecsig_save_obj, &cf);
+	pthread_mutex_unlock(&mutex);
+	return cachefile_save_end(&cf);
+}
+
+/*
+ * Drop all cached code signatures, for shedding memory.  Thread-safe.
+ */
+void
+cachecsig_flush(void) {
+	pthread_mutex_lock(&mutex);
+	lrucache_flush(&lrucache);
+	pthread_mutex_unlock(&mutex);
 }
 
 void
 cachecsig_fini(void) {
 	lrucache_destroy(&lrucache);
 	pthread_mutex_destroy(&mutex);
+	cachepath[0] = '\0';
 }
 
 /*
@@ -71,6 +286,8 @@ codesign_t *
 cachecsig_get(hashes_t *hashes) {
 	cachecsig_obj_t *obj;
 	codesign_t *cs;
+	tommy_node *garbage;
+	struct timespec now;
 
 	assert(hashes);
 
@@ -80,18 +297,31 @@ cachecsig_get(hashes_t *hashes) {
 	fprintf(stderr, "DEBUG_CACHE: codesig get %s\n",
 	                obj ? "HIT" : "MISS");
 #endif
+	if (obj && obj->expiry.tv_sec != 0 &&
+	    (timespec_monotime(&now) == -1 ||
+	     timespec_greater(&now, &obj->expiry))) {
+		lrucache_invalidate(&lrucache, &obj->node);
+		obj = NULL;
+	}
 	if (!obj) {
+		garbage = lrucache_garbage(&lrucache);
 		pthread_mutex_unlock(&mutex);
+		lrucache_reclaim(&lrucache, garbage);
 		return NULL;
 	}
-	cs = codesign_dup(obj->codesign);
+	cs = codesign_ref(obj->codesign);
 	pthread_mutex_unlock(&mutex);
 	return cs;
 }
 
+/*
+ * The path is recorded for revalidation by csrefresh and may be NULL.
+ */
 void
-cachecsig_put(hashes_t *hashes, codesign_t *codesign) {
+cachecsig_put(hashes_t *hashes, codesign_t *codesign, const char *path) {
+	struct timespec now;
 	cachecsig_obj_t *obj;
+	tommy_node *garbage;
 
 	assert(hashes);
 	assert(codesign);
@@ -103,11 +333,111 @@ cachecsig_put(hashes_t *hashes, codesign_t *codesign) {
 	obj = cachecsig_obj_new();
 	if (!obj)
 		return;
+	if (codesign->result == CODESIGN_RESULT_ERROR) {
+		if (timespec_monotime(&obj->expiry) == -1) {
+			cachecsig_obj_free(obj);
+			return;
+		}
+		obj->expiry.tv_sec += CACHECSIG_NEGATIVE_TTL;
+	}
 	memcpy(&obj->hashes, hashes, sizeof(hashes_t));
-	obj->codesign = codesign_dup(codesign);
+	obj->codesign = codesign_ref(codesign);
+	if (path)
+		obj->path = strdup(path);
+	if (timespec_monotime(&now) == 0)
+		obj->validated = now.tv_sec;
 	pthread_mutex_lock(&mutex);
 	lrucache_put(&lrucache, &obj->node, obj);
+	garbage = lrucache_garbage(&lrucache);
+	pthread_mutex_unlock(&mutex);
+	lrucache_reclaim(&lrucache, garbage);
+}
+
+typedef struct {
+	cachecsig_ref_t *refs;
+	size_t size;
+	size_t count;
+	time_t before;
+} cachecsig_hot_ctx_t;
+
+static bool
+cachecsig_hot_obj(void *vobj, void *arg) {
+	cachecsig_obj_t *obj = vobj;
+	cachecsig_hot_ctx_t *ctx = arg;
+	cachecsig_ref_t *ref;
+
+	if (!obj->path || obj->expiry.tv_sec != 0 ||
+	    obj->validated >= ctx->before)
+		return true;
+	ref = &ctx->refs[ctx->count];
+	ref->path = strdup(obj->path);
+	ref->codesign = codesign_ref(obj->codesign);
+	if (!ref->path) {
+		cachecsig_ref_free(ref);
+		return false;
+	}
+	memcpy(&ref->hashes, &obj->hashes, sizeof(hashes_t));
+	return ++ctx->count < ctx->size;
+}
+
+/*
+ * Fill in copies of up to n of the most recently used entries that were last
+ * evaluated before monotonic time `before', have a path and are not negative
+ * entries, for revalidation.  Returns the number of refs filled in, which
+ * the caller must free using cachecsig_ref_free.
+ */
+size_t
+cachecsig_hot(cachecsig_ref_t *refs, size_t n, time_t before) {
+	cachecsig_hot_ctx_t ctx;
+
+	if (n == 0)
+		return 0;
+	ctx.refs = refs;
+	ctx.size = n;
+	ctx.count = 0;
+	ctx.before = before;
+	pthread_mutex_lock(&mutex);
+	lrucache_visit_mru(&lrucache, cachecsig_hot_obj, &ctx);
+	pthread_mutex_unlock(&mutex);
+	return ctx.count;
+}
+
+void
+cachecsig_ref_free(cachecsig_ref_t *ref) {
+	if (ref->path)
+		free(ref->path);
+	if (ref->codesign)
+		codesign_free(ref->codesign);
+	bzero(ref, sizeof(cachecsig_ref_t));
+}
+
+/*
+ * Record that the entry for hashes was evaluated again, replacing its result
+ * with codesign unless that is NULL.  Does not affect recency.
+ */
+void
+cachecsig_revalidated(hashes_t *hashes, codesign_t *codesign) {
+	struct timespec now;
+	cachecsig_obj_t *obj;
+	codesign_t *cs = NULL, *prev;
+
+	if (codesign)
+		cs = codesign_ref(codesign);
+	pthread_mutex_lock(&mutex);
+	obj = lrucache_peek(&lrucache, hashes);
+	if (obj && obj->expiry.tv_sec == 0) {
+		if (cs) {
+			/* free the previous signature outside the lock */
+			prev = obj->codesign;
+			obj->codesign = cs;
+			cs = prev;
+		}
+		if (timespec_monotime(&now) == 0)
+			obj->validated = now.tv_sec;
+	}
 	pthread_mutex_unlock(&mutex);
+	if (cs)
+		codesign_free(cs);
 }
 
 void
@@ -16,10 +16,25 @@
 #include "codesign.h"
 #include "attrib.h"
 
-void cachecsig_init(void);
+#include <sys/types.h>
+
+#define CACHECSIG_BUCKETS       LRUCACHE_BUCKETS /* default initial size */
+
+typedef struct {
+	hashes_t hashes;
+	char *path;
+	codesign_t *codesign;
+} cachecsig_ref_t;
+
+void cachecsig_init(const char *, int, size_t, int);
+int cachecsig_save(void);
 void cachecsig_fini(void);
-codesign_t * cachecsig_get(hashes_t *) MALLOC NONNULL(1);
-void cachecsig_put(hashes_t *, codesign_t *) NONNULL(1,2);
+void cachecsig_flush(void);
+codesign_t * cachecsig_get(hashes_t *) NONNULL(1);
+void cachecsig_put(hashes_t *, codesign_t *, const char *) NONNULL(1,2);
+size_t cachecsig_hot(cachecsig_ref_t *, size_t, time_t) NONNULL(1);
+void cachecsig_ref_free(cachecsig_ref_t *) NONNULL(1);
+void cachecsig_revalidated(hashes_t *, codesign_t *) NONNULL(1);
 void cachecsig_stats(lrucache_stat_t *) NONNULL(1);
 
 #endif
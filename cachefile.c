@@ -0,0 +1,193 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+/*
+ * Persistent cache files for carrying cache contents across restarts.
+ *
+ * A cache file consists of a fixed header followed by the records of the
+ * cache in least to most recently used order.  Files are written to a
+ * temporary file and atomically renamed into place, and loaded by mapping
+ * them read-only into memory.  A file is only accepted if magic, format
+ * version, configured hash flags and record size all match; otherwise the
+ * cache starts empty as if there were no file.
+ */
+
+#include "cachefile.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+
+/*
+ * Load cache file `path' and call `func' with the records following the
+ * header, their total size and the record count.
+ *
+ * Returns 0 on success and -1 with errno set if the file does not exist, is
+ * not valid for `magic', `hflags' and `recsz', or if `func' returned -1.
+ */
+int
+cachefile_load(const char *path, const char *magic, int hflags, uint32_t recsz,
+               cachefile_load_func_t *func, void *arg) {
+	cachefile_hdr_t hdr;
+	struct stat st;
+	unsigned char *p;
+	int fd, rv;
+
+	assert(path);
+	assert(magic);
+	assert(func);
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &st) == -1)
+		goto errout;
+	if (st.st_size < (off_t)sizeof(hdr) || st.st_size > SSIZE_MAX) {
+		errno = EINVAL;
+		goto errout;
+	}
+	p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED)
+		goto errout;
+	close(fd);
+	(void)madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+	memcpy(&hdr, p, sizeof(hdr));
+	if (memcmp(hdr.magic, magic, CACHEFILE_MAGICSZ) ||
+	    hdr.version != CACHEFILE_VERSION ||
+	    hdr.hflags != hflags ||
+	    hdr.recsz != recsz ||
+	    (recsz > 0 && (hdr.count != (st.st_size - sizeof(hdr)) / recsz ||
+	                   (st.st_size - sizeof(hdr)) % recsz != 0))) {
+		munmap(p, (size_t)st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+	rv = func(p + sizeof(hdr), (size_t)st.st_size - sizeof(hdr),
+	          hdr.count, arg);
+	munmap(p, (size_t)st.st_size);
+	return rv;
+errout:
+	close(fd);
+	return -1;
+}
+
+/*
+ * Copy `sz' bytes from the record data at `*p' to `dst' and advance `*p',
+ * without reading beyond `end'.  Used for parsing variable-length records,
+ * which are not necessarily aligned in the mapped file.
+ */
+int
+cachefile_read(void *dst, size_t sz,
+               const unsigned char **p, const unsigned char *end) {
+	if ((size_t)(end - *p) < sz) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(dst, *p, sz);
+	*p += sz;
+	return 0;
+}
+
+/*
+ * Start writing a new cache file to be renamed to `path' in
+ * cachefile_save_end.  Records are appended using cachefile_write and
+ * cachefile_record.
+ */
+int
+cachefile_save_begin(cachefile_t *cf, const char *path, const char *magic,
+                     int hflags, uint32_t recsz) {
+	int fd;
+
+	assert(cf);
+	assert(path);
+	assert(magic);
+
+	if ((snprintf(cf->path, sizeof(cf->path), "%s", path) >=
+	     (int)sizeof(cf->path)) ||
+	    (snprintf(cf->tmppath, sizeof(cf->tmppath), "%s.tmp", path) >=
+	     (int)sizeof(cf->tmppath))) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	bzero(&cf->hdr, sizeof(cf->hdr));
+	memcpy(cf->hdr.magic, magic, CACHEFILE_MAGICSZ);
+	cf->hdr.version = CACHEFILE_VERSION;
+	cf->hdr.hflags = hflags;
+	cf->hdr.recsz = recsz;
+
+	fd = open(cf->tmppath, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+	if (fd == -1)
+		return -1;
+	cf->f = fdopen(fd, "w");
+	if (!cf->f) {
+		close(fd);
+		unlink(cf->tmppath);
+		return -1;
+	}
+	if (fwrite(&cf->hdr, sizeof(cf->hdr), 1, cf->f) != 1) {
+		fclose(cf->f);
+		unlink(cf->tmppath);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Append `sz' bytes of record data and count a complete record, respectively.
+ * Variable-length records can be written field by field.  Write errors are
+ * detected in cachefile_save_end.
+ */
+void
+cachefile_write(cachefile_t *cf, const void *buf, size_t sz) {
+	assert(cf);
+	assert(buf);
+
+	(void)fwrite(buf, sz, 1, cf->f);
+}
+
+void
+cachefile_record(cachefile_t *cf) {
+	assert(cf);
+
+	cf->hdr.count++;
+}
+
+/*
+ * Finish writing the cache file, updating the record count in the header,
+ * and atomically replace any previous cache file.
+ */
+int
+cachefile_save_end(cachefile_t *cf) {
+	assert(cf);
+
+	if (fseeko(cf->f, 0, SEEK_SET) == -1 ||
+	    fwrite(&cf->hdr, sizeof(cf->hdr), 1, cf->f) != 1 ||
+	    fflush(cf->f) == EOF ||
+	    ferror(cf->f)) {
+		fclose(cf->f);
+		unlink(cf->tmppath);
+		return -1;
+	}
+	if (fclose(cf->f) == EOF) {
+		unlink(cf->tmppath);
+		return -1;
+	}
+	if (rename(cf->tmppath, cf->path) == -1) {
+		unlink(cf->tmppath);
+		return -1;
+	}
+	return 0;
+}
+
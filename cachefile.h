@@ -0,0 +1,57 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef CACHEFILE_H
+#define CACHEFILE_H
+
+#include "attrib.h"
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <limits.h>
+
+/*
+ * Increase whenever the layout of the header or of any records changes.
+ */
+#define CACHEFILE_VERSION       1
+#define CACHEFILE_MAGICSZ       8
+
+typedef struct __attribute__((packed)) {
+	char magic[CACHEFILE_MAGICSZ];
+	uint32_t version;
+	int32_t hflags;
+	uint32_t recsz;                 /* fixed record size or 0 */
+	uint64_t count;
+} cachefile_hdr_t;
+
+typedef struct {
+	FILE *f;
+	char path[PATH_MAX];
+	char tmppath[PATH_MAX];
+	cachefile_hdr_t hdr;
+} cachefile_t;
+
+typedef int cachefile_load_func_t(const unsigned char *, size_t, uint64_t,
+                                  void *) NONNULL(1);
+
+int cachefile_load(const char *, const char *, int, uint32_t,
+                   cachefile_load_func_t *, void *) NONNULL(1,2,5) WUNRES;
+int cachefile_save_begin(cachefile_t *, const char *, const char *, int,
+                         uint32_t) NONNULL(1,2,3) WUNRES;
+void cachefile_write(cachefile_t *, const void *, size_t) NONNULL(1,2);
+void cachefile_record(cachefile_t *) NONNULL(1);
+int cachefile_save_end(cachefile_t *) NONNULL(1) WUNRES;
+int cachefile_read(void *, size_t,
+                   const unsigned char **, const unsigned char *)
+                   NONNULL(1,3,4) WUNRES;
+
+#endif
+
@@ -0,0 +1,143 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "cachefp.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <pthread.h>
+
+/*
+ * Tier behind the hashes and cdhash caches, keyed by the fast keyed content
+ * fingerprint from hashes_fp() and the file size instead of by inode,
+ * mapping to the configured file hashes.  Identical content in a new inode,
+ * such as a copied or reinstalled binary, then only costs a fingerprint
+ * pass instead of the cryptographic digests, and the hashes found lead to
+ * the code signature cache as usual.  Since the fingerprint key is random
+ * per process, nothing is saved to disk; the hashes cache covers restarts.
+ */
+
+typedef struct __attribute__((packed)) {
+	uint64_t fp;
+	uint64_t size;                  /* must match */
+} cachefp_key_t;
+
+typedef struct {
+	cachefp_key_t key;
+	hashes_t hashes;
+
+	lrucache_node_t node;
+} cachefp_obj_t;
+
+static void
+cachefp_obj_free(void *vobj) {
+	free(vobj);
+}
+
+static lrucache_t lrucache;
+static pthread_mutex_t mutex;
+static bool enabled = false;
+
+/*
+ * The cache starts out with `buckets' buckets and uses the replacement policy
+ * given by LRUCACHE_FLAG_* `policy'.  A size of 0 disables the cache.
+ */
+void
+cachefp_init(size_t buckets, int policy) {
+	if (buckets == 0)
+		return;
+	pthread_mutex_init(&mutex, NULL);
+	lrucache_init(&lrucache, buckets, sizeof(cachefp_obj_t),
+	              sizeof(uint64_t), sizeof(uint64_t),
+	              sizeof(cachefp_key_t), policy,
+	              lrucache_hash_digest, cachefp_obj_free);
+	enabled = true;
+}
+
+void
+cachefp_fini(void) {
+	if (!enabled)
+		return;
+	lrucache_destroy(&lrucache);
+	pthread_mutex_destroy(&mutex);
+	enabled = false;
+}
+
+/*
+ * Drop all cached entries, for shedding memory.  Thread-safe.
+ */
+void
+cachefp_flush(void) {
+	if (!enabled)
+		return;
+	pthread_mutex_lock(&mutex);
+	lrucache_flush(&lrucache);
+	pthread_mutex_unlock(&mutex);
+}
+
+bool
+cachefp_enabled(void) {
+	return enabled;
+}
+
+bool
+cachefp_get(uint64_t fp, off_t size, hashes_t *hashes) {
+	cachefp_obj_t *obj;
+	cachefp_key_t key;
+
+	assert(hashes);
+
+	if (!enabled)
+		return false;
+	key.fp = fp;
+	key.size = (uint64_t)size;
+	pthread_mutex_lock(&mutex);
+	obj = lrucache_get(&lrucache, &key);
+	if (!obj) {
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+	memcpy(hashes, &obj->hashes, sizeof(hashes_t));
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+void
+cachefp_put(uint64_t fp, off_t size, hashes_t *hashes) {
+	cachefp_obj_t *obj;
+
+	assert(hashes);
+
+	if (!enabled)
+		return;
+	obj = malloc(sizeof(cachefp_obj_t));
+	if (!obj)
+		return;
+	bzero(obj, sizeof(cachefp_obj_t));
+	obj->key.fp = fp;
+	obj->key.size = (uint64_t)size;
+	memcpy(&obj->hashes, hashes, sizeof(hashes_t));
+	pthread_mutex_lock(&mutex);
+	lrucache_put(&lrucache, &obj->node, obj);
+	pthread_mutex_unlock(&mutex);
+}
+
+void
+cachefp_stats(lrucache_stat_t *st) {
+	if (!enabled) {
+		bzero(st, sizeof(lrucache_stat_t));
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	lrucache_stats(&lrucache, st);
+	pthread_mutex_unlock(&mutex);
+}
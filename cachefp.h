@@ -0,0 +1,31 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef CACHEFP_H
+#define CACHEFP_H
+
+#include "lrucache.h"
+#include "hashes.h"
+#include "attrib.h"
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+void cachefp_init(size_t, int);
+void cachefp_fini(void);
+void cachefp_flush(void);
+bool cachefp_enabled(void);
+bool cachefp_get(uint64_t, off_t, hashes_t *) NONNULL(3) WUNRES;
+void cachefp_put(uint64_t, off_t, hashes_t *) NONNULL(3);
+void cachefp_stats(lrucache_stat_t *) NONNULL(1);
+
+#endif
+
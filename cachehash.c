@@ -10,14 +10,48 @@
 
 #include "cachehash.h"
 
+#include "cachefile.h"
+#include "atomic.h"
+
+#include "tommyhash.h"
+
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <pthread.h>
-#ifdef DEBUG_CACHE
+#include <limits.h>
 #include <stdio.h>
+#ifdef DEBUG_CACHE
+#include <errno.h>
 #endif
 
-#define CACHEHASH_BUCKETS       LRUCACHE_BUCKETS
+
+/*
+ * The cache is split into independently locked shards by (dev,ino) in order
+ * to avoid contention between work threads.  Each shard holds an equal part
+ * of the buckets.  The shard index is derived from a hash with a different
+ * seed than the one used within the shard's hashtable, so that the two do not
+ * correlate.
+ */
+#define CACHEHASH_SHARDS        8
+#define CACHEHASH_SHARD_SEED    0x5eed5eed
+_Static_assert(CACHEHASH_SHARDS <= LRUCACHE_SHARDS_MAX,
+               "CACHEHASH_SHARDS exceeds LRUCACHE_SHARDS_MAX");
+
+/*
+ * A lock-free counting Bloom filter over (dev,ino) in front of the shards
+ * answers gets for inodes that are definitely not cached without taking any
+ * shard lock.  Counters are incremented before an object is put into a shard
+ * and decremented after it was removed from it, so that the filter never
+ * reports false negatives.  The filter is sized for the initial number of
+ * buckets; if the cache grows, its false positive rate increases, which is
+ * reported in the statistics.
+ */
+#define CACHEHASH_BLOOM_COUNTERS 8      /* counters per initial bucket */
+#define CACHEHASH_BLOOM_K        3      /* counters per key */
+#define CACHEHASH_BLOOM_SEED     0xb1003b10
+
+#define CACHEHASH_MAGIC         "xnhashes"
 
 typedef struct __attribute__((packed)) {
 	ino_t ino;
@@ -36,6 +70,58 @@ typedef struct {
 	lrucache_node_t node;
 } cachehash_obj_t;
 
+static atomic32_t *bloom;       /* NULL if disabled */
+static size_t bloom_mask;
+
+static uint64_t
+cachehash_bloom_hash(cachehash_key_t *key) {
+	return tommy_hash_u64(CACHEHASH_BLOOM_SEED, key,
+	                      sizeof(dev_t) + sizeof(ino_t));
+}
+
+#define BLOOM_IDX(H,I) ((((uint32_t)(H)) + (I) * (((H) >> 32) | 1)) & \
+                        bloom_mask)
+
+static void
+cachehash_bloom_add(cachehash_key_t *key) {
+	uint64_t h;
+
+	if (!bloom)
+		return;
+	h = cachehash_bloom_hash(key);
+	for (uint64_t i = 0; i < CACHEHASH_BLOOM_K; i++)
+		atomic32_fenced_inc(&bloom[BLOOM_IDX(h, i)]);
+}
+
+static void
+cachehash_bloom_del(cachehash_key_t *key) {
+	uint64_t h;
+
+	if (!bloom)
+		return;
+	h = cachehash_bloom_hash(key);
+	for (uint64_t i = 0; i < CACHEHASH_BLOOM_K; i++)
+		atomic32_fenced_dec(&bloom[BLOOM_IDX(h, i)]);
+}
+
+/*
+ * Returns false if no object with the (dev,ino) of `key' is in the cache,
+ * true if there may be one.
+ */
+static bool
+cachehash_bloom_test(cachehash_key_t *key) {
+	uint64_t h;
+
+	if (!bloom)
+		return true;
+	h = cachehash_bloom_hash(key);
+	for (uint64_t i = 0; i < CACHEHASH_BLOOM_K; i++) {
+		if (atomic32_fenced_load(&bloom[BLOOM_IDX(h, i)]) == 0)
+			return false;
+	}
+	return true;
+}
+
 static cachehash_obj_t *
 cachehash_obj_new() {
 	cachehash_obj_t *obj;
@@ -47,29 +133,206 @@ cachehash_obj_new() {
 	return obj;
 }
 
+/*
+ * Called by lrucache after the object was removed from the shard, and for
+ * objects that were rejected by lrucache_put as duplicates; both have been
+ * added to the filter before.
+ */
 static void
-cachehash_obj_free(void *obj) {
+cachehash_obj_free(void *vobj) {
+	cachehash_obj_t *obj = vobj;
 	assert(obj);
+	cachehash_bloom_del(&obj->key);
 	free(obj);
 }
 
-static lrucache_t lrucache;
-static pthread_mutex_t mutex;
+typedef struct {
+	pthread_mutex_t mutex;
+	lrucache_t lrucache;
+	uint64_t falsepos;      /* gets that passed the filter but missed */
+	atomic64_t filtered;    /* gets answered by the filter */
+	uint64_t filtered_seen; /* filtered gets accounted in lrucache */
+} cachehash_shard_t;
+
+/*
+ * Account gets answered by the filter as misses of the shard's lrucache, so
+ * that they drive its adaptive sizing.  Called with the shard mutex held.
+ */
+static void
+cachehash_sync_filtered(cachehash_shard_t *shard) {
+	uint64_t filtered;
+
+	filtered = atomic64_fenced_load(&shard->filtered);
+	if (filtered != shard->filtered_seen) {
+		lrucache_misses(&shard->lrucache,
+		                filtered - shard->filtered_seen);
+		shard->filtered_seen = filtered;
+	}
+}
+
+static cachehash_shard_t shards[CACHEHASH_SHARDS];
+
+static cachehash_shard_t *
+cachehash_shard(cachehash_key_t *key) {
+	tommy_hash_t h;
+
+	h = tommy_hash_u32(CACHEHASH_SHARD_SEED, key,
+	                   sizeof(dev_t) + sizeof(ino_t));
+	return &shards[h % CACHEHASH_SHARDS];
+}
+
+static char cachepath[PATH_MAX];
+static int cachehflags;
+
+#define CACHEHASH_RECSZ (sizeof(cachehash_key_t) + sizeof(hashes_t))
 
+static int
+cachehash_load(const unsigned char *p, size_t sz, uint64_t count,
+               UNUSED void *arg) {
+	cachehash_shard_t *shard;
+	cachehash_obj_t *obj;
+
+	assert(sz == count * CACHEHASH_RECSZ);
+	for (uint64_t i = 0; i < count; i++) {
+		obj = cachehash_obj_new();
+		if (!obj)
+			return -1;
+		memcpy(&obj->key, p, sizeof(cachehash_key_t));
+		memcpy(&obj->hashes, p + sizeof(cachehash_key_t),
+		       sizeof(hashes_t));
+		p += CACHEHASH_RECSZ;
+		shard = cachehash_shard(&obj->key);
+		cachehash_bloom_add(&obj->key);
+		lrucache_put(&shard->lrucache, &obj->node, obj);
+		lrucache_reclaim(&shard->lrucache,
+		                 lrucache_garbage(&shard->lrucache));
+	}
+	return 0;
+}
+
+static void
+cachehash_save_obj(void *vobj, void *arg) {
+	cachehash_obj_t *obj = vobj;
+	cachefile_t *cf = arg;
+
+	cachefile_write(cf, &obj->key, sizeof(cachehash_key_t));
+	cachefile_write(cf, &obj->hashes, sizeof(hashes_t));
+	cachefile_record(cf);
+}
+
+/*
+ * If `path' is not NULL, the cache is populated from the cache file at
+ * `path' if one exists that was written with the same `hflags', and
+ * cachehash_save will write the cache to `path'.  The cache starts out with
+ * `buckets' buckets, split evenly across shards, and uses the replacement
+ * policy given by LRUCACHE_FLAG_* `policy'.
+ */
+void
+cachehash_init(const char *path, int hflags, size_t buckets, int policy) {
+	size_t n;
+
+	/* the filter is an optimization only, run without it on OOM */
+	n = tommy_roundup_pow2_u32(buckets * CACHEHASH_BLOOM_COUNTERS);
+	bloom = calloc(n, sizeof(atomic32_t));
+	bloom_mask = bloom ? n - 1 : 0;
+	for (size_t i = 0; i < CACHEHASH_SHARDS; i++) {
+		pthread_mutex_init(&shards[i].mutex, NULL);
+		shards[i].falsepos = 0;
+		shards[i].filtered = 0;
+		shards[i].filtered_seen = 0;
+		lrucache_init(&shards[i].lrucache,
+		              buckets / CACHEHASH_SHARDS,
+		              sizeof(cachehash_obj_t),
+		              sizeof(dev_t) + sizeof(ino_t),
+		              sizeof(dev_t) + sizeof(ino_t),
+		              sizeof(cachehash_key_t),
+		              policy|LRUCACHE_FLAG_DEFER, lrucache_hash_mix,
+		              cachehash_obj_free);
+	}
+	cachepath[0] = '\0';
+	cachehflags = hflags;
+	if (!path || snprintf(cachepath, sizeof(cachepath), "%s", path) >=
+	             (int)sizeof(cachepath)) {
+		cachepath[0] = '\0';
+		return;
+	}
+	if (cachefile_load(cachepath, CACHEHASH_MAGIC, cachehflags,
+	                   CACHEHASH_RECSZ, cachehash_load, NULL) == -1) {
+#ifdef DEBUG_CACHE
+		fprintf(stderr, "DEBUG_CACHE: hash load %s failed: %s (%i)\n",
+		                cachepath, strerror(errno), errno);
+#endif
+	}
+}
+
+/*
+ * Write the cache to the cache file, if one was configured.  Shards are
+ * locked one at a time, so concurrent get and put operations only ever wait
+ * for a single shard being written.
+ */
+int
+cachehash_save(void) {
+	cachefile_t cf;
+
+	if (!cachepath[0])
+		return 0;
+	if (cachefile_save_begin(&cf, cachepath, CACHEHASH_MAGIC, cachehflags,
+	                         CACHEHASH_RECSZ) == -1)
+		return -1;
+	for (size_t i = 0; i < CACHEHASH_SHARDS; i++) {
+		pthread_mutex_lock(&shards[i].mutex);
+		lrucache_foreach(&shards[i].lrucache, cachehash_save_obj, &cf);
+		pthread_mutex_unlock(&shards[i].mutex);
+	}
+	return cachefile_save_end(&cf);
+}
+
+/*
+ * Drop all cached hashes, for shedding memory.  Thread-safe.
+ */
 void
-cachehash_init(void) {
-	pthread_mutex_init(&mutex, NULL);
-	lrucache_init(&lrucache, CACHEHASH_BUCKETS,
-	              sizeof(dev_t) + sizeof(ino_t),
-	              sizeof(dev_t) + sizeof(ino_t),
-	              sizeof(cachehash_key_t),
-	              cachehash_obj_free);
+cachehash_flush(void) {
+	for (size_t i = 0; i < CACHEHASH_SHARDS; i++) {
+		pthread_mutex_lock(&shards[i].mutex);
+		lrucache_flush(&shards[i].lrucache);
+		pthread_mutex_unlock(&shards[i].mutex);
+	}
+}
+
+static bool
+cachehash_obj_on_dev(void *vobj, void *arg) {
+	return ((cachehash_obj_t *)vobj)->key.dev == *(dev_t *)arg;
+}
+
+/*
+ * Drop all cached hashes of files on device `dev', such as after it was
+ * unmounted.  Returns the number of dropped objects.  Thread-safe.
+ */
+size_t
+cachehash_purge_dev(dev_t dev) {
+	tommy_node *garbage;
+	size_t n = 0;
+
+	for (size_t i = 0; i < CACHEHASH_SHARDS; i++) {
+		pthread_mutex_lock(&shards[i].mutex);
+		n += lrucache_purge(&shards[i].lrucache,
+		                    cachehash_obj_on_dev, &dev);
+		garbage = lrucache_garbage(&shards[i].lrucache);
+		pthread_mutex_unlock(&shards[i].mutex);
+		lrucache_reclaim(&shards[i].lrucache, garbage);
+	}
+	return n;
 }
 
 void
 cachehash_fini(void) {
-	lrucache_destroy(&lrucache);
-	pthread_mutex_destroy(&mutex);
+	for (size_t i = 0; i < CACHEHASH_SHARDS; i++) {
+		lrucache_destroy(&shards[i].lrucache);
+		pthread_mutex_destroy(&shards[i].mutex);
+	}
+	free((void *)bloom);
+	bloom = NULL;
+	cachepath[0] = '\0';
 }
 
 bool
@@ -78,8 +341,11 @@ cachehash_get(hashes_t *hashes,
               struct timespec *mtime,
               struct timespec *ctime,
               struct timespec *btime) {
+	cachehash_shard_t *shard;
 	cachehash_obj_t *obj;
 	cachehash_key_t key;
+	tommy_node *garbage;
+	uint64_t misses;
 
 	key.dev = dev;
 	key.ino = ino;
@@ -89,19 +355,36 @@ cachehash_get(hashes_t *hashes,
 	key.ctime_nsec = ctime->tv_nsec;
 	key.btime_sec  = btime->tv_sec;
 	key.btime_nsec = btime->tv_nsec;
-	pthread_mutex_lock(&mutex);
-	obj = lrucache_get(&lrucache, &key);
+	shard = cachehash_shard(&key);
+	if (!cachehash_bloom_test(&key)) {
+		atomic64_fenced_inc(&shard->filtered);
+#ifdef DEBUG_CACHE
+		fprintf(stderr, "DEBUG_CACHE: hash get FILTERED "
+		                "(%u,%llu,%lu,%lu,%lu)\n",
+		                dev, ino, mtime->tv_sec, ctime->tv_sec,
+		                btime->tv_sec);
+#endif
+		return false;
+	}
+	pthread_mutex_lock(&shard->mutex);
+	cachehash_sync_filtered(shard);
+	misses = shard->lrucache.stat.misses;
+	obj = lrucache_get(&shard->lrucache, &key);
+	if (bloom && shard->lrucache.stat.misses != misses)
+		shard->falsepos++;
 #ifdef DEBUG_CACHE
 	fprintf(stderr, "DEBUG_CACHE: hash get %s (%u,%llu,%lu,%lu,%lu)\n",
 	                obj ? "HIT" : "MISS",
 	                dev, ino, mtime->tv_sec, ctime->tv_sec, btime->tv_sec);
 #endif
 	if (!obj) {
-		pthread_mutex_unlock(&mutex);
+		garbage = lrucache_garbage(&shard->lrucache);
+		pthread_mutex_unlock(&shard->mutex);
+		lrucache_reclaim(&shard->lrucache, garbage);
 		return false;
 	}
 	memcpy(hashes, &obj->hashes, sizeof(hashes_t));
-	pthread_mutex_unlock(&mutex);
+	pthread_mutex_unlock(&shard->mutex);
 	return true;
 }
 
@@ -111,7 +394,9 @@ cachehash_put(dev_t dev, ino_t ino,
               struct timespec *ctime,
               struct timespec *btime,
               hashes_t *hashes) {
+	cachehash_shard_t *shard;
 	cachehash_obj_t *obj;
+	tommy_node *garbage;
 
 	assert(hashes);
 
@@ -132,15 +417,48 @@ cachehash_put(dev_t dev, ino_t ino,
 	obj->key.btime_sec  = btime->tv_sec;
 	obj->key.btime_nsec = btime->tv_nsec;
 	memcpy(&obj->hashes, hashes, sizeof(hashes_t));
-	pthread_mutex_lock(&mutex);
-	lrucache_put(&lrucache, &obj->node, obj);
-	pthread_mutex_unlock(&mutex);
+	shard = cachehash_shard(&obj->key);
+	cachehash_bloom_add(&obj->key);
+	pthread_mutex_lock(&shard->mutex);
+	cachehash_sync_filtered(shard);
+	lrucache_put(&shard->lrucache, &obj->node, obj);
+	garbage = lrucache_garbage(&shard->lrucache);
+	pthread_mutex_unlock(&shard->mutex);
+	lrucache_reclaim(&shard->lrucache, garbage);
 }
 
+/*
+ * Return statistics aggregated over all shards, with hits and misses also
+ * reported per shard.  Gets answered by the filter count as gets and misses.
+ */
 void
 cachehash_stats(lrucache_stat_t *st) {
-	pthread_mutex_lock(&mutex);
-	lrucache_stats(&lrucache, st);
-	pthread_mutex_unlock(&mutex);
+	lrucache_stat_t sst;
+
+	bzero(st, sizeof(lrucache_stat_t));
+	st->shards = CACHEHASH_SHARDS;
+	for (size_t i = 0; i < CACHEHASH_SHARDS; i++) {
+		pthread_mutex_lock(&shards[i].mutex);
+		cachehash_sync_filtered(&shards[i]);
+		lrucache_stats(&shards[i].lrucache, &sst);
+		st->falsepos += shards[i].falsepos;
+		st->filtered += shards[i].filtered_seen;
+		pthread_mutex_unlock(&shards[i].mutex);
+		st->size += sst.size;
+		st->policy = sst.policy;
+		st->used += sst.used;
+		st->protected += sst.protected;
+		st->bytes += sst.bytes;
+		st->grows += sst.grows;
+		st->puts += sst.puts;
+		st->gets += sst.gets;
+		st->hits += sst.hits;
+		st->misses += sst.misses;
+		st->invalids += sst.invalids;
+		st->shard[i] = sst.shard[0];
+	}
+	if (bloom)
+		st->bytes += (bloom_mask + 1) * sizeof(atomic32_t);
+	st->hitrate = lrucache_hitrate(st->hits, st->gets);
 }
 
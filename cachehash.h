@@ -19,8 +19,13 @@
 #include <time.h>
 #include <stdbool.h>
 
-void cachehash_init(void);
+#define CACHEHASH_BUCKETS       LRUCACHE_BUCKETS /* default initial size */
+
+void cachehash_init(const char *, int, size_t, int);
+int cachehash_save(void);
 void cachehash_fini(void);
+void cachehash_flush(void);
+size_t cachehash_purge_dev(dev_t);
 bool cachehash_get(hashes_t *,
                    dev_t, ino_t,
                    struct timespec *,
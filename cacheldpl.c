@@ -10,18 +10,22 @@
 
 #include "cacheldpl.h"
 
+#include "cachefile.h"
+#include "aev.h"
+
+#include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <assert.h>
 #include <pthread.h>
-#ifdef DEBUG_CACHE
-#include <stdio.h>
-#endif
+#include <errno.h>
+
+#define CACHELDPL_MAGIC         "xnldpls\0"
 
 /*
  * It is not uncommon for systems to have daemons and agents in the high
  * hundreds; go above 1k by default.
  */
-#define CACHELDPL_BUCKETS       1536
 
 typedef struct __attribute__((packed)) {
 	ino_t ino;
@@ -54,23 +58,176 @@ cacheldpl_obj_free(void *obj) {
 	free(obj);
 }
 
+/*
+ * The content tier maps the SHA-256 of a plist's bytes to the program path
+ * and arguments read from it, so that rewrites of a plist with identical
+ * content, which miss the stat-keyed tier, need not be parsed again.  It is
+ * not persisted.
+ */
+
+typedef struct {
+	unsigned char sha256[SHA256SZ];
+	char *program_path; /* free */
+	char **program_argv; /* free */
+	lrucache_node_t node;
+} cacheldpl_content_t;
+
+static cacheldpl_content_t *
+cacheldpl_content_new() {
+	cacheldpl_content_t *obj;
+
+	obj = malloc(sizeof(cacheldpl_content_t));
+	if (!obj)
+		return NULL;
+	bzero(obj, sizeof(cacheldpl_content_t));
+	return obj;
+}
+
+static void
+cacheldpl_content_free(void *vobj) {
+	cacheldpl_content_t *obj = vobj;
+	assert(obj);
+	if (obj->program_path)
+		free(obj->program_path);
+	if (obj->program_argv)
+		free(obj->program_argv);
+	free(obj);
+}
+
+/*
+ * Returns a copy of argv in a single allocation, or NULL with errno set.
+ */
+static char **
+cacheldpl_argv_dup(char **argv) {
+	size_t argc = 0;
+
+	while (argv[argc])
+		argc++;
+	return aev_new(argc, argv);
+}
+
 static lrucache_t lrucache;
+static lrucache_t contents;
 static pthread_mutex_t mutex;
+static char cachepath[PATH_MAX];
+static bool loaded;
+
+static int
+cacheldpl_load(const unsigned char *p, size_t sz, uint64_t count,
+               UNUSED void *arg) {
+	cacheldpl_obj_t *obj;
+
+	assert(sz == count * sizeof(cacheldpl_key_t));
+	for (uint64_t i = 0; i < count; i++) {
+		obj = cacheldpl_obj_new();
+		if (!obj)
+			return -1;
+		memcpy(&obj->key, p, sizeof(cacheldpl_key_t));
+		p += sizeof(cacheldpl_key_t);
+		lrucache_put(&lrucache, &obj->node, obj);
+	}
+	return 0;
+}
 
+static void
+cacheldpl_save_obj(void *vobj, void *arg) {
+	cacheldpl_obj_t *obj = vobj;
+	cachefile_t *cf = arg;
+
+	cachefile_write(cf, &obj->key, sizeof(cacheldpl_key_t));
+	cachefile_record(cf);
+}
+
+/*
+ * If `path' is not NULL, the cache is populated from the cache file at
+ * `path' if one exists, and cacheldpl_save will write the cache to `path'.
+ * The cache starts out with `buckets' buckets and uses the replacement policy
+ * given by LRUCACHE_FLAG_* `policy'.
+ */
 void
-cacheldpl_init(void) {
+cacheldpl_init(const char *path, size_t buckets, int policy) {
 	pthread_mutex_init(&mutex, NULL);
-	lrucache_init(&lrucache, CACHELDPL_BUCKETS,
+	lrucache_init(&lrucache, buckets, sizeof(cacheldpl_obj_t),
 	              sizeof(dev_t) + sizeof(ino_t),
 	              sizeof(dev_t) + sizeof(ino_t),
-	              sizeof(cacheldpl_key_t),
-	              cacheldpl_obj_free);
+	              sizeof(cacheldpl_key_t), policy,
+	              lrucache_hash_mix, cacheldpl_obj_free);
+	lrucache_init(&contents, buckets, sizeof(cacheldpl_content_t),
+	              SHA256SZ, SHA256SZ, SHA256SZ, policy,
+	              lrucache_hash_digest, cacheldpl_content_free);
+	cachepath[0] = '\0';
+	loaded = false;
+	if (!path || snprintf(cachepath, sizeof(cachepath), "%s", path) >=
+	             (int)sizeof(cachepath)) {
+		cachepath[0] = '\0';
+		return;
+	}
+	if (cachefile_load(cachepath, CACHELDPL_MAGIC, 0,
+	                   sizeof(cacheldpl_key_t), cacheldpl_load,
+	                   NULL) == -1) {
+#ifdef DEBUG_CACHE
+		fprintf(stderr, "DEBUG_CACHE: ldpl load %s failed: %s (%i)\n",
+		                cachepath, strerror(errno), errno);
+#endif
+		return;
+	}
+	loaded = true;
+}
+
+/*
+ * Returns true iff the cache was populated from a cache file, that is, if
+ * it reflects the launchd plists known at the time it was last saved.
+ */
+bool
+cacheldpl_loaded(void) {
+	return loaded;
+}
+
+/*
+ * Write the cache to the cache file, if one was configured.
+ */
+int
+cacheldpl_save(void) {
+	cachefile_t cf;
+
+	if (!cachepath[0])
+		return 0;
+	if (cachefile_save_begin(&cf, cachepath, CACHELDPL_MAGIC, 0,
+	                         sizeof(cacheldpl_key_t)) == -1)
+		return -1;
+	pthread_mutex_lock(&mutex);
+	lrucache_foreach(&lrucache, cacheldpl_save_obj, &cf);
+	pthread_mutex_unlock(&mutex);
+	return cachefile_save_end(&cf);
 }
 
 void
 cacheldpl_fini(void) {
+	lrucache_destroy(&contents);
 	lrucache_destroy(&lrucache);
 	pthread_mutex_destroy(&mutex);
+	cachepath[0] = '\0';
+	loaded = false;
+}
+
+static bool
+cacheldpl_obj_on_dev(void *vobj, void *arg) {
+	return ((cacheldpl_obj_t *)vobj)->key.dev == *(dev_t *)arg;
+}
+
+/*
+ * Drop all cached entries for plists on device `dev', such as after it was
+ * unmounted.  Contents are keyed by digest and remain valid.  Returns the
+ * number of dropped entries.  Thread-safe.
+ */
+size_t
+cacheldpl_purge_dev(dev_t dev) {
+	size_t n;
+
+	pthread_mutex_lock(&mutex);
+	n = lrucache_purge(&lrucache, cacheldpl_obj_on_dev, &dev);
+	pthread_mutex_unlock(&mutex);
+	return n;
 }
 
 bool
@@ -124,3 +281,78 @@ cacheldpl_stats(lrucache_stat_t *st) {
 	pthread_mutex_unlock(&mutex);
 }
 
+/*
+ * Look up the plist content with SHA-256 digest sha256.  On a hit, returns
+ * true and copies of the cached program path and arguments, either of which
+ * may be NULL, in *path and *argv.  Returns false with errno set to 0 on a
+ * miss, or to ENOMEM if the copies could not be made.
+ */
+bool
+cacheldpl_content_get(const unsigned char *sha256,
+                      char **path, char ***argv) {
+	cacheldpl_content_t *obj;
+
+	*path = NULL;
+	*argv = NULL;
+	pthread_mutex_lock(&mutex);
+	obj = lrucache_get(&contents, (void *)sha256);
+	if (!obj) {
+		pthread_mutex_unlock(&mutex);
+		errno = 0;
+		return false;
+	}
+	if (obj->program_path) {
+		*path = strdup(obj->program_path);
+		if (!*path)
+			goto errout;
+	}
+	if (obj->program_argv) {
+		*argv = cacheldpl_argv_dup(obj->program_argv);
+		if (!*argv)
+			goto errout;
+	}
+	pthread_mutex_unlock(&mutex);
+	return true;
+errout:
+	pthread_mutex_unlock(&mutex);
+	if (*path) {
+		free(*path);
+		*path = NULL;
+	}
+	errno = ENOMEM;
+	return false;
+}
+
+void
+cacheldpl_content_put(const unsigned char *sha256,
+                      const char *path, char **argv) {
+	cacheldpl_content_t *obj;
+
+	obj = cacheldpl_content_new();
+	if (!obj)
+		return;
+	memcpy(obj->sha256, sha256, SHA256SZ);
+	if (path) {
+		obj->program_path = strdup(path);
+		if (!obj->program_path)
+			goto errout;
+	}
+	if (argv) {
+		obj->program_argv = cacheldpl_argv_dup(argv);
+		if (!obj->program_argv)
+			goto errout;
+	}
+	pthread_mutex_lock(&mutex);
+	lrucache_put(&contents, &obj->node, obj);
+	pthread_mutex_unlock(&mutex);
+	return;
+errout:
+	cacheldpl_content_free(obj);
+}
+
+void
+cacheldpl_content_stats(lrucache_stat_t *st) {
+	pthread_mutex_lock(&mutex);
+	lrucache_stats(&contents, st);
+	pthread_mutex_unlock(&mutex);
+}
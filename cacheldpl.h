@@ -12,17 +12,28 @@
 #define CACHELDPL_H
 
 #include "lrucache.h"
+#include "hashes.h"
 #include "attrib.h"
 
 #include <sys/types.h>
 #include <time.h>
 #include <stdbool.h>
 
-void cacheldpl_init(void);
+#define CACHELDPL_BUCKETS       1536 /* default initial size */
+
+void cacheldpl_init(const char *, size_t, int);
+int cacheldpl_save(void) WUNRES;
+bool cacheldpl_loaded(void) WUNRES;
 void cacheldpl_fini(void);
+size_t cacheldpl_purge_dev(dev_t);
 bool cacheldpl_get(dev_t, ino_t, time_t, time_t, time_t);
 void cacheldpl_put(dev_t, ino_t, time_t, time_t, time_t);
 void cacheldpl_stats(lrucache_stat_t *) NONNULL(1);
+bool cacheldpl_content_get(const unsigned char *, char **, char ***)
+     NONNULL(1,2,3);
+void cacheldpl_content_put(const unsigned char *, const char *, char **)
+     NONNULL(1);
+void cacheldpl_content_stats(lrucache_stat_t *) NONNULL(1);
 
 #endif
 
@@ -0,0 +1,263 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "cachepath.h"
+
+#include "sys.h"
+#include "time.h"
+#include "tommyhash.h"
+
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <errno.h>
+
+/*
+ * Cache of resolved directories for the paths that need to be resolved in
+ * userspace because of audit(4) bugs, such that resolving a path relative
+ * to the same working directory or beneath the same directory again only
+ * needs to resolve the last path component, if at all.  Objects are keyed
+ * by a hash of the unresolved absolute directory, which is compared in full
+ * on hits.
+ *
+ * Renames and unlinks can change what a cached directory resolves to; they
+ * bump the generation, which invalidates all objects at once.  Creating
+ * names cannot change the resolution of existing paths, and failures are
+ * not cached.  Changes not seen as audit events, such as mounts, are
+ * covered by objects expiring after CACHEPATH_TTL seconds.
+ */
+
+typedef struct __attribute__((packed)) {
+	uint64_t hash;
+	uint64_t generation;
+} cachepath_key_t;
+
+typedef struct {
+	cachepath_key_t key;
+	uint64_t expires;       /* monotonic nsec */
+	char *udir;             /* free */
+	char *rdir;             /* free */
+	lrucache_node_t node;
+} cachepath_obj_t;
+
+static void
+cachepath_obj_free(void *vobj) {
+	cachepath_obj_t *obj = vobj;
+
+	assert(obj);
+	free(obj->udir);
+	free(obj->rdir);
+	free(obj);
+}
+
+static lrucache_t lrucache;
+static pthread_mutex_t mutex;
+static uint64_t generation;
+
+/*
+ * The cache starts out with `buckets' buckets and uses the replacement policy
+ * given by LRUCACHE_FLAG_* `policy'.
+ */
+void
+cachepath_init(size_t buckets, int policy) {
+	pthread_mutex_init(&mutex, NULL);
+	lrucache_init(&lrucache, buckets, sizeof(cachepath_obj_t),
+	              sizeof(uint64_t), sizeof(uint64_t),
+	              sizeof(cachepath_key_t), policy|LRUCACHE_FLAG_DEFER,
+	              lrucache_hash_digest, cachepath_obj_free);
+	generation = 0;
+}
+
+void
+cachepath_fini(void) {
+	lrucache_destroy(&lrucache);
+	pthread_mutex_destroy(&mutex);
+}
+
+void
+cachepath_invalidate(void) {
+	pthread_mutex_lock(&mutex);
+	generation++;
+	pthread_mutex_unlock(&mutex);
+}
+
+void
+cachepath_stats(lrucache_stat_t *st) {
+	pthread_mutex_lock(&mutex);
+	lrucache_stats(&lrucache, st);
+	pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * Returns a newly allocated copy of the cached resolution of udir, or NULL
+ * with errno set to 0 on a miss or to ENOMEM.
+ */
+static char *
+cachepath_get(const char *udir, uint64_t now) {
+	cachepath_obj_t *obj;
+	cachepath_key_t key;
+	tommy_node *garbage;
+	char *rdir;
+
+	key.hash = tommy_hash_u64(0, udir, strlen(udir));
+	pthread_mutex_lock(&mutex);
+	key.generation = generation;
+	obj = lrucache_get(&lrucache, &key);
+	if (obj && (obj->expires < now || strcmp(obj->udir, udir))) {
+		lrucache_invalidate(&lrucache, &obj->node);
+		obj = NULL;
+	}
+	if (!obj) {
+		garbage = lrucache_garbage(&lrucache);
+		pthread_mutex_unlock(&mutex);
+		lrucache_reclaim(&lrucache, garbage);
+		errno = 0;
+		return NULL;
+	}
+	rdir = strdup(obj->rdir);
+	pthread_mutex_unlock(&mutex);
+	return rdir;
+}
+
+static void
+cachepath_put(const char *udir, const char *rdir, uint64_t now) {
+	cachepath_obj_t *obj;
+	tommy_node *garbage;
+
+	obj = malloc(sizeof(cachepath_obj_t));
+	if (!obj)
+		return;
+	bzero(obj, sizeof(cachepath_obj_t));
+	obj->udir = strdup(udir);
+	obj->rdir = strdup(rdir);
+	if (!obj->udir || !obj->rdir) {
+		cachepath_obj_free(obj);
+		return;
+	}
+	obj->key.hash = tommy_hash_u64(0, udir, strlen(udir));
+	obj->expires = now + (uint64_t)CACHEPATH_TTL * 1000000000;
+	pthread_mutex_lock(&mutex);
+	obj->key.generation = generation;
+	lrucache_put(&lrucache, &obj->node, obj);
+	garbage = lrucache_garbage(&lrucache);
+	pthread_mutex_unlock(&mutex);
+	lrucache_reclaim(&lrucache, garbage);
+}
+
+/*
+ * Like sys_realdir, but with the directory resolved through the cache.
+ * Sets *cacheable to false if the path cannot be handled by the cache, in
+ * which case the caller needs to fall back to resolving without it.
+ */
+static char *
+cachepath_resolve(const char *path, const char *cwd, bool *cacheable) {
+	char *udir, *rdir, *sep, *p;
+	uint64_t now;
+	int rv;
+
+	*cacheable = true;
+	if (path[0] == '/') {
+		udir = strdup(path);
+	} else {
+		if (!cwd) {
+			errno = 0;
+			return NULL;
+		}
+		rv = asprintf(&udir, "%s/%s", cwd, path);
+		if (rv == -1)
+			udir = NULL;
+	}
+	if (!udir) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	sep = strrchr(udir, '/');
+	assert(sep);
+	if (sep == udir || !strcmp(sep + 1, "") ||
+	    !strcmp(sep + 1, ".") || !strcmp(sep + 1, "..")) {
+		free(udir);
+		*cacheable = false;
+		return NULL;
+	}
+	*sep = '\0';
+
+	now = timespec_mononsec();
+	rdir = cachepath_get(udir, now);
+	if (!rdir) {
+		if (errno == ENOMEM)
+			goto errout;
+		rdir = realpath(udir, NULL);
+		if (!rdir)
+			goto errout;
+		cachepath_put(udir, rdir, now);
+	}
+	/* realpath(3) only returns a trailing slash for the root */
+	rv = asprintf(&p, "%s/%s", strcmp(rdir, "/") ? rdir : "", sep + 1);
+	free(rdir);
+	free(udir);
+	if (rv == -1) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return p;
+errout:
+	rv = errno;
+	free(udir);
+	errno = rv;
+	return NULL;
+}
+
+/*
+ * Drop-in replacement for sys_realpath.  The last path component is only
+ * resolved using realpath(3) if it is a symlink.
+ */
+char *
+cachepath_realpath(const char *path, const char *cwd) {
+	struct stat sb;
+	bool cacheable;
+	char *p;
+	int e;
+
+	p = cachepath_resolve(path, cwd, &cacheable);
+	if (!cacheable)
+		return sys_realpath(path, cwd);
+	if (!p)
+		return NULL;
+	if (lstat(p, &sb) == -1) {
+		e = errno;
+		free(p);
+		errno = e;
+		return NULL;
+	}
+	if (S_ISLNK(sb.st_mode)) {
+		free(p);
+		return sys_realpath(path, cwd);
+	}
+	return p;
+}
+
+/*
+ * Drop-in replacement for sys_realdir.
+ */
+char *
+cachepath_realdir(const char *path, const char *cwd) {
+	bool cacheable;
+	char *p;
+
+	p = cachepath_resolve(path, cwd, &cacheable);
+	if (!cacheable)
+		return sys_realdir(path, cwd);
+	return p;
+}
+
@@ -0,0 +1,28 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef CACHEPATH_H
+#define CACHEPATH_H
+
+#include "lrucache.h"
+#include "attrib.h"
+
+#define CACHEPATH_BUCKETS       1024    /* default initial size */
+#define CACHEPATH_TTL           10      /* seconds */
+
+void cachepath_init(size_t, int);
+void cachepath_fini(void);
+char * cachepath_realpath(const char *, const char *) MALLOC NONNULL(1);
+char * cachepath_realdir(const char *, const char *) MALLOC NONNULL(1);
+void cachepath_invalidate(void);
+void cachepath_stats(lrucache_stat_t *) NONNULL(1);
+
+#endif
+
@@ -0,0 +1,299 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "cacheseal.h"
+
+#include "cachefile.h"
+#include "os.h"
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/attr.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <pthread.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/*
+ * Cache of executable images on the sealed system volume, keyed by inode
+ * only, mapping to the stat attributes and hashes of the image.  The signed
+ * system volume is mounted read-only from a sealed snapshot and cannot
+ * change without an OS update, so an image found here needs neither open
+ * nor stat nor hashing; the hashes lead to the codesign cache as usual, and
+ * acquisition is reduced to cache lookups.
+ *
+ * Entries are only valid for the volume UUID and OS build they were
+ * acquired on.  Both are stored with each record in the cache file and
+ * records of any other volume or build are dropped on load.  If the root
+ * filesystem is not a read-only snapshot, such as before macOS 11 or with
+ * authenticated root disabled, the cache stays disabled.
+ */
+
+#ifndef MNT_SNAPSHOT
+#define MNT_SNAPSHOT            0x40000000
+#endif
+
+#define CACHESEAL_MAGIC         "xnsealed"
+#define CACHESEAL_BUILDSZ       16
+
+typedef struct __attribute__((packed)) {
+	unsigned char uuid[16];
+	char build[CACHESEAL_BUILDSZ];
+} cacheseal_ident_t;
+
+typedef struct {
+	ino_t ino;
+	stat_attr_t stat;
+	hashes_t hashes;
+	bool shebang;
+
+	lrucache_node_t node;
+} cacheseal_obj_t;
+
+#define CACHESEAL_RECSZ (sizeof(cacheseal_ident_t) + sizeof(ino_t) + \
+                         sizeof(stat_attr_t) + sizeof(hashes_t) + \
+                         sizeof(uint32_t))
+
+static lrucache_t lrucache;
+static pthread_mutex_t mutex;
+static bool enabled = false;
+static dev_t sealdev;
+static cacheseal_ident_t ident;
+static char cachepath[PATH_MAX];
+static int cachehflags;
+
+static void
+cacheseal_obj_free(void *vobj) {
+	free(vobj);
+}
+
+/*
+ * Identify the sealed system volume mounted at /.  Returns -1 if / is not
+ * a read-only snapshot or its volume UUID is unavailable.
+ */
+static int
+cacheseal_ident(dev_t *dev, cacheseal_ident_t *id) {
+	struct attrlist al;
+	struct {
+		uint32_t len;
+		uuid_t uuid;
+	} __attribute__((aligned(4), packed)) buf;
+	struct statfs sfs;
+	struct stat st;
+	const char *build;
+
+	if (statfs("/", &sfs) == -1)
+		return -1;
+	if ((sfs.f_flags & (MNT_RDONLY|MNT_SNAPSHOT)) !=
+	    (MNT_RDONLY|MNT_SNAPSHOT))
+		return -1;
+	if (stat("/", &st) == -1)
+		return -1;
+	bzero(&al, sizeof(al));
+	al.bitmapcount = ATTR_BIT_MAP_COUNT;
+	al.volattr = ATTR_VOL_INFO|ATTR_VOL_UUID;
+	if (getattrlist("/", &al, &buf, sizeof(buf), 0) == -1)
+		return -1;
+	build = os_build();
+	if (!build || strlen(build) >= CACHESEAL_BUILDSZ)
+		return -1;
+
+	bzero(id, sizeof(cacheseal_ident_t));
+	memcpy(id->uuid, buf.uuid, sizeof(id->uuid));
+	memcpy(id->build, build, strlen(build));
+	*dev = st.st_dev;
+	return 0;
+}
+
+static int
+cacheseal_load(const unsigned char *p, UNUSED size_t sz, uint64_t count,
+               UNUSED void *arg) {
+	cacheseal_obj_t *obj;
+	const unsigned char *q;
+	uint32_t flags;
+
+	for (uint64_t i = 0; i < count; i++, p += CACHESEAL_RECSZ) {
+		/* other volume or OS build */
+		if (memcmp(p, &ident, sizeof(cacheseal_ident_t)))
+			continue;
+		obj = malloc(sizeof(cacheseal_obj_t));
+		if (!obj)
+			return -1;
+		bzero(obj, sizeof(cacheseal_obj_t));
+		q = p + sizeof(cacheseal_ident_t);
+		memcpy(&obj->ino, q, sizeof(ino_t));
+		q += sizeof(ino_t);
+		memcpy(&obj->stat, q, sizeof(stat_attr_t));
+		q += sizeof(stat_attr_t);
+		memcpy(&obj->hashes, q, sizeof(hashes_t));
+		q += sizeof(hashes_t);
+		memcpy(&flags, q, sizeof(uint32_t));
+		obj->shebang = !!flags;
+		obj->stat.dev = sealdev;
+		lrucache_put(&lrucache, &obj->node, obj);
+	}
+	return 0;
+}
+
+static void
+cacheseal_save_obj(void *vobj, void *arg) {
+	cacheseal_obj_t *obj = vobj;
+	cachefile_t *cf = arg;
+	uint32_t flags = obj->shebang ? 1 : 0;
+
+	cachefile_write(cf, &ident, sizeof(cacheseal_ident_t));
+	cachefile_write(cf, &obj->ino, sizeof(ino_t));
+	cachefile_write(cf, &obj->stat, sizeof(stat_attr_t));
+	cachefile_write(cf, &obj->hashes, sizeof(hashes_t));
+	cachefile_write(cf, &flags, sizeof(uint32_t));
+	cachefile_record(cf);
+}
+
+/*
+ * If `path' is not NULL, the cache is populated from the cache file at
+ * `path' if one exists that was written with the same `hflags' on the same
+ * volume and OS build, and cacheseal_save will write the cache to `path'.
+ * The cache starts out with `buckets' buckets and uses the replacement
+ * policy given by LRUCACHE_FLAG_* `policy'.  A size of 0 disables the
+ * cache.  Must be called after os_init.
+ */
+void
+cacheseal_init(const char *path, int hflags, size_t buckets, int policy) {
+	if (buckets == 0)
+		return;
+	if (cacheseal_ident(&sealdev, &ident) == -1)
+		return;
+	pthread_mutex_init(&mutex, NULL);
+	lrucache_init(&lrucache, buckets, sizeof(cacheseal_obj_t),
+	              sizeof(ino_t), sizeof(ino_t), sizeof(ino_t), policy,
+	              lrucache_hash_mix, cacheseal_obj_free);
+	enabled = true;
+
+	cachepath[0] = '\0';
+	cachehflags = hflags;
+	if (!path || snprintf(cachepath, sizeof(cachepath), "%s", path) >=
+	             (int)sizeof(cachepath)) {
+		cachepath[0] = '\0';
+		return;
+	}
+	(void)cachefile_load(cachepath, CACHESEAL_MAGIC, cachehflags,
+	                     CACHESEAL_RECSZ, cacheseal_load, NULL);
+}
+
+int
+cacheseal_save(void) {
+	cachefile_t cf;
+
+	if (!enabled || !cachepath[0])
+		return 0;
+	if (cachefile_save_begin(&cf, cachepath, CACHESEAL_MAGIC, cachehflags,
+	                         CACHESEAL_RECSZ) == -1)
+		return -1;
+	pthread_mutex_lock(&mutex);
+	lrucache_foreach(&lrucache, cacheseal_save_obj, &cf);
+	pthread_mutex_unlock(&mutex);
+	return cachefile_save_end(&cf);
+}
+
+void
+cacheseal_fini(void) {
+	if (!enabled)
+		return;
+	lrucache_destroy(&lrucache);
+	pthread_mutex_destroy(&mutex);
+	enabled = false;
+}
+
+/*
+ * Drop all cached entries, for shedding memory.  Thread-safe.
+ */
+void
+cacheseal_flush(void) {
+	if (!enabled)
+		return;
+	pthread_mutex_lock(&mutex);
+	lrucache_flush(&lrucache);
+	pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * Returns true if dev is the sealed system volume.
+ */
+bool
+cacheseal_sealed(dev_t dev) {
+	return enabled && dev == sealdev;
+}
+
+bool
+cacheseal_get(stat_attr_t *st, hashes_t *hashes, bool *shebang,
+              dev_t dev, ino_t ino) {
+	cacheseal_obj_t *obj;
+
+	assert(st);
+	assert(hashes);
+	assert(shebang);
+
+	if (!cacheseal_sealed(dev))
+		return false;
+	pthread_mutex_lock(&mutex);
+	obj = lrucache_get(&lrucache, &ino);
+	if (!obj) {
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+	memcpy(st, &obj->stat, sizeof(stat_attr_t));
+	memcpy(hashes, &obj->hashes, sizeof(hashes_t));
+	*shebang = obj->shebang;
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+/*
+ * Remember the stat attributes and hashes of an image, if it resides on the
+ * sealed system volume.
+ */
+void
+cacheseal_put(stat_attr_t *st, hashes_t *hashes, bool shebang) {
+	cacheseal_obj_t *obj;
+
+	assert(st);
+	assert(hashes);
+
+	if (!cacheseal_sealed(st->dev))
+		return;
+	obj = malloc(sizeof(cacheseal_obj_t));
+	if (!obj)
+		return;
+	bzero(obj, sizeof(cacheseal_obj_t));
+	obj->ino = st->ino;
+	memcpy(&obj->stat, st, sizeof(stat_attr_t));
+	memcpy(&obj->hashes, hashes, sizeof(hashes_t));
+	obj->shebang = shebang;
+	pthread_mutex_lock(&mutex);
+	lrucache_put(&lrucache, &obj->node, obj);
+	pthread_mutex_unlock(&mutex);
+}
+
+void
+cacheseal_stats(lrucache_stat_t *st) {
+	if (!enabled) {
+		bzero(st, sizeof(lrucache_stat_t));
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	lrucache_stats(&lrucache, st);
+	pthread_mutex_unlock(&mutex);
+}
+
@@ -0,0 +1,35 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef CACHESEAL_H
+#define CACHESEAL_H
+
+#include "lrucache.h"
+#include "hashes.h"
+#include "sys.h"
+#include "attrib.h"
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+#define CACHESEAL_BUCKETS       4096    /* default initial size */
+
+void cacheseal_init(const char *, int, size_t, int);
+int cacheseal_save(void);
+void cacheseal_fini(void);
+void cacheseal_flush(void);
+bool cacheseal_sealed(dev_t) WUNRES;
+bool cacheseal_get(stat_attr_t *, hashes_t *, bool *,
+                   dev_t, ino_t) NONNULL(1,2,3) WUNRES;
+void cacheseal_put(stat_attr_t *, hashes_t *, bool) NONNULL(1,2);
+void cacheseal_stats(lrucache_stat_t *) NONNULL(1);
+
+#endif
+
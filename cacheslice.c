@@ -0,0 +1,143 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "cacheslice.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <pthread.h>
+
+/*
+ * Cache next to the hashes cache, keyed by the file hashes of an image,
+ * mapping to the hash of the slice of the universal binary that the host
+ * runs natively, or to the fact that the image is not a universal binary or
+ * has no such slice.  Keying by content instead of by inode covers all
+ * copies of a binary and never needs invalidation.
+ */
+
+typedef struct {
+	hashes_t hashes;                /* key */
+	hashes_slice_t slice;
+	bool found;                     /* false if not universal */
+
+	lrucache_node_t node;
+} cacheslice_obj_t;
+
+static void
+cacheslice_obj_free(void *vobj) {
+	free(vobj);
+}
+
+static lrucache_t lrucache;
+static pthread_mutex_t mutex;
+static bool enabled = false;
+
+/*
+ * The cache starts out with `buckets' buckets and uses the replacement policy
+ * given by LRUCACHE_FLAG_* `policy'.  A size of 0 disables the cache.
+ */
+void
+cacheslice_init(size_t buckets, int policy) {
+	if (buckets == 0)
+		return;
+	pthread_mutex_init(&mutex, NULL);
+	lrucache_init(&lrucache, buckets, sizeof(cacheslice_obj_t),
+	              sizeof(hashes_t), sizeof(hashes_t), 0, policy,
+	              lrucache_hash_digest, cacheslice_obj_free);
+	enabled = true;
+}
+
+void
+cacheslice_fini(void) {
+	if (!enabled)
+		return;
+	lrucache_destroy(&lrucache);
+	pthread_mutex_destroy(&mutex);
+	enabled = false;
+}
+
+/*
+ * Drop all cached entries, for shedding memory.  Thread-safe.
+ */
+void
+cacheslice_flush(void) {
+	if (!enabled)
+		return;
+	pthread_mutex_lock(&mutex);
+	lrucache_flush(&lrucache);
+	pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * Look up the slice for an image with file hashes `hashes'.  On hits, sets
+ * `found' to whether the image has a slice for the host and if so, fills in
+ * `slice'.
+ */
+bool
+cacheslice_get(hashes_t *hashes, hashes_slice_t *slice, bool *found) {
+	cacheslice_obj_t *obj;
+
+	assert(hashes);
+	assert(slice);
+	assert(found);
+
+	if (!enabled)
+		return false;
+	pthread_mutex_lock(&mutex);
+	obj = lrucache_get(&lrucache, hashes);
+	if (!obj) {
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+	*found = obj->found;
+	if (obj->found)
+		memcpy(slice, &obj->slice, sizeof(hashes_slice_t));
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+/*
+ * Store the slice for an image with file hashes `hashes', NULL if the image
+ * has no slice for the host.
+ */
+void
+cacheslice_put(hashes_t *hashes, hashes_slice_t *slice) {
+	cacheslice_obj_t *obj;
+
+	assert(hashes);
+
+	if (!enabled)
+		return;
+	obj = malloc(sizeof(cacheslice_obj_t));
+	if (!obj)
+		return;
+	bzero(obj, sizeof(cacheslice_obj_t));
+	memcpy(&obj->hashes, hashes, sizeof(hashes_t));
+	if (slice) {
+		memcpy(&obj->slice, slice, sizeof(hashes_slice_t));
+		obj->found = true;
+	}
+	pthread_mutex_lock(&mutex);
+	lrucache_put(&lrucache, &obj->node, obj);
+	pthread_mutex_unlock(&mutex);
+}
+
+void
+cacheslice_stats(lrucache_stat_t *st) {
+	if (!enabled) {
+		bzero(st, sizeof(lrucache_stat_t));
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	lrucache_stats(&lrucache, st);
+	pthread_mutex_unlock(&mutex);
+}
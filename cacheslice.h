@@ -0,0 +1,30 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef CACHESLICE_H
+#define CACHESLICE_H
+
+#include "lrucache.h"
+#include "hashes.h"
+#include "attrib.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+void cacheslice_init(size_t, int);
+void cacheslice_fini(void);
+void cacheslice_flush(void);
+bool cacheslice_get(hashes_t *, hashes_slice_t *, bool *)
+     NONNULL(1,2,3) WUNRES;
+void cacheslice_put(hashes_t *, hashes_slice_t *) NONNULL(1);
+void cacheslice_stats(lrucache_stat_t *) NONNULL(1);
+
+#endif
+
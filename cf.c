@@ -166,6 +166,50 @@ cf_dictionary1(CFTypeRef key, CFTypeRef value) {
 	                          &kCFTypeDictionaryValueCallBacks);
 }
 
+/*
+ * Returns the dictionary plist parsed from data, or NULL if data is not a
+ * plist or its root is not a dictionary.
+ */
+static CFPropertyListRef
+cf_plist_from_data(CFDataRef data) {
+	CFPropertyListRef plist;
+	CFErrorRef error = NULL;
+
+	plist = CFPropertyListCreateWithData(kCFAllocatorDefault,
+	                                     data,
+	                                     kCFPropertyListImmutable,
+	                                     NULL,
+	                                     &error);
+	if (error)
+		CFRelease(error);
+	if (!plist)
+		return NULL;
+
+	if (CFGetTypeID(plist) != CFDictionaryGetTypeID()) {
+		CFRelease(plist);
+		return NULL;
+	}
+	return plist;
+}
+
+/*
+ * Like cf_plist_load, but parses the sz bytes at buf instead of reading a
+ * file.  The bytes are not copied.
+ */
+CFPropertyListRef
+cf_plist_parse(const unsigned char *buf, size_t sz) {
+	CFDataRef data;
+	CFPropertyListRef plist;
+
+	data = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, buf,
+	                                   (CFIndex)sz, kCFAllocatorNull);
+	if (!data)
+		return NULL;
+	plist = cf_plist_from_data(data);
+	CFRelease(data);
+	return plist;
+}
+
 /*
  * FIXME CFURLCreateDataAndPropertiesFromResource() is deprecated and should
  * be replaced by the more convoluted CFURLCopyResourcePropertiesForKeys().
@@ -177,7 +221,6 @@ cf_plist_load(const char *path) {
 	CFURLRef url;
 	CFDataRef data;
 	CFPropertyListRef plist;
-	CFErrorRef error = NULL;
 	SInt32 errcode;
 	Boolean ok;
 
@@ -199,21 +242,8 @@ cf_plist_load(const char *path) {
 	if (!ok)
 		return NULL;
 
-	plist = CFPropertyListCreateWithData(kCFAllocatorDefault,
-	                                     data,
-	                                     kCFPropertyListImmutable,
-	                                     NULL,
-	                                     &error);
+	plist = cf_plist_from_data(data);
 	CFRelease(data);
-	if (error)
-		CFRelease(error);
-	if (!plist)
-		return NULL;
-
-	if (CFGetTypeID(plist) != CFDictionaryGetTypeID()) {
-		CFRelease(plist);
-		return NULL;
-	}
 	return plist;
 }
 
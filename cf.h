@@ -31,6 +31,8 @@ CFNumberRef cf_number(int64_t) MALLOC;
 CFURLRef cf_url(const char *) MALLOC NONNULL(1);
 CFDictionaryRef cf_dictionary1(CFTypeRef, CFTypeRef) MALLOC NONNULL(1,2);
 CFPropertyListRef cf_plist_load(const char *) MALLOC;
+CFPropertyListRef cf_plist_parse(const unsigned char *, size_t)
+                  MALLOC NONNULL(1);
 
 #endif
 
@@ -11,40 +11,319 @@
 /*
  * Simple code signature extraction utility that uses the xnumon code signature
  * code to acquire code signature metadata from either a process or a path.
+ *
+ * In batch mode (-b), walks the given directory trees, hashes and evaluates
+ * the code signatures of all Mach-O files found using a pool of threads and
+ * writes the results to the persistent hash and code signature caches in
+ * the cache directory of the xnumon configuration, so that xnumon starts
+ * with a warm cache on freshly installed systems.  Since the hash cache is
+ * keyed by device and inode, this must run on the system that xnumon will
+ * be monitoring.
  */
 
 #include "codesign.h"
+#include "hashes.h"
+#include "cachehash.h"
+#include "cachecsig.h"
+#include "cachebundle.h"
+#include "config.h"
+#include "queue.h"
+#include "counter.h"
+#include "sys.h"
+#include "time.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <fts.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <mach-o/loader.h>
+#include <mach-o/fat.h>
 #ifndef __BSD__
 #include <getopt.h>
 #endif /* !__BSD__ */
 
+#define BATCH_THREADS_MAX       64
+#define BATCH_QUEUE             1024
+
+static config_t *batch_cfg;
+static queue_t batch_queue;
+static char batch_stop[1];              /* sentinel, one per thread */
+static counter_t batch_files;
+static counter_t batch_macho;
+static counter_t batch_bytes;
+static counter_t batch_good;
+static counter_t batch_notgood;
+static counter_t batch_failed;
+
 static void
 fusage(FILE *f, const char *argv0) {
 	fprintf(f,
 "Usage: %s [-v] <path>\n"
 "       %s [-v] <pid>\n"
+"       %s [-v] -b [-c config] [-o dir] [-j threads] <dir> [...]\n"
 "       %s -h\n"
 " -v             verbose: print diagnostic messages\n"
+" -b             batch mode: populate xnumon's persistent caches with all\n"
+"                Mach-O files found in the given directory trees\n"
+" -c config      batch mode: use hashes and caches of config\n"
+" -o dir         batch mode: write caches to dir instead of cache_directory\n"
+" -j threads     batch mode: evaluate using threads threads (default: #cpus)\n"
 " -h             print usage and exit\n"
-, argv0, argv0, argv0);
+, argv0, argv0, argv0, argv0);
+}
+
+static bool
+batch_is_macho(int fd) {
+	uint32_t magic;
+
+	if (pread(fd, &magic, sizeof(magic), 0) != sizeof(magic))
+		return false;
+	switch (magic) {
+	case MH_MAGIC:
+	case MH_CIGAM:
+	case MH_MAGIC_64:
+	case MH_CIGAM_64:
+	case FAT_MAGIC:
+	case FAT_CIGAM:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool
+batch_same_file(const stat_attr_t *a, const stat_attr_t *b) {
+	return a->size == b->size &&
+	       a->mtime.tv_sec == b->mtime.tv_sec &&
+	       a->mtime.tv_nsec == b->mtime.tv_nsec &&
+	       a->ctime.tv_sec == b->ctime.tv_sec &&
+	       a->ctime.tv_nsec == b->ctime.tv_nsec &&
+	       a->btime.tv_sec == b->btime.tv_sec &&
+	       a->btime.tv_nsec == b->btime.tv_nsec;
+}
+
+/*
+ * Hash and evaluate the file at path and put the results into the caches,
+ * the same way as procmon and cspool do for executed images.
+ */
+static void
+batch_check(const char *path) {
+	stat_attr_t st1, st2;
+	hashes_t hashes;
+	codesign_t *cs;
+	off_t sz;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		counter_inc(&batch_failed);
+		return;
+	}
+	if (!batch_is_macho(fd)) {
+		close(fd);
+		return;
+	}
+	counter_inc(&batch_macho);
+	if (sys_fdattr(&st1, fd) == -1 ||
+	    hashes_fd(&sz, &hashes, batch_cfg->hflags, fd, NULL) == -1 ||
+	    sz != st1.size ||
+	    sys_fdattr(&st2, fd) == -1 ||
+	    !batch_same_file(&st1, &st2)) {
+		close(fd);
+		counter_inc(&batch_failed);
+		return;
+	}
+	close(fd);
+	counter_add(&batch_bytes, (uint64_t)sz);
+	cachehash_put(st1.dev, st1.ino, &st1.mtime, &st1.ctime, &st1.btime,
+	              &hashes);
+
+	cs = codesign_new(path, -1);
+	if (!cs) {
+		counter_inc(&batch_failed);
+		return;
+	}
+	if (batch_cfg->debug)
+		fprintf(stderr, "%s: %s\n", path, codesign_result_s(cs));
+	if (cs->result == CODESIGN_RESULT_ERROR) {
+		counter_inc(&batch_failed);
+	} else {
+		if (codesign_is_good(cs))
+			counter_inc(&batch_good);
+		else
+			counter_inc(&batch_notgood);
+		cachecsig_put(&hashes, cs, path);
+	}
+	codesign_free(cs);
+}
+
+static void *
+batch_thread(UNUSED void *arg) {
+	char *path;
+
+	while ((path = queue_dequeue(&batch_queue)) != batch_stop) {
+		batch_check(path);
+		free(path);
+	}
+	return NULL;
+}
+
+/*
+ * The directory walk itself only touches metadata and is done on the main
+ * thread; the threads do the hashing and code signature evaluation, which
+ * dominate the cost by far.
+ */
+static int
+batch(config_t *cfg, const char *outdir, long threads, char *dirs[]) {
+	pthread_t thr[BATCH_THREADS_MAX];
+	char hcpath[PATH_MAX], ccpath[PATH_MAX];
+	uint64_t t0, nsec;
+	FTS *tree;
+	FTSENT *node;
+	char *path;
+	double secs;
+	long i;
+	int rv = 0;
+
+	if (!outdir)
+		outdir = cfg->cache_directory;
+	if (!outdir) {
+		fprintf(stderr, "No cache_directory configured and no -o\n");
+		return -1;
+	}
+	if (snprintf(hcpath, sizeof(hcpath), "%s/hashes.cache",
+	             outdir) >= (int)sizeof(hcpath) ||
+	    snprintf(ccpath, sizeof(ccpath), "%s/codesign.cache",
+	             outdir) >= (int)sizeof(ccpath)) {
+		fprintf(stderr, "Cache directory path too long\n");
+		return -1;
+	}
+
+	batch_cfg = cfg;
+	hashes_init(cfg->hash_chunk_size, cfg->hash_parallel, cfg->hash_mmap,
+	            cfg->hash_nocache_threshold);
+	/* existing cache files are loaded and extended */
+	cachehash_init(hcpath, cfg->hflags, cfg->cache_hashes_size,
+	               cfg->cache_hashes_policy);
+	cachecsig_init(ccpath, cfg->hflags, cfg->cache_codesign_size,
+	               cfg->cache_codesign_policy);
+	cachebundle_init(cfg->cache_bundle_size, cfg->cache_codesign_policy);
+	if (queue_init(&batch_queue, BATCH_QUEUE, QUEUE_BLOCK, NULL) == -1) {
+		fprintf(stderr, "Failed to initialize queue\n");
+		rv = -1;
+		goto out;
+	}
+	counter_reset(&batch_files);
+	counter_reset(&batch_macho);
+	counter_reset(&batch_bytes);
+	counter_reset(&batch_good);
+	counter_reset(&batch_notgood);
+	counter_reset(&batch_failed);
+
+	t0 = timespec_mononsec();
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&thr[i], NULL, batch_thread, NULL) != 0) {
+			fprintf(stderr, "Failed to create thread\n");
+			threads = i;
+			rv = -1;
+			goto join;
+		}
+	}
+
+	tree = fts_open(dirs, FTS_NOCHDIR|FTS_PHYSICAL, NULL);
+	if (!tree) {
+		fprintf(stderr, "fts_open(): %s (%i)\n",
+		                strerror(errno), errno);
+		rv = -1;
+		goto join;
+	}
+	while ((node = fts_read(tree))) {
+		if (node->fts_info != FTS_F ||
+		    node->fts_statp->st_size < (off_t)sizeof(uint32_t))
+			continue;
+		counter_inc(&batch_files);
+		path = strdup(node->fts_path);
+		if (!path) {
+			counter_inc(&batch_failed);
+			continue;
+		}
+		queue_enqueue_wait(&batch_queue, path);
+	}
+	fts_close(tree);
+
+join:
+	for (i = 0; i < threads; i++)
+		queue_enqueue_wait(&batch_queue, batch_stop);
+	for (i = 0; i < threads; i++)
+		pthread_join(thr[i], NULL);
+	nsec = timespec_mononsec() - t0;
+	queue_destroy(&batch_queue);
+
+	if (cachehash_save() == -1 || cachecsig_save() == -1) {
+		fprintf(stderr, "Failed to save caches to %s: %s (%i)\n",
+		                outdir, strerror(errno), errno);
+		rv = -1;
+	}
+
+	secs = (double)nsec / 1000000000.0;
+	if (secs <= 0.0)
+		secs = 1e-9;
+	printf("files=%"PRIu64" macho=%"PRIu64" good=%"PRIu64" "
+	       "notgood=%"PRIu64" failed=%"PRIu64" bytes=%"PRIu64" "
+	       "threads=%ld\n",
+	       counter_get(&batch_files), counter_get(&batch_macho),
+	       counter_get(&batch_good), counter_get(&batch_notgood),
+	       counter_get(&batch_failed), counter_get(&batch_bytes),
+	       threads);
+	printf("elapsed=%.3fs files/s=%.1f macho/s=%.1f MB/s=%.1f\n",
+	       secs,
+	       (double)counter_get(&batch_files) / secs,
+	       (double)counter_get(&batch_macho) / secs,
+	       (double)counter_get(&batch_bytes) / secs / 1000000.0);
+out:
+	cachebundle_fini();
+	cachecsig_fini();
+	cachehash_fini();
+	return rv;
 }
 
 int
 main(int argc, char *argv[]) {
 	int ch;
 	config_t cfg;
+	bool batchmode = false;
+	const char *cfgpath = NULL;
+	const char *outdir = NULL;
+	long threads = 0;
 
 	bzero(&cfg, sizeof(config_t));
-	while ((ch = getopt(argc, argv, "vh")) != -1) {
+	while ((ch = getopt(argc, argv, "vbc:o:j:h")) != -1) {
 		switch (ch) {
 			case 'v':
 				cfg.debug = true;
 				break;
+			case 'b':
+				batchmode = true;
+				break;
+			case 'c':
+				cfgpath = optarg;
+				break;
+			case 'o':
+				outdir = optarg;
+				break;
+			case 'j':
+				threads = atol(optarg);
+				break;
 			case 'h':
 				fusage(stdout, argv[0]);
 				exit(EXIT_SUCCESS);
@@ -55,6 +334,45 @@ main(int argc, char *argv[]) {
 				exit(EXIT_FAILURE);
 		}
 	}
+	if (batchmode) {
+		config_t *bcfg;
+		int rv;
+
+		if (argc < optind + 1) {
+			fusage(stderr, argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		if (threads < 0 || threads > BATCH_THREADS_MAX) {
+			fprintf(stderr, "threads must be between 1 and %i\n",
+			                BATCH_THREADS_MAX);
+			exit(EXIT_FAILURE);
+		}
+		bcfg = config_new(cfgpath);
+		if (!bcfg) {
+			fprintf(stderr, "Failed to load configuration\n");
+			exit(EXIT_FAILURE);
+		}
+		bcfg->debug = cfg.debug;
+		if (threads == 0) {
+			threads = sysconf(_SC_NPROCESSORS_ONLN);
+			if (threads < 1)
+				threads = 1;
+			if (threads > BATCH_THREADS_MAX)
+				threads = BATCH_THREADS_MAX;
+		}
+		if (codesign_init(bcfg) != 0) {
+			fprintf(stderr, "Failed to initialize codesign "
+			                "module\n");
+			codesign_fini();
+			config_free(bcfg);
+			exit(EXIT_FAILURE);
+		}
+		rv = batch(bcfg, outdir, threads, argv + optind);
+		codesign_fini();
+		config_free(bcfg);
+		exit(rv == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
 	if (argc != optind + 1) {
 		fusage(stderr, argv[0]);
 		exit(EXIT_FAILURE);
@@ -10,14 +10,24 @@
 
 #include "codesign.h"
 
+#include "cachebundle.h"
+#include "cachecdhash.h"
 #include "cf.h"
 #include "debug.h"
+#include "intern.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <mach-o/loader.h>
+#include <mach-o/fat.h>
 
 #include <CoreFoundation/CoreFoundation.h>
 #include <Security/Security.h>
+#include <CommonCrypto/CommonDigest.h>
 
 /* CarbonCore MacErrors.h */
 #ifndef kPOSIXErrorESRCH
@@ -25,6 +35,7 @@
 #endif
 
 static config_t *config;
+static atomic64_t codesigns;            /* live code signatures */
 
 typedef struct {
 	int origin;
@@ -39,6 +50,77 @@ origin_req_tuple_t reqs[] = {
 	{CODESIGN_ORIGIN_TRUSTED_CA, NULL},
 };
 
+#define REQS (sizeof(reqs)/sizeof(origin_req_tuple_t))
+
+/*
+ * Single-pass origin classification.  Once a signature passed the full
+ * validity check against its designated requirement, its certificate chain
+ * is known to be valid, and the origin can be derived from the chain and
+ * the certificate fields the requirements in reqs look at, instead of
+ * checking the requirements one by one, each of which repeats much of the
+ * validation.  The digests of the Apple root and of the intermediate
+ * issuing Apple's own code signing certificates are taken from a reference
+ * binary satisfying anchor apple at init time instead of being hard coded.
+ * If the reference is unavailable, the requirements are checked in order.
+ * With codesign_verify_origin, the requirements are checked in order and
+ * the classification is only compared against them.
+ */
+#define CODESIGN_REFPATH        "/sbin/launchd"
+#define OID_MAC_APP_STORE       CFSTR("1.2.840.113635.100.6.1.9")
+#define OID_DEVELOPER_ID_CA     CFSTR("1.2.840.113635.100.6.2.6")
+#define OID_DEVELOPER_ID_LEAF   CFSTR("1.2.840.113635.100.6.1.13")
+
+static bool classify;
+static unsigned char appleroot[CC_SHA256_DIGEST_LENGTH];
+static unsigned char appleca[CC_SHA256_DIGEST_LENGTH];
+
+static int codesign_cert_digest(unsigned char *, CFArrayRef, CFIndex);
+
+/*
+ * Learn the Apple root and code signing intermediate from the reference
+ * binary.  Failure only disables the single-pass classification.
+ */
+static void
+codesign_classify_init(void) {
+	SecStaticCodeRef scode = NULL;
+	CFDictionaryRef dict = NULL;
+	CFArrayRef chain;
+	CFURLRef url;
+	CFIndex n;
+
+	classify = false;
+	url = cf_url(CODESIGN_REFPATH);
+	if (!url)
+		return;
+	if (SecStaticCodeCreateWithPath(url, kSecCSDefaultFlags,
+	                                &scode) != errSecSuccess) {
+		CFRelease(url);
+		return;
+	}
+	CFRelease(url);
+	if (SecStaticCodeCheckValidity(scode,
+	                               kSecCSDefaultFlags|
+	                               kSecCSDoNotValidateResources,
+	                               reqs[0].req) != errSecSuccess ||
+	    SecCodeCopySigningInformation(scode, kSecCSSigningInformation,
+	                                  &dict) != errSecSuccess || !dict)
+		goto out;
+	chain = CFDictionaryGetValue(dict, kSecCodeInfoCertificates);
+	if (!chain || !cf_is_array(chain) || (n = CFArrayGetCount(chain)) < 3)
+		goto out;
+	if (codesign_cert_digest(appleroot, chain, n - 1) == -1 ||
+	    codesign_cert_digest(appleca, chain, 1) == -1)
+		goto out;
+	classify = true;
+out:
+	DEBUG(config->debug && !classify, "codesign_error",
+	      "No reference chain from %s, checking requirements in order",
+	      CODESIGN_REFPATH);
+	if (dict)
+		CFRelease(dict);
+	CFRelease(scode);
+}
+
 #define CREATE_REQ(REQ, REQSTR) \
 { \
 	REQ = NULL; \
@@ -57,8 +139,9 @@ codesign_init(config_t *cfg) {
 	/*
 	 * Order needs to match the order of the origin values in reqs above;
 	 * should be most specific first.  Will be tested from top to bottom
-	 * until the first fulfilled requirement.  Current list obtained from
-	 * 10.11.6 El Capitan using `spctl --list --type execute`.
+	 * until the first fulfilled requirement where the certificate chain
+	 * is not conclusive.  Current list obtained from 10.11.6 El Capitan
+	 * using `spctl --list --type execute`.
 	 */
 	CREATE_REQ(reqs[0].req, "anchor apple");
 	CREATE_REQ(reqs[1].req, "anchor apple generic and "
@@ -68,12 +151,14 @@ codesign_init(config_t *cfg) {
 		"certificate leaf[field.1.2.840.113635.100.6.1.13] exists");
 	CREATE_REQ(reqs[3].req, "anchor apple generic");
 	CREATE_REQ(reqs[4].req, "anchor trusted");
+	codesign_classify_init();
 	return 0;
 }
 
 void
 codesign_fini() {
-	for (size_t i = 0; i < sizeof(reqs)/sizeof(origin_req_tuple_t); i++) {
+	classify = false;
+	for (size_t i = 0; i < REQS; i++) {
 		if (reqs[i].req) {
 			CFRelease(reqs[i].req);
 			reqs[i].req = NULL;
@@ -84,56 +169,269 @@ codesign_fini() {
 
 #undef CREATE_REQ
 
+/*
+ * Allocate a code signature holding a single reference, for constructing
+ * it before it is shared.
+ */
+codesign_t *
+codesign_alloc(void) {
+	codesign_t *cs;
+
+	cs = malloc(sizeof(codesign_t));
+	if (!cs)
+		return NULL;
+	bzero(cs, sizeof(codesign_t));
+	cs->refs = 1;
+	atomic64_fast_inc(&codesigns);
+	return cs;
+}
+
+/*
+ * Take another reference to cs.  New references are only ever taken from an
+ * existing one, so the increment needs no ordering with respect to other
+ * memory accesses.
+ */
+codesign_t *
+codesign_ref(codesign_t *cs) {
+	atomic32_fast_inc(&cs->refs);
+	return cs;
+}
+
+/*
+ * Release a reference to cs, freeing it with the last one.
+ */
 void
 codesign_free(codesign_t *cs) {
+	if (!atomic32_dec_test0(&cs->refs))
+		return;
 	if (cs->cdhash)
 		free(cs->cdhash);
 	if (cs->ident)
-		free(cs->ident);
+		intern_free(cs->ident);
 	if (cs->teamid)
-		free(cs->teamid);
+		intern_free(cs->teamid);
 	if (cs->certcn)
-		free(cs->certcn);
+		intern_free(cs->certcn);
 	free(cs);
+	atomic64_fast_dec(&codesigns);
 }
 
-codesign_t *
-codesign_dup(const codesign_t *other) {
-	codesign_t *cs;
+/*
+ * Live code signatures and an estimate of their bytes, assuming a cdhash of
+ * the usual size and not counting the interned strings.  Thread-safe.
+ */
+void
+codesign_stats(codesign_stat_t *st) {
+	st->objects = atomic64_load(&codesigns);
+	st->bytes = st->objects * (sizeof(codesign_t) + CDHASHSZ);
+}
 
-	cs = malloc(sizeof(codesign_t));
-	if (!cs)
-		return NULL;
-	bzero(cs, sizeof(codesign_t));
+static bool
+codesign_str_equal(const char *a, const char *b) {
+	if (!a || !b)
+		return a == b;
+	return a == b || !strcmp(a, b);
+}
 
-	cs->result = other->result;
-	cs->origin = other->origin;
-	if (other->ident) {
-		cs->ident = strdup(other->ident);
-		if (!cs->ident)
-			goto errout;
+/*
+ * Returns true iff both code signatures would be logged identically.
+ */
+bool
+codesign_equal(const codesign_t *a, const codesign_t *b) {
+	return a->result == b->result &&
+	       a->origin == b->origin &&
+	       a->cdhashsz == b->cdhashsz &&
+	       (a->cdhashsz == 0 ||
+	        !memcmp(a->cdhash, b->cdhash, a->cdhashsz)) &&
+	       codesign_str_equal(a->ident, b->ident) &&
+	       codesign_str_equal(a->teamid, b->teamid) &&
+	       codesign_str_equal(a->certcn, b->certcn);
+}
+
+/*
+ * Calculate the digest over the DER encoded certificates of the chain in the
+ * signing information dict.  Returns -1 if there is no chain, such as for
+ * ad-hoc signatures.
+ */
+static int
+codesign_chain_digest(unsigned char *digest, CFDictionaryRef dict) {
+	CC_SHA256_CTX ctx;
+	CFIndex n;
+
+	CFArrayRef chain = CFDictionaryGetValue(dict,
+	                                        kSecCodeInfoCertificates);
+	if (!chain || !cf_is_array(chain) || (n = CFArrayGetCount(chain)) < 1)
+		return -1;
+	CC_SHA256_Init(&ctx);
+	for (CFIndex i = 0; i < n; i++) {
+		SecCertificateRef crt =
+		        (SecCertificateRef)CFArrayGetValueAtIndex(chain, i);
+		if (!crt || !cf_is_cert(crt))
+			return -1;
+		CFDataRef der = SecCertificateCopyData(crt);
+		if (!der)
+			return -1;
+		CC_SHA256_Update(&ctx, CFDataGetBytePtr(der),
+		                 (CC_LONG)CFDataGetLength(der));
+		CFRelease(der);
 	}
-	if (other->cdhash) {
-		cs->cdhashsz = other->cdhashsz;
-		cs->cdhash = malloc(cs->cdhashsz);
-		if (!cs->cdhash)
-			goto errout;
-		memcpy(cs->cdhash, other->cdhash, cs->cdhashsz);
+	CC_SHA256_Final(digest, &ctx);
+	return 0;
+}
+
+/*
+ * Calculate the digest over the DER encoding of certificate i of chain.
+ */
+static int
+codesign_cert_digest(unsigned char *digest, CFArrayRef chain, CFIndex i) {
+	SecCertificateRef crt;
+	CFDataRef der;
+
+	crt = (SecCertificateRef)CFArrayGetValueAtIndex(chain, i);
+	if (!crt || !cf_is_cert(crt))
+		return -1;
+	der = SecCertificateCopyData(crt);
+	if (!der)
+		return -1;
+	CC_SHA256(CFDataGetBytePtr(der), (CC_LONG)CFDataGetLength(der), digest);
+	CFRelease(der);
+	return 0;
+}
+
+/*
+ * Returns 1 if certificate i of chain has the extension oid, 0 if not and
+ * -1 on errors.
+ */
+static int
+codesign_cert_has_ext(CFArrayRef chain, CFIndex i, CFStringRef oid) {
+	SecCertificateRef crt;
+	CFDictionaryRef values;
+	CFArrayRef keys;
+	int rv;
+
+	crt = (SecCertificateRef)CFArrayGetValueAtIndex(chain, i);
+	if (!crt || !cf_is_cert(crt))
+		return -1;
+	keys = CFArrayCreate(NULL, (const void **)&oid, 1,
+	                     &kCFTypeArrayCallBacks);
+	if (!keys)
+		return -1;
+	values = SecCertificateCopyValues(crt, keys, NULL);
+	CFRelease(keys);
+	if (!values)
+		return -1;
+	rv = CFDictionaryContainsKey(values, oid) ? 1 : 0;
+	CFRelease(values);
+	return rv;
+}
+
+/*
+ * Check requirement i of reqs with the reduced set of flags; the signature
+ * itself was already fully validated against its designated requirement.
+ */
+static bool
+codesign_check_req(SecStaticCodeRef scode, const char *cpath, size_t i) {
+	SecCSFlags csflags = kSecCSDefaultFlags|
+	                     kSecCSStrictValidate;
+	OSStatus rv;
+
+	if (cpath) {
+		csflags |= kSecCSCheckAllArchitectures|
+		           kSecCSDoNotValidateResources;
+		rv = SecStaticCodeCheckValidity(scode, csflags, reqs[i].req);
+	} else {
+		rv = SecCodeCheckValidity((SecCodeRef)scode, csflags,
+		                          reqs[i].req);
 	}
-	if (other->teamid) {
-		cs->teamid = strdup(other->teamid);
-		if (!cs->teamid)
-			goto errout;
+	return rv == errSecSuccess;
+}
+
+/*
+ * Check the requirements in order until the first fulfilled one.
+ */
+static int
+codesign_origin_reqs(SecStaticCodeRef scode, const char *cpath) {
+	for (size_t i = 0; i < REQS; i++) {
+		if (codesign_check_req(scode, cpath, i))
+			return reqs[i].origin;
 	}
-	if (other->certcn) {
-		cs->certcn = strdup(other->certcn);
-		if (!cs->certcn)
-			goto errout;
+	return CODESIGN_ORIGIN_NONE;
+}
+
+/*
+ * Classify the origin from the certificate chain of a validated signature,
+ * checking at most one requirement where the chain alone is not conclusive.
+ * Returns -1 if the chain could not be inspected.
+ */
+static int
+codesign_origin_chain(SecStaticCodeRef scode, const char *cpath,
+                      CFDictionaryRef dict) {
+	unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+	CFArrayRef chain;
+	CFIndex n;
+	int rv;
+
+	chain = CFDictionaryGetValue(dict, kSecCodeInfoCertificates);
+	if (!chain)
+		return CODESIGN_ORIGIN_NONE; /* ad-hoc signature */
+	if (!cf_is_array(chain))
+		return -1;
+	n = CFArrayGetCount(chain);
+	if (n < 1)
+		return CODESIGN_ORIGIN_NONE;
+	if (codesign_cert_digest(digest, chain, n - 1) == -1)
+		return -1;
+	if (memcmp(digest, appleroot, sizeof(digest)) != 0) {
+		/* only anchor trusted remains */
+		return codesign_check_req(scode, cpath, REQS - 1)
+		       ? reqs[REQS - 1].origin : CODESIGN_ORIGIN_NONE;
 	}
-	return cs;
-errout:
-	codesign_free(cs);
-	return NULL;
+	/* anchor apple generic is fulfilled from here on */
+	if (n >= 3) {
+		if (codesign_cert_digest(digest, chain, 1) == -1)
+			return -1;
+		if (memcmp(digest, appleca, sizeof(digest)) == 0)
+			return CODESIGN_ORIGIN_APPLE_SYSTEM;
+	}
+	rv = codesign_cert_has_ext(chain, 0, OID_MAC_APP_STORE);
+	if (rv == -1)
+		return -1;
+	if (rv == 1)
+		return CODESIGN_ORIGIN_MAC_APP_STORE;
+	if (n >= 2) {
+		rv = codesign_cert_has_ext(chain, 1, OID_DEVELOPER_ID_CA);
+		if (rv == 1)
+			rv = codesign_cert_has_ext(chain, 0,
+			                           OID_DEVELOPER_ID_LEAF);
+		if (rv == -1)
+			return -1;
+		if (rv == 1)
+			return CODESIGN_ORIGIN_DEVELOPER_ID;
+	}
+	/* anchor apple with an unexpected intermediate, or generic */
+	return codesign_check_req(scode, cpath, 0)
+	       ? reqs[0].origin : CODESIGN_ORIGIN_APPLE_GENERIC;
+}
+
+static int
+codesign_origin(SecStaticCodeRef scode, const char *cpath,
+                CFDictionaryRef dict) {
+	int origin, chained;
+
+	if (!classify)
+		return codesign_origin_reqs(scode, cpath);
+	if (!config->codesign_verify_origin) {
+		origin = codesign_origin_chain(scode, cpath, dict);
+		if (origin == -1)
+			origin = codesign_origin_reqs(scode, cpath);
+		return origin;
+	}
+	origin = codesign_origin_reqs(scode, cpath);
+	chained = codesign_origin_chain(scode, cpath, dict);
+	DEBUG(config->debug && chained != origin, "codesign_mismatch",
+	      "%s: origin %i from requirements, %i from chain",
+	      cpath ? cpath : "pid", origin, chained);
+	return origin;
 }
 
 /*
@@ -157,10 +455,9 @@ codesign_new(const char *cpath, pid_t pid) {
 
 	assert((cpath && pid == (pid_t)-1) || (!cpath && pid != (pid_t)-1));
 
-	cs = malloc(sizeof(codesign_t));
+	cs = codesign_alloc();
 	if (!cs)
 		goto enomemout;
-	bzero(cs, sizeof(codesign_t));
 
 	SecStaticCodeRef scode = NULL;
 	if (cpath) {
@@ -285,28 +582,19 @@ codesign_new(const char *cpath, pid_t pid) {
 		return cs;
 	}
 
-	/* reduced set of flags, we are only checking requirements here */
-	csflags = kSecCSDefaultFlags|
-	          kSecCSStrictValidate;
-	if (cpath)
-		csflags |= kSecCSCheckAllArchitectures|
-		           kSecCSDoNotValidateResources;
-	for (size_t i = 0; i < sizeof(reqs)/sizeof(origin_req_tuple_t); i++) {
-		if (cpath)
-			rv = SecStaticCodeCheckValidity(scode,
-			                                csflags,
-			                                reqs[i].req);
-		else
-			rv = SecCodeCheckValidity((SecCodeRef)scode,
-			                          csflags,
-			                          reqs[i].req);
-		if (rv == errSecSuccess) {
-			cs->origin = reqs[i].origin;
-			break;
-		}
-	}
+	/* the origin only depends on the certificate chain, reuse it for
+	 * images in a bundle already seen with the same chain */
+	cachebundle_key_t bkey;
+	bool bundled = cpath && cachebundle_enabled() &&
+	               cachebundle_key(&bkey, cpath) == 0 &&
+	               codesign_chain_digest(bkey.chain, dict) == 0;
+	bool cached = bundled &&
+	              cachebundle_get(&bkey, &cs->origin, &cs->certcn);
+
+	if (!cached)
+		cs->origin = codesign_origin(scode, cpath, dict);
 	CFRelease(scode);
-	if (rv != errSecSuccess) {
+	if (cs->origin == CODESIGN_ORIGIN_NONE) {
 		/* signature is okay, but none of the requirements match;
 		 * either the signature is from a self-signed certificate, a
 		 * certificate issued by an untrusted CA, or it is an ad-hoc
@@ -335,7 +623,7 @@ codesign_new(const char *cpath, pid_t pid) {
 	/* extract ident */
 	CFStringRef ident = CFDictionaryGetValue(dict, kSecCodeInfoIdentifier);
 	if (ident && cf_is_string(ident)) {
-		cs->ident = cf_cstr(ident);
+		cs->ident = intern_take(cf_cstr(ident));
 		if (!cs->ident) {
 			CFRelease(dict);
 			goto enomemout;
@@ -346,7 +634,7 @@ codesign_new(const char *cpath, pid_t pid) {
 	CFStringRef teamid = CFDictionaryGetValue(dict,
 	                                          kSecCodeInfoTeamIdentifier);
 	if (teamid && cf_is_string(teamid)) {
-		cs->teamid = cf_cstr(teamid);
+		cs->teamid = intern_take(cf_cstr(teamid));
 		if (!cs->teamid) {
 			CFRelease(dict);
 			goto enomemout;
@@ -354,7 +642,8 @@ codesign_new(const char *cpath, pid_t pid) {
 	}
 
 	/* skip certificate CN extraction where it holds no interesting data */
-	if (cs->origin == CODESIGN_ORIGIN_APPLE_SYSTEM ||
+	if (cached ||
+	    cs->origin == CODESIGN_ORIGIN_APPLE_SYSTEM ||
 	    cs->origin == CODESIGN_ORIGIN_MAC_APP_STORE)
 		goto out;
 
@@ -370,7 +659,7 @@ codesign_new(const char *cpath, pid_t pid) {
 				CFRelease(dict);
 				goto enomemout;
 			}
-			cs->certcn = cf_cstr(s);
+			cs->certcn = intern_take(cf_cstr(s));
 			CFRelease(s);
 			if (!cs->certcn) {
 				CFRelease(dict);
@@ -380,6 +669,8 @@ codesign_new(const char *cpath, pid_t pid) {
 	}
 
 out:
+	if (bundled && !cached)
+		cachebundle_put(&bkey, cs->origin, cs->certcn);
 	CFRelease(dict);
 	return cs;
 
@@ -391,6 +682,112 @@ errout:
 	return NULL;
 }
 
+#define CODESIGN_FAT_ARCHS_MAX  30
+#define CODESIGN_LOADCMDS_MAX   (1024*1024)
+
+/*
+ * Returns 1 if the Mach-O image at offset off of the file open at fd has an
+ * LC_CODE_SIGNATURE load command, 0 if it has none, and -1 if there is no
+ * Mach-O image at off or it cannot be read.
+ */
+static int
+codesign_present_macho(int fd, off_t off) {
+	struct mach_header_64 mh;
+	struct load_command lc;
+	unsigned char *buf;
+	size_t hdrsz, pos;
+	int rv = 0;
+
+	if (pread(fd, &mh, sizeof(mh), off) != sizeof(mh))
+		return -1;
+	if (mh.magic == MH_MAGIC)
+		hdrsz = sizeof(struct mach_header);
+	else if (mh.magic == MH_MAGIC_64)
+		hdrsz = sizeof(struct mach_header_64);
+	else
+		return -1;
+	if (mh.sizeofcmds > CODESIGN_LOADCMDS_MAX)
+		return -1;
+	buf = malloc(mh.sizeofcmds);
+	if (!buf)
+		return -1;
+	if (pread(fd, buf, mh.sizeofcmds, off + (off_t)hdrsz) !=
+	    (ssize_t)mh.sizeofcmds) {
+		free(buf);
+		return -1;
+	}
+	pos = 0;
+	for (uint32_t i = 0; i < mh.ncmds; i++) {
+		if (pos + sizeof(lc) > mh.sizeofcmds) {
+			rv = -1;
+			break;
+		}
+		memcpy(&lc, buf + pos, sizeof(lc));
+		if (lc.cmd == LC_CODE_SIGNATURE) {
+			rv = 1;
+			break;
+		}
+		if (lc.cmdsize < sizeof(lc)) {
+			rv = -1;
+			break;
+		}
+		pos += lc.cmdsize;
+	}
+	free(buf);
+	return rv;
+}
+
+/*
+ * Cheap check for an embedded code signature in the executable open at fd,
+ * reading only the Mach-O headers and load commands and not validating the
+ * signature in any way.  Returns 1 if the file, or any of the slices of a
+ * universal binary, has an LC_CODE_SIGNATURE load command, 0 if none has,
+ * and -1 if the file is not a Mach-O file or cannot be read.  A result of 0
+ * means that full verification would find the file to be unsigned.
+ */
+int
+codesign_present(int fd) {
+	unsigned char hdr[sizeof(struct fat_header) +
+	                  CODESIGN_FAT_ARCHS_MAX * sizeof(struct fat_arch_64)];
+	struct fat_header fh;
+	struct fat_arch fa;
+	struct fat_arch_64 fa64;
+	size_t entsz;
+	ssize_t n;
+	off_t off;
+	int rv;
+
+	n = pread(fd, hdr, sizeof(hdr), 0);
+	if (n < (ssize_t)sizeof(fh))
+		return -1;
+	memcpy(&fh, hdr, sizeof(fh));
+	fh.magic = ntohl(fh.magic);
+	fh.nfat_arch = ntohl(fh.nfat_arch);
+	if (fh.magic == FAT_MAGIC)
+		entsz = sizeof(fa);
+	else if (fh.magic == FAT_MAGIC_64)
+		entsz = sizeof(fa64);
+	else
+		return codesign_present_macho(fd, 0);
+	if (fh.nfat_arch == 0 || fh.nfat_arch > CODESIGN_FAT_ARCHS_MAX ||
+	    sizeof(fh) + fh.nfat_arch * entsz > (size_t)n)
+		return -1;
+	for (uint32_t i = 0; i < fh.nfat_arch; i++) {
+		if (fh.magic == FAT_MAGIC) {
+			memcpy(&fa, hdr + sizeof(fh) + i * entsz, sizeof(fa));
+			off = (off_t)ntohl(fa.offset);
+		} else {
+			memcpy(&fa64, hdr + sizeof(fh) + i * entsz,
+			       sizeof(fa64));
+			off = (off_t)ntohll(fa64.offset);
+		}
+		rv = codesign_present_macho(fd, off);
+		if (rv != 0)
+			return rv;
+	}
+	return 0;
+}
+
 const char *
 codesign_result_s(codesign_t *cs) {
 	switch (cs->result) {
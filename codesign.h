@@ -12,13 +12,21 @@
 #define CODESIGN_H
 
 #include "config.h"
+#include "atomic.h"
 #include "attrib.h"
 
 #include <sys/types.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
 
+/*
+ * Code signatures are immutable once constructed and shared by reference
+ * between the caches and the images using them; see codesign_ref and
+ * codesign_free.
+ */
 typedef struct {
+	atomic32_t refs;
 	int result;
 #define CODESIGN_RESULT_NONE          0
 #define CODESIGN_RESULT_UNSIGNED      1 /* no signature */
@@ -35,19 +43,27 @@ typedef struct {
 #define CODESIGN_ORIGIN_TRUSTED_CA    5
 	unsigned char *cdhash;
 	size_t cdhashsz;
-	char *ident;
-	char *teamid;
-	char *certcn;
+	char *ident;                    /* interned */
+	char *teamid;                   /* interned */
+	char *certcn;                   /* interned */
 } codesign_t;
 
+typedef struct {
+	uint64_t objects;
+	uint64_t bytes;                 /* estimated */
+} codesign_stat_t;
+
 #define codesign_is_good(CS) \
 	((CS)->result == CODESIGN_RESULT_GOOD)
 #define codesign_is_apple_system(CS) \
 	((CS)->origin == CODESIGN_ORIGIN_APPLE_SYSTEM)
 
 codesign_t * codesign_new(const char *, pid_t) MALLOC;
-codesign_t * codesign_dup(const codesign_t *) MALLOC NONNULL(1);
+codesign_t * codesign_alloc(void) MALLOC;
+codesign_t * codesign_ref(codesign_t *) NONNULL(1);
+bool codesign_equal(const codesign_t *, const codesign_t *) NONNULL(1,2);
 void codesign_free(codesign_t *) NONNULL(1);
+int codesign_present(int) WUNRES;
 
 const char * codesign_result_s(codesign_t *) NONNULL(1);
 const char * codesign_origin_s(codesign_t *) NONNULL(1);
@@ -55,6 +71,7 @@ void codesign_fprint(FILE *, codesign_t *) NONNULL(1,2);
 
 int codesign_init(config_t *) WUNRES NONNULL(1);
 void codesign_fini(void);
+void codesign_stats(codesign_stat_t *) NONNULL(1);
 
 #endif
 
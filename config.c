@@ -14,6 +14,14 @@
 #include "cf.h"
 #include "sys.h"
 #include "memstream.h"
+#include "cachehash.h"
+#include "cachecsig.h"
+#include "cacheldpl.h"
+#include "cachebundle.h"
+#include "cacheseal.h"
+#include "fleetcache.h"
+#include "evtidx.h"
+#include "policy.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -51,7 +59,7 @@ select_file(const char *path1, const char *path2, const char *path3) {
 /*
  * Parse a string of comma-separated eventcodes into a bitmask of events.
  */
-static int
+int
 config_parse_events(const char *spec) {
 	const char *p;
 	size_t sz;
@@ -160,6 +168,311 @@ config_str(config_t *cfg, const char *key, const char *value) {
 		return 0;
 	}
 
+	if (!strcmp(key, "worker_threads")) {
+		cfg->worker_threads = atoi(value);
+		if (cfg->worker_threads < 1 ||
+		    cfg->worker_threads > WORKER_THREADS_MAX)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "worker_threads_max")) {
+		cfg->worker_threads_max = atoi(value);
+		if (cfg->worker_threads_max > WORKER_THREADS_MAX)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "worker_lag_target")) {
+		cfg->worker_lag_target = atoi(value);
+		if (cfg->worker_lag_target < 1)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "bulk_threads")) {
+		cfg->bulk_threads = atoi(value);
+		if (cfg->bulk_threads > BULK_THREADS_MAX)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "priority_events")) {
+		if (value[0] == '\0') {
+			cfg->priority_events = 0;
+			return 0;
+		}
+		cfg->priority_events = config_parse_events(value);
+		return cfg->priority_events == -1 ? -1 : 0;
+	}
+
+	if (!strcmp(key, "enrich_threads")) {
+		cfg->enrich_threads = atoi(value);
+		if (cfg->enrich_threads > ENRICH_THREADS_MAX)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "qos_evtloop")) {
+		cfg->qos_evtloop = policy_qos(value);
+		return cfg->qos_evtloop == -1 ? -1 : 0;
+	}
+
+	if (!strcmp(key, "qos_kextloop")) {
+		cfg->qos_kextloop = policy_qos(value);
+		return cfg->qos_kextloop == -1 ? -1 : 0;
+	}
+
+	if (!strcmp(key, "qos_work")) {
+		cfg->qos_work = policy_qos(value);
+		return cfg->qos_work == -1 ? -1 : 0;
+	}
+
+	if (!strcmp(key, "qos_bulk")) {
+		cfg->qos_bulk = policy_qos(value);
+		return cfg->qos_bulk == -1 ? -1 : 0;
+	}
+
+	if (!strcmp(key, "qos_log")) {
+		cfg->qos_log = policy_qos(value);
+		return cfg->qos_log == -1 ? -1 : 0;
+	}
+
+	if (!strcmp(key, "codesign_threads")) {
+		cfg->codesign_threads = atoi(value);
+		if (cfg->codesign_threads > CODESIGN_THREADS_MAX)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "codesign_overlap")) {
+		if (config_set_bool(&cfg->codesign_overlap, value) == -1)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "codesign_verify_origin")) {
+		if (config_set_bool(&cfg->codesign_verify_origin, value) == -1)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "codesign_helpers")) {
+		if (config_set_bool(&cfg->codesign_helpers, value) == -1)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "codesign_helper_timeout")) {
+		cfg->codesign_helper_timeout = atoi(value);
+		if (cfg->codesign_helper_timeout == 0)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "codesign_refresh_interval")) {
+		cfg->codesign_refresh_interval = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "codesign_refresh_count")) {
+		cfg->codesign_refresh_count = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "bulk_threshold")) {
+		cfg->bulk_threshold = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "auditpipe_qlimit")) {
+		if (!strcmp(value, "auto"))
+			cfg->auditpipe_qlimit = AUPIPE_QLIMIT_AUTO;
+		else if (!strcmp(value, "max"))
+			cfg->auditpipe_qlimit = AUPIPE_QLIMIT_MAX;
+		else {
+			cfg->auditpipe_qlimit = atoi(value);
+			if (cfg->auditpipe_qlimit < 1)
+				return -1;
+		}
+		return 0;
+	}
+
+	if (!strcmp(key, "auditpipe_lean_auids")) {
+		uint32_t auids[AUPIPE_LEAN_MAX];
+		if (aupipe_parse_auids(auids, AUPIPE_LEAN_MAX, value) == -1)
+			return -1;
+		if (cfg->auditpipe_lean_auids)
+			free(cfg->auditpipe_lean_auids);
+		cfg->auditpipe_lean_auids = strdup(value);
+		return cfg->auditpipe_lean_auids == NULL ? -1 : 0;
+	}
+
+	if (!strcmp(key, "governor_rate")) {
+		cfg->governor_rate = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "governor_burst")) {
+		cfg->governor_burst = atoi(value);
+		if (cfg->governor_burst < 1 ||
+		    cfg->governor_burst > GOVERNOR_BURST_MAX)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "governor_interval")) {
+		cfg->governor_interval = atoi(value);
+		if (cfg->governor_interval < 1)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "degrade")) {
+		if (config_set_bool(&cfg->degrade, value) == -1)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "degrade_queue")) {
+		cfg->degrade_queue = atoi(value);
+		if (cfg->degrade_queue < 1 || cfg->degrade_queue > 100)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "degrade_cpu")) {
+		cfg->degrade_cpu = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "degrade_ancestors")) {
+		cfg->degrade_ancestors = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "memory_budget")) {
+		cfg->memory_budget = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "queue_capacity")) {
+		cfg->queue_capacity = atoi(value);
+		if (cfg->queue_capacity < 2 ||
+		    cfg->queue_capacity > QUEUE_CAPACITY_MAX)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "queue_overflow"))
+		return config_queue_overflow(cfg, value);
+
+	if (!strcmp(key, "cache_directory")) {
+		if (cfg->cache_directory)
+			free(cfg->cache_directory);
+		cfg->cache_directory = strdup(value);
+		return cfg->cache_directory == NULL ? -1 : 0;
+	}
+
+	if (!strcmp(key, "cache_save_interval")) {
+		cfg->cache_save_interval = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "cache_hashes_size")) {
+		cfg->cache_hashes_size = atoi(value);
+		return cfg->cache_hashes_size == 0 ? -1 : 0;
+	}
+
+	if (!strcmp(key, "cache_codesign_size")) {
+		cfg->cache_codesign_size = atoi(value);
+		return cfg->cache_codesign_size == 0 ? -1 : 0;
+	}
+
+	if (!strcmp(key, "cache_ldpl_size")) {
+		cfg->cache_ldpl_size = atoi(value);
+		return cfg->cache_ldpl_size == 0 ? -1 : 0;
+	}
+
+	if (!strcmp(key, "cache_cdhash_size")) {
+		cfg->cache_cdhash_size = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "cache_fingerprint_size")) {
+		cfg->cache_fingerprint_size = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "cache_bundle_size")) {
+		cfg->cache_bundle_size = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "cache_sealed_size")) {
+		cfg->cache_sealed_size = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "cache_fleet_socket")) {
+		if (cfg->cache_fleet_socket)
+			free(cfg->cache_fleet_socket);
+		cfg->cache_fleet_socket = strdup(value);
+		return cfg->cache_fleet_socket == NULL ? -1 : 0;
+	}
+
+	if (!strcmp(key, "cache_fleet_timeout")) {
+		cfg->cache_fleet_timeout = atoi(value);
+		return (cfg->cache_fleet_timeout == 0 ||
+		        cfg->cache_fleet_timeout > FLEETCACHE_TIMEOUT_MAX)
+		       ? -1 : 0;
+	}
+
+	if (!strcmp(key, "cache_hashes_policy")) {
+		cfg->cache_hashes_policy = lrucache_policy(value);
+		return cfg->cache_hashes_policy == -1 ? -1 : 0;
+	}
+
+	if (!strcmp(key, "cache_codesign_policy")) {
+		cfg->cache_codesign_policy = lrucache_policy(value);
+		return cfg->cache_codesign_policy == -1 ? -1 : 0;
+	}
+
+	if (!strcmp(key, "cache_ldpl_policy")) {
+		cfg->cache_ldpl_policy = lrucache_policy(value);
+		return cfg->cache_ldpl_policy == -1 ? -1 : 0;
+	}
+
+	if (!strcmp(key, "cache_memory_budget")) {
+		cfg->cache_memory_budget = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "trace_record")) {
+		if (cfg->trace_record)
+			free(cfg->trace_record);
+		cfg->trace_record = strdup(value);
+		return cfg->trace_record == NULL ? -1 : 0;
+	}
+
+	if (!strcmp(key, "trace_replay")) {
+		if (cfg->trace_replay)
+			free(cfg->trace_replay);
+		cfg->trace_replay = strdup(value);
+		return cfg->trace_replay == NULL ? -1 : 0;
+	}
+
+	if (!strcmp(key, "trace_replay_speed")) {
+		cfg->trace_replay_speed = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "trace_replay_lookups")) {
+		if (config_set_bool(&cfg->trace_replay_lookups, value) == -1)
+			return -1;
+		return 0;
+	}
+
 	if (!strcmp(key, "events")) {
 		cfg->events = config_parse_events(value);
 		return cfg->events == -1 ? -1 : 0;
@@ -170,14 +483,104 @@ config_str(config_t *cfg, const char *key, const char *value) {
 		return 0;
 	}
 
+	if (!strcmp(key, "metrics_socket")) {
+		if (cfg->metrics_socket)
+			free(cfg->metrics_socket);
+		cfg->metrics_socket = strdup(value);
+		return cfg->metrics_socket == NULL ? -1 : 0;
+	}
+
+	if (!strcmp(key, "query_socket")) {
+		if (cfg->query_socket)
+			free(cfg->query_socket);
+		cfg->query_socket = strdup(value);
+		return cfg->query_socket == NULL ? -1 : 0;
+	}
+
+	if (!strcmp(key, "query_index_size")) {
+		cfg->query_index_size = atoi(value);
+		return cfg->query_index_size == 0 ? -1 : 0;
+	}
+
+	if (!strcmp(key, "latency_sample")) {
+		cfg->latency_sample = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "profile_duration")) {
+		int i = atoi(value);
+		if (i < 1 || i > PROFILE_DURATION_MAX)
+			return -1;
+		cfg->profile_duration = (size_t)i;
+		return 0;
+	}
+
 	if (!strcmp(key, "kextlevel"))
 		return config_kextlevel(cfg, value);
 
+	if (!strcmp(key, "kext_hash_max")) {
+		int i = atoi(value);
+		if (i < 0)
+			return -1;
+		cfg->kext_hash_max = (uint32_t)i;
+		return 0;
+	}
+
+	if (!strcmp(key, "kext_backlog_watermark")) {
+		int i = atoi(value);
+		if (i < 0)
+			return -1;
+		cfg->kext_backlog_watermark = (uint32_t)i;
+		return 0;
+	}
+
+	if (!strcmp(key, "kext_threads")) {
+		int i = atoi(value);
+		if (i < 0 || i > KEXT_THREADS_MAX)
+			return -1;
+		cfg->kext_threads = (size_t)i;
+		return 0;
+	}
+
 	if (!strcmp(key, "hashes")) {
 		cfg->hflags = hashes_parse(value);
 		return cfg->hflags == -1 ? -1 : 0;
 	}
 
+	if (!strcmp(key, "hash_chunk_size")) {
+		cfg->hash_chunk_size = atoi(value);
+		if (cfg->hash_chunk_size < HASHES_CHUNKSZ_MIN ||
+		    cfg->hash_chunk_size > HASHES_CHUNKSZ_MAX)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "hash_parallel")) {
+		if (config_set_bool(&cfg->hash_parallel, value) == -1)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "hash_mmap")) {
+		if (config_set_bool(&cfg->hash_mmap, value) == -1)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "hash_slice")) {
+		if (config_set_bool(&cfg->hash_slice, value) == -1)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "hash_nocache_threshold")) {
+		int i = atoi(value);
+		if (i < 0)
+			return -1;
+		cfg->hash_nocache_threshold = (size_t)i;
+		return 0;
+	}
+
 	if (!strcmp(key, "codesign")) {
 		if (config_set_bool(&cfg->codesign, value) == -1)
 			return -1;
@@ -241,6 +644,27 @@ config_str(config_t *cfg, const char *key, const char *value) {
 		return 0;
 	}
 
+	if (!strcmp(key, "ancestor_ids")) {
+		if (config_set_bool(&cfg->ancestor_ids, value) == -1)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "socket_connect_window")) {
+		cfg->socket_connect_window = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "socket_accept_window")) {
+		cfg->socket_accept_window = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "process_access_window")) {
+		cfg->process_access_window = atoi(value);
+		return 0;
+	}
+
 	if (!strcmp(key, "ancestors")) {
 		if (!strcmp(value, "unlimited"))
 			cfg->ancestors = SIZE_MAX;
@@ -249,6 +673,22 @@ config_str(config_t *cfg, const char *key, const char *value) {
 		return 0;
 	}
 
+	if (!strcmp(key, "ancestor_argv")) {
+		if (!strcmp(value, "unlimited"))
+			cfg->ancestor_argv = SIZE_MAX;
+		else
+			cfg->ancestor_argv = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "ancestor_argv_bytes")) {
+		int i = atoi(value);
+		if (i < 0)
+			return -1;
+		cfg->ancestor_argv_bytes = i;
+		return 0;
+	}
+
 	if (!strcmp(key, "debug")) {
 		if (config_set_bool(&cfg->debug, value) == -1)
 			return -1;
@@ -267,6 +707,76 @@ config_str(config_t *cfg, const char *key, const char *value) {
 		return 0;
 	}
 
+	if (!strcmp(key, "log_flush_deadline")) {
+		cfg->log_flush_deadline = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "log_compression")) {
+		if (!strcmp(value, "none"))
+			cfg->log_compress = false;
+		else if (!strcmp(value, "gzip"))
+			cfg->log_compress = true;
+		else
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "log_file_coalesce")) {
+		cfg->log_file_coalesce = atoi(value);
+		return cfg->log_file_coalesce > LOG_FILE_COALESCE_MAX ? -1 : 0;
+	}
+
+	if (!strcmp(key, "log_file_interval")) {
+		cfg->log_file_interval = atoi(value);
+		return cfg->log_file_interval == 0 ? -1 : 0;
+	}
+
+	if (!strcmp(key, "log_file_sync"))
+		return config_log_file_sync(cfg, value);
+
+	if (!strcmp(key, "log_stdout_buffer")) {
+		cfg->log_stdout_buffer = atoi(value);
+		return cfg->log_stdout_buffer > LOG_STDOUT_BUFFER_MAX ? -1 : 0;
+	}
+
+	if (!strcmp(key, "log_stdout_interval")) {
+		cfg->log_stdout_interval = atoi(value);
+		return cfg->log_stdout_interval == 0 ? -1 : 0;
+	}
+
+	if (!strcmp(key, "log_fanout")) {
+		if (log_fanout_parse(cfg, value) == -1)
+			return -1;
+		return 0;
+	}
+
+	if (!strcmp(key, "log_spool_memory")) {
+		cfg->log_spool_memory = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "log_spool_file")) {
+		if (cfg->log_spool_file)
+			free(cfg->log_spool_file);
+		cfg->log_spool_file = strdup(value);
+		return cfg->log_spool_file == NULL ? -1 : 0;
+	}
+
+	if (!strcmp(key, "log_spool_size")) {
+		cfg->log_spool_size = atoi(value);
+		return 0;
+	}
+
+	if (!strcmp(key, "log_shm_size")) {
+		cfg->log_shm_size = atoi(value);
+		if (cfg->log_shm_size < LOG_SHM_SIZE_MIN ||
+		    cfg->log_shm_size > LOG_SHM_SIZE_MAX ||
+		    (cfg->log_shm_size & (cfg->log_shm_size - 1)))
+			return -1;
+		return 0;
+	}
+
 	if (!strcmp(key, "log_mode")) {
 		if (!strcmp(value, "oneline"))
 			cfg->logoneline = 1;
@@ -284,6 +794,21 @@ config_str(config_t *cfg, const char *key, const char *value) {
 		return 0;
 	}
 
+	if (!strcmp(key, "preload_rate")) {
+		int i = atoi(value);
+		if (i < 0)
+			return -1;
+		cfg->preload_rate = i;
+		return 0;
+	}
+
+	if (!strcmp(key, "suppress_image_exec_lean")) {
+		if (config_set_bool(&cfg->suppress_image_exec_lean,
+		                    value) == -1)
+			return -1;
+		return 0;
+	}
+
 	if (!strcmp(key, "suppress_socket_op_localhost")) {
 		if (config_set_bool(&cfg->suppress_socket_op_localhost,
 		                    value) == -1)
@@ -338,6 +863,38 @@ config_bool_from_plist(config_t *cfg, const char *optname,
 	return 0;
 }
 
+/*
+ * Like config_str_from_plist, but for keys that take an array of strings,
+ * each of which is passed to config_str in turn.
+ */
+static int
+config_strv_from_plist(config_t *cfg, const char *optname,
+                       CFPropertyListRef plist, CFStringRef key) {
+	CFArrayRef arr;
+	CFIndex arrsz;
+	char **v;
+	int rv = 0;
+
+	arr = CFDictionaryGetValue((CFDictionaryRef)plist, key);
+	if (!arr)
+		return 0;
+	if (!cf_is_array(arr))
+		return -1;
+	arrsz = CFArrayGetCount(arr);
+	if (arrsz == 0)
+		return 0;
+	v = cf_cstrv(arr);
+	if (!v)
+		return -1;
+	for (CFIndex i = 0; i < arrsz; i++) {
+		if (rv == 0 && config_str(cfg, optname, v[i]) == -1)
+			rv = -1;
+		free(v[i]);
+	}
+	free(v);
+	return rv;
+}
+
 static int
 config_setstr_from_plist(setstr_t *set,
                          CFPropertyListRef plist, CFStringRef key) {
@@ -359,11 +916,50 @@ config_setstr_from_plist(setstr_t *set,
 	return setstr_init(set, arrsz, v);
 }
 
+/*
+ * Like config_setstr_from_plist, but for the suppression sets, which are
+ * allocated separately such that config_apply() can replace them.
+ */
+static int
+config_setstrp_from_plist(setstr_t *_Atomic *setp,
+                          CFPropertyListRef plist, CFStringRef key) {
+	setstr_t *set;
+
+	set = malloc(sizeof(setstr_t));
+	if (!set)
+		return -1;
+	bzero(set, sizeof(setstr_t));
+	if (config_setstr_from_plist(set, plist, key) == -1) {
+		free(set);
+		return -1;
+	}
+	atomic_store(setp, set);
+	return 0;
+}
+
+static void
+config_setstr_free(setstr_t *set) {
+	if (!set)
+		return;
+	setstr_destroy(set);
+	free(set);
+}
+
+static void
+config_setstrp_free(setstr_t *_Atomic *setp) {
+	config_setstr_free(atomic_exchange(setp, NULL));
+}
+
 #define CONFIG_STR_FROM_PLIST(RV, CFG, PLIST, KEY) \
 	if ((RV = config_str_from_plist(CFG, KEY, PLIST, CFSTR(KEY))) == -1) { \
 		fprintf(stderr, "Failed to load '" KEY "'\n"); \
 		goto errout; \
 	}
+#define CONFIG_STRV_FROM_PLIST(RV, CFG, PLIST, KEY) \
+	if ((RV = config_strv_from_plist(CFG, KEY, PLIST, CFSTR(KEY))) == -1) {\
+		fprintf(stderr, "Failed to load '" KEY "'\n"); \
+		goto errout; \
+	}
 #define CONFIG_BOOL_FROM_PLIST(RV, CFG, PLIST, KEY) \
 	if ((RV = config_bool_from_plist(CFG, KEY, PLIST, CFSTR(KEY))) == -1) {\
 		fprintf(stderr, "Failed to load '" KEY "'\n"); \
@@ -375,6 +971,12 @@ config_setstr_from_plist(setstr_t *set,
 		fprintf(stderr, "Failed to load '" #KEY "'\n"); \
 		goto errout; \
 	}
+#define CONFIG_SETSTRP_FROM_PLIST(RV, CFG, PLIST, KEY) \
+	if ((rv = config_setstrp_from_plist(&CFG->KEY, PLIST, \
+	                                    CFSTR(#KEY))) == -1) { \
+		fprintf(stderr, "Failed to load '" #KEY "'\n"); \
+		goto errout; \
+	}
 
 config_t *
 config_new(const char *cfgpath) {
@@ -391,17 +993,76 @@ config_new(const char *cfgpath) {
 
 	/* set defaults that differ from all zeroes */
 	cfg->limit_nofile = 8192;
+	cfg->worker_threads = 1;
+	cfg->worker_threads_max = 0;
+	cfg->worker_lag_target = 500;
+	cfg->bulk_threads = 1;
+	cfg->codesign_threads = 1;
+	cfg->enrich_threads = 0;
+	cfg->qos_evtloop = POLICY_QOS_DEFAULT;
+	cfg->qos_kextloop = POLICY_QOS_DEFAULT;
+	cfg->qos_work = POLICY_QOS_DEFAULT;
+	cfg->qos_bulk = POLICY_QOS_DEFAULT;
+	cfg->qos_log = POLICY_QOS_DEFAULT;
+	cfg->codesign_helper_timeout = 30;
+	cfg->codesign_refresh_interval = 3600;
+	cfg->codesign_refresh_count = 32;
+	cfg->bulk_threshold = 1024*1024*8;
+	cfg->auditpipe_qlimit = AUPIPE_QLIMIT_MAX;
+	cfg->governor_rate = 0;
+	cfg->governor_burst = 100;
+	cfg->governor_interval = 60;
+	cfg->degrade_queue = 50;
+	cfg->degrade_ancestors = 1;
+	cfg->memory_budget = 0;
+	cfg->queue_capacity = 32768;
+	cfg->queue_overflow = QUEUE_BLOCK;
+	cfg->cache_save_interval = 900;
+	cfg->cache_hashes_size = CACHEHASH_BUCKETS;
+	cfg->cache_codesign_size = CACHECSIG_BUCKETS;
+	cfg->cache_ldpl_size = CACHELDPL_BUCKETS;
+	cfg->cache_bundle_size = CACHEBUNDLE_BUCKETS;
+	cfg->cache_sealed_size = CACHESEAL_BUCKETS;
+	cfg->cache_fleet_timeout = FLEETCACHE_TIMEOUT;
+	cfg->cache_hashes_policy = LRUCACHE_FLAG_CLOCK;
+	cfg->cache_memory_budget = 64;
+	cfg->trace_replay_speed = 100;
+	cfg->trace_replay_lookups = true;
 	cfg->events = (1 << LOGEVT_SIZE) - 1;
 	cfg->stats_interval = 3600;
+	cfg->query_index_size = EVTIDX_SIZE;
+	cfg->latency_sample = 0;
+	cfg->profile_duration = 10;
 	cfg->kextlevel = KEXTLEVEL_HASH;
+	cfg->kext_backlog_watermark = 512;
+	cfg->kext_threads = 2;
 	cfg->hflags = HASH_SHA256;
+	cfg->hash_chunk_size = HASHES_CHUNKSZ_DEFAULT;
+	cfg->hash_nocache_threshold = 268435456;
 	cfg->codesign = true;
 	cfg->envlevel = ENVLEVEL_DYLD;
 	cfg->resolve_users_groups = true;
 	cfg->omit_apple_hashes = true;
 	cfg->ancestors = SIZE_MAX;
+	cfg->ancestor_ids = false;
+	cfg->ancestor_argv = SIZE_MAX;
+	cfg->ancestor_argv_bytes = 256;
+	cfg->socket_connect_window = 0;
+	cfg->socket_accept_window = 0;
+	cfg->process_access_window = 0;
 	cfg->logoneline = -1; /* any */
+	cfg->log_flush_deadline = 50;
+	cfg->log_compress = false;
+	cfg->log_file_coalesce = 0;
+	cfg->log_file_interval = 1000;
+	cfg->log_stdout_buffer = 0;
+	cfg->log_stdout_interval = 250;
+	cfg->log_file_sync = LOG_FILE_SYNC_NONE;
+	cfg->log_spool_memory = 16;
+	cfg->log_spool_size = 256;
+	cfg->log_shm_size = 4096;
 	cfg->suppress_image_exec_at_start = true;
+	cfg->preload_rate = 100;
 	cfg->suppress_socket_op_localhost = true;
 	if (logfmt_parse(cfg, "json") == -1) {
 		fprintf(stderr, "Failed to set default logfmt 'json'\n");
@@ -437,8 +1098,28 @@ config_new(const char *cfgpath) {
 	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "log_format");
 	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "log_destination");
 	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "log_mode");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "log_flush_deadline");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "log_compression");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "log_file_coalesce");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "log_file_interval");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "log_stdout_buffer");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "log_stdout_interval");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "log_file_sync");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "log_spool_memory");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "log_spool_file");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "log_spool_size");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "log_shm_size");
+	CONFIG_STRV_FROM_PLIST(rv, cfg, plist, "log_fanout");
 	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "kextlevel");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "kext_hash_max");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "kext_backlog_watermark");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "kext_threads");
 	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "hashes");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "hash_chunk_size");
+	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "hash_parallel");
+	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "hash_mmap");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "hash_nocache_threshold");
+	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "hash_slice");
 	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "codesign");
 	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "envlevel");
 	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "resolve_users_groups");
@@ -451,31 +1132,99 @@ config_new(const char *cfgpath) {
 	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "omit_groups");
 	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "omit_apple_hashes");
 	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "ancestors");
+	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "ancestor_ids");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "ancestor_argv");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "ancestor_argv_bytes");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "socket_connect_window");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "socket_accept_window");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "process_access_window");
 	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "events");
 	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "stats_interval");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "metrics_socket");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "query_socket");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "query_index_size");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "latency_sample");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "profile_duration");
 	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "rlimit_nofile");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "worker_threads");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "worker_threads_max");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "worker_lag_target");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "bulk_threads");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "bulk_threshold");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "priority_events");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "auditpipe_qlimit");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "auditpipe_lean_auids");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "governor_rate");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "governor_burst");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "governor_interval");
+	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "degrade");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "degrade_queue");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "degrade_cpu");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "degrade_ancestors");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "memory_budget");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "codesign_threads");
+	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "codesign_overlap");
+	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "codesign_verify_origin");
+	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "codesign_helpers");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "codesign_helper_timeout");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "enrich_threads");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "qos_evtloop");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "qos_kextloop");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "qos_work");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "qos_bulk");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "qos_log");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "codesign_refresh_interval");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "codesign_refresh_count");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "queue_capacity");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "queue_overflow");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "cache_directory");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "cache_save_interval");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "cache_hashes_size");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "cache_codesign_size");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "cache_cdhash_size");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "cache_fingerprint_size");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "cache_bundle_size");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "cache_sealed_size");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "cache_fleet_socket");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "cache_fleet_timeout");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "cache_ldpl_size");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "cache_hashes_policy");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "cache_codesign_policy");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "cache_ldpl_policy");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "cache_memory_budget");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "trace_record");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "trace_replay");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "trace_replay_speed");
+	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "trace_replay_lookups");
 	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "debug");
 	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "suppress_image_exec_at_start");
+	CONFIG_STR_FROM_PLIST(rv, cfg, plist, "preload_rate");
 	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "suppress_socket_op_localhost");
 
 	/* The setstr initializations must be called even if we were to allow
 	 * xnumon to run without a config file; they handle plist==NULL. */
 	CONFIG_SETSTR_FROM_PLIST(rv, cfg, plist,
-	                         suppress_image_exec_by_ident);
-	CONFIG_SETSTR_FROM_PLIST(rv, cfg, plist,
-	                         suppress_image_exec_by_path);
-	CONFIG_SETSTR_FROM_PLIST(rv, cfg, plist,
-	                         suppress_image_exec_by_ancestor_ident);
-	CONFIG_SETSTR_FROM_PLIST(rv, cfg, plist,
-	                         suppress_image_exec_by_ancestor_path);
-	CONFIG_SETSTR_FROM_PLIST(rv, cfg, plist,
-	                         suppress_process_access_by_subject_ident);
-	CONFIG_SETSTR_FROM_PLIST(rv, cfg, plist,
-	                         suppress_process_access_by_subject_path);
-	CONFIG_SETSTR_FROM_PLIST(rv, cfg, plist,
-	                         suppress_socket_op_by_subject_ident);
-	CONFIG_SETSTR_FROM_PLIST(rv, cfg, plist,
-	                         suppress_socket_op_by_subject_path);
+	                         kext_nowait_by_path);
+	CONFIG_SETSTR_FROM_PLIST(rv, cfg, plist, fstypes_bulk);
+	CONFIG_SETSTR_FROM_PLIST(rv, cfg, plist, fstypes_skip);
+	CONFIG_SETSTR_FROM_PLIST(rv, cfg, plist, codesign_build_dirs);
+	CONFIG_SETSTRP_FROM_PLIST(rv, cfg, plist,
+	                          suppress_image_exec_by_ident);
+	CONFIG_SETSTRP_FROM_PLIST(rv, cfg, plist,
+	                          suppress_image_exec_by_path);
+	CONFIG_BOOL_FROM_PLIST(rv, cfg, plist, "suppress_image_exec_lean");
+	CONFIG_SETSTRP_FROM_PLIST(rv, cfg, plist,
+	                          suppress_image_exec_by_ancestor_ident);
+	CONFIG_SETSTRP_FROM_PLIST(rv, cfg, plist,
+	                          suppress_image_exec_by_ancestor_path);
+	CONFIG_SETSTRP_FROM_PLIST(rv, cfg, plist,
+	                          suppress_process_access_by_subject_ident);
+	CONFIG_SETSTRP_FROM_PLIST(rv, cfg, plist,
+	                          suppress_process_access_by_subject_path);
+	CONFIG_SETSTRP_FROM_PLIST(rv, cfg, plist,
+	                          suppress_socket_op_by_subject_ident);
+	CONFIG_SETSTRP_FROM_PLIST(rv, cfg, plist,
+	                          suppress_socket_op_by_subject_path);
 
 	if (plist)
 		CFRelease(plist);
@@ -492,23 +1241,382 @@ void
 config_free(config_t *cfg) {
 	assert(cfg);
 
-	setstr_destroy(&cfg->suppress_image_exec_by_ident);
-	setstr_destroy(&cfg->suppress_image_exec_by_path);
-	setstr_destroy(&cfg->suppress_image_exec_by_ancestor_ident);
-	setstr_destroy(&cfg->suppress_image_exec_by_ancestor_path);
-	setstr_destroy(&cfg->suppress_process_access_by_subject_ident);
-	setstr_destroy(&cfg->suppress_process_access_by_subject_path);
-	setstr_destroy(&cfg->suppress_socket_op_by_subject_ident);
-	setstr_destroy(&cfg->suppress_socket_op_by_subject_path);
+	setstr_destroy(&cfg->kext_nowait_by_path);
+	setstr_destroy(&cfg->fstypes_bulk);
+	setstr_destroy(&cfg->fstypes_skip);
+	setstr_destroy(&cfg->codesign_build_dirs);
+	config_setstrp_free(&cfg->suppress_image_exec_by_ident);
+	config_setstrp_free(&cfg->suppress_image_exec_by_path);
+	config_setstrp_free(&cfg->suppress_image_exec_by_ancestor_ident);
+	config_setstrp_free(&cfg->suppress_image_exec_by_ancestor_path);
+	config_setstrp_free(&cfg->suppress_process_access_by_subject_ident);
+	config_setstrp_free(&cfg->suppress_process_access_by_subject_path);
+	config_setstrp_free(&cfg->suppress_socket_op_by_subject_ident);
+	config_setstrp_free(&cfg->suppress_socket_op_by_subject_path);
 	if (cfg->path)
 		free(cfg->path);
 	if (cfg->id)
 		free(cfg->id);
 	if (cfg->logfile)
 		free(cfg->logfile);
+	if (cfg->loghost)
+		free(cfg->loghost);
+	if (cfg->log_spool_file)
+		free(cfg->log_spool_file);
+	if (cfg->logshm)
+		free(cfg->logshm);
+	for (size_t i = 0; i < cfg->log_fanouts; i++) {
+		if (cfg->log_fanout_fields[i])
+			free(cfg->log_fanout_fields[i]);
+	}
+	if (cfg->cache_directory)
+		free(cfg->cache_directory);
+	if (cfg->trace_record)
+		free(cfg->trace_record);
+	if (cfg->trace_replay)
+		free(cfg->trace_replay);
+	if (cfg->metrics_socket)
+		free(cfg->metrics_socket);
+	if (cfg->query_socket)
+		free(cfg->query_socket);
+	if (cfg->cache_fleet_socket)
+		free(cfg->cache_fleet_socket);
+	if (cfg->auditpipe_lean_auids)
+		free(cfg->auditpipe_lean_auids);
+	for (size_t i = 0; i < cfg->overridec; i++)
+		free(cfg->overrides[i]);
+	if (cfg->overrides)
+		free(cfg->overrides);
+	for (size_t i = 0; i < cfg->retiredc; i++)
+		config_setstr_free(cfg->retired[i]);
+	if (cfg->retired)
+		free(cfg->retired);
 	free(cfg);
 }
 
+/*
+ * Apply a command line override and remember it, such that config_reload()
+ * can apply it again on top of the reloaded configuration file.
+ */
+int
+config_override(config_t *cfg, const char *key, const char *value) {
+	char **overrides;
+
+	if (config_str(cfg, key, value) == -1)
+		return -1;
+	overrides = realloc(cfg->overrides,
+	                    (cfg->overridec + 2) * sizeof(char *));
+	if (!overrides)
+		return -1;
+	cfg->overrides = overrides;
+	cfg->overrides[cfg->overridec] = strdup(key);
+	if (!cfg->overrides[cfg->overridec])
+		return -1;
+	cfg->overridec++;
+	cfg->overrides[cfg->overridec] = strdup(value);
+	if (!cfg->overrides[cfg->overridec])
+		return -1;
+	cfg->overridec++;
+	return 0;
+}
+
+/*
+ * Load the configuration file of the running configuration cfg again and
+ * apply the same command line overrides.  The result can be compared to
+ * cfg using config_diff().
+ */
+config_t *
+config_reload(config_t *cfg) {
+	config_t *newcfg;
+
+	newcfg = config_new(cfg->path);
+	if (!newcfg)
+		return NULL;
+	newcfg->launchd_mode = cfg->launchd_mode;
+	for (size_t i = 0; i + 1 < cfg->overridec; i += 2) {
+		if (config_override(newcfg, cfg->overrides[i],
+		                    cfg->overrides[i + 1]) == -1) {
+			fprintf(stderr, "Failed to apply override '%s'\n",
+			                cfg->overrides[i]);
+			config_free(newcfg);
+			return NULL;
+		}
+	}
+	return newcfg;
+}
+
+static bool
+config_str_equal(const char *a, const char *b) {
+	if (!a || !b)
+		return a == b;
+	return !strcmp(a, b);
+}
+
+static bool
+config_setstrp_equal(setstr_t *_Atomic *a, setstr_t *_Atomic *b) {
+	return setstr_equal(atomic_load(a), atomic_load(b));
+}
+
+#define CHANGED(F)      (cfg->F != newcfg->F)
+#define CHANGED_STR(F)  (!config_str_equal(cfg->F, newcfg->F))
+#define CHANGED_SET(F)  (!setstr_equal(&cfg->F, &newcfg->F))
+#define CHANGED_SETP(F) (!config_setstrp_equal(&cfg->F, &newcfg->F))
+
+/*
+ * Compare the running configuration cfg to newcfg as returned by
+ * config_reload() and return the CONFIG_CHANGED_* flags of what differs.
+ * Events can only be changed without a restart within mask, the events the
+ * monitors were initialized for.  Any change not covered by the other flags
+ * results in CONFIG_CHANGED_RESTART.
+ */
+int
+config_diff(config_t *cfg, config_t *newcfg, int mask) {
+	int changes = 0;
+
+	if (CHANGED(suppress_image_exec_at_start) ||
+	    CHANGED(suppress_socket_op_localhost) ||
+	    CHANGED(suppress_image_exec_lean) ||
+	    CHANGED_SETP(suppress_image_exec_by_ident) ||
+	    CHANGED_SETP(suppress_image_exec_by_path) ||
+	    CHANGED_SETP(suppress_image_exec_by_ancestor_ident) ||
+	    CHANGED_SETP(suppress_image_exec_by_ancestor_path) ||
+	    CHANGED_SETP(suppress_process_access_by_subject_ident) ||
+	    CHANGED_SETP(suppress_process_access_by_subject_path) ||
+	    CHANGED_SETP(suppress_socket_op_by_subject_ident) ||
+	    CHANGED_SETP(suppress_socket_op_by_subject_path))
+		changes |= CONFIG_CHANGED_SUPPRESS;
+
+	if (CHANGED(events)) {
+		if (newcfg->events & ~mask)
+			changes |= CONFIG_CHANGED_RESTART;
+		else
+			changes |= CONFIG_CHANGED_EVENTS;
+	}
+
+	if (CHANGED_STR(id) ||
+	    CHANGED(logfmt) ||
+	    CHANGED(logoneline) ||
+	    CHANGED(resolve_users_groups) ||
+	    CHANGED(omit_mode) ||
+	    CHANGED(omit_size) ||
+	    CHANGED(omit_mtime) ||
+	    CHANGED(omit_ctime) ||
+	    CHANGED(omit_btime) ||
+	    CHANGED(omit_groups) ||
+	    CHANGED(omit_sid) ||
+	    CHANGED(omit_apple_hashes) ||
+	    CHANGED(ancestor_ids))
+		changes |= CONFIG_CHANGED_LOG;
+
+	if (CHANGED(launchd_mode) ||
+	    CHANGED(debug) ||
+	    CHANGED(stats_interval) ||
+	    CHANGED_STR(metrics_socket) ||
+	    CHANGED_STR(query_socket) ||
+	    CHANGED(query_index_size) ||
+	    CHANGED(latency_sample) ||
+	    CHANGED(profile_duration) ||
+	    CHANGED(limit_nofile) ||
+	    CHANGED(worker_threads) ||
+	    CHANGED(worker_threads_max) ||
+	    CHANGED(worker_lag_target) ||
+	    CHANGED(bulk_threads) ||
+	    CHANGED(bulk_threshold) ||
+	    CHANGED_SET(fstypes_bulk) ||
+	    CHANGED_SET(fstypes_skip) ||
+	    CHANGED(priority_events) ||
+	    CHANGED(queue_capacity) ||
+	    CHANGED(governor_rate) ||
+	    CHANGED(governor_burst) ||
+	    CHANGED(governor_interval) ||
+	    CHANGED(degrade) ||
+	    CHANGED(degrade_queue) ||
+	    CHANGED(degrade_cpu) ||
+	    CHANGED(degrade_ancestors) ||
+	    CHANGED(memory_budget) ||
+	    CHANGED(queue_overflow) ||
+	    CHANGED(auditpipe_qlimit) ||
+	    CHANGED_STR(auditpipe_lean_auids) ||
+	    CHANGED_STR(cache_directory) ||
+	    CHANGED(cache_save_interval) ||
+	    CHANGED(cache_hashes_size) ||
+	    CHANGED(cache_codesign_size) ||
+	    CHANGED(cache_cdhash_size) ||
+	    CHANGED(cache_fingerprint_size) ||
+	    CHANGED(cache_bundle_size) ||
+	    CHANGED(cache_sealed_size) ||
+	    CHANGED_STR(cache_fleet_socket) ||
+	    CHANGED(cache_fleet_timeout) ||
+	    CHANGED(cache_ldpl_size) ||
+	    CHANGED(cache_hashes_policy) ||
+	    CHANGED(cache_codesign_policy) ||
+	    CHANGED(cache_ldpl_policy) ||
+	    CHANGED(cache_memory_budget) ||
+	    CHANGED_STR(trace_record) ||
+	    CHANGED_STR(trace_replay) ||
+	    CHANGED(trace_replay_speed) ||
+	    CHANGED(trace_replay_lookups) ||
+	    CHANGED(kextlevel) ||
+	    CHANGED_SET(kext_nowait_by_path) ||
+	    CHANGED(kext_hash_max) ||
+	    CHANGED(kext_backlog_watermark) ||
+	    CHANGED(kext_threads) ||
+	    CHANGED(hflags) ||
+	    CHANGED(hash_chunk_size) ||
+	    CHANGED(hash_parallel) ||
+	    CHANGED(hash_mmap) ||
+	    CHANGED(hash_nocache_threshold) ||
+	    CHANGED(hash_slice) ||
+	    CHANGED(envlevel) ||
+	    CHANGED(codesign) ||
+	    CHANGED(codesign_threads) ||
+	    CHANGED(codesign_overlap) ||
+	    CHANGED(codesign_verify_origin) ||
+	    CHANGED(codesign_helpers) ||
+	    CHANGED(codesign_helper_timeout) ||
+	    CHANGED_SET(codesign_build_dirs) ||
+	    CHANGED(enrich_threads) ||
+	    CHANGED(qos_evtloop) ||
+	    CHANGED(qos_kextloop) ||
+	    CHANGED(qos_work) ||
+	    CHANGED(qos_bulk) ||
+	    CHANGED(qos_log) ||
+	    CHANGED(codesign_refresh_interval) ||
+	    CHANGED(codesign_refresh_count) ||
+	    CHANGED(ancestors) ||
+	    CHANGED(ancestor_argv) ||
+	    CHANGED(ancestor_argv_bytes) ||
+	    CHANGED(preload_rate) ||
+	    CHANGED(socket_connect_window) ||
+	    CHANGED(socket_accept_window) ||
+	    CHANGED(process_access_window) ||
+	    CHANGED(logdst) ||
+	    CHANGED_STR(logfile) ||
+	    CHANGED(log_flush_deadline) ||
+	    CHANGED(log_compress) ||
+	    CHANGED(log_file_coalesce) ||
+	    CHANGED(log_file_interval) ||
+	    CHANGED(log_stdout_buffer) ||
+	    CHANGED(log_stdout_interval) ||
+	    CHANGED(log_file_sync) ||
+	    CHANGED_STR(loghost) ||
+	    CHANGED(log_spool_memory) ||
+	    CHANGED_STR(log_spool_file) ||
+	    CHANGED(log_spool_size) ||
+	    CHANGED_STR(logshm) ||
+	    CHANGED(log_shm_size) ||
+	    CHANGED(log_fanouts) ||
+	    memcmp(cfg->log_fanout_dst, newcfg->log_fanout_dst,
+	           sizeof(cfg->log_fanout_dst)) ||
+	    memcmp(cfg->log_fanout_fmt, newcfg->log_fanout_fmt,
+	           sizeof(cfg->log_fanout_fmt)) ||
+	    memcmp(cfg->log_fanout_oneline, newcfg->log_fanout_oneline,
+	           sizeof(cfg->log_fanout_oneline)) ||
+	    memcmp(cfg->log_fanout_events, newcfg->log_fanout_events,
+	           sizeof(cfg->log_fanout_events)))
+		changes |= CONFIG_CHANGED_RESTART;
+	for (size_t i = 0; i < LOG_FANOUT_MAX; i++) {
+		if (CHANGED_STR(log_fanout_fields[i]))
+			changes |= CONFIG_CHANGED_RESTART;
+	}
+
+	/* formats shared between fan-out destinations are set up at start */
+	if (cfg->log_fanouts > 0 &&
+	    (CHANGED(logfmt) || CHANGED(logoneline)))
+		changes |= CONFIG_CHANGED_RESTART;
+
+	return changes;
+}
+
+#undef CHANGED
+#undef CHANGED_STR
+#undef CHANGED_SET
+#undef CHANGED_SETP
+
+#define SUPPRESS_SETS 8
+
+/*
+ * Apply the CONFIG_CHANGED_SUPPRESS and CONFIG_CHANGED_EVENTS changes of
+ * newcfg to the running configuration cfg.  Main thread only.
+ *
+ * Workers may still be looking up strings in the replaced suppression sets,
+ * therefore they are retired to cfg instead of being freed, and newcfg's
+ * set pointers are cleared.  Changes cannot fail halfway through; on error,
+ * cfg is left unmodified.
+ */
+int
+config_apply(config_t *cfg, config_t *newcfg, int changes) {
+	setstr_t *_Atomic *sets[SUPPRESS_SETS][2] = {
+		{&cfg->suppress_image_exec_by_ident,
+		 &newcfg->suppress_image_exec_by_ident},
+		{&cfg->suppress_image_exec_by_path,
+		 &newcfg->suppress_image_exec_by_path},
+		{&cfg->suppress_image_exec_by_ancestor_ident,
+		 &newcfg->suppress_image_exec_by_ancestor_ident},
+		{&cfg->suppress_image_exec_by_ancestor_path,
+		 &newcfg->suppress_image_exec_by_ancestor_path},
+		{&cfg->suppress_process_access_by_subject_ident,
+		 &newcfg->suppress_process_access_by_subject_ident},
+		{&cfg->suppress_process_access_by_subject_path,
+		 &newcfg->suppress_process_access_by_subject_path},
+		{&cfg->suppress_socket_op_by_subject_ident,
+		 &newcfg->suppress_socket_op_by_subject_ident},
+		{&cfg->suppress_socket_op_by_subject_path,
+		 &newcfg->suppress_socket_op_by_subject_path},
+	};
+	setstr_t **retired;
+
+	if (changes & CONFIG_CHANGED_SUPPRESS) {
+		retired = realloc(cfg->retired, (cfg->retiredc +
+		                  SUPPRESS_SETS) * sizeof(setstr_t *));
+		if (!retired)
+			return -1;
+		cfg->retired = retired;
+		for (size_t i = 0; i < SUPPRESS_SETS; i++) {
+			cfg->retired[cfg->retiredc++] = atomic_exchange(
+			        sets[i][0], atomic_load(sets[i][1]));
+			atomic_store(sets[i][1], NULL);
+		}
+		cfg->suppress_image_exec_at_start =
+			newcfg->suppress_image_exec_at_start;
+		cfg->suppress_socket_op_localhost =
+			newcfg->suppress_socket_op_localhost;
+		cfg->suppress_image_exec_lean =
+			newcfg->suppress_image_exec_lean;
+	}
+	if (changes & CONFIG_CHANGED_EVENTS)
+		cfg->events = newcfg->events;
+	return 0;
+}
+
+#undef SUPPRESS_SETS
+
+/*
+ * Apply the CONFIG_CHANGED_LOG changes of newcfg to the running
+ * configuration cfg.  Log thread only, between rendering two events; the
+ * caller is responsible for reinitializing the log format.
+ */
+void
+config_apply_log(config_t *cfg, config_t *newcfg) {
+	char *id;
+
+	id = cfg->id;
+	cfg->id = newcfg->id;
+	newcfg->id = id;
+	cfg->logfmt = newcfg->logfmt;
+	cfg->logoneline = newcfg->logoneline;
+	cfg->resolve_users_groups = newcfg->resolve_users_groups;
+	cfg->omit_mode = newcfg->omit_mode;
+	cfg->omit_size = newcfg->omit_size;
+	cfg->omit_mtime = newcfg->omit_mtime;
+	cfg->omit_ctime = newcfg->omit_ctime;
+	cfg->omit_btime = newcfg->omit_btime;
+	cfg->omit_groups = newcfg->omit_groups;
+	cfg->omit_sid = newcfg->omit_sid;
+	cfg->omit_apple_hashes = newcfg->omit_apple_hashes;
+	cfg->ancestor_ids = newcfg->ancestor_ids;
+}
+
 int
 config_kextlevel(config_t *cfg, const char *opt) {
 	assert(opt);
@@ -565,3 +1673,54 @@ config_envlevel_s(config_t *cfg) {
 	return envlevels[cfg->envlevel];
 }
 
+int
+config_queue_overflow(config_t *cfg, const char *opt) {
+	assert(opt);
+
+	if (!strcmp(opt, "block")) {
+		cfg->queue_overflow = QUEUE_BLOCK;
+		return 0;
+	}
+	if (!strcmp(opt, "drop-oldest")) {
+		cfg->queue_overflow = QUEUE_DROP_OLDEST;
+		return 0;
+	}
+	if (!strcmp(opt, "drop-newest")) {
+		cfg->queue_overflow = QUEUE_DROP_NEWEST;
+		return 0;
+	}
+	return -1;
+}
+
+static const char *queue_overflows[] = {"block", "drop-oldest", "drop-newest"};
+
+const char *
+config_queue_overflow_s(config_t *cfg) {
+	return queue_overflows[cfg->queue_overflow];
+}
+
+int
+config_log_file_sync(config_t *cfg, const char *opt) {
+	assert(opt);
+
+	if (!strcmp(opt, "none")) {
+		cfg->log_file_sync = LOG_FILE_SYNC_NONE;
+		return 0;
+	}
+	if (!strcmp(opt, "interval")) {
+		cfg->log_file_sync = LOG_FILE_SYNC_INTERVAL;
+		return 0;
+	}
+	if (!strcmp(opt, "batch")) {
+		cfg->log_file_sync = LOG_FILE_SYNC_BATCH;
+		return 0;
+	}
+	return -1;
+}
+
+static const char *log_file_syncs[] = {"none", "interval", "batch"};
+
+const char *
+config_log_file_sync_s(config_t *cfg) {
+	return log_file_syncs[cfg->log_file_sync];
+}
@@ -13,9 +13,12 @@
 
 #include "hashes.h"
 #include "setstr.h"
+#include "queue.h"
+#include "aupipe.h"
 #include "attrib.h"
 
 #include <stddef.h>
+#include <stdatomic.h>
 
 typedef struct {
 	char *path;
@@ -25,7 +28,64 @@ typedef struct {
 	bool debug;
 
 	size_t stats_interval;  /* generate xnumon-stats every n seconds */
+	char *metrics_socket;   /* serve xnumon-stats on request, NULL not */
+	char *query_socket;     /* serve queries on recent events, NULL not */
+	size_t query_index_size; /* recent events retained for queries */
+	size_t latency_sample;  /* log latency of every nth event, 0 never */
+	size_t profile_duration; /* seconds profiled on SIGUSR2 */
+#define PROFILE_DURATION_MAX 3600
 	size_t limit_nofile;
+	size_t worker_threads;  /* minimum if worker_threads_max is larger */
+#define WORKER_THREADS_MAX 16
+	size_t worker_threads_max; /* 0 for a fixed number of workers */
+	size_t worker_lag_target; /* ms from event to worker */
+	size_t bulk_threads;    /* 0 to process large images in workers */
+#define BULK_THREADS_MAX 4
+	size_t bulk_threshold;  /* images larger than this are bulk work */
+	setstr_t fstypes_bulk;  /* filesystem types whose images are bulk */
+	setstr_t fstypes_skip;  /* filesystem types whose images are unhashed */
+	int priority_events;    /* bit mask of events in priority lane */
+	size_t enrich_threads;  /* 0 to log image-exec in a single phase */
+#define ENRICH_THREADS_MAX 4
+	int qos_evtloop;        /* POLICY_QOS_* see policy.h */
+	int qos_kextloop;
+	int qos_work;
+	int qos_bulk;
+	int qos_log;
+	size_t queue_capacity;  /* work and log queue size */
+	size_t governor_rate;   /* events per second per key, 0 to disable */
+	size_t governor_burst;  /* events per key before rate applies */
+#define GOVERNOR_BURST_MAX 1000000
+	size_t governor_interval; /* summarize suppressed every n seconds */
+	bool degrade;           /* shed work under pressure, see degrade.h */
+	size_t degrade_queue;   /* percent of queue_capacity */
+	size_t degrade_cpu;     /* percent of one cpu, 0 to ignore cpu */
+	size_t degrade_ancestors; /* ancestors logged at DEGRADE_ANCESTORS */
+	size_t memory_budget;   /* MiB footprint to shed at, 0 unbounded */
+	int queue_overflow;
+	/* QUEUE_* see queue.h */
+	unsigned int auditpipe_qlimit;
+	/* AUPIPE_QLIMIT_* see aupipe.h, or a fixed limit */
+	char *auditpipe_lean_auids; /* comma-separated, NULL for none */
+	char *cache_directory;  /* persistent cache files, NULL to disable */
+	size_t cache_save_interval; /* save caches every n seconds */
+	size_t cache_hashes_size;   /* initial buckets per cache */
+	size_t cache_codesign_size;
+	size_t cache_ldpl_size;
+	size_t cache_cdhash_size;   /* 0 disables the cdhash cache */
+	size_t cache_fingerprint_size; /* 0 disables the fingerprint cache */
+	size_t cache_bundle_size;   /* 0 disables the bundle cache */
+	size_t cache_sealed_size;   /* 0 disables the sealed volume cache */
+	char *cache_fleet_socket;   /* fleet cache relay, NULL to disable */
+	size_t cache_fleet_timeout; /* ms */
+	int cache_hashes_policy;    /* LRUCACHE_FLAG_* see lrucache.h */
+	int cache_codesign_policy;
+	int cache_ldpl_policy;
+	size_t cache_memory_budget; /* MiB caches may grow into, 0 fixed */
+	char *trace_record;     /* record input to trace file, NULL to not */
+	char *trace_replay;     /* replay trace file instead of live input */
+	unsigned int trace_replay_speed; /* percent, 0 as fast as possible */
+	bool trace_replay_lookups; /* look up processes and images on replay */
 	int events;             /* bit mask of enabled events */
 
 	int kextlevel;
@@ -33,13 +93,33 @@ typedef struct {
 #define KEXTLEVEL_OPEN 1
 #define KEXTLEVEL_HASH 2
 #define KEXTLEVEL_CSIG 3
+	setstr_t kext_nowait_by_path; /* directories execs need not wait for */
+	uint32_t kext_hash_max; /* bytes up to which the kext hashes, 0 never */
+	uint32_t kext_backlog_watermark; /* stop waiting for ACKs, 0 never */
+	size_t kext_threads;    /* 0 to handle kext messages in kextloop */
+#define KEXT_THREADS_MAX 8
 	int hflags;
 	/* HASH_* see hashes.h */
+	size_t hash_chunk_size; /* bytes per read(2) */
+	bool hash_parallel;     /* one thread per hash algorithm */
+	bool hash_mmap;         /* hash mapped files instead of read(2) */
+	size_t hash_nocache_threshold; /* bytes from which to bypass the
+	                                  buffer cache, 0 never */
+	bool hash_slice;        /* also hash native slice of fat binaries */
 	int envlevel;
 #define ENVLEVEL_NONE 0
 #define ENVLEVEL_DYLD 1
 #define ENVLEVEL_FULL 2
 	bool codesign;
+	size_t codesign_threads; /* 0 to verify in the requesting thread */
+	bool codesign_overlap;  /* verify while hashing */
+	bool codesign_verify_origin; /* check all requirements */
+	bool codesign_helpers;  /* verify in helper processes */
+	size_t codesign_helper_timeout; /* seconds */
+	setstr_t codesign_build_dirs; /* names of build output directories */
+	size_t codesign_refresh_interval; /* seconds, 0 disables */
+	size_t codesign_refresh_count;    /* entries per interval */
+#define CODESIGN_THREADS_MAX 8
 	bool resolve_users_groups;
 
 	bool omit_mode;
@@ -51,34 +131,92 @@ typedef struct {
 	bool omit_sid;
 	bool omit_apple_hashes;
 	size_t ancestors;       /* 0 unlimited, > 0 limited */
+	bool ancestor_ids;      /* reference already logged ancestors by id */
+	size_t ancestor_argv;   /* ancestors keeping argv and env in full */
+	size_t ancestor_argv_bytes; /* argv kept beyond ancestor_argv */
+	size_t socket_connect_window; /* s to fold connects, 0 to disable */
+	size_t socket_accept_window; /* s to fold accepts, 0 to disable */
+	size_t process_access_window; /* s to fold accesses, 0 to disable */
 
 	int logdst;
 	int logfmt;
 	int logoneline;         /* compact one-line log format */
 	char *logfile;
-
+	size_t log_flush_deadline; /* ms */
+	bool log_compress;      /* gzip member per batch */
+	size_t log_file_coalesce; /* KiB, 0 to write every batch */
+#define LOG_FILE_COALESCE_MAX 65536
+	size_t log_file_interval; /* ms */
+	int log_file_sync;
+#define LOG_FILE_SYNC_NONE     0
+#define LOG_FILE_SYNC_INTERVAL 1
+#define LOG_FILE_SYNC_BATCH    2
+	size_t log_stdout_buffer; /* KiB, 0 to use stdio */
+#define LOG_STDOUT_BUFFER_MAX 65536
+	size_t log_stdout_interval; /* ms */
+	char *loghost;          /* host:port for the tcp logdst */
+	size_t log_spool_memory; /* MiB */
+	char *log_spool_file;   /* NULL to disable */
+	size_t log_spool_size;  /* MiB */
+	char *logshm;           /* ring file path for the shm logdst */
+	size_t log_shm_size;    /* KiB, power of two */
+#define LOG_SHM_SIZE_MIN 64
+#define LOG_SHM_SIZE_MAX 1048576
+#define LOG_FANOUT_MAX 4        /* one per logdst driver besides logdst */
+	size_t log_fanouts;     /* additional destinations, see log.c */
+	int log_fanout_dst[LOG_FANOUT_MAX];
+	int log_fanout_fmt[LOG_FANOUT_MAX];
+	int log_fanout_oneline[LOG_FANOUT_MAX]; /* resolved by log_check */
+	int log_fanout_events[LOG_FANOUT_MAX];  /* event mask, 0 for all */
+	char *log_fanout_fields[LOG_FANOUT_MAX]; /* projection, NULL for all */
+
+	/* suppression sets are replaced on reload, see config_apply() */
 	bool suppress_image_exec_at_start;
-	setstr_t suppress_image_exec_by_ident;
-	setstr_t suppress_image_exec_by_path;
-	setstr_t suppress_image_exec_by_ancestor_ident;
-	setstr_t suppress_image_exec_by_ancestor_path;
-	setstr_t suppress_process_access_by_subject_ident;
-	setstr_t suppress_process_access_by_subject_path;
+	size_t preload_rate;    /* startup lane images per second, 0 off */
+	setstr_t *_Atomic suppress_image_exec_by_ident;
+	setstr_t *_Atomic suppress_image_exec_by_path;
+	bool suppress_image_exec_lean; /* skip acquiring suppressed by path */
+	setstr_t *_Atomic suppress_image_exec_by_ancestor_ident;
+	setstr_t *_Atomic suppress_image_exec_by_ancestor_path;
+	setstr_t *_Atomic suppress_process_access_by_subject_ident;
+	setstr_t *_Atomic suppress_process_access_by_subject_path;
 	bool suppress_socket_op_localhost;
-	setstr_t suppress_socket_op_by_subject_ident;
-	setstr_t suppress_socket_op_by_subject_path;
+	setstr_t *_Atomic suppress_socket_op_by_subject_ident;
+	setstr_t *_Atomic suppress_socket_op_by_subject_path;
+
+	char **overrides;       /* key, value pairs from the command line */
+	size_t overridec;
+	setstr_t **retired;     /* replaced sets, freed with the config */
+	size_t retiredc;
 } config_t;
 
+/* changes found by config_diff() */
+#define CONFIG_CHANGED_SUPPRESS 0x01    /* suppression sets and options */
+#define CONFIG_CHANGED_EVENTS   0x02    /* events, within the initial set */
+#define CONFIG_CHANGED_LOG      0x04    /* log format and rendering */
+#define CONFIG_CHANGED_RESTART  0x80    /* anything else, needs restart */
+
 config_t * config_new(const char *) MALLOC;
 void config_free(config_t *) NONNULL(1);
 
 int config_str(config_t *, const char *, const char *) NONNULL(1,2,3) WUNRES;
+int config_override(config_t *, const char *, const char *)
+     NONNULL(1,2,3) WUNRES;
+config_t * config_reload(config_t *) MALLOC NONNULL(1);
+int config_diff(config_t *, config_t *, int) NONNULL(1,2);
+int config_apply(config_t *, config_t *, int) NONNULL(1,2) WUNRES;
+void config_apply_log(config_t *, config_t *) NONNULL(1,2);
 
 int config_kextlevel(config_t *, const char *) NONNULL(1,2);
 const char * config_kextlevel_s(config_t *) NONNULL(1);
 int config_envlevel(config_t *, const char *) NONNULL(1,2);
 const char * config_envlevel_s(config_t *) NONNULL(1);
+int config_queue_overflow(config_t *, const char *) NONNULL(1,2);
+const char * config_queue_overflow_s(config_t *) NONNULL(1);
+int config_log_file_sync(config_t *, const char *) NONNULL(1,2);
+const char * config_log_file_sync_s(config_t *) NONNULL(1);
 
+int config_parse_events(const char *) NONNULL(1) WUNRES;
 char * config_events_s(config_t *) NONNULL(1);
 
 #endif
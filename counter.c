@@ -0,0 +1,52 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "counter.h"
+
+#include <assert.h>
+
+_Thread_local unsigned int counter_tshard;
+
+static atomic_uint counter_next;
+
+/*
+ * Returns the shard of the calling thread, plus one.
+ */
+unsigned int
+counter_shard_assign(void) {
+	counter_tshard = atomic_fetch_add_explicit(&counter_next, 1,
+	                 memory_order_relaxed) % COUNTER_SHARDS + 1;
+	return counter_tshard;
+}
+
+uint64_t
+counter_get(counter_t *c) {
+	uint64_t sum = 0;
+
+	assert(c);
+
+	for (int i = 0; i < COUNTER_SHARDS; i++)
+		sum += atomic_load_explicit(&c->shard[i].v,
+		                            memory_order_relaxed);
+	return sum;
+}
+
+/*
+ * Not atomic with respect to concurrent increments; only call while no
+ * other threads may be incrementing, i.e. from init functions.
+ */
+void
+counter_reset(counter_t *c) {
+	assert(c);
+
+	for (int i = 0; i < COUNTER_SHARDS; i++)
+		atomic_store_explicit(&c->shard[i].v, 0, memory_order_relaxed);
+}
+
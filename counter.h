@@ -0,0 +1,61 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef COUNTER_H
+#define COUNTER_H
+
+#include "attrib.h"
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Statistics counter incremented from many threads.  Each thread adds to
+ * its own cache line sized shard, so that concurrent increments from the
+ * worker threads do not contend on a shared cache line; reading sums up all
+ * shards.  Threads are assigned to shards round-robin on their first
+ * increment.  Reads are not synchronized with increments, which is fine for
+ * statistics.
+ */
+#define COUNTER_CACHELINE       64
+#define COUNTER_SHARDS          16
+
+typedef struct {
+	_Alignas(COUNTER_CACHELINE)
+	atomic_uint_fast64_t v;
+} counter_shard_t;
+
+typedef struct {
+	counter_shard_t shard[COUNTER_SHARDS];
+} counter_t;
+
+extern _Thread_local unsigned int counter_tshard; /* shard + 1, 0 unset */
+
+unsigned int counter_shard_assign(void);
+uint64_t counter_get(counter_t *) NONNULL(1) WUNRES;
+void counter_reset(counter_t *) NONNULL(1);
+
+static inline void
+counter_add(counter_t *c, uint64_t n) {
+	unsigned int i = counter_tshard;
+
+	if (i == 0)
+		i = counter_shard_assign();
+	atomic_fetch_add_explicit(&c->shard[i - 1].v, n,
+	                          memory_order_relaxed);
+}
+
+static inline void
+counter_inc(counter_t *c) {
+	counter_add(c, 1);
+}
+
+#endif
+
@@ -0,0 +1,477 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+/*
+ * Out-of-process code signature verification.
+ *
+ * With codesign_helpers, every codesign pool thread hands the verification
+ * of its images to a helper process of its own instead of calling
+ * codesign_new itself, such that the checks in Security.framework run in
+ * parallel in separate processes, and a binary that makes them stall or
+ * crash only takes down a helper.  Helpers are xnumon itself, spawned with
+ * CSHELPER_OPT and the configuration file of the daemon, serving requests
+ * on a socketpair on their stdin:  a request is the length of the path
+ * followed by the path, a reply is a cshelper_rep_t followed by the cdhash
+ * and the strings of the code signature.  A helper that does not reply
+ * within codesign_helper_timeout seconds, or whose reply is malformed, is
+ * killed and the image gets an error result; the next request spawns a new
+ * helper.  Helpers exit when the socketpair is closed.
+ *
+ * Records of the helper processes are ignored like those of xnumon itself,
+ * see cshelper_is_helper.  The bundle cache is not available in helpers.
+ */
+
+#include "cshelper.h"
+
+#include "sys.h"
+#include "intern.h"
+#include "atomic.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <signal.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <assert.h>
+
+extern char **environ;
+
+#define CSHELPER_STR_MAX        4096    /* ident, teamid and certcn */
+#define CSHELPER_CDHASH_MAX     64
+#define CSHELPER_EXIT_MSEC      250     /* grace to exit on close */
+
+typedef struct {
+	int32_t error;                  /* errno if no code signature */
+	int32_t result;
+	int32_t origin;
+	uint32_t cdhashsz;
+	uint32_t identsz;               /* including NUL, 0 if NULL */
+	uint32_t teamidsz;
+	uint32_t certcnsz;
+} cshelper_rep_t;
+
+static config_t *config;
+static char *exepath;
+static atomic_int pids[CODESIGN_THREADS_MAX];   /* running helpers */
+static atomic64_t spawns;
+static atomic64_t kills;
+
+/*
+ * Read or write exactly sz bytes.  Reads wait at most timeout ms for each
+ * chunk, -1 waits forever.
+ */
+static int
+cshelper_read(int fd, void *buf, size_t sz, int timeout) {
+	struct pollfd pfd;
+	ssize_t n;
+	int rv;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (sz > 0) {
+		pfd.revents = 0;
+		rv = poll(&pfd, 1, timeout);
+		if (rv == -1 && errno == EINTR)
+			continue;
+		if (rv <= 0) {
+			if (rv == 0)
+				errno = ETIMEDOUT;
+			return -1;
+		}
+		n = read(fd, buf, sz);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			if (n == 0)
+				errno = EPIPE;
+			return -1;
+		}
+		buf = (char *)buf + n;
+		sz -= (size_t)n;
+	}
+	return 0;
+}
+
+static int
+cshelper_write(int fd, const void *buf, size_t sz) {
+	ssize_t n;
+
+	while (sz > 0) {
+		n = write(fd, buf, sz);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf = (const char *)buf + n;
+		sz -= (size_t)n;
+	}
+	return 0;
+}
+
+/*
+ * Spawn the helper process for h.  Returns -1 on errors.
+ */
+static int
+cshelper_spawn(cshelper_t *h) {
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	char *argv[5];
+	int s[2], one = 1;
+	pid_t pid;
+	int rv;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, s) == -1)
+		return -1;
+#ifdef SO_NOSIGPIPE
+	(void)setsockopt(s[0], SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#else
+	(void)one;
+#endif
+	if (posix_spawn_file_actions_init(&fa) != 0)
+		goto errout1;
+	if (posix_spawnattr_init(&attr) != 0)
+		goto errout2;
+	/* only stdin and stderr are passed on to the helper */
+	if (posix_spawn_file_actions_adddup2(&fa, s[1], STDIN_FILENO) != 0 ||
+	    posix_spawn_file_actions_addinherit_np(&fa, STDERR_FILENO) != 0 ||
+	    posix_spawnattr_setflags(&attr, POSIX_SPAWN_CLOEXEC_DEFAULT) != 0)
+		goto errout3;
+	argv[0] = exepath;
+	argv[1] = CSHELPER_OPT;
+	argv[2] = "-c";
+	argv[3] = config->path;
+	argv[4] = NULL;
+	rv = posix_spawn(&pid, exepath, &fa, &attr, argv, environ);
+	if (rv != 0) {
+		errno = rv;
+		goto errout3;
+	}
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&fa);
+	close(s[1]);
+	h->pid = pid;
+	h->fd = s[0];
+	atomic_store(&pids[h->slot], pid);
+	atomic64_fast_inc(&spawns);
+	return 0;
+errout3:
+	posix_spawnattr_destroy(&attr);
+errout2:
+	posix_spawn_file_actions_destroy(&fa);
+errout1:
+	close(s[0]);
+	close(s[1]);
+	return -1;
+}
+
+/*
+ * Prepare h to be used by the codesign pool thread in slot.  The helper
+ * process is only spawned by the first request.
+ */
+void
+cshelper_open(cshelper_t *h, size_t slot) {
+	assert(slot < CODESIGN_THREADS_MAX);
+	h->pid = 0;
+	h->fd = -1;
+	h->slot = slot;
+}
+
+/*
+ * Reap pid, waiting up to msec milliseconds for it to exit.  Returns false
+ * if it is still running.
+ */
+static bool
+cshelper_reap(pid_t pid, unsigned int msec) {
+	for (unsigned int i = 0;; i++) {
+		if (waitpid(pid, NULL, WNOHANG) != 0)
+			return true;
+		if (i == msec)
+			return false;
+		(void)usleep(1000);
+	}
+}
+
+/*
+ * Terminate the helper process of h, if any.  Closing the socketpair makes
+ * a responsive helper exit by itself within CSHELPER_EXIT_MSEC; others are
+ * killed.
+ */
+void
+cshelper_close(cshelper_t *h) {
+	if (!h->pid)
+		return;
+	close(h->fd);
+	h->fd = -1;
+	if (!cshelper_reap(h->pid, CSHELPER_EXIT_MSEC)) {
+		(void)kill(h->pid, SIGKILL);
+		(void)waitpid(h->pid, NULL, 0);
+	}
+	atomic_store(&pids[h->slot], 0);
+	h->pid = 0;
+}
+
+static void
+cshelper_kill(cshelper_t *h) {
+	(void)kill(h->pid, SIGKILL);
+	cshelper_close(h);
+	atomic64_fast_inc(&kills);
+}
+
+static char *
+cshelper_read_str(cshelper_t *h, uint32_t sz, int timeout) {
+	char *s;
+
+	if (sz == 0)
+		return NULL;
+	s = malloc(sz);
+	if (!s)
+		return NULL;
+	if (cshelper_read(h->fd, s, sz, timeout) == -1) {
+		free(s);
+		return NULL;
+	}
+	s[sz - 1] = '\0';
+	return intern_take(s);
+}
+
+/*
+ * Obtain the code signature of the image at path from the helper process,
+ * spawning it first if it is not running.  Returns the same as
+ * codesign_new, with a code signature with result CODESIGN_RESULT_ERROR if
+ * the helper failed to verify the image.
+ */
+codesign_t *
+cshelper_codesign(cshelper_t *h, const char *path) {
+	cshelper_rep_t rep;
+	codesign_t *cs;
+	uint32_t len;
+	int timeout;
+
+	if (!h->pid && cshelper_spawn(h) == -1)
+		return codesign_new(path, -1);
+
+	len = (uint32_t)strlen(path);
+	if (cshelper_write(h->fd, &len, sizeof(len)) == -1 ||
+	    cshelper_write(h->fd, path, len) == -1) {
+		/* helper went away since the last request, retry once */
+		cshelper_kill(h);
+		if (cshelper_spawn(h) == -1)
+			return codesign_new(path, -1);
+		if (cshelper_write(h->fd, &len, sizeof(len)) == -1 ||
+		    cshelper_write(h->fd, path, len) == -1)
+			goto failed;
+	}
+	timeout = (int)config->codesign_helper_timeout * 1000;
+	if (cshelper_read(h->fd, &rep, sizeof(rep), timeout) == -1 ||
+	    rep.cdhashsz > CSHELPER_CDHASH_MAX ||
+	    rep.identsz > CSHELPER_STR_MAX ||
+	    rep.teamidsz > CSHELPER_STR_MAX ||
+	    rep.certcnsz > CSHELPER_STR_MAX)
+		goto failed;
+	if (rep.error) {
+		errno = rep.error;
+		return NULL;
+	}
+
+	cs = codesign_alloc();
+	if (!cs) {
+		/* the rest of the reply cannot be skipped reliably */
+		cshelper_close(h);
+		errno = ENOMEM;
+		return NULL;
+	}
+	cs->result = rep.result;
+	cs->origin = rep.origin;
+	if (rep.cdhashsz > 0) {
+		cs->cdhash = malloc(rep.cdhashsz);
+		if (!cs->cdhash)
+			goto enomem;
+		cs->cdhashsz = rep.cdhashsz;
+		if (cshelper_read(h->fd, cs->cdhash, cs->cdhashsz,
+		                  timeout) == -1)
+			goto failed_cs;
+	}
+	errno = 0;
+	cs->ident = cshelper_read_str(h, rep.identsz, timeout);
+	if (rep.identsz && !cs->ident)
+		goto errout_cs;
+	cs->teamid = cshelper_read_str(h, rep.teamidsz, timeout);
+	if (rep.teamidsz && !cs->teamid)
+		goto errout_cs;
+	cs->certcn = cshelper_read_str(h, rep.certcnsz, timeout);
+	if (rep.certcnsz && !cs->certcn)
+		goto errout_cs;
+	return cs;
+
+errout_cs:
+	if (errno != ENOMEM)
+		goto failed_cs;
+enomem:
+	/* the rest of the reply cannot be skipped reliably */
+	codesign_free(cs);
+	cshelper_close(h);
+	errno = ENOMEM;
+	return NULL;
+failed_cs:
+	codesign_free(cs);
+failed:
+	fprintf(stderr, "Codesign helper failed on %s: %s (%i)\n",
+	                path, strerror(errno), errno);
+	cshelper_kill(h);
+	cs = codesign_alloc();
+	if (!cs) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	cs->result = CODESIGN_RESULT_ERROR;
+	return cs;
+}
+
+/*
+ * Returns true if pid is one of the running helper processes.  Thread-safe.
+ */
+bool
+cshelper_is_helper(pid_t pid) {
+	if (!config || !config->codesign_helpers)
+		return false;
+	for (size_t i = 0; i < CODESIGN_THREADS_MAX; i++) {
+		if (atomic_load_explicit(&pids[i], memory_order_relaxed) ==
+		    pid)
+			return true;
+	}
+	return false;
+}
+
+int
+cshelper_init(config_t *cfg) {
+	config = cfg;
+	spawns = 0;
+	kills = 0;
+	for (size_t i = 0; i < CODESIGN_THREADS_MAX; i++)
+		atomic_init(&pids[i], 0);
+	exepath = NULL;
+	if (!cfg->codesign_helpers)
+		return 0;
+	exepath = sys_pidpath(getpid());
+	if (!exepath) {
+		config = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Must only be called after the codesign pool threads closed their helpers.
+ */
+void
+cshelper_fini(void) {
+	if (!config)
+		return;
+	if (exepath) {
+		free(exepath);
+		exepath = NULL;
+	}
+	config = NULL;
+}
+
+void
+cshelper_stats(cshelper_stat_t *st) {
+	bzero(st, sizeof(cshelper_stat_t));
+	if (!config)
+		return;
+	for (size_t i = 0; i < CODESIGN_THREADS_MAX; i++) {
+		if (atomic_load_explicit(&pids[i], memory_order_relaxed))
+			st->running++;
+	}
+	st->spawns = atomic64_load(&spawns);
+	st->kills = atomic64_load(&kills);
+}
+
+/*
+ * Send the reply for cs or for the error from codesign_new.
+ */
+static int
+cshelper_reply(int fd, codesign_t *cs, int error) {
+	cshelper_rep_t rep;
+
+	bzero(&rep, sizeof(rep));
+	if (!cs) {
+		rep.error = error ? error : EIO;
+		return cshelper_write(fd, &rep, sizeof(rep));
+	}
+	rep.result = cs->result;
+	rep.origin = cs->origin;
+	rep.cdhashsz = cs->cdhash ? (uint32_t)cs->cdhashsz : 0;
+	rep.identsz = cs->ident ? (uint32_t)strlen(cs->ident) + 1 : 0;
+	rep.teamidsz = cs->teamid ? (uint32_t)strlen(cs->teamid) + 1 : 0;
+	rep.certcnsz = cs->certcn ? (uint32_t)strlen(cs->certcn) + 1 : 0;
+	if (rep.cdhashsz > CSHELPER_CDHASH_MAX ||
+	    rep.identsz > CSHELPER_STR_MAX ||
+	    rep.teamidsz > CSHELPER_STR_MAX ||
+	    rep.certcnsz > CSHELPER_STR_MAX) {
+		bzero(&rep, sizeof(rep));
+		rep.result = CODESIGN_RESULT_ERROR;
+	}
+	if (cshelper_write(fd, &rep, sizeof(rep)) == -1 ||
+	    cshelper_write(fd, cs->cdhash, rep.cdhashsz) == -1 ||
+	    cshelper_write(fd, cs->ident, rep.identsz) == -1 ||
+	    cshelper_write(fd, cs->teamid, rep.teamidsz) == -1 ||
+	    cshelper_write(fd, cs->certcn, rep.certcnsz) == -1)
+		return -1;
+	return 0;
+}
+
+/*
+ * Main loop of a helper process, serving requests on stdin until xnumon
+ * closes the socketpair.
+ */
+int
+cshelper_serve(config_t *cfg) {
+	char path[PATH_MAX];
+	codesign_t *cs;
+	uint32_t len;
+	int fd = STDIN_FILENO;
+	int rv;
+
+	if (codesign_init(cfg) == -1) {
+		fprintf(stderr, "Failed to initialize codesign\n");
+		return -1;
+	}
+	rv = 0;
+	for (;;) {
+		if (cshelper_read(fd, &len, sizeof(len), -1) == -1)
+			break;
+		if (len >= sizeof(path) ||
+		    cshelper_read(fd, path, len, -1) == -1) {
+			rv = -1;
+			break;
+		}
+		path[len] = '\0';
+		cs = codesign_new(path, -1);
+		if (cshelper_reply(fd, cs, errno) == -1)
+			rv = -1;
+		if (cs)
+			codesign_free(cs);
+		if (rv == -1)
+			break;
+	}
+	codesign_fini();
+	return rv;
+}
+
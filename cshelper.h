@@ -0,0 +1,47 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef CSHELPER_H
+#define CSHELPER_H
+
+#include "codesign.h"
+#include "config.h"
+#include "attrib.h"
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CSHELPER_OPT    "-X"            /* argv[1] of helper processes */
+
+typedef struct {
+	pid_t pid;                      /* 0 if not running */
+	int fd;
+	size_t slot;
+} cshelper_t;
+
+typedef struct {
+	uint32_t running;
+	uint64_t spawns;
+	uint64_t kills;                 /* helpers that crashed or timed out */
+} cshelper_stat_t;
+
+int cshelper_init(config_t *) WUNRES NONNULL(1);
+void cshelper_fini(void);
+void cshelper_open(cshelper_t *, size_t) NONNULL(1);
+void cshelper_close(cshelper_t *) NONNULL(1);
+codesign_t * cshelper_codesign(cshelper_t *, const char *) NONNULL(1,2);
+bool cshelper_is_helper(pid_t) WUNRES;
+void cshelper_stats(cshelper_stat_t *) NONNULL(1);
+
+int cshelper_serve(config_t *) WUNRES NONNULL(1);
+
+#endif
+
@@ -0,0 +1,491 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+/*
+ * Code signature verification pool.
+ *
+ * Verifying code signatures is by far the slowest step in acquiring image
+ * information.  Requests are keyed by the hashes of the image, and concurrent
+ * requests for identical images are coalesced into a single evaluation whose
+ * result is shared by all waiters and put into cachecsig exactly once.
+ * Together with cachecsig, an image is thus in one of three states:  cached,
+ * in flight with followers blocking on its evaluation, or neither.
+ * Evaluations run on config->codesign_threads dedicated threads, or in the
+ * requesting thread if that is 0.  Callers always block until the result of
+ * the evaluation is available.
+ *
+ * With codesign_overlap, evaluations of images missing from the caches can
+ * also be started before their hashes are known, keyed provisionally by
+ * file identity, such that hashing and evaluation overlap.  Such
+ * provisional evaluations are put into cachecsig by the requester once it
+ * knows the hashes, or abandoned if the hashes turn out to be cached.
+ *
+ * With codesign_helpers, each thread delegates its evaluations to a helper
+ * process of its own, see cshelper.c.
+ */
+
+#include "cspool.h"
+
+#include "cachecsig.h"
+#include "cshelper.h"
+#include "policy.h"
+#include "thrstat.h"
+
+#include "tommyhash.h"
+#include "tommyhashinc.h"
+#include "tommylist.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <errno.h>
+#include <assert.h>
+
+struct cspool_job {
+	hashes_t hashes;                /* unknown if provisional */
+	char *path;
+	stat_attr_t stat;
+
+	uint32_t refs;                  /* requesters waiting for this job */
+	bool provisional;               /* keyed by stat, not hashes */
+	bool running;
+	bool done;
+	bool cached;                    /* provisional result in cachecsig */
+	int rv;
+	int error;                      /* errno if rv == -1 */
+	codesign_t *codesign;
+
+	tommy_node hnode;               /* inflight or provisional */
+	tommy_node qnode;               /* runq */
+};
+
+static config_t *config;
+static pthread_t threads[CODESIGN_THREADS_MAX];
+static cshelper_t helpers[CODESIGN_THREADS_MAX];
+static size_t nthreads;
+static pthread_mutex_t mutex;
+static pthread_cond_t runcond;          /* runq not empty or stopping */
+static pthread_cond_t donecond;         /* some job done */
+static bool stopping;
+static tommy_hashinc inflight;
+static tommy_hashinc provisional;
+static tommy_list runq;
+static uint32_t qsize;
+static uint64_t evals;
+static uint64_t coalesced;
+static uint64_t overlapped;
+static uint64_t abandoned;
+
+#define hashhashes(H) tommy_hash_u32(0, (H), sizeof(hashes_t))
+#define hashstat(S) tommy_hash_u32((uint32_t)(S)->dev, &(S)->ino, \
+                                   sizeof((S)->ino))
+
+static int
+cspool_job_cmp(const void *hashes, const void *vjob) {
+	const cspool_job_t *job = vjob;
+	return memcmp(&job->hashes, hashes, sizeof(hashes_t));
+}
+
+static int
+cspool_job_statcmp(const void *vstat, const void *vjob) {
+	const stat_attr_t *st = vstat;
+	const cspool_job_t *job = vjob;
+
+	return (job->stat.dev != st->dev) ||
+	       (job->stat.ino != st->ino) ||
+	       (job->stat.size != st->size) ||
+	       (job->stat.mtime.tv_sec != st->mtime.tv_sec) ||
+	       (job->stat.mtime.tv_nsec != st->mtime.tv_nsec) ||
+	       (job->stat.ctime.tv_sec != st->ctime.tv_sec) ||
+	       (job->stat.ctime.tv_nsec != st->ctime.tv_nsec) ||
+	       (job->stat.btime.tv_sec != st->btime.tv_sec) ||
+	       (job->stat.btime.tv_nsec != st->btime.tv_nsec);
+}
+
+static cspool_job_t *
+cspool_job_new(const char *path, const stat_attr_t *stat) {
+	cspool_job_t *job;
+
+	job = malloc(sizeof(cspool_job_t));
+	if (!job)
+		return NULL;
+	bzero(job, sizeof(cspool_job_t));
+	job->path = strdup(path);
+	if (!job->path) {
+		free(job);
+		return NULL;
+	}
+	job->stat = *stat;
+	return job;
+}
+
+static void
+cspool_job_free(cspool_job_t *job) {
+	if (job->codesign)
+		codesign_free(job->codesign);
+	free(job->path);
+	free(job);
+}
+
+/*
+ * Evaluate the code signature of the job's image, in helper process h if
+ * not NULL, and put the result into cachecsig unless the image changed
+ * while it was being evaluated.  Called without holding the mutex.
+ */
+static void
+cspool_eval(cspool_job_t *job, cshelper_t *h) {
+	stat_attr_t st;
+
+	if (h)
+		job->codesign = cshelper_codesign(h, job->path);
+	else
+		job->codesign = codesign_new(job->path, -1);
+	if (!job->codesign) {
+		job->rv = -1;
+		job->error = errno;
+		return;
+	}
+
+	/*
+	 * If 3rd stat does not match 1st, invalidate codesign.
+	 * If 3rd stat fails, return error but don't invalidate.
+	 * The codesign routines fail internally if the data is changed
+	 * during signature verification.
+	 */
+	if (sys_pathattr(&st, job->path) == -1) {
+		job->rv = -1;
+		job->error = errno;
+		return;
+	}
+	if ((job->stat.size != st.size) ||
+	    (job->stat.dev != st.dev) ||
+	    (job->stat.ino != st.ino) ||
+	    (job->stat.mtime.tv_sec != st.mtime.tv_sec) ||
+	    (job->stat.mtime.tv_nsec != st.mtime.tv_nsec) ||
+	    (job->stat.ctime.tv_sec != st.ctime.tv_sec) ||
+	    (job->stat.ctime.tv_nsec != st.ctime.tv_nsec) ||
+	    (job->stat.btime.tv_sec != st.btime.tv_sec) ||
+	    (job->stat.btime.tv_nsec != st.btime.tv_nsec)) {
+		codesign_free(job->codesign);
+		job->codesign = NULL;
+		job->rv = -1;
+		job->error = 0;
+		return;
+	}
+
+	if (!job->provisional)
+		cachecsig_put(&job->hashes, job->codesign, job->path);
+	job->rv = 0;
+}
+
+/*
+ * Mark job done and wake up its waiters.  Called with the mutex held.
+ */
+static void
+cspool_complete(cspool_job_t *job) {
+	tommy_hashinc_remove_existing(job->provisional ? &provisional
+	                                               : &inflight,
+	                              &job->hnode);
+	job->done = true;
+	evals++;
+	pthread_cond_broadcast(&donecond);
+}
+
+static void *
+cspool_thread(void *arg) {
+	cspool_job_t *job;
+	cshelper_t *h;
+
+	h = config->codesign_helpers ? &helpers[(uintptr_t)arg] : NULL;
+
+	(void)policy_thread_diskio_standard();
+	thrstat_register(THRSTAT_CSPOOL);
+
+	pthread_mutex_lock(&mutex);
+	for (;;) {
+		while (tommy_list_empty(&runq) && !stopping)
+			pthread_cond_wait(&runcond, &mutex);
+		if (tommy_list_empty(&runq))
+			break;
+		job = tommy_list_head(&runq)->data;
+		tommy_list_remove_existing(&runq, &job->qnode);
+		qsize--;
+		job->running = true;
+		pthread_mutex_unlock(&mutex);
+		cspool_eval(job, h);
+		pthread_mutex_lock(&mutex);
+		cspool_complete(job);
+		/* abandoned while running */
+		if (job->refs == 0)
+			cspool_job_free(job);
+	}
+	pthread_mutex_unlock(&mutex);
+	if (h)
+		cshelper_close(h);
+	return NULL;
+}
+
+/*
+ * Obtain the code signature of the image at path with the given hashes and
+ * stat attributes from the first stat.  Blocks until the code signature is
+ * available; if another thread is already evaluating an image with the same
+ * hashes, waits for that evaluation instead of starting another one.
+ *
+ * Returns 0 on success and -1 on errors.  Even on errors, *cs can be set to
+ * a code signature that could not be cached because the third stat failed.
+ * On errors, errno is ENOMEM if the failure was due to lack of memory.
+ */
+int
+cspool_verify(codesign_t **cs, const char *path, hashes_t *hashes,
+              const stat_attr_t *stat) {
+	cspool_job_t *job;
+	tommy_hash_t h;
+	bool inline_eval = false;
+	int rv, error;
+
+	assert(config);
+
+	h = hashhashes(hashes);
+	pthread_mutex_lock(&mutex);
+	job = tommy_hashinc_search(&inflight, cspool_job_cmp, hashes, h);
+	if (job) {
+		coalesced++;
+	} else {
+		/* an evaluation may have completed since the caller missed
+		 * the cache; completed results are put into the cache before
+		 * they are removed from inflight */
+		errno = 0;
+		*cs = cachecsig_get(hashes);
+		if (*cs || errno == ENOMEM) {
+			pthread_mutex_unlock(&mutex);
+			return *cs ? 0 : -1;
+		}
+		job = cspool_job_new(path, stat);
+		if (!job) {
+			pthread_mutex_unlock(&mutex);
+			errno = ENOMEM;
+			return -1;
+		}
+		memcpy(&job->hashes, hashes, sizeof(hashes_t));
+		tommy_hashinc_insert(&inflight, &job->hnode, job, h);
+		if (nthreads > 0) {
+			tommy_list_insert_tail(&runq, &job->qnode, job);
+			qsize++;
+			pthread_cond_signal(&runcond);
+		} else {
+			inline_eval = true;
+		}
+	}
+	job->refs++;
+
+	if (inline_eval) {
+		pthread_mutex_unlock(&mutex);
+		cspool_eval(job, NULL);
+		pthread_mutex_lock(&mutex);
+		cspool_complete(job);
+	}
+	while (!job->done)
+		pthread_cond_wait(&donecond, &mutex);
+
+	rv = job->rv;
+	error = job->error;
+	if (job->codesign) {
+		*cs = codesign_ref(job->codesign);
+	}
+	if (--job->refs == 0)
+		cspool_job_free(job);
+	pthread_mutex_unlock(&mutex);
+	errno = error;
+	return rv;
+}
+
+/*
+ * Start evaluating the code signature of the image at path with the stat
+ * attributes from the first stat before its hashes are known.  Requests for
+ * the same file identity are coalesced.  Returns NULL if the evaluation
+ * cannot overlap with the caller, because there are no codesign threads or
+ * there is no memory, in which case the caller uses cspool_verify once the
+ * hashes are known.  Every job returned must be passed to either cspool_wait
+ * or cspool_abandon exactly once.
+ */
+cspool_job_t *
+cspool_start(const char *path, const stat_attr_t *stat) {
+	cspool_job_t *job;
+	tommy_hash_t h;
+
+	assert(config);
+
+	if (nthreads == 0)
+		return NULL;
+	h = hashstat(stat);
+	pthread_mutex_lock(&mutex);
+	job = tommy_hashinc_search(&provisional, cspool_job_statcmp, stat, h);
+	if (job) {
+		coalesced++;
+	} else {
+		job = cspool_job_new(path, stat);
+		if (!job) {
+			pthread_mutex_unlock(&mutex);
+			return NULL;
+		}
+		job->provisional = true;
+		tommy_hashinc_insert(&provisional, &job->hnode, job, h);
+		tommy_list_insert_tail(&runq, &job->qnode, job);
+		qsize++;
+		overlapped++;
+		pthread_cond_signal(&runcond);
+	}
+	job->refs++;
+	pthread_mutex_unlock(&mutex);
+	return job;
+}
+
+/*
+ * Wait for the result of job started by cspool_start and reconcile it with
+ * the hashes of the image, which the caller has determined in the meantime
+ * from a file matching the same first stat:  the first requester to get the
+ * result puts it into cachecsig under the hashes.  Return values are the
+ * same as for cspool_verify.
+ */
+int
+cspool_wait(cspool_job_t *job, codesign_t **cs, hashes_t *hashes) {
+	int rv, error;
+
+	pthread_mutex_lock(&mutex);
+	while (!job->done)
+		pthread_cond_wait(&donecond, &mutex);
+
+	rv = job->rv;
+	error = job->error;
+	if (job->codesign) {
+		if (rv == 0 && !job->cached) {
+			cachecsig_put(hashes, job->codesign, job->path);
+			job->cached = true;
+		}
+		*cs = codesign_ref(job->codesign);
+	}
+	if (--job->refs == 0)
+		cspool_job_free(job);
+	pthread_mutex_unlock(&mutex);
+	errno = error;
+	return rv;
+}
+
+/*
+ * Drop the caller's interest in job started by cspool_start, because the
+ * code signature was found in cachecsig after all, or acquisition failed.
+ * An evaluation no longer wanted by anyone is dequeued if it did not start
+ * yet, and discarded when done otherwise.
+ */
+void
+cspool_abandon(cspool_job_t *job) {
+	pthread_mutex_lock(&mutex);
+	if (--job->refs == 0) {
+		abandoned++;
+		if (job->done) {
+			cspool_job_free(job);
+		} else if (!job->running) {
+			tommy_list_remove_existing(&runq, &job->qnode);
+			tommy_hashinc_remove_existing(&provisional,
+			                              &job->hnode);
+			qsize--;
+			cspool_job_free(job);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+int
+cspool_init(config_t *cfg) {
+	assert(cfg->codesign_threads <= CODESIGN_THREADS_MAX);
+
+	config = cfg;
+	stopping = false;
+	qsize = 0;
+	evals = 0;
+	coalesced = 0;
+	overlapped = 0;
+	abandoned = 0;
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&runcond, NULL);
+	pthread_cond_init(&donecond, NULL);
+	tommy_hashinc_init(&inflight);
+	tommy_hashinc_init(&provisional);
+	tommy_list_init(&runq);
+	for (nthreads = 0; nthreads < cfg->codesign_threads; nthreads++) {
+		cshelper_open(&helpers[nthreads], nthreads);
+		if (pthread_create(&threads[nthreads], NULL, cspool_thread,
+		                   (void *)(uintptr_t)nthreads) != 0) {
+			cspool_fini();
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Must only be called when no more requests can be made, i.e. after the
+ * work threads and the kext thread have been stopped.
+ */
+void
+cspool_fini(void) {
+	if (!config)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	stopping = true;
+	pthread_cond_broadcast(&runcond);
+	pthread_mutex_unlock(&mutex);
+	for (size_t i = 0; i < nthreads; i++) {
+		if (pthread_join(threads[i], NULL) != 0) {
+			fprintf(stderr, "Failed to join codesign thread - "
+			                "exiting\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	nthreads = 0;
+	assert(tommy_list_empty(&runq));
+	assert(tommy_hashinc_count(&inflight) == 0);
+	assert(tommy_hashinc_count(&provisional) == 0);
+	tommy_hashinc_done(&inflight);
+	tommy_hashinc_done(&provisional);
+	pthread_cond_destroy(&donecond);
+	pthread_cond_destroy(&runcond);
+	pthread_mutex_destroy(&mutex);
+	config = NULL;
+}
+
+void
+cspool_stats(cspool_stat_t *st) {
+	cshelper_stat_t hst;
+
+	if (!config) {
+		bzero(st, sizeof(cspool_stat_t));
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	st->threads = (uint32_t)nthreads;
+	st->qsize = qsize;
+	st->inflight = (uint32_t)(tommy_hashinc_count(&inflight) +
+	                          tommy_hashinc_count(&provisional));
+	st->evals = evals;
+	st->coalesced = coalesced;
+	st->overlapped = overlapped;
+	st->abandoned = abandoned;
+	pthread_mutex_unlock(&mutex);
+	cshelper_stats(&hst);
+	st->helpers = hst.running;
+	st->spawns = hst.spawns;
+	st->kills = hst.kills;
+}
+
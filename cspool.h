@@ -0,0 +1,49 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef CSPOOL_H
+#define CSPOOL_H
+
+#include "codesign.h"
+#include "hashes.h"
+#include "sys.h"
+#include "config.h"
+#include "attrib.h"
+
+#include <stdint.h>
+
+typedef struct {
+	uint32_t threads;
+	uint32_t qsize;                 /* evaluations waiting for a thread */
+	uint32_t inflight;              /* evaluations queued or running */
+	uint64_t evals;
+	uint64_t coalesced;             /* requests joining an evaluation */
+	uint64_t overlapped;            /* evaluations started while hashing */
+	uint64_t abandoned;             /* overlapped evaluations not needed */
+	uint32_t helpers;               /* running helper processes */
+	uint64_t spawns;                /* helper processes spawned */
+	uint64_t kills;                 /* helpers that crashed or timed out */
+} cspool_stat_t;
+
+typedef struct cspool_job cspool_job_t;
+
+int cspool_init(config_t *) WUNRES NONNULL(1);
+void cspool_fini(void);
+int cspool_verify(codesign_t **, const char *, hashes_t *,
+                  const stat_attr_t *) WUNRES NONNULL(1,2,3,4);
+cspool_job_t * cspool_start(const char *, const stat_attr_t *)
+               WUNRES NONNULL(1,2);
+int cspool_wait(cspool_job_t *, codesign_t **, hashes_t *)
+                WUNRES NONNULL(1,2,3);
+void cspool_abandon(cspool_job_t *) NONNULL(1);
+void cspool_stats(cspool_stat_t *) NONNULL(1);
+
+#endif
+
@@ -0,0 +1,247 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+/*
+ * Background revalidation of cached code signatures.
+ *
+ * Once cached, code signature results are served from cachecsig until they
+ * are evicted, even though a certificate can be revoked or expire after the
+ * evaluation.  Every config->codesign_refresh_interval seconds, a single low
+ * priority thread takes up to config->codesign_refresh_count of the most
+ * recently used cachecsig entries that have not been evaluated within the
+ * interval and evaluates them again from the path they were last put for.
+ * Entries whose file no longer matches the cached hashes are skipped, as are
+ * transient evaluation errors.  If the result differs, the cache entry is
+ * updated in place and a xnumon-ops[0] event with op revalidate is logged
+ * with both results.  Lookups on the hot path stay pure cache hits; images
+ * acquired before the update are not logged again.
+ *
+ * To bound the CPU and I/O used, the thread runs with the utility I/O
+ * policy and after each evaluation sleeps long enough for revalidation to
+ * take no more than CSREFRESH_DUTY percent of wall clock time.
+ */
+
+#include "csrefresh.h"
+
+#include "cachecsig.h"
+#include "codesign.h"
+#include "hashes.h"
+#include "sys.h"
+#include "log.h"
+#include "policy.h"
+#include "thrstat.h"
+#include "counter.h"
+#include "time.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <errno.h>
+#include <assert.h>
+
+static config_t *config;
+static pthread_t thread;
+static bool running;
+static pthread_mutex_t mutex;
+static pthread_cond_t cond;             /* stopping */
+static bool stopping;
+static counter_t rounds;
+static counter_t checked;
+static counter_t changed;
+static counter_t skipped;
+
+/*
+ * Wait for nsec or until stopping.  Called with the mutex held.  Returns
+ * true if stopping.
+ */
+static bool
+csrefresh_wait(uint64_t nsec) {
+	struct timespec ts;
+
+	if (timespec_nanotime(&ts) == -1)
+		return stopping;
+	nsec += (uint64_t)ts.tv_nsec;
+	ts.tv_sec += (time_t)(nsec / 1000000000);
+	ts.tv_nsec = (long)(nsec % 1000000000);
+	while (!stopping) {
+		if (pthread_cond_timedwait(&cond, &mutex, &ts) == ETIMEDOUT)
+			break;
+	}
+	return stopping;
+}
+
+static bool
+csrefresh_same_file(const stat_attr_t *a, const stat_attr_t *b) {
+	return a->size == b->size &&
+	       a->dev == b->dev &&
+	       a->ino == b->ino &&
+	       a->mtime.tv_sec == b->mtime.tv_sec &&
+	       a->mtime.tv_nsec == b->mtime.tv_nsec &&
+	       a->ctime.tv_sec == b->ctime.tv_sec &&
+	       a->ctime.tv_nsec == b->ctime.tv_nsec;
+}
+
+/*
+ * Evaluate the code signature of ref's file again and update the cache.
+ * Called without holding the mutex.
+ */
+static void
+csrefresh_check(cachecsig_ref_t *ref) {
+	stat_attr_t st1, st2;
+	hashes_t hashes;
+	codesign_t *cs;
+	off_t sz;
+
+	if (sys_pathattr(&st1, ref->path) == -1 ||
+	    hashes_path(&sz, &hashes, config->hflags, ref->path) == -1 ||
+	    memcmp(&hashes, &ref->hashes, sizeof(hashes_t))) {
+		counter_inc(&skipped);
+		return;
+	}
+	cs = codesign_new(ref->path, -1);
+	if (!cs) {
+		counter_inc(&skipped);
+		return;
+	}
+	if (cs->result == CODESIGN_RESULT_ERROR ||
+	    sys_pathattr(&st2, ref->path) == -1 ||
+	    !csrefresh_same_file(&st1, &st2)) {
+		codesign_free(cs);
+		counter_inc(&skipped);
+		return;
+	}
+	counter_inc(&checked);
+	if (codesign_equal(cs, ref->codesign)) {
+		cachecsig_revalidated(&ref->hashes, NULL);
+	} else {
+		counter_inc(&changed);
+		cachecsig_revalidated(&ref->hashes, cs);
+		if (log_event_xnumon_revalidate(ref->path, ref->codesign,
+		                                cs) == -1)
+			fprintf(stderr, "Failed to log revalidation: "
+			                "%s (%i)\n", strerror(errno), errno);
+	}
+	codesign_free(cs);
+}
+
+/*
+ * Revalidate one round of entries.  Called with the mutex held.
+ */
+static void
+csrefresh_round(cachecsig_ref_t *refs) {
+	struct timespec now;
+	uint64_t t0, spent;
+	time_t before;
+	size_t n, i;
+
+	if (timespec_monotime(&now) == -1)
+		return;
+	before = now.tv_sec - (time_t)config->codesign_refresh_interval;
+	pthread_mutex_unlock(&mutex);
+	n = cachecsig_hot(refs, config->codesign_refresh_count, before);
+	pthread_mutex_lock(&mutex);
+	counter_inc(&rounds);
+	for (i = 0; i < n && !stopping; i++) {
+		pthread_mutex_unlock(&mutex);
+		t0 = timespec_mononsec();
+		csrefresh_check(&refs[i]);
+		spent = timespec_mononsec() - t0;
+		pthread_mutex_lock(&mutex);
+		if (csrefresh_wait(spent * (100 - CSREFRESH_DUTY) /
+		                   CSREFRESH_DUTY))
+			break;
+	}
+	for (i = 0; i < n; i++)
+		cachecsig_ref_free(&refs[i]);
+}
+
+static void *
+csrefresh_thread(void *arg) {
+	cachecsig_ref_t *refs = arg;
+
+	(void)policy_thread_diskio_utility();
+	thrstat_register(THRSTAT_CSPOOL);
+
+	pthread_mutex_lock(&mutex);
+	while (!csrefresh_wait((uint64_t)config->codesign_refresh_interval *
+	                       1000000000))
+		csrefresh_round(refs);
+	pthread_mutex_unlock(&mutex);
+	free(refs);
+	return NULL;
+}
+
+/*
+ * Start the refresher thread if code signatures are verified and
+ * revalidation is enabled.
+ */
+int
+csrefresh_init(config_t *cfg) {
+	cachecsig_ref_t *refs;
+
+	config = cfg;
+	stopping = false;
+	running = false;
+	counter_reset(&rounds);
+	counter_reset(&checked);
+	counter_reset(&changed);
+	counter_reset(&skipped);
+	if (!cfg->codesign || cfg->codesign_refresh_interval == 0 ||
+	    cfg->codesign_refresh_count == 0)
+		return 0;
+
+	refs = calloc(cfg->codesign_refresh_count, sizeof(cachecsig_ref_t));
+	if (!refs)
+		return -1;
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
+	if (pthread_create(&thread, NULL, csrefresh_thread, refs) != 0) {
+		pthread_cond_destroy(&cond);
+		pthread_mutex_destroy(&mutex);
+		free(refs);
+		return -1;
+	}
+	running = true;
+	return 0;
+}
+
+/*
+ * Must be called before the work queue is shut down, since revalidation
+ * submits events.  Safe to be called repeatedly.
+ */
+void
+csrefresh_fini(void) {
+	if (!running)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	stopping = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+	if (pthread_join(thread, NULL) != 0) {
+		fprintf(stderr, "Failed to join codesign refresh thread - "
+		                "exiting\n");
+		exit(EXIT_FAILURE);
+	}
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+	running = false;
+}
+
+void
+csrefresh_stats(csrefresh_stat_t *st) {
+	st->rounds = counter_get(&rounds);
+	st->checked = counter_get(&checked);
+	st->changed = counter_get(&changed);
+	st->skipped = counter_get(&skipped);
+}
+
@@ -0,0 +1,37 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef CSREFRESH_H
+#define CSREFRESH_H
+
+#include "config.h"
+#include "attrib.h"
+
+#include <stdint.h>
+
+/*
+ * Percentage of wall clock time the refresher may spend revalidating; after
+ * each evaluation it sleeps for the remainder.
+ */
+#define CSREFRESH_DUTY          10
+
+typedef struct {
+	uint64_t rounds;
+	uint64_t checked;               /* evaluated again */
+	uint64_t changed;               /* result differed, ops event logged */
+	uint64_t skipped;               /* file changed, gone or errors */
+} csrefresh_stat_t;
+
+int csrefresh_init(config_t *) WUNRES NONNULL(1);
+void csrefresh_fini(void);
+void csrefresh_stats(csrefresh_stat_t *) NONNULL(1);
+
+#endif
+
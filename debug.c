@@ -14,18 +14,182 @@
 #include "time.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
 #include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Debug records are formatted by the calling thread into a ring of its own
+ * and written out by a background thread, such that turning on debugging
+ * does not serialize the calling threads on stderr and on timestamp
+ * formatting.  Each ring has a single producer, the thread owning it, and a
+ * single consumer, the drain thread, and needs no locking.  Records that do
+ * not fit into a full ring are dropped and counted; the drain thread
+ * reports the count.  Rings of exited threads are reused by new threads.
+ *
+ * Before debug_init and after debug_fini, records are written directly.
+ */
+
+#define DEBUG_RECSZ             512     /* bytes per record */
+#define DEBUG_RINGSZ            128     /* records per ring, power of 2 */
+#define DEBUG_DRAIN_MSEC        20
+
+typedef struct {
+	struct timespec tv;
+	FILE *f;
+	char buf[DEBUG_RECSZ];
+} debug_rec_t;
+
+typedef struct debug_ring {
+	struct debug_ring *next;
+	atomic_bool owned;
+	atomic_size_t head;                     /* written by owner */
+	atomic_size_t tail;                     /* written by drain thread */
+	debug_rec_t rec[DEBUG_RINGSZ];
+} debug_ring_t;
 
 static pthread_mutex_t mutex;
+static pthread_key_t ringkey;
+static debug_ring_t *_Atomic rings;
+static _Thread_local debug_ring_t *ring;
+static atomic_bool running;
+static atomic_bool stop;
+static atomic_uint_fast64_t overflows;
+static pthread_t drainthr;
+
+static void
+debug_write(FILE *f, struct timespec *tv, const char *s) {
+	char buf[20];
+	struct tm stm;
+
+	if (tv->tv_sec > 0) {
+		gmtime_r(&tv->tv_sec, &stm);
+		strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &stm);
+		fprintf(f, "%s.%06luZ ", buf, tv->tv_nsec / 1000);
+	}
+	fputs(s, f);
+}
+
+/*
+ * Write out all records queued in all rings.  Drain thread only, or after
+ * the drain thread has stopped.
+ */
+static void
+debug_drain(void) {
+	static uint64_t reported;
+	debug_ring_t *r;
+	size_t head, tail;
+	uint64_t n;
+
+	for (r = atomic_load(&rings); r; r = r->next) {
+		head = atomic_load_explicit(&r->head, memory_order_acquire);
+		tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+		if (head == tail)
+			continue;
+		pthread_mutex_lock(&mutex);
+		for (; tail != head; tail++) {
+			debug_rec_t *rec = &r->rec[tail & (DEBUG_RINGSZ - 1)];
+			debug_write(rec->f, &rec->tv, rec->buf);
+		}
+		pthread_mutex_unlock(&mutex);
+		atomic_store_explicit(&r->tail, tail, memory_order_release);
+	}
+	n = atomic_load_explicit(&overflows, memory_order_relaxed);
+	if (n != reported) {
+		pthread_mutex_lock(&mutex);
+		fprintf(stderr, "debug: %"PRIu64" records dropped\n",
+		                n - reported);
+		pthread_mutex_unlock(&mutex);
+		reported = n;
+	}
+}
+
+static void *
+debug_thread(UNUSED void *arg) {
+	while (!atomic_load(&stop)) {
+		debug_drain();
+		usleep(DEBUG_DRAIN_MSEC * 1000);
+	}
+	return NULL;
+}
+
+/*
+ * Called on exit of a thread owning a ring.
+ */
+static void
+debug_ring_release(void *arg) {
+	debug_ring_t *r = arg;
+
+	atomic_store_explicit(&r->owned, false, memory_order_release);
+}
+
+/*
+ * Claim the ring of an exited thread or allocate a new one.  The ring of an
+ * exited thread may still hold records not written out yet, which is fine
+ * since the new owner continues where the old one stopped.
+ */
+static debug_ring_t *
+debug_ring_claim(void) {
+	debug_ring_t *r;
+	bool expected;
+
+	for (r = atomic_load(&rings); r; r = r->next) {
+		expected = false;
+		if (atomic_compare_exchange_strong(&r->owned, &expected, true))
+			goto out;
+	}
+	r = calloc(1, sizeof(debug_ring_t));
+	if (!r)
+		return NULL;
+	atomic_init(&r->owned, true);
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	r->next = atomic_load(&rings);
+	while (!atomic_compare_exchange_weak(&rings, &r->next, r));
+out:
+	(void)pthread_setspecific(ringkey, r);
+	return r;
+}
 
 void
 debug_init(void) {
 	pthread_mutex_init(&mutex, NULL);
+	atomic_init(&rings, NULL);
+	atomic_init(&overflows, 0);
+	atomic_init(&stop, false);
+	atomic_init(&running, false);
+	if (pthread_key_create(&ringkey, debug_ring_release) != 0)
+		return;
+	if (pthread_create(&drainthr, NULL, debug_thread, NULL) != 0) {
+		(void)pthread_key_delete(ringkey);
+		return;
+	}
+	atomic_store(&running, true);
 }
 
 void
 debug_fini(void) {
+	if (atomic_load(&running)) {
+		atomic_store(&running, false);
+		atomic_store(&stop, true);
+		if (pthread_join(drainthr, NULL) != 0) {
+			fprintf(stderr, "Failed to join debug thread - "
+			                "exiting\n");
+			exit(EXIT_FAILURE);
+		}
+		/*
+		 * Threads still running write directly from here on.  Rings
+		 * are not freed, since such threads may still be writing
+		 * the records they started before.
+		 */
+		debug_drain();
+	}
 	pthread_mutex_destroy(&mutex);
 }
 
@@ -33,18 +197,40 @@ void
 debug_fprintf(FILE *f, const char *fmt, ...) {
 	va_list ap;
 	struct timespec tv;
-	char buf[20];
-	struct tm stm;
+	debug_rec_t *rec;
+	size_t head;
+	int n;
 
-	pthread_mutex_lock(&mutex);
-	if (timespec_nanotime(&tv) != -1) {
-		gmtime_r(&tv.tv_sec, &stm);
-		strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &stm);
-		fprintf(f, "%s.%06luZ ", buf, tv.tv_nsec / 1000);
+	if (timespec_nanotime(&tv) == -1)
+		tv.tv_sec = 0;
+
+	if (!atomic_load_explicit(&running, memory_order_acquire) ||
+	    (!ring && !(ring = debug_ring_claim()))) {
+		char buf[DEBUG_RECSZ];
+
+		va_start(ap, fmt);
+		vsnprintf(buf, sizeof(buf), fmt, ap);
+		va_end(ap);
+		pthread_mutex_lock(&mutex);
+		debug_write(f, &tv, buf);
+		pthread_mutex_unlock(&mutex);
+		return;
+	}
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >=
+	    DEBUG_RINGSZ) {
+		atomic_fetch_add_explicit(&overflows, 1, memory_order_relaxed);
+		return;
 	}
+	rec = &ring->rec[head & (DEBUG_RINGSZ - 1)];
+	rec->tv = tv;
+	rec->f = f;
 	va_start(ap, fmt);
-	vfprintf(f, fmt, ap);
+	n = vsnprintf(rec->buf, sizeof(rec->buf), fmt, ap);
 	va_end(ap);
-	pthread_mutex_unlock(&mutex);
+	if (n >= (int)sizeof(rec->buf))
+		rec->buf[sizeof(rec->buf) - 2] = '\n';
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
 }
 
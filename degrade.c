@@ -0,0 +1,169 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "degrade.h"
+
+#include "log.h"
+#include "time.h"
+#include "counter.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+/*
+ * Self-throttling under load.  Once per second, the event loop feeds the
+ * depth of the deepest work or log queue, the auditpipe(4) drop counter and
+ * the CPU time used by xnumon into degrade_tick.  If any of them indicates
+ * pressure for DEGRADE_RAISE_SECS consecutive seconds, the degradation level
+ * is raised by one step, up to DEGRADE_ANCESTORS.  After DEGRADE_LOWER_SECS
+ * consecutive seconds without pressure, it is lowered by one step again.
+ * Every transition is logged as a xnumon-ops[0] event with op degrade.
+ *
+ * The workers and the log thread read the current level when acquiring and
+ * rendering images and skip the work of the steps in effect, see
+ * degrade.h.  Skipped work is not redone later, i.e. events processed while
+ * degraded lack the sha256 hash, the signature or the older ancestors.
+ * Degraded images never enter the hash cache, so that no partial hashes
+ * are served from it after the pressure is gone.
+ */
+
+atomic_uint degrade_current;
+
+static config_t *config = NULL;
+static unsigned int pressured;          /* consecutive seconds */
+static unsigned int calm;               /* consecutive seconds */
+static uint64_t last_nsec;
+static uint64_t last_apdrops;
+static uint64_t last_usecs;
+static uint64_t raises;
+static uint64_t lowers;
+static counter_t sha256_skipped;
+static counter_t codesign_skipped;
+static counter_t ancestors_truncated;
+
+void
+degrade_init(config_t *cfg) {
+	config = cfg;
+	atomic_store(&degrade_current, DEGRADE_NONE);
+	pressured = 0;
+	calm = 0;
+	last_nsec = 0;
+	last_apdrops = 0;
+	last_usecs = 0;
+	raises = 0;
+	lowers = 0;
+	counter_reset(&sha256_skipped);
+	counter_reset(&codesign_skipped);
+	counter_reset(&ancestors_truncated);
+}
+
+/*
+ * Returns the kind of pressure observed since the last call, or NULL if
+ * there was none.
+ */
+static const char *
+degrade_pressure(uint32_t depth, uint64_t apdrops, uint64_t usecs,
+                 uint64_t nsec) {
+	const char *reason = NULL;
+
+	if (last_nsec == 0)
+		goto out;
+	if ((uint64_t)depth * 100 >=
+	    (uint64_t)config->queue_capacity * config->degrade_queue)
+		reason = "queue";
+	else if (apdrops > last_apdrops)
+		reason = "aupipe_drops";
+	else if (config->degrade_cpu > 0 && nsec > last_nsec &&
+	         usecs > last_usecs &&
+	         (usecs - last_usecs) * 100000 / (nsec - last_nsec) >=
+	         config->degrade_cpu)
+		reason = "cpu";
+out:
+	last_nsec = nsec;
+	last_apdrops = apdrops;
+	last_usecs = usecs;
+	return reason;
+}
+
+static void
+degrade_transition(unsigned int level, const char *reason) {
+	unsigned int prev = degrade_level();
+
+	atomic_store_explicit(&degrade_current, level, memory_order_relaxed);
+	if (level > prev)
+		raises++;
+	else
+		lowers++;
+	if (log_event_xnumon_degrade(level, prev, reason) == -1)
+		fprintf(stderr, "Failed to log degrade transition: "
+		                "%s (%i)\n", strerror(errno), errno);
+}
+
+/*
+ * Called by the event loop every second with the depth of the deepest work
+ * or log queue, the total auditpipe(4) drops and the total CPU time used.
+ * Main thread only.
+ */
+void
+degrade_tick(uint32_t depth, uint64_t apdrops, uint64_t usecs) {
+	const char *reason;
+	unsigned int level;
+
+	if (!config || !config->degrade)
+		return;
+
+	reason = degrade_pressure(depth, apdrops, usecs, timespec_mononsec());
+	level = degrade_level();
+	if (reason) {
+		calm = 0;
+		if (++pressured >= DEGRADE_RAISE_SECS &&
+		    level + 1 < DEGRADE_LEVELS) {
+			pressured = 0;
+			degrade_transition(level + 1, reason);
+		}
+	} else {
+		pressured = 0;
+		if (++calm >= DEGRADE_LOWER_SECS && level > DEGRADE_NONE) {
+			calm = 0;
+			degrade_transition(level - 1, "calm");
+		}
+	}
+}
+
+void
+degrade_stats(degrade_stat_t *st) {
+	assert(st);
+
+	st->level = degrade_level();
+	st->raises = raises;
+	st->lowers = lowers;
+	st->sha256_skipped = counter_get(&sha256_skipped);
+	st->codesign_skipped = counter_get(&codesign_skipped);
+	st->ancestors_truncated = counter_get(&ancestors_truncated);
+}
+
+void
+degrade_skipped_sha256(void) {
+	counter_inc(&sha256_skipped);
+}
+
+void
+degrade_skipped_codesign(void) {
+	counter_inc(&codesign_skipped);
+}
+
+void
+degrade_truncated_ancestors(void) {
+	counter_inc(&ancestors_truncated);
+}
+
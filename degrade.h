@@ -0,0 +1,55 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef DEGRADE_H
+#define DEGRADE_H
+
+#include "config.h"
+#include "attrib.h"
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* degradation levels, each implying all lower ones */
+#define DEGRADE_NONE            0
+#define DEGRADE_HASHES          1       /* skip sha256 if md5/sha1 enabled */
+#define DEGRADE_CODESIGN        2       /* skip uncached codesign checks */
+#define DEGRADE_ANCESTORS       3       /* cap ancestors at degrade_ancestors */
+#define DEGRADE_LEVELS          4
+
+#define DEGRADE_RAISE_SECS      3       /* pressure before stepping up */
+#define DEGRADE_LOWER_SECS      30      /* calm before stepping down */
+
+typedef struct {
+	uint32_t level;
+	uint64_t raises;
+	uint64_t lowers;
+	uint64_t sha256_skipped;
+	uint64_t codesign_skipped;
+	uint64_t ancestors_truncated;
+} degrade_stat_t;
+
+extern atomic_uint degrade_current;
+
+/*
+ * Current degradation level, may be called from any thread.
+ */
+#define degrade_level() \
+	atomic_load_explicit(&degrade_current, memory_order_relaxed)
+
+void degrade_init(config_t *) NONNULL(1);
+void degrade_tick(uint32_t, uint64_t, uint64_t);
+void degrade_stats(degrade_stat_t *) NONNULL(1);
+void degrade_skipped_sha256(void);
+void degrade_skipped_codesign(void);
+void degrade_truncated_ancestors(void);
+
+#endif
+
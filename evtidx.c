@@ -0,0 +1,761 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "evtidx.h"
+
+#include "procmon.h"
+#include "hackmon.h"
+#include "filemon.h"
+#include "sockmon.h"
+#include "hashes.h"
+#include "intern.h"
+#include "log.h"
+#include "time.h"
+#include "sys.h"
+
+#include "tommyhash.h"
+#include "tommyhashinc.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <assert.h>
+
+/*
+ * Bounded in-memory index over the most recent logged events, answering
+ * queries on a Unix domain socket such as which processes executed an image
+ * with a given sha256 without scanning the log.  Every event passing the log
+ * stage that has a subject image, that is image-exec, process-access,
+ * launchd-add and the socket events, is recorded in a ring of fixed size,
+ * the oldest record making room for the newest one.  Records are indexed by
+ * pid, sha256 of the image, image path and team ID of good signatures, and
+ * retain the paths of up to EVTIDX_LINEAGE ancestor images from the lineage
+ * of the image, such that answers do not depend on procmon still tracking
+ * the processes involved.  Strings are shared with the images through the
+ * intern table.
+ *
+ * A query is a single line "pid <pid>", "sha256 <hex>", "path <path>" or
+ * "teamid <teamid>", answered with the EVTIDX_LIMIT most recent matching
+ * records, newest first, rendered in the configured log format, after which
+ * the connection is closed.  Like the metrics endpoint, clients are served
+ * from the main thread and the socket is only accessible to root.  Client
+ * sockets are added to the kqueue of the main thread and only read when
+ * they become readable, such that slow clients never stall the event loop.
+ * Up to EVTIDX_CLIENTS clients can be waiting for their query to arrive;
+ * clients that have not sent their query within EVTIDX_RECV_TIMEOUT are
+ * dropped when the next client connects, and if none has timed out, the
+ * oldest one is dropped to make room.
+ */
+
+#define EVTIDX_BACKLOG          16
+#define EVTIDX_CLIENTS          16
+#define EVTIDX_RECV_TIMEOUT     1000    /* ms */
+#define EVTIDX_QUERYSZ          1280
+
+#define EVTIDX_KEY_PID          0
+#define EVTIDX_KEY_SHA256       1
+#define EVTIDX_KEY_PATH         2
+#define EVTIDX_KEY_TEAMID       3
+#define EVTIDX_KEYS             4
+
+typedef struct {
+	uint64_t seq;
+	uint64_t code;
+	struct timespec tv;
+	pid_t pid;
+	uint64_t id;                    /* image id */
+	char *path;                     /* interned, or NULL */
+	char *teamid;                   /* interned, or NULL */
+	bool has_sha256;
+	unsigned char sha256[SHA256SZ];
+	size_t depth;
+	struct {
+		pid_t pid;
+		char *path;             /* interned, or NULL */
+	} lineage[EVTIDX_LINEAGE];
+	/* nodes of the records in the index for each key, if indexed */
+	bool indexed[EVTIDX_KEYS];
+	tommy_hashinc_node node[EVTIDX_KEYS];
+} evtidx_rec_t;
+
+typedef struct {
+	int key;                        /* EVTIDX_KEY_* */
+	pid_t pid;
+	unsigned char sha256[SHA256SZ];
+	const char *s;
+} evtidx_query_t;
+
+static const char *evtidx_keys[EVTIDX_KEYS] = {
+	"pid", "sha256", "path", "teamid"
+};
+
+static pthread_mutex_t mutex;
+static tommy_hashinc tables[EVTIDX_KEYS];
+static evtidx_rec_t *ring = NULL;
+static size_t ring_size;
+static size_t ring_used;
+static size_t ring_next;
+static int hflags;
+
+static uint64_t added;
+static uint64_t queries;
+static uint64_t results;
+static uint64_t errors;
+
+typedef struct {
+	int fd;                         /* -1 if unused */
+	uint64_t since;                 /* monotonic nsec of accept */
+	size_t len;
+	char query[EVTIDX_QUERYSZ];
+	kevent_ctx_t ctx;
+} evtidx_client_t;
+
+static int evtidx_fd = -1;
+static char *evtidx_path = NULL;
+static kqueue_t *evtidx_kq = NULL;
+static evtidx_client_t clients[EVTIDX_CLIENTS];
+
+static tommy_hash_t
+evtidx_hash(const evtidx_rec_t *rec, int key) {
+	switch (key) {
+	case EVTIDX_KEY_PID:
+		return tommy_inthash_u32((uint32_t)rec->pid);
+	case EVTIDX_KEY_SHA256:
+		return tommy_hash_u32(0, rec->sha256, SHA256SZ);
+	case EVTIDX_KEY_PATH:
+		return tommy_hash_u32(0, rec->path, strlen(rec->path));
+	case EVTIDX_KEY_TEAMID:
+		return tommy_hash_u32(0, rec->teamid, strlen(rec->teamid));
+	default:
+		assert(0);
+		return 0;
+	}
+}
+
+static tommy_hash_t
+evtidx_query_hash(const evtidx_query_t *q) {
+	switch (q->key) {
+	case EVTIDX_KEY_PID:
+		return tommy_inthash_u32((uint32_t)q->pid);
+	case EVTIDX_KEY_SHA256:
+		return tommy_hash_u32(0, q->sha256, SHA256SZ);
+	default:
+		return tommy_hash_u32(0, q->s, strlen(q->s));
+	}
+}
+
+static bool
+evtidx_match(const evtidx_query_t *q, const evtidx_rec_t *rec) {
+	if (!rec->indexed[q->key])
+		return false;
+	switch (q->key) {
+	case EVTIDX_KEY_PID:
+		return rec->pid == q->pid;
+	case EVTIDX_KEY_SHA256:
+		return !memcmp(rec->sha256, q->sha256, SHA256SZ);
+	case EVTIDX_KEY_PATH:
+		return !strcmp(rec->path, q->s);
+	case EVTIDX_KEY_TEAMID:
+		return !strcmp(rec->teamid, q->s);
+	default:
+		return false;
+	}
+}
+
+static void
+evtidx_rec_release(evtidx_rec_t *rec) {
+	if (rec->path)
+		intern_free(rec->path);
+	if (rec->teamid)
+		intern_free(rec->teamid);
+	for (size_t i = 0; i < rec->depth; i++) {
+		if (rec->lineage[i].path)
+			intern_free(rec->lineage[i].path);
+	}
+}
+
+/*
+ * Remove rec from the index and release its strings.  Called with the mutex
+ * held.
+ */
+static void
+evtidx_rec_evict(evtidx_rec_t *rec) {
+	for (int key = 0; key < EVTIDX_KEYS; key++) {
+		if (rec->indexed[key])
+			tommy_hashinc_remove_existing(&tables[key],
+			                              &rec->node[key]);
+	}
+	evtidx_rec_release(rec);
+}
+
+/*
+ * Fill rec from the event at hdr and its subject image ie.  Called with the
+ * mutex held.
+ */
+static void
+evtidx_rec_fill(evtidx_rec_t *rec, logevt_header_t *hdr, pid_t pid,
+                image_exec_t *ie) {
+	image_exec_t *pie;
+
+	bzero(rec, sizeof(evtidx_rec_t));
+	rec->seq = ++added;
+	rec->code = hdr->code;
+	rec->tv = hdr->tv;
+	rec->pid = pid;
+	rec->indexed[EVTIDX_KEY_PID] = true;
+	if (!ie)
+		return;
+	rec->id = ie->id;
+	if (ie->path) {
+		rec->path = intern_ref(ie->path);
+		rec->indexed[EVTIDX_KEY_PATH] = true;
+	}
+	if ((ie->flags & EIFLAG_HASHES) && (hflags & HASH_SHA256) &&
+	    !(ie->flags & EIFLAG_NOSHA256)) {
+		memcpy(rec->sha256, ie->hashes.sha256, SHA256SZ);
+		rec->has_sha256 = true;
+		rec->indexed[EVTIDX_KEY_SHA256] = true;
+	}
+	if (ie->codesign && codesign_is_good(ie->codesign) &&
+	    ie->codesign->teamid) {
+		rec->teamid = intern_ref(ie->codesign->teamid);
+		rec->indexed[EVTIDX_KEY_TEAMID] = true;
+	}
+	for (pie = ie->prev; pie && pie->pid > 0 &&
+	                     rec->depth < EVTIDX_LINEAGE; pie = pie->prev) {
+		rec->lineage[rec->depth].pid = pie->pid;
+		if (pie->path)
+			rec->lineage[rec->depth].path = intern_ref(pie->path);
+		rec->depth++;
+	}
+}
+
+/*
+ * Record the event at hdr before it is logged.  Called by the log stage for
+ * every event; events without a subject process are ignored.
+ */
+void
+evtidx_add(logevt_header_t *hdr) {
+	evtidx_rec_t *rec;
+	image_exec_t *ie;
+	pid_t pid;
+
+	if (!ring)
+		return;
+
+	switch (hdr->code) {
+	case LOGEVT_IMAGE_EXEC:
+	case LOGEVT_IMAGE_ENRICH:
+		ie = (image_exec_t *)hdr;
+		pid = ie->pid;
+		break;
+	case LOGEVT_PROCESS_ACCESS:
+		ie = ((process_access_t *)hdr)->subject_image_exec;
+		pid = ((process_access_t *)hdr)->subject.pid;
+		break;
+	case LOGEVT_LAUNCHD_ADD:
+		if (((launchd_add_t *)hdr)->flags & LAFLAG_NOSUBJECT)
+			return;
+		ie = ((launchd_add_t *)hdr)->subject_image_exec;
+		pid = ((launchd_add_t *)hdr)->subject.pid;
+		break;
+	case LOGEVT_SOCKET_LISTEN:
+	case LOGEVT_SOCKET_ACCEPT:
+	case LOGEVT_SOCKET_CONNECT:
+		ie = ((socket_op_t *)hdr)->subject_image_exec;
+		pid = ((socket_op_t *)hdr)->subject.pid;
+		break;
+	default:
+		return;
+	}
+
+	pthread_mutex_lock(&mutex);
+	rec = &ring[ring_next];
+	if (ring_used == ring_size)
+		evtidx_rec_evict(rec);
+	else
+		ring_used++;
+	ring_next = (ring_next + 1) % ring_size;
+	evtidx_rec_fill(rec, hdr, pid, ie);
+	for (int key = 0; key < EVTIDX_KEYS; key++) {
+		if (rec->indexed[key])
+			tommy_hashinc_insert(&tables[key], &rec->node[key], rec,
+			                     evtidx_hash(rec, key));
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * Copy the limit most recent records matching q into res, newest first, with
+ * references to their strings.  Returns the number of records copied.
+ */
+static size_t
+evtidx_lookup(evtidx_rec_t *res, size_t limit, const evtidx_query_t *q) {
+	tommy_hashinc_node *node;
+	evtidx_rec_t *rec, tmp;
+	tommy_hash_t h;
+	size_t n = 0, min, j;
+
+	h = evtidx_query_hash(q);
+	pthread_mutex_lock(&mutex);
+	node = tommy_hashinc_bucket(&tables[q->key], h);
+	for (; node; node = node->next) {
+		rec = node->data;
+		if (node->key != h || !evtidx_match(q, rec))
+			continue;
+		if (n < limit) {
+			res[n++] = *rec;
+			continue;
+		}
+		/* replace the oldest record found so far */
+		min = 0;
+		for (size_t i = 1; i < n; i++) {
+			if (res[i].seq < res[min].seq)
+				min = i;
+		}
+		if (rec->seq > res[min].seq)
+			res[min] = *rec;
+	}
+	for (size_t i = 0; i < n; i++) {
+		rec = &res[i];
+		if (rec->path)
+			(void)intern_ref(rec->path);
+		if (rec->teamid)
+			(void)intern_ref(rec->teamid);
+		for (j = 0; j < rec->depth; j++) {
+			if (rec->lineage[j].path)
+				(void)intern_ref(rec->lineage[j].path);
+		}
+	}
+	queries++;
+	results += n;
+	pthread_mutex_unlock(&mutex);
+
+	/* newest first */
+	for (size_t i = 1; i < n; i++) {
+		tmp = res[i];
+		for (j = i; j > 0 && res[j - 1].seq < tmp.seq; j--)
+			res[j] = res[j - 1];
+		res[j] = tmp;
+	}
+	return n;
+}
+
+static int
+evtidx_render_rec(logfmt_t *fmt, logfmt_ctx_t *ctx, void *arg) {
+	evtidx_rec_t *rec = arg;
+
+	fmt->record_begin(ctx);
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "version");
+	fmt->value_uint(ctx, LOGEVT_VERSION);
+	fmt->dict_item(ctx, "time");
+	fmt->value_timespec(ctx, &rec->tv);
+	fmt->dict_item(ctx, "eventcode");
+	fmt->value_uint(ctx, rec->code);
+	fmt->dict_item(ctx, "pid");
+	fmt->value_int(ctx, rec->pid);
+	if (rec->id > 0) {
+		fmt->dict_item(ctx, "image");
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "image_id");
+		fmt->value_uint(ctx, rec->id);
+		if (rec->path) {
+			fmt->dict_item(ctx, "path");
+			fmt->value_string(ctx, rec->path);
+		}
+		if (rec->has_sha256) {
+			fmt->dict_item(ctx, "sha256");
+			fmt->value_buf_hex(ctx, rec->sha256, SHA256SZ);
+		}
+		if (rec->teamid) {
+			fmt->dict_item(ctx, "teamid");
+			fmt->value_string(ctx, rec->teamid);
+		}
+		fmt->dict_end(ctx); /* image */
+		fmt->dict_item(ctx, "ancestors");
+		fmt->list_begin(ctx);
+		for (size_t i = 0; i < rec->depth; i++) {
+			fmt->list_item(ctx, "ancestor");
+			fmt->dict_begin(ctx);
+			fmt->dict_item(ctx, "pid");
+			fmt->value_int(ctx, rec->lineage[i].pid);
+			if (rec->lineage[i].path) {
+				fmt->dict_item(ctx, "path");
+				fmt->value_string(ctx, rec->lineage[i].path);
+			}
+			fmt->dict_end(ctx); /* ancestor */
+		}
+		fmt->list_end(ctx); /* ancestors */
+	}
+	fmt->dict_end(ctx);
+	fmt->record_end(ctx);
+	return 0;
+}
+
+static int
+evtidx_unhex(unsigned char *dst, const char *src, size_t sz) {
+	unsigned int v;
+
+	if (strlen(src) != sz * 2)
+		return -1;
+	for (size_t i = 0; i < sz * 2; i++) {
+		if (!isxdigit((unsigned char)src[i]))
+			return -1;
+	}
+	for (size_t i = 0; i < sz; i++) {
+		if (sscanf(src + i * 2, "%2x", &v) != 1)
+			return -1;
+		dst[i] = (unsigned char)v;
+	}
+	return 0;
+}
+
+/*
+ * Parse the query line in buf, which is modified.
+ */
+static int
+evtidx_parse(evtidx_query_t *q, char *buf) {
+	char *value, *end;
+	long pid;
+
+	buf[strcspn(buf, "\r\n")] = '\0';
+	value = strchr(buf, ' ');
+	if (!value)
+		return -1;
+	*value++ = '\0';
+	if (!*value)
+		return -1;
+	for (q->key = 0; q->key < EVTIDX_KEYS; q->key++) {
+		if (!strcmp(buf, evtidx_keys[q->key]))
+			break;
+	}
+	switch (q->key) {
+	case EVTIDX_KEY_PID:
+		errno = 0;
+		pid = strtol(value, &end, 10);
+		if (errno || *end || pid <= 0 || pid > INT32_MAX)
+			return -1;
+		q->pid = (pid_t)pid;
+		return 0;
+	case EVTIDX_KEY_SHA256:
+		return evtidx_unhex(q->sha256, value, SHA256SZ);
+	case EVTIDX_KEY_PATH:
+	case EVTIDX_KEY_TEAMID:
+		q->s = value;
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Render the answer to the query in buf into a newly allocated buffer.
+ */
+static int
+evtidx_answer(char *buf, char **out, size_t *outsz) {
+	evtidx_query_t q;
+	evtidx_rec_t *res;
+	FILE *f;
+	size_t n;
+	int rv = 0;
+
+	bzero(&q, sizeof(q));
+	if (evtidx_parse(&q, buf) == -1) {
+		pthread_mutex_lock(&mutex);
+		errors++;
+		pthread_mutex_unlock(&mutex);
+		errno = EINVAL;
+		return -1;
+	}
+	res = malloc(EVTIDX_LIMIT * sizeof(evtidx_rec_t));
+	if (!res)
+		return -1;
+	n = evtidx_lookup(res, EVTIDX_LIMIT, &q);
+	*out = NULL;
+	*outsz = 0;
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunguarded-availability"
+	f = open_memstream(out, outsz);
+#pragma clang diagnostic pop
+	if (!f)
+		rv = -1;
+	for (size_t i = 0; i < n; i++) {
+		if (f && rv == 0)
+			rv = log_render_func(f, evtidx_render_rec, &res[i]);
+		evtidx_rec_release(&res[i]);
+	}
+	free(res);
+	if (f && fclose(f) == EOF)
+		rv = -1;
+	if (rv == -1) {
+		free(*out);
+		*out = NULL;
+	}
+	return rv;
+}
+
+static void
+evtidx_respond(int fd, const char *buf, size_t sz) {
+	int bufsz = (int)sz, one = 1;
+	ssize_t n;
+
+#ifdef SO_NOSIGPIPE
+	(void)setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#else
+	(void)one;
+#endif
+	(void)setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsz, sizeof(bufsz));
+	while (sz > 0) {
+		n = write(fd, buf, sz);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		buf += n;
+		sz -= (size_t)n;
+	}
+}
+
+/*
+ * Stop watching a client and close the connection.
+ */
+static void
+evtidx_drop(evtidx_client_t *c) {
+	if (kqueue_del_fd_read(evtidx_kq, c->fd) == -1)
+		fprintf(stderr, "Failed to remove query client: %s (%i)\n",
+		                strerror(errno), errno);
+	close(c->fd);
+	c->fd = -1;
+}
+
+/*
+ * Called by the event loop whenever a client socket becomes readable.  The
+ * query is answered as soon as the line is complete or the client shuts
+ * down its end of the connection, whichever comes first.
+ */
+static int
+evtidx_client_readable(int fd, UNUSED size_t avail, void *udata) {
+	evtidx_client_t *c = udata;
+	char *buf;
+	size_t sz;
+	ssize_t n;
+
+	/* client dropped after the event was returned by the kqueue */
+	if (c->fd != fd)
+		return 0;
+
+	n = read(fd, c->query + c->len, sizeof(c->query) - 1 - c->len);
+	if (n == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
+		evtidx_drop(c);
+		return 0;
+	}
+	c->len += (size_t)n;
+	c->query[c->len] = '\0';
+	if (!strchr(c->query, '\n')) {
+		if (n > 0 && c->len < sizeof(c->query) - 1)
+			return 0;
+		/* query too long, or connection closed without query */
+		if (n > 0 || c->len == 0) {
+			evtidx_drop(c);
+			return 0;
+		}
+	}
+
+	if (evtidx_answer(c->query, &buf, &sz) == 0) {
+		evtidx_respond(fd, buf, sz);
+		free(buf);
+	} else if (errno != EINVAL) {
+		fprintf(stderr, "Failed to answer query: %s (%i)\n",
+		                strerror(errno), errno);
+	}
+	evtidx_drop(c);
+	return 0;
+}
+
+/*
+ * Find a slot for a newly accepted client, dropping clients that have not
+ * sent their query within EVTIDX_RECV_TIMEOUT, or else the oldest client.
+ */
+static evtidx_client_t *
+evtidx_slot(uint64_t now) {
+	evtidx_client_t *c, *slot = NULL, *oldest = NULL;
+
+	for (size_t i = 0; i < EVTIDX_CLIENTS; i++) {
+		c = &clients[i];
+		if (c->fd != -1 &&
+		    now - c->since >= EVTIDX_RECV_TIMEOUT * 1000000ULL)
+			evtidx_drop(c);
+		if (c->fd == -1) {
+			if (!slot)
+				slot = c;
+			continue;
+		}
+		if (!oldest || c->since < oldest->since)
+			oldest = c;
+	}
+	if (!slot) {
+		evtidx_drop(oldest);
+		slot = oldest;
+	}
+	return slot;
+}
+
+/*
+ * Accept all pending clients and start watching them for their query.
+ * Called by the event loop whenever the listening socket becomes readable.
+ */
+int
+evtidx_serve(void) {
+	evtidx_client_t *c;
+	uint64_t now;
+	int fd;
+
+	for (;;) {
+		fd = sys_unixsock_accept(evtidx_fd);
+		if (fd == -1)
+			return errno == EAGAIN ? 0 : -1;
+		now = timespec_mononsec();
+		c = evtidx_slot(now);
+		if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1 ||
+		    kqueue_add_fd_read(evtidx_kq, fd, &c->ctx) == -1) {
+			fprintf(stderr, "Failed to add query client: "
+			                "%s (%i)\n", strerror(errno), errno);
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		c->since = now;
+		c->len = 0;
+	}
+}
+
+/*
+ * Create the listening socket at path, replacing a stale socket left over
+ * from a previous run.  Returns the fd to watch for readability, on which
+ * evtidx_serve must be called.  Accepted clients are added to kq, which
+ * must be dispatched on the same thread.
+ */
+int
+evtidx_open(const char *path, kqueue_t *kq) {
+	int e;
+
+	evtidx_path = strdup(path);
+	if (!evtidx_path)
+		return -1;
+	evtidx_fd = sys_unixsock_open(path, EVTIDX_BACKLOG);
+	if (evtidx_fd == -1) {
+		e = errno;
+		free(evtidx_path);
+		evtidx_path = NULL;
+		errno = e;
+		return -1;
+	}
+	evtidx_kq = kq;
+	for (size_t i = 0; i < EVTIDX_CLIENTS; i++) {
+		clients[i].fd = -1;
+		clients[i].ctx = (kevent_ctx_t)KEVENT_CTX_FD_READ(
+		                 evtidx_client_readable, &clients[i]);
+	}
+	return evtidx_fd;
+}
+
+/*
+ * Closing the client sockets removes them from the kqueue, which may have
+ * been freed already.
+ */
+void
+evtidx_close(void) {
+	if (evtidx_fd == -1)
+		return;
+	for (size_t i = 0; i < EVTIDX_CLIENTS; i++) {
+		if (clients[i].fd == -1)
+			continue;
+		close(clients[i].fd);
+		clients[i].fd = -1;
+	}
+	evtidx_kq = NULL;
+	sys_unixsock_close(evtidx_fd, evtidx_path);
+	evtidx_fd = -1;
+	free(evtidx_path);
+	evtidx_path = NULL;
+}
+
+/*
+ * Allocate an index retaining the most recent size records.  The sha256
+ * hashes of images are only indexed if they are part of flags.
+ */
+int
+evtidx_init(size_t size, int flags) {
+	assert(size > 0);
+
+	ring = calloc(size, sizeof(evtidx_rec_t));
+	if (!ring)
+		return -1;
+	if (pthread_mutex_init(&mutex, NULL) != 0) {
+		free(ring);
+		ring = NULL;
+		return -1;
+	}
+	for (int key = 0; key < EVTIDX_KEYS; key++)
+		tommy_hashinc_init(&tables[key]);
+	ring_size = size;
+	ring_used = 0;
+	ring_next = 0;
+	hflags = flags;
+	added = 0;
+	queries = 0;
+	results = 0;
+	errors = 0;
+	return 0;
+}
+
+/*
+ * Must be called after the log stage has been shut down.
+ */
+void
+evtidx_fini(void) {
+	if (!ring)
+		return;
+	for (size_t i = 0; i < ring_used; i++)
+		evtidx_rec_release(&ring[i]);
+	for (int key = 0; key < EVTIDX_KEYS; key++)
+		tommy_hashinc_done(&tables[key]);
+	free(ring);
+	ring = NULL;
+	pthread_mutex_destroy(&mutex);
+}
+
+void
+evtidx_stats(evtidx_stat_t *st) {
+	if (!ring) {
+		bzero(st, sizeof(evtidx_stat_t));
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	st->size = ring_size;
+	st->used = ring_used;
+	st->added = added;
+	st->queries = queries;
+	st->results = results;
+	st->errors = errors;
+	pthread_mutex_unlock(&mutex);
+}
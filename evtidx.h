@@ -0,0 +1,43 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef EVTIDX_H
+#define EVTIDX_H
+
+#include "logevt.h"
+#include "kqueue.h"
+#include "attrib.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EVTIDX_SIZE             16384   /* records, default */
+#define EVTIDX_LINEAGE          4       /* ancestor images per record */
+#define EVTIDX_LIMIT            100     /* results per query, default */
+
+typedef struct {
+	uint64_t size;          /* records retained */
+	uint64_t used;
+	uint64_t added;
+	uint64_t queries;
+	uint64_t results;
+	uint64_t errors;        /* malformed queries */
+} evtidx_stat_t;
+
+int evtidx_init(size_t, int) WUNRES;
+void evtidx_fini(void);
+void evtidx_add(logevt_header_t *) NONNULL(1);
+int evtidx_open(const char *, kqueue_t *) NONNULL(1,2) WUNRES;
+void evtidx_close(void);
+int evtidx_serve(void);
+void evtidx_stats(evtidx_stat_t *) NONNULL(1);
+
+#endif
+
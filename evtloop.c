@@ -11,13 +11,23 @@
 #include "evtloop.h"
 
 #include "auclass.h"
+#include "cshelper.h"
 #include "auevent.h"
 #include "aupolicy.h"
 #include "sys.h"
+#include "pidcache.h"
+#include "trace.h"
+#include "probes.h"
+#include "signpost.h"
+#include "metrics.h"
+#include "profile.h"
+#include "queue.h"
 #include "str.h"
 #include "time.h"
+#include "minmax.h"
 #include "os.h"
 #include "policy.h"
+#include "thrstat.h"
 #include "debug.h"
 #include "attrib.h"
 
@@ -34,10 +44,19 @@
 #include <assert.h>
 
 static bool running = true;     /* shared */
+static kqueue_t *mainkq = NULL; /* shared */
 static int kefd = -1;           /* shared */
 static FILE *auef = NULL;
+static aubuf_t aubuf;                   /* zero-copy reader for auef */
+static bool aubuf_enabled = false;
+static auring_t auring;                 /* threaded reader for auef */
+static bool auring_enabled = false;
+static auevent_typeset_t auetypes;      /* types in AC_XNUMON class mask */
+static evtloop_aue_count_t auerejects[EVTLOOP_AUEREJECTS_MAX];
 static pid_t xnumon_pid;
 static uint64_t aupclobbers = 0;
+static uint64_t aupchecks = 0;
+static uint64_t aupnotifies = 0;
 static uint64_t aueunknowns = 0;
 static uint64_t failedsyscalls = 0;
 static uint64_t radar38845422 = 0;
@@ -56,25 +75,181 @@ static uint64_t radar42946744_fatal = 0;
 static uint64_t radar43151662_fatal = 0;        /* always fatal */
 static uint64_t missingtoken = 0;
 static uint64_t ooms = 0;
+static uint64_t partials = 0;
+static uint64_t localskips = 0;
 
 static bool kextloop_running = true;
 static pthread_t kextloop_thr;
+static kqueue_t *kextloop_kq = NULL;
+static bool kextloop_backlog_ok = false;        /* kextloop only */
+static uint32_t kextloop_backlog_level;         /* kextloop only */
+
+/*
+ * Both event loops block in kevent until an event is ready.  Other threads
+ * wake them up through a user event after changing running or
+ * kextloop_running, instead of the loops polling these every second.
+ */
+#define USER_WAKEUP     1
 
 static int
-kefd_readable(int fd, UNUSED void *udata) {
-	const xnumon_msg_t *msg;
-	struct timespec tm;
+wakeup_arrived(UNUSED int ident, UNUSED void *udata) {
+	return 0;
+}
 
-	msg = kextctl_recv(fd);
-	if (!msg)
-		return -1;
-	tm.tv_sec = msg->time_s;
-	tm.tv_nsec = msg->time_ns;
-	procmon_kern_preexec(&tm, (pid_t)msg->pid, msg->path);
-	if (kextctl_ack(fd, msg) == -1) {
-		fprintf(stderr, "Failed to acknowledge message from kext\n");
-		return -1;
+static kevent_ctx_t wakeup_ctx = KEVENT_CTX_USER(wakeup_arrived, NULL);
+
+/*
+ * Make the main event loop notice a change of running.
+ */
+static void
+evtloop_wakeup(void) {
+	kqueue_t *kq = mainkq;
+
+	if (kq && kqueue_trigger_user(kq, USER_WAKEUP) == -1)
+		fprintf(stderr, "kqueue_trigger_user() failed: %s (%i)\n",
+		                strerror(errno), errno);
+}
+
+/* counters at the start of the current stats interval */
+static struct {
+	uint64_t nsec;                  /* monotonic */
+	uint64_t counts[LOGEVT_SIZE];
+	uint64_t hashbytes;
+	uint64_t csevals;
+	uint64_t ch_gets, ch_hits;
+	uint64_t cc_gets, cc_hits;
+	uint64_t cl_gets, cl_hits;
+	uint64_t usecs[THRSTAT_CLASSES];
+	uint64_t ap_drops;
+	uint64_t wq_drops;
+	uint64_t lq_drops;
+} ivstart;
+
+static char snpath[PATH_MAX];
+static const char *snapshot_path;       /* NULL if not persisted */
+static struct timespec startup_tv;      /* monotonic */
+static struct timespec stage_tv;        /* monotonic */
+static xnumon_stage_t stagev[XNUMON_STAGES_MAX];
+static size_t stagec;
+
+/*
+ * Record the time spent since the previous startup stage, or since the
+ * start of evtloop_run, as startup stage name.
+ */
+static void
+startup_stage(const char *name) {
+	struct timespec now;
+
+	if (stagec >= XNUMON_STAGES_MAX || timespec_monotime(&now) == -1)
+		return;
+	stagev[stagec].name = name;
+	stagev[stagec].nsec = timespec_diff_nsec(&now, &stage_tv);
+	stagec++;
+	stage_tv = now;
+}
+
+/*
+ * Nanoseconds since the start of evtloop_run, at least 1.
+ */
+static uint64_t
+startup_nsec(void) {
+	struct timespec now;
+
+	if (timespec_monotime(&now) == -1)
+		return 1;
+	return max(timespec_diff_nsec(&now, &startup_tv), (uint64_t)1);
+}
+
+/*
+ * Maximum number of records or messages processed per readability event
+ * before going back to kevent, so that signals and timers are not starved.
+ */
+#define READ_BUDGET 1024
+
+/*
+ * Report the prep queue size to the kext whenever it moves into another
+ * sixteenth of kext_backlog_watermark, such that the kext can adapt how
+ * long it blocks execs without an ioctl per batch.  Stops trying with kexts
+ * not supporting it.
+ */
+static void
+kextloop_backlog(int fd, config_t *cfg) {
+	uint32_t wm = cfg->kext_backlog_watermark;
+	uint32_t backlog, level;
+
+	if (!kextloop_backlog_ok || wm == 0)
+		return;
+	backlog = (uint32_t)min(procmon_prepq_size(), (uint64_t)wm);
+	level = (uint32_t)((uint64_t)backlog * 16 / wm);
+	if (level == kextloop_backlog_level)
+		return;
+	if (kextctl_backlog(fd, backlog, wm) == -1) {
+		fprintf(stderr, "Failed to report backlog to kext: %s (%i)\n",
+		                strerror(errno), errno);
+		kextloop_backlog_ok = false;
+		return;
 	}
+	kextloop_backlog_level = level;
+}
+
+/*
+ * With protocol version 2, keep reading as long as the kext fills a whole
+ * batch instead of going back to kevent for every batch; under exec bursts
+ * this saves a kevent round-trip per batch while execs are blocked.  With
+ * both protocol versions, keep reading as long as the byte count reported
+ * by kevent has not been consumed yet.  Before reading, kesched may delay
+ * the kext in favour of audit consumption, see kesched.c.  Afterwards, the
+ * backlog is reported to the kext.  With kext_threads, messages are handed
+ * to the kextpool threads, which acknowledge them, see kextpool.c.
+ */
+static int
+kefd_readable(int fd, size_t avail, void *udata) {
+	const xnumon_msg_t *msgv[XNUMON_ACKV_MAX];
+	struct timespec tm;
+	size_t budget = READ_BUDGET;
+	size_t want, got = 0, nack;
+	ssize_t n;
+	int rv;
+
+	kesched_kext(avail);
+	do {
+		want = min(budget, (size_t)XNUMON_ACKV_MAX);
+		n = kextctl_recv_batch(fd, msgv, want);
+		if (n == -1)
+			return -1;
+		nack = 0;
+		for (ssize_t i = 0; i < n; i++) {
+			if (trace_recording())
+				trace_record_kext(msgv[i]);
+			got += msgv[i]->msgsz;
+			XNUMON_KEXT_RECV((int)msgv[i]->pid, msgv[i]->path);
+			if (kextpool_threads() > 0) {
+				if (kextpool_submit(msgv[i]) == -1) {
+					fprintf(stderr, "Failed to dispatch "
+					                "message from kext\n");
+					return -1;
+				}
+				continue;
+			}
+			tm.tv_sec = msgv[i]->time_s;
+			tm.tv_nsec = msgv[i]->time_ns;
+			procmon_kern_preexec(&tm, (pid_t)msgv[i]->pid,
+			                     msgv[i]->path,
+			                     XNUMON_MSG_HASH(msgv[i]),
+			                     XNUMON_MSG_IDENT(msgv[i]));
+			msgv[nack++] = msgv[i];
+		}
+		rv = kextctl_ack_batch(fd, msgv, nack);
+		XNUMON_KEXT_ACK((int)nack, rv);
+		if (rv == -1) {
+			fprintf(stderr, "Failed to acknowledge message "
+			                "from kext\n");
+			return -1;
+		}
+		budget -= (size_t)n;
+	} while (n > 0 && budget > 0 && kextloop_running &&
+	         ((kextctl_proto() >= 2 && (size_t)n == want) || got < avail));
+	kextloop_backlog(fd, (config_t *)udata);
 	return 0;
 }
 
@@ -86,46 +261,133 @@ kextloop_thread(void *arg) {
 	(void)policy_thread_sched_priority(TP_HIGH);
 #endif
 	(void)policy_thread_diskio_important();
+	(void)policy_thread_qos(THRSTAT_KEXTLOOP);
+	thrstat_register(THRSTAT_KEXTLOOP);
 
 	/* event dispatch loop */
-	kextloop_running = true;
 	for (;;) {
-		int rv = kqueue_dispatch(kq);
+		int rv = kqueue_dispatch(kq, NULL);
 		if (!kextloop_running)
 			break;
 		if (rv != 0) {
 			fprintf(stderr, "kevent_dispatch() failed\n");
 			running = false; /* stop main loop */
+			evtloop_wakeup();
 			break;
 		}
 	}
 
-	kqueue_free(kq);
+	kextpool_fini();
 	close(kefd);
 	kefd = -1;
 	return NULL;
 }
 
+/*
+ * The kqueue of the kextloop thread is freed here rather than by the thread
+ * itself, such that it can be triggered without racing the thread exiting.
+ */
 static void
 kextloop_break(void) {
 	kextloop_running = false;
+	if (kqueue_trigger_user(kextloop_kq, USER_WAKEUP) == -1)
+		fprintf(stderr, "kqueue_trigger_user() failed: %s (%i)\n",
+		                strerror(errno), errno);
 	if (pthread_join(kextloop_thr, NULL) != 0) {
 		fprintf(stderr, "Failed to join kextloop thread - exiting\n");
 		exit(EXIT_FAILURE);
 	}
+	kqueue_free(kextloop_kq);
+	kextloop_kq = NULL;
 }
 
+/*
+ * Push the directories in kext_nowait_by_path to the kext and, with
+ * suppress_image_exec_lean, the absolute paths in suppress_image_exec_by_path,
+ * whose execs are suppressed regardless of what the kext would wait for.
+ * Kexts that only support directories get the directories only.  An empty
+ * filter is only pushed if force is set, to clear a previous filter.
+ */
 static int
-kextloop_spawn(kevent_ctx_t *ctx) {
+kextloop_filter(config_t *cfg, bool force) {
+	setstr_t *by_path = NULL;
+	setstr_prefix_t *v;
+	size_t n, ndirs;
+	int rv;
+
+	ndirs = cfg->kext_nowait_by_path.prefixes_size;
+	n = ndirs;
+	if (cfg->suppress_image_exec_lean) {
+		by_path = atomic_load(&cfg->suppress_image_exec_by_path);
+		if (by_path)
+			n += by_path->slots_size;
+	}
+	if (n == 0 && !force)
+		return 0;
+	v = malloc((n > 0 ? n : 1) * sizeof(setstr_prefix_t));
+	if (!v)
+		return -1;
+	memcpy(v, cfg->kext_nowait_by_path.prefixes,
+	       ndirs * sizeof(setstr_prefix_t));
+	n = ndirs;
+	for (size_t i = 0; by_path && i < by_path->slots_size; i++) {
+		if (by_path->slots[i].str[0] != '/')
+			continue;
+		v[n].str = by_path->slots[i].str;
+		v[n].len = by_path->slots[i].len;
+		n++;
+	}
+	rv = kextctl_filter(kefd, v, n);
+	if (rv == -1 && n > ndirs && (errno == EINVAL || errno == E2BIG))
+		rv = kextctl_filter(kefd, v, ndirs);
+	free(v);
+	return rv;
+}
+
+/*
+ * If tracefd is not -1, read recorded kext messages from tracefd instead of
+ * the kext device.
+ */
+static int
+kextloop_spawn(kevent_ctx_t *ctx, config_t *cfg, int tracefd) {
 	kqueue_t *kq = NULL;
 
-	if ((kefd = kextctl_open()) == -1) {
+	if (tracefd != -1) {
+		kefd = kextctl_attach(tracefd);
+	} else if ((kefd = kextctl_open()) == -1) {
 		fprintf(stderr, "kextctl_open() failed: %s (%i)\n",
 		        strerror(errno), errno);
 		goto errout;
 	}
 	/* from here on the kernel blocks execs until we ACK */
 
+	if (tracefd == -1 && kextloop_filter(cfg, false) == -1) {
+		/* not fatal, the kext just keeps waiting for all execs */
+		fprintf(stderr, "Failed to set kext_nowait_by_path: "
+		                "%s (%i)\n", strerror(errno), errno);
+	}
+	if (tracefd == -1 && cfg->kext_hash_max > 0 &&
+	    cfg->kextlevel >= KEXTLEVEL_HASH && (cfg->hflags & HASH_SHA256) &&
+	    kextctl_hash(kefd, cfg->kext_hash_max) == -1) {
+		/* not fatal, we just keep hashing in userspace */
+		fprintf(stderr, "Failed to set kext_hash_max: %s (%i)\n",
+		                strerror(errno), errno);
+	}
+	if (tracefd == -1 && kextctl_proto() >= 2 &&
+	    kextctl_ident(kefd, true) == -1 && errno != ENOTTY) {
+		/* not fatal, we just open images by path */
+		fprintf(stderr, "Failed to enable kext identities: %s (%i)\n",
+		                strerror(errno), errno);
+	}
+	kextloop_backlog_ok = tracefd == -1 && kextctl_proto() >= 2;
+	kextloop_backlog_level = UINT32_MAX;
+	/* replayed messages are handled in order on the kextloop thread */
+	if (kextpool_init(kefd, tracefd == -1 ? cfg->kext_threads : 0) == -1) {
+		/* not fatal, we just handle all messages on the kextloop */
+		fprintf(stderr, "Failed to start kext threads: %s (%i)\n",
+		                strerror(errno), errno);
+	}
+
 	kq = kqueue_new();
 	if (!kq) {
 		fprintf(stderr, "kqueue_new() failed: %s (%i)\n",
@@ -139,6 +401,14 @@ kextloop_spawn(kevent_ctx_t *ctx) {
 		goto errout;
 	}
 
+	if (kqueue_add_user(kq, USER_WAKEUP, &wakeup_ctx) == -1) {
+		fprintf(stderr, "kqueue_add_user() failed: %s (%i)\n",
+		                strerror(errno), errno);
+		goto errout;
+	}
+
+	kextloop_running = true;
+	kextloop_kq = kq;
 	if (pthread_create(&kextloop_thr, NULL, kextloop_thread, kq) != 0) {
 		fprintf(stderr, "pthread_create() failed: "
 		                "%s (%i)\n", strerror(errno), errno);
@@ -148,9 +418,11 @@ kextloop_spawn(kevent_ctx_t *ctx) {
 
 errout:
 	if (kq) {
+		kextloop_kq = NULL;
 		kqueue_free(kq);
 	}
 	if (kefd != -1) {
+		kextpool_fini();
 		close(kefd);
 		kefd = -1;
 	}
@@ -178,7 +450,7 @@ path_resolve(char **path, const char **cwd, const char *unrpath,
 		*cwd = NULL;
 	}
 
-	*path = sys_realpath(unrpath, *cwd);
+	*path = cachepath_realpath(unrpath, *cwd);
 	if (!*path && (errno == ENOMEM))
 		ooms++;
 }
@@ -198,7 +470,7 @@ path_resolve_symlink(char **path, const char **cwd, const char *unrpath,
 		*cwd = NULL;
 	}
 
-	*path = sys_realdir(unrpath, *cwd);
+	*path = cachepath_realdir(unrpath, *cwd);
 	if (!*path && (errno == ENOMEM))
 		ooms++;
 }
@@ -233,743 +505,817 @@ path_resolve_symlink(char **path, const char **cwd, const char *unrpath,
  *
  * Presence of bugs without workaround can be detected using the test suite.
  */
-#define TOKEN_ASSERT(EVENT, TOKEN, COND) \
-	if (!(COND)) { \
-		missingtoken++; \
-		DEBUG(cfg->debug, "missingtoken", \
-		      "event=" EVENT " token=" TOKEN); \
-		if (cfg->debug) \
-			auevent_fprint(stderr, &ev); \
-		break; \
+/*
+ * Some event types seem to be logged regardless of the class mask settings.
+ * Records of types we do not handle are rejected by the reader based on the
+ * header token.  Count them by type; the first EVTLOOP_AUEREJECTS_MAX - 1
+ * types seen get their own counter, all others are counted in the last slot
+ * with type 0.
+ */
+static void
+auereject(uint16_t type) {
+	size_t i;
+
+	aueunknowns++;
+	for (i = 0; i < EVTLOOP_AUEREJECTS_MAX - 1; i++) {
+		if (auerejects[i].type == type)
+			break;
+		if (auerejects[i].count == 0) {
+			auerejects[i].type = type;
+			break;
+		}
 	}
-static int
-auef_readable(UNUSED int fd, void *udata) {
-	config_t *cfg = (config_t *)udata;
-	audit_event_t ev;
-	const char *cwd;
-	char *path;
-	const char *cpath;
-	bool flag;
-	int rv;
+	auerejects[i].count++;
+}
 
-	auevent_create(&ev);
-	rv = auevent_fread(&ev, NULL, cfg->envlevel /* HACK */, auef);
-	if (rv == -1 || rv == 0) {
-		if (ev.flags & AEFLAG_ENOMEM)
-			ooms++;
-		auevent_destroy(&ev);
-		return rv;
+/*
+ * Tokens that handlers can require, as a mask computed once per record such
+ * that all required tokens are checked in a single test.
+ */
+#define AUEF_TOK_RETURN         0x01
+#define AUEF_TOK_SUBJECT        0x02
+#define AUEF_TOK_PROCESS        0x04
+#define AUEF_TOK_PATH0          0x08
+#define AUEF_TOK_ARG1           0x10
+#define AUEF_TOK_ARG2           0x20
+#define AUEF_TOK_ARG3           0x40
+
+static const char *auef_toknames[] = {
+	"return", "subject", "process", "path[0]",
+	"args[1]", "args[2]", "args[3]"
+};
+
+static inline uint32_t
+auef_tokens(const audit_event_t *ev) {
+	return (ev->return_present ? AUEF_TOK_RETURN : 0) |
+	       (ev->subject_present ? AUEF_TOK_SUBJECT : 0) |
+	       (ev->process_present ? AUEF_TOK_PROCESS : 0) |
+	       (ev->path[0] ? AUEF_TOK_PATH0 : 0) |
+	       (ev->args[1].present ? AUEF_TOK_ARG1 : 0) |
+	       (ev->args[2].present ? AUEF_TOK_ARG2 : 0) |
+	       (ev->args[3].present ? AUEF_TOK_ARG3 : 0);
+}
+
+/*
+ * Return values that indicate a successful syscall.  Records of failed
+ * syscalls are counted and dropped before the handler is called.
+ */
+#define AUEF_RET_ANY            0       /* no return token required */
+#define AUEF_RET_ZERO           1       /* zero */
+#define AUEF_RET_INT            2       /* non-negative, fd or pid */
+#define AUEF_RET_PID            3       /* positive pid */
+
+static inline bool
+auef_succeeded(int ret, uint32_t value) {
+	switch (ret) {
+	case AUEF_RET_ZERO:
+		return value == 0;
+	case AUEF_RET_INT:
+		return value <= INT_MAX;
+	case AUEF_RET_PID:
+		return value != 0 && value <= INT_MAX;
+	default:
+		return true;
 	}
+}
 
-#ifdef DEBUG_AUDITPIPE
-	auevent_fprint(stderr, &ev);
-#endif
+static void NONNULL(1,2,3,4)
+auef_missingtoken(config_t *cfg, audit_event_t *ev,
+                  const char *event, const char *token) {
+	missingtoken++;
+	DEBUG(cfg->debug, "missingtoken", "event=%s token=%s", event, token);
+	if (cfg->debug)
+		auevent_fprint(stderr, ev);
+}
 
-	/* avoid reacting on our own close invocations */
-	if (ev.subject.pid == xnumon_pid)
-		goto out;
+/*
+ * Handlers are only called for records that passed the checks of their
+ * entry in auef_handlers.
+ */
 
-	switch (ev.type) {
+/*
+ * Events for process monitoring.
+ */
 
-	/*
-	 * Events for process monitoring.
-	 */
+static void
+aue_fork(UNUSED config_t *cfg, audit_event_t *ev) {
+	procmon_fork(&ev->tv, &ev->subject, ev->return_value);
+}
 
-	case AUE_FORK:
-	case AUE_VFORK:
-		TOKEN_ASSERT("fork", "return", ev.return_present);
-		if (ev.return_value > INT_MAX) {
-			failedsyscalls++;
-			break;
-		}
-		TOKEN_ASSERT("fork", "subject", ev.subject_present);
-		procmon_fork(&ev.tv, &ev.subject, ev.return_value);
-		break;
+/*
+ * posix_spawnp spams an event for each directory in $PATH with
+ * return_value==2 until it finds the actual matching executable (10.11.6);
+ * those are dropped as failed syscalls.
+ */
+static void
+aue_posix_spawn(config_t *cfg, audit_event_t *ev) {
+	char *path;
 
-	case AUE_POSIX_SPAWN:
-		TOKEN_ASSERT("posix_spawn", "return", ev.return_present);
-		if (ev.return_value) {
-			/* posix_spawnp spams an event for each directory in
-			 * $PATH with return_value==2 until it finds the actual
-			 * matching executable (10.11.6) */
-			failedsyscalls++;
-			break;
-		}
-		TOKEN_ASSERT("posix_spawn", "subject", ev.subject_present);
-		/*
-		 * On at least 10.11.6 and 10.12.6, the following happens:
-		 * path is /dev/console when launchd spawns xpcproxy,
-		 * path is /dev/null when xpcproxy execs the XPC target,
-		 * path is $CWD/dev/ttysNNN when lldb spawns debug subject;
-		 * in all of these cases, no attr token is provided, and there
-		 * is only one path instead of two.
-		 *
-		 * Reported to Apple as radar 38845422 on 2018-03-25.
-		 *
-		 * As a result, whenever no attr is present or path starts in
-		 * /dev, assume a buggy path.  First try the path by pid.
-		 * If that fails, employ less reliable ways to work around the
-		 * issue.
-		 */
-		path = (char *)(ev.path[1] ? ev.path[1] : ev.path[0]);
-		if (ev.attr_count == 0 || !path ||
-		    !str_beginswith(path, "/dev/")) {
-			radar38845422++;
-			path = sys_pidpath(ev.args[0].present ?
-			                   ev.args[0].value : ev.subject.pid);
-			if (!path) {
-				if (!ev.execarg) {
-					radar38845422_fatal++;
-					DEBUG(cfg->debug,
-					      "radar38845422_fatal",
-					      "path[0]=%s "
-					      "path[1]=%s "
-					      "args[0]=%i "
-					      "pid=%i "
-					      "sys_pidpath(args[0]||pid)=>%s",
-					      ev.path[0],
-					      ev.path[1],
-					      ev.args[0].present
-					      ? (int)ev.args[0].value : -1,
-					      ev.subject.pid,
-					      cwd);
-					break;
-				}
-				/* When launchd spawns the xpcproxy exec
-				 * trampoline, path is /dev/console and argv[0]
-				 * is just xpcproxy; hardcode that.
-				 * This allows a malicious binary to be named
-				 * xpcproxy and triggering this kernel bug to
-				 * hide its hash and codesigning status from
-				 * us unless kextlevel >= 1. */
-				if (!strcmp(ev.execarg[0], "xpcproxy")) {
-					path = strdup("/usr/libexec/xpcproxy");
-				} else {
-					/* As a last resort, use execarg[0] as
-					 * path; note that this is not always
-					 * absolute, can be just the basename;
-					 * also it is forgeable.
-					 * If we are using the kext, the real
-					 * path will be fetched from the kext.
-					 * If not, there will be no way to
-					 * reliably find the corresponding
-					 * image on disk. */
-					path = strdup(ev.execarg[0]);
-				}
-				if (!path)
-					ooms++;
+	/*
+	 * On at least 10.11.6 and 10.12.6, the following happens:
+	 * path is /dev/console when launchd spawns xpcproxy,
+	 * path is /dev/null when xpcproxy execs the XPC target,
+	 * path is $CWD/dev/ttysNNN when lldb spawns debug subject;
+	 * in all of these cases, no attr token is provided, and there
+	 * is only one path instead of two.
+	 *
+	 * Reported to Apple as radar 38845422 on 2018-03-25.
+	 *
+	 * As a result, whenever no attr is present or path starts in
+	 * /dev, assume a buggy path.  First try the path by pid.
+	 * If that fails, employ less reliable ways to work around the
+	 * issue.
+	 */
+	path = (char *)(ev->path[1] ? ev->path[1] : ev->path[0]);
+	if (ev->attr_count == 0 || !path ||
+	    !str_beginswith(path, "/dev/")) {
+		radar38845422++;
+		path = pidcache_path(ev->args[0].present ?
+		                   ev->args[0].value : ev->subject.pid);
+		if (!path) {
+			if (!ev->execarg) {
+				radar38845422_fatal++;
+				DEBUG(cfg->debug,
+				      "radar38845422_fatal",
+				      "path[0]=%s "
+				      "path[1]=%s "
+				      "args[0]=%i "
+				      "pid=%i "
+				      "pidcache_path(args[0]||pid)=>%s",
+				      ev->path[0],
+				      ev->path[1],
+				      ev->args[0].present
+				      ? (int)ev->args[0].value : -1,
+				      ev->subject.pid,
+				      path);
+				return;
+			}
+			/* When launchd spawns the xpcproxy exec
+			 * trampoline, path is /dev/console and argv[0]
+			 * is just xpcproxy; hardcode that.
+			 * This allows a malicious binary to be named
+			 * xpcproxy and triggering this kernel bug to
+			 * hide its hash and codesigning status from
+			 * us unless kextlevel >= 1. */
+			if (!strcmp(ev->execarg[0], "xpcproxy")) {
+				path = strdup("/usr/libexec/xpcproxy");
+			} else {
+				/* As a last resort, use execarg[0] as
+				 * path; note that this is not always
+				 * absolute, can be just the basename;
+				 * also it is forgeable.
+				 * If we are using the kext, the real
+				 * path will be fetched from the kext.
+				 * If not, there will be no way to
+				 * reliably find the corresponding
+				 * image on disk. */
+				path = strdup(ev->execarg[0]);
 			}
-		} else {
-			path = strdup(path);
 			if (!path)
 				ooms++;
 		}
+	} else {
+		path = strdup(path);
 		if (!path)
-			/* got counted above */
-			break;
-		if (!ev.args[0].present) {
-			/* POSIX_SPAWN_SETEXEC */
-			procmon_exec(&ev.tv,
-			             &ev.subject,
-			             path,
-			             ev.attr_count > 0 ? &ev.attr[0] : NULL,
-			             ev.execarg,
-			             ev.execenv);
-			ev.execarg = NULL; /* pass ownership to procmon */
-			ev.execenv = NULL; /* pass ownership to procmon */
-			break;
-		}
-		TOKEN_ASSERT("execve", "args[0]", ev.args[0].present);
-		procmon_spawn(&ev.tv,
-		              &ev.subject,
-		              ev.args[0].value,
+			ooms++;
+	}
+	if (!path)
+		/* got counted above */
+		return;
+	if (!ev->args[0].present) {
+		/* POSIX_SPAWN_SETEXEC */
+		procmon_exec(&ev->tv,
+		             &ev->subject,
+		             path,
+		             ev->attr_count > 0 ? &ev->attr[0] : NULL,
+		             ev->execarg,
+		             ev->execenv);
+	} else {
+		procmon_spawn(&ev->tv,
+		              &ev->subject,
+		              ev->args[0].value,
 		              path,
-		              ev.attr_count > 0 ? &ev.attr[0] : NULL,
-		              ev.execarg,
-		              ev.execenv);
-		ev.execarg = NULL; /* pass ownership to procmon */
-		ev.execenv = NULL; /* pass ownership to procmon */
-		break;
+		              ev->attr_count > 0 ? &ev->attr[0] : NULL,
+		              ev->execarg,
+		              ev->execenv);
+	}
+	ev->execarg = NULL; /* pass ownership to procmon */
+	ev->execenv = NULL; /* pass ownership to procmon */
+}
 
-	case AUE_EXEC:
-	case AUE_EXECVE:
-	case AUE_MAC_EXECVE:
-		TOKEN_ASSERT("execve", "subject", ev.subject_present);
+static void
+aue_execve(config_t *cfg, audit_event_t *ev) {
+	char *path;
+
+	/*
+	 * On at least 10.11.6, audit records for successful execve
+	 * invocations sometimes have a pid as return value, for
+	 * example when being spawned from make, which does not
+	 * indicate failure; only treat negative values as errors.
+	 *
+	 * Reported to Apple as radar 38845784 on 2018-03-25.
+	 */
+	if (ev->return_present) {
+		if (ev->return_value > INT_MAX) {
+			failedsyscalls++;
+			return;
+		} else if (ev->return_value != 0) {
+			radar38845784++;
+		}
+	}
+	path = (char *)(ev->path[1] ? ev->path[1] : ev->path[0]);
+	assert(path);
+	path = strdup(path);
+	if (!path) {
+		ooms++;
+		return;
+	}
+	if (ev->type == AUE_MAC_EXECVE && (
+	    !ev->execarg || ((cfg->envlevel > 0) && !ev->execenv))) {
 		/*
-		 * On at least 10.11.6, audit records for successful execve
-		 * invocations sometimes have a pid as return value, for
-		 * example when being spawned from make, which does not
-		 * indicate failure; only treat negative values as errors.
+		 * On at least 10.11.6, audit records for __mac_execve
+		 * are missing their exec arg and exec env tokens.
 		 *
-		 * Reported to Apple as radar 38845784 on 2018-03-25.
+		 * Reported to Apple as radar 42946744 on 2018-08-05.
 		 */
-		if (ev.return_present) {
-			if (ev.return_value > INT_MAX) {
-				failedsyscalls++;
-				break;
-			} else if (ev.return_value != 0) {
-				radar38845784++;
-			}
-		}
-		TOKEN_ASSERT("execve", "path", ev.path[0]);
-		path = (char *)(ev.path[1] ? ev.path[1] : ev.path[0]);
-		assert(path);
-		path = strdup(path);
-		if (!path) {
-			ooms++;
-			break;
-		}
-		if (ev.type == AUE_MAC_EXECVE && (
-		    !ev.execarg || ((cfg->envlevel > 0) && !ev.execenv))) {
-			/*
-			 * On at least 10.11.6, audit records for __mac_execve
-			 * are missing their exec arg and exec env tokens.
-			 *
-			 * Reported to Apple as radar 42946744 on 2018-08-05.
-			 */
-			radar42946744_fatal++;
-			DEBUG(cfg->debug,
-			      "radar42946744_fatal",
-			      "path[0]=%s "
-			      "path[1]=%s "
-			      "argv=%i env=%i "
-			      "pid=%i",
-			      ev.path[0],
-			      ev.path[1],
-			      ev.execarg ? 1 : 0,
-			      ev.execenv ? 1 : 0,
-			      ev.subject.pid);
-		}
-		procmon_exec(&ev.tv,
-		             &ev.subject,
-		             path,
-		             ev.attr_count > 0 ? &ev.attr[0] : NULL,
-		             ev.execarg,
-		             ev.execenv);
-		ev.execarg = NULL; /* pass ownership to procmon */
-		ev.execenv = NULL; /* pass ownership to procmon */
-		break;
+		radar42946744_fatal++;
+		DEBUG(cfg->debug,
+		      "radar42946744_fatal",
+		      "path[0]=%s "
+		      "path[1]=%s "
+		      "argv=%i env=%i "
+		      "pid=%i",
+		      ev->path[0],
+		      ev->path[1],
+		      ev->execarg ? 1 : 0,
+		      ev->execenv ? 1 : 0,
+		      ev->subject.pid);
+	}
+	procmon_exec(&ev->tv,
+	             &ev->subject,
+	             path,
+	             ev->attr_count > 0 ? &ev->attr[0] : NULL,
+	             ev->execarg,
+	             ev->execenv);
+	ev->execarg = NULL; /* pass ownership to procmon */
+	ev->execenv = NULL; /* pass ownership to procmon */
+}
 
-	case AUE_EXIT:
-		TOKEN_ASSERT("exit", "subject", ev.subject_present);
-		/* exit never fails; audit event not triggered if process got
-		 * terminated in other ways than calling exit() */
-		procmon_exit(&ev.tv, ev.subject.pid);
-		break;
+/*
+ * exit never fails; audit event not triggered if process got terminated in
+ * other ways than calling exit().
+ */
+static void
+aue_exit(UNUSED config_t *cfg, audit_event_t *ev) {
+	procmon_exit(&ev->tv, ev->subject.pid);
+}
 
-	case AUE_WAIT4:
-		TOKEN_ASSERT("wait4", "return", ev.return_present);
-		if (ev.return_value == 0 || ev.return_value > INT_MAX) {
-			failedsyscalls++;
-			break;
-		}
-		/* cannot distinguish terminated and stopped processes */
-		procmon_wait4(&ev.tv, ev.return_value);
-		break;
+/*
+ * Cannot distinguish terminated and stopped processes.
+ */
+static void
+aue_wait4(UNUSED config_t *cfg, audit_event_t *ev) {
+	procmon_wait4(&ev->tv, ev->return_value);
+}
 
-	case AUE_CHDIR:
-	case AUE_FCHDIR:
-		TOKEN_ASSERT("chdir", "return", ev.return_present);
-		if (ev.return_value) {
-			failedsyscalls++;
-			break;
-		}
-		TOKEN_ASSERT("chdir", "subject", ev.subject_present);
-		TOKEN_ASSERT("chdir", "path", ev.path[0]);
-		path = (char *)(ev.path[1] ? ev.path[1] : ev.path[0]);
-		assert(path);
-		path = strdup(path);
-		if (!path) {
-			ooms++;
-			break;
-		}
-		procmon_chdir(&ev.tv, ev.subject.pid, path);
-		break;
+static void
+aue_chdir(UNUSED config_t *cfg, audit_event_t *ev) {
+	char *path;
 
-	/*
-	 * Events for tracking inter-process access commonly used for
-	 * code injection and other manipulation.
-	 */
+	path = (char *)(ev->path[1] ? ev->path[1] : ev->path[0]);
+	assert(path);
+	path = strdup(path);
+	if (!path) {
+		ooms++;
+		return;
+	}
+	procmon_chdir(&ev->tv, ev->subject.pid, path);
+}
 
-	case AUE_TASKFORPID:
-		if (!LOGEVT_WANT(cfg->events, LOGEVT_HACKMON))
-			break;
-		TOKEN_ASSERT("task_for_pid", "return", ev.return_present);
-		if (ev.return_value) {
-			failedsyscalls++;
-			break;
-		}
-		TOKEN_ASSERT("task_for_pid", "subject", ev.subject_present);
-		TOKEN_ASSERT("task_for_pid", "process|args[2](pid)",
-		             ev.process_present || ev.args[2].present);
-		if (ev.process_present) {
-			hackmon_taskforpid(&ev.tv, &ev.subject,
-			                   &ev.process, ev.process.pid);
-		} else {
-			hackmon_taskforpid(&ev.tv, &ev.subject,
-			                   NULL, ev.args[2].value);
-		}
-		break;
+/*
+ * Events for noticing audit(4) policy changes by other tools.
+ */
 
-	case AUE_PTRACE:
-		if (!LOGEVT_WANT(cfg->events, LOGEVT_HACKMON))
-			break;
-		TOKEN_ASSERT("ptrace", "return", ev.return_present);
-		if (ev.return_value) {
-			failedsyscalls++;
-			break;
-		}
-		TOKEN_ASSERT("ptrace", "subject", ev.subject_present);
-		TOKEN_ASSERT("ptrace", "args[1](request)", ev.args[1].present);
-		if (ev.args[1].value != PT_ATTACHEXC)
-			break;
-		TOKEN_ASSERT("ptrace", "process|args[2](pid)",
-		             ev.process_present || ev.args[2].present);
-		if (ev.process_present) {
-			hackmon_ptrace(&ev.tv, &ev.subject,
-			               &ev.process, ev.process.pid);
-		} else {
-			hackmon_ptrace(&ev.tv, &ev.subject,
-			               NULL, ev.args[2].value);
-		}
-		break;
+static int aupol_check(void);
 
-	/*
-	 * Events for tracking file modifications.
-	 */
+static void
+aue_auditon(config_t *cfg, UNUSED audit_event_t *ev) {
+	if (cfg->trace_replay)
+		return;
+	aupnotifies++;
+	(void)aupol_check();
+}
 
-	case AUE_OPEN_W:
-	case AUE_OPEN_WC:
-	case AUE_OPEN_WT:
-	case AUE_OPEN_WTC:
-	case AUE_OPEN_RW:
-	case AUE_OPEN_RWC:
-	case AUE_OPEN_RWT:
-	case AUE_OPEN_RWTC:
-	case AUE_OPEN_EXTENDED_W:
-	case AUE_OPEN_EXTENDED_WC:
-	case AUE_OPEN_EXTENDED_WT:
-	case AUE_OPEN_EXTENDED_WTC:
-	case AUE_OPEN_EXTENDED_RW:
-	case AUE_OPEN_EXTENDED_RWC:
-	case AUE_OPEN_EXTENDED_RWT:
-	case AUE_OPEN_EXTENDED_RWTC:
-	case AUE_OPENAT_W:
-	case AUE_OPENAT_WC:
-	case AUE_OPENAT_WT:
-	case AUE_OPENAT_WTC:
-	case AUE_OPENAT_RW:
-	case AUE_OPENAT_RWC:
-	case AUE_OPENAT_RWT:
-	case AUE_OPENAT_RWTC:
-	case AUE_OPENBYID_W:
-	case AUE_OPENBYID_WT:
-	case AUE_OPENBYID_RW:
-	case AUE_OPENBYID_RWT:
-		if (!LOGEVT_WANT(cfg->events, LOGEVT_FILEMON))
-			break;
-		TOKEN_ASSERT("open(w)", "return", ev.return_present);
-		if (ev.return_value > INT_MAX) {
-			failedsyscalls++;
-			break;
-		}
-		TOKEN_ASSERT("open(w)", "subject", ev.subject_present);
-#if 0
-		TOKEN_ASSERT("open(w)", "arg[2](flags)", ev.args[2].present);
-		TOKEN_ASSERT("open(w)", "arg[3](mode)", ev.args[3].present);
-#endif
-		TOKEN_ASSERT("open(2)", "path[0]", ev.path[0]);
-		/* sometimes one, sometimes two path tokens, unsure if bug */
-		path = (char *)(ev.path[1] ? ev.path[1] : ev.path[0]);
-		assert(path);
-		procmon_file_open(&ev.subject, ev.return_value, path, &ev.tv);
-		break;
+/*
+ * Events for tracking inter-process access commonly used for code injection
+ * and other manipulation.
+ */
 
-	case AUE_CLOSE:
-		if (!LOGEVT_WANT(cfg->events, LOGEVT_FILEMON|LOGEVT_SOCKMON))
-			break;
-		TOKEN_ASSERT("close", "return", ev.return_present);
-		if (ev.return_value) {
-			failedsyscalls++;
-			break;
-		}
-		TOKEN_ASSERT("close", "subject", ev.subject_present);
-		TOKEN_ASSERT("close", "arg[2](fd)", ev.args[2].present);
-		procmon_fd_close(ev.subject.pid, ev.args[2].value);
-		if (!LOGEVT_WANT(cfg->events, LOGEVT_FILEMON))
-			break;
-		if (!ev.path[0]) {
-			/* closed file descriptor does not point to vnode */
-			break;
-		}
-		path = (char *)(ev.path[1] ? ev.path[1] : ev.path[0]);
-		assert(path);
-		path = strdup(path);
-		if (!path) {
-			ooms++;
-			break;
-		}
-		filemon_touched(&ev.tv, &ev.subject, path);
-		break;
+static void
+aue_taskforpid(config_t *cfg, audit_event_t *ev) {
+	if (ev->process_present) {
+		hackmon_taskforpid(&ev->tv, &ev->subject,
+		                   &ev->process, ev->process.pid);
+	} else if (ev->args[2].present) {
+		hackmon_taskforpid(&ev->tv, &ev->subject,
+		                   NULL, ev->args[2].value);
+	} else {
+		auef_missingtoken(cfg, ev, "task_for_pid",
+		                  "process|args[2](pid)");
+	}
+}
 
-	case AUE_UTIMES:
-	case AUE_FUTIMES:
-		if (!LOGEVT_WANT(cfg->events, LOGEVT_FILEMON))
-			break;
-		TOKEN_ASSERT("utimes", "return", ev.return_present);
-		if (ev.return_value) {
-			failedsyscalls++;
-			break;
-		}
-		TOKEN_ASSERT("utimes", "subject", ev.subject_present);
-		/*
-		 * On at least 10.11.6, records include only an unresolved
-		 * path.
-		 *
-		 * Reported to Apple as radar 39623812 on 2018-04-21.
-		 */
-		if (ev.path[1]) {
-			/* two path tokens */
-			path = strdup(ev.path[1]);
+static void
+aue_ptrace(config_t *cfg, audit_event_t *ev) {
+	if (ev->args[1].value != PT_ATTACHEXC)
+		return;
+	if (ev->process_present) {
+		hackmon_ptrace(&ev->tv, &ev->subject,
+		               &ev->process, ev->process.pid);
+	} else if (ev->args[2].present) {
+		hackmon_ptrace(&ev->tv, &ev->subject,
+		               NULL, ev->args[2].value);
+	} else {
+		auef_missingtoken(cfg, ev, "ptrace", "process|args[2](pid)");
+	}
+}
+
+/*
+ * Events for tracking file modifications.
+ */
+
+static void
+aue_open(UNUSED config_t *cfg, audit_event_t *ev) {
+	char *path;
+
+	/* sometimes one, sometimes two path tokens, unsure if bug */
+	path = (char *)(ev->path[1] ? ev->path[1] : ev->path[0]);
+	assert(path);
+	procmon_file_open(&ev->subject, ev->return_value, path, &ev->tv);
+}
+
+static void
+aue_close(config_t *cfg, audit_event_t *ev) {
+	char *path;
+
+	procmon_fd_close(ev->subject.pid, ev->args[2].value);
+	if (!LOGEVT_WANT(cfg->events, LOGEVT_FILEMON))
+		return;
+	if (!ev->path[0]) {
+		/* closed file descriptor does not point to vnode */
+		return;
+	}
+	path = (char *)(ev->path[1] ? ev->path[1] : ev->path[0]);
+	assert(path);
+	path = strdup(path);
+	if (!path) {
+		ooms++;
+		return;
+	}
+	filemon_touched(&ev->tv, &ev->subject, path);
+}
+
+static void
+aue_utimes(config_t *cfg, audit_event_t *ev) {
+	const char *cwd;
+	char *path;
+
+	/*
+	 * On at least 10.11.6, records include only an unresolved
+	 * path.
+	 *
+	 * Reported to Apple as radar 39623812 on 2018-04-21.
+	 */
+	if (ev->path[1]) {
+		/* two path tokens */
+		path = strdup(ev->path[1]);
+		if (!path)
+			ooms++;
+	} else if (ev->path[0]) {
+		/* one path token, assume unresolved if no attr */
+		if (ev->attr_count > 0) {
+			path = strdup(ev->path[0]);
 			if (!path)
 				ooms++;
-		} else if (ev.path[0]) {
-			/* one path token, assume unresolved if no attr */
-			if (ev.attr_count > 0) {
-				path = strdup(ev.path[0]);
-				if (!path)
-					ooms++;
-			} else {
-				radar39623812++;
-				path_resolve(&path, &cwd, ev.path[0],
-				             ev.subject.pid, &ev.tv, true);
-				if (!path && (errno != ENOMEM)) {
-					radar39623812_fatal++;
-					DEBUG(cfg->debug, "radar39623812_fatal",
-					      "path[0]=%s pid=%i "
-					      "cwd(pid)=>%s",
-					      ev.path[0], ev.subject.pid, cwd);
-				}
-			}
 		} else {
-			path = NULL;
-			missingtoken++;
-			DEBUG(cfg->debug, "missingtoken",
-			      "event=utimes token=path");
-			if (cfg->debug)
-				auevent_fprint(stderr, &ev);
+			radar39623812++;
+			path_resolve(&path, &cwd, ev->path[0],
+			             ev->subject.pid, &ev->tv, true);
+			if (!path && (errno != ENOMEM)) {
+				radar39623812_fatal++;
+				DEBUG(cfg->debug, "radar39623812_fatal",
+				      "path[0]=%s pid=%i "
+				      "cwd(pid)=>%s",
+				      ev->path[0], ev->subject.pid, cwd);
+			}
 		}
+	} else {
+		path = NULL;
+		auef_missingtoken(cfg, ev, "utimes", "path");
+	}
+	if (!path)
+		/* counted above */
+		return;
+	filemon_touched(&ev->tv, &ev->subject, path);
+}
+
+/*
+ * Common handler for rename, link, clonefile and copyfile(2), not
+ * copyfile(3).  If use_cwd, resolve relative to cwd on path bugs.
+ */
+static void
+aue_rename_et_al(config_t *cfg, audit_event_t *ev, bool use_cwd) {
+	const char *cwd;
+	char *path;
+
+	if (ev->type == AUE_RENAME || ev->type == AUE_RENAMEAT)
+		cachepath_invalidate();
+	/*
+	 * Before 10.14.3/2019-001, AUE_RENAME and AUE_LINK records
+	 * include only an unresolved target path.
+	 *
+	 * Reported to Apple as radar 39267328 on 2018-04-08 and
+	 * radar 42783724 on 2018-07-31 respectively.  Fix published by
+	 * Apple on 2019-01-22.
+	 */
+	if (ev->path[3]) {
+		/* four path tokens, as expected */
+		path = strdup(ev->path[3]);
 		if (!path)
-			/* counted above */
+			ooms++;
+	} else if (ev->path[2] && !ev->path[3]) {
+		/* three path tokens, assume third unresolved dpath */
+		switch (ev->type) {
+		case AUE_RENAME:
+			radar39267328++;
 			break;
-		filemon_touched(&ev.tv, &ev.subject, path);
-		break;
-
-	case AUE_RENAMEAT:
-	case AUE_LINKAT:
-	case AUE_CLONEFILEAT:
-	case AUE_FCLONEFILEAT:
-		flag = false;   /* dont resolve relative to cwd on path bugs */
-		goto rename_et_al;
-	case AUE_RENAME:
-	case AUE_LINK:
-	case AUE_COPYFILE: /* copyfile(2) not copyfile(3) */
-		flag = true;    /* resolve relative to cwd on path bugs */
-rename_et_al:
-		if (!LOGEVT_WANT(cfg->events, LOGEVT_FILEMON))
+		case AUE_LINK:
+			radar42783724++;
 			break;
-		TOKEN_ASSERT("rename|link|clonefile|copyfile",
-		             "return", ev.return_present);
-		if (ev.return_value) {
-			failedsyscalls++;
+		default:
+			auef_missingtoken(cfg, ev,
+			                  "rename|link|clonefile|copyfile",
+			                  "path");
 			break;
 		}
-		TOKEN_ASSERT("rename|link|clonefile|copyfile",
-		             "subject", ev.subject_present);
-		/*
-		 * Before 10.14.3/2019-001, AUE_RENAME and AUE_LINK records
-		 * include only an unresolved target path.
-		 *
-		 * Reported to Apple as radar 39267328 on 2018-04-08 and
-		 * radar 42783724 on 2018-07-31 respectively.  Fix published by
-		 * Apple on 2019-01-22.
-		 */
-		if (ev.path[3]) {
-			/* four path tokens, as expected */
-			path = strdup(ev.path[3]);
-			if (!path)
-				ooms++;
-		} else if (ev.path[2] && !ev.path[3]) {
-			/* three path tokens, assume third unresolved dpath */
-			switch (ev.type) {
+		path_resolve(&path, &cwd, ev->path[2],
+		             ev->subject.pid, &ev->tv, use_cwd);
+		if (!path && (errno != ENOMEM)) {
+			switch (ev->type) {
 			case AUE_RENAME:
-				radar39267328++;
+				radar39267328_fatal++;
+				DEBUG(cfg->debug,
+				      "radar39267328_fatal",
+				      "path[2]=%s pid=%i "
+				      "getcwd(pid)=>%s",
+				      ev->path[2], ev->subject.pid, cwd);
 				break;
 			case AUE_LINK:
-				radar42783724++;
-				break;
-			default:
-				missingtoken++;
-				DEBUG(cfg->debug, "missingtoken",
-				      "event=rename|link|clonefile|copyfile "
-				      "token=path");
-				if (cfg->debug)
-					auevent_fprint(stderr, &ev);
-				break;
-			}
-			path_resolve(&path, &cwd, ev.path[2],
-			             ev.subject.pid, &ev.tv, flag);
-			if (!path && (errno != ENOMEM)) {
-				switch (ev.type) {
-				case AUE_RENAME:
-					radar39267328_fatal++;
-					DEBUG(cfg->debug,
-					      "radar39267328_fatal",
-					      "path[2]=%s pid=%i "
-					      "getcwd(pid)=>%s",
-					      ev.path[2], ev.subject.pid, cwd);
-					break;
-				case AUE_LINK:
-					radar42783724_fatal++;
-					DEBUG(cfg->debug,
-					      "radar42783724_fatal",
-					      "path[2]=%s pid=%i "
-					      "getcwd(pid)=>%s",
-					      ev.path[2], ev.subject.pid, cwd);
-					break;
-				}
-				/* others already got a "missingtoken" above */
-			}
-		} else {
-			/* less than three path tokens */
-			path = NULL;
-			/*
-			 * AUE_RENAMEAT and AUE_LINKAT records sometimes have
-			 * only one or two path tokens instead of four.
-			 *
-			 * Reported to Apple as radar 42770257 and 43151662 on
-			 * 2018-07-31 and 2018-08-10 respectively.
-			 */
-			switch (ev.type) {
-			case AUE_RENAMEAT:
-				radar42770257_fatal++;
-				DEBUG(cfg->debug, "radar42770257_fatal",
-				      "event=renameat token=path");
-				break;
-			case AUE_LINKAT:
-				radar43151662_fatal++;
-				DEBUG(cfg->debug, "radar43151662_fatal",
-				      "event=linkat token=path");
-				break;
-			default:
-				missingtoken++;
-				DEBUG(cfg->debug, "missingtoken",
-				      "event=rename|link|clonefile|copyfile "
-				      "token=path");
-				if (cfg->debug)
-					auevent_fprint(stderr, &ev);
+				radar42783724_fatal++;
+				DEBUG(cfg->debug,
+				      "radar42783724_fatal",
+				      "path[2]=%s pid=%i "
+				      "getcwd(pid)=>%s",
+				      ev->path[2], ev->subject.pid, cwd);
 				break;
 			}
+			/* others already got a "missingtoken" above */
 		}
-		if (!path)
-			/* counted above */
+	} else {
+		/* less than three path tokens */
+		path = NULL;
+		/*
+		 * AUE_RENAMEAT and AUE_LINKAT records sometimes have
+		 * only one or two path tokens instead of four.
+		 *
+		 * Reported to Apple as radar 42770257 and 43151662 on
+		 * 2018-07-31 and 2018-08-10 respectively.
+		 */
+		switch (ev->type) {
+		case AUE_RENAMEAT:
+			radar42770257_fatal++;
+			DEBUG(cfg->debug, "radar42770257_fatal",
+			      "event=renameat token=path");
 			break;
-		filemon_touched(&ev.tv, &ev.subject, path);
-		break;
-
-	case AUE_SYMLINK:
-	case AUE_SYMLINKAT:
-		if (!LOGEVT_WANT(cfg->events, LOGEVT_FILEMON))
+		case AUE_LINKAT:
+			radar43151662_fatal++;
+			DEBUG(cfg->debug, "radar43151662_fatal",
+			      "event=linkat token=path");
 			break;
-		TOKEN_ASSERT("symlink", "return", ev.return_present);
-		if (ev.return_value) {
-			failedsyscalls++;
+		default:
+			auef_missingtoken(cfg, ev,
+			                  "rename|link|clonefile|copyfile",
+			                  "path");
 			break;
 		}
-		TOKEN_ASSERT("symlink", "subject", ev.subject_present);
-		/*
-		 * On at least 10.11.6, AUE_SYMLINK and AUE_SYMLINKAT records
-		 * include only an unresolved target path.
-		 *
-		 * Reported to Apple as radar 42784847 on 2018-07-31.
-		 */
-		if (ev.path[1]) {
-			path = strdup(ev.path[1]);
+	}
+	if (!path)
+		/* counted above */
+		return;
+	filemon_touched(&ev->tv, &ev->subject, path);
+}
+
+static void
+aue_rename(config_t *cfg, audit_event_t *ev) {
+	aue_rename_et_al(cfg, ev, true);
+}
+
+static void
+aue_renameat(config_t *cfg, audit_event_t *ev) {
+	aue_rename_et_al(cfg, ev, false);
+}
+
+static void
+aue_symlink(config_t *cfg, audit_event_t *ev) {
+	const char *cwd;
+	char *path;
+
+	/*
+	 * On at least 10.11.6, AUE_SYMLINK and AUE_SYMLINKAT records
+	 * include only an unresolved target path.
+	 *
+	 * Reported to Apple as radar 42784847 on 2018-07-31.
+	 */
+	if (ev->path[1]) {
+		path = strdup(ev->path[1]);
+		if (!path)
+			ooms++;
+	} else if (ev->path[0] && !ev->path[1]) {
+		/* only an unresolved target path token */
+		radar42784847++;
+		path_resolve_symlink(&path, &cwd, ev->path[0],
+		                     ev->subject.pid, &ev->tv,
+		                     (ev->type == AUE_SYMLINK));
+		if (!path && (errno != ENOMEM)) {
+			radar42784847_fatal++;
+			DEBUG(cfg->debug,
+			      "radar42784847_fatal",
+			      "path[0]=%s pid=%i "
+			      "getcwd(pid)=>%s",
+			      ev->path[0], ev->subject.pid, cwd);
+		}
+	} else {
+		path = NULL;
+		auef_missingtoken(cfg, ev, "symlink", "path");
+	}
+	if (!path)
+		/* counted above */
+		return;
+	filemon_symlink(&ev->tv, &ev->subject, path);
+}
+
+static void
+aue_unlink(config_t *cfg, audit_event_t *ev) {
+	const char *cpath;
+
+	cachepath_invalidate();
+	if (ev->path[1]) {
+		/* two path tokens */
+		cpath = ev->path[1];
+#if 0
+	} else if (ev->path[0]) {
+		/* one path token, assume unresolved if no attr */
+		if (ev->attr_count > 0) {
+			path = strdup(ev->path[0]);
 			if (!path)
 				ooms++;
-		} else if (ev.path[0] && !ev.path[1]) {
-			/* only an unresolved target path token */
-			radar42784847++;
-			path_resolve_symlink(&path, &cwd, ev.path[0],
-			                     ev.subject.pid, &ev.tv,
-			                     (ev.type == AUE_SYMLINK));
+		} else {
+			radarXXX++;
+			path_resolve_symlink(&path, &cwd, ev->path[0],
+			                     ev->subject.pid, &ev->tv,
+			                     (ev->type == AUE_UNLINK));
 			if (!path && (errno != ENOMEM)) {
-				radar42784847_fatal++;
-				DEBUG(cfg->debug,
-				      "radar42784847_fatal",
+				radarXXX_fatal++;
+				DEBUG(cfg->debug, "radarXXX_fatal",
 				      "path[0]=%s pid=%i "
-				      "getcwd(pid)=>%s",
-				      ev.path[0], ev.subject.pid, cwd);
+				      "cwd(pid)=>%s",
+				      ev->path[0], ev->subject.pid, cwd);
 			}
-		} else {
-			path = NULL;
-			missingtoken++;
-			DEBUG(cfg->debug, "missingtoken",
-			      "event=symlink token=path");
-			if (cfg->debug)
-				auevent_fprint(stderr, &ev);
-		}
-		if (!path)
-			/* counted above */
-			break;
-		filemon_symlink(&ev.tv, &ev.subject, path);
-		break;
-
-	case AUE_UNLINK:
-	case AUE_UNLINKAT:
-		if (!LOGEVT_WANT(cfg->events, LOGEVT_FILEMON))
-			break;
-		TOKEN_ASSERT("unlink", "return", ev.return_present);
-		if (ev.return_value) {
-			failedsyscalls++;
-			break;
 		}
-		TOKEN_ASSERT("unlink", "subject", ev.subject_present);
-		if (ev.path[1]) {
-			/* two path tokens */
-			cpath = ev.path[1];
-#if 0
-		} else if (ev.path[0]) {
-			/* one path token, assume unresolved if no attr */
-			if (ev.attr_count > 0) {
-				path = strdup(ev.path[0]);
-				if (!path)
-					ooms++;
-			} else {
-				radarXXX++;
-				path_resolve_symlink(&path, &cwd, ev.path[0],
-				                     ev.subject.pid, &ev.tv,
-				                     (ev.type == AUE_UNLINK));
-				if (!path && (errno != ENOMEM)) {
-					radarXXX_fatal++;
-					DEBUG(cfg->debug, "radarXXX_fatal",
-					      "path[0]=%s pid=%i "
-					      "cwd(pid)=>%s",
-					      ev.path[0], ev.subject.pid, cwd);
-				}
-			}
-			// XXX free path after call to unlink!
+		// XXX free path after call to unlink!
 #endif
-		} else {
-			cpath = NULL;
-			missingtoken++;
-			DEBUG(cfg->debug, "missingtoken",
-			      "event=unlink token=path");
-			if (cfg->debug)
-				auevent_fprint(stderr, &ev);
-		}
-		if (!cpath)
-			/* counted above */
-			break;
-		filemon_unlink(cpath, ev.attr_count > 0 ? &ev.attr[0] : NULL);
-		break;
+	} else {
+		cpath = NULL;
+		auef_missingtoken(cfg, ev, "unlink", "path");
+	}
+	if (!cpath)
+		/* counted above */
+		return;
+	filemon_unlink(cpath, ev->attr_count > 0 ? &ev->attr[0] : NULL);
+}
+
+/*
+ * Events for socket tracking.  Records for unix sockets have no sockinet
+ * token and are skipped.
+ */
 
-	/*
-	 * Events for socket tracking.
-	 */
+static void
+aue_socket(UNUSED config_t *cfg, audit_event_t *ev) {
+	sockmon_socket(&ev->tv, &ev->subject, ev->return_value,
+	               auevent_sock_domain(ev->args[1].value),
+	               auevent_sock_type(ev->args[2].value),
+	               ev->args[3].value);
+}
 
-	case AUE_SOCKET:
-		if (!LOGEVT_WANT(cfg->events, LOGEVT_SOCKMON))
-			break;
-		TOKEN_ASSERT("socket", "return", ev.return_present);
-		if (ev.return_value > INT_MAX) {
-			failedsyscalls++;
-			break;
-		}
-		TOKEN_ASSERT("socket", "subject", ev.subject_present);
-		TOKEN_ASSERT("socket", "arg[1](domain)", ev.args[1].present);
-		TOKEN_ASSERT("socket", "arg[2](type)", ev.args[2].present);
-		TOKEN_ASSERT("socket", "arg[3](protocol)", ev.args[3].present);
-		sockmon_socket(&ev.tv, &ev.subject, ev.return_value,
-		               auevent_sock_domain(ev.args[1].value),
-		               auevent_sock_type(ev.args[2].value),
-		               ev.args[3].value);
-		break;
+static void
+aue_bind(UNUSED config_t *cfg, audit_event_t *ev) {
+	if (!ev->sockinet_present)
+		return;
+	sockmon_bind(&ev->tv, &ev->subject, ev->args[1].value,
+	             &ev->sockinet_addr, ev->sockinet_port);
+}
 
-	case AUE_BIND:
-		if (!LOGEVT_WANT(cfg->events, LOGEVT_SOCKMON))
-			break;
-		TOKEN_ASSERT("bind", "return", ev.return_present);
-		if (ev.return_value != 0) {
-			failedsyscalls++;
-			break;
-		}
-		if (!ev.sockinet_present)
-			/* skip unix socket */
-			break;
-		TOKEN_ASSERT("bind", "subject", ev.subject_present);
-		TOKEN_ASSERT("bind", "arg[1](fd)", ev.args[1].present);
-		sockmon_bind(&ev.tv, &ev.subject, ev.args[1].value,
-		             &ev.sockinet_addr, ev.sockinet_port);
-		break;
+static void
+aue_listen(UNUSED config_t *cfg, audit_event_t *ev) {
+	sockmon_listen(&ev->tv, &ev->subject, ev->args[1].value);
+}
 
-	case AUE_LISTEN:
-		if (!LOGEVT_WANT(cfg->events,
-		                 LOGEVT_FLAG(LOGEVT_SOCKET_LISTEN)))
-			break;
-		TOKEN_ASSERT("listen", "return", ev.return_present);
-		if (ev.return_value != 0) {
-			failedsyscalls++;
-			break;
-		}
-		TOKEN_ASSERT("listen", "subject", ev.subject_present);
-		TOKEN_ASSERT("listen", "arg[1](fd)", ev.args[1].present);
-		sockmon_listen(&ev.tv, &ev.subject, ev.args[1].value);
-		break;
+static void
+aue_accept(UNUSED config_t *cfg, audit_event_t *ev) {
+	if (!ev->sockinet_present)
+		return;
+	sockmon_accept(&ev->tv, &ev->subject, ev->args[1].value,
+	               &ev->sockinet_addr, ev->sockinet_port);
+}
 
-	case AUE_ACCEPT:
-		if (!LOGEVT_WANT(cfg->events,
-		                 LOGEVT_FLAG(LOGEVT_SOCKET_ACCEPT)))
-			break;
-		TOKEN_ASSERT("accept", "return", ev.return_present);
-		if (ev.return_value > INT_MAX) {
-			failedsyscalls++;
-			break;
-		}
-		if (!ev.sockinet_present)
-			/* skip unix socket */
-			break;
-		TOKEN_ASSERT("accept", "subject", ev.subject_present);
-		TOKEN_ASSERT("accept", "arg[1](fd)", ev.args[1].present);
-		sockmon_accept(&ev.tv, &ev.subject, ev.args[1].value,
-		               &ev.sockinet_addr, ev.sockinet_port);
-		break;
+/*
+ * While it would be interesting to see failed connects, XNU does not seem
+ * to provide audit(4) records for them.
+ */
+static void
+aue_connect(UNUSED config_t *cfg, audit_event_t *ev) {
+	if (!ev->sockinet_present)
+		return;
+	sockmon_connect(&ev->tv, &ev->subject, ev->args[1].value,
+	                &ev->sockinet_addr, ev->sockinet_port);
+}
 
-	case AUE_CONNECT:
-		if (!LOGEVT_WANT(cfg->events,
-		                 LOGEVT_FLAG(LOGEVT_SOCKET_CONNECT)))
-			break;
-		/* While it would be interesting to see failed connects,
-		 * XNU does not seem to provide audit(4) records for them. */
-		TOKEN_ASSERT("connect", "return", ev.return_present);
-		if (ev.return_value != 0) {
-			failedsyscalls++;
-			break;
-		}
-		if (!ev.sockinet_present)
-			/* unix socket */
-			break;
-		TOKEN_ASSERT("connect", "subject", ev.subject_present);
-		TOKEN_ASSERT("connect", "arg[1](fd)", ev.args[1].present);
-		sockmon_connect(&ev.tv, &ev.subject, ev.args[1].value,
-		                &ev.sockinet_addr, ev.sockinet_port);
-		break;
+static const uint16_t aues_fork[] = {
+	AUE_FORK, AUE_VFORK, 0 };
+static const uint16_t aues_posix_spawn[] = {
+	AUE_POSIX_SPAWN, 0 };
+static const uint16_t aues_execve[] = {
+	AUE_EXEC, AUE_EXECVE, AUE_MAC_EXECVE, 0 };
+static const uint16_t aues_exit[] = {
+	AUE_EXIT, 0 };
+static const uint16_t aues_wait4[] = {
+	AUE_WAIT4, 0 };
+static const uint16_t aues_chdir[] = {
+	AUE_CHDIR, AUE_FCHDIR, 0 };
+static const uint16_t aues_taskforpid[] = {
+	AUE_TASKFORPID, 0 };
+static const uint16_t aues_ptrace[] = {
+	AUE_PTRACE, 0 };
+static const uint16_t aues_open[] = {
+	AUE_OPEN_W, AUE_OPEN_WC, AUE_OPEN_WT, AUE_OPEN_WTC,
+	AUE_OPEN_RW, AUE_OPEN_RWC, AUE_OPEN_RWT, AUE_OPEN_RWTC,
+	AUE_OPEN_EXTENDED_W, AUE_OPEN_EXTENDED_WC,
+	AUE_OPEN_EXTENDED_WT, AUE_OPEN_EXTENDED_WTC,
+	AUE_OPEN_EXTENDED_RW, AUE_OPEN_EXTENDED_RWC,
+	AUE_OPEN_EXTENDED_RWT, AUE_OPEN_EXTENDED_RWTC,
+	AUE_OPENAT_W, AUE_OPENAT_WC, AUE_OPENAT_WT, AUE_OPENAT_WTC,
+	AUE_OPENAT_RW, AUE_OPENAT_RWC, AUE_OPENAT_RWT, AUE_OPENAT_RWTC,
+	AUE_OPENBYID_W, AUE_OPENBYID_WT, AUE_OPENBYID_RW, AUE_OPENBYID_RWT,
+	0 };
+static const uint16_t aues_close[] = {
+	AUE_CLOSE, 0 };
+static const uint16_t aues_utimes[] = {
+	AUE_UTIMES, AUE_FUTIMES, 0 };
+static const uint16_t aues_rename[] = {
+	AUE_RENAME, AUE_LINK, AUE_COPYFILE, 0 };
+static const uint16_t aues_renameat[] = {
+	AUE_RENAMEAT, AUE_LINKAT, AUE_CLONEFILEAT, AUE_FCLONEFILEAT, 0 };
+static const uint16_t aues_symlink[] = {
+	AUE_SYMLINK, AUE_SYMLINKAT, 0 };
+static const uint16_t aues_unlink[] = {
+	AUE_UNLINK, AUE_UNLINKAT, 0 };
+static const uint16_t aues_socket[] = {
+	AUE_SOCKET, 0 };
+static const uint16_t aues_bind[] = {
+	AUE_BIND, 0 };
+static const uint16_t aues_listen[] = {
+	AUE_LISTEN, 0 };
+static const uint16_t aues_accept[] = {
+	AUE_ACCEPT, 0 };
+static const uint16_t aues_connect[] = {
+	AUE_CONNECT, 0 };
 
-	/*
-	 * Unhandled events.
-	 */
+/*
+ * Registered handlers.  Records are only handed to a handler if any of the
+ * events are wanted (or events is 0), the return value indicates success,
+ * and all tokens are present.
+ */
+typedef struct {
+	const char *name;
+	const uint16_t *aues;           /* zero-terminated */
+	int events;                     /* LOGEVT_FLAG mask, 0 for always */
+	int ret;                        /* AUEF_RET_* */
+	uint32_t tokens;                /* AUEF_TOK_* mask */
+	void (*handle)(config_t *, audit_event_t *);
+} auef_handler_t;
+
+static const auef_handler_t auef_handlers[] = {
+	{ "fork", aues_fork, 0,
+	  AUEF_RET_INT, AUEF_TOK_SUBJECT,
+	  aue_fork },
+	{ "posix_spawn", aues_posix_spawn, 0,
+	  AUEF_RET_ZERO, AUEF_TOK_SUBJECT,
+	  aue_posix_spawn },
+	{ "execve", aues_execve, 0,
+	  AUEF_RET_ANY, AUEF_TOK_SUBJECT|AUEF_TOK_PATH0,
+	  aue_execve },
+	{ "exit", aues_exit, 0,
+	  AUEF_RET_ANY, AUEF_TOK_SUBJECT,
+	  aue_exit },
+	{ "wait4", aues_wait4, 0,
+	  AUEF_RET_PID, 0,
+	  aue_wait4 },
+	{ "chdir", aues_chdir, 0,
+	  AUEF_RET_ZERO, AUEF_TOK_SUBJECT|AUEF_TOK_PATH0,
+	  aue_chdir },
+	{ "auditon", auclass_xnumon_events_aupol, 0,
+	  AUEF_RET_ZERO, AUEF_TOK_SUBJECT,
+	  aue_auditon },
+	{ "task_for_pid", aues_taskforpid, LOGEVT_HACKMON,
+	  AUEF_RET_ZERO, AUEF_TOK_SUBJECT,
+	  aue_taskforpid },
+	{ "ptrace", aues_ptrace, LOGEVT_HACKMON,
+	  AUEF_RET_ZERO, AUEF_TOK_SUBJECT|AUEF_TOK_ARG1,
+	  aue_ptrace },
+	{ "open", aues_open, LOGEVT_FILEMON,
+	  AUEF_RET_INT, AUEF_TOK_SUBJECT|AUEF_TOK_PATH0,
+	  aue_open },
+	{ "close", aues_close, LOGEVT_FILEMON|LOGEVT_SOCKMON,
+	  AUEF_RET_ZERO, AUEF_TOK_SUBJECT|AUEF_TOK_ARG2,
+	  aue_close },
+	{ "utimes", aues_utimes, LOGEVT_FILEMON,
+	  AUEF_RET_ZERO, AUEF_TOK_SUBJECT,
+	  aue_utimes },
+	{ "rename", aues_rename, LOGEVT_FILEMON,
+	  AUEF_RET_ZERO, AUEF_TOK_SUBJECT,
+	  aue_rename },
+	{ "renameat", aues_renameat, LOGEVT_FILEMON,
+	  AUEF_RET_ZERO, AUEF_TOK_SUBJECT,
+	  aue_renameat },
+	{ "symlink", aues_symlink, LOGEVT_FILEMON,
+	  AUEF_RET_ZERO, AUEF_TOK_SUBJECT,
+	  aue_symlink },
+	{ "unlink", aues_unlink, LOGEVT_FILEMON,
+	  AUEF_RET_ZERO, AUEF_TOK_SUBJECT,
+	  aue_unlink },
+	{ "socket", aues_socket, LOGEVT_SOCKMON,
+	  AUEF_RET_INT,
+	  AUEF_TOK_SUBJECT|AUEF_TOK_ARG1|AUEF_TOK_ARG2|AUEF_TOK_ARG3,
+	  aue_socket },
+	{ "bind", aues_bind, LOGEVT_SOCKMON,
+	  AUEF_RET_ZERO, AUEF_TOK_SUBJECT|AUEF_TOK_ARG1,
+	  aue_bind },
+	{ "listen", aues_listen, LOGEVT_FLAG(LOGEVT_SOCKET_LISTEN),
+	  AUEF_RET_ZERO, AUEF_TOK_SUBJECT|AUEF_TOK_ARG1,
+	  aue_listen },
+	{ "accept", aues_accept, LOGEVT_FLAG(LOGEVT_SOCKET_ACCEPT),
+	  AUEF_RET_INT, AUEF_TOK_SUBJECT|AUEF_TOK_ARG1,
+	  aue_accept },
+	{ "connect", aues_connect, LOGEVT_FLAG(LOGEVT_SOCKET_CONNECT),
+	  AUEF_RET_ZERO, AUEF_TOK_SUBJECT|AUEF_TOK_ARG1,
+	  aue_connect },
+};
+
+#define AUEF_HANDLERS (sizeof(auef_handlers)/sizeof(auef_handlers[0]))
+_Static_assert(AUEF_HANDLERS <= EVTLOOP_AUEHANDLERS_MAX,
+               "handlers do not fit into evtloop_stat_t");
+_Static_assert(AUEF_HANDLERS < UINT8_MAX, "handler index is uint8_t");
+
+/* index into auef_handlers plus one by event type, 0 for unhandled */
+static uint8_t auef_handler_index[UINT16_MAX + 1];
+static evtloop_aue_handler_t auehandlers[EVTLOOP_AUEHANDLERS_MAX];
 
-	default:
+static void
+auef_handlers_init(void) {
+	bzero(auef_handler_index, sizeof(auef_handler_index));
+	bzero(auehandlers, sizeof(auehandlers));
+	for (size_t i = 0; i < AUEF_HANDLERS; i++) {
+		for (size_t j = 0; auef_handlers[i].aues[j]; j++) {
+			assert(!auef_handler_index[auef_handlers[i].aues[j]]);
+			auef_handler_index[auef_handlers[i].aues[j]] = i + 1;
+		}
+		auehandlers[i].name = auef_handlers[i].name;
+	}
+}
+
+/*
+ * Hand ev to its handler after the checks common to all handlers.
+ */
+static void
+auef_dispatch(config_t *cfg, audit_event_t *ev) {
+	const auef_handler_t *h;
+	evtloop_aue_handler_t *st;
+	uint32_t tokens, missing;
+	uint64_t start;
+	size_t i;
+
+	i = auef_handler_index[ev->type];
+	if (!i) {
 		/*
 		 * Some event types seem to be logged regardless of the class
 		 * mask settings.  However, their volume seems to be low, so
@@ -977,17 +1323,157 @@ rename_et_al:
 		 * just ignore them here instead of filtering on each event.
 		 */
 #ifdef DEBUG_AUDITPIPE
-		fprintf(stderr, "Unhandled event type=%u\n", ev.type);
+		fprintf(stderr, "Unhandled event type=%u\n", ev->type);
 #endif
 		aueunknowns++;
-		break;
+		return;
+	}
+	h = &auef_handlers[i - 1];
+	st = &auehandlers[i - 1];
+	if (h->events && !LOGEVT_WANT(cfg->events, h->events))
+		return;
+	st->count++;
+
+	tokens = auef_tokens(ev);
+	if (h->ret != AUEF_RET_ANY) {
+		if (!(tokens & AUEF_TOK_RETURN)) {
+			auef_missingtoken(cfg, ev, h->name, "return");
+			return;
+		}
+		if (!auef_succeeded(h->ret, ev->return_value)) {
+			failedsyscalls++;
+			st->failed++;
+			return;
+		}
+	}
+	missing = h->tokens & ~tokens;
+	if (missing) {
+		auef_missingtoken(cfg, ev, h->name,
+		                  auef_toknames[__builtin_ctz(missing)]);
+		return;
+	}
+
+	XNUMON_AUDIT_DISPATCH_START((int)ev->type);
+	SIGNPOST_BEGIN(signpost_category(h->events), "dispatch", ev);
+	start = timespec_mononsec();
+	h->handle(cfg, ev);
+	st->nsecs += timespec_mononsec() - start;
+	SIGNPOST_END(signpost_category(h->events), "dispatch", ev);
+	XNUMON_AUDIT_DISPATCH_DONE((int)ev->type);
+}
+
+static int
+auef_read_one(config_t *cfg) {
+	audit_event_t ev;
+	int flags;
+	int rv;
+
+	/* local socket ops are skipped in the parser, see auevent_parse;
+	 * only fields used by the handlers here are decoded */
+	flags = cfg->envlevel /* HACK */ | AUEVENT_FLAG_SKIP_UNIX |
+	        AUEVENT_FLAG_HANDLERS;
+	if (cfg->suppress_socket_op_localhost)
+		flags |= AUEVENT_FLAG_SKIP_LOOPBACK;
+	auevent_create(&ev);
+	XNUMON_AUDIT_READ_START();
+	SIGNPOST_BEGIN(SIGNPOST_PIPELINE, "audit-read", &ev);
+	if (auring_enabled)
+		rv = auevent_read_ring(&ev, &auetypes, flags, &auring);
+	else if (aubuf_enabled)
+		rv = auevent_read(&ev, &auetypes, flags, &aubuf);
+	else
+		rv = auevent_fread(&ev, &auetypes, flags, auef);
+	SIGNPOST_END(SIGNPOST_PIPELINE, "audit-read", &ev);
+	XNUMON_AUDIT_READ_DONE((int)rv, (int)ev.type);
+	if (rv == -1 || rv == 0) {
+		if (ev.flags & AEFLAG_ENOMEM)
+			ooms++;
+		if (ev.flags & AEFLAG_REJECTED)
+			auereject(ev.type);
+		if (ev.flags & AEFLAG_PARTIAL)
+			partials++;
+		if (ev.flags & AEFLAG_LOCAL)
+			localskips++;
+		auevent_destroy(&ev);
+		return rv;
 	}
+	pidcache_tick();
+	if (trace_recording())
+		trace_record(TRACE_AUDIT, ev.raw, ev.rawlen);
+
+#ifdef DEBUG_AUDITPIPE
+	auevent_fprint(stderr, &ev);
+#endif
+
+	/* avoid reacting on our own close invocations and on the code
+	 * signature verifications of our helper processes */
+	if (ev.subject.pid != xnumon_pid &&
+	    !cshelper_is_helper(ev.subject.pid))
+		auef_dispatch(cfg, &ev);
 
-out:
 	auevent_destroy(&ev); /* free all allocated members not NULLed above */
 	return 0;
 }
-#undef TOKEN_ASSERT
+
+/*
+ * The zero-copy reader may have read more than one record into its buffer;
+ * process all complete records before returning to the kqueue, which will
+ * not report the file descriptor readable for data already read.  Then keep
+ * reading from the non-blocking file descriptor until the kernel queue is
+ * empty or the budget is used up, instead of going back to kevent for every
+ * read.  With the threaded reader, the kqueue watches the reader's
+ * notification pipe, and if the budget is used up before all records handed
+ * over by the reader thread are processed, the pipe is made readable again.
+ * The au_read_rec fallback reads exactly the one record that the kevent
+ * data count refers to.
+ */
+static int
+auef_drain(config_t *cfg) {
+	size_t budget = READ_BUDGET;
+	int rv;
+
+	if (auring_enabled) {
+		auring_ack(&auring);
+		rv = 0;
+		while (rv != -1 && auring_pending(&auring)) {
+			if (budget-- == 0) {
+				auring_kick(&auring);
+				break;
+			}
+			rv = auef_read_one(cfg);
+		}
+		return rv;
+	}
+	if (aubuf_enabled) {
+		do {
+			rv = auef_read_one(cfg);
+		} while (rv != -1 && (aubuf_pending(&aubuf) ||
+		                      (!aubuf.empty && --budget > 0)));
+		return rv;
+	}
+	return auef_read_one(cfg);
+}
+
+/*
+ * When replaying a trace, the end of the audit records shows as an error
+ * reading them and shuts down the event loop like SIGTERM.
+ */
+static int
+auef_readable(UNUSED int fd, UNUSED size_t avail, void *udata) {
+	int rv;
+
+	rv = auef_drain((config_t *)udata);
+	if (auring_enabled)
+		kesched_audit(aupipe_fill(fileno(auef)), auring_used(&auring),
+		              AURING_CHUNKS);
+	else
+		kesched_audit(aupipe_fill(fileno(auef)), 0, 0);
+	if (rv == -1 && trace_replaying()) {
+		running = false;
+		fprintf(stderr, "End of trace, draining queues...\n");
+	}
+	return rv;
+}
 
 /*
  * Handles SIGTERM, SIGQUIT and SIGINT.
@@ -1008,18 +1494,119 @@ sigtstp_arrived(UNUSED int sig, UNUSED void *udata) {
 	return 0;
 }
 
+/*
+ * Collect the counters of events discarded along the pipeline, spread over
+ * the stats of the stages, into a single table by stage and reason, so that
+ * lost events can be told apart from a drop in throughput.  Must be called
+ * after all other stats have been filled in.
+ */
+static void
+evtloop_stats_drops(evtloop_stat_t *st) {
+	evtloop_drop_t *dr = st->el_drops;
+	uint64_t sum;
+	size_t n = 0;
+
+#define DROP(STAGE, REASON, COUNT) \
+	do { \
+		assert(n < EVTLOOP_DROPS_MAX); \
+		dr[n].stage = (STAGE); \
+		dr[n].reason = (REASON); \
+		dr[n].count = (COUNT); \
+		n++; \
+	} while (0)
+	DROP("audit", "auditpipe", st->ap.drops);
+	DROP("audit", "partial", partials);
+	DROP("audit", "unknown", st->el_aueunknowns);
+	DROP("audit", "failedsyscall", st->el_failedsyscalls);
+	DROP("audit", "missingtoken", st->el_missingtoken);
+	DROP("audit", "radar", st->el_radar38845422_fatal +
+	                       st->el_radar39267328_fatal +
+	                       st->el_radar39623812_fatal +
+	                       st->el_radar42770257_fatal +
+	                       st->el_radar42783724_fatal +
+	                       st->el_radar42784847_fatal +
+	                       st->el_radar42946744_fatal +
+	                       st->el_radar43151662_fatal);
+	DROP("audit", "oom", st->el_ooms);
+	DROP("procmon", "miss", st->pm.miss_bypid +
+	                        st->pm.miss_forksubj +
+	                        st->pm.miss_execsubj +
+	                        st->pm.miss_execinterp +
+	                        st->pm.miss_chdirsubj +
+	                        st->pm.miss_getcwd);
+	DROP("procmon", "prepqueue", st->pm.pqdrop);
+	DROP("procmon", "oom", st->pm.ooms);
+	DROP("hackmon", "oom", st->hm.ooms);
+	DROP("filemon", "oom", st->fm.ooms);
+	DROP("sockmon", "oom", st->sm.ooms);
+	DROP("work", "overflow", st->wq.drops);
+	DROP("work", "failed", st->wq.failed);
+	DROP("work", "suppressed", st->wq.suppressed);
+	DROP("work", "filtered", st->wq.filtered);
+	sum = 0;
+	for (size_t i = 0; i < LOGEVT_SIZE; i++)
+		sum += st->gv.suppressed[i];
+	DROP("governor", "suppressed", sum);
+	DROP("log", "overflow", st->lq.drops);
+	DROP("log", "error", st->lq.errors);
+#undef DROP
+	for (; n < EVTLOOP_DROPS_MAX; n++)
+		dr[n].stage = NULL;
+}
+
+/*
+ * Sum up the bytes accounted by the individual subsystems.  Pools hold the
+ * image_exec_t, proc_t and fd_ctx_t objects themselves, the other items are
+ * memory owned by them or held by caches and queues.  Only allocations large
+ * or numerous enough to matter are accounted; the total falls short of the
+ * footprint by heap overhead, thread stacks, libraries and what the system
+ * frameworks allocate on behalf of xnumon.
+ */
+static void
+evtloop_stats_memory(evtloop_stat_t *st) {
+	evtloop_memory_t *mem = &st->mem;
+
+	mem->pools = 0;
+	for (uint32_t i = 0; i < st->pools; i++)
+		mem->pools += st->pool[i].bytes;
+	mem->argv = st->pm.vecbytes;
+	mem->frags = st->pm.fragbytes;
+	mem->fdpaths = st->pm.pt.fdpathbytes;
+	mem->codesign = st->co.bytes;
+	mem->intern = st->is.bytes;
+	mem->caches = st->ch.bytes + st->cc.bytes + st->cd.bytes +
+	              st->cf.bytes + st->cn.bytes + st->cb.bytes +
+	              st->cs.bytes + st->cu.bytes +
+	              st->cl.bytes + st->clc.bytes + st->pc.bytes;
+	mem->queues = queue_reserved();
+	mem->total = mem->pools + mem->argv + mem->frags + mem->fdpaths +
+	             mem->codesign + mem->intern + mem->caches + mem->queues;
+}
+
 void
 evtloop_stats(evtloop_stat_t *st) {
 	if (kefd != -1) {
 		kextctl_stats(kefd, &st->ke);
+		st->keproto = (uint32_t)kextctl_proto();
+		_Static_assert(XNUMON_WAIT_BUCKETS == HIST_BUCKETS,
+		               "kext wait buckets must match hist_t");
+		st->kewait.count = 0;
+		for (size_t i = 0; i < HIST_BUCKETS; i++) {
+			st->kewait.bucket[i] = st->ke.kauth_wait[i];
+			st->kewait.count += st->ke.kauth_wait[i];
+		}
 	}
+	kextpool_stats(&st->kp);
 	procmon_stats(&st->pm);
 	hackmon_stats(&st->hm);
 	filemon_stats(&st->fm);
 	sockmon_stats(&st->sm);
 	st->el_aupclobbers = aupclobbers;
+	st->el_aupchecks = aupchecks;
+	st->el_aupnotifies = aupnotifies;
 	st->el_aueunknowns = aueunknowns;
 	st->el_failedsyscalls = failedsyscalls;
+	st->el_localskips = localskips;
 	st->el_radar38845422_fatal = radar38845422_fatal;
 	st->el_radar38845422 = radar38845422;
 	st->el_radar38845784 = radar38845784;
@@ -1039,14 +1626,119 @@ evtloop_stats(evtloop_stat_t *st) {
 	st->el_radar43151662 = radar43151662_fatal;
 	st->el_missingtoken = missingtoken;
 	st->el_ooms = ooms;
+	pidcache_stats(&st->el_pc);
+	if (auring_enabled) {
+		st->el_ringused = auring_used(&auring);
+		st->el_ringstalls = atomic_load_explicit(&auring.stalls,
+		                                         memory_order_relaxed);
+		st->el_resyncs = atomic_load_explicit(&auring.resyncs,
+		                                      memory_order_relaxed);
+	} else {
+		st->el_ringused = 0;
+		st->el_ringstalls = 0;
+		st->el_resyncs = aubuf_enabled ? aubuf.resyncs : 0;
+	}
+	memcpy(st->el_auerejects, auerejects, sizeof(auerejects));
+	memcpy(st->el_auehandlers, auehandlers, sizeof(auehandlers));
 	aupipe_stats(fileno(auef), &st->ap);
 	work_stats(&st->wq);
+	governor_stats(&st->gv);
+	degrade_stats(&st->dg);
+	membudget_stats(&st->mb);
+	kesched_stats(&st->ks);
 	log_stats(&st->lq);
+	hashes_stats(&st->hs);
 	cachehash_stats(&st->ch);
 	cachecsig_stats(&st->cc);
+	cachecdhash_stats(&st->cd);
+	fleetcache_stats(&st->fc);
+	evtidx_stats(&st->ei);
+	cachefp_stats(&st->cf);
+	cacheslice_stats(&st->cn);
+	cachebuild_stats(&st->cu);
+	cachebundle_stats(&st->cb);
+	cacheseal_stats(&st->cs);
+	cspool_stats(&st->cp);
+	csrefresh_stats(&st->cr);
 	cacheldpl_stats(&st->cl);
+	cacheldpl_content_stats(&st->clc);
+	cachepath_stats(&st->pc);
+	st->pools = pool_stats_all(st->pool, POOL_MAX);
+	intern_stats(&st->is);
+	idname_stats(&st->in);
+	fsclass_stats(&st->fs);
+	mounts_stats(&st->mn);
+	thrstat_stats(&st->ts);
+	codesign_stats(&st->co);
+	evtloop_stats_memory(st);
+	evtloop_stats_drops(st);
+}
+
+#define IVDELTA(NOW,THEN) ((NOW) > (THEN) ? (NOW) - (THEN) : 0)
+#define IVRATE(D,MS) ((MS) > 0 ? (D) * 1000 / (MS) : (D))
+
+/*
+ * Fill in the interval rates of st, which must have been filled in by
+ * evtloop_stats, relative to the start of the current interval.  If reset is
+ * true, also fold the high-water marks into st and start a new interval.
+ * Counters that went backwards, for instance across cache invalidation or
+ * reinitialization, count as zero for the interval.
+ */
+void
+evtloop_stats_interval(evtloop_stat_t *st, bool reset) {
+	evtloop_interval_t *iv = &st->iv;
+	uint64_t now, ms;
+
+	now = timespec_mononsec();
+	ms = IVDELTA(now, ivstart.nsec) / 1000000;
+	iv->msecs = ms;
+	for (size_t i = 0; i < LOGEVT_SIZE; i++)
+		iv->eps[i] = IVRATE(IVDELTA(st->lq.counts[i],
+		                            ivstart.counts[i]), ms);
+	iv->hashbps = IVRATE(IVDELTA(st->hs.bytes, ivstart.hashbytes), ms);
+	iv->csigps = IVRATE(IVDELTA(st->cp.evals, ivstart.csevals), ms);
+	iv->ch_hitrate = lrucache_hitrate(
+	        IVDELTA(st->ch.hits, ivstart.ch_hits),
+	        IVDELTA(st->ch.gets, ivstart.ch_gets));
+	iv->cc_hitrate = lrucache_hitrate(
+	        IVDELTA(st->cc.hits, ivstart.cc_hits),
+	        IVDELTA(st->cc.gets, ivstart.cc_gets));
+	iv->cl_hitrate = lrucache_hitrate(
+	        IVDELTA(st->cl.hits, ivstart.cl_hits),
+	        IVDELTA(st->cl.gets, ivstart.cl_gets));
+	for (size_t i = 0; i < THRSTAT_CLASSES; i++)
+		iv->cpu[i] = (uint32_t)(IVRATE(IVDELTA(st->ts.usecs[i],
+		                                       ivstart.usecs[i]), ms) /
+		                        1000);
+	iv->ap_drops = IVDELTA(st->ap.drops, ivstart.ap_drops);
+	iv->wq_drops = IVDELTA(st->wq.drops, ivstart.wq_drops);
+	iv->lq_drops = IVDELTA(st->lq.drops, ivstart.lq_drops);
+	if (!reset)
+		return;
+
+	procmon_peaks_reset(&st->pm);
+	work_peaks_reset(&st->wq);
+	log_peaks_reset(&st->lq);
+	ivstart.nsec = now;
+	memcpy(ivstart.counts, st->lq.counts, sizeof(ivstart.counts));
+	ivstart.hashbytes = st->hs.bytes;
+	ivstart.csevals = st->cp.evals;
+	ivstart.ch_gets = st->ch.gets;
+	ivstart.ch_hits = st->ch.hits;
+	ivstart.cc_gets = st->cc.gets;
+	ivstart.cc_hits = st->cc.hits;
+	ivstart.cl_gets = st->cl.gets;
+	ivstart.cl_hits = st->cl.hits;
+	memcpy(ivstart.usecs, st->ts.usecs, sizeof(ivstart.usecs));
+	ivstart.ap_drops = st->ap.drops;
+	ivstart.wq_drops = st->wq.drops;
+	ivstart.lq_drops = st->lq.drops;
 }
 
+static const char *latency_stages[LOGEVT_STAMPS] = {
+	"audit", "workq", "work", "reorder", "logq", "log", "total"
+};
+
 /*
  * Handles SIGINFO.
  */
@@ -1055,13 +1747,19 @@ siginfo_arrived(UNUSED int sig, UNUSED void *udata) {
 	evtloop_stat_t st;
 
 	evtloop_stats(&st);
+	evtloop_stats_interval(&st, false);
 
 	fprintf(stderr, "evtloop "
-	                "aupclobber:%"PRIu64" "
+	                "aupclobber:%"PRIu64"/%"PRIu64"/%"PRIu64" "
 	                "aueunknown:%"PRIu64" "
 	                "failedsyscalls:%"PRIu64" "
+	                "localskips:%"PRIu64" "
 	                "missingtoken:%"PRIu64" "
 	                "oom:%"PRIu64"\n        "
+	                "ring:%zu/%u "
+	                "ringstall:%"PRIu64" "
+	                "resync:%"PRIu64" "
+	                "pidcache:%"PRIu64"/%"PRIu64"/%"PRIu64"\n        "
 	                "r38845422:%"PRIu64"/%"PRIu64" "
 	                "r38845784:0/%"PRIu64" "
 	                "r39267328:%"PRIu64"/%"PRIu64" "
@@ -1072,10 +1770,20 @@ siginfo_arrived(UNUSED int sig, UNUSED void *udata) {
 	                "r42946744:%"PRIu64"/%"PRIu64" "
 	                "r43151662:%"PRIu64"/%"PRIu64"\n",
 	                st.el_aupclobbers,
+	                st.el_aupchecks,
+	                st.el_aupnotifies,
 	                st.el_aueunknowns,
 	                st.el_failedsyscalls,
+	                st.el_localskips,
 	                st.el_missingtoken,
 	                st.el_ooms,
+	                st.el_ringused,
+	                AURING_CHUNKS,
+	                st.el_ringstalls,
+	                st.el_resyncs,
+	                st.el_pc.hits,
+	                st.el_pc.misses,
+	                st.el_pc.invalidations,
 	                st.el_radar38845422_fatal,
 	                st.el_radar38845422,
 	                st.el_radar38845784,
@@ -1093,11 +1801,43 @@ siginfo_arrived(UNUSED int sig, UNUSED void *udata) {
 	                st.el_radar42946744,
 	                st.el_radar43151662_fatal,
 	                st.el_radar43151662);
+	if (st.el_auerejects[0].count > 0) {
+		fprintf(stderr, "        auereject:");
+		for (size_t i = 0; i < EVTLOOP_AUEREJECTS_MAX; i++) {
+			if (st.el_auerejects[i].count == 0)
+				break;
+			fprintf(stderr, "%s%"PRIu16"=%"PRIu64, i ? "," : "",
+			        st.el_auerejects[i].type,
+			        st.el_auerejects[i].count);
+		}
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr, "        auehandler:");
+	for (size_t i = 0; i < EVTLOOP_AUEHANDLERS_MAX; i++) {
+		if (!st.el_auehandlers[i].name)
+			break;
+		fprintf(stderr, "%s%s=%"PRIu64"/%"PRIu64"/%"PRIu64"us",
+		        i ? "," : "",
+		        st.el_auehandlers[i].name,
+		        st.el_auehandlers[i].count,
+		        st.el_auehandlers[i].failed,
+		        st.el_auehandlers[i].nsecs / 1000);
+	}
+	fprintf(stderr, "\n");
 
 	fprintf(stderr, "procmon "
-	                "actprc:%"PRIu32" "
+	                "actprc:%"PRIu32"/%"PRIu32" "
 	                "actimg:%"PRIu32" "
 	                "liveacq:%"PRIu64" "
+	                "kexthash:%"PRIu64"/%"PRIu64" "
+	                "kextident:%"PRIu64"/%"PRIu64" "
+	                "enrich:%"PRIu64"/%"PRIu64"/%"PRIu32" "
+	                "scriptpar:%"PRIu64" "
+	                "leanskip:%"PRIu64" "
+	                "restored:%"PRIu64" "
+	                "reap:%"PRIu64"/%"PRIu64"/%"PRIu64"/%"PRIu64" "
+	                "rexec:%"PRIu64"/%"PRIu64" "
+	                "opens:%"PRIu64"/%"PRIu64"/%"PRIu64" "
 	                "miss bp:%"PRIu64" "
 	                "fs:%"PRIu64" "
 	                "es:%"PRIu64" "
@@ -1106,8 +1846,28 @@ siginfo_arrived(UNUSED int sig, UNUSED void *udata) {
 	                "gc:%"PRIu64" "
 	                "oom:%"PRIu64"\n",
 	                st.pm.procs,
+	                st.pm.procspeak,
 	                st.pm.images,
 	                st.pm.liveacq,
+	                st.pm.kexthash,
+	                st.pm.kexthash_stale,
+	                st.pm.kextident,
+	                st.pm.kextident_miss,
+	                st.pm.enriched,
+	                st.pm.enrichsync,
+	                st.pm.enrichq,
+	                st.pm.scriptpar,
+	                st.pm.leanskip,
+	                st.pm.restored,
+	                st.pm.reaped,
+	                st.pm.reapsweeps,
+	                st.pm.reapstorms,
+	                st.pm.forks,
+	                st.pm.rexec_hit,
+	                st.pm.rexec_stale,
+	                st.pm.opens,
+	                st.pm.fdhandoffs,
+	                st.pm.execs,
 	                st.pm.miss_bypid,
 	                st.pm.miss_forksubj,
 	                st.pm.miss_execsubj,
@@ -1116,77 +1876,242 @@ siginfo_arrived(UNUSED int sig, UNUSED void *udata) {
 	                st.pm.miss_getcwd,
 	                st.pm.ooms);
 
+	fprintf(stderr, "proctab "
+	                "buckets:%"PRIu32" "
+	                "load:%"PRIu32"%% "
+	                "dispmax:%"PRIu32" "
+	                "lookups:%"PRIu64" "
+	                "probes:%"PRIu64" "
+	                "fdshared:%"PRIu64" "
+	                "fdunshared:%"PRIu64"\n",
+	                st.pm.pt.buckets,
+	                st.pm.pt.load,
+	                st.pm.pt.dispmax,
+	                st.pm.pt.lookups,
+	                st.pm.pt.probes,
+	                st.pm.pt.fdshared,
+	                st.pm.pt.fdunshared);
+
 	fprintf(stderr, "hackmon "
 	                "recvd:%"PRIu64" "
 	                "procd:%"PRIu64" "
-	                "oom:%"PRIu64"\n",
+	                "oom:%"PRIu64" "
+	                "folded:%"PRIu64" "
+	                "held:%"PRIu32"\n",
 	                st.hm.recvd,
 	                st.hm.procd,
-	                st.hm.ooms);
+	                st.hm.ooms,
+	                st.hm.folded,
+	                st.hm.held);
 
 	fprintf(stderr, "filemon "
 	                "recvd:%"PRIu64" "
 	                "procd:%"PRIu64" "
+	                "openskip:%"PRIu64"/%"PRIu64" "
 	                "lpmiss:%"PRIu64" "
+	                "lpoffline:%"PRIu64" "
+	                "symlinks:%"PRIu64"/%"PRIu64" "
 	                "oom:%"PRIu64"\n",
 	                st.fm.recvd,
 	                st.fm.procd,
+	                st.fm.openskips, st.fm.opens,
 	                st.fm.lpmiss,
+	                st.fm.lpoffline,
+	                st.fm.symlinks, st.fm.symlinks_bytes,
 	                st.fm.ooms);
 
 	fprintf(stderr, "sockmon "
 	                "recvd:%"PRIu64" "
 	                "procd:%"PRIu64" "
-	                "oom:%"PRIu64"\n",
+	                "oom:%"PRIu64" "
+	                "folded:%"PRIu64" "
+	                "held:%"PRIu32" "
+	                "early:%"PRIu64" "
+	                "ignored:%"PRIu64"\n",
 	                st.sm.recvd,
 	                st.sm.procd,
-	                st.sm.ooms);
+	                st.sm.ooms,
+	                st.sm.folded,
+	                st.sm.held,
+	                st.sm.early,
+	                st.sm.ignored);
 
 	if (kefd != -1) {
 		fprintf(stderr, "kext cdevq "
+		                "proto:%"PRIu32" "
 		                "buckets:%"PRIu32"/~ "
 		                "visitors:%"PRIu32" "
 		                "timeout:%"PRIu64" "
 		                "err:%"PRIu64" "
 		                "defer:%"PRIu64" "
-		                "deny:%"PRIu64"\n",
+		                "deny:%"PRIu64" "
+		                "nowait:%"PRIu64" "
+		                "poolmiss:%"PRIu64" "
+		                "degraded:%"PRIu64" "
+		                "repeat:%"PRIu64" "
+		                "wait<us:%"PRIu64"/%"PRIu64"/%"PRIu64"\n",
+		                st.keproto,
 		                st.ke.cdev_qsize,
 		                st.ke.kauth_visitors,
 		                st.ke.kauth_timeouts,
 		                st.ke.kauth_errors,
 		                st.ke.kauth_defers,
-		                st.ke.kauth_denies);
+		                st.ke.kauth_denies,
+		                st.ke.kauth_nowaits,
+		                st.ke.cdev_poolmisses,
+		                st.ke.kauth_degraded,
+		                st.ke.kauth_repeats,
+		                hist_percentile(&st.kewait, 50),
+		                hist_percentile(&st.kewait, 90),
+		                hist_percentile(&st.kewait, 99));
+
+		fprintf(stderr, "kext pool "
+		                "threads:%"PRIu32" "
+		                "dispatched:%"PRIu64" "
+		                "peak:%"PRIu64" "
+		                "block:%"PRIu64"\n",
+		                st.kp.threads,
+		                st.kp.dispatched,
+		                st.kp.peak,
+		                st.kp.blocks);
 
 		fprintf(stderr, "prep queue "
 		                "buckets:%"PRIu64"/~ "
+		                "peak:%"PRIu64" "
 		                "lookup:%"PRIu64" "
 		                "miss:%"PRIu64" "       /* normal at startup */
 		                "drop:%"PRIu64" "       /* too many ooo */
-		                "bktskip:%"PRIu64"\n",  /* ooo arrival search */
+		                "bktskip:%"PRIu64" "    /* ooo arrival search */
+		                "lat<us:%"PRIu64"/%"PRIu64"/%"PRIu64"\n",
 		                st.pm.pqsize,
+		                st.pm.pqpeak,
 		                st.pm.pqlookup,
 		                st.pm.pqmiss,
 		                st.pm.pqdrop,
-		                st.pm.pqskip);
+		                st.pm.pqskip,
+		                hist_percentile(&st.pm.pqlat, 50),
+		                hist_percentile(&st.pm.pqlat, 90),
+		                hist_percentile(&st.pm.pqlat, 99));
 	}
 
 	fprintf(stderr, "aupi cdevq "
 	                "buckets:%u/%u "
-	                "insert:%u "
-	                "read:%u "
-	                "drop:%u\n",
+	                "insert:%"PRIu64" "
+	                "read:%"PRIu64" "
+	                "drop:%"PRIu64" "
+	                "lean:%u "
+	                "grow:%u "
+	                "shrink:%u "
+	                "series:",
 	                st.ap.qlen,
 	                st.ap.qlimit,
 	                st.ap.inserts,
 	                st.ap.reads,
-	                st.ap.drops);
+	                st.ap.drops,
+	                st.ap.lean,
+	                st.ap.grows,
+	                st.ap.shrinks);
+	for (unsigned int i = 0; i < st.ap.samples; i++) {
+		fprintf(stderr, "%s%u/%u", i ? "," : "",
+		                st.ap.series[i].qlen, st.ap.series[i].qlimit);
+	}
+	fprintf(stderr, "\n");
 
 	fprintf(stderr, "work queue "
-	                "buckets:%"PRIu32"/~\n",
-	                st.wq.qsize);
+	                "buckets:%"PRIu32"/~ "
+	                "peak:%"PRIu32" "
+	                "reorder:%"PRIu32" "
+	                "drop:%"PRIu64" "
+	                "block:%"PRIu64" "
+	                "workers:",
+	                st.wq.qsize,
+	                st.wq.qpeak,
+	                st.wq.rbsize,
+	                st.wq.drops,
+	                st.wq.blocks);
+	for (uint32_t i = 0; i < st.wq.workers; i++) {
+		fprintf(stderr, "%s%"PRIu32, i ? "," : "", st.wq.wqsize[i]);
+	}
+	fprintf(stderr, " bulked:%"PRIu64" bulk:", st.wq.bulked);
+	for (uint32_t i = 0; i < st.wq.bulkers; i++) {
+		fprintf(stderr, "%s%"PRIu32, i ? "," : "", st.wq.bqsize[i]);
+	}
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "governor "
+	                "keys:%"PRIu32" "
+	                "untracked:%"PRIu64" "
+	                "summaries:%"PRIu64" "
+	                "suppressed [2]:%"PRIu64" "
+	                "[3]:%"PRIu64" "
+	                "[5]:%"PRIu64" "
+	                "[6]:%"PRIu64" "
+	                "[7]:%"PRIu64"\n",
+	                st.gv.keys,
+	                st.gv.untracked,
+	                st.gv.summaries,
+	                st.gv.suppressed[LOGEVT_IMAGE_EXEC],
+	                st.gv.suppressed[LOGEVT_PROCESS_ACCESS],
+	                st.gv.suppressed[LOGEVT_SOCKET_LISTEN],
+	                st.gv.suppressed[LOGEVT_SOCKET_ACCEPT],
+	                st.gv.suppressed[LOGEVT_SOCKET_CONNECT]);
+
+	fprintf(stderr, "degrade "
+	                "level:%"PRIu32" "
+	                "raises:%"PRIu64" "
+	                "lowers:%"PRIu64" "
+	                "skipped sha256:%"PRIu64" "
+	                "codesign:%"PRIu64" "
+	                "ancestors:%"PRIu64"\n",
+	                st.dg.level,
+	                st.dg.raises,
+	                st.dg.lowers,
+	                st.dg.sha256_skipped,
+	                st.dg.codesign_skipped,
+	                st.dg.ancestors_truncated);
+
+	fprintf(stderr, "membudget "
+	                "level:%"PRIu32" "
+	                "raises:%"PRIu64" "
+	                "lowers:%"PRIu64" "
+	                "budget:%"PRIu64" "
+	                "footprint:%"PRIu64"/%"PRIu64" "
+	                "caches:%"PRIu64" "
+	                "procs:%"PRIu32" "
+	                "images:%"PRIu32" "
+	                "queued:%"PRIu64" "
+	                "flushes:%"PRIu64" "
+	                "envs:%"PRIu64"\n",
+	                st.mb.level,
+	                st.mb.raises,
+	                st.mb.lowers,
+	                st.mb.budget,
+	                st.mb.footprint,
+	                st.mb.footprintpeak,
+	                st.mb.caches,
+	                st.mb.procs,
+	                st.mb.images,
+	                st.mb.queued,
+	                st.mb.flushes,
+	                st.mb.envs_dropped);
+
+	fprintf(stderr, "kesched "
+	                "audit fill:%"PRIu32"/1000 "
+	                "reads:%"PRIu64" "
+	                "deferred:%"PRIu64" "
+	                "(%"PRIu64" us) "
+	                "kext first:%"PRIu64" "
+	                "forced:%"PRIu64"\n",
+	                st.ks.audit_fill,
+	                st.ks.reads,
+	                st.ks.deferred,
+	                st.ks.deferred_nsec / 1000,
+	                st.ks.kext_first,
+	                st.ks.forced);
 
 	fprintf(stderr, "log  queue "
 	                "buckets:%"PRIu32"/~ "
+	                "peak:%"PRIu32" "
 	                "[0]:%"PRIu64" "
 	                "[1]:%"PRIu64" "
 	                "[2]:%"PRIu64" "
@@ -1195,8 +2120,14 @@ siginfo_arrived(UNUSED int sig, UNUSED void *udata) {
 	                "[5]:%"PRIu64" "
 	                "[6]:%"PRIu64" "
 	                "[7]:%"PRIu64" "
+	                "[8]:%"PRIu64" "
+	                "[9]:%"PRIu64" "
+	                "drop:%"PRIu64" "
+	                "block:%"PRIu64" "
+	                "flush:%"PRIu64" "
 	                "err:%"PRIu64"\n",
 	                st.lq.qsize,
+	                st.lq.qpeak,
 	                st.lq.counts[LOGEVT_XNUMON_OPS],
 	                st.lq.counts[LOGEVT_XNUMON_STATS],
 	                st.lq.counts[LOGEVT_IMAGE_EXEC],
@@ -1205,91 +2136,786 @@ siginfo_arrived(UNUSED int sig, UNUSED void *udata) {
 	                st.lq.counts[LOGEVT_SOCKET_LISTEN],
 	                st.lq.counts[LOGEVT_SOCKET_ACCEPT],
 	                st.lq.counts[LOGEVT_SOCKET_CONNECT],
+	                st.lq.counts[LOGEVT_EVENT_SUMMARY],
+	                st.lq.counts[LOGEVT_IMAGE_ENRICH],
+	                st.lq.drops,
+	                st.lq.blocks,
+	                st.lq.flushes,
 	                st.lq.errors);
-	_Static_assert(LOGEVT_SIZE == 8, "number of handled event types here");
+	_Static_assert(LOGEVT_SIZE == 10, "number of handled event types here");
+
+	fprintf(stderr, "log  dest "
+	                "rendered:%"PRIu64" "
+	                "written:%"PRIu64" "
+	                "writes:%"PRIu64" "
+	                "syncs:%"PRIu64" "
+	                "spooled:%"PRIu32" "
+	                "spoolbytes:%"PRIu64" "
+	                "segs:%"PRIu32" "
+	                "spilled:%"PRIu64" "
+	                "stalls:%"PRIu64" "
+	                "spooldrop:%"PRIu64" "
+	                "connects:%"PRIu64" "
+	                "lat<us:%"PRIu64"/%"PRIu64"/%"PRIu64"\n",
+	                st.lq.ld.rendered,
+	                st.lq.ld.written,
+	                st.lq.ld.writes,
+	                st.lq.ld.syncs,
+	                st.lq.ld.spooled,
+	                st.lq.ld.spoolbytes,
+	                st.lq.ld.spoolsegs,
+	                st.lq.ld.spilled,
+	                st.lq.ld.stalls,
+	                st.lq.ld.drops,
+	                st.lq.ld.connects,
+	                hist_percentile(&st.lq.ld.latency, 50),
+	                hist_percentile(&st.lq.ld.latency, 90),
+	                hist_percentile(&st.lq.ld.latency, 99));
+
+	for (size_t i = 0; i < st.lq.outs; i++) {
+		fprintf(stderr, "log  out %s:%s "
+		                "size:%"PRIu32" "
+		                "peak:%"PRIu32" "
+		                "rec:%"PRIu64" "
+		                "drop:%"PRIu64" "
+		                "block:%"PRIu64" "
+		                "flush:%"PRIu64" "
+		                "err:%"PRIu64"\n",
+		                st.lq.out[i].fmt,
+		                st.lq.out[i].dst,
+		                st.lq.out[i].qsize,
+		                st.lq.out[i].qpeak,
+		                st.lq.out[i].records,
+		                st.lq.out[i].drops,
+		                st.lq.out[i].blocks,
+		                st.lq.out[i].flushes,
+		                st.lq.out[i].errors);
+	}
+
+	fprintf(stderr, "pipeline lat<us");
+	for (size_t i = 0; i < LOGEVT_STAMPS; i++)
+		fprintf(stderr, " %s:%"PRIu64"/%"PRIu64"/%"PRIu64,
+		                latency_stages[i],
+		                hist_percentile(&st.lq.latency[i], 50),
+		                hist_percentile(&st.lq.latency[i], 90),
+		                hist_percentile(&st.lq.latency[i], 99));
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "hashes "
+	                "files:%"PRIu64" "
+	                "bytes:%"PRIu64" "
+	                "par:%"PRIu64" "
+	                "map:%"PRIu64" "
+	                "MB/s:%"PRIu64" "
+	                "leaves:%"PRIu64" "
+	                "reused:%"PRIu64"\n",
+	                st.hs.files,
+	                st.hs.bytes,
+	                st.hs.parallel,
+	                st.hs.mapped,
+	                st.hs.mbps,
+	                st.hs.leaves,
+	                st.hs.reused);
 
 	fprintf(stderr, "hash cache "
+	                "policy:%s "
 	                "buckets:%"PRIu32"/%"PRIu32" "
+	                "protected:%"PRIu32" "
+	                "bytes:%"PRIu64" "
+	                "grow:%"PRIu64" "
 	                "put:%"PRIu64" "
 	                "get:%"PRIu64" "
 	                "hit:%"PRIu64" "
 	                "miss:%"PRIu64" "       /* once per binary inode */
-	                "inv:%"PRIu64"\n",      /* modified binary inodes */
-	                st.ch.used, st.ch.size,
+	                "hitrate:%"PRIu32"/1000 "
+	                "inv:%"PRIu64" "        /* modified binary inodes */
+	                "filtered:%"PRIu64" "   /* definite misses */
+	                "falsepos:%"PRIu64" "
+	                "shards:",
+	                lrucache_policy_s(st.ch.policy),
+	                st.ch.used, st.ch.size, st.ch.protected,
+	                st.ch.bytes, st.ch.grows,
 	                st.ch.puts, st.ch.gets,
-	                st.ch.hits, st.ch.misses,
-	                st.ch.invalids);
+	                st.ch.hits, st.ch.misses, st.ch.hitrate,
+	                st.ch.invalids,
+	                st.ch.filtered, st.ch.falsepos);
+	for (uint32_t i = 0; i < st.ch.shards; i++) {
+		fprintf(stderr, "%s%"PRIu64"/%"PRIu64, i ? "," : "",
+		                st.ch.shard[i].hits, st.ch.shard[i].misses);
+	}
+	fprintf(stderr, "\n");
 
 	fprintf(stderr, "csig cache "
+	                "policy:%s "
 	                "buckets:%"PRIu32"/%"PRIu32" "
+	                "protected:%"PRIu32" "
+	                "bytes:%"PRIu64" "
+	                "grow:%"PRIu64" "
 	                "put:%"PRIu64" "
 	                "get:%"PRIu64" "
 	                "hit:%"PRIu64" "
 	                "miss:%"PRIu64" "       /* once per binary content */
-	                "inv:%"PRIu64"\n",      /* cannot happen */
-	                st.cc.used, st.cc.size,
+	                "hitrate:%"PRIu32"/1000 "
+	                "inv:%"PRIu64"\n",      /* expired negative entries */
+	                lrucache_policy_s(st.cc.policy),
+	                st.cc.used, st.cc.size, st.cc.protected,
+	                st.cc.bytes, st.cc.grows,
 	                st.cc.puts, st.cc.gets,
-	                st.cc.hits, st.cc.misses,
+	                st.cc.hits, st.cc.misses, st.cc.hitrate,
 	                st.cc.invalids);
 
+	fprintf(stderr, "cdhash cache "
+	                "buckets:%"PRIu32"/%"PRIu32" "
+	                "bytes:%"PRIu64" "
+	                "put:%"PRIu64" "
+	                "get:%"PRIu64" "
+	                "hit:%"PRIu64" "        /* known code in new inodes */
+	                "miss:%"PRIu64" "
+	                "hitrate:%"PRIu32"/1000 "
+	                "inv:%"PRIu64"\n",      /* file size mismatches */
+	                st.cd.used, st.cd.size,
+	                st.cd.bytes,
+	                st.cd.puts, st.cd.gets,
+	                st.cd.hits, st.cd.misses, st.cd.hitrate,
+	                st.cd.invalids);
+
+	fprintf(stderr, "fleet cache "
+	                "get:%"PRIu64" "
+	                "hit:%"PRIu64" "
+	                "miss:%"PRIu64" "
+	                "reject:%"PRIu64" "
+	                "timeout:%"PRIu64" "
+	                "err:%"PRIu64" "
+	                "put:%"PRIu64"/%"PRIu64"\n",  /* published/dropped */
+	                st.fc.lookups,
+	                st.fc.hits,
+	                st.fc.misses,
+	                st.fc.rejects,
+	                st.fc.timeouts,
+	                st.fc.errors,
+	                st.fc.puts, st.fc.putdrops);
+
+	fprintf(stderr, "query index "
+	                "used:%"PRIu64"/%"PRIu64" "
+	                "added:%"PRIu64" "
+	                "queries:%"PRIu64" "
+	                "results:%"PRIu64" "
+	                "err:%"PRIu64"\n",
+	                st.ei.used, st.ei.size,
+	                st.ei.added,
+	                st.ei.queries,
+	                st.ei.results,
+	                st.ei.errors);
+
+	fprintf(stderr, "fp cache "
+	                "buckets:%"PRIu32"/%"PRIu32" "
+	                "bytes:%"PRIu64" "
+	                "put:%"PRIu64" "
+	                "get:%"PRIu64" "
+	                "hit:%"PRIu64" "        /* known content, new inode */
+	                "miss:%"PRIu64" "
+	                "hitrate:%"PRIu32"/1000 "
+	                "inv:%"PRIu64"\n",      /* file size mismatches */
+	                st.cf.used, st.cf.size,
+	                st.cf.bytes,
+	                st.cf.puts, st.cf.gets,
+	                st.cf.hits, st.cf.misses, st.cf.hitrate,
+	                st.cf.invalids);
+
+	fprintf(stderr, "sealed cache "
+	                "buckets:%"PRIu32"/%"PRIu32" "
+	                "bytes:%"PRIu64" "
+	                "put:%"PRIu64" "
+	                "get:%"PRIu64" "
+	                "hit:%"PRIu64" "
+	                "miss:%"PRIu64" "
+	                "hitrate:%"PRIu32"/1000\n",
+	                st.cs.used, st.cs.size,
+	                st.cs.bytes,
+	                st.cs.puts, st.cs.gets,
+	                st.cs.hits, st.cs.misses, st.cs.hitrate);
+
+	fprintf(stderr, "bundle cache "
+	                "buckets:%"PRIu32"/%"PRIu32" "
+	                "bytes:%"PRIu64" "
+	                "put:%"PRIu64" "
+	                "get:%"PRIu64" "
+	                "hit:%"PRIu64" "        /* origin checks skipped */
+	                "miss:%"PRIu64" "
+	                "hitrate:%"PRIu32"/1000\n",
+	                st.cb.used, st.cb.size,
+	                st.cb.bytes,
+	                st.cb.puts, st.cb.gets,
+	                st.cb.hits, st.cb.misses, st.cb.hitrate);
+
+	fprintf(stderr, "csig pool "
+	                "threads:%"PRIu32" "
+	                "buckets:%"PRIu32" "
+	                "inflight:%"PRIu32" "
+	                "eval:%"PRIu64" "
+	                "coalesced:%"PRIu64" "
+	                "overlapped:%"PRIu64" "
+	                "abandoned:%"PRIu64"\n",
+	                st.cp.threads,
+	                st.cp.qsize,
+	                st.cp.inflight,
+	                st.cp.evals,
+	                st.cp.coalesced,
+	                st.cp.overlapped,
+	                st.cp.abandoned);
+
+	fprintf(stderr, "csig refresh "
+	                "rounds:%"PRIu64" "
+	                "checked:%"PRIu64" "
+	                "changed:%"PRIu64" "
+	                "skipped:%"PRIu64"\n",
+	                st.cr.rounds,
+	                st.cr.checked,
+	                st.cr.changed,
+	                st.cr.skipped);
+
 	fprintf(stderr, "ldpl cache "
+	                "policy:%s "
 	                "buckets:%"PRIu32"/%"PRIu32" "
+	                "protected:%"PRIu32" "
+	                "bytes:%"PRIu64" "
+	                "grow:%"PRIu64" "
 	                "put:%"PRIu64" "
 	                "get:%"PRIu64" "
 	                "hit:%"PRIu64" "
 	                "miss:%"PRIu64" "       /* once per launchd plist */
+	                "hitrate:%"PRIu32"/1000 "
 	                "inv:%"PRIu64"\n",      /* modified launchd plist */
-	                st.cl.used, st.cl.size,
+	                lrucache_policy_s(st.cl.policy),
+	                st.cl.used, st.cl.size, st.cl.protected,
+	                st.cl.bytes, st.cl.grows,
 	                st.cl.puts, st.cl.gets,
-	                st.cl.hits, st.cl.misses,
+	                st.cl.hits, st.cl.misses, st.cl.hitrate,
 	                st.cl.invalids);
 
+	fprintf(stderr, "ldpl content cache "
+	                "buckets:%"PRIu32"/%"PRIu32" "
+	                "bytes:%"PRIu64" "
+	                "put:%"PRIu64" "
+	                "get:%"PRIu64" "
+	                "hit:%"PRIu64" "        /* identical rewrite */
+	                "miss:%"PRIu64" "
+	                "hitrate:%"PRIu32"/1000\n",
+	                st.clc.used, st.clc.size,
+	                st.clc.bytes,
+	                st.clc.puts, st.clc.gets,
+	                st.clc.hits, st.clc.misses, st.clc.hitrate);
+
+	fprintf(stderr, "path cache "
+	                "buckets:%"PRIu32"/%"PRIu32" "
+	                "bytes:%"PRIu64" "
+	                "put:%"PRIu64" "
+	                "get:%"PRIu64" "
+	                "hit:%"PRIu64" "
+	                "miss:%"PRIu64" "
+	                "hitrate:%"PRIu32"/1000 "
+	                "inv:%"PRIu64"\n",      /* renamed, unlinked, expired */
+	                st.pc.used, st.pc.size,
+	                st.pc.bytes,
+	                st.pc.puts, st.pc.gets,
+	                st.pc.hits, st.pc.misses, st.pc.hitrate,
+	                st.pc.invalids);
+
+	fprintf(stderr, "pools");
+	for (uint32_t i = 0; i < st.pools; i++) {
+		fprintf(stderr, " %s:%"PRIu32"/%"PRIu32"/%"PRIu32"/%"PRIu64
+		                "/%"PRIu64,
+		                st.pool[i].name, st.pool[i].used,
+		                st.pool[i].hiwat, st.pool[i].slabs,
+		                st.pool[i].allocs, st.pool[i].bytes);
+	}
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "threads cpu<ms");
+	for (int i = 0; i < THRSTAT_CLASSES; i++)
+		fprintf(stderr, " %s:%"PRIu32"/%"PRIu64,
+		                thrstat_class_s(i), st.ts.threads[i],
+		                st.ts.usecs[i] / 1000);
+	fprintf(stderr, " rss:%"PRIu64"/%"PRIu64" footprint:%"PRIu64"\n",
+	                st.ts.rss, st.ts.rsspeak, st.ts.footprint);
+
+	fprintf(stderr, "accounted "
+	                "pools:%"PRIu64" "
+	                "argv:%"PRIu64" "
+	                "frags:%"PRIu64" "
+	                "fdpaths:%"PRIu64" "
+	                "codesign:%"PRIu64" "
+	                "intern:%"PRIu64" "
+	                "caches:%"PRIu64" "
+	                "queues:%"PRIu64" "
+	                "total:%"PRIu64"\n",
+	                st.mem.pools,
+	                st.mem.argv,
+	                st.mem.frags,
+	                st.mem.fdpaths,
+	                st.mem.codesign,
+	                st.mem.intern,
+	                st.mem.caches,
+	                st.mem.queues,
+	                st.mem.total);
+
+	fprintf(stderr, "intern "
+	                "strings:%"PRIu64" "
+	                "bytes:%"PRIu64" "
+	                "lookups:%"PRIu64" "
+	                "hits:%"PRIu64"\n",
+	                st.is.strings,
+	                st.is.bytes,
+	                st.is.lookups,
+	                st.is.hits);
+
+	fprintf(stderr, "idname "
+	                "hits:%"PRIu64" "
+	                "misses:%"PRIu64" "
+	                "refreshes:%"PRIu64"\n",
+	                st.in.hits,
+	                st.in.misses,
+	                st.in.refreshes);
+
+	fprintf(stderr, "fsclass "
+	                "hits:%"PRIu64" "
+	                "misses:%"PRIu64" "
+	                "bulk:%"PRIu64" "
+	                "skip:%"PRIu64"\n",
+	                st.fs.hits,
+	                st.fs.misses,
+	                st.fs.bulk,
+	                st.fs.skip);
+
+	fprintf(stderr, "mounts "
+	                "mounted:%"PRIu64" "
+	                "unmounts:%"PRIu64" "
+	                "purged:%"PRIu64"\n",
+	                st.mn.mounted,
+	                st.mn.unmounts,
+	                st.mn.purged);
+
+	fprintf(stderr, "interval "
+	                "ms:%"PRIu64" "
+	                "ev/s:",
+	                st.iv.msecs);
+	for (size_t i = 0; i < LOGEVT_SIZE; i++)
+		fprintf(stderr, "%s%"PRIu64, i ? "," : "", st.iv.eps[i]);
+	fprintf(stderr, " cpu:");           /* permille of one cpu */
+	for (int i = 0; i < THRSTAT_CLASSES; i++)
+		fprintf(stderr, "%s%"PRIu32, i ? "," : "", st.iv.cpu[i]);
+	fprintf(stderr, " hashB/s:%"PRIu64" "
+	                "csig/s:%"PRIu64" "
+	                "hitrate:%"PRIu32"/%"PRIu32"/%"PRIu32" "
+	                "drop:%"PRIu64"/%"PRIu64"/%"PRIu64"\n",
+	                st.iv.hashbps,
+	                st.iv.csigps,
+	                st.iv.ch_hitrate,
+	                st.iv.cc_hitrate,
+	                st.iv.cl_hitrate,
+	                st.iv.ap_drops,
+	                st.iv.wq_drops,
+	                st.iv.lq_drops);
+
+	return 0;
+}
+
+/*
+ * Handles SIGHUP.
+ */
+static int
+sighup_arrived(UNUSED int sig, UNUSED void *udata) {
+	if (log_reinit() == -1) {
+		fprintf(stderr, "Failed to reopen the log\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Called when a client connects to the query socket.
+ */
+static int
+query_readable(UNUSED int fd, UNUSED size_t avail, UNUSED void *udata) {
+	if (evtidx_serve() == -1)
+		fprintf(stderr, "evtidx_serve() failed: %s (%i)\n",
+		                strerror(errno), errno);
+	return 0;
+}
+
+/*
+ * Called when a client connects to the metrics socket.
+ */
+static int
+metrics_readable(UNUSED int fd, UNUSED size_t avail, UNUSED void *udata) {
+	if (metrics_serve() == -1)
+		fprintf(stderr, "metrics_serve() failed: %s (%i)\n",
+		                strerror(errno), errno);
+	return 0;
+}
+
+/*
+ * Called by stats timer, configurable interval.
+ */
+static int
+stats_timer_fired(UNUSED int ident, UNUSED void *udata) {
+	if ((log_event_xnumon_stats() == -1) && (errno == ENOMEM))
+		ooms++;
+	return 0;
+}
+
+/*
+ * Save the persistent caches, if configured.
+ */
+static void
+cache_save(void) {
+	if (cachehash_save() == -1)
+		fprintf(stderr, "Failed to save hash cache: %s (%i)\n",
+		                strerror(errno), errno);
+	if (cachecsig_save() == -1)
+		fprintf(stderr, "Failed to save codesign cache: %s (%i)\n",
+		                strerror(errno), errno);
+	if (cacheldpl_save() == -1)
+		fprintf(stderr, "Failed to save launchd plist cache: %s (%i)\n",
+		                strerror(errno), errno);
+	if (cacheseal_save() == -1)
+		fprintf(stderr, "Failed to save sealed cache: %s (%i)\n",
+		                strerror(errno), errno);
+}
+
+/*
+ * Save the lineage snapshot, if caches are persisted and processes were
+ * preloaded.  Drained indicates that the work stage was shut down.
+ */
+static void
+snapshot_save(bool drained) {
+	if (!snapshot_path)
+		return;
+	if (procmon_snapshot_save(snapshot_path, drained) == -1)
+		fprintf(stderr, "Failed to save lineage snapshot: %s (%i)\n",
+		                strerror(errno), errno);
+}
+
+/*
+ * Called by cache save timer, configurable interval.
+ */
+static int
+cache_timer_fired(UNUSED int ident, UNUSED void *udata) {
+	cache_save();
+	snapshot_save(false);
+	return 0;
+}
+
+/*
+ * Called by socket-connect, socket-accept and process-access aggregation
+ * timer, every second.
+ */
+static int
+aggr_timer_fired(UNUSED int ident, UNUSED void *udata) {
+	struct timespec tv;
+
+	if (timespec_nanotime(&tv) == -1)
+		return 0;
+	sockmon_flush(&tv);
+	hackmon_flush(&tv);
+	return 0;
+}
+
+/*
+ * Build the path of persistent cache file `name' in the configured cache
+ * directory.  Returns NULL if caches are not persisted.
+ */
+static const char *
+cache_path(char *buf, size_t sz, config_t *cfg, const char *name) {
+	if (!cfg->cache_directory)
+		return NULL;
+	if (snprintf(buf, sz, "%s/%s",
+	             cfg->cache_directory, name) >= (int)sz) {
+		fprintf(stderr, "Cache directory path too long, "
+		                "not persisting caches\n");
+		return NULL;
+	}
+	return buf;
+}
+
+/*
+ * Called by process table reconciliation timer, every PROCMON_REAP_TICK
+ * seconds.
+ */
+static int
+reap_timer_fired(UNUSED int ident, UNUSED void *udata) {
+	struct timespec tv;
+
+	if (timespec_nanotime(&tv) == -1)
+		return 0;
+	procmon_reap(&tv);
+	return 0;
+}
+
+/*
+ * Called by auditpipe tuning timer, every second.
+ */
+static int
+aupipe_timer_fired(UNUSED int ident, UNUSED void *udata) {
+	aupipe_tune(fileno(auef));
 	return 0;
 }
 
 /*
- * Handles SIGHUP.
+ * Called by degrade timer, every second; also drives the elastic workers.
  */
 static int
-sighup_arrived(UNUSED int sig, UNUSED void *udata) {
-	if (log_reinit() == -1) {
-		fprintf(stderr, "Failed to reopen the log\n");
-		return -1;
+degrade_timer_fired(UNUSED int ident, UNUSED void *udata) {
+	aupipe_stat_t ap;
+	work_stat_t wq;
+	log_stat_t lq;
+	thrstat_stat_t ts;
+	uint32_t depth;
+	uint64_t usecs = 0, queued;
+
+	work_stats(&wq);
+	log_stats(&lq);
+	depth = lq.qsize;
+	queued = lq.qsize;
+	for (uint32_t i = 0; i < wq.workers; i++) {
+		depth = max(depth, wq.wqsize[i]);
+		queued += wq.wqsize[i];
+	}
+	for (uint32_t i = 0; i < wq.bulkers; i++) {
+		depth = max(depth, wq.bqsize[i]);
+		queued += wq.bqsize[i];
 	}
+	aupipe_stats(fileno(auef), &ap);
+	thrstat_stats(&ts);
+	for (size_t i = 0; i < THRSTAT_CLASSES; i++)
+		usecs += ts.usecs[i];
+	degrade_tick(depth, ap.drops, usecs);
+	membudget_tick(ts.footprint, queued);
+	work_tick();
 	return 0;
 }
 
+#define TIMER_AUPOL     1
+#define TIMER_STATS     2
+#define TIMER_CONFIG    3
+#define TIMER_CACHE     4
+#define TIMER_AGGR      5
+#define TIMER_AUPIPE    6
+#define TIMER_DEGRADE   7
+#define TIMER_REAP      8
+#define TIMER_PRELOAD   9
+
 /*
- * Called by stats timer, configurable interval.
+ * Called by startup lane timer, every second while images preloaded at
+ * startup are held back.  Submits up to preload_rate of them, less the
+ * backlog of live events queued in the work and log stages, such that the
+ * preloaded images only take up capacity the live events leave over.
  */
 static int
-stats_timer_fired(UNUSED int ident, UNUSED void *udata) {
-	if ((log_event_xnumon_stats() == -1) && (errno == ENOMEM))
-		ooms++;
+preload_timer_fired(UNUSED int ident, void *udata) {
+	config_t *cfg = (config_t *)udata;
+	work_stat_t wq;
+	log_stat_t lq;
+	size_t queued;
+
+	work_stats(&wq);
+	log_stats(&lq);
+	queued = lq.qsize;
+	for (uint32_t i = 0; i < wq.workers; i++)
+		queued += wq.wqsize[i];
+	for (uint32_t i = 0; i < wq.bulkers; i++)
+		queued += wq.bqsize[i];
+	if (procmon_preload_drain(cfg->preload_rate > queued
+	                          ? cfg->preload_rate - queued : 0) > 0)
+		return 0;
+	if (mainkq && kqueue_del_timer(mainkq, TIMER_PRELOAD) == -1)
+		fprintf(stderr, "kqueue_del_timer(TIMER_PRELOAD) failed: "
+		                "%s (%i)\n", strerror(errno), errno);
 	return 0;
 }
 
 /*
- * Called by audit policy watchdog timer, every five minutes.
+ * Audit policy check intervals in seconds.  The interval drops to the
+ * minimum whenever the policy was found clobbered by other tools, since
+ * that tends to happen repeatedly, for instance while auditd(8) is being
+ * restarted, and doubles with every check that finds the policy intact, up
+ * to AUPOL_INTERVAL.  If audit(4) reports policy changes, which are then
+ * checked on immediately, the timer is only a safety net and backs off up
+ * to AUPOL_INTERVAL_MAX, to avoid periodic wakeups on quiet systems.
  */
+#define AUPOL_INTERVAL_MIN      15
+#define AUPOL_INTERVAL          300
+#define AUPOL_INTERVAL_MAX      3600
+
 int aupol_wanted = -1;
+static int aupol_interval;              /* current timer interval */
+static bool aupol_notify;               /* policy changes are reported */
+static kevent_ctx_t *aupol_ctx;         /* NULL until the timer is added */
+
+/*
+ * Check on the audit policy, re-apply it if needed and adjust the check
+ * interval.
+ */
 static int
-aupol_timer_fired(UNUSED int ident, UNUSED void *udata) {
+aupol_check(void) {
+	int interval;
+
 	assert(aupol_wanted != -1);
+	aupchecks++;
 	switch (aupolicy_ensure(aupol_wanted)) {
 	case 0:
-		return 0;
+		interval = min(aupol_interval * 2,
+		               aupol_notify ? AUPOL_INTERVAL_MAX
+		                            : AUPOL_INTERVAL);
+		break;
 	case 1:
 		aupclobbers++;
-		return 0;
+		interval = AUPOL_INTERVAL_MIN;
+		break;
 	default:
 		fprintf(stderr, "Failed to configure audit policy\n");
 		return -1;
 	}
-	/* not reached */
+	if (interval == aupol_interval)
+		return 0;
+	if (mainkq && aupol_ctx &&
+	    kqueue_mod_timer(mainkq, TIMER_AUPOL, interval, aupol_ctx) == -1) {
+		fprintf(stderr, "kqueue_mod_timer(TIMER_AUPOL) failed: "
+		                "%s (%i)\n", strerror(errno), errno);
+		return 0;
+	}
+	aupol_interval = interval;
+	return 0;
+}
+
+/*
+ * Called by audit policy watchdog timer, every AUPOL_INTERVAL_MIN to
+ * AUPOL_INTERVAL_MAX seconds, see aupol_check.
+ */
+static int
+aupol_timer_fired(UNUSED int ident, UNUSED void *udata) {
+	return aupol_check();
+}
+
+/*
+ * The event lists added to the AC_XNUMON class besides the procmon events,
+ * and the eventcodes each of them is needed for.
+ */
+static const struct {
+	int events;
+	const uint16_t *aues;
+} auclasses[] = {
+	{LOGEVT_HACKMON,                  auclass_xnumon_events_hackmon},
+	{LOGEVT_FILEMON,                  auclass_xnumon_events_filemon},
+	{LOGEVT_SOCKMON,                  auclass_xnumon_events_sockmon},
+	{LOGEVT_FILEMON|LOGEVT_SOCKMON,   auclass_xnumon_events_fdtrack},
+};
+
+/*
+ * Bring the AC_XNUMON class in line with a change of the enabled events from
+ * prev to cfg->events at runtime, such that the kernel stops producing the
+ * records for monitors that were disabled, most notably the close(2) records
+ * of file descriptor tracking once neither filemon nor sockmon need them.
+ * Events can only change within those the monitors were set up for, which
+ * is also what the record type filter was set up for, so that stays as is.
+ */
+static int
+evtloop_auclass_update(config_t *cfg, int prev) {
+	bool was, want;
+	int rv = 0;
+
+	if (cfg->trace_replay)
+		return 0;
+	for (size_t i = 0; i < sizeof(auclasses)/sizeof(auclasses[0]); i++) {
+		was = !!LOGEVT_WANT(prev, auclasses[i].events);
+		want = !!LOGEVT_WANT(cfg->events, auclasses[i].events);
+		if (want && !was)
+			rv |= auclass_addmask(AC_XNUMON, auclasses[i].aues);
+		else if (was && !want)
+			rv |= auclass_removemask(AC_XNUMON, auclasses[i].aues);
+	}
+	if (LOGEVT_WANT(prev, LOGEVT_FILEMON|LOGEVT_SOCKMON) &&
+	    !LOGEVT_WANT(cfg->events, LOGEVT_FILEMON|LOGEVT_SOCKMON))
+		procmon_fds_drop();
+	return rv;
 }
 
 static stat_attr_t cfgattr[2];
+static int cfgevents;           /* events the monitors were set up for */
+static int cfgkextlevel;        /* kextlevel before falling back to none */
+
+/*
+ * Load the changed configuration file and apply the changes that can take
+ * effect without a restart:  suppression sets and options, events within
+ * those enabled at startup, and the log format and rendering options.
+ * Caches, the process table and queued events are kept.  Returns 1 if the
+ * changes require a restart, 0 if they were applied or there were none, or
+ * -1 on errors, in which case the running configuration stays in effect.
+ * Fails with EBUSY while a previous log reconfiguration is still pending.
+ */
+static int
+config_reload_hot(config_t *cfg) {
+	config_t *newcfg;
+	int changes, prev;
+
+	if (log_reconfig_pending()) {
+		errno = EBUSY;
+		return -1;
+	}
+	fprintf(stderr, "Reloading configuration:\n");
+	newcfg = config_reload(cfg);
+	if (!newcfg) {
+		errno = EINVAL;
+		return -1;
+	}
+	/* a kext that failed to load at startup is no configuration change */
+	if (newcfg->kextlevel == cfgkextlevel)
+		newcfg->kextlevel = cfg->kextlevel;
+	if (log_check(newcfg) == -1) {
+		config_free(newcfg);
+		errno = EINVAL;
+		return -1;
+	}
+	prev = cfg->events;
+	changes = config_diff(cfg, newcfg, cfgevents);
+	if (changes & CONFIG_CHANGED_RESTART) {
+		config_free(newcfg);
+		return 1;
+	}
+	if (!changes) {
+		config_free(newcfg);
+		fprintf(stderr, "Configuration unchanged\n");
+		return 0;
+	}
+	if (config_apply(cfg, newcfg, changes) == -1) {
+		config_free(newcfg);
+		return -1;
+	}
+	if (changes & CONFIG_CHANGED_SUPPRESS) {
+		image_exec_suppressions_changed();
+		if (kefd != -1 && !cfg->trace_replay &&
+		    kextloop_filter(cfg, true) == -1)
+			fprintf(stderr, "Failed to update kext filter: "
+			                "%s (%i)\n", strerror(errno), errno);
+	}
+	if ((changes & CONFIG_CHANGED_EVENTS) &&
+	    evtloop_auclass_update(cfg, prev) == -1)
+		fprintf(stderr, "Failed to update AC_XNUMON class mask\n");
+	if (changes & CONFIG_CHANGED_LOG) {
+		/* not expected to fail, as checked above */
+		if (log_reconfig(newcfg) == -1) {
+			fprintf(stderr, "Failed to reconfigure logging: "
+			                "%s (%i)\n", strerror(errno), errno);
+			config_free(newcfg);
+		}
+	} else {
+		config_free(newcfg);
+	}
+	if (log_event_xnumon_reload(changes) == -1 && errno == ENOMEM)
+		ooms++;
+	fprintf(stderr, "Configuration reloaded without restart\n");
+	return 0;
+}
 
 /*
  * Called by config timer, every five minutes.
@@ -1309,10 +2935,24 @@ config_timer_fired(UNUSED int ident, void *udata) {
 	  || (!timespec_equal(&cfgattr[0].mtime, &cfgattr[1].mtime))
 	  || (!timespec_equal(&cfgattr[0].ctime, &cfgattr[1].ctime))
 	  || (!timespec_equal(&cfgattr[0].btime, &cfgattr[1].btime)))) {
-		fprintf(stderr, "Configuration change detected, "
-		                "exiting to reload config\n");
-		running = false;
-		return -1;
+		fprintf(stderr, "Configuration change detected\n");
+		switch (config_reload_hot(cfg)) {
+		case 0:
+			break;
+		case 1:
+			fprintf(stderr, "Configuration change requires "
+			                "restart, exiting to reload config\n");
+			running = false;
+			return -1;
+		default:
+			/* retry on the next timer */
+			if (errno == EBUSY)
+				return 0;
+			/* retry once the file changes again */
+			fprintf(stderr, "Failed to reload configuration, "
+			                "keeping running configuration\n");
+			break;
+		}
 	}
 	cfgattr[0] = cfgattr[1];
 	return 0;
@@ -1340,9 +2980,21 @@ sigusr1_arrived(UNUSED int sig, UNUSED void *udata) {
 	return 0;
 }
 
-#define TIMER_AUPOL     1
-#define TIMER_STATS     2
-#define TIMER_CONFIG    3
+/*
+ * Handles SIGUSR2.
+ */
+static int
+sigusr2_arrived(UNUSED int sig, void *udata) {
+	config_t *cfg = (config_t *)udata;
+
+	if (profile_start() == -1) {
+		fprintf(stderr, "Failed to start profiling: %s (%i)\n",
+		                strerror(errno), errno);
+		return 0;
+	}
+	fprintf(stderr, "Profiling for %zu seconds\n", cfg->profile_duration);
+	return 0;
+}
 
 int
 evtloop_run(config_t *cfg) {
@@ -1351,18 +3003,51 @@ evtloop_run(config_t *cfg) {
 	kevent_ctx_t siginfo_ctx = KEVENT_CTX_SIGNAL(siginfo_arrived, cfg);
 	kevent_ctx_t sighup_ctx  = KEVENT_CTX_SIGNAL(sighup_arrived, cfg);
 	kevent_ctx_t sigusr1_ctx = KEVENT_CTX_SIGNAL(sigusr1_arrived, cfg);
+	kevent_ctx_t sigusr2_ctx = KEVENT_CTX_SIGNAL(sigusr2_arrived, cfg);
 	kevent_ctx_t auef_ctx    = KEVENT_CTX_FD_READ(auef_readable, cfg);
 	kevent_ctx_t kefd_ctx    = KEVENT_CTX_FD_READ(kefd_readable, cfg);
+	kevent_ctx_t mtfd_ctx    = KEVENT_CTX_FD_READ(metrics_readable, cfg);
+	kevent_ctx_t qyfd_ctx    = KEVENT_CTX_FD_READ(query_readable, cfg);
 	kevent_ctx_t aptm_ctx    = KEVENT_CTX_TIMER(aupol_timer_fired, cfg);
 	kevent_ctx_t sttm_ctx    = KEVENT_CTX_TIMER(stats_timer_fired, cfg);
 	kevent_ctx_t cftm_ctx    = KEVENT_CTX_TIMER(config_timer_fired, cfg);
+	kevent_ctx_t cctm_ctx    = KEVENT_CTX_TIMER(cache_timer_fired, cfg);
+	kevent_ctx_t agtm_ctx    = KEVENT_CTX_TIMER(aggr_timer_fired, cfg);
+	kevent_ctx_t aqtm_ctx    = KEVENT_CTX_TIMER(aupipe_timer_fired, cfg);
+	kevent_ctx_t dgtm_ctx    = KEVENT_CTX_TIMER(degrade_timer_fired, cfg);
+	kevent_ctx_t rptm_ctx    = KEVENT_CTX_TIMER(reap_timer_fired, cfg);
+	kevent_ctx_t pltm_ctx    = KEVENT_CTX_TIMER(preload_timer_fired, cfg);
+	kevent_ctx_t mnfs_ctx    = KEVENT_CTX_FS(mounts_changed, cfg);
+	char hcpath[PATH_MAX], ccpath[PATH_MAX], lcpath[PATH_MAX];
+	char scpath[PATH_MAX];
 	kqueue_t *kq = NULL;
+	uint64_t ready_seq;
+	bool ready = false;
+	bool held = false;
+	struct timespec readypoll = {1, 0};
 	int pidc;
 	pid_t *pidv;
+	int trace_aufd = -1, trace_kefd = -1;
+	int mtfd = -1;
+	int qyfd = -1;
 	int rv;
 
+	if (timespec_monotime(&startup_tv) == -1)
+		bzero(&startup_tv, sizeof(startup_tv));
+	stage_tv = startup_tv;
+	stagec = 0;
+	snapshot_path = NULL;
+	bzero(&ivstart, sizeof(ivstart));
+	ivstart.nsec = timespec_mononsec();
+	policy_thread_qos_init(cfg);
+	if (policy_thread_qos(THRSTAT_EVTLOOP) == -1)
+		fprintf(stderr, "Failed to set evtloop thread QoS: "
+		                "%s (%i)\n", strerror(errno), errno);
+	thrstat_register(THRSTAT_EVTLOOP);
 	auef = NULL;
 	aupclobbers = 0;
+	aupchecks = 0;
+	aupnotifies = 0;
 	aueunknowns = 0;
 	failedsyscalls = 0;
 	radar38845422_fatal = 0;
@@ -1381,48 +3066,121 @@ evtloop_run(config_t *cfg) {
 	radar43151662_fatal = 0;
 	missingtoken = 0;
 	ooms = 0;
+	partials = 0;
+	localskips = 0;
 	xnumon_pid = getpid();
 
 	/* system-global audit(4) setup: audit policy */
 	aupol_wanted = AUDIT_ARGV;
 	if (cfg->envlevel > 0)
 		aupol_wanted |= AUDIT_ARGE;
-	if (aupol_timer_fired(TIMER_AUPOL, NULL) == -1)
+	aupol_interval = AUPOL_INTERVAL;
+	aupol_notify = false;
+	aupol_ctx = NULL;
+	if (!cfg->trace_replay && aupol_check() == -1)
 		goto errout;
 
-	/* system-global audit(4) setup: audit class */
-	if (auclass_addmask(AC_XNUMON, auclass_xnumon_events_procmon) == -1) {
+	/* system-global audit(4) setup: audit class, not when replaying */
+	auevent_typeset_init(&auetypes);
+	bzero(auerejects, sizeof(auerejects));
+	auef_handlers_init();
+	if (!cfg->trace_replay &&
+	    auclass_addmask(AC_XNUMON, auclass_xnumon_events_procmon) == -1) {
 		fprintf(stderr, "Failed to configure AC_XNUMON class mask\n");
 		goto errout;
 	}
-	if (LOGEVT_WANT(cfg->events, LOGEVT_HACKMON) &&
-	    auclass_addmask(AC_XNUMON, auclass_xnumon_events_hackmon) == -1) {
-		fprintf(stderr, "Failed to configure AC_XNUMON class mask\n");
+	auevent_typeset_add(&auetypes, auclass_xnumon_events_procmon);
+	/* process lifecycle and access only for lean auids, see aupipe_lean */
+	if (!cfg->trace_replay && cfg->auditpipe_lean_auids &&
+	    (auclass_addmask(AC_XNUMON_PROC,
+	                     auclass_xnumon_events_procmon) == -1 ||
+	     (LOGEVT_WANT(cfg->events, LOGEVT_HACKMON) &&
+	      auclass_addmask(AC_XNUMON_PROC,
+	                      auclass_xnumon_events_hackmon) == -1))) {
+		fprintf(stderr, "Failed to configure AC_XNUMON_PROC "
+		                "class mask\n");
 		goto errout;
 	}
-	if (LOGEVT_WANT(cfg->events, LOGEVT_FILEMON) &&
-	    auclass_addmask(AC_XNUMON, auclass_xnumon_events_filemon) == -1) {
-		fprintf(stderr, "Failed to configure AC_XNUMON class mask\n");
-		goto errout;
+	for (size_t i = 0; i < sizeof(auclasses)/sizeof(auclasses[0]); i++) {
+		if (!LOGEVT_WANT(cfg->events, auclasses[i].events))
+			continue;
+		if (!cfg->trace_replay &&
+		    auclass_addmask(AC_XNUMON, auclasses[i].aues) == -1) {
+			fprintf(stderr, "Failed to configure AC_XNUMON "
+			                "class mask\n");
+			goto errout;
+		}
+		auevent_typeset_add(&auetypes, auclasses[i].aues);
 	}
-	if (LOGEVT_WANT(cfg->events, LOGEVT_SOCKMON) &&
-	    auclass_addmask(AC_XNUMON, auclass_xnumon_events_sockmon) == -1) {
-		fprintf(stderr, "Failed to configure AC_XNUMON class mask\n");
-		goto errout;
+	if (auclass_xnumon_events_aupol[0] && !cfg->trace_replay) {
+		if (auclass_addmask(AC_XNUMON,
+		                    auclass_xnumon_events_aupol) == -1) {
+			fprintf(stderr, "Failed to configure AC_XNUMON "
+			                "class mask\n");
+			goto errout;
+		}
+		auevent_typeset_add(&auetypes, auclass_xnumon_events_aupol);
+		aupol_notify = true;
+	}
+	startup_stage("audit");
+
+	/* open trace files */
+	if (cfg->trace_replay) {
+		if (trace_replay_open(cfg->trace_replay, &trace_aufd,
+		                      cfg->kextlevel > 0 ? &trace_kefd
+		                                         : NULL) == -1) {
+			fprintf(stderr, "Failed to open trace %s: %s (%i)\n",
+			                cfg->trace_replay,
+			                strerror(errno), errno);
+			rv = -1;
+			goto errout_silent;
+		}
+		pidcache_stub(!cfg->trace_replay_lookups);
+	}
+	if (cfg->trace_record &&
+	    trace_record_open(cfg->trace_record) == -1) {
+		fprintf(stderr, "Failed to open trace %s: %s (%i)\n",
+		                cfg->trace_record, strerror(errno), errno);
+		rv = -1;
+		goto errout_silent;
 	}
 
 	/* load kext */
-	if ((cfg->kextlevel > 0) && (kextctl_load() == -1)) {
+	if ((cfg->kextlevel > 0) && !cfg->trace_replay &&
+	    (kextctl_load() == -1)) {
 		fprintf(stderr, "Failed to load kernel extension\n");
 	}
+	startup_stage("kextload");
 
 	/* initialize */
 	if (cfg->launchd_mode) {
 		config_timer_init(cfg, TIMER_CONFIG);
 	}
-	cachehash_init();
-	cachecsig_init();
-	cacheldpl_init();
+	cfgevents = cfg->events;
+	cfgkextlevel = cfg->kextlevel;
+	hashes_init(cfg->hash_chunk_size, cfg->hash_parallel, cfg->hash_mmap,
+	            cfg->hash_nocache_threshold);
+	lrucache_budget(cfg->cache_memory_budget * 1024 * 1024);
+	cachehash_init(cache_path(hcpath, sizeof(hcpath), cfg, "hashes.cache"),
+	               cfg->hflags, cfg->cache_hashes_size,
+	               cfg->cache_hashes_policy);
+	cachecsig_init(cache_path(ccpath, sizeof(ccpath), cfg, "codesign.cache"),
+	               cfg->hflags, cfg->cache_codesign_size,
+	               cfg->cache_codesign_policy);
+	cachecdhash_init(cfg->cache_cdhash_size, cfg->cache_codesign_policy);
+	if (!cfg->trace_replay)
+		fleetcache_init(cfg->cache_fleet_socket,
+		                cfg->cache_fleet_timeout, cfg->hflags);
+	cachefp_init(cfg->cache_fingerprint_size, cfg->cache_hashes_policy);
+	cacheslice_init(cfg->hash_slice ? cfg->cache_hashes_size : 0,
+	                cfg->cache_hashes_policy);
+	cachebundle_init(cfg->cache_bundle_size, cfg->cache_codesign_policy);
+	cacheldpl_init(cache_path(lcpath, sizeof(lcpath), cfg, "ldpl.cache"),
+	               cfg->cache_ldpl_size, cfg->cache_ldpl_policy);
+	cachepath_init(CACHEPATH_BUCKETS, LRUCACHE_FLAG_CLOCK);
+	cachebuild_init(setstr_size(&cfg->codesign_build_dirs) > 0 ?
+	                CACHEBUILD_BUCKETS : 0, LRUCACHE_FLAG_CLOCK);
+	startup_stage("caches");
 	if (auevent_init() == -1) {
 		fprintf(stderr, "Failed to initialize auevent\n");
 		rv = -1;
@@ -1433,11 +3191,44 @@ evtloop_run(config_t *cfg) {
 		rv = -1;
 		goto errout_silent;
 	}
+	cacheseal_init(cache_path(scpath, sizeof(scpath), cfg, "sealed.cache"),
+	               cfg->hflags, cfg->cache_sealed_size,
+	               cfg->cache_hashes_policy);
 	if (codesign_init(cfg) == -1) {
 		fprintf(stderr, "Failed to initialize codesign\n");
 		rv = -1;
 		goto errout_silent;
 	}
+	if (cshelper_init(cfg) == -1) {
+		fprintf(stderr, "Failed to initialize codesign helpers\n");
+		rv = -1;
+		goto errout_silent;
+	}
+	if (cspool_init(cfg) == -1) {
+		fprintf(stderr, "Failed to initialize codesign pool\n");
+		rv = -1;
+		goto errout_silent;
+	}
+	startup_stage("codesign");
+	degrade_init(cfg);
+	profile_init(cfg);
+	membudget_init(cfg);
+	kesched_init();
+	fsclass_init(cfg);
+	if (mounts_init() == -1)
+		fprintf(stderr, "Failed to list mounts, not tracking "
+		                "unmounts: %s (%i)\n", strerror(errno), errno);
+	if (idname_init() == -1) {
+		fprintf(stderr, "Failed to initialize idname\n");
+		rv = -1;
+		goto errout_silent;
+	}
+	if (cfg->query_socket &&
+	    evtidx_init(cfg->query_index_size, cfg->hflags) == -1) {
+		fprintf(stderr, "Failed to initialize query index\n");
+		rv = -1;
+		goto errout_silent;
+	}
 	if (log_init(cfg) == -1) {
 		fprintf(stderr, "Failed to initialize logging\n");
 		rv = -1;
@@ -1448,24 +3239,42 @@ evtloop_run(config_t *cfg) {
 		rv = -1;
 		goto errout_silent;
 	}
+	if (csrefresh_init(cfg) == -1) {
+		fprintf(stderr, "Failed to initialize codesign refresh\n");
+		rv = -1;
+		goto errout_silent;
+	}
+	startup_stage("queues");
 	if (procmon_init(cfg) == -1) {
 		fprintf(stderr, "Failed to initialize procmon\n");
 		rv = -1;
 		goto errout_silent;
 	}
+	startup_stage("procmon");
 	if (filemon_init(cfg) == -1) {
 		fprintf(stderr, "Failed to initialize filemon\n");
 		rv = -1;
 		goto errout_silent;
 	}
-	hackmon_init(cfg);
-	sockmon_init(cfg);
+	startup_stage("filemon");
+	if (hackmon_init(cfg) == -1) {
+		fprintf(stderr, "Failed to initialize hackmon\n");
+		rv = -1;
+		goto errout_silent;
+	}
+	if (sockmon_init(cfg) == -1) {
+		fprintf(stderr, "Failed to initialize sockmon\n");
+		rv = -1;
+		goto errout_silent;
+	}
 
 	/* try to spawn kextloop thread */
-	if (cfg->kextlevel > 0 && kextloop_spawn(&kefd_ctx) == -1) {
+	if (cfg->kextlevel > 0 &&
+	    kextloop_spawn(&kefd_ctx, cfg, trace_kefd) == -1) {
 		cfg->kextlevel = 0;
 		fprintf(stderr, "Proceeding without kext\n");
 	}
+	startup_stage("monitors");
 
 	/* open kqueue */
 	kq = kqueue_new();
@@ -1476,6 +3285,15 @@ evtloop_run(config_t *cfg) {
 		goto errout_silent;
 	}
 
+	rv = kqueue_add_user(kq, USER_WAKEUP, &wakeup_ctx);
+	if (rv == -1) {
+		fprintf(stderr, "kqueue_add_user() failed: %s (%i)\n",
+		                strerror(errno), errno);
+		rv = -1;
+		goto errout_silent;
+	}
+	mainkq = kq;
+
 	/* install kevent-based signal handlers */
 	rv = kqueue_add_signal(kq, SIGQUIT, &sigquit_ctx);
 	if (rv == -1) {
@@ -1519,6 +3337,13 @@ evtloop_run(config_t *cfg) {
 		rv = -1;
 		goto errout_silent;
 	}
+	rv = kqueue_add_signal(kq, SIGUSR2, &sigusr2_ctx);
+	if (rv == -1) {
+		fprintf(stderr, "kqueue_add_signal(SIGUSR2) failed: %s (%i)\n",
+		                strerror(errno), errno);
+		rv = -1;
+		goto errout_silent;
+	}
 	if (cfg->kextlevel > 0) {
 		rv = kqueue_add_signal(kq, SIGTSTP, &sigtstp_ctx);
 		if (rv == -1) {
@@ -1530,37 +3355,95 @@ evtloop_run(config_t *cfg) {
 		}
 	}
 
-	/* open auditpipe to start queueing audit events */
-	if ((auef = aupipe_fopen(AC_XNUMON)) == NULL) {
-		fprintf(stderr, "aupipe_fopen(AC_XNUMON) failed\n");
+	/* track unmounts for purging caches */
+	rv = kqueue_add_fs(kq, &mnfs_ctx);
+	if (rv == -1) {
+		fprintf(stderr, "kqueue_add_fs() failed: %s (%i)\n",
+		                strerror(errno), errno);
 		rv = -1;
 		goto errout_silent;
 	}
 
-	/* walk already running processes */
-	pidv = sys_pidlist(&pidc);
-	if (!pidv) {
-		fprintf(stderr, "sys_pidlist() failed\n");
-		rv = -1;
-		goto errout_silent;
+	if (cfg->trace_replay) {
+		/* read audit records from the trace instead */
+		if ((auef = fdopen(trace_aufd, "r")) == NULL) {
+			fprintf(stderr, "fdopen(trace) failed: %s (%i)\n",
+			                strerror(errno), errno);
+			rv = -1;
+			goto errout_silent;
+		}
+		trace_aufd = -1;
+	} else {
+		/* open auditpipe to start queueing audit events */
+		auef = aupipe_fopen(AC_XNUMON, cfg->auditpipe_qlimit);
+		if (auef == NULL) {
+			fprintf(stderr, "aupipe_fopen(AC_XNUMON) failed\n");
+			rv = -1;
+			goto errout_silent;
+		}
+		aupipe_tune_init(fileno(auef),
+		                 cfg->auditpipe_qlimit == AUPIPE_QLIMIT_AUTO,
+		                 cfg->stats_interval / AUPIPE_SERIES);
+		if (cfg->auditpipe_lean_auids) {
+			uint32_t auids[AUPIPE_LEAN_MAX];
+			int n = aupipe_parse_auids(auids, AUPIPE_LEAN_MAX,
+			                           cfg->auditpipe_lean_auids);
+			if (n == -1 ||
+			    aupipe_lean(fileno(auef), AC_XNUMON_PROC,
+			                auids, (size_t)n) == -1) {
+				fprintf(stderr, "Failed to configure "
+				                "auditpipe_lean_auids\n");
+				rv = -1;
+				goto errout_silent;
+			}
+		}
 	}
-	fprintf(stderr, "Preloading pid");
-	for (int i = pidc - 1; i >= 0; i--) {
-		fprintf(stderr, " %i", pidv[i]);
-		procmon_preloadpid(pidv[i]);
+	if (auring_init(&auring, fileno(auef)) == 0) {
+		auring_enabled = true;
+	} else if (aubuf_init(&aubuf, fileno(auef), AUBUF_SIZE) == 0) {
+		fprintf(stderr, "auring_init() failed, "
+		                "falling back to aubuf\n");
+		aubuf_enabled = true;
+	} else {
+		fprintf(stderr, "aubuf_init() failed, "
+		                "falling back to au_read_rec\n");
 	}
-	free(pidv);
-	fprintf(stderr, "\n");
+
+	startup_stage("auditpipe");
+
+	if (!cfg->trace_replay) {
+		/* walk already running processes */
+		pidv = sys_pidlist(&pidc);
+		if (!pidv) {
+			fprintf(stderr, "sys_pidlist() failed\n");
+			rv = -1;
+			goto errout_silent;
+		}
+		snapshot_path = cache_path(snpath, sizeof(snpath), cfg,
+		                           "procs.snapshot");
+		if (snapshot_path &&
+		    procmon_snapshot_load(snapshot_path) == -1 &&
+		    errno != ENOENT)
+			fprintf(stderr, "Failed to load lineage snapshot: "
+			                "%s (%i)\n", strerror(errno), errno);
+		fprintf(stderr, "Preloading %i pids\n", pidc);
+		procmon_preload(pidv, pidc);
+		free(pidv);
+	}
+	startup_stage("preload");
 
 	/* log xnumon start */
-	if (log_event_xnumon_start() == -1) {
+	if (log_event_xnumon_start(startup_nsec(), stagev, stagec) == -1) {
 		fprintf(stderr, "log_event_xnumon_start() failed\n");
 		rv = -1;
 		goto errout_silent;
 	}
+	filemon_init_submit();
+	ready_seq = work_submitted();
 
 	/* add auditpipe to kqueue */
-	rv = kqueue_add_fd_read(kq, fileno(auef), &auef_ctx);
+	rv = kqueue_add_fd_read(kq, auring_enabled ? auring.notify[0]
+	                                           : fileno(auef), &auef_ctx);
 	if (rv == -1) {
 		fprintf(stderr, "kqueue_add_fd_read(/dev/auditpipe) failed: "
 		                "%s (%i)\n", strerror(errno), errno);
@@ -1568,13 +3451,51 @@ evtloop_run(config_t *cfg) {
 		goto errout;
 	}
 
-	/* start audit(4) policy watchdog timer */
-	rv = kqueue_add_timer(kq, TIMER_AUPOL, 300, &aptm_ctx);
-	if (rv == -1) {
-		fprintf(stderr, "kqueue_add_timer(TIMER_AUPOL) failed: "
-		                "%s (%i)\n", strerror(errno), errno);
-		rv = -1;
-		goto errout;
+	if (!cfg->trace_replay) {
+		/* start audit(4) policy watchdog timer */
+		rv = kqueue_add_timer(kq, TIMER_AUPOL, aupol_interval,
+		                      &aptm_ctx);
+		if (rv == -1) {
+			fprintf(stderr, "kqueue_add_timer(TIMER_AUPOL) "
+			                "failed: %s (%i)\n",
+			                strerror(errno), errno);
+			rv = -1;
+			goto errout;
+		}
+		aupol_ctx = &aptm_ctx;
+
+		/* start auditpipe tuning timer */
+		rv = kqueue_add_timer(kq, TIMER_AUPIPE, 1, &aqtm_ctx);
+		if (rv == -1) {
+			fprintf(stderr, "kqueue_add_timer(TIMER_AUPIPE) "
+			                "failed: %s (%i)\n",
+			                strerror(errno), errno);
+			rv = -1;
+			goto errout;
+		}
+
+		/* start feeding the startup lane if anything is held */
+		if (procmon_preload_drain(cfg->preload_rate) > 0) {
+			rv = kqueue_add_timer(kq, TIMER_PRELOAD, 1, &pltm_ctx);
+			if (rv == -1) {
+				fprintf(stderr, "kqueue_add_timer(TIMER_PRELOAD)"
+				                " failed: %s (%i)\n",
+				                strerror(errno), errno);
+				rv = -1;
+				goto errout;
+			}
+		}
+
+		/* start process table reconciliation timer */
+		rv = kqueue_add_timer(kq, TIMER_REAP, PROCMON_REAP_TICK,
+		                      &rptm_ctx);
+		if (rv == -1) {
+			fprintf(stderr, "kqueue_add_timer(TIMER_REAP) "
+			                "failed: %s (%i)\n",
+			                strerror(errno), errno);
+			rv = -1;
+			goto errout;
+		}
 	}
 
 	/* start stats timer */
@@ -1586,6 +3507,83 @@ evtloop_run(config_t *cfg) {
 		goto errout;
 	}
 
+	if (cfg->metrics_socket) {
+		/* serve metrics on request */
+		mtfd = metrics_open(cfg->metrics_socket);
+		if (mtfd == -1) {
+			fprintf(stderr, "metrics_open(%s) failed: %s (%i)\n",
+			                cfg->metrics_socket,
+			                strerror(errno), errno);
+			rv = -1;
+			goto errout;
+		}
+		rv = kqueue_add_fd_read(kq, mtfd, &mtfd_ctx);
+		if (rv == -1) {
+			fprintf(stderr, "kqueue_add_fd_read(%s) failed: "
+			                "%s (%i)\n", cfg->metrics_socket,
+			                strerror(errno), errno);
+			rv = -1;
+			goto errout;
+		}
+	}
+
+	if (cfg->query_socket) {
+		/* answer queries against the index of recent events */
+		qyfd = evtidx_open(cfg->query_socket, kq);
+		if (qyfd == -1) {
+			fprintf(stderr, "evtidx_open(%s) failed: %s (%i)\n",
+			                cfg->query_socket,
+			                strerror(errno), errno);
+			rv = -1;
+			goto errout;
+		}
+		rv = kqueue_add_fd_read(kq, qyfd, &qyfd_ctx);
+		if (rv == -1) {
+			fprintf(stderr, "kqueue_add_fd_read(%s) failed: "
+			                "%s (%i)\n", cfg->query_socket,
+			                strerror(errno), errno);
+			rv = -1;
+			goto errout;
+		}
+	}
+
+	if (cfg->cache_directory && cfg->cache_save_interval > 0) {
+		/* start cache save timer */
+		rv = kqueue_add_timer(kq, TIMER_CACHE,
+		                      cfg->cache_save_interval, &cctm_ctx);
+		if (rv == -1) {
+			fprintf(stderr, "kqueue_add_timer(TIMER_CACHE) failed"
+			                ": %s (%i)\n", strerror(errno), errno);
+			rv = -1;
+			goto errout;
+		}
+	}
+
+	if (cfg->socket_connect_window > 0 || cfg->socket_accept_window > 0 ||
+	    cfg->process_access_window > 0) {
+		/* start socket and process-access aggregation timer */
+		rv = kqueue_add_timer(kq, TIMER_AGGR, 1, &agtm_ctx);
+		if (rv == -1) {
+			fprintf(stderr, "kqueue_add_timer(TIMER_AGGR) "
+			                "failed: %s (%i)\n",
+			                strerror(errno), errno);
+			rv = -1;
+			goto errout;
+		}
+	}
+
+	if (cfg->degrade || cfg->memory_budget > 0) {
+		/* start degradation and memory budget timer */
+		rv = kqueue_add_timer(kq, TIMER_DEGRADE, 1, &dgtm_ctx);
+		if (rv == -1) {
+			fprintf(stderr, "kqueue_add_timer(TIMER_DEGRADE) "
+			                "failed: %s (%i)\n",
+			                strerror(errno), errno);
+			rv = -1;
+			goto errout;
+		}
+	}
+
 	if (cfg->launchd_mode) {
 		/* start config file timer */
 		rv = kqueue_add_timer(kq, TIMER_CONFIG, 300, &cftm_ctx);
@@ -1597,11 +3595,22 @@ evtloop_run(config_t *cfg) {
 		}
 	}
 
+	if (cfg->trace_replay) {
+		/* start feeding the recorded events */
+		if (trace_replay_start(cfg->trace_replay_speed) == -1) {
+			fprintf(stderr, "trace_replay_start() failed\n");
+			rv = -1;
+			goto errout;
+		}
+		fprintf(stderr, "Replaying trace %s\n", cfg->trace_replay);
+	}
+
 	/* event dispatch loop */
 	DEBUG(cfg->debug, "xnumon_start", "init complete");
 	running = true;
 	for (;;) {
-		rv = kqueue_dispatch(kq);
+		/* poll for the preload backlog to drain until ready */
+		rv = kqueue_dispatch(kq, ready ? NULL : &readypoll);
 		if (!running)
 			break;
 		if (rv != 0) {
@@ -1609,6 +3618,26 @@ evtloop_run(config_t *cfg) {
 			rv = -1;
 			goto errout;
 		}
+		/*
+		 * Log xnumon ready once the startup lane and the preload
+		 * backlog have drained.
+		 */
+		if (ready)
+			continue;
+		if (procmon_preload_drain(0) > 0) {
+			held = true;
+			continue;
+		}
+		if (held) {
+			ready_seq = work_submitted();
+			held = false;
+		}
+		if (work_passed() >= ready_seq) {
+			if (log_event_xnumon_ready(startup_nsec()) == -1)
+				fprintf(stderr, "log_event_xnumon_ready() "
+				                "failed\n");
+			ready = true;
+		}
 	}
 
 	/* stop and join the kextloop thread */
@@ -1618,8 +3647,11 @@ evtloop_run(config_t *cfg) {
 
 	rv = 0;
 errout:
-	/* log xnumon stats and stop */
+	/* log held events, xnumon stats and stop */
 	DEBUG(cfg->debug, "xnumon_stop", "shutting down");
+	csrefresh_fini();
+	sockmon_flush(NULL);
+	hackmon_flush(NULL);
 	(void)log_event_xnumon_stats();
 	if (log_event_xnumon_stop() == -1) {
 		fprintf(stderr, "log_event_xnumon_stop() failed\n");
@@ -1629,33 +3661,83 @@ errout:
 
 errout_silent:
 	/* system-global audit(4) cleanup */
-	if (auclass_removemask(AC_XNUMON,
-	                       auclass_xnumon_events_procmon) == -1 ||
-	    auclass_removemask(AC_XNUMON,
-	                       auclass_xnumon_events_hackmon) == -1 ||
-	    auclass_removemask(AC_XNUMON,
-	                       auclass_xnumon_events_filemon) == -1) {
+	if (!cfg->trace_replay &&
+	    (auclass_removemask(AC_XNUMON,
+	                        auclass_xnumon_events_procmon) == -1 ||
+	     auclass_removemask(AC_XNUMON,
+	                        auclass_xnumon_events_hackmon) == -1 ||
+	     auclass_removemask(AC_XNUMON,
+	                        auclass_xnumon_events_filemon) == -1 ||
+	     auclass_removemask(AC_XNUMON,
+	                        auclass_xnumon_events_sockmon) == -1 ||
+	     auclass_removemask(AC_XNUMON,
+	                        auclass_xnumon_events_fdtrack) == -1 ||
+	     auclass_removemask(AC_XNUMON,
+	                        auclass_xnumon_events_aupol) == -1 ||
+	     auclass_removemask(AC_XNUMON_PROC,
+	                        auclass_xnumon_events_procmon) == -1 ||
+	     auclass_removemask(AC_XNUMON_PROC,
+	                        auclass_xnumon_events_hackmon) == -1)) {
 		fprintf(stderr, "Failed to configure AC_XNUMON class mask\n");
 	}
 
-	if (kq)
+	aupol_ctx = NULL;
+	if (kq) {
+		mainkq = NULL;
 		kqueue_free(kq);
+	}
+	if (mtfd != -1)
+		metrics_close();
+	if (qyfd != -1)
+		evtidx_close();
+	if (auring_enabled) {
+		auring_destroy(&auring);
+		auring_enabled = false;
+	}
+	if (aubuf_enabled) {
+		aubuf_destroy(&aubuf);
+		aubuf_enabled = false;
+	}
 	if (auef) {
 		fclose(auef);
 		auef = NULL;
 	}
+	if (trace_aufd != -1)
+		close(trace_aufd);
+	trace_replay_stop();
+	trace_record_close();
+	pidcache_stub(false);
+	csrefresh_fini();
 	work_fini();            /* drain work queue */
+	snapshot_save(true);
 	sockmon_fini();
 	hackmon_fini();
 	filemon_fini();
 	procmon_fini();         /* clear kext queue */
 	log_fini();             /* drain log queue */
+	profile_fini();
+	evtidx_fini();
+	idname_fini();
+	fsclass_fini();
+	mounts_fini();
 	assert(procmon_images() == 0);
+	cspool_fini();
+	cshelper_fini();
 	codesign_fini();
 	os_fini();
+	cache_save();
 	cacheldpl_fini();
+	cachebuild_fini();
+	cachepath_fini();
+	cacheseal_fini();
+	cachebundle_fini();
+	cacheslice_fini();
+	cachefp_fini();
+	fleetcache_fini();
+	cachecdhash_fini();
 	cachecsig_fini();
 	cachehash_fini();
+	intern_fini();
 	return rv;
 }
 
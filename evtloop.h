@@ -21,12 +21,90 @@
 #include "sockmon.h"
 #include "log.h"
 #include "work.h"
+#include "governor.h"
+#include "degrade.h"
+#include "membudget.h"
+#include "kesched.h"
+#include "pidcache.h"
 #include "cachehash.h"
 #include "cachecsig.h"
+#include "cachecdhash.h"
+#include "cachefp.h"
+#include "cacheslice.h"
+#include "cachebuild.h"
+#include "fleetcache.h"
+#include "evtidx.h"
+#include "cachebundle.h"
+#include "cacheseal.h"
+#include "cspool.h"
+#include "csrefresh.h"
 #include "cacheldpl.h"
+#include "cachepath.h"
 #include "logevt.h"
+#include "pool.h"
+#include "intern.h"
+#include "idname.h"
+#include "fsclass.h"
+#include "mounts.h"
+#include "kextpool.h"
+#include "thrstat.h"
+#include "codesign.h"
 #include "attrib.h"
 
+typedef struct {
+	uint16_t type;
+	uint64_t count;
+} evtloop_aue_count_t;
+
+#define EVTLOOP_AUEREJECTS_MAX 16
+
+/* per registered audit event handler */
+typedef struct {
+	const char *name;               /* NULL for unused slots */
+	uint64_t count;                 /* records of wanted events */
+	uint64_t failed;                /* records of failed syscalls */
+	uint64_t nsecs;                 /* time spent in the handler */
+} evtloop_aue_handler_t;
+
+#define EVTLOOP_AUEHANDLERS_MAX 24
+
+/* per pipeline stage and reason for discarding events */
+typedef struct {
+	const char *stage;              /* NULL for unused slots */
+	const char *reason;
+	uint64_t count;
+} evtloop_drop_t;
+
+#define EVTLOOP_DROPS_MAX 24
+
+/* rates over the interval since the last xnumon-stats event */
+typedef struct {
+	uint64_t msecs;
+	uint64_t eps[LOGEVT_SIZE];      /* events logged per second */
+	uint64_t hashbps;               /* bytes hashed per second */
+	uint64_t csigps;                /* codesign evaluations per second */
+	uint32_t ch_hitrate;            /* permille of gets in interval */
+	uint32_t cc_hitrate;
+	uint32_t cl_hitrate;
+	uint32_t cpu[THRSTAT_CLASSES];  /* permille of one cpu */
+	uint64_t ap_drops;
+	uint64_t wq_drops;
+	uint64_t lq_drops;
+} evtloop_interval_t;
+
+/* bytes accounted per subsystem */
+typedef struct {
+	uint64_t pools;                 /* slabs of all object pools */
+	uint64_t argv;                  /* argv and envv of live images */
+	uint64_t frags;                 /* cached renderings of images */
+	uint64_t fdpaths;               /* paths of open files */
+	uint64_t codesign;              /* estimated */
+	uint64_t intern;
+	uint64_t caches;                /* estimated */
+	uint64_t queues;                /* slots of all queues */
+	uint64_t total;
+} evtloop_memory_t;
+
 typedef struct {
 	logevt_header_t hdr;
 
@@ -35,9 +113,15 @@ typedef struct {
 	filemon_stat_t fm;
 	sockmon_stat_t sm;
 	xnumon_stat_t ke;
+	uint32_t keproto;
+	kextpool_stat_t kp;
+	hist_t kewait;
 	uint64_t el_aueunknowns;
 	uint64_t el_aupclobbers;
+	uint64_t el_aupchecks;
+	uint64_t el_aupnotifies;
 	uint64_t el_failedsyscalls;
+	uint64_t el_localskips;         /* local socket records skipped */
 	uint64_t el_radar38845422_fatal;
 	uint64_t el_radar38845422;
 	uint64_t el_radar38845784;
@@ -57,16 +141,51 @@ typedef struct {
 	uint64_t el_radar43151662;
 	uint64_t el_missingtoken;
 	uint64_t el_ooms;
+	size_t el_ringused;
+	uint64_t el_ringstalls;
+	uint64_t el_resyncs;
+	pidcache_stat_t el_pc;
+	evtloop_aue_count_t el_auerejects[EVTLOOP_AUEREJECTS_MAX];
+	evtloop_aue_handler_t el_auehandlers[EVTLOOP_AUEHANDLERS_MAX];
+	evtloop_drop_t el_drops[EVTLOOP_DROPS_MAX];
 	aupipe_stat_t ap;
 	work_stat_t wq;
+	governor_stat_t gv;
+	degrade_stat_t dg;
+	membudget_stat_t mb;
+	kesched_stat_t ks;
 	log_stat_t lq;
+	hashes_stat_t hs;
 	lrucache_stat_t ch;
 	lrucache_stat_t cc;
+	lrucache_stat_t cd;
+	fleetcache_stat_t fc;
+	evtidx_stat_t ei;
+	lrucache_stat_t cf;             /* content fingerprints */
+	lrucache_stat_t cn;             /* native slices */
+	lrucache_stat_t cu;             /* unsigned build output trees */
+	lrucache_stat_t cb;
+	lrucache_stat_t cs;             /* sealed system volume */
+	cspool_stat_t cp;
+	csrefresh_stat_t cr;
 	lrucache_stat_t cl;
+	lrucache_stat_t clc;            /* ldpl content tier */
+	lrucache_stat_t pc;             /* resolved directories */
+	uint32_t pools;
+	pool_stat_t pool[POOL_MAX];
+	intern_stat_t is;
+	idname_stat_t in;
+	fsclass_stat_t fs;
+	mounts_stat_t mn;
+	thrstat_stat_t ts;
+	codesign_stat_t co;
+	evtloop_memory_t mem;
+	evtloop_interval_t iv;
 } evtloop_stat_t;
 
 int evtloop_run(config_t *) NONNULL(1);
 void evtloop_stats(evtloop_stat_t *) NONNULL(1);
+void evtloop_stats_interval(evtloop_stat_t *, bool) NONNULL(1);
 
 #endif
 
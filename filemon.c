@@ -29,26 +29,46 @@
 #include "str.h"
 #include "cf.h"
 #include "cacheldpl.h"
-#include "atomic.h"
-#include "tommyhashdyn.h"
+#include "signpost.h"
+#include "hashes.h"
+#include "counter.h"
+#include "pool.h"
+#include "pathtree.h"
 #include "tommylist.h"
 #include "minmax.h"
+#include "time.h"
 
 #include <sys/stat.h>
+#include <unistd.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <strings.h>
 #include <fcntl.h>
 #include <glob.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <paths.h>
+#include <errno.h>
 #include <assert.h>
 
 static config_t *config;
 
 static uint64_t events_recvd;       /* number of filesystem events received */
 static uint64_t events_procd;       /* number of filesystem events processed */
-static atomic64_t ooms;             /* counts events impaired due to OOM */
-static atomic64_t lpmiss;           /* plists that were not present anymore */
+static uint64_t opens_recvd;        /* number of files opened for writing */
+static uint64_t opens_skipd;        /* of which not tracked */
+static counter_t ooms;              /* counts events impaired due to OOM */
+static counter_t lpmiss;            /* plists that were not present anymore */
+static uint64_t lpoffline;          /* plists changed while not running */
+static char **offline;              /* their paths, until submitted */
+static size_t offlinec;
+static size_t offlinesz;
+
+#define FILEMON_SLABOBJS        64
+#define LDPL_CONTENT_MAX        (1024*64) /* larger plists are not cached */
+
+static pool_t ldaddpool;
 
 static void filemon_launchd_touched(struct timespec *, audit_proc_t *, char *);
 static bool filemon_is_launchd_path(const char *);
@@ -57,13 +77,12 @@ static bool filemon_is_launchd_path(const char *);
  * Symlinks tracking for launchd add
  */
 
-static tommy_hashdyn symlinks;
+static pathtree_t symlinks;
 static tommy_list symlinks_dangling; /* subset of symlinks */
 
 typedef struct symlinks_obj {
-	tommy_hashdyn_node h_node;
 	tommy_node l_node;
-	char *path;
+	pathtree_node_t *node;          /* path in symlinks */
 
 	/*
 	 * Object is in one of three states at all times:
@@ -77,14 +96,13 @@ typedef struct symlinks_obj {
 } symlinks_obj_t;
 
 static symlinks_obj_t *
-symlinks_obj_new(char *path) {
+symlinks_obj_new(void) {
 	symlinks_obj_t *obj;
 
 	obj = malloc(sizeof(symlinks_obj_t));
 	if (!obj)
 		return NULL;
 	bzero(obj, sizeof(symlinks_obj_t));
-	obj->path = path;
 	tommy_list_init(&obj->origins);
 	return obj;
 }
@@ -92,31 +110,23 @@ symlinks_obj_new(char *path) {
 static void
 symlinks_obj_free(void *arg) {
 	symlinks_obj_t *obj = arg;
-	free(obj->path);
 	free(obj);
 }
 
 static int
-symlinks_obj_cmp(const void *path, const void* obj) {
-	return strcmp(((const symlinks_obj_t*)obj)->path, path);
-}
-
-static void
 symlinks_init(void) {
-	tommy_hashdyn_init(&symlinks);
 	tommy_list_init(&symlinks_dangling);
+	return pathtree_init(&symlinks);
 }
 
 static void
 symlinks_fini(void) {
-	tommy_hashdyn_foreach(&symlinks, symlinks_obj_free);
-	tommy_hashdyn_done(&symlinks);
+	pathtree_destroy(&symlinks, symlinks_obj_free);
 }
 
 static symlinks_obj_t *
 symlinks_path_find(const char *path) {
-	return tommy_hashdyn_search(&symlinks, symlinks_obj_cmp, path,
-	                            tommy_strhash_u32(0, path));
+	return pathtree_get(&symlinks, path);
 }
 
 #define symlinks_path_is_relevant(P) ((bool)symlinks_path_find(P))
@@ -141,7 +151,7 @@ symlinks_obj_unref(symlinks_obj_t *obj, symlinks_obj_t *origin) {
 	if (obj->target) {
 		symlinks_obj_unref(obj->target, obj);
 	}
-	tommy_hashdyn_remove_existing(&symlinks, &obj->h_node);
+	pathtree_remove(&symlinks, obj->node);
 	if (!obj->is_regular_file) {
 		tommy_list_remove_existing(&symlinks_dangling, &obj->l_node);
 	}
@@ -154,15 +164,19 @@ symlinks_obj_unref(symlinks_obj_t *obj, symlinks_obj_t *origin) {
 static symlinks_obj_t *
 symlinks_path_add(const char *path, symlinks_obj_t *origin) {
 	symlinks_obj_t *obj;
+	pathtree_node_t *node;
 
-	tommy_hash_t h;
-	h = tommy_strhash_u32(0, path);
-	obj = tommy_hashdyn_search(&symlinks, symlinks_obj_cmp, path, h);
+	obj = pathtree_get(&symlinks, path);
 	if (!obj) {
-		obj = symlinks_obj_new(strdup(path));
+		obj = symlinks_obj_new();
 		if (!obj)
 			return NULL;
-		tommy_hashdyn_insert(&symlinks, &obj->h_node, obj, h);
+		node = pathtree_insert(&symlinks, path, obj);
+		if (!node) {
+			symlinks_obj_free(obj);
+			return NULL;
+		}
+		obj->node = node;
 		tommy_list_insert_head(&symlinks_dangling, &obj->l_node, obj);
 	}
 	assert(obj);
@@ -183,13 +197,16 @@ static void
 symlinks_path_walk(const char *path,
                    struct timespec *tv, audit_proc_t *subject) {
 	symlinks_obj_t *obj, *root;
-	char *target, *rtarget;
+	char *target, *rtarget, *rootpath;
 
 	root = obj = symlinks_path_add(path, NULL);
-	assert(obj);
+	if (!obj) {
+		counter_inc(&ooms);
+		return;
+	}
 	rtarget = strdup(path);
 	if (!rtarget) {
-		ooms++;
+		counter_inc(&ooms);
 		return;
 	}
 	while (rtarget) {
@@ -207,12 +224,25 @@ symlinks_path_walk(const char *path,
 		free(target);
 		obj = symlinks_path_add(rtarget, obj);
 	}
+	if (!obj) {
+		counter_inc(&ooms);
+		return;
+	}
 
-	if (!obj->is_regular_file && sys_islnk(obj->path) != 1) {
-		if (obj->target)
-			symlinks_obj_unref(obj->target, obj);
-		tommy_list_remove_existing(&symlinks_dangling, &obj->l_node);
-		obj->is_regular_file = true;
+	if (!obj->is_regular_file) {
+		char *objpath = pathtree_strdup(obj->node);
+		if (!objpath) {
+			counter_inc(&ooms);
+			return;
+		}
+		if (sys_islnk(objpath) != 1) {
+			if (obj->target)
+				symlinks_obj_unref(obj->target, obj);
+			tommy_list_remove_existing(&symlinks_dangling,
+			                           &obj->l_node);
+			obj->is_regular_file = true;
+		}
+		free(objpath);
 	}
 
 	if (!tv)
@@ -223,24 +253,34 @@ symlinks_path_walk(const char *path,
 	while (!tommy_list_empty(&root->origins)) {
 		root = tommy_list_head(&root->origins)->data;
 	}
-	if (!filemon_is_launchd_path(root->path) &&
+	rootpath = pathtree_strdup(root->node);
+	if (!rootpath) {
+		counter_inc(&ooms);
+		return;
+	}
+	if (!filemon_is_launchd_path(rootpath) &&
 	    !tommy_list_empty(&symlinks_dangling)) {
 		/* limit aggressively */
 		size_t n = min(tommy_list_count(&symlinks_dangling),
 		               (size_t)16);
 		char *paths[n];
-		char **pp = paths;
+		size_t i = 0;
 		tommy_node *dsl = tommy_list_head(&symlinks_dangling);
-		while (dsl) {
+		while (dsl && i < n) {
 			symlinks_obj_t *dslobj = dsl->data;
-			*(pp++) = dslobj->path;
+			paths[i] = pathtree_strdup(dslobj->node);
+			if (!paths[i])
+				break;
+			i++;
 			dsl = dsl->next;
 		}
-		for (size_t i = 0; i < n; i++) {
+		n = i;
+		for (i = 0; i < n; i++) {
 			symlinks_path_walk(paths[i], NULL, NULL);
+			free(paths[i]);
 		}
 	}
-	filemon_launchd_touched(tv, subject, strdup(root->path));
+	filemon_launchd_touched(tv, subject, rootpath);
 }
 
 static void
@@ -253,32 +293,108 @@ symlinks_path_remove(const char *path) {
 	symlinks_obj_unref(obj, NULL);
 }
 
+/*
+ * Directories containing launchd plists; * matches any single component.
+ */
+static const char *launchd_dirs[] = {
+	"/System/Library/LaunchDaemons/",
+	"/Library/LaunchDaemons/",
+	"/System/Library/LaunchAgents/",
+	"/Library/LaunchAgents/",
+	"/Users/*/Library/LaunchAgents/",
+};
+
+/*
+ * Trie of path components compiled from launchd_dirs by filemon_init, such
+ * that a single pass over a path decides whether it is within one of the
+ * directories, and most paths are rejected on their first component.
+ * Exact labels take precedence over *, without backtracking.
+ */
+typedef struct ldtrie_node {
+	const char *label;              /* not NUL-terminated, NULL for * */
+	size_t len;
+	bool dir;                       /* a launchd directory ends here */
+	struct ldtrie_node *child;      /* first child */
+	struct ldtrie_node *next;       /* next sibling */
+} ldtrie_node_t;
+
+#define LDTRIE_NODES            16
+
+static ldtrie_node_t ldtrie[LDTRIE_NODES]; /* root at index 0 */
+static size_t ldtrie_count;
+
+static int
+ldtrie_add(const char *dir) {
+	ldtrie_node_t *node, *child;
+	const char *p, *end;
+	size_t len;
+
+	assert(dir[0] == '/');
+	node = &ldtrie[0];
+	for (p = dir + 1; (end = strchr(p, '/')); p = end + 1) {
+		len = end - p;
+		for (child = node->child; child; child = child->next) {
+			if (len == 1 && *p == '*' ? !child->label :
+			    (child->label && child->len == len &&
+			     !memcmp(child->label, p, len)))
+				break;
+		}
+		if (!child) {
+			if (ldtrie_count == LDTRIE_NODES)
+				return -1;
+			child = &ldtrie[ldtrie_count++];
+			child->label = (len == 1 && *p == '*') ? NULL : p;
+			child->len = len;
+			child->next = node->child;
+			node->child = child;
+		}
+		node = child;
+	}
+	node->dir = true;
+	return 0;
+}
+
+static int
+ldtrie_init(void) {
+	bzero(ldtrie, sizeof(ldtrie));
+	ldtrie_count = 1;
+	for (size_t i = 0; i < sizeof(launchd_dirs)/sizeof(launchd_dirs[0]);
+	     i++) {
+		if (ldtrie_add(launchd_dirs[i]) == -1)
+			return -1;
+	}
+	return 0;
+}
+
 static bool
 filemon_is_launchd_path(const char *path) {
-	const char *p;
+	const ldtrie_node_t *node, *child, *any;
+	const char *p, *end;
+	size_t len;
 
 	assert(path);
 	if (path[0] != '/')
 		return false;
-	if (str_beginswith(path, "/System/Library/LaunchDaemons/"))
-		return true;
-	if (str_beginswith(path, "/Library/LaunchDaemons/"))
-		return true;
-	if (str_beginswith(path, "/System/Library/LaunchAgents/"))
-		return true;
-	if (str_beginswith(path, "/Library/LaunchAgents/"))
-		return true;
-	if (!str_beginswith(path, "/Users/"))
-		return false;
-	p = path + 7;
-	while (*p != '/') {
-		if (!*p)
+	node = &ldtrie[0];
+	for (p = path + 1; (end = strchr(p, '/')); p = end + 1) {
+		len = end - p;
+		any = NULL;
+		for (child = node->child; child; child = child->next) {
+			if (!child->label)
+				any = child;
+			else if (child->len == len &&
+			         !memcmp(child->label, p, len))
+				break;
+		}
+		if (!child)
+			child = any;
+		if (!child)
 			return false;
-		p++;
+		if (child->dir)
+			return true;
+		node = child;
 	}
-	if (!str_beginswith(p, "/Library/LaunchAgents/"))
-		return false;
-	return true;
+	return false;
 }
 
 static void launchd_add_free(launchd_add_t *);
@@ -291,7 +407,7 @@ static launchd_add_t *
 launchd_add_new(char *path) {
 	launchd_add_t *ldadd;
 
-	ldadd = malloc(sizeof(*ldadd));
+	ldadd = pool_alloc(&ldaddpool);
 	if (!ldadd) {
 		free(path);
 		return NULL;
@@ -315,34 +431,91 @@ launchd_add_free(launchd_add_t *ldadd) {
 	if (ldadd->subject_image_exec)
 		image_exec_free(ldadd->subject_image_exec);
 	free(ldadd->plist_path);
-	free(ldadd);
+	pool_free(&ldaddpool, ldadd);
 }
 
 static int
 launchd_add_open(launchd_add_t *ldadd) {
 	ldadd->plist_fd = open(ldadd->plist_path, O_RDONLY);
 	if (ldadd->plist_fd == -1) {
-		atomic64_inc(&lpmiss);
+		counter_inc(&lpmiss);
 		return -1;
 	}
 	return sys_fdattr(&ldadd->plist_stat, ldadd->plist_fd);
 }
 
+/*
+ * Read the whole plist from the open fd into buf.  Returns the number of
+ * bytes read, or -1 if the plist could not be read or is larger than bufsz.
+ */
+static ssize_t
+launchd_add_read(launchd_add_t *ldadd, unsigned char *buf, size_t bufsz) {
+	size_t len = 0;
+	ssize_t n;
+
+	if (ldadd->plist_fd == -1)
+		return -1;
+	for (;;) {
+		n = pread(ldadd->plist_fd, buf + len, bufsz - len, (off_t)len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)
+			return (ssize_t)len;
+		len += (size_t)n;
+		if (len == bufsz)
+			return -1;
+	}
+}
+
 static void
 launchd_add_acquire(launchd_add_t *ldadd) {
 	CFPropertyListRef plist;
+	unsigned char *buf;
+	hashes_t hashes;
+	bool keyed = false;
+	ssize_t n;
 
 	assert(ldadd->plist_path);
-	plist = cf_plist_load(ldadd->plist_path);
+
+	/* rewrites with identical content are resolved from the cache */
+	buf = malloc(LDPL_CONTENT_MAX);
+	n = buf ? launchd_add_read(ldadd, buf, LDPL_CONTENT_MAX) : -1;
+	if (n >= 0) {
+		hashes_mem(&hashes, HASH_SHA256, buf, (size_t)n);
+		keyed = true;
+		if (cacheldpl_content_get(hashes.sha256,
+		                          &ldadd->program_path,
+		                          &ldadd->program_argv)) {
+			free(buf);
+			goto resolve;
+		}
+		if (errno == ENOMEM) {
+			counter_inc(&ooms);
+			free(buf);
+			return;
+		}
+		SIGNPOST_BEGIN(SIGNPOST_FILEMON, "plist", ldadd);
+		plist = cf_plist_parse(buf, (size_t)n);
+		SIGNPOST_END(SIGNPOST_FILEMON, "plist", ldadd);
+	} else {
+		SIGNPOST_BEGIN(SIGNPOST_FILEMON, "plist", ldadd);
+		plist = cf_plist_load(ldadd->plist_path);
+		SIGNPOST_END(SIGNPOST_FILEMON, "plist", ldadd);
+	}
+	if (buf)
+		free(buf);
 	if (!plist) {
-		atomic64_inc(&lpmiss);
+		counter_inc(&lpmiss);
 		return;
 	}
 	ldadd->program_path = cf_cstr(CFDictionaryGetValue(
 	                      (CFDictionaryRef)plist,
 	                      CFSTR("Program")));
 	if (!ldadd->program_path && (errno == ENOMEM)) {
-		atomic64_inc(&ooms);
+		counter_inc(&ooms);
 		CFRelease(plist);
 		return;
 	}
@@ -350,12 +523,17 @@ launchd_add_acquire(launchd_add_t *ldadd) {
 	                      (CFDictionaryRef)plist,
 	                      CFSTR("ProgramArguments")));
 	if (!ldadd->program_argv && (errno == ENOMEM)) {
-		atomic64_inc(&ooms);
+		counter_inc(&ooms);
 		CFRelease(plist);
 		return;
 	}
 	CFRelease(plist);
+	if (keyed)
+		cacheldpl_content_put(hashes.sha256,
+		                      ldadd->program_path,
+		                      ldadd->program_argv);
 
+resolve:
 	if (ldadd->program_path) {
 		ldadd->program_rpath = sys_realpath(ldadd->program_path, NULL);
 	} else if (ldadd->program_argv && ldadd->program_argv[0]) {
@@ -376,7 +554,7 @@ launchd_add_acquire(launchd_add_t *ldadd) {
 		}
 	}
 	if (!ldadd->program_path && (errno == ENOMEM))
-		atomic64_inc(&ooms);
+		counter_inc(&ooms);
 
 	/*
 	 * For now, we are deliberatly not obtaining hashes and codesign status
@@ -407,7 +585,7 @@ filemon_launchd_touched(struct timespec *tv, audit_proc_t *subject,
 
 	ldadd = launchd_add_new(path);
 	if (!ldadd) {
-		atomic64_inc(&ooms);
+		counter_inc(&ooms);
 		return;
 	}
 	if (launchd_add_open(ldadd) == -1) {
@@ -429,8 +607,12 @@ filemon_launchd_touched(struct timespec *tv, audit_proc_t *subject,
 	              ldadd->plist_stat.mtime.tv_sec,
 	              ldadd->plist_stat.ctime.tv_sec,
 	              ldadd->plist_stat.btime.tv_sec);
-	ldadd->subject_image_exec = image_exec_by_pid(subject->pid, tv);
-	if (ldadd->subject_image_exec && (
+	if (subject)
+		ldadd->subject_image_exec = image_exec_by_pid(subject->pid, tv);
+	if (!subject) {
+		/* changed while xnumon was not running */
+		ldadd->flags |= LAFLAG_NOSUBJECT;
+	} else if (ldadd->subject_image_exec && (
 	        (ldadd->subject_image_exec->pid == 1) ||
 	        (ldadd->subject_image_exec->path &&
 	         str_beginswith(ldadd->subject_image_exec->path,
@@ -453,6 +635,9 @@ filemon_launchd_touched(struct timespec *tv, audit_proc_t *subject,
 		ldadd->subject = *subject;
 	}
 	ldadd->hdr.tv = *tv;
+	ldadd->hdr.affinity = ldadd->subject_image_exec;
+	ldadd->hdr.priority = !ldadd->subject_image_exec ||
+	                      image_exec_settled(ldadd->subject_image_exec);
 	work_submit(ldadd);
 }
 
@@ -474,6 +659,21 @@ filemon_touched(struct timespec *tv, audit_proc_t *subject, char *path) {
 	free(path);
 }
 
+/*
+ * Called for files opened for writing, before the file descriptor is tracked
+ * for filemon_touched on close.  Only paths that filemon_touched would
+ * process at this time are worth tracking; symlinks to path created while
+ * the file is open are caught by the next scan instead.
+ */
+bool
+filemon_open_is_relevant(const char *path) {
+	opens_recvd++;
+	if (symlinks_path_is_relevant(path) || filemon_is_launchd_path(path))
+		return true;
+	opens_skipd++;
+	return false;
+}
+
 /*
  * Called for unlink() with path to the unlinked file or directory.
  * Path is not freed.
@@ -514,27 +714,180 @@ filemon_symlink(struct timespec *tv, audit_proc_t *subject, char *path) {
 }
 
 /*
- * Add a single plist file to the launchd plist file cache; used as callback
- * for sys_dir_eachfile().
+ * Add a single plist file to the launchd plist file cache.  If the cache was
+ * loaded from the persistent cache file, plists not found in it were added
+ * or modified since the cache was last saved; these are remembered for
+ * filemon_init_submit, so that only plists that changed are parsed and
+ * logged.
+ */
+static void
+filemon_init_add_plist(const char *path, const stat_attr_t *st, bool islnk) {
+	char **v;
+
+	if (islnk)
+		symlinks_path_walk(path, NULL, NULL);
+	if (cacheldpl_loaded() && S_ISREG(st->mode)) {
+		if (cacheldpl_get(st->dev,
+		                  st->ino,
+		                  st->mtime.tv_sec,
+		                  st->ctime.tv_sec,
+		                  st->btime.tv_sec))
+			return;
+		if (offlinec == offlinesz) {
+			v = realloc(offline, (offlinesz ? offlinesz * 2 : 16) *
+			                     sizeof(char *));
+			if (!v) {
+				counter_inc(&ooms);
+				return;
+			}
+			offline = v;
+			offlinesz = offlinesz ? offlinesz * 2 : 16;
+		}
+		offline[offlinec] = strdup(path);
+		if (!offline[offlinec]) {
+			counter_inc(&ooms);
+			return;
+		}
+		offlinec++;
+		lpoffline++;
+		return;
+	}
+	cacheldpl_put(st->dev,
+	              st->ino,
+	              st->mtime.tv_sec,
+	              st->ctime.tv_sec,
+	              st->btime.tv_sec);
+}
+
+/*
+ * The initial scan walks the launchd directories in parallel, one directory
+ * per thread at a time, collecting the attributes of all the files found.
+ * The results are then added to the plist file cache and the symlinks table
+ * in a single pass on the calling thread, in the same order as a serial
+ * scan would, such that neither needs to be thread-safe.  Falls back to
+ * scanning one directory after the other if memory is not available.
+ */
+
+#define SCAN_THREADS    8
+
+typedef struct {
+	char *path;
+	stat_attr_t st;
+	bool islnk;
+} scan_file_t;
+
+typedef struct {
+	const char *dir;
+	scan_file_t *filev;
+	size_t filec;
+	size_t filesz;
+} scan_dir_t;
+
+static scan_dir_t *scanv;
+static size_t scanc;
+static atomic_size_t scannext;
+
+/*
+ * Collect the attributes of a single file; used as callback for
+ * sys_dir_eachfile_l() by the scan threads.
  */
 static int
-filemon_init_add_plist(const char *path, UNUSED void *udata) {
+filemon_init_scan_file(const char *path, void *udata) {
+	scan_dir_t *sd = udata;
+	scan_file_t *v;
 	stat_attr_t st;
-	int rv;
 
-	rv = sys_pathattr(&st, path);
-	if (rv == -1)
+	if (sys_pathattr(&st, path) == -1)
 		return 0;
-	cacheldpl_put(st.dev,
-	              st.ino,
-	              st.mtime.tv_sec,
-	              st.ctime.tv_sec,
-	              st.btime.tv_sec);
-	if (sys_islnk(path) == 1)
-		symlinks_path_walk(path, NULL, NULL);
+	if (sd->filec == sd->filesz) {
+		v = realloc(sd->filev, (sd->filesz ? sd->filesz * 2 : 64) *
+		                       sizeof(scan_file_t));
+		if (!v) {
+			counter_inc(&ooms);
+			return 0;
+		}
+		sd->filev = v;
+		sd->filesz = sd->filesz ? sd->filesz * 2 : 64;
+	}
+	sd->filev[sd->filec].path = strdup(path);
+	if (!sd->filev[sd->filec].path) {
+		counter_inc(&ooms);
+		return 0;
+	}
+	sd->filev[sd->filec].st = st;
+	sd->filev[sd->filec].islnk = (sys_islnk(path) == 1);
+	sd->filec++;
+	return 0;
+}
+
+static void *
+filemon_init_scan_thread(UNUSED void *arg) {
+	size_t i;
+
+	while ((i = atomic_fetch_add(&scannext, 1)) < scanc)
+		(void)sys_dir_eachfile_l(scanv[i].dir, filemon_init_scan_file,
+		                         &scanv[i]);
+	return NULL;
+}
+
+/*
+ * Add a single plist file to the launchd plist file cache without prior
+ * scan; used as callback for sys_dir_eachfile_l() in the fallback.
+ */
+static int
+filemon_init_add_file(const char *path, UNUSED void *udata) {
+	stat_attr_t st;
+
+	if (sys_pathattr(&st, path) == -1)
+		return 0;
+	filemon_init_add_plist(path, &st, sys_islnk(path) == 1);
 	return 0;
 }
 
+/*
+ * Scan all the directories in dirv, adding the plist files found.
+ */
+static void
+filemon_init_scan(char **dirv, size_t dirc) {
+	pthread_t thrs[SCAN_THREADS];
+	size_t nthrs;
+
+	if (dirc == 0)
+		return;
+	scanv = calloc(dirc, sizeof(scan_dir_t));
+	if (!scanv) {
+		for (size_t i = 0; i < dirc; i++)
+			(void)sys_dir_eachfile_l(dirv[i],
+			                         filemon_init_add_file, NULL);
+		return;
+	}
+	for (size_t i = 0; i < dirc; i++)
+		scanv[i].dir = dirv[i];
+	scanc = dirc;
+	atomic_init(&scannext, 0);
+	for (nthrs = 0; nthrs < SCAN_THREADS && nthrs + 1 < scanc; nthrs++) {
+		if (pthread_create(&thrs[nthrs], NULL,
+		                   filemon_init_scan_thread, NULL) != 0)
+			break;
+	}
+	(void)filemon_init_scan_thread(NULL);
+	for (size_t i = 0; i < nthrs; i++)
+		(void)pthread_join(thrs[i], NULL);
+
+	for (size_t i = 0; i < scanc; i++) {
+		for (size_t j = 0; j < scanv[i].filec; j++) {
+			filemon_init_add_plist(scanv[i].filev[j].path,
+			                       &scanv[i].filev[j].st,
+			                       scanv[i].filev[j].islnk);
+			free(scanv[i].filev[j].path);
+		}
+		free(scanv[i].filev);
+	}
+	free(scanv);
+	scanv = NULL;
+	scanc = 0;
+}
+
 /*
  * Initialize the file monitor and add all the existing plist files to the
  * plist file cache.  We accept that there is a race condition here in that
@@ -544,38 +897,86 @@ filemon_init_add_plist(const char *path, UNUSED void *udata) {
  */
 int
 filemon_init(config_t *cfg) {
+	glob_t g[sizeof(launchd_dirs)/sizeof(launchd_dirs[0])];
+	char **dirv = NULL, **v;
+	size_t dirc = 0;
+
+	if (pool_init(&ldaddpool, "launchd_add", sizeof(launchd_add_t),
+	              FILEMON_SLABOBJS) == -1)
+		return -1;
 	config = cfg;
-	ooms = 0;
-	lpmiss = 0;
+	counter_reset(&ooms);
+	counter_reset(&lpmiss);
+	lpoffline = 0;
+	offline = NULL;
+	offlinec = 0;
+	offlinesz = 0;
 	events_recvd = 0;
 	events_procd = 0;
-	glob_t g;
+	opens_recvd = 0;
+	opens_skipd = 0;
 
-	symlinks_init();
+	if (ldtrie_init() == -1 || symlinks_init() == -1) {
+		pool_destroy(&ldaddpool);
+		config = NULL;
+		return -1;
+	}
 
-	(void)sys_dir_eachfile_l("/System/Library/LaunchDaemons/",
-	                         filemon_init_add_plist, NULL);
-	(void)sys_dir_eachfile_l("/Library/LaunchDaemons/",
-	                         filemon_init_add_plist, NULL);
-	(void)sys_dir_eachfile_l("/System/Library/LaunchAgents/",
-	                         filemon_init_add_plist, NULL);
-	(void)sys_dir_eachfile_l("/Library/LaunchAgents/",
-	                         filemon_init_add_plist, NULL);
-	bzero(&g, sizeof(g));
-	glob("/Users/*/Library/LaunchAgents/", 0, NULL, &g);
-	for (int i = 0; i < g.gl_matchc; i++) {
-		(void)sys_dir_eachfile_l(g.gl_pathv[i],
-		                         filemon_init_add_plist, NULL);
+	for (size_t i = 0; i < sizeof(launchd_dirs)/sizeof(launchd_dirs[0]);
+	     i++) {
+		bzero(&g[i], sizeof(g[i]));
+		if (glob(launchd_dirs[i], 0, NULL, &g[i]) != 0)
+			continue;
+		v = realloc(dirv, (dirc + (size_t)g[i].gl_matchc) *
+		                  sizeof(char *));
+		if (!v) {
+			counter_inc(&ooms);
+			continue;
+		}
+		dirv = v;
+		for (int j = 0; j < g[i].gl_matchc; j++)
+			dirv[dirc++] = g[i].gl_pathv[j];
 	}
+	filemon_init_scan(dirv, dirc);
+	free(dirv);
+	for (size_t i = 0; i < sizeof(launchd_dirs)/sizeof(launchd_dirs[0]);
+	     i++)
+		globfree(&g[i]);
 
 	return 0;
 }
 
+/*
+ * Submit launchd-add events without subject for the plists found by
+ * filemon_init to have changed while xnumon was not running.  Called once
+ * during startup, after the xnumon-ops start event was submitted.
+ */
+void
+filemon_init_submit(void) {
+	struct timespec tv;
+
+	if (timespec_nanotime(&tv) == -1)
+		bzero(&tv, sizeof(tv));
+	for (size_t i = 0; i < offlinec; i++)
+		filemon_launchd_touched(&tv, NULL, offline[i]);
+	free(offline);
+	offline = NULL;
+	offlinec = 0;
+	offlinesz = 0;
+}
+
 void
 filemon_fini(void) {
 	if (!config)
 		return;
 	symlinks_fini();
+	for (size_t i = 0; i < offlinec; i++)
+		free(offline[i]);
+	free(offline);
+	offline = NULL;
+	offlinec = 0;
+	offlinesz = 0;
+	pool_destroy(&ldaddpool);
 	config = NULL;
 }
 
@@ -585,7 +986,13 @@ filemon_stats(filemon_stat_t *st) {
 
 	st->recvd = events_recvd;
 	st->procd = events_procd;
-	st->lpmiss = (uint64_t)lpmiss;
-	st->ooms = (uint64_t)ooms;
+	st->opens = opens_recvd;
+	st->openskips = opens_skipd;
+	st->lpmiss = counter_get(&lpmiss);
+	st->lpoffline = lpoffline;
+	st->symlinks = symlinks.count;
+	st->symlinks_bytes = symlinks.bytes +
+	                     symlinks.count * sizeof(symlinks_obj_t);
+	st->ooms = counter_get(&ooms);
 }
 
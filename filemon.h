@@ -23,7 +23,12 @@
 typedef struct {
 	uint64_t recvd;
 	uint64_t procd;
+	uint64_t opens;                 /* files opened for writing */
+	uint64_t openskips;             /* opens not tracked until close */
 	uint64_t lpmiss;
+	uint64_t lpoffline;
+	uint64_t symlinks;              /* tracked paths */
+	uint64_t symlinks_bytes;
 	uint64_t ooms;
 } filemon_stat_t;
 
@@ -51,8 +56,10 @@ void filemon_touched(struct timespec *, audit_proc_t *, char *)
 void filemon_symlink(struct timespec *, audit_proc_t *, char *)
      NONNULL(1,2,3);
 void filemon_unlink(const char *, audit_attr_t *) NONNULL(1);
+bool filemon_open_is_relevant(const char *) NONNULL(1) WUNRES;
 
 int filemon_init(config_t *) WUNRES NONNULL(1);
+void filemon_init_submit(void);
 void filemon_fini(void);
 void filemon_stats(filemon_stat_t *) NONNULL(1);
 
@@ -0,0 +1,493 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "fleetcache.h"
+
+#include "cachecdhash.h"
+#include "cachefile.h"
+#include "intern.h"
+#include "time.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+
+/*
+ * Client for a cache of file hashes and code signatures shared across a
+ * fleet of machines, behind the local cdhash cache.  xnumon only talks to a
+ * relay on a local Unix domain socket, which must be owned by root; talking
+ * to the fleet-wide service, authenticating it, and deciding which results
+ * of which machines to trust is left to the relay.
+ *
+ * Like cachecdhash, lookups are keyed by the cdhash the kernel reports for a
+ * running process and the file size, which unlike inodes or the per-run
+ * keyed content fingerprints mean the same on every machine, and only good
+ * signatures over the same cdhash are accepted from or published to the
+ * relay.  Lookups block the calling thread for at most the configured
+ * timeout.  Timeouts and errors drop the connection, and lookups are then
+ * answered as misses without contacting the relay for FLEETCACHE_RETRY
+ * seconds.  Results of local verification are published without waiting
+ * for the relay, and dropped if it is not ready to receive them.
+ *
+ * Messages are a fleetcache_hdr_t in host byte order followed by len bytes
+ * of payload:  a fleetcache_key_t for lookups and misses, and for hits and
+ * publications the key followed by the hashes, result and origin, and the
+ * cdhash, ident, teamid and certcn blobs, each as a 32 bit length plus one,
+ * or zero for NULL, followed by the bytes, as in the cachecsig cache file.
+ * The relay answers every lookup in order with a hit or a miss carrying the
+ * seq of the lookup, and nothing else.
+ */
+
+#define FLEETCACHE_MAGIC        0x31434658      /* XFC1 */
+#define FLEETCACHE_OP_GET       1
+#define FLEETCACHE_OP_MISS      2
+#define FLEETCACHE_OP_HIT       3
+#define FLEETCACHE_OP_PUT       4
+#define FLEETCACHE_PAYLOADSZ    2048
+
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint32_t op;                    /* FLEETCACHE_OP_* */
+	uint32_t seq;                   /* of the lookup answered */
+	int32_t hflags;                 /* HASH_* computed in the hashes */
+	uint32_t len;                   /* of the payload */
+} fleetcache_hdr_t;
+
+typedef struct __attribute__((packed)) {
+	unsigned char cdhash[CDHASHSZ];
+	uint64_t size;
+} fleetcache_key_t;
+
+typedef struct {
+	fleetcache_hdr_t hdr;
+	unsigned char payload[FLEETCACHE_PAYLOADSZ];
+} fleetcache_msg_t;
+
+static pthread_mutex_t mutex;
+static bool enabled = false;
+static char *sockpath = NULL;
+static int sock = -1;
+static uint64_t timeout;                /* ns */
+static int hflags;
+static uint64_t retry_at = 0;           /* monotonic ns */
+static uint32_t seq = 0;
+static fleetcache_stat_t stats;
+
+/*
+ * Use the relay listening on the Unix domain socket at path for lookups
+ * that time out after timeout_ms, for hashes as configured in hashflags.
+ * A NULL path disables the client.
+ */
+void
+fleetcache_init(const char *path, size_t timeout_ms, int hashflags) {
+	if (!path)
+		return;
+	sockpath = strdup(path);
+	if (!sockpath)
+		return;
+	pthread_mutex_init(&mutex, NULL);
+	timeout = (uint64_t)timeout_ms * 1000000;
+	hflags = hashflags;
+	retry_at = 0;
+	bzero(&stats, sizeof(stats));
+	enabled = true;
+}
+
+void
+fleetcache_fini(void) {
+	if (!enabled)
+		return;
+	if (sock != -1) {
+		close(sock);
+		sock = -1;
+	}
+	free(sockpath);
+	sockpath = NULL;
+	pthread_mutex_destroy(&mutex);
+	enabled = false;
+}
+
+bool
+fleetcache_enabled(void) {
+	return enabled;
+}
+
+/*
+ * Drop the connection after a timeout or error, counting it by errno, and
+ * do not try again for a while.  Called with the mutex held.
+ */
+static void
+fleetcache_fail(void) {
+	if (errno == ETIMEDOUT)
+		stats.timeouts++;
+	else
+		stats.errors++;
+	if (sock != -1) {
+		close(sock);
+		sock = -1;
+	}
+	retry_at = timespec_mononsec() + (uint64_t)FLEETCACHE_RETRY *
+	                                 1000000000;
+}
+
+/*
+ * Connect to the relay unless already connected.  Called with the mutex
+ * held.
+ */
+static int
+fleetcache_connect(void) {
+	struct sockaddr_un sun;
+	uid_t euid;
+	gid_t egid;
+	int fd, flags, one = 1;
+
+	if (sock != -1)
+		return 0;
+	if (retry_at && timespec_mononsec() < retry_at)
+		return -1;
+
+	bzero(&sun, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen(sockpath) >= sizeof(sun.sun_path)) {
+		errno = ENAMETOOLONG;
+		goto errout;
+	}
+	strlcpy(sun.sun_path, sockpath, sizeof(sun.sun_path));
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		goto errout;
+	(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+		goto errout_close;
+	if (getpeereid(fd, &euid, &egid) == -1)
+		goto errout_close;
+	if (euid != 0) {
+		errno = EPERM;
+		goto errout_close;
+	}
+#ifdef SO_NOSIGPIPE
+	(void)setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+	flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		goto errout_close;
+	sock = fd;
+	retry_at = 0;
+	return 0;
+
+errout_close:
+	close(fd);
+errout:
+	fleetcache_fail();
+	return -1;
+}
+
+/*
+ * Send or receive exactly sz bytes before the monotonic deadline.
+ */
+static int
+fleetcache_xfer(void *buf, size_t sz, bool out, uint64_t deadline) {
+	unsigned char *p = buf;
+	struct pollfd pfd;
+	uint64_t now;
+	ssize_t n;
+
+	while (sz > 0) {
+		n = out ? send(sock, p, sz, 0) : recv(sock, p, sz, 0);
+		if (n > 0) {
+			p += n;
+			sz -= (size_t)n;
+			continue;
+		}
+		if (n == 0) {
+			errno = ECONNRESET;
+			return -1;
+		}
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN)
+			return -1;
+		now = timespec_mononsec();
+		if (now >= deadline) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		pfd.fd = sock;
+		pfd.events = out ? POLLOUT : POLLIN;
+		if (poll(&pfd, 1, (int)((deadline - now + 999999) / 1000000))
+		    == -1 && errno != EINTR)
+			return -1;
+	}
+	return 0;
+}
+
+static int
+fleetcache_enc(fleetcache_msg_t *msg, const void *buf, size_t sz) {
+	if (sz > FLEETCACHE_PAYLOADSZ - msg->hdr.len)
+		return -1;
+	memcpy(msg->payload + msg->hdr.len, buf, sz);
+	msg->hdr.len += (uint32_t)sz;
+	return 0;
+}
+
+static int
+fleetcache_enc_blob(fleetcache_msg_t *msg, const void *buf, size_t sz) {
+	uint32_t len;
+
+	if (!buf) {
+		len = 0;
+		return fleetcache_enc(msg, &len, sizeof(len));
+	}
+	len = (uint32_t)sz + 1;
+	if (fleetcache_enc(msg, &len, sizeof(len)) == -1)
+		return -1;
+	return fleetcache_enc(msg, buf, sz);
+}
+
+/*
+ * Decode a blob or interned string as encoded by fleetcache_enc_blob.
+ */
+static int
+fleetcache_dec_blob(unsigned char **dst, size_t *dstsz,
+                    const unsigned char **p, const unsigned char *end) {
+	uint32_t len;
+
+	if (cachefile_read(&len, sizeof(len), p, end) == -1)
+		return -1;
+	if (len == 0)
+		return 0;
+	len--;
+	if ((size_t)(end - *p) < len)
+		return -1;
+	*dst = malloc(len);
+	if (!*dst)
+		return -1;
+	memcpy(*dst, *p, len);
+	*dstsz = len;
+	*p += len;
+	return 0;
+}
+
+static int
+fleetcache_dec_str(char **dst,
+                   const unsigned char **p, const unsigned char *end) {
+	uint32_t len;
+
+	if (cachefile_read(&len, sizeof(len), p, end) == -1)
+		return -1;
+	if (len == 0)
+		return 0;
+	len--;
+	if ((size_t)(end - *p) < len || memchr(*p, '\0', len))
+		return -1;
+	*dst = intern_strn((const char *)*p, len);
+	if (!*dst)
+		return -1;
+	*p += len;
+	return 0;
+}
+
+/*
+ * Decode the payload of a hit for key into hashes and a newly allocated
+ * codesign_t.  Returns -1 if the payload is malformed or not acceptable.
+ */
+static int
+fleetcache_dec_hit(hashes_t *hashes, codesign_t **codesign,
+                   const fleetcache_key_t *key,
+                   const unsigned char *p, const unsigned char *end) {
+	fleetcache_key_t hitkey;
+	codesign_t *cs;
+	int32_t i32;
+
+	if (cachefile_read(&hitkey, sizeof(hitkey), &p, end) == -1 ||
+	    memcmp(&hitkey, key, sizeof(hitkey)))
+		return -1;
+	cs = codesign_alloc();
+	if (!cs)
+		return -1;
+	if (cachefile_read(hashes, sizeof(hashes_t), &p, end) == -1)
+		goto errout;
+	if (cachefile_read(&i32, sizeof(i32), &p, end) == -1)
+		goto errout;
+	cs->result = i32;
+	if (cachefile_read(&i32, sizeof(i32), &p, end) == -1)
+		goto errout;
+	cs->origin = i32;
+	if (fleetcache_dec_blob(&cs->cdhash, &cs->cdhashsz, &p, end) == -1 ||
+	    fleetcache_dec_str(&cs->ident, &p, end) == -1 ||
+	    fleetcache_dec_str(&cs->teamid, &p, end) == -1 ||
+	    fleetcache_dec_str(&cs->certcn, &p, end) == -1)
+		goto errout;
+	if (p != end || !codesign_is_good(cs) ||
+	    cs->cdhashsz != CDHASHSZ ||
+	    memcmp(cs->cdhash, key->cdhash, CDHASHSZ))
+		goto errout;
+	*codesign = cs;
+	return 0;
+errout:
+	codesign_free(cs);
+	return -1;
+}
+
+/*
+ * Returns true and fills in hashes and a codesign result holding a reference
+ * for the caller in *codesign on hits.  Thread-safe; lookups of concurrent threads are
+ * serialized.
+ */
+bool
+fleetcache_get(const unsigned char *cdhash, off_t size, hashes_t *hashes,
+               codesign_t **codesign) {
+	fleetcache_msg_t msg;
+	fleetcache_key_t key;
+	uint64_t deadline;
+	uint32_t myseq;
+
+	assert(cdhash && hashes && codesign);
+
+	if (!enabled)
+		return false;
+	bzero(&key, sizeof(key));
+	memcpy(key.cdhash, cdhash, CDHASHSZ);
+	key.size = (uint64_t)size;
+
+	pthread_mutex_lock(&mutex);
+	stats.lookups++;
+	if (fleetcache_connect() == -1)
+		goto errout;
+	deadline = timespec_mononsec() + timeout;
+	myseq = ++seq;
+	bzero(&msg.hdr, sizeof(msg.hdr));
+	msg.hdr.magic = FLEETCACHE_MAGIC;
+	msg.hdr.op = FLEETCACHE_OP_GET;
+	msg.hdr.seq = myseq;
+	msg.hdr.hflags = hflags;
+	(void)fleetcache_enc(&msg, &key, sizeof(key));
+	if (fleetcache_xfer(&msg, sizeof(msg.hdr) + msg.hdr.len,
+	                    true, deadline) == -1 ||
+	    fleetcache_xfer(&msg.hdr, sizeof(msg.hdr), false, deadline) == -1)
+		goto errout_fail;
+	if (msg.hdr.magic != FLEETCACHE_MAGIC || msg.hdr.seq != myseq ||
+	    msg.hdr.len > FLEETCACHE_PAYLOADSZ) {
+		errno = EPROTO;
+		goto errout_fail;
+	}
+	if (fleetcache_xfer(msg.payload, msg.hdr.len, false, deadline) == -1)
+		goto errout_fail;
+	switch (msg.hdr.op) {
+	case FLEETCACHE_OP_MISS:
+		stats.misses++;
+		goto errout;
+	case FLEETCACHE_OP_HIT:
+		break;
+	default:
+		errno = EPROTO;
+		goto errout_fail;
+	}
+	if (msg.hdr.hflags != hflags ||
+	    fleetcache_dec_hit(hashes, codesign, &key, msg.payload,
+	                       msg.payload + msg.hdr.len) == -1) {
+		stats.rejects++;
+		goto errout;
+	}
+	stats.hits++;
+	pthread_mutex_unlock(&mutex);
+	return true;
+
+errout_fail:
+	fleetcache_fail();
+errout:
+	pthread_mutex_unlock(&mutex);
+	return false;
+}
+
+/*
+ * Publish the result of a local verification to the relay, without waiting
+ * for it.  Only good signatures over cdhash are published.  Thread-safe.
+ */
+void
+fleetcache_put(const unsigned char *cdhash, off_t size, hashes_t *hashes,
+               codesign_t *codesign) {
+	fleetcache_msg_t msg;
+	fleetcache_key_t key;
+	size_t sz;
+	ssize_t n;
+	int32_t i32;
+
+	assert(cdhash && hashes && codesign);
+
+	if (!enabled || !codesign_is_good(codesign) ||
+	    codesign->cdhashsz != CDHASHSZ ||
+	    memcmp(codesign->cdhash, cdhash, CDHASHSZ))
+		return;
+	bzero(&key, sizeof(key));
+	memcpy(key.cdhash, cdhash, CDHASHSZ);
+	key.size = (uint64_t)size;
+	bzero(&msg.hdr, sizeof(msg.hdr));
+	msg.hdr.magic = FLEETCACHE_MAGIC;
+	msg.hdr.op = FLEETCACHE_OP_PUT;
+	msg.hdr.hflags = hflags;
+	if (fleetcache_enc(&msg, &key, sizeof(key)) == -1 ||
+	    fleetcache_enc(&msg, hashes, sizeof(hashes_t)) == -1)
+		return;
+	i32 = codesign->result;
+	if (fleetcache_enc(&msg, &i32, sizeof(i32)) == -1)
+		return;
+	i32 = codesign->origin;
+	if (fleetcache_enc(&msg, &i32, sizeof(i32)) == -1 ||
+	    fleetcache_enc_blob(&msg, codesign->cdhash,
+	                        codesign->cdhashsz) == -1 ||
+	    fleetcache_enc_blob(&msg, codesign->ident, codesign->ident ?
+	                        strlen(codesign->ident) : 0) == -1 ||
+	    fleetcache_enc_blob(&msg, codesign->teamid, codesign->teamid ?
+	                        strlen(codesign->teamid) : 0) == -1 ||
+	    fleetcache_enc_blob(&msg, codesign->certcn, codesign->certcn ?
+	                        strlen(codesign->certcn) : 0) == -1)
+		return;
+	sz = sizeof(msg.hdr) + msg.hdr.len;
+
+	pthread_mutex_lock(&mutex);
+	if (fleetcache_connect() == -1) {
+		pthread_mutex_unlock(&mutex);
+		return;
+	}
+	n = send(sock, &msg, sz, 0);
+	if (n == (ssize_t)sz) {
+		stats.puts++;
+	} else if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+		stats.putdrops++;
+	} else {
+		/* partially sent messages leave the stream out of sync */
+		if (n != -1)
+			errno = EPROTO;
+		fleetcache_fail();
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void
+fleetcache_stats(fleetcache_stat_t *st) {
+	if (!enabled) {
+		bzero(st, sizeof(fleetcache_stat_t));
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	memcpy(st, &stats, sizeof(fleetcache_stat_t));
+	pthread_mutex_unlock(&mutex);
+}
+
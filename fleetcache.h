@@ -0,0 +1,47 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef FLEETCACHE_H
+#define FLEETCACHE_H
+
+#include "hashes.h"
+#include "codesign.h"
+#include "attrib.h"
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FLEETCACHE_TIMEOUT      20      /* ms, default */
+#define FLEETCACHE_TIMEOUT_MAX  1000
+#define FLEETCACHE_RETRY        30      /* s after failures */
+
+typedef struct {
+	uint64_t lookups;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t rejects;               /* answers not accepted */
+	uint64_t timeouts;
+	uint64_t errors;
+	uint64_t puts;
+	uint64_t putdrops;              /* relay not ready to receive */
+} fleetcache_stat_t;
+
+void fleetcache_init(const char *, size_t, int);
+void fleetcache_fini(void);
+bool fleetcache_enabled(void);
+bool fleetcache_get(const unsigned char *, off_t, hashes_t *,
+                    codesign_t **) NONNULL(1,3,4) WUNRES;
+void fleetcache_put(const unsigned char *, off_t, hashes_t *,
+                    codesign_t *) NONNULL(1,3,4);
+void fleetcache_stats(fleetcache_stat_t *) NONNULL(1);
+
+#endif
+
@@ -0,0 +1,186 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "fsclass.h"
+
+#include "setstr.h"
+#include "time.h"
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+/*
+ * Acquisition policy of executable images by the type of the filesystem
+ * they reside on.  Hashing an image on an SMB, AFP or NFS share or on a slow
+ * removable disk can take seconds, which is fine in the bulk lane but not
+ * in the worker threads or while the kext is waiting for us.
+ *
+ * The type of a filesystem is looked up using fstatfs(2) on the first image
+ * opened from it, and the resulting policy is cached by dev_t for
+ * FSCLASS_TTL seconds, such that a device number reused by a later mount is
+ * classified again eventually.  Devices not fitting into the cache are
+ * looked up every time.  Without fsclass_init, all images are hashed.
+ */
+
+typedef struct {
+	dev_t dev;
+	int policy;
+	struct timespec expiry;         /* monotonic */
+} fsclass_entry_t;
+
+static fsclass_entry_t entries[FSCLASS_SIZE];
+static size_t nentries = 0;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static setstr_t *bulk = NULL;
+static setstr_t *skip = NULL;
+static uint64_t hits = 0;
+static uint64_t misses = 0;
+static uint64_t nbulk = 0;
+static uint64_t nskip = 0;
+
+/*
+ * Count the classification of an image.  Must be called with mutex held.
+ */
+static int
+fsclass_count(int policy) {
+	if (policy == FSCLASS_BULK)
+		nbulk++;
+	else if (policy == FSCLASS_SKIP)
+		nskip++;
+	return policy;
+}
+
+void
+fsclass_init(config_t *cfg) {
+	assert(cfg);
+
+	pthread_mutex_lock(&mutex);
+	bulk = &cfg->fstypes_bulk;
+	skip = &cfg->fstypes_skip;
+	nentries = 0;
+	hits = 0;
+	misses = 0;
+	nbulk = 0;
+	nskip = 0;
+	pthread_mutex_unlock(&mutex);
+}
+
+void
+fsclass_fini(void) {
+	pthread_mutex_lock(&mutex);
+	bulk = NULL;
+	skip = NULL;
+	nentries = 0;
+	pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * Must be called with mutex held.
+ */
+static fsclass_entry_t *
+fsclass_find(dev_t dev) {
+	for (size_t i = 0; i < nentries; i++) {
+		if (entries[i].dev == dev)
+			return &entries[i];
+	}
+	return NULL;
+}
+
+/*
+ * Returns the FSCLASS_* policy for images on device dev, using the open
+ * descriptor fd of one of them to look up the filesystem type if needed.
+ */
+int
+fsclass_policy(dev_t dev, int fd) {
+	struct statfs sfs;
+	struct timespec now;
+	fsclass_entry_t *e;
+	int policy;
+
+	if (timespec_monotime(&now) == -1)
+		bzero(&now, sizeof(now));
+
+	pthread_mutex_lock(&mutex);
+	if (!bulk || (setstr_size(bulk) == 0 && setstr_size(skip) == 0)) {
+		pthread_mutex_unlock(&mutex);
+		return FSCLASS_HASH;
+	}
+	e = fsclass_find(dev);
+	if (e && timespec_greater(&e->expiry, &now)) {
+		hits++;
+		policy = fsclass_count(e->policy);
+		pthread_mutex_unlock(&mutex);
+		return policy;
+	}
+	misses++;
+
+	/* statfs of a network filesystem can block, do not hold the lock */
+	pthread_mutex_unlock(&mutex);
+	if (fstatfs(fd, &sfs) == -1)
+		return FSCLASS_HASH;
+	pthread_mutex_lock(&mutex);
+	if (!bulk) {
+		pthread_mutex_unlock(&mutex);
+		return FSCLASS_HASH;
+	}
+	if (setstr_contains(skip, sfs.f_fstypename))
+		policy = FSCLASS_SKIP;
+	else if (setstr_contains(bulk, sfs.f_fstypename))
+		policy = FSCLASS_BULK;
+	else
+		policy = FSCLASS_HASH;
+	(void)fsclass_count(policy);
+
+	/* the cache may have changed while unlocked */
+	e = fsclass_find(dev);
+	if (!e && nentries < FSCLASS_SIZE)
+		e = &entries[nentries++];
+	if (e) {
+		e->dev = dev;
+		e->policy = policy;
+		e->expiry = now;
+		timespec_add_msec(&e->expiry, FSCLASS_TTL * 1000);
+	}
+	pthread_mutex_unlock(&mutex);
+	return policy;
+}
+
+/*
+ * Forget the classification of device dev, such as after it was unmounted,
+ * such that a later mount reusing the device number is classified again
+ * right away instead of after FSCLASS_TTL.
+ */
+void
+fsclass_purge_dev(dev_t dev) {
+	fsclass_entry_t *e;
+
+	pthread_mutex_lock(&mutex);
+	e = fsclass_find(dev);
+	if (e)
+		*e = entries[--nentries];
+	pthread_mutex_unlock(&mutex);
+}
+
+void
+fsclass_stats(fsclass_stat_t *st) {
+	assert(st);
+
+	pthread_mutex_lock(&mutex);
+	st->hits = hits;
+	st->misses = misses;
+	st->bulk = nbulk;
+	st->skip = nskip;
+	pthread_mutex_unlock(&mutex);
+}
+
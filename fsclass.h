@@ -0,0 +1,41 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef FSCLASS_H
+#define FSCLASS_H
+
+#include "config.h"
+#include "attrib.h"
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#define FSCLASS_SIZE    64      /* devices cached */
+#define FSCLASS_TTL     60      /* sec */
+
+#define FSCLASS_HASH    0       /* acquire inline */
+#define FSCLASS_BULK    1       /* acquire in the bulk lane */
+#define FSCLASS_SKIP    2       /* do not hash or verify */
+
+typedef struct {
+	uint64_t hits;
+	uint64_t misses;                /* looked up using fstatfs(2) */
+	uint64_t bulk;                  /* images classified FSCLASS_BULK */
+	uint64_t skip;                  /* images classified FSCLASS_SKIP */
+} fsclass_stat_t;
+
+void fsclass_init(config_t *) NONNULL(1);
+void fsclass_fini(void);
+int fsclass_policy(dev_t, int) WUNRES;
+void fsclass_purge_dev(dev_t);
+void fsclass_stats(fsclass_stat_t *) NONNULL(1);
+
+#endif
+
@@ -0,0 +1,307 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "governor.h"
+
+#include "procmon.h"
+#include "intern.h"
+#include "log.h"
+#include "time.h"
+#include "minmax.h"
+
+#include "tommyhash.h"
+#include "tommyhashinc.h"
+#include "tommylist.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/*
+ * The governor sits between the work stage and the log stage and limits the
+ * rate of events per key, where a key is the image path and eventcode of an
+ * event.  The image is the executed image for image-exec events and the
+ * subject image for all other events, i.e. the affinity of the event.  Each
+ * key has a token bucket of config->governor_burst tokens, refilled at
+ * config->governor_rate tokens per second.  Events finding the bucket empty
+ * are suppressed and counted, and the suppressed events of each key are
+ * logged as an event-summary event with the count and the time of the first
+ * and last suppressed event at most every config->governor_interval
+ * seconds, as well as before xnumon-ops events such as stop.
+ *
+ * Only eventcodes that are expected in high volume are governed; xnumon-ops,
+ * xnumon-stats and launchd-add events always pass.  Time is taken from the
+ * event timestamps, not from the clock, so that the governor's decisions
+ * are independent of how far the log stage is lagging behind.
+ *
+ * The governor is only called from work_pass, which is serialized by the
+ * reorder buffer lock, and therefore needs no locking of its own.  It keeps
+ * at most GOVERNOR_KEYS_MAX keys; keys with a full bucket and no pending
+ * suppressed events are evicted about once per second, and events for which
+ * no key can be allocated pass ungoverned.
+ */
+
+#define GOVERNOR_TOKEN  1000000000ULL   /* one token is 1e9 units, per ns */
+
+#define GOVERNED        (LOGEVT_FLAG(LOGEVT_IMAGE_EXEC)|\
+                         LOGEVT_FLAG(LOGEVT_PROCESS_ACCESS)|\
+                         LOGEVT_SOCKMON)
+
+typedef struct {
+	char *path;             /* interned, key */
+	uint64_t code;          /* key */
+	uint64_t tokens;        /* in GOVERNOR_TOKEN units */
+	struct timespec refill; /* time tokens were last refilled */
+	uint64_t count;         /* suppressed since last summary */
+	struct timespec first;
+	struct timespec last;
+	tommy_node node;        /* keys */
+	tommy_node lnode;       /* keylist */
+} governor_key_t;
+
+static tommy_hashinc keys;
+static tommy_list keylist;              /* all keys, for sweeping */
+static struct timespec next_sweep;
+static uint64_t untracked;
+static uint64_t summaries;
+static uint64_t suppressed[LOGEVT_SIZE];
+
+static config_t *config = NULL;
+
+typedef struct {
+	const char *path;
+	uint64_t code;
+} governor_arg_t;
+
+static int
+governor_key_cmp(const void *arg, const void *obj) {
+	const governor_arg_t *a = arg;
+	const governor_key_t *key = obj;
+
+	return a->path != key->path || a->code != key->code;
+}
+
+static tommy_hash_t
+governor_hash(const char *path, uint64_t code) {
+	return tommy_inthash_u64((uintptr_t)path + code);
+}
+
+static void
+event_summary_free(event_summary_t *es) {
+	intern_free(es->path);
+	free(es);
+}
+
+/*
+ * Log the events suppressed for key so far and start over.  If event-summary
+ * events are disabled or the summary cannot be allocated, the count is lost;
+ * the suppressed events are still accounted for in the stats.
+ */
+static void
+governor_summarize(governor_key_t *key, struct timespec *tv) {
+	event_summary_t *es;
+
+	assert(key->count > 0);
+	if (LOGEVT_WANT(config->events,
+	                LOGEVT_FLAG(LOGEVT_EVENT_SUMMARY))) {
+		es = malloc(sizeof(event_summary_t));
+		if (es) {
+			bzero(es, sizeof(event_summary_t));
+			es->hdr.code = LOGEVT_EVENT_SUMMARY;
+			es->hdr.tv = *tv;
+			es->hdr.le_free = (__typeof__(es->hdr.le_free))
+			                  event_summary_free;
+			es->path = intern_ref(key->path);
+			es->eventcode = key->code;
+			es->count = key->count;
+			es->first = key->first;
+			es->last = key->last;
+			log_submit(es);
+			summaries++;
+		}
+	}
+	key->count = 0;
+}
+
+/*
+ * Add the tokens accrued since the last refill, up to the bucket size.
+ * Returns true if the bucket is full.
+ */
+static bool
+governor_refill(governor_key_t *key, struct timespec *tv) {
+	uint64_t full = config->governor_burst * GOVERNOR_TOKEN;
+	uint64_t ns;
+
+	ns = timespec_diff_nsec(tv, &key->refill);
+	if (ns >= full / config->governor_rate)
+		key->tokens = full;
+	else
+		key->tokens = min(full,
+		                  key->tokens + ns * config->governor_rate);
+	if (timespec_greater(tv, &key->refill))
+		key->refill = *tv;
+	return key->tokens == full;
+}
+
+static void
+governor_evict(governor_key_t *key) {
+	tommy_hashinc_remove_existing(&keys, &key->node);
+	tommy_list_remove_existing(&keylist, &key->lnode);
+	intern_free(key->path);
+	free(key);
+}
+
+/*
+ * Log the summaries that are due, or all pending summaries if all is set,
+ * and evict idle keys.
+ */
+static void
+governor_sweep(struct timespec *tv, bool all) {
+	tommy_node *node;
+	governor_key_t *key;
+
+	node = tommy_list_head(&keylist);
+	while (node) {
+		key = node->data;
+		node = node->next;
+		if (key->count > 0 && (all ||
+		    timespec_greater_plus(tv, &key->first,
+		                          config->governor_interval)))
+			governor_summarize(key, tv);
+		if (key->count == 0 && governor_refill(key, tv))
+			governor_evict(key);
+	}
+	next_sweep = *tv;
+	next_sweep.tv_sec++;
+}
+
+static governor_key_t *
+governor_key(char *path, uint64_t code, struct timespec *tv) {
+	governor_key_t *key;
+	governor_arg_t arg = {path, code};
+	tommy_hash_t h;
+
+	h = governor_hash(path, code);
+	key = tommy_hashinc_search(&keys, governor_key_cmp, &arg, h);
+	if (key)
+		return key;
+
+	if (tommy_hashinc_count(&keys) >= GOVERNOR_KEYS_MAX)
+		return NULL;
+	key = malloc(sizeof(governor_key_t));
+	if (!key)
+		return NULL;
+	bzero(key, sizeof(governor_key_t));
+	key->path = intern_ref(path);
+	key->code = code;
+	key->tokens = config->governor_burst * GOVERNOR_TOKEN;
+	key->refill = *tv;
+	tommy_hashinc_insert(&keys, &key->node, key, h);
+	tommy_list_insert_tail(&keylist, &key->lnode, key);
+	return key;
+}
+
+/*
+ * Pass hdr on to the log stage or suppress and free it.
+ */
+void
+governor_submit(logevt_header_t *hdr) {
+	const image_exec_t *image = hdr->affinity;
+	governor_key_t *key;
+
+	if (config->governor_rate == 0) {
+		log_submit(hdr);
+		return;
+	}
+	if (hdr->code == LOGEVT_XNUMON_OPS) {
+		governor_sweep(&hdr->tv, true);
+		log_submit(hdr);
+		return;
+	}
+	if (!LOGEVT_WANT(GOVERNED, LOGEVT_FLAG(hdr->code)) ||
+	    !image || !image->path) {
+		log_submit(hdr);
+		return;
+	}
+
+	if (!timespec_greater(&next_sweep, &hdr->tv))
+		governor_sweep(&hdr->tv, false);
+	key = governor_key(image->path, hdr->code, &hdr->tv);
+	if (!key) {
+		untracked++;
+		log_submit(hdr);
+		return;
+	}
+
+	(void)governor_refill(key, &hdr->tv);
+	if (key->tokens >= GOVERNOR_TOKEN) {
+		key->tokens -= GOVERNOR_TOKEN;
+		log_submit(hdr);
+		return;
+	}
+	if (key->count == 0)
+		key->first = hdr->tv;
+	key->last = hdr->tv;
+	key->count++;
+	suppressed[hdr->code]++;
+	if (timespec_greater_plus(&hdr->tv, &key->first,
+	                          config->governor_interval))
+		governor_summarize(key, &hdr->tv);
+	hdr->le_free(hdr);
+}
+
+void
+governor_init(config_t *cfg) {
+	config = cfg;
+	tommy_hashinc_init(&keys);
+	tommy_list_init(&keylist);
+	bzero(&next_sweep, sizeof(next_sweep));
+	untracked = 0;
+	summaries = 0;
+	for (size_t i = 0; i < LOGEVT_SIZE; i++)
+		suppressed[i] = 0;
+}
+
+/*
+ * Log all pending summaries and release all keys.  Must be called while the
+ * log stage is still running.
+ */
+void
+governor_fini(void) {
+	tommy_node *node;
+	governor_key_t *key;
+
+	if (!config)
+		return;
+
+	node = tommy_list_head(&keylist);
+	while (node) {
+		key = node->data;
+		node = node->next;
+		if (key->count > 0)
+			governor_summarize(key, &key->last);
+		governor_evict(key);
+	}
+	assert(tommy_hashinc_count(&keys) == 0);
+	tommy_hashinc_done(&keys);
+	config = NULL;
+}
+
+void
+governor_stats(governor_stat_t *st) {
+	assert(st);
+
+	st->keys = config ? tommy_hashinc_count(&keys) : 0;
+	st->untracked = untracked;
+	st->summaries = summaries;
+	for (size_t i = 0; i < LOGEVT_SIZE; i++)
+		st->suppressed[i] = suppressed[i];
+}
+
@@ -0,0 +1,46 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include "logevt.h"
+#include "config.h"
+#include "attrib.h"
+
+#include <stdint.h>
+#include <time.h>
+
+#define GOVERNOR_KEYS_MAX 16384
+
+typedef struct {
+	logevt_header_t hdr;
+
+	char *path;             /* interned */
+	uint64_t eventcode;     /* of the suppressed events */
+	uint64_t count;
+	struct timespec first;
+	struct timespec last;
+} event_summary_t;
+
+typedef struct {
+	uint32_t keys;
+	uint64_t untracked;     /* passed ungoverned, no key available */
+	uint64_t summaries;
+	uint64_t suppressed[LOGEVT_SIZE];
+} governor_stat_t;
+
+void governor_init(config_t *) NONNULL(1);
+void governor_fini(void);
+void governor_submit(logevt_header_t *) NONNULL(1);
+void governor_stats(governor_stat_t *) NONNULL(1);
+
+#endif
+
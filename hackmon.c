@@ -15,8 +15,15 @@
 #include "hackmon.h"
 
 #include "work.h"
-#include "atomic.h"
+#include "counter.h"
+#include "pool.h"
+#include "time.h"
 
+#include "tommyhash.h"
+#include "tommyhashinc.h"
+#include "tommylist.h"
+
+#include <stdlib.h>
 #include <strings.h>
 #include <assert.h>
 
@@ -24,10 +31,43 @@ static config_t *config;
 
 static uint64_t events_recvd;       /* number of events received */
 static uint64_t events_procd;       /* number of events processed */
-static atomic64_t ooms;             /* counts events impaired due to OOM */
+static counter_t ooms;              /* counts events impaired due to OOM */
+static uint64_t events_folded;      /* accesses folded into a held access */
+#define HACKMON_SLABOBJS        64
+
+static pool_t papool;
+
+/*
+ * Aggregation of process-access events:  if config->process_access_window
+ * is set, the first access of a subject to an object using a given method
+ * is held back for that many seconds, and all further accesses within the
+ * window are folded into it, counting them and recording the time of the
+ * last one.  Debuggers and profilers tend to call task_for_pid on their
+ * target over and over again.  Held events are looked up by subject pid,
+ * object pid and method, such that repeated accesses need neither an
+ * allocation nor image_exec_by_pid; an access is only folded if both pids
+ * still have the images of the held event, otherwise the held event is
+ * submitted and the access starts a new one.  Held events are submitted
+ * when their window expires, when the table is full, or on shutdown; hence
+ * they are logged up to process_access_window seconds out of order.
+ *
+ * Only accessed from the main event loop thread, no locking needed.
+ */
+typedef struct {
+	process_access_t *pa;
+	pid_t subjectpid;
+	pid_t objectpid;
+	tommy_node node;                /* aggrs */
+	tommy_node lnode;               /* aggrlist, in order of first access */
+} hackmon_aggr_t;
+
+#define HACKMON_AGGR_MAX        4096
+
+static tommy_hashinc aggrs;
+static tommy_list aggrlist;
 
-setstr_t *suppress_process_access_by_subject_ident;
-setstr_t *suppress_process_access_by_subject_path;
+setstr_t *_Atomic *suppress_process_access_by_subject_ident;
+setstr_t *_Atomic *suppress_process_access_by_subject_path;
 
 static void process_access_free(process_access_t *);
 static int process_access_work(process_access_t *);
@@ -36,7 +76,7 @@ static process_access_t *
 process_access_new() {
 	process_access_t *pa;
 
-	pa = malloc(sizeof(*pa));
+	pa = pool_alloc(&papool);
 	if (!pa)
 		return NULL;
 	bzero(pa, sizeof(*pa));
@@ -52,7 +92,7 @@ process_access_free(process_access_t *pa) {
 		image_exec_free(pa->subject_image_exec);
 	if (pa->object_image_exec)
 		image_exec_free(pa->object_image_exec);
-	free(pa);
+	pool_free(&papool, pa);
 }
 
 /*
@@ -64,12 +104,117 @@ static int
 process_access_work(process_access_t *pa) {
 	if (pa->subject_image_exec && image_exec_match_suppressions(
 	                              pa->subject_image_exec,
+	                              SUPPRESS_PROCESS_ACCESS,
 	                              suppress_process_access_by_subject_ident,
-	                              suppress_process_access_by_subject_path))
+	                              suppress_process_access_by_subject_path)) {
+		pa->hdr.suppressed = true;
 		return -1;
+	}
 	return 0;
 }
 
+static tommy_hash_t
+hackmon_aggr_hash(pid_t subjectpid, pid_t objectpid, const char *method) {
+	return (tommy_hash_t)tommy_inthash_u64(
+	       ((uint64_t)(uint32_t)subjectpid << 32 | (uint32_t)objectpid) ^
+	       (uintptr_t)method);
+}
+
+static int
+hackmon_aggr_cmp(const void *arg, const void *obj) {
+	const hackmon_aggr_t *a = (const hackmon_aggr_t *)arg;
+	const hackmon_aggr_t *b = (const hackmon_aggr_t *)obj;
+
+	return a->subjectpid != b->subjectpid ||
+	       a->objectpid != b->objectpid ||
+	       a->pa->method != b->pa->method;
+}
+
+static void
+hackmon_aggr_submit(hackmon_aggr_t *aggr) {
+	tommy_hashinc_remove_existing(&aggrs, &aggr->node);
+	tommy_list_remove_existing(&aggrlist, &aggr->lnode);
+	work_submit(aggr->pa);
+	free(aggr);
+}
+
+/*
+ * Submit the held accesses whose window has expired at tv, or all of them
+ * if tv is NULL.
+ */
+void
+hackmon_flush(struct timespec *tv) {
+	hackmon_aggr_t *aggr;
+
+	if (!config)
+		return;
+	while (!tommy_list_empty(&aggrlist)) {
+		aggr = tommy_list_head(&aggrlist)->data;
+		if (tv && !timespec_greater_plus(tv, &aggr->pa->hdr.tv,
+		                                 config->process_access_window))
+			break;
+		hackmon_aggr_submit(aggr);
+	}
+}
+
+/*
+ * Fold the access into a held access and return true, or return false if
+ * there is no held access with the same subject and object images.
+ */
+static bool
+hackmon_fold(struct timespec *tv, pid_t subjectpid, pid_t objectpid,
+             const char *method) {
+	process_access_t key_pa;
+	hackmon_aggr_t key, *aggr;
+
+	hackmon_flush(tv);
+	key_pa.method = method;
+	key.pa = &key_pa;
+	key.subjectpid = subjectpid;
+	key.objectpid = objectpid;
+	aggr = tommy_hashinc_search(&aggrs, hackmon_aggr_cmp, &key,
+	                            hackmon_aggr_hash(subjectpid, objectpid,
+	                                              method));
+	if (!aggr)
+		return false;
+	if (image_exec_peek(subjectpid) != aggr->pa->subject_image_exec ||
+	    image_exec_peek(objectpid) != aggr->pa->object_image_exec) {
+		/* either pid has exec'd or was reused since */
+		hackmon_aggr_submit(aggr);
+		return false;
+	}
+	aggr->pa->count++;
+	aggr->pa->last = *tv;
+	events_folded++;
+	return true;
+}
+
+/*
+ * Hold pa for the accesses to follow.
+ */
+static void
+hackmon_aggregate(process_access_t *pa, pid_t subjectpid, pid_t objectpid) {
+	hackmon_aggr_t *aggr;
+
+	pa->count = 1;
+	pa->last = pa->hdr.tv;
+	if (tommy_hashinc_count(&aggrs) >= HACKMON_AGGR_MAX)
+		hackmon_aggr_submit(tommy_list_head(&aggrlist)->data);
+	aggr = malloc(sizeof(hackmon_aggr_t));
+	if (!aggr) {
+		counter_inc(&ooms);
+		work_submit(pa);
+		return;
+	}
+	aggr->pa = pa;
+	aggr->subjectpid = subjectpid;
+	aggr->objectpid = objectpid;
+	tommy_hashinc_insert(&aggrs, &aggr->node, aggr,
+	                     hackmon_aggr_hash(subjectpid, objectpid,
+	                                       pa->method));
+	tommy_list_insert_tail(&aggrlist, &aggr->lnode, aggr);
+}
+
 static void
 log_event_process_access(struct timespec *tv,
                          audit_proc_t *subject,
@@ -78,9 +223,12 @@ log_event_process_access(struct timespec *tv,
                          const char *method) {
 	process_access_t *pa;
 
+	if (config->process_access_window > 0 &&
+	    hackmon_fold(tv, subject->pid, objectpid, method))
+		return;
 	pa = process_access_new();
 	if (!pa) {
-		atomic64_inc(&ooms);
+		counter_inc(&ooms);
 		return;
 	}
 	pa->subject_image_exec = image_exec_by_pid(subject->pid, tv);
@@ -93,7 +241,14 @@ log_event_process_access(struct timespec *tv,
 	}
 	pa->method = method;
 	pa->hdr.tv = *tv;
-	work_submit(pa);
+	pa->hdr.affinity = pa->subject_image_exec;
+	pa->hdr.priority = !pa->subject_image_exec ||
+	                   image_exec_settled(pa->subject_image_exec);
+	if (config->process_access_window > 0 &&
+	    pa->subject_image_exec && pa->object_image_exec)
+		hackmon_aggregate(pa, subject->pid, objectpid);
+	else
+		work_submit(pa);
 }
 
 static void
@@ -135,22 +290,41 @@ hackmon_ptrace(struct timespec *tv,
 	hackmon_process_access(tv, subject, object, objectpid, "ptrace");
 }
 
-void
+int
 hackmon_init(config_t *cfg) {
+	if (pool_init(&papool, "process_access", sizeof(process_access_t),
+	              HACKMON_SLABOBJS) == -1)
+		return -1;
 	config = cfg;
-	ooms = 0;
+	counter_reset(&ooms);
 	events_recvd = 0;
 	events_procd = 0;
+	events_folded = 0;
+	tommy_hashinc_init(&aggrs);
+	tommy_list_init(&aggrlist);
 	suppress_process_access_by_subject_ident =
 		&cfg->suppress_process_access_by_subject_ident;
 	suppress_process_access_by_subject_path =
 		&cfg->suppress_process_access_by_subject_path;
+	return 0;
 }
 
 void
 hackmon_fini(void) {
+	hackmon_aggr_t *aggr;
+
 	if (!config)
 		return;
+	/* held accesses are normally flushed before the work stage stops */
+	while (!tommy_list_empty(&aggrlist)) {
+		aggr = tommy_list_head(&aggrlist)->data;
+		tommy_hashinc_remove_existing(&aggrs, &aggr->node);
+		tommy_list_remove_existing(&aggrlist, &aggr->lnode);
+		process_access_free(aggr->pa);
+		free(aggr);
+	}
+	tommy_hashinc_done(&aggrs);
+	pool_destroy(&papool);
 	config = NULL;
 }
 
@@ -160,6 +334,8 @@ hackmon_stats(hackmon_stat_t *st) {
 
 	st->recvd = events_recvd;
 	st->procd = events_procd;
-	st->ooms = (uint64_t)ooms;
+	st->ooms = counter_get(&ooms);
+	st->folded = events_folded;
+	st->held = tommy_hashinc_count(&aggrs);
 }
 
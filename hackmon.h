@@ -24,6 +24,8 @@ typedef struct {
 	uint64_t recvd;
 	uint64_t procd;
 	uint64_t ooms;
+	uint64_t folded;                /* accesses folded into another */
+	uint32_t held;                  /* accesses waiting for more */
 } hackmon_stat_t;
 
 typedef struct {
@@ -34,6 +36,8 @@ typedef struct {
 	image_exec_t *subject_image_exec;
 	image_exec_t *object_image_exec;
 	const char *method; /* "ptrace" or "task_for_pid" */
+	uint64_t count;     /* aggregated accesses, 0 if not aggregated */
+	struct timespec last; /* time of last aggregated access */
 } process_access_t;
 
 void hackmon_taskforpid(struct timespec *, audit_proc_t *, audit_proc_t *,
@@ -41,7 +45,9 @@ void hackmon_taskforpid(struct timespec *, audit_proc_t *, audit_proc_t *,
 void hackmon_ptrace(struct timespec *, audit_proc_t *, audit_proc_t *,
                     pid_t) NONNULL(1,2);
 
-void hackmon_init(config_t *) NONNULL(1);
+void hackmon_flush(struct timespec *);
+
+int hackmon_init(config_t *) WUNRES NONNULL(1);
 void hackmon_fini(void);
 void hackmon_stats(hackmon_stat_t *) NONNULL(1);
 
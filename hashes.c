@@ -9,13 +9,30 @@
  */
 
 #include "hashes.h"
+#include "blake3.h"
+#include "time.h"
+#include "minmax.h"
 #include "map.h"
+#include "counter.h"
+#include "attrib.h"
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sysctl.h>
+#include <arpa/inet.h>
+#include <mach/machine.h>
+#include <mach-o/fat.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <setjmp.h>
 #include <assert.h>
 #include <string.h>
+#include <errno.h>
 
 #ifdef USE_OPENSSL
 #include <openssl/md5.h>
@@ -50,6 +67,68 @@
 
 #define RDBUFSZ 1024*32
 
+/*
+ * Files smaller than this are always hashed serially, since starting the
+ * digest threads would cost more than it saves.
+ */
+#define HASHES_PARALLEL_MIN     (1024*1024)
+
+/*
+ * Files smaller than this are always read into a buffer, since mapping and
+ * unmapping them would cost more than copying them.
+ */
+#define HASHES_MMAP_MIN         (1024*64)
+
+/*
+ * Files of nocache_min bytes or more are read bypassing the buffer cache
+ * using F_NOCACHE, such that hashing a huge executable does not evict the
+ * cached pages of everything else.  Since uncached reads go to disk every
+ * time, they are done in page aligned chunks of at least this size, and the
+ * kernel is advised to read ahead the next chunk using F_RDADVISE while the
+ * current one is digested.  Uncached files are never mapped.
+ */
+#define HASHES_NOCACHE_CHUNKSZ  (1024*1024)
+
+static size_t chunksz = HASHES_CHUNKSZ_DEFAULT;
+static bool parallel = false;
+static bool use_mmap = false;
+static size_t nocache_min = 0;
+
+static counter_t stat_files;
+static counter_t stat_bytes;
+static counter_t stat_nsecs;
+static counter_t stat_parallel;
+static counter_t stat_mapped;
+static counter_t stat_mapfaults;
+static counter_t stat_leaves;
+static counter_t stat_reused;
+static counter_t stat_nocache;
+static counter_t stat_readbytes;
+static counter_t stat_mappedbytes;
+static counter_t stat_nocachebytes;
+static counter_t stat_slices;
+static counter_t stat_slicebytes;
+
+/*
+ * Read the next chunk of `fd'.  For uncached reads, first advise the kernel
+ * to read ahead the chunk following this one.
+ */
+static ssize_t
+hashes_read(int fd, unsigned char *buf, size_t bufsz, bool nocache) {
+	struct radvisory ra;
+	off_t off;
+
+	if (nocache) {
+		off = lseek(fd, 0, SEEK_CUR);
+		if (off != -1) {
+			ra.ra_offset = off + (off_t)bufsz;
+			ra.ra_count = (int)bufsz;
+			(void)fcntl(fd, F_RDADVISE, &ra);
+		}
+	}
+	return read(fd, buf, bufsz);
+}
+
 #define CTX(H)          H##_ctx_t H##ctx;
 #define INIT(H)         H##_init(&H##ctx);
 #define UPDATE(H)       H##_update(&H##ctx, buf, n);
@@ -57,15 +136,15 @@
 
 #define HASHES_FD(N,...)                                        \
 static int                                                      \
-hashes_fd_##N(off_t *sz, hashes_t *hashes, int fd) {            \
-	unsigned char buf[RDBUFSZ];                             \
+hashes_fd_##N(off_t *sz, hashes_t *hashes, int fd,              \
+              unsigned char *buf, size_t bufsz, bool nocache) { \
 	ssize_t n;                                              \
 	off_t count;                                            \
 	MAP(CTX, __VA_ARGS__)                                   \
 	count = 0;                                              \
 	MAP(INIT, __VA_ARGS__)                                  \
 	for (;;) {                                              \
-		n = read(fd, buf, sizeof(buf));                 \
+		n = hashes_read(fd, buf, bufsz, nocache);       \
 		if (n == 0)                                     \
 			break;                                  \
 		else if (n == -1) {                             \
@@ -87,28 +166,1433 @@ HASHES_FD(md5_sha1, md5, sha1)
 HASHES_FD(sha1_sha256, sha1, sha256)
 HASHES_FD(md5_sha256, md5, sha256)
 HASHES_FD(md5_sha1_sha256, md5, sha1, sha256)
+HASHES_FD(blake3, blake3)
+HASHES_FD(md5_blake3, md5, blake3)
+HASHES_FD(sha1_blake3, sha1, blake3)
+HASHES_FD(sha256_blake3, sha256, blake3)
+HASHES_FD(md5_sha1_blake3, md5, sha1, blake3)
+HASHES_FD(sha1_sha256_blake3, sha1, sha256, blake3)
+HASHES_FD(md5_sha256_blake3, md5, sha256, blake3)
+HASHES_FD(md5_sha1_sha256_blake3, md5, sha1, sha256, blake3)
 
-int
-hashes_fd(off_t *sz, hashes_t *hashes, int flags, int fd) {
+/*
+ * Hashing of memory-mapped files is done in chunks of `bufsz' bytes, which
+ * keeps each chunk in cache while all hash algorithms are run over it and
+ * keeps the length argument within the range of CC_LONG.
+ */
+#define MEMUPDATE(H)    H##_update(&H##ctx, p + off, n);
+
+#define HASHES_MEM(N,...)                                       \
+static void                                                     \
+hashes_mem_##N(hashes_t *hashes, const unsigned char *p,        \
+               size_t size, size_t bufsz) {                     \
+	size_t off, n;                                          \
+	MAP(CTX, __VA_ARGS__)                                   \
+	MAP(INIT, __VA_ARGS__)                                  \
+	for (off = 0; off < size; off += n) {                   \
+		n = min(size - off, bufsz);                     \
+		MAP(MEMUPDATE, __VA_ARGS__)                     \
+	}                                                       \
+	MAP(FINAL, __VA_ARGS__)                                 \
+}
+
+HASHES_MEM(md5, md5)
+HASHES_MEM(sha1, sha1)
+HASHES_MEM(sha256, sha256)
+HASHES_MEM(md5_sha1, md5, sha1)
+HASHES_MEM(sha1_sha256, sha1, sha256)
+HASHES_MEM(md5_sha256, md5, sha256)
+HASHES_MEM(md5_sha1_sha256, md5, sha1, sha256)
+HASHES_MEM(blake3, blake3)
+HASHES_MEM(md5_blake3, md5, blake3)
+HASHES_MEM(sha1_blake3, sha1, blake3)
+HASHES_MEM(sha256_blake3, sha256, blake3)
+HASHES_MEM(md5_sha1_blake3, md5, sha1, blake3)
+HASHES_MEM(sha1_sha256_blake3, sha1, sha256, blake3)
+HASHES_MEM(md5_sha256_blake3, md5, sha256, blake3)
+HASHES_MEM(md5_sha1_sha256_blake3, md5, sha1, sha256, blake3)
+
+static void
+hashes_mem_serial(hashes_t *hashes, int flags, const unsigned char *p,
+                  size_t size, size_t bufsz) {
+	switch (flags) {
+	case HASH_MD5:
+		hashes_mem_md5(hashes, p, size, bufsz);
+		break;
+	case HASH_SHA1:
+		hashes_mem_sha1(hashes, p, size, bufsz);
+		break;
+	case HASH_SHA256:
+		hashes_mem_sha256(hashes, p, size, bufsz);
+		break;
+	case HASH_MD5_SHA1:
+		hashes_mem_md5_sha1(hashes, p, size, bufsz);
+		break;
+	case HASH_SHA1_SHA256:
+		hashes_mem_sha1_sha256(hashes, p, size, bufsz);
+		break;
+	case HASH_MD5_SHA256:
+		hashes_mem_md5_sha256(hashes, p, size, bufsz);
+		break;
+	case HASH_MD5_SHA1_SHA256:
+		hashes_mem_md5_sha1_sha256(hashes, p, size, bufsz);
+		break;
+	case HASH_BLAKE3:
+		hashes_mem_blake3(hashes, p, size, bufsz);
+		break;
+	case HASH_MD5|HASH_BLAKE3:
+		hashes_mem_md5_blake3(hashes, p, size, bufsz);
+		break;
+	case HASH_SHA1|HASH_BLAKE3:
+		hashes_mem_sha1_blake3(hashes, p, size, bufsz);
+		break;
+	case HASH_SHA256|HASH_BLAKE3:
+		hashes_mem_sha256_blake3(hashes, p, size, bufsz);
+		break;
+	case HASH_MD5_SHA1|HASH_BLAKE3:
+		hashes_mem_md5_sha1_blake3(hashes, p, size, bufsz);
+		break;
+	case HASH_SHA1_SHA256|HASH_BLAKE3:
+		hashes_mem_sha1_sha256_blake3(hashes, p, size, bufsz);
+		break;
+	case HASH_MD5_SHA256|HASH_BLAKE3:
+		hashes_mem_md5_sha256_blake3(hashes, p, size, bufsz);
+		break;
+	case HASH_MD5_SHA1_SHA256|HASH_BLAKE3:
+		hashes_mem_md5_sha1_sha256_blake3(hashes, p, size, bufsz);
+		break;
+	}
+}
+
+static int
+hashes_fd_serial(off_t *sz, hashes_t *hashes, int flags, int fd,
+                 unsigned char *buf, size_t bufsz, bool nocache) {
 	switch (flags) {
 	case HASH_MD5:
-		return hashes_fd_md5(sz, hashes, fd);
+		return hashes_fd_md5(sz, hashes, fd, buf, bufsz, nocache);
 	case HASH_SHA1:
-		return hashes_fd_sha1(sz, hashes, fd);
+		return hashes_fd_sha1(sz, hashes, fd, buf, bufsz, nocache);
 	case HASH_SHA256:
-		return hashes_fd_sha256(sz, hashes, fd);
+		return hashes_fd_sha256(sz, hashes, fd, buf, bufsz, nocache);
 	case HASH_MD5_SHA1:
-		return hashes_fd_md5_sha1(sz, hashes, fd);
+		return hashes_fd_md5_sha1(sz, hashes, fd, buf, bufsz, nocache);
 	case HASH_SHA1_SHA256:
-		return hashes_fd_sha1_sha256(sz, hashes, fd);
+		return hashes_fd_sha1_sha256(sz, hashes, fd, buf, bufsz,
+		                             nocache);
 	case HASH_MD5_SHA256:
-		return hashes_fd_md5_sha256(sz, hashes, fd);
+		return hashes_fd_md5_sha256(sz, hashes, fd, buf, bufsz,
+		                            nocache);
 	case HASH_MD5_SHA1_SHA256:
-		return hashes_fd_md5_sha1_sha256(sz, hashes, fd);
+		return hashes_fd_md5_sha1_sha256(sz, hashes, fd, buf, bufsz,
+		                                 nocache);
+	case HASH_BLAKE3:
+		return hashes_fd_blake3(sz, hashes, fd, buf, bufsz, nocache);
+	case HASH_MD5|HASH_BLAKE3:
+		return hashes_fd_md5_blake3(sz, hashes, fd, buf, bufsz,
+		                            nocache);
+	case HASH_SHA1|HASH_BLAKE3:
+		return hashes_fd_sha1_blake3(sz, hashes, fd, buf, bufsz,
+		                             nocache);
+	case HASH_SHA256|HASH_BLAKE3:
+		return hashes_fd_sha256_blake3(sz, hashes, fd, buf, bufsz,
+		                               nocache);
+	case HASH_MD5_SHA1|HASH_BLAKE3:
+		return hashes_fd_md5_sha1_blake3(sz, hashes, fd, buf, bufsz,
+		                                 nocache);
+	case HASH_SHA1_SHA256|HASH_BLAKE3:
+		return hashes_fd_sha1_sha256_blake3(sz, hashes, fd, buf, bufsz,
+		                                    nocache);
+	case HASH_MD5_SHA256|HASH_BLAKE3:
+		return hashes_fd_md5_sha256_blake3(sz, hashes, fd, buf, bufsz,
+		                                   nocache);
+	case HASH_MD5_SHA1_SHA256|HASH_BLAKE3:
+		return hashes_fd_md5_sha1_sha256_blake3(sz, hashes, fd, buf,
+		                                        bufsz, nocache);
 	}
 	return -1;
 }
 
+/*
+ * Parallel hashing:  the calling thread reads the file into two alternating
+ * chunk buffers, while one digest thread per configured hash algorithm
+ * consumes them.  A buffer is refilled once all digest threads are done with
+ * it, so reading the next chunk overlaps with digesting the current one.
+ * A chunk length of 0 signals end of file, -1 a read error.
+ */
+
+typedef struct {
+	unsigned char *buf[2];
+	ssize_t len[2];
+	uint64_t seq[2];                /* chunk number held by buffer */
+	int pending[2];                 /* digest threads not done with buffer */
+	pthread_mutex_t mutex;
+	pthread_cond_t filled;
+	pthread_cond_t drained;
+} hashes_pipe_t;
+
+typedef struct {
+	hashes_pipe_t *pipe;
+	hashes_t *hashes;
+	int flag;
+	pthread_t thr;
+} hashes_digest_t;
+
+static void *
+hashes_digest_thread(void *arg) {
+	hashes_digest_t *dig = arg;
+	hashes_pipe_t *pipe = dig->pipe;
+	hashes_t *hashes = dig->hashes;
+	unsigned char *buf;
+	ssize_t n;
+	union {
+		md5_ctx_t md5;
+		sha1_ctx_t sha1;
+		sha256_ctx_t sha256;
+		blake3_ctx_t blake3;
+	} ctx;
+
+	switch (dig->flag) {
+	case HASH_MD5:
+		md5_init(&ctx.md5);
+		break;
+	case HASH_SHA1:
+		sha1_init(&ctx.sha1);
+		break;
+	case HASH_SHA256:
+		sha256_init(&ctx.sha256);
+		break;
+	case HASH_BLAKE3:
+		blake3_init(&ctx.blake3);
+		break;
+	}
+	for (uint64_t i = 0;; i++) {
+		int b = i & 1;
+		pthread_mutex_lock(&pipe->mutex);
+		while (pipe->seq[b] != i)
+			pthread_cond_wait(&pipe->filled, &pipe->mutex);
+		n = pipe->len[b];
+		buf = pipe->buf[b];
+		pthread_mutex_unlock(&pipe->mutex);
+		if (n <= 0)
+			break;
+		switch (dig->flag) {
+		case HASH_MD5:
+			md5_update(&ctx.md5, buf, n);
+			break;
+		case HASH_SHA1:
+			sha1_update(&ctx.sha1, buf, n);
+			break;
+		case HASH_SHA256:
+			sha256_update(&ctx.sha256, buf, n);
+			break;
+		case HASH_BLAKE3:
+			blake3_update(&ctx.blake3, buf, n);
+			break;
+		}
+		pthread_mutex_lock(&pipe->mutex);
+		if (--pipe->pending[b] == 0)
+			pthread_cond_signal(&pipe->drained);
+		pthread_mutex_unlock(&pipe->mutex);
+	}
+	if (n == 0) {
+		switch (dig->flag) {
+		case HASH_MD5:
+			md5_final(hashes->md5, &ctx.md5);
+			break;
+		case HASH_SHA1:
+			sha1_final(hashes->sha1, &ctx.sha1);
+			break;
+		case HASH_SHA256:
+			sha256_final(hashes->sha256, &ctx.sha256);
+			break;
+		case HASH_BLAKE3:
+			blake3_final(hashes->blake3, &ctx.blake3);
+			break;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Publish chunk `i' of length `n' in buffer `b' to the digest threads.
+ */
+static void
+hashes_pipe_publish(hashes_pipe_t *pipe, uint64_t i, ssize_t n, int ndigs) {
+	int b = i & 1;
+
+	pthread_mutex_lock(&pipe->mutex);
+	pipe->len[b] = n;
+	pipe->pending[b] = ndigs;
+	pipe->seq[b] = i;
+	pthread_cond_broadcast(&pipe->filled);
+	pthread_mutex_unlock(&pipe->mutex);
+}
+
+/*
+ * Returns -1 with errno EAGAIN if the digest threads could not be started,
+ * in which case nothing has been read from `fd' and the caller should fall
+ * back to serial hashing.
+ */
+static int
+hashes_fd_parallel(off_t *sz, hashes_t *hashes, int flags, int fd,
+                   unsigned char *buf, size_t bufsz, bool nocache) {
+	static const int algos[] = {HASH_MD5, HASH_SHA1, HASH_SHA256,
+	                            HASH_BLAKE3};
+	hashes_digest_t digs[sizeof(algos)/sizeof(algos[0])];
+	hashes_pipe_t pipe;
+	int ndigs = 0;
+	off_t count = 0;
+	ssize_t n;
+	uint64_t i;
+
+	bzero(&pipe, sizeof(pipe));
+	pipe.buf[0] = buf;
+	pipe.buf[1] = buf + bufsz;
+	pipe.seq[0] = UINT64_MAX;
+	pipe.seq[1] = UINT64_MAX;
+	pthread_mutex_init(&pipe.mutex, NULL);
+	pthread_cond_init(&pipe.filled, NULL);
+	pthread_cond_init(&pipe.drained, NULL);
+
+	for (size_t j = 0; j < sizeof(algos)/sizeof(algos[0]); j++) {
+		if (!(flags & algos[j]))
+			continue;
+		digs[ndigs].pipe = &pipe;
+		digs[ndigs].hashes = hashes;
+		digs[ndigs].flag = algos[j];
+		if (pthread_create(&digs[ndigs].thr, NULL,
+		                   hashes_digest_thread, &digs[ndigs]) != 0) {
+			hashes_pipe_publish(&pipe, 0, -1, ndigs);
+			n = -2;
+			goto out;
+		}
+		ndigs++;
+	}
+
+	for (i = 0;; i++) {
+		int b = i & 1;
+		pthread_mutex_lock(&pipe.mutex);
+		while (pipe.pending[b] > 0)
+			pthread_cond_wait(&pipe.drained, &pipe.mutex);
+		pthread_mutex_unlock(&pipe.mutex);
+		n = hashes_read(fd, pipe.buf[b], bufsz, nocache);
+		hashes_pipe_publish(&pipe, i, n, ndigs);
+		if (n <= 0)
+			break;
+		count += n;
+	}
+
+out:
+	for (int j = 0; j < ndigs; j++)
+		pthread_join(digs[j].thr, NULL);
+	pthread_cond_destroy(&pipe.drained);
+	pthread_cond_destroy(&pipe.filled);
+	pthread_mutex_destroy(&pipe.mutex);
+	if (n == -2) {
+		errno = EAGAIN;
+		return -1;
+	}
+	if (n == -1) {
+		bzero(hashes, sizeof(hashes_t));
+		return -1;
+	}
+	*sz = count;
+	return 0;
+}
+
+/*
+ * The pages of a mapped file are only read when they are digested, long
+ * after mmap(2) returned.  If the file is truncated in the meantime, for
+ * instance by the user who just executed it, touching the pages beyond the
+ * new end of file raises SIGBUS.  All passes over a mapping therefore run
+ * under a guard of the thread running them:  the SIGBUS handler installed by
+ * hashes_init jumps back to the guard if the fault address lies within the
+ * guarded mapping, and the caller falls back to read(2).  Any other SIGBUS
+ * still terminates the process.  Guarded passes only digest the mapping and
+ * must not hold locks while touching it.
+ */
+typedef struct {
+	sigjmp_buf env;
+	const unsigned char *p;
+	size_t size;
+} hashes_guard_t;
+
+static _Thread_local hashes_guard_t *volatile guard;
+
+static void
+hashes_sigbus(int sig, siginfo_t *si, UNUSED void *uctx) {
+	hashes_guard_t *g = guard;
+	const unsigned char *addr = si->si_addr;
+
+	if (g && addr >= g->p && addr < g->p + g->size)
+		siglongjmp(g->env, 1);
+	(void)signal(sig, SIG_DFL);
+	(void)raise(sig);
+}
+
+/*
+ * Run func(arg) over the size bytes mapped at p.  Returns -1 if it was
+ * aborted by a fault within the mapping, 0 otherwise.
+ */
+static int
+hashes_guarded(const unsigned char *p, size_t size, void (*func)(void *),
+               void *arg) {
+	hashes_guard_t g;
+
+	g.p = p;
+	g.size = size;
+	if (sigsetjmp(g.env, 1)) {
+		guard = NULL;
+		counter_inc(&stat_mapfaults);
+		return -1;
+	}
+	guard = &g;
+	func(arg);
+	guard = NULL;
+	return 0;
+}
+
+/*
+ * Parallel hashing of a memory-mapped file:  each hash algorithm runs over
+ * the whole mapping on its own thread, the last one on the calling thread.
+ * Algorithms for which no thread could be started run on the calling thread.
+ */
+
+typedef struct {
+	hashes_t *hashes;
+	int flag;
+	const unsigned char *p;
+	size_t size;
+	pthread_t thr;
+	int rv;
+} hashes_memdigest_t;
+
+static void
+hashes_memdigest_run(void *arg) {
+	hashes_memdigest_t *dig = arg;
+
+	hashes_mem_serial(dig->hashes, dig->flag, dig->p, dig->size, chunksz);
+}
+
+static void *
+hashes_memdigest_thread(void *arg) {
+	hashes_memdigest_t *dig = arg;
+
+	dig->rv = hashes_guarded(dig->p, dig->size, hashes_memdigest_run, dig);
+	return NULL;
+}
+
+static int
+hashes_mem_parallel(hashes_t *hashes, int flags, const unsigned char *p,
+                    size_t size) {
+	static const int algos[] = {HASH_MD5, HASH_SHA1, HASH_SHA256,
+	                            HASH_BLAKE3};
+	hashes_memdigest_t digs[sizeof(algos)/sizeof(algos[0])];
+	hashes_memdigest_t self;
+	int ndigs = 0;
+	int local = 0;
+	int rv;
+
+	for (size_t j = 0; j < sizeof(algos)/sizeof(algos[0]); j++) {
+		if (!(flags & algos[j]))
+			continue;
+		flags &= ~algos[j];
+		if (!flags) {
+			local |= algos[j];
+			break;
+		}
+		digs[ndigs].hashes = hashes;
+		digs[ndigs].flag = algos[j];
+		digs[ndigs].p = p;
+		digs[ndigs].size = size;
+		if (pthread_create(&digs[ndigs].thr, NULL,
+		                   hashes_memdigest_thread, &digs[ndigs]) != 0) {
+			local |= algos[j];
+			continue;
+		}
+		ndigs++;
+	}
+	self.hashes = hashes;
+	self.flag = local;
+	self.p = p;
+	self.size = size;
+	rv = hashes_guarded(p, size, hashes_memdigest_run, &self);
+	for (int j = 0; j < ndigs; j++) {
+		pthread_join(digs[j].thr, NULL);
+		if (digs[j].rv == -1)
+			rv = -1;
+	}
+	return rv;
+}
+
+/*
+ * The sha256tree root is streamed from the leaf digests, so computing it
+ * needs no memory beyond a single block.  For files of at least
+ * HASHES_TREE_MIN bytes hashed by path, the leaf digests are remembered
+ * along with a fingerprint of each block, for the last HASHES_TREES_MAX
+ * such paths.  When the file at a remembered path is hashed again, every
+ * block is still read and fingerprinted, but only the blocks whose
+ * fingerprint or length changed are digested; for large binaries replaced
+ * by updates that touch few blocks, this saves most of the digesting.
+ *
+ * Fingerprints are SipHash-2-4 under a random key generated at startup,
+ * such that a block cannot be crafted to collide with the fingerprint of
+ * another without knowing the key.  A collision would carry the digest of
+ * the old block over to the new block, so unkeyed fast hashes are not
+ * sufficient here.
+ */
+#define HASHES_TREE_MIN         (4*HASHES_TREE_LEAFSZ)
+#define HASHES_TREES_MAX        64
+
+typedef struct hashes_tree {
+	struct hashes_tree *next;
+	char *path;
+	off_t size;
+	size_t leaves;
+	size_t cap;
+	uint64_t *fp;
+	unsigned char (*leaf)[SHA256SZ];
+} hashes_tree_t;
+
+typedef struct {
+	sha256_ctx_t root;
+	hashes_tree_t *old;             /* remembered for path, or NULL */
+	hashes_tree_t *tree;            /* to be remembered, or NULL */
+	size_t leaves;
+} hashes_treebuild_t;
+
+static uint64_t tree_key[2];
+static hashes_tree_t *trees;            /* most recently used first */
+static size_t ntrees;
+static pthread_mutex_t trees_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define ROTL(X,B)       (((X) << (B)) | ((X) >> (64 - (B))))
+#define SIPROUND                                                \
+	do {                                                    \
+		v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0;          \
+		v0 = ROTL(v0, 32);                              \
+		v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;          \
+		v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;          \
+		v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2;          \
+		v2 = ROTL(v2, 32);                              \
+	} while (0)
+
+static uint64_t
+hashes_siphash(const unsigned char *p, size_t size) {
+	uint64_t v0 = 0x736f6d6570736575ULL ^ tree_key[0];
+	uint64_t v1 = 0x646f72616e646f6dULL ^ tree_key[1];
+	uint64_t v2 = 0x6c7967656e657261ULL ^ tree_key[0];
+	uint64_t v3 = 0x7465646279746573ULL ^ tree_key[1];
+	uint64_t m, b;
+	size_t off;
+
+	for (off = 0; off + 8 <= size; off += 8) {
+		/* all supported platforms are little endian */
+		memcpy(&m, p + off, 8);
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+	b = (uint64_t)size << 56;
+	for (size_t i = 0; off + i < size; i++)
+		b |= (uint64_t)p[off + i] << (8 * i);
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#undef SIPROUND
+#undef ROTL
+
+static void
+hashes_tree_free(hashes_tree_t *tree) {
+	free(tree->path);
+	free(tree->fp);
+	free(tree->leaf);
+	free(tree);
+}
+
+static hashes_tree_t *
+hashes_tree_new(const char *path, size_t cap) {
+	hashes_tree_t *tree;
+
+	tree = malloc(sizeof(hashes_tree_t));
+	if (!tree)
+		return NULL;
+	bzero(tree, sizeof(hashes_tree_t));
+	tree->path = strdup(path);
+	tree->fp = malloc(cap * sizeof(uint64_t));
+	tree->leaf = malloc(cap * SHA256SZ);
+	if (!tree->path || !tree->fp || !tree->leaf) {
+		hashes_tree_free(tree);
+		return NULL;
+	}
+	tree->cap = cap;
+	return tree;
+}
+
+/*
+ * Remove and return the tree remembered for path, if any.
+ */
+static hashes_tree_t *
+hashes_tree_take(const char *path) {
+	hashes_tree_t **pp, *tree;
+
+	pthread_mutex_lock(&trees_mutex);
+	for (pp = &trees; (tree = *pp); pp = &tree->next) {
+		if (!strcmp(tree->path, path)) {
+			*pp = tree->next;
+			ntrees--;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&trees_mutex);
+	return tree;
+}
+
+static void
+hashes_tree_put(hashes_tree_t *tree) {
+	hashes_tree_t **pp, *evict = NULL;
+
+	pthread_mutex_lock(&trees_mutex);
+	tree->next = trees;
+	trees = tree;
+	if (++ntrees > HASHES_TREES_MAX) {
+		for (pp = &trees; (*pp)->next; pp = &(*pp)->next);
+		evict = *pp;
+		*pp = NULL;
+		ntrees--;
+	}
+	pthread_mutex_unlock(&trees_mutex);
+	if (evict)
+		hashes_tree_free(evict);
+}
+
+/*
+ * Drop all remembered trees, for shedding memory.  Thread-safe.
+ */
+void
+hashes_flush(void) {
+	hashes_tree_t *tree;
+
+	pthread_mutex_lock(&trees_mutex);
+	tree = trees;
+	trees = NULL;
+	ntrees = 0;
+	pthread_mutex_unlock(&trees_mutex);
+	while (tree) {
+		hashes_tree_t *next = tree->next;
+		hashes_tree_free(tree);
+		tree = next;
+	}
+}
+
+/*
+ * Begin a tree over a file of expected size `size', remembered for `path'
+ * unless path is NULL or the file is too small to be worth it.
+ */
+static void
+hashes_tree_begin(hashes_treebuild_t *tb, const char *path, off_t size) {
+	static const unsigned char node = 0x01;
+	size_t cap;
+
+	sha256_init(&tb->root);
+	sha256_update(&tb->root, &node, 1);
+	tb->leaves = 0;
+	tb->old = NULL;
+	tb->tree = NULL;
+	if (!path || size < HASHES_TREE_MIN)
+		return;
+	cap = ((size_t)size + HASHES_TREE_LEAFSZ - 1) / HASHES_TREE_LEAFSZ;
+	tb->old = hashes_tree_take(path);
+	tb->tree = hashes_tree_new(path, cap);
+}
+
+static size_t
+hashes_tree_blocksz(const hashes_tree_t *tree, size_t i) {
+	if (i + 1 < tree->leaves)
+		return HASHES_TREE_LEAFSZ;
+	return (size_t)(tree->size - (off_t)i * HASHES_TREE_LEAFSZ);
+}
+
+/*
+ * Add the next block of `size' bytes at p, which must be HASHES_TREE_LEAFSZ
+ * bytes long unless it is the last block.
+ */
+static void
+hashes_tree_block(void *arg, const unsigned char *p, size_t size) {
+	static const unsigned char leaf = 0x00;
+	hashes_treebuild_t *tb = arg;
+	hashes_tree_t *tree = tb->tree;
+	hashes_tree_t *old = tb->old;
+	unsigned char md[SHA256SZ];
+	sha256_ctx_t ctx;
+	size_t i = tb->leaves++;
+	uint64_t fp = 0;
+	bool reuse;
+
+	/* grown beyond the expected size, stop remembering */
+	if (tree && i == tree->cap) {
+		hashes_tree_free(tree);
+		tb->tree = tree = NULL;
+	}
+	if (tree || old)
+		fp = hashes_siphash(p, size);
+	reuse = old && i < old->leaves && old->fp[i] == fp &&
+	        hashes_tree_blocksz(old, i) == size;
+	if (reuse) {
+		memcpy(md, old->leaf[i], SHA256SZ);
+		counter_inc(&stat_reused);
+	} else {
+		sha256_init(&ctx);
+		sha256_update(&ctx, &leaf, 1);
+		sha256_update(&ctx, p, size);
+		sha256_final(md, &ctx);
+	}
+	counter_inc(&stat_leaves);
+	sha256_update(&tb->root, md, SHA256SZ);
+	if (tree) {
+		tree->fp[i] = fp;
+		memcpy(tree->leaf[i], md, SHA256SZ);
+		tree->leaves++;
+		tree->size += (off_t)size;
+	}
+}
+
+/*
+ * Finish the tree into hashes if ok is true, or discard it.  The previous
+ * tree of the path is replaced on success and restored otherwise.
+ */
+static void
+hashes_tree_end(hashes_treebuild_t *tb, hashes_t *hashes, bool ok) {
+	if (ok) {
+		sha256_final(hashes->sha256tree, &tb->root);
+		if (tb->tree) {
+			hashes_tree_put(tb->tree);
+			if (tb->old)
+				hashes_tree_free(tb->old);
+			return;
+		}
+	} else {
+		bzero(hashes->sha256tree, SHA256SZ);
+	}
+	if (tb->tree)
+		hashes_tree_free(tb->tree);
+	if (tb->old)
+		hashes_tree_put(tb->old);
+}
+
+typedef struct {
+	hashes_treebuild_t tb;
+	const unsigned char *p;
+	size_t size;
+} hashes_memtree_t;
+
+static void
+hashes_mem_blocks(void *arg) {
+	hashes_memtree_t *mt = arg;
+	size_t off, n;
+
+	for (off = 0; off < mt->size; off += n) {
+		n = min(mt->size - off, (size_t)HASHES_TREE_LEAFSZ);
+		hashes_tree_block(&mt->tb, mt->p + off, n);
+	}
+}
+
+static void
+hashes_mem_tree(hashes_t *hashes, const unsigned char *p, size_t size,
+                const char *path) {
+	hashes_memtree_t mt;
+
+	mt.p = p;
+	mt.size = size;
+	hashes_tree_begin(&mt.tb, path, (off_t)size);
+	hashes_mem_blocks(&mt);
+	hashes_tree_end(&mt.tb, hashes, true);
+}
+
+typedef void (hashes_block_func_t)(void *, const unsigned char *, size_t);
+
+/*
+ * Pass the blocks of `fd' from offset `off' to the end of file to `func'
+ * using pread(2), such that it can run as a separate pass after the linear
+ * digests were read.  All blocks are HASHES_TREE_LEAFSZ bytes long except
+ * for the last one.
+ */
+static int
+hashes_fd_blocks(off_t *sz, int fd, off_t off, hashes_block_func_t *func,
+                 void *arg) {
+	unsigned char *buf;
+	size_t fill;
+	off_t count = 0;
+	ssize_t n = 0;
+
+	buf = malloc(HASHES_TREE_LEAFSZ);
+	if (!buf)
+		return -1;
+	for (;;) {
+		fill = 0;
+		while (fill < HASHES_TREE_LEAFSZ) {
+			n = pread(fd, buf + fill, HASHES_TREE_LEAFSZ - fill,
+			          off + count + (off_t)fill);
+			if (n <= 0)
+				break;
+			fill += (size_t)n;
+		}
+		if (n == -1) {
+			free(buf);
+			return -1;
+		}
+		if (fill > 0)
+			func(arg, buf, fill);
+		count += (off_t)fill;
+		if (fill < HASHES_TREE_LEAFSZ)
+			break;
+	}
+	free(buf);
+	*sz = count;
+	return 0;
+}
+
+static int
+hashes_fd_tree(off_t *sz, hashes_t *hashes, int fd, off_t off, off_t size,
+               const char *path) {
+	hashes_treebuild_t tb;
+	int rv;
+
+	hashes_tree_begin(&tb, path, size);
+	rv = hashes_fd_blocks(sz, fd, off, hashes_tree_block, &tb);
+	hashes_tree_end(&tb, hashes, rv == 0);
+	return rv;
+}
+
+/*
+ * The fingerprint chains the SipHash-2-4 of each block, then the file size.
+ */
+static void
+hashes_fp_block(void *arg, const unsigned char *p, size_t size) {
+	uint64_t *acc = arg;
+
+	acc[1] = hashes_siphash(p, size);
+	acc[0] = hashes_siphash((const unsigned char *)acc,
+	                        2 * sizeof(uint64_t));
+}
+
+typedef struct {
+	uint64_t acc[2];
+	const unsigned char *p;
+	size_t size;
+} hashes_memfp_t;
+
+static void
+hashes_mem_fp(void *arg) {
+	hashes_memfp_t *mf = arg;
+	size_t off, n;
+
+	for (off = 0; off < mf->size; off += n) {
+		n = min(mf->size - off, (size_t)HASHES_TREE_LEAFSZ);
+		hashes_fp_block(mf->acc, mf->p + off, n);
+	}
+}
+
+/*
+ * Fast keyed fingerprint of the whole file at `fd', for looking up the
+ * digests of known content before computing any of them.  Costs a single
+ * pass of SipHash-2-4 under the random key used for sha256tree blocks, so
+ * fingerprints are only comparable within the same process and cannot be
+ * forged without the key.  Does not change the file offset.  Mapped files
+ * truncated while being fingerprinted are read again using pread(2).
+ */
+int
+hashes_fp(off_t *sz, uint64_t *fp, int fd) {
+	hashes_memfp_t mf;
+	unsigned char *p;
+	struct stat st;
+	int rv = -1;
+
+	if (fstat(fd, &st) == -1)
+		return -1;
+	p = MAP_FAILED;
+	mf.size = (size_t)st.st_size;
+	if (use_mmap && S_ISREG(st.st_mode) && st.st_size >= HASHES_MMAP_MIN)
+		p = mmap(NULL, mf.size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p != MAP_FAILED) {
+		(void)madvise(p, mf.size, MADV_SEQUENTIAL);
+		mf.acc[0] = mf.acc[1] = 0;
+		mf.p = p;
+		rv = hashes_guarded(p, mf.size, hashes_mem_fp, &mf);
+		munmap(p, mf.size);
+		*sz = st.st_size;
+	}
+	if (rv == -1) {
+		mf.acc[0] = mf.acc[1] = 0;
+		if (hashes_fd_blocks(sz, fd, 0, hashes_fp_block, mf.acc) == -1)
+			return -1;
+	}
+	mf.acc[1] = (uint64_t)*sz;
+	*fp = hashes_siphash((const unsigned char *)mf.acc, sizeof(mf.acc));
+	return 0;
+}
+
+/*
+ * Hash `size' bytes of `fd' by mapping the file read-only instead of copying
+ * it into a buffer.  Returns -1 if the file cannot be mapped or was
+ * truncated while being hashed, in which case the caller should fall back to
+ * read(2).  The sha256tree remembered for path is only replaced on success.
+ */
+static int
+hashes_fd_mmap(off_t *sz, hashes_t *hashes, int flags, int fd, size_t size,
+               bool par, const char *path) {
+	hashes_memdigest_t dig;
+	hashes_memtree_t mt;
+	unsigned char *p;
+	int rv;
+
+	p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED)
+		return -1;
+	(void)madvise(p, size, MADV_SEQUENTIAL);
+	if (par) {
+		rv = hashes_mem_parallel(hashes, flags & HASH_LINEAR, p, size);
+	} else {
+		dig.hashes = hashes;
+		dig.flag = flags & HASH_LINEAR;
+		dig.p = p;
+		dig.size = size;
+		rv = hashes_guarded(p, size, hashes_memdigest_run, &dig);
+	}
+	if (rv == 0 && (flags & HASH_SHA256TREE)) {
+		mt.p = p;
+		mt.size = size;
+		hashes_tree_begin(&mt.tb, path, (off_t)size);
+		rv = hashes_guarded(p, size, hashes_mem_blocks, &mt);
+		hashes_tree_end(&mt.tb, hashes, rv == 0);
+	}
+	munmap(p, size);
+	if (rv == -1)
+		return -1;
+	*sz = (off_t)size;
+	return 0;
+}
+
+/*
+ * Hash `fd' from the current offset to the end of file using read(2).  For
+ * uncached reads, the chunks are page aligned and at least
+ * HASHES_NOCACHE_CHUNKSZ bytes large.
+ */
+static int
+hashes_fd_read(off_t *sz, hashes_t *hashes, int flags, int fd, bool par,
+               bool nocache) {
+	unsigned char stackbuf[RDBUFSZ];
+	unsigned char *buf;
+	size_t bufsz, pgsz;
+	int rv;
+
+	bufsz = chunksz;
+	if (nocache) {
+		pgsz = (size_t)getpagesize();
+		bufsz = max(bufsz, (size_t)HASHES_NOCACHE_CHUNKSZ);
+		bufsz = (bufsz + pgsz - 1) & ~(pgsz - 1);
+		if (posix_memalign((void **)&buf, pgsz,
+		                   par ? 2 * bufsz : bufsz) != 0)
+			return -1;
+	} else if (!par && bufsz <= sizeof(stackbuf)) {
+		buf = stackbuf;
+	} else {
+		buf = malloc(par ? 2 * bufsz : bufsz);
+		if (!buf)
+			return -1;
+	}
+	if (par) {
+		rv = hashes_fd_parallel(sz, hashes, flags, fd, buf, bufsz,
+		                        nocache);
+		if (rv == 0)
+			counter_inc(&stat_parallel);
+		else if (errno == EAGAIN)
+			par = false;
+	}
+	if (!par)
+		rv = hashes_fd_serial(sz, hashes, flags, fd, buf, bufsz,
+		                      nocache);
+	if (buf != stackbuf)
+		free(buf);
+	return rv;
+}
+
+/*
+ * Universal binaries:  hashes_slice locates the slice of a universal binary
+ * that the host runs natively and hashes only that slice.  The slice is
+ * chosen by matching the cputype and cpusubtype of the host exactly, then by
+ * cputype alone, and on arm64 hosts falling back to x86_64 for binaries that
+ * run under Rosetta.  This approximates, but is not guaranteed to match, the
+ * choice made by the kernel when executing the binary.  Java class files
+ * share FAT_MAGIC, but have a version number of at least 45 where universal
+ * binaries have their number of slices.
+ */
+#define HASHES_FAT_ARCHS_MAX    30
+#define HASHES_FAT_HDRSZ        (sizeof(struct fat_header) + \
+                                 HASHES_FAT_ARCHS_MAX * \
+                                 sizeof(struct fat_arch_64))
+
+static cpu_type_t host_cputype = CPU_TYPE_ANY;
+static cpu_subtype_t host_cpusubtype = CPU_SUBTYPE_MULTIPLE;
+
+static void
+hashes_slice_init(void) {
+	size_t sz;
+	int cap64;
+
+	sz = sizeof(host_cputype);
+	if (sysctlbyname("hw.cputype", &host_cputype, &sz, NULL, 0) == -1)
+		host_cputype = CPU_TYPE_ANY;
+	sz = sizeof(cap64);
+	if (sysctlbyname("hw.cpu64bit_capable", &cap64, &sz, NULL, 0) == 0 &&
+	    cap64)
+		host_cputype |= CPU_ARCH_ABI64;
+	sz = sizeof(host_cpusubtype);
+	if (sysctlbyname("hw.cpusubtype", &host_cpusubtype, &sz,
+	                 NULL, 0) == -1)
+		host_cpusubtype = CPU_SUBTYPE_MULTIPLE;
+	host_cpusubtype &= ~CPU_SUBTYPE_MASK;
+}
+
+static uint32_t
+hashes_be32(const unsigned char *p) {
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return ntohl(v);
+}
+
+/*
+ * How well a slice for cputype and cpusubtype fits the host, 0 if not at all.
+ */
+static int
+hashes_slice_rank(cpu_type_t cputype, cpu_subtype_t cpusubtype) {
+	if (cputype == host_cputype)
+		return cpusubtype == host_cpusubtype ? 3 : 2;
+	if (host_cputype == CPU_TYPE_ARM64 && cputype == CPU_TYPE_X86_64)
+		return 1;
+	return 0;
+}
+
+/*
+ * Hash the slice of the universal binary at `fd' of `filesz' bytes that the
+ * host runs natively with SHA-256.  Returns 0 with `slice' filled in, 1 if
+ * the file is not a universal binary or has no slice for the host, and -1
+ * on errors.  Does not change the file offset.
+ */
+int
+hashes_slice(hashes_slice_t *slice, int fd, off_t filesz) {
+	unsigned char hdr[HASHES_FAT_HDRSZ];
+	const unsigned char *p;
+	unsigned char *buf;
+	sha256_ctx_t ctx;
+	uint64_t off, size, done;
+	uint32_t magic, n;
+	size_t entsz;
+	ssize_t got;
+	int rank, best = 0;
+
+	got = pread(fd, hdr, sizeof(hdr), 0);
+	if (got == -1)
+		return -1;
+	if ((size_t)got < sizeof(struct fat_header))
+		return 1;
+	magic = hashes_be32(hdr);
+	n = hashes_be32(hdr + 4);
+	if (magic == FAT_MAGIC)
+		entsz = sizeof(struct fat_arch);
+	else if (magic == FAT_MAGIC_64)
+		entsz = sizeof(struct fat_arch_64);
+	else
+		return 1;
+	if (n == 0 || n > HASHES_FAT_ARCHS_MAX ||
+	    sizeof(struct fat_header) + n * entsz > (size_t)got)
+		return 1;
+
+	bzero(slice, sizeof(hashes_slice_t));
+	for (uint32_t i = 0; i < n; i++) {
+		p = hdr + sizeof(struct fat_header) + i * entsz;
+		rank = hashes_slice_rank((cpu_type_t)hashes_be32(p),
+		                         (cpu_subtype_t)hashes_be32(p + 4) &
+		                         ~CPU_SUBTYPE_MASK);
+		if (rank <= best)
+			continue;
+		best = rank;
+		slice->cputype = (int32_t)hashes_be32(p);
+		slice->cpusubtype = (int32_t)(hashes_be32(p + 4) &
+		                              ~CPU_SUBTYPE_MASK);
+		if (magic == FAT_MAGIC_64) {
+			slice->offset = (uint64_t)hashes_be32(p + 8) << 32 |
+			                hashes_be32(p + 12);
+			slice->size = (uint64_t)hashes_be32(p + 16) << 32 |
+			              hashes_be32(p + 20);
+		} else {
+			slice->offset = hashes_be32(p + 8);
+			slice->size = hashes_be32(p + 12);
+		}
+	}
+	off = slice->offset;
+	size = slice->size;
+	if (best == 0 || size == 0 ||
+	    off > (uint64_t)filesz || size > (uint64_t)filesz - off)
+		return 1;
+
+	buf = malloc(chunksz);
+	if (!buf)
+		return -1;
+	sha256_init(&ctx);
+	for (done = 0; done < size; done += (uint64_t)got) {
+		got = pread(fd, buf, (size_t)min(size - done, (uint64_t)chunksz),
+		            (off_t)(off + done));
+		if (got <= 0) {
+			free(buf);
+			if (got == 0)
+				errno = EIO;
+			return -1;
+		}
+		sha256_update(&ctx, buf, (size_t)got);
+	}
+	sha256_final(slice->sha256, &ctx);
+	free(buf);
+	counter_inc(&stat_slices);
+	counter_add(&stat_slicebytes, size);
+	return 0;
+}
+
+/*
+ * Name of the architecture of a slice, or NULL if unknown.
+ */
+const char *
+hashes_slice_arch_s(const hashes_slice_t *slice) {
+	switch (slice->cputype) {
+	case CPU_TYPE_ARM64:
+		return slice->cpusubtype == CPU_SUBTYPE_ARM64E ? "arm64e"
+		                                               : "arm64";
+	case CPU_TYPE_X86_64:
+		return slice->cpusubtype == CPU_SUBTYPE_X86_64_H ? "x86_64h"
+		                                                 : "x86_64";
+	case CPU_TYPE_X86:
+		return "i386";
+	default:
+		return NULL;
+	}
+}
+
+static void
+hashes_sigbus_init(void) {
+	struct sigaction sa;
+
+	bzero(&sa, sizeof(sa));
+	sa.sa_sigaction = hashes_sigbus;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGBUS, &sa, NULL) == -1) {
+		/* unguarded mappings could be crashed by any user */
+		fprintf(stderr, "sigaction(SIGBUS) failed: %s (%i), "
+		                "not hashing mapped files\n",
+		                strerror(errno), errno);
+		use_mmap = false;
+	}
+}
+
+/*
+ * Configure chunk size, parallel hashing, hashing of memory-mapped files and
+ * the size from which files are read bypassing the buffer cache, 0 to never
+ * bypass it.  Must be called before any hashing takes place; without calling
+ * it, files are read and hashed serially in chunks of HASHES_CHUNKSZ_DEFAULT
+ * bytes.
+ */
+void
+hashes_init(size_t size, bool par, bool map, size_t nocache) {
+	assert(size >= HASHES_CHUNKSZ_MIN && size <= HASHES_CHUNKSZ_MAX);
+
+	chunksz = size;
+	parallel = par;
+	use_mmap = map;
+	nocache_min = nocache;
+	if (map)
+		hashes_sigbus_init();
+	arc4random_buf(tree_key, sizeof(tree_key));
+	counter_reset(&stat_mapped);
+	counter_reset(&stat_mapfaults);
+	counter_reset(&stat_nocache);
+	counter_reset(&stat_readbytes);
+	counter_reset(&stat_mappedbytes);
+	counter_reset(&stat_nocachebytes);
+	counter_reset(&stat_files);
+	counter_reset(&stat_bytes);
+	counter_reset(&stat_nsecs);
+	counter_reset(&stat_parallel);
+	counter_reset(&stat_leaves);
+	counter_reset(&stat_reused);
+	counter_reset(&stat_slices);
+	counter_reset(&stat_slicebytes);
+	hashes_slice_init();
+}
+
+/*
+ * Hash the size bytes at p.  Not accounted in the stats, which are about
+ * files.
+ */
+void
+hashes_mem(hashes_t *hashes, int flags, const void *p, size_t size) {
+	if (flags & HASH_LINEAR)
+		hashes_mem_serial(hashes, flags & HASH_LINEAR, p, size,
+		                  chunksz);
+	if (flags & HASH_SHA256TREE)
+		hashes_mem_tree(hashes, p, size, NULL);
+}
+
+/*
+ * Hash `fd' from the current offset to the end of file.  If `path' is not
+ * NULL, it is used as the key under which the sha256tree leaves of the file
+ * are remembered for rehashing it after changes.
+ */
+int
+hashes_fd(off_t *sz, hashes_t *hashes, int flags, int fd, const char *path) {
+	struct timespec t0, t1;
+	struct stat st;
+	int lin = flags & HASH_LINEAR;
+	off_t off, treesz;
+	bool par, nocache, mapped = false;
+	int rv;
+
+	if (fstat(fd, &st) == -1)
+		bzero(&st, sizeof(st));
+	par = parallel && (lin & (lin - 1)) &&
+	      st.st_size >= HASHES_PARALLEL_MIN;
+	nocache = nocache_min > 0 && S_ISREG(st.st_mode) &&
+	          (uint64_t)st.st_size >= nocache_min &&
+	          fcntl(fd, F_NOCACHE, 1) != -1;
+	off = lseek(fd, 0, SEEK_CUR);
+
+	if (timespec_monotime(&t0) == -1)
+		bzero(&t0, sizeof(t0));
+	if (!nocache && use_mmap && S_ISREG(st.st_mode) &&
+	    st.st_size >= HASHES_MMAP_MIN && off == 0 &&
+	    hashes_fd_mmap(sz, hashes, flags, fd, (size_t)st.st_size,
+	                   par, path) == 0) {
+		counter_inc(&stat_mapped);
+		if (par)
+			counter_inc(&stat_parallel);
+		mapped = true;
+		rv = 0;
+	} else {
+		rv = lin ? hashes_fd_read(sz, hashes, lin, fd, par,
+		                          nocache) : 0;
+		if (rv == 0 && (flags & HASH_SHA256TREE)) {
+			rv = hashes_fd_tree(&treesz, hashes, fd, off,
+			                    st.st_size, path);
+			/* file changed between the two passes */
+			if (rv == 0 && lin && treesz != *sz)
+				rv = -1;
+			if (rv == -1)
+				bzero(hashes, sizeof(hashes_t));
+			else
+				*sz = treesz;
+		}
+	}
+	if (timespec_monotime(&t1) == -1)
+		t1 = t0;
+	if (nocache)
+		(void)fcntl(fd, F_NOCACHE, 0);
+
+	if (rv == 0) {
+		counter_inc(&stat_files);
+		counter_add(&stat_bytes, (uint64_t)*sz);
+		counter_add(&stat_nsecs, timespec_diff_nsec(&t1, &t0));
+		if (mapped) {
+			counter_add(&stat_mappedbytes, (uint64_t)*sz);
+		} else if (nocache) {
+			counter_inc(&stat_nocache);
+			counter_add(&stat_nocachebytes, (uint64_t)*sz);
+		} else {
+			counter_add(&stat_readbytes, (uint64_t)*sz);
+		}
+	}
+	return rv;
+}
+
+/*
+ * Resumable hashing:  a hashes_ctx_t holds the digest states of a file that
+ * is hashed in slices by hashes_ctx_update, such that hashing can be
+ * interrupted and resumed later, possibly on another thread, without reading
+ * any part of the file twice.  Slices are read from the start of the file
+ * using pread(2) in blocks of HASHES_TREE_LEAFSZ bytes, which feed both the
+ * linear digests and the sha256tree in a single pass.  Accounted in the
+ * stats as read(2) hashing once finished.
+ */
+struct hashes_ctx {
+	int flags;
+	off_t off;                      /* bytes hashed so far */
+	uint64_t nsecs;
+	md5_ctx_t md5ctx;
+	sha1_ctx_t sha1ctx;
+	sha256_ctx_t sha256ctx;
+	blake3_ctx_t blake3ctx;
+	hashes_treebuild_t tb;
+};
+
+/*
+ * Begin hashing the file at path of expected size `size' with the digests
+ * in flags.  Returns NULL if out of memory.
+ */
+hashes_ctx_t *
+hashes_ctx_new(int flags, const char *path, off_t size) {
+	hashes_ctx_t *ctx;
+
+	ctx = malloc(sizeof(hashes_ctx_t));
+	if (!ctx)
+		return NULL;
+	bzero(ctx, sizeof(hashes_ctx_t));
+	ctx->flags = flags;
+	if (flags & HASH_MD5)
+		md5_init(&ctx->md5ctx);
+	if (flags & HASH_SHA1)
+		sha1_init(&ctx->sha1ctx);
+	if (flags & HASH_SHA256)
+		sha256_init(&ctx->sha256ctx);
+	if (flags & HASH_BLAKE3)
+		blake3_init(&ctx->blake3ctx);
+	if (flags & HASH_SHA256TREE)
+		hashes_tree_begin(&ctx->tb, path, size);
+	return ctx;
+}
+
+int
+hashes_ctx_flags(const hashes_ctx_t *ctx) {
+	return ctx->flags;
+}
+
+/*
+ * Hash the next slice of at least `budget' bytes of `fd', or up to the end
+ * of file if budget is 0.  Returns 1 if the budget was used up before the
+ * end of file, 0 once the whole file has been hashed, and -1 on errors, in
+ * which case ctx must be discarded using hashes_ctx_free.
+ */
+int
+hashes_ctx_update(hashes_ctx_t *ctx, int fd, size_t budget) {
+	struct timespec t0, t1;
+	unsigned char *buf;
+	size_t fill, done = 0;
+	ssize_t n = 0;
+	int rv;
+
+	buf = malloc(HASHES_TREE_LEAFSZ);
+	if (!buf)
+		return -1;
+	if (timespec_monotime(&t0) == -1)
+		bzero(&t0, sizeof(t0));
+	for (;;) {
+		fill = 0;
+		while (fill < HASHES_TREE_LEAFSZ) {
+			n = pread(fd, buf + fill, HASHES_TREE_LEAFSZ - fill,
+			          ctx->off + (off_t)fill);
+			if (n <= 0)
+				break;
+			fill += (size_t)n;
+		}
+		if (n == -1) {
+			rv = -1;
+			break;
+		}
+		if (fill > 0) {
+			if (ctx->flags & HASH_MD5)
+				md5_update(&ctx->md5ctx, buf, fill);
+			if (ctx->flags & HASH_SHA1)
+				sha1_update(&ctx->sha1ctx, buf, fill);
+			if (ctx->flags & HASH_SHA256)
+				sha256_update(&ctx->sha256ctx, buf, fill);
+			if (ctx->flags & HASH_BLAKE3)
+				blake3_update(&ctx->blake3ctx, buf, fill);
+			if (ctx->flags & HASH_SHA256TREE)
+				hashes_tree_block(&ctx->tb, buf, fill);
+		}
+		ctx->off += (off_t)fill;
+		done += fill;
+		if (fill < HASHES_TREE_LEAFSZ) {
+			rv = 0;
+			break;
+		}
+		if (budget > 0 && done >= budget) {
+			rv = 1;
+			break;
+		}
+	}
+	if (timespec_monotime(&t1) == -1)
+		t1 = t0;
+	ctx->nsecs += timespec_diff_nsec(&t1, &t0);
+	free(buf);
+	return rv;
+}
+
+/*
+ * Finish the digests of a file completely hashed by hashes_ctx_update into
+ * hashes and free ctx.
+ */
+void
+hashes_ctx_final(hashes_ctx_t *ctx, off_t *sz, hashes_t *hashes) {
+	if (ctx->flags & HASH_MD5)
+		md5_final(hashes->md5, &ctx->md5ctx);
+	if (ctx->flags & HASH_SHA1)
+		sha1_final(hashes->sha1, &ctx->sha1ctx);
+	if (ctx->flags & HASH_SHA256)
+		sha256_final(hashes->sha256, &ctx->sha256ctx);
+	if (ctx->flags & HASH_BLAKE3)
+		blake3_final(hashes->blake3, &ctx->blake3ctx);
+	if (ctx->flags & HASH_SHA256TREE)
+		hashes_tree_end(&ctx->tb, hashes, true);
+	*sz = ctx->off;
+	counter_inc(&stat_files);
+	counter_add(&stat_bytes, (uint64_t)ctx->off);
+	counter_add(&stat_nsecs, ctx->nsecs);
+	counter_add(&stat_readbytes, (uint64_t)ctx->off);
+	free(ctx);
+}
+
+/*
+ * Discard ctx without finishing the digests.
+ */
+void
+hashes_ctx_free(hashes_ctx_t *ctx) {
+	hashes_t discard;
+
+	if (ctx->flags & HASH_SHA256TREE)
+		hashes_tree_end(&ctx->tb, &discard, false);
+	free(ctx);
+}
+
+void
+hashes_stats(hashes_stat_t *st) {
+	assert(st);
+
+	st->files = counter_get(&stat_files);
+	st->bytes = counter_get(&stat_bytes);
+	st->nsecs = counter_get(&stat_nsecs);
+	st->parallel = counter_get(&stat_parallel);
+	st->mapped = counter_get(&stat_mapped);
+	st->mapfaults = counter_get(&stat_mapfaults);
+	st->mbps = st->nsecs ? (st->bytes * 1000) / st->nsecs : 0;
+	st->leaves = counter_get(&stat_leaves);
+	st->reused = counter_get(&stat_reused);
+	st->nocache = counter_get(&stat_nocache);
+	st->readbytes = counter_get(&stat_readbytes);
+	st->mappedbytes = counter_get(&stat_mappedbytes);
+	st->nocachebytes = counter_get(&stat_nocachebytes);
+	st->slices = counter_get(&stat_slices);
+	st->slicebytes = counter_get(&stat_slicebytes);
+}
+
 int
 hashes_path(off_t *sz, hashes_t *hashes, int flags, const char *path) {
 	int fd, rv;
@@ -119,7 +1603,7 @@ hashes_path(off_t *sz, hashes_t *hashes, int flags, const char *path) {
 	if ((fd = open(path, O_RDONLY)) == -1)
 		return -1;
 
-	rv = hashes_fd(sz, hashes, flags, fd);
+	rv = hashes_fd(sz, hashes, flags, fd, path);
 	close(fd);
 	return rv;
 }
@@ -142,6 +1626,10 @@ hashes_parse(const char *hashspec) {
 			flags |= HASH_SHA1;
 		if (sz == 6 && !memcmp(p, "sha256", sz))
 			flags |= HASH_SHA256;
+		if (sz == 10 && !memcmp(p, "sha256tree", sz))
+			flags |= HASH_SHA256TREE;
+		if (sz == 6 && !memcmp(p, "blake3", sz))
+			flags |= HASH_BLAKE3;
 		if (!p[sz])
 			break;
 		p += sz + 1;
@@ -161,7 +1649,31 @@ static const char *hflags[] = {
 	"sha256",
 	"md5,sha256",
 	"sha1,sha256",
-	"md5,sha1,sha256"
+	"md5,sha1,sha256",
+	"sha256tree",
+	"md5,sha256tree",
+	"sha1,sha256tree",
+	"md5,sha1,sha256tree",
+	"sha256,sha256tree",
+	"md5,sha256,sha256tree",
+	"sha1,sha256,sha256tree",
+	"md5,sha1,sha256,sha256tree",
+	"blake3",
+	"md5,blake3",
+	"sha1,blake3",
+	"md5,sha1,blake3",
+	"sha256,blake3",
+	"md5,sha256,blake3",
+	"sha1,sha256,blake3",
+	"md5,sha1,sha256,blake3",
+	"sha256tree,blake3",
+	"md5,sha256tree,blake3",
+	"sha1,sha256tree,blake3",
+	"md5,sha1,sha256tree,blake3",
+	"sha256,sha256tree,blake3",
+	"md5,sha256,sha256tree,blake3",
+	"sha1,sha256,sha256tree,blake3",
+	"md5,sha1,sha256,sha256tree,blake3"
 };
 
 const char *
@@ -11,9 +11,12 @@
 #ifndef HASHES_H
 #define HASHES_H
 
+#include "blake3.h"
 #include "attrib.h"
 
 #include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 #define MD5SZ    16
 #define SHA1SZ   20
@@ -23,10 +26,67 @@ typedef struct __attribute__((packed)) {
 	unsigned char md5[MD5SZ];
 	unsigned char sha1[SHA1SZ];
 	unsigned char sha256[SHA256SZ];
+	unsigned char sha256tree[SHA256SZ];
+	unsigned char blake3[BLAKE3SZ];
 } hashes_t;
 
-int hashes_fd(off_t *, hashes_t *, int, int) NONNULL(1,2);
+/*
+ * The sha256tree digest is the root of a two-level hash tree over the file:
+ * SHA-256 of a 0x01 byte followed by the leaf digests in order, where each
+ * leaf digest is SHA-256 of a 0x00 byte followed by the next block of
+ * HASHES_TREE_LEAFSZ bytes of the file, the last block being shorter.
+ */
+#define HASHES_TREE_LEAFSZ      (1024*1024)
+
+typedef struct {
+	uint64_t files;
+	uint64_t bytes;
+	uint64_t nsecs;
+	uint64_t parallel;
+	uint64_t mapped;
+	uint64_t mapfaults;     /* mapped files truncated while hashed */
+	uint64_t mbps;          /* throughput in MB/s */
+	uint64_t leaves;        /* sha256tree blocks fingerprinted */
+	uint64_t reused;        /* sha256tree blocks found unchanged */
+	uint64_t nocache;       /* files read bypassing the buffer cache */
+	uint64_t readbytes;     /* bytes hashed using cached read(2) */
+	uint64_t mappedbytes;   /* bytes hashed using mmap(2) */
+	uint64_t nocachebytes;  /* bytes hashed using uncached read(2) */
+	uint64_t slices;        /* universal binary slices hashed */
+	uint64_t slicebytes;    /* bytes hashed as slices */
+} hashes_stat_t;
+
+/*
+ * Slice of a universal binary that the host runs natively, see hashes_slice.
+ */
+typedef struct {
+	int32_t cputype;
+	int32_t cpusubtype;
+	uint64_t offset;
+	uint64_t size;
+	unsigned char sha256[SHA256SZ];
+} hashes_slice_t;
+
+typedef struct hashes_ctx hashes_ctx_t;
+
+#define HASHES_CHUNKSZ_DEFAULT  (1024*32)
+#define HASHES_CHUNKSZ_MIN      (1024*4)
+#define HASHES_CHUNKSZ_MAX      (1024*1024*16)
+
+void hashes_init(size_t, bool, bool, size_t);
+void hashes_stats(hashes_stat_t *) NONNULL(1);
+int hashes_fd(off_t *, hashes_t *, int, int, const char *) NONNULL(1,2);
+void hashes_mem(hashes_t *, int, const void *, size_t) NONNULL(1);
+void hashes_flush(void);
+int hashes_fp(off_t *, uint64_t *, int) NONNULL(1,2) WUNRES;
 int hashes_path(off_t *, hashes_t *, int, const char *) NONNULL(1,2,4);
+hashes_ctx_t * hashes_ctx_new(int, const char *, off_t) MALLOC;
+int hashes_ctx_flags(const hashes_ctx_t *) NONNULL(1) WUNRES;
+int hashes_ctx_update(hashes_ctx_t *, int, size_t) NONNULL(1) WUNRES;
+void hashes_ctx_final(hashes_ctx_t *, off_t *, hashes_t *) NONNULL(1,2,3);
+void hashes_ctx_free(hashes_ctx_t *) NONNULL(1);
+int hashes_slice(hashes_slice_t *, int, off_t) NONNULL(1) WUNRES;
+const char * hashes_slice_arch_s(const hashes_slice_t *) NONNULL(1);
 int hashes_parse(const char *) NONNULL(1);
 const char * hashes_flags_s(int);
 
@@ -37,7 +97,10 @@ const char * hashes_flags_s(int);
 #define HASH_MD5_SHA256         (HASH_MD5|HASH_SHA256)
 #define HASH_SHA1_SHA256        (HASH_SHA1|HASH_SHA256)
 #define HASH_MD5_SHA1_SHA256    (HASH_MD5|HASH_SHA1|HASH_SHA256)
-#define HASH_ALL                HASH_MD5_SHA1_SHA256
+#define HASH_SHA256TREE         8
+#define HASH_BLAKE3             16
+#define HASH_LINEAR             (HASH_MD5_SHA1_SHA256|HASH_BLAKE3)
+#define HASH_ALL                (HASH_LINEAR|HASH_SHA256TREE)
 
 #endif
 
@@ -0,0 +1,59 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "hist.h"
+
+#include "tommytypes.h"
+
+#include <assert.h>
+
+void
+hist_add(hist_t *this, uint64_t value) {
+	unsigned int i;
+
+	assert(this);
+
+	if (value == 0)
+		i = 0;
+	else if (value >= (1ULL << (HIST_BUCKETS - 2)))
+		i = HIST_BUCKETS - 1;
+	else
+		i = tommy_ilog2_u32((uint32_t)value) + 1;
+	this->bucket[i]++;
+	this->count++;
+}
+
+/*
+ * Returns the exclusive upper bound of the bucket containing the pct-th
+ * percentile, or 0 if the histogram is empty.  Values in the last bucket are
+ * reported as its lower bound.
+ */
+uint64_t
+hist_percentile(const hist_t *this, unsigned int pct) {
+	uint64_t rank, sum = 0;
+
+	assert(this);
+	assert(pct <= 100);
+
+	if (this->count == 0)
+		return 0;
+	rank = (this->count * pct + 99) / 100;
+	if (rank == 0)
+		rank = 1;
+	for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+		sum += this->bucket[i];
+		if (sum >= rank) {
+			if (i == HIST_BUCKETS - 1)
+				return 1ULL << (HIST_BUCKETS - 2);
+			return 1ULL << i;
+		}
+	}
+	return 1ULL << (HIST_BUCKETS - 2);
+}
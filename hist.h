@@ -0,0 +1,34 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef HIST_H
+#define HIST_H
+
+#include "attrib.h"
+
+#include <stdint.h>
+
+/*
+ * Histogram with log2 buckets.  Bucket 0 counts zero values, bucket i > 0
+ * counts values in [2^(i-1), 2^i), and the last bucket also counts all
+ * larger values.
+ */
+#define HIST_BUCKETS    24
+
+typedef struct {
+	uint64_t bucket[HIST_BUCKETS];
+	uint64_t count;
+} hist_t;
+
+void hist_add(hist_t *, uint64_t) NONNULL(1);
+uint64_t hist_percentile(const hist_t *, unsigned int) NONNULL(1) WUNRES;
+
+#endif
+
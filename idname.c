@@ -0,0 +1,276 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "idname.h"
+
+#include "time.h"
+#include "thrstat.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <grp.h>
+
+/*
+ * Cache of user and group names for resolve_users_groups, so that the log
+ * thread does not call into directory services for every uid and gid field
+ * of every event; on directory-bound systems, each lookup is an IPC round
+ * trip to opendirectoryd that can take arbitrarily long.
+ *
+ * Names, including the absence of a name, are cached for IDNAME_TTL
+ * seconds.  Expired entries keep being served while the refresher thread
+ * resolves them again in the background, such that only the first lookup
+ * of an id blocks the calling thread.  Without idname_init, lookups go to
+ * directory services directly.
+ */
+
+#define KIND_USER       0
+#define KIND_GROUP      1
+#define KINDS           2
+
+typedef struct {
+	unsigned int id;
+	bool valid;
+	bool found;                     /* id has a name */
+	bool queued;                    /* expired, refresh pending */
+	struct timespec expiry;         /* monotonic */
+	char name[IDNAME_NAMESZ];
+} idname_entry_t;
+
+static idname_entry_t entries[KINDS][IDNAME_SIZE];
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_t thread;
+static bool running = false;
+static bool stopping = false;
+static size_t queued = 0;
+static uint64_t hits = 0;
+static uint64_t misses = 0;
+static uint64_t refreshes = 0;
+
+/*
+ * Resolve id of kind into name using the reentrant interfaces, since the
+ * refresher and the log thread resolve concurrently.  Returns true if the
+ * id has a name.
+ */
+static bool
+idname_resolve(char *name, int kind, unsigned int id) {
+	struct passwd pw, *pwp;
+	struct group gr, *grp;
+	char stackbuf[4096];
+	char *buf = stackbuf;
+	size_t bufsz = sizeof(stackbuf);
+	bool found = false;
+	int rv;
+
+	for (;;) {
+		if (kind == KIND_USER) {
+			rv = getpwuid_r((uid_t)id, &pw, buf, bufsz, &pwp);
+			if (rv == 0 && pwp) {
+				snprintf(name, IDNAME_NAMESZ, "%s",
+				         pwp->pw_name);
+				found = true;
+			}
+		} else {
+			rv = getgrgid_r((gid_t)id, &gr, buf, bufsz, &grp);
+			if (rv == 0 && grp) {
+				snprintf(name, IDNAME_NAMESZ, "%s",
+				         grp->gr_name);
+				found = true;
+			}
+		}
+		/* groups with many members need larger buffers */
+		if (rv != ERANGE || bufsz >= 1024*1024)
+			break;
+		if (buf != stackbuf)
+			free(buf);
+		bufsz *= 4;
+		buf = malloc(bufsz);
+		if (!buf)
+			return false;
+	}
+	if (buf != stackbuf)
+		free(buf);
+	return found;
+}
+
+/*
+ * Must be called with the mutex held.
+ */
+static void
+idname_store(idname_entry_t *e, unsigned int id, bool found,
+             const char *name, struct timespec *now) {
+	if (e->valid && e->queued)
+		queued--;
+	e->id = id;
+	e->valid = true;
+	e->found = found;
+	e->queued = false;
+	e->expiry = *now;
+	timespec_add_msec(&e->expiry, IDNAME_TTL * 1000);
+	if (found)
+		snprintf(e->name, IDNAME_NAMESZ, "%s", name);
+}
+
+static bool
+idname_lookup(char *name, int kind, unsigned int id) {
+	char resolved[IDNAME_NAMESZ];
+	idname_entry_t *e;
+	struct timespec now;
+	bool found;
+
+	if (!running || timespec_monotime(&now) == -1)
+		return idname_resolve(name, kind, id);
+
+	pthread_mutex_lock(&mutex);
+	e = &entries[kind][id % IDNAME_SIZE];
+	if (e->valid && e->id == id) {
+		if (!e->queued && !timespec_greater(&e->expiry, &now)) {
+			e->queued = true;
+			queued++;
+			pthread_cond_signal(&cond);
+		}
+		found = e->found;
+		if (found)
+			snprintf(name, IDNAME_NAMESZ, "%s", e->name);
+		hits++;
+		pthread_mutex_unlock(&mutex);
+		return found;
+	}
+	misses++;
+	pthread_mutex_unlock(&mutex);
+
+	found = idname_resolve(resolved, kind, id);
+
+	pthread_mutex_lock(&mutex);
+	idname_store(&entries[kind][id % IDNAME_SIZE], id, found, resolved,
+	             &now);
+	pthread_mutex_unlock(&mutex);
+	if (found)
+		snprintf(name, IDNAME_NAMESZ, "%s", resolved);
+	return found;
+}
+
+/*
+ * Resolve all queued entries again, without holding the mutex while
+ * calling into directory services.  Must be called with the mutex held.
+ */
+static void
+idname_refresh(void) {
+	char resolved[IDNAME_NAMESZ];
+	struct timespec now;
+	idname_entry_t *e;
+	unsigned int id;
+	bool found;
+
+	for (int kind = 0; kind < KINDS; kind++) {
+		for (size_t i = 0; i < IDNAME_SIZE && !stopping; i++) {
+			e = &entries[kind][i];
+			if (!e->valid || !e->queued)
+				continue;
+			id = e->id;
+			pthread_mutex_unlock(&mutex);
+			found = idname_resolve(resolved, kind, id);
+			if (timespec_monotime(&now) == -1)
+				bzero(&now, sizeof(now));
+			pthread_mutex_lock(&mutex);
+			/* slot may have been taken over by another id */
+			if (e->valid && e->id == id && e->queued) {
+				idname_store(e, id, found, resolved, &now);
+				refreshes++;
+			}
+		}
+	}
+}
+
+static void *
+idname_thread(UNUSED void *arg) {
+	thrstat_register(THRSTAT_LOG);
+
+	pthread_mutex_lock(&mutex);
+	while (!stopping) {
+		if (queued == 0) {
+			pthread_cond_wait(&cond, &mutex);
+			continue;
+		}
+		idname_refresh();
+	}
+	pthread_mutex_unlock(&mutex);
+	return NULL;
+}
+
+/*
+ * Start the refresher thread and serve lookups from the cache.
+ */
+int
+idname_init(void) {
+	pthread_mutex_lock(&mutex);
+	bzero(entries, sizeof(entries));
+	queued = 0;
+	hits = 0;
+	misses = 0;
+	refreshes = 0;
+	stopping = false;
+	pthread_mutex_unlock(&mutex);
+	if (pthread_create(&thread, NULL, idname_thread, NULL) != 0)
+		return -1;
+	running = true;
+	return 0;
+}
+
+/*
+ * Must be called after the log thread was stopped.  Safe to be called
+ * repeatedly.
+ */
+void
+idname_fini(void) {
+	if (!running)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	stopping = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+	(void)pthread_join(thread, NULL);
+	running = false;
+}
+
+/*
+ * Copy the name of uid into name, which must hold IDNAME_NAMESZ bytes.
+ * Returns false if uid has no name.
+ */
+bool
+idname_user(char *name, uid_t uid) {
+	return idname_lookup(name, KIND_USER, (unsigned int)uid);
+}
+
+/*
+ * Same for gid.
+ */
+bool
+idname_group(char *name, gid_t gid) {
+	return idname_lookup(name, KIND_GROUP, (unsigned int)gid);
+}
+
+void
+idname_stats(idname_stat_t *st) {
+	assert(st);
+
+	pthread_mutex_lock(&mutex);
+	st->hits = hits;
+	st->misses = misses;
+	st->refreshes = refreshes;
+	pthread_mutex_unlock(&mutex);
+}
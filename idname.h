@@ -0,0 +1,37 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef IDNAME_H
+#define IDNAME_H
+
+#include "attrib.h"
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define IDNAME_SIZE     128     /* direct-mapped by id, per kind */
+#define IDNAME_TTL      300     /* sec */
+#define IDNAME_NAMESZ   256     /* MAXLOGNAME plus terminator */
+
+typedef struct {
+	uint64_t hits;
+	uint64_t misses;                /* resolved on the calling thread */
+	uint64_t refreshes;             /* resolved in the background */
+} idname_stat_t;
+
+int idname_init(void) WUNRES;
+void idname_fini(void);
+bool idname_user(char *, uid_t) NONNULL(1) WUNRES;
+bool idname_group(char *, gid_t) NONNULL(1) WUNRES;
+void idname_stats(idname_stat_t *) NONNULL(1);
+
+#endif
+
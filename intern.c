@@ -0,0 +1,222 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+/*
+ * Global table of interned, reference-counted strings.  Paths, working
+ * directories and code signing identities are drawn from a small set of
+ * recurring values; interning them replaces repeated strdup(3) copies with a
+ * reference count increment.
+ *
+ * Interned strings are returned as plain char pointers but must not be
+ * modified, and must be released with intern_free() instead of free(3).  A
+ * given pointer field must therefore consistently hold interned strings only.
+ *
+ * The table is split into independently locked shards and is initialized
+ * lazily, so that it can be used by all programs without explicit setup.
+ * All functions are thread-safe.
+ */
+
+#include "intern.h"
+
+#include "tommyhashinc.h"
+#include "tommyhash.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+#include <assert.h>
+
+#define INTERN_SHARDS           16
+#define INTERN_SHARD(H)         ((H) >> 28)
+_Static_assert(INTERN_SHARDS == 1 << (32 - 28), "INTERN_SHARD mismatch");
+
+typedef struct {
+	tommy_node node;
+	uint32_t refs;                  /* protected by shard mutex */
+	uint32_t len;
+	char str[];
+} intern_obj_t;
+
+#define intern_obj(S) \
+	((intern_obj_t *)(void *)((S) - offsetof(intern_obj_t, str)))
+
+typedef struct {
+	pthread_mutex_t mutex;
+	bool initialized;
+	tommy_hashinc table;
+	uint64_t bytes;
+	uint64_t lookups;
+	uint64_t hits;
+} intern_shard_t;
+
+static intern_shard_t shards[INTERN_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+static void
+intern_shards_init(void) {
+	for (int i = 0; i < INTERN_SHARDS; i++)
+		pthread_mutex_init(&shards[i].mutex, NULL);
+}
+
+typedef struct {
+	const char *str;
+	size_t len;
+} intern_key_t;
+
+static int
+intern_cmp(const void *arg, const void *obj) {
+	const intern_key_t *key = arg;
+	const intern_obj_t *o = obj;
+
+	if (key->len != o->len)
+		return 1;
+	return memcmp(key->str, o->str, key->len);
+}
+
+/*
+ * Returns an interned copy of the first len bytes of s with an additional
+ * reference, or NULL on oom.  The string must not contain NUL bytes.
+ */
+char *
+intern_strn(const char *s, size_t len) {
+	intern_key_t key = {s, len};
+	intern_shard_t *shard;
+	intern_obj_t *obj;
+	tommy_hash_t h;
+
+	assert(s);
+
+	if (len > UINT32_MAX) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	h = tommy_hash_u32(0, s, len);
+	pthread_once(&shards_once, intern_shards_init);
+	shard = &shards[INTERN_SHARD(h)];
+
+	pthread_mutex_lock(&shard->mutex);
+	if (!shard->initialized) {
+		tommy_hashinc_init(&shard->table);
+		shard->initialized = true;
+	}
+	shard->lookups++;
+	obj = tommy_hashinc_search(&shard->table, intern_cmp, &key, h);
+	if (obj) {
+		shard->hits++;
+		obj->refs++;
+		pthread_mutex_unlock(&shard->mutex);
+		return obj->str;
+	}
+	obj = malloc(sizeof(intern_obj_t) + len + 1);
+	if (!obj) {
+		pthread_mutex_unlock(&shard->mutex);
+		return NULL;
+	}
+	obj->refs = 1;
+	obj->len = (uint32_t)len;
+	memcpy(obj->str, s, len);
+	obj->str[len] = '\0';
+	tommy_hashinc_insert(&shard->table, &obj->node, obj, h);
+	shard->bytes += len;
+	pthread_mutex_unlock(&shard->mutex);
+	return obj->str;
+}
+
+char *
+intern_str(const char *s) {
+	assert(s);
+	return intern_strn(s, strlen(s));
+}
+
+/*
+ * Returns an interned copy of heap-allocated s and frees s.  Accepts NULL in
+ * order to directly wrap functions returning heap-allocated strings; returns
+ * NULL if s is NULL or on oom.
+ */
+char *
+intern_take(char *s) {
+	char *is;
+
+	if (!s)
+		return NULL;
+	is = intern_str(s);
+	free(s);
+	return is;
+}
+
+/*
+ * Returns s with an additional reference.  Never fails.
+ */
+char *
+intern_ref(char *s) {
+	intern_obj_t *obj = intern_obj(s);
+	intern_shard_t *shard = &shards[INTERN_SHARD(obj->node.key)];
+
+	pthread_mutex_lock(&shard->mutex);
+	assert(obj->refs > 0);
+	obj->refs++;
+	pthread_mutex_unlock(&shard->mutex);
+	return s;
+}
+
+void
+intern_free(char *s) {
+	intern_obj_t *obj = intern_obj(s);
+	intern_shard_t *shard = &shards[INTERN_SHARD(obj->node.key)];
+
+	pthread_mutex_lock(&shard->mutex);
+	assert(obj->refs > 0);
+	if (--obj->refs > 0) {
+		pthread_mutex_unlock(&shard->mutex);
+		return;
+	}
+	tommy_hashinc_remove_existing(&shard->table, &obj->node);
+	shard->bytes -= obj->len;
+	pthread_mutex_unlock(&shard->mutex);
+	free(obj);
+}
+
+/*
+ * Release the table memory.  Strings still interned at this point are leaked
+ * and must not be released anymore.
+ */
+void
+intern_fini(void) {
+	pthread_once(&shards_once, intern_shards_init);
+	for (int i = 0; i < INTERN_SHARDS; i++) {
+		pthread_mutex_lock(&shards[i].mutex);
+		if (shards[i].initialized) {
+			tommy_hashinc_done(&shards[i].table);
+			shards[i].initialized = false;
+		}
+		shards[i].bytes = 0;
+		pthread_mutex_unlock(&shards[i].mutex);
+	}
+}
+
+void
+intern_stats(intern_stat_t *st) {
+	assert(st);
+
+	bzero(st, sizeof(intern_stat_t));
+	pthread_once(&shards_once, intern_shards_init);
+	for (int i = 0; i < INTERN_SHARDS; i++) {
+		pthread_mutex_lock(&shards[i].mutex);
+		if (shards[i].initialized)
+			st->strings += tommy_hashinc_count(&shards[i].table);
+		st->bytes += shards[i].bytes;
+		st->lookups += shards[i].lookups;
+		st->hits += shards[i].hits;
+		pthread_mutex_unlock(&shards[i].mutex);
+	}
+}
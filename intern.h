@@ -0,0 +1,35 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef INTERN_H
+#define INTERN_H
+
+#include "attrib.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+	uint64_t strings;               /* unique strings currently interned */
+	uint64_t bytes;                 /* string bytes currently interned */
+	uint64_t lookups;
+	uint64_t hits;                  /* lookups that found existing string */
+} intern_stat_t;
+
+char * intern_str(const char *) MALLOC;
+char * intern_strn(const char *, size_t) MALLOC;
+char * intern_take(char *) MALLOC;
+char * intern_ref(char *) NONNULL(1);
+void intern_free(char *) NONNULL(1);
+void intern_fini(void);
+void intern_stats(intern_stat_t *) NONNULL(1);
+
+#endif
+
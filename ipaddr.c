@@ -10,25 +10,60 @@
 
 #include "ipaddr.h"
 
+#include "tommyhash.h"
+
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <string.h>
 #include <stdio.h>
-#include <errno.h>
 
-char ipaddrtoa_buf[INET6_ADDRSTRLEN];
+/*
+ * Reentrant, formats addr into buf of size sz, which should be at least
+ * IPADDR_STRLEN.  If address family is empty/unset, returns nullstr (can be
+ * NULL).  On errors, returns a static error string.
+ */
+const char *
+ipaddr_ntop(ipaddr_t *addr, char *buf, size_t sz, const char *nullstr) {
+	if (ipaddr_is_empty(addr))
+		return nullstr;
+	if (!inet_ntop(addr->family, &addr->sin_addr, buf, (socklen_t)sz))
+		return "(invalid address)";
+	return buf;
+}
 
 /*
- * If address family is empty/unset, returns nullstr (can be NULL).
+ * The same peers and local addresses tend to show up in event after event,
+ * so each thread keeps a small direct-mapped cache of formatted addresses.
+ */
+#define IPADDR_CACHE_SIZE       64      /* power of two */
+
+typedef struct {
+	ipaddr_t addr;
+	char str[IPADDR_STRLEN];
+} ipaddr_cache_t;
+
+static _Thread_local ipaddr_cache_t ipaddr_cache[IPADDR_CACHE_SIZE];
+
+/*
+ * Like ipaddr_ntop, but formats into a buffer owned by the calling thread,
+ * which remains valid until the next call from the same thread.
  */
 const char *
 ipaddrtoa(ipaddr_t *addr, const char *nullstr) {
+	ipaddr_cache_t *slot;
+	const char *str;
+
 	if (ipaddr_is_empty(addr))
 		return nullstr;
-	if (!inet_ntop(addr->family, &addr->sin_addr,
-	               ipaddrtoa_buf, sizeof(ipaddrtoa_buf)))
-		return strerror(errno);
-	return ipaddrtoa_buf;
+	slot = &ipaddr_cache[ipaddr_hash(addr, 0) & (IPADDR_CACHE_SIZE - 1)];
+	if (!ipaddr_is_empty(&slot->addr) && ipaddr_equal(&slot->addr, addr))
+		return slot->str;
+	str = ipaddr_ntop(addr, slot->str, sizeof(slot->str), nullstr);
+	if (str == slot->str)
+		slot->addr = *addr;
+	else
+		slot->addr.family = 0;
+	return str;
 }
 
 /* ::1 - compare all 16 bytes */
@@ -58,9 +93,40 @@ ipaddr_is_localhost(ipaddr_t *addr) {
 	}
 }
 
+/*
+ * Compares only the bytes of the address that are in use for its family.
+ */
+bool
+ipaddr_equal(ipaddr_t *a, ipaddr_t *b) {
+	if (a->family != b->family)
+		return false;
+	switch (a->family) {
+	case AF_INET:
+		return a->ev_addr == b->ev_addr;
+	case AF_INET6:
+		return !memcmp(a->ev6_addr, b->ev6_addr, sizeof(a->ev6_addr));
+	default:
+		return true;
+	}
+}
+
+uint32_t
+ipaddr_hash(ipaddr_t *addr, uint32_t init) {
+	switch (addr->family) {
+	case AF_INET:
+		return tommy_hash_u32(init, &addr->ev_addr,
+		                      sizeof(addr->ev_addr));
+	case AF_INET6:
+		return tommy_hash_u32(init, addr->ev6_addr,
+		                      sizeof(addr->ev6_addr));
+	default:
+		return init;
+	}
+}
+
 const char *
 protocoltoa(int protocol) {
-	static char buf[16];
+	static _Thread_local char buf[16];
 	switch (protocol) {
 	case IPPROTO_IP:
 		return "ip";
@@ -84,7 +150,7 @@ protocoltoa(int protocol) {
 
 const char *
 domaintoa(int domain) {
-	static char buf[16];
+	static _Thread_local char buf[16];
 	switch (domain) {
 	case PF_UNSPEC:
 		return "unspec";
@@ -106,7 +172,7 @@ domaintoa(int domain) {
 
 const char *
 typetoa(int type) {
-	static char buf[16];
+	static _Thread_local char buf[16];
 	switch (type) {
 	case SOCK_DGRAM:
 		return "dgram";
@@ -14,6 +14,8 @@
 #include "attrib.h"
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 
@@ -39,10 +41,17 @@ typedef struct ipaddr {
 	};
 } ipaddr_t;
 
+#define IPADDR_STRLEN   INET6_ADDRSTRLEN
+
+const char * ipaddr_ntop(ipaddr_t *, char *, size_t, const char *)
+             NONNULL(1,2) WUNRES;
 const char * ipaddrtoa(ipaddr_t *, const char *) NONNULL(1) WUNRES;
 bool ipaddr_is_localhost(ipaddr_t *) NONNULL(1) WUNRES;
 #define ipaddr_is_empty(PIPADDR) ((PIPADDR)->family == 0)
+bool ipaddr_equal(ipaddr_t *, ipaddr_t *) NONNULL(1,2) WUNRES;
+uint32_t ipaddr_hash(ipaddr_t *, uint32_t) NONNULL(1) WUNRES;
 
+/* return static strings or thread-local buffers */
 const char * protocoltoa(int) WUNRES;
 const char * domaintoa(int) WUNRES;
 const char * typetoa(int) WUNRES;
@@ -0,0 +1,129 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "kesched.h"
+
+#include "procmon.h"
+#include "minmax.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+#include <assert.h>
+
+/*
+ * Scheduling between the kextloop thread reading exec messages from the
+ * kext and the main thread reading audit records.  Every exec message
+ * blocks an exec until acknowledged, and is only matched up with its exec
+ * once the audit record arrives; images waiting in the prep queue for too
+ * long are dropped.  When audit consumption falls behind, reading exec
+ * messages as fast as possible only adds to the prep queue and to the load
+ * on the system, while delaying the acknowledgements throttles the execs
+ * that cause the audit records in the first place.
+ *
+ * After every drain, the main thread reports the fill of the auditpipe(4)
+ * queue and of the reader ring, if any, in kesched_audit.  Before reading,
+ * the kextloop thread calls kesched_kext with the number of bytes pending
+ * in the kext queue.  If audit consumption is pressured, i.e. the audit
+ * backlog is at KESCHED_AUDIT_HIGH permille or more, or the prep queue
+ * holds KESCHED_PREPQ_HIGH images or more, reading is deferred by
+ * KESCHED_DEFER_NSEC.  Deferral never happens while the kext queue holds
+ * KESCHED_KEXT_HIGH bytes or more, and at most KESCHED_DEFER_MAX times in
+ * a row, which bounds the added exec blocking time to a few milliseconds,
+ * far below the kext's timeout.
+ */
+
+static atomic_uint audit_fill;
+static unsigned int deferrals;          /* consecutive, kextloop only */
+static atomic_uint_fast64_t reads;
+static atomic_uint_fast64_t deferred;
+static atomic_uint_fast64_t deferred_nsec;
+static atomic_uint_fast64_t kext_first;
+static atomic_uint_fast64_t forced;
+
+void
+kesched_init(void) {
+	atomic_store(&audit_fill, 0);
+	deferrals = 0;
+	atomic_store(&reads, 0);
+	atomic_store(&deferred, 0);
+	atomic_store(&deferred_nsec, 0);
+	atomic_store(&kext_first, 0);
+	atomic_store(&forced, 0);
+}
+
+/*
+ * Called by the main thread after draining audit records with the fill of
+ * the auditpipe(4) queue in permille and the used and total chunks of the
+ * reader ring, which are both 0 if there is no reader ring.
+ */
+void
+kesched_audit(unsigned int fill, size_t used, size_t chunks) {
+	fill = min(fill, 1000U);
+	if (chunks > 0)
+		fill = max(fill, (unsigned int)(min(used, chunks) * 1000 /
+		                                chunks));
+	atomic_store_explicit(&audit_fill, fill, memory_order_relaxed);
+}
+
+static bool
+kesched_pressured(void) {
+	return atomic_load_explicit(&audit_fill, memory_order_relaxed) >=
+	       KESCHED_AUDIT_HIGH ||
+	       procmon_prepq_size() >= KESCHED_PREPQ_HIGH;
+}
+
+/*
+ * Called by the kextloop thread before reading messages from the kext, with
+ * the number of bytes pending as reported by kevent.  Sleeps if reading
+ * should be deferred in favour of audit consumption.
+ */
+void
+kesched_kext(size_t pending) {
+	struct timespec ts = {0, KESCHED_DEFER_NSEC};
+
+	atomic_fetch_add_explicit(&reads, 1, memory_order_relaxed);
+	if (!kesched_pressured()) {
+		deferrals = 0;
+		return;
+	}
+	if (pending >= KESCHED_KEXT_HIGH) {
+		atomic_fetch_add_explicit(&kext_first, 1,
+		                          memory_order_relaxed);
+		deferrals = 0;
+		return;
+	}
+	if (deferrals >= KESCHED_DEFER_MAX) {
+		atomic_fetch_add_explicit(&forced, 1, memory_order_relaxed);
+		deferrals = 0;
+		return;
+	}
+	deferrals++;
+	(void)nanosleep(&ts, NULL);
+	atomic_fetch_add_explicit(&deferred, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&deferred_nsec, KESCHED_DEFER_NSEC,
+	                          memory_order_relaxed);
+}
+
+void
+kesched_stats(kesched_stat_t *st) {
+	assert(st);
+
+	st->audit_fill = atomic_load_explicit(&audit_fill,
+	                                      memory_order_relaxed);
+	st->reads = atomic_load_explicit(&reads, memory_order_relaxed);
+	st->deferred = atomic_load_explicit(&deferred, memory_order_relaxed);
+	st->deferred_nsec = atomic_load_explicit(&deferred_nsec,
+	                                         memory_order_relaxed);
+	st->kext_first = atomic_load_explicit(&kext_first,
+	                                      memory_order_relaxed);
+	st->forced = atomic_load_explicit(&forced, memory_order_relaxed);
+}
+
@@ -0,0 +1,40 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef KESCHED_H
+#define KESCHED_H
+
+#include "attrib.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KESCHED_AUDIT_HIGH      500     /* permille audit backlog */
+#define KESCHED_PREPQ_HIGH      64      /* images waiting for audit */
+#define KESCHED_KEXT_HIGH       16384   /* bytes pending in kext queue */
+#define KESCHED_DEFER_NSEC      250000  /* per deferral */
+#define KESCHED_DEFER_MAX       8       /* consecutive deferrals */
+
+typedef struct {
+	uint32_t audit_fill;            /* permille, last sample */
+	uint64_t reads;                 /* kext readability events */
+	uint64_t deferred;              /* reads delayed in favour of audit */
+	uint64_t deferred_nsec;
+	uint64_t kext_first;            /* pressured, but kext backlogged */
+	uint64_t forced;                /* KESCHED_DEFER_MAX reached */
+} kesched_stat_t;
+
+void kesched_init(void);
+void kesched_audit(unsigned int, size_t, size_t);
+void kesched_kext(size_t);
+void kesched_stats(kesched_stat_t *) NONNULL(1);
+
+#endif
+
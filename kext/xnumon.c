@@ -24,7 +24,8 @@ xnumon_start(__attribute((unused)) kmod_info_t *ki,
 		return krv;
 
 	printf(KEXTNAME_S ": " KEXTBUILD_S " started, providing "
-	       "XNUMON_MSG_VERSION %d\n", XNUMON_MSG_VERSION);
+	       "XNUMON_MSG_VERSION %d XNUMON_PROTO_VERSION %d\n",
+	       XNUMON_MSG_VERSION, XNUMON_PROTO_VERSION);
 	return KERN_SUCCESS;
 }
 
@@ -16,6 +16,52 @@
  * message individually using the XNUMON_ACK_COOKIE ioctl.  The kext will block
  * the process calling execve until it receives the ACK for the respective
  * message from userspace.
+ *
+ * Protocol version 2 is negotiated by the daemon using the XNUMON_SET_PROTO
+ * ioctl right after opening the device.  In version 2, each read returns as
+ * many complete queued messages as fit into the buffer, each padded to
+ * XNUMON_MSG_ALIGN bytes, and the daemon acknowledges a whole batch of
+ * messages with a single XNUMON_ACK_COOKIES ioctl.  Kexts not supporting
+ * version 2 fail XNUMON_SET_PROTO with ENOTTY; the daemon then falls back to
+ * version 1.  The message record format is the same in both versions.
+ *
+ * Also with protocol version 2, the daemon can push a list of directory
+ * prefixes using XNUMON_SET_FILTER.  Execs of images beneath these
+ * directories are still reported, but with a cookie of 0, and the kext does
+ * not block the process waiting for an ACK.  Cookie 0 must not be ACK'ed.
+ *
+ * Also with protocol version 2, the daemon can ask the kext to hash images
+ * of up to a maximum size using XNUMON_SET_HASH.  Messages for images the
+ * kext hashed have version XNUMON_MSG_VERSION_HASH; the NUL-terminated path
+ * is then padded with NULs to XNUMON_MSG_ALIGN and followed by a trailing
+ * xnumon_msg_hash_t, holding the SHA-256 together with the size and times
+ * of the vnode at the time it was hashed, so that the daemon can verify that
+ * the hash belongs to the file it opened.  A maximum size of 0 disables
+ * hashing.  Execs not waiting for an ACK are never hashed.
+ *
+ * Also with protocol version 2, the daemon can report its backlog of exec
+ * messages not yet matched up with their audit records using
+ * XNUMON_SET_BACKLOG, together with a watermark.  The kext shortens the time
+ * it waits for an ACK in proportion to the backlog plus the messages queued
+ * in the kext, and once they reach the watermark, stops waiting altogether
+ * and reports execs with a cookie of 0, counted as degraded, until the
+ * daemon reports a lower backlog.  A watermark of 0 disables both.
+ *
+ * Also with protocol version 2, the daemon can ask the kext to identify the
+ * vnode of each exec using XNUMON_SET_IDENT, such that the daemon can look
+ * up its caches without opening and stat'ing the image by path.  Messages
+ * carrying the identity have version XNUMON_MSG_VERSION_IDENT, or
+ * XNUMON_MSG_VERSION_IDENT_HASH if also hashed; the NUL-terminated path is
+ * then padded with NULs to XNUMON_MSG_ALIGN and followed by a trailing
+ * xnumon_msg_ident_t, which in turn is followed by the xnumon_msg_hash_t if
+ * the image was hashed.  The path is still sent, since the daemon matches
+ * exec messages with audit records by path and logs it.  Execs matching the
+ * filter are never identified.
+ *
+ * Regardless of protocol version, the kext does not wait for the ACK of
+ * repeated execs of an image it received an ACK for within the last few
+ * seconds, as long as the vnode and its modification and change times are
+ * unchanged.  These are also reported with a cookie of 0.
  */
 
 #ifndef KEXT_XNUMON_H
@@ -28,6 +74,14 @@
 #include <stdint.h>
 #endif /* !KERNEL */
 
+/*
+ * Time execs spent blocked waiting for the ACK from userspace in microseconds,
+ * in log2 buckets:  bucket 0 counts zero values, bucket i > 0 counts values
+ * in [2^(i-1), 2^i), and the last bucket also counts all larger values.
+ * This is the same layout as hist_t in the daemon.
+ */
+#define XNUMON_WAIT_BUCKETS     24
+
 typedef struct __attribute__((packed)) {
 	uint64_t kauth_timeouts;
 	uint64_t kauth_errors;
@@ -35,11 +89,71 @@ typedef struct __attribute__((packed)) {
 	uint64_t kauth_denies;
 	uint32_t kauth_visitors;
 	uint32_t cdev_qsize;
+	/* not provided by kexts only supporting XNUMON_GET_STATS_V1 */
+	uint64_t kauth_nowaits;
+	uint64_t kauth_wait[XNUMON_WAIT_BUCKETS];
+	/* not provided by kexts only supporting XNUMON_GET_STATS_V2 */
+	uint64_t cdev_poolmisses;       /* messages allocated outside pool */
+	/* not provided by kexts only supporting XNUMON_GET_STATS_V3 */
+	uint64_t kauth_degraded;        /* not waited for due to backlog */
+	/* not provided by kexts only supporting XNUMON_GET_STATS_V4 */
+	uint64_t kauth_repeats;         /* not waited for, recently ACK'ed */
 } xnumon_stat_t;
+#define XNUMON_STAT_V1_SZ       __builtin_offsetof(xnumon_stat_t, \
+                                           kauth_nowaits)
+#define XNUMON_STAT_V2_SZ       __builtin_offsetof(xnumon_stat_t, \
+                                           cdev_poolmisses)
+#define XNUMON_STAT_V3_SZ       __builtin_offsetof(xnumon_stat_t, \
+                                           kauth_degraded)
+#define XNUMON_STAT_V4_SZ       __builtin_offsetof(xnumon_stat_t, \
+                                           kauth_repeats)
+
+/*
+ * Filter of size bytes at userspace address addr, consisting of concatenated
+ * NUL-terminated absolute paths.  Directory paths end in a slash and match
+ * all images beneath them, other paths match exactly that image.  Kexts
+ * predating exact paths reject them with EINVAL.  A size of 0 clears the
+ * filter.
+ */
+#define XNUMON_FILTER_MAX       8192
+
+typedef struct __attribute__((packed)) {
+	uint64_t addr;
+	uint32_t size;
+	uint32_t reserved;
+} xnumon_filter_t;
+
+typedef struct __attribute__((packed)) {
+	uint32_t backlog;               /* messages queued in the daemon */
+	uint32_t watermark;             /* 0 to always wait */
+} xnumon_backlog_t;
+
+#define XNUMON_ACKV_MAX         32
+
+typedef struct __attribute__((packed)) {
+	uint32_t count;
+	uint32_t reserved;
+	uint64_t cookie[XNUMON_ACKV_MAX];
+} xnumon_ackv_t;
 
 #define XNUMON_IOBASE           'X'
 #define XNUMON_ACK_COOKIE       _IOW(XNUMON_IOBASE, 1, uint64_t)
 #define XNUMON_GET_STATS        _IOR(XNUMON_IOBASE, 2, xnumon_stat_t)
+/* truncated xnumon_stat_t, as supported by older kexts */
+#define XNUMON_GET_STATS_V1     _IOC(IOC_OUT, XNUMON_IOBASE, 2, \
+                                     XNUMON_STAT_V1_SZ)
+#define XNUMON_GET_STATS_V2     _IOC(IOC_OUT, XNUMON_IOBASE, 2, \
+                                     XNUMON_STAT_V2_SZ)
+#define XNUMON_GET_STATS_V3     _IOC(IOC_OUT, XNUMON_IOBASE, 2, \
+                                     XNUMON_STAT_V3_SZ)
+#define XNUMON_GET_STATS_V4     _IOC(IOC_OUT, XNUMON_IOBASE, 2, \
+                                     XNUMON_STAT_V4_SZ)
+#define XNUMON_SET_PROTO        _IOW(XNUMON_IOBASE, 3, uint32_t)
+#define XNUMON_ACK_COOKIES      _IOW(XNUMON_IOBASE, 4, xnumon_ackv_t)
+#define XNUMON_SET_FILTER       _IOW(XNUMON_IOBASE, 5, xnumon_filter_t)
+#define XNUMON_SET_HASH         _IOW(XNUMON_IOBASE, 6, uint32_t)
+#define XNUMON_SET_BACKLOG      _IOW(XNUMON_IOBASE, 7, xnumon_backlog_t)
+#define XNUMON_SET_IDENT        _IOW(XNUMON_IOBASE, 8, uint32_t)
 
 typedef struct {
 	uint16_t version;
@@ -52,11 +166,70 @@ typedef struct {
 } xnumon_msg_t;
 _Static_assert(sizeof(xnumon_msg_t) == 32, "xnumon_msg_t has unexpected size");
 
+typedef struct __attribute__((packed)) {
+	uint64_t size;
+	uint64_t mtime_s;
+	uint64_t mtime_ns;
+	uint64_t ctime_s;
+	uint64_t ctime_ns;
+	uint8_t sha256[32];
+} xnumon_msg_hash_t;
+_Static_assert(sizeof(xnumon_msg_hash_t) == 72,
+               "xnumon_msg_hash_t has unexpected size");
+
+typedef struct __attribute__((packed)) {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	uint64_t mtime_s;
+	uint64_t mtime_ns;
+	uint64_t ctime_s;
+	uint64_t ctime_ns;
+	uint64_t btime_s;
+	uint64_t btime_ns;
+	uint32_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t flags;
+#define XNUMON_IDENT_SHEBANG    0x00000001      /* starts with #! */
+} xnumon_msg_ident_t;
+_Static_assert(sizeof(xnumon_msg_ident_t) == 88,
+               "xnumon_msg_ident_t has unexpected size");
+
 #define XNUMON_MSG_VERSION      1
+#define XNUMON_MSG_VERSION_HASH 2
+#define XNUMON_MSG_VERSION_IDENT 3
+#define XNUMON_MSG_VERSION_IDENT_HASH 4
+#define XNUMON_PROTO_VERSION    2
 #define XNUMON_MAXPATHLEN       1024
+#define XNUMON_MSG_ALIGN(sz)    (((sz) + 7) & ~(size_t)7)
 #define XNUMON_MSG_HDR          sizeof(xnumon_msg_t)
 #define XNUMON_MSG_MIN          sizeof(xnumon_msg_t) + 1
-#define XNUMON_MSG_MAX          sizeof(xnumon_msg_t) + XNUMON_MAXPATHLEN
+#define XNUMON_MSG_MAX          (XNUMON_MSG_ALIGN(sizeof(xnumon_msg_t) + \
+                                                  XNUMON_MAXPATHLEN) + \
+                                 sizeof(xnumon_msg_ident_t) + \
+                                 sizeof(xnumon_msg_hash_t))
+#define XNUMON_MSG_HAS_HASH(msg) \
+                                ((msg)->version == XNUMON_MSG_VERSION_HASH || \
+                                 (msg)->version == XNUMON_MSG_VERSION_IDENT_HASH)
+#define XNUMON_MSG_HAS_IDENT(msg) \
+                                ((msg)->version == XNUMON_MSG_VERSION_IDENT || \
+                                 (msg)->version == XNUMON_MSG_VERSION_IDENT_HASH)
+/* bytes following the path */
+#define XNUMON_MSG_TRAILER(msg) ((XNUMON_MSG_HAS_HASH(msg) ? \
+                                  sizeof(xnumon_msg_hash_t) : 0) + \
+                                 (XNUMON_MSG_HAS_IDENT(msg) ? \
+                                  sizeof(xnumon_msg_ident_t) : 0))
+/* trailing hash or NULL */
+#define XNUMON_MSG_HASH(msg)    (XNUMON_MSG_HAS_HASH(msg) ? \
+                                 (const xnumon_msg_hash_t *) \
+                                 ((const char *)(msg) + (msg)->msgsz - \
+                                  sizeof(xnumon_msg_hash_t)) : NULL)
+/* identity following the path or NULL */
+#define XNUMON_MSG_IDENT(msg)   (XNUMON_MSG_HAS_IDENT(msg) ? \
+                                 (const xnumon_msg_ident_t *) \
+                                 ((const char *)(msg) + (msg)->msgsz - \
+                                  XNUMON_MSG_TRAILER(msg)) : NULL)
 #define XNUMON_DEVNAME          "xnumon"
 #define XNUMON_DEVPATH          "/dev/" XNUMON_DEVNAME
 #define XNUMON_BUNDLEID         "ch.roe.kext.xnumon"
@@ -13,6 +13,7 @@
 #include "xnumon_kauth.h"
 
 #include <libkern/libkern.h>
+#include <libkern/OSAtomic.h>
 #include <libkern/OSMalloc.h>
 #include <mach/mach_types.h>
 #include <sys/param.h>
@@ -36,6 +37,9 @@
  * While this is not the Apple-recommended way to do things, it has the
  * advantage that the resuling interface exposed to userspace is conceptually
  * similar to the interface provided by the OpenBSM auditpipe facility.
+ *
+ * With protocol version 2, reads only ever return complete messages, padded
+ * to XNUMON_MSG_ALIGN, and ACKs can be batched using ACK_COOKIES.
  */
 
 #ifdef USE_PRIVATE_KPI
@@ -58,9 +62,26 @@ struct xnumon_cdev_selinfo {
 	unsigned char space[64];
 };
 
+/*
+ * Messages are taken from a pool of preallocated entries large enough for
+ * any message, such that execs do not allocate and free kernel memory while
+ * waiting for the daemon.  Free entries are tracked in a bitmap claimed and
+ * released with atomic bit operations; unlike a freelist popped with
+ * compare-and-swap, this is not susceptible to ABA.  When all entries are in
+ * use, messages are allocated individually as before and counted.
+ */
+#define XNUMON_CDEV_POOLWORDS   4
+#define XNUMON_CDEV_POOLSZ      (XNUMON_CDEV_POOLWORDS * 32)
+#define XNUMON_CDEV_ENTRYSZ     XNUMON_MSG_ALIGN(sizeof(struct \
+                                xnumon_cdev_entry) + XNUMON_MSG_MAX)
+
 static struct {
 	OSMallocTag     mtag;
 
+	unsigned char   *pool;
+	volatile UInt32 poolmap[XNUMON_CDEV_POOLWORDS]; /* 1 = in use */
+	SInt64          poolmisses;
+
 	lck_grp_t       *lck_grp;
 	lck_mtx_t       *lck_mtx;
 
@@ -74,6 +95,8 @@ static struct {
 	pid_t pid;
 	pid_t kthrpid;
 
+	uint32_t proto;
+
 	int flags;
 #define XNUMON_CDEV_FLAG_NBIO   0x00000001
 #define XNUMON_CDEV_FLAG_ASYNC  0x00000002
@@ -92,11 +115,54 @@ static struct {
 #define XNUMON_CDEV_LOCK()   lck_mtx_lock(XNUMON_CDEV_MTX)
 #define XNUMON_CDEV_UNLOCK() lck_mtx_unlock(XNUMON_CDEV_MTX)
 
+static struct xnumon_cdev_entry *
+xnumon_cdev_pool_get(void) {
+	UInt32 map, bit, old;
+	int i;
+
+	for (i = 0; i < XNUMON_CDEV_POOLWORDS; i++) {
+		map = xnumon_cdev.poolmap[i];
+		while (map != 0xFFFFFFFF) {
+			bit = ~map & (map + 1);
+			old = OSBitOrAtomic(bit, &xnumon_cdev.poolmap[i]);
+			if (!(old & bit))
+				return (struct xnumon_cdev_entry *)
+				       (xnumon_cdev.pool + XNUMON_CDEV_ENTRYSZ *
+				        (i * 32 + __builtin_ctz(bit)));
+			map = old | bit;
+		}
+	}
+	return NULL;
+}
+
+static int
+xnumon_cdev_pool_put(struct xnumon_cdev_entry *entry) {
+	unsigned long idx;
+
+	if (!xnumon_cdev.pool ||
+	    (unsigned char *)entry < xnumon_cdev.pool ||
+	    (unsigned char *)entry >= xnumon_cdev.pool +
+	                              XNUMON_CDEV_POOLSZ * XNUMON_CDEV_ENTRYSZ)
+		return -1;
+	idx = ((unsigned char *)entry - xnumon_cdev.pool) /
+	      XNUMON_CDEV_ENTRYSZ;
+	OSBitAndAtomic(~(1U << (idx % 32)), &xnumon_cdev.poolmap[idx / 32]);
+	return 0;
+}
+
 struct xnumon_cdev_entry *
 xnumon_cdev_entry_alloc(unsigned long sz) {
 	struct xnumon_cdev_entry *entry;
 	uint32_t toalloc;
 
+	if (xnumon_cdev.pool && sz <= XNUMON_MSG_MAX) {
+		entry = xnumon_cdev_pool_get();
+		if (entry) {
+			entry->sz = sz;
+			return entry;
+		}
+		OSIncrementAtomic64(&xnumon_cdev.poolmisses);
+	}
 	toalloc = sz + sizeof(struct xnumon_cdev_entry);
 	if (toalloc < sz)
 		return NULL;
@@ -108,6 +174,8 @@ xnumon_cdev_entry_alloc(unsigned long sz) {
 
 void
 xnumon_cdev_entry_free(struct xnumon_cdev_entry *entry) {
+	if (xnumon_cdev_pool_put(entry) == 0)
+		return;
 	OSFree(entry, sizeof(struct xnumon_cdev_entry) + entry->sz, xnumon_cdev.mtag);
 }
 
@@ -145,6 +213,15 @@ xnumon_cdev_enqueue(struct xnumon_cdev_entry *entry) {
 	return KERN_SUCCESS;
 }
 
+/*
+ * Number of records queued for the daemon.  Read without the lock, since an
+ * approximate value is good enough for adapting the kauth wait.
+ */
+unsigned long
+xnumon_cdev_qlength(void) {
+	return xnumon_cdev.qlength;
+}
+
 static int
 xnumon_cdev_open(__attribute__((unused)) dev_t dev,
                  __attribute__((unused)) int flags,
@@ -189,6 +266,7 @@ xnumon_cdev_open(__attribute__((unused)) dev_t dev,
 
 	xnumon_cdev.state = XNUMON_CDEV_STATE_OPEN;
 	xnumon_cdev.pid = proc_pid(p);
+	xnumon_cdev.proto = 1;
 	xnumon_kauth_start();
 	XNUMON_CDEV_UNLOCK();
 
@@ -249,6 +327,9 @@ xnumon_cdev_ioctl(__attribute__((unused)) dev_t dev,
                                           proc_t p) {
 	unsigned long available;
 	xnumon_stat_t *st;
+	xnumon_ackv_t *ackv;
+	xnumon_filter_t *filter;
+	uint32_t i;
 
 	if (xnumon_cdev.state == XNUMON_CDEV_STATE_DEAD)
 		return ENXIO;
@@ -286,7 +367,57 @@ xnumon_cdev_ioctl(__attribute__((unused)) dev_t dev,
 		xnumon_kauth_release(*(uint64_t *)data);
 		return 0;
 
+	case XNUMON_SET_PROTO:
+		if (*(uint32_t *)data < 1 ||
+		    *(uint32_t *)data > XNUMON_PROTO_VERSION)
+			return EINVAL;
+		XNUMON_CDEV_LOCK();
+		/* switching framing in the middle of a message is not sane */
+		if (xnumon_cdev.qoffset != 0) {
+			XNUMON_CDEV_UNLOCK();
+			return EBUSY;
+		}
+		xnumon_cdev.proto = *(uint32_t *)data;
+		XNUMON_CDEV_UNLOCK();
+		return 0;
+
+	case XNUMON_ACK_COOKIES:
+		ackv = (xnumon_ackv_t *)data;
+		if (ackv->count > XNUMON_ACKV_MAX)
+			return EINVAL;
+		for (i = 0; i < ackv->count; i++)
+			xnumon_kauth_release(ackv->cookie[i]);
+		return 0;
+
+	case XNUMON_SET_FILTER:
+		filter = (xnumon_filter_t *)data;
+		if (xnumon_cdev.proto < 2 || proc_pid(p) != xnumon_cdev.pid)
+			return EPERM;
+		return xnumon_kauth_set_filter((user_addr_t)filter->addr,
+		                               filter->size);
+
+	case XNUMON_SET_HASH:
+		if (xnumon_cdev.proto < 2 || proc_pid(p) != xnumon_cdev.pid)
+			return EPERM;
+		return xnumon_kauth_set_hash(*(uint32_t *)data);
+
+	case XNUMON_SET_IDENT:
+		if (xnumon_cdev.proto < 2 || proc_pid(p) != xnumon_cdev.pid)
+			return EPERM;
+		return xnumon_kauth_set_ident(*(uint32_t *)data);
+
+	case XNUMON_SET_BACKLOG:
+		if (xnumon_cdev.proto < 2 || proc_pid(p) != xnumon_cdev.pid)
+			return EPERM;
+		return xnumon_kauth_set_backlog(
+		        ((xnumon_backlog_t *)data)->backlog,
+		        ((xnumon_backlog_t *)data)->watermark);
+
 	case XNUMON_GET_STATS:
+	case XNUMON_GET_STATS_V4:
+	case XNUMON_GET_STATS_V3:
+	case XNUMON_GET_STATS_V2:
+	case XNUMON_GET_STATS_V1:
 		st = (xnumon_stat_t*)data;
 		xnumon_kauth_stats(&st->kauth_defers,
 		                   &st->kauth_denies,
@@ -294,6 +425,20 @@ xnumon_cdev_ioctl(__attribute__((unused)) dev_t dev,
 		                   &st->kauth_timeouts,
 		                   &st->kauth_visitors);
 		st->cdev_qsize = (uint32_t)xnumon_cdev.qlength;
+		/* the V1 buffer ends before kauth_nowaits */
+		if (cmd != XNUMON_GET_STATS_V1)
+			xnumon_kauth_waits(&st->kauth_nowaits,
+			                   st->kauth_wait);
+		/* the V2 buffer ends before cdev_poolmisses */
+		if (cmd == XNUMON_GET_STATS || cmd == XNUMON_GET_STATS_V4 ||
+		    cmd == XNUMON_GET_STATS_V3)
+			st->cdev_poolmisses = (uint64_t)xnumon_cdev.poolmisses;
+		/* the V3 buffer ends before kauth_degraded */
+		if (cmd == XNUMON_GET_STATS || cmd == XNUMON_GET_STATS_V4)
+			xnumon_kauth_degraded(&st->kauth_degraded);
+		/* the V4 buffer ends before kauth_repeats */
+		if (cmd == XNUMON_GET_STATS)
+			xnumon_kauth_repeats(&st->kauth_repeats);
 		return 0;
 
 	}
@@ -301,6 +446,38 @@ xnumon_cdev_ioctl(__attribute__((unused)) dev_t dev,
 	return ENOTTY;
 }
 
+/*
+ * Protocol version 2 read: copy as many complete messages as fit into the
+ * buffer, each followed by zero padding up to XNUMON_MSG_ALIGN.  Fails with
+ * EMSGSIZE if not even the first queued message fits.  Called with the lock
+ * held; returns with the lock held.
+ */
+static int
+xnumon_cdev_read_batch(uio_t uio) {
+	static const char pad[8] = {0};
+	struct xnumon_cdev_entry *entry;
+	unsigned long padsz;
+	int error;
+	int count = 0;
+
+	while ((entry = TAILQ_FIRST(&xnumon_cdev.queue)) != NULL) {
+		padsz = XNUMON_MSG_ALIGN(entry->sz) - entry->sz;
+		if ((user_ssize_t)(entry->sz + padsz) > uio_resid(uio))
+			break;
+		error = uiomove((char *)(entry->payload), entry->sz, uio);
+		if (!error && padsz > 0)
+			error = uiomove((char *)pad, padsz, uio);
+		if (error)
+			return error;
+		TAILQ_REMOVE(&xnumon_cdev.queue, entry, queue);
+		xnumon_cdev.qbytes -= entry->sz;
+		xnumon_cdev_entry_free(entry);
+		xnumon_cdev.qlength--;
+		count++;
+	}
+	return count > 0 ? 0 : EMSGSIZE;
+}
+
 static int
 xnumon_cdev_read(__attribute__((unused)) dev_t dev,
                                          uio_t uio,
@@ -329,6 +506,12 @@ retry:
 		goto retry;
 	}
 
+	if (xnumon_cdev.proto >= 2) {
+		error = xnumon_cdev_read_batch(uio);
+		XNUMON_CDEV_UNLOCK();
+		return error;
+	}
+
 	while ((entry = TAILQ_FIRST(&xnumon_cdev.queue)) != NULL &&
 	       uio_resid(uio) > 0) {
 		/* copy (remaining bytes) of first element to userspace */
@@ -403,6 +586,13 @@ xnumon_cdev_free(void) {
 		xnumon_cdev.lck_grp = NULL;
 	}
 
+	if (xnumon_cdev.pool) {
+		OSFree(xnumon_cdev.pool,
+		       XNUMON_CDEV_POOLSZ * XNUMON_CDEV_ENTRYSZ,
+		       xnumon_cdev.mtag);
+		xnumon_cdev.pool = NULL;
+	}
+
 	if (xnumon_cdev.mtag) {
 		OSMalloc_Tagfree(xnumon_cdev.mtag);
 		xnumon_cdev.mtag = NULL;
@@ -422,6 +612,15 @@ xnumon_cdev_start(void) {
 		return KERN_FAILURE;
 	}
 
+	/* all entries start out free from the bzero above */
+	xnumon_cdev.pool = OSMalloc(XNUMON_CDEV_POOLSZ * XNUMON_CDEV_ENTRYSZ,
+	                            xnumon_cdev.mtag);
+	if (!xnumon_cdev.pool) {
+		printf(KEXTNAME_S ": OSMalloc pool failed\n");
+		xnumon_cdev_free();
+		return KERN_FAILURE;
+	}
+
 	xnumon_cdev.lck_grp = lck_grp_alloc_init(BUNDLEID_S ".cdev",
 	                                         LCK_GRP_ATTR_NULL);
 	if (!xnumon_cdev.lck_grp) {
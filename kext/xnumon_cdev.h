@@ -29,6 +29,7 @@ struct xnumon_cdev_entry {
 struct xnumon_cdev_entry * xnumon_cdev_entry_alloc(unsigned long);
 void xnumon_cdev_entry_free(struct xnumon_cdev_entry *);
 kern_return_t xnumon_cdev_enqueue(struct xnumon_cdev_entry *);
+unsigned long xnumon_cdev_qlength(void);
 void xnumon_cdev_kill(void);
 kern_return_t xnumon_cdev_start(void);
 kern_return_t xnumon_cdev_stop(void);
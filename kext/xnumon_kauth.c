@@ -13,13 +13,37 @@
 
 #include <libkern/libkern.h>
 #include <libkern/OSAtomic.h>
+#include <libkern/OSMalloc.h>
 #include <mach/mach_types.h>
 #include <sys/systm.h>
 #include <sys/proc.h>
 #include <sys/vnode.h>
 #include <sys/kauth.h>
+#include <sys/stat.h>
 #include <sys/random.h>
+#include <sys/uio.h>
 #include <kern/thread.h>
+#include <libkern/crypto/sha2.h>
+
+/*
+ * Recently acknowledged executable vnodes, identified by vnode and vnode id
+ * and by modification and change time, such that a recycled vnode or a
+ * modified file never matches.  Build tools exec the same few compilers
+ * thousands of times per minute, and the daemon only needs to see the
+ * contents of each once; repeat execs within ACKED_SEC of the last ACK are
+ * reported with a cookie of 0 and do not wait.  Direct-mapped by vnode
+ * address, collisions simply replace the older entry.
+ */
+#define ACKED_SIZE 64           /* power of 2 */
+#define ACKED_SEC 5
+
+typedef struct {
+	vnode_t vp;
+	uint32_t vid;
+	struct timespec mtime;
+	struct timespec ctime;
+	time_t expiry;          /* uptime seconds */
+} xnumon_kauth_acked_t;
 
 static struct {
 	int active;
@@ -35,6 +59,10 @@ static struct {
 	SInt64 denies;
 	SInt64 errors;
 	SInt64 timeouts;
+	SInt64 nowaits;
+	SInt64 degraded;
+	SInt64 repeats;
+	SInt64 waits[XNUMON_WAIT_BUCKETS];
 
 	/* Note that the mutex is only used for msleeping in the callback,
 	 * not for protecting this data structure. */
@@ -43,6 +71,28 @@ static struct {
 
 	kauth_listener_t vnode_listener;
 
+	/* directory prefixes of images not to wait for, see xnumon.h */
+	OSMallocTag mtag;
+	lck_rw_t *filter_lck;
+	char *filter;
+	uint32_t filter_size;
+
+	/* maximum size of images to hash, 0 to not hash, see xnumon.h */
+	uint32_t hash_max;
+#define HASH_CHUNK 16384
+
+	/* whether to identify vnodes in messages, see xnumon.h */
+	uint32_t ident;
+
+	/* daemon backlog and watermark at which to stop waiting, see
+	 * xnumon.h; written by the daemon without locking */
+	uint32_t backlog;
+	uint32_t watermark;
+
+	/* recently acknowledged vnodes, see above */
+	lck_spin_t *acked_lck;
+	xnumon_kauth_acked_t acked[ACKED_SIZE];
+
 	/* random cookie mask to avoid leaking kernel addresses to userspace */
 	uint64_t cookie_mask;
 } xnumon_kauth;
@@ -53,6 +103,272 @@ static struct {
 
 kern_return_t xnumon_kauth_stop(void);
 
+/*
+ * Returns true if path is beneath one of the directories in the filter, or
+ * is one of the other paths in the filter.
+ */
+static int
+xnumon_kauth_filter_match(const char *path) {
+	const char *p;
+	size_t len;
+	int match = 0;
+
+	lck_rw_lock_shared(xnumon_kauth.filter_lck);
+	p = xnumon_kauth.filter;
+	while (p && p < xnumon_kauth.filter + xnumon_kauth.filter_size) {
+		len = strlen(p);
+		if (p[len - 1] == '/' ? !strncmp(p, path, len)
+		                      : !strcmp(p, path)) {
+			match = 1;
+			break;
+		}
+		p += len + 1;
+	}
+	lck_rw_unlock_shared(xnumon_kauth.filter_lck);
+	return match;
+}
+
+/*
+ * Hash the image at vp into h if it is not larger than hash_max.  Called
+ * with the exec'ing process blocked in the callback, which spares the
+ * daemon opening and reading the image while the process waits for the ACK.
+ * Returns 0 on success or an errno value.
+ */
+static int
+xnumon_kauth_hash(vnode_t vp, vfs_context_t ctx, xnumon_msg_hash_t *h) {
+	struct vnode_attr va;
+	SHA256_CTX sha;
+	char *buf;
+	off_t off;
+	int len, resid;
+	int error = 0;
+
+	VATTR_INIT(&va);
+	VATTR_WANTED(&va, va_data_size);
+	VATTR_WANTED(&va, va_modify_time);
+	VATTR_WANTED(&va, va_change_time);
+	error = vnode_getattr(vp, &va, ctx);
+	if (error)
+		return error;
+	if (!VATTR_IS_SUPPORTED(&va, va_data_size) ||
+	    !VATTR_IS_SUPPORTED(&va, va_modify_time) ||
+	    !VATTR_IS_SUPPORTED(&va, va_change_time))
+		return ENOTSUP;
+	if (va.va_data_size > xnumon_kauth.hash_max)
+		return EFBIG;
+
+	buf = OSMalloc(HASH_CHUNK, xnumon_kauth.mtag);
+	if (!buf)
+		return ENOMEM;
+	SHA256_Init(&sha);
+	for (off = 0; off < (off_t)va.va_data_size; off += len) {
+		len = (int)MIN((off_t)HASH_CHUNK,
+		               (off_t)va.va_data_size - off);
+		error = vn_rdwr(UIO_READ, vp, buf, len, off, UIO_SYSSPACE,
+		                IO_NOAUTH, vfs_context_ucred(ctx), &resid,
+		                vfs_context_proc(ctx));
+		if (error)
+			break;
+		if (resid != 0) {
+			/* truncated while hashing */
+			error = EIO;
+			break;
+		}
+		SHA256_Update(&sha, buf, len);
+	}
+	OSFree(buf, HASH_CHUNK, xnumon_kauth.mtag);
+	if (error)
+		return error;
+	SHA256_Final(h->sha256, &sha);
+	h->size = va.va_data_size;
+	h->mtime_s = va.va_modify_time.tv_sec;
+	h->mtime_ns = va.va_modify_time.tv_nsec;
+	h->ctime_s = va.va_change_time.tv_sec;
+	h->ctime_ns = va.va_change_time.tv_nsec;
+	return 0;
+}
+
+/*
+ * Fill in the identity of the image at vp in id, including whether it is a
+ * script, for sparing the daemon opening it by path.  Returns 0 on success
+ * or an errno value.
+ */
+static int
+xnumon_kauth_ident(vnode_t vp, vfs_context_t ctx, xnumon_msg_ident_t *id) {
+	struct vnode_attr va;
+	char buf[2];
+	int resid;
+	int error;
+
+	VATTR_INIT(&va);
+	VATTR_WANTED(&va, va_fsid);
+	VATTR_WANTED(&va, va_fileid);
+	VATTR_WANTED(&va, va_data_size);
+	VATTR_WANTED(&va, va_mode);
+	VATTR_WANTED(&va, va_uid);
+	VATTR_WANTED(&va, va_gid);
+	VATTR_WANTED(&va, va_modify_time);
+	VATTR_WANTED(&va, va_change_time);
+	VATTR_WANTED(&va, va_create_time);
+	error = vnode_getattr(vp, &va, ctx);
+	if (error)
+		return error;
+	if (!VATTR_IS_SUPPORTED(&va, va_fsid) ||
+	    !VATTR_IS_SUPPORTED(&va, va_fileid) ||
+	    !VATTR_IS_SUPPORTED(&va, va_data_size) ||
+	    !VATTR_IS_SUPPORTED(&va, va_mode) ||
+	    !VATTR_IS_SUPPORTED(&va, va_uid) ||
+	    !VATTR_IS_SUPPORTED(&va, va_gid) ||
+	    !VATTR_IS_SUPPORTED(&va, va_modify_time) ||
+	    !VATTR_IS_SUPPORTED(&va, va_change_time))
+		return ENOTSUP;
+
+	error = vn_rdwr(UIO_READ, vp, buf, sizeof(buf), 0, UIO_SYSSPACE,
+	                IO_NOAUTH, vfs_context_ucred(ctx), &resid,
+	                vfs_context_proc(ctx));
+	if (error)
+		return error;
+
+	id->dev = va.va_fsid;
+	id->ino = va.va_fileid;
+	id->size = va.va_data_size;
+	id->mtime_s = va.va_modify_time.tv_sec;
+	id->mtime_ns = va.va_modify_time.tv_nsec;
+	id->ctime_s = va.va_change_time.tv_sec;
+	id->ctime_ns = va.va_change_time.tv_nsec;
+	if (VATTR_IS_SUPPORTED(&va, va_create_time)) {
+		id->btime_s = va.va_create_time.tv_sec;
+		id->btime_ns = va.va_create_time.tv_nsec;
+	} else {
+		id->btime_s = 0;
+		id->btime_ns = 0;
+	}
+	id->mode = S_IFREG | (va.va_mode & ~S_IFMT);
+	id->uid = va.va_uid;
+	id->gid = va.va_gid;
+	id->flags = (resid == 0 && buf[0] == '#' && buf[1] == '!') ?
+	            XNUMON_IDENT_SHEBANG : 0;
+	return 0;
+}
+
+/*
+ * Fill in the identity of vp in a.  Returns 0 on success or an errno value.
+ */
+static int
+xnumon_kauth_acked_key(vnode_t vp, vfs_context_t ctx,
+                       xnumon_kauth_acked_t *a) {
+	struct vnode_attr va;
+	int error;
+
+	VATTR_INIT(&va);
+	VATTR_WANTED(&va, va_modify_time);
+	VATTR_WANTED(&va, va_change_time);
+	error = vnode_getattr(vp, &va, ctx);
+	if (error)
+		return error;
+	if (!VATTR_IS_SUPPORTED(&va, va_modify_time) ||
+	    !VATTR_IS_SUPPORTED(&va, va_change_time))
+		return ENOTSUP;
+	a->vp = vp;
+	a->vid = vnode_vid(vp);
+	a->mtime = va.va_modify_time;
+	a->ctime = va.va_change_time;
+	return 0;
+}
+
+static xnumon_kauth_acked_t *
+xnumon_kauth_acked_slot(vnode_t vp) {
+	uintptr_t h = (uintptr_t)vp;
+
+	h = (h >> 4) ^ (h >> 12);
+	return &xnumon_kauth.acked[h & (ACKED_SIZE - 1)];
+}
+
+/*
+ * Returns true if the vnode identified by a was acknowledged by the daemon
+ * less than ACKED_SEC ago.
+ */
+static int
+xnumon_kauth_acked_find(xnumon_kauth_acked_t *a) {
+	xnumon_kauth_acked_t *e;
+	struct timeval now;
+	int found;
+
+	microuptime(&now);
+	e = xnumon_kauth_acked_slot(a->vp);
+	lck_spin_lock(xnumon_kauth.acked_lck);
+	found = e->vp == a->vp && e->vid == a->vid &&
+	        e->mtime.tv_sec == a->mtime.tv_sec &&
+	        e->mtime.tv_nsec == a->mtime.tv_nsec &&
+	        e->ctime.tv_sec == a->ctime.tv_sec &&
+	        e->ctime.tv_nsec == a->ctime.tv_nsec &&
+	        e->expiry > now.tv_sec;
+	lck_spin_unlock(xnumon_kauth.acked_lck);
+	return found;
+}
+
+/*
+ * Remember the vnode identified by a as acknowledged by the daemon.
+ */
+static void
+xnumon_kauth_acked_put(xnumon_kauth_acked_t *a) {
+	xnumon_kauth_acked_t *e;
+	struct timeval now;
+
+	microuptime(&now);
+	a->expiry = now.tv_sec + ACKED_SEC;
+	e = xnumon_kauth_acked_slot(a->vp);
+	lck_spin_lock(xnumon_kauth.acked_lck);
+	*e = *a;
+	lck_spin_unlock(xnumon_kauth.acked_lck);
+}
+
+/*
+ * Returns the number of deciseconds to wait for the ACK, which shrinks from
+ * TIMEOUT_DSEC towards 1 as the daemon backlog plus the messages queued in
+ * the cdev approach the watermark, such that a backed up daemon does not
+ * hold every exec on the system for the full timeout.  Returns 0 if the
+ * watermark is reached and the exec should not wait at all.
+ */
+static size_t
+xnumon_kauth_timeout(void) {
+	uint32_t watermark = xnumon_kauth.watermark;
+	uint64_t load;
+
+	if (watermark == 0)
+		return TIMEOUT_DSEC;
+	load = (uint64_t)xnumon_kauth.backlog + xnumon_cdev_qlength();
+	if (load >= watermark)
+		return 0;
+	return MAX(1, TIMEOUT_DSEC - TIMEOUT_DSEC * load / watermark);
+}
+
+/*
+ * Account the time from enqueueing the message to being released by the
+ * ACK from userspace.
+ */
+static void
+xnumon_kauth_waited(struct timespec *enq) {
+	struct timespec now;
+	uint64_t us;
+	int i;
+
+	nanotime(&now);
+	if (now.tv_sec < enq->tv_sec ||
+	    (now.tv_sec == enq->tv_sec && now.tv_nsec < enq->tv_nsec))
+		us = 0;
+	else
+		us = (uint64_t)(now.tv_sec - enq->tv_sec) * 1000000 +
+		     (now.tv_nsec - enq->tv_nsec) / 1000;
+	if (us == 0)
+		i = 0;
+	else if (us >= (1ULL << (XNUMON_WAIT_BUCKETS - 2)))
+		i = XNUMON_WAIT_BUCKETS - 1;
+	else
+		i = 64 - __builtin_clzll(us);
+	OSIncrementAtomic64(&xnumon_kauth.waits[i]);
+}
+
 /*
  * KAuth KAUTH_SCOPE_VNODE callback.
  *
@@ -76,10 +392,16 @@ xnumon_kauth_vnode_cb(__attribute__((unused)) kauth_cred_t cred,
 
 	struct xnumon_cdev_entry *entry;
 	xnumon_msg_t *msg;
+	xnumon_msg_hash_t hash;
 	char path[MAXPATHLEN] = {0};
 	int pathlenz = MAXPATHLEN;
+	size_t pathsz;
 	uint64_t kcookie;
 	struct timespec tm;
+	size_t timeout;
+	xnumon_kauth_acked_t acked;
+	xnumon_msg_ident_t ident;
+	int nowait, keyed, repeat, degraded, hashed, ided;
 	int error;
 
 	_Static_assert(MAXPATHLEN <= XNUMON_MAXPATHLEN,
@@ -119,12 +441,46 @@ xnumon_kauth_vnode_cb(__attribute__((unused)) kauth_cred_t cred,
 	if (!strcmp(path, "/usr/lib/dyld"))
 		goto outunseen;
 
+	nowait = xnumon_kauth.filter_size > 0 &&
+	         xnumon_kauth_filter_match(path);
+	/* failing to identify the vnode only means more work for the daemon */
+	ided = !nowait && xnumon_kauth.ident &&
+	       xnumon_kauth_ident(vp, ctx, &ident) == 0;
+	/* failing to identify the vnode only means waiting for the ACK */
+	if (ided) {
+		acked.vp = vp;
+		acked.vid = vnode_vid(vp);
+		acked.mtime.tv_sec = ident.mtime_s;
+		acked.mtime.tv_nsec = ident.mtime_ns;
+		acked.ctime.tv_sec = ident.ctime_s;
+		acked.ctime.tv_nsec = ident.ctime_ns;
+		keyed = 1;
+	} else {
+		keyed = !nowait &&
+		        xnumon_kauth_acked_key(vp, ctx, &acked) == 0;
+	}
+	repeat = keyed && xnumon_kauth_acked_find(&acked);
+	timeout = nowait || repeat ? 0 : xnumon_kauth_timeout();
+	degraded = !nowait && !repeat && timeout == 0;
+	nowait = nowait || repeat || degraded;
+
+	/* failing to hash is not an error, the daemon hashes instead */
+	hashed = !nowait && xnumon_kauth.hash_max > 0 &&
+	         xnumon_kauth_hash(vp, ctx, &hash) == 0;
+
 	kcookie = (uint64_t)current_thread();
 	_Static_assert(sizeof(thread_t) <= sizeof(uint64_t),
 	               "sizeof(thread_t) <= sizeof(uint64_t)");
 	nanotime(&tm);
 
-	entry = xnumon_cdev_entry_alloc(sizeof(*msg) + pathlenz);
+	if (hashed || ided)
+		pathsz = XNUMON_MSG_ALIGN(sizeof(*msg) + pathlenz) -
+		         sizeof(*msg);
+	else
+		pathsz = pathlenz;
+	entry = xnumon_cdev_entry_alloc(sizeof(*msg) + pathsz +
+	                                (ided ? sizeof(ident) : 0) +
+	                                (hashed ? sizeof(hash) : 0));
 	if (!entry) {
 		printf(KEXTNAME_S ": kauth: xnumon_cdev_entry_alloc() "
 		       "failed\n");
@@ -133,16 +489,27 @@ xnumon_kauth_vnode_cb(__attribute__((unused)) kauth_cred_t cred,
 		goto out;
 	}
 	msg = (void*)entry->payload;
-	msg->version = XNUMON_MSG_VERSION;
+	if (ided)
+		msg->version = hashed ? XNUMON_MSG_VERSION_IDENT_HASH
+		                      : XNUMON_MSG_VERSION_IDENT;
+	else
+		msg->version = hashed ? XNUMON_MSG_VERSION_HASH
+		                      : XNUMON_MSG_VERSION;
 	msg->msgsz = entry->sz;
 	msg->pid = vfs_context_pid(ctx);
 	_Static_assert(sizeof(pid_t) <= sizeof(msg->pid),
 	               "sizeof(pid_t) <= sizeof(msg->pid)");
-	msg->cookie = kcookie ^ xnumon_kauth.cookie_mask;
+	msg->cookie = nowait ? 0 : kcookie ^ xnumon_kauth.cookie_mask;
 	/* auditpipe time resolution is microseconds, not nanoseconds */
 	msg->time_s = tm.tv_sec;
 	msg->time_ns = tm.tv_nsec - (tm.tv_nsec % 1000);
-	strncpy(msg->path, path, entry->sz - sizeof(*msg));
+	/* pads the path with NULs up to the identity or hash */
+	strncpy(msg->path, path, pathsz);
+	if (ided)
+		memcpy(msg->path + pathsz, &ident, sizeof(ident));
+	if (hashed)
+		memcpy(msg->path + pathsz + (ided ? sizeof(ident) : 0),
+		       &hash, sizeof(hash));
 	if (xnumon_cdev_enqueue(entry) != KERN_SUCCESS) {
 		xnumon_cdev_entry_free(entry);
 		printf(KEXTNAME_S ": kauth: xnumon_cdev_enqueue() failed\n");
@@ -150,6 +517,18 @@ xnumon_kauth_vnode_cb(__attribute__((unused)) kauth_cred_t cred,
 		OSIncrementAtomic64(&xnumon_kauth.errors);
 		goto out;
 	}
+	if (repeat) {
+		OSIncrementAtomic64(&xnumon_kauth.repeats);
+		goto out;
+	}
+	if (degraded) {
+		OSIncrementAtomic64(&xnumon_kauth.degraded);
+		goto out;
+	}
+	if (nowait) {
+		OSIncrementAtomic64(&xnumon_kauth.nowaits);
+		goto out;
+	}
 
 	size_t count = 0;
 	while (xnumon_kauth.active) {
@@ -164,7 +543,7 @@ xnumon_kauth_vnode_cb(__attribute__((unused)) kauth_cred_t cred,
 			goto outunseen;
 		}
 		if (error == EWOULDBLOCK) {
-			if (count++ > TIMEOUT_DSEC) {
+			if (count++ > timeout) {
 				/* count timeout as an error for checking */
 				OSIncrementAtomic(&xnumon_kauth.check_errors);
 				OSIncrementAtomic64(&xnumon_kauth.timeouts);
@@ -176,6 +555,10 @@ xnumon_kauth_vnode_cb(__attribute__((unused)) kauth_cred_t cred,
 		if (error) {
 			OSIncrementAtomic(&xnumon_kauth.check_errors);
 			OSIncrementAtomic64(&xnumon_kauth.errors);
+		} else {
+			xnumon_kauth_waited(&tm);
+			if (keyed)
+				xnumon_kauth_acked_put(&acked);
 		}
 		goto out;
 	}
@@ -226,11 +609,136 @@ xnumon_kauth_stats(uint64_t *defers, uint64_t *denies,
 	*visitors = (uint32_t)xnumon_kauth.visitors;
 }
 
+void
+xnumon_kauth_waits(uint64_t *nowaits, uint64_t *waits) {
+	*nowaits = (uint64_t)xnumon_kauth.nowaits;
+	for (int i = 0; i < XNUMON_WAIT_BUCKETS; i++)
+		waits[i] = (uint64_t)xnumon_kauth.waits[i];
+}
+
+void
+xnumon_kauth_degraded(uint64_t *degraded) {
+	*degraded = (uint64_t)xnumon_kauth.degraded;
+}
+
+void
+xnumon_kauth_repeats(uint64_t *repeats) {
+	*repeats = (uint64_t)xnumon_kauth.repeats;
+}
+
+/*
+ * Set the daemon backlog and the watermark at which execs stop waiting for
+ * the ACK, 0 to always wait.
+ */
+int
+xnumon_kauth_set_backlog(uint32_t backlog, uint32_t watermark) {
+	if (!xnumon_kauth.active)
+		return ENXIO;
+	if (xnumon_kauth.watermark != watermark)
+		printf(KEXTNAME_S ": kauth: backlog watermark set to %u\n",
+		       watermark);
+	xnumon_kauth.backlog = backlog;
+	xnumon_kauth.watermark = watermark;
+	return 0;
+}
+
+/*
+ * Turn identification of vnodes in messages on or off.
+ */
+int
+xnumon_kauth_set_ident(uint32_t on) {
+	if (!xnumon_kauth.active)
+		return ENXIO;
+	xnumon_kauth.ident = !!on;
+	printf(KEXTNAME_S ": kauth: %s vnodes\n",
+	       on ? "identifying" : "not identifying");
+	return 0;
+}
+
+/*
+ * Set the maximum size of images to hash, 0 to stop hashing.
+ */
+int
+xnumon_kauth_set_hash(uint32_t max) {
+	if (!xnumon_kauth.active)
+		return ENXIO;
+	xnumon_kauth.hash_max = max;
+	printf(KEXTNAME_S ": kauth: hashing images up to %u bytes\n", max);
+	return 0;
+}
+
+/*
+ * Replace the filter with size bytes copied from userspace address uaddr.
+ * Must be called from the context of the attached daemon.  Returns 0 on
+ * success or an errno value.
+ */
+int
+xnumon_kauth_set_filter(user_addr_t uaddr, uint32_t size) {
+	char *filter = NULL;
+	char *old;
+	uint32_t oldsize;
+	size_t len;
+	int error;
+
+	if (!xnumon_kauth.active)
+		return ENXIO;
+	if (size > XNUMON_FILTER_MAX)
+		return EINVAL;
+
+	if (size > 0) {
+		filter = OSMalloc(size, xnumon_kauth.mtag);
+		if (!filter)
+			return ENOMEM;
+		error = copyin(uaddr, filter, size);
+		if (error) {
+			OSFree(filter, size, xnumon_kauth.mtag);
+			return error;
+		}
+		if (filter[size - 1] != '\0')
+			goto einval;
+		for (char *p = filter; p < filter + size; p += len + 1) {
+			len = strlen(p);
+			if (len < 2 || p[0] != '/')
+				goto einval;
+		}
+	}
+
+	lck_rw_lock_exclusive(xnumon_kauth.filter_lck);
+	old = xnumon_kauth.filter;
+	oldsize = xnumon_kauth.filter_size;
+	xnumon_kauth.filter = filter;
+	xnumon_kauth.filter_size = size;
+	lck_rw_unlock_exclusive(xnumon_kauth.filter_lck);
+
+	if (old)
+		OSFree(old, oldsize, xnumon_kauth.mtag);
+	printf(KEXTNAME_S ": kauth: filter set to %u bytes\n", size);
+	return 0;
+
+einval:
+	OSFree(filter, size, xnumon_kauth.mtag);
+	return EINVAL;
+}
+
 static void
 xnumon_kauth_free(void) {
 	KASSERT(xnumon_kauth.active == 0,
 	        "xnumon_kauth_free: xnumon_kauth.active != 0");
 
+	if (xnumon_kauth.filter) {
+		OSFree(xnumon_kauth.filter, xnumon_kauth.filter_size,
+		       xnumon_kauth.mtag);
+		xnumon_kauth.filter = NULL;
+		xnumon_kauth.filter_size = 0;
+	}
+	if (xnumon_kauth.filter_lck) {
+		lck_rw_free(xnumon_kauth.filter_lck, xnumon_kauth.lck_grp);
+		xnumon_kauth.filter_lck = NULL;
+	}
+	if (xnumon_kauth.acked_lck) {
+		lck_spin_free(xnumon_kauth.acked_lck, xnumon_kauth.lck_grp);
+		xnumon_kauth.acked_lck = NULL;
+	}
 	if (xnumon_kauth.lck_mtx) {
 		lck_mtx_free(xnumon_kauth.lck_mtx, xnumon_kauth.lck_grp);
 		xnumon_kauth.lck_mtx = NULL;
@@ -239,6 +747,10 @@ xnumon_kauth_free(void) {
 		lck_grp_free(xnumon_kauth.lck_grp);
 		xnumon_kauth.lck_grp = NULL;
 	}
+	if (xnumon_kauth.mtag) {
+		OSMalloc_Tagfree(xnumon_kauth.mtag);
+		xnumon_kauth.mtag = NULL;
+	}
 }
 
 kern_return_t
@@ -248,6 +760,13 @@ xnumon_kauth_start(void) {
 
 	bzero(&xnumon_kauth, sizeof(xnumon_kauth));
 
+	xnumon_kauth.mtag = OSMalloc_Tagalloc(BUNDLEID_S ".kauth",
+	                                      OSMT_DEFAULT);
+	if (!xnumon_kauth.mtag) {
+		printf(KEXTNAME_S ": OSMalloc_Tagalloc failed\n");
+		return KERN_FAILURE;
+	}
+
 	xnumon_kauth.lck_grp = lck_grp_alloc_init(BUNDLEID_S ".kauth",
 	                                          LCK_GRP_ATTR_NULL);
 	if (!xnumon_kauth.lck_grp) {
@@ -264,8 +783,26 @@ xnumon_kauth_start(void) {
 		return KERN_FAILURE;
 	}
 
+	xnumon_kauth.filter_lck = lck_rw_alloc_init(xnumon_kauth.lck_grp,
+	                                            LCK_ATTR_NULL);
+	if (!xnumon_kauth.filter_lck) {
+		printf(KEXTNAME_S ": lck_rw_alloc_init failed\n");
+		xnumon_kauth_free();
+		return KERN_FAILURE;
+	}
+
+	xnumon_kauth.acked_lck = lck_spin_alloc_init(xnumon_kauth.lck_grp,
+	                                             LCK_ATTR_NULL);
+	if (!xnumon_kauth.acked_lck) {
+		printf(KEXTNAME_S ": lck_spin_alloc_init failed\n");
+		xnumon_kauth_free();
+		return KERN_FAILURE;
+	}
+
 	read_random(&xnumon_kauth.cookie_mask,
 	            sizeof(xnumon_kauth.cookie_mask));
+	/* thread pointers are aligned, so real cookies are never 0 */
+	xnumon_kauth.cookie_mask |= 1;
 
 	xnumon_kauth.active = 1;
 	xnumon_kauth.next_check = CHECK_EVERY;
@@ -16,6 +16,13 @@
 void xnumon_kauth_release(uint64_t);
 void xnumon_kauth_stats(uint64_t *, uint64_t *, uint64_t *, uint64_t *,
                         uint32_t *);
+void xnumon_kauth_waits(uint64_t *, uint64_t *);
+int xnumon_kauth_set_filter(user_addr_t, uint32_t);
+int xnumon_kauth_set_hash(uint32_t);
+int xnumon_kauth_set_ident(uint32_t);
+int xnumon_kauth_set_backlog(uint32_t, uint32_t);
+void xnumon_kauth_degraded(uint64_t *);
+void xnumon_kauth_repeats(uint64_t *);
 kern_return_t xnumon_kauth_start(void);
 kern_return_t xnumon_kauth_stop(void);
 
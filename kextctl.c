@@ -82,18 +82,64 @@ kextctl_load(void) {
 	return 0;
 }
 
+static uint32_t proto = 1;
+
+/*
+ * Open the device and negotiate the protocol version.  Kexts predating
+ * protocol version 2 reject XNUMON_SET_PROTO with ENOTTY, in which case we
+ * fall back to protocol version 1 with one message per read and one ioctl
+ * per ACK.  With protocol version 2, the fd is put into non-blocking mode
+ * so that the queue can be drained with back-to-back reads without risking
+ * to block once it runs empty.
+ */
 int
 kextctl_open(void) {
+	uint32_t want = XNUMON_PROTO_VERSION;
+	int on = 1;
+	int fd;
+
 	/* Block SIGTSTP regardless if calling code will catch it or not in
 	 * order to avoid the kext waiting for us while we are stopped.
 	 * Since SIGSTOP cannot be ignored, the kext still needs to able to
 	 * deal with the connected process being stopped. */
 	signal(SIGTSTP, SIG_IGN);
-	return open(XNUMON_DEVPATH, O_RDONLY);
+	fd = open(XNUMON_DEVPATH, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	if (ioctl(fd, XNUMON_SET_PROTO, &want) == 0 &&
+	    ioctl(fd, FIONBIO, &on) == 0) {
+		proto = want;
+	} else {
+		want = 1;
+		(void)ioctl(fd, XNUMON_SET_PROTO, &want);
+		proto = 1;
+	}
+	return fd;
+}
+
+/*
+ * Use fd in place of the device, such as a non-blocking datagram socket
+ * delivering recorded messages when replaying a trace.  Messages from fd
+ * are read using protocol version 2.  Recorded messages have cookie 0 and
+ * are therefore never acknowledged.
+ */
+int
+kextctl_attach(int fd) {
+	proto = XNUMON_PROTO_VERSION;
+	return fd;
+}
+
+int
+kextctl_proto(void) {
+	return (int)proto;
 }
 
 char buf[XNUMON_MSG_MAX];
 
+/* room for a full batch of maximum size messages including padding */
+#define BATCHBUFSZ (XNUMON_ACKV_MAX * XNUMON_MSG_ALIGN(XNUMON_MSG_MAX))
+static uint64_t batchbuf[BATCHBUFSZ / sizeof(uint64_t)];
+
 /*
  * The current implementation passes a static buffer to the caller.
  * This is okay as long as receiving messages from this file descriptor is
@@ -114,7 +160,8 @@ kextctl_recv(int fd) {
 		fprintf(stderr, "short read (header)\n");
 		return NULL;
 	}
-	if (msg->version != XNUMON_MSG_VERSION) {
+	if (msg->version < XNUMON_MSG_VERSION ||
+	    msg->version > XNUMON_MSG_VERSION_IDENT_HASH) {
 		fprintf(stderr, "version mismatch\n");
 		return NULL;
 	}
@@ -122,7 +169,7 @@ kextctl_recv(int fd) {
 		fprintf(stderr, "message too long\n");
 		return NULL;
 	}
-	if (msg->msgsz <= XNUMON_MSG_HDR) {
+	if (msg->msgsz <= XNUMON_MSG_HDR + XNUMON_MSG_TRAILER(msg)) {
 		fprintf(stderr, "message too short\n");
 		return NULL;
 	}
@@ -136,13 +183,133 @@ kextctl_recv(int fd) {
 		fprintf(stderr, "short read (body)\n");
 		return NULL;
 	}
-	if (buf[msg->msgsz - 1] != '\0') {
+	if (buf[msg->msgsz - XNUMON_MSG_TRAILER(msg) - 1] != '\0') {
 		fprintf(stderr, "path not null-terminated\n");
 		return NULL;
 	}
 	return msg;
 }
 
+/*
+ * Receive up to msgc messages into msgv and return the number of messages
+ * received, 0 if the queue is empty, or -1 on errors.  Using protocol version
+ * 1, this receives exactly one message and blocks while the queue is empty.
+ * Like kextctl_recv, the messages point into a static buffer and remain valid
+ * until the next call.
+ */
+ssize_t
+kextctl_recv_batch(int fd, const xnumon_msg_t **msgv, size_t msgc) {
+	const xnumon_msg_t *msg;
+	char *p = (char *)batchbuf;
+	size_t off, count;
+	ssize_t n;
+
+	assert(msgc > 0);
+	if (proto < 2) {
+		msg = kextctl_recv(fd);
+		if (!msg)
+			return -1;
+		msgv[0] = msg;
+		return 1;
+	}
+
+	if (msgc > XNUMON_ACKV_MAX)
+		msgc = XNUMON_ACKV_MAX;
+	n = read(fd, batchbuf, msgc * XNUMON_MSG_ALIGN(XNUMON_MSG_MAX));
+	if (n < 0 && errno == EAGAIN)
+		return 0;
+	if (n < 0) {
+		fprintf(stderr, "read() failed: %s (%i)\n",
+		                strerror(errno), errno);
+		return -1;
+	}
+
+	off = 0;
+	count = 0;
+	while (off < (size_t)n && count < msgc) {
+		msg = (const xnumon_msg_t *)(p + off);
+		if ((size_t)n - off < XNUMON_MSG_HDR) {
+			fprintf(stderr, "short read (header)\n");
+			return -1;
+		}
+		if (msg->version < XNUMON_MSG_VERSION ||
+		    msg->version > XNUMON_MSG_VERSION_IDENT_HASH) {
+			fprintf(stderr, "version mismatch\n");
+			return -1;
+		}
+		if (msg->msgsz > XNUMON_MSG_MAX) {
+			fprintf(stderr, "message too long\n");
+			return -1;
+		}
+		if (msg->msgsz <= XNUMON_MSG_HDR + XNUMON_MSG_TRAILER(msg)) {
+			fprintf(stderr, "message too short\n");
+			return -1;
+		}
+		if ((size_t)n - off < msg->msgsz) {
+			fprintf(stderr, "short read (body)\n");
+			return -1;
+		}
+		if (p[off + msg->msgsz - XNUMON_MSG_TRAILER(msg) - 1] !=
+		    '\0') {
+			fprintf(stderr, "path not null-terminated\n");
+			return -1;
+		}
+		msgv[count++] = msg;
+		off += XNUMON_MSG_ALIGN(msg->msgsz);
+	}
+	if (count == 0) {
+		fprintf(stderr, "short read (header)\n");
+		return -1;
+	}
+	return (ssize_t)count;
+}
+
+/*
+ * Acknowledge msgc messages.  Using protocol version 2, this costs a single
+ * ioctl per XNUMON_ACKV_MAX messages instead of one ioctl per message.
+ */
+int
+kextctl_ack_batch(int fd, const xnumon_msg_t **msgv, size_t msgc) {
+	xnumon_ackv_t ackv;
+	size_t i;
+	int rv;
+
+	if (proto < 2) {
+		for (i = 0; i < msgc; i++) {
+			if (kextctl_ack(fd, msgv[i]) == -1)
+				return -1;
+		}
+		return 0;
+	}
+
+	/* messages with cookie 0 were not waited for, see XNUMON_SET_FILTER */
+	ackv.count = 0;
+	ackv.reserved = 0;
+	for (i = 0; i < msgc; i++) {
+		if (msgv[i]->cookie == 0)
+			continue;
+		ackv.cookie[ackv.count++] = msgv[i]->cookie;
+		if (ackv.count < XNUMON_ACKV_MAX)
+			continue;
+		rv = ioctl(fd, XNUMON_ACK_COOKIES, &ackv);
+		if (rv == -1) {
+			fprintf(stderr, "ioctl() failed: %s (%i)\n",
+			                strerror(errno), errno);
+			return -1;
+		}
+		ackv.count = 0;
+	}
+	if (ackv.count > 0) {
+		rv = ioctl(fd, XNUMON_ACK_COOKIES, &ackv);
+		if (rv == -1) {
+			fprintf(stderr, "ioctl() failed: %s (%i)\n",
+			                strerror(errno), errno);
+			return -1;
+		}
+	}
+	return 0;
+}
+
 int
 kextctl_ack(int fd, const xnumon_msg_t *msg) {
 	int rv;
@@ -156,15 +323,135 @@ kextctl_ack(int fd, const xnumon_msg_t *msg) {
 	return rv;
 }
 
+/*
+ * Push the absolute paths of images the kext does not need to wait for;
+ * paths ending in a slash match all images beneath that directory.
+ * Requires protocol version 2; fails with ENOTSUP otherwise, and with
+ * EINVAL if the kext does not support paths other than directories.
+ */
+int
+kextctl_filter(int fd, const setstr_prefix_t *prefixes, size_t count) {
+	xnumon_filter_t filter;
+	char *buf, *p;
+	size_t size = 0;
+	int rv;
+
+	if (proto < 2) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	for (size_t i = 0; i < count; i++)
+		size += prefixes[i].len + 1;
+	if (size > XNUMON_FILTER_MAX) {
+		errno = E2BIG;
+		return -1;
+	}
+	buf = malloc(size > 0 ? size : 1);
+	if (!buf)
+		return -1;
+	p = buf;
+	for (size_t i = 0; i < count; i++) {
+		memcpy(p, prefixes[i].str, prefixes[i].len + 1);
+		p += prefixes[i].len + 1;
+	}
+	filter.addr = (uint64_t)(uintptr_t)buf;
+	filter.size = (uint32_t)size;
+	filter.reserved = 0;
+	rv = ioctl(fd, XNUMON_SET_FILTER, &filter);
+	free(buf);
+	return rv;
+}
+
+/*
+ * Ask the kext to hash images of up to max bytes.  Requires protocol version
+ * 2; fails with ENOTSUP otherwise, and with ENOTTY with kexts that do not
+ * support hashing.
+ */
+int
+kextctl_hash(int fd, uint32_t max) {
+	if (proto < 2) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	return ioctl(fd, XNUMON_SET_HASH, &max);
+}
+
+/*
+ * Ask the kext to identify the vnode of each exec in its messages.  Requires
+ * protocol version 2; fails with ENOTSUP otherwise, and with ENOTTY with
+ * kexts that do not support identification.
+ */
+int
+kextctl_ident(int fd, bool on) {
+	uint32_t v = on ? 1 : 0;
+
+	if (proto < 2) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	return ioctl(fd, XNUMON_SET_IDENT, &v);
+}
+
+/*
+ * Report the backlog of exec messages in the daemon and the watermark at
+ * which the kext stops waiting for ACKs.  Requires protocol version 2;
+ * fails with ENOTSUP otherwise, and with ENOTTY with kexts that do not
+ * support backlog reporting.
+ */
+int
+kextctl_backlog(int fd, uint32_t backlog, uint32_t watermark) {
+	xnumon_backlog_t bl;
+
+	if (proto < 2) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	bl.backlog = backlog;
+	bl.watermark = watermark;
+	return ioctl(fd, XNUMON_SET_BACKLOG, &bl);
+}
+
+/*
+ * Kexts predating the repeat exec cache only know the shorter V4 stats,
+ * kexts predating backlog reporting the V3 stats, kexts predating the
+ * message pool the V2 stats, and kexts predating the exec wait histogram
+ * only the even shorter V1 stats; fields beyond those are all zeroes for
+ * those.
+ */
 int
 kextctl_stats(int fd, xnumon_stat_t *st) {
 	assert(st);
-	return ioctl(fd, XNUMON_GET_STATS, st);
+	if (ioctl(fd, XNUMON_GET_STATS, st) == 0)
+		return 0;
+	if (errno != ENOTTY)
+		return -1;
+	memset((char *)st + XNUMON_STAT_V4_SZ, 0,
+	       sizeof(xnumon_stat_t) - XNUMON_STAT_V4_SZ);
+	if (ioctl(fd, XNUMON_GET_STATS_V4, st) == 0)
+		return 0;
+	if (errno != ENOTTY)
+		return -1;
+	memset((char *)st + XNUMON_STAT_V3_SZ, 0,
+	       sizeof(xnumon_stat_t) - XNUMON_STAT_V3_SZ);
+	if (ioctl(fd, XNUMON_GET_STATS_V3, st) == 0)
+		return 0;
+	if (errno != ENOTTY)
+		return -1;
+	memset((char *)st + XNUMON_STAT_V2_SZ, 0,
+	       sizeof(xnumon_stat_t) - XNUMON_STAT_V2_SZ);
+	if (ioctl(fd, XNUMON_GET_STATS_V2, st) == 0)
+		return 0;
+	if (errno != ENOTTY)
+		return -1;
+	memset((char *)st + XNUMON_STAT_V1_SZ, 0,
+	       sizeof(xnumon_stat_t) - XNUMON_STAT_V1_SZ);
+	return ioctl(fd, XNUMON_GET_STATS_V1, st);
 }
 
 void
 kextctl_version(FILE *f) {
-	fprintf(f, "Kernel extension protocol version: %i\n",
-	           XNUMON_MSG_VERSION);
+	fprintf(f, "Kernel extension protocol version: %i "
+	           "(message version %i)\n",
+	           XNUMON_PROTO_VERSION, XNUMON_MSG_VERSION_IDENT_HASH);
 }
 
@@ -13,13 +13,25 @@
 
 #include "attrib.h"
 #include "kext/xnumon.h"
+#include "setstr.h"
 
 #include <stdio.h>
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 int kextctl_load(void);
 int kextctl_open(void);
+int kextctl_attach(int);
+int kextctl_proto(void);
 const xnumon_msg_t * kextctl_recv(int);
+ssize_t kextctl_recv_batch(int, const xnumon_msg_t **, size_t) NONNULL(2);
 int kextctl_ack(int, const xnumon_msg_t *) NONNULL(2);
+int kextctl_ack_batch(int, const xnumon_msg_t **, size_t) NONNULL(2);
+int kextctl_filter(int, const setstr_prefix_t *, size_t);
+int kextctl_hash(int, uint32_t);
+int kextctl_ident(int, bool);
+int kextctl_backlog(int, uint32_t, uint32_t);
 int kextctl_stats(int, xnumon_stat_t *) NONNULL(2);
 void kextctl_version(FILE *) NONNULL(1);
 
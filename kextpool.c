@@ -0,0 +1,195 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "kextpool.h"
+
+#include "config.h"
+#include "kextctl.h"
+#include "procmon.h"
+#include "queue.h"
+#include "policy.h"
+#include "thrstat.h"
+#include "counter.h"
+#include "probes.h"
+#include "minmax.h"
+
+#include "tommyhash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <assert.h>
+
+/*
+ * Pool of threads handling the exec messages of the kext while the execs are
+ * blocked, such that opening and hashing a slow or large image does not hold
+ * up the unrelated execs queued behind it.  The kextloop thread keeps reading
+ * batches from the device and hands each message to a pool thread, which
+ * acknowledges it by its cookie as soon as it has been handled.  Messages are
+ * assigned to threads by pid, such that the messages of a process are handled
+ * in order and enter the prep queue in order.
+ *
+ * Messages are copied, since kextctl_recv_batch reuses its buffer.  Failing
+ * to acknowledge a message is fatal to the kextloop, as it is without pool.
+ */
+
+typedef struct {
+	queue_t queue;
+	pthread_t thr;
+} kextpool_worker_t;
+
+#define KEXTPOOL_QUEUE          256     /* messages per thread */
+#define KEXTPOOL_BATCH          16
+
+static kextpool_worker_t workers[KEXT_THREADS_MAX];
+static size_t nworkers = 0;
+static int kefd = -1;
+static atomic_bool broken;
+static counter_t dispatched;
+
+static void *
+kextpool_thread(void *arg) {
+	kextpool_worker_t *worker = arg;
+	xnumon_msg_t *msg;
+	void *batch[KEXTPOOL_BATCH];
+	struct timespec tm;
+	size_t n;
+	int rv;
+
+	(void)policy_thread_diskio_important();
+	(void)policy_thread_qos(THRSTAT_KEXTLOOP);
+	thrstat_register(THRSTAT_KEXTLOOP);
+
+	for (;;) {
+		n = queue_dequeue_batch(&worker->queue, batch, KEXTPOOL_BATCH);
+		for (size_t i = 0; i < n; i++) {
+			if (batch[i] == worker)
+				return NULL;
+			msg = batch[i];
+			tm.tv_sec = msg->time_s;
+			tm.tv_nsec = msg->time_ns;
+			procmon_kern_preexec(&tm, (pid_t)msg->pid, msg->path,
+			                     XNUMON_MSG_HASH(msg),
+			                     XNUMON_MSG_IDENT(msg));
+			/* cookie 0 was not waited for, see XNUMON_SET_FILTER */
+			if (msg->cookie != 0 && !atomic_load(&broken)) {
+				rv = kextctl_ack(kefd, msg);
+				XNUMON_KEXT_ACK(1, rv);
+				if (rv == -1) {
+					fprintf(stderr, "Failed to acknowledge "
+					                "message from kext\n");
+					atomic_store(&broken, true);
+				}
+			}
+			free(msg);
+			counter_inc(&dispatched);
+		}
+	}
+}
+
+static void
+kextpool_stop(kextpool_worker_t *worker) {
+	queue_enqueue_wait(&worker->queue, worker);
+	if (pthread_join(worker->thr, NULL) != 0) {
+		fprintf(stderr, "Failed to join kextpool thread - exiting\n");
+		exit(EXIT_FAILURE);
+	}
+	assert(queue_size(&worker->queue) == 0);
+	queue_destroy(&worker->queue);
+}
+
+/*
+ * Start the given number of pool threads, acknowledging messages on fd.
+ * With 0 threads, the caller handles all messages itself.
+ */
+int
+kextpool_init(int fd, size_t threads) {
+	assert(threads <= KEXT_THREADS_MAX);
+
+	kefd = fd;
+	atomic_init(&broken, false);
+	counter_reset(&dispatched);
+	for (nworkers = 0; nworkers < threads; nworkers++) {
+		kextpool_worker_t *worker = &workers[nworkers];
+
+		if (queue_init(&worker->queue, KEXTPOOL_QUEUE,
+		               QUEUE_BLOCK, NULL) == -1)
+			goto errout;
+		if (pthread_create(&worker->thr, NULL, kextpool_thread,
+		                   worker) != 0) {
+			queue_destroy(&worker->queue);
+			goto errout;
+		}
+	}
+	return 0;
+
+errout:
+	kextpool_fini();
+	return -1;
+}
+
+/*
+ * Wait for the pool threads to handle all queued messages and stop them.
+ * Must be called before closing the fd passed to kextpool_init.
+ */
+void
+kextpool_fini(void) {
+	while (nworkers > 0)
+		kextpool_stop(&workers[--nworkers]);
+	kefd = -1;
+}
+
+size_t
+kextpool_threads(void) {
+	return nworkers;
+}
+
+/*
+ * Queue a copy of msg to the pool thread of its pid.  Blocks while the queue
+ * of that thread is full.  Returns -1 if a pool thread failed to acknowledge
+ * a message or on OOM.
+ */
+int
+kextpool_submit(const xnumon_msg_t *msg) {
+	xnumon_msg_t *copy;
+	size_t i;
+
+	assert(nworkers > 0);
+	if (atomic_load(&broken)) {
+		errno = EIO;
+		return -1;
+	}
+	copy = malloc(msg->msgsz);
+	if (!copy)
+		return -1;
+	memcpy(copy, msg, msg->msgsz);
+	i = tommy_inthash_u32((uint32_t)msg->pid) % nworkers;
+	queue_enqueue_wait(&workers[i].queue, copy);
+	return 0;
+}
+
+void
+kextpool_stats(kextpool_stat_t *st) {
+	st->threads = (uint32_t)nworkers;
+	st->dispatched = counter_get(&dispatched);
+	st->peak = 0;
+	st->blocks = 0;
+	for (size_t i = 0; i < nworkers; i++) {
+		queue_t *q = &workers[i].queue;
+
+		st->peak = max(st->peak, (uint64_t)queue_peak(q));
+		st->blocks += queue_blocks(q);
+	}
+}
+
@@ -0,0 +1,34 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef KEXTPOOL_H
+#define KEXTPOOL_H
+
+#include "attrib.h"
+#include "kext/xnumon.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+	uint32_t threads;
+	uint64_t dispatched;            /* messages handled by pool threads */
+	uint64_t peak;                  /* highest queue depth seen */
+	uint64_t blocks;                /* reader waited for a full queue */
+} kextpool_stat_t;
+
+int kextpool_init(int, size_t) WUNRES;
+void kextpool_fini(void);
+size_t kextpool_threads(void) WUNRES;
+int kextpool_submit(const xnumon_msg_t *) NONNULL(1) WUNRES;
+void kextpool_stats(kextpool_stat_t *) NONNULL(1);
+
+#endif
+
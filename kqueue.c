@@ -27,12 +27,27 @@
  * the kqueue fd for signals and timers.  For now, only support 10.11+.
  */
 
+/*
+ * The event buffer has room for one event per registered filter, so that a
+ * single kevent() call returns all filters that are ready.  Read handlers
+ * are passed the data count from the event and are expected to drain their
+ * file descriptor in batches instead of reading one record per event.
+ * Handlers may add and remove file descriptors while the buffer is being
+ * dispatched, so the buffer is only grown before waiting for events.  If
+ * growing fails, the old buffer is kept and fewer events are returned per
+ * kevent() call.
+ */
 static int
-kqueue_enlarge(kqueue_t *kq) {
-	kq->nke++;
-	kq->ke = realloc(kq->ke, kq->nke * sizeof(struct kevent));
-	if (!kq->ke)
-		return -1;
+kqueue_grow(kqueue_t *kq) {
+	struct kevent *ke;
+
+	if (kq->cap >= kq->nke)
+		return 0;
+	ke = realloc(kq->ke, kq->nke * sizeof(struct kevent));
+	if (!ke)
+		return kq->ke ? 0 : -1;
+	kq->ke = ke;
+	kq->cap = kq->nke;
 	return 0;
 }
 
@@ -61,20 +76,20 @@ kqueue_free(kqueue_t *kq) {
 	free(kq);
 }
 
+/*
+ * Wait for and dispatch ready events.  Blocks until an event is ready if
+ * timeout is NULL; other threads interrupt the wait using user events.
+ */
 int
-kqueue_dispatch(kqueue_t *kq) {
+kqueue_dispatch(kqueue_t *kq, const struct timespec *timeout) {
 	kevent_ctx_t *ctx;
 	int nev;
-	struct timespec timeout;
 
-	if (!kq->ke)
+	if (kqueue_grow(kq) == -1 || kq->cap == 0)
 		return -1;
 
-	bzero(&timeout, sizeof(struct timespec));
-	timeout.tv_sec = 1;
-
 retry:
-	nev = kevent(kq->fd, NULL, 0, kq->ke, kq->nke, &timeout);
+	nev = kevent(kq->fd, NULL, 0, kq->ke, kq->cap, timeout);
 	if (nev == 0)
 		return 0;
 	if (nev == -1) {
@@ -96,6 +111,17 @@ retry:
 			return -1;
 	}
 
+	/* process user events */
+	for (size_t i = 0; i < (size_t)nev; i++) {
+		if (kq->ke[i].filter != EVFILT_USER)
+			continue;
+		ctx = (kevent_ctx_t *)kq->ke[i].udata;
+		assert(ctx);
+		assert(ctx->user);
+		if (ctx->user((int)kq->ke[i].ident, ctx->udata) == -1)
+			return -1;
+	}
+
 	/* process timers */
 	for (size_t i = 0; i < (size_t)nev; i++) {
 		if (kq->ke[i].filter != EVFILT_TIMER)
@@ -107,6 +133,17 @@ retry:
 			return -1;
 	}
 
+	/* process filesystem changes */
+	for (size_t i = 0; i < (size_t)nev; i++) {
+		if (kq->ke[i].filter != EVFILT_FS)
+			continue;
+		ctx = (kevent_ctx_t *)kq->ke[i].udata;
+		assert(ctx);
+		assert(ctx->fs);
+		if (ctx->fs((unsigned int)kq->ke[i].fflags, ctx->udata) == -1)
+			return -1;
+	}
+
 	/* process file descriptors */
 	for (size_t i = 0; i < (size_t)nev; i++) {
 		if (kq->ke[i].filter != EVFILT_READ)
@@ -114,7 +151,8 @@ retry:
 		ctx = (kevent_ctx_t *)kq->ke[i].udata;
 		assert(ctx);
 		assert(ctx->fd_read);
-		if (ctx->fd_read((int)kq->ke[i].ident, ctx->udata) == -1)
+		if (ctx->fd_read((int)kq->ke[i].ident,
+		                 (size_t)kq->ke[i].data, ctx->udata) == -1)
 			return -1;
 	}
 
@@ -125,30 +163,111 @@ int
 kqueue_add_fd_read(kqueue_t *kq, int fd, kevent_ctx_t *ctx) {
 	struct kevent ke;
 
-	if (kqueue_enlarge(kq) == -1)
-		return -1;
 	EV_SET(&ke, fd, EVFILT_READ, EV_ADD, NOTE_LOWAT, 1, ctx);
-	return kevent(kq->fd, &ke, 1, NULL, 0, NULL);
+	if (kevent(kq->fd, &ke, 1, NULL, 0, NULL) == -1)
+		return -1;
+	kq->nke++;
+	return 0;
 }
 
+/*
+ * Remove a file descriptor previously added with kqueue_add_fd_read.  Must be
+ * called before closing the file descriptor.
+ */
 int
-kqueue_add_signal(kqueue_t *kq, int sig, kevent_ctx_t *ctx) {
+kqueue_del_fd_read(kqueue_t *kq, int fd) {
 	struct kevent ke;
 
-	if (kqueue_enlarge(kq) == -1)
+	EV_SET(&ke, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+	if (kevent(kq->fd, &ke, 1, NULL, 0, NULL) == -1)
 		return -1;
+	kq->nke--;
+	return 0;
+}
+
+int
+kqueue_add_signal(kqueue_t *kq, int sig, kevent_ctx_t *ctx) {
+	struct kevent ke;
+
 	signal(sig, SIG_IGN);
 	EV_SET(&ke, sig, EVFILT_SIGNAL, EV_ADD, 0, 0, ctx);
-	return kevent(kq->fd, &ke, 1, NULL, 0, NULL);
+	if (kevent(kq->fd, &ke, 1, NULL, 0, NULL) == -1)
+		return -1;
+	kq->nke++;
+	return 0;
 }
 
 int
 kqueue_add_timer(kqueue_t *kq, int ident, int secs, kevent_ctx_t *ctx) {
 	struct kevent ke;
 
-	if (kqueue_enlarge(kq) == -1)
+	EV_SET(&ke, ident, EVFILT_TIMER, EV_ADD, NOTE_SECONDS, secs, ctx);
+	if (kevent(kq->fd, &ke, 1, NULL, 0, NULL) == -1)
 		return -1;
+	kq->nke++;
+	return 0;
+}
+
+/*
+ * Change the interval of a timer previously added with kqueue_add_timer.
+ */
+int
+kqueue_mod_timer(kqueue_t *kq, int ident, int secs, kevent_ctx_t *ctx) {
+	struct kevent ke;
+
 	EV_SET(&ke, ident, EVFILT_TIMER, EV_ADD, NOTE_SECONDS, secs, ctx);
 	return kevent(kq->fd, &ke, 1, NULL, 0, NULL);
 }
 
+/*
+ * Remove a timer previously added with kqueue_add_timer.
+ */
+int
+kqueue_del_timer(kqueue_t *kq, int ident) {
+	struct kevent ke;
+
+	EV_SET(&ke, ident, EVFILT_TIMER, EV_DELETE, 0, 0, NULL);
+	return kevent(kq->fd, &ke, 1, NULL, 0, NULL);
+}
+
+/*
+ * User events are cleared when dispatched, such that any number of triggers
+ * before the next kqueue_dispatch result in a single call of the handler.
+ */
+int
+kqueue_add_user(kqueue_t *kq, int ident, kevent_ctx_t *ctx) {
+	struct kevent ke;
+
+	EV_SET(&ke, ident, EVFILT_USER, EV_ADD|EV_CLEAR, 0, 0, ctx);
+	if (kevent(kq->fd, &ke, 1, NULL, 0, NULL) == -1)
+		return -1;
+	kq->nke++;
+	return 0;
+}
+
+/*
+ * Wake up the thread dispatching kq.  Safe to call from any thread.
+ */
+int
+kqueue_trigger_user(kqueue_t *kq, int ident) {
+	struct kevent ke;
+
+	EV_SET(&ke, ident, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+	return kevent(kq->fd, &ke, 1, NULL, 0, NULL);
+}
+
+/*
+ * Filesystem events are global and report mounts and unmounts of any
+ * filesystem in fflags; the handler has to find out which one changed.
+ */
+int
+kqueue_add_fs(kqueue_t *kq, kevent_ctx_t *ctx) {
+	struct kevent ke;
+
+	EV_SET(&ke, 0, EVFILT_FS, EV_ADD|EV_CLEAR, VQ_MOUNT|VQ_UNMOUNT, 0,
+	       ctx);
+	if (kevent(kq->fd, &ke, 1, NULL, 0, NULL) == -1)
+		return -1;
+	kq->nke++;
+	return 0;
+}
@@ -18,33 +18,47 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <time.h>
 
-typedef int (*kevent_fd_read_func_t)(int, void *);
+typedef int (*kevent_fd_read_func_t)(int, size_t, void *);
 typedef int (*kevent_signal_func_t)(int, void *);
 typedef int (*kevent_timer_func_t)(int, void *);
+typedef int (*kevent_user_func_t)(int, void *);
+typedef int (*kevent_fs_func_t)(unsigned int, void *);
 
 typedef struct {
 	kevent_fd_read_func_t fd_read;
 	kevent_signal_func_t signal;
 	kevent_timer_func_t timer;
+	kevent_user_func_t user;
+	kevent_fs_func_t fs;
 	void *udata;
 } kevent_ctx_t;
 
-#define KEVENT_CTX_SIGNAL(SF,UD)            {NULL, (SF), NULL, (UD)}
-#define KEVENT_CTX_FD_READ(RF,UD)           {(RF), NULL, NULL, (UD)}
-#define KEVENT_CTX_TIMER(TF,UD)             {NULL, NULL, (TF), (UD)}
+#define KEVENT_CTX_SIGNAL(SF,UD)            {NULL, (SF), NULL, NULL, NULL, (UD)}
+#define KEVENT_CTX_FD_READ(RF,UD)           {(RF), NULL, NULL, NULL, NULL, (UD)}
+#define KEVENT_CTX_TIMER(TF,UD)             {NULL, NULL, (TF), NULL, NULL, (UD)}
+#define KEVENT_CTX_USER(UF,UD)              {NULL, NULL, NULL, (UF), NULL, (UD)}
+#define KEVENT_CTX_FS(FF,UD)                {NULL, NULL, NULL, NULL, (FF), (UD)}
 
 typedef struct {
 	int fd;
 	struct kevent *ke;
-	size_t nke;
+	size_t nke;             /* registered filters */
+	size_t cap;             /* events ke has room for */
 } kqueue_t;
 
 kqueue_t * kqueue_new(void) MALLOC;
 void kqueue_free(kqueue_t *) NONNULL(1);
-int kqueue_dispatch(kqueue_t *) NONNULL(1) WUNRES;
+int kqueue_dispatch(kqueue_t *, const struct timespec *) NONNULL(1) WUNRES;
 int kqueue_add_fd_read(kqueue_t *, int, kevent_ctx_t *) NONNULL(1,3) WUNRES;
+int kqueue_del_fd_read(kqueue_t *, int) NONNULL(1) WUNRES;
 int kqueue_add_signal(kqueue_t *, int, kevent_ctx_t *) NONNULL(1,3) WUNRES;
 int kqueue_add_timer(kqueue_t *, int, int, kevent_ctx_t *) NONNULL(1,4) WUNRES;
+int kqueue_mod_timer(kqueue_t *, int, int, kevent_ctx_t *) NONNULL(1,4) WUNRES;
+int kqueue_del_timer(kqueue_t *, int) NONNULL(1) WUNRES;
+int kqueue_add_user(kqueue_t *, int, kevent_ctx_t *) NONNULL(1,3) WUNRES;
+int kqueue_trigger_user(kqueue_t *, int) NONNULL(1) WUNRES;
+int kqueue_add_fs(kqueue_t *, kevent_ctx_t *) NONNULL(1,2) WUNRES;
 
 #endif
@@ -13,36 +13,35 @@
 #include "logfmtjson.h"
 #include "logfmtyaml.h"
 #include "logfmtxml.h"
+#include "logfmtcbor.h"
 #include "logdstfile.h"
 #include "logdststdout.h"
 #include "logdstsyslog.h"
+#include "logdstnet.h"
+#include "logdstshm.h"
+#include "logdstnull.h"
+#include "logbuf.h"
+#include "logproj.h"
 
 #include "queue.h"
+#include "atomic.h"
 #include "attrib.h"
 #include "policy.h"
+#include "thrstat.h"
+#include "probes.h"
+#include "signpost.h"
 #include "time.h"
+#include "minmax.h"
 #include "work.h"
+#include "evtidx.h"
 #include "evtloop.h"
+#include "profile.h"
 
 #include <string.h>
+#include <pthread.h>
+#include <errno.h>
 #include <assert.h>
 
-/*
- * Log events.
- */
-typedef int (*logevt_func_t)(logfmt_t *, FILE *, void *) NONNULL(1,2) WUNRES;
-logevt_func_t le_logevt[LOGEVT_SIZE] = {
-	logevt_xnumon_ops,
-	logevt_xnumon_stats,
-	logevt_image_exec,
-	logevt_process_access,
-	logevt_launchd_add,
-	logevt_socket_listen,
-	logevt_socket_accept,
-	logevt_socket_connect
-};
-_Static_assert(LOGEVT_SIZE == 8, "number of logevt types initialized above");
-
 /*
  * Log formats.
  */
@@ -50,7 +49,8 @@ static logfmt_t *logfmttab[] = {
 	&logfmtjson,
 	&logfmtjsonseq,
 	&logfmtyaml,
-	&logfmtxml
+	&logfmtxml,
+	&logfmtcbor
 };
 #define LOGFMTS (sizeof(logfmttab)/sizeof(logfmttab[0]))
 
@@ -60,26 +60,65 @@ static logfmt_t *logfmttab[] = {
 static logdst_t *logdsttab[] = {
 	&logdstfile,
 	&logdststdout,
-	&logdstsyslog
+	&logdstsyslog,
+	&logdstnet,
+	&logdstshm,
+	&logdstnull
 };
 #define LOGDSTS (sizeof(logdsttab)/sizeof(logdsttab[0]))
 
-int
-logdst_parse(config_t *cfg, const char *name) {
-	assert(cfg);
-	assert(name);
-	for (size_t i = 1; i < LOGDSTS; i++) {
-		if (!strcmp(logdsttab[i]->ld_name, name)) {
-			cfg->logdst = i;
-			return 0;
+/*
+ * Look up the logdst driver for name and store its argument in cfg, if any.
+ * Returns the index of the driver or -1 on errors.
+ */
+static int
+logdst_lookup(config_t *cfg, const char *name) {
+	if (!strncmp(name, LOGDSTNET_PREFIX, strlen(LOGDSTNET_PREFIX))) {
+		if (cfg->loghost)
+			free(cfg->loghost);
+		cfg->loghost = strdup(name + strlen(LOGDSTNET_PREFIX));
+		if (!cfg->loghost)
+			return -1;
+		for (size_t i = 1; i < LOGDSTS; i++) {
+			if (logdsttab[i] == &logdstnet)
+				return i;
 		}
+		return -1;
+	}
+	if (!strncmp(name, LOGDSTSHM_PREFIX, strlen(LOGDSTSHM_PREFIX))) {
+		if (cfg->logshm)
+			free(cfg->logshm);
+		cfg->logshm = strdup(name + strlen(LOGDSTSHM_PREFIX));
+		if (!cfg->logshm)
+			return -1;
+		for (size_t i = 1; i < LOGDSTS; i++) {
+			if (logdsttab[i] == &logdstshm)
+				return i;
+		}
+		return -1;
+	}
+	for (size_t i = 1; i < LOGDSTS; i++) {
+		if (!strcmp(logdsttab[i]->ld_name, name))
+			return i;
 	}
 	if (cfg->logfile)
 		free(cfg->logfile);
 	cfg->logfile = strdup(name);
 	if (!cfg->logfile)
 		return -1;
-	cfg->logdst = 0;
+	return 0;
+}
+
+int
+logdst_parse(config_t *cfg, const char *name) {
+	int dst;
+
+	assert(cfg);
+	assert(name);
+	dst = logdst_lookup(cfg, name);
+	if (dst == -1)
+		return -1;
+	cfg->logdst = dst;
 	return 0;
 }
 
@@ -106,104 +145,1077 @@ logfmt_s(config_t *cfg) {
 	return logfmttab[cfg->logfmt]->lf_name;
 }
 
+logfmt_t *
+logfmt_driver(config_t *cfg) {
+	return logfmttab[cfg->logfmt];
+}
+
+bool
+logfmt_binary(config_t *cfg) {
+	return logfmttab[cfg->logfmt]->lf_binary;
+}
+
+/*
+ * Parse the options following the logdst of a log_fanout destination.
+ */
+static int
+log_fanout_parse_opt(config_t *cfg, size_t i, const char *opt, size_t sz) {
+	logproj_t *proj;
+	char *arg;
+
+	if (sz > 7 && !strncmp(opt, "events=", 7)) {
+		arg = strndup(opt + 7, sz - 7);
+		if (!arg)
+			return -1;
+		cfg->log_fanout_events[i] = config_parse_events(arg);
+		free(arg);
+		return cfg->log_fanout_events[i] == -1 ? -1 : 0;
+	}
+	if (sz > 7 && !strncmp(opt, "fields=", 7)) {
+		arg = strndup(opt + 7, sz - 7);
+		if (!arg)
+			return -1;
+		proj = logproj_new(arg);
+		if (!proj) {
+			free(arg);
+			return -1;
+		}
+		logproj_free(proj);
+		if (cfg->log_fanout_fields[i])
+			free(cfg->log_fanout_fields[i]);
+		cfg->log_fanout_fields[i] = arg;
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * Parse an additional log destination of the form <logfmt>:<logdst>, where
+ * <logdst> takes the same values as log_destination, optionally followed by
+ * space-separated events=<eventcodes> to log only those events to it, and
+ * fields=<paths> to render only those fields for it, see logproj.h.
+ */
+int
+log_fanout_parse(config_t *cfg, const char *value) {
+	const char *sep, *opt, *p;
+	char *name;
+	size_t fmt, i, sz;
+	int dst;
+
+	assert(cfg);
+	assert(value);
+	i = cfg->log_fanouts;
+	if (i == LOG_FANOUT_MAX)
+		return -1;
+	sep = strchr(value, ':');
+	if (!sep)
+		return -1;
+	for (fmt = 0; fmt < LOGFMTS; fmt++) {
+		if (strlen(logfmttab[fmt]->lf_name) == (size_t)(sep - value) &&
+		    !strncmp(logfmttab[fmt]->lf_name, value, sep - value))
+			break;
+	}
+	if (fmt == LOGFMTS)
+		return -1;
+	opt = strstr(sep, " events=");
+	p = strstr(sep, " fields=");
+	if (!opt || (p && p < opt))
+		opt = p;
+	if (!opt)
+		opt = sep + strlen(sep);
+	name = strndup(sep + 1, opt - sep - 1);
+	if (!name)
+		return -1;
+	dst = logdst_lookup(cfg, name);
+	free(name);
+	if (dst == -1)
+		return -1;
+	cfg->log_fanout_events[i] = 0;
+	cfg->log_fanout_fields[i] = NULL;
+	for (p = opt; *p;) {
+		if (*p == ' ') {
+			p++;
+			continue;
+		}
+		sz = strcspn(p, " ");
+		if (log_fanout_parse_opt(cfg, i, p, sz) == -1) {
+			if (cfg->log_fanout_fields[i]) {
+				free(cfg->log_fanout_fields[i]);
+				cfg->log_fanout_fields[i] = NULL;
+			}
+			return -1;
+		}
+		p += sz;
+	}
+	cfg->log_fanout_fmt[i] = fmt;
+	cfg->log_fanout_dst[i] = dst;
+	cfg->log_fanout_oneline[i] = -1;
+	cfg->log_fanouts++;
+	return 0;
+}
+
+const char *
+log_fanout_dst_s(config_t *cfg, size_t i) {
+	assert(i < cfg->log_fanouts);
+	return logdsttab[cfg->log_fanout_dst[i]]->ld_name;
+}
+
+const char *
+log_fanout_fmt_s(config_t *cfg, size_t i) {
+	assert(i < cfg->log_fanouts);
+	return logfmttab[cfg->log_fanout_fmt[i]]->lf_name;
+}
+
 static bool log_initialized = false;
-static int logfmt = -1;
+static config_t *config;
+static atomic_int logfmt = -1;
 static int logdst = -1;
 static queue_t log_queue;
 static pthread_t log_thr;
 static logevt_header_t log_sentinel;
+static config_t *_Atomic log_reconfig_cfg;      /* pending, see log_reconfig */
+static pthread_mutex_t log_fmtmutex = PTHREAD_MUTEX_INITIALIZER;
+static logfmt_ctx_t log_ctx;           /* used by log thread only */
+
+#define LOG_BATCH 32
+#define LOG_RAW_BATCH 256       /* events per ld_event_batch call */
 
 static uint64_t counts[LOGEVT_SIZE];
 static uint64_t errors;
+static uint64_t flushes;
+static size_t flush_deadline;           /* ms */
+static size_t latency_sample;           /* trace every nth event, 0 off */
+static size_t traced;
+static hist_t latency[LOGEVT_STAMPS];
+
+/*
+ * Fan-out.  With log_fanout, the log thread acts as the fan-out stage:  it
+ * renders every event once per distinct log format into a reference-counted
+ * record and hands the record to the queue of each destination using that
+ * format.  Every destination has its own thread writing records to it and
+ * its own queue, to which queue_capacity and queue_overflow apply
+ * separately, such that a slow destination only backs up its own queue and
+ * drops and blocks are accounted per destination.  Destination 0 is logdst,
+ * followed by the log_fanout destinations in configuration order.
+ */
+#define LOG_OUTS (LOG_FANOUT_MAX + 1)
+
+typedef struct {
+	atomic32_t refs;
+	size_t slot;            /* rendering the record was produced by */
+	size_t sz;
+	char buf[];
+} log_rec_t;
+
+/*
+ * Contexts of different formats render the same images, so the epochs of
+ * all contexts including log_ctx are handed out from a single counter to
+ * keep renderings cached in images by one context from being mistaken as
+ * valid in another.
+ */
+typedef struct {
+	int fmt;
+	int oneline;
+	const char *fields;     /* NULL for all */
+	logproj_t *proj;
+	logproj_ctx_t projctx;
+	int events;             /* wanted by any destination using the slot */
+	FILE *f;                /* unbuffered, appends to buf */
+	logbuf_t buf;
+	logfmt_ctx_t ctx;
+	bool lost;              /* a record was dropped, start a new epoch */
+} log_slot_t;
+
+typedef struct {
+	int dst;
+	int events;
+	size_t slot;
+	config_t cfg;           /* shallow copy of config for ld_init */
+	queue_t queue;
+	pthread_t thr;
+	int state;              /* setup steps completed, see log_fanout_fini */
+	uint64_t records;
+	uint64_t errors;
+	uint64_t flushes;
+} log_out_t;
+
+static log_slot_t slots[LOG_OUTS];      /* used by log thread only */
+static size_t nslots;
+static log_out_t outs[LOG_OUTS];
+static size_t nouts;                    /* 0 without log_fanout */
+static uint64_t epochs;                 /* last epoch handed out */
+static log_rec_t log_rec_sentinel;
+
+/*
+ * Account the time hdr spent in each stage of the pipeline, skipping the
+ * stages it did not pass through, such as the work stage for events
+ * submitted to the log stage directly.
+ */
+static void
+log_latency(logevt_header_t *hdr) {
+	uint64_t *stamp = hdr->stamp;
+
+	stamp[LOGEVT_STAMP_LOGGED] = timespec_mononsec();
+	for (size_t i = 0; i < LOGEVT_STAMPS - 1; i++) {
+		if (stamp[i] && stamp[i + 1] && stamp[i + 1] >= stamp[i])
+			hist_add(&latency[i], (stamp[i + 1] - stamp[i]) / 1000);
+	}
+	if (stamp[LOGEVT_STAMP_EVENT] && stamp[LOGEVT_STAMP_LOGGED])
+		hist_add(&latency[LOGEVT_STAMPS - 1],
+		         (stamp[LOGEVT_STAMP_LOGGED] -
+		          stamp[LOGEVT_STAMP_EVENT]) / 1000);
+	if (profile_active())
+		profile_event(hdr->code, stamp);
+}
+
+static void
+log_stamp(logevt_header_t *hdr) {
+	hdr->stamp[LOGEVT_STAMP_LOG] = timespec_mononsec();
+	if (latency_sample > 0 && hdr->stamp[LOGEVT_STAMP_SUBMIT] &&
+	    ++traced % latency_sample == 0)
+		hdr->trace = true;
+}
 
 static int
 log_log(logevt_header_t *hdr) {
+	logfmt_t *fmt;
 	FILE *f;
-	int rv;
+	int rv, cat;
 
 	assert(logdst != -1);
 	assert(logdsttab[logdst]->ld_raw || logfmt != -1);
 	assert(hdr->code >= 0 && hdr->code < LOGEVT_SIZE);
 
+	cat = signpost_category(LOGEVT_FLAG(hdr->code));
+	SIGNPOST_BEGIN(cat, "log", hdr);
+	log_stamp(hdr);
 	if (logdsttab[logdst]->ld_raw) {
+		XNUMON_LOG_WRITE_START(0);
 		rv = logdsttab[logdst]->ld_event(hdr);
+		XNUMON_LOG_WRITE_DONE(rv);
 	} else {
 		f = logdsttab[logdst]->ld_open();
-		if (!f)
+		if (!f) {
+			SIGNPOST_END(cat, "log", hdr);
 			return -1;
-		rv = le_logevt[hdr->code](logfmttab[logfmt], f, hdr);
-		if (logdsttab[logdst]->ld_close(f) == -1)
+		}
+		log_ctx.f = f;
+		fmt = logfmttab[logfmt];
+		XNUMON_LOG_RENDER_START(hdr->code);
+		rv = logevt_renderers(fmt, config->logoneline)[hdr->code](
+		                      fmt, &log_ctx, hdr);
+		XNUMON_LOG_RENDER_DONE(hdr->code, rv);
+		log_ctx.f = NULL;
+		XNUMON_LOG_WRITE_START(0);
+		if (logdsttab[logdst]->ld_close(f) == -1) {
+			XNUMON_LOG_WRITE_DONE(-1);
 			errors++;
+		} else {
+			XNUMON_LOG_WRITE_DONE(0);
+		}
 	}
-	if (rv == 0)
+	if (rv == 0) {
 		counts[hdr->code]++;
-	else
+		log_latency(hdr);
+	} else {
 		errors++;
+	}
+	SIGNPOST_END(cat, "log", hdr);
 	assert(hdr->le_free);
 	hdr->le_free(hdr);
 	return rv;
 }
 
+/*
+ * Pass the n events in hdrv to a raw destination implementing
+ * ld_event_batch at once.  If the destination fails, all events of the
+ * batch are counted as errors.
+ */
+static void
+log_log_batch(logevt_header_t **hdrv, size_t n) {
+	int rv;
+
+	if (n == 0)
+		return;
+	assert(logdst != -1);
+	assert(logdsttab[logdst]->ld_event_batch);
+	for (size_t i = 0; i < n; i++) {
+		assert(hdrv[i]->code >= 0 && hdrv[i]->code < LOGEVT_SIZE);
+		log_stamp(hdrv[i]);
+	}
+	XNUMON_LOG_WRITE_START(0);
+	rv = logdsttab[logdst]->ld_event_batch(hdrv, n);
+	XNUMON_LOG_WRITE_DONE(rv);
+	for (size_t i = 0; i < n; i++) {
+		if (rv == 0) {
+			counts[hdrv[i]->code]++;
+			log_latency(hdrv[i]);
+		} else {
+			errors++;
+		}
+		assert(hdrv[i]->le_free);
+		hdrv[i]->le_free(hdrv[i]);
+	}
+	flushes++;
+}
+
+/*
+ * Render arg to f using func, or the renderer for the log event arg using
+ * the configured log format if func is NULL.
+ */
+static int
+log_render_any(FILE *f, logevt_func_t func, void *arg) {
+	logfmt_t *fmt;
+	logfmt_ctx_t ctx;
+	int rv;
+
+	pthread_mutex_lock(&log_fmtmutex);
+	if (logfmt == -1) {
+		pthread_mutex_unlock(&log_fmtmutex);
+		errno = ENOTSUP;
+		return -1;
+	}
+	fmt = logfmttab[logfmt];
+	if (!func)
+		func = logevt_renderers(fmt, config->logoneline)[
+		       ((logevt_header_t *)arg)->code];
+	logfmt_ctx_init(&ctx);
+	ctx.f = f;
+	rv = func(fmt, &ctx, arg);
+	ctx.f = NULL;
+	logfmt_ctx_fini(&ctx);
+	pthread_mutex_unlock(&log_fmtmutex);
+	return rv;
+}
+
+/*
+ * Render hdr to f using the configured log format, outside of the log
+ * stage.  The event is neither counted nor freed.  Fails with ENOTSUP for
+ * log destinations that take raw events.  Serialized with log_reconfigure,
+ * which changes the format configuration shared by all contexts.
+ */
+int
+log_render(FILE *f, logevt_header_t *hdr) {
+	assert(hdr->code >= 0 && hdr->code < LOGEVT_SIZE);
+
+	return log_render_any(f, NULL, hdr);
+}
+
+/*
+ * Like log_render, but render arg using func, for records that are not log
+ * events, such as query results.
+ */
+int
+log_render_func(FILE *f, logevt_func_t func, void *arg) {
+	return log_render_any(f, func, arg);
+}
+
+/*
+ * Called by the queue for events dropped due to the overflow policy.
+ */
+static void
+log_drop(void *data) {
+	logevt_header_t *hdr = data;
+
+	hdr->le_free(hdr);
+}
+
+static void
+log_flush(void) {
+	if (logdsttab[logdst]->ld_flush() == -1)
+		errors++;
+	flushes++;
+}
+
+static void
+log_rec_unref(log_rec_t *rec) {
+	if (atomic32_dec_test0(&rec->refs))
+		free(rec);
+}
+
+/*
+ * Called by the queue of a destination for records dropped due to the
+ * overflow policy, in the log thread, which is the only producer.  Images
+ * logged in full in the dropped record may be referenced by image_id in
+ * later records of the same rendering, so the rendering starts over.
+ */
+static void
+log_rec_drop(void *data) {
+	log_rec_t *rec = data;
+
+	slots[rec->slot].lost = true;
+	log_rec_unref(rec);
+}
+
+static int
+log_slot_write(void *cookie, const char *buf, int sz) {
+	log_slot_t *slot = cookie;
+
+	if (logbuf_write(&slot->buf, buf, (size_t)sz) == -1)
+		return -1;
+	return sz;
+}
+
+/*
+ * Initialize the format of slot with the log mode of the slot, which may
+ * differ from the logoneline of config.
+ */
+static int
+log_slot_fmtinit(log_slot_t *slot) {
+	config_t cfg;
+
+	cfg = *config;
+	cfg.logfmt = slot->fmt;
+	cfg.logoneline = slot->oneline;
+	return logfmttab[slot->fmt]->lf_init(&cfg);
+}
+
+/*
+ * Start a new epoch in all renderings, invalidating everything cached in
+ * images and logged by image_id so far.
+ */
+static void
+log_slot_epoch(void) {
+	for (size_t i = 0; i < nslots; i++) {
+		slots[i].ctx.epoch = ++epochs;
+		slots[i].lost = false;
+	}
+}
+
+/*
+ * Render hdr into a new record with a single reference held by the caller.
+ */
+static log_rec_t *
+log_slot_render(size_t i, logevt_header_t *hdr) {
+	log_slot_t *slot = &slots[i];
+	logfmt_t *fmt;
+	log_rec_t *rec;
+	int rv;
+
+	if (slot->lost) {
+		slot->ctx.epoch = ++epochs;
+		slot->lost = false;
+	}
+	logbuf_reset(&slot->buf);
+	slot->ctx.f = slot->f;
+	fmt = slot->proj ? &logfmtproj : logfmttab[slot->fmt];
+	XNUMON_LOG_RENDER_START(hdr->code);
+	rv = logevt_renderers(fmt, slot->oneline)[hdr->code](fmt, &slot->ctx,
+	                                                     hdr);
+	XNUMON_LOG_RENDER_DONE(hdr->code, rv);
+	slot->ctx.f = NULL;
+	if (rv == -1 || ferror(slot->f) || slot->buf.len == 0) {
+		clearerr(slot->f);
+		slot->lost = true;
+		return NULL;
+	}
+	rec = malloc(sizeof(log_rec_t) + slot->buf.len);
+	if (!rec) {
+		slot->lost = true;
+		return NULL;
+	}
+	rec->refs = 1;
+	rec->slot = i;
+	rec->sz = slot->buf.len;
+	memcpy(rec->buf, slot->buf.buf, slot->buf.len);
+	return rec;
+}
+
+/*
+ * Render hdr once per slot and pass the records to the destinations.  Slots
+ * whose destinations all filter out hdr do not render it at all.  The event
+ * counts as logged if it could be rendered for all destinations wanting it.
+ */
+static int
+log_fanout(logevt_header_t *hdr) {
+	log_rec_t *recv[LOG_OUTS];
+	log_rec_t *rec;
+	int rv = 0, cat;
+
+	assert(hdr->code >= 0 && hdr->code < LOGEVT_SIZE);
+
+	cat = signpost_category(LOGEVT_FLAG(hdr->code));
+	SIGNPOST_BEGIN(cat, "log", hdr);
+	log_stamp(hdr);
+	for (size_t i = 0; i < nslots; i++) {
+		if (!(slots[i].events & LOGEVT_FLAG(hdr->code))) {
+			recv[i] = NULL;
+			continue;
+		}
+		recv[i] = log_slot_render(i, hdr);
+		if (!recv[i])
+			rv = -1;
+	}
+	for (size_t i = 0; i < nouts; i++) {
+		rec = recv[outs[i].slot];
+		if (!rec || !(outs[i].events & LOGEVT_FLAG(hdr->code)))
+			continue;
+		atomic32_fast_inc(&rec->refs);
+		(void)queue_enqueue(&outs[i].queue, rec);
+	}
+	for (size_t i = 0; i < nslots; i++) {
+		if (recv[i])
+			log_rec_unref(recv[i]);
+	}
+	if (rv == 0) {
+		counts[hdr->code]++;
+		log_latency(hdr);
+	} else {
+		errors++;
+	}
+	SIGNPOST_END(cat, "log", hdr);
+	hdr->le_free(hdr);
+	return rv;
+}
+
+static void
+log_out_write(log_out_t *out, log_rec_t *rec) {
+	logdst_t *ld = logdsttab[out->dst];
+	FILE *f;
+	int rv;
+
+	f = ld->ld_open();
+	if (!f) {
+		out->errors++;
+		log_rec_unref(rec);
+		return;
+	}
+	XNUMON_LOG_WRITE_START(rec->sz);
+	rv = 0;
+	if (fwrite(rec->buf, rec->sz, 1, f) != 1) {
+		out->errors++;
+		rv = -1;
+	}
+	if (ld->ld_close(f) == -1) {
+		out->errors++;
+		rv = -1;
+	} else {
+		out->records++;
+	}
+	XNUMON_LOG_WRITE_DONE(rv);
+	log_rec_unref(rec);
+}
+
+/*
+ * With log_fanout, destinations switch to a reopened destination at the
+ * first batch boundary after log_reinit, since the rotation marker might be
+ * filtered or dropped before it reaches them.
+ */
+static void
+log_out_flush(log_out_t *out) {
+	logdst_t *ld = logdsttab[out->dst];
+
+	if (ld->ld_flush() == -1)
+		out->errors++;
+	out->flushes++;
+	if (ld->ld_rotate && ld->ld_rotate() == -1)
+		out->errors++;
+}
+
+/*
+ * Destination thread, batching like log_thread for destinations
+ * implementing ld_flush.
+ */
+static void *
+log_out_thread(void *arg) {
+	log_out_t *out = arg;
+	void *batch[LOG_BATCH];
+	size_t n;
+	bool batching, pending;
+	struct timespec deadline, now;
+
+	(void)policy_thread_diskio_utility();
+	(void)policy_thread_qos(THRSTAT_LOG);
+	thrstat_register(THRSTAT_LOG);
+
+	batching = logdsttab[out->dst]->ld_flush != NULL;
+	pending = false;
+	for (;;) {
+		n = queue_dequeue_batch(&out->queue, batch, LOG_BATCH);
+		if (batching && !pending) {
+			if (timespec_monotime(&deadline) == -1)
+				deadline.tv_sec = 0;
+			timespec_add_msec(&deadline, flush_deadline);
+			pending = true;
+		}
+		for (size_t i = 0; i < n; i++) {
+			if (batch[i] == &log_rec_sentinel) {
+				if (pending)
+					log_out_flush(out);
+				return NULL;
+			}
+			log_out_write(out, batch[i]);
+		}
+		if (!pending)
+			continue;
+		if (queue_size(&out->queue) == 0 ||
+		    timespec_monotime(&now) == -1 ||
+		    !timespec_greater(&deadline, &now)) {
+			log_out_flush(out);
+			pending = false;
+		}
+	}
+}
+
+/*
+ * Stop and tear down the destinations and renderings set up by
+ * log_fanout_init, after the log thread has stopped producing records.
+ * Destination threads write all records queued before they stop.
+ */
+static void
+log_fanout_fini(void) {
+	for (size_t i = 0; i < nouts; i++) {
+		if (outs[i].state < 3)
+			continue;
+		queue_enqueue_wait(&outs[i].queue, &log_rec_sentinel);
+		if (pthread_join(outs[i].thr, NULL) != 0) {
+			fprintf(stderr, "Failed to join logdst thread - "
+			                "exiting\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (size_t i = 0; i < nouts; i++) {
+		if (outs[i].state >= 2) {
+			assert(queue_size(&outs[i].queue) == 0);
+			queue_destroy(&outs[i].queue);
+		}
+		if (outs[i].state >= 1)
+			logdsttab[outs[i].dst]->ld_fini();
+		outs[i].state = 0;
+	}
+	nouts = 0;
+	for (size_t i = 0; i < nslots; i++) {
+		fclose(slots[i].f);
+		logbuf_fini(&slots[i].buf);
+		logfmt_ctx_fini(&slots[i].ctx);
+		if (slots[i].proj)
+			logproj_free(slots[i].proj);
+	}
+	nslots = 0;
+}
+
+/*
+ * Add a slot for out unless one with the same format, projection and events
+ * exists already, and return its index.  log_check made sure that all
+ * destinations using the same format agree on oneline.  Destinations with
+ * different events cannot share a slot, since the rendering state of a slot,
+ * such as which images were already logged in full for ancestor_ids, must
+ * reflect exactly the events its destinations received.
+ */
+static int
+log_fanout_slot(log_out_t *out, const char *fields) {
+	log_slot_t *slot;
+
+	for (size_t i = 0; i < nslots; i++) {
+		if (slots[i].fmt == out->cfg.logfmt &&
+		    slots[i].events == out->events &&
+		    (slots[i].fields == fields ||
+		     (slots[i].fields && fields &&
+		      !strcmp(slots[i].fields, fields)))) {
+			assert(slots[i].oneline == out->cfg.logoneline);
+			return i;
+		}
+	}
+	slot = &slots[nslots];
+	bzero(slot, sizeof(log_slot_t));
+	slot->fmt = out->cfg.logfmt;
+	slot->oneline = out->cfg.logoneline;
+	slot->fields = fields;
+	slot->events = out->events;
+	if (log_slot_fmtinit(slot) == -1) {
+		fprintf(stderr, "Failed to initialize logfmt %i\n", slot->fmt);
+		return -1;
+	}
+	if (fields) {
+		slot->proj = logproj_new(fields);
+		if (!slot->proj)
+			return -1;
+	}
+	if (logbuf_init(&slot->buf, LOGBUF_SIZE_INITIAL) == -1)
+		goto errout;
+	slot->f = funopen(slot, NULL, log_slot_write, NULL, NULL);
+	if (!slot->f) {
+		logbuf_fini(&slot->buf);
+		goto errout;
+	}
+	/* formats write whole records, buffering would only copy twice */
+	(void)setvbuf(slot->f, NULL, _IONBF, 0);
+	logfmt_ctx_init(&slot->ctx);
+	if (slot->proj) {
+		logproj_ctx_init(&slot->projctx, slot->proj,
+		                 logfmttab[slot->fmt]);
+		slot->ctx.proj = &slot->projctx;
+	}
+	slot->ctx.epoch = ++epochs;
+	return nslots++;
+errout:
+	if (slot->proj)
+		logproj_free(slot->proj);
+	return -1;
+}
+
+/*
+ * Set up the renderings and destinations of cfg.  Each destination driver
+ * is initialized with a copy of cfg carrying the format and log mode of
+ * that destination; log_compression only applies to logdst.
+ */
+static int
+log_fanout_init(config_t *cfg) {
+	log_out_t *out;
+	const char *fields;
+	int slot;
+
+	nslots = 0;
+	nouts = 0;
+	for (size_t i = 0; i <= cfg->log_fanouts; i++) {
+		out = &outs[nouts++];
+		bzero(out, sizeof(log_out_t));
+		out->cfg = *cfg;
+		out->events = ~0;
+		fields = NULL;
+		if (i > 0) {
+			out->cfg.logdst = cfg->log_fanout_dst[i - 1];
+			out->cfg.logfmt = cfg->log_fanout_fmt[i - 1];
+			out->cfg.logoneline = cfg->log_fanout_oneline[i - 1];
+			out->cfg.log_compress = false;
+			if (cfg->log_fanout_events[i - 1])
+				out->events = cfg->log_fanout_events[i - 1];
+			fields = cfg->log_fanout_fields[i - 1];
+		}
+		out->dst = out->cfg.logdst;
+		slot = log_fanout_slot(out, fields);
+		if (slot == -1)
+			goto errout;
+		out->slot = slot;
+		if (logdsttab[out->dst]->ld_init(&out->cfg) == -1) {
+			fprintf(stderr, "Failed to initialize logdst %i\n",
+			                out->dst);
+			goto errout;
+		}
+		out->state = 1;
+		if (queue_init(&out->queue, cfg->queue_capacity,
+		               cfg->queue_overflow, log_rec_drop) == -1)
+			goto errout;
+		out->state = 2;
+		if (pthread_create(&out->thr, NULL, log_out_thread, out) != 0)
+			goto errout;
+		out->state = 3;
+	}
+	return 0;
+errout:
+	log_fanout_fini();
+	return -1;
+}
+
+/*
+ * Apply the reconfiguration passed to log_reconfig.  Executed in the log
+ * thread before rendering the next batch of events, such that every event
+ * is rendered entirely with either the old or the new configuration, and
+ * events submitted after log_reconfig with the new one.  The context starts
+ * a new epoch, invalidating all renderings cached in images.
+ */
+static void
+log_reconfigure(void) {
+	config_t *newcfg;
+
+	newcfg = atomic_load(&log_reconfig_cfg);
+	assert(newcfg);
+	pthread_mutex_lock(&log_fmtmutex);
+	config_apply_log(config, newcfg);
+	if (!logdsttab[logdst]->ld_raw) {
+		if (logfmt != config->logfmt) {
+			/* a context must only be used with one driver */
+			logfmt_ctx_fini(&log_ctx);
+			logfmt_ctx_init(&log_ctx);
+			log_ctx.restart = true;
+			logfmt = config->logfmt;
+		}
+		if (logfmttab[logfmt]->lf_init(config) == -1) {
+			fprintf(stderr, "Failed to reinitialize logfmt %i\n",
+			                logfmt);
+			errors++;
+		}
+	}
+	log_ctx.epoch = ++epochs;
+	for (size_t i = 0; i < nslots; i++) {
+		if (log_slot_fmtinit(&slots[i]) == -1) {
+			fprintf(stderr, "Failed to reinitialize logfmt %i\n",
+			                slots[i].fmt);
+			errors++;
+		}
+	}
+	log_slot_epoch();
+	pthread_mutex_unlock(&log_fmtmutex);
+	config_free(newcfg);
+	atomic_store(&log_reconfig_cfg, NULL);
+}
+
+/*
+ * Called by the log thread for the xnumon-ops(rotate) event submitted by
+ * log_reinit, after committing all events before it to the old destination.
+ * Switches to the destination reopened by log_reinit, such that the event
+ * is the first one logged to the new destination, which starts over with
+ * images and stateful formats such as cbor.  With log_fanout, renderings
+ * start over and the destination threads switch on their own.
+ */
+static void
+log_rotate(xnumon_ops_t *ops) {
+	if (nouts > 0) {
+		log_slot_epoch();
+	} else if (logdsttab[logdst]->ld_rotate) {
+		switch (logdsttab[logdst]->ld_rotate()) {
+		case 1:
+			log_ctx.restart = true;
+			log_ctx.epoch = ++epochs;
+			break;
+		case -1:
+			errors++;
+			break;
+		}
+	}
+	ops->rotate_latency = timespec_mononsec() - ops->rotate_requested;
+}
+
+static bool
+log_is_rotate(logevt_header_t *hdr) {
+	return hdr->code == LOGEVT_XNUMON_OPS &&
+	       ((xnumon_ops_t *)hdr)->rotate_requested > 0;
+}
+
+/*
+ * For destinations implementing ld_flush, events are rendered back to back
+ * and committed once the queue has been drained, or under sustained load,
+ * once the flush deadline has passed since the first uncommitted event.
+ * For raw destinations implementing ld_event_batch, all events dequeued at
+ * once are passed to the destination in a single call.  With log_fanout,
+ * events are passed on to the destination threads instead.
+ */
 static void *
 log_thread(UNUSED void *arg) {
-	logevt_header_t *hdr;
+	void *batch[LOG_RAW_BATCH];
+	logevt_header_t *raw[LOG_RAW_BATCH];
+	size_t n, nraw, max;
+	bool batching, pending, rawbatch;
+	struct timespec deadline, now;
 
 #if 0	/* terra pericolosa */
 	(void)policy_thread_sched_standard();
 #endif
 	(void)policy_thread_diskio_utility();
+	(void)policy_thread_qos(THRSTAT_LOG);
+	thrstat_register(THRSTAT_LOG);
 
+	batching = nouts == 0 && !logdsttab[logdst]->ld_raw &&
+	           logdsttab[logdst]->ld_flush;
+	rawbatch = nouts == 0 && logdsttab[logdst]->ld_raw &&
+	           logdsttab[logdst]->ld_event_batch;
+	max = rawbatch ? LOG_RAW_BATCH : LOG_BATCH;
+	pending = false;
 	for (;;) {
-		hdr = queue_dequeue(&log_queue);
-		if (hdr == &log_sentinel)
-			break;
-		(void)log_log(hdr);
+		n = queue_dequeue_batch(&log_queue, batch, max);
+		nraw = 0;
+		if (atomic_load(&log_reconfig_cfg))
+			log_reconfigure();
+		if (batching && !pending) {
+			if (timespec_monotime(&deadline) == -1)
+				deadline.tv_sec = 0;
+			timespec_add_msec(&deadline, flush_deadline);
+			pending = true;
+		}
+		for (size_t i = 0; i < n; i++) {
+			if (batch[i] == &log_sentinel) {
+				log_log_batch(raw, nraw);
+				if (pending)
+					log_flush();
+				return NULL;
+			}
+			if (log_is_rotate(batch[i])) {
+				log_log_batch(raw, nraw);
+				nraw = 0;
+				if (pending)
+					log_flush();
+				log_rotate(batch[i]);
+			}
+			evtidx_add(batch[i]);
+			if (rawbatch)
+				raw[nraw++] = batch[i];
+			else if (nouts > 0)
+				(void)log_fanout(batch[i]);
+			else
+				(void)log_log(batch[i]);
+		}
+		log_log_batch(raw, nraw);
+		if (!pending)
+			continue;
+		if (queue_size(&log_queue) == 0 ||
+		    timespec_monotime(&now) == -1 ||
+		    !timespec_greater(&deadline, &now)) {
+			log_flush();
+			pending = false;
+		}
+	}
+}
+
+/*
+ * Check that log format fmt and destination dst are compatible and resolve
+ * the log mode *oneline to what they support.
+ */
+static int
+log_check_dst(int dst, int fmt, bool compress, int *oneline) {
+	if ((!logfmttab[fmt]->lf_oneline && !logdsttab[dst]->ld_multiline) ||
+	    (!logfmttab[fmt]->lf_multiline && !logdsttab[dst]->ld_oneline)) {
+		fprintf(stderr, "Incompatible logfmt and logdst\n");
+		return -1;
+	}
+	if (logfmttab[fmt]->lf_binary && !logdsttab[dst]->ld_binary) {
+		fprintf(stderr, "Incompatible logfmt and logdst\n");
+		return -1;
+	}
+	if (compress && !logdsttab[dst]->ld_compress) {
+		fprintf(stderr, "Incompatible log_compression and logdst\n");
+		return -1;
+	}
+	if (*oneline == -1)
+		*oneline = logdsttab[dst]->ld_onelineprefered ? 1 : 0;
+	if (*oneline && (!logfmttab[fmt]->lf_oneline ||
+	                 !logdsttab[dst]->ld_oneline))
+		*oneline = 0;
+	if (!*oneline && (!logfmttab[fmt]->lf_multiline ||
+	                  !logdsttab[dst]->ld_multiline))
+		*oneline = 1;
+	return 0;
+}
+
+/*
+ * Destinations using the same log format share its rendering, so the first
+ * destination using a format determines the log mode of all others, and
+ * those that do not support it are rejected.  Each logdst driver can only
+ * be used once.  Binary formats keep encoder state across the records of
+ * an output, which would break as soon as a destination drops a record of
+ * a shared rendering, so they cannot be used with log_fanout.
+ */
+static int
+log_check_fanout(config_t *cfg) {
+	int dst, fmt, inherited;
+	bool unique;
+
+	if (logfmttab[cfg->logfmt]->lf_binary) {
+		fprintf(stderr, "Binary logfmt cannot be used with "
+		                "log_fanout\n");
+		return -1;
+	}
+	for (size_t i = 0; i < cfg->log_fanouts; i++) {
+		dst = cfg->log_fanout_dst[i];
+		fmt = cfg->log_fanout_fmt[i];
+		unique = !logdsttab[dst]->ld_raw && dst != cfg->logdst;
+		for (size_t j = 0; j < i; j++) {
+			if (cfg->log_fanout_dst[j] == dst)
+				unique = false;
+		}
+		if (!unique) {
+			fprintf(stderr, "Unsupported log_fanout logdst %s\n",
+			                logdsttab[dst]->ld_name);
+			return -1;
+		}
+		if (logfmttab[fmt]->lf_binary) {
+			fprintf(stderr, "Binary logfmt cannot be used with "
+			                "log_fanout\n");
+			return -1;
+		}
+		inherited = fmt == cfg->logfmt ? cfg->logoneline : -1;
+		for (size_t j = 0; j < i; j++) {
+			if (inherited == -1 && cfg->log_fanout_fmt[j] == fmt)
+				inherited = cfg->log_fanout_oneline[j];
+		}
+		cfg->log_fanout_oneline[i] = inherited;
+		if (log_check_dst(dst, fmt, false,
+		                  &cfg->log_fanout_oneline[i]) == -1)
+			return -1;
+		if (inherited != -1 &&
+		    cfg->log_fanout_oneline[i] != inherited) {
+			fprintf(stderr, "Incompatible log mode of logfmt %s "
+			                "for log_fanout logdst %s\n",
+			                logfmttab[fmt]->lf_name,
+			                logdsttab[dst]->ld_name);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Check that the log formats and destinations of cfg are compatible and
+ * resolve the log modes to what they support.
+ */
+int
+log_check(config_t *cfg) {
+	if (logdsttab[cfg->logdst]->ld_raw) {
+		if (cfg->log_fanouts > 0) {
+			fprintf(stderr, "Raw logdst cannot be used with "
+			                "log_fanout\n");
+			return -1;
+		}
+		return 0;
 	}
+	if (log_check_dst(cfg->logdst, cfg->logfmt, cfg->log_compress,
+	                  &cfg->logoneline) == -1)
+		return -1;
+	if (cfg->log_fanouts > 0)
+		return log_check_fanout(cfg);
+	return 0;
+}
 
-	return NULL;
+static void
+log_dst_fini(void) {
+	if (nouts > 0)
+		log_fanout_fini();
+	else
+		logdsttab[logdst]->ld_fini();
 }
 
 int
 log_init(config_t *cfg) {
+	if (log_check(cfg) == -1)
+		return -1;
+	config = cfg;
 	logdst = cfg->logdst;
-	if (!logdsttab[logdst]->ld_raw) {
+	if (!logdsttab[logdst]->ld_raw)
 		logfmt = cfg->logfmt;
-		if ((!logfmttab[logfmt]->lf_oneline &&
-		     !logdsttab[logdst]->ld_multiline) ||
-		    (!logfmttab[logfmt]->lf_multiline &&
-		     !logdsttab[logdst]->ld_oneline)) {
-			fprintf(stderr, "Incompatible logfmt and logdst\n");
-			return -1;
-		}
-		if (cfg->logoneline == -1)
-			cfg->logoneline =
-				logdsttab[logdst]->ld_onelineprefered ? 1 : 0;
-		if (cfg->logoneline && (!logfmttab[logfmt]->lf_oneline ||
-		                        !logdsttab[logdst]->ld_oneline))
-			cfg->logoneline = 0;
-		if (!cfg->logoneline && (!logfmttab[logfmt]->lf_multiline ||
-		                         !logdsttab[logdst]->ld_multiline))
-			cfg->logoneline = 1;
-	}
 	logevt_init(cfg);
-	if (!logdsttab[logdst]->ld_raw) {
-		if (logfmttab[logfmt]->lf_init(cfg) == -1) {
+	flush_deadline = cfg->log_flush_deadline;
+	latency_sample = cfg->latency_sample;
+	traced = 0;
+	bzero(latency, sizeof(latency));
+	if (cfg->log_fanouts > 0) {
+		if (log_fanout_init(cfg) == -1)
+			return -1;
+	} else {
+		if (!logdsttab[logdst]->ld_raw &&
+		    logfmttab[logfmt]->lf_init(cfg) == -1) {
 			fprintf(stderr, "Failed to initialize logfmt %i\n",
 			                logfmt);
 			return -1;
 		}
+		if (logdsttab[logdst]->ld_init(cfg) == -1) {
+			fprintf(stderr, "Failed to initialize logdst %i\n",
+			                logdst);
+			return -1;
+		}
 	}
-	if (logdsttab[logdst]->ld_init(cfg) == -1) {
-		fprintf(stderr, "Failed to initialize logdst %i\n", logdst);
+	logfmt_ctx_init(&log_ctx);
+	log_ctx.epoch = ++epochs;
+	if (queue_init(&log_queue, cfg->queue_capacity, cfg->queue_overflow,
+	               log_drop) == -1) {
+		log_dst_fini();
 		return -1;
 	}
-	queue_init(&log_queue);
 	if (pthread_create(&log_thr, NULL, log_thread, NULL) != 0) {
 		queue_destroy(&log_queue);
-		logdsttab[logdst]->ld_fini();
+		log_dst_fini();
 		return -1;
 	}
 	errors = 0;
+	flushes = 0;
 	for (int i = 0; i < LOGEVT_SIZE; i++) {
 		counts[i] = 0;
 	}
@@ -211,32 +1223,102 @@ log_init(config_t *cfg) {
 	return 0;
 }
 
+/*
+ * Hand the CONFIG_CHANGED_LOG changes of newcfg to the log thread, which
+ * applies them before logging the next events and frees newcfg.  The log
+ * destination cannot be changed.  Only one reconfiguration can be pending
+ * at a time; fails with EBUSY if the previous one has not been applied yet.
+ * Main thread only.
+ */
 int
-log_reinit(void) {
+log_reconfig(config_t *newcfg) {
 	assert(log_initialized);
-	if (!logdsttab[logdst]->ld_reinit)
+	assert(newcfg->logdst == logdst);
+	if (atomic_load(&log_reconfig_cfg)) {
+		errno = EBUSY;
+		return -1;
+	}
+	if (log_check(newcfg) == -1) {
+		errno = EINVAL;
+		return -1;
+	}
+	atomic_store(&log_reconfig_cfg, newcfg);
+	return 0;
+}
+
+bool
+log_reconfig_pending(void) {
+	return atomic_load(&log_reconfig_cfg) != NULL;
+}
+
+static int
+log_reinit_dst(int dst) {
+	if (!logdsttab[dst]->ld_reinit)
 		return 0;
-	if (logdsttab[logdst]->ld_reinit() == -1) {
-		fprintf(stderr, "Failed to reinitialize logdst %i\n", logdst);
+	if (logdsttab[dst]->ld_reinit() == -1) {
+		fprintf(stderr, "Failed to reinitialize logdst %i\n", dst);
 		return -1;
 	}
 	return 0;
 }
 
+static xnumon_ops_t * log_event_xnumon_ops_new(const char *, uint64_t,
+                                               const xnumon_stage_t *,
+                                               size_t);
+
+/*
+ * Reopen the log destinations for log rotation without waiting for the log
+ * thread.  The destinations open their new files on the side, and an
+ * xnumon-ops(rotate) event passed to the log thread marks the batch
+ * boundary at which the log thread switches to them, see log_rotate.  The
+ * old files are closed in the background.  Main thread only.
+ */
+int
+log_reinit(void) {
+	xnumon_ops_t *evt;
+	uint64_t requested;
+	int rv = 0;
+
+	assert(log_initialized);
+	requested = timespec_mononsec();
+	if (nouts == 0) {
+		rv = log_reinit_dst(logdst);
+	} else {
+		for (size_t i = 0; i < nouts; i++) {
+			if (log_reinit_dst(outs[i].dst) == -1)
+				rv = -1;
+		}
+	}
+	evt = log_event_xnumon_ops_new("rotate", 0, NULL, 0);
+	if (!evt)
+		return -1;
+	evt->rotate_requested = requested;
+	evt->rotate_open = timespec_mononsec() - requested;
+	evt->hdr.stamp[LOGEVT_STAMP_PASS] = requested;
+	/* must not be dropped by the overflow policy */
+	queue_enqueue_wait(&log_queue, evt);
+	return rv;
+}
+
 void
 log_fini(void) {
 	if (!log_initialized)
 		return;
 
 	bzero(&log_sentinel, sizeof(log_sentinel));
-	queue_enqueue(&log_queue, &log_sentinel.node, &log_sentinel);
+	queue_enqueue_wait(&log_queue, &log_sentinel);
 	if (pthread_join(log_thr, NULL) != 0) {
 		fprintf(stderr, "Failed to join logger thread - exiting\n");
 		exit(EXIT_FAILURE);
 	}
 	assert(queue_size(&log_queue) == 0);
 	queue_destroy(&log_queue);
-	logdsttab[logdst]->ld_fini();
+	log_dst_fini();
+	logfmt_ctx_fini(&log_ctx);
+	if (atomic_load(&log_reconfig_cfg)) {
+		config_free(atomic_load(&log_reconfig_cfg));
+		atomic_store(&log_reconfig_cfg, NULL);
+	}
 	logfmt = -1;
 	logdst = -1;
 	log_initialized = false;
@@ -251,7 +1333,8 @@ log_submit(void *data) {
 	assert(hdr->code <= LOGEVT_SIZE);
 	assert(hdr->tv.tv_sec > 0);
 	assert(hdr->le_free);
-	queue_enqueue(&log_queue, &hdr->node, hdr);
+	hdr->stamp[LOGEVT_STAMP_PASS] = timespec_mononsec();
+	(void)queue_enqueue(&log_queue, hdr);
 }
 
 void
@@ -259,9 +1342,56 @@ log_stats(log_stat_t *st) {
 	assert(st);
 
 	st->qsize = queue_size(&log_queue);
+	st->qpeak = queue_peak(&log_queue);
+	st->drops = queue_drops(&log_queue);
+	st->blocks = queue_blocks(&log_queue);
 	st->errors = errors;
+	st->flushes = flushes;
+	if (logdst != -1 && logdsttab[logdst]->ld_stats)
+		logdsttab[logdst]->ld_stats(&st->ld);
+	else
+		bzero(&st->ld, sizeof(logdst_stat_t));
 	for (size_t i = 0; i < LOGEVT_SIZE; i++)
 		st->counts[i] = counts[i];
+	memcpy(st->latency, latency, sizeof(latency));
+	st->outs = nouts;
+	for (size_t i = 0; i < nouts; i++) {
+		log_out_stat_t *os = &st->out[i];
+		log_out_t *out = &outs[i];
+
+		os->dst = logdsttab[out->dst]->ld_name;
+		os->fmt = logfmttab[out->cfg.logfmt]->lf_name;
+		os->qsize = queue_size(&out->queue);
+		os->qpeak = queue_peak(&out->queue);
+		os->records = out->records;
+		os->drops = queue_drops(&out->queue);
+		os->blocks = queue_blocks(&out->queue);
+		os->errors = out->errors;
+		os->flushes = out->flushes;
+		if (logdsttab[out->dst]->ld_stats)
+			logdsttab[out->dst]->ld_stats(&os->ld);
+		else
+			bzero(&os->ld, sizeof(logdst_stat_t));
+		st->errors += out->errors;
+		st->flushes += out->flushes;
+	}
+}
+
+/*
+ * Fold the high-water marks reached since log_stats into st and start a new
+ * period.
+ */
+void
+log_peaks_reset(log_stat_t *st) {
+	uint32_t peak;
+
+	assert(st);
+
+	st->qpeak = max(st->qpeak, (uint32_t)queue_peak_reset(&log_queue));
+	for (size_t i = 0; i < st->outs && i < nouts; i++) {
+		peak = queue_peak_reset(&outs[i].queue);
+		st->out[i].qpeak = max(st->out[i].qpeak, peak);
+	}
 }
 
 void
@@ -282,33 +1412,64 @@ log_version(FILE *f) {
 }
 
 /*
- * Convenience function to generate and submit a xnumon-ops event.
+ * Allocate and fill in a xnumon-ops event, without submitting it.
  */
-static int
-log_event_xnumon_ops(const char *subtype) {
+static xnumon_ops_t *
+log_event_xnumon_ops_new(const char *subtype, uint64_t startup,
+                         const xnumon_stage_t *stagev, size_t stagec) {
 	xnumon_ops_t *evt;
 
 	evt = malloc(sizeof(xnumon_ops_t));
 	if (!evt)
-		return -1;
+		return NULL;
 	bzero(evt, sizeof(xnumon_ops_t));
 	evt->hdr.code = LOGEVT_XNUMON_OPS;
 	if (timespec_nanotime(&evt->hdr.tv) == -1) {
 		free(evt);
-		return -1;
+		return NULL;
 	}
 	evt->hdr.le_free = free;
 	evt->subtype = subtype;
+	evt->startup = startup;
+	evt->stages = min(stagec, (size_t)XNUMON_STAGES_MAX);
+	if (evt->stages > 0)
+		memcpy(evt->stage, stagev,
+		       evt->stages * sizeof(xnumon_stage_t));
+	return evt;
+}
+
+/*
+ * Convenience function to generate and submit a xnumon-ops event.
+ */
+static int
+log_event_xnumon_ops(const char *subtype, uint64_t startup,
+                     const xnumon_stage_t *stagev, size_t stagec) {
+	xnumon_ops_t *evt;
+
+	evt = log_event_xnumon_ops_new(subtype, startup, stagev, stagec);
+	if (!evt)
+		return -1;
 	work_submit(evt);
 	return 0;
 }
 
 /*
- * Convenience function to generate and submit a xnumon-ops(start) event.
+ * Convenience function to generate and submit a xnumon-ops(start) event,
+ * including the time spent in each startup stage.
+ */
+int
+log_event_xnumon_start(uint64_t startup,
+                       const xnumon_stage_t *stagev, size_t stagec) {
+	return log_event_xnumon_ops("start", startup, stagev, stagec);
+}
+
+/*
+ * Convenience function to generate and submit a xnumon-ops(ready) event,
+ * once all events queued during startup have passed the work stage.
  */
 int
-log_event_xnumon_start(void) {
-	return log_event_xnumon_ops("start");
+log_event_xnumon_ready(uint64_t startup) {
+	return log_event_xnumon_ops("ready", startup, NULL, 0);
 }
 
 /*
@@ -316,7 +1477,101 @@ log_event_xnumon_start(void) {
  */
 int
 log_event_xnumon_stop(void) {
-	return log_event_xnumon_ops("stop");
+	return log_event_xnumon_ops("stop", 0, NULL, 0);
+}
+
+/*
+ * Convenience function to generate and submit a xnumon-ops(degrade) event
+ * for a transition from degradation level prevlevel to level.
+ */
+int
+log_event_xnumon_degrade(unsigned int level, unsigned int prevlevel,
+                         const char *reason) {
+	xnumon_ops_t *evt;
+
+	evt = log_event_xnumon_ops_new("degrade", 0, NULL, 0);
+	if (!evt)
+		return -1;
+	evt->reason = reason;
+	evt->level = level;
+	evt->prevlevel = prevlevel;
+	work_submit(evt);
+	return 0;
+}
+
+/*
+ * Convenience function to generate and submit a xnumon-ops(shed) event for
+ * a transition from memory shedding level prevlevel to level.
+ */
+int
+log_event_xnumon_shed(unsigned int level, unsigned int prevlevel,
+                      uint64_t footprint, uint64_t budget) {
+	xnumon_ops_t *evt;
+
+	evt = log_event_xnumon_ops_new("shed", 0, NULL, 0);
+	if (!evt)
+		return -1;
+	evt->level = level;
+	evt->prevlevel = prevlevel;
+	evt->footprint = footprint;
+	evt->budget = budget;
+	work_submit(evt);
+	return 0;
+}
+
+/*
+ * Convenience function to generate and submit a xnumon-ops(reload) event
+ * after the CONFIG_CHANGED_* changes were applied without a restart.
+ */
+int
+log_event_xnumon_reload(int changes) {
+	xnumon_ops_t *evt;
+
+	evt = log_event_xnumon_ops_new("reload", 0, NULL, 0);
+	if (!evt)
+		return -1;
+	evt->changes = changes;
+	work_submit(evt);
+	return 0;
+}
+
+static void
+log_event_xnumon_ops_free(void *vevt) {
+	xnumon_ops_t *evt = vevt;
+
+	if (evt->path)
+		free(evt->path);
+	if (evt->codesign)
+		codesign_free(evt->codesign);
+	if (evt->prevcodesign)
+		codesign_free(evt->prevcodesign);
+	free(evt);
+}
+
+/*
+ * Convenience function to generate and submit a xnumon-ops(revalidate)
+ * event after the cached code signature of the image at path changed from
+ * prev to cs on revalidation.
+ */
+int
+log_event_xnumon_revalidate(const char *path, codesign_t *prev,
+                            codesign_t *cs) {
+	xnumon_ops_t *evt;
+
+	evt = log_event_xnumon_ops_new("revalidate", 0, NULL, 0);
+	if (!evt)
+		return -1;
+	evt->hdr.le_free = log_event_xnumon_ops_free;
+	evt->path = strdup(path);
+	evt->codesign = codesign_ref(cs);
+	evt->prevcodesign = codesign_ref(prev);
+	if (!evt->path) {
+		log_event_xnumon_ops_free(evt);
+		errno = ENOMEM;
+		return -1;
+	}
+	work_submit(evt);
+	return 0;
 }
 
 /*
@@ -331,6 +1586,7 @@ log_event_xnumon_stats(void) {
 		return -1;
 	bzero(st, sizeof(evtloop_stat_t));
 	evtloop_stats(st);
+	evtloop_stats_interval(st, true);
 	st->hdr.code = LOGEVT_XNUMON_STATS;
 	if (timespec_nanotime(&st->hdr.tv) == -1) {
 		free(st);
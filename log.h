@@ -12,33 +12,79 @@
 #define LOG_H
 
 #include "logevt.h"
+#include "logdst.h"
 #include "config.h"
+#include "hist.h"
 #include "attrib.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
 int logfmt_parse(config_t *, const char *) NONNULL(1,2) WUNRES;
 const char *logfmt_s(config_t *) NONNULL(1);
+logfmt_t *logfmt_driver(config_t *) NONNULL(1);
+bool logfmt_binary(config_t *) NONNULL(1);
 int logdst_parse(config_t *, const char *) NONNULL(1,2) WUNRES;
 const char *logdst_s(config_t *) NONNULL(1);
+int log_fanout_parse(config_t *, const char *) NONNULL(1,2) WUNRES;
+const char *log_fanout_dst_s(config_t *, size_t) NONNULL(1);
+const char *log_fanout_fmt_s(config_t *, size_t) NONNULL(1);
 
+int log_check(config_t *) NONNULL(1) WUNRES;
 int log_init(config_t *) NONNULL(1) WUNRES;
 int log_reinit(void) WUNRES;
+int log_reconfig(config_t *) NONNULL(1) WUNRES;
+bool log_reconfig_pending(void);
 void log_fini(void);
 
+/* per destination with log_fanout, logdst first */
 typedef struct {
+	const char *dst;        /* logdst driver */
+	const char *fmt;        /* logfmt driver */
 	uint32_t qsize;
+	uint32_t qpeak;         /* since last log_peaks_reset */
+	uint64_t records;
+	uint64_t drops;
+	uint64_t blocks;
 	uint64_t errors;
+	uint64_t flushes;
+	logdst_stat_t ld;       /* if reported by logdst */
+} log_out_stat_t;
+
+typedef struct {
+	uint32_t qsize;
+	uint32_t qpeak;         /* since last log_peaks_reset */
+	uint64_t drops;
+	uint64_t blocks;
+	uint64_t errors;        /* including those of all destinations */
+	uint64_t flushes;       /* including those of all destinations */
+	logdst_stat_t ld;       /* if reported by logdst */
 	uint64_t counts[LOGEVT_SIZE];
+	/* usec from stamp i to stamp i + 1, and from the event stamp to
+	 * logged in the last histogram */
+	hist_t latency[LOGEVT_STAMPS];
+	uint32_t outs;          /* 0 without log_fanout */
+	log_out_stat_t out[LOG_FANOUT_MAX + 1];
 } log_stat_t;
 
 void log_submit(void *) NONNULL(1);
+int log_render(FILE *, logevt_header_t *) NONNULL(1,2);
+int log_render_func(FILE *, logevt_func_t, void *) NONNULL(1,2);
 void log_stats(log_stat_t *) NONNULL(1);
+void log_peaks_reset(log_stat_t *) NONNULL(1);
 void log_version(FILE *) NONNULL(1);
 
-int log_event_xnumon_start(void) WUNRES;
+int log_event_xnumon_start(uint64_t, const xnumon_stage_t *, size_t) WUNRES;
+int log_event_xnumon_ready(uint64_t) WUNRES;
 int log_event_xnumon_stop(void) WUNRES;
+int log_event_xnumon_degrade(unsigned int, unsigned int, const char *)
+    NONNULL(3) WUNRES;
+int log_event_xnumon_shed(unsigned int, unsigned int, uint64_t, uint64_t)
+    WUNRES;
+int log_event_xnumon_reload(int) WUNRES;
+int log_event_xnumon_revalidate(const char *, codesign_t *, codesign_t *)
+    NONNULL(1,2,3) WUNRES;
 int log_event_xnumon_stats(void) WUNRES;
 
 #endif
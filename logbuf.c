@@ -0,0 +1,61 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "logbuf.h"
+
+#include <stdlib.h>
+#include <errno.h>
+
+int
+logbuf_init(logbuf_t *lb, size_t cap) {
+	lb->buf = malloc(cap);
+	if (!lb->buf) {
+		lb->len = lb->cap = 0;
+		return -1;
+	}
+	lb->len = 0;
+	lb->cap = cap;
+	return 0;
+}
+
+void
+logbuf_fini(logbuf_t *lb) {
+	free(lb->buf);
+	lb->buf = NULL;
+	lb->len = lb->cap = 0;
+}
+
+/*
+ * Grow the buffer such that at least `sz' more bytes fit.  Returns -1 with
+ * errno set to ENOMEM if that is not possible.
+ */
+int
+logbuf_grow(logbuf_t *lb, size_t sz) {
+	size_t cap;
+	char *buf;
+
+	cap = lb->cap ? lb->cap : LOGBUF_SIZE_INITIAL;
+	while (cap - lb->len < sz) {
+		if (cap > ((size_t)-1) / 2) {
+			errno = ENOMEM;
+			return -1;
+		}
+		cap *= 2;
+	}
+	buf = realloc(lb->buf, cap);
+	if (!buf) {
+		errno = ENOMEM;
+		return -1;
+	}
+	lb->buf = buf;
+	lb->cap = cap;
+	return 0;
+}
+
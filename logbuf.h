@@ -0,0 +1,61 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef LOGBUF_H
+#define LOGBUF_H
+
+#include "attrib.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Growable output buffer for rendering log records.  Rendering appends to
+ * the buffer without any stdio overhead; the finished record is then written
+ * out in one go.  Writes that fail to grow the buffer return -1 and leave
+ * the buffer unchanged.
+ */
+#define LOGBUF_SIZE_INITIAL     4096
+
+typedef struct {
+	char *buf;
+	size_t len;
+	size_t cap;
+} logbuf_t;
+
+int logbuf_init(logbuf_t *, size_t) NONNULL(1) WUNRES;
+void logbuf_fini(logbuf_t *) NONNULL(1);
+int logbuf_grow(logbuf_t *, size_t) NONNULL(1) WUNRES;
+
+static inline void
+logbuf_reset(logbuf_t *lb) {
+	lb->len = 0;
+}
+
+static inline int
+logbuf_write(logbuf_t *lb, const void *p, size_t sz) {
+	if (lb->cap - lb->len < sz && logbuf_grow(lb, sz) == -1)
+		return -1;
+	memcpy(lb->buf + lb->len, p, sz);
+	lb->len += sz;
+	return 0;
+}
+
+static inline int
+logbuf_putc(logbuf_t *lb, char c) {
+	if (lb->len == lb->cap && logbuf_grow(lb, 1) == -1)
+		return -1;
+	lb->buf[lb->len++] = c;
+	return 0;
+}
+
+#endif
+
@@ -14,8 +14,10 @@
 #include "attrib.h"
 #include "config.h"
 #include "logevt.h"
+#include "hist.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 /*
@@ -25,25 +27,78 @@
  * formatted logging.  The FILE * produced by ld_open will be passed to the
  * event formatter, which will use the log format driver to write a formatted
  * log record to the FILE *.
+ *
+ * Raw drivers can optionally implement ld_event_batch, in which case the
+ * log thread passes them all events dequeued at once, up to LOG_RAW_BATCH,
+ * in a single call instead of calling ld_event, such that they can amortize
+ * round trips and serialization over many events.  The events are freed by
+ * the log thread after ld_event_batch returns and must neither be modified
+ * nor retained.  A return value of -1 counts all events as errors.
+ *
+ * Normal drivers can optionally implement ld_flush, in which case ld_close
+ * is not expected to commit the record to the destination.  Instead, the
+ * log thread renders batches of events back to back and calls ld_flush once
+ * per batch, or when the log_flush_deadline has passed under sustained load.
+ *
+ * Only drivers that set ld_binary can be used with binary log formats, which
+ * write length-prefixed frames instead of lines of text.  Only drivers that
+ * set ld_compress honour log_compression.  Drivers can optionally implement
+ * ld_stats to report the number of bytes rendered into and written by them,
+ * the number of writes and syncs they issued, and for destinations that
+ * spool batches before writing them out, their spool depth and write
+ * latency.
+ *
+ * Drivers implementing ld_reinit reopen the destination for log rotation.
+ * Since ld_reinit is called from the main thread, it only opens the new
+ * destination on the side and must not disturb the thread writing to the
+ * current one.  The writing thread calls ld_rotate at a batch boundary to
+ * switch to the new destination, which returns 1 if it switched, 0 if there
+ * was nothing to switch to and -1 on error.  The old destination is closed
+ * in the background.
  */
+typedef struct {
+	uint64_t rendered;      /* bytes */
+	uint64_t written;       /* bytes */
+	uint64_t writes;        /* write(2) calls */
+	uint64_t syncs;         /* fsync(2) calls */
+	uint32_t spooled;       /* batches waiting to be written */
+	uint64_t spoolbytes;
+	uint32_t spoolsegs;     /* disk spool segments in use */
+	uint64_t spilled;       /* bytes written to the disk spool */
+	uint64_t stalls;        /* flushes that waited for spool space */
+	uint64_t drops;         /* batches dropped due to full spool */
+	uint64_t connects;
+	hist_t latency;         /* usec from flush to written */
+} logdst_stat_t;
+
 typedef int    (*logdst_init_func_t)(config_t *);
 typedef int    (*logdst_reinit_func_t)(void);
 typedef void   (*logdst_fini_func_t)(void);
 typedef FILE * (*logdst_open_func_t)(void);
 typedef int    (*logdst_close_func_t)(FILE *);
+typedef int    (*logdst_flush_func_t)(void);
 typedef int    (*logdst_event_func_t)(const logevt_header_t *);
+typedef int    (*logdst_event_batch_func_t)(logevt_header_t **, size_t);
+typedef void   (*logdst_stats_func_t)(logdst_stat_t *);
+typedef int    (*logdst_rotate_func_t)(void);
 typedef struct {
 	const char *ld_name;
 	bool ld_raw;                /* wants raw event, not formatted buffer */
 	bool ld_oneline;            /* supports compact one-line format */
 	bool ld_multiline;          /* supports readable multi-line format */
 	bool ld_onelineprefered;    /* prefers oneline if both are available */
+	bool ld_binary;             /* supports binary formats */
+	bool ld_compress;           /* supports compression */
 	logdst_init_func_t   ld_init;
 	logdst_reinit_func_t ld_reinit;
 	logdst_fini_func_t   ld_fini;
 	logdst_event_func_t  ld_event;  /* raw mode only */
 	logdst_open_func_t   ld_open;   /* normal mode only */
 	logdst_close_func_t  ld_close;  /* normal mode only */
+	logdst_flush_func_t  ld_flush;  /* normal mode only, optional */
+	logdst_stats_func_t  ld_stats;  /* optional */
+	logdst_rotate_func_t ld_rotate; /* with ld_reinit only */
+	logdst_event_batch_func_t ld_event_batch; /* raw only, optional */
 } logdst_t;
 
 
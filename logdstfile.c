@@ -13,36 +13,477 @@
 #include "sys.h"
 #include "attrib.h"
 #include "config.h"
+#include "log.h"
+#include "logbuf.h"
+#include "policy.h"
+#include "thrstat.h"
+#include "time.h"
+
+#include "memstream.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <assert.h>
 
+#include <zlib.h>
+
+#define LOGDSTFILE_BUFSIZE (256*1024)
+#define LOGDSTFILE_ZLEVEL  3
+#define LOGDSTFILE_ZWBITS  (15+16)      /* gzip wrapper */
+#define LOGDSTFILE_PREALLOC (8*1024*1024)
+
 static config_t *config = NULL;
 static FILE *f = NULL;
 static gid_t gid;
 
+/*
+ * The mutex serializes writing, syncing and switching files between the
+ * writing thread, the sync thread and log_reinit.
+ */
+static pthread_mutex_t mutex;
+static pthread_cond_t synccond;         /* stopping */
+static pthread_t sync_thr;
+static bool syncing;                    /* sync thread running */
+static bool stopping;
+
+/*
+ * Log rotation:  logdstfile_reinit opens the new file as nextf, and the
+ * writing thread switches to it in logdstfile_rotate, handing the old file
+ * to a close thread as oldf.
+ */
+static FILE *nextf = NULL;
+static FILE *oldf = NULL;
+static bool oldsync;                    /* sync oldf before closing */
+static pthread_t close_thr;
+static bool closing;                    /* close thread not joined yet */
+
+/*
+ * With log_file_coalesce, flushed batches are collected in cbuf and written
+ * to the file in page-aligned chunks of at least log_file_coalesce KiB, with
+ * whatever is left over written out by the sync thread at most
+ * log_file_interval ms later.  Disk space is preallocated ahead of the
+ * chunks using F_PREALLOCATE, which does not change the file size, such
+ * that appending rarely needs to allocate new extents.  The file is written
+ * using write(2) on the descriptor instead of stdio in this mode.
+ */
+static logbuf_t cbuf;
+static size_t coalesce;                 /* bytes, 0 if not coalescing */
+static off_t off;                       /* end of file, -1 if unknown */
+static off_t prealloc;                  /* preallocated up to */
+static off_t fpos;                      /* stdio position at last flush */
+static bool unsynced;
+static uint64_t writes;
+static uint64_t syncs;
+
+/*
+ * With log_compression, each batch is rendered into a memory buffer and
+ * written out as a complete gzip member on flush.  Concatenated members form
+ * a valid gzip file, so that the log can be read with zcat(1) and zgrep(1),
+ * and every member can be decompressed on its own as soon as it is written.
+ */
+static z_stream zs;
+static FILE *batch = NULL;
+static char *bbuf = NULL;
+static size_t bsz;
+static unsigned char *zbuf = NULL;
+static size_t zbufsz = 0;
+static uint64_t rendered;
+static uint64_t written;
+
 static FILE *
 logdstfile_open(void) {
-	return f;
+	if (!config->log_compress && !coalesce) {
+		if (fpos == -1 && fseeko(f, 0, SEEK_END) == 0)
+			fpos = ftello(f);
+		return f;
+	}
+	if (!batch) {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunguarded-availability"
+		batch = open_memstream(&bbuf, &bsz);
+#pragma clang diagnostic pop
+	}
+	return batch;
 }
 
 static int
-logdstfile_close(FILE *f) {
-	fflush(f);
+logdstfile_close(UNUSED FILE *f) {
 	return 0;
 }
 
-static int logdstfile_reinit(void);
+/*
+ * Sync the file according to log_file_sync after writing to it.
+ * Called with the mutex held.
+ */
+static void
+logdstfile_sync(bool interval) {
+	if (!unsynced)
+		return;
+	if (config->log_file_sync == LOG_FILE_SYNC_NONE ||
+	    (config->log_file_sync == LOG_FILE_SYNC_INTERVAL && !interval))
+		return;
+	if (fsync(fileno(f)) == 0) {
+		unsynced = false;
+		syncs++;
+	}
+}
+
+/*
+ * Preallocate disk space for the file up to at least end.  Contiguous space
+ * is preferred but not required.  Called with the mutex held.
+ */
+static void
+logdstfile_prealloc(off_t end) {
+#ifdef F_PREALLOCATE
+	fstore_t fst;
 
+	if (end <= prealloc)
+		return;
+	fst.fst_flags = F_ALLOCATECONTIG|F_ALLOCATEALL;
+	fst.fst_posmode = F_PEOFPOSMODE;
+	fst.fst_offset = 0;
+	fst.fst_length = end - off + LOGDSTFILE_PREALLOC;
+	fst.fst_bytesalloc = 0;
+	if (fcntl(fileno(f), F_PREALLOCATE, &fst) == -1) {
+		fst.fst_flags = F_ALLOCATEALL;
+		(void)fcntl(fileno(f), F_PREALLOCATE, &fst);
+	}
+	/* do not retry on every chunk if the file system does not support it */
+	prealloc = end + LOGDSTFILE_PREALLOC;
+#else
+	(void)end;
+#endif
+}
+
+/*
+ * Write out the coalesced bytes up to the last page boundary, or all of
+ * them if all is set.  Called with the mutex held.
+ */
 static int
-logdstfile_init(config_t *cfg) {
-	config = cfg;
-	gid = sys_gidbyname("admin");
-	logdstfile_reinit();
+logdstfile_drain(bool all) {
+	size_t n, done;
+	ssize_t rv;
+	int fd;
+
+	if (cbuf.len == 0)
+		return 0;
+	fd = fileno(f);
+	if (off == -1) {
+		off = lseek(fd, 0, SEEK_END);
+		if (off == -1)
+			return -1;
+		prealloc = off;
+	}
+	if (all) {
+		n = cbuf.len;
+	} else {
+		off_t pg = getpagesize();
+		off_t end = (off + (off_t)cbuf.len) & ~(pg - 1);
+		if (end <= off)
+			return 0;
+		n = end - off;
+	}
+	logdstfile_prealloc(off + n);
+	for (done = 0; done < n; done += rv) {
+		rv = write(fd, cbuf.buf + done, n - done);
+		if (rv == -1) {
+			if (errno == EINTR) {
+				rv = 0;
+				continue;
+			}
+			break;
+		}
+		writes++;
+	}
+	written += done;
+	off += done;
+	if (done > 0)
+		unsynced = true;
+	memmove(cbuf.buf, cbuf.buf + done, cbuf.len - done);
+	cbuf.len -= done;
+	if (done < n)
+		return -1;
+	logdstfile_sync(false);
+	return 0;
+}
+
+/*
+ * Write a flushed batch of n bytes to the file, or add it to the coalescing
+ * buffer.  Called with the mutex held.
+ */
+static int
+logdstfile_out(const void *p, size_t n) {
+	if (!coalesce) {
+		if (fwrite(p, 1, n, f) != n || fflush(f) == EOF)
+			return -1;
+		writes++;
+		written += n;
+		unsynced = true;
+		logdstfile_sync(false);
+		return 0;
+	}
+	if (logbuf_write(&cbuf, p, n) == -1)
+		return -1;
+	if (cbuf.len < coalesce)
+		return 0;
+	return logdstfile_drain(false);
+}
+
+/*
+ * Move a rendered uncompressed batch into the coalescing buffer.
+ * Called with the mutex held.
+ */
+static int
+logdstfile_flush_coalesced(void) {
+	int rv;
+
+	if (!batch)
+		return 0;
+	fclose(batch);
+	batch = NULL;
+	if (!bbuf)
+		return -1;
+	rendered += bsz;
+	rv = logdstfile_out(bbuf, bsz);
+	free(bbuf);
+	bbuf = NULL;
+	return rv;
+}
+
+/*
+ * Flush stdio in the default mode and account for what it wrote.
+ * Called with the mutex held.
+ */
+static int
+logdstfile_flush_stdio(void) {
+	off_t pos;
+
+	pos = ftello(f);
+	if (fflush(f) == EOF)
+		return -1;
+	if (fpos != -1 && pos > fpos) {
+		rendered += pos - fpos;
+		written += pos - fpos;
+		writes++;
+		unsynced = true;
+		logdstfile_sync(false);
+	}
+	fpos = pos;
+	return 0;
+}
+
+static int
+logdstfile_flush_compressed(void) {
+	unsigned char *p;
+	size_t n;
+	int rv = -1;
+
+	if (!batch)
+		return 0;
+	fclose(batch);
+	batch = NULL;
+	if (!bbuf)
+		return -1;
+	if (bsz == 0) {
+		rv = 0;
+		goto out;
+	}
+
+	n = deflateBound(&zs, bsz);
+	if (n > zbufsz) {
+		p = realloc(zbuf, n);
+		if (!p)
+			goto out;
+		zbuf = p;
+		zbufsz = n;
+	}
+	zs.next_in = (unsigned char *)bbuf;
+	zs.avail_in = bsz;
+	zs.next_out = zbuf;
+	zs.avail_out = zbufsz;
+	if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+		(void)deflateReset(&zs);
+		goto out;
+	}
+	n = zbufsz - zs.avail_out;
+	(void)deflateReset(&zs);
+
+	rendered += bsz;
+	rv = logdstfile_out(zbuf, n);
+out:
+	free(bbuf);
+	bbuf = NULL;
+	return rv;
+}
+
+static int
+logdstfile_flush(void) {
+	int rv;
+
+	pthread_mutex_lock(&mutex);
+	if (config->log_compress)
+		rv = logdstfile_flush_compressed();
+	else if (coalesce)
+		rv = logdstfile_flush_coalesced();
+	else
+		rv = logdstfile_flush_stdio();
+	pthread_mutex_unlock(&mutex);
+	return rv;
+}
+
+/*
+ * Write out coalesced bytes and sync the file every log_file_interval ms.
+ */
+static void *
+logdstfile_thread(UNUSED void *arg) {
+	struct timespec ts;
+
+	(void)policy_thread_diskio_utility();
+	thrstat_register(THRSTAT_LOGSEND);
+
+	pthread_mutex_lock(&mutex);
+	while (!stopping) {
+		if (timespec_nanotime(&ts) == -1)
+			break;
+		timespec_add_msec(&ts, config->log_file_interval);
+		while (!stopping) {
+			if (pthread_cond_timedwait(&synccond, &mutex, &ts) ==
+			    ETIMEDOUT)
+				break;
+		}
+		if (stopping || !f)
+			break;
+		(void)logdstfile_drain(true);
+		logdstfile_sync(true);
+	}
+	pthread_mutex_unlock(&mutex);
+	return NULL;
+}
+
+static FILE * logdstfile_fopen(void);
+
+/*
+ * Remove an incomplete last frame of a binary log format, if any, by walking
+ * the length prefixes of all frames from the beginning of the file.
+ */
+static void
+logdstfile_truncate_frames(void) {
+	unsigned char hdr[LOGFMT_FRAME_HDRSZ];
+	struct stat st;
+	off_t pos, sz;
+
+	if (fstat(fileno(f), &st) == -1)
+		return;
+	pos = 0;
+	while (pos < st.st_size) {
+		if (fseeko(f, pos, SEEK_SET) == -1 ||
+		    fread(hdr, sizeof(hdr), 1, f) != 1)
+			break;
+		sz = 0;
+		for (size_t i = 0; i < sizeof(hdr); i++)
+			sz = (sz << 8) | hdr[i];
+		if (pos + (off_t)sizeof(hdr) + sz > st.st_size)
+			break;
+		pos += sizeof(hdr) + sz;
+	}
+	if (pos < st.st_size)
+		ftruncate(fileno(f), pos);
+	fseeko(f, 0, SEEK_END);
+}
+
+/*
+ * Remove an incomplete or corrupt last gzip member, if any, by decompressing
+ * all members from the beginning of the file.  Refuses to append to a file
+ * that does not start with a gzip member.
+ */
+static int
+logdstfile_truncate_members(void) {
+	unsigned char in[16384], out[16384];
+	z_stream is;
+	struct stat st;
+	off_t rd, good;
+	size_t n;
+	int rv;
+
+	if (fstat(fileno(f), &st) == -1)
+		return -1;
+	if (st.st_size == 0)
+		return 0;
+	bzero(&is, sizeof(is));
+	if (inflateInit2(&is, LOGDSTFILE_ZWBITS) != Z_OK)
+		return -1;
+	fseeko(f, 0, SEEK_SET);
+	if (fread(in, 1, 2, f) != 2 || in[0] != 0x1f || in[1] != 0x8b) {
+		(void)inflateEnd(&is);
+		fseeko(f, 0, SEEK_END);
+		fprintf(stderr, "Not appending to non-gzip file %s\n",
+		                config->logfile);
+		return -1;
+	}
+	fseeko(f, 0, SEEK_SET);
+	rd = 0;
+	good = 0;
+	for (;;) {
+		if (is.avail_in == 0) {
+			n = fread(in, 1, sizeof(in), f);
+			if (n == 0)
+				break;
+			is.next_in = in;
+			is.avail_in = n;
+			rd += n;
+		}
+		is.next_out = out;
+		is.avail_out = sizeof(out);
+		rv = inflate(&is, Z_NO_FLUSH);
+		if (rv == Z_STREAM_END) {
+			good = rd - is.avail_in;
+			(void)inflateReset(&is);
+		} else if (rv != Z_OK && rv != Z_BUF_ERROR) {
+			break;
+		}
+	}
+	(void)inflateEnd(&is);
+	if (good < st.st_size) {
+		fflush(f);
+		ftruncate(fileno(f), good);
+	}
+	fseeko(f, 0, SEEK_END);
+	return 0;
+}
+
+static int
+logdstfile_init_file(config_t *cfg) {
+	f = logdstfile_fopen();
 	if (!f)
 		return -1;
+	if (cfg->log_compress) {
+		bzero(&zs, sizeof(zs));
+		if (deflateInit2(&zs, LOGDSTFILE_ZLEVEL, Z_DEFLATED,
+		                 LOGDSTFILE_ZWBITS, 8,
+		                 Z_DEFAULT_STRATEGY) != Z_OK) {
+			fclose(f);
+			f = NULL;
+			return -1;
+		}
+		if (logdstfile_truncate_members() == -1) {
+			(void)deflateEnd(&zs);
+			fclose(f);
+			f = NULL;
+			return -1;
+		}
+		return 0;
+	}
+	if (logfmt_binary(cfg)) {
+		logdstfile_truncate_frames();
+		return 0;
+	}
 	/* remove incomplete last line, if any */
 	for (int offset = -1;; offset--) {
 		if (fseek(f, offset, SEEK_END) == -1) {
@@ -66,36 +507,222 @@ logdstfile_init(config_t *cfg) {
 }
 
 static int
-logdstfile_reinit(void) {
+logdstfile_init(config_t *cfg) {
+	config = cfg;
+	gid = sys_gidbyname("admin");
+	rendered = 0;
+	written = 0;
+	writes = 0;
+	syncs = 0;
+	coalesce = cfg->log_file_coalesce * 1024;
+	off = -1;
+	prealloc = 0;
+	fpos = -1;
+	unsynced = false;
+	stopping = false;
+	syncing = false;
+	closing = false;
+	if (coalesce &&
+	    logbuf_init(&cbuf, coalesce + LOGDSTFILE_BUFSIZE) == -1) {
+		config = NULL;
+		return -1;
+	}
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&synccond, NULL);
+	if (logdstfile_init_file(cfg) == -1)
+		goto errout;
+	if (coalesce || cfg->log_file_sync == LOG_FILE_SYNC_INTERVAL) {
+		if (pthread_create(&sync_thr, NULL,
+		                   logdstfile_thread, NULL) != 0) {
+			if (cfg->log_compress)
+				(void)deflateEnd(&zs);
+			fclose(f);
+			f = NULL;
+			goto errout;
+		}
+		syncing = true;
+	}
+	return 0;
+errout:
+	pthread_cond_destroy(&synccond);
+	pthread_mutex_destroy(&mutex);
+	if (coalesce)
+		logbuf_fini(&cbuf);
+	config = NULL;
+	return -1;
+}
+
+static FILE *
+logdstfile_fopen(void) {
+	FILE *nf;
 	int fd;
 
 	assert(config);
-	if (f)
-		fclose(f);
-	f = fopen(config->logfile, "a+");
-	if (!f)
-		return -1;
-	fd = fileno(f);
+	nf = fopen(config->logfile, "a+");
+	if (!nf)
+		return NULL;
+	/* large buffer so that a batch of events results in a single write */
+	(void)setvbuf(nf, NULL, _IOFBF, LOGDSTFILE_BUFSIZE);
+	fd = fileno(nf);
 	(void)fchown(fd, 0, gid);
 	(void)fcntl(fd, F_NOCACHE, 1);
 	(void)fcntl(fd, F_SINGLE_WRITER, 1);
+	return nf;
+}
+
+/*
+ * Open the log file anew on the side for log_reinit, for the writing thread
+ * to switch to in logdstfile_rotate.  Replaces a previously opened new file
+ * that was not switched to yet.
+ */
+static int
+logdstfile_reinit(void) {
+	FILE *nf;
+
+	nf = logdstfile_fopen();
+	if (!nf)
+		return -1;
+	pthread_mutex_lock(&mutex);
+	if (nextf)
+		fclose(nextf);
+	nextf = nf;
+	pthread_mutex_unlock(&mutex);
 	return 0;
 }
 
+/*
+ * Sync and close a file switched away from in the background.
+ */
+static void *
+logdstfile_closer(UNUSED void *arg) {
+	(void)policy_thread_diskio_utility();
+
+	if (oldsync && fsync(fileno(oldf)) == 0) {
+		pthread_mutex_lock(&mutex);
+		syncs++;
+		pthread_mutex_unlock(&mutex);
+	}
+	fclose(oldf);
+	return NULL;
+}
+
+/*
+ * Wait for the file switched away from last to be closed.
+ */
+static void
+logdstfile_closer_join(void) {
+	if (!closing)
+		return;
+	if (pthread_join(close_thr, NULL) != 0) {
+		fprintf(stderr, "Failed to join log close thread - "
+		                "exiting\n");
+		exit(EXIT_FAILURE);
+	}
+	closing = false;
+}
+
+/*
+ * Switch to the file opened by logdstfile_reinit, if any.  Everything
+ * written so far goes to the old file, which is then synced if required by
+ * log_file_sync and closed in the background.  Called by the writing thread
+ * at a batch boundary.
+ */
+static int
+logdstfile_rotate(void) {
+	pthread_mutex_lock(&mutex);
+	if (!nextf) {
+		pthread_mutex_unlock(&mutex);
+		return 0;
+	}
+	pthread_mutex_unlock(&mutex);
+	/* the close thread of the previous rotation takes the mutex */
+	logdstfile_closer_join();
+	pthread_mutex_lock(&mutex);
+	if (coalesce)
+		(void)logdstfile_drain(true);
+	else if (!config->log_compress)
+		(void)logdstfile_flush_stdio();
+	oldf = f;
+	oldsync = unsynced && config->log_file_sync != LOG_FILE_SYNC_NONE;
+	f = nextf;
+	nextf = NULL;
+	off = -1;
+	prealloc = 0;
+	fpos = -1;
+	unsynced = false;
+	pthread_mutex_unlock(&mutex);
+	if (pthread_create(&close_thr, NULL, logdstfile_closer, NULL) != 0)
+		(void)logdstfile_closer(NULL);
+	else
+		closing = true;
+	return 1;
+}
+
 static void
 logdstfile_fini(void) {
+	if (syncing) {
+		pthread_mutex_lock(&mutex);
+		stopping = true;
+		pthread_cond_broadcast(&synccond);
+		pthread_mutex_unlock(&mutex);
+		if (pthread_join(sync_thr, NULL) != 0) {
+			fprintf(stderr, "Failed to join log sync thread - "
+			                "exiting\n");
+			exit(EXIT_FAILURE);
+		}
+		syncing = false;
+	}
+	logdstfile_closer_join();
+	if (nextf) {
+		fclose(nextf);
+		nextf = NULL;
+	}
+	if (f) {
+		(void)logdstfile_flush();
+		if (coalesce)
+			(void)logdstfile_drain(true);
+		logdstfile_sync(true);
+	}
+	if (config->log_compress) {
+		(void)deflateEnd(&zs);
+		if (zbuf) {
+			free(zbuf);
+			zbuf = NULL;
+			zbufsz = 0;
+		}
+	}
+	if (coalesce)
+		logbuf_fini(&cbuf);
 	if (f)
 		fclose(f);
+	f = NULL;
+	pthread_cond_destroy(&synccond);
+	pthread_mutex_destroy(&mutex);
 	config = NULL;
 }
 
+static void
+logdstfile_stats(logdst_stat_t *st) {
+	bzero(st, sizeof(logdst_stat_t));
+	pthread_mutex_lock(&mutex);
+	st->rendered = rendered;
+	st->written = written;
+	st->writes = writes;
+	st->syncs = syncs;
+	pthread_mutex_unlock(&mutex);
+}
+
 logdst_t logdstfile = {
-	"file", false, true, true, true,
+	"file", false, true, true, true, true, true,
 	logdstfile_init,
 	logdstfile_reinit,
 	logdstfile_fini,
 	NULL,
 	logdstfile_open,
-	logdstfile_close
+	logdstfile_close,
+	logdstfile_flush,
+	logdstfile_stats,
+	logdstfile_rotate,
+	NULL
 };
 
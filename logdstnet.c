@@ -0,0 +1,1045 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+/*
+ * Log destination streaming batches of formatted events to a collector over
+ * TCP, such as a JSON Lines or syslog TCP input.
+ *
+ * The log thread renders each batch into a memory buffer and hands it over
+ * to the spool on flush.  A separate send thread writes spooled batches to
+ * the socket, up to LOGDSTNET_INFLIGHT batches per writev(2), so that sending
+ * overlaps with rendering the next batches.  While the collector is slow or
+ * unreachable, batches accumulate in memory up to log_spool_memory, then in
+ * log_spool_file up to log_spool_size.  When the spool is full while
+ * connected, flushing blocks, which pushes back on the log queue and its
+ * queue_overflow policy; when the spool is full while disconnected, batches
+ * are dropped.
+ *
+ * Spooled batches are sent in order:  once a batch went to the disk spool,
+ * all later batches also go there until it has been drained, so all batches
+ * spooled in memory are always older than those spooled on disk.  A batch is
+ * removed from the spool as soon as it has been completely written to the
+ * socket; batches still in the kernel's send buffer when the connection
+ * breaks are lost, and a partially written batch is sent again in full after
+ * reconnecting.
+ *
+ * The disk spool consists of LOGDSTNET_SEGMENTS append-only segment files,
+ * named after log_spool_file with the slot number appended, that are filled
+ * and drained in order of their sequence numbers.  A segment is filled up to
+ * its share of log_spool_size before the next one is started, and emptied
+ * as soon as the send thread has drained it, so that the space of batches
+ * already sent becomes available again while a slow collector is still
+ * catching up with later segments.  Each segment starts with a header
+ * holding a magic, its sequence number and the offset of its first unsent
+ * batch, followed by a sequence of batches, each prefixed by its length and
+ * its flush time in microseconds since the epoch, as 32 bit and 64 bit big
+ * endian integers.  Batches remaining on shutdown are saved to a segment in
+ * front of the oldest one, if any, and sent after the next start.
+ */
+
+#include "logdstnet.h"
+
+#include "config.h"
+#include "attrib.h"
+#include "policy.h"
+#include "thrstat.h"
+#include "time.h"
+#include "hist.h"
+#include "minmax.h"
+
+#include "memstream.h"
+#include "tommylist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <assert.h>
+
+#define LOGDSTNET_INFLIGHT      8       /* batches per writev */
+#define LOGDSTNET_HDRSZ         12      /* disk spool entry header */
+#define LOGDSTNET_SEGMENTS      8       /* disk spool segment files */
+#define LOGDSTNET_SEGHDRSZ      24      /* disk spool segment header */
+#define LOGDSTNET_SEGMAGIC      "XNSPOOL1"
+#define LOGDSTNET_SEGSEQ0       ((uint64_t)1 << 32) /* room to prepend */
+#define LOGDSTNET_CONNTIMEO     10      /* sec */
+#define LOGDSTNET_SNDTIMEO      30      /* sec */
+#define LOGDSTNET_BACKOFF_MAX   60      /* sec */
+#define LOGDSTNET_COPYBUFSZ     (64*1024)
+
+typedef struct {
+	char *buf;
+	size_t sz;
+	uint64_t usec;          /* flush time */
+	off_t next;             /* disk spool segment offset of next entry */
+	tommy_node node;
+} logdstnet_batch_t;
+
+static config_t *config = NULL;
+static char *host = NULL;
+static char *port = NULL;
+
+static pthread_t send_thr;
+static pthread_mutex_t mutex;
+static pthread_cond_t sendcond;         /* spool not empty or stopping */
+static pthread_cond_t spacecond;        /* spool space was freed */
+static bool stopping;
+static bool connected;
+static int sock = -1;                   /* send thread only */
+
+/* current batch, log thread only */
+static FILE *batch = NULL;
+static char *bbuf = NULL;
+static size_t bsz;
+
+/* memory spool */
+static tommy_list mspool;
+static uint32_t mcount;
+static size_t mbytes;
+static size_t mlimit;
+
+/* disk spool; drd is only modified by the send thread */
+#define DSLOT(SEQ) ((size_t)((SEQ) % LOGDSTNET_SEGMENTS))
+static int dfd[LOGDSTNET_SEGMENTS] = {-1, -1, -1, -1, -1, -1, -1, -1};
+static off_t dstart[LOGDSTNET_SEGMENTS]; /* first unsent entry per slot */
+static off_t dend[LOGDSTNET_SEGMENTS];  /* end of data per slot */
+static uint64_t drdseq;                 /* oldest live segment */
+static uint64_t dwrseq;                 /* newest live segment */
+static uint32_t dsegs;                  /* live segments */
+static off_t drd;                       /* offset in oldest segment */
+static uint32_t dcount;
+static uint64_t dbytes;
+static uint64_t dlimit;
+static off_t dseglimit;
+static uint64_t spilled;
+
+static uint64_t rendered;
+static uint64_t written;
+static uint64_t stalls;
+static uint64_t drops;
+static uint64_t connects;
+static hist_t latency;
+
+static uint64_t
+logdstnet_usec(void) {
+	struct timespec tv;
+
+	if (timespec_nanotime(&tv) == -1)
+		return 0;
+	return (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_nsec / 1000;
+}
+
+static void
+logdstnet_hdr_encode(unsigned char *hdr, size_t sz, uint64_t usec) {
+	for (int i = 0; i < 4; i++)
+		hdr[i] = (sz >> (8 * (3 - i))) & 0xFF;
+	for (int i = 0; i < 8; i++)
+		hdr[4 + i] = (usec >> (8 * (7 - i))) & 0xFF;
+}
+
+static void
+logdstnet_hdr_decode(const unsigned char *hdr, size_t *sz, uint64_t *usec) {
+	*sz = 0;
+	for (int i = 0; i < 4; i++)
+		*sz = (*sz << 8) | hdr[i];
+	*usec = 0;
+	for (int i = 0; i < 8; i++)
+		*usec = (*usec << 8) | hdr[4 + i];
+}
+
+static int
+logdstnet_write_full(int fd, const void *buf, size_t sz, off_t off) {
+	const char *p = buf;
+	ssize_t n;
+
+	while (sz > 0) {
+		n = pwrite(fd, p, sz, off);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		sz -= n;
+		off += n;
+	}
+	return 0;
+}
+
+static int
+logdstnet_read_full(int fd, void *buf, size_t sz, off_t off) {
+	char *p = buf;
+	ssize_t n;
+
+	while (sz > 0) {
+		n = pread(fd, p, sz, off);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		p += n;
+		sz -= n;
+		off += n;
+	}
+	return 0;
+}
+
+static void
+logdstnet_seghdr_encode(unsigned char *hdr, uint64_t seq, off_t start) {
+	memcpy(hdr, LOGDSTNET_SEGMAGIC, 8);
+	for (int i = 0; i < 8; i++)
+		hdr[8 + i] = (seq >> (8 * (7 - i))) & 0xFF;
+	for (int i = 0; i < 8; i++)
+		hdr[16 + i] = ((uint64_t)start >> (8 * (7 - i))) & 0xFF;
+}
+
+static int
+logdstnet_seghdr_decode(const unsigned char *hdr, uint64_t *seq,
+                        off_t *start) {
+	uint64_t u = 0;
+
+	if (memcmp(hdr, LOGDSTNET_SEGMAGIC, 8)) {
+		errno = EINVAL;
+		return -1;
+	}
+	*seq = 0;
+	for (int i = 0; i < 8; i++)
+		*seq = (*seq << 8) | hdr[8 + i];
+	for (int i = 0; i < 8; i++)
+		u = (u << 8) | hdr[16 + i];
+	*start = (off_t)u;
+	return 0;
+}
+
+/*
+ * Start segment seq in its slot, which must not hold a live segment.
+ * Called with the mutex held, or while the send thread is not running.
+ */
+static int
+logdstnet_seg_begin(uint64_t seq) {
+	unsigned char hdr[LOGDSTNET_SEGHDRSZ];
+	int fd = dfd[DSLOT(seq)];
+
+	logdstnet_seghdr_encode(hdr, seq, LOGDSTNET_SEGHDRSZ);
+	if (ftruncate(fd, 0) == -1 ||
+	    logdstnet_write_full(fd, hdr, sizeof(hdr), 0) == -1)
+		return -1;
+	dstart[DSLOT(seq)] = LOGDSTNET_SEGHDRSZ;
+	dend[DSLOT(seq)] = LOGDSTNET_SEGHDRSZ;
+	return 0;
+}
+
+/*
+ * Empty all segments.  The next segment continues the sequence.  Called
+ * with the mutex held, or while the send thread is not running.
+ */
+static void
+logdstnet_spool_reset(void) {
+	for (size_t i = 0; i < LOGDSTNET_SEGMENTS; i++) {
+		(void)ftruncate(dfd[i], 0);
+		dstart[i] = 0;
+		dend[i] = 0;
+	}
+	drdseq = dwrseq;
+	dsegs = 0;
+	drd = 0;
+	dcount = 0;
+	dbytes = 0;
+}
+
+/*
+ * Empty the oldest segments as long as they have been drained completely
+ * and a newer segment exists.  Called with the mutex held.
+ */
+static void
+logdstnet_spool_advance(void) {
+	while (drdseq < dwrseq && drd >= dend[DSLOT(drdseq)]) {
+		(void)ftruncate(dfd[DSLOT(drdseq)], 0);
+		dend[DSLOT(drdseq)] = 0;
+		drdseq++;
+		dsegs--;
+		drd = dstart[DSLOT(drdseq)];
+	}
+}
+
+/*
+ * Whether a batch of sz bytes can be appended to the disk spool.  Called
+ * with the mutex held.
+ */
+static bool
+logdstnet_spool_fits(size_t sz) {
+	off_t entry = (off_t)(LOGDSTNET_HDRSZ + sz);
+	off_t end;
+
+	if (dfd[0] == -1)
+		return false;
+	if (dsegs == 0)
+		return true;
+	if (dbytes + (uint64_t)entry > dlimit)
+		return false;
+	end = dend[DSLOT(dwrseq)];
+	return end == LOGDSTNET_SEGHDRSZ || end + entry <= dseglimit ||
+	       dsegs < LOGDSTNET_SEGMENTS;
+}
+
+/*
+ * Append a batch to the disk spool, starting a new segment if the newest
+ * one is full.  Called with the mutex held.
+ */
+static int
+logdstnet_spool_disk(const char *buf, size_t sz, uint64_t usec) {
+	unsigned char hdr[LOGDSTNET_HDRSZ];
+	off_t entry = (off_t)(sizeof(hdr) + sz);
+	off_t end;
+	int fd;
+
+	if (dsegs == 0 || (dend[DSLOT(dwrseq)] > LOGDSTNET_SEGHDRSZ &&
+	                   dend[DSLOT(dwrseq)] + entry > dseglimit)) {
+		if (logdstnet_seg_begin(dwrseq + 1) == -1)
+			return -1;
+		dwrseq++;
+		if (dsegs++ == 0) {
+			drdseq = dwrseq;
+			drd = dstart[DSLOT(dwrseq)];
+		}
+	}
+	fd = dfd[DSLOT(dwrseq)];
+	end = dend[DSLOT(dwrseq)];
+	logdstnet_hdr_encode(hdr, sz, usec);
+	if (logdstnet_write_full(fd, hdr, sizeof(hdr), end) == -1 ||
+	    logdstnet_write_full(fd, buf, sz, end + sizeof(hdr)) == -1) {
+		(void)ftruncate(fd, end);
+		return -1;
+	}
+	dend[DSLOT(dwrseq)] = end + entry;
+	dcount++;
+	dbytes += (uint64_t)entry;
+	spilled += (uint64_t)entry;
+	return 0;
+}
+
+/*
+ * Read up to max batches from disk spool segment fd, starting at off.
+ * Called by the send thread without holding the mutex.
+ */
+static size_t
+logdstnet_read_disk(logdstnet_batch_t **b, size_t max, int fd, off_t off,
+                    off_t end) {
+	unsigned char hdr[LOGDSTNET_HDRSZ];
+	size_t n;
+
+	for (n = 0; n < max && off < end; n++) {
+		b[n] = malloc(sizeof(logdstnet_batch_t));
+		if (!b[n])
+			break;
+		if (logdstnet_read_full(fd, hdr, sizeof(hdr), off) == -1) {
+			free(b[n]);
+			break;
+		}
+		logdstnet_hdr_decode(hdr, &b[n]->sz, &b[n]->usec);
+		b[n]->buf = malloc(b[n]->sz);
+		if (!b[n]->buf) {
+			free(b[n]);
+			break;
+		}
+		if (logdstnet_read_full(fd, b[n]->buf, b[n]->sz,
+		                        off + sizeof(hdr)) == -1) {
+			free(b[n]->buf);
+			free(b[n]);
+			break;
+		}
+		off += sizeof(hdr) + b[n]->sz;
+		b[n]->next = off;
+	}
+	return n;
+}
+
+static void
+logdstnet_disconnect(void) {
+	if (sock == -1)
+		return;
+	close(sock);
+	sock = -1;
+	pthread_mutex_lock(&mutex);
+	connected = false;
+	pthread_cond_broadcast(&spacecond);
+	pthread_mutex_unlock(&mutex);
+}
+
+static int
+logdstnet_connect_addr(struct addrinfo *ai) {
+	struct pollfd pfd;
+	struct timeval tv;
+	socklen_t len;
+	int fd, flags, err, one = 1;
+
+	fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (fd == -1)
+		return -1;
+	(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+	flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		goto errout;
+	if (connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+		if (errno != EINPROGRESS)
+			goto errout;
+		pfd.fd = fd;
+		pfd.events = POLLOUT;
+		if (poll(&pfd, 1, LOGDSTNET_CONNTIMEO * 1000) != 1)
+			goto errout;
+		len = sizeof(err);
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 ||
+		    err != 0)
+			goto errout;
+	}
+	if (fcntl(fd, F_SETFL, flags) == -1)
+		goto errout;
+#ifdef SO_NOSIGPIPE
+	(void)setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+	(void)setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+	tv.tv_sec = LOGDSTNET_SNDTIMEO;
+	tv.tv_usec = 0;
+	(void)setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	return fd;
+errout:
+	close(fd);
+	return -1;
+}
+
+static int
+logdstnet_connect(void) {
+	struct addrinfo hints, *res, *ai;
+	int fd = -1;
+
+	bzero(&hints, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &res) != 0)
+		return -1;
+	for (ai = res; ai && fd == -1; ai = ai->ai_next)
+		fd = logdstnet_connect_addr(ai);
+	freeaddrinfo(res);
+	if (fd == -1)
+		return -1;
+	sock = fd;
+	pthread_mutex_lock(&mutex);
+	connected = true;
+	connects++;
+	pthread_mutex_unlock(&mutex);
+	return 0;
+}
+
+/*
+ * Write batches to the socket.  Returns -1 if the connection broke.
+ */
+static int
+logdstnet_send(logdstnet_batch_t **b, size_t n) {
+	struct iovec iov[LOGDSTNET_INFLIGHT];
+	struct iovec *v = iov;
+	int iovcnt = (int)n;
+	ssize_t rv;
+	size_t len;
+
+	for (size_t i = 0; i < n; i++) {
+		iov[i].iov_base = b[i]->buf;
+		iov[i].iov_len = b[i]->sz;
+	}
+	while (iovcnt > 0) {
+		rv = writev(sock, v, iovcnt);
+		if (rv == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		len = (size_t)rv;
+		while (iovcnt > 0 && len >= v->iov_len) {
+			len -= v->iov_len;
+			v++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			v->iov_base = (char *)v->iov_base + len;
+			v->iov_len -= len;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Double the reconnect backoff and wait for it to expire or for stopping.
+ * Called with the mutex held.
+ */
+static void
+logdstnet_backoff(unsigned int *backoff) {
+	struct timespec ts;
+
+	*backoff = *backoff ? *backoff * 2 : 1;
+	if (*backoff > LOGDSTNET_BACKOFF_MAX)
+		*backoff = LOGDSTNET_BACKOFF_MAX;
+	if (timespec_nanotime(&ts) == -1)
+		return;
+	ts.tv_sec += *backoff;
+	while (!stopping) {
+		if (pthread_cond_timedwait(&sendcond, &mutex, &ts) ==
+		    ETIMEDOUT)
+			break;
+	}
+}
+
+static void *
+logdstnet_thread(UNUSED void *arg) {
+	logdstnet_batch_t *b[LOGDSTNET_INFLIGHT];
+	tommy_node *node;
+	unsigned int backoff = 0;
+	bool fromdisk;
+	uint64_t now;
+	off_t rd, end;
+	size_t n;
+	int fd;
+
+	(void)policy_thread_diskio_utility();
+	thrstat_register(THRSTAT_LOGSEND);
+
+	pthread_mutex_lock(&mutex);
+	for (;;) {
+		while (mcount == 0 && dcount == 0 && !stopping)
+			pthread_cond_wait(&sendcond, &mutex);
+		if (mcount == 0 && dcount == 0)
+			break;
+		/* on shutdown, drain over an established connection only */
+		if (stopping && sock == -1)
+			break;
+
+		if (sock == -1) {
+			pthread_mutex_unlock(&mutex);
+			if (logdstnet_connect() == -1) {
+				pthread_mutex_lock(&mutex);
+				logdstnet_backoff(&backoff);
+				continue;
+			}
+			pthread_mutex_lock(&mutex);
+		}
+
+		fromdisk = (mcount == 0);
+		if (fromdisk) {
+			logdstnet_spool_advance();
+			fd = dfd[DSLOT(drdseq)];
+			rd = drd;
+			end = dend[DSLOT(drdseq)];
+			pthread_mutex_unlock(&mutex);
+			n = logdstnet_read_disk(b, LOGDSTNET_INFLIGHT,
+			                        fd, rd, end);
+			if (n == 0) {
+				/* unreadable disk spool, give up on it */
+				fprintf(stderr, "Failed to read log spool - "
+				                "discarding %"PRIu32" batches\n",
+				                dcount);
+				pthread_mutex_lock(&mutex);
+				logdstnet_spool_reset();
+				pthread_cond_broadcast(&spacecond);
+				continue;
+			}
+		} else {
+			n = 0;
+			for (node = tommy_list_head(&mspool);
+			     node && n < LOGDSTNET_INFLIGHT; node = node->next)
+				b[n++] = node->data;
+			pthread_mutex_unlock(&mutex);
+		}
+
+		if (logdstnet_send(b, n) == -1) {
+			logdstnet_disconnect();
+			if (fromdisk) {
+				for (size_t i = 0; i < n; i++) {
+					free(b[i]->buf);
+					free(b[i]);
+				}
+			}
+			pthread_mutex_lock(&mutex);
+			logdstnet_backoff(&backoff);
+			continue;
+		}
+		backoff = 0;
+
+		now = logdstnet_usec();
+		pthread_mutex_lock(&mutex);
+		for (size_t i = 0; i < n; i++) {
+			written += b[i]->sz;
+			hist_add(&latency, now > b[i]->usec ?
+			                   now - b[i]->usec : 0);
+			if (!fromdisk) {
+				tommy_list_remove_existing(&mspool,
+				                           &b[i]->node);
+				mcount--;
+				mbytes -= b[i]->sz;
+			} else {
+				dbytes -= LOGDSTNET_HDRSZ + b[i]->sz;
+			}
+		}
+		if (fromdisk) {
+			drd = b[n - 1]->next;
+			dcount -= (uint32_t)n;
+			if (dcount == 0)
+				logdstnet_spool_reset();
+			else
+				logdstnet_spool_advance();
+		}
+		for (size_t i = 0; i < n; i++) {
+			free(b[i]->buf);
+			free(b[i]);
+		}
+		pthread_cond_broadcast(&spacecond);
+	}
+	pthread_mutex_unlock(&mutex);
+	return NULL;
+}
+
+static FILE *
+logdstnet_open(void) {
+	if (!batch) {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunguarded-availability"
+		batch = open_memstream(&bbuf, &bsz);
+#pragma clang diagnostic pop
+	}
+	return batch;
+}
+
+static int
+logdstnet_close(UNUSED FILE *f) {
+	return 0;
+}
+
+/*
+ * Hand the current batch over to the spool, waiting for space if both the
+ * memory and the disk spool are full and the collector is connected.
+ */
+static int
+logdstnet_flush(void) {
+	logdstnet_batch_t *b;
+	uint64_t usec;
+	int rv = 0;
+
+	if (!batch)
+		return 0;
+	fclose(batch);
+	batch = NULL;
+	if (!bbuf)
+		return -1;
+	if (bsz == 0) {
+		free(bbuf);
+		bbuf = NULL;
+		return 0;
+	}
+	usec = logdstnet_usec();
+
+	pthread_mutex_lock(&mutex);
+	rendered += bsz;
+	for (;;) {
+		if (dcount == 0 && (mcount == 0 || mbytes + bsz <= mlimit)) {
+			b = malloc(sizeof(logdstnet_batch_t));
+			if (!b) {
+				rv = -1;
+				break;
+			}
+			b->buf = bbuf;
+			b->sz = bsz;
+			b->usec = usec;
+			b->next = -1;
+			bbuf = NULL;
+			tommy_list_insert_tail(&mspool, &b->node, b);
+			mcount++;
+			mbytes += bsz;
+			break;
+		}
+		if (logdstnet_spool_fits(bsz)) {
+			rv = logdstnet_spool_disk(bbuf, bsz, usec);
+			break;
+		}
+		if (stopping || !connected) {
+			drops++;
+			rv = -1;
+			break;
+		}
+		stalls++;
+		pthread_cond_wait(&spacecond, &mutex);
+	}
+	pthread_cond_signal(&sendcond);
+	pthread_mutex_unlock(&mutex);
+	if (bbuf) {
+		free(bbuf);
+		bbuf = NULL;
+	}
+	return rv;
+}
+
+/*
+ * Remove an incomplete last entry from the segment in fd and count the
+ * entries from pos on.  Returns the end of the last complete entry.
+ */
+static off_t
+logdstnet_seg_load(int fd, off_t pos) {
+	unsigned char hdr[LOGDSTNET_HDRSZ];
+	struct stat st;
+	uint64_t usec;
+	size_t sz;
+
+	if (fstat(fd, &st) == -1)
+		st.st_size = 0;
+	while (pos + (off_t)sizeof(hdr) <= st.st_size) {
+		if (logdstnet_read_full(fd, hdr, sizeof(hdr), pos) == -1)
+			break;
+		logdstnet_hdr_decode(hdr, &sz, &usec);
+		if (pos + (off_t)(sizeof(hdr) + sz) > st.st_size)
+			break;
+		pos += sizeof(hdr) + sz;
+		dcount++;
+		dbytes += sizeof(hdr) + sz;
+	}
+	if (pos < st.st_size)
+		(void)ftruncate(fd, pos);
+	return pos;
+}
+
+/*
+ * Find the segments left over from the last run.  The live segments are
+ * the newest one and those directly preceding it in sequence; any other
+ * segments are remnants and discarded.
+ */
+static void
+logdstnet_spool_load(void) {
+	unsigned char hdr[LOGDSTNET_SEGHDRSZ];
+	uint64_t seq[LOGDSTNET_SEGMENTS];
+	off_t start[LOGDSTNET_SEGMENTS];
+	bool valid[LOGDSTNET_SEGMENTS];
+	bool found = false;
+	uint64_t s;
+	size_t i;
+
+	dwrseq = LOGDSTNET_SEGSEQ0;
+	for (i = 0; i < LOGDSTNET_SEGMENTS; i++) {
+		dstart[i] = 0;
+		dend[i] = 0;
+		valid[i] = logdstnet_read_full(dfd[i], hdr, sizeof(hdr),
+		                               0) == 0 &&
+		           logdstnet_seghdr_decode(hdr, &seq[i],
+		                                   &start[i]) == 0 &&
+		           DSLOT(seq[i]) == i;
+		if (valid[i] && (!found || seq[i] > dwrseq)) {
+			dwrseq = seq[i];
+			found = true;
+		}
+	}
+	if (!found) {
+		logdstnet_spool_reset();
+		return;
+	}
+
+	dsegs = 0;
+	dcount = 0;
+	dbytes = 0;
+	for (s = dwrseq; dsegs < LOGDSTNET_SEGMENTS; s--) {
+		i = DSLOT(s);
+		if (!valid[i] || seq[i] != s)
+			break;
+		dsegs++;
+	}
+	drdseq = s + 1;
+	for (s = drdseq; s <= dwrseq; s++) {
+		i = DSLOT(s);
+		dstart[i] = max(start[i], (off_t)LOGDSTNET_SEGHDRSZ);
+		dend[i] = logdstnet_seg_load(dfd[i], dstart[i]);
+		valid[i] = false;
+	}
+	drd = dstart[DSLOT(drdseq)];
+	for (i = 0; i < LOGDSTNET_SEGMENTS; i++) {
+		if (valid[i]) {
+			(void)ftruncate(dfd[i], 0);
+			dstart[i] = 0;
+			dend[i] = 0;
+		}
+	}
+	if (dcount == 0)
+		logdstnet_spool_reset();
+}
+
+/*
+ * Record how far the oldest segment has been sent, and save batches
+ * remaining in the memory spool to a new segment in front of it, so that
+ * all of them are sent in order after the next start.  Called after the
+ * send thread has stopped.
+ */
+static void
+logdstnet_spool_save(void) {
+	logdstnet_batch_t *b;
+	unsigned char hdr[LOGDSTNET_SEGHDRSZ];
+	unsigned char bhdr[LOGDSTNET_HDRSZ];
+	tommy_node *node;
+	uint64_t seq;
+	off_t off;
+	int fd;
+
+	if (dfd[0] == -1) {
+		if (mcount > 0)
+			fprintf(stderr, "Discarding %"PRIu32" unsent log "
+			                "batches\n", mcount);
+		return;
+	}
+	if (dsegs > 0) {
+		fd = dfd[DSLOT(drdseq)];
+		logdstnet_seghdr_encode(hdr, drdseq, drd);
+		if (logdstnet_write_full(fd, hdr, sizeof(hdr), 0) == -1 ||
+		    fsync(fd) == -1)
+			fprintf(stderr, "Failed to save log spool position - "
+			                "batches may be sent twice\n");
+	}
+	if (mcount == 0)
+		return;
+	if (dsegs == LOGDSTNET_SEGMENTS)
+		goto errout;
+	seq = dsegs > 0 ? drdseq - 1 : dwrseq + 1;
+	if (logdstnet_seg_begin(seq) == -1)
+		goto errout;
+	fd = dfd[DSLOT(seq)];
+	off = LOGDSTNET_SEGHDRSZ;
+	for (node = tommy_list_head(&mspool); node; node = node->next) {
+		b = node->data;
+		logdstnet_hdr_encode(bhdr, b->sz, b->usec);
+		if (logdstnet_write_full(fd, bhdr, sizeof(bhdr), off) == -1 ||
+		    logdstnet_write_full(fd, b->buf, b->sz,
+		                         off + sizeof(bhdr)) == -1)
+			goto errout2;
+		off += sizeof(bhdr) + b->sz;
+	}
+	if (fsync(fd) == -1)
+		goto errout2;
+	return;
+errout2:
+	(void)ftruncate(fd, 0);
+errout:
+	fprintf(stderr, "Failed to save log spool - "
+	                "discarding %"PRIu32" unsent log batches\n", mcount);
+}
+
+/*
+ * Open the segment files of the disk spool.
+ */
+static int
+logdstnet_spool_open(const char *path) {
+	char *segpath;
+
+	for (size_t i = 0; i < LOGDSTNET_SEGMENTS; i++) {
+		if (asprintf(&segpath, "%s.%zu", path, i) == -1)
+			goto errout;
+		dfd[i] = open(segpath, O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+		if (dfd[i] == -1) {
+			fprintf(stderr, "Failed to open log spool %s: "
+			                "%s (%i)\n",
+			                segpath, strerror(errno), errno);
+			free(segpath);
+			goto errout;
+		}
+		free(segpath);
+	}
+	return 0;
+errout:
+	for (size_t i = 0; i < LOGDSTNET_SEGMENTS; i++) {
+		if (dfd[i] != -1) {
+			close(dfd[i]);
+			dfd[i] = -1;
+		}
+	}
+	return -1;
+}
+
+static void
+logdstnet_spool_close(void) {
+	for (size_t i = 0; i < LOGDSTNET_SEGMENTS; i++) {
+		if (dfd[i] != -1) {
+			close(dfd[i]);
+			dfd[i] = -1;
+		}
+	}
+}
+
+/*
+ * Split host:port or [host]:port.
+ */
+static int
+logdstnet_parse_host(const char *s) {
+	const char *p;
+	size_t len;
+
+	p = strrchr(s, ':');
+	if (!p || p == s || p[1] == '\0') {
+		errno = EINVAL;
+		return -1;
+	}
+	len = p - s;
+	if (s[0] == '[' && s[len - 1] == ']') {
+		s++;
+		len -= 2;
+	}
+	host = strndup(s, len);
+	port = strdup(p + 1);
+	if (!host || !port) {
+		if (host)
+			free(host);
+		if (port)
+			free(port);
+		host = port = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static void logdstnet_fini(void);
+
+static int
+logdstnet_init(config_t *cfg) {
+	config = cfg;
+	if (!cfg->loghost || logdstnet_parse_host(cfg->loghost) == -1) {
+		fprintf(stderr, "Invalid log destination host, expected "
+		                LOGDSTNET_PREFIX "host:port\n");
+		config = NULL;
+		return -1;
+	}
+	mlimit = cfg->log_spool_memory * 1024 * 1024;
+	dlimit = (uint64_t)cfg->log_spool_size * 1024 * 1024;
+	dseglimit = (off_t)(dlimit / LOGDSTNET_SEGMENTS);
+	tommy_list_init(&mspool);
+	mcount = 0;
+	mbytes = 0;
+	drdseq = dwrseq = LOGDSTNET_SEGSEQ0;
+	dsegs = 0;
+	drd = 0;
+	dcount = 0;
+	dbytes = 0;
+	spilled = 0;
+	rendered = 0;
+	written = 0;
+	stalls = 0;
+	drops = 0;
+	connects = 0;
+	bzero(&latency, sizeof(latency));
+	stopping = false;
+	connected = false;
+	if (cfg->log_spool_file) {
+		if (logdstnet_spool_open(cfg->log_spool_file) == -1) {
+			free(host);
+			free(port);
+			host = port = NULL;
+			config = NULL;
+			return -1;
+		}
+		logdstnet_spool_load();
+	}
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&sendcond, NULL);
+	pthread_cond_init(&spacecond, NULL);
+	if (pthread_create(&send_thr, NULL, logdstnet_thread, NULL) != 0) {
+		pthread_cond_destroy(&spacecond);
+		pthread_cond_destroy(&sendcond);
+		pthread_mutex_destroy(&mutex);
+		logdstnet_spool_close();
+		free(host);
+		free(port);
+		host = port = NULL;
+		config = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Must only be called after the log thread has stopped.
+ */
+static void
+logdstnet_fini(void) {
+	logdstnet_batch_t *b;
+
+	if (!config)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	stopping = true;
+	pthread_cond_broadcast(&sendcond);
+	pthread_mutex_unlock(&mutex);
+	(void)logdstnet_flush();
+	if (pthread_join(send_thr, NULL) != 0) {
+		fprintf(stderr, "Failed to join log send thread - exiting\n");
+		exit(EXIT_FAILURE);
+	}
+	logdstnet_disconnect();
+	logdstnet_spool_save();
+	while (!tommy_list_empty(&mspool)) {
+		b = tommy_list_head(&mspool)->data;
+		tommy_list_remove_existing(&mspool, &b->node);
+		free(b->buf);
+		free(b);
+	}
+	logdstnet_spool_close();
+	pthread_cond_destroy(&spacecond);
+	pthread_cond_destroy(&sendcond);
+	pthread_mutex_destroy(&mutex);
+	free(host);
+	free(port);
+	host = port = NULL;
+	config = NULL;
+}
+
+static void
+logdstnet_stats(logdst_stat_t *st) {
+	pthread_mutex_lock(&mutex);
+	st->rendered = rendered;
+	st->written = written;
+	st->spooled = mcount + dcount;
+	st->spoolbytes = mbytes + dbytes;
+	st->spoolsegs = dsegs;
+	st->spilled = spilled;
+	st->stalls = stalls;
+	st->drops = drops;
+	st->connects = connects;
+	st->latency = latency;
+	pthread_mutex_unlock(&mutex);
+}
+
+logdst_t logdstnet = {
+	"tcp", false, true, true, true, true, false,
+	logdstnet_init,
+	NULL,
+	logdstnet_fini,
+	NULL,
+	logdstnet_open,
+	logdstnet_close,
+	logdstnet_flush,
+	logdstnet_stats,
+	NULL,
+	NULL
+};
+
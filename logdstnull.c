@@ -0,0 +1,67 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "logdstnull.h"
+
+#include "attrib.h"
+
+#include <strings.h>
+
+/*
+ * Raw destination discarding all events without rendering them, for
+ * measuring the pipeline up to and including the log thread without the
+ * cost of the format and destination drivers.  The log thread passes events
+ * in batches through ld_event_batch, such that the per-call overhead is that
+ * of a raw driver taking batches.
+ */
+static uint64_t writes;         /* ld_event and ld_event_batch calls */
+
+static int
+logdstnull_init(UNUSED config_t *cfg) {
+	writes = 0;
+	return 0;
+}
+
+static void
+logdstnull_fini(void) {
+}
+
+static int
+logdstnull_event(UNUSED const logevt_header_t *hdr) {
+	writes++;
+	return 0;
+}
+
+static int
+logdstnull_event_batch(UNUSED logevt_header_t **hdrv, UNUSED size_t n) {
+	writes++;
+	return 0;
+}
+
+static void
+logdstnull_stats(logdst_stat_t *st) {
+	bzero(st, sizeof(logdst_stat_t));
+	st->writes = writes;
+}
+
+logdst_t logdstnull = {
+	"null", true, true, true, false, true, false,
+	logdstnull_init,
+	NULL,
+	logdstnull_fini,
+	logdstnull_event,
+	NULL,
+	NULL,
+	NULL,
+	logdstnull_stats,
+	NULL,
+	logdstnull_event_batch
+};
+
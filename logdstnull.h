@@ -0,0 +1,19 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef LOGDSTNULL_H
+#define LOGDSTNULL_H
+
+#include "logdst.h"
+
+logdst_t logdstnull;
+
+#endif
+
@@ -0,0 +1,272 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "logdstshm.h"
+
+#include "sys.h"
+#include "config.h"
+#include "logbuf.h"
+#include "attrib.h"
+#include "time.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#define LOGDSTSHM_RECSZ(LEN) \
+	(((uint64_t)(LEN) + sizeof(logdstshm_rec_t) + LOGDSTSHM_ALIGN - 1) & \
+	 ~(uint64_t)(LOGDSTSHM_ALIGN - 1))
+
+static config_t *config;
+
+/*
+ * Records are rendered through a single unbuffered stream into rec, and
+ * ld_close copies each complete record into the ring, see logdstshm.h.
+ * head, tail and seq are the writing thread's copies of the ring state;
+ * nothing but this driver ever writes to the ring.
+ */
+static FILE *f = NULL;
+static logbuf_t rec;
+static logdstshm_hdr_t *hdr = NULL;
+static unsigned char *data;
+static size_t mapsz;
+static uint64_t size;
+static uint64_t mask;
+static uint64_t head;
+static uint64_t tail;
+static uint64_t seq;
+static uint64_t rendered;
+static uint64_t written;
+static uint64_t writes;
+static uint64_t drops;                  /* records too large for the ring */
+
+#define logdstshm_at(POS) ((logdstshm_rec_t *)(data + ((POS) & mask)))
+
+static int
+logdstshm_write(UNUSED void *cookie, const char *buf, int sz) {
+	if (logbuf_write(&rec, buf, (size_t)sz) == -1)
+		return -1;
+	return sz;
+}
+
+static FILE *
+logdstshm_open(void) {
+	return f;
+}
+
+/*
+ * Advance tail past all records that writing up to position end overwrites,
+ * and order the new tail before the writes that overwrite them, such that
+ * consumers validating their position against tail after reading a record
+ * notice when it was overwritten under them.
+ */
+static void
+logdstshm_evict(uint64_t end) {
+	logdstshm_rec_t *r;
+	uint64_t old = tail;
+
+	while (end - tail > size) {
+		r = logdstshm_at(tail);
+		if (r->len == LOGDSTSHM_WRAP)
+			tail = (tail | mask) + 1;
+		else
+			tail += LOGDSTSHM_RECSZ(r->len);
+	}
+	if (tail != old) {
+		atomic_store_explicit(&hdr->tail, tail, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+	}
+}
+
+/*
+ * Append a record to the ring, overwriting the oldest records as needed.
+ * Records larger than a quarter of the ring are dropped, such that a single
+ * record never wipes out most of what consumers have not read yet.
+ */
+static int
+logdstshm_commit(const char *buf, size_t len) {
+	logdstshm_rec_t *r;
+	uint64_t need, pos;
+
+	need = LOGDSTSHM_RECSZ(len);
+	if (need > size / 4) {
+		drops++;
+		return -1;
+	}
+	pos = head;
+	if ((pos & mask) + need > size)
+		pos = (pos | mask) + 1;
+	logdstshm_evict(pos + need);
+	if (pos != head) {
+		r = logdstshm_at(head);
+		r->len = LOGDSTSHM_WRAP;
+		r->reserved = 0;
+		atomic_store_explicit(&r->seq, 0, memory_order_relaxed);
+	}
+	r = logdstshm_at(pos);
+	r->len = (uint32_t)len;
+	r->reserved = 0;
+	memcpy(r + 1, buf, len);
+	atomic_store_explicit(&r->seq, ++seq, memory_order_release);
+	head = pos + need;
+	atomic_store_explicit(&hdr->head, head, memory_order_release);
+	written += len;
+	writes++;
+	return 0;
+}
+
+static int
+logdstshm_close(FILE *fp) {
+	int rv;
+
+	if (ferror(fp)) {
+		clearerr(fp);
+		logbuf_reset(&rec);
+		return -1;
+	}
+	rendered += rec.len;
+	rv = logdstshm_commit(rec.buf, rec.len);
+	logbuf_reset(&rec);
+	return rv;
+}
+
+/*
+ * Create the ring file anew instead of truncating an existing one, such that
+ * consumers still mapping the ring of a previous run are not hit by SIGBUS.
+ */
+static int
+logdstshm_map(const char *path) {
+	struct timespec ts;
+	void *p;
+	int fd;
+
+	mapsz = LOGDSTSHM_HDRSZ + size;
+	(void)unlink(path);
+	fd = open(path, O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC, 0640);
+	if (fd == -1)
+		return -1;
+	(void)fchown(fd, 0, sys_gidbyname("admin"));
+	if (ftruncate(fd, (off_t)mapsz) == -1) {
+		close(fd);
+		(void)unlink(path);
+		return -1;
+	}
+	p = mmap(NULL, mapsz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		(void)unlink(path);
+		return -1;
+	}
+	hdr = p;
+	data = (unsigned char *)p + LOGDSTSHM_HDRSZ;
+	if (timespec_nanotime(&ts) == -1)
+		bzero(&ts, sizeof(ts));
+	hdr->version = LOGDSTSHM_VERSION;
+	hdr->size = size;
+	hdr->started = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	atomic_store(&hdr->closed, 0);
+	atomic_store(&hdr->head, 0);
+	atomic_store(&hdr->tail, 0);
+	atomic_thread_fence(memory_order_release);
+	hdr->magic = LOGDSTSHM_MAGIC;
+	return 0;
+}
+
+static int
+logdstshm_init(config_t *cfg) {
+	config = cfg;
+	if (!cfg->logshm) {
+		fprintf(stderr, "Invalid log destination path, expected "
+		                LOGDSTSHM_PREFIX "path\n");
+		config = NULL;
+		return -1;
+	}
+	size = (uint64_t)cfg->log_shm_size * 1024;
+	assert(size > 0 && (size & (size - 1)) == 0);
+	mask = size - 1;
+	head = 0;
+	tail = 0;
+	seq = 0;
+	rendered = 0;
+	written = 0;
+	writes = 0;
+	drops = 0;
+	if (logbuf_init(&rec, LOGBUF_SIZE_INITIAL) == -1)
+		goto errout1;
+	f = funopen(NULL, NULL, logdstshm_write, NULL, NULL);
+	if (!f)
+		goto errout2;
+	/* formats write whole records, buffering would only copy twice */
+	(void)setvbuf(f, NULL, _IONBF, 0);
+	if (logdstshm_map(cfg->logshm) == -1) {
+		fprintf(stderr, "Failed to create %s: %s (%i)\n",
+		                cfg->logshm, strerror(errno), errno);
+		goto errout3;
+	}
+	return 0;
+errout3:
+	fclose(f);
+	f = NULL;
+errout2:
+	logbuf_fini(&rec);
+errout1:
+	config = NULL;
+	return -1;
+}
+
+/*
+ * The ring file stays in place for consumers to read the last records.
+ */
+static void
+logdstshm_fini(void) {
+	if (hdr) {
+		atomic_store_explicit(&hdr->closed, 1, memory_order_release);
+		(void)munmap(hdr, mapsz);
+		hdr = NULL;
+	}
+	if (f) {
+		fclose(f);
+		f = NULL;
+	}
+	logbuf_fini(&rec);
+	config = NULL;
+}
+
+static void
+logdstshm_stats(logdst_stat_t *st) {
+	bzero(st, sizeof(logdst_stat_t));
+	st->rendered = rendered;
+	st->written = written;
+	st->writes = writes;
+	st->spoolbytes = head - tail;
+	st->drops = drops;
+}
+
+logdst_t logdstshm = {
+	"shm", false, true, true, true, true, false,
+	logdstshm_init,
+	NULL,
+	logdstshm_fini,
+	NULL,
+	logdstshm_open,
+	logdstshm_close,
+	NULL,
+	logdstshm_stats,
+	NULL,
+	NULL
+};
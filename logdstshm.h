@@ -0,0 +1,88 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef LOGDSTSHM_H
+#define LOGDSTSHM_H
+
+#include "logdst.h"
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define LOGDSTSHM_PREFIX "shm://"
+
+/*
+ * Export ring for co-located consumers.  The ring file consists of a header
+ * of LOGDSTSHM_HDRSZ bytes followed by the data area of size bytes, a power
+ * of two, and is meant to be mapped read-only by consumers.  Records are
+ * rendered in the log format configured for the destination, preferably
+ * cbor, such that each record holds exactly one frame of a binary format or
+ * one record of a text format.  There is a single producer, xnumon, and any
+ * number of consumers, which never write to the ring and therefore cannot
+ * slow xnumon down.
+ *
+ * Positions are byte offsets into an infinite stream that never wrap around;
+ * the offset into the data area is the position modulo size.  Every record
+ * starts at a position aligned to LOGDSTSHM_ALIGN with a logdstshm_rec_t,
+ * followed by len bytes of payload, padded to LOGDSTSHM_ALIGN.  Records do
+ * not wrap around the end of the data area; if a record does not fit, a
+ * record with len LOGDSTSHM_WRAP fills the rest of the data area.  Records
+ * carry consecutive sequence numbers starting at 1, except for wrap records.
+ *
+ * head is the position after the last committed record, tail the position
+ * of the oldest record that has not been overwritten yet.  When the ring is
+ * full, the oldest records are overwritten:  xnumon first advances tail past
+ * them, then writes the new record, then advances head.  A consumer reads
+ * the record at its position pos only while pos < head, uses the payload in
+ * place, and afterwards validates that tail has not moved past pos, using an
+ * acquire fence before loading tail.  If it has, the record may have been
+ * overwritten while in use, so it must be discarded and the consumer has
+ * overrun; it continues at tail and sees a gap in the sequence numbers.
+ * After an overrun or when starting at a position other than the beginning
+ * of the ring, cbor consumers skip records up to the next frame with the
+ * string dictionary reset flag, see logfmtcbor.h.
+ *
+ * The ring is created anew every time xnumon opens it.  When xnumon closes
+ * the ring, it sets closed, and consumers should map the file anew.
+ */
+#define LOGDSTSHM_MAGIC         0x584e5852      /* XNXR */
+#define LOGDSTSHM_VERSION       1
+#define LOGDSTSHM_HDRSZ         4096
+#define LOGDSTSHM_ALIGN         16
+#define LOGDSTSHM_WRAP          UINT32_MAX
+#define LOGDSTSHM_CACHELINE     64
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;                          /* data area bytes */
+	uint64_t started;                       /* ns since epoch */
+	_Atomic uint32_t closed;
+	_Alignas(LOGDSTSHM_CACHELINE)
+	_Atomic uint64_t head;
+	_Alignas(LOGDSTSHM_CACHELINE)
+	_Atomic uint64_t tail;
+} logdstshm_hdr_t;
+
+typedef struct {
+	_Atomic uint64_t seq;                   /* 0 for wrap records */
+	uint32_t len;
+	uint32_t reserved;
+} logdstshm_rec_t;
+
+_Static_assert(sizeof(logdstshm_hdr_t) <= LOGDSTSHM_HDRSZ,
+               "logdstshm_hdr_t fits into the header");
+_Static_assert(sizeof(logdstshm_rec_t) == LOGDSTSHM_ALIGN,
+               "logdstshm_rec_t is one alignment unit");
+
+logdst_t logdstshm;
+
+#endif
+
@@ -12,51 +12,306 @@
 
 #include "config.h"
 #include "attrib.h"
+#include "logbuf.h"
+#include "policy.h"
+#include "thrstat.h"
+#include "time.h"
+#include "minmax.h"
+
+#include "memstream.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <stdbool.h>
 #include <assert.h>
 
+#define LOGDSTSTDOUT_CHUNK      16384   /* if the pipe size is unknown */
+
 static config_t *config;
 static bool do_flush;
 
+/*
+ * With log_stdout_buffer, if stdout is a pipe or socket, each batch is
+ * rendered into a memory buffer and appended to sbuf on flush.  sbuf is
+ * written to the non-blocking descriptor in multiples of the pipe buffer
+ * size, with whatever is left over written out by the drain thread at most
+ * log_stdout_interval ms later.  If the reader is slow and the pipe is full,
+ * the bytes stay in sbuf instead of blocking the log thread, up to
+ * log_stdout_buffer KiB.  Only once sbuf is full, the log thread waits for
+ * the reader, and such waits are counted as stalls.
+ */
+static pthread_mutex_t mutex;           /* protects sbuf and the counters */
+static pthread_cond_t draincond;        /* stopping */
+static pthread_t drain_thr;
+static bool stopping;
+static logbuf_t sbuf;
+static size_t bufsz;                    /* bytes, 0 if not buffering */
+static size_t chunk;                    /* pipe buffer size */
+static int fd;
+static int fdflags;                     /* to restore on fini */
+static FILE *batch = NULL;
+static char *bbuf = NULL;
+static size_t bsz;
+static uint64_t rendered;
+static uint64_t written;
+static uint64_t writes;
+static uint64_t stalls;
+
 static FILE *
 logdststdout_open(void) {
-	return stdout;
+	if (!bufsz)
+		return stdout;
+	if (!batch) {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunguarded-availability"
+		batch = open_memstream(&bbuf, &bsz);
+#pragma clang diagnostic pop
+	}
+	return batch;
 }
 
 static int
 logdststdout_close(UNUSED FILE *f) {
+	return 0;
+}
+
+/*
+ * Write out the buffered bytes in multiples of the pipe buffer size, or all
+ * of them if all is set, as far as the pipe takes them without blocking.
+ * Called with the mutex held.
+ */
+static int
+logdststdout_drain(bool all) {
+	size_t n, done;
+	ssize_t rv;
+
+	n = all ? sbuf.len : sbuf.len - sbuf.len % chunk;
+	for (done = 0; done < n; done += rv) {
+		rv = write(fd, sbuf.buf + done, n - done);
+		if (rv == -1) {
+			if (errno == EINTR) {
+				rv = 0;
+				continue;
+			}
+			break;
+		}
+		writes++;
+	}
+	written += done;
+	memmove(sbuf.buf, sbuf.buf + done, sbuf.len - done);
+	sbuf.len -= done;
+	if (done < n && errno != EAGAIN)
+		return -1;
+	return 0;
+}
+
+/*
+ * Wait for the reader to make room in the pipe.  Called with the mutex
+ * held, which keeps the drain thread waiting too.
+ */
+static int
+logdststdout_wait(void) {
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
+	while (poll(&pfd, 1, -1) == -1) {
+		if (errno != EINTR)
+			return -1;
+	}
+	if (pfd.revents & (POLLERR|POLLHUP|POLLNVAL))
+		return -1;
+	return 0;
+}
+
+static int
+logdststdout_flush_buffered(void) {
+	bool stalled = false;
+	int rv = -1;
+
+	if (!batch)
+		return 0;
+	fclose(batch);
+	batch = NULL;
+	if (!bbuf)
+		return -1;
+	pthread_mutex_lock(&mutex);
+	rendered += bsz;
+	if (logbuf_write(&sbuf, bbuf, bsz) == -1)
+		goto out;
+	if (logdststdout_drain(false) == -1)
+		goto out;
+	while (sbuf.len > bufsz) {
+		if (!stalled) {
+			stalls++;
+			stalled = true;
+		}
+		if (logdststdout_wait() == -1 ||
+		    logdststdout_drain(true) == -1)
+			goto out;
+	}
+	rv = 0;
+out:
+	pthread_mutex_unlock(&mutex);
+	free(bbuf);
+	bbuf = NULL;
+	return rv;
+}
+
+static int
+logdststdout_flush(void) {
+	if (bufsz)
+		return logdststdout_flush_buffered();
 	/*
 	 * Need to flush if stdout refers to a file in order to prevent
 	 * committing incomplete events to disk.  If stdout refers to a TTY,
 	 * assume the TTY is line-buffered anyway.
 	 */
 	if (do_flush)
-		fflush(f);
+		return fflush(stdout) == EOF ? -1 : 0;
+	return 0;
+}
+
+/*
+ * Write out the bytes left over every log_stdout_interval ms.
+ */
+static void *
+logdststdout_thread(UNUSED void *arg) {
+	struct timespec ts;
+
+	thrstat_register(THRSTAT_LOGSEND);
+
+	pthread_mutex_lock(&mutex);
+	while (!stopping) {
+		if (timespec_nanotime(&ts) == -1)
+			break;
+		timespec_add_msec(&ts, config->log_stdout_interval);
+		while (!stopping) {
+			if (pthread_cond_timedwait(&draincond, &mutex, &ts) ==
+			    ETIMEDOUT)
+				break;
+		}
+		if (stopping)
+			break;
+		(void)logdststdout_drain(true);
+	}
+	pthread_mutex_unlock(&mutex);
+	return NULL;
+}
+
+/*
+ * Set up buffering if configured and stdout is a pipe or socket; on files
+ * and TTYs, stdio buffering is used regardless.
+ */
+static int
+logdststdout_init_buffered(config_t *cfg) {
+	struct stat st;
+
+	fd = fileno(stdout);
+	if (fstat(fd, &st) == -1 ||
+	    !(S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)))
+		return 0;
+	fdflags = fcntl(fd, F_GETFL);
+	if (fdflags == -1 || fcntl(fd, F_SETFL, fdflags|O_NONBLOCK) == -1)
+		return -1;
+	bufsz = cfg->log_stdout_buffer * 1024;
+	chunk = st.st_blksize > 0 ? (size_t)st.st_blksize
+	                          : LOGDSTSTDOUT_CHUNK;
+	chunk = min(chunk, bufsz);
+	if (logbuf_init(&sbuf, bufsz + chunk) == -1)
+		goto errout1;
+	/* whatever stdio buffered so far goes first */
+	(void)fflush(stdout);
+	stopping = false;
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&draincond, NULL);
+	if (pthread_create(&drain_thr, NULL, logdststdout_thread, NULL) != 0)
+		goto errout2;
 	return 0;
+errout2:
+	pthread_cond_destroy(&draincond);
+	pthread_mutex_destroy(&mutex);
+	logbuf_fini(&sbuf);
+errout1:
+	(void)fcntl(fd, F_SETFL, fdflags);
+	bufsz = 0;
+	return -1;
 }
 
 static int
 logdststdout_init(config_t *cfg) {
 	config = cfg;
 	do_flush = !isatty(fileno(stdout));
+	rendered = 0;
+	written = 0;
+	writes = 0;
+	stalls = 0;
+	bufsz = 0;
+	if (cfg->log_stdout_buffer > 0 &&
+	    logdststdout_init_buffered(cfg) == -1) {
+		config = NULL;
+		return -1;
+	}
 	return 0;
 }
 
 static void
 logdststdout_fini(void) {
+	if (bufsz) {
+		pthread_mutex_lock(&mutex);
+		stopping = true;
+		pthread_cond_broadcast(&draincond);
+		pthread_mutex_unlock(&mutex);
+		if (pthread_join(drain_thr, NULL) != 0) {
+			fprintf(stderr, "Failed to join log drain thread - "
+			                "exiting\n");
+			exit(EXIT_FAILURE);
+		}
+		(void)logdststdout_flush_buffered();
+		/* hand the rest to the reader before giving back stdout */
+		(void)fcntl(fd, F_SETFL, fdflags);
+		(void)logdststdout_drain(true);
+		logbuf_fini(&sbuf);
+		pthread_cond_destroy(&draincond);
+		pthread_mutex_destroy(&mutex);
+		bufsz = 0;
+	}
 	config = NULL;
 }
 
+static void
+logdststdout_stats(logdst_stat_t *st) {
+	bzero(st, sizeof(logdst_stat_t));
+	if (!bufsz)
+		return;
+	pthread_mutex_lock(&mutex);
+	st->rendered = rendered;
+	st->written = written;
+	st->writes = writes;
+	st->spoolbytes = sbuf.len;
+	st->stalls = stalls;
+	pthread_mutex_unlock(&mutex);
+}
+
 logdst_t logdststdout = {
-	"-", false, true, true, false,
+	"-", false, true, true, false, true, false,
 	logdststdout_init,
 	NULL,
 	logdststdout_fini,
 	NULL,
 	logdststdout_open,
-	logdststdout_close
+	logdststdout_close,
+	logdststdout_flush,
+	logdststdout_stats,
+	NULL,
+	NULL
 };
-
@@ -11,35 +11,75 @@
 #include "logdstsyslog.h"
 
 #include "config.h"
+#include "logbuf.h"
 #include "attrib.h"
 
-#include "memstream.h"
-
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <syslog.h>
+#include <errno.h>
 #include <assert.h>
 
 static config_t *config;
 
-static char *msg;
-static size_t sz;
+/*
+ * Records are rendered through a single unbuffered stream that appends to a
+ * growable batch buffer, instead of through a new memory stream per record.
+ * ld_close terminates each record with a NUL byte, and ld_flush, called
+ * once per batch by the log thread, hands all records in the buffer to
+ * syslog(3) back to back and starts over with the same buffer.
+ */
+static FILE *f = NULL;
+static logbuf_t batch;
+static size_t recstart;         /* start of the record being rendered */
+static uint64_t rendered;
+static uint64_t written;
+
+static int
+logdstsyslog_write(UNUSED void *cookie, const char *buf, int sz) {
+	if (logbuf_write(&batch, buf, (size_t)sz) == -1)
+		return -1;
+	return sz;
+}
 
 static FILE *
 logdstsyslog_open(void) {
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wunguarded-availability"
-	return open_memstream(&msg, &sz);
-#pragma clang diagnostic pop
+	return f;
 }
 
+/*
+ * Record a rendered record for the next flush, or drop it if the buffer
+ * could not hold all of it.
+ */
 static int
-logdstsyslog_close(FILE *f) {
-	fclose(f);
-	if (!msg)
+logdstsyslog_close(FILE *fp) {
+	if (ferror(fp) || logbuf_putc(&batch, '\0') == -1) {
+		clearerr(fp);
+		batch.len = recstart;
 		return -1;
-	syslog(LOG_NOTICE, "%s", msg);
-	free(msg);
+	}
+	rendered += batch.len - recstart - 1;
+	recstart = batch.len;
+	return 0;
+}
+
+static int
+logdstsyslog_flush(void) {
+	const char *p, *end;
+	size_t len;
+
+	p = batch.buf;
+	end = batch.buf + recstart;
+	while (p < end) {
+		len = strlen(p);
+		syslog(LOG_NOTICE, "%s", p);
+		written += len;
+		p += len + 1;
+	}
+	logbuf_reset(&batch);
+	recstart = 0;
 	return 0;
 }
 
@@ -47,6 +87,18 @@ static int
 logdstsyslog_init(config_t *cfg) {
 	config = cfg;
 	assert(cfg->logoneline);
+	if (logbuf_init(&batch, LOGBUF_SIZE_INITIAL) == -1)
+		return -1;
+	f = funopen(NULL, NULL, logdstsyslog_write, NULL, NULL);
+	if (!f) {
+		logbuf_fini(&batch);
+		return -1;
+	}
+	/* formats write whole records, buffering would only copy twice */
+	(void)setvbuf(f, NULL, _IONBF, 0);
+	recstart = 0;
+	rendered = 0;
+	written = 0;
 	setlogmask(LOG_UPTO(LOG_NOTICE));
 	openlog("xnumon", LOG_CONS|LOG_PID|LOG_NDELAY, LOG_LOCAL1);
 	return 0;
@@ -54,17 +106,31 @@ logdstsyslog_init(config_t *cfg) {
 
 static void
 logdstsyslog_fini(void) {
+	(void)logdstsyslog_flush();
 	closelog();
+	fclose(f);
+	f = NULL;
+	logbuf_fini(&batch);
 	config = NULL;
 }
 
+static void
+logdstsyslog_stats(logdst_stat_t *st) {
+	bzero(st, sizeof(logdst_stat_t));
+	st->rendered = rendered;
+	st->written = written;
+}
+
 logdst_t logdstsyslog = {
-	"syslog", false, true, false, true,
+	"syslog", false, true, false, true, false, false,
 	logdstsyslog_init,
 	NULL,
 	logdstsyslog_fini,
 	NULL,
 	logdstsyslog_open,
-	logdstsyslog_close
+	logdstsyslog_close,
+	logdstsyslog_flush,
+	logdstsyslog_stats,
+	NULL,
+	NULL
 };
-
@@ -0,0 +1,139 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+/*
+ * Utility for converting logs written in the binary cbor log format back to
+ * one of the text log formats, JSON by default.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifndef __BSD__
+#include <getopt.h>
+#endif /* !__BSD__ */
+
+#include "log.h"
+#include "logfmtcbor.h"
+#include "config.h"
+
+static void
+fusage(FILE *f, const char *argv0) {
+	fprintf(f,
+"Usage: %s [-hm] [-l logfmt] [file ...]\n"
+" -h             print usage and exit\n"
+" -l logfmt      output log format: json*, json-seq, yaml, xml\n"
+" -m             multi-line output instead of one line per event\n"
+"Reads cbor format logs from the files or from standard input.\n"
+, argv0);
+}
+
+static int
+dump(FILE *in, const char *name, logfmt_t *fmt, logfmt_ctx_t *ctx) {
+	logfmtcbor_dec_stat_t st;
+
+	if (logfmtcbor_decode(in, fmt, ctx, &st) == -1) {
+		fprintf(stderr, "%s: %s (%i)\n", name,
+		        errno == EINVAL ? "corrupt framing" : strerror(errno),
+		        errno);
+		return -1;
+	}
+	if (st.skipped > 0)
+		fprintf(stderr, "%s: skipped %"PRIu64" undecodable records\n",
+		        name, st.skipped);
+	if (st.newer > 0)
+		fprintf(stderr, "%s: skipped %"PRIu64" records of newer log "
+		                "event versions\n", name, st.newer);
+	if (st.truncated)
+		fprintf(stderr, "%s: incomplete last record\n", name);
+	return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+	config_t cfg;
+	logfmt_t *fmt;
+	logfmt_ctx_t ctx;
+	FILE *in;
+	int ch, rv = EXIT_SUCCESS;
+	const char *argv0 = argv[0];
+
+	bzero(&cfg, sizeof(cfg));
+	if (logfmt_parse(&cfg, "json") == -1)
+		exit(EXIT_FAILURE);
+	cfg.logoneline = 1;
+
+	while ((ch = getopt(argc, argv, "hl:m")) != -1) {
+		switch (ch) {
+			case 'h':
+				fusage(stdout, argv0);
+				exit(EXIT_SUCCESS);
+			case 'l':
+				if (logfmt_parse(&cfg, optarg) == -1 ||
+				    logfmt_binary(&cfg)) {
+					fprintf(stderr, "%s: invalid logfmt "
+					                "'%s'\n", argv0, optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'm':
+				cfg.logoneline = 0;
+				break;
+			case '?':
+				exit(EXIT_FAILURE);
+			default:
+				fusage(stderr, argv0);
+				exit(EXIT_FAILURE);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	fmt = logfmt_driver(&cfg);
+	if (cfg.logoneline && !fmt->lf_oneline)
+		cfg.logoneline = 0;
+	if (!cfg.logoneline && !fmt->lf_multiline)
+		cfg.logoneline = 1;
+	if (fmt->lf_init(&cfg) == -1) {
+		fprintf(stderr, "%s: failed to initialize logfmt\n", argv0);
+		exit(EXIT_FAILURE);
+	}
+	logfmt_ctx_init(&ctx);
+	ctx.f = stdout;
+
+	if (argc == 0) {
+		if (dump(stdin, "-", fmt, &ctx) == -1)
+			rv = EXIT_FAILURE;
+	}
+	for (int i = 0; i < argc; i++) {
+		in = fopen(argv[i], "r");
+		if (!in) {
+			fprintf(stderr, "%s: %s (%i)\n", argv[i],
+			        strerror(errno), errno);
+			rv = EXIT_FAILURE;
+			continue;
+		}
+		if (dump(in, argv[i], fmt, &ctx) == -1)
+			rv = EXIT_FAILURE;
+		fclose(in);
+	}
+
+	logfmt_ctx_fini(&ctx);
+	if (fflush(stdout) == EOF)
+		rv = EXIT_FAILURE;
+	exit(rv);
+}
+
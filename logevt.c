@@ -33,13 +33,40 @@
 #include "filemon.h"
 #include "hackmon.h"
 #include "sockmon.h"
+#include "governor.h"
+#include "degrade.h"
+#include "membudget.h"
+#include "policy.h"
 #include "str.h"
+#include "logproj.h"
+#include "logschema.h"
 #include "sys.h"
+#include "idname.h"
+#include "minmax.h"
 
+#ifdef LOGFMT_SPECIALIZE
+#include "logfmtjson.h"
+#include "logfmtyaml.h"
+#include "logfmtxml.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <sys/types.h>
-#include <pwd.h>
-#include <grp.h>
+
+/*
+ * With LOGFMT_SPECIALIZE, the event renderers and their helpers are inlined
+ * into one copy per text log format and mode, with the driver table being a
+ * constant that the compiler can resolve the render calls against; see
+ * logevt_renderers.  Without, there is only the generic copy that renders
+ * through the driver table passed in at runtime.
+ */
+#ifdef LOGFMT_SPECIALIZE
+#define LOGEVT_RENDER static inline __attribute__((always_inline))
+#else
+#define LOGEVT_RENDER static
+#endif
 
 static config_t *config;
 
@@ -48,461 +75,1820 @@ logevt_init(config_t *cfg) {
 	config = cfg;
 }
 
-static void
-logevt_uid(logfmt_t *fmt, FILE *f,
+LOGEVT_RENDER void
+logevt_uid(logfmt_t *fmt, logfmt_ctx_t *ctx,
            uid_t uid, const char *idlabel, const char *namelabel) {
-	struct passwd *pw;
+	char name[IDNAME_NAMESZ];
 
-	fmt->dict_item(f, idlabel);
+	fmt->dict_item(ctx, idlabel);
 	if (uid == (uid_t)-1) {
-		fmt->value_int(f, -1);
+		fmt->value_int(ctx, -1);
 		return;
 	}
-	fmt->value_uint(f, uid);
+	fmt->value_uint(ctx, uid);
 
-	if (config->resolve_users_groups) {
-		pw = getpwuid(uid);
-		if (pw) {
-			fmt->dict_item(f, namelabel);
-			fmt->value_string(f, pw->pw_name);
+	if (config->resolve_users_groups && logproj_wants(ctx, namelabel)) {
+		if (idname_user(name, uid)) {
+			fmt->dict_item(ctx, namelabel);
+			fmt->value_string(ctx, name);
 		}
 	}
 }
 
-static void
-logevt_gid(logfmt_t *fmt, FILE *f,
+LOGEVT_RENDER void
+logevt_gid(logfmt_t *fmt, logfmt_ctx_t *ctx,
            gid_t gid, const char *idlabel, const char *namelabel) {
-	struct group *gr;
+	char name[IDNAME_NAMESZ];
 
-	fmt->dict_item(f, idlabel);
+	fmt->dict_item(ctx, idlabel);
 	if (gid == (gid_t)-1) {
-		fmt->value_int(f, -1);
+		fmt->value_int(ctx, -1);
 		return;
 	}
-	fmt->value_uint(f, gid);
+	fmt->value_uint(ctx, gid);
 
-	if (config->resolve_users_groups) {
-		gr = getgrgid(gid);
-		if (gr) {
-			fmt->dict_item(f, namelabel);
-			fmt->value_string(f, gr->gr_name);
+	if (config->resolve_users_groups && logproj_wants(ctx, namelabel)) {
+		if (idname_group(name, gid)) {
+			fmt->dict_item(ctx, namelabel);
+			fmt->value_string(ctx, name);
 		}
 	}
 }
 
-static void
-logevt_header(logfmt_t *fmt, FILE *f, logevt_header_t *hdr) {
+/*
+ * Names of the pipeline stages between stamp i and stamp i + 1, and of the
+ * total from the event stamp to logged.
+ */
+static const char *latency_names[LOGEVT_STAMPS] = {
+	"audit", "workq", "work", "reorder", "logq", "log", "total"
+};
+
+/*
+ * Usec spent in each stage the event passed through so far.
+ */
+LOGEVT_RENDER void
+logevt_latency(logfmt_t *fmt, logfmt_ctx_t *ctx, logevt_header_t *hdr) {
+	uint64_t *stamp = hdr->stamp;
+
+	fmt->dict_item(ctx, "latency");
+	fmt->dict_begin(ctx);
+	for (size_t i = 0; i < LOGEVT_STAMP_LOG; i++) {
+		if (!stamp[i] || !stamp[i + 1] || stamp[i + 1] < stamp[i])
+			continue;
+		fmt->dict_item(ctx, latency_names[i]);
+		fmt->value_uint(ctx, (stamp[i + 1] - stamp[i]) / 1000);
+	}
+	fmt->dict_end(ctx); /* latency */
+}
+
+LOGEVT_RENDER void
+logevt_header(logfmt_t *fmt, logfmt_ctx_t *ctx, logevt_header_t *hdr) {
 	assert(hdr);
-	fmt->record_begin(f);
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "version");
-	fmt->value_uint(f, LOGEVT_VERSION);
-	fmt->dict_item(f, "time");
-	fmt->value_timespec(f, &hdr->tv);
-	fmt->dict_item(f, "eventcode");
-	fmt->value_uint(f, hdr->code);
+	fmt->record_begin(ctx);
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "version");
+	fmt->value_uint(ctx, LOGEVT_VERSION);
+	fmt->dict_item(ctx, "time");
+	fmt->value_timespec(ctx, &hdr->tv);
+	fmt->dict_item(ctx, "eventcode");
+	fmt->value_uint(ctx, hdr->code);
+	if (hdr->trace)
+		logevt_latency(fmt, ctx, hdr);
 }
 
-static void
-logevt_footer(logfmt_t *fmt, FILE *f) {
-	fmt->dict_end(f);
-	fmt->record_end(f);
+LOGEVT_RENDER void
+logevt_footer(logfmt_t *fmt, logfmt_ctx_t *ctx) {
+	fmt->dict_end(ctx);
+	fmt->record_end(ctx);
 }
 
+/*
+ * Code signature items of an image, also used for revalidation ops events.
+ */
+LOGEVT_RENDER void
+logevt_codesign(logfmt_t *fmt, logfmt_ctx_t *ctx, codesign_t *cs) {
+	fmt->dict_item(ctx, "signature");
+	fmt->value_string(ctx, codesign_result_s(cs));
+	if (cs->origin) {
+		fmt->dict_item(ctx, "origin");
+		fmt->value_string(ctx, codesign_origin_s(cs));
+	}
+	if (cs->cdhash) {
+		fmt->dict_item(ctx, "cdhash");
+		fmt->value_buf_hex(ctx, cs->cdhash, cs->cdhashsz);
+	}
+	if (cs->ident) {
+		fmt->dict_item(ctx, "ident");
+		fmt->value_string(ctx, cs->ident);
+	}
+	if (cs->teamid) {
+		fmt->dict_item(ctx, "teamid");
+		fmt->value_string(ctx, cs->teamid);
+	}
+	if (cs->certcn) {
+		fmt->dict_item(ctx, "certcn");
+		fmt->value_string(ctx, cs->certcn);
+	}
+}
+
+/* suppression sets are replaced on reload, see config_apply() */
+#define LOGEVT_SETSTR_SIZE(KEY) \
+	do { \
+		fmt->dict_item(ctx, #KEY); \
+		fmt->value_uint(ctx, setstr_size(atomic_load(&config->KEY))); \
+	} while (0)
+
 int
-logevt_xnumon_ops(logfmt_t *fmt, FILE *f, void *arg0) {
+logevt_xnumon_ops(logfmt_t *fmt, logfmt_ctx_t *ctx, void *arg0) {
 	xnumon_ops_t *ops = (xnumon_ops_t *)arg0;
 
-	logevt_header(fmt, f, (logevt_header_t *)arg0);
-
-	fmt->dict_item(f, "op");
-	fmt->value_string(f, ops->subtype);
-
-	fmt->dict_item(f, "build");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "version");
-	fmt->value_string(f, build_version);
-	fmt->dict_item(f, "date");
-	fmt->value_string(f, build_date);
-	fmt->dict_item(f, "info");
-	fmt->value_string(f, build_info);
-	fmt->dict_end(f); /* build */
-
-	fmt->dict_item(f, "config");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "path");
-	fmt->value_string(f, config->path);
-	fmt->dict_item(f, "id");
+	logevt_header(fmt, ctx, (logevt_header_t *)arg0);
+
+	fmt->dict_item(ctx, "op");
+	fmt->value_string(ctx, ops->subtype);
+
+	if (ops->reason) {
+		fmt->dict_item(ctx, "degrade");
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "level");
+		fmt->value_uint(ctx, ops->level);
+		fmt->dict_item(ctx, "previous");
+		fmt->value_uint(ctx, ops->prevlevel);
+		fmt->dict_item(ctx, "reason");
+		fmt->value_string(ctx, ops->reason);
+		fmt->dict_end(ctx); /* degrade */
+	}
+
+	if (ops->budget > 0) {
+		fmt->dict_item(ctx, "shed");
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "level");
+		fmt->value_uint(ctx, ops->level);
+		fmt->dict_item(ctx, "previous");
+		fmt->value_uint(ctx, ops->prevlevel);
+		fmt->dict_item(ctx, "step");
+		fmt->value_string(ctx, membudget_level_s(ops->level));
+		fmt->dict_item(ctx, "footprint");
+		fmt->value_uint(ctx, ops->footprint);
+		fmt->dict_item(ctx, "budget");
+		fmt->value_uint(ctx, ops->budget);
+		fmt->dict_end(ctx); /* shed */
+	}
+
+	if (ops->path) {
+		fmt->dict_item(ctx, "revalidate");
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "path");
+		fmt->value_string(ctx, ops->path);
+		logevt_codesign(fmt, ctx, ops->codesign);
+		fmt->dict_item(ctx, "previous");
+		fmt->dict_begin(ctx);
+		logevt_codesign(fmt, ctx, ops->prevcodesign);
+		fmt->dict_end(ctx); /* previous */
+		fmt->dict_end(ctx); /* revalidate */
+	}
+
+	if (ops->rotate_requested > 0) {
+		fmt->dict_item(ctx, "rotate");
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "open");
+		fmt->value_uint(ctx, ops->rotate_open);
+		fmt->dict_item(ctx, "latency");
+		fmt->value_uint(ctx, ops->rotate_latency);
+		fmt->dict_end(ctx); /* rotate */
+	}
+
+	if (ops->changes) {
+		fmt->dict_item(ctx, "reload");
+		fmt->list_begin(ctx);
+		if (ops->changes & CONFIG_CHANGED_SUPPRESS) {
+			fmt->list_item(ctx, "change");
+			fmt->value_string(ctx, "suppress");
+		}
+		if (ops->changes & CONFIG_CHANGED_EVENTS) {
+			fmt->list_item(ctx, "change");
+			fmt->value_string(ctx, "events");
+		}
+		if (ops->changes & CONFIG_CHANGED_LOG) {
+			fmt->list_item(ctx, "change");
+			fmt->value_string(ctx, "log");
+		}
+		fmt->list_end(ctx); /* reload */
+	}
+
+	if (ops->startup > 0) {
+		fmt->dict_item(ctx, "startup");
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "total");
+		fmt->value_uint(ctx, ops->startup);
+		if (ops->stages > 0) {
+			fmt->dict_item(ctx, "stages");
+			fmt->dict_begin(ctx);
+			for (size_t i = 0; i < ops->stages; i++) {
+				fmt->dict_item(ctx, ops->stage[i].name);
+				fmt->value_uint(ctx, ops->stage[i].nsec);
+			}
+			fmt->dict_end(ctx); /* stages */
+		}
+		fmt->dict_end(ctx); /* startup */
+	}
+
+	fmt->dict_item(ctx, "build");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "version");
+	fmt->value_string(ctx, build_version);
+	fmt->dict_item(ctx, "date");
+	fmt->value_string(ctx, build_date);
+	fmt->dict_item(ctx, "info");
+	fmt->value_string(ctx, build_info);
+	fmt->dict_end(ctx); /* build */
+
+	fmt->dict_item(ctx, "config");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "path");
+	fmt->value_string(ctx, config->path);
+	fmt->dict_item(ctx, "id");
 	if (config->id)
-		fmt->value_string(f, config->id);
+		fmt->value_string(ctx, config->id);
 	else
-		fmt->value_null(f);
-	fmt->dict_item(f, "launchd_mode");
-	fmt->value_bool(f, config->launchd_mode);
-	fmt->dict_item(f, "debug");
-	fmt->value_bool(f, config->debug);
-	fmt->dict_item(f, "events");
+		fmt->value_null(ctx);
+	fmt->dict_item(ctx, "launchd_mode");
+	fmt->value_bool(ctx, config->launchd_mode);
+	fmt->dict_item(ctx, "debug");
+	fmt->value_bool(ctx, config->debug);
+	fmt->dict_item(ctx, "events");
 	char *evts = config_events_s(config);
-	fmt->value_string(f, evts);
+	fmt->value_string(ctx, evts);
 	free(evts);
-	fmt->dict_item(f, "stats_interval");
-	fmt->value_uint(f, config->stats_interval);
-	fmt->dict_item(f, "kextlevel");
-	fmt->value_string(f, config_kextlevel_s(config));
-	fmt->dict_item(f, "hashes");
-	fmt->value_string(f, hashes_flags_s(config->hflags));
-	fmt->dict_item(f, "codesign");
-	fmt->value_bool(f, config->codesign);
-	fmt->dict_item(f, "envlevel");
-	fmt->value_string(f, config_envlevel_s(config));
-	fmt->dict_item(f, "resolve_users_groups");
-	fmt->value_bool(f, config->resolve_users_groups);
-	fmt->dict_item(f, "omit_mode");
-	fmt->value_bool(f, config->omit_mode);
-	fmt->dict_item(f, "omit_size");
-	fmt->value_bool(f, config->omit_size);
-	fmt->dict_item(f, "omit_mtime");
-	fmt->value_bool(f, config->omit_mtime);
-	fmt->dict_item(f, "omit_ctime");
-	fmt->value_bool(f, config->omit_ctime);
-	fmt->dict_item(f, "omit_btime");
-	fmt->value_bool(f, config->omit_btime);
-	fmt->dict_item(f, "omit_sid");
-	fmt->value_bool(f, config->omit_sid);
-	fmt->dict_item(f, "omit_groups");
-	fmt->value_bool(f, config->omit_groups);
-	fmt->dict_item(f, "omit_apple_hashes");
-	fmt->value_bool(f, config->omit_apple_hashes);
-	fmt->dict_item(f, "ancestors");
+	fmt->dict_item(ctx, "stats_interval");
+	fmt->value_uint(ctx, config->stats_interval);
+	fmt->dict_item(ctx, "metrics_socket");
+	if (config->metrics_socket)
+		fmt->value_string(ctx, config->metrics_socket);
+	else
+		fmt->value_null(ctx);
+	fmt->dict_item(ctx, "query_socket");
+	if (config->query_socket)
+		fmt->value_string(ctx, config->query_socket);
+	else
+		fmt->value_null(ctx);
+	fmt->dict_item(ctx, "query_index_size");
+	fmt->value_uint(ctx, config->query_index_size);
+	fmt->dict_item(ctx, "latency_sample");
+	fmt->value_uint(ctx, config->latency_sample);
+	fmt->dict_item(ctx, "profile_duration");
+	fmt->value_uint(ctx, config->profile_duration);
+	fmt->dict_item(ctx, "kextlevel");
+	fmt->value_string(ctx, config_kextlevel_s(config));
+	fmt->dict_item(ctx, "kext_nowait_by_path");
+	fmt->value_uint(ctx, setstr_size(&config->kext_nowait_by_path));
+	fmt->dict_item(ctx, "kext_hash_max");
+	fmt->value_uint(ctx, config->kext_hash_max);
+	fmt->dict_item(ctx, "kext_backlog_watermark");
+	fmt->value_uint(ctx, config->kext_backlog_watermark);
+	fmt->dict_item(ctx, "kext_threads");
+	fmt->value_uint(ctx, config->kext_threads);
+	fmt->dict_item(ctx, "hashes");
+	fmt->value_string(ctx, hashes_flags_s(config->hflags));
+	fmt->dict_item(ctx, "hash_chunk_size");
+	fmt->value_uint(ctx, config->hash_chunk_size);
+	fmt->dict_item(ctx, "hash_parallel");
+	fmt->value_bool(ctx, config->hash_parallel);
+	fmt->dict_item(ctx, "hash_mmap");
+	fmt->value_bool(ctx, config->hash_mmap);
+	fmt->dict_item(ctx, "hash_nocache_threshold");
+	fmt->value_uint(ctx, config->hash_nocache_threshold);
+	fmt->dict_item(ctx, "hash_slice");
+	fmt->value_bool(ctx, config->hash_slice);
+	fmt->dict_item(ctx, "codesign");
+	fmt->value_bool(ctx, config->codesign);
+	fmt->dict_item(ctx, "envlevel");
+	fmt->value_string(ctx, config_envlevel_s(config));
+	fmt->dict_item(ctx, "resolve_users_groups");
+	fmt->value_bool(ctx, config->resolve_users_groups);
+	fmt->dict_item(ctx, "omit_mode");
+	fmt->value_bool(ctx, config->omit_mode);
+	fmt->dict_item(ctx, "omit_size");
+	fmt->value_bool(ctx, config->omit_size);
+	fmt->dict_item(ctx, "omit_mtime");
+	fmt->value_bool(ctx, config->omit_mtime);
+	fmt->dict_item(ctx, "omit_ctime");
+	fmt->value_bool(ctx, config->omit_ctime);
+	fmt->dict_item(ctx, "omit_btime");
+	fmt->value_bool(ctx, config->omit_btime);
+	fmt->dict_item(ctx, "omit_sid");
+	fmt->value_bool(ctx, config->omit_sid);
+	fmt->dict_item(ctx, "omit_groups");
+	fmt->value_bool(ctx, config->omit_groups);
+	fmt->dict_item(ctx, "omit_apple_hashes");
+	fmt->value_bool(ctx, config->omit_apple_hashes);
+	fmt->dict_item(ctx, "ancestors");
 	if (config->ancestors < SIZE_MAX)
-		fmt->value_uint(f, config->ancestors);
+		fmt->value_uint(ctx, config->ancestors);
 	else
-		fmt->value_string(f, "unlimited");
-	fmt->dict_item(f, "logdst");
-	fmt->value_string(f, logdst_s(config));
-	fmt->dict_item(f, "logfmt");
-	fmt->value_string(f, logfmt_s(config));
-	fmt->dict_item(f, "logoneline");
+		fmt->value_string(ctx, "unlimited");
+	fmt->dict_item(ctx, "ancestor_ids");
+	fmt->value_bool(ctx, config->ancestor_ids);
+	fmt->dict_item(ctx, "ancestor_argv");
+	if (config->ancestor_argv < SIZE_MAX)
+		fmt->value_uint(ctx, config->ancestor_argv);
+	else
+		fmt->value_string(ctx, "unlimited");
+	fmt->dict_item(ctx, "ancestor_argv_bytes");
+	fmt->value_uint(ctx, config->ancestor_argv_bytes);
+	fmt->dict_item(ctx, "socket_connect_window");
+	fmt->value_uint(ctx, config->socket_connect_window);
+	fmt->dict_item(ctx, "socket_accept_window");
+	fmt->value_uint(ctx, config->socket_accept_window);
+	fmt->dict_item(ctx, "process_access_window");
+	fmt->value_uint(ctx, config->process_access_window);
+	fmt->dict_item(ctx, "logdst");
+	fmt->value_string(ctx, logdst_s(config));
+	fmt->dict_item(ctx, "logfmt");
+	fmt->value_string(ctx, logfmt_s(config));
+	fmt->dict_item(ctx, "logoneline");
 	if (config->logoneline == -1)
-		fmt->value_null(f);
+		fmt->value_null(ctx);
 	else
-		fmt->value_bool(f, config->logoneline);
-	fmt->dict_item(f, "logfile");
+		fmt->value_bool(ctx, config->logoneline);
+	fmt->dict_item(ctx, "logfile");
 	if (config->logfile)
-		fmt->value_string(f, config->logfile);
+		fmt->value_string(ctx, config->logfile);
+	else
+		fmt->value_null(ctx);
+	fmt->dict_item(ctx, "log_flush_deadline");
+	fmt->value_uint(ctx, config->log_flush_deadline);
+	fmt->dict_item(ctx, "log_compression");
+	fmt->value_string(ctx, config->log_compress ? "gzip" : "none");
+	fmt->dict_item(ctx, "log_file_coalesce");
+	fmt->value_uint(ctx, config->log_file_coalesce);
+	fmt->dict_item(ctx, "log_file_interval");
+	fmt->value_uint(ctx, config->log_file_interval);
+	fmt->dict_item(ctx, "log_stdout_buffer");
+	fmt->value_uint(ctx, config->log_stdout_buffer);
+	fmt->dict_item(ctx, "log_stdout_interval");
+	fmt->value_uint(ctx, config->log_stdout_interval);
+	fmt->dict_item(ctx, "log_file_sync");
+	fmt->value_string(ctx, config_log_file_sync_s(config));
+	fmt->dict_item(ctx, "loghost");
+	if (config->loghost)
+		fmt->value_string(ctx, config->loghost);
+	else
+		fmt->value_null(ctx);
+	fmt->dict_item(ctx, "log_spool_memory");
+	fmt->value_uint(ctx, config->log_spool_memory);
+	fmt->dict_item(ctx, "log_spool_file");
+	if (config->log_spool_file)
+		fmt->value_string(ctx, config->log_spool_file);
+	else
+		fmt->value_null(ctx);
+	fmt->dict_item(ctx, "log_spool_size");
+	fmt->value_uint(ctx, config->log_spool_size);
+	fmt->dict_item(ctx, "logshm");
+	if (config->logshm)
+		fmt->value_string(ctx, config->logshm);
+	else
+		fmt->value_null(ctx);
+	fmt->dict_item(ctx, "log_shm_size");
+	fmt->value_uint(ctx, config->log_shm_size);
+	fmt->dict_item(ctx, "log_fanout");
+	fmt->list_begin(ctx);
+	for (size_t i = 0; i < config->log_fanouts; i++) {
+		fmt->list_item(ctx, "destination");
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "logdst");
+		fmt->value_string(ctx, log_fanout_dst_s(config, i));
+		fmt->dict_item(ctx, "logfmt");
+		fmt->value_string(ctx, log_fanout_fmt_s(config, i));
+		fmt->dict_item(ctx, "logoneline");
+		if (config->log_fanout_oneline[i] == -1)
+			fmt->value_null(ctx);
+		else
+			fmt->value_bool(ctx, config->log_fanout_oneline[i]);
+		fmt->dict_item(ctx, "events");
+		if (config->log_fanout_events[i]) {
+			fmt->list_begin(ctx);
+			for (int code = 0; code < LOGEVT_SIZE; code++) {
+				if (!(config->log_fanout_events[i] &
+				      LOGEVT_FLAG(code)))
+					continue;
+				fmt->list_item(ctx, "eventcode");
+				fmt->value_uint(ctx, code);
+			}
+			fmt->list_end(ctx);
+		} else {
+			fmt->value_null(ctx);
+		}
+		fmt->dict_item(ctx, "fields");
+		if (config->log_fanout_fields[i])
+			fmt->value_string(ctx, config->log_fanout_fields[i]);
+		else
+			fmt->value_null(ctx);
+		fmt->dict_end(ctx);
+	}
+	fmt->list_end(ctx);
+	fmt->dict_item(ctx, "limit_nofile");
+	fmt->value_uint(ctx, config->limit_nofile);
+	fmt->dict_item(ctx, "worker_threads");
+	fmt->value_uint(ctx, config->worker_threads);
+	fmt->dict_item(ctx, "worker_threads_max");
+	fmt->value_uint(ctx, config->worker_threads_max);
+	fmt->dict_item(ctx, "worker_lag_target");
+	fmt->value_uint(ctx, config->worker_lag_target);
+	fmt->dict_item(ctx, "bulk_threads");
+	fmt->value_uint(ctx, config->bulk_threads);
+	fmt->dict_item(ctx, "priority_events");
+	fmt->list_begin(ctx);
+	for (int code = 0; code < LOGEVT_SIZE; code++) {
+		if (!(config->priority_events & LOGEVT_FLAG(code)))
+			continue;
+		fmt->list_item(ctx, "eventcode");
+		fmt->value_uint(ctx, code);
+	}
+	fmt->list_end(ctx);
+	fmt->dict_item(ctx, "codesign_threads");
+	fmt->value_uint(ctx, config->codesign_threads);
+	fmt->dict_item(ctx, "codesign_overlap");
+	fmt->value_bool(ctx, config->codesign_overlap);
+	fmt->dict_item(ctx, "codesign_verify_origin");
+	fmt->value_bool(ctx, config->codesign_verify_origin);
+	fmt->dict_item(ctx, "codesign_helpers");
+	fmt->value_bool(ctx, config->codesign_helpers);
+	fmt->dict_item(ctx, "codesign_helper_timeout");
+	fmt->value_uint(ctx, config->codesign_helper_timeout);
+	fmt->dict_item(ctx, "codesign_build_dirs");
+	fmt->value_uint(ctx, setstr_size(&config->codesign_build_dirs));
+	fmt->dict_item(ctx, "enrich_threads");
+	fmt->value_uint(ctx, config->enrich_threads);
+	fmt->dict_item(ctx, "qos_evtloop");
+	fmt->value_string(ctx, policy_qos_s(config->qos_evtloop));
+	fmt->dict_item(ctx, "qos_kextloop");
+	fmt->value_string(ctx, policy_qos_s(config->qos_kextloop));
+	fmt->dict_item(ctx, "qos_work");
+	fmt->value_string(ctx, policy_qos_s(config->qos_work));
+	fmt->dict_item(ctx, "qos_bulk");
+	fmt->value_string(ctx, policy_qos_s(config->qos_bulk));
+	fmt->dict_item(ctx, "qos_log");
+	fmt->value_string(ctx, policy_qos_s(config->qos_log));
+	fmt->dict_item(ctx, "codesign_refresh_interval");
+	fmt->value_uint(ctx, config->codesign_refresh_interval);
+	fmt->dict_item(ctx, "codesign_refresh_count");
+	fmt->value_uint(ctx, config->codesign_refresh_count);
+	fmt->dict_item(ctx, "bulk_threshold");
+	fmt->value_uint(ctx, config->bulk_threshold);
+	fmt->dict_item(ctx, "fstypes_bulk");
+	fmt->value_uint(ctx, setstr_size(&config->fstypes_bulk));
+	fmt->dict_item(ctx, "fstypes_skip");
+	fmt->value_uint(ctx, setstr_size(&config->fstypes_skip));
+	fmt->dict_item(ctx, "governor_rate");
+	fmt->value_uint(ctx, config->governor_rate);
+	fmt->dict_item(ctx, "governor_burst");
+	fmt->value_uint(ctx, config->governor_burst);
+	fmt->dict_item(ctx, "governor_interval");
+	fmt->value_uint(ctx, config->governor_interval);
+	fmt->dict_item(ctx, "degrade");
+	fmt->value_bool(ctx, config->degrade);
+	fmt->dict_item(ctx, "degrade_queue");
+	fmt->value_uint(ctx, config->degrade_queue);
+	fmt->dict_item(ctx, "degrade_cpu");
+	fmt->value_uint(ctx, config->degrade_cpu);
+	fmt->dict_item(ctx, "degrade_ancestors");
+	fmt->value_uint(ctx, config->degrade_ancestors);
+	fmt->dict_item(ctx, "memory_budget");
+	fmt->value_uint(ctx, config->memory_budget);
+	fmt->dict_item(ctx, "queue_capacity");
+	fmt->value_uint(ctx, config->queue_capacity);
+	fmt->dict_item(ctx, "queue_overflow");
+	fmt->value_string(ctx, config_queue_overflow_s(config));
+	fmt->dict_item(ctx, "auditpipe_qlimit");
+	if (config->auditpipe_qlimit == AUPIPE_QLIMIT_AUTO)
+		fmt->value_string(ctx, "auto");
+	else if (config->auditpipe_qlimit == AUPIPE_QLIMIT_MAX)
+		fmt->value_string(ctx, "max");
+	else
+		fmt->value_uint(ctx, config->auditpipe_qlimit);
+	fmt->dict_item(ctx, "auditpipe_lean_auids");
+	if (config->auditpipe_lean_auids)
+		fmt->value_string(ctx, config->auditpipe_lean_auids);
+	else
+		fmt->value_null(ctx);
+	fmt->dict_item(ctx, "cache_directory");
+	if (config->cache_directory)
+		fmt->value_string(ctx, config->cache_directory);
+	else
+		fmt->value_null(ctx);
+	fmt->dict_item(ctx, "cache_save_interval");
+	fmt->value_uint(ctx, config->cache_save_interval);
+	fmt->dict_item(ctx, "cache_hashes_size");
+	fmt->value_uint(ctx, config->cache_hashes_size);
+	fmt->dict_item(ctx, "cache_codesign_size");
+	fmt->value_uint(ctx, config->cache_codesign_size);
+	fmt->dict_item(ctx, "cache_ldpl_size");
+	fmt->value_uint(ctx, config->cache_ldpl_size);
+	fmt->dict_item(ctx, "cache_cdhash_size");
+	fmt->value_uint(ctx, config->cache_cdhash_size);
+	fmt->dict_item(ctx, "cache_fingerprint_size");
+	fmt->value_uint(ctx, config->cache_fingerprint_size);
+	fmt->dict_item(ctx, "cache_bundle_size");
+	fmt->value_uint(ctx, config->cache_bundle_size);
+	fmt->dict_item(ctx, "cache_sealed_size");
+	fmt->value_uint(ctx, config->cache_sealed_size);
+	fmt->dict_item(ctx, "cache_fleet_socket");
+	if (config->cache_fleet_socket)
+		fmt->value_string(ctx, config->cache_fleet_socket);
 	else
-		fmt->value_null(f);
-	fmt->dict_item(f, "limit_nofile");
-	fmt->value_uint(f, config->limit_nofile);
-	fmt->dict_item(f, "suppress_image_exec_at_start");
-	fmt->value_bool(f, config->suppress_image_exec_at_start);
-	fmt->dict_item(f, "suppress_image_exec_by_ident");
-	fmt->value_uint(f, setstr_size(&config->suppress_image_exec_by_ident));
-	fmt->dict_item(f, "suppress_image_exec_by_path");
-	fmt->value_uint(f, setstr_size(&config->suppress_image_exec_by_path));
-	fmt->dict_item(f, "suppress_image_exec_by_ancestor_ident");
-	fmt->value_uint(f,
-		setstr_size(&config->suppress_image_exec_by_ancestor_ident));
-	fmt->dict_item(f, "suppress_image_exec_by_ancestor_path");
-	fmt->value_uint(f,
-		setstr_size(&config->suppress_image_exec_by_ancestor_path));
-	fmt->dict_item(f, "suppress_process_access_by_subject_ident");
-	fmt->value_uint(f,
-		setstr_size(&config->suppress_process_access_by_subject_ident));
-	fmt->dict_item(f, "suppress_process_access_by_subject_path");
-	fmt->value_uint(f,
-		setstr_size(&config->suppress_process_access_by_subject_path));
-	fmt->dict_item(f, "suppress_socket_op_localhost");
-	fmt->value_bool(f, config->suppress_socket_op_localhost);
-	fmt->dict_item(f, "suppress_socket_op_by_subject_ident");
-	fmt->value_uint(f,
-		setstr_size(&config->suppress_socket_op_by_subject_ident));
-	fmt->dict_item(f, "suppress_socket_op_by_subject_path");
-	fmt->value_uint(f,
-		setstr_size(&config->suppress_socket_op_by_subject_path));
-	fmt->dict_end(f); /* config */
-
-	fmt->dict_item(f, "system");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "name");
-	fmt->value_string(f, os_name());
-	fmt->dict_item(f, "version");
-	fmt->value_string(f, os_version());
-	fmt->dict_item(f, "build");
-	fmt->value_string(f, os_build());
-	fmt->dict_end(f); /* system */
-
-	logevt_footer(fmt, f);
+		fmt->value_null(ctx);
+	fmt->dict_item(ctx, "cache_fleet_timeout");
+	fmt->value_uint(ctx, config->cache_fleet_timeout);
+	fmt->dict_item(ctx, "cache_hashes_policy");
+	fmt->value_string(ctx, lrucache_policy_s(config->cache_hashes_policy));
+	fmt->dict_item(ctx, "cache_codesign_policy");
+	fmt->value_string(ctx, lrucache_policy_s(config->cache_codesign_policy));
+	fmt->dict_item(ctx, "cache_ldpl_policy");
+	fmt->value_string(ctx, lrucache_policy_s(config->cache_ldpl_policy));
+	fmt->dict_item(ctx, "cache_memory_budget");
+	fmt->value_uint(ctx, config->cache_memory_budget);
+	fmt->dict_item(ctx, "trace_record");
+	if (config->trace_record)
+		fmt->value_string(ctx, config->trace_record);
+	else
+		fmt->value_null(ctx);
+	fmt->dict_item(ctx, "trace_replay");
+	if (config->trace_replay)
+		fmt->value_string(ctx, config->trace_replay);
+	else
+		fmt->value_null(ctx);
+	fmt->dict_item(ctx, "trace_replay_speed");
+	fmt->value_uint(ctx, config->trace_replay_speed);
+	fmt->dict_item(ctx, "trace_replay_lookups");
+	fmt->value_bool(ctx, config->trace_replay_lookups);
+	fmt->dict_item(ctx, "suppress_image_exec_at_start");
+	fmt->value_bool(ctx, config->suppress_image_exec_at_start);
+	fmt->dict_item(ctx, "preload_rate");
+	fmt->value_uint(ctx, config->preload_rate);
+	LOGEVT_SETSTR_SIZE(suppress_image_exec_by_ident);
+	LOGEVT_SETSTR_SIZE(suppress_image_exec_by_path);
+	fmt->dict_item(ctx, "suppress_image_exec_lean");
+	fmt->value_bool(ctx, config->suppress_image_exec_lean);
+	LOGEVT_SETSTR_SIZE(suppress_image_exec_by_ancestor_ident);
+	LOGEVT_SETSTR_SIZE(suppress_image_exec_by_ancestor_path);
+	LOGEVT_SETSTR_SIZE(suppress_process_access_by_subject_ident);
+	LOGEVT_SETSTR_SIZE(suppress_process_access_by_subject_path);
+	fmt->dict_item(ctx, "suppress_socket_op_localhost");
+	fmt->value_bool(ctx, config->suppress_socket_op_localhost);
+	LOGEVT_SETSTR_SIZE(suppress_socket_op_by_subject_ident);
+	LOGEVT_SETSTR_SIZE(suppress_socket_op_by_subject_path);
+	fmt->dict_end(ctx); /* config */
+
+	fmt->dict_item(ctx, "system");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "name");
+	fmt->value_string(ctx, os_name());
+	fmt->dict_item(ctx, "version");
+	fmt->value_string(ctx, os_version());
+	fmt->dict_item(ctx, "build");
+	fmt->value_string(ctx, os_build());
+	fmt->dict_end(ctx); /* system */
+
+	logevt_footer(fmt, ctx);
 	return 0;
 }
 
 int
-logevt_xnumon_stats(logfmt_t *fmt, FILE *f, void *arg0) {
+logevt_xnumon_stats(logfmt_t *fmt, logfmt_ctx_t *ctx, void *arg0) {
 	evtloop_stat_t *st = (evtloop_stat_t *)arg0;
+	const char *stage = NULL;
+
+	logevt_header(fmt, ctx, (logevt_header_t *)arg0);
 
-	logevt_header(fmt, f, (logevt_header_t *)arg0);
-
-	fmt->dict_item(f, "evtloop");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "aupclobber");
-	fmt->value_uint(f, st->el_aupclobbers);
-	fmt->dict_item(f, "aueunknown");
-	fmt->value_uint(f, st->el_aueunknowns);
-	fmt->dict_item(f, "failedsyscall");
-	fmt->value_uint(f, st->el_failedsyscalls);
-	fmt->dict_item(f, "radar38845422");
-	fmt->value_uint(f, st->el_radar38845422);
-	fmt->dict_item(f, "radar38845422_fatal");
-	fmt->value_uint(f, st->el_radar38845422_fatal);
-	fmt->dict_item(f, "radar38845784");
-	fmt->value_uint(f, st->el_radar38845784);
-	fmt->dict_item(f, "radar39267328");
-	fmt->value_uint(f, st->el_radar39267328);
-	fmt->dict_item(f, "radar39267328_fatal");
-	fmt->value_uint(f, st->el_radar39267328_fatal);
-	fmt->dict_item(f, "radar39623812");
-	fmt->value_uint(f, st->el_radar39623812);
-	fmt->dict_item(f, "radar39623812_fatal");
-	fmt->value_uint(f, st->el_radar39623812_fatal);
-	fmt->dict_item(f, "radar42770257");
-	fmt->value_uint(f, st->el_radar42770257);
-	fmt->dict_item(f, "radar42770257_fatal");
-	fmt->value_uint(f, st->el_radar42770257_fatal);
-	fmt->dict_item(f, "radar42783724");
-	fmt->value_uint(f, st->el_radar42783724);
-	fmt->dict_item(f, "radar42783724_fatal");
-	fmt->value_uint(f, st->el_radar42783724_fatal);
-	fmt->dict_item(f, "radar42784847");
-	fmt->value_uint(f, st->el_radar42784847);
-	fmt->dict_item(f, "radar42784847_fatal");
-	fmt->value_uint(f, st->el_radar42784847_fatal);
-	fmt->dict_item(f, "radar42946744");
-	fmt->value_uint(f, st->el_radar42946744);
-	fmt->dict_item(f, "radar42946744_fatal");
-	fmt->value_uint(f, st->el_radar42946744_fatal);
-	fmt->dict_item(f, "radar43151662");
-	fmt->value_uint(f, st->el_radar43151662);
-	fmt->dict_item(f, "radar43151662_fatal");
-	fmt->value_uint(f, st->el_radar43151662_fatal);
-	fmt->dict_item(f, "missingtoken");
-	fmt->value_uint(f, st->el_missingtoken);
-	fmt->dict_item(f, "oom");
-	fmt->value_uint(f, st->el_ooms);
-	fmt->dict_end(f); /* evtloop */
-
-	fmt->dict_item(f, "procmon");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "actprocs");
-	fmt->value_uint(f, st->pm.procs);
-	fmt->dict_item(f, "actexecimages");
-	fmt->value_uint(f, st->pm.images);
-	fmt->dict_item(f, "liveacq");
-	fmt->value_uint(f, st->pm.liveacq);
-	fmt->dict_item(f, "miss");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "bypid");
-	fmt->value_uint(f, st->pm.miss_bypid);
-	fmt->dict_item(f, "forksubj");
-	fmt->value_uint(f, st->pm.miss_forksubj);
-	fmt->dict_item(f, "execsubj");
-	fmt->value_uint(f, st->pm.miss_execsubj);
-	fmt->dict_item(f, "execinterp");
-	fmt->value_uint(f, st->pm.miss_execinterp);
-	fmt->dict_item(f, "chdirsubj");
-	fmt->value_uint(f, st->pm.miss_chdirsubj);
-	fmt->dict_item(f, "getcwd");
-	fmt->value_uint(f, st->pm.miss_getcwd);
-	fmt->dict_end(f); /* miss */
-	fmt->dict_item(f, "oom");
-	fmt->value_uint(f, st->pm.ooms);
-	fmt->dict_end(f); /* procmon */
-
-	fmt->dict_item(f, "hackmon");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "recvd");
-	fmt->value_uint(f, st->hm.recvd);
-	fmt->dict_item(f, "procd");
-	fmt->value_uint(f, st->hm.procd);
-	fmt->dict_item(f, "oom");
-	fmt->value_uint(f, st->hm.ooms);
-	fmt->dict_end(f); /* hackmon */
-
-	fmt->dict_item(f, "filemon");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "recvd");
-	fmt->value_uint(f, st->fm.recvd);
-	fmt->dict_item(f, "procd");
-	fmt->value_uint(f, st->fm.procd);
-	fmt->dict_item(f, "lpmiss");
-	fmt->value_uint(f, st->fm.lpmiss);
-	fmt->dict_item(f, "oom");
-	fmt->value_uint(f, st->fm.ooms);
-	fmt->dict_end(f); /* filemon */
-
-	fmt->dict_item(f, "sockmon");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "recvd");
-	fmt->value_uint(f, st->sm.recvd);
-	fmt->dict_item(f, "procd");
-	fmt->value_uint(f, st->sm.procd);
-	fmt->dict_item(f, "oom");
-	fmt->value_uint(f, st->sm.ooms);
-	fmt->dict_end(f); /* sockmon */
-
-	fmt->dict_item(f, "kext_cdevq");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "buckets");
-	fmt->value_uint(f, st->ke.cdev_qsize);
-	fmt->dict_item(f, "visitors");
-	fmt->value_uint(f, st->ke.kauth_visitors);
-	fmt->dict_item(f, "timeout");
-	fmt->value_uint(f, st->ke.kauth_timeouts);
-	fmt->dict_item(f, "error");
-	fmt->value_uint(f, st->ke.kauth_errors);
-	fmt->dict_item(f, "defer");
-	fmt->value_uint(f, st->ke.kauth_defers);
-	fmt->dict_item(f, "deny");
-	fmt->value_uint(f, st->ke.kauth_denies);
-	fmt->dict_end(f); /* kext-cdevq */
-
-	fmt->dict_item(f, "prep_queue");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "buckets");
-	fmt->value_uint(f, st->pm.pqsize);
-	fmt->dict_item(f, "lookup");
-	fmt->value_uint(f, st->pm.pqlookup);
-	fmt->dict_item(f, "miss");
-	fmt->value_uint(f, st->pm.pqmiss);
-	fmt->dict_item(f, "drop");
-	fmt->value_uint(f, st->pm.pqdrop);
-	fmt->dict_item(f, "bktskip");
-	fmt->value_uint(f, st->pm.pqskip);
-	fmt->dict_end(f); /* prep-queue */
-
-	fmt->dict_item(f, "aupi_cdevq");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "buckets");
-	fmt->value_uint(f, st->ap.qlen);
-	fmt->dict_item(f, "bucketmax");
-	fmt->value_uint(f, st->ap.qlimit);
-	fmt->dict_item(f, "insert");
-	fmt->value_uint(f, st->ap.inserts);
-	fmt->dict_item(f, "read");
-	fmt->value_uint(f, st->ap.reads);
-	fmt->dict_item(f, "drop");
-	fmt->value_uint(f, st->ap.drops);
-	fmt->dict_end(f); /* aupi-cdevq */
-
-	fmt->dict_item(f, "work_queue");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "buckets");
-	fmt->value_uint(f, st->wq.qsize);
-	fmt->dict_end(f); /* work-queue */
-
-	fmt->dict_item(f, "log_queue");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "buckets");
-	fmt->value_uint(f, st->lq.qsize);
-	fmt->dict_item(f, "events");
-	fmt->list_begin(f);
+	fmt->dict_item(ctx, "drops");
+	fmt->dict_begin(ctx);
+	for (size_t i = 0; i < EVTLOOP_DROPS_MAX; i++) {
+		if (!st->el_drops[i].stage)
+			break;
+		if (!stage || strcmp(stage, st->el_drops[i].stage)) {
+			if (stage)
+				fmt->dict_end(ctx);
+			stage = st->el_drops[i].stage;
+			fmt->dict_item(ctx, stage);
+			fmt->dict_begin(ctx);
+		}
+		fmt->dict_item(ctx, st->el_drops[i].reason);
+		fmt->value_uint(ctx, st->el_drops[i].count);
+	}
+	if (stage)
+		fmt->dict_end(ctx);
+	fmt->dict_end(ctx); /* drops */
+
+	fmt->dict_item(ctx, "evtloop");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "aupclobber");
+	fmt->value_uint(ctx, st->el_aupclobbers);
+	fmt->dict_item(ctx, "aupcheck");
+	fmt->value_uint(ctx, st->el_aupchecks);
+	fmt->dict_item(ctx, "aupnotify");
+	fmt->value_uint(ctx, st->el_aupnotifies);
+	fmt->dict_item(ctx, "aueunknown");
+	fmt->value_uint(ctx, st->el_aueunknowns);
+	fmt->dict_item(ctx, "auereject");
+	fmt->list_begin(ctx);
+	for (size_t i = 0; i < EVTLOOP_AUEREJECTS_MAX; i++) {
+		if (st->el_auerejects[i].count == 0)
+			break;
+		fmt->list_item(ctx, "aue");
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "type");
+		fmt->value_uint(ctx, st->el_auerejects[i].type);
+		fmt->dict_item(ctx, "count");
+		fmt->value_uint(ctx, st->el_auerejects[i].count);
+		fmt->dict_end(ctx);
+	}
+	fmt->list_end(ctx);
+	fmt->dict_item(ctx, "auehandler");
+	fmt->dict_begin(ctx);
+	for (size_t i = 0; i < EVTLOOP_AUEHANDLERS_MAX; i++) {
+		if (!st->el_auehandlers[i].name)
+			break;
+		fmt->dict_item(ctx, st->el_auehandlers[i].name);
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "count");
+		fmt->value_uint(ctx, st->el_auehandlers[i].count);
+		fmt->dict_item(ctx, "failed");
+		fmt->value_uint(ctx, st->el_auehandlers[i].failed);
+		fmt->dict_item(ctx, "nsecs");
+		fmt->value_uint(ctx, st->el_auehandlers[i].nsecs);
+		fmt->dict_end(ctx);
+	}
+	fmt->dict_end(ctx);
+	fmt->dict_item(ctx, "failedsyscall");
+	fmt->value_uint(ctx, st->el_failedsyscalls);
+	fmt->dict_item(ctx, "localskips");
+	fmt->value_uint(ctx, st->el_localskips);
+	fmt->dict_item(ctx, "radar38845422");
+	fmt->value_uint(ctx, st->el_radar38845422);
+	fmt->dict_item(ctx, "radar38845422_fatal");
+	fmt->value_uint(ctx, st->el_radar38845422_fatal);
+	fmt->dict_item(ctx, "radar38845784");
+	fmt->value_uint(ctx, st->el_radar38845784);
+	fmt->dict_item(ctx, "radar39267328");
+	fmt->value_uint(ctx, st->el_radar39267328);
+	fmt->dict_item(ctx, "radar39267328_fatal");
+	fmt->value_uint(ctx, st->el_radar39267328_fatal);
+	fmt->dict_item(ctx, "radar39623812");
+	fmt->value_uint(ctx, st->el_radar39623812);
+	fmt->dict_item(ctx, "radar39623812_fatal");
+	fmt->value_uint(ctx, st->el_radar39623812_fatal);
+	fmt->dict_item(ctx, "radar42770257");
+	fmt->value_uint(ctx, st->el_radar42770257);
+	fmt->dict_item(ctx, "radar42770257_fatal");
+	fmt->value_uint(ctx, st->el_radar42770257_fatal);
+	fmt->dict_item(ctx, "radar42783724");
+	fmt->value_uint(ctx, st->el_radar42783724);
+	fmt->dict_item(ctx, "radar42783724_fatal");
+	fmt->value_uint(ctx, st->el_radar42783724_fatal);
+	fmt->dict_item(ctx, "radar42784847");
+	fmt->value_uint(ctx, st->el_radar42784847);
+	fmt->dict_item(ctx, "radar42784847_fatal");
+	fmt->value_uint(ctx, st->el_radar42784847_fatal);
+	fmt->dict_item(ctx, "radar42946744");
+	fmt->value_uint(ctx, st->el_radar42946744);
+	fmt->dict_item(ctx, "radar42946744_fatal");
+	fmt->value_uint(ctx, st->el_radar42946744_fatal);
+	fmt->dict_item(ctx, "radar43151662");
+	fmt->value_uint(ctx, st->el_radar43151662);
+	fmt->dict_item(ctx, "radar43151662_fatal");
+	fmt->value_uint(ctx, st->el_radar43151662_fatal);
+	fmt->dict_item(ctx, "missingtoken");
+	fmt->value_uint(ctx, st->el_missingtoken);
+	fmt->dict_item(ctx, "oom");
+	fmt->value_uint(ctx, st->el_ooms);
+	fmt->dict_item(ctx, "ringused");
+	fmt->value_uint(ctx, st->el_ringused);
+	fmt->dict_item(ctx, "ringstall");
+	fmt->value_uint(ctx, st->el_ringstalls);
+	fmt->dict_item(ctx, "resync");
+	fmt->value_uint(ctx, st->el_resyncs);
+	fmt->dict_item(ctx, "pidcache");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "hit");
+	fmt->value_uint(ctx, st->el_pc.hits);
+	fmt->dict_item(ctx, "miss");
+	fmt->value_uint(ctx, st->el_pc.misses);
+	fmt->dict_item(ctx, "invalidated");
+	fmt->value_uint(ctx, st->el_pc.invalidations);
+	fmt->dict_end(ctx); /* pidcache */
+	fmt->dict_end(ctx); /* evtloop */
+
+	fmt->dict_item(ctx, "procmon");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "actprocs");
+	fmt->value_uint(ctx, st->pm.procs);
+	fmt->dict_item(ctx, "actprocspeak");
+	fmt->value_uint(ctx, st->pm.procspeak);
+	fmt->dict_item(ctx, "ptbuckets");
+	fmt->value_uint(ctx, st->pm.pt.buckets);
+	fmt->dict_item(ctx, "ptload");
+	fmt->value_uint(ctx, st->pm.pt.load);
+	fmt->dict_item(ctx, "ptdispmax");
+	fmt->value_uint(ctx, st->pm.pt.dispmax);
+	fmt->dict_item(ctx, "ptlookups");
+	fmt->value_uint(ctx, st->pm.pt.lookups);
+	fmt->dict_item(ctx, "ptprobes");
+	fmt->value_uint(ctx, st->pm.pt.probes);
+	fmt->dict_item(ctx, "ptfdshared");
+	fmt->value_uint(ctx, st->pm.pt.fdshared);
+	fmt->dict_item(ctx, "ptfdunshared");
+	fmt->value_uint(ctx, st->pm.pt.fdunshared);
+	fmt->dict_item(ctx, "actexecimages");
+	fmt->value_uint(ctx, st->pm.images);
+	fmt->dict_item(ctx, "liveacq");
+	fmt->value_uint(ctx, st->pm.liveacq);
+	fmt->dict_item(ctx, "pidmaprebuilds");
+	fmt->value_uint(ctx, st->pm.pidmaprebuilds);
+	fmt->dict_item(ctx, "pidmapskips");
+	fmt->value_uint(ctx, st->pm.pidmapskips);
+	fmt->dict_item(ctx, "kexthash");
+	fmt->value_uint(ctx, st->pm.kexthash);
+	fmt->dict_item(ctx, "kexthash_stale");
+	fmt->value_uint(ctx, st->pm.kexthash_stale);
+	fmt->dict_item(ctx, "kextident");
+	fmt->value_uint(ctx, st->pm.kextident);
+	fmt->dict_item(ctx, "kextident_miss");
+	fmt->value_uint(ctx, st->pm.kextident_miss);
+	fmt->dict_item(ctx, "enriched");
+	fmt->value_uint(ctx, st->pm.enriched);
+	fmt->dict_item(ctx, "enrichsync");
+	fmt->value_uint(ctx, st->pm.enrichsync);
+	fmt->dict_item(ctx, "enrichq");
+	fmt->value_uint(ctx, st->pm.enrichq);
+	fmt->dict_item(ctx, "scriptpar");
+	fmt->value_uint(ctx, st->pm.scriptpar);
+	fmt->dict_item(ctx, "leanskip");
+	fmt->value_uint(ctx, st->pm.leanskip);
+	fmt->dict_item(ctx, "restored");
+	fmt->value_uint(ctx, st->pm.restored);
+	fmt->dict_item(ctx, "rexec_hit");
+	fmt->value_uint(ctx, st->pm.rexec_hit);
+	fmt->dict_item(ctx, "rexec_stale");
+	fmt->value_uint(ctx, st->pm.rexec_stale);
+	fmt->dict_item(ctx, "execs");
+	fmt->value_uint(ctx, st->pm.execs);
+	fmt->dict_item(ctx, "opens");
+	fmt->value_uint(ctx, st->pm.opens);
+	fmt->dict_item(ctx, "fdhandoffs");
+	fmt->value_uint(ctx, st->pm.fdhandoffs);
+	fmt->dict_item(ctx, "hashresumes");
+	fmt->value_uint(ctx, st->pm.hashresumes);
+	fmt->dict_item(ctx, "buildunsigned");
+	fmt->value_uint(ctx, st->pm.buildunsigned);
+	fmt->dict_item(ctx, "opensperexec");
+	fmt->value_uint(ctx, st->pm.opensperexec);
+	fmt->dict_item(ctx, "forks");
+	fmt->value_uint(ctx, st->pm.forks);
+	fmt->dict_item(ctx, "reapsweeps");
+	fmt->value_uint(ctx, st->pm.reapsweeps);
+	fmt->dict_item(ctx, "reapstorms");
+	fmt->value_uint(ctx, st->pm.reapstorms);
+	fmt->dict_item(ctx, "reaped");
+	fmt->value_uint(ctx, st->pm.reaped);
+	fmt->dict_item(ctx, "reclaims");
+	fmt->value_uint(ctx, st->pm.reclaims);
+	fmt->dict_item(ctx, "trims");
+	fmt->value_uint(ctx, st->pm.trims);
+	fmt->dict_item(ctx, "preloadq");
+	fmt->value_uint(ctx, st->pm.preloadq);
+	fmt->dict_item(ctx, "preloaded");
+	fmt->value_uint(ctx, st->pm.preloaded);
+	fmt->dict_item(ctx, "miss");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "bypid");
+	fmt->value_uint(ctx, st->pm.miss_bypid);
+	fmt->dict_item(ctx, "forksubj");
+	fmt->value_uint(ctx, st->pm.miss_forksubj);
+	fmt->dict_item(ctx, "execsubj");
+	fmt->value_uint(ctx, st->pm.miss_execsubj);
+	fmt->dict_item(ctx, "execinterp");
+	fmt->value_uint(ctx, st->pm.miss_execinterp);
+	fmt->dict_item(ctx, "chdirsubj");
+	fmt->value_uint(ctx, st->pm.miss_chdirsubj);
+	fmt->dict_item(ctx, "getcwd");
+	fmt->value_uint(ctx, st->pm.miss_getcwd);
+	fmt->dict_end(ctx); /* miss */
+	fmt->dict_item(ctx, "oom");
+	fmt->value_uint(ctx, st->pm.ooms);
+	fmt->dict_end(ctx); /* procmon */
+
+	fmt->dict_item(ctx, "hackmon");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "recvd");
+	fmt->value_uint(ctx, st->hm.recvd);
+	fmt->dict_item(ctx, "procd");
+	fmt->value_uint(ctx, st->hm.procd);
+	fmt->dict_item(ctx, "oom");
+	fmt->value_uint(ctx, st->hm.ooms);
+	fmt->dict_item(ctx, "folded");
+	fmt->value_uint(ctx, st->hm.folded);
+	fmt->dict_item(ctx, "held");
+	fmt->value_uint(ctx, st->hm.held);
+	fmt->dict_end(ctx); /* hackmon */
+
+	fmt->dict_item(ctx, "filemon");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "recvd");
+	fmt->value_uint(ctx, st->fm.recvd);
+	fmt->dict_item(ctx, "procd");
+	fmt->value_uint(ctx, st->fm.procd);
+	fmt->dict_item(ctx, "opens");
+	fmt->value_uint(ctx, st->fm.opens);
+	fmt->dict_item(ctx, "openskips");
+	fmt->value_uint(ctx, st->fm.openskips);
+	fmt->dict_item(ctx, "lpmiss");
+	fmt->value_uint(ctx, st->fm.lpmiss);
+	fmt->dict_item(ctx, "lpoffline");
+	fmt->value_uint(ctx, st->fm.lpoffline);
+	fmt->dict_item(ctx, "symlinks");
+	fmt->value_uint(ctx, st->fm.symlinks);
+	fmt->dict_item(ctx, "symlinks_bytes");
+	fmt->value_uint(ctx, st->fm.symlinks_bytes);
+	fmt->dict_item(ctx, "oom");
+	fmt->value_uint(ctx, st->fm.ooms);
+	fmt->dict_end(ctx); /* filemon */
+
+	fmt->dict_item(ctx, "sockmon");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "recvd");
+	fmt->value_uint(ctx, st->sm.recvd);
+	fmt->dict_item(ctx, "procd");
+	fmt->value_uint(ctx, st->sm.procd);
+	fmt->dict_item(ctx, "oom");
+	fmt->value_uint(ctx, st->sm.ooms);
+	fmt->dict_item(ctx, "folded");
+	fmt->value_uint(ctx, st->sm.folded);
+	fmt->dict_item(ctx, "held");
+	fmt->value_uint(ctx, st->sm.held);
+	fmt->dict_item(ctx, "early");
+	fmt->value_uint(ctx, st->sm.early);
+	fmt->dict_item(ctx, "ignored");
+	fmt->value_uint(ctx, st->sm.ignored);
+	fmt->dict_end(ctx); /* sockmon */
+
+	fmt->dict_item(ctx, "kext_cdevq");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "proto");
+	fmt->value_uint(ctx, st->keproto);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->ke.cdev_qsize);
+	fmt->dict_item(ctx, "visitors");
+	fmt->value_uint(ctx, st->ke.kauth_visitors);
+	fmt->dict_item(ctx, "timeout");
+	fmt->value_uint(ctx, st->ke.kauth_timeouts);
+	fmt->dict_item(ctx, "error");
+	fmt->value_uint(ctx, st->ke.kauth_errors);
+	fmt->dict_item(ctx, "defer");
+	fmt->value_uint(ctx, st->ke.kauth_defers);
+	fmt->dict_item(ctx, "deny");
+	fmt->value_uint(ctx, st->ke.kauth_denies);
+	fmt->dict_item(ctx, "nowait");
+	fmt->value_uint(ctx, st->ke.kauth_nowaits);
+	fmt->dict_item(ctx, "poolmiss");
+	fmt->value_uint(ctx, st->ke.cdev_poolmisses);
+	fmt->dict_item(ctx, "degraded");
+	fmt->value_uint(ctx, st->ke.kauth_degraded);
+	fmt->dict_item(ctx, "repeat");
+	fmt->value_uint(ctx, st->ke.kauth_repeats);
+	fmt->dict_item(ctx, "wait");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "count");
+	fmt->value_uint(ctx, st->kewait.count);
+	fmt->dict_item(ctx, "p50");
+	fmt->value_uint(ctx, hist_percentile(&st->kewait, 50));
+	fmt->dict_item(ctx, "p90");
+	fmt->value_uint(ctx, hist_percentile(&st->kewait, 90));
+	fmt->dict_item(ctx, "p99");
+	fmt->value_uint(ctx, hist_percentile(&st->kewait, 99));
+	fmt->dict_end(ctx); /* wait */
+	fmt->dict_end(ctx); /* kext-cdevq */
+
+	fmt->dict_item(ctx, "kext_pool");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "threads");
+	fmt->value_uint(ctx, st->kp.threads);
+	fmt->dict_item(ctx, "dispatched");
+	fmt->value_uint(ctx, st->kp.dispatched);
+	fmt->dict_item(ctx, "peak");
+	fmt->value_uint(ctx, st->kp.peak);
+	fmt->dict_item(ctx, "block");
+	fmt->value_uint(ctx, st->kp.blocks);
+	fmt->dict_end(ctx); /* kext_pool */
+
+	fmt->dict_item(ctx, "prep_queue");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->pm.pqsize);
+	fmt->dict_item(ctx, "bucketpeak");
+	fmt->value_uint(ctx, st->pm.pqpeak);
+	fmt->dict_item(ctx, "lookup");
+	fmt->value_uint(ctx, st->pm.pqlookup);
+	fmt->dict_item(ctx, "miss");
+	fmt->value_uint(ctx, st->pm.pqmiss);
+	fmt->dict_item(ctx, "drop");
+	fmt->value_uint(ctx, st->pm.pqdrop);
+	fmt->dict_item(ctx, "bktskip");
+	fmt->value_uint(ctx, st->pm.pqskip);
+	fmt->dict_item(ctx, "latency");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "count");
+	fmt->value_uint(ctx, st->pm.pqlat.count);
+	fmt->dict_item(ctx, "p50");
+	fmt->value_uint(ctx, hist_percentile(&st->pm.pqlat, 50));
+	fmt->dict_item(ctx, "p90");
+	fmt->value_uint(ctx, hist_percentile(&st->pm.pqlat, 90));
+	fmt->dict_item(ctx, "p99");
+	fmt->value_uint(ctx, hist_percentile(&st->pm.pqlat, 99));
+	fmt->dict_end(ctx); /* latency */
+	fmt->dict_end(ctx); /* prep-queue */
+
+	fmt->dict_item(ctx, "aupi_cdevq");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->ap.qlen);
+	fmt->dict_item(ctx, "bucketmax");
+	fmt->value_uint(ctx, st->ap.qlimit);
+	fmt->dict_item(ctx, "insert");
+	fmt->value_uint(ctx, st->ap.inserts);
+	fmt->dict_item(ctx, "read");
+	fmt->value_uint(ctx, st->ap.reads);
+	fmt->dict_item(ctx, "drop");
+	fmt->value_uint(ctx, st->ap.drops);
+	fmt->dict_item(ctx, "lean");
+	fmt->value_uint(ctx, st->ap.lean);
+	fmt->dict_item(ctx, "grow");
+	fmt->value_uint(ctx, st->ap.grows);
+	fmt->dict_item(ctx, "shrink");
+	fmt->value_uint(ctx, st->ap.shrinks);
+	fmt->dict_item(ctx, "period");
+	fmt->value_uint(ctx, st->ap.period);
+	fmt->dict_item(ctx, "series");
+	fmt->list_begin(ctx);
+	for (unsigned int i = 0; i < st->ap.samples; i++) {
+		fmt->list_item(ctx, "sample");
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "buckets");
+		fmt->value_uint(ctx, st->ap.series[i].qlen);
+		fmt->dict_item(ctx, "bucketmax");
+		fmt->value_uint(ctx, st->ap.series[i].qlimit);
+		fmt->dict_item(ctx, "drop");
+		fmt->value_uint(ctx, st->ap.series[i].drops);
+		fmt->dict_end(ctx);
+	}
+	fmt->list_end(ctx);
+	fmt->dict_end(ctx); /* aupi-cdevq */
+
+	fmt->dict_item(ctx, "work_queue");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->wq.qsize);
+	fmt->dict_item(ctx, "bucketpeak");
+	fmt->value_uint(ctx, st->wq.qpeak);
+	fmt->dict_item(ctx, "workers");
+	fmt->list_begin(ctx);
+	for (uint32_t i = 0; i < st->wq.workers; i++) {
+		fmt->list_item(ctx, "worker");
+		fmt->value_uint(ctx, st->wq.wqsize[i]);
+	}
+	fmt->list_end(ctx);
+	fmt->dict_item(ctx, "workers_min");
+	fmt->value_uint(ctx, st->wq.workers_min);
+	fmt->dict_item(ctx, "workers_max");
+	fmt->value_uint(ctx, st->wq.workers_max);
+	fmt->dict_item(ctx, "lag");
+	fmt->value_uint(ctx, st->wq.lag);
+	fmt->dict_item(ctx, "scaleup");
+	fmt->value_uint(ctx, st->wq.scaleups);
+	fmt->dict_item(ctx, "scaledown");
+	fmt->value_uint(ctx, st->wq.scaledowns);
+	fmt->dict_item(ctx, "scaling");
+	fmt->list_begin(ctx);
+	for (uint32_t i = 0; i < st->wq.scales; i++) {
+		fmt->list_item(ctx, "decision");
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "time");
+		fmt->value_timespec(ctx, &st->wq.scale[i].tv);
+		fmt->dict_item(ctx, "from");
+		fmt->value_uint(ctx, st->wq.scale[i].from);
+		fmt->dict_item(ctx, "to");
+		fmt->value_uint(ctx, st->wq.scale[i].to);
+		fmt->dict_item(ctx, "buckets");
+		fmt->value_uint(ctx, st->wq.scale[i].depth);
+		fmt->dict_item(ctx, "lag");
+		fmt->value_uint(ctx, st->wq.scale[i].lag);
+		fmt->dict_end(ctx);
+	}
+	fmt->list_end(ctx);
+	fmt->dict_item(ctx, "bulk");
+	fmt->list_begin(ctx);
+	for (uint32_t i = 0; i < st->wq.bulkers; i++) {
+		fmt->list_item(ctx, "worker");
+		fmt->value_uint(ctx, st->wq.bqsize[i]);
+	}
+	fmt->list_end(ctx);
+	fmt->dict_item(ctx, "bulked");
+	fmt->value_uint(ctx, st->wq.bulked);
+	fmt->dict_item(ctx, "priority");
+	fmt->value_uint(ctx, st->wq.pqsize);
+	fmt->dict_item(ctx, "prioritized");
+	fmt->value_uint(ctx, st->wq.prioritized);
+	fmt->dict_item(ctx, "reorder");
+	fmt->value_uint(ctx, st->wq.rbsize);
+	fmt->dict_item(ctx, "reorderpeak");
+	fmt->value_uint(ctx, st->wq.rbpeak);
+	fmt->dict_item(ctx, "drop");
+	fmt->value_uint(ctx, st->wq.drops);
+	fmt->dict_item(ctx, "block");
+	fmt->value_uint(ctx, st->wq.blocks);
+	fmt->dict_item(ctx, "failed");
+	fmt->value_uint(ctx, st->wq.failed);
+	fmt->dict_item(ctx, "suppressed");
+	fmt->value_uint(ctx, st->wq.suppressed);
+	fmt->dict_item(ctx, "filtered");
+	fmt->value_uint(ctx, st->wq.filtered);
+	fmt->dict_end(ctx); /* work-queue */
+
+	fmt->dict_item(ctx, "governor");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "keys");
+	fmt->value_uint(ctx, st->gv.keys);
+	fmt->dict_item(ctx, "untracked");
+	fmt->value_uint(ctx, st->gv.untracked);
+	fmt->dict_item(ctx, "summaries");
+	fmt->value_uint(ctx, st->gv.summaries);
+	fmt->dict_item(ctx, "suppressed");
+	fmt->list_begin(ctx);
+	for (int i = 0; i < LOGEVT_SIZE; i++) {
+		fmt->list_item(ctx, "event");
+		fmt->value_uint(ctx, st->gv.suppressed[i]);
+	}
+	fmt->list_end(ctx);
+	fmt->dict_end(ctx); /* governor */
+
+	fmt->dict_item(ctx, "degrade");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "level");
+	fmt->value_uint(ctx, st->dg.level);
+	fmt->dict_item(ctx, "raises");
+	fmt->value_uint(ctx, st->dg.raises);
+	fmt->dict_item(ctx, "lowers");
+	fmt->value_uint(ctx, st->dg.lowers);
+	fmt->dict_item(ctx, "sha256_skipped");
+	fmt->value_uint(ctx, st->dg.sha256_skipped);
+	fmt->dict_item(ctx, "codesign_skipped");
+	fmt->value_uint(ctx, st->dg.codesign_skipped);
+	fmt->dict_item(ctx, "ancestors_truncated");
+	fmt->value_uint(ctx, st->dg.ancestors_truncated);
+	fmt->dict_end(ctx); /* degrade */
+
+	fmt->dict_item(ctx, "membudget");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "level");
+	fmt->value_uint(ctx, st->mb.level);
+	fmt->dict_item(ctx, "raises");
+	fmt->value_uint(ctx, st->mb.raises);
+	fmt->dict_item(ctx, "lowers");
+	fmt->value_uint(ctx, st->mb.lowers);
+	fmt->dict_item(ctx, "budget");
+	fmt->value_uint(ctx, st->mb.budget);
+	fmt->dict_item(ctx, "footprint");
+	fmt->value_uint(ctx, st->mb.footprint);
+	fmt->dict_item(ctx, "footprintpeak");
+	fmt->value_uint(ctx, st->mb.footprintpeak);
+	fmt->dict_item(ctx, "caches");
+	fmt->value_uint(ctx, st->mb.caches);
+	fmt->dict_item(ctx, "procs");
+	fmt->value_uint(ctx, st->mb.procs);
+	fmt->dict_item(ctx, "images");
+	fmt->value_uint(ctx, st->mb.images);
+	fmt->dict_item(ctx, "queued");
+	fmt->value_uint(ctx, st->mb.queued);
+	fmt->dict_item(ctx, "flushes");
+	fmt->value_uint(ctx, st->mb.flushes);
+	fmt->dict_item(ctx, "envs_dropped");
+	fmt->value_uint(ctx, st->mb.envs_dropped);
+	fmt->dict_end(ctx); /* membudget */
+
+	fmt->dict_item(ctx, "kesched");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "audit_fill");
+	fmt->value_uint(ctx, st->ks.audit_fill);
+	fmt->dict_item(ctx, "reads");
+	fmt->value_uint(ctx, st->ks.reads);
+	fmt->dict_item(ctx, "deferred");
+	fmt->value_uint(ctx, st->ks.deferred);
+	fmt->dict_item(ctx, "deferred_nsec");
+	fmt->value_uint(ctx, st->ks.deferred_nsec);
+	fmt->dict_item(ctx, "kext_first");
+	fmt->value_uint(ctx, st->ks.kext_first);
+	fmt->dict_item(ctx, "forced");
+	fmt->value_uint(ctx, st->ks.forced);
+	fmt->dict_end(ctx); /* kesched */
+
+	fmt->dict_item(ctx, "log_queue");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->lq.qsize);
+	fmt->dict_item(ctx, "bucketpeak");
+	fmt->value_uint(ctx, st->lq.qpeak);
+	fmt->dict_item(ctx, "events");
+	fmt->list_begin(ctx);
+	for (int i = 0; i < LOGEVT_SIZE; i++) {
+		fmt->list_item(ctx, "event");
+		fmt->value_uint(ctx, st->lq.counts[i]);
+	}
+	fmt->list_end(ctx);
+	fmt->dict_item(ctx, "drop");
+	fmt->value_uint(ctx, st->lq.drops);
+	fmt->dict_item(ctx, "block");
+	fmt->value_uint(ctx, st->lq.blocks);
+	fmt->dict_item(ctx, "flush");
+	fmt->value_uint(ctx, st->lq.flushes);
+	fmt->dict_item(ctx, "errors");
+	fmt->value_uint(ctx, st->lq.errors);
+	fmt->dict_item(ctx, "rendered");
+	fmt->value_uint(ctx, st->lq.ld.rendered);
+	fmt->dict_item(ctx, "written");
+	fmt->value_uint(ctx, st->lq.ld.written);
+	fmt->dict_item(ctx, "ratio");
+	fmt->value_uint(ctx, st->lq.ld.written > 0 ?
+	                     st->lq.ld.rendered * 100 / st->lq.ld.written : 0);
+	fmt->dict_item(ctx, "writes");
+	fmt->value_uint(ctx, st->lq.ld.writes);
+	fmt->dict_item(ctx, "bytes_per_write");
+	fmt->value_uint(ctx, st->lq.ld.writes > 0 ?
+	                     st->lq.ld.written / st->lq.ld.writes : 0);
+	fmt->dict_item(ctx, "syncs");
+	fmt->value_uint(ctx, st->lq.ld.syncs);
+	fmt->dict_item(ctx, "spooled");
+	fmt->value_uint(ctx, st->lq.ld.spooled);
+	fmt->dict_item(ctx, "spoolbytes");
+	fmt->value_uint(ctx, st->lq.ld.spoolbytes);
+	fmt->dict_item(ctx, "spoolsegs");
+	fmt->value_uint(ctx, st->lq.ld.spoolsegs);
+	fmt->dict_item(ctx, "spilled");
+	fmt->value_uint(ctx, st->lq.ld.spilled);
+	fmt->dict_item(ctx, "stalls");
+	fmt->value_uint(ctx, st->lq.ld.stalls);
+	fmt->dict_item(ctx, "spooldrops");
+	fmt->value_uint(ctx, st->lq.ld.drops);
+	fmt->dict_item(ctx, "connects");
+	fmt->value_uint(ctx, st->lq.ld.connects);
+	fmt->dict_item(ctx, "latency");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "count");
+	fmt->value_uint(ctx, st->lq.ld.latency.count);
+	fmt->dict_item(ctx, "p50");
+	fmt->value_uint(ctx, hist_percentile(&st->lq.ld.latency, 50));
+	fmt->dict_item(ctx, "p90");
+	fmt->value_uint(ctx, hist_percentile(&st->lq.ld.latency, 90));
+	fmt->dict_item(ctx, "p99");
+	fmt->value_uint(ctx, hist_percentile(&st->lq.ld.latency, 99));
+	fmt->dict_end(ctx); /* latency */
+	fmt->dict_item(ctx, "fanout");
+	fmt->list_begin(ctx);
+	for (size_t i = 0; i < st->lq.outs; i++) {
+		log_out_stat_t *os = &st->lq.out[i];
+
+		fmt->list_item(ctx, "destination");
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "logdst");
+		fmt->value_string(ctx, os->dst);
+		fmt->dict_item(ctx, "logfmt");
+		fmt->value_string(ctx, os->fmt);
+		fmt->dict_item(ctx, "buckets");
+		fmt->value_uint(ctx, os->qsize);
+		fmt->dict_item(ctx, "bucketpeak");
+		fmt->value_uint(ctx, os->qpeak);
+		fmt->dict_item(ctx, "records");
+		fmt->value_uint(ctx, os->records);
+		fmt->dict_item(ctx, "drop");
+		fmt->value_uint(ctx, os->drops);
+		fmt->dict_item(ctx, "block");
+		fmt->value_uint(ctx, os->blocks);
+		fmt->dict_item(ctx, "flush");
+		fmt->value_uint(ctx, os->flushes);
+		fmt->dict_item(ctx, "errors");
+		fmt->value_uint(ctx, os->errors);
+		fmt->dict_item(ctx, "written");
+		fmt->value_uint(ctx, os->ld.written);
+		fmt->dict_item(ctx, "writes");
+		fmt->value_uint(ctx, os->ld.writes);
+		fmt->dict_item(ctx, "spooled");
+		fmt->value_uint(ctx, os->ld.spooled);
+		fmt->dict_item(ctx, "spooldrops");
+		fmt->value_uint(ctx, os->ld.drops);
+		fmt->dict_end(ctx);
+	}
+	fmt->list_end(ctx); /* fanout */
+	fmt->dict_end(ctx); /* log-queue */
+
+	fmt->dict_item(ctx, "pipeline_latency");
+	fmt->dict_begin(ctx);
+	for (size_t i = 0; i < LOGEVT_STAMPS; i++) {
+		fmt->dict_item(ctx, latency_names[i]);
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "count");
+		fmt->value_uint(ctx, st->lq.latency[i].count);
+		fmt->dict_item(ctx, "p50");
+		fmt->value_uint(ctx, hist_percentile(&st->lq.latency[i], 50));
+		fmt->dict_item(ctx, "p90");
+		fmt->value_uint(ctx, hist_percentile(&st->lq.latency[i], 90));
+		fmt->dict_item(ctx, "p99");
+		fmt->value_uint(ctx, hist_percentile(&st->lq.latency[i], 99));
+		fmt->dict_end(ctx);
+	}
+	fmt->dict_end(ctx); /* pipeline_latency */
+
+	fmt->dict_item(ctx, "hashes");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "files");
+	fmt->value_uint(ctx, st->hs.files);
+	fmt->dict_item(ctx, "bytes");
+	fmt->value_uint(ctx, st->hs.bytes);
+	fmt->dict_item(ctx, "parallel");
+	fmt->value_uint(ctx, st->hs.parallel);
+	fmt->dict_item(ctx, "mapped");
+	fmt->value_uint(ctx, st->hs.mapped);
+	fmt->dict_item(ctx, "mapfaults");
+	fmt->value_uint(ctx, st->hs.mapfaults);
+	fmt->dict_item(ctx, "nocache");
+	fmt->value_uint(ctx, st->hs.nocache);
+	fmt->dict_item(ctx, "readbytes");
+	fmt->value_uint(ctx, st->hs.readbytes);
+	fmt->dict_item(ctx, "mappedbytes");
+	fmt->value_uint(ctx, st->hs.mappedbytes);
+	fmt->dict_item(ctx, "nocachebytes");
+	fmt->value_uint(ctx, st->hs.nocachebytes);
+	fmt->dict_item(ctx, "slices");
+	fmt->value_uint(ctx, st->hs.slices);
+	fmt->dict_item(ctx, "slicebytes");
+	fmt->value_uint(ctx, st->hs.slicebytes);
+	fmt->dict_item(ctx, "mbps");
+	fmt->value_uint(ctx, st->hs.mbps);
+	fmt->dict_item(ctx, "leaves");
+	fmt->value_uint(ctx, st->hs.leaves);
+	fmt->dict_item(ctx, "reused");
+	fmt->value_uint(ctx, st->hs.reused);
+	fmt->dict_end(ctx); /* hashes */
+
+	fmt->dict_item(ctx, "hash_cache");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->ch.used);
+	fmt->dict_item(ctx, "policy");
+	fmt->value_string(ctx, lrucache_policy_s(st->ch.policy));
+	fmt->dict_item(ctx, "bucketmax");
+	fmt->value_uint(ctx, st->ch.size);
+	fmt->dict_item(ctx, "protected");
+	fmt->value_uint(ctx, st->ch.protected);
+	fmt->dict_item(ctx, "bytes");
+	fmt->value_uint(ctx, st->ch.bytes);
+	fmt->dict_item(ctx, "grow");
+	fmt->value_uint(ctx, st->ch.grows);
+	fmt->dict_item(ctx, "put");
+	fmt->value_uint(ctx, st->ch.puts);
+	fmt->dict_item(ctx, "get");
+	fmt->value_uint(ctx, st->ch.gets);
+	fmt->dict_item(ctx, "hit");
+	fmt->value_uint(ctx, st->ch.hits);
+	fmt->dict_item(ctx, "miss");
+	fmt->value_uint(ctx, st->ch.misses);
+	fmt->dict_item(ctx, "hitrate");
+	fmt->value_uint(ctx, st->ch.hitrate);
+	fmt->dict_item(ctx, "inv");
+	fmt->value_uint(ctx, st->ch.invalids);
+	fmt->dict_item(ctx, "filtered");
+	fmt->value_uint(ctx, st->ch.filtered);
+	fmt->dict_item(ctx, "falsepos");
+	fmt->value_uint(ctx, st->ch.falsepos);
+	fmt->dict_item(ctx, "shards");
+	fmt->list_begin(ctx);
+	for (uint32_t i = 0; i < st->ch.shards; i++) {
+		fmt->list_item(ctx, "shard");
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "buckets");
+		fmt->value_uint(ctx, st->ch.shard[i].used);
+		fmt->dict_item(ctx, "hit");
+		fmt->value_uint(ctx, st->ch.shard[i].hits);
+		fmt->dict_item(ctx, "miss");
+		fmt->value_uint(ctx, st->ch.shard[i].misses);
+		fmt->dict_end(ctx);
+	}
+	fmt->list_end(ctx);
+	fmt->dict_end(ctx); /* hash-cache */
+
+	fmt->dict_item(ctx, "csig_cache");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->cc.used);
+	fmt->dict_item(ctx, "policy");
+	fmt->value_string(ctx, lrucache_policy_s(st->cc.policy));
+	fmt->dict_item(ctx, "bucketmax");
+	fmt->value_uint(ctx, st->cc.size);
+	fmt->dict_item(ctx, "protected");
+	fmt->value_uint(ctx, st->cc.protected);
+	fmt->dict_item(ctx, "bytes");
+	fmt->value_uint(ctx, st->cc.bytes);
+	fmt->dict_item(ctx, "grow");
+	fmt->value_uint(ctx, st->cc.grows);
+	fmt->dict_item(ctx, "put");
+	fmt->value_uint(ctx, st->cc.puts);
+	fmt->dict_item(ctx, "get");
+	fmt->value_uint(ctx, st->cc.gets);
+	fmt->dict_item(ctx, "hit");
+	fmt->value_uint(ctx, st->cc.hits);
+	fmt->dict_item(ctx, "miss");
+	fmt->value_uint(ctx, st->cc.misses);
+	fmt->dict_item(ctx, "hitrate");
+	fmt->value_uint(ctx, st->cc.hitrate);
+	fmt->dict_item(ctx, "inv");
+	fmt->value_uint(ctx, st->cc.invalids);
+	fmt->dict_end(ctx); /* csig-cache */
+
+	fmt->dict_item(ctx, "cdhash_cache");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->cd.used);
+	fmt->dict_item(ctx, "bucketmax");
+	fmt->value_uint(ctx, st->cd.size);
+	fmt->dict_item(ctx, "bytes");
+	fmt->value_uint(ctx, st->cd.bytes);
+	fmt->dict_item(ctx, "put");
+	fmt->value_uint(ctx, st->cd.puts);
+	fmt->dict_item(ctx, "get");
+	fmt->value_uint(ctx, st->cd.gets);
+	fmt->dict_item(ctx, "hit");
+	fmt->value_uint(ctx, st->cd.hits);
+	fmt->dict_item(ctx, "miss");
+	fmt->value_uint(ctx, st->cd.misses);
+	fmt->dict_item(ctx, "hitrate");
+	fmt->value_uint(ctx, st->cd.hitrate);
+	fmt->dict_item(ctx, "inv");
+	fmt->value_uint(ctx, st->cd.invalids);
+	fmt->dict_end(ctx); /* cdhash-cache */
+
+	fmt->dict_item(ctx, "fleet_cache");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "get");
+	fmt->value_uint(ctx, st->fc.lookups);
+	fmt->dict_item(ctx, "hit");
+	fmt->value_uint(ctx, st->fc.hits);
+	fmt->dict_item(ctx, "miss");
+	fmt->value_uint(ctx, st->fc.misses);
+	fmt->dict_item(ctx, "reject");
+	fmt->value_uint(ctx, st->fc.rejects);
+	fmt->dict_item(ctx, "timeout");
+	fmt->value_uint(ctx, st->fc.timeouts);
+	fmt->dict_item(ctx, "err");
+	fmt->value_uint(ctx, st->fc.errors);
+	fmt->dict_item(ctx, "put");
+	fmt->value_uint(ctx, st->fc.puts);
+	fmt->dict_item(ctx, "putdrop");
+	fmt->value_uint(ctx, st->fc.putdrops);
+	fmt->dict_end(ctx); /* fleet-cache */
+
+	fmt->dict_item(ctx, "query_index");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "size");
+	fmt->value_uint(ctx, st->ei.size);
+	fmt->dict_item(ctx, "used");
+	fmt->value_uint(ctx, st->ei.used);
+	fmt->dict_item(ctx, "added");
+	fmt->value_uint(ctx, st->ei.added);
+	fmt->dict_item(ctx, "queries");
+	fmt->value_uint(ctx, st->ei.queries);
+	fmt->dict_item(ctx, "results");
+	fmt->value_uint(ctx, st->ei.results);
+	fmt->dict_item(ctx, "errors");
+	fmt->value_uint(ctx, st->ei.errors);
+	fmt->dict_end(ctx); /* query-index */
+
+	fmt->dict_item(ctx, "fp_cache");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->cf.used);
+	fmt->dict_item(ctx, "bucketmax");
+	fmt->value_uint(ctx, st->cf.size);
+	fmt->dict_item(ctx, "bytes");
+	fmt->value_uint(ctx, st->cf.bytes);
+	fmt->dict_item(ctx, "put");
+	fmt->value_uint(ctx, st->cf.puts);
+	fmt->dict_item(ctx, "get");
+	fmt->value_uint(ctx, st->cf.gets);
+	fmt->dict_item(ctx, "hit");
+	fmt->value_uint(ctx, st->cf.hits);
+	fmt->dict_item(ctx, "miss");
+	fmt->value_uint(ctx, st->cf.misses);
+	fmt->dict_item(ctx, "hitrate");
+	fmt->value_uint(ctx, st->cf.hitrate);
+	fmt->dict_item(ctx, "inv");
+	fmt->value_uint(ctx, st->cf.invalids);
+	fmt->dict_end(ctx); /* fp-cache */
+
+	fmt->dict_item(ctx, "slice_cache");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->cn.used);
+	fmt->dict_item(ctx, "bucketmax");
+	fmt->value_uint(ctx, st->cn.size);
+	fmt->dict_item(ctx, "bytes");
+	fmt->value_uint(ctx, st->cn.bytes);
+	fmt->dict_item(ctx, "put");
+	fmt->value_uint(ctx, st->cn.puts);
+	fmt->dict_item(ctx, "get");
+	fmt->value_uint(ctx, st->cn.gets);
+	fmt->dict_item(ctx, "hit");
+	fmt->value_uint(ctx, st->cn.hits);
+	fmt->dict_item(ctx, "miss");
+	fmt->value_uint(ctx, st->cn.misses);
+	fmt->dict_item(ctx, "hitrate");
+	fmt->value_uint(ctx, st->cn.hitrate);
+	fmt->dict_item(ctx, "inv");
+	fmt->value_uint(ctx, st->cn.invalids);
+	fmt->dict_end(ctx); /* slice-cache */
+
+	fmt->dict_item(ctx, "build_cache");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->cu.used);
+	fmt->dict_item(ctx, "bucketmax");
+	fmt->value_uint(ctx, st->cu.size);
+	fmt->dict_item(ctx, "bytes");
+	fmt->value_uint(ctx, st->cu.bytes);
+	fmt->dict_item(ctx, "put");
+	fmt->value_uint(ctx, st->cu.puts);
+	fmt->dict_item(ctx, "get");
+	fmt->value_uint(ctx, st->cu.gets);
+	fmt->dict_item(ctx, "hit");
+	fmt->value_uint(ctx, st->cu.hits);
+	fmt->dict_item(ctx, "miss");
+	fmt->value_uint(ctx, st->cu.misses);
+	fmt->dict_item(ctx, "hitrate");
+	fmt->value_uint(ctx, st->cu.hitrate);
+	fmt->dict_item(ctx, "inv");
+	fmt->value_uint(ctx, st->cu.invalids);
+	fmt->dict_end(ctx); /* build-cache */
+
+	fmt->dict_item(ctx, "sealed_cache");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->cs.used);
+	fmt->dict_item(ctx, "bucketmax");
+	fmt->value_uint(ctx, st->cs.size);
+	fmt->dict_item(ctx, "bytes");
+	fmt->value_uint(ctx, st->cs.bytes);
+	fmt->dict_item(ctx, "put");
+	fmt->value_uint(ctx, st->cs.puts);
+	fmt->dict_item(ctx, "get");
+	fmt->value_uint(ctx, st->cs.gets);
+	fmt->dict_item(ctx, "hit");
+	fmt->value_uint(ctx, st->cs.hits);
+	fmt->dict_item(ctx, "miss");
+	fmt->value_uint(ctx, st->cs.misses);
+	fmt->dict_item(ctx, "hitrate");
+	fmt->value_uint(ctx, st->cs.hitrate);
+	fmt->dict_end(ctx); /* sealed-cache */
+
+	fmt->dict_item(ctx, "bundle_cache");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->cb.used);
+	fmt->dict_item(ctx, "bucketmax");
+	fmt->value_uint(ctx, st->cb.size);
+	fmt->dict_item(ctx, "bytes");
+	fmt->value_uint(ctx, st->cb.bytes);
+	fmt->dict_item(ctx, "put");
+	fmt->value_uint(ctx, st->cb.puts);
+	fmt->dict_item(ctx, "get");
+	fmt->value_uint(ctx, st->cb.gets);
+	fmt->dict_item(ctx, "hit");
+	fmt->value_uint(ctx, st->cb.hits);
+	fmt->dict_item(ctx, "miss");
+	fmt->value_uint(ctx, st->cb.misses);
+	fmt->dict_item(ctx, "hitrate");
+	fmt->value_uint(ctx, st->cb.hitrate);
+	fmt->dict_end(ctx); /* bundle-cache */
+
+	fmt->dict_item(ctx, "csig_pool");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "threads");
+	fmt->value_uint(ctx, st->cp.threads);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->cp.qsize);
+	fmt->dict_item(ctx, "inflight");
+	fmt->value_uint(ctx, st->cp.inflight);
+	fmt->dict_item(ctx, "eval");
+	fmt->value_uint(ctx, st->cp.evals);
+	fmt->dict_item(ctx, "coalesced");
+	fmt->value_uint(ctx, st->cp.coalesced);
+	fmt->dict_item(ctx, "overlapped");
+	fmt->value_uint(ctx, st->cp.overlapped);
+	fmt->dict_item(ctx, "abandoned");
+	fmt->value_uint(ctx, st->cp.abandoned);
+	fmt->dict_item(ctx, "helpers");
+	fmt->value_uint(ctx, st->cp.helpers);
+	fmt->dict_item(ctx, "spawns");
+	fmt->value_uint(ctx, st->cp.spawns);
+	fmt->dict_item(ctx, "kills");
+	fmt->value_uint(ctx, st->cp.kills);
+	fmt->dict_end(ctx); /* csig-pool */
+
+	fmt->dict_item(ctx, "csig_refresh");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "rounds");
+	fmt->value_uint(ctx, st->cr.rounds);
+	fmt->dict_item(ctx, "checked");
+	fmt->value_uint(ctx, st->cr.checked);
+	fmt->dict_item(ctx, "changed");
+	fmt->value_uint(ctx, st->cr.changed);
+	fmt->dict_item(ctx, "skipped");
+	fmt->value_uint(ctx, st->cr.skipped);
+	fmt->dict_end(ctx); /* csig-refresh */
+
+	fmt->dict_item(ctx, "ldpl_cache");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->cl.used);
+	fmt->dict_item(ctx, "policy");
+	fmt->value_string(ctx, lrucache_policy_s(st->cl.policy));
+	fmt->dict_item(ctx, "bucketmax");
+	fmt->value_uint(ctx, st->cl.size);
+	fmt->dict_item(ctx, "protected");
+	fmt->value_uint(ctx, st->cl.protected);
+	fmt->dict_item(ctx, "bytes");
+	fmt->value_uint(ctx, st->cl.bytes);
+	fmt->dict_item(ctx, "grow");
+	fmt->value_uint(ctx, st->cl.grows);
+	fmt->dict_item(ctx, "put");
+	fmt->value_uint(ctx, st->cl.puts);
+	fmt->dict_item(ctx, "get");
+	fmt->value_uint(ctx, st->cl.gets);
+	fmt->dict_item(ctx, "hit");
+	fmt->value_uint(ctx, st->cl.hits);
+	fmt->dict_item(ctx, "miss");
+	fmt->value_uint(ctx, st->cl.misses);
+	fmt->dict_item(ctx, "hitrate");
+	fmt->value_uint(ctx, st->cl.hitrate);
+	fmt->dict_item(ctx, "inv");
+	fmt->value_uint(ctx, st->cl.invalids);
+	fmt->dict_item(ctx, "content");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->clc.used);
+	fmt->dict_item(ctx, "bucketmax");
+	fmt->value_uint(ctx, st->clc.size);
+	fmt->dict_item(ctx, "bytes");
+	fmt->value_uint(ctx, st->clc.bytes);
+	fmt->dict_item(ctx, "put");
+	fmt->value_uint(ctx, st->clc.puts);
+	fmt->dict_item(ctx, "get");
+	fmt->value_uint(ctx, st->clc.gets);
+	fmt->dict_item(ctx, "hit");
+	fmt->value_uint(ctx, st->clc.hits);
+	fmt->dict_item(ctx, "miss");
+	fmt->value_uint(ctx, st->clc.misses);
+	fmt->dict_item(ctx, "hitrate");
+	fmt->value_uint(ctx, st->clc.hitrate);
+	fmt->dict_end(ctx); /* content */
+	fmt->dict_end(ctx); /* ldpl-cache */
+
+	fmt->dict_item(ctx, "path_cache");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "buckets");
+	fmt->value_uint(ctx, st->pc.used);
+	fmt->dict_item(ctx, "bucketmax");
+	fmt->value_uint(ctx, st->pc.size);
+	fmt->dict_item(ctx, "bytes");
+	fmt->value_uint(ctx, st->pc.bytes);
+	fmt->dict_item(ctx, "put");
+	fmt->value_uint(ctx, st->pc.puts);
+	fmt->dict_item(ctx, "get");
+	fmt->value_uint(ctx, st->pc.gets);
+	fmt->dict_item(ctx, "hit");
+	fmt->value_uint(ctx, st->pc.hits);
+	fmt->dict_item(ctx, "miss");
+	fmt->value_uint(ctx, st->pc.misses);
+	fmt->dict_item(ctx, "hitrate");
+	fmt->value_uint(ctx, st->pc.hitrate);
+	fmt->dict_item(ctx, "inv");
+	fmt->value_uint(ctx, st->pc.invalids);
+	fmt->dict_end(ctx); /* path-cache */
+
+	fmt->dict_item(ctx, "pools");
+	fmt->list_begin(ctx);
+	for (uint32_t i = 0; i < st->pools; i++) {
+		fmt->list_item(ctx, "pool");
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "name");
+		fmt->value_string(ctx, st->pool[i].name);
+		fmt->dict_item(ctx, "used");
+		fmt->value_uint(ctx, st->pool[i].used);
+		fmt->dict_item(ctx, "hiwat");
+		fmt->value_uint(ctx, st->pool[i].hiwat);
+		fmt->dict_item(ctx, "slabs");
+		fmt->value_uint(ctx, st->pool[i].slabs);
+		fmt->dict_item(ctx, "allocs");
+		fmt->value_uint(ctx, st->pool[i].allocs);
+		fmt->dict_item(ctx, "bytes");
+		fmt->value_uint(ctx, st->pool[i].bytes);
+		fmt->dict_end(ctx);
+	}
+	fmt->list_end(ctx);
+
+	fmt->dict_item(ctx, "intern");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "strings");
+	fmt->value_uint(ctx, st->is.strings);
+	fmt->dict_item(ctx, "bytes");
+	fmt->value_uint(ctx, st->is.bytes);
+	fmt->dict_item(ctx, "lookups");
+	fmt->value_uint(ctx, st->is.lookups);
+	fmt->dict_item(ctx, "hits");
+	fmt->value_uint(ctx, st->is.hits);
+	fmt->dict_end(ctx); /* intern */
+
+	fmt->dict_item(ctx, "idname");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "hits");
+	fmt->value_uint(ctx, st->in.hits);
+	fmt->dict_item(ctx, "misses");
+	fmt->value_uint(ctx, st->in.misses);
+	fmt->dict_item(ctx, "refreshes");
+	fmt->value_uint(ctx, st->in.refreshes);
+	fmt->dict_end(ctx); /* idname */
+
+	fmt->dict_item(ctx, "fsclass");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "hits");
+	fmt->value_uint(ctx, st->fs.hits);
+	fmt->dict_item(ctx, "misses");
+	fmt->value_uint(ctx, st->fs.misses);
+	fmt->dict_item(ctx, "bulk");
+	fmt->value_uint(ctx, st->fs.bulk);
+	fmt->dict_item(ctx, "skip");
+	fmt->value_uint(ctx, st->fs.skip);
+	fmt->dict_end(ctx); /* fsclass */
+
+	fmt->dict_item(ctx, "mounts");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "mounted");
+	fmt->value_uint(ctx, st->mn.mounted);
+	fmt->dict_item(ctx, "unmounts");
+	fmt->value_uint(ctx, st->mn.unmounts);
+	fmt->dict_item(ctx, "purged");
+	fmt->value_uint(ctx, st->mn.purged);
+	fmt->dict_end(ctx); /* mounts */
+
+	fmt->dict_item(ctx, "threads");
+	fmt->dict_begin(ctx);
+	for (int i = 0; i < THRSTAT_CLASSES; i++) {
+		fmt->dict_item(ctx, thrstat_class_s(i));
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "threads");
+		fmt->value_uint(ctx, st->ts.threads[i]);
+		fmt->dict_item(ctx, "cpu_usecs");
+		fmt->value_uint(ctx, st->ts.usecs[i]);
+		fmt->dict_end(ctx);
+	}
+	fmt->dict_end(ctx); /* threads */
+
+	fmt->dict_item(ctx, "memory");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "rss");
+	fmt->value_uint(ctx, st->ts.rss);
+	fmt->dict_item(ctx, "rsspeak");
+	fmt->value_uint(ctx, st->ts.rsspeak);
+	fmt->dict_item(ctx, "footprint");
+	fmt->value_uint(ctx, st->ts.footprint);
+	fmt->dict_item(ctx, "accounted");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "pools");
+	fmt->value_uint(ctx, st->mem.pools);
+	fmt->dict_item(ctx, "argv");
+	fmt->value_uint(ctx, st->mem.argv);
+	fmt->dict_item(ctx, "frags");
+	fmt->value_uint(ctx, st->mem.frags);
+	fmt->dict_item(ctx, "fdpaths");
+	fmt->value_uint(ctx, st->mem.fdpaths);
+	fmt->dict_item(ctx, "codesign");
+	fmt->value_uint(ctx, st->mem.codesign);
+	fmt->dict_item(ctx, "intern");
+	fmt->value_uint(ctx, st->mem.intern);
+	fmt->dict_item(ctx, "caches");
+	fmt->value_uint(ctx, st->mem.caches);
+	fmt->dict_item(ctx, "queues");
+	fmt->value_uint(ctx, st->mem.queues);
+	fmt->dict_item(ctx, "total");
+	fmt->value_uint(ctx, st->mem.total);
+	fmt->dict_end(ctx); /* accounted */
+	fmt->dict_end(ctx); /* memory */
+
+	fmt->dict_item(ctx, "interval");
+	fmt->dict_begin(ctx);
+	fmt->dict_item(ctx, "msecs");
+	fmt->value_uint(ctx, st->iv.msecs);
+	fmt->dict_item(ctx, "eventrate");
+	fmt->list_begin(ctx);
 	for (int i = 0; i < LOGEVT_SIZE; i++) {
-		fmt->list_item(f, "event");
-		fmt->value_uint(f, st->lq.counts[i]);
-	}
-	fmt->list_end(f);
-	fmt->dict_item(f, "errors");
-	fmt->value_uint(f, st->lq.errors);
-	fmt->dict_end(f); /* log-queue */
-
-	fmt->dict_item(f, "hash_cache");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "buckets");
-	fmt->value_uint(f, st->ch.used);
-	fmt->dict_item(f, "bucketmax");
-	fmt->value_uint(f, st->ch.size);
-	fmt->dict_item(f, "put");
-	fmt->value_uint(f, st->ch.puts);
-	fmt->dict_item(f, "get");
-	fmt->value_uint(f, st->ch.gets);
-	fmt->dict_item(f, "hit");
-	fmt->value_uint(f, st->ch.hits);
-	fmt->dict_item(f, "miss");
-	fmt->value_uint(f, st->ch.misses);
-	fmt->dict_item(f, "inv");
-	fmt->value_uint(f, st->ch.invalids);
-	fmt->dict_end(f); /* hash-cache */
-
-	fmt->dict_item(f, "csig_cache");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "buckets");
-	fmt->value_uint(f, st->cc.used);
-	fmt->dict_item(f, "bucketmax");
-	fmt->value_uint(f, st->cc.size);
-	fmt->dict_item(f, "put");
-	fmt->value_uint(f, st->cc.puts);
-	fmt->dict_item(f, "get");
-	fmt->value_uint(f, st->cc.gets);
-	fmt->dict_item(f, "hit");
-	fmt->value_uint(f, st->cc.hits);
-	fmt->dict_item(f, "miss");
-	fmt->value_uint(f, st->cc.misses);
-	fmt->dict_item(f, "inv");
-	fmt->value_uint(f, st->cc.invalids);
-	fmt->dict_end(f); /* csig-cache */
-
-	fmt->dict_item(f, "ldpl_cache");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "buckets");
-	fmt->value_uint(f, st->cl.used);
-	fmt->dict_item(f, "bucketmax");
-	fmt->value_uint(f, st->cl.size);
-	fmt->dict_item(f, "put");
-	fmt->value_uint(f, st->cl.puts);
-	fmt->dict_item(f, "get");
-	fmt->value_uint(f, st->cl.gets);
-	fmt->dict_item(f, "hit");
-	fmt->value_uint(f, st->cl.hits);
-	fmt->dict_item(f, "miss");
-	fmt->value_uint(f, st->cl.misses);
-	fmt->dict_item(f, "inv");
-	fmt->value_uint(f, st->cl.invalids);
-	fmt->dict_end(f); /* ldpl-cache */
-
-	logevt_footer(fmt, f);
+		fmt->list_item(ctx, "event");
+		fmt->value_uint(ctx, st->iv.eps[i]);
+	}
+	fmt->list_end(ctx);
+	fmt->dict_item(ctx, "cpu");
+	fmt->dict_begin(ctx);
+	for (int i = 0; i < THRSTAT_CLASSES; i++) {
+		fmt->dict_item(ctx, thrstat_class_s(i));
+		fmt->value_uint(ctx, st->iv.cpu[i]);
+	}
+	fmt->dict_end(ctx); /* cpu */
+	fmt->dict_item(ctx, "hashbps");
+	fmt->value_uint(ctx, st->iv.hashbps);
+	fmt->dict_item(ctx, "csigevalrate");
+	fmt->value_uint(ctx, st->iv.csigps);
+	fmt->dict_item(ctx, "hash_cache_hitrate");
+	fmt->value_uint(ctx, st->iv.ch_hitrate);
+	fmt->dict_item(ctx, "csig_cache_hitrate");
+	fmt->value_uint(ctx, st->iv.cc_hitrate);
+	fmt->dict_item(ctx, "ldpl_cache_hitrate");
+	fmt->value_uint(ctx, st->iv.cl_hitrate);
+	fmt->dict_item(ctx, "aupi_cdevq_drop");
+	fmt->value_uint(ctx, st->iv.ap_drops);
+	fmt->dict_item(ctx, "work_queue_drop");
+	fmt->value_uint(ctx, st->iv.wq_drops);
+	fmt->dict_item(ctx, "log_queue_drop");
+	fmt->value_uint(ctx, st->iv.lq_drops);
+	fmt->dict_end(ctx); /* interval */
+
+	logevt_footer(fmt, ctx);
 	return 0;
 }
 
-static void
-logevt_image_exec_image(logfmt_t *fmt, FILE *f, image_exec_t *ie) {
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "path");
-	fmt->value_string(f, ie->path);
+/*
+ * Native slice of a universal binary, see hashes_slice().
+ */
+LOGEVT_RENDER void
+logevt_image_slice(logfmt_t *fmt, logfmt_ctx_t *ctx,
+                   const hashes_slice_t *slice) {
+	const char *arch;
+
+	fmt->dict_item(ctx, "slice");
+	fmt->dict_begin(ctx);
+	arch = hashes_slice_arch_s(slice);
+	if (arch) {
+		fmt->dict_item(ctx, "arch");
+		fmt->value_string(ctx, arch);
+	}
+	fmt->dict_item(ctx, "offset");
+	fmt->value_uint(ctx, slice->offset);
+	fmt->dict_item(ctx, "size");
+	fmt->value_uint(ctx, slice->size);
+	fmt->dict_item(ctx, "sha256");
+	fmt->value_buf_hex(ctx, slice->sha256, SHA256SZ);
+	fmt->dict_end(ctx); /* slice */
+}
+
+LOGEVT_RENDER void
+logevt_image_exec_image(logfmt_t *fmt, logfmt_ctx_t *ctx, image_exec_t *ie) {
+	fmt->dict_begin(ctx);
+	if (config->ancestor_ids || (ie->flags & EIFLAG_ENRICH)) {
+		fmt->dict_item(ctx, "image_id");
+		fmt->value_uint(ctx, ie->id);
+	}
+	fmt->dict_item(ctx, "path");
+	fmt->value_string(ctx, ie->path);
 	if (ie->flags & (EIFLAG_STAT|EIFLAG_ATTR)) {
 		if (!config->omit_mode) {
-			fmt->dict_item(f, "mode");
-			fmt->value_uint_oct(f, ie->stat.mode);
+			fmt->dict_item(ctx, "mode");
+			fmt->value_uint_oct(ctx, ie->stat.mode);
 		}
-		logevt_uid(fmt, f, ie->stat.uid, "uid", "uname");
+		logevt_uid(fmt, ctx, ie->stat.uid, "uid", "uname");
 		if (!config->omit_groups) {
-			logevt_gid(fmt, f, ie->stat.gid, "gid", "gname");
+			logevt_gid(fmt, ctx, ie->stat.gid, "gid", "gname");
 		}
 	}
 	if (ie->flags & EIFLAG_STAT) {
 		if (!config->omit_size) {
-			fmt->dict_item(f, "size");
-			fmt->value_uint(f, ie->stat.size);
+			fmt->dict_item(ctx, "size");
+			fmt->value_uint(ctx, ie->stat.size);
 		}
 		if (!config->omit_mtime) {
-			fmt->dict_item(f, "mtime");
-			fmt->value_timespec(f, &ie->stat.mtime);
+			fmt->dict_item(ctx, "mtime");
+			fmt->value_timespec(ctx, &ie->stat.mtime);
 		}
 		if (!config->omit_ctime) {
-			fmt->dict_item(f, "ctime");
-			fmt->value_timespec(f, &ie->stat.ctime);
+			fmt->dict_item(ctx, "ctime");
+			fmt->value_timespec(ctx, &ie->stat.ctime);
 		}
 		if (!config->omit_btime) {
-			fmt->dict_item(f, "btime");
-			fmt->value_timespec(f, &ie->stat.btime);
+			fmt->dict_item(ctx, "btime");
+			fmt->value_timespec(ctx, &ie->stat.btime);
 		}
 	}
 	if ((ie->flags & EIFLAG_HASHES) &&
@@ -510,396 +1896,735 @@ logevt_image_exec_image(logfmt_t *fmt, FILE *f, image_exec_t *ie) {
 	     !ie->codesign ||
 	     !codesign_is_apple_system(ie->codesign))) {
 		if (config->hflags & HASH_MD5) {
-			fmt->dict_item(f, "md5");
-			fmt->value_buf_hex(f, ie->hashes.md5, MD5SZ);
+			fmt->dict_item(ctx, "md5");
+			fmt->value_buf_hex(ctx, ie->hashes.md5, MD5SZ);
 		}
 		if (config->hflags & HASH_SHA1) {
-			fmt->dict_item(f, "sha1");
-			fmt->value_buf_hex(f, ie->hashes.sha1, SHA1SZ);
-		}
-		if (config->hflags & HASH_SHA256) {
-			fmt->dict_item(f, "sha256");
-			fmt->value_buf_hex(f, ie->hashes.sha256, SHA256SZ);
+			fmt->dict_item(ctx, "sha1");
+			fmt->value_buf_hex(ctx, ie->hashes.sha1, SHA1SZ);
 		}
-	}
-
-	if (ie->codesign) {
-		fmt->dict_item(f, "signature");
-		fmt->value_string(f, codesign_result_s(ie->codesign));
-		if (ie->codesign->origin) {
-			fmt->dict_item(f, "origin");
-			fmt->value_string(f, codesign_origin_s(ie->codesign));
-		}
-		if (ie->codesign->cdhash) {
-			fmt->dict_item(f, "cdhash");
-			fmt->value_buf_hex(f, ie->codesign->cdhash,
-			                      ie->codesign->cdhashsz);
+		if ((config->hflags & HASH_SHA256) &&
+		    !(ie->flags & EIFLAG_NOSHA256)) {
+			fmt->dict_item(ctx, "sha256");
+			fmt->value_buf_hex(ctx, ie->hashes.sha256, SHA256SZ);
 		}
-		if (ie->codesign->ident) {
-			fmt->dict_item(f, "ident");
-			fmt->value_string(f, ie->codesign->ident);
-		}
-		if (ie->codesign->teamid) {
-			fmt->dict_item(f, "teamid");
-			fmt->value_string(f, ie->codesign->teamid);
+		if (config->hflags & HASH_SHA256TREE) {
+			fmt->dict_item(ctx, "sha256tree");
+			fmt->value_buf_hex(ctx, ie->hashes.sha256tree,
+			                   SHA256SZ);
 		}
-		if (ie->codesign->certcn) {
-			fmt->dict_item(f, "certcn");
-			fmt->value_string(f, ie->codesign->certcn);
+		if (config->hflags & HASH_BLAKE3) {
+			fmt->dict_item(ctx, "blake3");
+			fmt->value_buf_hex(ctx, ie->hashes.blake3, BLAKE3SZ);
 		}
+		if (ie->slice)
+			logevt_image_slice(fmt, ctx, ie->slice);
 	}
-	fmt->dict_end(f); /* image */
+	if ((ie->flags & (EIFLAG_FSSKIP|EIFLAG_HASHES)) == EIFLAG_FSSKIP) {
+		fmt->dict_item(ctx, "unhashed");
+		fmt->value_bool(ctx, true);
+	}
+
+	if (ie->codesign)
+		logevt_codesign(fmt, ctx, ie->codesign);
+	fmt->dict_end(ctx); /* image */
 }
 
-static void
-logevt_process_image_exec(logfmt_t *fmt, FILE *f, image_exec_t *ie) {
-	fmt->dict_begin(f);
+/*
+ * With ancestor_ids, rendering an image in full records that it has been
+ * logged in the current log output, so that later ancestor lists can refer
+ * to it by its image_id only.
+ */
+LOGEVT_RENDER void
+logevt_process_image_exec(logfmt_t *fmt, logfmt_ctx_t *ctx, image_exec_t *ie) {
+	fmt->dict_begin(ctx);
+	if (config->ancestor_ids) {
+		fmt->dict_item(ctx, "image_id");
+		fmt->value_uint(ctx, ie->id);
+		ie->logepoch = ctx->epoch;
+	}
 	if (!(ie->flags & EIFLAG_PIDLOOKUP)) {
-		fmt->dict_item(f, "exec_time");
-		fmt->value_timespec(f, &ie->hdr.tv);
+		fmt->dict_item(ctx, "exec_time");
+		fmt->value_timespec(ctx, &ie->hdr.tv);
 	}
-	fmt->dict_item(f, "exec_pid");
-	fmt->value_int(f, ie->pid);
-	fmt->dict_item(f, "path");
-	fmt->value_string(f, ie->path);
+	fmt->dict_item(ctx, "exec_pid");
+	fmt->value_int(ctx, ie->pid);
+	fmt->dict_item(ctx, "path");
+	fmt->value_string(ctx, ie->path);
 	if ((ie->flags & EIFLAG_HASHES) &&
 	    (!config->omit_apple_hashes ||
 	     !ie->codesign ||
 	     !codesign_is_apple_system(ie->codesign))) {
 		if (config->hflags & HASH_MD5) {
-			fmt->dict_item(f, "md5");
-			fmt->value_buf_hex(f, ie->hashes.md5, MD5SZ);
+			fmt->dict_item(ctx, "md5");
+			fmt->value_buf_hex(ctx, ie->hashes.md5, MD5SZ);
 		}
 		if (config->hflags & HASH_SHA1) {
-			fmt->dict_item(f, "sha1");
-			fmt->value_buf_hex(f, ie->hashes.sha1, SHA1SZ);
+			fmt->dict_item(ctx, "sha1");
+			fmt->value_buf_hex(ctx, ie->hashes.sha1, SHA1SZ);
 		}
-		if (config->hflags & HASH_SHA256) {
-			fmt->dict_item(f, "sha256");
-			fmt->value_buf_hex(f, ie->hashes.sha256, SHA256SZ);
+		if ((config->hflags & HASH_SHA256) &&
+		    !(ie->flags & EIFLAG_NOSHA256)) {
+			fmt->dict_item(ctx, "sha256");
+			fmt->value_buf_hex(ctx, ie->hashes.sha256, SHA256SZ);
+		}
+		if (config->hflags & HASH_SHA256TREE) {
+			fmt->dict_item(ctx, "sha256tree");
+			fmt->value_buf_hex(ctx, ie->hashes.sha256tree,
+			                   SHA256SZ);
+		}
+		if (config->hflags & HASH_BLAKE3) {
+			fmt->dict_item(ctx, "blake3");
+			fmt->value_buf_hex(ctx, ie->hashes.blake3, BLAKE3SZ);
 		}
 	}
 	if (ie->codesign && codesign_is_good(ie->codesign)) {
 		if (ie->codesign->ident) {
-			fmt->dict_item(f, "ident");
-			fmt->value_string(f, ie->codesign->ident);
+			fmt->dict_item(ctx, "ident");
+			fmt->value_string(ctx, ie->codesign->ident);
 		}
 		if (ie->codesign->teamid) {
-			fmt->dict_item(f, "teamid");
-			fmt->value_string(f, ie->codesign->teamid);
+			fmt->dict_item(ctx, "teamid");
+			fmt->value_string(ctx, ie->codesign->teamid);
 		}
 	}
 	if (ie->script) {
-		fmt->dict_item(f, "script");
-		fmt->dict_begin(f);
-		fmt->dict_item(f, "path");
-		fmt->value_string(f, ie->script->path);
+		fmt->dict_item(ctx, "script");
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "path");
+		fmt->value_string(ctx, ie->script->path);
 		assert(!ie->script->codesign);
 		if (ie->script->flags & EIFLAG_HASHES) {
 			if (config->hflags & HASH_MD5) {
-				fmt->dict_item(f, "md5");
-				fmt->value_buf_hex(f,
+				fmt->dict_item(ctx, "md5");
+				fmt->value_buf_hex(ctx,
 				        ie->script->hashes.md5, MD5SZ);
 			}
 			if (config->hflags & HASH_SHA1) {
-				fmt->dict_item(f, "sha1");
-				fmt->value_buf_hex(f,
+				fmt->dict_item(ctx, "sha1");
+				fmt->value_buf_hex(ctx,
 				        ie->script->hashes.sha1, SHA1SZ);
 			}
-			if (config->hflags & HASH_SHA256) {
-				fmt->dict_item(f, "sha256");
-				fmt->value_buf_hex(f,
+			if ((config->hflags & HASH_SHA256) &&
+			    !(ie->script->flags & EIFLAG_NOSHA256)) {
+				fmt->dict_item(ctx, "sha256");
+				fmt->value_buf_hex(ctx,
 				        ie->script->hashes.sha256, SHA256SZ);
 			}
+			if (config->hflags & HASH_SHA256TREE) {
+				fmt->dict_item(ctx, "sha256tree");
+				fmt->value_buf_hex(ctx,
+				        ie->script->hashes.sha256tree,
+				        SHA256SZ);
+			}
+			if (config->hflags & HASH_BLAKE3) {
+				fmt->dict_item(ctx, "blake3");
+				fmt->value_buf_hex(ctx,
+				        ie->script->hashes.blake3, BLAKE3SZ);
+			}
 		}
-		fmt->dict_end(f); /* script */
+		fmt->dict_end(ctx); /* script */
 	}
-	fmt->dict_end(f); /* exec */
+	fmt->dict_end(ctx); /* exec */
 }
 
-static void
-logevt_process_image_exec_ancestors(logfmt_t *fmt, FILE *f, image_exec_t *ie) {
-	size_t depth = 0;
+/*
+ * Long-running processes such as shells, build tools and browsers are
+ * rendered as the subject of every socket and process access event they
+ * cause, and as an ancestor of every single one of their descendants.  Where
+ * the format driver supports it, the rendered image is cached in the image
+ * the first time it is rendered, and copied verbatim for later occurrences
+ * at the same depth in any event type.  Images still being processed can
+ * change and are never cached.  Each context caches its own renderings,
+ * which are only valid within the context epoch they were captured in; that
+ * changes when the output starts over or the log configuration is reloaded.
+ * Epochs are unique across contexts, such that outputs of different formats
+ * do not evict each other's renderings; stale ones are evicted as least
+ * recently used.
+ */
+#define LOGEVT_FRAGS_MAX        (2 * (LOG_FANOUT_MAX + 1))
+
+LOGEVT_RENDER void
+logevt_process_image_exec_cached(logfmt_t *fmt, logfmt_ctx_t *ctx,
+                                 image_exec_t *ie) {
+	image_frag_t *frag, **pp;
+	size_t n = 0;
 
-	fmt->list_begin(f);
+	if (!fmt->frag_begin || !(ie->flags & EIFLAG_DONE)) {
+		logevt_process_image_exec(fmt, ctx, ie);
+		return;
+	}
+	for (pp = &ie->frags; (frag = *pp); pp = &frag->next, n++) {
+		if (frag->epoch != ctx->epoch ||
+		    frag->level != ctx->indent_level)
+			continue;
+		if (pp != &ie->frags) {
+			*pp = frag->next;
+			frag->next = ie->frags;
+			ie->frags = frag;
+		}
+		fmt->frag_put(ctx, frag->buf, frag->sz);
+		if (config->ancestor_ids)
+			ie->logepoch = ctx->epoch;
+		return;
+	}
+	if (n == LOGEVT_FRAGS_MAX) {
+		for (pp = &ie->frags; (*pp)->next; pp = &(*pp)->next);
+		frag = *pp;
+		*pp = NULL;
+		image_exec_frags_account(-(int64_t)(sizeof(image_frag_t) +
+		                                    frag->sz));
+		free(frag->buf);
+	} else {
+		frag = malloc(sizeof(image_frag_t));
+		if (!frag) {
+			logevt_process_image_exec(fmt, ctx, ie);
+			return;
+		}
+	}
+	fmt->frag_begin(ctx);
+	logevt_process_image_exec(fmt, ctx, ie);
+	if (fmt->frag_end(ctx, &frag->buf, &frag->sz) == -1) {
+		free(frag);
+		return;
+	}
+	frag->epoch = ctx->epoch;
+	frag->level = ctx->indent_level;
+	frag->next = ie->frags;
+	ie->frags = frag;
+	image_exec_frags_account((int64_t)(sizeof(image_frag_t) + frag->sz));
+}
+
+/*
+ * With ancestor_ids, images are rendered in full only once per epoch and by
+ * image_id only thereafter.  Outputs with a field projection render
+ * ancestors in full every time, as they may not select the image_id.
+ */
+LOGEVT_RENDER void
+logevt_process_image_exec_ancestor(logfmt_t *fmt, logfmt_ctx_t *ctx,
+                                   image_exec_t *ie) {
+	if (config->ancestor_ids && ie->logepoch == ctx->epoch && !ctx->proj) {
+		fmt->dict_begin(ctx);
+		fmt->dict_item(ctx, "image_id");
+		fmt->value_uint(ctx, ie->id);
+		fmt->dict_end(ctx);
+		return;
+	}
+	logevt_process_image_exec_cached(fmt, ctx, ie);
+}
+
+/*
+ * Ancestors are walked without taking references:  the event's reference to
+ * its subject image pins the lineage, as every image holds a reference to its
+ * previous image, and image_exec_prune_ancestors only cuts off history beyond
+ * the configured number of ancestors.  Rendering is therefore free of
+ * refcount traffic on shared ancestors such as launchd's image.
+ */
+LOGEVT_RENDER void
+logevt_process_image_exec_ancestors(logfmt_t *fmt, logfmt_ctx_t *ctx,
+                                    image_exec_t *ie) {
+	size_t depth = 0, maxdepth = config->ancestors;
+
+	if (degrade_level() >= DEGRADE_ANCESTORS)
+		maxdepth = min(maxdepth, config->degrade_ancestors);
+	fmt->list_begin(ctx);
 	for (image_exec_t *pie = ie; pie && pie->pid > 0; pie = pie->prev) {
-		if (depth == config->ancestors)
+		if (depth == maxdepth) {
+			if (maxdepth < config->ancestors)
+				degrade_truncated_ancestors();
 			break;
-		fmt->list_item(f, "ancestor");
-		logevt_process_image_exec(fmt, f, pie);
+		}
+		assert(atomic64_load(&pie->refs) > 0);
+		fmt->list_item(ctx, "ancestor");
+		logevt_process_image_exec_ancestor(fmt, ctx, pie);
 		depth++;
 	}
-	fmt->list_end(f); /* process image exec ancestors */
+	fmt->list_end(ctx); /* process image exec ancestors */
 }
 
 /*
  * If we only know the pid and not the full process information, processpid
  * is != 0 and process must be ignored even if it is != NULL.
  */
-static void
-logevt_process(logfmt_t *fmt, FILE *f,
+LOGEVT_RENDER void
+logevt_process(logfmt_t *fmt, logfmt_ctx_t *ctx,
                audit_proc_t *process, pid_t processpid,
                image_exec_t *ie) {
-	fmt->dict_begin(f);
+	fmt->dict_begin(ctx);
 	if (ie && (ie->flags & EIFLAG_PIDLOOKUP)) {
-		fmt->dict_item(f, "reconstructed");
-		fmt->value_bool(f, true);
+		fmt->dict_item(ctx, "reconstructed");
+		fmt->value_bool(ctx, true);
 	}
 	if (processpid > 0) {
-		fmt->dict_item(f, "pid");
-		fmt->value_int(f, processpid);
+		fmt->dict_item(ctx, "pid");
+		fmt->value_int(ctx, processpid);
 	} else if (process) {
-		fmt->dict_item(f, "pid");
-		fmt->value_int(f, process->pid);
-		logevt_uid(fmt, f, process->auid, "auid", "auname");
-		logevt_uid(fmt, f, process->euid, "euid", "euname");
+		fmt->dict_item(ctx, "pid");
+		fmt->value_int(ctx, process->pid);
+		logevt_uid(fmt, ctx, process->auid, "auid", "auname");
+		logevt_uid(fmt, ctx, process->euid, "euid", "euname");
 		if (!config->omit_groups) {
-			logevt_gid(fmt, f, process->egid, "egid", "egname");
+			logevt_gid(fmt, ctx, process->egid, "egid", "egname");
 		}
-		logevt_uid(fmt, f, process->ruid, "ruid", "runame");
+		logevt_uid(fmt, ctx, process->ruid, "ruid", "runame");
 		if (!config->omit_groups) {
-			logevt_gid(fmt, f, process->rgid, "rgid", "rgname");
+			logevt_gid(fmt, ctx, process->rgid, "rgid", "rgname");
 		}
 		if (!config->omit_sid) {
-			fmt->dict_item(f, "sid");
-			fmt->value_uint(f, process->sid);
+			fmt->dict_item(ctx, "sid");
+			fmt->value_uint(ctx, process->sid);
 		}
 		if (process->dev != (dev_t)-1) {
-			fmt->dict_item(f, "dev");
-			fmt->value_ttydev(f, process->dev);
+			fmt->dict_item(ctx, "dev");
+			fmt->value_ttydev(ctx, process->dev);
 		}
 		if (!ipaddr_is_empty(&process->addr)) {
-			fmt->dict_item(f, "addr");
-			fmt->value_string(f, ipaddrtoa(&process->addr, NULL));
+			fmt->dict_item(ctx, "addr");
+			fmt->value_string(ctx, ipaddrtoa(&process->addr, NULL));
 		}
 	}
 	if (ie) {
 		if (ie->fork_tv.tv_sec > 0) {
-			fmt->dict_item(f, "fork_time");
-			fmt->value_timespec(f, &ie->fork_tv);
+			fmt->dict_item(ctx, "fork_time");
+			fmt->value_timespec(ctx, &ie->fork_tv);
+		}
+		if (logproj_wants(ctx, "image")) {
+			fmt->dict_item(ctx, "image");
+			logevt_process_image_exec_cached(fmt, ctx, ie);
 		}
-		fmt->dict_item(f, "image");
-		logevt_process_image_exec(fmt, f, ie);
-		if (config->ancestors > 0) {
-			fmt->dict_item(f, "ancestors");
-			logevt_process_image_exec_ancestors(fmt, f, ie->prev);
+		if (config->ancestors > 0 && logproj_wants(ctx, "ancestors")) {
+			fmt->dict_item(ctx, "ancestors");
+			logevt_process_image_exec_ancestors(fmt, ctx, ie->prev);
 		}
 	}
-	fmt->dict_end(f); /* process */
+	fmt->dict_end(ctx); /* process */
 }
 
-int
-logevt_image_exec(logfmt_t *fmt, FILE *f, void *arg0) {
+LOGEVT_RENDER int
+logevt_image_exec_render(logfmt_t *fmt, logfmt_ctx_t *ctx, void *arg0) {
 	image_exec_t *ie = (image_exec_t *)arg0;
 
-	logevt_header(fmt, f, (logevt_header_t *)arg0);
+	logevt_header(fmt, ctx, (logevt_header_t *)arg0);
 
 	if (ie->flags & EIFLAG_PIDLOOKUP) {
-		fmt->dict_item(f, "reconstructed");
-		fmt->value_bool(f, true);
+		fmt->dict_item(ctx, "reconstructed");
+		fmt->value_bool(ctx, true);
 	}
 
-	if (ie->argv) {
-		fmt->dict_item(f, "argv");
-		fmt->list_begin(f);
+	if (ie->argv && logproj_wants(ctx, "argv")) {
+		fmt->dict_item(ctx, "argv");
+		fmt->list_begin(ctx);
 		for (int i = 0; ie->argv[i]; i++) {
-			fmt->list_item(f, "arg");
-			fmt->value_string(f, ie->argv[i]);
+			fmt->list_item(ctx, "arg");
+			fmt->value_string(ctx, ie->argv[i]);
 		}
-		fmt->list_end(f); /* argv */
+		fmt->list_end(ctx); /* argv */
 	}
 
-	if (ie->envv) {
-		fmt->dict_item(f, "env");
-		fmt->list_begin(f);
+	if (ie->envv && logproj_wants(ctx, "env")) {
+		fmt->dict_item(ctx, "env");
+		fmt->list_begin(ctx);
 		for (int i = 0; ie->envv[i]; i++) {
-			fmt->list_item(f, "var");
-			fmt->value_string(f, ie->envv[i]);
+			fmt->list_item(ctx, "var");
+			fmt->value_string(ctx, ie->envv[i]);
 		}
-		fmt->list_end(f); /* env */
+		fmt->list_end(ctx); /* env */
 	}
 
 	if (ie->cwd) {
-		fmt->dict_item(f, "cwd");
-		fmt->value_string(f, ie->cwd);
+		fmt->dict_item(ctx, "cwd");
+		fmt->value_string(ctx, ie->cwd);
 	}
 
-	fmt->dict_item(f, "image");
-	logevt_image_exec_image(fmt, f, ie);
+	fmt->dict_item(ctx, "image");
+	logevt_image_exec_image(fmt, ctx, ie);
+	if (config->ancestor_ids)
+		ie->logepoch = ctx->epoch;
 
 	if (ie->script) {
-		fmt->dict_item(f, "script");
-		logevt_image_exec_image(fmt, f, ie->script);
+		fmt->dict_item(ctx, "script");
+		logevt_image_exec_image(fmt, ctx, ie->script);
 	}
 
-	fmt->dict_item(f, "subject");
-	logevt_process(fmt, f,
-	               (ie->flags & EIFLAG_PIDLOOKUP) ? NULL : &ie->subject, 0,
-	               ie->prev);
+	if (logproj_wants(ctx, "subject")) {
+		fmt->dict_item(ctx, "subject");
+		logevt_process(fmt, ctx, (ie->flags & EIFLAG_PIDLOOKUP) ?
+		                         NULL : &ie->subject, 0, ie->prev);
+	}
 
-	logevt_footer(fmt, f);
+	logevt_footer(fmt, ctx);
 	return 0;
 }
 
-int
-logevt_process_access(logfmt_t *fmt, FILE *f, void *arg0) {
-	process_access_t *pa = (process_access_t *)arg0;
-
-	logevt_header(fmt, f, (logevt_header_t *)arg0);
+/*
+ * Second phase of an image-exec logged in two phases, carrying the hashes
+ * and code signature acquired after the image-exec with the same image_id
+ * was logged.
+ */
+LOGEVT_RENDER int
+logevt_image_enrich_render(logfmt_t *fmt, logfmt_ctx_t *ctx, void *arg0) {
+	image_exec_t *ie = (image_exec_t *)arg0;
 
-	fmt->dict_item(f, "method");
-	fmt->value_string(f, pa->method);
+	logevt_header(fmt, ctx, (logevt_header_t *)arg0);
 
-	fmt->dict_item(f, "object");
-	logevt_process(fmt, f,
-	               &pa->object, pa->objectpid,
-	               pa->object_image_exec);
+	fmt->dict_item(ctx, "image");
+	logevt_image_exec_image(fmt, ctx, ie);
 
-	fmt->dict_item(f, "subject");
-	logevt_process(fmt, f,
-	               &pa->subject, 0,
-	               pa->subject_image_exec);
+	if (ie->script) {
+		fmt->dict_item(ctx, "script");
+		logevt_image_exec_image(fmt, ctx, ie->script);
+	}
 
-	logevt_footer(fmt, f);
+	logevt_footer(fmt, ctx);
 	return 0;
 }
 
-int
-logevt_launchd_add(logfmt_t *fmt, FILE *f, void *arg0) {
-	launchd_add_t *ldadd = (launchd_add_t *)arg0;
-
-	logevt_header(fmt, f, (logevt_header_t *)arg0);
+/*
+ * Render functions of the events described in logschema.h, generated by
+ * expanding each field X(KIND, LABEL, A, B, C) of the schema into
+ * LOGEVT_FIELD_KIND(LABEL, A, B, C) with the event in e.
+ */
+#define LOGEVT_FIELD(KIND, L, A, B, C) LOGEVT_FIELD_##KIND(L, A, B, C)
 
-	fmt->dict_item(f, "plist");
-	fmt->dict_begin(f);
-	fmt->dict_item(f, "path");
-	fmt->value_string(f, ldadd->plist_path);
-	fmt->dict_end(f); /* plist */
+#define LOGEVT_FIELD_STRING(L, A, B, C) \
+	fmt->dict_item(ctx, L); \
+	fmt->value_string(ctx, e->A);
 
-	fmt->dict_item(f, "program");
-	fmt->dict_begin(f);
-	if (ldadd->program_rpath) {
-		fmt->dict_item(f, "rpath");
-		fmt->value_string(f, ldadd->program_rpath);
-	}
-	if (ldadd->program_path) {
-		fmt->dict_item(f, "path");
-		fmt->value_string(f, ldadd->program_path);
+#define LOGEVT_FIELD_STRING_OPT(L, A, B, C) \
+	if (e->A) { \
+		fmt->dict_item(ctx, L); \
+		fmt->value_string(ctx, e->A); \
 	}
-	if (ldadd->program_argv) {
-		fmt->dict_item(f, "argv");
-		fmt->list_begin(f);
-		for (size_t i = 0; ldadd->program_argv[i]; i++) {
-			fmt->list_item(f, "arg");
-			fmt->value_string(f, ldadd->program_argv[i]);
-		}
-		fmt->list_end(f); /* argv */
-	}
-	fmt->dict_end(f); /* program */
 
-	if (!(ldadd->flags & LAFLAG_NOSUBJECT)) {
-		fmt->dict_item(f, "subject");
-		logevt_process(fmt, f,
-		               &ldadd->subject, 0,
-		               ldadd->subject_image_exec);
+#define LOGEVT_FIELD_PROTO(L, A, B, C) \
+	if (e->A) { \
+		fmt->dict_item(ctx, L); \
+		fmt->value_string(ctx, protocoltoa(e->A)); \
 	}
 
-	logevt_footer(fmt, f);
-	return 0;
-}
-
-int
-logevt_socket_listen(logfmt_t *fmt, FILE *f, void *arg0) {
-	socket_listen_t *so = (socket_listen_t *)arg0;
+#define LOGEVT_FIELD_UINT(L, A, B, C) \
+	fmt->dict_item(ctx, L); \
+	fmt->value_uint(ctx, e->A);
 
-	logevt_header(fmt, f, (logevt_header_t *)arg0);
+#define LOGEVT_FIELD_TIMESPEC(L, A, B, C) \
+	fmt->dict_item(ctx, L); \
+	fmt->value_timespec(ctx, &e->A);
 
-	if (so->protocol) {
-		fmt->dict_item(f, "proto");
-		fmt->value_string(f, protocoltoa(so->protocol));
+#define LOGEVT_FIELD_ADDRPORT(L, A, B, C) \
+	if (!ipaddr_is_empty(&e->A)) { \
+		fmt->dict_item(ctx, L "addr"); \
+		fmt->value_string(ctx, ipaddrtoa(&e->A, NULL)); \
+		fmt->dict_item(ctx, L "port"); \
+		fmt->value_uint(ctx, e->B); \
 	}
 
-	if (!ipaddr_is_empty(&so->sock_addr)) {
-		fmt->dict_item(f, "sockaddr");
-		fmt->value_string(f, ipaddrtoa(&so->sock_addr, NULL));
-		fmt->dict_item(f, "sockport");
-		fmt->value_uint(f, so->sock_port);
+#define LOGEVT_FIELD_AGGREGATE(L, A, B, C) \
+	if (e->A > 0) { \
+		fmt->dict_item(ctx, "count"); \
+		fmt->value_uint(ctx, e->A); \
+		fmt->dict_item(ctx, "last"); \
+		fmt->value_timespec(ctx, &e->B); \
 	}
 
-	fmt->dict_item(f, "subject");
-	logevt_process(fmt, f,
-	               &so->subject, 0,
-	               so->subject_image_exec);
-
-	logevt_footer(fmt, f);
-	return 0;
-}
+#define LOGEVT_FIELD_ARGV(L, A, B, C) \
+	if (e->A && logproj_wants(ctx, L)) { \
+		fmt->dict_item(ctx, L); \
+		fmt->list_begin(ctx); \
+		for (size_t i = 0; e->A[i]; i++) { \
+			fmt->list_item(ctx, "arg"); \
+			fmt->value_string(ctx, e->A[i]); \
+		} \
+		fmt->list_end(ctx); \
+	}
 
-int
-logevt_socket_accept(logfmt_t *fmt, FILE *f, void *arg0) {
-	socket_accept_t *so = (socket_accept_t *)arg0;
+#define LOGEVT_FIELD_DICT_BEGIN(L, A, B, C) \
+	fmt->dict_item(ctx, L); \
+	fmt->dict_begin(ctx);
 
-	logevt_header(fmt, f, (logevt_header_t *)arg0);
+#define LOGEVT_FIELD_DICT_END(L, A, B, C) \
+	fmt->dict_end(ctx);
 
-	if (so->protocol) {
-		fmt->dict_item(f, "proto");
-		fmt->value_string(f, protocoltoa(so->protocol));
+#define LOGEVT_FIELD_PROCESS(L, A, B, C) \
+	if (logproj_wants(ctx, L)) { \
+		fmt->dict_item(ctx, L); \
+		logevt_process(fmt, ctx, &e->A, e->C, e->B); \
 	}
 
-	if (!ipaddr_is_empty(&so->sock_addr)) {
-		fmt->dict_item(f, "sockaddr");
-		fmt->value_string(f, ipaddrtoa(&so->sock_addr, NULL));
-		fmt->dict_item(f, "sockport");
-		fmt->value_uint(f, so->sock_port);
+#define LOGEVT_FIELD_SUBJECT(L, A, B, C) \
+	if (logproj_wants(ctx, L)) { \
+		fmt->dict_item(ctx, L); \
+		logevt_process(fmt, ctx, &e->A, 0, e->B); \
 	}
 
-	if (!ipaddr_is_empty(&so->peer_addr)) {
-		fmt->dict_item(f, "peeraddr");
-		fmt->value_string(f, ipaddrtoa(&so->peer_addr, NULL));
-		fmt->dict_item(f, "peerport");
-		fmt->value_uint(f, so->peer_port);
+#define LOGEVT_FIELD_SUBJECT_UNLESS(L, A, B, C) \
+	if (!(e->flags & (C)) && logproj_wants(ctx, L)) { \
+		fmt->dict_item(ctx, L); \
+		logevt_process(fmt, ctx, &e->A, 0, e->B); \
 	}
 
-	fmt->dict_item(f, "subject");
-	logevt_process(fmt, f,
-	               &so->subject, 0,
-	               so->subject_image_exec);
-
-	logevt_footer(fmt, f);
-	return 0;
+#define LOGEVT_SCHEMA_RENDER(E, T, SCHEMA) \
+LOGEVT_RENDER int \
+logevt_##E##_render(logfmt_t *fmt, logfmt_ctx_t *ctx, void *arg0) { \
+	T *e = (T *)arg0; \
+\
+	logevt_header(fmt, ctx, (logevt_header_t *)arg0); \
+	SCHEMA(LOGEVT_FIELD) \
+	logevt_footer(fmt, ctx); \
+	return 0; \
 }
 
-int
-logevt_socket_connect(logfmt_t *fmt, FILE *f, void *arg0) {
-	socket_connect_t *so = (socket_connect_t *)arg0;
+LOGEVT_SCHEMA_RENDER(process_access, process_access_t,
+                     LOGSCHEMA_PROCESS_ACCESS)
+LOGEVT_SCHEMA_RENDER(launchd_add, launchd_add_t,
+                     LOGSCHEMA_LAUNCHD_ADD)
+LOGEVT_SCHEMA_RENDER(socket_listen, socket_listen_t,
+                     LOGSCHEMA_SOCKET_LISTEN)
+LOGEVT_SCHEMA_RENDER(socket_accept, socket_accept_t,
+                     LOGSCHEMA_SOCKET_ACCEPT)
+LOGEVT_SCHEMA_RENDER(socket_connect, socket_connect_t,
+                     LOGSCHEMA_SOCKET_CONNECT)
+LOGEVT_SCHEMA_RENDER(event_summary, event_summary_t,
+                     LOGSCHEMA_EVENT_SUMMARY)
 
-	logevt_header(fmt, f, (logevt_header_t *)arg0);
+/*
+ * Schema documentation, generated from the same tables.
+ */
+enum {
+	LOGEVT_KIND_STRING,
+	LOGEVT_KIND_STRING_OPT,
+	LOGEVT_KIND_PROTO,
+	LOGEVT_KIND_UINT,
+	LOGEVT_KIND_TIMESPEC,
+	LOGEVT_KIND_ADDRPORT,
+	LOGEVT_KIND_AGGREGATE,
+	LOGEVT_KIND_ARGV,
+	LOGEVT_KIND_DICT_BEGIN,
+	LOGEVT_KIND_DICT_END,
+	LOGEVT_KIND_PROCESS,
+	LOGEVT_KIND_SUBJECT,
+	LOGEVT_KIND_SUBJECT_UNLESS
+};
+
+typedef struct {
+	int kind;
+	const char *label;
+} logevt_field_t;
+
+#define LOGEVT_FIELD_DOC(KIND, L, A, B, C) {LOGEVT_KIND_##KIND, L},
+
+#define LOGEVT_SCHEMA_DOC(E, SCHEMA) \
+static const logevt_field_t logevt_##E##_schema[] = { \
+	SCHEMA(LOGEVT_FIELD_DOC) \
+	{-1, NULL} \
+};
+
+LOGEVT_SCHEMA_DOC(process_access, LOGSCHEMA_PROCESS_ACCESS)
+LOGEVT_SCHEMA_DOC(launchd_add, LOGSCHEMA_LAUNCHD_ADD)
+LOGEVT_SCHEMA_DOC(socket_listen, LOGSCHEMA_SOCKET_LISTEN)
+LOGEVT_SCHEMA_DOC(socket_accept, LOGSCHEMA_SOCKET_ACCEPT)
+LOGEVT_SCHEMA_DOC(socket_connect, LOGSCHEMA_SOCKET_CONNECT)
+LOGEVT_SCHEMA_DOC(event_summary, LOGSCHEMA_EVENT_SUMMARY)
+
+#define LOGEVT_SCHEMAS 6
+static const struct {
+	int code;
+	const char *name;
+	const logevt_field_t *fields;
+} logevt_schemas[LOGEVT_SCHEMAS] = {
+	{LOGEVT_PROCESS_ACCESS, "process-access", logevt_process_access_schema},
+	{LOGEVT_LAUNCHD_ADD,    "launchd-add",    logevt_launchd_add_schema},
+	{LOGEVT_SOCKET_LISTEN,  "socket-listen",  logevt_socket_listen_schema},
+	{LOGEVT_SOCKET_ACCEPT,  "socket-accept",  logevt_socket_accept_schema},
+	{LOGEVT_SOCKET_CONNECT, "socket-connect", logevt_socket_connect_schema},
+	{LOGEVT_EVENT_SUMMARY,  "event-summary",  logevt_event_summary_schema},
+};
 
-	if (so->protocol) {
-		fmt->dict_item(f, "proto");
-		fmt->value_string(f, protocoltoa(so->protocol));
-	}
+static void
+logevt_schema_field(FILE *f, int depth, const char *label, const char *type) {
+	fprintf(f, "%*s%-*s %s\n", 2 + depth * 2, "", 24 - depth * 2, label,
+	           type);
+}
 
-	if (!ipaddr_is_empty(&so->sock_addr)) {
-		fmt->dict_item(f, "sockaddr");
-		fmt->value_string(f, ipaddrtoa(&so->sock_addr, NULL));
-		fmt->dict_item(f, "sockport");
-		fmt->value_uint(f, so->sock_port);
+/*
+ * Print the fields of the events described in logschema.h, following the
+ * version, time and eventcode fields common to all events.  Optional fields
+ * are marked with a question mark.
+ */
+void
+logevt_schema(FILE *f) {
+	const logevt_field_t *fld;
+	char label[32];
+	int depth;
+
+	for (size_t i = 0; i < LOGEVT_SCHEMAS; i++) {
+		fprintf(f, "%s[%i]\n", logevt_schemas[i].name,
+		           logevt_schemas[i].code);
+		depth = 0;
+		for (fld = logevt_schemas[i].fields; fld->label; fld++) {
+			switch (fld->kind) {
+			case LOGEVT_KIND_STRING:
+				logevt_schema_field(f, depth, fld->label,
+				                    "string");
+				break;
+			case LOGEVT_KIND_STRING_OPT:
+			case LOGEVT_KIND_PROTO:
+				logevt_schema_field(f, depth, fld->label,
+				                    "string?");
+				break;
+			case LOGEVT_KIND_UINT:
+				logevt_schema_field(f, depth, fld->label,
+				                    "uint");
+				break;
+			case LOGEVT_KIND_TIMESPEC:
+				logevt_schema_field(f, depth, fld->label,
+				                    "time");
+				break;
+			case LOGEVT_KIND_ADDRPORT:
+				snprintf(label, sizeof(label), "%saddr",
+				         fld->label);
+				logevt_schema_field(f, depth, label, "string?");
+				snprintf(label, sizeof(label), "%sport",
+				         fld->label);
+				logevt_schema_field(f, depth, label, "uint?");
+				break;
+			case LOGEVT_KIND_AGGREGATE:
+				logevt_schema_field(f, depth, "count", "uint?");
+				logevt_schema_field(f, depth, "last", "time?");
+				break;
+			case LOGEVT_KIND_ARGV:
+				logevt_schema_field(f, depth, fld->label,
+				                    "list of string?");
+				break;
+			case LOGEVT_KIND_DICT_BEGIN:
+				logevt_schema_field(f, depth, fld->label,
+				                    "dict");
+				depth++;
+				break;
+			case LOGEVT_KIND_DICT_END:
+				depth--;
+				break;
+			case LOGEVT_KIND_PROCESS:
+			case LOGEVT_KIND_SUBJECT:
+				logevt_schema_field(f, depth, fld->label,
+				                    "process");
+				break;
+			case LOGEVT_KIND_SUBJECT_UNLESS:
+				logevt_schema_field(f, depth, fld->label,
+				                    "process?");
+				break;
+			default:
+				assert(0);
+				break;
+			}
+		}
 	}
+}
 
-	if (!ipaddr_is_empty(&so->peer_addr)) {
-		fmt->dict_item(f, "peeraddr");
-		fmt->value_string(f, ipaddrtoa(&so->peer_addr, NULL));
-		fmt->dict_item(f, "peerport");
-		fmt->value_uint(f, so->peer_port);
-	}
+#define LOGEVT_GENERIC(E) \
+int \
+logevt_##E(logfmt_t *fmt, logfmt_ctx_t *ctx, void *arg0) { \
+	return logevt_##E##_render(fmt, ctx, arg0); \
+}
+LOGEVT_GENERIC(image_exec)
+LOGEVT_GENERIC(process_access)
+LOGEVT_GENERIC(launchd_add)
+LOGEVT_GENERIC(socket_listen)
+LOGEVT_GENERIC(socket_accept)
+LOGEVT_GENERIC(socket_connect)
+LOGEVT_GENERIC(event_summary)
+LOGEVT_GENERIC(image_enrich)
+
+static const logevt_func_t logevt_generic[LOGEVT_SIZE] = {
+	logevt_xnumon_ops,
+	logevt_xnumon_stats,
+	logevt_image_exec,
+	logevt_process_access,
+	logevt_launchd_add,
+	logevt_socket_listen,
+	logevt_socket_accept,
+	logevt_socket_connect,
+	logevt_event_summary,
+	logevt_image_enrich
+};
+_Static_assert(LOGEVT_SIZE == 10, "number of logevt types initialized above");
+
+#ifdef LOGFMT_SPECIALIZE
+/*
+ * Driver tables with the mode fixed at compile time.  They have no init
+ * function because they are never registered as log formats; they only
+ * stand in for logfmtjson, logfmtxml and logfmtyaml when rendering through
+ * the specialized renderers below.  The xnumon-ops and xnumon-stats events
+ * are rare and stay generic.
+ */
+LOGFMTJSON_MODE(logevt_json1, true)
+LOGFMTJSON_MODE(logevt_jsonm, false)
+LOGFMTXML_MODE(logevt_xml1, true)
+LOGFMTXML_MODE(logevt_xmlm, false)
+
+static const logfmt_t logevt_fmt_json1 = LOGFMTJSON_DRIVER("json", NULL,
+                                        logfmtjson_record_begin_jsonlines,
+                                        logevt_json1);
+static const logfmt_t logevt_fmt_jsonm = LOGFMTJSON_DRIVER("json", NULL,
+                                        logfmtjson_record_begin_jsonlines,
+                                        logevt_jsonm);
+static const logfmt_t logevt_fmt_xml1 = LOGFMTXML_DRIVER("xml", NULL,
+                                                         logevt_xml1);
+static const logfmt_t logevt_fmt_xmlm = LOGFMTXML_DRIVER("xml", NULL,
+                                                         logevt_xmlm);
+static const logfmt_t logevt_fmt_yamlm = LOGFMTYAML_DRIVER("yaml", NULL);
+
+#define LOGEVT_VARIANT(E, V) \
+static int \
+logevt_##E##_##V(UNUSED logfmt_t *fmt, logfmt_ctx_t *ctx, void *arg0) { \
+	return logevt_##E##_render((logfmt_t *)&logevt_fmt_##V, ctx, arg0); \
+}
 
-	fmt->dict_item(f, "subject");
-	logevt_process(fmt, f,
-	               &so->subject, 0,
-	               so->subject_image_exec);
+#define LOGEVT_VARIANTS(V) \
+LOGEVT_VARIANT(image_exec, V) \
+LOGEVT_VARIANT(process_access, V) \
+LOGEVT_VARIANT(launchd_add, V) \
+LOGEVT_VARIANT(socket_listen, V) \
+LOGEVT_VARIANT(socket_accept, V) \
+LOGEVT_VARIANT(socket_connect, V) \
+LOGEVT_VARIANT(event_summary, V) \
+LOGEVT_VARIANT(image_enrich, V) \
+static const logevt_func_t logevt_##V[LOGEVT_SIZE] = { \
+	logevt_xnumon_ops, \
+	logevt_xnumon_stats, \
+	logevt_image_exec_##V, \
+	logevt_process_access_##V, \
+	logevt_launchd_add_##V, \
+	logevt_socket_listen_##V, \
+	logevt_socket_accept_##V, \
+	logevt_socket_connect_##V, \
+	logevt_event_summary_##V, \
+	logevt_image_enrich_##V \
+};
+
+LOGEVT_VARIANTS(json1)
+LOGEVT_VARIANTS(jsonm)
+LOGEVT_VARIANTS(xml1)
+LOGEVT_VARIANTS(xmlm)
+LOGEVT_VARIANTS(yamlm)
+#endif
 
-	logevt_footer(fmt, f);
-	return 0;
+/*
+ * Returns the renderers to use for events in log format fmt in the given
+ * mode, indexed by event code.  These are the specialized renderers where
+ * available, else the generic ones that render through fmt.
+ */
+const logevt_func_t *
+logevt_renderers(logfmt_t *fmt, bool oneline) {
+#ifdef LOGFMT_SPECIALIZE
+	if (fmt == &logfmtjson)
+		return oneline ? logevt_json1 : logevt_jsonm;
+	if (fmt == &logfmtxml)
+		return oneline ? logevt_xml1 : logevt_xmlm;
+	if (fmt == &logfmtyaml && !oneline)
+		return logevt_yamlm;
+#else
+	(void)fmt;
+	(void)oneline;
+#endif
+	return logevt_generic;
 }
-
@@ -13,12 +13,14 @@
 
 #include "logfmt.h"
 #include "config.h"
+#include "codesign.h"
 #include "attrib.h"
 
 #include "tommylist.h"
 
 #include <time.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdio.h>
 
 /*
@@ -51,11 +53,46 @@ typedef struct {
 #define LOGEVT_SOCKET_LISTEN    5       /* socket_listen_t */
 #define LOGEVT_SOCKET_ACCEPT    6       /* socket_accept_t */
 #define LOGEVT_SOCKET_CONNECT   7       /* socket_connect_t */
-#define LOGEVT_SIZE             8
+#define LOGEVT_EVENT_SUMMARY    8       /* event_summary_t */
+#define LOGEVT_IMAGE_ENRICH     9       /* image_exec_t */
+#define LOGEVT_SIZE             10
 	struct timespec tv;
 	logevt_work_func_t le_work;
 	logevt_free_func_t le_free;
+	/* work stage state; affinity is set by the submitting subsystem to
+	 * the object that work items must not be processed concurrently for,
+	 * typically the subject image_exec_t, or NULL; bulk is set by the
+	 * submitting subsystem for items expected to take long, such as
+	 * hashing large images, and by the work stage for all items routed
+	 * to the bulk lane; priority is set by the submitting subsystem for
+	 * items that do not depend on earlier items of the same affinity and
+	 * cleared by the work stage for all items not routed to the priority
+	 * lane; suppressed is set by le_work when returning -1 because the
+	 * event is suppressed by configuration; epoch is set by the work stage
+	 * to the routing epoch of items in the normal lanes */
+	const void *affinity;
+	uint64_t seq;
+	uint32_t epoch;
+	bool bulk;
+	bool priority;
+	bool discard;
+	bool suppressed;
 	tommy_node node;
+	/* latency tracing; monotonic nsec at which the event passed each
+	 * stage boundary, or 0 if it did not pass through that stage; the
+	 * event stamp is tv translated to the monotonic clock at submission,
+	 * and trace is set by the log stage for events sampled to be logged
+	 * with their per-stage latency */
+	uint64_t stamp[7];
+#define LOGEVT_STAMP_EVENT      0       /* tv */
+#define LOGEVT_STAMP_SUBMIT     1       /* work_submit */
+#define LOGEVT_STAMP_WORK       2       /* dequeued by worker */
+#define LOGEVT_STAMP_WORKED     3       /* le_work done */
+#define LOGEVT_STAMP_PASS       4       /* log_submit */
+#define LOGEVT_STAMP_LOG        5       /* dequeued by logger */
+#define LOGEVT_STAMP_LOGGED     6       /* rendered and written */
+#define LOGEVT_STAMPS           7
+	bool trace;
 } logevt_header_t;
 
 #define LOGEVT_FLAG(E)          (1 << (E))
@@ -66,21 +103,61 @@ typedef struct {
                                 LOGEVT_FLAG(LOGEVT_SOCKET_ACCEPT)|\
                                 LOGEVT_FLAG(LOGEVT_SOCKET_CONNECT)
 
+#define XNUMON_STAGES_MAX       16
+
+typedef struct {
+	const char *name;       /* static */
+	uint64_t nsec;
+} xnumon_stage_t;
+
 typedef struct {
 	logevt_header_t hdr;
 
 	const char *subtype;
+	uint64_t startup;       /* nsec since start, 0 if not applicable */
+	size_t stages;
+	xnumon_stage_t stage[XNUMON_STAGES_MAX];
+	const char *reason;     /* static, degrade only, else NULL */
+	unsigned int level;     /* degrade and shed only */
+	unsigned int prevlevel; /* degrade and shed only */
+	uint64_t footprint;     /* bytes, shed only */
+	uint64_t budget;        /* bytes, shed only, else 0 */
+	int changes;            /* CONFIG_CHANGED_*, reload only, else 0 */
+	char *path;             /* revalidate only, else NULL */
+	codesign_t *codesign;   /* revalidate only */
+	codesign_t *prevcodesign; /* revalidate only */
+	uint64_t rotate_requested; /* mononsec, rotate only, else 0 */
+	uint64_t rotate_open;   /* nsec reopening took, rotate only */
+	uint64_t rotate_latency; /* nsec until switched, rotate only */
 } xnumon_ops_t;
 
-int logevt_xnumon_ops(logfmt_t *, FILE *, void *) NONNULL(1,2,3) WUNRES;
-int logevt_xnumon_stats(logfmt_t *, FILE *, void *) NONNULL(1,2,3) WUNRES;
-int logevt_image_exec(logfmt_t *, FILE *, void *) NONNULL(1,2,3) WUNRES;
-int logevt_process_access(logfmt_t *, FILE *, void *) NONNULL(1,2,3) WUNRES;
-int logevt_launchd_add(logfmt_t *, FILE *, void *) NONNULL(1,2,3) WUNRES;
-int logevt_socket_listen(logfmt_t *, FILE *, void *) NONNULL(1,2,3) WUNRES;
-int logevt_socket_accept(logfmt_t *, FILE *, void *) NONNULL(1,2,3) WUNRES;
-int logevt_socket_connect(logfmt_t *, FILE *, void *) NONNULL(1,2,3) WUNRES;
+typedef int (*logevt_func_t)(logfmt_t *, logfmt_ctx_t *, void *)
+             NONNULL(1,2) WUNRES;
+
+int logevt_xnumon_ops(logfmt_t *, logfmt_ctx_t *, void *)
+    NONNULL(1,2,3) WUNRES;
+int logevt_xnumon_stats(logfmt_t *, logfmt_ctx_t *, void *)
+    NONNULL(1,2,3) WUNRES;
+int logevt_image_exec(logfmt_t *, logfmt_ctx_t *, void *)
+    NONNULL(1,2,3) WUNRES;
+int logevt_process_access(logfmt_t *, logfmt_ctx_t *, void *)
+    NONNULL(1,2,3) WUNRES;
+int logevt_launchd_add(logfmt_t *, logfmt_ctx_t *, void *)
+    NONNULL(1,2,3) WUNRES;
+int logevt_socket_listen(logfmt_t *, logfmt_ctx_t *, void *)
+    NONNULL(1,2,3) WUNRES;
+int logevt_socket_accept(logfmt_t *, logfmt_ctx_t *, void *)
+    NONNULL(1,2,3) WUNRES;
+int logevt_socket_connect(logfmt_t *, logfmt_ctx_t *, void *)
+    NONNULL(1,2,3) WUNRES;
+int logevt_event_summary(logfmt_t *, logfmt_ctx_t *, void *)
+    NONNULL(1,2,3) WUNRES;
+int logevt_image_enrich(logfmt_t *, logfmt_ctx_t *, void *)
+    NONNULL(1,2,3) WUNRES;
+
+const logevt_func_t *logevt_renderers(logfmt_t *, bool) NONNULL(1) WUNRES;
 
+void logevt_schema(FILE *) NONNULL(1);
 void logevt_init(config_t *);
 
 #endif
@@ -0,0 +1,35 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "logfmt.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Initialize a rendering context.  The caller sets `f' before rendering each
+ * record.  The record buffer is allocated lazily and reused across records.
+ */
+void
+logfmt_ctx_init(logfmt_ctx_t *ctx) {
+	bzero(ctx, sizeof(logfmt_ctx_t));
+	logutl_tscache_init(&ctx->ts);
+	ctx->frag = SIZE_MAX;
+	ctx->epoch = 1;
+}
+
+void
+logfmt_ctx_fini(logfmt_ctx_t *ctx) {
+	if (ctx->priv && ctx->priv_free)
+		ctx->priv_free(ctx->priv);
+	ctx->priv = NULL;
+	logbuf_fini(&ctx->buf);
+}
+
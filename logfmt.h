@@ -13,29 +13,74 @@
 
 #include "attrib.h"
 #include "config.h"
+#include "logbuf.h"
+#include "logutl.h"
 
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <assert.h>
+#include <string.h>
 #include <time.h>
 
 #define LOGFMT_INDENT_MAX 5
+/* double the max depth because lists need two levels in XML */
+#define LOGFMT_DEPTH_MAX (LOGFMT_INDENT_MAX*2)
+
+/*
+ * Rendering state of a log record.  Format drivers keep all state that
+ * changes while rendering in the context instead of in globals, so that
+ * records can be rendered concurrently using one context per thread.
+ * Configuration set by lf_init is shared and read-only while rendering.
+ * A context must only ever be used with a single format driver.
+ */
+typedef struct {
+	FILE *f;                /* output */
+	logbuf_t buf;           /* record buffer of buffering drivers */
+	size_t indent_level;
+	bool indent_used[LOGFMT_DEPTH_MAX+1];
+	const char *tags[LOGFMT_DEPTH_MAX+1];   /* xml */
+	size_t tags_next;                       /* xml */
+	bool reuse_line;                        /* yaml */
+	logutl_tscache_t ts;
+	bool restart;           /* output starts over, e.g. after reopening */
+	uint64_t epoch;         /* incremented whenever output starts over */
+	size_t frag;            /* start of captured fragment, or SIZE_MAX */
+	void *proj;             /* field projection state, see logproj.h */
+	void *priv;             /* driver private state */
+	void (*priv_free)(void *);
+} logfmt_ctx_t;
+
+/*
+ * Binary format drivers write every record as a frame consisting of a 32 bit
+ * big-endian payload length followed by the payload, such that readers can
+ * skip records without decoding them and destinations can locate the end of
+ * the last complete record.
+ */
+#define LOGFMT_FRAME_HDRSZ 4
+
+void logfmt_ctx_init(logfmt_ctx_t *) NONNULL(1);
+void logfmt_ctx_fini(logfmt_ctx_t *) NONNULL(1);
 
 typedef int (*logfmt_init_func_t)(config_t *);
-typedef void (*logfmt_noarg_func_t)(FILE *);
-typedef void (*logfmt_bool_func_t)(FILE *, bool);
-typedef void (*logfmt_int_func_t)(FILE *, int64_t);
-typedef void (*logfmt_uint_func_t)(FILE *, uint64_t);
-typedef void (*logfmt_timespec_func_t)(FILE *, struct timespec *);
-typedef void (*logfmt_ttydev_func_t)(FILE *, dev_t);
-typedef void (*logfmt_buf_func_t)(FILE *, const unsigned char *, size_t);
-typedef void (*logfmt_cchar_func_t)(FILE *, const char *);
+typedef void (*logfmt_noarg_func_t)(logfmt_ctx_t *);
+typedef void (*logfmt_bool_func_t)(logfmt_ctx_t *, bool);
+typedef void (*logfmt_int_func_t)(logfmt_ctx_t *, int64_t);
+typedef void (*logfmt_uint_func_t)(logfmt_ctx_t *, uint64_t);
+typedef void (*logfmt_timespec_func_t)(logfmt_ctx_t *, struct timespec *);
+typedef void (*logfmt_ttydev_func_t)(logfmt_ctx_t *, dev_t);
+typedef void (*logfmt_buf_func_t)(logfmt_ctx_t *, const unsigned char *,
+                                  size_t);
+typedef void (*logfmt_cchar_func_t)(logfmt_ctx_t *, const char *);
+typedef int (*logfmt_frag_end_func_t)(logfmt_ctx_t *, char **, size_t *);
+typedef void (*logfmt_frag_put_func_t)(logfmt_ctx_t *, const char *, size_t);
 
 typedef struct {
 	/* meta information */
 	const char *lf_name;
 	bool lf_oneline;                /* supports compact */
 	bool lf_multiline;              /* supports multi-line */
+	bool lf_binary;                 /* not text, needs binary logdst */
 	logfmt_init_func_t lf_init;
 
 	/* actual render functions */
@@ -56,7 +101,149 @@ typedef struct {
 	logfmt_ttydev_func_t    value_ttydev;
 	logfmt_buf_func_t       value_buf_hex;
 	logfmt_cchar_func_t     value_string;
+
+	/*
+	 * Optional fragment capture for values that are rendered repeatedly.
+	 * The output of all render calls between frag_begin and frag_end is
+	 * returned by frag_end in a newly allocated buffer, which frag_put
+	 * can later emit again in place of the same render calls, provided
+	 * that the context is at the same indent_level.  frag_end returns
+	 * -1 if the fragment could not be captured.
+	 */
+	logfmt_noarg_func_t     frag_begin;
+	logfmt_frag_end_func_t  frag_end;
+	logfmt_frag_put_func_t  frag_put;
 } logfmt_t;
 
+/*
+ * Output primitives of the buffering text format drivers.  Records are
+ * rendered into the context's growable buffer that is written to the FILE
+ * in one go by logfmt_flush at the end of the record, instead of going
+ * through stdio for every single token.  Should growing the buffer fail,
+ * output falls back to writing to the FILE directly, which also ends any
+ * fragment capture in progress.
+ */
+static inline void
+logfmt_write(logfmt_ctx_t *ctx, const void *p, size_t sz) {
+	if (logbuf_write(&ctx->buf, p, sz) == 0)
+		return;
+	if (ctx->buf.len > 0) {
+		fwrite(ctx->buf.buf, ctx->buf.len, 1, ctx->f);
+		logbuf_reset(&ctx->buf);
+	}
+	fwrite(p, sz, 1, ctx->f);
+	ctx->frag = SIZE_MAX;
+}
+
+#define logfmt_puts(C,S) logfmt_write((C), (S), sizeof(S) - 1)
+
+static inline void
+logfmt_putc(logfmt_ctx_t *ctx, char c) {
+	if (logbuf_putc(&ctx->buf, c) == 0)
+		return;
+	logfmt_write(ctx, &c, 1);
+}
+
+static inline void
+logfmt_flush(logfmt_ctx_t *ctx) {
+	if (ctx->buf.len > 0) {
+		fwrite(ctx->buf.buf, ctx->buf.len, 1, ctx->f);
+		logbuf_reset(&ctx->buf);
+	}
+}
+
+/*
+ * A newline followed by the indentation of the deepest level; indentation
+ * to level n is the 2 * n bytes after the newline.
+ */
+static const char logfmt_indent[] = "\n                    ";
+_Static_assert(sizeof(logfmt_indent) == 2 * LOGFMT_DEPTH_MAX + 2,
+               "indentation for LOGFMT_DEPTH_MAX levels");
+
+static inline void
+logfmt_indent_to(logfmt_ctx_t *ctx, size_t level, bool newline) {
+	assert(level <= LOGFMT_DEPTH_MAX);
+	if (newline)
+		logfmt_write(ctx, logfmt_indent, 1 + level * 2);
+	else
+		logfmt_write(ctx, logfmt_indent + 1, level * 2);
+}
+
+/*
+ * Write the decimal representation of `value' right-aligned into the bytes
+ * before `end', padded with '0' to at least `width' digits.  Returns a
+ * pointer to the first digit.
+ */
+static inline char *
+logfmt_utoa(char *end, uint64_t value, size_t width) {
+	char *p = end;
+
+	do {
+		*--p = '0' + (value % 10);
+		value /= 10;
+	} while (value > 0);
+	while ((size_t)(end - p) < width)
+		*--p = '0';
+	return p;
+}
+
+/*
+ * Same for octal, without any leading '0'.
+ */
+static inline char *
+logfmt_otoa(char *end, uint64_t value) {
+	char *p = end;
+
+	do {
+		*--p = '0' + (value & 7);
+		value >>= 3;
+	} while (value > 0);
+	return p;
+}
+
+static inline void
+logfmt_write_int(logfmt_ctx_t *ctx, int64_t value) {
+	char s[21], *p;
+
+	if (value < 0) {
+		/* avoid overflow negating INT64_MIN */
+		p = logfmt_utoa(s + sizeof(s), -(uint64_t)value, 0);
+		*--p = '-';
+	} else {
+		p = logfmt_utoa(s + sizeof(s), (uint64_t)value, 0);
+	}
+	logfmt_write(ctx, p, s + sizeof(s) - p);
+}
+
+static inline void
+logfmt_write_uint(logfmt_ctx_t *ctx, uint64_t value) {
+	char s[20], *p;
+
+	p = logfmt_utoa(s + sizeof(s), value, 0);
+	logfmt_write(ctx, p, s + sizeof(s) - p);
+}
+
+static inline void
+logfmt_write_timespec(logfmt_ctx_t *ctx, struct timespec *tv) {
+	char s[LOGUTL_TIMESTAMPSZ];
+
+	logutl_timestamp(s, tv, &ctx->ts);
+	logfmt_write(ctx, s, sizeof(s));
+}
+
+static inline void
+logfmt_write_hex(logfmt_ctx_t *ctx, const unsigned char *p, size_t sz) {
+	char s[64];
+	size_t n;
+
+	while (sz > 0) {
+		n = sz < sizeof(s) / 2 ? sz : sizeof(s) / 2;
+		logutl_hex(s, p, n);
+		logfmt_write(ctx, s, 2 * n);
+		p += n;
+		sz -= n;
+	}
+}
+
 #endif
 
@@ -0,0 +1,800 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+/*
+ * CBOR log format driver and decoder.
+ *
+ * Records are written as length-prefixed frames, see logfmt.h, with a payload
+ * as described in logfmtcbor.h.  Dicts are indefinite-length maps, lists are
+ * indefinite-length arrays whose first element is the label of the list items
+ * if the list is not empty, byte buffers are byte strings and strings are
+ * text strings or references into the string dictionary.  Repeated keys and
+ * values such as paths and code signing identities therefore cost only a few
+ * bytes after their first occurrence.
+ */
+
+#include "logfmtcbor.h"
+#include "logevt.h"
+
+#include "sys.h"
+
+#include "tommyhash.h"
+#include "tommyhashinc.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#define CBOR_UINT       0
+#define CBOR_NINT       1
+#define CBOR_BYTES      2
+#define CBOR_TEXT       3
+#define CBOR_ARRAY      4
+#define CBOR_MAP        5
+#define CBOR_TAG        6
+#define CBOR_SIMPLE     7
+
+#define CBOR_FALSE      20
+#define CBOR_TRUE       21
+#define CBOR_NULL       22
+#define CBOR_INDEF      31
+#define CBOR_INDEF_ARG  UINT64_MAX      /* decoded argument if indefinite */
+
+#define CBOR_BREAK      0xFF
+
+#define LOGFMTCBOR_DICT_ELIGIBLE(SZ) \
+	((SZ) >= LOGFMTCBOR_DICT_MINLEN && (SZ) <= LOGFMTCBOR_DICT_MAXLEN)
+#define LOGFMTCBOR_DICT_ROOM(CNT, BYTES, SZ) \
+	((CNT) < LOGFMTCBOR_DICT_MAX && (BYTES) + (SZ) <= LOGFMTCBOR_DICT_BYTES)
+
+typedef struct {
+	tommy_node node;
+	uint32_t idx;
+	size_t sz;
+	char s[];
+} logfmtcbor_str_t;
+
+/*
+ * Writer state, kept in the rendering context.
+ */
+typedef struct {
+	tommy_hashinc dict;
+	uint32_t count;
+	size_t bytes;
+	uint32_t records;               /* since last reset */
+	bool reset;                     /* reset before next record */
+	bool failed;                    /* current record is incomplete */
+	size_t depth;
+	bool labelled[LOGFMT_DEPTH_MAX+1];
+} logfmtcbor_enc_t;
+
+typedef struct {
+	const char *s;
+	size_t sz;
+} logfmtcbor_key_t;
+
+static int
+logfmtcbor_str_cmp(const void *arg, const void *obj) {
+	const logfmtcbor_key_t *key = arg;
+	const logfmtcbor_str_t *str = obj;
+
+	if (key->sz != str->sz)
+		return 1;
+	return memcmp(key->s, str->s, key->sz);
+}
+
+static void
+logfmtcbor_dict_clear(logfmtcbor_enc_t *enc) {
+	tommy_hashinc_foreach(&enc->dict, free);
+	tommy_hashinc_done(&enc->dict);
+	tommy_hashinc_init(&enc->dict);
+	enc->count = 0;
+	enc->bytes = 0;
+	enc->records = 0;
+}
+
+static void
+logfmtcbor_enc_free(void *arg) {
+	logfmtcbor_enc_t *enc = arg;
+
+	tommy_hashinc_foreach(&enc->dict, free);
+	tommy_hashinc_done(&enc->dict);
+	free(enc);
+}
+
+static int
+logfmtcbor_init(UNUSED config_t *cfg) {
+	return 0;
+}
+
+static void
+logfmtcbor_write(logfmt_ctx_t *ctx, const void *p, size_t sz) {
+	logfmtcbor_enc_t *enc = ctx->priv;
+
+	if (enc->failed)
+		return;
+	if (logbuf_write(&ctx->buf, p, sz) == -1)
+		enc->failed = true;
+}
+
+static void
+logfmtcbor_head(logfmt_ctx_t *ctx, unsigned int major, uint64_t value) {
+	unsigned char b[9];
+	size_t sz;
+
+	if (value < 24) {
+		b[0] = (major << 5) | value;
+		sz = 1;
+	} else if (value <= UINT8_MAX) {
+		b[0] = (major << 5) | 24;
+		b[1] = value;
+		sz = 2;
+	} else if (value <= UINT16_MAX) {
+		b[0] = (major << 5) | 25;
+		b[1] = value >> 8;
+		b[2] = value;
+		sz = 3;
+	} else if (value <= UINT32_MAX) {
+		b[0] = (major << 5) | 26;
+		for (int i = 0; i < 4; i++)
+			b[1 + i] = value >> (24 - 8 * i);
+		sz = 5;
+	} else {
+		b[0] = (major << 5) | 27;
+		for (int i = 0; i < 8; i++)
+			b[1 + i] = value >> (56 - 8 * i);
+		sz = 9;
+	}
+	logfmtcbor_write(ctx, b, sz);
+}
+
+static void
+logfmtcbor_byte(logfmt_ctx_t *ctx, unsigned char c) {
+	logfmtcbor_write(ctx, &c, 1);
+}
+
+/*
+ * Write a text string, or a reference to it if it is in the dictionary.
+ * Readers add every eligible literal to their dictionary while there is room,
+ * so a literal must be added here too unless the record is dropped.
+ */
+static void
+logfmtcbor_text(logfmt_ctx_t *ctx, const char *s, size_t sz) {
+	logfmtcbor_enc_t *enc = ctx->priv;
+	logfmtcbor_key_t key;
+	logfmtcbor_str_t *str;
+	tommy_hash_t h;
+
+	if (!LOGFMTCBOR_DICT_ELIGIBLE(sz)) {
+		logfmtcbor_head(ctx, CBOR_TEXT, sz);
+		logfmtcbor_write(ctx, s, sz);
+		return;
+	}
+
+	key.s = s;
+	key.sz = sz;
+	h = tommy_hash_u32(0, s, sz);
+	str = tommy_hashinc_search(&enc->dict, logfmtcbor_str_cmp, &key, h);
+	if (str) {
+		logfmtcbor_head(ctx, CBOR_TAG, LOGFMTCBOR_TAG_STRREF);
+		logfmtcbor_head(ctx, CBOR_UINT, str->idx);
+		return;
+	}
+
+	logfmtcbor_head(ctx, CBOR_TEXT, sz);
+	logfmtcbor_write(ctx, s, sz);
+	if (!LOGFMTCBOR_DICT_ROOM(enc->count, enc->bytes, sz))
+		return;
+	str = malloc(sizeof(logfmtcbor_str_t) + sz);
+	if (!str) {
+		enc->failed = true;
+		return;
+	}
+	str->idx = enc->count++;
+	str->sz = sz;
+	memcpy(str->s, s, sz);
+	enc->bytes += sz;
+	tommy_hashinc_insert(&enc->dict, &str->node, str, h);
+}
+
+static void
+logfmtcbor_record_begin(logfmt_ctx_t *ctx) {
+	logfmtcbor_enc_t *enc = ctx->priv;
+	unsigned char hdr[LOGFMT_FRAME_HDRSZ + LOGFMTCBOR_HDRSZ] = {0};
+
+	if (!enc) {
+		enc = malloc(sizeof(logfmtcbor_enc_t));
+		if (!enc) {
+			logbuf_reset(&ctx->buf);
+			return;
+		}
+		bzero(enc, sizeof(logfmtcbor_enc_t));
+		tommy_hashinc_init(&enc->dict);
+		enc->reset = true;
+		ctx->priv = enc;
+		ctx->priv_free = logfmtcbor_enc_free;
+	}
+	if (ctx->restart) {
+		enc->reset = true;
+		ctx->restart = false;
+	}
+	if (enc->records >= LOGFMTCBOR_RESET_RECORDS ||
+	    enc->count >= LOGFMTCBOR_DICT_MAX ||
+	    enc->bytes + LOGFMTCBOR_DICT_MAXLEN > LOGFMTCBOR_DICT_BYTES)
+		enc->reset = true;
+	if (enc->reset) {
+		logfmtcbor_dict_clear(enc);
+		hdr[LOGFMT_FRAME_HDRSZ + 1] = LOGFMTCBOR_FLAG_RESET;
+		enc->reset = false;
+	}
+	hdr[LOGFMT_FRAME_HDRSZ] = LOGEVT_VERSION;
+	enc->failed = false;
+	enc->depth = 0;
+	logbuf_reset(&ctx->buf);
+	logfmtcbor_write(ctx, hdr, sizeof(hdr));
+}
+
+/*
+ * Records that could not be rendered completely are dropped.  Since the
+ * dropped record may have added strings to the dictionary, the next record
+ * starts a new dictionary.
+ */
+static void
+logfmtcbor_record_end(logfmt_ctx_t *ctx) {
+	logfmtcbor_enc_t *enc = ctx->priv;
+	size_t sz;
+
+	if (!enc)
+		return;
+	sz = ctx->buf.len - LOGFMT_FRAME_HDRSZ;
+	if (enc->failed || sz > LOGFMTCBOR_FRAME_MAX) {
+		logbuf_reset(&ctx->buf);
+		enc->reset = true;
+		return;
+	}
+	for (int i = 0; i < LOGFMT_FRAME_HDRSZ; i++)
+		ctx->buf.buf[i] = sz >> (8 * (LOGFMT_FRAME_HDRSZ - 1 - i));
+	fwrite(ctx->buf.buf, ctx->buf.len, 1, ctx->f);
+	logbuf_reset(&ctx->buf);
+	enc->records++;
+}
+
+static void
+logfmtcbor_container_begin(logfmt_ctx_t *ctx, unsigned int major) {
+	logfmtcbor_enc_t *enc = ctx->priv;
+
+	if (!enc)
+		return;
+	logfmtcbor_byte(ctx, (major << 5) | CBOR_INDEF);
+	enc->depth++;
+	assert(enc->depth <= LOGFMT_DEPTH_MAX);
+	enc->labelled[enc->depth] = false;
+}
+
+static void
+logfmtcbor_container_end(logfmt_ctx_t *ctx) {
+	logfmtcbor_enc_t *enc = ctx->priv;
+
+	if (!enc)
+		return;
+	assert(enc->depth > 0);
+	enc->depth--;
+	logfmtcbor_byte(ctx, CBOR_BREAK);
+}
+
+static void
+logfmtcbor_dict_begin(logfmt_ctx_t *ctx) {
+	logfmtcbor_container_begin(ctx, CBOR_MAP);
+}
+
+static void
+logfmtcbor_dict_end(logfmt_ctx_t *ctx) {
+	logfmtcbor_container_end(ctx);
+}
+
+static void
+logfmtcbor_dict_item(logfmt_ctx_t *ctx, const char *label) {
+	if (!ctx->priv)
+		return;
+	logfmtcbor_text(ctx, label, strlen(label));
+}
+
+static void
+logfmtcbor_list_begin(logfmt_ctx_t *ctx) {
+	logfmtcbor_container_begin(ctx, CBOR_ARRAY);
+}
+
+static void
+logfmtcbor_list_end(logfmt_ctx_t *ctx) {
+	logfmtcbor_container_end(ctx);
+}
+
+static void
+logfmtcbor_list_item(logfmt_ctx_t *ctx, const char *label) {
+	logfmtcbor_enc_t *enc = ctx->priv;
+
+	if (!enc || enc->labelled[enc->depth])
+		return;
+	enc->labelled[enc->depth] = true;
+	logfmtcbor_text(ctx, label, strlen(label));
+}
+
+static void
+logfmtcbor_value_null(logfmt_ctx_t *ctx) {
+	if (!ctx->priv)
+		return;
+	logfmtcbor_byte(ctx, (CBOR_SIMPLE << 5) | CBOR_NULL);
+}
+
+static void
+logfmtcbor_value_bool(logfmt_ctx_t *ctx, bool value) {
+	if (!ctx->priv)
+		return;
+	logfmtcbor_byte(ctx, (CBOR_SIMPLE << 5) |
+	                     (value ? CBOR_TRUE : CBOR_FALSE));
+}
+
+static void
+logfmtcbor_value_int(logfmt_ctx_t *ctx, int64_t value) {
+	if (!ctx->priv)
+		return;
+	if (value < 0)
+		logfmtcbor_head(ctx, CBOR_NINT, -(uint64_t)(value + 1));
+	else
+		logfmtcbor_head(ctx, CBOR_UINT, (uint64_t)value);
+}
+
+static void
+logfmtcbor_value_uint(logfmt_ctx_t *ctx, uint64_t value) {
+	if (!ctx->priv)
+		return;
+	logfmtcbor_head(ctx, CBOR_UINT, value);
+}
+
+static void
+logfmtcbor_value_uint_oct(logfmt_ctx_t *ctx, uint64_t value) {
+	if (!ctx->priv)
+		return;
+	logfmtcbor_head(ctx, CBOR_TAG, LOGFMTCBOR_TAG_OCTAL);
+	logfmtcbor_head(ctx, CBOR_UINT, value);
+}
+
+static void
+logfmtcbor_value_timespec(logfmt_ctx_t *ctx, struct timespec *tv) {
+	assert(tv->tv_sec > 0);
+	if (!ctx->priv)
+		return;
+	logfmtcbor_head(ctx, CBOR_TAG, LOGFMTCBOR_TAG_TIMESPEC);
+	logfmtcbor_head(ctx, CBOR_UINT, (uint64_t)tv->tv_sec * 1000000000 +
+	                                (uint64_t)tv->tv_nsec);
+}
+
+static void
+logfmtcbor_value_ttydev(logfmt_ctx_t *ctx, dev_t dev) {
+	char s[64];
+	int sz;
+
+	if (!ctx->priv)
+		return;
+	sz = snprintf(s, sizeof(s), "/dev/%s", sys_ttydevname(dev));
+	if (sz < 0 || (size_t)sz >= sizeof(s)) {
+		((logfmtcbor_enc_t *)ctx->priv)->failed = true;
+		return;
+	}
+	logfmtcbor_text(ctx, s, sz);
+}
+
+static void
+logfmtcbor_value_buf_hex(logfmt_ctx_t *ctx, const unsigned char *buf,
+                         size_t sz) {
+	if (!ctx->priv)
+		return;
+	logfmtcbor_head(ctx, CBOR_BYTES, sz);
+	logfmtcbor_write(ctx, buf, sz);
+}
+
+static void
+logfmtcbor_value_string(logfmt_ctx_t *ctx, const char *s) {
+	if (!ctx->priv)
+		return;
+	logfmtcbor_text(ctx, s, strlen(s));
+}
+
+logfmt_t logfmtcbor = {
+	"cbor", true, false, true,
+	logfmtcbor_init,
+	logfmtcbor_record_begin,
+	logfmtcbor_record_end,
+	logfmtcbor_dict_begin,
+	logfmtcbor_dict_end,
+	logfmtcbor_dict_item,
+	logfmtcbor_list_begin,
+	logfmtcbor_list_end,
+	logfmtcbor_list_item,
+	logfmtcbor_value_null,
+	logfmtcbor_value_bool,
+	logfmtcbor_value_int,
+	logfmtcbor_value_uint,
+	logfmtcbor_value_uint_oct,
+	logfmtcbor_value_timespec,
+	logfmtcbor_value_ttydev,
+	logfmtcbor_value_buf_hex,
+	logfmtcbor_value_string,
+	NULL,
+	NULL,
+	NULL
+};
+
+/*
+ * Decoder.  Every frame is decoded twice:  first to validate it and to add
+ * its literals to the dictionary, then to render it using the output format
+ * driver, such that no partial records are ever rendered.
+ */
+
+typedef struct {
+	char *buf;
+	size_t sz;
+} logfmtcbor_tmp_t;
+
+/*
+ * Decoded strings that are not in the dictionary are copied to temporary
+ * buffers for NUL termination.  Keys and list labels are passed to the output
+ * format driver before the value and may be referenced until the value has
+ * been rendered, so they get one buffer per nesting level.
+ */
+typedef struct {
+	char *strs[LOGFMTCBOR_DICT_MAX];
+	uint32_t count;
+	size_t bytes;
+	bool synced;                    /* dictionary matches the writer's */
+	logfmtcbor_tmp_t value;
+	logfmtcbor_tmp_t names[LOGFMT_INDENT_MAX];
+} logfmtcbor_dec_t;
+
+typedef struct {
+	const unsigned char *p;
+	const unsigned char *end;
+} logfmtcbor_cur_t;
+
+static void
+logfmtcbor_dec_clear(logfmtcbor_dec_t *dec) {
+	for (uint32_t i = 0; i < dec->count; i++)
+		free(dec->strs[i]);
+	dec->count = 0;
+	dec->bytes = 0;
+}
+
+static int
+logfmtcbor_dec_head(logfmtcbor_cur_t *cur, unsigned int *major,
+                    uint64_t *value) {
+	unsigned int info;
+	size_t sz;
+
+	if (cur->p >= cur->end)
+		return -1;
+	*major = *cur->p >> 5;
+	info = *cur->p & 0x1F;
+	cur->p++;
+	if (info < 24) {
+		*value = info;
+		return 0;
+	}
+	if (info == CBOR_INDEF) {
+		*value = CBOR_INDEF_ARG;
+		return 0;
+	}
+	if (info > 27)
+		return -1;
+	sz = 1 << (info - 24);
+	if ((size_t)(cur->end - cur->p) < sz)
+		return -1;
+	*value = 0;
+	for (size_t i = 0; i < sz; i++)
+		*value = (*value << 8) | cur->p[i];
+	cur->p += sz;
+	return 0;
+}
+
+/*
+ * Decode a string, either a literal or a dictionary reference, into a
+ * NUL-terminated string.  When adding, eligible literals are appended to the
+ * dictionary.
+ */
+static const char *
+logfmtcbor_dec_text(logfmtcbor_dec_t *dec, logfmtcbor_cur_t *cur,
+                    bool add, logfmtcbor_tmp_t *tmp) {
+	unsigned int major;
+	uint64_t value;
+	char *s;
+
+	if (logfmtcbor_dec_head(cur, &major, &value) == -1)
+		return NULL;
+	if (major == CBOR_TAG && value == LOGFMTCBOR_TAG_STRREF) {
+		if (logfmtcbor_dec_head(cur, &major, &value) == -1 ||
+		    major != CBOR_UINT || value >= dec->count)
+			return NULL;
+		return dec->strs[value];
+	}
+	if (major != CBOR_TEXT || value > (uint64_t)(cur->end - cur->p) ||
+	    memchr(cur->p, '\0', value))
+		return NULL;
+	if (add && LOGFMTCBOR_DICT_ELIGIBLE(value) &&
+	    LOGFMTCBOR_DICT_ROOM(dec->count, dec->bytes, value)) {
+		s = malloc(value + 1);
+		if (!s)
+			return NULL;
+		memcpy(s, cur->p, value);
+		s[value] = '\0';
+		dec->strs[dec->count++] = s;
+		dec->bytes += value;
+		cur->p += value;
+		return s;
+	}
+	if (value + 1 > tmp->sz) {
+		s = realloc(tmp->buf, value + 1);
+		if (!s)
+			return NULL;
+		tmp->buf = s;
+		tmp->sz = value + 1;
+	}
+	memcpy(tmp->buf, cur->p, value);
+	tmp->buf[value] = '\0';
+	cur->p += value;
+	return tmp->buf;
+}
+
+static bool
+logfmtcbor_dec_break(logfmtcbor_cur_t *cur) {
+	if (cur->p < cur->end && *cur->p == CBOR_BREAK) {
+		cur->p++;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Decode a single value.  If fmt is NULL, only validate and add literals to
+ * the dictionary.  Returns -1 if the data is invalid or memory ran out.
+ */
+static int
+logfmtcbor_dec_value(logfmtcbor_dec_t *dec, logfmtcbor_cur_t *cur,
+                     logfmt_t *fmt, logfmt_ctx_t *ctx, size_t depth) {
+	const unsigned char *start = cur->p;
+	unsigned int major;
+	uint64_t value;
+	const char *s;
+
+	if (logfmtcbor_dec_head(cur, &major, &value) == -1)
+		return -1;
+	switch (major) {
+	case CBOR_UINT:
+		if (fmt)
+			fmt->value_uint(ctx, value);
+		return 0;
+	case CBOR_NINT:
+		if (value > INT64_MAX)
+			return -1;
+		if (fmt)
+			fmt->value_int(ctx, -(int64_t)value - 1);
+		return 0;
+	case CBOR_BYTES:
+		if (value > (uint64_t)(cur->end - cur->p))
+			return -1;
+		if (fmt)
+			fmt->value_buf_hex(ctx, cur->p, value);
+		cur->p += value;
+		return 0;
+	case CBOR_TEXT:
+		cur->p = start;
+		s = logfmtcbor_dec_text(dec, cur, !fmt, &dec->value);
+		if (!s)
+			return -1;
+		if (fmt)
+			fmt->value_string(ctx, s);
+		return 0;
+	case CBOR_TAG:
+		if (value == LOGFMTCBOR_TAG_STRREF) {
+			cur->p = start;
+			s = logfmtcbor_dec_text(dec, cur, !fmt, &dec->value);
+			if (!s)
+				return -1;
+			if (fmt)
+				fmt->value_string(ctx, s);
+			return 0;
+		}
+		if (value == LOGFMTCBOR_TAG_OCTAL) {
+			if (logfmtcbor_dec_head(cur, &major, &value) == -1 ||
+			    major != CBOR_UINT)
+				return -1;
+			if (fmt)
+				fmt->value_uint_oct(ctx, value);
+			return 0;
+		}
+		if (value == LOGFMTCBOR_TAG_TIMESPEC) {
+			struct timespec tv;
+			if (logfmtcbor_dec_head(cur, &major, &value) == -1 ||
+			    major != CBOR_UINT || value < 1000000000)
+				return -1;
+			tv.tv_sec = value / 1000000000;
+			tv.tv_nsec = value % 1000000000;
+			if (fmt)
+				fmt->value_timespec(ctx, &tv);
+			return 0;
+		}
+		return -1;
+	case CBOR_SIMPLE:
+		if (value == CBOR_NULL) {
+			if (fmt)
+				fmt->value_null(ctx);
+			return 0;
+		}
+		if (value == CBOR_TRUE || value == CBOR_FALSE) {
+			if (fmt)
+				fmt->value_bool(ctx, value == CBOR_TRUE);
+			return 0;
+		}
+		return -1;
+	case CBOR_MAP:
+		if (value != CBOR_INDEF_ARG || depth >= LOGFMT_INDENT_MAX)
+			return -1;
+		if (fmt)
+			fmt->dict_begin(ctx);
+		while (!logfmtcbor_dec_break(cur)) {
+			s = logfmtcbor_dec_text(dec, cur, !fmt,
+			                        &dec->names[depth]);
+			if (!s)
+				return -1;
+			if (fmt)
+				fmt->dict_item(ctx, s);
+			if (logfmtcbor_dec_value(dec, cur, fmt, ctx,
+			                         depth + 1) == -1)
+				return -1;
+		}
+		if (fmt)
+			fmt->dict_end(ctx);
+		return 0;
+	case CBOR_ARRAY:
+		if (value != CBOR_INDEF_ARG || depth >= LOGFMT_INDENT_MAX)
+			return -1;
+		if (fmt)
+			fmt->list_begin(ctx);
+		if (!logfmtcbor_dec_break(cur)) {
+			s = logfmtcbor_dec_text(dec, cur, !fmt,
+			                        &dec->names[depth]);
+			if (!s)
+				return -1;
+			do {
+				if (fmt)
+					fmt->list_item(ctx, s);
+				if (logfmtcbor_dec_value(dec, cur, fmt, ctx,
+				                         depth + 1) == -1)
+					return -1;
+			} while (!logfmtcbor_dec_break(cur));
+		}
+		if (fmt)
+			fmt->list_end(ctx);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+static int
+logfmtcbor_dec_record(logfmtcbor_dec_t *dec, logfmtcbor_cur_t *cur,
+                      logfmt_t *fmt, logfmt_ctx_t *ctx) {
+	if (cur->p >= cur->end || *cur->p != ((CBOR_MAP << 5) | CBOR_INDEF))
+		return -1;
+	if (fmt)
+		fmt->record_begin(ctx);
+	if (logfmtcbor_dec_value(dec, cur, fmt, ctx, 0) == -1)
+		return -1;
+	if (cur->p != cur->end)
+		return -1;
+	if (fmt)
+		fmt->record_end(ctx);
+	return 0;
+}
+
+/*
+ * Read frames from in until EOF and render every record using fmt to ctx->f.
+ * Records that cannot be decoded are skipped along with all records up to
+ * the next dictionary reset.  Returns -1 with errno set if reading fails,
+ * memory runs out or the framing is corrupt, 0 otherwise.
+ */
+int
+logfmtcbor_decode(FILE *in, logfmt_t *fmt, logfmt_ctx_t *ctx,
+                  logfmtcbor_dec_stat_t *st) {
+	logfmtcbor_dec_t *dec;
+	logfmtcbor_cur_t cur, cur2;
+	unsigned char hdr[LOGFMT_FRAME_HDRSZ];
+	unsigned char *buf;
+	size_t sz, n;
+	int rv = 0;
+
+	bzero(st, sizeof(logfmtcbor_dec_stat_t));
+	dec = malloc(sizeof(logfmtcbor_dec_t));
+	buf = malloc(LOGFMTCBOR_FRAME_MAX);
+	if (!dec || !buf) {
+		free(dec);
+		free(buf);
+		errno = ENOMEM;
+		return -1;
+	}
+	bzero(dec, sizeof(logfmtcbor_dec_t));
+
+	for (;;) {
+		n = fread(hdr, 1, sizeof(hdr), in);
+		if (n == 0 && !ferror(in))
+			break;
+		if (n < sizeof(hdr)) {
+			if (ferror(in))
+				goto errout;
+			st->truncated = 1;
+			break;
+		}
+		sz = 0;
+		for (size_t i = 0; i < sizeof(hdr); i++)
+			sz = (sz << 8) | hdr[i];
+		if (sz <= LOGFMTCBOR_HDRSZ || sz > LOGFMTCBOR_FRAME_MAX) {
+			errno = EINVAL;
+			goto errout;
+		}
+		n = fread(buf, 1, sz, in);
+		if (n < sz) {
+			if (ferror(in))
+				goto errout;
+			st->truncated = 1;
+			break;
+		}
+
+		if (buf[0] > LOGEVT_VERSION) {
+			dec->synced = false;
+			st->newer++;
+			continue;
+		}
+		if (buf[1] & LOGFMTCBOR_FLAG_RESET) {
+			logfmtcbor_dec_clear(dec);
+			dec->synced = true;
+		}
+		if (!dec->synced) {
+			st->skipped++;
+			continue;
+		}
+		cur.p = buf + LOGFMTCBOR_HDRSZ;
+		cur.end = buf + sz;
+		cur2 = cur;
+		errno = 0;
+		if (logfmtcbor_dec_record(dec, &cur, NULL, ctx) == -1) {
+			if (errno == ENOMEM)
+				goto errout;
+			dec->synced = false;
+			st->skipped++;
+			continue;
+		}
+		(void)logfmtcbor_dec_record(dec, &cur2, fmt, ctx);
+		st->records++;
+	}
+	goto out;
+
+errout:
+	rv = -1;
+out:
+	logfmtcbor_dec_clear(dec);
+	free(dec->value.buf);
+	for (size_t i = 0; i < LOGFMT_INDENT_MAX; i++)
+		free(dec->names[i].buf);
+	free(dec);
+	free(buf);
+	return rv;
+}
+
@@ -0,0 +1,65 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef LOGFMTCBOR_H
+#define LOGFMTCBOR_H
+
+#include "logfmt.h"
+#include "attrib.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Frame payload:  one byte LOGEVT_VERSION, one byte of flags, and a single
+ * CBOR (RFC 7049) data item, the record itself.
+ */
+#define LOGFMTCBOR_HDRSZ        2
+#define LOGFMTCBOR_FLAG_RESET   0x01    /* string dictionary starts over */
+#define LOGFMTCBOR_FRAME_MAX    (16*1024*1024)
+
+/*
+ * String dictionary:  every literal text string between DICT_MINLEN and
+ * DICT_MAXLEN bytes is appended to the dictionary by both writer and reader,
+ * as long as the dictionary has less than DICT_MAX entries and DICT_BYTES
+ * total string bytes.  A string already in the dictionary is written as its
+ * index tagged with the stringref reference tag.  The dictionary is reset
+ * with the first record, every RESET_RECORDS records, when it is full, and
+ * when the log is reopened; readers can start decoding at any reset.
+ */
+#define LOGFMTCBOR_DICT_MINLEN  4
+#define LOGFMTCBOR_DICT_MAXLEN  1024
+#define LOGFMTCBOR_DICT_MAX     16384
+#define LOGFMTCBOR_DICT_BYTES   (1024*1024)
+#define LOGFMTCBOR_RESET_RECORDS 4096
+
+/*
+ * Tags.  Octal unsigned integers and timestamps in nanoseconds since the
+ * epoch use xnumon-specific tags so that they can be rendered exactly as
+ * the text formats would.
+ */
+#define LOGFMTCBOR_TAG_STRREF   25      /* stringref reference */
+#define LOGFMTCBOR_TAG_OCTAL    250
+#define LOGFMTCBOR_TAG_TIMESPEC 251
+
+logfmt_t logfmtcbor;
+
+typedef struct {
+	uint64_t records;       /* rendered */
+	uint64_t skipped;       /* undecodable or not following a reset */
+	uint64_t newer;         /* skipped for unknown LOGEVT_VERSION */
+	int truncated;          /* input ended within a frame */
+} logfmtcbor_dec_stat_t;
+
+int logfmtcbor_decode(FILE *, logfmt_t *, logfmt_ctx_t *,
+                      logfmtcbor_dec_stat_t *) NONNULL(1,2,3,4) WUNRES;
+
+#endif
+
@@ -12,9 +12,312 @@
 #define LOGFMTJSON_H
 
 #include "logfmt.h"
+#include "logbuf.h"
+#include "logutl.h"
+#include "attrib.h"
+
+#include "sys.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
 
 logfmt_t logfmtjson;
 logfmt_t logfmtjsonseq;
 
+/*
+ * The render functions of the JSON drivers are inline, such that renderers
+ * specialized for JSON can call them directly, see logevt.c.  Functions
+ * depending on the log mode take it as an argument instead of reading it
+ * from the configuration, and LOGFMTJSON_MODE generates wrappers with the
+ * signature of the driver table for a given mode, which is either a
+ * constant or a variable.
+ *
+ * Records are rendered using the buffered output primitives of logfmt.h.
+ * Fragments are captured directly from the record buffer, as long as there
+ * was no fallback to unbuffered output since frag_begin.
+ */
+
+/*
+ * Escape sequences for string values:  0 for bytes that need no escaping,
+ * 'u' for control characters that are escaped as \u00XX, and the character
+ * following the backslash otherwise.
+ */
+static const char logfmtjson_esctab[256] = {
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	['"'] = '"',
+	['\\'] = '\\',
+};
+
+static const char logfmtjson_hexdigits[] = "0123456789ABCDEF";
+
+static inline void
+logfmtjson_eol(logfmt_ctx_t *ctx, bool oneline) {
+	if (oneline)
+		return;
+	logfmt_indent_to(ctx, ctx->indent_level, true);
+}
+
+static inline void
+logfmtjson_indent_inc(logfmt_ctx_t *ctx) {
+	ctx->indent_level++;
+	assert(ctx->indent_level <= LOGFMT_INDENT_MAX);
+	ctx->indent_used[ctx->indent_level] = false;
+}
+
+static inline void
+logfmtjson_indent_dec(logfmt_ctx_t *ctx) {
+	assert(ctx->indent_level > 0);
+	ctx->indent_level--;
+}
+
+static inline void
+logfmtjson_record_begin_jsonlines(logfmt_ctx_t *ctx) {
+	logbuf_reset(&ctx->buf);
+	ctx->frag = SIZE_MAX;
+}
+
+static inline void
+logfmtjson_record_begin_jsonseq(logfmt_ctx_t *ctx) {
+	logbuf_reset(&ctx->buf);
+	ctx->frag = SIZE_MAX;
+	logfmt_putc(ctx, '\x1E');
+}
+
+static inline void
+logfmtjson_record_end(logfmt_ctx_t *ctx) {
+	logfmt_putc(ctx, '\n');
+	logfmt_flush(ctx);
+}
+
+static inline void
+logfmtjson_dict_begin(logfmt_ctx_t *ctx) {
+	logfmt_putc(ctx, '{');
+	logfmtjson_indent_inc(ctx);
+}
+
+static inline void
+logfmtjson_dict_end_mode(logfmt_ctx_t *ctx, bool oneline) {
+	logfmtjson_indent_dec(ctx);
+	logfmtjson_eol(ctx, oneline);
+	logfmt_putc(ctx, '}');
+}
+
+static inline void
+logfmtjson_dict_item_mode(logfmt_ctx_t *ctx, const char *label,
+                          bool oneline) {
+	bool first = !ctx->indent_used[ctx->indent_level];
+	if (first)
+		ctx->indent_used[ctx->indent_level] = true;
+	else
+		logfmt_putc(ctx, ',');
+	logfmtjson_eol(ctx, oneline);
+	logfmt_putc(ctx, '"');
+	logfmt_write(ctx, label, strlen(label));
+	if (oneline)
+		logfmt_puts(ctx, "\":");
+	else
+		logfmt_puts(ctx, "\": ");
+}
+
+static inline void
+logfmtjson_list_begin(logfmt_ctx_t *ctx) {
+	logfmt_putc(ctx, '[');
+	logfmtjson_indent_inc(ctx);
+}
+
+static inline void
+logfmtjson_list_end_mode(logfmt_ctx_t *ctx, bool oneline) {
+	logfmtjson_indent_dec(ctx);
+	logfmtjson_eol(ctx, oneline);
+	logfmt_putc(ctx, ']');
+}
+
+static inline void
+logfmtjson_list_item_mode(logfmt_ctx_t *ctx, UNUSED const char *label,
+                          bool oneline) {
+	bool first = !ctx->indent_used[ctx->indent_level];
+	if (first)
+		ctx->indent_used[ctx->indent_level] = true;
+	else
+		logfmt_putc(ctx, ',');
+	logfmtjson_eol(ctx, oneline);
+}
+
+static inline void
+logfmtjson_value_null(logfmt_ctx_t *ctx) {
+	logfmt_puts(ctx, "null");
+}
+
+static inline void
+logfmtjson_value_bool(logfmt_ctx_t *ctx, bool value) {
+	if (value)
+		logfmt_puts(ctx, "true");
+	else
+		logfmt_puts(ctx, "false");
+}
+
+static inline void
+logfmtjson_value_int(logfmt_ctx_t *ctx, int64_t value) {
+	logfmt_write_int(ctx, value);
+}
+
+static inline void
+logfmtjson_value_uint(logfmt_ctx_t *ctx, uint64_t value) {
+	logfmt_write_uint(ctx, value);
+}
+
+static inline void
+logfmtjson_value_uint_oct(logfmt_ctx_t *ctx, uint64_t value) {
+	char s[25], *p;
+
+	p = s + sizeof(s);
+	*--p = '"';
+	p = logfmt_otoa(p, value);
+	*--p = '0';
+	*--p = '"';
+	logfmt_write(ctx, p, s + sizeof(s) - p);
+}
+
+static inline void
+logfmtjson_value_timespec(logfmt_ctx_t *ctx, struct timespec *tv) {
+	char s[LOGUTL_TIMESTAMPSZ + 2];
+
+	assert(tv->tv_sec > 0);
+	s[0] = '"';
+	logutl_timestamp(s + 1, tv, &ctx->ts);
+	s[sizeof(s) - 1] = '"';
+	logfmt_write(ctx, s, sizeof(s));
+}
+
+static inline void
+logfmtjson_value_ttydev(logfmt_ctx_t *ctx, dev_t dev) {
+	const char *name = sys_ttydevname(dev);
+
+	logfmt_puts(ctx, "\"/dev/");
+	logfmt_write(ctx, name, strlen(name));
+	logfmt_putc(ctx, '"');
+}
+
+static inline void
+logfmtjson_value_buf_hex(logfmt_ctx_t *ctx, const unsigned char *p,
+                         size_t sz) {
+	logfmt_putc(ctx, '"');
+	logfmt_write_hex(ctx, p, sz);
+	logfmt_putc(ctx, '"');
+}
+
+static inline void
+logfmtjson_value_string(logfmt_ctx_t *ctx, const char *s) {
+	const unsigned char *p = (const unsigned char *)s;
+	char e[6] = {'\\', 'u', '0', '0'};
+	size_t sz;
+
+	logfmt_putc(ctx, '"');
+	for (;;) {
+		sz = logutl_span_json((const char *)p);
+		if (sz > 0) {
+			logfmt_write(ctx, p, sz);
+			p += sz;
+		}
+		if (*p == '\0')
+			break;
+		if (logfmtjson_esctab[*p] == 'u') {
+			e[4] = logfmtjson_hexdigits[*p >> 4];
+			e[5] = logfmtjson_hexdigits[*p & 0x0F];
+			logfmt_write(ctx, e, 6);
+		} else {
+			e[1] = logfmtjson_esctab[*p];
+			logfmt_write(ctx, e, 2);
+			e[1] = 'u';
+		}
+		p++;
+	}
+	logfmt_putc(ctx, '"');
+}
+
+static inline void
+logfmtjson_frag_begin(logfmt_ctx_t *ctx) {
+	ctx->frag = ctx->buf.len;
+}
+
+static inline int
+logfmtjson_frag_end(logfmt_ctx_t *ctx, char **p, size_t *sz) {
+	size_t start = ctx->frag;
+
+	ctx->frag = SIZE_MAX;
+	if (start == SIZE_MAX || start > ctx->buf.len)
+		return -1;
+	*sz = ctx->buf.len - start;
+	*p = malloc(*sz);
+	if (!*p)
+		return -1;
+	memcpy(*p, ctx->buf.buf + start, *sz);
+	return 0;
+}
+
+static inline void
+logfmtjson_frag_put(logfmt_ctx_t *ctx, const char *p, size_t sz) {
+	logfmt_write(ctx, p, sz);
+}
+
+/*
+ * Generate the mode-dependent render functions P_dict_end, P_dict_item,
+ * P_list_end and P_list_item for log mode ONELINE.
+ */
+#define LOGFMTJSON_MODE(P, ONELINE) \
+static void \
+P##_dict_end(logfmt_ctx_t *ctx) { \
+	logfmtjson_dict_end_mode(ctx, (ONELINE)); \
+} \
+static void \
+P##_dict_item(logfmt_ctx_t *ctx, const char *label) { \
+	logfmtjson_dict_item_mode(ctx, label, (ONELINE)); \
+} \
+static void \
+P##_list_end(logfmt_ctx_t *ctx) { \
+	logfmtjson_list_end_mode(ctx, (ONELINE)); \
+} \
+static void \
+P##_list_item(logfmt_ctx_t *ctx, const char *label) { \
+	logfmtjson_list_item_mode(ctx, label, (ONELINE)); \
+}
+
+/*
+ * Initializer of a driver table using the functions generated by
+ * LOGFMTJSON_MODE with prefix P.
+ */
+#define LOGFMTJSON_DRIVER(NAME, INIT, RECORD_BEGIN, P) { \
+	NAME, true, true, false, \
+	INIT, \
+	RECORD_BEGIN, \
+	logfmtjson_record_end, \
+	logfmtjson_dict_begin, \
+	P##_dict_end, \
+	P##_dict_item, \
+	logfmtjson_list_begin, \
+	P##_list_end, \
+	P##_list_item, \
+	logfmtjson_value_null, \
+	logfmtjson_value_bool, \
+	logfmtjson_value_int, \
+	logfmtjson_value_uint, \
+	logfmtjson_value_uint_oct, \
+	logfmtjson_value_timespec, \
+	logfmtjson_value_ttydev, \
+	logfmtjson_value_buf_hex, \
+	logfmtjson_value_string, \
+	logfmtjson_frag_begin, \
+	logfmtjson_frag_end, \
+	logfmtjson_frag_put \
+}
+
 #endif
 
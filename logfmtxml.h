@@ -12,8 +12,288 @@
 #define LOGFMTXML_H
 
 #include "logfmt.h"
+#include "logbuf.h"
+#include "logutl.h"
+#include "attrib.h"
+
+#include "sys.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
 
 logfmt_t logfmtxml;
 
+/*
+ * The render functions of the XML driver are inline, such that renderers
+ * specialized for XML can call them directly, see logevt.c.  Functions
+ * depending on the log mode take it as an argument instead of reading it
+ * from the configuration, and LOGFMTXML_MODE generates wrappers with the
+ * signature of the driver table for a given mode, which is either a
+ * constant or a variable.  Records are rendered using the buffered output
+ * primitives of logfmt.h.
+ */
+
+/* lists need two levels in XML, see LOGFMT_DEPTH_MAX */
+#define LOGFMTXML_INDENT_MAX LOGFMT_DEPTH_MAX
+
+/*
+ * Entity references for the bytes that need escaping in character data,
+ * NULL for all others.
+ */
+static const char *const logfmtxml_esctab[256] = {
+	['<'] = "&lt;",
+	['>'] = "&gt;",
+	['&'] = "&amp;",
+	['"'] = "&quot;",
+	['\''] = "&apos;",
+};
+
+static inline void
+logfmtxml_indent_inc(logfmt_ctx_t *ctx) {
+	ctx->indent_level++;
+	assert(ctx->indent_level <= LOGFMTXML_INDENT_MAX);
+	ctx->indent_used[ctx->indent_level] = false;
+}
+
+static inline void
+logfmtxml_indent_dec(logfmt_ctx_t *ctx) {
+	assert(ctx->indent_level > 0);
+	ctx->indent_level--;
+}
+
+static inline void
+logfmtxml_tag_open(logfmt_ctx_t *ctx, const char *label, bool oneline) {
+	if (!oneline)
+		logfmt_indent_to(ctx, ctx->indent_level, false);
+	logfmt_putc(ctx, '<');
+	logfmt_write(ctx, label, strlen(label));
+	logfmt_putc(ctx, '>');
+	ctx->tags[ctx->tags_next] = label;
+	ctx->tags_next++;
+	assert(ctx->tags_next <= LOGFMTXML_INDENT_MAX);
+}
+
+static inline void
+logfmtxml_tag_close(logfmt_ctx_t *ctx, bool oneline) {
+	const char *label;
+
+	assert(ctx->tags_next > 0);
+	ctx->tags_next--;
+	label = ctx->tags[ctx->tags_next];
+	logfmt_puts(ctx, "</");
+	logfmt_write(ctx, label, strlen(label));
+	if (oneline)
+		logfmt_putc(ctx, '>');
+	else
+		logfmt_puts(ctx, ">\n");
+}
+
+static inline void
+logfmtxml_record_begin(logfmt_ctx_t *ctx) {
+	logbuf_reset(&ctx->buf);
+	logfmt_puts(ctx, "<event>");
+}
+
+static inline void
+logfmtxml_record_end(logfmt_ctx_t *ctx) {
+	logfmt_puts(ctx, "</event>\n");
+	logfmt_flush(ctx);
+}
+
+static inline void
+logfmtxml_dict_begin_mode(logfmt_ctx_t *ctx, UNUSED bool oneline) {
+	logfmtxml_indent_inc(ctx);
+}
+
+static inline void
+logfmtxml_dict_end_mode(logfmt_ctx_t *ctx, bool oneline) {
+	logfmtxml_indent_dec(ctx);
+	if (!oneline)
+		logfmt_indent_to(ctx, ctx->indent_level, false);
+	if (ctx->tags_next > 0)
+		logfmtxml_tag_close(ctx, oneline);
+}
+
+static inline void
+logfmtxml_dict_item_mode(logfmt_ctx_t *ctx, const char *label,
+                         bool oneline) {
+	bool first = !ctx->indent_used[ctx->indent_level];
+	if (first) {
+		ctx->indent_used[ctx->indent_level] = true;
+		if (!oneline)
+			logfmt_putc(ctx, '\n');
+	}
+	logfmtxml_tag_open(ctx, label, oneline);
+}
+
+static inline void
+logfmtxml_value_null_mode(logfmt_ctx_t *ctx, bool oneline) {
+	logfmtxml_tag_close(ctx, oneline);
+}
+
+static inline void
+logfmtxml_value_bool_mode(logfmt_ctx_t *ctx, bool value, bool oneline) {
+	if (value)
+		logfmt_puts(ctx, "true");
+	else
+		logfmt_puts(ctx, "false");
+	logfmtxml_tag_close(ctx, oneline);
+}
+
+static inline void
+logfmtxml_value_int_mode(logfmt_ctx_t *ctx, int64_t value, bool oneline) {
+	logfmt_write_int(ctx, value);
+	logfmtxml_tag_close(ctx, oneline);
+}
+
+static inline void
+logfmtxml_value_uint_mode(logfmt_ctx_t *ctx, uint64_t value, bool oneline) {
+	logfmt_write_uint(ctx, value);
+	logfmtxml_tag_close(ctx, oneline);
+}
+
+static inline void
+logfmtxml_value_uint_oct_mode(logfmt_ctx_t *ctx, uint64_t value,
+                              bool oneline) {
+	char s[23], *p;
+
+	p = logfmt_otoa(s + sizeof(s), value);
+	*--p = '0';
+	logfmt_write(ctx, p, s + sizeof(s) - p);
+	logfmtxml_tag_close(ctx, oneline);
+}
+
+static inline void
+logfmtxml_value_timespec_mode(logfmt_ctx_t *ctx, struct timespec *tv,
+                              bool oneline) {
+	assert(tv->tv_sec > 0);
+	logfmt_write_timespec(ctx, tv);
+	logfmtxml_tag_close(ctx, oneline);
+}
+
+static inline void
+logfmtxml_value_ttydev_mode(logfmt_ctx_t *ctx, dev_t dev, bool oneline) {
+	const char *name = sys_ttydevname(dev);
+
+	logfmt_puts(ctx, "/dev/");
+	logfmt_write(ctx, name, strlen(name));
+	logfmtxml_tag_close(ctx, oneline);
+}
+
+static inline void
+logfmtxml_value_buf_hex_mode(logfmt_ctx_t *ctx, const unsigned char *buf,
+                             size_t sz, bool oneline) {
+	logfmt_write_hex(ctx, buf, sz);
+	logfmtxml_tag_close(ctx, oneline);
+}
+
+static inline void
+logfmtxml_value_string_mode(logfmt_ctx_t *ctx, const char *s, bool oneline) {
+	const unsigned char *p = (const unsigned char *)s;
+	const char *e;
+	size_t sz;
+
+	for (;;) {
+		sz = logutl_span_xml((const char *)p);
+		if (sz > 0) {
+			logfmt_write(ctx, p, sz);
+			p += sz;
+		}
+		if (*p == '\0')
+			break;
+		e = logfmtxml_esctab[*p++];
+		assert(e);
+		logfmt_write(ctx, e, strlen(e));
+	}
+	logfmtxml_tag_close(ctx, oneline);
+}
+
+/*
+ * Generate all render functions with prefix P for log mode ONELINE; lists
+ * render like dicts.
+ */
+#define LOGFMTXML_MODE(P, ONELINE) \
+static void \
+P##_dict_begin(logfmt_ctx_t *ctx) { \
+	logfmtxml_dict_begin_mode(ctx, (ONELINE)); \
+} \
+static void \
+P##_dict_end(logfmt_ctx_t *ctx) { \
+	logfmtxml_dict_end_mode(ctx, (ONELINE)); \
+} \
+static void \
+P##_dict_item(logfmt_ctx_t *ctx, const char *label) { \
+	logfmtxml_dict_item_mode(ctx, label, (ONELINE)); \
+} \
+static void \
+P##_value_null(logfmt_ctx_t *ctx) { \
+	logfmtxml_value_null_mode(ctx, (ONELINE)); \
+} \
+static void \
+P##_value_bool(logfmt_ctx_t *ctx, bool value) { \
+	logfmtxml_value_bool_mode(ctx, value, (ONELINE)); \
+} \
+static void \
+P##_value_int(logfmt_ctx_t *ctx, int64_t value) { \
+	logfmtxml_value_int_mode(ctx, value, (ONELINE)); \
+} \
+static void \
+P##_value_uint(logfmt_ctx_t *ctx, uint64_t value) { \
+	logfmtxml_value_uint_mode(ctx, value, (ONELINE)); \
+} \
+static void \
+P##_value_uint_oct(logfmt_ctx_t *ctx, uint64_t value) { \
+	logfmtxml_value_uint_oct_mode(ctx, value, (ONELINE)); \
+} \
+static void \
+P##_value_timespec(logfmt_ctx_t *ctx, struct timespec *tv) { \
+	logfmtxml_value_timespec_mode(ctx, tv, (ONELINE)); \
+} \
+static void \
+P##_value_ttydev(logfmt_ctx_t *ctx, dev_t dev) { \
+	logfmtxml_value_ttydev_mode(ctx, dev, (ONELINE)); \
+} \
+static void \
+P##_value_buf_hex(logfmt_ctx_t *ctx, const unsigned char *buf, size_t sz) { \
+	logfmtxml_value_buf_hex_mode(ctx, buf, sz, (ONELINE)); \
+} \
+static void \
+P##_value_string(logfmt_ctx_t *ctx, const char *s) { \
+	logfmtxml_value_string_mode(ctx, s, (ONELINE)); \
+}
+
+/*
+ * Initializer of a driver table using the functions generated by
+ * LOGFMTXML_MODE with prefix P.
+ */
+#define LOGFMTXML_DRIVER(NAME, INIT, P) { \
+	NAME, true, true, false, \
+	INIT, \
+	logfmtxml_record_begin, \
+	logfmtxml_record_end, \
+	P##_dict_begin, \
+	P##_dict_end, \
+	P##_dict_item, \
+	P##_dict_begin, \
+	P##_dict_end, \
+	P##_dict_item, \
+	P##_value_null, \
+	P##_value_bool, \
+	P##_value_int, \
+	P##_value_uint, \
+	P##_value_uint_oct, \
+	P##_value_timespec, \
+	P##_value_ttydev, \
+	P##_value_buf_hex, \
+	P##_value_string, \
+	NULL, \
+	NULL, \
+	NULL \
+}
+
 #endif
 
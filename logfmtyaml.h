@@ -12,8 +12,210 @@
 #define LOGFMTYAML_H
 
 #include "logfmt.h"
+#include "logbuf.h"
+#include "logutl.h"
+#include "attrib.h"
+
+#include "sys.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
 
 logfmt_t logfmtyaml;
 
+/*
+ * The render functions of the YAML driver are inline, such that renderers
+ * specialized for YAML can call them directly, see logevt.c.  YAML is only
+ * supported in multi-line mode.  Records are rendered using the buffered
+ * output primitives of logfmt.h.
+ */
+
+static inline void
+logfmtyaml_indent_inc(logfmt_ctx_t *ctx) {
+	ctx->indent_level++;
+	assert(ctx->indent_level <= LOGFMT_INDENT_MAX);
+}
+
+static inline void
+logfmtyaml_indent_dec(logfmt_ctx_t *ctx) {
+	assert(ctx->indent_level > 0);
+	ctx->indent_level--;
+}
+
+static inline void
+logfmtyaml_record_begin(logfmt_ctx_t *ctx) {
+	logbuf_reset(&ctx->buf);
+	logfmt_puts(ctx, "---");
+}
+
+static inline void
+logfmtyaml_record_end(logfmt_ctx_t *ctx) {
+	logfmt_putc(ctx, '\n');
+	logfmt_flush(ctx);
+}
+
+static inline void
+logfmtyaml_dict_begin(logfmt_ctx_t *ctx) {
+	logfmtyaml_indent_inc(ctx);
+}
+
+static inline void
+logfmtyaml_dict_end(logfmt_ctx_t *ctx) {
+	logfmtyaml_indent_dec(ctx);
+}
+
+static inline void
+logfmtyaml_dict_item(logfmt_ctx_t *ctx, const char *label) {
+	if (ctx->reuse_line) {
+		logfmt_putc(ctx, ' ');
+		ctx->reuse_line = false;
+	} else {
+		logfmt_indent_to(ctx, ctx->indent_level, true);
+	}
+	logfmt_write(ctx, label, strlen(label));
+	logfmt_putc(ctx, ':');
+}
+
+static inline void
+logfmtyaml_list_begin(logfmt_ctx_t *ctx) {
+	logfmtyaml_indent_inc(ctx);
+}
+
+static inline void
+logfmtyaml_list_end(logfmt_ctx_t *ctx) {
+	logfmtyaml_indent_dec(ctx);
+}
+
+static inline void
+logfmtyaml_list_item(logfmt_ctx_t *ctx, UNUSED const char *label) {
+	logfmt_indent_to(ctx, ctx->indent_level, true);
+	logfmt_putc(ctx, '-');
+	ctx->reuse_line = true;
+}
+
+static inline void
+logfmtyaml_value_null(logfmt_ctx_t *ctx) {
+	logfmt_puts(ctx, " null");
+	ctx->reuse_line = false;
+}
+
+static inline void
+logfmtyaml_value_bool(logfmt_ctx_t *ctx, bool value) {
+	if (value)
+		logfmt_puts(ctx, " true");
+	else
+		logfmt_puts(ctx, " false");
+	ctx->reuse_line = false;
+}
+
+static inline void
+logfmtyaml_value_int(logfmt_ctx_t *ctx, int64_t value) {
+	logfmt_putc(ctx, ' ');
+	logfmt_write_int(ctx, value);
+	ctx->reuse_line = false;
+}
+
+static inline void
+logfmtyaml_value_uint(logfmt_ctx_t *ctx, uint64_t value) {
+	logfmt_putc(ctx, ' ');
+	logfmt_write_uint(ctx, value);
+	ctx->reuse_line = false;
+}
+
+static inline void
+logfmtyaml_value_uint_oct(logfmt_ctx_t *ctx, uint64_t value) {
+	char s[25], *p;
+
+	p = logfmt_otoa(s + sizeof(s), value);
+	*--p = 'o';
+	*--p = '0';
+	*--p = ' ';
+	logfmt_write(ctx, p, s + sizeof(s) - p);
+	ctx->reuse_line = false;
+}
+
+static inline void
+logfmtyaml_value_timespec(logfmt_ctx_t *ctx, struct timespec *tv) {
+	assert(tv->tv_sec > 0);
+	logfmt_putc(ctx, ' ');
+	logfmt_write_timespec(ctx, tv);
+	ctx->reuse_line = false;
+}
+
+static inline void
+logfmtyaml_value_ttydev(logfmt_ctx_t *ctx, dev_t dev) {
+	const char *name = sys_ttydevname(dev);
+
+	logfmt_puts(ctx, " /dev/");
+	logfmt_write(ctx, name, strlen(name));
+	ctx->reuse_line = false;
+}
+
+static inline void
+logfmtyaml_value_buf_hex(logfmt_ctx_t *ctx, const unsigned char *buf,
+                         size_t sz) {
+	logfmt_putc(ctx, ' ');
+	logfmt_write_hex(ctx, buf, sz);
+	ctx->reuse_line = false;
+}
+
+/*
+ * YAML Double-Quoted Style string; the only bytes that need escaping are
+ * '"' and '\\', which logutl_span_yaml stops at.
+ */
+static inline void
+logfmtyaml_value_string(logfmt_ctx_t *ctx, const char *s) {
+	const char *p = s;
+	char e[2] = {'\\'};
+	size_t sz;
+
+	logfmt_puts(ctx, " \"");
+	for (;;) {
+		sz = logutl_span_yaml(p);
+		if (sz > 0) {
+			logfmt_write(ctx, p, sz);
+			p += sz;
+		}
+		if (*p == '\0')
+			break;
+		e[1] = *p++;
+		logfmt_write(ctx, e, 2);
+	}
+	logfmt_putc(ctx, '"');
+	ctx->reuse_line = false;
+}
+
+/*
+ * Initializer of a driver table.
+ */
+#define LOGFMTYAML_DRIVER(NAME, INIT) { \
+	NAME, false, true, false, \
+	INIT, \
+	logfmtyaml_record_begin, \
+	logfmtyaml_record_end, \
+	logfmtyaml_dict_begin, \
+	logfmtyaml_dict_end, \
+	logfmtyaml_dict_item, \
+	logfmtyaml_list_begin, \
+	logfmtyaml_list_end, \
+	logfmtyaml_list_item, \
+	logfmtyaml_value_null, \
+	logfmtyaml_value_bool, \
+	logfmtyaml_value_int, \
+	logfmtyaml_value_uint, \
+	logfmtyaml_value_uint_oct, \
+	logfmtyaml_value_timespec, \
+	logfmtyaml_value_ttydev, \
+	logfmtyaml_value_buf_hex, \
+	logfmtyaml_value_string, \
+	NULL, \
+	NULL, \
+	NULL \
+}
+
 #endif
 
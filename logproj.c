@@ -0,0 +1,315 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "logproj.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+
+static const logproj_node_t *
+logproj_lookup(const logproj_node_t *node, const char *key) {
+	for (size_t i = 0; i < node->children; i++) {
+		if (!strcmp(node->child[i].key, key))
+			return &node->child[i];
+	}
+	return NULL;
+}
+
+static logproj_node_t *
+logproj_add(logproj_node_t *node, const char *key, size_t sz) {
+	logproj_node_t *child;
+
+	for (size_t i = 0; i < node->children; i++) {
+		if (strlen(node->child[i].key) == sz &&
+		    !strncmp(node->child[i].key, key, sz))
+			return &node->child[i];
+	}
+	child = realloc(node->child,
+	                (node->children + 1) * sizeof(logproj_node_t));
+	if (!child)
+		return NULL;
+	node->child = child;
+	child = &node->child[node->children];
+	bzero(child, sizeof(logproj_node_t));
+	child->key = strndup(key, sz);
+	if (!child->key)
+		return NULL;
+	node->children++;
+	return child;
+}
+
+static void
+logproj_node_fini(logproj_node_t *node) {
+	for (size_t i = 0; i < node->children; i++)
+		logproj_node_fini(&node->child[i]);
+	free(node->child);
+	free(node->key);
+}
+
+void
+logproj_free(logproj_t *proj) {
+	logproj_node_fini(proj);
+	free(proj);
+}
+
+/*
+ * Add the dotted path at p of length sz to proj.
+ */
+static int
+logproj_add_path(logproj_t *proj, const char *p, size_t sz) {
+	logproj_node_t *node = proj;
+	const char *end = p + sz;
+	size_t n;
+
+	for (size_t depth = 0;; depth++) {
+		n = 0;
+		while (p + n < end && p[n] != '.')
+			n++;
+		if (n == 0 || depth == LOGFMT_DEPTH_MAX)
+			return -1;
+		node = logproj_add(node, p, n);
+		if (!node)
+			return -1;
+		if (p + n == end)
+			break;
+		p += n + 1;
+	}
+	node->all = true;
+	return 0;
+}
+
+/*
+ * Compile the comma-separated list of dotted field paths in spec.  Returns
+ * NULL if spec is empty or malformed.
+ */
+logproj_t *
+logproj_new(const char *spec) {
+	logproj_t *proj;
+	const char *p;
+	size_t sz;
+
+	proj = malloc(sizeof(logproj_t));
+	if (!proj)
+		return NULL;
+	bzero(proj, sizeof(logproj_t));
+	if (logproj_add_path(proj, "version", 7) == -1 ||
+	    logproj_add_path(proj, "eventcode", 9) == -1)
+		goto errout;
+	p = spec;
+	for (;;) {
+		sz = strcspn(p, ",");
+		if (logproj_add_path(proj, p, sz) == -1)
+			goto errout;
+		if (!p[sz])
+			break;
+		p += sz + 1;
+	}
+	return proj;
+errout:
+	logproj_free(proj);
+	return NULL;
+}
+
+void
+logproj_ctx_init(logproj_ctx_t *pc, const logproj_t *proj, logfmt_t *fmt) {
+	bzero(pc, sizeof(logproj_ctx_t));
+	pc->proj = proj;
+	pc->fmt = fmt;
+}
+
+/*
+ * Returns true if a dict item key at the current position of ctx would be
+ * rendered, for renderers to skip work for fields that are not selected.
+ * Always true for contexts without a projection.
+ */
+bool
+logproj_wants(logfmt_ctx_t *ctx, const char *key) {
+	logproj_ctx_t *pc = ctx->proj;
+	const logproj_node_t *parent;
+
+	if (!pc)
+		return true;
+	if (pc->skip > 0 || pc->depth == 0)
+		return false;
+	parent = pc->node[pc->depth - 1];
+	return parent->all || logproj_lookup(parent, key);
+}
+
+static void
+logproj_record_begin(logfmt_ctx_t *ctx) {
+	logproj_ctx_t *pc = ctx->proj;
+
+	pc->depth = 0;
+	pc->skip = 0;
+	pc->next = pc->proj;
+	pc->fmt->record_begin(ctx);
+}
+
+static void
+logproj_record_end(logfmt_ctx_t *ctx) {
+	logproj_ctx_t *pc = ctx->proj;
+
+	pc->fmt->record_end(ctx);
+}
+
+/*
+ * Returns true if the container being opened is rendered.
+ */
+static bool
+logproj_push(logproj_ctx_t *pc) {
+	if (pc->skip > 0 || !pc->next || pc->depth == LOGFMT_DEPTH_MAX) {
+		pc->skip++;
+		return false;
+	}
+	pc->node[pc->depth++] = pc->next;
+	return true;
+}
+
+/*
+ * Returns true if the container being closed was rendered.
+ */
+static bool
+logproj_pop(logproj_ctx_t *pc) {
+	if (pc->skip > 0) {
+		pc->skip--;
+		return false;
+	}
+	assert(pc->depth > 0);
+	pc->depth--;
+	return true;
+}
+
+static void
+logproj_dict_begin(logfmt_ctx_t *ctx) {
+	logproj_ctx_t *pc = ctx->proj;
+
+	if (logproj_push(pc))
+		pc->fmt->dict_begin(ctx);
+}
+
+static void
+logproj_dict_end(logfmt_ctx_t *ctx) {
+	logproj_ctx_t *pc = ctx->proj;
+
+	if (logproj_pop(pc))
+		pc->fmt->dict_end(ctx);
+}
+
+static void
+logproj_dict_item(logfmt_ctx_t *ctx, const char *key) {
+	logproj_ctx_t *pc = ctx->proj;
+	const logproj_node_t *parent;
+
+	if (pc->skip > 0)
+		return;
+	assert(pc->depth > 0);
+	parent = pc->node[pc->depth - 1];
+	pc->next = parent->all ? parent : logproj_lookup(parent, key);
+	if (pc->next)
+		pc->fmt->dict_item(ctx, key);
+}
+
+static void
+logproj_list_begin(logfmt_ctx_t *ctx) {
+	logproj_ctx_t *pc = ctx->proj;
+
+	if (logproj_push(pc))
+		pc->fmt->list_begin(ctx);
+}
+
+static void
+logproj_list_end(logfmt_ctx_t *ctx) {
+	logproj_ctx_t *pc = ctx->proj;
+
+	if (logproj_pop(pc))
+		pc->fmt->list_end(ctx);
+}
+
+/* list items take the selection of the list */
+static void
+logproj_list_item(logfmt_ctx_t *ctx, const char *name) {
+	logproj_ctx_t *pc = ctx->proj;
+
+	if (pc->skip > 0)
+		return;
+	assert(pc->depth > 0);
+	pc->next = pc->node[pc->depth - 1];
+	pc->fmt->list_item(ctx, name);
+}
+
+#define LOGPROJ_VALUE(NAME, TYPE) \
+static void \
+logproj_value_##NAME(logfmt_ctx_t *ctx, TYPE value) { \
+	logproj_ctx_t *pc = ctx->proj; \
+	if (pc->skip == 0 && pc->next) \
+		pc->fmt->value_##NAME(ctx, value); \
+}
+
+LOGPROJ_VALUE(bool, bool)
+LOGPROJ_VALUE(int, int64_t)
+LOGPROJ_VALUE(uint, uint64_t)
+LOGPROJ_VALUE(uint_oct, uint64_t)
+LOGPROJ_VALUE(timespec, struct timespec *)
+LOGPROJ_VALUE(ttydev, dev_t)
+LOGPROJ_VALUE(string, const char *)
+
+#undef LOGPROJ_VALUE
+
+static void
+logproj_value_null(logfmt_ctx_t *ctx) {
+	logproj_ctx_t *pc = ctx->proj;
+
+	if (pc->skip == 0 && pc->next)
+		pc->fmt->value_null(ctx);
+}
+
+static void
+logproj_value_buf_hex(logfmt_ctx_t *ctx, const unsigned char *buf,
+                      size_t sz) {
+	logproj_ctx_t *pc = ctx->proj;
+
+	if (pc->skip == 0 && pc->next)
+		pc->fmt->value_buf_hex(ctx, buf, sz);
+}
+
+/*
+ * Never initialized itself; the projected driver is initialized instead.
+ */
+static int
+logproj_init(UNUSED config_t *cfg) {
+	return 0;
+}
+
+logfmt_t logfmtproj = {
+	"proj", true, true, false,
+	logproj_init,
+	logproj_record_begin,
+	logproj_record_end,
+	logproj_dict_begin,
+	logproj_dict_end,
+	logproj_dict_item,
+	logproj_list_begin,
+	logproj_list_end,
+	logproj_list_item,
+	logproj_value_null,
+	logproj_value_bool,
+	logproj_value_int,
+	logproj_value_uint,
+	logproj_value_uint_oct,
+	logproj_value_timespec,
+	logproj_value_ttydev,
+	logproj_value_buf_hex,
+	logproj_value_string,
+	NULL,
+	NULL,
+	NULL
+};
@@ -0,0 +1,62 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef LOGPROJ_H
+#define LOGPROJ_H
+
+#include "attrib.h"
+#include "logfmt.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Field projections restrict log records to a list of fields, given as
+ * comma-separated dotted paths of dict keys such as image.path or
+ * subject.image.sha256.  Lists are transparent, such that a path selects
+ * the field in every dict of a list, and a path ending in a dict or list
+ * selects it with everything below.  The version and eventcode fields are
+ * always included.  The projection is compiled into a tree of keys once.
+ */
+typedef struct logproj_node {
+	char *key;
+	bool all;                       /* everything below is included */
+	size_t children;
+	struct logproj_node *child;
+} logproj_node_t;
+
+typedef logproj_node_t logproj_t;
+
+logproj_t *logproj_new(const char *) NONNULL(1) MALLOC;
+void logproj_free(logproj_t *) NONNULL(1);
+
+/*
+ * Rendering a record through logfmtproj passes only the render calls of
+ * selected fields on to the projected format driver, such that fields that
+ * are not selected are never formatted.  The state is kept in ctx->proj.
+ * Fragment capture is not supported, since the same cached rendering can
+ * appear at paths with different projections.
+ */
+typedef struct {
+	const logproj_t *proj;
+	logfmt_t *fmt;                  /* projected driver */
+	const logproj_node_t *node[LOGFMT_DEPTH_MAX+1]; /* open containers */
+	size_t depth;
+	const logproj_node_t *next;     /* of the next value, NULL to drop */
+	size_t skip;                    /* depth within a dropped value */
+} logproj_ctx_t;
+
+void logproj_ctx_init(logproj_ctx_t *, const logproj_t *, logfmt_t *)
+     NONNULL(1,2,3);
+bool logproj_wants(logfmt_ctx_t *, const char *) NONNULL(1,2) WUNRES;
+
+logfmt_t logfmtproj;
+
+#endif
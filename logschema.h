@@ -0,0 +1,98 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef LOGSCHEMA_H
+#define LOGSCHEMA_H
+
+/*
+ * Schemas of the log events with a flat structure, as X-macro tables that
+ * are expanded by logevt.c into the renderers, into the projection checks
+ * of the renderers and into the schema documentation printed by xnumon -S.
+ * Since all log formats including cbor are drivers fed by the renderers,
+ * binary encoding and decoding need no per-event code.
+ *
+ * Each field is X(KIND, LABEL, A, B, C) with A, B and C naming members of
+ * the event struct, or _ if unused:
+ *
+ * STRING       LABEL from string A
+ * STRING_OPT   LABEL from string A, omitted if NULL
+ * PROTO        LABEL from protocol number A, omitted if 0
+ * UINT         LABEL from unsigned integer A
+ * TIMESPEC     LABEL from timespec A
+ * ADDRPORT     LABEL addr and LABEL port from ipaddr A and port B,
+ *              omitted if A is empty
+ * AGGREGATE    count and last from count A and timespec B, omitted if A is
+ *              0, that is if the event was not aggregated
+ * ARGV         LABEL as list of arg from NULL-terminated array A, omitted
+ *              if NULL
+ * DICT_BEGIN   LABEL as dict of the fields up to the matching DICT_END
+ * DICT_END     end of the dict opened by the last DICT_BEGIN
+ * PROCESS      LABEL from audit_proc_t A and image_exec_t pointer B, or
+ *              from pid C only if C is non-zero
+ * SUBJECT      LABEL from audit_proc_t A and image_exec_t pointer B
+ * SUBJECT_UNLESS
+ *              like SUBJECT, but omitted if flag C is set in the flags
+ *              member of the event
+ *
+ * Composite fields, that is ARGV, PROCESS and SUBJECT*, are not rendered at
+ * all if dropped by the field projection.  The image-exec, image-enrich and
+ * xnumon-* events are nested too deeply and depend on too much state to be
+ * described this way and are rendered by hand in logevt.c.
+ */
+
+#define LOGSCHEMA_PROCESS_ACCESS(X) \
+	X(STRING,       "method",       method,         _,      _) \
+	X(AGGREGATE,    "",             count,          last,   _) \
+	X(PROCESS,      "object",       object,         object_image_exec, \
+	                                                        objectpid) \
+	X(SUBJECT,      "subject",      subject,        subject_image_exec, _)
+
+#define LOGSCHEMA_LAUNCHD_ADD(X) \
+	X(DICT_BEGIN,   "plist",        _,              _,      _) \
+	X(STRING,       "path",         plist_path,     _,      _) \
+	X(DICT_END,     "",             _,              _,      _) \
+	X(DICT_BEGIN,   "program",      _,              _,      _) \
+	X(STRING_OPT,   "rpath",        program_rpath,  _,      _) \
+	X(STRING_OPT,   "path",         program_path,   _,      _) \
+	X(ARGV,         "argv",         program_argv,   _,      _) \
+	X(DICT_END,     "",             _,              _,      _) \
+	X(SUBJECT_UNLESS, "subject",    subject,        subject_image_exec, \
+	                                                LAFLAG_NOSUBJECT)
+
+#define LOGSCHEMA_SOCKET_LISTEN(X) \
+	X(PROTO,        "proto",        protocol,       _,      _) \
+	X(ADDRPORT,     "sock",         sock_addr,      sock_port, _) \
+	X(SUBJECT,      "subject",      subject,        subject_image_exec, _)
+
+#define LOGSCHEMA_SOCKET_ACCEPT(X) \
+	X(PROTO,        "proto",        protocol,       _,      _) \
+	X(ADDRPORT,     "sock",         sock_addr,      sock_port, _) \
+	X(ADDRPORT,     "peer",         peer_addr,      peer_port, _) \
+	X(AGGREGATE,    "",             count,          last,   _) \
+	X(SUBJECT,      "subject",      subject,        subject_image_exec, _)
+
+#define LOGSCHEMA_SOCKET_CONNECT(X) \
+	X(PROTO,        "proto",        protocol,       _,      _) \
+	X(ADDRPORT,     "sock",         sock_addr,      sock_port, _) \
+	X(ADDRPORT,     "peer",         peer_addr,      peer_port, _) \
+	X(AGGREGATE,    "",             count,          last,   _) \
+	X(SUBJECT,      "subject",      subject,        subject_image_exec, _)
+
+#define LOGSCHEMA_EVENT_SUMMARY(X) \
+	X(STRING,       "path",         path,           _,      _) \
+	X(DICT_BEGIN,   "suppressed",   _,              _,      _) \
+	X(UINT,         "eventcode",    eventcode,      _,      _) \
+	X(UINT,         "count",        count,          _,      _) \
+	X(TIMESPEC,     "first",        first,          _,      _) \
+	X(TIMESPEC,     "last",         last,           _,      _) \
+	X(DICT_END,     "",             _,              _,      _)
+
+#endif
+
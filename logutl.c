@@ -10,23 +10,235 @@
 
 #include "logutl.h"
 
+#include <stdint.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+
+static const char hexdigits[] = "0123456789abcdef";
+
+static const char decpairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233"
+	"34353637383940414243444546474849505152535455565758596061626364656667"
+	"6869707172737475767778798081828384858687888990919293949596979899";
+
+static inline void
+logutl_put2(char *p, unsigned int v) {
+	memcpy(p, &decpairs[2 * v], 2);
+}
+
+/*
+ * Scanning for the bytes a log format needs to escape, i.e. the terminating
+ * NUL, control characters if ctrl is set, and the setsz bytes in set.  The
+ * callers pass constants, so that the inlined copies are specialized for
+ * each format.
+ *
+ * The SSE2 version tests 16 bytes at a time.  Loads are aligned to 16 bytes
+ * and therefore never cross a page boundary, even though they may read
+ * beyond the terminating NUL.  SSE2 is part of the x86_64 baseline.
+ */
+#ifdef __SSE2__
+static inline __m128i
+logutl_span_match(__m128i v, bool ctrl, const char *set, size_t setsz) {
+	__m128i m;
+
+	if (ctrl)
+		m = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1F)), v);
+	else
+		m = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+	for (size_t i = 0; i < setsz; i++)
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(set[i])));
+	return m;
+}
+
+static inline size_t
+logutl_span(const char *s, bool ctrl, const char *set, size_t setsz) {
+	uintptr_t off = (uintptr_t)s & 15;
+	const __m128i *p = (const __m128i *)((uintptr_t)s - off);
+	unsigned int mask;
+
+	mask = (unsigned int)_mm_movemask_epi8(logutl_span_match(
+	       _mm_load_si128(p), ctrl, set, setsz)) >> off;
+	if (mask)
+		return (size_t)__builtin_ctz(mask);
+	for (;;) {
+		p++;
+		mask = (unsigned int)_mm_movemask_epi8(logutl_span_match(
+		       _mm_load_si128(p), ctrl, set, setsz));
+		if (mask)
+			return (size_t)((const char *)p - s) +
+			       (size_t)__builtin_ctz(mask);
+	}
+}
+#else /* !__SSE2__ */
+static inline size_t
+logutl_span(const char *s, bool ctrl, const char *set, size_t setsz) {
+	const unsigned char *p = (const unsigned char *)s;
+
+	while (*p != '\0' && (!ctrl || *p >= 0x20) && !memchr(set, *p, setsz))
+		p++;
+	return (size_t)(p - (const unsigned char *)s);
+}
+#endif /* !__SSE2__ */
+
+/*
+ * Number of leading bytes of s that can be written verbatim into a JSON
+ * string, i.e. that are neither control characters nor '"' or '\\'.
+ */
+size_t
+logutl_span_json(const char *s) {
+	return logutl_span(s, true, "\"\\", 2);
+}
+
+/*
+ * Same for YAML double-quoted style strings, which only escape '"' and '\\'.
+ */
+size_t
+logutl_span_yaml(const char *s) {
+	return logutl_span(s, false, "\"\\", 2);
+}
+
+/*
+ * Same for XML character data and attribute values.
+ */
+size_t
+logutl_span_xml(const char *s) {
+	return logutl_span(s, false, "<>&\"'", 5);
+}
+
+/*
+ * Write the lowercase hex representation of the sz bytes at src to the
+ * 2 * sz bytes at dst, without terminating NUL.
+ */
 void
-logutl_fwrite_hex(FILE *f, const unsigned char *buf, size_t sz) {
+logutl_hex(char *dst, const unsigned char *src, size_t sz) {
+#ifdef __SSE2__
+	const __m128i lomask = _mm_set1_epi8(0x0F);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i digit = _mm_set1_epi8('0');
+	const __m128i alpha = _mm_set1_epi8('a' - '0' - 10);
+	__m128i v, hi, lo;
+
+	for (; sz >= 16; sz -= 16, src += 16, dst += 32) {
+		v = _mm_loadu_si128((const __m128i *)src);
+		hi = _mm_and_si128(_mm_srli_epi16(v, 4), lomask);
+		lo = _mm_and_si128(v, lomask);
+		hi = _mm_add_epi8(_mm_add_epi8(hi, digit), _mm_and_si128(
+		                  _mm_cmpgt_epi8(hi, nine), alpha));
+		lo = _mm_add_epi8(_mm_add_epi8(lo, digit), _mm_and_si128(
+		                  _mm_cmpgt_epi8(lo, nine), alpha));
+		_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *)(dst + 16),
+		                 _mm_unpackhi_epi8(hi, lo));
+	}
+#endif /* __SSE2__ */
 	for (size_t i = 0; i < sz; i++) {
-		fprintf(f, "%02x", buf[i]);
+		dst[2 * i] = hexdigits[src[i] >> 4];
+		dst[2 * i + 1] = hexdigits[src[i] & 0x0F];
 	}
 }
 
 void
-logutl_fwrite_timespec(FILE *f, struct timespec *tv) {
-	char buf[20];
-	struct tm stm;
+logutl_fwrite_hex(FILE *f, const unsigned char *buf, size_t sz) {
+	char s[128];
+	size_t n;
 
-	gmtime_r(&tv->tv_sec, &stm);
-	strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &stm);
-	fprintf(f, "%s.%09luZ", buf, tv->tv_nsec);
+	while (sz > 0) {
+		n = sz < sizeof(s) / 2 ? sz : sizeof(s) / 2;
+		logutl_hex(s, buf, n);
+		fwrite(s, 2 * n, 1, f);
+		buf += n;
+		sz -= n;
+	}
 }
 
+/*
+ * Format the date and time of sec as YYYY-MM-DDTHH:MM:SS without calling
+ * gmtime_r and strftime, using the days-to-civil conversion of the
+ * proleptic Gregorian calendar by Howard Hinnant.  Times outside of the
+ * years 0000 to 9999 are clamped, as they do not fit the fixed width.
+ */
+static void
+logutl_datetime(char *p, time_t sec) {
+	int64_t days, z, era, doe, yoe, y, doy, mp, d, m, sod;
+
+	if (sec < -62167219200)                 /* 0000-01-01T00:00:00Z */
+		sec = -62167219200;
+	else if (sec > 253402300799)            /* 9999-12-31T23:59:59Z */
+		sec = 253402300799;
+	days = sec / 86400;
+	sod = sec % 86400;
+	if (sod < 0) {
+		sod += 86400;
+		days--;
+	}
+	z = days + 719468;
+	era = (z >= 0 ? z : z - 146096) / 146097;
+	doe = z - era * 146097;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+	d = doy - (153 * mp + 2) / 5 + 1;
+	m = mp < 10 ? mp + 3 : mp - 9;
+	y = yoe + era * 400 + (m <= 2);
+	logutl_put2(p, (unsigned int)(y / 100));
+	logutl_put2(p + 2, (unsigned int)(y % 100));
+	p[4] = '-';
+	logutl_put2(p + 5, (unsigned int)m);
+	p[7] = '-';
+	logutl_put2(p + 8, (unsigned int)d);
+	p[10] = 'T';
+	logutl_put2(p + 11, (unsigned int)(sod / 3600));
+	p[13] = ':';
+	logutl_put2(p + 14, (unsigned int)(sod / 60 % 60));
+	p[16] = ':';
+	logutl_put2(p + 17, (unsigned int)(sod % 60));
+}
+
+/*
+ * Prime slot i with second i, so that no slot ever matches uninitialized.
+ */
+void
+logutl_tscache_init(logutl_tscache_t *c) {
+	for (size_t i = 0; i < LOGUTL_TSCACHE_SLOTS; i++) {
+		c->sec[i] = (time_t)i;
+		logutl_datetime(c->prefix[i], (time_t)i);
+	}
+}
+
+/*
+ * Write the LOGUTL_TIMESTAMPSZ bytes of the ISO 8601 representation of tv
+ * in UTC with nanoseconds to dst, without terminating NUL.  Timestamps
+ * within the same second share the date and time from the cache; an
+ * image-exec has timestamps from a handful of different seconds.
+ */
+void
+logutl_timestamp(char *dst, const struct timespec *tv, logutl_tscache_t *c) {
+	size_t slot = (size_t)((uint64_t)tv->tv_sec % LOGUTL_TSCACHE_SLOTS);
+	unsigned int ns = (unsigned int)tv->tv_nsec;
+
+	if (c->sec[slot] != tv->tv_sec) {
+		logutl_datetime(c->prefix[slot], tv->tv_sec);
+		c->sec[slot] = tv->tv_sec;
+	}
+	memcpy(dst, c->prefix[slot], 19);
+	dst[19] = '.';
+	dst[20] = '0' + ns / 100000000;
+	ns %= 100000000;
+	logutl_put2(dst + 21, ns / 1000000);
+	logutl_put2(dst + 23, ns / 10000 % 100);
+	logutl_put2(dst + 25, ns / 100 % 100);
+	logutl_put2(dst + 27, ns % 100);
+	dst[29] = 'Z';
+}
+
+void
+logutl_fwrite_timespec(FILE *f, struct timespec *tv, logutl_tscache_t *c) {
+	char buf[LOGUTL_TIMESTAMPSZ];
+
+	logutl_timestamp(buf, tv, c);
+	fwrite(buf, sizeof(buf), 1, f);
+}
 
@@ -13,11 +13,33 @@
 
 #include "attrib.h"
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <time.h>
 
+#define LOGUTL_TIMESTAMPSZ      30      /* 2019-01-27T12:34:56.123456789Z */
+#define LOGUTL_TSCACHE_SLOTS    4
+
+/*
+ * Formatted date and time of the seconds of recent timestamps, direct-mapped
+ * by second.  One per rendering context.
+ */
+typedef struct {
+	time_t sec[LOGUTL_TSCACHE_SLOTS];
+	char prefix[LOGUTL_TSCACHE_SLOTS][19];  /* not terminated */
+} logutl_tscache_t;
+
+size_t logutl_span_json(const char *) NONNULL(1) WUNRES;
+size_t logutl_span_yaml(const char *) NONNULL(1) WUNRES;
+size_t logutl_span_xml(const char *) NONNULL(1) WUNRES;
+void logutl_hex(char *, const unsigned char *, size_t) NONNULL(1,2);
 void logutl_fwrite_hex(FILE *, const unsigned char *, size_t) NONNULL(1,2);
-void logutl_fwrite_timespec(FILE *, struct timespec *) NONNULL(1,2);
+void logutl_tscache_init(logutl_tscache_t *) NONNULL(1);
+void logutl_timestamp(char *, const struct timespec *, logutl_tscache_t *)
+     NONNULL(1,2,3);
+void logutl_fwrite_timespec(FILE *, struct timespec *, logutl_tscache_t *)
+     NONNULL(1,2,3);
 
 #endif
 
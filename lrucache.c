@@ -9,16 +9,24 @@
  */
 
 /*
- * Generic, fixed-size least-recently-used cache based on tommy_hashtable and
- * tommy_list.  The implementation is not thread-safe.
+ * Generic, bounded-size least-recently-used cache based on tommy_hashtable
+ * and tommy_list.  The implementation is not thread-safe, except for the
+ * memory budget shared by all caches.
  */
 
 #include "lrucache.h"
 
 #include "tommy_ext.h"
 
+#include <stdint.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
+
+static pthread_mutex_t budget_mutex = PTHREAD_MUTEX_INITIALIZER;
+static size_t budget_limit;
+static size_t budget_reserved;
 
 typedef struct {
 	void *key;
@@ -39,32 +47,345 @@ freeargfunc(void *arg, void *obj) {
 	freefunc(node->data);
 }
 
+/*
+ * Hash functions for fixed-size keys, for use as `hashfunc' argument to
+ * lrucache_init.  lrucache_hash_digest is for keys that are cryptographic
+ * digests or other uniformly distributed hashes:  the key is folded into 32
+ * bits by xor'ing its 32 bit words without any further mixing.  Folding
+ * instead of truncating keeps it working for hashes_t keys, where only some
+ * of the digests may have been calculated and the others are zero.  The
+ * size must be a multiple of 4.  lrucache_hash_mix is for keys of up to 16
+ * bytes such as dev and ino, which are mixed using tommy_inthash_u64.
+ */
+tommy_hash_t
+lrucache_hash_digest(const void *key, size_t sz) {
+	const unsigned char *p = key;
+	uint32_t h = 0, w;
+
+	assert(sz % sizeof(uint32_t) == 0);
+	for (size_t i = 0; i < sz; i += sizeof(uint32_t)) {
+		memcpy(&w, p + i, sizeof(uint32_t));
+		h ^= w;
+	}
+	return h;
+}
+
+tommy_hash_t
+lrucache_hash_mix(const void *key, size_t sz) {
+	uint64_t w[2] = {0, 0};
+	uint64_t h;
+
+	assert(sz <= sizeof(w));
+	memcpy(w, key, sz);
+	h = tommy_inthash_u64(w[0] ^ tommy_inthash_u64(w[1]));
+	return (tommy_hash_t)(h ^ (h >> 32));
+}
+
+static tommy_hash_t
+lrucache_hash_default(const void *key, size_t sz) {
+	return tommy_hash_u32(0, key, sz);
+}
+
+/*
+ * Parse a replacement policy name into LRUCACHE_FLAG_* flags.
+ * Returns -1 for unknown names.
+ */
+int
+lrucache_policy(const char *s) {
+	if (!strcmp(s, "lru"))
+		return 0;
+	if (!strcmp(s, "clock"))
+		return LRUCACHE_FLAG_CLOCK;
+	if (!strcmp(s, "slru"))
+		return LRUCACHE_FLAG_SLRU;
+	return -1;
+}
+
+const char *
+lrucache_policy_s(int flags) {
+	if (flags & LRUCACHE_FLAG_CLOCK)
+		return "clock";
+	if (flags & LRUCACHE_FLAG_SLRU)
+		return "slru";
+	return "lru";
+}
+
+static tommy_list *
+lrucache_list(lrucache_t *this, lrucache_node_t *node) {
+	return node->protected ? &this->protected : &this->list;
+}
+
+static void
+lrucache_unlink(lrucache_t *this, lrucache_node_t *node) {
+	tommy_list_remove_existing(lrucache_list(this, node), &node->l_node);
+	if (node->protected)
+		this->protected_count--;
+}
+
+/*
+ * Free an object that is no longer stored in the cache, or queue it for
+ * lrucache_reclaim in deferred mode.  The object's list node is unused once
+ * unlinked and doubles as link on the garbage list.
+ */
+static void
+lrucache_discard(lrucache_t *this, lrucache_node_t *node, void *data) {
+	if (this->flags & LRUCACHE_FLAG_DEFER) {
+		tommy_list_insert_tail(&this->garbage, &node->l_node, data);
+		return;
+	}
+	this->freefunc(data);
+}
+
+/*
+ * (Re)allocate the ghost table for the current number of buckets.  Ghosts
+ * are an optimization only, so running without them on allocation failure
+ * is fine.
+ */
+static void
+lrucache_ghost_init(lrucache_t *this) {
+	tommy_count_t n;
+
+	free(this->ghost);
+	n = tommy_roundup_pow2_u32(this->bucket_max);
+	this->ghost = calloc(n, sizeof(tommy_hash_t));
+	this->ghost_mask = this->ghost ? n - 1 : 0;
+}
+
+/*
+ * Insert an object that is not yet linked at the head of the protected
+ * segment, demoting the least recently used protected object to the head of
+ * the probationary segment if the protected segment is full.
+ */
+static void
+lrucache_protect(lrucache_t *this, lrucache_node_t *node) {
+	tommy_node *lnode;
+	lrucache_node_t *lrunode;
+
+	tommy_list_insert_head(&this->protected, &node->l_node, node);
+	node->protected = true;
+	this->protected_count++;
+	if (this->protected_count > this->protected_max) {
+		lnode = tommy_list_tail(&this->protected);
+		lrunode = lnode->data;
+		tommy_list_remove_existing(&this->protected, lnode);
+		tommy_list_insert_head(&this->list, lnode, lrunode);
+		lrunode->protected = false;
+		this->protected_count--;
+	}
+}
+
+/*
+ * Move an object that was hit to the head of the protected segment.
+ */
+static void
+lrucache_promote(lrucache_t *this, lrucache_node_t *node) {
+	if (node->protected) {
+		if (&node->l_node == tommy_list_head(&this->protected))
+			return;
+		tommy_list_remove_existing(&this->protected, &node->l_node);
+		tommy_list_insert_head(&this->protected, &node->l_node, node);
+		return;
+	}
+	tommy_list_remove_existing(&this->list, &node->l_node);
+	lrucache_protect(this, node);
+}
+
+/*
+ * Select the object to evict from a full cache.
+ */
+static lrucache_node_t *
+lrucache_victim(lrucache_t *this) {
+	tommy_node *lnode;
+	lrucache_node_t *lrunode;
+
+	if (tommy_list_empty(&this->list))
+		return tommy_list_tail(&this->protected)->data;
+	lnode = tommy_list_tail(&this->list);
+	lrunode = lnode->data;
+	while ((this->flags & LRUCACHE_FLAG_CLOCK) &&
+	       lrunode->referenced) {
+		lrunode->referenced = false;
+		tommy_list_remove_existing(&this->list, lnode);
+		tommy_list_insert_head(&this->list, lnode, lrunode);
+		lnode = tommy_list_tail(&this->list);
+		lrunode = lnode->data;
+	}
+	return lrunode;
+}
+
+/*
+ * Estimated bytes used by a cache with `buckets' buckets of which `used' are
+ * in use, counting objects, the hashtable's bucket array and the ghost table.
+ */
+static size_t
+lrucache_bytes(lrucache_t *this, tommy_count_t buckets, tommy_count_t used) {
+	size_t bytes;
+
+	bytes = used * this->objsz +
+	        tommy_roundup_pow2_u32(buckets) * sizeof(tommy_hashtable_node *);
+	if (this->flags & LRUCACHE_FLAG_SLRU)
+		bytes += tommy_roundup_pow2_u32(buckets) * sizeof(tommy_hash_t);
+	return bytes;
+}
+
+/*
+ * Set the memory budget in bytes that caches are allowed to grow into.
+ * Caches are always allowed their initial number of buckets, which counts
+ * against the budget.  A budget of 0 disables growth.  Thread-safe.
+ */
+void
+lrucache_budget(size_t bytes) {
+	pthread_mutex_lock(&budget_mutex);
+	budget_limit = bytes;
+	pthread_mutex_unlock(&budget_mutex);
+}
+
+/*
+ * Bytes currently accounted against the budget by all caches.  Thread-safe.
+ */
+size_t
+lrucache_reserved(void) {
+	size_t reserved;
+
+	pthread_mutex_lock(&budget_mutex);
+	reserved = budget_reserved;
+	pthread_mutex_unlock(&budget_mutex);
+	return reserved;
+}
+
+/*
+ * Double the number of buckets if the budget allows for it, rehashing all
+ * objects into a new hashtable.
+ */
+static void
+lrucache_grow(lrucache_t *this) {
+	tommy_hashtable hashtable;
+	tommy_count_t bucket_max;
+	tommy_node *lnode;
+	lrucache_node_t *lrunode;
+	size_t reserve;
+	bool ok;
+
+	bucket_max = bucket_max_for_buckets(this->bucket_max * 2);
+	reserve = lrucache_bytes(this, bucket_max, bucket_max);
+	pthread_mutex_lock(&budget_mutex);
+	ok = budget_reserved - this->reserved + reserve <= budget_limit;
+	if (ok)
+		budget_reserved = budget_reserved - this->reserved + reserve;
+	pthread_mutex_unlock(&budget_mutex);
+	if (!ok)
+		return;
+	this->reserved = reserve;
+
+	tommy_hashtable_init(&hashtable, bucket_max);
+	for (lnode = tommy_list_head(&this->list); lnode; lnode = lnode->next) {
+		lrunode = lnode->data;
+		tommy_hashtable_insert(&hashtable, &lrunode->h_node, lrunode,
+		                       lrunode->h_node.key);
+	}
+	for (lnode = tommy_list_head(&this->protected); lnode;
+	     lnode = lnode->next) {
+		lrunode = lnode->data;
+		tommy_hashtable_insert(&hashtable, &lrunode->h_node, lrunode,
+		                       lrunode->h_node.key);
+	}
+	tommy_hashtable_done(&this->hashtable);
+	this->hashtable = hashtable;
+	this->bucket_max = bucket_max;
+	this->protected_max = bucket_max - bucket_max / LRUCACHE_SLRU_PROBATION;
+	if (this->ghost)
+		lrucache_ghost_init(this);
+	this->stat.size = bucket_max;
+	this->stat.grows++;
+}
+
+/*
+ * Close the current window once it has seen as many gets as there are
+ * buckets, growing the cache if it evicted objects and missed too often.
+ * Invalid objects are misses that a larger cache would not have avoided.
+ */
+static void
+lrucache_adapt(lrucache_t *this) {
+	uint64_t gets, misses, invalids;
+
+	gets = this->stat.gets - this->win_gets;
+	if (gets < this->bucket_max)
+		return;
+	misses = this->stat.misses - this->win_misses;
+	invalids = this->stat.invalids - this->win_invalids;
+	if ((this->evictions > this->win_evictions) &&
+	    (misses * LRUCACHE_GROW_MISSRATE > gets) &&
+	    (invalids < misses))
+		lrucache_grow(this);
+	this->win_gets = this->stat.gets;
+	this->win_misses = this->stat.misses;
+	this->win_invalids = this->stat.invalids;
+	this->win_evictions = this->evictions;
+}
+
 /*
  * Initialize an already allocated tommy_lrucache struct with the given
- * number of effectively usable cache buckets.  The initial `hashsz', `compsz'
- * and `condsz' bytes of stored objects are used as input to the hash function,
- * as key for key comparison in get and put operations, and as object validity
- * criteria as part of get operations.  If `hashsz' and `compsz' are equal, the
- * full number of key bytes is also used as hash, which is the right thing to
- * do when in doubt.  If `condsz' is 0, objects are not checked for validity.
- * The cache uses `freefunc' to free objects for cache eviction.
+ * initial number of effectively usable cache buckets.  `objsz' is the
+ * estimated number of bytes per stored object, including any memory it
+ * references, used for reporting and for growing within the budget.  The
+ * initial `hashsz', `compsz' and `condsz' bytes of stored objects are used as
+ * input to the hash function, as key for key comparison in get and put
+ * operations, and as object validity criteria as part of get operations.  If
+ * `hashsz' and `compsz' are equal, the full number of key bytes is also used
+ * as hash, which is the right thing to do when in doubt.  If `condsz' is 0,
+ * objects are not checked for validity.  If `hashfunc' is not NULL, it is
+ * used instead of tommy_hash_u32 to hash the initial `hashsz' bytes of keys,
+ * see lrucache_hash_digest and lrucache_hash_mix.
+ * If `flags' contains LRUCACHE_FLAG_CLOCK, hits only set a referenced bit on
+ * the object and eviction gives referenced objects a second chance, so that
+ * get operations do not modify the LRU queue.  If `flags' contains
+ * LRUCACHE_FLAG_SLRU, the cache uses the segmented LRU policy instead.  The
+ * two flags are mutually exclusive.
+ * The cache uses `freefunc' to free objects for cache eviction; if `flags'
+ * contains LRUCACHE_FLAG_DEFER, only once they are passed to
+ * lrucache_reclaim.
  */
 void
-lrucache_init(lrucache_t *this, tommy_count_t buckets,
-              size_t hashsz, size_t compsz, size_t condsz,
+lrucache_init(lrucache_t *this, tommy_count_t buckets, size_t objsz,
+              size_t hashsz, size_t compsz, size_t condsz, int flags,
+              lrucache_hash_func_t *hashfunc,
               lrucache_free_func_t *freefunc) {
 	assert(this);
 	assert(freefunc);
+	assert(!((flags & LRUCACHE_FLAG_CLOCK) && (flags & LRUCACHE_FLAG_SLRU)));
 
 	this->bucket_max = bucket_max_for_buckets(buckets);
+	this->protected_max = this->bucket_max -
+	                      this->bucket_max / LRUCACHE_SLRU_PROBATION;
+	this->protected_count = 0;
+	this->ghost = NULL;
+	this->ghost_mask = 0;
+	this->objsz = objsz;
+	this->win_gets = 0;
+	this->win_misses = 0;
+	this->win_invalids = 0;
+	this->evictions = 0;
+	this->win_evictions = 0;
 	this->hashsz = hashsz;
 	this->compsz = compsz;
 	this->condsz = condsz;
+	this->flags = flags;
+	this->hashfunc = hashfunc ? hashfunc : lrucache_hash_default;
 	this->freefunc = freefunc;
 	bzero(&this->stat, sizeof(this->stat));
+	this->stat.policy = flags & (LRUCACHE_FLAG_CLOCK|LRUCACHE_FLAG_SLRU);
 	this->stat.size = this->bucket_max;
 	tommy_hashtable_init(&this->hashtable, this->bucket_max);
 	tommy_list_init(&this->list);
+	tommy_list_init(&this->protected);
+	tommy_list_init(&this->garbage);
+	if (flags & LRUCACHE_FLAG_SLRU)
+		lrucache_ghost_init(this);
+	this->reserved = lrucache_bytes(this, this->bucket_max,
+	                                this->bucket_max);
+	pthread_mutex_lock(&budget_mutex);
+	budget_reserved += this->reserved;
+	pthread_mutex_unlock(&budget_mutex);
 }
 
 /*
@@ -72,7 +393,11 @@ lrucache_init(lrucache_t *this, tommy_count_t buckets,
  * If an object with matching key is already in the cache, `data' is freed and
  * the object already in the cache is moved to the beginning of the LRU queue.
  * If the cache is already at maximum capacity, the object at the end of the
- * LRU queue will be freed using `freefunc'.
+ * LRU queue will be freed using `freefunc'.  In CLOCK mode, referenced objects
+ * at the end of the LRU queue are moved to the beginning with their referenced
+ * bit cleared until an unreferenced object is found for eviction.  In SLRU
+ * mode, new objects are put at the beginning of the probationary segment,
+ * or of the protected segment if they were recently evicted from probation.
  *
  * The inital `compsz` bytes of the object must not be modified while the
  * object remains stored in the cache.
@@ -80,7 +405,6 @@ lrucache_init(lrucache_t *this, tommy_count_t buckets,
 void
 lrucache_put(lrucache_t *this, lrucache_node_t *node, void *data) {
 	compfunc_ctx_t ctx;
-	tommy_node *lnode;
 	lrucache_node_t *lrunode;
 	tommy_hash_t h;
 
@@ -90,23 +414,34 @@ lrucache_put(lrucache_t *this, lrucache_node_t *node, void *data) {
 
 	this->stat.puts++;
 	if (tommy_hashtable_count(&this->hashtable) == this->bucket_max) {
-		lnode = tommy_list_tail(&this->list);
-		lrunode = lnode->data;
-		tommy_list_remove_existing(&this->list, lnode);
+		lrunode = lrucache_victim(this);
+		if (this->ghost && !lrunode->protected) {
+			this->ghost[lrunode->h_node.key & this->ghost_mask] =
+			        lrunode->h_node.key;
+		}
+		lrucache_unlink(this, lrunode);
 		tommy_hashtable_remove_existing(&this->hashtable,
 		                                &lrunode->h_node);
-		this->freefunc(lrunode->data);
+		lrucache_discard(this, lrunode, lrunode->data);
+		this->evictions++;
 	}
 	ctx.key = data;
 	ctx.sz = this->compsz;
-	h = tommy_hash_u32(0, data, this->hashsz);
+	h = this->hashfunc(data, this->hashsz);
 	lrunode = tommy_hashtable_search(&this->hashtable, compfunc, &ctx, h);
 	if (lrunode) {
-		this->freefunc(data);
+		lrucache_discard(this, node, data);
 		return;
 	}
 	node->data = data;
+	node->referenced = false;
+	node->protected = false;
 	tommy_hashtable_insert(&this->hashtable, &node->h_node, node, h);
+	if (this->ghost && h && this->ghost[h & this->ghost_mask] == h) {
+		this->ghost[h & this->ghost_mask] = 0;
+		lrucache_protect(this, node);
+		return;
+	}
 	tommy_list_insert_head(&this->list, &node->l_node, node);
 }
 
@@ -130,10 +465,11 @@ lrucache_get(lrucache_t *this, void *key) {
 	assert(key);
 
 	this->stat.gets++;
+	lrucache_adapt(this);
 	ctx.key = key;
 	ctx.sz = this->compsz;
 	lrunode = tommy_hashtable_search(&this->hashtable, compfunc, &ctx,
-	                                 tommy_hash_u32(0, key, this->hashsz));
+	                                 this->hashfunc(key, this->hashsz));
 	if (!lrunode) {
 		this->stat.misses++;
 		return NULL;
@@ -144,12 +480,16 @@ lrucache_get(lrucache_t *this, void *key) {
 	             this->condsz - this->compsz)) {
 		tommy_hashtable_remove_existing(&this->hashtable,
 		                                &lrunode->h_node);
-		tommy_list_remove_existing(&this->list, &lrunode->l_node);
-		this->freefunc(lrunode->data);
+		lrucache_unlink(this, lrunode);
+		lrucache_discard(this, lrunode, lrunode->data);
 		this->stat.invalids++;
 		return NULL;
 	}
-	if (&lrunode->l_node != tommy_list_head(&this->list)) {
+	if (this->flags & LRUCACHE_FLAG_CLOCK) {
+		lrunode->referenced = true;
+	} else if (this->flags & LRUCACHE_FLAG_SLRU) {
+		lrucache_promote(this, lrunode);
+	} else if (&lrunode->l_node != tommy_list_head(&this->list)) {
 		tommy_list_remove_existing(&this->list, &lrunode->l_node);
 		tommy_list_insert_head(&this->list, &lrunode->l_node, lrunode);
 	}
@@ -158,7 +498,128 @@ lrucache_get(lrucache_t *this, void *key) {
 }
 
 /*
- * Return statistics.
+ * Look up an object like lrucache_get, but without checking its validity,
+ * without updating the statistics and without affecting its recency, for
+ * maintenance that should not interfere with the replacement policy.
+ */
+void *
+lrucache_peek(lrucache_t *this, void *key) {
+	compfunc_ctx_t ctx;
+	lrucache_node_t *lrunode;
+
+	assert(this);
+	assert(key);
+
+	ctx.key = key;
+	ctx.sz = this->compsz;
+	lrunode = tommy_hashtable_search(&this->hashtable, compfunc, &ctx,
+	                                 this->hashfunc(key, this->hashsz));
+	return lrunode ? lrunode->data : NULL;
+}
+
+/*
+ * Account for `n' gets that were answered as misses without consulting the
+ * cache, such as by a filter in front of it.
+ */
+void
+lrucache_misses(lrucache_t *this, uint64_t n) {
+	assert(this);
+
+	this->stat.gets += n;
+	this->stat.misses += n;
+	lrucache_adapt(this);
+}
+
+/*
+ * Remove an object that is stored in the cache, such as one returned by
+ * lrucache_get, and free it using `freefunc'.  Counts as an invalid object.
+ */
+void
+lrucache_invalidate(lrucache_t *this, lrucache_node_t *node) {
+	assert(this);
+	assert(node);
+
+	tommy_hashtable_remove_existing(&this->hashtable, &node->h_node);
+	lrucache_unlink(this, node);
+	lrucache_discard(this, node, node->data);
+	this->stat.invalids++;
+}
+
+static size_t
+lrucache_purge_list(lrucache_t *this, tommy_list *list,
+                    lrucache_visit_func_t *func, void *arg) {
+	tommy_node *lnode, *next;
+	lrucache_node_t *node;
+	size_t n = 0;
+
+	for (lnode = tommy_list_head(list); lnode; lnode = next) {
+		next = lnode->next;
+		node = lnode->data;
+		if (!func(node->data, arg))
+			continue;
+		tommy_hashtable_remove_existing(&this->hashtable,
+		                                &node->h_node);
+		lrucache_unlink(this, node);
+		lrucache_discard(this, node, node->data);
+		n++;
+	}
+	return n;
+}
+
+/*
+ * Remove all objects for which `func' returns true from the cache and free
+ * them using `freefunc', such as all objects of a device that went away.
+ * Unlike lrucache_invalidate, removed objects do not count as invalid ones
+ * and are not remembered as ghosts.  Returns the number of removed objects.
+ */
+size_t
+lrucache_purge(lrucache_t *this, lrucache_visit_func_t *func, void *arg) {
+	size_t n;
+
+	assert(this);
+	assert(func);
+
+	n = lrucache_purge_list(this, &this->list, func, arg);
+	n += lrucache_purge_list(this, &this->protected, func, arg);
+	return n;
+}
+
+/*
+ * Take the objects queued for freeing in deferred mode off the cache, for
+ * passing to lrucache_reclaim.  Must be called under the same lock as the
+ * operations that queued them.  Returns NULL if there are none.
+ */
+tommy_node *
+lrucache_garbage(lrucache_t *this) {
+	tommy_node *head;
+
+	assert(this);
+
+	head = tommy_list_head(&this->garbage);
+	tommy_list_init(&this->garbage);
+	return head;
+}
+
+/*
+ * Free the objects returned by lrucache_garbage using `freefunc'.  Does not
+ * access the cache otherwise, so it can and should be called after releasing
+ * the lock around the cache.
+ */
+void
+lrucache_reclaim(lrucache_t *this, tommy_node *garbage) {
+	tommy_node *next;
+
+	assert(this);
+
+	while (garbage) {
+		next = garbage->next;
+		this->freefunc(garbage->data);
+		garbage = next;
+	}
+}
+
+/*
+ * Return statistics.  The cache itself is reported as a single shard.
  */
 void
 lrucache_stats(lrucache_t *this, lrucache_stat_t *st) {
@@ -166,20 +627,96 @@ lrucache_stats(lrucache_t *this, lrucache_stat_t *st) {
 	assert(st);
 
 	this->stat.used = tommy_hashtable_count(&this->hashtable);
+	this->stat.bytes = lrucache_bytes(this, this->bucket_max,
+	                                  this->stat.used);
+	this->stat.protected = this->protected_count;
+	this->stat.hitrate = lrucache_hitrate(this->stat.hits,
+	                                      this->stat.gets);
+	this->stat.shards = 1;
+	this->stat.shard[0].used = this->stat.used;
+	this->stat.shard[0].hits = this->stat.hits;
+	this->stat.shard[0].misses = this->stat.misses;
 	*st = this->stat;
 }
 
+static void
+lrucache_foreach_list(tommy_list *list, lrucache_foreach_func_t *func,
+                      void *arg) {
+	tommy_node *lnode, *head;
+
+	head = tommy_list_head(list);
+	if (!head)
+		return;
+	lnode = tommy_list_tail(list);
+	for (;;) {
+		func(((lrucache_node_t *)lnode->data)->data, arg);
+		if (lnode == head)
+			break;
+		lnode = lnode->prev;
+	}
+}
+
 /*
- * Flush the cache, resulting in an empty initialized cache.
- * Objects stored in the cache will be freed using `freefunc'.
+ * Call `func' for all objects in the cache, from the least to the most
+ * recently used one, such that putting the objects into an empty cache in
+ * the same order recreates the LRU queue.  In SLRU mode, probationary objects
+ * are visited before protected ones; recreating the cache puts all objects
+ * into the probationary segment.  The cache must not be modified from within
+ * `func'.
+ */
+void
+lrucache_foreach(lrucache_t *this, lrucache_foreach_func_t *func, void *arg) {
+	assert(this);
+	assert(func);
+
+	lrucache_foreach_list(&this->list, func, arg);
+	lrucache_foreach_list(&this->protected, func, arg);
+}
+
+/*
+ * Call `func' for objects in the cache from the most to the least recently
+ * used one until it returns false.  In SLRU mode, protected objects are
+ * visited before probationary ones.  In CLOCK mode, the order is that of
+ * insertion and second chances.  The cache must not be modified from within
+ * `func'.
+ */
+void
+lrucache_visit_mru(lrucache_t *this, lrucache_visit_func_t *func, void *arg) {
+	tommy_node *lnode;
+
+	assert(this);
+	assert(func);
+
+	for (lnode = tommy_list_head(&this->protected); lnode;
+	     lnode = lnode->next) {
+		if (!func(((lrucache_node_t *)lnode->data)->data, arg))
+			return;
+	}
+	for (lnode = tommy_list_head(&this->list); lnode;
+	     lnode = lnode->next) {
+		if (!func(((lrucache_node_t *)lnode->data)->data, arg))
+			return;
+	}
+}
+
+/*
+ * Flush the cache, resulting in an empty initialized cache of the current
+ * size.  Objects stored in the cache will be freed using `freefunc'.
  */
 void
 lrucache_flush(lrucache_t *this) {
 	assert(this);
 
-	lrucache_destroy(this);
+	tommy_hashtable_done(&this->hashtable);
+	tommy_list_foreach_arg(&this->list, freeargfunc,
+	                       (void *)this->freefunc);
+	tommy_list_foreach_arg(&this->protected, freeargfunc,
+	                       (void *)this->freefunc);
+	lrucache_reclaim(this, lrucache_garbage(this));
 	tommy_hashtable_init(&this->hashtable, this->bucket_max);
 	tommy_list_init(&this->list);
+	tommy_list_init(&this->protected);
+	this->protected_count = 0;
 }
 
 /*
@@ -193,5 +730,14 @@ lrucache_destroy(lrucache_t *this) {
 	tommy_hashtable_done(&this->hashtable);
 	tommy_list_foreach_arg(&this->list, freeargfunc,
 	                       (void *)this->freefunc);
+	tommy_list_foreach_arg(&this->protected, freeargfunc,
+	                       (void *)this->freefunc);
+	lrucache_reclaim(this, lrucache_garbage(this));
+	free(this->ghost);
+	this->ghost = NULL;
+	pthread_mutex_lock(&budget_mutex);
+	budget_reserved -= this->reserved;
+	pthread_mutex_unlock(&budget_mutex);
+	this->reserved = 0;
 }
 
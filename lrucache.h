@@ -16,6 +16,8 @@
 #include "tommylist.h"
 #include "tommyhashtbl.h"
 
+#include <stdbool.h>
+
 /*
  * Trade-off between the number of binaries actively used on a system, the
  * performance curves of the underlying data structures and acceptable memory
@@ -25,41 +27,145 @@
  */
 #define LRUCACHE_BUCKETS           12288
 
+/*
+ * Maximum number of independently locked shards a cache built on top of
+ * lrucache can report statistics for.
+ */
+#define LRUCACHE_SHARDS_MAX        16
+
+/*
+ * Approximate recency using the CLOCK algorithm:  hits only mark the object
+ * as referenced instead of moving it to the head of the LRU queue.
+ */
+#define LRUCACHE_FLAG_CLOCK        1
+
+/*
+ * Scan-resistant segmented LRU:  new objects enter a probationary segment and
+ * are only promoted to the protected segment on their first hit, so that
+ * objects used only once, such as during a file system sweep, cannot displace
+ * the working set.  Eviction takes from the probationary segment first.  The
+ * protected segment holds at most 1 - 1/LRUCACHE_SLRU_PROBATION of the
+ * buckets; objects pushed out of it are demoted back to probation.  Like the
+ * A1out queue of 2Q, a direct-mapped table of the hashes of objects recently
+ * evicted from probation lets objects that recur at intervals longer than
+ * the probationary segment go straight to the protected segment when they
+ * are put again.
+ */
+#define LRUCACHE_FLAG_SLRU         2
+#define LRUCACHE_SLRU_PROBATION    4
+
+/*
+ * Deferred freeing:  objects evicted, invalidated or rejected as duplicates
+ * by put, get and invalidate are queued on the cache instead of being freed
+ * right away, such that callers holding a lock around the cache can take
+ * them using lrucache_garbage and free them using lrucache_reclaim after
+ * releasing the lock.
+ */
+#define LRUCACHE_FLAG_DEFER        4
+
+/*
+ * Adaptive sizing:  after every window of as many gets as the cache has
+ * buckets, a cache that had to evict objects during the window doubles its
+ * number of buckets if more than 1/LRUCACHE_GROW_MISSRATE of the gets missed
+ * and fewer misses were due to invalid objects than due to absent ones, as
+ * long as the estimated memory use of all caches stays within the budget set
+ * with lrucache_budget.  Caches never shrink.
+ */
+#define LRUCACHE_GROW_MISSRATE     8
+
 typedef void lrucache_free_func_t(void *) NONNULL(1);
+typedef void lrucache_foreach_func_t(void *, void *) NONNULL(1);
+typedef bool lrucache_visit_func_t(void *, void *) NONNULL(1);
+typedef tommy_hash_t lrucache_hash_func_t(const void *, size_t) NONNULL(1);
 
 typedef struct lrucache_node {
 	tommy_hashtable_node h_node;
 	tommy_node l_node;
 	void *data;
+	bool referenced;
+	bool protected;
 } lrucache_node_t;
 
+typedef struct lrucache_shard_stat {
+	uint32_t used;
+	uint64_t hits;
+	uint64_t misses;
+} lrucache_shard_stat_t;
+
 typedef struct lrucache_stat {
+	int policy;             /* LRUCACHE_FLAG_* */
 	uint32_t size;
 	uint32_t used;
+	uint32_t protected;     /* used in protected segment */
+	uint32_t hitrate;       /* permille of gets */
+	uint64_t bytes;         /* estimated memory use of used buckets */
+	uint64_t grows;
 	uint64_t puts;
 	uint64_t gets;
 	uint64_t hits;
 	uint64_t misses;
 	uint64_t invalids;
+	uint64_t filtered;      /* misses answered by a filter, if any */
+	uint64_t falsepos;      /* misses the filter did not catch */
+	uint32_t shards;
+	lrucache_shard_stat_t shard[LRUCACHE_SHARDS_MAX];
 } lrucache_stat_t;
 
+static inline uint32_t
+lrucache_hitrate(uint64_t hits, uint64_t gets) {
+	return gets ? (uint32_t)(hits * 1000 / gets) : 0;
+}
+
 typedef struct lrucache {
 	tommy_hashtable hashtable;
-	tommy_list list;
+	tommy_list list;        /* probationary segment in SLRU mode */
+	tommy_list protected;
+	tommy_list garbage;     /* deferred frees */
+	tommy_count_t protected_count;
+	tommy_count_t protected_max;
+	tommy_hash_t *ghost;    /* hashes evicted from probation, or NULL */
+	tommy_count_t ghost_mask;
 	tommy_count_t bucket_max;
+	size_t objsz;
+	size_t reserved;        /* bytes accounted against the budget */
+	uint64_t win_gets;      /* counters at the start of the window */
+	uint64_t win_misses;
+	uint64_t win_invalids;
+	uint64_t evictions;
+	uint64_t win_evictions;
 	size_t hashsz;
 	size_t compsz;
 	size_t condsz;
+	int flags;
+	lrucache_hash_func_t *hashfunc;
 	lrucache_free_func_t *freefunc;
 	lrucache_stat_t stat;
 } lrucache_t;
 
-void lrucache_init(lrucache_t *, tommy_count_t,
-                   size_t, size_t, size_t,
+int lrucache_policy(const char *) NONNULL(1) WUNRES;
+const char * lrucache_policy_s(int);
+void lrucache_budget(size_t);
+size_t lrucache_reserved(void) WUNRES;
+tommy_hash_t lrucache_hash_digest(const void *, size_t) NONNULL(1) WUNRES;
+tommy_hash_t lrucache_hash_mix(const void *, size_t) NONNULL(1) WUNRES;
+void lrucache_init(lrucache_t *, tommy_count_t, size_t,
+                   size_t, size_t, size_t, int,
+                   lrucache_hash_func_t *,
                    lrucache_free_func_t *) NONNULL(1);
 void lrucache_put(lrucache_t *, lrucache_node_t *, void *) NONNULL(1,2,3);
 void * lrucache_get(lrucache_t *, void *) NONNULL(1,2) WUNRES;
+void * lrucache_peek(lrucache_t *, void *) NONNULL(1,2) WUNRES;
+void lrucache_misses(lrucache_t *, uint64_t) NONNULL(1);
+void lrucache_invalidate(lrucache_t *, lrucache_node_t *) NONNULL(1,2);
+size_t lrucache_purge(lrucache_t *, lrucache_visit_func_t *, void *)
+                      NONNULL(1,2);
+tommy_node * lrucache_garbage(lrucache_t *) NONNULL(1) WUNRES;
+void lrucache_reclaim(lrucache_t *, tommy_node *) NONNULL(1);
 void lrucache_stats(lrucache_t *, lrucache_stat_t *) NONNULL(1,2);
+void lrucache_foreach(lrucache_t *, lrucache_foreach_func_t *, void *)
+                      NONNULL(1,2);
+void lrucache_visit_mru(lrucache_t *, lrucache_visit_func_t *, void *)
+                        NONNULL(1,2);
 void lrucache_flush(lrucache_t *) NONNULL(1);
 void lrucache_destroy(lrucache_t *) NONNULL(1);
 
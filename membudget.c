@@ -0,0 +1,195 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "membudget.h"
+
+#include "log.h"
+#include "proc.h"
+#include "procmon.h"
+#include "lrucache.h"
+#include "cachehash.h"
+#include "hashes.h"
+#include "cachecsig.h"
+#include "cachecdhash.h"
+#include "cachefp.h"
+#include "cacheslice.h"
+#include "cachebuild.h"
+#include "cachebundle.h"
+#include "cacheseal.h"
+#include "counter.h"
+#include "minmax.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+/*
+ * Bounded memory mode.  Once per second, the event loop feeds the physical
+ * footprint of xnumon, which covers caches, queued events, the process
+ * table and image lineages alike, into membudget_tick.  If it stays at or
+ * above memory_budget for MEMBUDGET_RAISE_SECS consecutive seconds, the
+ * shedding level is raised by one step, up to MEMBUDGET_DETAIL.  After
+ * MEMBUDGET_LOWER_SECS consecutive seconds below MEMBUDGET_LOWER_PERCENT of
+ * the budget, it is lowered by one step again.  Every transition is logged
+ * as a xnumon-ops[0] event with op shed.
+ *
+ * Steps are ordered from cheapest to most visible loss:  the caches are
+ * flushed and kept from growing, which only costs CPU time for acquiring
+ * things again; then image lineages are pruned to degrade_ancestors as
+ * processes exec, which shortens ancestors in later events; finally, the
+ * environment of new images is dropped, which removes detail from events.
+ * The process table is never shed, as processes that are not tracked
+ * cannot be attributed, and the queues are bounded by queue_capacity.
+ *
+ * The cache table, process and image counts and queued events are
+ * reported alongside the footprint in xnumon-stats[1], so that the share
+ * of each can be told apart.
+ */
+
+atomic_uint membudget_current;
+
+static config_t *config = NULL;
+static unsigned int pressured;          /* consecutive seconds */
+static unsigned int calm;               /* consecutive seconds */
+static uint64_t footprint;
+static uint64_t footprintpeak;
+static uint64_t queued;
+static uint64_t raises;
+static uint64_t lowers;
+static uint64_t flushes;
+static counter_t envs_dropped;
+
+static const char *levelnames[MEMBUDGET_LEVELS] = {
+	"none", "caches", "ancestors", "detail"
+};
+
+const char *
+membudget_level_s(unsigned int level) {
+	if (level >= MEMBUDGET_LEVELS)
+		return "unknown";
+	return levelnames[level];
+}
+
+void
+membudget_init(config_t *cfg) {
+	config = cfg;
+	atomic_store(&membudget_current, MEMBUDGET_NONE);
+	pressured = 0;
+	calm = 0;
+	footprint = 0;
+	footprintpeak = 0;
+	queued = 0;
+	raises = 0;
+	lowers = 0;
+	flushes = 0;
+	counter_reset(&envs_dropped);
+}
+
+static void
+membudget_shed_caches(void) {
+	lrucache_budget(0);
+	cachehash_flush();
+	hashes_flush();
+	cachecsig_flush();
+	cachecdhash_flush();
+	cachefp_flush();
+	cacheslice_flush();
+	cachebuild_flush();
+	cachebundle_flush();
+	cacheseal_flush();
+	flushes++;
+}
+
+static void
+membudget_transition(unsigned int level, uint64_t budget) {
+	unsigned int prev = membudget_level();
+
+	atomic_store_explicit(&membudget_current, level, memory_order_relaxed);
+	if (level > prev) {
+		raises++;
+		if (level == MEMBUDGET_CACHES)
+			membudget_shed_caches();
+	} else {
+		lowers++;
+		if (level == MEMBUDGET_NONE)
+			lrucache_budget(config->cache_memory_budget *
+			                1024 * 1024);
+	}
+	if (log_event_xnumon_shed(level, prev, footprint, budget) == -1)
+		fprintf(stderr, "Failed to log shed transition: "
+		                "%s (%i)\n", strerror(errno), errno);
+}
+
+/*
+ * Called by the event loop every second with the physical footprint in
+ * bytes and the number of events in the work and log queues.
+ * Main thread only.
+ */
+void
+membudget_tick(uint64_t bytes, uint64_t events) {
+	uint64_t budget;
+	unsigned int level;
+
+	footprint = bytes;
+	footprintpeak = max(footprintpeak, bytes);
+	queued = events;
+	if (!config || config->memory_budget == 0)
+		return;
+
+	budget = (uint64_t)config->memory_budget * 1024 * 1024;
+	level = membudget_level();
+	if (bytes >= budget) {
+		calm = 0;
+		if (++pressured >= MEMBUDGET_RAISE_SECS &&
+		    level + 1 < MEMBUDGET_LEVELS) {
+			pressured = 0;
+			membudget_transition(level + 1, budget);
+		}
+	} else if (bytes * 100 < budget * MEMBUDGET_LOWER_PERCENT) {
+		pressured = 0;
+		if (++calm >= MEMBUDGET_LOWER_SECS && level > MEMBUDGET_NONE) {
+			calm = 0;
+			membudget_transition(level - 1, budget);
+		}
+	} else {
+		pressured = 0;
+		calm = 0;
+	}
+}
+
+/*
+ * Main thread only.
+ */
+void
+membudget_stats(membudget_stat_t *st) {
+	assert(st);
+
+	st->level = membudget_level();
+	st->raises = raises;
+	st->lowers = lowers;
+	st->budget = config ? (uint64_t)config->memory_budget * 1024 * 1024
+	                    : 0;
+	st->footprint = footprint;
+	st->footprintpeak = footprintpeak;
+	st->caches = lrucache_reserved();
+	st->procs = procs; /* external */
+	st->images = procmon_images();
+	st->queued = queued;
+	st->flushes = flushes;
+	st->envs_dropped = counter_get(&envs_dropped);
+}
+
+void
+membudget_dropped_env(void) {
+	counter_inc(&envs_dropped);
+}
+
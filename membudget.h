@@ -0,0 +1,61 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef MEMBUDGET_H
+#define MEMBUDGET_H
+
+#include "config.h"
+#include "attrib.h"
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* shedding levels, each implying all lower ones */
+#define MEMBUDGET_NONE          0
+#define MEMBUDGET_CACHES        1       /* flush caches, do not grow them */
+#define MEMBUDGET_ANCESTORS     2       /* keep degrade_ancestors in memory */
+#define MEMBUDGET_DETAIL        3       /* drop environment of new images */
+#define MEMBUDGET_LEVELS        4
+
+#define MEMBUDGET_RAISE_SECS    3       /* over budget before stepping up */
+#define MEMBUDGET_LOWER_SECS    30      /* low before stepping down */
+#define MEMBUDGET_LOWER_PERCENT 80      /* low mark in percent of budget */
+
+typedef struct {
+	uint32_t level;
+	uint64_t raises;
+	uint64_t lowers;
+	uint64_t budget;                /* bytes, 0 if disabled */
+	uint64_t footprint;             /* bytes at last tick */
+	uint64_t footprintpeak;
+	uint64_t caches;                /* bytes reserved by cache tables */
+	uint32_t procs;
+	uint32_t images;
+	uint64_t queued;                /* events in work and log queues */
+	uint64_t flushes;               /* cache flushes */
+	uint64_t envs_dropped;
+} membudget_stat_t;
+
+extern atomic_uint membudget_current;
+
+/*
+ * Current shedding level, may be called from any thread.
+ */
+#define membudget_level() \
+	atomic_load_explicit(&membudget_current, memory_order_relaxed)
+
+void membudget_init(config_t *) NONNULL(1);
+void membudget_tick(uint64_t, uint64_t);
+void membudget_stats(membudget_stat_t *) NONNULL(1);
+void membudget_dropped_env(void);
+const char * membudget_level_s(unsigned int) WUNRES;
+
+#endif
+
@@ -0,0 +1,177 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "metrics.h"
+
+#include "evtloop.h"
+#include "log.h"
+#include "time.h"
+#include "sys.h"
+
+#include "memstream.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+/*
+ * Read-only metrics endpoint on a Unix domain socket.  Every client
+ * connecting to the socket receives a single xnumon-stats record with the
+ * current counters, rendered in the configured log format, after which the
+ * connection is closed; there is no request to send.  The record is neither
+ * logged nor counted as logged, and the interval rates are relative to the
+ * previous xnumon-stats event without resetting them, so polling the socket
+ * does not affect the logged stats.
+ *
+ * Clients are served from the main thread.  Responses are rendered into
+ * memory and written without blocking; clients that do not accept the whole
+ * response into their socket buffer right away receive a truncated record.
+ * The socket is only accessible to root.
+ */
+
+#define METRICS_BACKLOG 16
+
+static int metrics_fd = -1;
+static char *metrics_path = NULL;
+
+/*
+ * Create the listening socket at path, replacing a stale socket left over
+ * from a previous run.  Returns the fd to watch for readability, on which
+ * metrics_serve must be called.
+ */
+int
+metrics_open(const char *path) {
+	int e;
+
+	metrics_path = strdup(path);
+	if (!metrics_path)
+		return -1;
+	metrics_fd = sys_unixsock_open(path, METRICS_BACKLOG);
+	if (metrics_fd == -1) {
+		e = errno;
+		free(metrics_path);
+		metrics_path = NULL;
+		errno = e;
+	}
+	return metrics_fd;
+}
+
+void
+metrics_close(void) {
+	if (metrics_fd == -1)
+		return;
+	sys_unixsock_close(metrics_fd, metrics_path);
+	metrics_fd = -1;
+	free(metrics_path);
+	metrics_path = NULL;
+}
+
+/*
+ * Render the current stats into a newly allocated buffer.
+ */
+static int
+metrics_render(char **buf, size_t *sz) {
+	evtloop_stat_t *st;
+	FILE *f;
+	int rv;
+
+	st = malloc(sizeof(evtloop_stat_t));
+	if (!st)
+		return -1;
+	bzero(st, sizeof(evtloop_stat_t));
+	evtloop_stats(st);
+	evtloop_stats_interval(st, false);
+	st->hdr.code = LOGEVT_XNUMON_STATS;
+	if (timespec_nanotime(&st->hdr.tv) == -1) {
+		free(st);
+		return -1;
+	}
+	*buf = NULL;
+	*sz = 0;
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunguarded-availability"
+	f = open_memstream(buf, sz);
+#pragma clang diagnostic pop
+	if (!f) {
+		free(st);
+		return -1;
+	}
+	rv = log_render(f, &st->hdr);
+	if (fclose(f) == EOF)
+		rv = -1;
+	free(st);
+	if (rv == -1) {
+		free(*buf);
+		*buf = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static void
+metrics_respond(int fd, const char *buf, size_t sz) {
+	int bufsz = (int)sz, one = 1;
+	ssize_t n;
+
+#ifdef SO_NOSIGPIPE
+	(void)setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#else
+	(void)one;
+#endif
+	(void)setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsz, sizeof(bufsz));
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+		return;
+	while (sz > 0) {
+		n = write(fd, buf, sz);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		buf += n;
+		sz -= (size_t)n;
+	}
+}
+
+/*
+ * Serve all pending clients.  Called by the event loop whenever the
+ * listening socket becomes readable.  The stats are rendered once for all
+ * clients pending at the same time.
+ */
+int
+metrics_serve(void) {
+	char *buf = NULL;
+	size_t sz = 0;
+	int fd;
+
+	for (;;) {
+		fd = sys_unixsock_accept(metrics_fd);
+		if (fd == -1) {
+			if (errno == EAGAIN)
+				break;
+			free(buf);
+			return -1;
+		}
+		if (!buf && metrics_render(&buf, &sz) == -1)
+			fprintf(stderr, "Failed to render metrics: %s (%i)\n",
+			                strerror(errno), errno);
+		if (buf)
+			metrics_respond(fd, buf, sz);
+		close(fd);
+	}
+	free(buf);
+	return 0;
+}
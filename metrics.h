@@ -0,0 +1,21 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "attrib.h"
+
+int metrics_open(const char *) NONNULL(1) WUNRES;
+void metrics_close(void);
+int metrics_serve(void);
+
+#endif
+
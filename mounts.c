@@ -0,0 +1,173 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "mounts.h"
+
+#include "cachehash.h"
+#include "cacheldpl.h"
+#include "cachebundle.h"
+#include "fsclass.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <assert.h>
+
+/*
+ * Tracking of mounted filesystems, for dropping the cache entries of a
+ * device once it is unmounted.  Entries keyed by (dev,ino) of a removable
+ * disk or network share that went away can never be hit again until the
+ * device number is reused by a later mount, where they would at best be
+ * rejected by their timestamps; until then they only take up room that
+ * live entries could use.
+ *
+ * The kernel signals mounts and unmounts without saying which filesystem
+ * changed, so the list of mounted devices is taken with getfsstat(2) on
+ * every change and compared to the previous one.  The device number of a
+ * filesystem is the first word of its fsid, which is what stat(2) reports
+ * as st_dev for files on it.  Main thread only, except for mounts_stats.
+ */
+
+static dev_t *devs = NULL;
+static size_t ndevs = 0;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t unmounts = 0;
+static uint64_t purged = 0;
+
+static int
+mounts_compare(const void *a, const void *b) {
+	dev_t da = *(const dev_t *)a;
+	dev_t db = *(const dev_t *)b;
+
+	return (da > db) - (da < db);
+}
+
+/*
+ * Returns a sorted array of the devices currently mounted and their number
+ * in *n, or NULL on errors.
+ */
+static dev_t *
+mounts_list(size_t *n) {
+	struct statfs *sfs;
+	dev_t *list;
+	int count;
+
+	count = getfsstat(NULL, 0, MNT_NOWAIT);
+	if (count == -1)
+		return NULL;
+	/* leave room for filesystems mounted in between */
+	count += 4;
+	sfs = malloc(count * sizeof(struct statfs));
+	if (!sfs)
+		return NULL;
+	count = getfsstat(sfs, count * sizeof(struct statfs), MNT_NOWAIT);
+	if (count == -1) {
+		free(sfs);
+		return NULL;
+	}
+	list = malloc((count + 1) * sizeof(dev_t));
+	if (!list) {
+		free(sfs);
+		return NULL;
+	}
+	for (int i = 0; i < count; i++)
+		list[i] = (dev_t)sfs[i].f_fsid.val[0];
+	free(sfs);
+	qsort(list, count, sizeof(dev_t), mounts_compare);
+	*n = (size_t)count;
+	return list;
+}
+
+static size_t
+mounts_purge(dev_t dev) {
+	size_t n;
+
+	n = cachehash_purge_dev(dev);
+	n += cacheldpl_purge_dev(dev);
+	n += cachebundle_purge_dev(dev);
+	fsclass_purge_dev(dev);
+	return n;
+}
+
+int
+mounts_init(void) {
+	dev_t *list;
+	size_t n;
+
+	list = mounts_list(&n);
+	if (!list)
+		return -1;
+	pthread_mutex_lock(&mutex);
+	devs = list;
+	ndevs = n;
+	unmounts = 0;
+	purged = 0;
+	pthread_mutex_unlock(&mutex);
+	return 0;
+}
+
+void
+mounts_fini(void) {
+	pthread_mutex_lock(&mutex);
+	free(devs);
+	devs = NULL;
+	ndevs = 0;
+	pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * Called by kqueue on mounts and unmounts.  Purges the caches of all devices
+ * that were mounted before but are not anymore.  Both lists are sorted, so
+ * a single merge pass finds them.  Failing to list the mounted filesystems
+ * is not fatal; the caches then keep their entries until the next change.
+ */
+int
+mounts_changed(unsigned int fflags, UNUSED void *udata) {
+	dev_t *list;
+	size_t n, i, j;
+	uint64_t gone = 0, dropped = 0;
+
+	if (!(fflags & (VQ_MOUNT|VQ_UNMOUNT)) || !devs)
+		return 0;
+	list = mounts_list(&n);
+	if (!list)
+		return 0;
+	for (i = 0, j = 0; i < ndevs; i++) {
+		while (j < n && list[j] < devs[i])
+			j++;
+		if (j < n && list[j] == devs[i])
+			continue;
+		gone++;
+		dropped += mounts_purge(devs[i]);
+	}
+	pthread_mutex_lock(&mutex);
+	free(devs);
+	devs = list;
+	ndevs = n;
+	unmounts += gone;
+	purged += dropped;
+	pthread_mutex_unlock(&mutex);
+	return 0;
+}
+
+void
+mounts_stats(mounts_stat_t *st) {
+	assert(st);
+
+	pthread_mutex_lock(&mutex);
+	st->mounted = ndevs;
+	st->unmounts = unmounts;
+	st->purged = purged;
+	pthread_mutex_unlock(&mutex);
+}
+
@@ -0,0 +1,30 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef MOUNTS_H
+#define MOUNTS_H
+
+#include "attrib.h"
+
+#include <stdint.h>
+
+typedef struct {
+	uint64_t mounted;               /* currently mounted filesystems */
+	uint64_t unmounts;              /* devices seen going away */
+	uint64_t purged;                /* cache entries dropped for them */
+} mounts_stat_t;
+
+int mounts_init(void) WUNRES;
+void mounts_fini(void);
+int mounts_changed(unsigned int, void *);
+void mounts_stats(mounts_stat_t *) NONNULL(1);
+
+#endif
+
@@ -0,0 +1,220 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "pathtree.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <errno.h>
+
+/*
+ * Radix tree mapping paths to data pointers.  Paths sharing a prefix share
+ * the nodes for it, each node holding the bytes of one edge inline, so that
+ * the bytes of a path are stored once per distinct prefix rather than once
+ * per path.  Lookups do not allocate.  Nodes stay at the same address for
+ * their whole lifetime, so users can keep pointers to the node of a path.
+ *
+ * Inner nodes left with only one child after a removal are not merged with
+ * that child again, since that would move it; they are freed once their
+ * whole subtree is gone.
+ */
+
+static pathtree_node_t *
+pathtree_node_new(pathtree_t *tree, pathtree_node_t *parent,
+                  const char *label, size_t len) {
+	pathtree_node_t *node;
+	size_t size = sizeof(pathtree_node_t) + len;
+
+	node = malloc(size);
+	if (!node)
+		return NULL;
+	bzero(node, sizeof(pathtree_node_t));
+	node->parent = parent;
+	node->size = size;
+	node->len = len;
+	memcpy(node->label, label, len);
+	tree->bytes += size;
+	return node;
+}
+
+static void
+pathtree_node_free(pathtree_t *tree, pathtree_node_t *node) {
+	tree->bytes -= node->size;
+	free(node);
+}
+
+int
+pathtree_init(pathtree_t *tree) {
+	tree->count = 0;
+	tree->bytes = 0;
+	tree->root = pathtree_node_new(tree, NULL, "", 0);
+	if (!tree->root)
+		return -1;
+	return 0;
+}
+
+static void
+pathtree_destroy_node(pathtree_t *tree, pathtree_node_t *node,
+                      pathtree_free_func_t *freefunc) {
+	pathtree_node_t *child, *next;
+
+	for (child = node->child; child; child = next) {
+		next = child->next;
+		pathtree_destroy_node(tree, child, freefunc);
+	}
+	if (node->data && freefunc)
+		freefunc(node->data);
+	pathtree_node_free(tree, node);
+}
+
+/*
+ * Free the tree, calling freefunc on all data pointers unless NULL.
+ */
+void
+pathtree_destroy(pathtree_t *tree, pathtree_free_func_t *freefunc) {
+	if (!tree->root)
+		return;
+	pathtree_destroy_node(tree, tree->root, freefunc);
+	tree->root = NULL;
+	tree->count = 0;
+}
+
+static pathtree_node_t *
+pathtree_child(pathtree_node_t *node, char c) {
+	pathtree_node_t *child;
+
+	for (child = node->child; child; child = child->next) {
+		if (child->label[0] == c)
+			return child;
+	}
+	return NULL;
+}
+
+/*
+ * Returns the data stored for path, or NULL if there is none.
+ */
+void *
+pathtree_get(pathtree_t *tree, const char *path) {
+	pathtree_node_t *node = tree->root;
+
+	while (*path != '\0') {
+		node = pathtree_child(node, *path);
+		if (!node || strncmp(path, node->label, node->len))
+			return NULL;
+		path += node->len;
+	}
+	return node->data;
+}
+
+/*
+ * Returns the node for path, storing data in it unless there already was
+ * data stored for path, in which case the node is returned unchanged.
+ * Returns NULL with errno set to ENOMEM if allocating failed.  Copies path.
+ */
+pathtree_node_t *
+pathtree_insert(pathtree_t *tree, const char *path, void *data) {
+	pathtree_node_t *node = tree->root;
+	pathtree_node_t *child, *mid, **pp;
+	size_t common;
+
+	while (*path != '\0') {
+		child = pathtree_child(node, *path);
+		if (!child) {
+			child = pathtree_node_new(tree, node,
+			                          path, strlen(path));
+			if (!child) {
+				errno = ENOMEM;
+				return NULL;
+			}
+			child->next = node->child;
+			node->child = child;
+			node = child;
+			break;
+		}
+		for (common = 1; common < child->len &&
+		                 path[common] == child->label[common];
+		     common++);
+		if (common < child->len) {
+			/* split child, keeping it at its address */
+			mid = pathtree_node_new(tree, node,
+			                        child->label, common);
+			if (!mid) {
+				errno = ENOMEM;
+				return NULL;
+			}
+			for (pp = &node->child; *pp != child;
+			     pp = &(*pp)->next);
+			mid->next = child->next;
+			*pp = mid;
+			memmove(child->label, child->label + common,
+			        child->len - common);
+			child->len -= common;
+			child->parent = mid;
+			child->next = NULL;
+			mid->child = child;
+			child = mid;
+		}
+		node = child;
+		path += common;
+	}
+	if (!node->data) {
+		node->data = data;
+		tree->count++;
+	}
+	return node;
+}
+
+/*
+ * Remove the data from node and free the nodes no longer needed, including
+ * node itself, which must not be used afterwards.  Does not free the data.
+ */
+void
+pathtree_remove(pathtree_t *tree, pathtree_node_t *node) {
+	pathtree_node_t *parent, **pp;
+
+	assert(node->data);
+	node->data = NULL;
+	tree->count--;
+	while (node != tree->root && !node->data && !node->child) {
+		parent = node->parent;
+		for (pp = &parent->child; *pp != node; pp = &(*pp)->next);
+		*pp = node->next;
+		pathtree_node_free(tree, node);
+		node = parent;
+	}
+}
+
+/*
+ * Returns a newly allocated copy of the path of node, or NULL with errno
+ * set to ENOMEM.
+ */
+char *
+pathtree_strdup(pathtree_node_t *node) {
+	pathtree_node_t *n;
+	size_t len = 0;
+	char *s;
+
+	for (n = node; n; n = n->parent)
+		len += n->len;
+	s = malloc(len + 1);
+	if (!s) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	s[len] = '\0';
+	for (n = node; n; n = n->parent) {
+		len -= n->len;
+		memcpy(s + len, n->label, n->len);
+	}
+	return s;
+}
+
@@ -0,0 +1,45 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef PATHTREE_H
+#define PATHTREE_H
+
+#include "attrib.h"
+
+#include <stddef.h>
+
+typedef struct pathtree_node {
+	struct pathtree_node *parent;
+	struct pathtree_node *child;    /* first child */
+	struct pathtree_node *next;     /* next sibling */
+	void *data;                     /* NULL if no path ends here */
+	size_t size;                    /* allocated bytes */
+	size_t len;
+	char label[];                   /* not NUL-terminated */
+} pathtree_node_t;
+
+typedef struct pathtree {
+	pathtree_node_t *root;
+	size_t count;                   /* nodes with data */
+	size_t bytes;
+} pathtree_t;
+
+typedef void pathtree_free_func_t(void *) NONNULL(1);
+
+int pathtree_init(pathtree_t *) NONNULL(1) WUNRES;
+void pathtree_destroy(pathtree_t *, pathtree_free_func_t *) NONNULL(1);
+void * pathtree_get(pathtree_t *, const char *) NONNULL(1,2) WUNRES;
+pathtree_node_t * pathtree_insert(pathtree_t *, const char *, void *)
+                  NONNULL(1,2,3) WUNRES;
+void pathtree_remove(pathtree_t *, pathtree_node_t *) NONNULL(1,2);
+char * pathtree_strdup(pathtree_node_t *) MALLOC NONNULL(1);
+
+#endif
+
@@ -0,0 +1,296 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "pidcache.h"
+
+#include "sys.h"
+#include "time.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+
+/*
+ * Short-lived cache of the libproc lookups in sys.c, so that the radar
+ * workarounds in evtloop and the live acquisition of processes in procmon
+ * do not pay for a syscall each time they look up the same pid within the
+ * same exec sequence.  Only successful lookups are cached.
+ *
+ * Entries expire after PIDCACHE_TTL milliseconds and are invalidated by
+ * procmon on fork, exec, exit and chdir of the pid.  Since the audit record
+ * for such an event is only read after the event happened, lookups made
+ * while processing the record itself already reflect the new state of the
+ * process.  The evtloop therefore advances an epoch for every audit record
+ * using pidcache_tick, and pidcache_invalidate keeps entries that were
+ * created during the current epoch.
+ */
+
+#define PCF_PATH        0x01
+#define PCF_CWD         0x02
+#define PCF_BSDINFO     0x04
+
+typedef struct {
+	pid_t pid;
+	int flags;                      /* valid fields */
+	uint64_t epoch;                 /* of creation */
+	struct timespec expiry;         /* monotonic */
+	char *path;
+	char *cwd;
+	struct timespec start_tv;
+	pid_t ppid;
+} pidcache_entry_t;
+
+static pidcache_entry_t entries[PIDCACHE_SIZE];
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_uint_fast64_t epoch;
+static uint64_t hits = 0;
+static uint64_t misses = 0;
+static uint64_t invalidations = 0;
+static bool stubbed = false;
+
+static void
+pidcache_clear(pidcache_entry_t *e) {
+	if (e->path)
+		free(e->path);
+	if (e->cwd)
+		free(e->cwd);
+	bzero(e, sizeof(pidcache_entry_t));
+}
+
+/*
+ * Must be called with the mutex held.
+ */
+static pidcache_entry_t *
+pidcache_slot(pid_t pid) {
+	return &entries[(unsigned int)pid % PIDCACHE_SIZE];
+}
+
+/*
+ * Returns the entry for pid if it has the fields in flag and has not
+ * expired yet, NULL otherwise.  Must be called with the mutex held.
+ */
+static pidcache_entry_t *
+pidcache_lookup(pid_t pid, int flag, struct timespec *now) {
+	pidcache_entry_t *e = pidcache_slot(pid);
+
+	if (e->flags == 0 || e->pid != pid || !(e->flags & flag) ||
+	    !timespec_greater(&e->expiry, now)) {
+		misses++;
+		return NULL;
+	}
+	hits++;
+	return e;
+}
+
+/*
+ * Returns the entry to add fields for pid to, replacing whatever entry was
+ * in the slot unless it is a live entry for the same pid.  Must be called
+ * with the mutex held.
+ */
+static pidcache_entry_t *
+pidcache_store(pid_t pid, struct timespec *now) {
+	pidcache_entry_t *e = pidcache_slot(pid);
+
+	if (e->flags != 0 && e->pid == pid &&
+	    timespec_greater(&e->expiry, now))
+		return e;
+	pidcache_clear(e);
+	e->pid = pid;
+	e->epoch = atomic_load_explicit(&epoch, memory_order_relaxed);
+	e->expiry = *now;
+	timespec_add_msec(&e->expiry, PIDCACHE_TTL);
+	return e;
+}
+
+/*
+ * Called by evtloop for every audit record processed.
+ */
+void
+pidcache_tick(void) {
+	atomic_fetch_add_explicit(&epoch, 1, memory_order_relaxed);
+}
+
+/*
+ * Called by procmon for every event that changes the state of pid.
+ */
+void
+pidcache_invalidate(pid_t pid) {
+	pidcache_entry_t *e;
+
+	pthread_mutex_lock(&mutex);
+	e = pidcache_slot(pid);
+	if (e->flags != 0 && e->pid == pid &&
+	    e->epoch != atomic_load_explicit(&epoch, memory_order_relaxed)) {
+		pidcache_clear(e);
+		invalidations++;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * Make all lookups fail as if the pid did not exist, for replaying a trace
+ * of processes that are not running on this system.
+ */
+void
+pidcache_stub(bool stub) {
+	stubbed = stub;
+}
+
+/*
+ * Same semantics as sys_pidpath.
+ */
+char *
+pidcache_path(pid_t pid) {
+	pidcache_entry_t *e;
+	struct timespec now;
+	char *path;
+
+	if (stubbed) {
+		errno = ESRCH;
+		return NULL;
+	}
+
+	if (timespec_monotime(&now) == -1)
+		return sys_pidpath(pid);
+
+	pthread_mutex_lock(&mutex);
+	e = pidcache_lookup(pid, PCF_PATH, &now);
+	if (e) {
+		path = strdup(e->path);
+		pthread_mutex_unlock(&mutex);
+		return path;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	path = sys_pidpath(pid);
+	if (!path)
+		return NULL;
+
+	pthread_mutex_lock(&mutex);
+	e = pidcache_store(pid, &now);
+	if (!(e->flags & PCF_PATH)) {
+		e->path = strdup(path);
+		if (e->path)
+			e->flags |= PCF_PATH;
+	}
+	pthread_mutex_unlock(&mutex);
+	return path;
+}
+
+/*
+ * Same semantics as sys_pidcwd.
+ */
+char *
+pidcache_cwd(pid_t pid) {
+	pidcache_entry_t *e;
+	struct timespec now;
+	char *cwd;
+
+	if (stubbed) {
+		errno = ESRCH;
+		return NULL;
+	}
+
+	if (timespec_monotime(&now) == -1)
+		return sys_pidcwd(pid);
+
+	pthread_mutex_lock(&mutex);
+	e = pidcache_lookup(pid, PCF_CWD, &now);
+	if (e) {
+		cwd = strdup(e->cwd);
+		pthread_mutex_unlock(&mutex);
+		return cwd;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	cwd = sys_pidcwd(pid);
+	if (!cwd)
+		return NULL;
+
+	pthread_mutex_lock(&mutex);
+	e = pidcache_store(pid, &now);
+	if (!(e->flags & PCF_CWD)) {
+		e->cwd = strdup(cwd);
+		if (e->cwd)
+			e->flags |= PCF_CWD;
+	}
+	pthread_mutex_unlock(&mutex);
+	return cwd;
+}
+
+/*
+ * Same semantics as sys_pidbsdinfo.
+ */
+int
+pidcache_bsdinfo(struct timespec *tv, pid_t *ppid, pid_t pid) {
+	pidcache_entry_t *e;
+	struct timespec now, start_tv;
+	pid_t parent;
+
+	if (stubbed) {
+		errno = ESRCH;
+		return -1;
+	}
+
+	if (timespec_monotime(&now) == -1)
+		return sys_pidbsdinfo(tv, ppid, pid);
+
+	pthread_mutex_lock(&mutex);
+	e = pidcache_lookup(pid, PCF_BSDINFO, &now);
+	if (e) {
+		start_tv = e->start_tv;
+		parent = e->ppid;
+		pthread_mutex_unlock(&mutex);
+		goto out;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	if (sys_pidbsdinfo(&start_tv, &parent, pid) == -1)
+		return -1;
+
+	pthread_mutex_lock(&mutex);
+	e = pidcache_store(pid, &now);
+	if (!(e->flags & PCF_BSDINFO)) {
+		e->start_tv = start_tv;
+		e->ppid = parent;
+		e->flags |= PCF_BSDINFO;
+	}
+	pthread_mutex_unlock(&mutex);
+out:
+	if (tv)
+		*tv = start_tv;
+	if (ppid)
+		*ppid = parent;
+	return 0;
+}
+
+void
+pidcache_fini(void) {
+	pthread_mutex_lock(&mutex);
+	for (size_t i = 0; i < PIDCACHE_SIZE; i++)
+		pidcache_clear(&entries[i]);
+	pthread_mutex_unlock(&mutex);
+}
+
+void
+pidcache_stats(pidcache_stat_t *st) {
+	assert(st);
+
+	pthread_mutex_lock(&mutex);
+	st->hits = hits;
+	st->misses = misses;
+	st->invalidations = invalidations;
+	pthread_mutex_unlock(&mutex);
+}
+
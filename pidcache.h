@@ -0,0 +1,40 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef PIDCACHE_H
+#define PIDCACHE_H
+
+#include "attrib.h"
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define PIDCACHE_SIZE   64      /* direct-mapped by pid */
+#define PIDCACHE_TTL    250     /* msec */
+
+typedef struct {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t invalidations;
+} pidcache_stat_t;
+
+void pidcache_fini(void);
+void pidcache_stub(bool);
+void pidcache_tick(void);
+void pidcache_invalidate(pid_t);
+char * pidcache_path(pid_t) MALLOC;
+char * pidcache_cwd(pid_t) MALLOC;
+int pidcache_bsdinfo(struct timespec *, pid_t *, pid_t) WUNRES;
+void pidcache_stats(pidcache_stat_t *) NONNULL(1);
+
+#endif
+
@@ -28,6 +28,7 @@ pkgutil --forget ch.roe.xnumon
 # remove files generated at run-time in default configuration
 rm -f /var/log/xnumon.log*
 rm -f /var/run/xnumon.pid
+rm -f /var/run/xnumon.profile /var/run/xnumon.profile.trace
 # remove uninstall script and default configuration
 asdir="/Library/Application Support/ch.roe.xnumon"
 if [ ! -f "$asdir/configuration.plist" ]; then
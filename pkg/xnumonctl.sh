@@ -32,6 +32,33 @@ reopen)
 event1)
 	kill -USR1 `/bin/cat /var/run/xnumon.pid`
 	;;
+profile)
+	/bin/rm -f /var/run/xnumon.profile
+	kill -USR2 `/bin/cat /var/run/xnumon.pid` || exit 1
+	n=0
+	while [ ! -f /var/run/xnumon.profile ]; do
+		n=$((n + 1))
+		if [ $n -gt 3660 ]; then
+			echo "No profile written, see xnumon stderr" >&2
+			exit 1
+		fi
+		/bin/sleep 1
+	done
+	/bin/cat /var/run/xnumon.profile
+	echo "Raw trace in /var/run/xnumon.profile.trace"
+	;;
+query)
+	case "$2" in
+	pid|sha256|path|teamid)
+		;;
+	*)
+		echo "Usage: $0 query pid|sha256|path|teamid <value>" >&2
+		exit 1
+		;;
+	esac
+	shift
+	echo "$*" | /usr/bin/nc -U /var/run/xnumon.query
+	;;
 logstderr)
 	/usr/bin/plutil -replace StandardErrorPath -string /var/log/xnumon.stderr /Library/LaunchDaemons/ch.roe.xnumon.plist
 	"$0" reload
@@ -40,7 +67,7 @@ uninstall)
 	exec /bin/sh '/Library/Application Support/ch.roe.xnumon/uninstall.sh'
 	;;
 *)
-	echo "Usage: $0 load|unload|reload|start|stop|restart|status|kextload|kextunload|kextstat|reopen|event1|logstderr|uninstall" >&2
+	echo "Usage: $0 load|unload|reload|start|stop|restart|status|kextload|kextunload|kextstat|reopen|event1|profile|query|logstderr|uninstall" >&2
 	exit 1
 	;;
 esac
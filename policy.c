@@ -8,11 +8,16 @@
  * Licensed under the Open Software License version 3.0.
  */
 
-#include "sched.h"
+#include "policy.h"
+
+#include "thrstat.h"
 
 #include <mach/mach.h>
 #include <mach/thread_policy.h>
+#include <pthread/qos.h>
 #include <sys/resource.h>
+#include <string.h>
+#include <errno.h>
 
 int
 policy_task_sched_priority(void) {
@@ -111,3 +116,94 @@ policy_thread_diskio_utility(void) {
 	                      IOPOL_UTILITY);
 }
 
+/*
+ * Per-thread QoS classes.  Unlike the precedence policy above, QoS classes
+ * leave the priority decisions to the scheduler, which also uses them for
+ * placing threads on performance or efficiency cores on asymmetric CPUs:
+ * user-interactive and user-initiated threads prefer performance cores,
+ * background threads are confined to efficiency cores.  Threads of classes
+ * configured as default keep the QoS they were created with.
+ */
+static int thread_qos[THRSTAT_CLASSES];
+
+int
+policy_qos(const char *s) {
+	if (!strcmp(s, "default"))
+		return POLICY_QOS_DEFAULT;
+	if (!strcmp(s, "user-interactive"))
+		return POLICY_QOS_USER_INTERACTIVE;
+	if (!strcmp(s, "user-initiated"))
+		return POLICY_QOS_USER_INITIATED;
+	if (!strcmp(s, "utility"))
+		return POLICY_QOS_UTILITY;
+	if (!strcmp(s, "background"))
+		return POLICY_QOS_BACKGROUND;
+	return -1;
+}
+
+const char *
+policy_qos_s(int qos) {
+	switch (qos) {
+	case POLICY_QOS_USER_INTERACTIVE:
+		return "user-interactive";
+	case POLICY_QOS_USER_INITIATED:
+		return "user-initiated";
+	case POLICY_QOS_UTILITY:
+		return "utility";
+	case POLICY_QOS_BACKGROUND:
+		return "background";
+	default:
+		return "default";
+	}
+}
+
+/*
+ * Must be called before any of the threads is started.
+ */
+void
+policy_thread_qos_init(config_t *cfg) {
+	for (int i = 0; i < THRSTAT_CLASSES; i++)
+		thread_qos[i] = POLICY_QOS_DEFAULT;
+	thread_qos[THRSTAT_EVTLOOP] = cfg->qos_evtloop;
+	thread_qos[THRSTAT_KEXTLOOP] = cfg->qos_kextloop;
+	thread_qos[THRSTAT_WORK] = cfg->qos_work;
+	thread_qos[THRSTAT_BULK] = cfg->qos_bulk;
+	thread_qos[THRSTAT_LOG] = cfg->qos_log;
+}
+
+/*
+ * Apply the configured QoS class of thread class THRSTAT_* to the calling
+ * thread.
+ */
+int
+policy_thread_qos(int class) {
+	qos_class_t qc;
+	int rv;
+
+	if (class < 0 || class >= THRSTAT_CLASSES) {
+		errno = EINVAL;
+		return -1;
+	}
+	switch (thread_qos[class]) {
+	case POLICY_QOS_USER_INTERACTIVE:
+		qc = QOS_CLASS_USER_INTERACTIVE;
+		break;
+	case POLICY_QOS_USER_INITIATED:
+		qc = QOS_CLASS_USER_INITIATED;
+		break;
+	case POLICY_QOS_UTILITY:
+		qc = QOS_CLASS_UTILITY;
+		break;
+	case POLICY_QOS_BACKGROUND:
+		qc = QOS_CLASS_BACKGROUND;
+		break;
+	default:
+		return 0;
+	}
+	rv = pthread_set_qos_class_self_np(qc, 0);
+	if (rv != 0) {
+		errno = rv;
+		return -1;
+	}
+	return 0;
+}
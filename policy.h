@@ -11,6 +11,9 @@
 #ifndef POLICY_H
 #define POLICY_H
 
+#include "config.h"
+#include "attrib.h"
+
 int policy_task_sched_priority(void);
 
 #if 0
@@ -26,5 +29,16 @@ int policy_thread_diskio_important(void);
 int policy_thread_diskio_standard(void);
 int policy_thread_diskio_utility(void);
 
+#define POLICY_QOS_DEFAULT              0
+#define POLICY_QOS_USER_INTERACTIVE     1
+#define POLICY_QOS_USER_INITIATED       2
+#define POLICY_QOS_UTILITY              3
+#define POLICY_QOS_BACKGROUND           4
+
+int policy_qos(const char *) NONNULL(1) WUNRES;
+const char * policy_qos_s(int);
+void policy_thread_qos_init(config_t *) NONNULL(1);
+int policy_thread_qos(int);
+
 #endif
 
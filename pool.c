@@ -0,0 +1,381 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+/*
+ * Fixed-size object pool allocating objects from slabs of `slabobjs' objects
+ * each.  Slabs are only released when the pool is destroyed.
+ *
+ * Each thread keeps a small cache of free objects per pool, so that alloc and
+ * free do not need to take the pool mutex in the common case.  Objects move
+ * between the per-thread caches and the shared free list in batches; this
+ * keeps objects allocated on one thread and freed on another (e.g. allocated
+ * on the main thread and freed on the log thread) flowing back without
+ * per-object locking.  When a thread exits, the objects in its caches are
+ * returned to the shared free lists.  Threads that cannot allocate their
+ * caches take the pool mutex for every object instead.
+ *
+ * Objects may still be freed after pool_destroy(); the slabs are then
+ * released when the last outstanding object is freed.  This allows pools for
+ * log events which are drained out of the log queue after the owning module
+ * has been shut down.
+ */
+
+#include "pool.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+/*
+ * Each slab starts with a pointer to the next slab, followed by the objects,
+ * aligned for any object type.
+ */
+typedef union pool_slab {
+	union pool_slab *next;
+	max_align_t align;
+} pool_slab_t;
+
+#define POOL_ALIGN(SZ) \
+	(((SZ) + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1))
+
+#define POOL_TCACHE_MAX         64      /* max objects cached per thread */
+#define POOL_TCACHE_BATCH       32      /* objects moved per refill/drain */
+
+typedef struct {
+	uint32_t gen;
+	uint32_t count;
+	void *head;
+} pool_tcache_t;
+
+static pthread_mutex_t pools_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pool_t *pools[POOL_MAX];
+static uint32_t pools_gen;
+
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;        /* POOL_MAX caches per thread */
+static bool tcache_keyed;
+
+/*
+ * Thread-specific data destructor, called on the exiting thread.  Returns
+ * the objects in its caches to the free lists of pools that still exist;
+ * objects cached for destroyed pools are discarded as in pool_tcache_get.
+ */
+static void
+pool_tcache_release(void *arg) {
+	pool_tcache_t *tcv = arg, *tc;
+	pool_t *this;
+	void *obj;
+
+	pthread_mutex_lock(&pools_mutex);
+	for (int id = 0; id < POOL_MAX; id++) {
+		tc = &tcv[id];
+		this = pools[id];
+		if (!tc->head || !this || atomic32_load(&this->gen) != tc->gen)
+			continue;
+		pthread_mutex_lock(&this->mutex);
+		while (tc->head) {
+			obj = tc->head;
+			tc->head = *(void **)obj;
+			*(void **)obj = this->freelist;
+			this->freelist = obj;
+		}
+		pthread_mutex_unlock(&this->mutex);
+	}
+	pthread_mutex_unlock(&pools_mutex);
+	free(tcv);
+}
+
+static void
+pool_tcache_init(void) {
+	tcache_keyed = pthread_key_create(&tcache_key,
+	                                  pool_tcache_release) == 0;
+}
+
+/*
+ * Name must remain valid for the lifetime of the pool.
+ *
+ * Returns -1 with errno set to ENOMEM if too many pools are active.
+ */
+int
+pool_init(pool_t *this, const char *name, size_t objsz, size_t slabobjs) {
+	int id;
+
+	assert(this);
+	assert(name);
+	assert(slabobjs > 0);
+
+	(void)pthread_once(&tcache_once, pool_tcache_init);
+	pthread_mutex_lock(&pools_mutex);
+	for (id = 0; id < POOL_MAX; id++) {
+		if (!pools[id])
+			break;
+	}
+	if (id == POOL_MAX) {
+		pthread_mutex_unlock(&pools_mutex);
+		errno = ENOMEM;
+		return -1;
+	}
+	bzero(this, sizeof(pool_t));
+	this->name = name;
+	this->objsz = POOL_ALIGN(objsz < sizeof(void *) ? sizeof(void *)
+	                                                : objsz);
+	this->slabobjs = slabobjs;
+	this->id = id;
+	if (++pools_gen == 0)
+		++pools_gen;
+	this->gen = pools_gen;
+	pthread_mutex_init(&this->mutex, NULL);
+	pools[id] = this;
+	pthread_mutex_unlock(&pools_mutex);
+	return 0;
+}
+
+/*
+ * Release all slabs once the pool is destroyed and no objects are
+ * outstanding.  Can be called concurrently from pool_destroy() and the last
+ * pool_free(); the mutex is therefore left initialized.
+ */
+static void
+pool_release(pool_t *this) {
+	pool_slab_t *slab, *next;
+
+	pthread_mutex_lock(&this->mutex);
+	if (atomic32_load(&this->gen) == 0 &&
+	    atomic32_load(&this->used) == 0) {
+		for (slab = this->slablist; slab; slab = next) {
+			next = slab->next;
+			free(slab);
+		}
+		this->slablist = NULL;
+		this->freelist = NULL;
+		this->slabs = 0;
+	}
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/*
+ * Must not be called while other threads may still allocate from the pool.
+ * Objects still allocated remain valid until freed.
+ */
+void
+pool_destroy(pool_t *this) {
+	assert(this);
+
+	pthread_mutex_lock(&pools_mutex);
+	if (pools[this->id] == this)
+		pools[this->id] = NULL;
+	pthread_mutex_unlock(&pools_mutex);
+
+	pthread_mutex_lock(&this->mutex);
+	this->gen = 0;
+	pthread_mutex_unlock(&this->mutex);
+	pool_release(this);
+}
+
+/*
+ * Called with mutex held.
+ */
+static int
+pool_grow(pool_t *this) {
+	pool_slab_t *slab;
+	unsigned char *p;
+
+	slab = malloc(sizeof(pool_slab_t) + this->objsz * this->slabobjs);
+	if (!slab)
+		return -1;
+	slab->next = this->slablist;
+	this->slablist = slab;
+	this->slabs++;
+	p = (unsigned char *)(slab + 1);
+	for (size_t i = 0; i < this->slabobjs; i++) {
+		*(void **)p = this->freelist;
+		this->freelist = p;
+		p += this->objsz;
+	}
+	return 0;
+}
+
+/*
+ * Returns the calling thread's cache for this pool, discarding any stale
+ * contents left over from a previous pool with the same id, or NULL if the
+ * calling thread has no caches.
+ */
+static pool_tcache_t *
+pool_tcache_get(pool_t *this) {
+	pool_tcache_t *tcv, *tc;
+	uint32_t gen;
+
+	if (!tcache_keyed)
+		return NULL;
+	tcv = pthread_getspecific(tcache_key);
+	if (!tcv) {
+		tcv = calloc(POOL_MAX, sizeof(pool_tcache_t));
+		if (!tcv)
+			return NULL;
+		if (pthread_setspecific(tcache_key, tcv) != 0) {
+			free(tcv);
+			return NULL;
+		}
+	}
+	tc = &tcv[this->id];
+	gen = atomic32_load(&this->gen);
+	if (tc->gen != gen) {
+		tc->gen = gen;
+		tc->count = 0;
+		tc->head = NULL;
+	}
+	return tc;
+}
+
+static int
+pool_refill(pool_t *this, pool_tcache_t *tc) {
+	void *obj;
+
+	pthread_mutex_lock(&this->mutex);
+	for (int i = 0; i < POOL_TCACHE_BATCH; i++) {
+		if (!this->freelist && pool_grow(this) == -1)
+			break;
+		obj = this->freelist;
+		this->freelist = *(void **)obj;
+		*(void **)obj = tc->head;
+		tc->head = obj;
+		tc->count++;
+	}
+	pthread_mutex_unlock(&this->mutex);
+	if (!tc->head) {
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+}
+
+static void
+pool_drain(pool_t *this, pool_tcache_t *tc) {
+	void *obj;
+
+	pthread_mutex_lock(&this->mutex);
+	for (int i = 0; i < POOL_TCACHE_BATCH && tc->head; i++) {
+		obj = tc->head;
+		tc->head = *(void **)obj;
+		tc->count--;
+		*(void **)obj = this->freelist;
+		this->freelist = obj;
+	}
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/*
+ * Returns an uninitialized object, or NULL with errno set on oom.
+ *
+ * Thread-safe.
+ */
+void *
+pool_alloc(pool_t *this) {
+	pool_tcache_t *tc;
+	uint32_t used;
+	void *obj;
+
+	assert(this);
+	assert(atomic32_load(&this->gen) != 0);
+
+	tc = pool_tcache_get(this);
+	if (tc) {
+		if (!tc->head && pool_refill(this, tc) == -1)
+			return NULL;
+		obj = tc->head;
+		tc->head = *(void **)obj;
+		tc->count--;
+	} else {
+		pthread_mutex_lock(&this->mutex);
+		if (!this->freelist && pool_grow(this) == -1) {
+			pthread_mutex_unlock(&this->mutex);
+			errno = ENOMEM;
+			return NULL;
+		}
+		obj = this->freelist;
+		this->freelist = *(void **)obj;
+		pthread_mutex_unlock(&this->mutex);
+	}
+
+	atomic64_fast_inc(&this->allocs);
+	atomic32_inc(&this->used);
+	used = atomic32_load(&this->used);
+	if (used > atomic32_load(&this->hiwat))
+		this->hiwat = used; /* racy but good enough for stats */
+	return obj;
+}
+
+/*
+ * Thread-safe.
+ */
+void
+pool_free(pool_t *this, void *obj) {
+	pool_tcache_t *tc;
+
+	assert(this);
+	assert(obj);
+	assert(atomic32_load(&this->used) > 0);
+
+	if (atomic32_load(&this->gen) != 0) {
+		tc = pool_tcache_get(this);
+		if (tc) {
+			*(void **)obj = tc->head;
+			tc->head = obj;
+			tc->count++;
+			if (tc->count > POOL_TCACHE_MAX)
+				pool_drain(this, tc);
+		} else {
+			pthread_mutex_lock(&this->mutex);
+			*(void **)obj = this->freelist;
+			this->freelist = obj;
+			pthread_mutex_unlock(&this->mutex);
+		}
+	}
+	if (atomic32_dec_test0(&this->used) &&
+	    atomic32_load(&this->gen) == 0)
+		pool_release(this);
+}
+
+void
+pool_stats(pool_t *this, pool_stat_t *st) {
+	assert(this);
+	assert(st);
+
+	pthread_mutex_lock(&this->mutex);
+	st->name = this->name;
+	st->slabs = this->slabs;
+	pthread_mutex_unlock(&this->mutex);
+	st->bytes = (uint64_t)st->slabs *
+	            (sizeof(pool_slab_t) + this->objsz * this->slabobjs);
+	st->used = atomic32_load(&this->used);
+	st->hiwat = atomic32_load(&this->hiwat);
+	st->allocs = atomic64_load(&this->allocs);
+}
+
+/*
+ * Fill at most `size' stats structures for all active pools.
+ * Returns the number of structures filled.
+ */
+size_t
+pool_stats_all(pool_stat_t *st, size_t size) {
+	size_t n = 0;
+
+	assert(st);
+
+	pthread_mutex_lock(&pools_mutex);
+	for (int id = 0; id < POOL_MAX && n < size; id++) {
+		if (pools[id])
+			pool_stats(pools[id], &st[n++]);
+	}
+	pthread_mutex_unlock(&pools_mutex);
+	return n;
+}
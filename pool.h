@@ -0,0 +1,57 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include "atomic.h"
+#include "attrib.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define POOL_MAX        16      /* max number of concurrently active pools */
+
+typedef struct pool_stat {
+	const char *name;
+	uint32_t used;                  /* objects currently allocated */
+	uint32_t hiwat;                 /* high-water mark of used */
+	uint32_t slabs;
+	uint64_t allocs;                /* cumulative */
+	uint64_t bytes;                 /* allocated for slabs */
+} pool_stat_t;
+
+typedef struct pool {
+	const char *name;
+	size_t objsz;
+	size_t slabobjs;
+	int id;                         /* index into per-thread caches */
+	atomic32_t gen;                 /* 0 after pool_destroy */
+
+	pthread_mutex_t mutex;          /* protects all fields below */
+	void *freelist;
+	void *slablist;
+	uint32_t slabs;
+
+	atomic32_t used;
+	atomic32_t hiwat;
+	atomic64_t allocs;
+} pool_t;
+
+int pool_init(pool_t *, const char *, size_t, size_t) NONNULL(1,2) WUNRES;
+void pool_destroy(pool_t *) NONNULL(1);
+void * pool_alloc(pool_t *) NONNULL(1) MALLOC;
+void pool_free(pool_t *, void *) NONNULL(1,2);
+void pool_stats(pool_t *, pool_stat_t *) NONNULL(1,2);
+size_t pool_stats_all(pool_stat_t *, size_t) NONNULL(1);
+
+#endif
+
@@ -10,70 +10,337 @@
 
 #include "proc.h"
 
+#include "pool.h"
+#include "intern.h"
 #include "tommyhash.h"
 #include "filemon.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <assert.h>
 
-static proc_t *proctab[UINT16_MAX + 1];
+/*
+ * The process table is an open-addressing hash table using Robin Hood
+ * linear probing with backward shift deletion, keyed by pid.  Buckets hold
+ * the pid and a pointer to the proc_t, which are allocated from a pool, such
+ * that pointers to proc_t remain valid while the table is resized.  The table
+ * doubles when it is more than 7/8 full and halves when it is less than 1/8
+ * full, but never shrinks below PROCTAB_BUCKETS_MIN buckets.
+ *
+ * The table is only ever accessed from the main thread and needs no locks.
+ * All pid lookups, image_exec_by_pid from hackmon, sockmon and filemon as
+ * well as procmon_socket_state, happen on the main thread while it handles
+ * the audit record or kext event at hand.  Worker and log threads never
+ * look up pids; they get the process context through the image references
+ * carried by the events they are passed.
+ */
+
+typedef struct {
+	pid_t pid;
+	proc_t *proc;                   /* NULL if bucket is empty */
+} proctab_bucket_t;
+
+#define PROCTAB_BUCKETS_MIN     4096
+#define PROCTAB_SLABOBJS        64
+#define FDCTX_SLABOBJS          256
+
+static proctab_bucket_t *proctab;
+static size_t proctab_mask;             /* number of buckets - 1 */
+static uint64_t proctab_lookups;
+static uint64_t proctab_probes;
+static pool_t procpool;
+static pool_t fdpool;
+static pool_t fdspool;
+static uint64_t fdshared;
+static uint64_t fdunshared;
+static uint64_t fdpathbytes;            /* paths of open files */
 uint32_t procs; /* external access from procmap.c */
+uint32_t procspeak; /* external, reset by procmon */
 
 _Static_assert(sizeof(pid_t) == 4, "pid_t is 32bit");
-#define hashpid(P) (uint16_t)tommy_inthash_u32((uint32_t)(P))
+#define hashpid(P) ((size_t)tommy_inthash_u32((uint32_t)(P)))
 
 /*
  * file descriptor tracking
  */
 
+static int
+proc_fdcmp(const void *arg, const void *obj) {
+	return *(const int *)arg != ((const fd_ctx_t *)obj)->fd;
+}
+
+#define hashfd(FD) tommy_inthash_u32((uint32_t)(FD))
+
+static fd_ctx_t *
+proc_fds_lookup(proc_fds_t *fds, int fd) {
+	if (fds->fdmap)
+		return tommy_hashinc_search(fds->fdmap, proc_fdcmp, &fd,
+		                            hashfd(fd));
+	for (uint32_t i = 0; i < fds->fdcount; i++) {
+		if (fds->fdinline[i]->fd == fd)
+			return fds->fdinline[i];
+	}
+	return NULL;
+}
+
 fd_ctx_t *
 proc_getfd(proc_t *proc, int fd) {
-	if (fd < 0)
+	if (fd < 0 || !proc->fds)
 		return NULL;
-	if (fd < (int)(sizeof(proc->fdlovect)/sizeof(proc->fdlovect[0])))
-		return proc->fdlovect[fd];
-	tommy_node *node = tommy_list_head(&proc->fdhilist);
-	while (node) {
-		fd_ctx_t *ctx = node->data;
-		if (ctx->fd == fd)
-			return ctx;
-		node = node->next;
+	return proc_fds_lookup(proc->fds, fd);
+}
+
+/*
+ * Move all inline descriptors to a newly allocated hash table.
+ * Returns -1 on oom.
+ */
+static int
+proc_fdmap_create(proc_fds_t *fds) {
+	fd_ctx_t *ctx;
+
+	assert(!fds->fdmap);
+	fds->fdmap = malloc(sizeof(tommy_hashinc));
+	if (!fds->fdmap)
+		return -1;
+	tommy_hashinc_init(fds->fdmap);
+	for (uint32_t i = 0; i < fds->fdcount; i++) {
+		ctx = fds->fdinline[i];
+		tommy_hashinc_insert(fds->fdmap, &ctx->node, ctx,
+		                     hashfd(ctx->fd));
+		fds->fdinline[i] = NULL;
 	}
-	return NULL;
+	fds->fdcount = 0;
+	return 0;
+}
+
+/*
+ * Returns -1 on oom; the caller retains ownership of ctx in that case.
+ */
+static int
+proc_fds_insert(proc_fds_t *fds, fd_ctx_t *ctx) {
+	if (!fds->fdmap) {
+		if (fds->fdcount < PROC_FDINLINE) {
+			fds->fdinline[fds->fdcount++] = ctx;
+			return 0;
+		}
+		if (proc_fdmap_create(fds) == -1)
+			return -1;
+	}
+	tommy_hashinc_insert(fds->fdmap, &ctx->node, ctx, hashfd(ctx->fd));
+	return 0;
+}
+
+static proc_fds_t *
+proc_fds_new(proc_t *owner) {
+	proc_fds_t *fds;
+
+	fds = pool_alloc(&fdspool);
+	if (!fds)
+		return NULL;
+	bzero(fds, sizeof(proc_fds_t));
+	fds->refs = 1;
+	fds->owner = owner;
+	return fds;
+}
+
+static void
+proc_fds_foreach(proc_fds_t *fds, void (*func)(void *, void *), void *arg) {
+	for (uint32_t i = 0; i < fds->fdcount; i++)
+		func(arg, fds->fdinline[i]);
+	if (fds->fdmap)
+		tommy_hashinc_foreach_arg(fds->fdmap, func, arg);
 }
 
+static void
+proc_freefd_cb(void *tv, void *ctx) {
+	if (tv)
+		proc_triggerfd(ctx, tv);
+	proc_freefd(ctx);
+}
+
+/*
+ * Drop the open file paths of a table that other processes keep using,
+ * triggering implicit close filemon events at tv unless tv is NULL.
+ */
+static void
+proc_disownfd_cb(void *tv, void *arg) {
+	fd_ctx_t *ctx = arg;
+
+	if (!(ctx->flags & FDFLAG_FILE) || !ctx->fi.path)
+		return;
+	if (tv) {
+		proc_triggerfd(ctx, tv);
+	} else {
+		fdpathbytes -= strlen(ctx->fi.path) + 1;
+		free(ctx->fi.path);
+		ctx->fi.path = NULL;
+	}
+}
+
+/*
+ * Release the reference of proc to its file descriptors, triggering implicit
+ * close filemon events at tv unless tv is NULL.
+ */
+static void
+proc_freefds(proc_t *proc, struct timespec *tv) {
+	proc_fds_t *fds = proc->fds;
+
+	if (!fds)
+		return;
+	proc->fds = NULL;
+	assert(fds->refs > 0);
+	if (--fds->refs > 0) {
+		if (fds->owner == proc) {
+			proc_fds_foreach(fds, proc_disownfd_cb, tv);
+			fds->owner = NULL;
+		}
+		return;
+	}
+	proc_fds_foreach(fds, proc_freefd_cb, tv);
+	if (fds->fdmap) {
+		tommy_hashinc_done(fds->fdmap);
+		free(fds->fdmap);
+	}
+	pool_free(&fdspool, fds);
+}
+
+/*
+ * Let child share the file descriptors of parent after a fork.
+ */
 void
+proc_sharefds(proc_t *child, proc_t *parent) {
+	assert(!child->fds);
+	if (!parent->fds)
+		return;
+	child->fds = parent->fds;
+	child->fds->refs++;
+	fdshared++;
+}
+
+typedef struct {
+	proc_fds_t *from;
+	proc_fds_t *to;
+	int rv;
+} proc_unshare_ctx_t;
+
+static void
+proc_unsharefd_cb(void *arg, void *obj) {
+	proc_unshare_ctx_t *uc = arg;
+	fd_ctx_t *ctx = obj, *copy;
+
+	if (uc->rv == -1)
+		return;
+	copy = proc_newfd();
+	if (!copy) {
+		uc->rv = -1;
+		return;
+	}
+	memcpy(((char *)copy)+sizeof(copy->node),
+	       ((char *)ctx)+sizeof(ctx->node),
+	       sizeof(fd_ctx_t)-sizeof(ctx->node));
+	if (copy->flags & FDFLAG_FILE)
+		copy->fi.path = NULL;
+	if (proc_fds_insert(uc->to, copy) == -1) {
+		proc_freefd(copy);
+		uc->rv = -1;
+	}
+}
+
+/*
+ * Open file paths move along with the process that opened the files.
+ */
+static void
+proc_movepath_cb(void *arg, void *obj) {
+	proc_fds_t *to = arg;
+	fd_ctx_t *ctx = obj, *copy;
+
+	if (!(ctx->flags & FDFLAG_FILE) || !ctx->fi.path)
+		return;
+	copy = proc_fds_lookup(to, ctx->fd);
+	assert(copy);
+	copy->fi.path = ctx->fi.path;
+	ctx->fi.path = NULL;
+}
+
+/*
+ * Give proc a private copy of its file descriptors if they are shared, to be
+ * called before changing them.  Returns -1 on oom, leaving them shared.
+ */
+int
+proc_unsharefds(proc_t *proc) {
+	proc_unshare_ctx_t uc;
+
+	if (!proc->fds || proc->fds->refs == 1)
+		return 0;
+	uc.from = proc->fds;
+	uc.to = proc_fds_new(proc);
+	if (!uc.to)
+		return -1;
+	uc.rv = 0;
+	proc_fds_foreach(uc.from, proc_unsharefd_cb, &uc);
+	if (uc.rv == -1) {
+		proc->fds = uc.to;
+		proc_freefds(proc, NULL);
+		proc->fds = uc.from;
+		return -1;
+	}
+	if (uc.from->owner == proc) {
+		proc_fds_foreach(uc.from, proc_movepath_cb, uc.to);
+		uc.from->owner = NULL;
+	}
+	uc.from->refs--;
+	proc->fds = uc.to;
+	fdunshared++;
+	return 0;
+}
+
+/*
+ * The fd must not already be set on proc.
+ * Returns -1 on oom; the caller retains ownership of ctx in that case.
+ */
+int
 proc_setfd(proc_t *proc, fd_ctx_t *ctx) {
 	if (ctx->fd < 0)
-		return;
-	if (ctx->fd < (int)(sizeof(proc->fdlovect)/sizeof(proc->fdlovect[0]))) {
-		proc->fdlovect[ctx->fd] = ctx;
-		tommy_list_insert_head(&proc->fdlolist, &ctx->node, ctx);
-	} else {
-		tommy_list_insert_head(&proc->fdhilist, &ctx->node, ctx);
+		return 0;
+	assert(!proc_getfd(proc, ctx->fd));
+	if (!proc->fds) {
+		proc->fds = proc_fds_new(proc);
+		if (!proc->fds)
+			return -1;
+	} else if (proc_unsharefds(proc) == -1) {
+		return -1;
 	}
+	return proc_fds_insert(proc->fds, ctx);
 }
 
+/*
+ * Returns NULL without removing the fd if the file descriptors of proc are
+ * shared and cannot be copied for lack of memory.
+ */
 fd_ctx_t *
 proc_closefd(proc_t *proc, int fd) {
-	if (fd < 0)
+	proc_fds_t *fds;
+	fd_ctx_t *ctx;
+
+	if (fd < 0 || !proc->fds || proc_unsharefds(proc) == -1)
 		return NULL;
-	if (fd < (int)(sizeof(proc->fdlovect)/sizeof(proc->fdlovect[0]))) {
-		fd_ctx_t *ctx = proc->fdlovect[fd];
-		proc->fdlovect[fd] = NULL;
+	fds = proc->fds;
+	if (fds->fdmap) {
+		ctx = tommy_hashinc_search(fds->fdmap, proc_fdcmp, &fd,
+		                           hashfd(fd));
 		if (ctx)
-			tommy_list_remove_existing(&proc->fdlolist, &ctx->node);
+			tommy_hashinc_remove_existing(fds->fdmap, &ctx->node);
 		return ctx;
 	}
-	tommy_node *node = tommy_list_head(&proc->fdhilist);
-	while (node) {
-		fd_ctx_t *ctx = node->data;
+	for (uint32_t i = 0; i < fds->fdcount; i++) {
+		ctx = fds->fdinline[i];
 		if (ctx->fd == fd) {
-			tommy_list_remove_existing(&proc->fdhilist, node);
+			fds->fdcount--;
+			fds->fdinline[i] = fds->fdinline[fds->fdcount];
+			fds->fdinline[fds->fdcount] = NULL;
 			return ctx;
 		}
-		node = node->next;
 	}
 	return NULL;
 }
@@ -82,18 +349,50 @@ void
 proc_triggerfd(fd_ctx_t *ctx, struct timespec *tv) {
 	if ((ctx->flags & FDFLAG_FILE) && ctx->fi.path) {
 		assert(ctx->fi.path);
+		fdpathbytes -= strlen(ctx->fi.path) + 1;
 		filemon_touched(tv, &ctx->fi.subject, ctx->fi.path);
 		ctx->fi.path = NULL;
 	}
 }
 
+/*
+ * Returns a zeroed fd_ctx_t, or NULL on oom.
+ */
+fd_ctx_t *
+proc_newfd(void) {
+	fd_ctx_t *ctx;
+
+	ctx = pool_alloc(&fdpool);
+	if (!ctx)
+		return NULL;
+	bzero(ctx, sizeof(fd_ctx_t));
+	return ctx;
+}
+
+/*
+ * Set the path of an open file, returns -1 on oom.
+ */
+int
+proc_setfdpath(fd_ctx_t *ctx, const char *path) {
+	size_t sz;
+
+	sz = strlen(path) + 1;
+	ctx->fi.path = malloc(sz);
+	if (!ctx->fi.path)
+		return -1;
+	memcpy(ctx->fi.path, path, sz);
+	fdpathbytes += sz;
+	return 0;
+}
+
 void
 proc_freefd(fd_ctx_t *ctx) {
 	if ((ctx->flags & FDFLAG_FILE) && ctx->fi.path) {
+		fdpathbytes -= strlen(ctx->fi.path) + 1;
 		free(ctx->fi.path);
 		ctx->fi.path = NULL;
 	}
-	free(ctx);
+	pool_free(&fdpool, ctx);
 }
 
 /*
@@ -104,13 +403,13 @@ static proc_t *
 proc_new(void) {
 	proc_t *proc;
 
-	proc = malloc(sizeof(proc_t));
+	proc = pool_alloc(&procpool);
 	if (!proc)
 		return NULL;
 	bzero(proc, sizeof(proc_t));
-	tommy_list_init(&proc->fdlolist);
-	tommy_list_init(&proc->fdhilist);
 	procs++;
+	if (procs > procspeak)
+		procspeak = procs;
 	return proc;
 }
 
@@ -121,30 +420,107 @@ proc_new(void) {
  */
 static void
 proc_free(proc_t *proc, struct timespec *tv) {
-	fd_ctx_t *ctx;
-
 	assert(proc);
-	while (!tommy_list_empty(&proc->fdlolist)) {
-		ctx = tommy_list_remove_existing(&proc->fdlolist,
-				tommy_list_head(&proc->fdlolist));
-		if (tv)
-			proc_triggerfd(ctx, tv);
-		proc_freefd(ctx);
-	}
-	while (!tommy_list_empty(&proc->fdhilist)) {
-		ctx = tommy_list_remove_existing(&proc->fdhilist,
-				tommy_list_head(&proc->fdhilist));
-		if (tv)
-			proc_triggerfd(ctx, tv);
-		proc_freefd(ctx);
-	}
+	proc_freefds(proc, tv);
 	if (proc->image_exec)
-		image_exec_free(proc->image_exec);
+		image_exec_release(proc->image_exec);
 	if (proc->cwd)
-		free(proc->cwd);
+		intern_free(proc->cwd);
 	assert(procs > 0);
 	procs--;
-	free(proc);
+	pool_free(&procpool, proc);
+}
+
+/*
+ * Distance of bucket `i' from the home bucket of `pid'.
+ */
+#define proctab_disp(I,PID) (((I) - hashpid(PID)) & proctab_mask)
+
+/*
+ * Returns the bucket index of `pid', or -1 if not in the table.
+ */
+static ssize_t
+proctab_lookup(pid_t pid) {
+	size_t i, d;
+
+	proctab_lookups++;
+	i = hashpid(pid) & proctab_mask;
+	for (d = 0;; d++) {
+		proctab_probes++;
+		if (!proctab[i].proc)
+			return -1;
+		if (proctab[i].pid == pid)
+			return (ssize_t)i;
+		if (proctab_disp(i, proctab[i].pid) < d)
+			return -1;
+		i = (i + 1) & proctab_mask;
+	}
+}
+
+/*
+ * Insert into a table that is known not to contain `pid' and to have at
+ * least one empty bucket.
+ */
+static void
+proctab_insert(proctab_bucket_t *tab, size_t mask, pid_t pid, proc_t *proc) {
+	proctab_bucket_t cur, tmp;
+	size_t i, d, dd;
+
+	cur.pid = pid;
+	cur.proc = proc;
+	i = hashpid(pid) & mask;
+	for (d = 0;; d++) {
+		if (!tab[i].proc) {
+			tab[i] = cur;
+			return;
+		}
+		dd = (i - hashpid(tab[i].pid)) & mask;
+		if (dd < d) {
+			tmp = tab[i];
+			tab[i] = cur;
+			cur = tmp;
+			d = dd;
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+static int
+proctab_resize(size_t buckets) {
+	proctab_bucket_t *tab;
+
+	assert(buckets >= procs);
+	tab = calloc(buckets, sizeof(proctab_bucket_t));
+	if (!tab)
+		return -1;
+	if (proctab) {
+		for (size_t i = 0; i <= proctab_mask; i++) {
+			if (proctab[i].proc)
+				proctab_insert(tab, buckets - 1,
+				               proctab[i].pid, proctab[i].proc);
+		}
+		free(proctab);
+	}
+	proctab = tab;
+	proctab_mask = buckets - 1;
+	return 0;
+}
+
+/*
+ * Remove bucket `i' by shifting subsequent displaced buckets back by one.
+ */
+static void
+proctab_delete(size_t i) {
+	size_t j;
+
+	for (;;) {
+		j = (i + 1) & proctab_mask;
+		if (!proctab[j].proc || proctab_disp(j, proctab[j].pid) == 0)
+			break;
+		proctab[i] = proctab[j];
+		i = j;
+	}
+	proctab[i].proc = NULL;
 }
 
 /*
@@ -155,29 +531,19 @@ proc_free(proc_t *proc, struct timespec *tv) {
 proc_t *
 proctab_create(pid_t pid) {
 	proc_t *proc;
-	uint16_t h;
-
-	h = hashpid(pid);
-	proc = proctab[h];
-	if (!proc) {
-		proc = proc_new();
-		if (proc == NULL)
-			return NULL;
-		proctab[h] = proc;
-	} else {
-		assert(proc->pid != pid);
-		while (proc->next) {
-			assert(proc->pid != pid);
-			proc = proc->next;
-		}
-		proc->next = proc_new();
-		if (proc->next == NULL)
-			return NULL;
-		proc = proc->next;
+	size_t buckets = proctab_mask + 1;
+
+	assert(proctab_lookup(pid) == -1);
+	if (procs + 1 > buckets / 8 * 7 && proctab_resize(buckets * 2) == -1 &&
+	    procs + 1 >= buckets) {
+		errno = ENOMEM;
+		return NULL;
 	}
-	assert(proc);
-	assert(!proc->next);
+	proc = proc_new();
+	if (proc == NULL)
+		return NULL;
 	proc->pid = pid;
+	proctab_insert(proctab, proctab_mask, pid, proc);
 	return proc;
 }
 
@@ -186,19 +552,12 @@ proctab_create(pid_t pid) {
  */
 proc_t *
 proctab_find(pid_t pid) {
-	proc_t *proc;
-
-	proc = proctab[hashpid(pid)];
-	if (proc) {
-		if (proc->pid == pid)
-			return proc;
-		while ((proc = proc->next)) {
-			if (proc->pid == pid)
-				return proc;
-		}
-	}
+	ssize_t i;
 
-	return NULL;
+	i = proctab_lookup(pid);
+	if (i == -1)
+		return NULL;
+	return proctab[i].proc;
 }
 
 /*
@@ -219,33 +578,24 @@ proctab_find_or_create(pid_t pid) {
  * Need to make sure to keep the proc_t accessible in proctab during
  * proc_free, because proc_free can trigger a launchd-add event which
  * in turn needs to loop up the proc to access the image_exec_t.
+ * Since that can also lead to other procs being created, the bucket needs
+ * to be looked up again after proc_free.
  */
 void
 proctab_remove(pid_t pid, struct timespec *tv) {
-	proc_t *proc;
-	uint16_t h;
-
-	h = hashpid(pid);
-	proc = proctab[h];
-	if (proc) {
-		/* pid is first in the list */
-		if (proc->pid == pid) {
-			proc_t *tmp = proc->next;
-			proc_free(proc, tv);
-			proctab[h] = tmp;
-			return;
-		}
-		/* pid is not first in the list */
-		while (proc->next) {
-			if (proc->next->pid == pid) {
-				proc_t *tmp = proc->next;
-				proc_free(tmp, tv);
-				proc->next = tmp->next;
-				return;
-			}
-			proc = proc->next;
-		}
-	}
+	size_t buckets;
+	ssize_t i;
+
+	i = proctab_lookup(pid);
+	if (i == -1)
+		return;
+	proc_free(proctab[i].proc, tv);
+	i = proctab_lookup(pid);
+	assert(i != -1);
+	proctab_delete(i);
+	buckets = proctab_mask + 1;
+	if (buckets > PROCTAB_BUCKETS_MIN && procs < buckets / 8)
+		(void)proctab_resize(buckets / 2);
 }
 
 /*
@@ -253,29 +603,103 @@ proctab_remove(pid_t pid, struct timespec *tv) {
  */
 static void
 proctab_flush(void) {
-	proc_t *proc, *next;
-	uint16_t h;
-
-	for (size_t i = 0; i < (sizeof(proctab)/sizeof(proctab[0])); i++) {
-		h = (uint16_t)i;
-		proc = proctab[h];
-		while (proc) {
-			next = proc->next;
-			proc_free(proc, NULL);
-			proc = next;
+	for (size_t i = 0; i <= proctab_mask; i++) {
+		if (proctab[i].proc) {
+			proc_free(proctab[i].proc, NULL);
+			proctab[i].proc = NULL;
 		}
 	}
 }
 
+/*
+ * Release the file descriptors of all processes, once neither filemon nor
+ * sockmon need them anymore.  Does not trigger any implicit close filemon
+ * events.
+ */
 void
+proctab_dropfds(void) {
+	for (size_t i = 0; i <= proctab_mask; i++) {
+		if (proctab[i].proc)
+			proc_freefds(proctab[i].proc, NULL);
+	}
+}
+
+/*
+ * Call `func' for every process in the table.  `func' must not add or remove
+ * processes.
+ */
+void
+proctab_foreach(void (*func)(proc_t *, void *), void *arg) {
+	for (size_t i = 0; i <= proctab_mask; i++) {
+		if (proctab[i].proc)
+			func(proctab[i].proc, arg);
+	}
+}
+
+int
 proctab_init(void) {
 	procs = 0;
-	bzero(proctab, sizeof(proctab));
+	procspeak = 0;
+	proctab = NULL;
+	proctab_lookups = 0;
+	proctab_probes = 0;
+	fdshared = 0;
+	fdunshared = 0;
+	if (pool_init(&procpool, "proc", sizeof(proc_t),
+	              PROCTAB_SLABOBJS) == -1)
+		return -1;
+	if (pool_init(&fdpool, "fd_ctx", sizeof(fd_ctx_t),
+	              FDCTX_SLABOBJS) == -1) {
+		pool_destroy(&procpool);
+		return -1;
+	}
+	if (pool_init(&fdspool, "proc_fds", sizeof(proc_fds_t),
+	              PROCTAB_SLABOBJS) == -1) {
+		pool_destroy(&fdpool);
+		pool_destroy(&procpool);
+		return -1;
+	}
+	if (proctab_resize(PROCTAB_BUCKETS_MIN) == -1) {
+		pool_destroy(&fdspool);
+		pool_destroy(&fdpool);
+		pool_destroy(&procpool);
+		return -1;
+	}
+	return 0;
 }
 
 void
 proctab_fini(void) {
+	if (!proctab)
+		return;
 	proctab_flush();
 	assert(procs == 0);
+	free(proctab);
+	proctab = NULL;
+	pool_destroy(&fdspool);
+	pool_destroy(&fdpool);
+	pool_destroy(&procpool);
 }
 
+void
+proctab_stats(proctab_stat_t *st) {
+	size_t d;
+
+	assert(st);
+
+	st->buckets = proctab_mask + 1;
+	st->load = (uint32_t)((uint64_t)procs * 100 / st->buckets);
+	st->dispmax = 0;
+	for (size_t i = 0; i <= proctab_mask; i++) {
+		if (!proctab[i].proc)
+			continue;
+		d = proctab_disp(i, proctab[i].pid);
+		if (d > st->dispmax)
+			st->dispmax = d;
+	}
+	st->lookups = proctab_lookups;
+	st->probes = proctab_probes;
+	st->fdshared = fdshared;
+	st->fdunshared = fdunshared;
+	st->fdpathbytes = fdpathbytes;
+}
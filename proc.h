@@ -13,7 +13,7 @@
 
 #include "procmon.h" /* image_exec_t */
 
-#include "tommylist.h"
+#include "tommyhashinc.h"
 
 #include <sys/types.h>
 
@@ -39,6 +39,27 @@ typedef struct {
 	};
 } fd_ctx_t;
 
+#define PROC_FDINLINE   6
+
+/*
+ * Open file descriptors.  Most processes only have a handful of tracked
+ * descriptors open at a time, which are kept in a small inline array
+ * searched linearly.  When the inline array overflows, all descriptors are
+ * moved to a hash table keyed by fd, which is kept until the table goes away.
+ *
+ * A forked child shares the descriptor table of its parent by reference
+ * until either of them changes it, at which point the process changing it
+ * gets a private copy.  Open files trigger implicit close events only from
+ * the table of the process that opened them.
+ */
+typedef struct proc_fds {
+	uint32_t refs;
+	uint32_t fdcount;               /* used slots in fdinline */
+	fd_ctx_t *fdinline[PROC_FDINLINE];
+	tommy_hashinc *fdmap;           /* NULL while descriptors are inline */
+	struct proc *owner;             /* owning the open file paths */
+} proc_fds_t;
+
 typedef struct proc {
 	/* fork meta-data at time of fork */
 	pid_t pid;
@@ -47,37 +68,33 @@ typedef struct proc {
 	/* image of last exec */
 	image_exec_t *image_exec;
 
-	/* current working directory, tracked via chdir/fchdir */
+	/* current working directory, tracked via chdir/fchdir; interned */
 	char *cwd;
 
-	/* hashtable bucket linkage */
-	struct proc *next;
-
-	/*
-	 * Open file descriptors smaller than default RLIMIT_NOFILE stored in
-	 * pointer array in addition to a list to allow O(1) access time but
-	 * still quick iteration on exit with only few descriptors.  This
-	 * yields good access complexity except for large network servers with
-	 * thousands of open sockets. FIXME look into alternatives
-	 */
-	fd_ctx_t *fdlovect[256];
-	tommy_list fdlolist;
-	tommy_list fdhilist;
+	proc_fds_t *fds;                /* NULL while no descriptors tracked */
 } proc_t;
 
 extern uint32_t procs;
+extern uint32_t procspeak;
 
-void proctab_init(void);
+int proctab_init(void) WUNRES;
 void proctab_fini(void);
+void proctab_stats(proctab_stat_t *) NONNULL(1);
 proc_t * proctab_create(pid_t);
 proc_t * proctab_find_or_create(pid_t);
 proc_t * proctab_find(pid_t);
 void proctab_remove(pid_t, struct timespec *);
+void proctab_dropfds(void);
+void proctab_foreach(void (*)(proc_t *, void *), void *) NONNULL(1);
 
+void proc_sharefds(proc_t *, proc_t *) NONNULL(1,2);
+int proc_unsharefds(proc_t *) NONNULL(1) WUNRES;
 fd_ctx_t * proc_getfd(proc_t *, int) NONNULL(1) WUNRES;
 fd_ctx_t * proc_closefd(proc_t *, int) NONNULL(1) WUNRES;
-void proc_setfd(proc_t *, fd_ctx_t *) NONNULL(1,2);
+int proc_setfd(proc_t *, fd_ctx_t *) NONNULL(1,2) WUNRES;
 void proc_triggerfd(fd_ctx_t *ctx, struct timespec *tv) NONNULL(1,2);
+fd_ctx_t * proc_newfd(void) MALLOC;
+int proc_setfdpath(fd_ctx_t *, const char *) NONNULL(1,2) WUNRES;
 void proc_freefd(fd_ctx_t *) NONNULL(1);
 
 #endif
@@ -18,13 +18,39 @@
 
 #include "tommylist.h"
 #include "proc.h"
+#include "aev.h"
 #include "hashes.h"
 #include "cachehash.h"
 #include "cachecsig.h"
+#include "cachecdhash.h"
+#include "cachefp.h"
+#include "cacheslice.h"
+#include "cachebuild.h"
+#include "cacheseal.h"
+#include "fleetcache.h"
+#include "cachefile.h"
+#include "cspool.h"
 #include "time.h"
 #include "work.h"
 #include "filemon.h"
 #include "atomic.h"
+#include "counter.h"
+#include "pool.h"
+#include "intern.h"
+#include "pidcache.h"
+#include "degrade.h"
+#include "membudget.h"
+#include "minmax.h"
+#include "queue.h"
+#include "log.h"
+#include "policy.h"
+#include "fsclass.h"
+#include "thrstat.h"
+#include "probes.h"
+#include "signpost.h"
+#include "profile.h"
+#include "tommyhashinc.h"
+#include "tommyhash.h"
 
 #include <stdbool.h>
 #include <stdint.h>
@@ -34,6 +60,7 @@
 #include <string.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <signal.h>
 #include <errno.h>
 #include <time.h>
@@ -43,29 +70,150 @@ static config_t *config;
 
 /* prepq state */
 static tommy_list pqlist;
-pthread_mutex_t pqmutex;        /* protects pqlist */
+static tommy_hashinc pqbypid;
+pthread_mutex_t pqmutex;        /* protects all prepq state */
+static uint64_t pqseq;          /* arrival sequence number */
+static size_t pqttlsum;         /* ttl of oldest element in pqlist */
+static hist_t pqlat;
 static uint64_t pqsize;         /* current number of elements in pqlist */
+static uint64_t pqpeak;         /* highest pqsize since last reset */
 static uint64_t pqlookup;       /* counts total number of lookups in pq */
 static uint64_t pqmiss;         /* counts no preloaded image found in pq */
 static uint64_t pqdrop;         /* counts preloaded imgs removed due max TTL */
 static uint64_t pqskip;         /* counts non-matching entries skipped in pq */
 
+#define IMAGE_SLABOBJS          64
+
+static pool_t imagepool;
 static atomic32_t images;
+static atomic64_t image_ids;
 static uint64_t liveacq;        /* counts live process acquisitions */
+static counter_t kexthash;      /* counts sha256 hashes taken from kext */
+static counter_t kexthash_stale; /* counts kext hashes not matching stat */
+static counter_t kextident;     /* counts images not opened due to kext id */
+static counter_t kextident_miss; /* counts kext ids not found in caches */
+static counter_t leanskip;      /* counts suppressed images not acquired */
 static uint64_t miss_bypid;     /* counts various miss conditions */
 static uint64_t miss_forksubj;
 static uint64_t miss_execsubj;
 static uint64_t miss_execinterp;
 static uint64_t miss_chdirsubj;
 static uint64_t miss_getcwd;
-static atomic64_t ooms;         /* counts events impaired due to OOM */
+static counter_t ooms;          /* counts events impaired due to OOM */
+static counter_t vecbytes;      /* bytes of argv and envv of live images */
+static counter_t fragbytes;     /* bytes of cached renderings */
+
+setstr_t *_Atomic *suppress_image_exec_by_ident;
+setstr_t *_Atomic *suppress_image_exec_by_path;
+setstr_t *_Atomic *suppress_image_exec_by_ancestor_ident;
+setstr_t *_Atomic *suppress_image_exec_by_ancestor_path;
+static atomic_uint suppress_epoch;     /* advanced by config reloads */
+
+/*
+ * Two-phase image-exec logging.  With config->enrich_threads > 0, images
+ * whose hashes or code signature cannot be served from the caches are
+ * logged by the worker right away with what is known at exec time, and
+ * flagged with EIFLAG_ENRICH.  A private copy of the image, taking over its
+ * open file descriptor, is queued to the enrichment threads, which acquire
+ * hashes and code signature as usual, filling the caches on the way, and
+ * log them as a separate image-enrich[9] event carrying the same image_id.
+ * Enrichment events bypass the work stage and its reorder buffer, so that
+ * slow acquisitions do not hold up any other events; they are logged out of
+ * timestamp order.
+ *
+ * The image logged in the first phase never receives the hashes and code
+ * signature, so that the log thread and other workers can keep using it
+ * without synchronization.  As a consequence, suppressions by ident do not
+ * match it, and its renderings as an ancestor lack hashes and signature.
+ * Later executions of the same file are served from the caches and logged
+ * in a single phase.  If the enrichment queue is full, the image is
+ * acquired by the worker in a single phase as well.
+ */
+static queue_t enrichq;
+static pthread_t enrichthr[ENRICH_THREADS_MAX];
+static size_t enrichthrs;
+static char enrich_stop[1];     /* sentinel, one per thread */
+static counter_t enriched;
+static counter_t scriptpar;     /* scripts acquired on a helper thread */
+
+/*
+ * Repeated execs.  Shells, build systems and CI scripts exec the same few
+ * images from the same parent thousands of times.  The main thread keeps
+ * the most recent image exec'd by children of each parent image in a small
+ * direct-mapped table keyed by parent image and (dev,ino) from the audit
+ * record.  Once a worker has published the acquisition of such an image as
+ * complete, a repeated exec of the same file from the same parent copies
+ * stat, hashes and code signature from it after a single stat(2) to make
+ * sure the file was not modified in place, instead of opening the file,
+ * reading the shebang, looking up both caches and possibly hashing.  Only
+ * images exec'd without the kext prep queue and that are not scripts are
+ * reused.  Holding the table entries keeps those images and their
+ * ancestors alive until replaced.
+ */
+#define EXECCACHE_SLOTS 64      /* power of two */
+typedef struct {
+	uint64_t parent;        /* id of the image of the exec'ing process */
+	image_exec_t *image;
+} execcache_t;
+static execcache_t execcache[EXECCACHE_SLOTS];  /* main thread only */
+static uint64_t rexec_hit;
+static uint64_t rexec_stale;
+static uint64_t execs;          /* main thread only */
+static counter_t opens;         /* also opened on preload threads */
+static uint64_t fdhandoffs;     /* main thread only */
+static counter_t hashresumes;
+static counter_t buildunsigned;
+static uint64_t forks;          /* main thread only */
+
+/*
+ * Reconciliation of proctab with the running processes; see procmon_reap.
+ * Main thread only.
+ */
+#define REAP_INTERVAL           60      /* seconds between regular sweeps */
+#define REAP_STORM_RATE         100     /* forks per second */
+#define REAP_STORM_GROWTH       4096    /* procs added since last sweep */
+static pid_t *reapv;            /* orphans left by last sweep, sorted */
+static size_t reapc;
+static struct timespec reaptv;  /* time of last sweep */
+static uint64_t reapforks;      /* forks at last sweep */
+static uint32_t reapprocs;      /* procs after last sweep */
+static uint64_t reapsweeps;
+static uint64_t reapstorms;     /* sweeps triggered by fork storms */
+static uint64_t reaped;         /* orphans evicted */
+
+/*
+ * Presence bitmap of the pids that were running at pidmaptv, built from
+ * the single sys_pidlist of every reap sweep, and rebuilt at most every
+ * PIDMAP_REBUILD_MSEC after a live acquisition found a process gone, which
+ * tends to come in bursts after auditpipe drops.  A record from before
+ * pidmaptv about a pid that was not running at pidmaptv refers to a process
+ * that has exited since, so live acquisition would fail or acquire an
+ * unrelated process reusing the pid, and is skipped without any syscalls.
+ * Main thread only.
+ */
+#define PIDMAP_PIDS             100000  /* PID_MAX + 1 in XNU */
+#define PIDMAP_REBUILD_MSEC     1000
+static uint64_t pidmap[(PIDMAP_PIDS + 63) / 64];
+static struct timespec pidmaptv;        /* zero while not built */
+static uint64_t pidmapnsec;             /* monotonic time of last build */
+static uint64_t pidmaprebuilds;
+static uint64_t pidmapskips;            /* acquisitions skipped */
 
-setstr_t *suppress_image_exec_by_ident;
-setstr_t *suppress_image_exec_by_path;
-setstr_t *suppress_image_exec_by_ancestor_ident;
-setstr_t *suppress_image_exec_by_ancestor_path;
+/*
+ * Background reclaimer for the images released by exiting processes; see
+ * image_exec_release.
+ */
+static image_exec_t *_Atomic reclaimstack;
+static pthread_mutex_t reclaimmutex;
+static pthread_cond_t reclaimcond;
+static pthread_t reclaimthr;
+static bool reclaiming;         /* reclaimer thread running */
+static bool reclaimstop;        /* protected by reclaimmutex */
+static uint64_t reclaims;       /* main thread only */
+static uint64_t trims;          /* main thread only */
 
 static int image_exec_work(image_exec_t *);
+static void image_exec_logged(image_exec_t *);
 
 /*
  * Ownership of path will be transfered to image_exec; caller must not assume
@@ -80,100 +228,376 @@ image_exec_new(char *path) {
 
 	assert(path);
 
-	image = malloc(sizeof(image_exec_t));
+	image = pool_alloc(&imagepool);
 	if (!image) {
 		free(path);
-		atomic64_inc(&ooms);
+		counter_inc(&ooms);
 		return NULL;
 	}
 	bzero(image, sizeof(image_exec_t));
-	pthread_mutex_init(&image->refsmutex, NULL);
+	image->id = atomic64_inc(&image_ids);
+	image->path = intern_take(path);
+	if (!image->path) {
+		pool_free(&imagepool, image);
+		counter_inc(&ooms);
+		return NULL;
+	}
 	image->refs = 1;
 #ifdef DEBUG_REFS
-	fprintf(stderr, "DEBUG_REFS: image_exec_new(%p) refs=%zu\n",
-	                image, image->refs);
+	fprintf(stderr, "DEBUG_REFS: image_exec_new(%p) refs=1\n", image);
 #endif
-	image->path = path;
 	image->fd = -1;
 	image->hdr.code = LOGEVT_IMAGE_EXEC;
 	image->hdr.le_work = (__typeof__(image->hdr.le_work))image_exec_work;
-	image->hdr.le_free = (__typeof__(image->hdr.le_free))image_exec_free;
+	image->hdr.le_free = (__typeof__(image->hdr.le_free))image_exec_logged;
+	image->hdr.affinity = image;
 	atomic32_inc(&images);
 	return image;
 }
 
 /*
- * Must not use config because config will be set to NULL before the last
- * instances of image_exec are drained out of the log queue.
+ * Release everything owned by image except for its previous image, which is
+ * left to the caller.
  */
-void
-image_exec_free(image_exec_t *image) {
-	assert(image);
-	pthread_mutex_lock(&image->refsmutex);
-	image->refs--;
-#ifdef DEBUG_REFS
-	fprintf(stderr, "DEBUG_REFS: image_exec_free(%p) refs=%zu (was %zu)\n",
-	                image, image->refs, image->refs + 1);
-#endif
-	if (image->refs > 0) {
-		pthread_mutex_unlock(&image->refsmutex);
-		return;
-	}
-	pthread_mutex_unlock(&image->refsmutex);
-	pthread_mutex_destroy(&image->refsmutex);
+static void
+image_exec_destroy(image_exec_t *image) {
 	if (image->script)
 		image_exec_free(image->script);
-	if (image->prev)
-		image_exec_free(image->prev);
 	if (image->argv)
 		free(image->argv);
 	if (image->envv)
 		free(image->envv);
+	if (image->vecsz)
+		counter_add(&vecbytes, -(uint64_t)image->vecsz);
 	if (image->path)
-		free(image->path);
+		intern_free(image->path);
 	if (image->cwd)
-		free(image->cwd);
+		intern_free(image->cwd);
 	if (image->codesign)
 		codesign_free(image->codesign);
+	if (image->hctx)
+		hashes_ctx_free(image->hctx);
+	if (image->slice)
+		free(image->slice);
+	image_exec_frags_free(image);
 	atomic32_dec(&images);
-	free(image);
+	pool_free(&imagepool, image);
+}
+
+/*
+ * Drop all renderings cached in image.
+ */
+void
+image_exec_frags_free(image_exec_t *image) {
+	image_frag_t *frag;
+
+	while (image->frags) {
+		frag = image->frags;
+		image->frags = frag->next;
+		image_exec_frags_account(-(int64_t)(sizeof(image_frag_t) +
+		                                    frag->sz));
+		free(frag->buf);
+		free(frag);
+	}
+}
+
+/*
+ * Account bytes of renderings added to or dropped from an image by the log
+ * thread, see logevt.c.  Thread-safe.
+ */
+void
+image_exec_frags_account(int64_t delta) {
+	counter_add(&fragbytes, (uint64_t)delta);
+}
+
+/*
+ * Drop a reference to image and free it if it was the last one.  The
+ * decrement is fenced, which orders all accesses made through this
+ * reference before the decrement, and all accesses of the thread freeing
+ * the image after it.  Freeing an image drops its reference to the previous
+ * image, which may in turn be the last one; the ancestor chain is unwound
+ * iteratively in a single pass instead of recursing once per level.
+ *
+ * Must not use config because config will be set to NULL before the last
+ * instances of image_exec are drained out of the log queue.
+ */
+void
+image_exec_free(image_exec_t *image) {
+	image_exec_t *prev;
+
+	assert(image);
+	do {
+#ifdef DEBUG_REFS
+		fprintf(stderr, "DEBUG_REFS: image_exec_free(%p) refs=%"PRIu64
+		                " (before)\n",
+		                image, (uint64_t)atomic64_load(&image->refs));
+#endif
+		if (!atomic64_dec_test0(&image->refs))
+			return;
+		prev = image->prev;
+		image_exec_destroy(image);
+		image = prev;
+	} while (image);
+}
+
+/*
+ * Drop the reference held by the own image-exec or image-enrich event of
+ * image, after it was logged or discarded.  The release pairs with the
+ * acquire in image_exec_trim_ancestors, ordering the renderings of argv and
+ * envv before trimming them.
+ */
+static void
+image_exec_logged(image_exec_t *image) {
+	atomic_store_explicit(&image->logged, true, memory_order_release);
+	image_exec_free(image);
 }
 
+/*
+ * New references are only ever taken from an existing one, so the increment
+ * needs no ordering with respect to other memory accesses.
+ */
 static void
 image_exec_ref(image_exec_t *image) {
 	assert(image);
-	pthread_mutex_lock(&image->refsmutex);
-	image->refs++;
+	atomic64_fast_inc(&image->refs);
 #ifdef DEBUG_REFS
-	fprintf(stderr, "DEBUG_REFS: image_exec_ref(%p) refs=%zu (was %zu)\n",
-	                image, image->refs, image->refs - 1);
+	fprintf(stderr, "DEBUG_REFS: image_exec_ref(%p) refs=%"PRIu64"\n",
+	                image, (uint64_t)atomic64_load(&image->refs));
 #endif
-	pthread_mutex_unlock(&image->refsmutex);
 }
 
 /*
- * Prune history of exec images to config->ancestors previous levels.  Go
- * back in history and free previous image iff on the whole path, all images
- * were exclusively owned by this one, i.e. had a refcount of 1, in order to
- * make sure that we are not cutting short another fork's exec history.
+ * Drop the reference of an exiting process to image.  Unwinding the lineage
+ * of the last reference would delay the main thread during bursts of exits,
+ * such as at the end of a build, so images whose last reference is dropped
+ * here are pushed onto a lock-free stack linked via reclaimnext instead,
+ * which the reclaimer thread takes as a whole and frees.  As the stack is
+ * only ever emptied as a whole, it needs no protection against ABA.  The
+ * mutex only serves to wake the reclaimer when the stack becomes non-empty.
+ * Falls back to image_exec_free if the reclaimer is not running.  Main
+ * thread only.
+ */
+void
+image_exec_release(image_exec_t *image) {
+	image_exec_t *head;
+
+	assert(image);
+	if (!reclaiming) {
+		image_exec_free(image);
+		return;
+	}
+	if (!atomic64_dec_test0(&image->refs))
+		return;
+	reclaims++;
+	head = atomic_load(&reclaimstack);
+	do {
+		image->reclaimnext = head;
+	} while (!atomic_compare_exchange_weak(&reclaimstack, &head, image));
+	if (!head) {
+		pthread_mutex_lock(&reclaimmutex);
+		pthread_cond_signal(&reclaimcond);
+		pthread_mutex_unlock(&reclaimmutex);
+	}
+}
+
+static void *
+reclaim_thread(UNUSED void *arg) {
+	image_exec_t *image, *next, *prev;
+	bool stop;
+
+	(void)policy_thread_qos(THRSTAT_BULK);
+	thrstat_register(THRSTAT_BULK);
+
+	do {
+		pthread_mutex_lock(&reclaimmutex);
+		while (!reclaimstop && !atomic_load(&reclaimstack))
+			pthread_cond_wait(&reclaimcond, &reclaimmutex);
+		stop = reclaimstop;
+		pthread_mutex_unlock(&reclaimmutex);
+		image = atomic_exchange(&reclaimstack, NULL);
+		while (image) {
+			next = image->reclaimnext;
+			prev = image->prev;
+			image_exec_destroy(image);
+			if (prev)
+				image_exec_free(prev);
+			image = next;
+		}
+	} while (!stop);
+	return NULL;
+}
+
+/*
+ * Without a reclaimer thread, images are released synchronously.
+ */
+static void
+reclaim_init(void) {
+	atomic_store(&reclaimstack, NULL);
+	reclaimstop = false;
+	reclaims = 0;
+	pthread_mutex_init(&reclaimmutex, NULL);
+	pthread_cond_init(&reclaimcond, NULL);
+	reclaiming = pthread_create(&reclaimthr, NULL,
+	                            reclaim_thread, NULL) == 0;
+}
+
+/*
+ * Must be called after all processes have been released and before the
+ * image pool is destroyed.
+ */
+static void
+reclaim_fini(void) {
+	if (reclaiming) {
+		pthread_mutex_lock(&reclaimmutex);
+		reclaimstop = true;
+		pthread_cond_signal(&reclaimcond);
+		pthread_mutex_unlock(&reclaimmutex);
+		if (pthread_join(reclaimthr, NULL) != 0) {
+			fprintf(stderr, "Failed to join reclaim thread - "
+			                "exiting\n");
+			exit(EXIT_FAILURE);
+		}
+		reclaiming = false;
+	}
+	assert(!atomic_load(&reclaimstack));
+	pthread_cond_destroy(&reclaimcond);
+	pthread_mutex_destroy(&reclaimmutex);
+}
+
+/*
+ * Link image to its previous image, taking over the caller's reference to
+ * prev.  Main thread only.
  */
 static void
-image_exec_prune_ancestors(image_exec_t *image, size_t level) {
+image_exec_link(image_exec_t *image, image_exec_t *prev) {
+	image->prev = prev;
+	image->depth = prev->depth < SIZE_MAX ? prev->depth + 1 : SIZE_MAX;
+}
+
+/*
+ * Prune history of exec images to the previous image, which is shown as the
+ * subject's image, and `ancestors' levels beyond it.
+ *
+ * Lineages are persistent lists:  forks share the image of their parent and
+ * execs link the new image to the previous one, so the common tail of all
+ * descendants of an image is stored only once.  The image at the limit may
+ * only be cut off from its own history if it and all images between it and
+ * image are held exclusively by the link from the next younger image, as
+ * anything holding one of them directly may need the full history beyond
+ * it.  The refcount of image itself does not matter, as all its holders
+ * need no more history than image.
+ *
+ * Images are only ever linked to images directly held by a process, ie.
+ * never to an exclusively held one, so the part of the lineage inspected
+ * here cannot change concurrently.  The depth recorded when linking lets
+ * shallow lineages return without walking them, and the walk ends at the
+ * first shared image, which usually is the parent's image for forks.
+ * Depths are upper bounds and only corrected on the pruned path.
+ */
+static void
+image_exec_prune_ancestors(image_exec_t *image, size_t ancestors) {
+	image_exec_t *pie, *cut;
+	size_t keep, level;
+
 	assert(image);
+	assert(ancestors < SIZE_MAX);
 
 #ifdef DEBUG_REFS
-	fprintf(stderr, "DEBUG_REFS: image_exec_prune_ancestors(%p, level %zu) "
-	                "refs=%zu\n", image, level, image->refs);
+	fprintf(stderr, "DEBUG_REFS: image_exec_prune_ancestors(%p) "
+	                "depth=%zu\n", image, image->depth);
 #endif
-	if (!image->prev)
+	keep = ancestors + 1;
+	if (image->depth <= keep)
 		return;
-	if (level >= config->ancestors) {
-		image_exec_free(image->prev);
-		image->prev = NULL;
+	cut = image;
+	for (level = 0; level < keep; level++) {
+		cut = cut->prev;
+		if (!cut || atomic64_load(&cut->refs) != 1)
+			return;
+	}
+	if (!cut->prev)
+		return;
+	image_exec_free(cut->prev);
+	cut->prev = NULL;
+	cut->depth = 0;
+	level = keep;
+	for (pie = image->prev; pie != cut; pie = pie->prev)
+		pie->depth = --level;
+}
+
+/*
+ * Number of ancestor levels that image_exec_prune_ancestors keeps in all
+ * lineages, which the main thread can walk while workers are pruning.
+ */
+static size_t
+image_exec_kept_levels(void) {
+	size_t levels = config->ancestors;
+
+	if (config->memory_budget > 0)
+		levels = min(levels, config->degrade_ancestors);
+	return levels;
+}
+
+/*
+ * Drop envv and truncate argv of image to ancestor_argv_bytes.
+ * Main thread only.
+ */
+static void
+image_exec_trim(image_exec_t *image) {
+	char **argv = image->argv;
+	size_t vecsz;
+
+	if (argv && aev_size(argv) > config->ancestor_argv_bytes) {
+		argv = aev_new_trunc(argv, config->ancestor_argv_bytes);
+		if (!argv && errno == ENOMEM) {
+			counter_inc(&ooms);
+			return;
+		}
+		free(image->argv);
+		image->argv = argv;
+	}
+	if (image->envv) {
+		free(image->envv);
+		image->envv = NULL;
+	}
+	vecsz = aev_size(image->argv);
+	counter_add(&vecbytes, vecsz - image->vecsz);
+	image->vecsz = vecsz;
+	image->trimmed = true;
+	trims++;
+}
+
+/*
+ * Trim argv and envv of the ancestors of image beyond ancestor_argv levels.
+ * Nothing renders the argv and envv of an image after its own event, but
+ * the event may still be in flight when the image becomes an ancestor;
+ * such ancestors are left for a later exec in the same lineage.  The walk
+ * ends at the first ancestor trimmed before, as every exec extends a
+ * lineage by a single level.
+ *
+ * Main thread only, before image is submitted to the work queue.
+ */
+static void
+image_exec_trim_ancestors(image_exec_t *image) {
+	image_exec_t *pie;
+	size_t level, levels;
+
+	if (config->ancestor_argv == SIZE_MAX)
 		return;
+	levels = image_exec_kept_levels();
+	level = 1;
+	for (pie = image->prev; pie && level <= levels; pie = pie->prev) {
+		if (level++ <= config->ancestor_argv)
+			continue;
+		if (pie->trimmed)
+			break;
+		if (!pie->argv && !pie->envv) {
+			pie->trimmed = true;
+			continue;
+		}
+		if (atomic_load_explicit(&pie->logged, memory_order_acquire))
+			image_exec_trim(pie);
 	}
-	if (image->refs == 1)
-		image_exec_prune_ancestors(image->prev, level + 1);
 }
 
 /*
@@ -188,6 +612,7 @@ static int
 image_exec_open(image_exec_t *image, const audit_attr_t *attr, bool kern)
 {
 	char buf[2];
+	bool shebang;
 	int rv;
 	int oflag;
 
@@ -201,9 +626,11 @@ image_exec_open(image_exec_t *image, const audit_attr_t *attr, bool kern)
 		 * way we do not have to change all the code to retry all file
 		 * operations when outside of prep queue mode.
 		 */
-		if (image->fd != -1 && !kern &&
-		    sys_fd_setblocking(image->fd) == -1)
-			return -1;
+		if (image->fd != -1 && !kern) {
+			if (sys_fd_setblocking(image->fd) == -1)
+				return -1;
+			fdhandoffs++;
+		}
 		return 0;
 	}
 
@@ -214,6 +641,26 @@ image_exec_open(image_exec_t *image, const audit_attr_t *attr, bool kern)
 	}
 	assert(!!strncmp(image->path, "/dev/", 5));
 
+	/* the images on disk are not the ones in the replayed trace */
+	if (config->trace_replay && !config->trace_replay_lookups) {
+		if (attr)
+			goto fallback;
+		errno = ENOENT;
+		return -1;
+	}
+
+	/* images on the sealed system volume cannot change, see cacheseal.c */
+	if (attr && cacheseal_get(&image->stat, &image->hashes, &shebang,
+	                          attr->dev, attr->ino) &&
+	    image->stat.mode == attr->mode &&
+	    image->stat.uid == attr->uid &&
+	    image->stat.gid == attr->gid) {
+		if (shebang)
+			image->flags |= EIFLAG_SHEBANG;
+		image->flags |= EIFLAG_STAT|EIFLAG_HASHES;
+		return 0;
+	}
+
 	/*
 	 * Open the image file non-blocking if the kext is waiting for us.
 	 * This is to avoid blocking processes in the kext while a long-running
@@ -223,7 +670,10 @@ image_exec_open(image_exec_t *image, const audit_attr_t *attr, bool kern)
 	oflag = O_RDONLY;
 	if (kern)
 		oflag |= O_NONBLOCK;
+	XNUMON_IMAGE_OPEN_START(image->path);
 	image->fd = open(image->path, oflag);
+	XNUMON_IMAGE_OPEN_DONE(image->path, image->fd == -1 ? -1 : 0);
+	counter_inc(&opens);
 	if (image->fd == -1) {
 		if (attr)
 			goto fallback;
@@ -255,6 +705,15 @@ image_exec_open(image_exec_t *image, const audit_attr_t *attr, bool kern)
 	} else if ((rv == 2) && (buf[0] == '#' && buf[1] == '!'))
 		image->flags |= EIFLAG_SHEBANG;
 
+	switch (fsclass_policy(image->stat.dev, image->fd)) {
+	case FSCLASS_BULK:
+		image->flags |= EIFLAG_FSBULK;
+		break;
+	case FSCLASS_SKIP:
+		image->flags |= EIFLAG_FSSKIP;
+		break;
+	}
+
 	image->flags |= EIFLAG_STAT;
 #ifdef DEBUG_EXECIMAGE
 	fprintf(stderr, "DEBUG_EXECIMAGE: stat from path=%s\n", image->path);
@@ -282,6 +741,181 @@ image_exec_close(image_exec_t *image) {
 		close(image->fd);
 		image->fd = -1;
 	}
+	if (image->hctx) {
+		hashes_ctx_free(image->hctx);
+		image->hctx = NULL;
+	}
+}
+
+/*
+ * Returns true if hashes still need to be acquired for the image or its
+ * script and the file is larger than the bulk threshold or resides on a
+ * filesystem in fstypes_bulk.
+ */
+static bool
+image_exec_is_bulk(image_exec_t *image) {
+	if (image->script && image_exec_is_bulk(image->script))
+		return true;
+	return (image->flags & (EIFLAG_STAT|EIFLAG_HASHES|EIFLAG_DONE)) ==
+	       EIFLAG_STAT &&
+	       ((size_t)image->stat.size > config->bulk_threshold ||
+	        (image->flags & EIFLAG_FSBULK));
+}
+
+/*
+ * Get the cdhash of the live process executing image, for use with the
+ * cdhash cache.  Only the main executable of a process has the cdhash of the
+ * process, and only once the process executes it, which excludes scripts and
+ * images acquired during kext callbacks.  The path check guards against the
+ * process having executed another image or exited in the meantime.
+ */
+static int
+image_exec_pidcdhash(image_exec_t *image, unsigned char *cdhash) {
+	char *path;
+	int rv;
+
+	if ((!cachecdhash_enabled() && !fleetcache_enabled()) ||
+	    image->pid <= 0 ||
+	    (image->flags & EIFLAG_SHEBANG) || !(image->flags & EIFLAG_STAT))
+		return -1;
+	if (sys_pidcdhash(image->pid, cdhash, CDHASHSZ) == -1)
+		return -1;
+	path = sys_pidpath(image->pid);
+	if (!path)
+		return -1;
+	rv = strcmp(path, image->path) ? -1 : 0;
+	free(path);
+	return rv;
+}
+
+/*
+ * Returns true if `st', taken from the still open fd of image, no longer
+ * matches the 1st stat of image.  No need to compare dev and ino.
+ */
+static bool
+image_exec_changed(image_exec_t *image, stat_attr_t *st) {
+	return (image->stat.size != st->size) ||
+	       (image->stat.mtime.tv_sec != st->mtime.tv_sec) ||
+	       (image->stat.mtime.tv_nsec != st->mtime.tv_nsec) ||
+	       (image->stat.ctime.tv_sec != st->ctime.tv_sec) ||
+	       (image->stat.ctime.tv_nsec != st->ctime.tv_nsec) ||
+	       (image->stat.btime.tv_sec != st->btime.tv_sec) ||
+	       (image->stat.btime.tv_nsec != st->btime.tv_nsec);
+}
+
+/*
+ * Get the content fingerprint of image for use with the fingerprint cache.
+ * Fails if the file changed while it was read, such that the fingerprint
+ * always belongs to the file matching the 1st stat.
+ */
+static int
+image_exec_fingerprint(image_exec_t *image, uint64_t *fp) {
+	stat_attr_t st;
+	off_t sz;
+
+	if (!cachefp_enabled())
+		return -1;
+	if (hashes_fp(&sz, fp, image->fd) == -1 || sz != image->stat.size)
+		return -1;
+	if (sys_fdattr(&st, image->fd) == -1 || image_exec_changed(image, &st))
+		return -1;
+	return 0;
+}
+
+/*
+ * Returns true if the code signature of image, which is about to be hashed,
+ * should be verified while hashing.  Only for images that will need a code
+ * signature verification right after hashing unless the hashes turn out to
+ * be in cachecsig; images acquired during kext callbacks and scripts are
+ * left to the serial path.
+ */
+static bool
+image_exec_overlap(image_exec_t *image, bool kern) {
+	return config->codesign_overlap && config->codesign && !kern &&
+	       !image->codesign && !(image->flags & EIFLAG_SHEBANG) &&
+	       degrade_level() < DEGRADE_CODESIGN;
+}
+
+/*
+ * Returns true if image is hashed in slices:  images larger than
+ * bulk_threshold are hashed bulk_threshold bytes at a time while the kext is
+ * waiting for us, and the remainder is hashed on the worker or bulk thread,
+ * continuing from where the last kext callback left off.
+ */
+static bool
+image_exec_sliced(image_exec_t *image, bool kern) {
+	return image->hctx ||
+	       (kern && config->bulk_threshold > 0 &&
+	        (size_t)image->stat.size > config->bulk_threshold);
+}
+
+/*
+ * Hash the next slice of image during a kext callback, or the remainder of
+ * image otherwise.  Returns 1 if more remains to be hashed, 0 with the
+ * hashes of image and *sz set once the whole file is hashed, and -1 on
+ * errors.
+ */
+static int
+image_exec_hash(image_exec_t *image, int hflags, bool kern, off_t *sz) {
+	int rv;
+
+	if (!image->hctx) {
+		image->hctx = hashes_ctx_new(hflags, image->path,
+		                             image->stat.size);
+		if (!image->hctx)
+			return -1;
+	} else if (!kern) {
+		counter_inc(&hashresumes);
+	}
+	rv = hashes_ctx_update(image->hctx, image->fd,
+	                       kern ? config->bulk_threshold : 0);
+	if (rv == 1)
+		return 1;
+	if (rv == 0)
+		hashes_ctx_final(image->hctx, sz, &image->hashes);
+	else
+		hashes_ctx_free(image->hctx);
+	image->hctx = NULL;
+	return rv;
+}
+
+/*
+ * Look up the hash of the slice of a universal binary that the host runs
+ * natively, by the file hashes in the slice cache or by hashing the slice.
+ * Requires the hashes of image and its open file descriptor.
+ */
+static void
+image_exec_slice(image_exec_t *image) {
+	hashes_slice_t slice;
+	bool found, hit = false;
+
+	image->flags |= EIFLAG_SLICE;
+	if (image->fd == -1 || (image->flags & EIFLAG_SHEBANG))
+		return;
+	if (!(image->flags & EIFLAG_NOSHA256))
+		hit = cacheslice_get(&image->hashes, &slice, &found);
+	if (!hit) {
+		switch (hashes_slice(&slice, image->fd, image->stat.size)) {
+		case 0:
+			found = true;
+			break;
+		case 1:
+			found = false;
+			break;
+		default:
+			return;
+		}
+		if (!(image->flags & EIFLAG_NOSHA256))
+			cacheslice_put(&image->hashes, found ? &slice : NULL);
+	}
+	if (!found)
+		return;
+	image->slice = malloc(sizeof(hashes_slice_t));
+	if (!image->slice) {
+		image->flags |= EIFLAG_ENOMEM;
+		return;
+	}
+	memcpy(image->slice, &slice, sizeof(hashes_slice_t));
 }
 
 /*
@@ -292,10 +926,14 @@ image_exec_close(image_exec_t *image) {
  */
 static int
 image_exec_acquire(image_exec_t *image, bool kern) {
+	unsigned char cdhash[CDHASHSZ];
+	cspool_job_t *csjob = NULL;
 	stat_attr_t st;
 	off_t sz;
-	bool hit;
-	int rv;
+	uint64_t fp, t0;
+	size_t len;
+	bool hit, fpok = false;
+	int hflags, rv;
 
 	assert(image);
 
@@ -306,8 +944,9 @@ image_exec_acquire(image_exec_t *image, bool kern) {
 	if (kern && config->kextlevel < KEXTLEVEL_HASH)
 		return 0;
 
-	/* postpone large binaries for later offline processing */
-	if (kern && image->stat.size > 1024*1024*8)
+	/* postpone slow filesystems for later offline processing, large
+	 * binaries are hashed in slices, see image_exec_sliced */
+	if (kern && (image->flags & EIFLAG_FSBULK))
 		return 0;
 
 	if (!(image->flags & EIFLAG_HASHES)) {
@@ -322,11 +961,100 @@ image_exec_acquire(image_exec_t *image, bool kern) {
 		                    &image->stat.mtime,
 		                    &image->stat.ctime,
 		                    &image->stat.btime);
+		if (!hit && !kern && !image->codesign &&
+		    image_exec_pidcdhash(image, cdhash) == 0) {
+			if (cachecdhash_get(cdhash, image->stat.size,
+			                    &image->hashes, &image->codesign)) {
+				/* known code in a new inode, see cachecdhash.c */
+				hit = true;
+			} else if (fleetcache_get(cdhash, image->stat.size,
+			                          &image->hashes,
+			                          &image->codesign)) {
+				/* known code elsewhere, see fleetcache.c */
+				cachecdhash_put(cdhash, image->stat.size,
+				                &image->hashes, image->codesign);
+				hit = true;
+			}
+			if (hit)
+				cachehash_put(image->stat.dev,
+				              image->stat.ino,
+				              &image->stat.mtime,
+				              &image->stat.ctime,
+				              &image->stat.btime,
+				              &image->hashes);
+		}
+		if (!hit && (image->flags & EIFLAG_FSSKIP)) {
+			/* fstypes_skip, do not read the file at all */
+			close(image->fd);
+			image->fd = -1;
+			image->flags |= EIFLAG_DONE;
+			return 0;
+		}
+		/* the fingerprint reads the whole file */
+		if (!hit && !image_exec_sliced(image, kern) &&
+		    image_exec_fingerprint(image, &fp) == 0) {
+			fpok = true;
+			if (cachefp_get(fp, image->stat.size,
+			                &image->hashes)) {
+				/* known content in a new inode */
+				cachehash_put(image->stat.dev,
+				              image->stat.ino,
+				              &image->stat.mtime,
+				              &image->stat.ctime,
+				              &image->stat.btime,
+				              &image->hashes);
+				hit = true;
+			}
+		}
+		/* hashed elsewhere since the last kext slice */
+		if (hit && image->hctx) {
+			hashes_ctx_free(image->hctx);
+			image->hctx = NULL;
+		}
+		XNUMON_IMAGE_HASH_CACHE(image->path, hit);
+		if (profile_active())
+			profile_cache(PROFILE_HASHCACHE, hit);
 		if (!hit) {
 			/* cache miss, calculate hashes */
-			rv = hashes_fd(&sz, &image->hashes, config->hflags,
-			               image->fd);
+			if (image->hctx)
+				hflags = hashes_ctx_flags(image->hctx);
+			else
+				hflags = config->hflags;
+			if (image->flags & EIFLAG_KEXTHASH)
+				hflags &= ~HASH_SHA256;
+			if ((hflags & HASH_SHA256) && (hflags & ~HASH_SHA256) &&
+			    !image->hctx &&
+			    degrade_level() >= DEGRADE_HASHES) {
+				hflags &= ~HASH_SHA256;
+				bzero(image->hashes.sha256, SHA256SZ);
+				image->flags |= EIFLAG_NOSHA256;
+				degrade_skipped_sha256();
+			}
+			/* kext hashed the file matching the 1st stat */
+			if (hflags == 0)
+				goto hashed;
+			if (image_exec_overlap(image, kern))
+				csjob = cspool_start(image->path, &image->stat);
+			XNUMON_IMAGE_HASH_START(image->path);
+			SIGNPOST_BEGIN(SIGNPOST_PROCMON, "hash", image);
+			t0 = profile_begin();
+			if (image_exec_sliced(image, kern))
+				rv = image_exec_hash(image, hflags, kern, &sz);
+			else
+				rv = hashes_fd(&sz, &image->hashes, hflags,
+				               image->fd, image->path);
+			if (t0)
+				profile_phase(PROFILE_HASH, t0);
+			SIGNPOST_END(SIGNPOST_PROCMON, "hash", image);
+			XNUMON_IMAGE_HASH_DONE(image->path, rv);
+			/* kext slice done, keep fd and digests for later */
+			if (rv == 1) {
+				assert(kern && !csjob);
+				return 0;
+			}
 			if ((rv == -1) || (sz != image->stat.size)) {
+				if (csjob)
+					cspool_abandon(csjob);
 				close(image->fd);
 				image->fd = -1;
 				image->flags |= EIFLAG_DONE;
@@ -338,31 +1066,35 @@ image_exec_acquire(image_exec_t *image, bool kern) {
 			 */
 			rv = sys_fdattr(&st, image->fd);
 			if (rv == -1) {
+				if (csjob)
+					cspool_abandon(csjob);
 				close(image->fd);
 				image->fd = -1;
 				image->flags |= EIFLAG_DONE;
 				return -1;
 			}
-			/* fd still open, no need to compare dev and ino */
-			if ((image->stat.size != st.size) ||
-			    (image->stat.mtime.tv_sec != st.mtime.tv_sec) ||
-			    (image->stat.mtime.tv_nsec != st.mtime.tv_nsec) ||
-			    (image->stat.ctime.tv_sec != st.ctime.tv_sec) ||
-			    (image->stat.ctime.tv_nsec != st.ctime.tv_nsec) ||
-			    (image->stat.btime.tv_sec != st.btime.tv_sec) ||
-			    (image->stat.btime.tv_nsec != st.btime.tv_nsec)) {
+			if (image_exec_changed(image, &st)) {
 				image->flags &= ~EIFLAG_HASHES;
+				if (csjob)
+					cspool_abandon(csjob);
 				close(image->fd);
 				image->fd = -1;
 				image->flags |= EIFLAG_DONE;
 				return -1;
 			}
-			cachehash_put(image->stat.dev,
-			              image->stat.ino,
-			              &image->stat.mtime,
-			              &image->stat.ctime,
-			              &image->stat.btime,
-			              &image->hashes);
+hashed:
+			/* never cache partial hashes */
+			if (!(image->flags & EIFLAG_NOSHA256)) {
+				cachehash_put(image->stat.dev,
+				              image->stat.ino,
+				              &image->stat.mtime,
+				              &image->stat.ctime,
+				              &image->stat.btime,
+				              &image->hashes);
+				if (fpok)
+					cachefp_put(fp, image->stat.size,
+					            &image->hashes);
+			}
 #ifdef DEBUG_EXECIMAGE
 			fprintf(stderr, "DEBUG_EXECIMAGE: hashes from path=%s\n", image->path);
 #endif
@@ -372,12 +1104,34 @@ image_exec_acquire(image_exec_t *image, bool kern) {
 			fprintf(stderr, "DEBUG_EXECIMAGE: hashes from cache\n");
 #endif
 		image->flags |= EIFLAG_HASHES;
+		if (!(image->flags & EIFLAG_NOSHA256))
+			cacheseal_put(&image->stat, &image->hashes,
+			              !!(image->flags & EIFLAG_SHEBANG));
 	}
 #ifdef DEBUG_EXECIMAGE
 	else
 		fprintf(stderr, "DEBUG_EXECIMAGE: already have hashes\n");
 #endif
 
+	/* hash native slice while the descriptor is open, large ones later */
+	if (config->hash_slice && (image->flags & EIFLAG_HASHES) &&
+	    !(image->flags & EIFLAG_SLICE)) {
+		if (kern && config->bulk_threshold > 0 &&
+		    (size_t)image->stat.size > config->bulk_threshold)
+			return 0;
+		image_exec_slice(image);
+	}
+
+	/* signature presence in build output trees with unsigned binaries */
+	if (config->codesign && !image->codesign && image->fd != -1 &&
+	    !(image->flags & EIFLAG_SHEBANG)) {
+		len = cachebuild_root(&config->codesign_build_dirs,
+		                      image->path);
+		if (len > 0 && cachebuild_get(image->path, len) &&
+		    codesign_present(image->fd) == 0)
+			image->flags |= EIFLAG_UNSIGNED;
+	}
+
 	/* everything below operates on paths, not open file descriptors */
 	if (image->fd != -1) {
 		close(image->fd);
@@ -388,6 +1142,9 @@ image_exec_acquire(image_exec_t *image, bool kern) {
 	if (kern && config->kextlevel < KEXTLEVEL_CSIG) {
 		return 0;
 	}
+	if (kern && config->bulk_threshold > 0 &&
+	    (size_t)image->stat.size > config->bulk_threshold)
+		return 0;
 
 	/* skip code signing for scripts */
 	if (image->flags & EIFLAG_SHEBANG) {
@@ -401,8 +1158,13 @@ image_exec_acquire(image_exec_t *image, bool kern) {
 #endif
 	if (!image->codesign && (image->flags & EIFLAG_HASHES)) {
 		image->codesign = cachecsig_get(&image->hashes);
+		XNUMON_IMAGE_CODESIGN_CACHE(image->path, !!image->codesign);
+		if (profile_active())
+			profile_cache(PROFILE_CSIGCACHE, !!image->codesign);
 		if (!image->codesign) {
 			if (errno == ENOMEM) {
+				if (csjob)
+					cspool_abandon(csjob);
 				image->flags |= EIFLAG_ENOMEM;
 				image->flags |= EIFLAG_DONE;
 				return -1;
@@ -413,6 +1175,23 @@ image_exec_acquire(image_exec_t *image, bool kern) {
 			fprintf(stderr, "DEBUG_EXECIMAGE: codesign from cache\n");
 #endif
 	}
+	if (!image->codesign && (image->flags & EIFLAG_UNSIGNED)) {
+		image->codesign = codesign_alloc();
+		if (!image->codesign) {
+			if (csjob)
+				cspool_abandon(csjob);
+			image->flags |= EIFLAG_ENOMEM;
+			image->flags |= EIFLAG_DONE;
+			return -1;
+		}
+		image->codesign->result = CODESIGN_RESULT_UNSIGNED;
+		counter_inc(&buildunsigned);
+	}
+	/* same code cached under the hashes, e.g. a copy of a known binary */
+	if (csjob && image->codesign) {
+		cspool_abandon(csjob);
+		csjob = NULL;
+	}
 	if (!image->codesign && config->codesign) {
 		/* Postpone codesign verification of processes spawned as part
 		 * of codesign verification during KAuth handling. */
@@ -420,106 +1199,499 @@ image_exec_acquire(image_exec_t *image, bool kern) {
 		             !strcmp(image->path, "/usr/sbin/ocspd")))
 			return 0;
 
-		/* Check code signature (can be very slow!) */
-		image->codesign = codesign_new(image->path, -1);
-		if (!image->codesign) {
-			if (errno == ENOMEM)
-				image->flags |= EIFLAG_ENOMEM;
+		/* Verification reads the file, see fstypes_skip */
+		if (image->flags & EIFLAG_FSSKIP) {
+			if (csjob)
+				cspool_abandon(csjob);
 			image->flags |= EIFLAG_DONE;
-			return -1;
+			return 0;
 		}
 
-		/*
-		 * If 3rd stat does not match 1st, invalidate codesign.
-		 * If 3rd stat fails, return error but don't invalidate.
-		 * The codesign routines fail internally if the data is changed
-		 * during signature verification.
-		 */
-		rv = sys_pathattr(&st, image->path);
-		if (rv == -1) {
+		/* Shed codesign verification under pressure */
+		if (degrade_level() >= DEGRADE_CODESIGN) {
+			if (csjob)
+				cspool_abandon(csjob);
+			degrade_skipped_codesign();
 			image->flags |= EIFLAG_DONE;
-			return -1;
+			return 0;
 		}
-		if ((image->stat.size != st.size) ||
-		    (image->stat.dev != st.dev) ||
-		    (image->stat.ino != st.ino) ||
-		    (image->stat.mtime.tv_sec != st.mtime.tv_sec) ||
-		    (image->stat.mtime.tv_nsec != st.mtime.tv_nsec) ||
-		    (image->stat.ctime.tv_sec != st.ctime.tv_sec) ||
-		    (image->stat.ctime.tv_nsec != st.ctime.tv_nsec) ||
-		    (image->stat.btime.tv_sec != st.btime.tv_sec) ||
-		    (image->stat.btime.tv_nsec != st.btime.tv_nsec)) {
-			codesign_free(image->codesign);
-			image->codesign = NULL;
+
+		/* Check code signature (can be very slow!) */
+		XNUMON_IMAGE_CODESIGN_START(image->path);
+		SIGNPOST_BEGIN(SIGNPOST_PROCMON, "codesign", image);
+		t0 = profile_begin();
+		if (csjob)
+			rv = cspool_wait(csjob, &image->codesign,
+			                 &image->hashes);
+		else
+			rv = cspool_verify(&image->codesign, image->path,
+			                   &image->hashes, &image->stat);
+		if (t0)
+			profile_phase(PROFILE_CODESIGN, t0);
+		SIGNPOST_END(SIGNPOST_PROCMON, "codesign", image);
+		XNUMON_IMAGE_CODESIGN_DONE(image->path, rv);
+		if (rv == -1) {
+			if (!image->codesign && errno == ENOMEM)
+				image->flags |= EIFLAG_ENOMEM;
 			image->flags |= EIFLAG_DONE;
 			return -1;
 		}
-
-		cachecsig_put(&image->hashes, image->codesign);
+		if (!kern && !(image->flags & EIFLAG_NOSHA256) &&
+		    image_exec_pidcdhash(image, cdhash) == 0) {
+			cachecdhash_put(cdhash, image->stat.size,
+			                &image->hashes, image->codesign);
+			fleetcache_put(cdhash, image->stat.size,
+			               &image->hashes, image->codesign);
+		}
 #ifdef DEBUG_EXECIMAGE
 		fprintf(stderr, "DEBUG_EXECIMAGE: codesign from path=%s\n",
 		                image->path);
 #endif
 	}
 
+	/* learn build output trees that contain unsigned binaries */
+	if (image->codesign && !(image->flags & EIFLAG_UNSIGNED) &&
+	    image->codesign->result == CODESIGN_RESULT_UNSIGNED) {
+		len = cachebuild_root(&config->codesign_build_dirs,
+		                      image->path);
+		if (len > 0)
+			cachebuild_put(image->path, len);
+	}
+
 	image->flags |= EIFLAG_DONE;
 	return 0;
 }
 
-/*
- * Return true iff exec image matches either one of the idents in by_ident or
- * one of the paths in by_path.
- */
-bool
-image_exec_match_suppressions(image_exec_t *ie,
-                              setstr_t *by_ident, setstr_t *by_path) {
+static bool
+image_exec_match(image_exec_t *ie, setstr_t *by_ident, setstr_t *by_path) {
 	if (ie->codesign && codesign_is_good(ie->codesign)) {
 		if (setstr_contains3(by_ident, ie->codesign->ident,
 		                               ie->codesign->teamid))
 			return true;
 	}
 	if (ie->path) {
-		if (setstr_contains(by_path, ie->path))
+		if (setstr_contains_path(by_path, ie->path))
 			return true;
 	}
 	if (ie->script && ie->script->path) {
-		if (setstr_contains(by_path, ie->script->path))
+		if (setstr_contains_path(by_path, ie->script->path))
 			return true;
 	}
 	return false;
 }
 
 /*
- * Work function to be executed in the worker thread.
+ * Return true iff exec image matches either one of the idents in by_ident or
+ * one of the paths in by_path.  The suppression sets are identified by one of
+ * the SUPPRESS_* constants in set, and must always be the same for a given
+ * set.
  *
- * Returning 0 leads to the event being logged, -1 indicates that this event
- * should not be logged (may or may not be due to an error).
+ * Since the same image is matched against the same sets for every event it
+ * is the subject of, and is shared by all forked children, the verdict is
+ * cached in the image once codesign and script are final.  Cached verdicts
+ * are tagged with the suppression epoch, which is advanced whenever a
+ * configuration reload replaces the sets.  The epoch is loaded before the
+ * sets, such that a verdict is never tagged with an epoch younger than the
+ * sets it was based on.  Verdicts of past epochs are discarded.
  *
- * Partially thread-safe: only a single thread may call functions on a given
- * image_exec_t instance at a time.
+ * Thread-safe as long as no other thread is acquiring the image.
  */
-static int
-image_exec_work(image_exec_t *ei) {
-#ifdef DEBUG_REFS
-	fprintf(stderr, "DEBUG_REFS: image_exec_work(%p)\n", ei);
+bool
+image_exec_match_suppressions(image_exec_t *ie, int set,
+                              setstr_t *_Atomic *by_ident,
+                              setstr_t *_Atomic *by_path) {
+	unsigned int known, match, epoch, cached, update;
+	bool rv;
+
+	assert(set >= 0 && set < SUPPRESS_EPOCH_SHIFT / 2);
+	known = 1U << (set * 2);
+	match = known << 1;
+	epoch = atomic_load(&suppress_epoch) << SUPPRESS_EPOCH_SHIFT;
+	cached = atomic_load(&ie->suppress);
+	if ((cached & ~SUPPRESS_VERDICTS) == epoch && (cached & known))
+		return !!(cached & match);
+
+	rv = image_exec_match(ie, atomic_load(by_ident),
+	                      atomic_load(by_path));
+	if (!(ie->flags & EIFLAG_DONE) ||
+	    (ie->script && !(ie->script->flags & EIFLAG_DONE)))
+		return rv;
+	do {
+		update = known | (rv ? match : 0);
+		if ((cached & ~SUPPRESS_VERDICTS) == epoch)
+			update |= cached;
+		else
+			update |= epoch;
+	} while (!atomic_compare_exchange_weak(&ie->suppress, &cached,
+	                                       update));
+	return rv;
+}
+
+/*
+ * Returns true if a verdict cached by image_exec_match_suppressions for the
+ * current epoch says that the image is suppressed in set.  Never matches
+ * the sets itself, therefore false is inconclusive.  Thread-safe, also while
+ * another thread is acquiring the image.
+ */
+bool
+image_exec_suppressed(image_exec_t *ie, int set) {
+	unsigned int known, match, epoch, cached;
+
+	assert(set >= 0 && set < SUPPRESS_EPOCH_SHIFT / 2);
+	known = 1U << (set * 2);
+	match = known << 1;
+	epoch = atomic_load(&suppress_epoch) << SUPPRESS_EPOCH_SHIFT;
+	cached = atomic_load(&ie->suppress);
+	return (cached & ~SUPPRESS_VERDICTS) == epoch && (cached & match);
+}
+
+/*
+ * Called after the suppression sets have been replaced, invalidating all
+ * verdicts cached in images.  Main thread only.
+ */
+void
+image_exec_suppressions_changed(void) {
+	atomic_fetch_add(&suppress_epoch, 1);
+}
+
+/*
+ * Look up the hashes and code signature of image in the caches.  Returns
+ * true if acquiring image needs nothing beyond cache lookups.
+ *
+ * Partially thread-safe: only a single thread may call functions on a given
+ * image_exec_t instance at a time.
+ */
+static bool
+image_exec_cached(image_exec_t *image) {
+	if (image->flags & EIFLAG_DONE)
+		return true;
+	/* acquisition will give up right away */
+	if ((!(image->flags & EIFLAG_STAT) || image->fd == -1) &&
+	    !(image->flags & EIFLAG_HASHES))
+		return true;
+	if (!(image->flags & EIFLAG_HASHES)) {
+		if (!cachehash_get(&image->hashes,
+		                   image->stat.dev,
+		                   image->stat.ino,
+		                   &image->stat.mtime,
+		                   &image->stat.ctime,
+		                   &image->stat.btime))
+			return !!(image->flags & EIFLAG_FSSKIP);
+		image->flags |= EIFLAG_HASHES;
+	}
+	if ((image->flags & EIFLAG_SHEBANG) || !config->codesign ||
+	    image->codesign)
+		return true;
+	image->codesign = cachecsig_get(&image->hashes);
+	return !!image->codesign;
+}
+
+static void *
+image_exec_acquire_thread(void *arg) {
+	image_exec_t *script = arg;
+
+	image_exec_acquire(script, false);
+	image_exec_close(script);
+	return NULL;
+}
+
+/*
+ * Acquire image and its script, if any.  Script and interpreter are
+ * independent files, so if neither can be served from the caches, the
+ * script is acquired on a short-lived helper thread while the calling
+ * thread acquires the interpreter, so that hashing the script overlaps
+ * with hashing and code signature evaluation of the interpreter.  Falls
+ * back to acquiring both in series if no thread can be started.
+ *
+ * Partially thread-safe: only a single thread may call functions on a given
+ * image_exec_t instance at a time.
+ */
+static void
+image_exec_acquire_all(image_exec_t *image) {
+	pthread_t thr;
+	bool par;
+
+	par = image->script &&
+	      !image_exec_cached(image) && !image_exec_cached(image->script) &&
+	      pthread_create(&thr, NULL, image_exec_acquire_thread,
+	                     image->script) == 0;
+	image_exec_acquire(image, false);
+	image_exec_close(image);
+	if (par) {
+		pthread_join(thr, NULL);
+		counter_inc(&scriptpar);
+	} else if (image->script) {
+		image_exec_acquire(image->script, false);
+		image_exec_close(image->script);
+	}
+}
+
+/*
+ * Create the private copy of image to be acquired by an enrichment thread.
+ * The file descriptor is left to the caller to hand over.
+ */
+static image_exec_t *
+image_exec_enrich_copy(image_exec_t *image) {
+	image_exec_t *copy;
+	char *path;
+
+	path = strdup(image->path);
+	if (!path) {
+		counter_inc(&ooms);
+		return NULL;
+	}
+	copy = image_exec_new(path);
+	if (!copy)
+		return NULL;
+	if (image->codesign)
+		copy->codesign = codesign_ref(image->codesign);
+	copy->hdr.code = LOGEVT_IMAGE_ENRICH;
+	copy->hdr.le_work = NULL;
+	copy->hdr.affinity = NULL;
+	copy->flags = (image->flags & (EIFLAG_STAT|EIFLAG_ATTR|EIFLAG_HASHES|
+	                               EIFLAG_SHEBANG|EIFLAG_KEXTHASH|
+	                               EIFLAG_FSBULK|EIFLAG_FSSKIP)) |
+	              EIFLAG_ENRICH;
+	copy->id = image->id;
+	copy->pid = image->pid;
+	copy->stat = image->stat;
+	copy->hashes = image->hashes;
+	return copy;
+}
+
+/*
+ * Hand the acquisition of image and its script over to the enrichment
+ * threads unless it can be served from the caches.  Returns true if it was
+ * handed over, in which case image is final as it is.
+ *
+ * Partially thread-safe: only a single thread may call functions on a given
+ * image_exec_t instance at a time.
+ */
+static bool
+image_exec_enrich(image_exec_t *image) {
+	image_exec_t *copy;
+
+	if (enrichthrs == 0)
+		return false;
+	if (image_exec_cached(image) &&
+	    (!image->script || image_exec_cached(image->script)))
+		return false;
+
+	copy = image_exec_enrich_copy(image);
+	if (!copy)
+		return false;
+	if (image->script) {
+		copy->script = image_exec_enrich_copy(image->script);
+		if (!copy->script) {
+			image_exec_free(copy);
+			return false;
+		}
+		copy->script->fd = image->script->fd;
+		copy->script->hctx = image->script->hctx;
+		image->script->fd = -1;
+		image->script->hctx = NULL;
+	}
+	copy->fd = image->fd;
+	copy->hctx = image->hctx;
+	image->fd = -1;
+	image->hctx = NULL;
+	if (queue_enqueue(&enrichq, copy) == -1) {
+		image->fd = copy->fd;
+		image->hctx = copy->hctx;
+		copy->fd = -1;
+		copy->hctx = NULL;
+		if (image->script) {
+			image->script->fd = copy->script->fd;
+			image->script->hctx = copy->script->hctx;
+			copy->script->fd = -1;
+			copy->script->hctx = NULL;
+		}
+		image_exec_free(copy);
+		return false;
+	}
+
+	image->flags |= EIFLAG_ENRICH|EIFLAG_DONE;
+	if (image->script)
+		image->script->flags |= EIFLAG_ENRICH|EIFLAG_DONE;
+	return true;
+}
+
+/*
+ * Called by the enrichment queue when full; the caller of queue_enqueue
+ * keeps ownership and acquires the image itself.
+ */
+static void
+image_exec_enrich_full(UNUSED void *data) {
+}
+
+static void
+image_exec_enrich_work(image_exec_t *copy) {
+	image_exec_acquire_all(copy);
+	if (copy->flags & EIFLAG_ENOMEM) {
+		counter_inc(&ooms);
+		image_exec_free(copy);
+		return;
+	}
+	/* the first phase was logged before the ident was known */
+	if (image_exec_match(copy, atomic_load(suppress_image_exec_by_ident),
+	                     atomic_load(suppress_image_exec_by_path)) ||
+	    timespec_nanotime(&copy->hdr.tv) == -1) {
+		image_exec_free(copy);
+		return;
+	}
+	counter_inc(&enriched);
+	log_submit(copy);
+}
+
+static void *
+enrich_thread(UNUSED void *arg) {
+	void *copy;
+
+	(void)policy_thread_diskio_standard();
+	(void)policy_thread_qos(THRSTAT_WORK);
+	thrstat_register(THRSTAT_WORK);
+
+	while ((copy = queue_dequeue(&enrichq)) != enrich_stop)
+		image_exec_enrich_work(copy);
+	return NULL;
+}
+
+static int
+enrich_init(config_t *cfg) {
+	enrichthrs = 0;
+	counter_reset(&enriched);
+	counter_reset(&scriptpar);
+	if (cfg->enrich_threads == 0 ||
+	    !LOGEVT_WANT(cfg->events, LOGEVT_FLAG(LOGEVT_IMAGE_ENRICH)))
+		return 0;
+
+	if (queue_init(&enrichq, cfg->queue_capacity, QUEUE_DROP_NEWEST,
+	               image_exec_enrich_full) == -1)
+		return -1;
+	for (; enrichthrs < cfg->enrich_threads; enrichthrs++) {
+		if (pthread_create(&enrichthr[enrichthrs], NULL,
+		                   enrich_thread, NULL) != 0)
+			break;
+	}
+	if (enrichthrs == 0) {
+		queue_destroy(&enrichq);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Must be called after the work stage is shut down and before the log
+ * stage is.
+ */
+static void
+enrich_fini(void) {
+	if (enrichthrs == 0)
+		return;
+
+	for (size_t i = 0; i < enrichthrs; i++)
+		queue_enqueue_wait(&enrichq, enrich_stop);
+	for (size_t i = 0; i < enrichthrs; i++) {
+		if (pthread_join(enrichthr[i], NULL) != 0) {
+			fprintf(stderr, "Failed to join enrich thread - "
+			                "exiting\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	enrichthrs = 0;
+	queue_destroy(&enrichq);
+}
+
+/*
+ * Mark the acquisition of image as complete for repeated execs to copy.
+ * Orders all writes to stat, hashes, codesign and flags before the flag is
+ * observed by the main thread; none of them are written afterwards.
+ */
+static void
+image_exec_publish(image_exec_t *image) {
+	if (image->script ||
+	    (image->flags & (EIFLAG_STAT|EIFLAG_HASHES|EIFLAG_DONE|
+	                     EIFLAG_SHEBANG|EIFLAG_PIDLOOKUP|EIFLAG_ENOMEM|
+	                     EIFLAG_NOSHA256|EIFLAG_ENRICH)) !=
+	    (EIFLAG_STAT|EIFLAG_HASHES|EIFLAG_DONE))
+		return;
+	if (config->codesign &&
+	    (!image->codesign ||
+	     image->codesign->result == CODESIGN_RESULT_ERROR))
+		return;
+	atomic_store_explicit(&image->acquired, true, memory_order_release);
+}
+
+/*
+ * Returns true if image or its script is suppressed by path and, with
+ * suppress_image_exec_lean, need not be acquired, because the suppression
+ * does not depend on hashes or code signature.  Thread-safe.
+ */
+static bool
+image_exec_lean(image_exec_t *image) {
+	setstr_t *by_path;
+
+	if (!config->suppress_image_exec_lean)
+		return false;
+	by_path = atomic_load(suppress_image_exec_by_path);
+	return (image->path && setstr_contains_path(by_path, image->path)) ||
+	       (image->script && image->script->path &&
+	        setstr_contains_path(by_path, image->script->path));
+}
+
+/*
+ * Finish image and its script as they are, without hashes or code
+ * signature.
+ *
+ * Partially thread-safe: only a single thread may call functions on a given
+ * image_exec_t instance at a time.
+ */
+static void
+image_exec_skip(image_exec_t *image) {
+	image_exec_close(image);
+	image->flags |= EIFLAG_DONE;
+	if (image->script) {
+		image_exec_close(image->script);
+		image->script->flags |= EIFLAG_DONE;
+	}
+	counter_inc(&leanskip);
+}
+
+/*
+ * Work function to be executed in the worker thread.
+ *
+ * Returning 0 leads to the event being logged, -1 indicates that this event
+ * should not be logged (may or may not be due to an error).
+ *
+ * Partially thread-safe: only a single thread may call functions on a given
+ * image_exec_t instance at a time.
+ */
+static int
+image_exec_work(image_exec_t *ei) {
+#ifdef DEBUG_REFS
+	fprintf(stderr, "DEBUG_REFS: image_exec_work(%p)\n", ei);
 #endif
-	image_exec_acquire(ei, false);
-	image_exec_close(ei);
-	if (ei->script) {
-		image_exec_acquire(ei->script, false);
-		image_exec_close(ei->script);
-	}
-	if (config->ancestors < SIZE_MAX)
-		image_exec_prune_ancestors(ei, false);
+	if (image_exec_lean(ei))
+		image_exec_skip(ei);
+	else if (!image_exec_enrich(ei))
+		image_exec_acquire_all(ei);
+	image_exec_publish(ei);
+	if (membudget_level() >= MEMBUDGET_ANCESTORS)
+		image_exec_prune_ancestors(ei, min(config->ancestors,
+		                                   config->degrade_ancestors));
+	else if (config->ancestors < SIZE_MAX)
+		image_exec_prune_ancestors(ei, config->ancestors);
 	if (ei->flags & EIFLAG_ENOMEM) {
-		atomic64_inc(&ooms);
+		counter_inc(&ooms);
 		return -1;
 	}
-	if (ei->flags & EIFLAG_NOLOG)
-		return -1;
-	if (image_exec_match_suppressions(ei, suppress_image_exec_by_ident,
-	                                      suppress_image_exec_by_path))
+	if ((ei->flags & EIFLAG_NOLOG) ||
+	    image_exec_match_suppressions(ei, SUPPRESS_IMAGE_EXEC,
+	                                  suppress_image_exec_by_ident,
+	                                  suppress_image_exec_by_path)) {
+		ei->hdr.suppressed = true;
 		return -1;
+	}
 	return 0;
 }
 
@@ -533,18 +1705,18 @@ image_exec_from_pid(pid_t pid) {
 	int nopath = 0;
 	int rv;
 
-	path = sys_pidpath(pid);
+	path = pidcache_path(pid);
 #ifdef DEBUG_PROCMON
 	DEBUG(config->debug, "image_exec_from_pid",
 	      "pid=%i path=%s", pid, path);
 #endif
 	if (!path) {
 		if (errno == ENOMEM) {
-			atomic64_inc(&ooms);
+			counter_inc(&ooms);
 			return NULL;
 		}
 		if (asprintf(&path, "<%i>", pid) == -1) {
-			atomic64_inc(&ooms);
+			counter_inc(&ooms);
 			free(path);
 			return NULL;
 		}
@@ -565,6 +1737,698 @@ image_exec_from_pid(pid_t pid) {
 	return ei;
 }
 
+/*
+ * Lineage snapshots.  With a cache directory configured, the main thread
+ * writes the processes in proctab along with the lineages of their images
+ * to a snapshot file every cache save interval, and a last time at shutdown
+ * once the work stage has drained.  At the next start, preloading restores
+ * the processes that are still running with the same pid, fork time and
+ * executable path from the snapshot, including argv, exec subject, hashes,
+ * code signature and the ancestors that are gone by now, instead of
+ * building pid lookup images without any history and acquiring them anew.
+ * Processes that exec'd since, or that did not exist at the time of the
+ * snapshot, are preloaded from runtime lookups as usual.
+ *
+ * Images are written once per snapshot, oldest first, such that records
+ * only refer to earlier ones and shared lineages are restored shared.  Stat
+ * and hashes are only saved for images whose acquisition was published as
+ * complete by the workers, see image_exec_publish(), and code signatures
+ * are served from the codesign cache on restore; other images are saved
+ * with their exec data only and are not restored for live processes.
+ * While the workers are running, the walk along each lineage stops at the
+ * ancestors that no worker can prune concurrently, see
+ * image_exec_prune_ancestors().  Environments are never saved.
+ */
+
+#define SNAPSHOT_MAGIC          "xnprocs\0"
+#define SNAPSHOT_IMAGE          1
+#define SNAPSHOT_PROC           2
+#define SNAPSHOT_EIFLAGS        (EIFLAG_PIDLOOKUP|EIFLAG_NOPATH|EIFLAG_STAT| \
+                                 EIFLAG_ATTR|EIFLAG_HASHES|EIFLAG_SHEBANG| \
+                                 EIFLAG_DONE|EIFLAG_NOSHA256|EIFLAG_KEXTHASH| \
+                                 EIFLAG_NOLOG_KIDS)
+
+typedef struct {
+	pid_t pid;
+	struct timespec fork_tv;
+	image_exec_t *image;
+} snapproc_t;
+
+typedef struct {
+	cachefile_t cf;
+	size_t levels;                  /* ancestors safe to walk */
+	uint32_t records;
+	image_exec_t **chain;
+	size_t chainsz;
+	int error;
+} snapsave_t;
+
+static uint64_t snapepoch;              /* main thread only */
+static image_exec_t **snapimgv = NULL;  /* refs owned by the snapshot */
+static bool *snapsubmitted = NULL;
+static uint32_t snapimgc = 0;
+static snapproc_t *snapprocv = NULL;
+static size_t snapprocc = 0;
+static uint64_t snaprestored;           /* main thread only */
+
+/*
+ * Snapshot records are variable-length:  a type byte, followed for images
+ * by the record number of the previous image or zero, pid, fork time, exec
+ * time, flags, subject and, if EIFLAG_DONE is set, stat and hashes, then
+ * path, cwd, argv and script path, each as a 32 bit length plus one, or
+ * zero for NULL, followed by the bytes; argv as terminated strings back to
+ * back.  Process records carry pid, fork time and the record number of the
+ * image.
+ */
+
+static void
+snapshot_save_blob(cachefile_t *cf, const void *buf, size_t sz) {
+	uint32_t len;
+
+	if (!buf || sz >= UINT32_MAX) {
+		len = 0;
+		cachefile_write(cf, &len, sizeof(len));
+		return;
+	}
+	len = (uint32_t)sz + 1;
+	cachefile_write(cf, &len, sizeof(len));
+	if (sz > 0)
+		cachefile_write(cf, buf, sz);
+}
+
+static void
+snapshot_save_str(cachefile_t *cf, const char *s) {
+	snapshot_save_blob(cf, s, s ? strlen(s) : 0);
+}
+
+static void
+snapshot_save_strv(cachefile_t *cf, char **v) {
+	uint32_t len;
+	size_t sz = 0;
+
+	if (v) {
+		for (size_t i = 0; v[i]; i++)
+			sz += strlen(v[i]) + 1;
+	}
+	if (!v || sz == 0 || sz >= UINT32_MAX) {
+		snapshot_save_blob(cf, NULL, 0);
+		return;
+	}
+	len = (uint32_t)sz + 1;
+	cachefile_write(cf, &len, sizeof(len));
+	for (size_t i = 0; v[i]; i++)
+		cachefile_write(cf, v[i], strlen(v[i]) + 1);
+}
+
+static void
+snapshot_save_image(snapsave_t *ss, image_exec_t *image, uint32_t prev) {
+	uint8_t type = SNAPSHOT_IMAGE;
+	uint32_t flags = 0;
+	int32_t pid = image->pid;
+
+	/* pairs with the release in image_exec_publish */
+	if (atomic_load_explicit(&image->acquired, memory_order_acquire))
+		flags = (uint32_t)(image->flags & SNAPSHOT_EIFLAGS);
+	cachefile_write(&ss->cf, &type, sizeof(type));
+	cachefile_write(&ss->cf, &prev, sizeof(prev));
+	cachefile_write(&ss->cf, &pid, sizeof(pid));
+	cachefile_write(&ss->cf, &image->fork_tv, sizeof(struct timespec));
+	cachefile_write(&ss->cf, &image->hdr.tv, sizeof(struct timespec));
+	cachefile_write(&ss->cf, &flags, sizeof(flags));
+	cachefile_write(&ss->cf, &image->subject, sizeof(audit_proc_t));
+	if (flags & EIFLAG_DONE) {
+		cachefile_write(&ss->cf, &image->stat, sizeof(stat_attr_t));
+		cachefile_write(&ss->cf, &image->hashes, sizeof(hashes_t));
+	}
+	snapshot_save_str(&ss->cf, image->path);
+	snapshot_save_str(&ss->cf, image->cwd);
+	snapshot_save_strv(&ss->cf, image->argv);
+	snapshot_save_str(&ss->cf, image->script ? image->script->path : NULL);
+	cachefile_record(&ss->cf);
+	image->snapepoch = snapepoch;
+	image->snapidx = ++ss->records;
+}
+
+static void
+snapshot_save_proc(proc_t *proc, void *arg) {
+	snapsave_t *ss = arg;
+	image_exec_t *ie, **chain;
+	uint8_t type = SNAPSHOT_PROC;
+	uint32_t prev = 0;
+	int32_t pid = proc->pid;
+	size_t n = 0;
+
+	if (ss->error || !proc->image_exec)
+		return;
+	for (ie = proc->image_exec; ie; ie = ie->prev) {
+		if (ie->snapepoch == snapepoch) {
+			prev = ie->snapidx;
+			break;
+		}
+		if (n == ss->chainsz) {
+			chain = realloc(ss->chain, (ss->chainsz + 16) *
+			                           sizeof(image_exec_t *));
+			if (!chain) {
+				ss->error = ENOMEM;
+				return;
+			}
+			ss->chain = chain;
+			ss->chainsz += 16;
+		}
+		ss->chain[n++] = ie;
+		if (n > ss->levels)
+			break;
+	}
+	while (n > 0) {
+		snapshot_save_image(ss, ss->chain[--n], prev);
+		prev = ss->chain[n]->snapidx;
+	}
+	cachefile_write(&ss->cf, &type, sizeof(type));
+	cachefile_write(&ss->cf, &pid, sizeof(pid));
+	cachefile_write(&ss->cf, &proc->fork_tv, sizeof(struct timespec));
+	cachefile_write(&ss->cf, &proc->image_exec->snapidx, sizeof(uint32_t));
+	cachefile_record(&ss->cf);
+	ss->records++;
+}
+
+/*
+ * Write the lineage snapshot to `path'.  Drained indicates that the work
+ * stage has been shut down, in which case lineages are saved in full.
+ *
+ * Main thread only.  Returns 0 on success and -1 with errno set on errors.
+ */
+int
+procmon_snapshot_save(const char *path, bool drained) {
+	snapsave_t ss;
+
+	bzero(&ss, sizeof(ss));
+	ss.levels = drained ? SIZE_MAX : image_exec_kept_levels();
+	if (cachefile_save_begin(&ss.cf, path, SNAPSHOT_MAGIC,
+	                         config->hflags, 0) == -1)
+		return -1;
+	snapepoch++;
+	proctab_foreach(snapshot_save_proc, &ss);
+	if (ss.chain)
+		free(ss.chain);
+	if (ss.error) {
+		/* discard the partial file */
+		fclose(ss.cf.f);
+		unlink(ss.cf.tmppath);
+		errno = ss.error;
+		return -1;
+	}
+	return cachefile_save_end(&ss.cf);
+}
+
+static int
+snapshot_load_blob(const unsigned char **dst, size_t *sz,
+                   const unsigned char **p, const unsigned char *end) {
+	uint32_t len;
+
+	*dst = NULL;
+	*sz = 0;
+	if (cachefile_read(&len, sizeof(len), p, end) == -1)
+		return -1;
+	if (len == 0)
+		return 0;
+	len--;
+	if ((size_t)(end - *p) < len) {
+		errno = EINVAL;
+		return -1;
+	}
+	*dst = *p;
+	*sz = len;
+	*p += len;
+	return 0;
+}
+
+/*
+ * Strings must not contain zeroes; returns a malloc'd copy in *dst, or NULL
+ * if the string was saved as NULL.
+ */
+static int
+snapshot_load_str(char **dst,
+                  const unsigned char **p, const unsigned char *end) {
+	const unsigned char *s;
+	size_t sz;
+
+	*dst = NULL;
+	if (snapshot_load_blob(&s, &sz, p, end) == -1)
+		return -1;
+	if (!s)
+		return 0;
+	if (memchr(s, '\0', sz)) {
+		errno = EINVAL;
+		return -1;
+	}
+	*dst = strndup((const char *)s, sz);
+	return *dst ? 0 : -1;
+}
+
+/*
+ * Builds an argv vector in the layout of aev_new().
+ */
+static int
+snapshot_load_strv(char ***dst,
+                   const unsigned char **p, const unsigned char *end) {
+	const unsigned char *s;
+	size_t sz, n = 0;
+	char **v, *dp;
+
+	*dst = NULL;
+	if (snapshot_load_blob(&s, &sz, p, end) == -1)
+		return -1;
+	if (!s)
+		return 0;
+	if (sz == 0 || s[sz - 1] != '\0') {
+		errno = EINVAL;
+		return -1;
+	}
+	for (size_t i = 0; i < sz; i++) {
+		if (s[i] == '\0')
+			n++;
+	}
+	v = malloc(sizeof(char *) * (n + 1) + sz);
+	if (!v)
+		return -1;
+	dp = (char *)&v[n + 1];
+	memcpy(dp, s, sz);
+	for (size_t i = 0; i < n; i++) {
+		v[i] = dp;
+		dp += strlen(dp) + 1;
+	}
+	v[n] = NULL;
+	*dst = v;
+	return 0;
+}
+
+static image_exec_t *
+snapshot_load_image(const unsigned char **p, const unsigned char *end) {
+	image_exec_t *image;
+	struct timespec fork_tv, tv;
+	audit_proc_t subject;
+	uint32_t prev, flags;
+	int32_t pid;
+	char *path, *cwd, *script;
+
+	if (cachefile_read(&prev, sizeof(prev), p, end) == -1 ||
+	    cachefile_read(&pid, sizeof(pid), p, end) == -1 ||
+	    cachefile_read(&fork_tv, sizeof(fork_tv), p, end) == -1 ||
+	    cachefile_read(&tv, sizeof(tv), p, end) == -1 ||
+	    cachefile_read(&flags, sizeof(flags), p, end) == -1 ||
+	    cachefile_read(&subject, sizeof(subject), p, end) == -1)
+		return NULL;
+	if (prev > snapimgc || (flags & ~SNAPSHOT_EIFLAGS)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (snapshot_load_str(&path, p, end) == -1)
+		return NULL;
+	if (!path) {
+		errno = EINVAL;
+		return NULL;
+	}
+	image = image_exec_new(path);
+	if (!image)
+		return NULL;
+	image->pid = pid;
+	image->fork_tv = fork_tv;
+	image->hdr.tv = tv;
+	image->flags = flags;
+	image->subject = subject;
+	if (flags & EIFLAG_DONE) {
+		if (cachefile_read(&image->stat, sizeof(stat_attr_t),
+		                   p, end) == -1 ||
+		    cachefile_read(&image->hashes, sizeof(hashes_t),
+		                   p, end) == -1)
+			goto errout;
+		if (config->codesign)
+			image->codesign = cachecsig_get(&image->hashes);
+		if (!config->codesign || image->codesign)
+			atomic_store(&image->acquired, true);
+	}
+	if (snapshot_load_str(&cwd, p, end) == -1)
+		goto errout;
+	if (cwd) {
+		image->cwd = intern_take(cwd);
+		if (!image->cwd)
+			goto errout;
+	}
+	if (snapshot_load_strv(&image->argv, p, end) == -1)
+		goto errout;
+	image->vecsz = aev_size(image->argv);
+	counter_add(&vecbytes, image->vecsz);
+	atomic_store(&image->logged, true);
+	if (snapshot_load_str(&script, p, end) == -1)
+		goto errout;
+	if (script) {
+		image->script = image_exec_new(script);
+		if (!image->script)
+			goto errout;
+	}
+	if (prev) {
+		image_exec_ref(snapimgv[prev - 1]);
+		image_exec_link(image, snapimgv[prev - 1]);
+	}
+	return image;
+errout:
+	image_exec_free(image);
+	return NULL;
+}
+
+static int
+snapproc_cmp(const void *a, const void *b) {
+	pid_t pa = ((const snapproc_t *)a)->pid;
+	pid_t pb = ((const snapproc_t *)b)->pid;
+
+	return (pa > pb) - (pa < pb);
+}
+
+/*
+ * Release the restored images that were not taken by any process.
+ */
+static void
+snapshot_release(void) {
+	if (snapimgv) {
+		for (uint32_t i = 0; i < snapimgc; i++)
+			image_exec_free(snapimgv[i]);
+		free(snapimgv);
+		snapimgv = NULL;
+	}
+	if (snapsubmitted) {
+		free(snapsubmitted);
+		snapsubmitted = NULL;
+	}
+	snapimgc = 0;
+	if (snapprocv) {
+		free(snapprocv);
+		snapprocv = NULL;
+	}
+	snapprocc = 0;
+}
+
+static int
+snapshot_load(const unsigned char *p, size_t sz, uint64_t count,
+              UNUSED void *arg) {
+	const unsigned char *end = p + sz;
+	image_exec_t *image;
+	snapproc_t *sp;
+	uint32_t idx;
+	uint8_t type;
+	int32_t pid;
+
+	if (count > UINT32_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	snapimgv = malloc(count * sizeof(image_exec_t *));
+	snapsubmitted = calloc(count, sizeof(bool));
+	snapprocv = malloc(count * sizeof(snapproc_t));
+	if (!snapimgv || !snapsubmitted || !snapprocv)
+		goto errout;
+	for (uint64_t i = 0; i < count; i++) {
+		if (cachefile_read(&type, sizeof(type), &p, end) == -1)
+			goto errout;
+		switch (type) {
+		case SNAPSHOT_IMAGE:
+			image = snapshot_load_image(&p, end);
+			if (!image)
+				goto errout;
+			image->snapidx = ++snapimgc;
+			snapimgv[snapimgc - 1] = image;
+			break;
+		case SNAPSHOT_PROC:
+			sp = &snapprocv[snapprocc];
+			if (cachefile_read(&pid, sizeof(pid), &p, end) == -1 ||
+			    cachefile_read(&sp->fork_tv, sizeof(sp->fork_tv),
+			                   &p, end) == -1 ||
+			    cachefile_read(&idx, sizeof(idx), &p, end) == -1)
+				goto errout;
+			if (idx == 0 || idx > snapimgc) {
+				errno = EINVAL;
+				goto errout;
+			}
+			sp->pid = pid;
+			sp->image = snapimgv[idx - 1];
+			snapprocc++;
+			break;
+		default:
+			errno = EINVAL;
+			goto errout;
+		}
+	}
+	qsort(snapprocv, snapprocc, sizeof(snapproc_t), snapproc_cmp);
+	return 0;
+errout:
+	snapshot_release();
+	return -1;
+}
+
+/*
+ * Load the lineage snapshot from `path' for restoring processes by the
+ * next call to procmon_preload.  Records are numbered from 1 in both the
+ * file and snapidx of the restored images, snapepoch stays 0.
+ *
+ * Main thread only.  Returns 0 on success and -1 with errno set on errors.
+ */
+int
+procmon_snapshot_load(const char *path) {
+	snapshot_release();
+	return cachefile_load(path, SNAPSHOT_MAGIC, config->hflags, 0,
+	                      snapshot_load, NULL);
+}
+
+/*
+ * Returns a new reference to the restored image of pid if the snapshot has
+ * a complete one for the same process and executable, or NULL.  Thread-safe
+ * as long as the snapshot is not being loaded or released.
+ */
+static image_exec_t *
+snapshot_take(pid_t pid, struct timespec *fork_tv, const char *path) {
+	snapproc_t key, *sp;
+
+	if (!snapprocv)
+		return NULL;
+	key.pid = pid;
+	sp = bsearch(&key, snapprocv, snapprocc, sizeof(snapproc_t),
+	             snapproc_cmp);
+	if (!sp || sp->fork_tv.tv_sec != fork_tv->tv_sec ||
+	    sp->fork_tv.tv_nsec != fork_tv->tv_nsec)
+		return NULL;
+	if (!atomic_load(&sp->image->acquired) ||
+	    strcmp(sp->image->path, path))
+		return NULL;
+	image_exec_ref(sp->image);
+	return sp->image;
+}
+
+/*
+ * Returns true the first time it is called for a restored image, for
+ * submitting each restored image to the work stage at most once even if
+ * shared by several processes.  Main thread only.
+ */
+static bool
+snapshot_submit(image_exec_t *image) {
+	assert(image->snapidx > 0 && image->snapidx <= snapimgc);
+	if (snapsubmitted[image->snapidx - 1])
+		return false;
+	snapsubmitted[image->snapidx - 1] = true;
+	return true;
+}
+
+/*
+ * At startup, the runtime lookups for all processes which executed before
+ * xnumon are done in parallel by PRELOAD_THREADS threads into preloadv,
+ * sorted by pid.  The proctab entries are then created on the main thread
+ * from the preloaded info in procmon_proc_from_pid, which takes each entry
+ * at most once.  Hashing and codesigning of the images happen later in the
+ * work stage as usual, unless the image was restored from the snapshot.
+ *
+ * With preload_rate, the images are not submitted to the work stage right
+ * away but held in the startup lane, from which procmon_preload_drain
+ * submits them at most preload_rate per second into whatever capacity the
+ * live events leave over.  An image referenced by a live event or an exec
+ * is taken out of the lane and submitted right away, such that its work
+ * item precedes the ones referencing it, as it would without the lane.
+ */
+
+#define PRELOAD_THREADS 8
+
+typedef struct {
+	pid_t pid;
+	int error;                      /* errno if acquisition failed */
+	bool taken;
+	bool restored;                  /* image_exec from snapshot */
+	pid_t ppid;
+	struct timespec fork_tv;
+	char *cwd;                      /* malloc */
+	image_exec_t *image_exec;       /* opened */
+} preload_t;
+
+static preload_t *preloadv = NULL;
+static size_t preloadc = 0;
+static atomic_size_t preloadnext;
+static bool preloading;                 /* within procmon_preload */
+static tommy_list preloadq;             /* startup lane, main thread only */
+static uint32_t preloadqsize;
+static uint64_t preloaded;              /* submitted from the startup lane */
+
+/*
+ * Submit image for acquisition and logging, holding it in the startup lane
+ * while preloading.  Main thread only.
+ */
+static void
+preload_submit(image_exec_t *image) {
+	image->hdr.bulk = image_exec_is_bulk(image);
+	if (preloading && config->preload_rate > 0) {
+		tommy_list_insert_tail(&preloadq, &image->hdr.node, image);
+		image->held = true;
+		preloadqsize++;
+		return;
+	}
+	work_submit(image);
+}
+
+/*
+ * Take image out of the startup lane and submit it now if it is held there.
+ * Main thread only.
+ */
+static void
+preload_promote(image_exec_t *image) {
+	if (!image->held)
+		return;
+	tommy_list_remove_existing(&preloadq, &image->hdr.node);
+	image->held = false;
+	preloadqsize--;
+	preloaded++;
+	work_submit(image);
+}
+
+/*
+ * Submit up to n images held in the startup lane to the work stage.
+ * Returns the number of images still held.  Main thread only.
+ */
+size_t
+procmon_preload_drain(size_t n) {
+	image_exec_t *image;
+
+	for (; n > 0 && !tommy_list_empty(&preloadq); n--) {
+		image = tommy_list_head(&preloadq)->data;
+		preload_promote(image);
+	}
+	return preloadqsize;
+}
+
+static int
+preload_cmp(const void *a, const void *b) {
+	pid_t pa = ((const preload_t *)a)->pid;
+	pid_t pb = ((const preload_t *)b)->pid;
+
+	return (pa > pb) - (pa < pb);
+}
+
+static void *
+preload_thread(UNUSED void *arg) {
+	image_exec_t *image;
+	preload_t *pl;
+	size_t i;
+
+	while ((i = atomic_fetch_add(&preloadnext, 1)) < preloadc) {
+		pl = &preloadv[i];
+		if (sys_pidbsdinfo(&pl->fork_tv, &pl->ppid, pl->pid) == -1) {
+			pl->error = ESRCH;
+			continue;
+		}
+		pl->cwd = sys_pidcwd(pl->pid);
+		if (!pl->cwd) {
+			pl->error = (errno == ENOMEM) ? ENOMEM : ESRCH;
+			if (pl->error == ENOMEM)
+				counter_inc(&ooms);
+			continue;
+		}
+		pl->image_exec = image_exec_from_pid(pl->pid);
+		if (!pl->image_exec) {
+			pl->error = (errno == ENOMEM) ? ENOMEM : ESRCH;
+			free(pl->cwd);
+			pl->cwd = NULL;
+			continue;
+		}
+		image = snapshot_take(pl->pid, &pl->fork_tv,
+		                      pl->image_exec->path);
+		if (image) {
+			image_exec_free(pl->image_exec);
+			pl->image_exec = image;
+			pl->restored = true;
+			continue;
+		}
+		image_exec_open(pl->image_exec, NULL, false);
+	}
+	return NULL;
+}
+
+/*
+ * Returns the preloaded info for pid if there is any that was not taken yet.
+ */
+static preload_t *
+preload_take(pid_t pid) {
+	preload_t key, *pl;
+
+	if (!preloadv)
+		return NULL;
+	key.pid = pid;
+	pl = bsearch(&key, preloadv, preloadc, sizeof(preload_t), preload_cmp);
+	if (!pl || pl->taken)
+		return NULL;
+	pl->taken = true;
+	return pl;
+}
+
+static void
+pidmap_build(pid_t *pidv, size_t pidc, struct timespec *tv) {
+	bzero(pidmap, sizeof(pidmap));
+	for (size_t i = 0; i < pidc; i++) {
+		if (pidv[i] >= 0 && pidv[i] < PIDMAP_PIDS)
+			pidmap[pidv[i] / 64] |= 1ULL << (pidv[i] % 64);
+	}
+	pidmaptv = *tv;
+	pidmapnsec = timespec_mononsec();
+	pidmaprebuilds++;
+}
+
+/*
+ * Rebuild the bitmap after a process was found gone, unless it is recent.
+ */
+static void
+pidmap_rebuild(void) {
+	struct timespec tv;
+	pid_t *pidv;
+	int pidc;
+
+	if (config->trace_replay ||
+	    timespec_mononsec() - pidmapnsec < PIDMAP_REBUILD_MSEC * 1000000ULL)
+		return;
+	/* before listing, such that all pids listed ran at tv or later */
+	if (timespec_nanotime(&tv) == -1)
+		return;
+	pidv = sys_pidlist(&pidc);
+	if (!pidv)
+		return;
+	pidmap_build(pidv, (size_t)pidc, &tv);
+	free(pidv);
+}
+
+/*
+ * Returns true if the process with pid, seen in a record at tv, is known
+ * to have exited since.
+ */
+static bool
+pidmap_gone(pid_t pid, struct timespec *tv) {
+	if (config->trace_replay || pid < 0 || pid >= PIDMAP_PIDS ||
+	    !timespec_greater(&pidmaptv, tv))
+		return false;
+	return !(pidmap[pid / 64] & (1ULL << (pid % 64)));
+}
+
 /*
  * Create new proc from pid using runtime lookups.  Called after looking up a
  * subject in proctab fails and for examination of processes which executed
@@ -578,27 +2442,52 @@ image_exec_from_pid(pid_t pid) {
 static proc_t *
 procmon_proc_from_pid(pid_t pid, bool log_event, struct timespec *tv) {
 	proc_t *proc;
+	preload_t *pl;
 	pid_t ppid;
+	bool restored = false;
+
+	if (pidmap_gone(pid, tv)) {
+		pidmapskips++;
+		errno = ESRCH;
+		return NULL;
+	}
 
 	proc = proctab_find_or_create(pid);
 	if (!proc) {
-		atomic64_inc(&ooms);
+		counter_inc(&ooms);
 		return NULL;
 	}
 
-	if (sys_pidbsdinfo(&proc->fork_tv, &ppid, pid) == -1) {
+	pl = preload_take(pid);
+	if (pl && pl->error) {
+		/* oom already counted by preload thread */
+		proctab_remove(pid, tv);
+		errno = pl->error;
+		return NULL;
+	}
+	if (pl) {
+		proc->fork_tv = pl->fork_tv;
+		ppid = pl->ppid;
+	} else if (pidcache_bsdinfo(&proc->fork_tv, &ppid, pid) == -1) {
 		/* process not alive anymore */
 		proctab_remove(pid, tv);
+		pidmap_rebuild();
+		errno = ESRCH;
 		return NULL;
 	}
 
 	if (proc->cwd) {
-		free(proc->cwd);
+		intern_free(proc->cwd);
+	}
+	if (pl) {
+		proc->cwd = intern_take(pl->cwd);
+		pl->cwd = NULL;
+	} else {
+		proc->cwd = intern_take(pidcache_cwd(pid));
 	}
-	proc->cwd = sys_pidcwd(pid);
 	if (!proc->cwd) {
 		if (errno == ENOMEM)
-			atomic64_inc(&ooms);
+			counter_inc(&ooms);
 		/* process not alive anymore unless ENOMEM */
 		proctab_remove(pid, tv);
 		return NULL;
@@ -607,13 +2496,19 @@ procmon_proc_from_pid(pid_t pid, bool log_event, struct timespec *tv) {
 	if (proc->image_exec) {
 		image_exec_free(proc->image_exec);
 	}
-	proc->image_exec = image_exec_from_pid(pid);
-	if (!proc->image_exec) {
-		/* process not alive anymore unless ENOMEM */
-		proctab_remove(pid, tv);
-		return NULL;
+	if (pl) {
+		proc->image_exec = pl->image_exec;
+		pl->image_exec = NULL;
+		restored = pl->restored;
+	} else {
+		proc->image_exec = image_exec_from_pid(pid);
+		if (!proc->image_exec) {
+			/* process not alive anymore unless ENOMEM */
+			proctab_remove(pid, tv);
+			return NULL;
+		}
+		image_exec_open(proc->image_exec, NULL, false);
 	}
-	image_exec_open(proc->image_exec, NULL, false);
 
 	/* after acquiring all info from process, go after parent before
 	 * submitting the child into the queues */
@@ -630,14 +2525,27 @@ procmon_proc_from_pid(pid_t pid, bool log_event, struct timespec *tv) {
 				ppid = -1;
 			}
 		}
-		if (pproc) {
-			proc->image_exec->prev = pproc->image_exec;
-			if (proc->image_exec->prev) {
-				image_exec_ref(proc->image_exec->prev);
+		/* restored images come with their own lineage */
+		if (pproc && !restored) {
+			if (pproc->image_exec) {
+				image_exec_ref(pproc->image_exec);
+				image_exec_link(proc->image_exec,
+				                pproc->image_exec);
 			}
 		}
 	}
 
+	if (restored) {
+		/* ref from snapshot is owned by proc; restored images may be
+		 * shared, only the first taker may submit it for logging */
+		snaprestored++;
+		if (!log_event || pid == 0 ||
+		    !snapshot_submit(proc->image_exec))
+			return proc;
+		image_exec_ref(proc->image_exec);
+		preload_submit(proc->image_exec);
+		return proc;
+	}
 	if (!log_event || pid == 0)
 		proc->image_exec->flags |= EIFLAG_NOLOG;
 #ifdef DEBUG_REFS
@@ -645,7 +2553,7 @@ procmon_proc_from_pid(pid_t pid, bool log_event, struct timespec *tv) {
 	                proc->image_exec);
 #endif
 	image_exec_ref(proc->image_exec); /* ref is owned by proc */
-	work_submit(proc->image_exec);
+	preload_submit(proc->image_exec);
 	return proc;
 }
 
@@ -676,24 +2584,45 @@ image_exec_by_pid(pid_t pid, struct timespec *tv) {
 		}
 		liveacq++;
 	}
+	preload_promote(proc->image_exec);
 	image_exec_ref(proc->image_exec);
 	return proc->image_exec;
 }
 
 /*
- * Handles fork.
+ * Returns the current image of pid without taking a reference, or NULL if
+ * the process is not tracked.  Only meant for comparing against images the
+ * caller holds a reference to.  Main thread only, like image_exec_by_pid.
  */
-void
-procmon_fork(struct timespec *tv,
-             audit_proc_t *subject, pid_t childpid) {
-	proc_t *parent, *child;
+image_exec_t *
+image_exec_peek(pid_t pid) {
+	proc_t *proc;
 
-#ifdef DEBUG_PROCMON
-	DEBUG(config->debug, "procmon_fork",
-	      "subject->pid=%i childpid=%i\n",
-	      subject->pid, childpid);
-#endif
+	proc = proctab_find(pid);
+	return proc ? proc->image_exec : NULL;
+}
+
+/*
+ * Returns true if the subject image of an event no longer has any work item
+ * pending that the event's work could depend on, that is, if the image has
+ * been acquired completely, see image_exec_publish().  Images that are not
+ * acquired cleanly never qualify.  Thread-safe.
+ */
+bool
+image_exec_settled(image_exec_t *image) {
+	return atomic_load_explicit(&image->acquired, memory_order_acquire);
+}
 
+/*
+ * Create the process table entry of a forked child and return it, or NULL
+ * if the parent is unknown or on OOM.
+ */
+static proc_t *
+procmon_fork_proc(struct timespec *tv,
+                  audit_proc_t *subject, pid_t childpid) {
+	proc_t *parent, *child;
+
+	pidcache_invalidate(childpid);
 	parent = proctab_find(subject->pid);
 	if (!parent) {
 		parent = procmon_proc_from_pid(subject->pid, true, tv);
@@ -704,7 +2633,7 @@ procmon_fork(struct timespec *tv,
 				      "subject.pid=%i childpid=%i",
 				      subject->pid, childpid);
 			}
-			return;
+			return NULL;
 		}
 		liveacq++;
 	}
@@ -713,28 +2642,49 @@ procmon_fork(struct timespec *tv,
 	proctab_remove(childpid, tv);
 	child = proctab_create(childpid);
 	if (!child) {
-		atomic64_inc(&ooms);
-		return;
+		counter_inc(&ooms);
+		return NULL;
 	}
 	child->fork_tv = *tv;
+	forks++;
 
 	assert(parent->cwd);
-	child->cwd = strdup(parent->cwd);
-	if (!child->cwd) {
-		proctab_remove(childpid, tv);
-		atomic64_inc(&ooms);
-		return;
-	}
+	child->cwd = intern_ref(parent->cwd);
+	proc_sharefds(child, parent);
 
 	assert(parent->image_exec);
 	child->image_exec = parent->image_exec;
 	image_exec_ref(child->image_exec);
+	return child;
+}
+
+/*
+ * Handles fork.
+ */
+void
+procmon_fork(struct timespec *tv,
+             audit_proc_t *subject, pid_t childpid) {
+#ifdef DEBUG_PROCMON
+	DEBUG(config->debug, "procmon_fork",
+	      "subject->pid=%i childpid=%i\n",
+	      subject->pid, childpid);
+#endif
+
+	(void)procmon_fork_proc(tv, subject, childpid);
 }
 
+static void procmon_exec_proc(struct timespec *, audit_proc_t *, proc_t *,
+                              char *, audit_attr_t *, char **, char **);
+
 /*
  * Only handles true posix_spawn without the POSIX_SPAWN_SETEXEC attribute set.
  * POSIX_SPAWN_SETEXEC is treated as regular exec.
  *
+ * The fork and exec halves are applied as a single transition:  the exec
+ * operates on the child just created, without invalidating its pidcache
+ * entry and looking it up again.  Only if the fork half fails, the exec half
+ * falls back to looking up the child like a regular exec.
+ *
  * Ownership of argv and imagepath is transfered; procmon guarantees that they
  * will be freed.
  */
@@ -744,17 +2694,40 @@ procmon_spawn(struct timespec *tv,
               pid_t childpid,
               char *imagepath, audit_attr_t *attr,
               char **argv, char **envv) {
+	proc_t *child;
+
 #ifdef DEBUG_PROCMON
 	DEBUG(config->debug, "procmon_spawn",
 	      "subject->pid=%i childpid=%i imagepath=%s",
 	      subject->pid, childpid, imagepath);
 #endif
 
-	procmon_fork(tv, subject, childpid);
+	child = procmon_fork_proc(tv, subject, childpid);
 	subject->pid = childpid;
-	procmon_exec(tv, subject, imagepath, attr, argv, envv);
+	if (!child) {
+		procmon_exec(tv, subject, imagepath, attr, argv, envv);
+		return;
+	}
+	procmon_exec_proc(tv, subject, child, imagepath, attr, argv, envv);
 }
 
+/*
+ * The prepq holds images acquired by kext events until the corresponding
+ * audit event arrives.  Entries are kept in arrival order in pqlist and
+ * indexed by pid in pqbypid; the per-pid chains retain arrival order.
+ *
+ * Every lookup ages all entries older than the last entry it matched, or all
+ * entries if it did not match, by incrementing their ttl.  Entries reaching
+ * MAXPQTTL are dropped.  Since aging always applies to a prefix of pqlist,
+ * ttl never increases from older to younger entries.  Instead of the ttl
+ * itself, each entry stores the amount by which its ttl exceeds that of the
+ * next younger entry, so that aging a prefix is a single increment on the
+ * youngest aged entry, and the ttl of the oldest entry, which is the only one
+ * that can reach MAXPQTTL, is the sum of all, tracked in pqttlsum.
+ */
+
+#define hashpid(P) tommy_inthash_u32((uint32_t)(P))
+
 /*
  * Append an element to the prepq.
  * Called from the kext event handler, if kextlevel is > 0.
@@ -762,25 +2735,70 @@ procmon_spawn(struct timespec *tv,
 static void
 prepq_append(image_exec_t *ei) {
 	pthread_mutex_lock(&pqmutex);
+	ei->pqseq = pqseq++;
+	ei->pqttl = 0;
 	tommy_list_insert_tail(&pqlist, &ei->hdr.node, ei);
+	tommy_hashinc_insert(&pqbypid, &ei->pqnode, ei, hashpid(ei->pid));
 	pqsize++;
+	if (pqsize > pqpeak)
+		pqpeak = pqsize;
 	pthread_mutex_unlock(&pqmutex);
 }
 
 /*
- * Remove an existing (!) element from the prepq.
- * Called from the exec handler only (!).
- *
- * The chosen locking strategy only works if only a single thread is removing
- * elements and one or more other threads are only adding elements.
+ * Remove an existing (!) element from the prepq, folding its ttl excess into
+ * the next older entry.
+ * Called with pqmutex held.
  */
 static void
 prepq_remove_existing(image_exec_t *ei) {
-	pthread_mutex_lock(&pqmutex);
-	tommy_list_remove_existing(&pqlist,
-	                           &ei->hdr.node);
+	image_exec_t *older;
+
+	if (&ei->hdr.node == tommy_list_head(&pqlist)) {
+		pqttlsum -= ei->pqttl;
+	} else {
+		older = ei->hdr.node.prev->data;
+		older->pqttl += ei->pqttl;
+	}
+	tommy_list_remove_existing(&pqlist, &ei->hdr.node);
+	tommy_hashinc_remove_existing(&pqbypid, &ei->pqnode);
 	pqsize--;
-	pthread_mutex_unlock(&pqmutex);
+}
+
+/*
+ * Age all entries older than stop, or all entries if stop is NULL.
+ * Called with pqmutex held.
+ */
+static void
+prepq_age(image_exec_t *stop) {
+	tommy_node *node;
+
+	if (stop) {
+		if (&stop->hdr.node == tommy_list_head(&pqlist))
+			return;
+		node = stop->hdr.node.prev;
+		pqskip += stop->pqseq -
+		          ((image_exec_t *)tommy_list_head(&pqlist)->data)->pqseq;
+	} else {
+		if (tommy_list_empty(&pqlist))
+			return;
+		node = tommy_list_tail(&pqlist);
+		pqskip += pqsize;
+	}
+	((image_exec_t *)node->data)->pqttl++;
+	pqttlsum++;
+}
+
+/*
+ * Record the latency from kext preexec to audit match.
+ */
+static void
+prepq_latency(image_exec_t *ei) {
+	struct timespec now;
+
+	if (timespec_nanotime(&now) == -1)
+		return;
+	hist_add(&pqlat, timespec_diff_nsec(&now, &ei->hdr.tv) / 1000);
 }
 
 /*
@@ -792,13 +2810,22 @@ prepq_remove_existing(image_exec_t *ei) {
 static void
 prepq_lookup(image_exec_t **image, image_exec_t **interp,
              proc_t *proc, char *imagepath, audit_attr_t *attr, char **argv) {
+	tommy_node *node;
+	image_exec_t *stop;
+	tommy_list dropped;
+
 	*image = NULL;
 	*interp = NULL;
+	tommy_list_init(&dropped);
+
+	pthread_mutex_lock(&pqmutex);
 	pqlookup++;
-	for (tommy_node *node = tommy_list_head(&pqlist);
-	     node; node = node->next) {
+	node = tommy_hashinc_bucket(&pqbypid, hashpid(proc->pid));
+	for (; node; node = node->next) {
 		image_exec_t *ei = node->data;
 		assert(ei);
+		if (ei->pid != proc->pid)
+			continue;
 
 		if (!*image) {
 			/*
@@ -809,13 +2836,10 @@ prepq_lookup(image_exec_t **image, image_exec_t **interp,
 			 * not provide attributes; in that case we have to rely
 			 * on just the pid and the basename.
 			 */
-			if (ei->pid == proc->pid &&
-			    ((attr && ei->stat.dev == attr->dev &&
-			              ei->stat.ino == attr->ino) ||
-			     (!attr &&
-			      !sys_basenamecmp(ei->path, imagepath)))) {
+			if ((attr && ei->stat.dev == attr->dev &&
+			             ei->stat.ino == attr->ino) ||
+			    (!attr && !sys_basenamecmp(ei->path, imagepath))) {
 				/* we have a match */
-				prepq_remove_existing(ei);
 				*image = ei;
 				/* script executions always have the
 				 * interpreter as argv[0] and the script file
@@ -832,33 +2856,142 @@ prepq_lookup(image_exec_t **image, image_exec_t **interp,
 			/* #! can be relative path and we have no attr now.
 			 * Using (pid,basename(path)) is the best we can do
 			 * at this point. */
-			if (ei->pid == proc->pid &&
-			    !sys_basenamecmp(ei->path, argv[0])) {
+			if (!sys_basenamecmp(ei->path, argv[0])) {
 				/* we have a match */
-				prepq_remove_existing(ei);
 				*interp = ei;
 				break;
 			}
 		}
+	}
 
-		pqskip++;
-#if 0
-		DEBUG(config->debug, "prepq_skip",
-		      "looking for %s[%i]: skipped %s[%i]",
+	/*
+	 * Age entries skipped by the equivalent linear search over pqlist:
+	 * up to the match, or up to the interpreter match for scripts.
+	 */
+	if (*interp)
+		stop = *interp;
+	else if (*image && !(((*image)->flags & EIFLAG_SHEBANG) &&
+	                     argv && argv[0] && argv[1]))
+		stop = *image;
+	else
+		stop = NULL;
+	prepq_age(stop);
+	if (*image) {
+		if (*image != stop && pqskip > 0)
+			pqskip--;       /* matched, not skipped */
+		prepq_remove_existing(*image);
+		prepq_latency(*image);
+	}
+	if (*interp) {
+		prepq_remove_existing(*interp);
+		prepq_latency(*interp);
+	}
+
+	while (pqttlsum >= MAXPQTTL) {
+		image_exec_t *ei = tommy_list_head(&pqlist)->data;
+		DEBUG(config->debug, "prepq_drop",
+		      "looking for %s[%i]: dropped %s[%i]",
 		      imagepath, proc->pid, ei->path, ei->pid);
-#endif
-		if (++ei->pqttl == MAXPQTTL) {
-			DEBUG(config->debug, "prepq_drop",
-			      "looking for %s[%i]: dropped %s[%i]",
-			      imagepath, proc->pid, ei->path, ei->pid);
-			prepq_remove_existing(ei);
-			image_exec_free(ei);
-			pqdrop++;
-		}
+		prepq_remove_existing(ei);
+		tommy_list_insert_tail(&dropped, &ei->hdr.node, ei);
+		pqdrop++;
+	}
+	pthread_mutex_unlock(&pqmutex);
+
+	while (!tommy_list_empty(&dropped)) {
+		image_exec_t *ei = tommy_list_remove_existing(&dropped,
+		                                     tommy_list_head(&dropped));
+		image_exec_free(ei);
 	}
 	assert(!(*interp && !*image));
 }
 
+static execcache_t *
+execcache_slot(image_exec_t *parent, audit_attr_t *attr) {
+	uint64_t h;
+
+	h = tommy_inthash_u64(parent->id ^ (uint64_t)attr->ino ^
+	                      ((uint64_t)attr->dev << 32));
+	return &execcache[h & (EXECCACHE_SLOTS - 1)];
+}
+
+/*
+ * Returns the image most recently exec'd by a child of parent if imagepath
+ * is the same unmodified file, with its current attributes in st, or NULL.
+ * Main thread only.
+ */
+static image_exec_t *
+execcache_lookup(image_exec_t *parent, const char *imagepath,
+                 audit_attr_t *attr, stat_attr_t *st) {
+	execcache_t *slot;
+	image_exec_t *cached;
+
+	if (!parent || !attr ||
+	    (config->trace_replay && !config->trace_replay_lookups))
+		return NULL;
+	slot = execcache_slot(parent, attr);
+	cached = slot->image;
+	if (!cached || slot->parent != parent->id ||
+	    cached->stat.dev != attr->dev || cached->stat.ino != attr->ino ||
+	    !atomic_load_explicit(&cached->acquired, memory_order_acquire))
+		return NULL;
+	if (sys_pathattr(st, imagepath) == -1 ||
+	    st->mode != attr->mode || st->uid != attr->uid ||
+	    st->gid != attr->gid || st->dev != attr->dev ||
+	    st->ino != attr->ino || st->size != cached->stat.size ||
+	    !timespec_equal(&st->mtime, &cached->stat.mtime) ||
+	    !timespec_equal(&st->ctime, &cached->stat.ctime) ||
+	    !timespec_equal(&st->btime, &cached->stat.btime)) {
+		rexec_stale++;
+		return NULL;
+	}
+	return cached;
+}
+
+/*
+ * Complete the fresh image from the cached one returned by execcache_lookup
+ * so that neither image_exec_open nor the worker touch the file.  On OOM,
+ * image is left to be opened and acquired as usual.  Main thread only.
+ */
+static void
+execcache_copy(image_exec_t *image, image_exec_t *cached, stat_attr_t *st) {
+	if (cached->codesign)
+		image->codesign = codesign_ref(cached->codesign);
+	image->stat = *st;
+	image->hashes = cached->hashes;
+	image->flags |= EIFLAG_STAT|EIFLAG_HASHES|EIFLAG_DONE;
+	rexec_hit++;
+}
+
+/*
+ * Remember image as the most recent exec by a child of parent, replacing
+ * whatever was in its slot.  Main thread only.
+ */
+static void
+execcache_insert(image_exec_t *parent, image_exec_t *image,
+                 audit_attr_t *attr) {
+	execcache_t *slot;
+
+	if (!attr || (image->flags & (EIFLAG_SHEBANG|EIFLAG_DONE)))
+		return;
+	slot = execcache_slot(parent, attr);
+	if (slot->image)
+		image_exec_free(slot->image);
+	image_exec_ref(image);
+	slot->parent = parent->id;
+	slot->image = image;
+}
+
+static void
+execcache_clear(void) {
+	for (size_t i = 0; i < EXECCACHE_SLOTS; i++) {
+		if (execcache[i].image) {
+			image_exec_free(execcache[i].image);
+			execcache[i].image = NULL;
+		}
+	}
+}
+
 /*
  * For scripts, this will be called once, with argv[0] as the interpreter and
  * argv[1+] as argv[0+] of the script execution, imagepath as the script and
@@ -873,14 +3006,13 @@ procmon_exec(struct timespec *tv,
              char *imagepath, audit_attr_t *attr,
              char **argv, char **envv) {
 	proc_t *proc;
-	image_exec_t *prev_image_exec;
-	char *cwd;
 
 #ifdef DEBUG_PROCMON
 	DEBUG(config->debug, "procmon_exec",
 	      "subject->pid=%i imagepath=%s", subject->pid, imagepath);
 #endif
 
+	pidcache_invalidate(subject->pid);
 	proc = proctab_find(subject->pid);
 	if (!proc) {
 		proc = procmon_proc_from_pid(subject->pid, true, tv);
@@ -902,8 +3034,21 @@ procmon_exec(struct timespec *tv,
 		liveacq++;
 	}
 	assert(proc);
+	procmon_exec_proc(tv, subject, proc, imagepath, attr, argv, envv);
+}
 
-	image_exec_t *image, *interp;
+/*
+ * Replace the executable image of proc, which is the process of subject.
+ */
+static void
+procmon_exec_proc(struct timespec *tv, audit_proc_t *subject, proc_t *proc,
+                  char *imagepath, audit_attr_t *attr,
+                  char **argv, char **envv) {
+	image_exec_t *prev_image_exec;
+	char *cwd;
+	image_exec_t *image, *interp, *cached = NULL;
+	stat_attr_t st;
+	bool pqhit = true;
 	prepq_lookup(&image, &interp, proc, imagepath, attr, argv);
 
 #if 0
@@ -925,6 +3070,9 @@ procmon_exec(struct timespec *tv,
 		      "looking for %s[%i]: not found (image)",
 		      imagepath, proc->pid);
 		pqmiss++;
+		pqhit = false;
+		cached = execcache_lookup(proc->image_exec, imagepath, attr,
+		                          &st);
 		image = image_exec_new(imagepath);
 		if (!image) {
 			/* no counter, oom is the only reason this can happen */
@@ -935,11 +3083,16 @@ procmon_exec(struct timespec *tv,
 			assert(!interp);
 			return;
 		}
+		if (cached)
+			execcache_copy(image, cached, &st);
 	} else {
 		free(imagepath);
 	}
 	assert(image);
 	image_exec_open(image, attr, false);
+	execs++;
+	if (!pqhit && !cached && proc->image_exec)
+		execcache_insert(proc->image_exec, image, attr);
 
 	/*
 	 * XXX why are we not using the shebang from the script file here if
@@ -969,7 +3122,7 @@ procmon_exec(struct timespec *tv,
 				char *p = sys_realpath(argv[0], proc->cwd);
 				if (!p) {
 					if (errno == ENOMEM)
-						atomic64_inc(&ooms);
+						counter_inc(&ooms);
 					miss_execinterp++;
 					DEBUG(config->debug,
 					      "miss_execinterp",
@@ -1008,6 +3161,7 @@ procmon_exec(struct timespec *tv,
 
 	/* replace the process' executable image */
 	prev_image_exec = proc->image_exec;
+	preload_promote(prev_image_exec);
 	if (image->flags & EIFLAG_SHEBANG) {
 		proc->image_exec = interp;
 		proc->image_exec->script = image;
@@ -1016,42 +3170,39 @@ procmon_exec(struct timespec *tv,
 	}
 	assert(proc->image_exec);
 	assert(proc->image_exec != prev_image_exec);
-	cwd = strdup(proc->cwd);
-	if (!cwd) {
-		atomic64_inc(&ooms);
-		image_exec_free(proc->image_exec);
-		proc->image_exec = NULL;
-		/* free what would have been transfered to image_exec below */
-		if (prev_image_exec)
-			image_exec_free(prev_image_exec);
-		if (argv)
-			free(argv);
-		if (envv)
-			free(envv);
-		return;
-	}
-	assert(proc->image_exec->refs == 1);
+	cwd = intern_ref(proc->cwd);
+	assert(atomic64_load(&proc->image_exec->refs) == 1);
 	proc->image_exec->hdr.tv = *tv;
 	proc->image_exec->fork_tv = proc->fork_tv;
 	proc->image_exec->pid = proc->pid;
 	proc->image_exec->subject = *subject;
 	proc->image_exec->argv = argv;
+	if (envv && membudget_level() >= MEMBUDGET_DETAIL) {
+		free(envv);
+		envv = NULL;
+		membudget_dropped_env();
+	}
 	proc->image_exec->envv = envv;
+	proc->image_exec->vecsz = aev_size(argv) + aev_size(envv);
+	counter_add(&vecbytes, proc->image_exec->vecsz);
 	proc->image_exec->cwd = cwd;
-	proc->image_exec->prev = prev_image_exec;
+	image_exec_link(proc->image_exec, prev_image_exec);
 
 	if (proc->image_exec->prev->flags & EIFLAG_NOLOG_KIDS)
 		proc->image_exec->flags |= EIFLAG_NOLOG | EIFLAG_NOLOG_KIDS;
 	else if (image_exec_match_suppressions(proc->image_exec,
+				SUPPRESS_ANCESTOR,
 				suppress_image_exec_by_ancestor_ident,
 				suppress_image_exec_by_ancestor_path))
 		proc->image_exec->flags |= EIFLAG_NOLOG_KIDS;
+	image_exec_trim_ancestors(proc->image_exec);
 
 #ifdef DEBUG_REFS
 	fprintf(stderr, "DEBUG_REFS: work_submit(%p)\n",
 	                proc->image_exec);
 #endif
 	image_exec_ref(proc->image_exec); /* ref is owned by proc */
+	proc->image_exec->hdr.bulk = image_exec_is_bulk(proc->image_exec);
 	work_submit(proc->image_exec);
 }
 
@@ -1069,6 +3220,7 @@ procmon_exit(struct timespec *tv, pid_t pid) {
 	      "pid=%i", pid);
 #endif
 
+	pidcache_invalidate(pid);
 	proctab_remove(pid, tv);
 }
 
@@ -1097,6 +3249,114 @@ procmon_wait4(struct timespec *tv, pid_t pid) {
 		procmon_exit(tv, pid);
 }
 
+static int
+pid_cmp(const void *a, const void *b) {
+	pid_t pa = *(const pid_t *)a;
+	pid_t pb = *(const pid_t *)b;
+
+	return (pa > pb) - (pa < pb);
+}
+
+typedef struct {
+	pid_t *pidv;                    /* running processes, sorted */
+	size_t pidc;
+	pid_t *orphv;                   /* processes not running */
+	size_t orphc;
+} reap_ctx_t;
+
+static void
+procmon_reap_orphan(proc_t *proc, void *arg) {
+	reap_ctx_t *ctx = arg;
+
+	if (!bsearch(&proc->pid, ctx->pidv, ctx->pidc, sizeof(pid_t), pid_cmp))
+		ctx->orphv[ctx->orphc++] = proc->pid;
+}
+
+/*
+ * Compare proctab to the list of running processes and evict the processes
+ * that are not running anymore.  A process is only evicted if it was
+ * missing from the previous sweep as well and was forked before it, since
+ * its exit and other records referring to it may still be queued in the
+ * auditpipe.
+ */
+static void
+procmon_reap_sweep(struct timespec *tv) {
+	reap_ctx_t ctx;
+	proc_t *proc;
+	size_t n;
+	int pidc;
+
+	ctx.pidv = sys_pidlist(&pidc);
+	if (!ctx.pidv)
+		return;
+	ctx.pidc = (size_t)pidc;
+	ctx.orphv = malloc((procs + 1) * sizeof(pid_t));
+	if (!ctx.orphv) {
+		free(ctx.pidv);
+		counter_inc(&ooms);
+		return;
+	}
+	ctx.orphc = 0;
+	qsort(ctx.pidv, ctx.pidc, sizeof(pid_t), pid_cmp);
+	proctab_foreach(procmon_reap_orphan, &ctx);
+	pidmap_build(ctx.pidv, ctx.pidc, tv);
+	free(ctx.pidv);
+	qsort(ctx.orphv, ctx.orphc, sizeof(pid_t), pid_cmp);
+
+	n = 0;
+	for (size_t i = 0; i < ctx.orphc; i++) {
+		proc = proctab_find(ctx.orphv[i]);
+		if (proc && reapv &&
+		    bsearch(&ctx.orphv[i], reapv, reapc, sizeof(pid_t),
+		            pid_cmp) &&
+		    !timespec_greater(&proc->fork_tv, &reaptv)) {
+			/* may trigger implicit close events */
+			procmon_exit(tv, ctx.orphv[i]);
+			reaped++;
+			continue;
+		}
+		ctx.orphv[n++] = ctx.orphv[i];
+	}
+	if (reapv)
+		free(reapv);
+	reapv = ctx.orphv;
+	reapc = n;
+	reaptv = *tv;
+	reapforks = forks;
+	reapprocs = procs;
+	reapsweeps++;
+}
+
+/*
+ * Called every PROCMON_REAP_TICK seconds from the main thread to bound
+ * proctab and the image chains it retains to the running processes, even if
+ * exit records are lost, for instance to auditpipe drops.  Sweeps run every
+ * REAP_INTERVAL seconds, and on every tick while a fork storm inflates the
+ * table, i.e. while processes are forked at more than REAP_STORM_RATE per
+ * second or the table grew by more than REAP_STORM_GROWTH since the last
+ * sweep.
+ */
+void
+procmon_reap(struct timespec *tv) {
+	time_t elapsed = tv->tv_sec - reaptv.tv_sec;
+	bool storm;
+
+	if (elapsed < 0) {
+		/* wall clock was set back */
+		reaptv = *tv;
+		return;
+	}
+	if (elapsed == 0)
+		return;
+	storm = (forks - reapforks) / (uint64_t)elapsed >= REAP_STORM_RATE ||
+	        procs > reapprocs + REAP_STORM_GROWTH;
+	if (!storm && elapsed < REAP_INTERVAL)
+		return;
+	if (storm)
+		reapstorms++;
+	procmon_reap_sweep(tv);
+}
+
 /*
  * CWD tracking is only needed in order to reconstruct full paths to relative
  * interpreter paths in shebangs.
@@ -1107,12 +3367,14 @@ procmon_wait4(struct timespec *tv, pid_t pid) {
 void
 procmon_chdir(struct timespec *tv, pid_t pid, char *path) {
 	proc_t *proc;
+	char *cwd;
 
 #ifdef DEBUG_CHDIR
 	DEBUG(config->debug, "procmon_chdir",
 	      "pid=%i path=%s", pid, path);
 #endif
 
+	pidcache_invalidate(pid);
 	proc = proctab_find(pid);
 	if (!proc) {
 		proc = procmon_proc_from_pid(pid, true, tv);
@@ -1129,9 +3391,20 @@ procmon_chdir(struct timespec *tv, pid_t pid, char *path) {
 	}
 	assert(proc);
 
+	/* make -C and friends often chdir to where they already are */
+	if (proc->cwd && !strcmp(proc->cwd, path)) {
+		free(path);
+		return;
+	}
+	cwd = intern_take(path);
+	if (!cwd) {
+		/* keep the stale cwd rather than none at all */
+		counter_inc(&ooms);
+		return;
+	}
 	if (proc->cwd)
-		free(proc->cwd);
-	proc->cwd = path;
+		intern_free(proc->cwd);
+	proc->cwd = cwd;
 }
 
 /*
@@ -1143,8 +3416,97 @@ procmon_chdir(struct timespec *tv, pid_t pid, char *path) {
  * Unlike other procmon functions, imagepath will NOT be owned by procmon and
  * remains owned by the caller.
  */
+/*
+ * Use the sha256 the kext calculated while the exec was blocked if it was
+ * calculated over the same file as the one we opened, saving the read and
+ * the hashing.  A stat different from the one the kext saw means the file
+ * was replaced or modified in between, in which case we hash it ourselves.
+ */
+static void
+image_exec_kexthash(image_exec_t *image, const xnumon_msg_hash_t *kh) {
+	if (!(image->flags & EIFLAG_STAT) || image->fd == -1)
+		return;
+	if (kh->size != (uint64_t)image->stat.size ||
+	    kh->mtime_s != (uint64_t)image->stat.mtime.tv_sec ||
+	    kh->mtime_ns != (uint64_t)image->stat.mtime.tv_nsec ||
+	    kh->ctime_s != (uint64_t)image->stat.ctime.tv_sec ||
+	    kh->ctime_ns != (uint64_t)image->stat.ctime.tv_nsec) {
+		counter_inc(&kexthash_stale);
+		return;
+	}
+	memcpy(image->hashes.sha256, kh->sha256, SHA256SZ);
+	image->flags |= EIFLAG_KEXTHASH;
+	counter_inc(&kexthash);
+}
+
+/*
+ * Look up the hashes of the image by the identity of its vnode from the
+ * kext, sparing opening and stat'ing it by path while the exec is blocked.
+ * Only if the hashes are cached is the identity taken as the stat of the
+ * image; otherwise it is opened as before.  In trace replay, the identity
+ * refers to the files of the recording system and is ignored.
+ */
+static void
+image_exec_kextident(image_exec_t *image, const xnumon_msg_ident_t *ki) {
+	stat_attr_t st;
+	bool shebang;
+
+	if (config->trace_replay)
+		return;
+
+	st.dev = (dev_t)ki->dev;
+	st.ino = (ino_t)ki->ino;
+	st.mode = (mode_t)ki->mode;
+	st.uid = (uid_t)ki->uid;
+	st.gid = (gid_t)ki->gid;
+	st.size = (off_t)ki->size;
+	st.mtime.tv_sec = (time_t)ki->mtime_s;
+	st.mtime.tv_nsec = (long)ki->mtime_ns;
+	st.ctime.tv_sec = (time_t)ki->ctime_s;
+	st.ctime.tv_nsec = (long)ki->ctime_ns;
+	st.btime.tv_sec = (time_t)ki->btime_s;
+	st.btime.tv_nsec = (long)ki->btime_ns;
+	shebang = !!(ki->flags & XNUMON_IDENT_SHEBANG);
+
+	/* images on the sealed system volume cannot change, see cacheseal.c */
+	if (cacheseal_get(&image->stat, &image->hashes, &shebang,
+	                  st.dev, st.ino)) {
+		if (image->stat.mode == st.mode &&
+		    image->stat.uid == st.uid &&
+		    image->stat.gid == st.gid)
+			goto hit;
+		shebang = !!(ki->flags & XNUMON_IDENT_SHEBANG);
+	}
+	if (!cachehash_get(&image->hashes, st.dev, st.ino,
+	                   &st.mtime, &st.ctime, &st.btime)) {
+		counter_inc(&kextident_miss);
+		return;
+	}
+	image->stat = st;
+hit:
+	if (shebang)
+		image->flags |= EIFLAG_SHEBANG;
+	/* only known if another image on the device was opened before */
+	switch (fsclass_policy(image->stat.dev, -1)) {
+	case FSCLASS_BULK:
+		image->flags |= EIFLAG_FSBULK;
+		break;
+	case FSCLASS_SKIP:
+		image->flags |= EIFLAG_FSSKIP;
+		break;
+	}
+	image->flags |= EIFLAG_STAT|EIFLAG_HASHES;
+	counter_inc(&kextident);
+}
+
+/*
+ * Kh is the hash calculated by the kext, or NULL.  Ki is the identity of the
+ * image from the kext, or NULL.
+ */
 void
-procmon_kern_preexec(struct timespec *tm, pid_t pid, const char *imagepath) {
+procmon_kern_preexec(struct timespec *tm, pid_t pid, const char *imagepath,
+                     const xnumon_msg_hash_t *kh,
+                     const xnumon_msg_ident_t *ki) {
 	image_exec_t *ei;
 	char *path;
 
@@ -1155,7 +3517,7 @@ procmon_kern_preexec(struct timespec *tm, pid_t pid, const char *imagepath) {
 
 	path = strdup(imagepath);
 	if (!path) {
-		atomic64_inc(&ooms);
+		counter_inc(&ooms);
 		return;
 	}
 
@@ -1164,8 +3526,14 @@ procmon_kern_preexec(struct timespec *tm, pid_t pid, const char *imagepath) {
 		return;
 	ei->hdr.tv = *tm;
 	ei->pid = pid;
+	if (ki)
+		image_exec_kextident(ei, ki);
 	image_exec_open(ei, NULL, true);
-	image_exec_acquire(ei, true);
+	if (kh)
+		image_exec_kexthash(ei, kh);
+	/* the kext did not wait for lean suppressed images */
+	if (!image_exec_lean(ei))
+		image_exec_acquire(ei, true);
 	prepq_append(ei);
 }
 
@@ -1189,6 +3557,59 @@ procmon_preloadpid(pid_t pid) {
 	                            NULL);
 }
 
+/*
+ * Preload all pids in pidv, doing the runtime lookups in parallel.  Falls
+ * back to preloading one pid after the other if memory or threads are not
+ * available.
+ */
+void
+procmon_preload(pid_t *pidv, int pidc) {
+	pthread_t thrs[PRELOAD_THREADS];
+	size_t nthrs;
+
+	if (pidc <= 0) {
+		snapshot_release();
+		return;
+	}
+	preloadv = calloc((size_t)pidc, sizeof(preload_t));
+	if (preloadv) {
+		for (int i = 0; i < pidc; i++)
+			preloadv[i].pid = pidv[i];
+		qsort(preloadv, (size_t)pidc, sizeof(preload_t), preload_cmp);
+		preloadc = (size_t)pidc;
+		atomic_init(&preloadnext, 0);
+		for (nthrs = 0; nthrs < PRELOAD_THREADS &&
+		                nthrs < preloadc / 16; nthrs++) {
+			if (pthread_create(&thrs[nthrs], NULL,
+			                   preload_thread, NULL) != 0)
+				break;
+		}
+		(void)preload_thread(NULL);
+		for (size_t i = 0; i < nthrs; i++)
+			(void)pthread_join(thrs[i], NULL);
+	}
+
+	preloading = true;
+	for (int i = pidc - 1; i >= 0; i--)
+		procmon_preloadpid(pidv[i]);
+	preloading = false;
+	snapshot_release();
+
+	if (!preloadv)
+		return;
+	for (size_t i = 0; i < preloadc; i++) {
+		if (preloadv[i].cwd)
+			free(preloadv[i].cwd);
+		if (preloadv[i].image_exec) {
+			image_exec_close(preloadv[i].image_exec);
+			image_exec_free(preloadv[i].image_exec);
+		}
+	}
+	free(preloadv);
+	preloadv = NULL;
+	preloadc = 0;
+}
+
 /*
  * Return the stored current working directory for a process by pid.
  * Caller must not free the string.
@@ -1230,6 +3651,10 @@ procmon_socket_create(pid_t pid, int fd,
 		/* XXX try to create from pid, count miss */
 		return;
 
+	if (proc_unsharefds(proc) == -1) {
+		counter_inc(&ooms);
+		return;
+	}
 	ctx = proc_getfd(proc, fd);
 	if (ctx) {
 		/* reuse existing allocation */
@@ -1238,14 +3663,17 @@ procmon_socket_create(pid_t pid, int fd,
 		      sizeof(fd_ctx_t)-sizeof(ctx->node));
 		ctx->fd = fd;
 	} else {
-		ctx = malloc(sizeof(fd_ctx_t));
+		ctx = proc_newfd();
 		if (!ctx) {
-			atomic64_inc(&ooms);
+			counter_inc(&ooms);
 			return;
 		}
-		bzero(ctx, sizeof(fd_ctx_t));
 		ctx->fd = fd;
-		proc_setfd(proc, ctx);
+		if (proc_setfd(proc, ctx) == -1) {
+			proc_freefd(ctx);
+			counter_inc(&ooms);
+			return;
+		}
 	}
 	ctx->flags = FDFLAG_SOCKET;
 	ctx->so.proto = proto;
@@ -1268,6 +3696,10 @@ procmon_socket_bind(int *proto,
 	proc = proctab_find(pid);
 	if (!proc)
 		goto errout;
+	if (proc_unsharefds(proc) == -1) {
+		counter_inc(&ooms);
+		goto errout;
+	}
 	ctx = proc_getfd(proc, fd);
 	if (!ctx || !(ctx->flags & FDFLAG_SOCKET))
 		goto errout;
@@ -1280,6 +3712,21 @@ errout:
 	*proto = 0;
 }
 
+/*
+ * Drop any state still held for a previous use of fd, for file descriptors
+ * that are not tracked because they can never lead to a logged event.
+ */
+static void
+procmon_fd_ignore(proc_t *proc, int fd, struct timespec *tv) {
+	fd_ctx_t *ctx;
+
+	ctx = proc_closefd(proc, fd);
+	if (ctx) {
+		proc_triggerfd(ctx, tv);
+		proc_freefd(ctx);
+	}
+}
+
 /*
  * Called from sockmon to retrieve socket state stored from previous calls
  * to procmon_socket_create() and procmon_socket_bind().
@@ -1324,6 +3771,14 @@ procmon_file_open(audit_proc_t *subject, int fd, char *path,
 		/* XXX try to create from pid, count miss */
 		return;
 
+	if (!filemon_open_is_relevant(path)) {
+		procmon_fd_ignore(proc, fd, tv);
+		return;
+	}
+	if (proc_unsharefds(proc) == -1) {
+		counter_inc(&ooms);
+		return;
+	}
 	ctx = proc_getfd(proc, fd);
 	if (ctx) {
 		/* reuse existing allocation */
@@ -1332,23 +3787,49 @@ procmon_file_open(audit_proc_t *subject, int fd, char *path,
 		      sizeof(fd_ctx_t)-sizeof(ctx->node));
 		ctx->fd = fd;
 	} else {
-		ctx = malloc(sizeof(fd_ctx_t));
+		ctx = proc_newfd();
 		if (!ctx) {
-			atomic64_inc(&ooms);
+			counter_inc(&ooms);
 			return;
 		}
-		bzero(ctx, sizeof(fd_ctx_t));
 		ctx->fd = fd;
-		proc_setfd(proc, ctx);
+		if (proc_setfd(proc, ctx) == -1) {
+			proc_freefd(ctx);
+			counter_inc(&ooms);
+			return;
+		}
 	}
 	ctx->flags = FDFLAG_FILE;
 	ctx->fi.subject = *subject;
-	ctx->fi.path = strdup(path);
-	if (!ctx->fi.path) {
-		atomic64_inc(&ooms);
+	if (proc_setfdpath(ctx, path) == -1) {
+		counter_inc(&ooms);
 	}
 }
 
+/*
+ * Called from sockmon for sockets that can never lead to a logged event.
+ * Drops any state still held for a previous use of fd, like a reuse by
+ * procmon_socket_create() would, without keeping state for the socket.
+ */
+void
+procmon_socket_ignore(pid_t pid, int fd, struct timespec *tv) {
+	proc_t *proc;
+
+	proc = proctab_find(pid);
+	if (!proc)
+		return;
+	procmon_fd_ignore(proc, fd, tv);
+}
+
+/*
+ * Drop all file descriptor state, for when file descriptor tracking is no
+ * longer needed at runtime.  Main thread only.
+ */
+void
+procmon_fds_drop(void) {
+	proctab_dropfds();
+}
+
 void
 procmon_fd_close(pid_t pid, int fd) {
 	proc_t *proc;
@@ -1364,7 +3845,13 @@ procmon_fd_close(pid_t pid, int fd) {
 
 int
 procmon_init(config_t *cfg) {
-	proctab_init();
+	if (pool_init(&imagepool, "image_exec", sizeof(image_exec_t),
+	              IMAGE_SLABOBJS) == -1)
+		return -1;
+	if (proctab_init() == -1) {
+		pool_destroy(&imagepool);
+		return -1;
+	}
 	config = cfg;
 	images = 0;
 	miss_bypid = 0;
@@ -1373,20 +3860,68 @@ procmon_init(config_t *cfg) {
 	miss_execinterp = 0;
 	miss_chdirsubj = 0;
 	miss_getcwd = 0;
-	ooms = 0;
+	counter_reset(&ooms);
+	counter_reset(&kexthash);
+	counter_reset(&leanskip);
+	counter_reset(&kexthash_stale);
+	counter_reset(&kextident);
+	counter_reset(&kextident_miss);
+	rexec_hit = 0;
+	rexec_stale = 0;
+	execs = 0;
+	counter_reset(&opens);
+	fdhandoffs = 0;
+	counter_reset(&hashresumes);
+	counter_reset(&buildunsigned);
+	forks = 0;
+	reapv = NULL;
+	reapc = 0;
+	bzero(&reaptv, sizeof(reaptv));
+	reapforks = 0;
+	reapprocs = 0;
+	reapsweeps = 0;
+	reapstorms = 0;
+	reaped = 0;
+	bzero(&pidmaptv, sizeof(pidmaptv));
+	pidmapnsec = 0;
+	pidmaprebuilds = 0;
+	pidmapskips = 0;
+	trims = 0;
+	snaprestored = 0;
+	snapepoch = 0;
+	bzero(execcache, sizeof(execcache));
 	pqlookup = 0;
 	pqmiss = 0;
 	pqdrop = 0;
 	pqskip = 0;
 	pqsize = 0;
+	pqpeak = 0;
+	pqseq = 0;
+	pqttlsum = 0;
+	bzero(&pqlat, sizeof(pqlat));
 	tommy_list_init(&pqlist);
+	tommy_list_init(&preloadq);
+	preloadqsize = 0;
+	preloaded = 0;
+	preloading = false;
+	tommy_hashinc_init(&pqbypid);
 	pthread_mutex_init(&pqmutex, NULL);
+	atomic_store(&suppress_epoch, 0);
 	suppress_image_exec_by_ident = &cfg->suppress_image_exec_by_ident;
 	suppress_image_exec_by_path = &cfg->suppress_image_exec_by_path;
 	suppress_image_exec_by_ancestor_ident =
 		&cfg->suppress_image_exec_by_ancestor_ident;
 	suppress_image_exec_by_ancestor_path =
 		&cfg->suppress_image_exec_by_ancestor_path;
+	if (enrich_init(cfg) == -1) {
+		tommy_hashinc_done(&pqbypid);
+		pthread_mutex_destroy(&pqmutex);
+		proctab_fini();
+		pool_destroy(&imagepool);
+		config = NULL;
+		return -1;
+	}
+	reclaim_init();
 	return 0;
 }
 
@@ -1395,17 +3930,40 @@ procmon_fini(void) {
 	if (!config)
 		return;
 
+	enrich_fini();
+	snapshot_release();
+	/* images still held in the startup lane are never logged */
+	while (!tommy_list_empty(&preloadq)) {
+		image_exec_t *ei;
+		ei = tommy_list_remove_existing(&preloadq,
+		                                tommy_list_head(&preloadq));
+		ei->held = false;
+		image_exec_logged(ei);
+		preloadqsize--;
+	}
 	/* kext thread must be terminated before call to procmon_fini */
 	pthread_mutex_destroy(&pqmutex);
 	while (!tommy_list_empty(&pqlist)) {
 		image_exec_t *ei;
 		ei = tommy_list_remove_existing(&pqlist,
 		                                tommy_list_head(&pqlist));
+		tommy_hashinc_remove_existing(&pqbypid, &ei->pqnode);
 		image_exec_free(ei);
 		pqsize--;
 	}
 	assert(pqsize == 0);
+	tommy_hashinc_done(&pqbypid);
+	execcache_clear();
+	if (reapv) {
+		free(reapv);
+		reapv = NULL;
+	}
+	reapc = 0;
 	proctab_fini();
+	reclaim_fini();
+	pidcache_fini();
+	/* image_exec still in the log queue are released later */
+	pool_destroy(&imagepool);
 	config = NULL;
 }
 
@@ -1414,20 +3972,88 @@ procmon_stats(procmon_stat_t *st) {
 	assert(st);
 
 	st->procs = procs; /* external */
+	st->procspeak = procspeak; /* external */
+	proctab_stats(&st->pt);
 	st->images = (uint32_t)images;
 	st->liveacq = liveacq;
+	st->pidmaprebuilds = pidmaprebuilds;
+	st->pidmapskips = pidmapskips;
+	st->kexthash = counter_get(&kexthash);
+	st->leanskip = counter_get(&leanskip);
+	st->kexthash_stale = counter_get(&kexthash_stale);
+	st->kextident = counter_get(&kextident);
+	st->kextident_miss = counter_get(&kextident_miss);
+	st->enriched = counter_get(&enriched);
+	st->enrichsync = enrichthrs ? queue_drops(&enrichq) : 0;
+	st->enrichq = enrichthrs ? (uint32_t)queue_size(&enrichq) : 0;
+	st->scriptpar = counter_get(&scriptpar);
+	st->restored = snaprestored;
+	st->rexec_hit = rexec_hit;
+	st->rexec_stale = rexec_stale;
+	st->execs = execs;
+	st->opens = counter_get(&opens);
+	st->fdhandoffs = fdhandoffs;
+	st->hashresumes = counter_get(&hashresumes);
+	st->buildunsigned = counter_get(&buildunsigned);
+	st->forks = forks;
+	st->reapsweeps = reapsweeps;
+	st->reapstorms = reapstorms;
+	st->reaped = reaped;
+	st->reclaims = reclaims;
+	st->trims = trims;
+	st->preloadq = preloadqsize;
+	st->preloaded = preloaded;
+	st->opensperexec = execs ? (uint32_t)(st->opens * 1000 / execs) : 0;
 	st->miss_bypid = miss_bypid;
 	st->miss_forksubj = miss_forksubj;
 	st->miss_execsubj = miss_execsubj;
 	st->miss_execinterp = miss_execinterp;
 	st->miss_chdirsubj = miss_chdirsubj;
 	st->miss_getcwd = miss_getcwd;
-	st->ooms = (uint64_t)ooms;
+	st->ooms = counter_get(&ooms);
+	st->vecbytes = counter_get(&vecbytes);
+	st->fragbytes = counter_get(&fragbytes);
 	st->pqlookup = pqlookup;
 	st->pqmiss = pqmiss;
 	st->pqdrop = pqdrop;
 	st->pqskip = pqskip;
 	st->pqsize = pqsize;
+	pthread_mutex_lock(&pqmutex);
+	st->pqpeak = pqpeak;
+	st->pqlat = pqlat;
+	pthread_mutex_unlock(&pqmutex);
+}
+
+/*
+ * Number of images waiting in the prep queue for their audit record.
+ * Called from the kextloop thread.
+ */
+uint64_t
+procmon_prepq_size(void) {
+	uint64_t sz;
+
+	pthread_mutex_lock(&pqmutex);
+	sz = pqsize;
+	pthread_mutex_unlock(&pqmutex);
+	return sz;
+}
+
+/*
+ * Fold the high-water marks reached since procmon_stats into st and start a
+ * new period at the current levels.
+ */
+void
+procmon_peaks_reset(procmon_stat_t *st) {
+	assert(st);
+
+	if (procspeak > st->procspeak)
+		st->procspeak = procspeak;
+	procspeak = procs;
+	pthread_mutex_lock(&pqmutex);
+	if (pqpeak > st->pqpeak)
+		st->pqpeak = pqpeak;
+	pqpeak = pqsize;
+	pthread_mutex_unlock(&pqmutex);
 }
 
 /*
@@ -20,16 +20,62 @@
 #include "log.h"
 #include "logevt.h"
 #include "debug.h"
+#include "hist.h"
+#include "kext/xnumon.h"
 #include "attrib.h"
+#include "atomic.h"
 
 #include <unistd.h>
 #include <sys/types.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* see proc.c */
+typedef struct {
+	uint32_t buckets;
+	uint32_t load;                  /* percent of buckets used */
+	uint32_t dispmax;               /* longest probe distance in table */
+	uint64_t lookups;
+	uint64_t probes;                /* buckets inspected by lookups */
+	uint64_t fdshared;              /* fd tables shared on fork */
+	uint64_t fdunshared;            /* shared fd tables copied on change */
+	uint64_t fdpathbytes;           /* paths of open files */
+} proctab_stat_t;
 
 typedef struct {
 	uint32_t procs;
+	uint32_t procspeak;             /* since last procmon_peaks_reset */
 	uint32_t images;
 	uint64_t liveacq;
+	uint64_t pidmaprebuilds;        /* pid presence bitmap rebuilds */
+	uint64_t pidmapskips;           /* acquisitions of exited pids skipped */
+	uint64_t kexthash;              /* sha256 from kext used */
+	uint64_t kexthash_stale;        /* sha256 from kext not matching */
+	uint64_t kextident;             /* not opened thanks to kext identity */
+	uint64_t kextident_miss;        /* kext identity not in caches */
+	uint64_t enriched;              /* image-enrich events submitted */
+	uint64_t enrichsync;            /* enrich queue full, acquired inline */
+	uint32_t enrichq;               /* images waiting for enrichment */
+	uint64_t scriptpar;             /* scripts acquired concurrently */
+	uint64_t leanskip;              /* suppressed images not acquired */
+	uint64_t restored;              /* procs restored from snapshot */
+	uint64_t rexec_hit;             /* execs reusing a sibling's image */
+	uint64_t rexec_stale;           /* sibling's image on disk changed */
+	uint64_t execs;                 /* exec events with an image */
+	uint64_t opens;                 /* open(2) of executable images */
+	uint64_t fdhandoffs;            /* kext-era descriptors reused */
+	uint64_t hashresumes;           /* hashing resumed after kext slices */
+	uint64_t buildunsigned;         /* unsigned without verification */
+	uint32_t opensperexec;          /* permille, since start */
+	uint64_t forks;                 /* fork events */
+	uint64_t reapsweeps;            /* reconciliations with running procs */
+	uint64_t reapstorms;            /* sweeps early due to fork storms */
+	uint64_t reaped;                /* procs evicted as not running */
+	uint64_t reclaims;              /* images freed in the background */
+	uint64_t trims;                 /* ancestors with argv and env trimmed */
+	uint32_t preloadq;              /* images held in the startup lane */
+	uint64_t preloaded;             /* submitted from the startup lane */
 	uint64_t miss_bypid;
 	uint64_t miss_forksubj;
 	uint64_t miss_execsubj;
@@ -37,13 +83,20 @@ typedef struct {
 	uint64_t miss_chdirsubj;
 	uint64_t miss_getcwd;
 	uint64_t ooms;
+	uint64_t vecbytes;              /* argv and envv of live images */
+	uint64_t fragbytes;             /* cached renderings of live images */
 	uint64_t pqsize;
+	uint64_t pqpeak;                /* since last procmon_peaks_reset */
 	uint64_t pqlookup;
 	uint64_t pqmiss;
 	uint64_t pqdrop;
 	uint64_t pqskip;
+	hist_t pqlat;                   /* usec from kext preexec to match */
+	proctab_stat_t pt;
 } procmon_stat_t;
 
+#define PROCMON_REAP_TICK       5       /* seconds, see procmon_reap */
+
 void procmon_fork(struct timespec *, audit_proc_t *, pid_t) NONNULL(1,2);
 void procmon_spawn(struct timespec *, audit_proc_t *, pid_t,
                    char *, audit_attr_t *, char **, char **) NONNULL(1,2);
@@ -52,14 +105,21 @@ void procmon_exec(struct timespec *, audit_proc_t *,
 void procmon_exit(struct timespec *, pid_t) NONNULL(1);
 void procmon_wait4(struct timespec *, pid_t) NONNULL(1);
 void procmon_chdir(struct timespec *tv, pid_t, char *) NONNULL(1,3);
+void procmon_reap(struct timespec *) NONNULL(1);
 
-void procmon_kern_preexec(struct timespec *, pid_t, const char *) NONNULL(1,3);
+void procmon_kern_preexec(struct timespec *, pid_t, const char *,
+                          const xnumon_msg_hash_t *,
+                          const xnumon_msg_ident_t *) NONNULL(1,3);
 
 void procmon_preloadpid(pid_t);
+void procmon_preload(pid_t *, int) NONNULL(1);
+size_t procmon_preload_drain(size_t);
 
 int procmon_init(config_t *) WUNRES NONNULL(1);
 void procmon_fini(void);
 void procmon_stats(procmon_stat_t *) NONNULL(1);
+uint64_t procmon_prepq_size(void);
+void procmon_peaks_reset(procmon_stat_t *) NONNULL(1);
 uint32_t procmon_images(void) WUNRES;
 const char * procmon_getcwd(pid_t, struct timespec *tv) WUNRES;
 
@@ -68,9 +128,13 @@ void procmon_socket_bind(int *, pid_t, int, ipaddr_t *, uint16_t)
      NONNULL(1,4);
 void procmon_socket_state(int *, ipaddr_t **, uint16_t *, pid_t, int)
      NONNULL(1,2);
+void procmon_socket_ignore(pid_t, int, struct timespec *) NONNULL(3);
 void procmon_file_open(audit_proc_t *, int, char *, struct timespec *)
      NONNULL(1,3,4);
 void procmon_fd_close(pid_t, int);
+void procmon_fds_drop(void);
+int procmon_snapshot_save(const char *, bool) NONNULL(1) WUNRES;
+int procmon_snapshot_load(const char *) NONNULL(1) WUNRES;
 
 /*
  * image_exec_t is both the data structure containing a snapshot of an
@@ -79,9 +143,28 @@ void procmon_fd_close(pid_t, int);
  * data doubly.  This reuse accounts for at least some of the complexity in
  * its implementation.
  */
+/*
+ * Rendering of an image as the image of a process, captured by one format
+ * context in one epoch at one indent level, most recently used first.
+ */
+typedef struct image_frag {
+	struct image_frag *next;
+	uint64_t epoch;
+	size_t level;
+	size_t sz;
+	char *buf; /* free */
+} image_frag_t;
+
 typedef struct image_exec {
 	logevt_header_t hdr;
 
+	/*
+	 * Hot fields, read by every lookup and every walk along prev, such
+	 * as pruning, trimming and suppression checks of ancestors.  Kept
+	 * together in IMAGE_EXEC_HOTSZ bytes right after the header, such
+	 * that a walk touches at most two cache lines per image; everything
+	 * below is only accessed when acquiring or logging the image itself.
+	 */
 	unsigned long flags;
 #define EIFLAG_PIDLOOKUP    0x0001UL  /* image created from pid lookup */
 #define EIFLAG_NOPATH       0x0002UL  /* external fetching failed, no path */
@@ -93,46 +176,111 @@ typedef struct image_exec {
 #define EIFLAG_ENOMEM       0x0080UL  /* set if parts missing due to ENOMEM */
 #define EIFLAG_NOLOG        0x0100UL  /* do not submit this for logging */
 #define EIFLAG_NOLOG_KIDS   0x0200UL  /* do not submit children to logging */
+#define EIFLAG_NOSHA256     0x0400UL  /* sha256 skipped, see degrade.h */
+#define EIFLAG_KEXTHASH     0x0800UL  /* sha256 provided by kext */
+#define EIFLAG_ENRICH       0x1000UL  /* acquisition logged as image-enrich */
+#define EIFLAG_FSBULK       0x2000UL  /* on a filesystem in fstypes_bulk */
+#define EIFLAG_FSSKIP       0x4000UL  /* on a filesystem in fstypes_skip */
+#define EIFLAG_SLICE        0x8000UL  /* native slice looked up, see slice */
+#define EIFLAG_UNSIGNED    0x10000UL  /* unsigned in known build tree */
+	pid_t pid;
+	bool trimmed;           /* argv and envv trimmed, main thread only */
+	bool held;              /* in the startup lane, main thread only */
+	atomic_bool logged;     /* own event logged or discarded */
+	/* set once stat, hashes and codesign are final and complete, for
+	 * reuse by repeated execs, see execcache_lookup() */
+	atomic_bool acquired;
+	/* origin image; shared with all other images of the same lineage,
+	 * held by a reference that pins the lineage for readers holding
+	 * this image, see logevt_process_image_exec_ancestors() */
+	struct image_exec *prev;
+	/* for interpreters, ptr to script file */
+	struct image_exec *script;
+	char *path; /* intern_free */
+	/* codesign results, or NULL */
+	codesign_t *codesign;
+	/* cached suppression verdicts, two bits per SUPPRESS_* rule set,
+	 * valid for the SUPPRESS_EPOCH stored in the upper bits */
+	atomic_uint suppress;
+	atomic64_t refs;        /* see image_exec_ref and image_exec_free */
+#define IMAGE_EXEC_HOTSZ 64
+
+	size_t depth;   /* upper bound of images linked via prev */
+	struct image_exec *reclaimnext; /* see image_exec_release() */
+
+	/* unique within this run of xnumon */
+	uint64_t id;
+
+	/* kext prep queue state, see prepq_append() */
+	uint64_t pqseq;
+	size_t pqttl;   /* ttl in excess of the next younger entry's ttl */
+	tommy_node pqnode;
+#define MAXPQTTL 16     /* maximum out-of-order window; for prioritizing
+                           kext versus audit consumption, see kesched.c */
 
-	/* open/analysis/close state */
+	/*
+	 * Open/analysis/close state.  Opened at most once per image by
+	 * image_exec_open, non-blocking while the kext is waiting for us.  The
+	 * descriptor is handed over with the image from the kext prep queue to
+	 * the audit exec event and on to the worker or enrichment thread, and
+	 * serves stat, shebang detection and hashing.  It is closed once
+	 * hashed; code signatures are evaluated by path, as the Security
+	 * framework has no descriptor-based static code API.  Images larger
+	 * than bulk_threshold are hashed in slices while the kext is waiting,
+	 * with the digest state kept in hctx until hashing completes on the
+	 * worker or bulk thread, see image_exec_hash().
+	 */
 	int fd;
+	hashes_ctx_t *hctx;
+
+	/* stat attrs if EIFLAG_STAT or EIFLAG_ATTR is set */
+	stat_attr_t stat;
 
 	/* exec data */
-	pid_t pid;
 	struct timespec fork_tv;
 	char **argv; /* free */
 	char **envv; /* free */
-	char *path; /* free */
-	char *cwd; /* free */
+	size_t vecsz;           /* bytes of argv and envv, for accounting */
+	char *cwd; /* intern_free */
 	audit_proc_t subject;
 
-	/* stat attrs if EIFLAG_STAT or EIFLAG_ATTR is set */
-	stat_attr_t stat;
-
 	/* hashes if EIFLAG_HASHES is set */
 	hashes_t hashes;
+	/* hash of the native slice of universal binaries, or NULL */
+	hashes_slice_t *slice; /* free */
 
-	/* codesign results, or NULL */
-	codesign_t *codesign;
+	/* record in the lineage snapshot of snapepoch, main thread only,
+	 * see procmon_snapshot_save() */
+	uint64_t snapepoch;
+	uint32_t snapidx;
 
-	/* for interpreters, ptr to script file */
-	struct image_exec *script;
-	/* origin image */
-	struct image_exec *prev;
+	/* cached renderings, log thread only, see logevt.c */
+	image_frag_t *frags; /* free */
+	uint64_t logepoch;      /* ctx epoch when last logged in full */
+} image_exec_t;
 
-	/* kext prep queue ttl */
-	size_t pqttl;
-#define MAXPQTTL 16     /* maximum out-of-order window and water level up to
-                           which the kextctl file descriptor will be drained
-                           with priority versus the auditpipe descriptor */
+_Static_assert(offsetof(image_exec_t, refs) + sizeof(atomic64_t) -
+               offsetof(image_exec_t, flags) <= IMAGE_EXEC_HOTSZ,
+               "image_exec_t hot fields exceed IMAGE_EXEC_HOTSZ");
 
-	size_t refs;
-	pthread_mutex_t refsmutex;
-} image_exec_t;
+#define SUPPRESS_IMAGE_EXEC             0
+#define SUPPRESS_ANCESTOR               1
+#define SUPPRESS_PROCESS_ACCESS         2
+#define SUPPRESS_SOCKET_OP              3
+#define SUPPRESS_VERDICTS               0xFFU   /* verdict bits of all sets */
+#define SUPPRESS_EPOCH_SHIFT            8
 
 image_exec_t * image_exec_by_pid(pid_t, struct timespec *tv) MALLOC NONNULL(2);
+image_exec_t * image_exec_peek(pid_t) WUNRES;
+bool image_exec_settled(image_exec_t *) NONNULL(1) WUNRES;
 void image_exec_free(image_exec_t *) NONNULL(1);
-bool image_exec_match_suppressions(image_exec_t *, setstr_t *, setstr_t *)
-     NONNULL(1,2,3) WUNRES;
+void image_exec_release(image_exec_t *) NONNULL(1);
+void image_exec_frags_free(image_exec_t *) NONNULL(1);
+void image_exec_frags_account(int64_t);
+bool image_exec_match_suppressions(image_exec_t *, int,
+                                   setstr_t *_Atomic *, setstr_t *_Atomic *)
+     NONNULL(1,3,4) WUNRES;
+bool image_exec_suppressed(image_exec_t *, int) NONNULL(1) WUNRES;
+void image_exec_suppressions_changed(void);
 
 #endif
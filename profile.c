@@ -0,0 +1,445 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "profile.h"
+
+#include "logevt.h"
+#include "minmax.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <assert.h>
+
+/*
+ * On-demand profiling for finding out where xnumon spends its time on a
+ * machine running a release build.  profile_start, called on SIGUSR2, opens
+ * a window of profile_duration seconds during which the pipeline stage
+ * stamps of every logged event, the hash and code signature cache lookups
+ * and the durations of hashing images and verifying code signatures are
+ * recorded into a preallocated ring.  Then the profile thread closes the
+ * window and writes a summary report with percentiles to PROFILE_PATH and
+ * all raw records to PROFILE_TRACE_PATH.
+ *
+ * Records are claimed by any number of threads using an atomic index and
+ * published using a per-record flag, such that recording takes no lock.
+ * Records beyond the size of the ring are dropped and counted.  While no
+ * window is open, the hooks cost a relaxed load and a branch, see
+ * profile_active, and the ring is only allocated on first use.
+ */
+
+#define PROFILE_RING            65536   /* records per window */
+
+typedef struct {
+	atomic_bool ready;
+	uint8_t kind;
+	uint8_t arg;                    /* eventcode, or cache hit */
+	uint64_t stamp[LOGEVT_STAMPS];  /* mononsec; begin and end for phases */
+} profile_rec_t;
+
+atomic_bool profile_running;
+
+static config_t *config;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_t thr;
+static bool started;                    /* thr needs joining */
+static bool done;                       /* thr finished writing */
+static bool stopping;
+static profile_rec_t *ring;
+static atomic_size_t head;
+static atomic_uint_fast64_t drops;
+static struct timespec begin_tv;
+static uint64_t begin;
+static uint64_t end;
+
+static const char *kind_names[PROFILE_KINDS] = {
+	"event", "hash", "codesign", "hashcache", "csigcache"
+};
+
+/* same as latency_names in logevt.c */
+static const char *stage_names[LOGEVT_STAMPS] = {
+	"audit", "workq", "work", "reorder", "logq", "log", "total"
+};
+
+void
+profile_init(config_t *cfg) {
+	config = cfg;
+	atomic_init(&profile_running, false);
+	atomic_init(&head, 0);
+	atomic_init(&drops, 0);
+}
+
+static profile_rec_t *
+profile_claim(int kind) {
+	profile_rec_t *rec;
+	size_t i;
+
+	i = atomic_fetch_add_explicit(&head, 1, memory_order_relaxed);
+	if (i >= PROFILE_RING) {
+		atomic_fetch_add_explicit(&drops, 1, memory_order_relaxed);
+		return NULL;
+	}
+	rec = &ring[i];
+	rec->kind = (uint8_t)kind;
+	return rec;
+}
+
+static void
+profile_publish(profile_rec_t *rec) {
+	atomic_store_explicit(&rec->ready, true, memory_order_release);
+}
+
+/*
+ * Record the stage stamps of an event that was logged.  Log thread only.
+ */
+void
+profile_event(int code, const uint64_t *stamp) {
+	profile_rec_t *rec;
+
+	if (!profile_active() || !(rec = profile_claim(PROFILE_EVENT)))
+		return;
+	rec->arg = (uint8_t)code;
+	memcpy(rec->stamp, stamp, sizeof(rec->stamp));
+	profile_publish(rec);
+}
+
+/*
+ * Record a phase that began at t0 as returned by profile_begin and ends
+ * now.  Phases that began before the window opened are not recorded.
+ */
+void
+profile_phase(int kind, uint64_t t0) {
+	profile_rec_t *rec;
+
+	if (!t0 || !profile_active() || !(rec = profile_claim(kind)))
+		return;
+	rec->arg = 0;
+	rec->stamp[0] = t0;
+	rec->stamp[1] = timespec_mononsec();
+	profile_publish(rec);
+}
+
+void
+profile_cache(int kind, bool hit) {
+	profile_rec_t *rec;
+
+	if (!profile_active() || !(rec = profile_claim(kind)))
+		return;
+	rec->arg = hit;
+	rec->stamp[0] = timespec_mononsec();
+	profile_publish(rec);
+}
+
+/*
+ * Usecs of series i of a record, or false if the record is not part of it.
+ * Series are the pipeline stages, followed by the total per eventcode,
+ * followed by the phases.
+ */
+#define SERIES_CODES    (LOGEVT_STAMPS)
+#define SERIES_PHASES   (SERIES_CODES + LOGEVT_SIZE)
+#define SERIES          (SERIES_PHASES + 2)
+
+static bool
+profile_value(profile_rec_t *rec, size_t i, uint64_t *usec) {
+	uint64_t *stamp = rec->stamp;
+	size_t a, b;
+
+	if (i >= SERIES_PHASES) {
+		if (rec->kind != (i == SERIES_PHASES ? PROFILE_HASH
+		                                     : PROFILE_CODESIGN))
+			return false;
+		a = 0;
+		b = 1;
+	} else if (rec->kind != PROFILE_EVENT) {
+		return false;
+	} else if (i >= SERIES_CODES) {
+		if (rec->arg != i - SERIES_CODES)
+			return false;
+		a = LOGEVT_STAMP_EVENT;
+		b = LOGEVT_STAMP_LOGGED;
+	} else if (i == LOGEVT_STAMPS - 1) {
+		a = LOGEVT_STAMP_EVENT;
+		b = LOGEVT_STAMP_LOGGED;
+	} else {
+		a = i;
+		b = i + 1;
+	}
+	if (!stamp[a] || !stamp[b] || stamp[b] < stamp[a])
+		return false;
+	*usec = (stamp[b] - stamp[a]) / 1000;
+	return true;
+}
+
+static int
+profile_cmp(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void
+profile_series(FILE *f, const char *label, uint64_t *v, size_t n) {
+	if (n == 0)
+		return;
+	qsort(v, n, sizeof(uint64_t), profile_cmp);
+	fprintf(f, "%-16s %8zu %10"PRIu64" %10"PRIu64" %10"PRIu64" %10"PRIu64
+	           "\n", label, n, v[(n - 1) * 50 / 100], v[(n - 1) * 90 / 100],
+	           v[(n - 1) * 99 / 100], v[n - 1]);
+}
+
+static FILE *
+profile_fopen(const char *path) {
+	FILE *f;
+	int fd;
+
+	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_NOFOLLOW|O_CLOEXEC, 0600);
+	if (fd == -1)
+		return NULL;
+	f = fdopen(fd, "w");
+	if (!f)
+		close(fd);
+	return f;
+}
+
+/*
+ * The report is renamed into place once complete, such that its appearance
+ * signals the end of profiling to xnumonctl.
+ */
+static int
+profile_write_report(size_t n) {
+	uint64_t *v;
+	uint64_t hits[PROFILE_KINDS], misses[PROFILE_KINDS];
+	char label[32], buf[20];
+	struct tm tm;
+	size_t m;
+	FILE *f;
+
+	v = malloc(max(n, (size_t)1) * sizeof(uint64_t));
+	if (!v)
+		return -1;
+	f = profile_fopen(PROFILE_PATH ".tmp");
+	if (!f) {
+		free(v);
+		return -1;
+	}
+
+	gmtime_r(&begin_tv.tv_sec, &tm);
+	strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+	fprintf(f, "start    %sZ\n", buf);
+	fprintf(f, "duration %"PRIu64" ms\n", (end - begin) / 1000000);
+	fprintf(f, "records  %zu\n", n);
+	fprintf(f, "dropped  %"PRIuFAST64"\n",
+	           atomic_load_explicit(&drops, memory_order_relaxed));
+
+	fprintf(f, "\n%-16s %8s %10s %10s %10s %10s\n", "usec", "count",
+	           "p50", "p90", "p99", "max");
+	for (size_t i = 0; i < SERIES; i++) {
+		m = 0;
+		for (size_t j = 0; j < n; j++) {
+			if (atomic_load_explicit(&ring[j].ready,
+			                         memory_order_acquire) &&
+			    profile_value(&ring[j], i, &v[m]))
+				m++;
+		}
+		if (i < SERIES_CODES)
+			snprintf(label, sizeof(label), "%s", stage_names[i]);
+		else if (i < SERIES_PHASES)
+			snprintf(label, sizeof(label), "total[%zu]",
+			         i - SERIES_CODES);
+		else
+			snprintf(label, sizeof(label), "%s",
+			         kind_names[i == SERIES_PHASES ?
+			                    PROFILE_HASH : PROFILE_CODESIGN]);
+		profile_series(f, label, v, m);
+	}
+
+	bzero(hits, sizeof(hits));
+	bzero(misses, sizeof(misses));
+	for (size_t j = 0; j < n; j++) {
+		profile_rec_t *rec = &ring[j];
+
+		if (!atomic_load_explicit(&rec->ready, memory_order_acquire) ||
+		    (rec->kind != PROFILE_HASHCACHE &&
+		     rec->kind != PROFILE_CSIGCACHE))
+			continue;
+		if (rec->arg)
+			hits[rec->kind]++;
+		else
+			misses[rec->kind]++;
+	}
+	fprintf(f, "\n%-16s %8s %10s\n", "cache", "hits", "misses");
+	for (size_t k = PROFILE_HASHCACHE; k < PROFILE_KINDS; k++)
+		fprintf(f, "%-16s %8"PRIu64" %10"PRIu64"\n", kind_names[k],
+		           hits[k], misses[k]);
+
+	free(v);
+	if (fclose(f) == EOF) {
+		(void)unlink(PROFILE_PATH ".tmp");
+		return -1;
+	}
+	return rename(PROFILE_PATH ".tmp", PROFILE_PATH);
+}
+
+/*
+ * One line per record with the kind, the eventcode or cache hit, and the
+ * stamps in nsec relative to the start of the window, - for missing stamps.
+ */
+static int
+profile_write_trace(size_t n) {
+	profile_rec_t *rec;
+	size_t nstamps;
+	FILE *f;
+
+	f = profile_fopen(PROFILE_TRACE_PATH);
+	if (!f)
+		return -1;
+	fprintf(f, "# kind arg stamps (nsec since start of profile)\n");
+	for (size_t j = 0; j < n; j++) {
+		rec = &ring[j];
+		if (!atomic_load_explicit(&rec->ready, memory_order_acquire))
+			continue;
+		switch (rec->kind) {
+		case PROFILE_EVENT:
+			nstamps = LOGEVT_STAMPS;
+			break;
+		case PROFILE_HASH:
+		case PROFILE_CODESIGN:
+			nstamps = 2;
+			break;
+		default:
+			nstamps = 1;
+			break;
+		}
+		fprintf(f, "%s %u", kind_names[rec->kind], rec->arg);
+		for (size_t i = 0; i < nstamps; i++) {
+			if (rec->stamp[i])
+				fprintf(f, " %"PRId64,
+				           (int64_t)(rec->stamp[i] - begin));
+			else
+				fprintf(f, " -");
+		}
+		fputc('\n', f);
+	}
+	return fclose(f) == EOF ? -1 : 0;
+}
+
+static void *
+profile_thread(UNUSED void *arg) {
+	struct timespec ts;
+	size_t n;
+
+	pthread_mutex_lock(&mutex);
+	if (timespec_nanotime(&ts) == 0) {
+		timespec_add_msec(&ts, config->profile_duration * 1000);
+		while (!stopping) {
+			if (pthread_cond_timedwait(&cond, &mutex, &ts) ==
+			    ETIMEDOUT)
+				break;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+
+	atomic_store(&profile_running, false);
+	end = timespec_mononsec();
+	n = min(atomic_load(&head), (size_t)PROFILE_RING);
+	if (profile_write_trace(n) == -1 || profile_write_report(n) == -1)
+		fprintf(stderr, "Failed to write profile: %s (%i)\n",
+		                strerror(errno), errno);
+	else
+		fprintf(stderr, "Profile written to %s\n", PROFILE_PATH);
+
+	pthread_mutex_lock(&mutex);
+	done = true;
+	pthread_mutex_unlock(&mutex);
+	return NULL;
+}
+
+/*
+ * Open a profiling window of profile_duration seconds.  Returns -1 with
+ * errno EBUSY if a window is open or its profile is still being written.
+ */
+int
+profile_start(void) {
+	assert(config);
+
+	pthread_mutex_lock(&mutex);
+	if (started) {
+		if (!done) {
+			pthread_mutex_unlock(&mutex);
+			errno = EBUSY;
+			return -1;
+		}
+		(void)pthread_join(thr, NULL);
+		started = false;
+	}
+	if (!ring) {
+		ring = calloc(PROFILE_RING, sizeof(profile_rec_t));
+		if (!ring) {
+			pthread_mutex_unlock(&mutex);
+			return -1;
+		}
+	} else {
+		for (size_t i = 0; i < PROFILE_RING; i++)
+			atomic_store_explicit(&ring[i].ready, false,
+			                      memory_order_relaxed);
+	}
+	atomic_store(&head, 0);
+	atomic_store(&drops, 0);
+	if (timespec_nanotime(&begin_tv) == -1) {
+		pthread_mutex_unlock(&mutex);
+		return -1;
+	}
+	begin = timespec_mononsec();
+	stopping = false;
+	done = false;
+	atomic_store(&profile_running, true);
+	if (pthread_create(&thr, NULL, profile_thread, NULL) != 0) {
+		atomic_store(&profile_running, false);
+		pthread_mutex_unlock(&mutex);
+		return -1;
+	}
+	started = true;
+	pthread_mutex_unlock(&mutex);
+	return 0;
+}
+
+/*
+ * Close an open window early, writing out what was recorded so far.  Must be
+ * called after all threads recording into the ring have stopped.
+ */
+void
+profile_fini(void) {
+	pthread_mutex_lock(&mutex);
+	stopping = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+	if (started) {
+		if (pthread_join(thr, NULL) != 0) {
+			fprintf(stderr, "Failed to join profile thread - "
+			                "exiting\n");
+			exit(EXIT_FAILURE);
+		}
+		started = false;
+	}
+	atomic_store(&profile_running, false);
+	free(ring);
+	ring = NULL;
+	config = NULL;
+}
+
@@ -0,0 +1,55 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "config.h"
+#include "attrib.h"
+#include "time.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define PROFILE_PATH            "/var/run/xnumon.profile"
+#define PROFILE_TRACE_PATH      PROFILE_PATH ".trace"
+
+/* kinds of records */
+#define PROFILE_EVENT           0       /* stage stamps of a logged event */
+#define PROFILE_HASH            1       /* hashing an image */
+#define PROFILE_CODESIGN        2       /* verifying a code signature */
+#define PROFILE_HASHCACHE       3       /* hash cache lookup */
+#define PROFILE_CSIGCACHE       4       /* code signature cache lookup */
+#define PROFILE_KINDS           5
+
+extern atomic_bool profile_running;
+
+/*
+ * True while a profiling window is open, may be called from any thread.
+ */
+#define profile_active() \
+	atomic_load_explicit(&profile_running, memory_order_relaxed)
+
+/*
+ * Start of a phase for profile_phase, 0 while not profiling.
+ */
+#define profile_begin() \
+	(profile_active() ? timespec_mononsec() : 0)
+
+void profile_init(config_t *) NONNULL(1);
+void profile_fini(void);
+int profile_start(void) WUNRES;
+void profile_event(int, const uint64_t *) NONNULL(2);
+void profile_phase(int, uint64_t);
+void profile_cache(int, bool);
+
+#endif
+
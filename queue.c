@@ -10,62 +10,339 @@
 
 #include "queue.h"
 
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <assert.h>
 
 /*
- * Single producer, single consumer queue, thread-safe.
- * Draining is handled externally by sending a sentinel down the queue.
+ * Bounded multi producer, multi consumer ring queue, thread-safe.
+ * Draining is handled externally by sending a sentinel down the queue
+ * using queue_enqueue_wait, which never drops.
+ *
+ * Enqueue and dequeue are lock-free using per-slot sequence numbers.  The
+ * mutex and condition variables are only used to park consumers on an empty
+ * queue and producers on a full queue with the QUEUE_BLOCK policy; the fast
+ * path does not make any syscalls.  Consumers spin for a short while before
+ * parking, producers only take the mutex if a consumer is actually parked.
  */
 
-void
-queue_init(queue_t *queue) {
-	int rv;
+#define QUEUE_SPIN 256
+
+static atomic_size_t queue_bytes;       /* slots of all queues */
+
+int
+queue_init(queue_t *queue, size_t size, int policy, queue_drop_func_t drop) {
+	size_t n;
 
 	assert(queue);
-	tommy_list_init(&queue->list);
-	rv = pthread_mutex_init(&queue->mutex, NULL);
-	assert(rv == 0);
-	rv = pthread_cond_init(&queue->notempty, NULL);
-	assert(rv == 0);
-	queue->size = 0;
+	assert(policy == QUEUE_BLOCK || drop);
+	assert(size > 1);
+
+	for (n = 2; n < size; n <<= 1);
+	queue->slots = malloc(n * sizeof(queue_slot_t));
+	if (!queue->slots)
+		return -1;
+	for (size_t i = 0; i < n; i++) {
+		atomic_init(&queue->slots[i].seq, i);
+		queue->slots[i].data = NULL;
+	}
+	queue->mask = n - 1;
+	queue->policy = policy;
+	queue->drop = drop;
+	atomic_init(&queue->enqpos, 0);
+	atomic_init(&queue->deqpos, 0);
+	atomic_init(&queue->consumers_parked, 0);
+	atomic_init(&queue->producers_parked, 0);
+	atomic_init(&queue->drops, 0);
+	atomic_init(&queue->blocks, 0);
+	atomic_init(&queue->peak, 0);
+	if (pthread_mutex_init(&queue->mutex, NULL) != 0)
+		goto errout1;
+	if (pthread_cond_init(&queue->notempty, NULL) != 0)
+		goto errout2;
+	if (pthread_cond_init(&queue->notfull, NULL) != 0)
+		goto errout3;
+	atomic_fetch_add_explicit(&queue_bytes, n * sizeof(queue_slot_t),
+	                          memory_order_relaxed);
+	return 0;
+
+errout3:
+	(void)pthread_cond_destroy(&queue->notempty);
+errout2:
+	(void)pthread_mutex_destroy(&queue->mutex);
+errout1:
+	free(queue->slots);
+	queue->slots = NULL;
+	return -1;
 }
 
 void
 queue_destroy(queue_t *queue) {
 	assert(queue);
+	(void)pthread_cond_destroy(&queue->notfull);
 	(void)pthread_cond_destroy(&queue->notempty);
 	(void)pthread_mutex_destroy(&queue->mutex);
+	if (!queue->slots)
+		return;
+	atomic_fetch_sub_explicit(&queue_bytes,
+	                          (queue->mask + 1) * sizeof(queue_slot_t),
+	                          memory_order_relaxed);
+	free(queue->slots);
+	queue->slots = NULL;
+}
+
+/*
+ * Bytes currently allocated for the slots of all queues.  Thread-safe.
+ */
+size_t
+queue_reserved(void) {
+	return atomic_load_explicit(&queue_bytes, memory_order_relaxed);
+}
+
+/*
+ * Returns 0 on success, -1 if the queue is full.
+ */
+static int
+queue_try_enqueue(queue_t *queue, void *data) {
+	queue_slot_t *slot;
+	size_t pos, seq;
+	intptr_t dif;
+
+	pos = atomic_load_explicit(&queue->enqpos, memory_order_relaxed);
+	for (;;) {
+		slot = &queue->slots[pos & queue->mask];
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		dif = (intptr_t)seq - (intptr_t)pos;
+		if (dif == 0) {
+			if (atomic_compare_exchange_weak_explicit(
+			    &queue->enqpos, &pos, pos + 1,
+			    memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (dif < 0) {
+			return -1;
+		} else {
+			pos = atomic_load_explicit(&queue->enqpos,
+			                           memory_order_relaxed);
+		}
+	}
+	slot->data = data;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+	return 0;
+}
+
+/*
+ * Returns the dequeued item or NULL if the queue is empty.
+ */
+static void *
+queue_try_dequeue(queue_t *queue) {
+	queue_slot_t *slot;
+	size_t pos, seq;
+	intptr_t dif;
+	void *data;
+
+	pos = atomic_load_explicit(&queue->deqpos, memory_order_relaxed);
+	for (;;) {
+		slot = &queue->slots[pos & queue->mask];
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		dif = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (dif == 0) {
+			if (atomic_compare_exchange_weak_explicit(
+			    &queue->deqpos, &pos, pos + 1,
+			    memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (dif < 0) {
+			return NULL;
+		} else {
+			pos = atomic_load_explicit(&queue->deqpos,
+			                           memory_order_relaxed);
+		}
+	}
+	data = slot->data;
+	atomic_store_explicit(&slot->seq, pos + queue->mask + 1,
+	                      memory_order_release);
+	return data;
 }
 
+/*
+ * The fences pair with the ones in queue_dequeue and queue_enqueue_wait,
+ * such that either the parked side sees the slot change or the other side
+ * sees the parked counter and signals.
+ */
+static void
+queue_wakeup(queue_t *queue, atomic_uint *parked, pthread_cond_t *cond) {
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(parked, memory_order_relaxed) == 0)
+		return;
+	pthread_mutex_lock(&queue->mutex);
+	pthread_cond_broadcast(cond);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+/*
+ * Enqueue data, waiting for free space if the queue is full regardless of
+ * the configured policy.
+ */
 void
-queue_enqueue(queue_t *queue, tommy_node *node, void *data) {
+queue_enqueue_wait(queue_t *queue, void *data) {
 	assert(queue);
-	assert(node);
 	assert(data);
 
-	pthread_mutex_lock(&queue->mutex);
-	tommy_list_insert_tail(&queue->list, node, data);
-	queue->size++;
-	pthread_mutex_unlock(&queue->mutex);
-	pthread_cond_signal(&queue->notempty);
+	if (queue_try_enqueue(queue, data) == -1) {
+		atomic_fetch_add_explicit(&queue->blocks, 1,
+		                          memory_order_relaxed);
+		pthread_mutex_lock(&queue->mutex);
+		atomic_fetch_add(&queue->producers_parked, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		while (queue_try_enqueue(queue, data) == -1)
+			pthread_cond_wait(&queue->notfull, &queue->mutex);
+		atomic_fetch_sub(&queue->producers_parked, 1);
+		pthread_mutex_unlock(&queue->mutex);
+	}
+	queue_wakeup(queue, &queue->consumers_parked, &queue->notempty);
+}
+
+/*
+ * Enqueue data, applying the overflow policy if the queue is full.
+ * Returns 0 if data was enqueued, -1 if data was dropped.  Dropped items are
+ * passed to the drop function, both for QUEUE_DROP_NEWEST and for
+ * QUEUE_DROP_OLDEST.
+ */
+int
+queue_enqueue(queue_t *queue, void *data) {
+	void *old;
+
+	assert(queue);
+	assert(data);
+
+	switch (queue->policy) {
+	case QUEUE_DROP_NEWEST:
+		if (queue_try_enqueue(queue, data) == -1) {
+			atomic_fetch_add_explicit(&queue->drops, 1,
+			                          memory_order_relaxed);
+			queue->drop(data);
+			return -1;
+		}
+		break;
+	case QUEUE_DROP_OLDEST:
+		while (queue_try_enqueue(queue, data) == -1) {
+			old = queue_try_dequeue(queue);
+			if (old) {
+				atomic_fetch_add_explicit(&queue->drops, 1,
+				                          memory_order_relaxed);
+				queue->drop(old);
+			}
+		}
+		break;
+	case QUEUE_BLOCK:
+	default:
+		queue_enqueue_wait(queue, data);
+		return 0;
+	}
+	queue_wakeup(queue, &queue->consumers_parked, &queue->notempty);
+	return 0;
+}
+
+/*
+ * Track the high-water mark of the queue depth.  Sampled by consumers once
+ * per batch, which keeps the producer fast path untouched; a consumer that
+ * falls behind sees the full depth on its next dequeue.
+ */
+static void
+queue_peak_update(queue_t *queue) {
+	size_t depth, peak;
+
+	depth = queue_size(queue) + 1;
+	peak = atomic_load_explicit(&queue->peak, memory_order_relaxed);
+	while (depth > peak && !atomic_compare_exchange_weak_explicit(
+	    &queue->peak, &peak, depth,
+	    memory_order_relaxed, memory_order_relaxed));
+}
+
+/*
+ * Dequeue up to max items into datav, waiting for at least one item.
+ * Returns the number of items dequeued, which is always at least one.
+ */
+size_t
+queue_dequeue_batch(queue_t *queue, void **datav, size_t max) {
+	size_t n;
+	void *data;
+
+	assert(queue);
+	assert(datav);
+	assert(max > 0);
+
+	data = queue_try_dequeue(queue);
+	for (int i = 0; !data && i < QUEUE_SPIN; i++) {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+		data = queue_try_dequeue(queue);
+	}
+	if (!data) {
+		pthread_mutex_lock(&queue->mutex);
+		atomic_fetch_add(&queue->consumers_parked, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		while (!(data = queue_try_dequeue(queue)))
+			pthread_cond_wait(&queue->notempty, &queue->mutex);
+		atomic_fetch_sub(&queue->consumers_parked, 1);
+		pthread_mutex_unlock(&queue->mutex);
+	}
+	queue_peak_update(queue);
+	datav[0] = data;
+	for (n = 1; n < max; n++) {
+		datav[n] = queue_try_dequeue(queue);
+		if (!datav[n])
+			break;
+	}
+	queue_wakeup(queue, &queue->producers_parked, &queue->notfull);
+	return n;
 }
 
 void *
 queue_dequeue(queue_t *queue) {
 	void *data;
 
+	(void)queue_dequeue_batch(queue, &data, 1);
+	return data;
+}
+
+/*
+ * Dequeue one item without waiting.  Returns NULL if the queue is empty.
+ */
+void *
+queue_dequeue_nowait(queue_t *queue) {
+	void *data;
+
 	assert(queue);
-	pthread_mutex_lock(&queue->mutex);
-	while (tommy_list_empty(&queue->list)) {
-		pthread_cond_wait(&queue->notempty, &queue->mutex);
+
+	data = queue_try_dequeue(queue);
+	if (data) {
+		queue_peak_update(queue);
+		queue_wakeup(queue, &queue->producers_parked, &queue->notfull);
 	}
-	assert(!tommy_list_empty(&queue->list));
-	assert(queue->size > 0);
-	data = tommy_list_remove_existing(&queue->list,
-	                                  tommy_list_head(&queue->list));
-	queue->size--;
-	pthread_mutex_unlock(&queue->mutex);
-	assert(data);
 	return data;
 }
 
+/*
+ * Approximate number of items in the queue.  Reading deqpos before enqpos
+ * ensures that the result never underflows.
+ */
+size_t
+queue_size(queue_t *queue) {
+	size_t deq, enq;
+
+	deq = atomic_load_explicit(&queue->deqpos, memory_order_acquire);
+	enq = atomic_load_explicit(&queue->enqpos, memory_order_acquire);
+	return enq - deq;
+}
+
+/*
+ * Returns the high-water mark of the queue depth since the last reset and
+ * starts a new period.
+ */
+size_t
+queue_peak_reset(queue_t *queue) {
+	return atomic_exchange_explicit(&queue->peak, queue_size(queue),
+	                                memory_order_relaxed);
+}
@@ -13,22 +13,62 @@
 
 #include "attrib.h"
 
-#include "tommylist.h"
-
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <pthread.h>
 
+#define QUEUE_CACHELINE 64
+#define QUEUE_CAPACITY_MAX      (1 << 24)
+
+/* overflow policies */
+#define QUEUE_BLOCK             0       /* producer waits for free space */
+#define QUEUE_DROP_OLDEST       1       /* drop oldest queued item */
+#define QUEUE_DROP_NEWEST       2       /* drop item being enqueued */
+
+typedef void (*queue_drop_func_t)(void *);
+
+typedef struct {
+	atomic_size_t seq;
+	void *data;
+} queue_slot_t;
+
 typedef struct {
-	tommy_list      list;
+	_Alignas(QUEUE_CACHELINE)
+	atomic_size_t   enqpos;
+	_Alignas(QUEUE_CACHELINE)
+	atomic_size_t   deqpos;
+	_Alignas(QUEUE_CACHELINE)
+	queue_slot_t *  slots;
+	size_t          mask;
+	int             policy;
+	queue_drop_func_t drop;
+	atomic_uint     consumers_parked;
+	atomic_uint     producers_parked;
 	pthread_mutex_t mutex;
 	pthread_cond_t  notempty;
-	size_t          size;
+	pthread_cond_t  notfull;
+	atomic_uint_fast64_t drops;
+	atomic_uint_fast64_t blocks;
+	atomic_size_t   peak;           /* highest depth seen by consumers */
 } queue_t;
 
-void queue_init(queue_t *) NONNULL(1);
+int queue_init(queue_t *, size_t, int, queue_drop_func_t) NONNULL(1) WUNRES;
 void queue_destroy(queue_t *) NONNULL(1);
-void queue_enqueue(queue_t *, tommy_node *, void *) NONNULL(1,2,3);
+int queue_enqueue(queue_t *, void *) NONNULL(1,2);
+void queue_enqueue_wait(queue_t *, void *) NONNULL(1,2);
 void * queue_dequeue(queue_t *) NONNULL(1);
-#define queue_size(Q) (Q)->size
+void * queue_dequeue_nowait(queue_t *) NONNULL(1);
+size_t queue_dequeue_batch(queue_t *, void **, size_t) NONNULL(1,2);
+size_t queue_size(queue_t *) NONNULL(1);
+size_t queue_peak_reset(queue_t *) NONNULL(1);
+size_t queue_reserved(void) WUNRES;
+#define queue_drops(Q) \
+	atomic_load_explicit(&(Q)->drops, memory_order_relaxed)
+#define queue_blocks(Q) \
+	atomic_load_explicit(&(Q)->blocks, memory_order_relaxed)
+#define queue_peak(Q) \
+	atomic_load_explicit(&(Q)->peak, memory_order_relaxed)
 
 #endif
 
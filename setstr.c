@@ -10,32 +10,203 @@
 
 /*
  * setstr - static set of strings
+ *
+ * Since the sets never change after setstr_init(), lookups use a minimal
+ * perfect hash built at init time following the CHD (compress, hash and
+ * displace) scheme:  the 64 bit hash of a string selects one of about n/4
+ * buckets, and the displacement stored for that bucket selects the one slot
+ * out of n the string can be in.  Displacements are searched for the buckets
+ * in order of decreasing size, so that the large buckets are placed while
+ * most slots are still free.  A lookup thus costs one hash and one string
+ * comparison at most, and absent strings are usually rejected by their
+ * first byte, their length or the hash stored in the slot without any
+ * string comparison.
  */
 
 #include "setstr.h"
 
-#include "tommy_ext.h"
+#include "tommyhash.h"
 
 #include <assert.h>
 #include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
+
+#define SETSTR_LAMBDA   4               /* average strings per bucket */
+#define SETSTR_DISP_MAX (1U << 24)      /* displacements tried per bucket */
+#define SETSTR_SEEDS    8               /* hash seeds tried */
 
-typedef struct setstr_obj {
-	tommy_hashtable_node h_node;
-	char *str;
-} setstr_obj_t;
+static inline size_t
+setstr_slot_of(uint64_t h, uint32_t d, size_t slots_size) {
+	return (size_t)(tommy_inthash_u64(h ^ (d * 0x9E3779B97F4A7C15ULL)) %
+	                slots_size);
+}
 
 static int
-setstr_obj_cmp(const void *str, const void *vobj) {
-	const setstr_obj_t *obj = vobj;
-	return strcmp(obj->str, str);
+setstr_str_cmp(const void *a, const void *b) {
+	return strcmp(*(char * const *)a, *(char * const *)b);
 }
 
+static int
+setstr_prefix_cmp(const void *a, const void *b) {
+	return strcmp(((const setstr_prefix_t *)a)->str,
+	              ((const setstr_prefix_t *)b)->str);
+}
+
+/*
+ * Sort the directory prefixes and drop all that are covered by a shorter
+ * prefix.  Afterwards no prefix is a prefix of another, which allows
+ * setstr_contains_path() to find the only candidate by binary search:  any
+ * string sorting between a prefix and a path it is a prefix of also shares
+ * that prefix.
+ */
 static void
-setstr_obj_free(void *vobj) {
-	setstr_obj_t *obj = vobj;
-	free(obj->str);
-	free(obj);
+setstr_prefixes_compact(setstr_t *this) {
+	size_t n = 0;
+
+	if (this->prefixes_size == 0)
+		return;
+	qsort(this->prefixes, this->prefixes_size, sizeof(setstr_prefix_t),
+	      setstr_prefix_cmp);
+	for (size_t i = 1; i < this->prefixes_size; i++) {
+		if (!strncmp(this->prefixes[n].str, this->prefixes[i].str,
+		             this->prefixes[n].len))
+			continue;
+		this->prefixes[++n] = this->prefixes[i];
+	}
+	this->prefixes_size = n + 1;
+}
+
+typedef struct {
+	size_t *count;                  /* strings per bucket */
+	size_t *start;                  /* offset of bucket in keys */
+	size_t *keys;                   /* string indices grouped by bucket */
+	size_t *order;                  /* buckets by decreasing size */
+	uint64_t *hash;                 /* per string */
+	size_t *slot;                   /* tentative slots of a bucket */
+	unsigned char *taken;           /* per slot */
+} setstr_build_t;
+
+/*
+ * Try to find displacements for all buckets with the current seed.  Returns
+ * -1 if a bucket cannot be placed, which calls for another seed.
+ */
+static int
+setstr_displace(setstr_t *this, setstr_build_t *b, char **strs) {
+	size_t n = this->slots_size;
+	size_t nb = this->disp_size;
+	size_t maxcount = 0;
+	size_t o;
+
+	bzero(b->count, nb * sizeof(size_t));
+	for (size_t i = 0; i < n; i++) {
+		b->hash[i] = tommy_hash_u64(this->seed, strs[i],
+		                            strlen(strs[i]));
+		b->count[b->hash[i] % nb]++;
+	}
+	b->start[0] = 0;
+	for (size_t i = 1; i < nb; i++)
+		b->start[i] = b->start[i - 1] + b->count[i - 1];
+	for (size_t i = 0; i < nb; i++)
+		b->order[i] = b->start[i];
+	for (size_t i = 0; i < n; i++)
+		b->keys[b->order[b->hash[i] % nb]++] = i;
+	/* bucket sizes are small, order them by counting */
+	for (size_t i = 0; i < nb; i++) {
+		if (b->count[i] > maxcount)
+			maxcount = b->count[i];
+	}
+	o = 0;
+	for (size_t c = maxcount; c > 0; c--) {
+		for (size_t i = 0; i < nb; i++) {
+			if (b->count[i] == c)
+				b->order[o++] = i;
+		}
+	}
+	bzero(b->taken, n);
+	bzero(this->disp, nb * sizeof(uint32_t));
+
+	for (size_t i = 0; i < o; i++) {
+		size_t bucket = b->order[i];
+		size_t *keys = &b->keys[b->start[bucket]];
+		size_t count = b->count[bucket];
+		uint32_t d;
+		size_t k;
+
+		/* strings with equal hashes can never be told apart */
+		for (size_t j = 1; j < count; j++) {
+			for (k = 0; k < j; k++) {
+				if (b->hash[keys[j]] == b->hash[keys[k]])
+					return -1;
+			}
+		}
+		for (d = 0; d < SETSTR_DISP_MAX; d++) {
+			for (k = 0; k < count; k++) {
+				b->slot[k] = setstr_slot_of(b->hash[keys[k]],
+				                            d, n);
+				if (b->taken[b->slot[k]])
+					break;
+				b->taken[b->slot[k]] = 1;
+			}
+			if (k == count)
+				break;
+			while (k-- > 0)
+				b->taken[b->slot[k]] = 0;
+		}
+		if (d == SETSTR_DISP_MAX)
+			return -1;
+		this->disp[bucket] = d;
+		for (k = 0; k < count; k++) {
+			this->slots[b->slot[k]].str = strs[keys[k]];
+			this->slots[b->slot[k]].len = strlen(strs[keys[k]]);
+			this->slots[b->slot[k]].hash = b->hash[keys[k]];
+		}
+	}
+	return 0;
+}
+
+/*
+ * Build the perfect hash over the n distinct strings in strs and take
+ * ownership of them.  On errors, the strings remain owned by the caller.
+ */
+static int
+setstr_build(setstr_t *this, char **strs, size_t n) {
+	setstr_build_t b;
+	int rv = -1;
+
+	this->slots_size = n;
+	this->disp_size = (n + SETSTR_LAMBDA - 1) / SETSTR_LAMBDA;
+	this->slots = calloc(n, sizeof(setstr_slot_t));
+	this->disp = malloc(this->disp_size * sizeof(uint32_t));
+	bzero(&b, sizeof(b));
+	b.count = malloc(this->disp_size * sizeof(size_t));
+	b.start = malloc(this->disp_size * sizeof(size_t));
+	b.order = malloc(this->disp_size * sizeof(size_t));
+	b.keys = malloc(n * sizeof(size_t));
+	b.hash = malloc(n * sizeof(uint64_t));
+	b.slot = malloc(n * sizeof(size_t));
+	b.taken = malloc(n);
+	if (!this->slots || !this->disp || !b.count || !b.start ||
+	    !b.order || !b.keys || !b.hash || !b.slot || !b.taken)
+		goto out;
+
+	for (this->seed = 0; this->seed < SETSTR_SEEDS; this->seed++) {
+		if (setstr_displace(this, &b, strs) == 0) {
+			rv = 0;
+			goto out;
+		}
+	}
+	errno = EINVAL;
+out:
+	free(b.count);
+	free(b.start);
+	free(b.order);
+	free(b.keys);
+	free(b.hash);
+	free(b.slot);
+	free(b.taken);
+	return rv;
 }
 
 /*
@@ -44,53 +215,89 @@ setstr_obj_free(void *vobj) {
  */
 int
 setstr_init(setstr_t *this, size_t buckets, char **strings) {
-	this->bucket_max = bucket_max_for_buckets(buckets);
+	size_t n;
+
+	bzero(this, sizeof(setstr_t));
 	this->size = buckets;
 	if (buckets == 0) {
-		assert(this->bucket_max == 0);
 		assert(strings == NULL);
 		return 0;
 	}
 
-	tommy_hashtable_init(&this->hashtable, this->bucket_max);
-
+	/* sorting brings duplicates together and the prefixes in order */
+	qsort(strings, buckets, sizeof(char *), setstr_str_cmp);
+	n = 0;
 	for (size_t i = 0; i < buckets; i++) {
-		setstr_obj_t *obj;
-		tommy_hash_t h;
-
-		if (setstr_contains(this, strings[i])) {
+		if (n > 0 && !strcmp(strings[n - 1], strings[i])) {
 			free(strings[i]);
+			strings[i] = NULL;
 			continue;
 		}
-		obj = malloc(sizeof(setstr_obj_t));
-		if (!obj)
-			goto errout;
-		obj->str = strings[i];
-		strings[i] = NULL;
-		h = tommy_strhash_u32(0, obj->str);
-		tommy_hashtable_insert(&this->hashtable, &obj->h_node,
-		                       obj, h);
+		strings[n] = strings[i];
+		if (n != i)
+			strings[i] = NULL;
+		n++;
+	}
+
+	this->prefixes = malloc(n * sizeof(setstr_prefix_t));
+	if (!this->prefixes)
+		goto errout;
+	this->minlen = SIZE_MAX;
+	for (size_t i = 0; i < n; i++) {
+		unsigned char c = (unsigned char)strings[i][0];
+		size_t len = strlen(strings[i]);
+
+		this->first[c >> 6] |= 1ULL << (c & 63);
+		if (len < this->minlen)
+			this->minlen = len;
+		if (len > this->maxlen)
+			this->maxlen = len;
+		if (strchr(strings[i], '@'))
+			this->scoped = true;
+		if (len > 0 && strings[i][len - 1] == '/') {
+			this->prefixes[this->prefixes_size].str = strings[i];
+			this->prefixes[this->prefixes_size].len = len;
+			this->prefixes_size++;
+		}
 	}
-	if (strings)
-		free(strings);
+	setstr_prefixes_compact(this);
+	if (setstr_build(this, strings, n) == -1)
+		goto errout;
+	free(strings);
 	return 0;
 errout:
 	for (size_t i = 0; i < buckets; i++) {
 		if (strings[i])
 			free(strings[i]);
 	}
-	if (strings)
-		free(strings);
+	free(strings);
+	free(this->slots);
+	free(this->disp);
+	free(this->prefixes);
+	bzero(this, sizeof(setstr_t));
 	return -1;
 }
 
 bool
 setstr_contains(setstr_t *this, const char *str) {
-	if (this->bucket_max == 0)
+	unsigned char c = (unsigned char)str[0];
+	const setstr_slot_t *slot;
+	size_t len;
+	uint64_t h;
+
+	if (this->slots_size == 0)
+		return false;
+	if (!(this->first[c >> 6] & (1ULL << (c & 63))))
+		return false;
+	len = strlen(str);
+	if (len < this->minlen || len > this->maxlen)
 		return false;
 
-	return tommy_hashtable_search(&this->hashtable, setstr_obj_cmp, str,
-	                              tommy_strhash_u32(0, str));
+	h = tommy_hash_u64(this->seed, str, len);
+	slot = &this->slots[setstr_slot_of(h, this->disp[h % this->disp_size],
+	                                   this->slots_size)];
+	return slot->hash == h && slot->len == len &&
+	       !memcmp(slot->str, str, len);
 }
 
 /*
@@ -98,22 +305,77 @@ setstr_contains(setstr_t *this, const char *str) {
  */
 bool
 setstr_contains3(setstr_t *this, const char *str, const char *scope) {
-	if (this->bucket_max == 0)
+	if (this->slots_size == 0)
 		return false;
 
 	/* TODO May be further optimized by keeping track of whether setstr
-	 * contains no scoped entries, or setstr contains only scoped entries,
-	 * and skipping the respective lookup accordingly */
-	if (scope) {
-		const size_t sz = strlen(str) + strlen(scope) + 2;
+	 * contains only scoped entries and skipping the unscoped lookup;
+	 * that requires that no unscoped entry contains '@' */
+	if (scope && this->scoped) {
+		const size_t len = strlen(str);
+		const size_t sz = len + strlen(scope) + 2;
 		char key[sz];
-		snprintf(key, sz, "%s@%s", str, scope);
+		memcpy(key, str, len);
+		key[len] = '@';
+		memcpy(key + len + 1, scope, sz - len - 1);
 		if (setstr_contains(this, key))
 			return true;
 	}
 	return setstr_contains(this, str);
 }
 
+/*
+ * Version of setstr_contains() for absolute paths:  in addition to exact
+ * matches, entries ending in '/' match all paths beneath that directory.
+ */
+bool
+setstr_contains_path(setstr_t *this, const char *path) {
+	size_t lo, hi, mid;
+
+	if (this->slots_size == 0)
+		return false;
+	if (setstr_contains(this, path))
+		return true;
+
+	/* find the last prefix sorting before or equal to path */
+	lo = 0;
+	hi = this->prefixes_size;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(this->prefixes[mid].str, path) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return false;
+	return !strncmp(this->prefixes[lo - 1].str, path,
+	                this->prefixes[lo - 1].len);
+}
+
+static bool
+setstr_subset(setstr_t *this, setstr_t *other) {
+	for (size_t i = 0; i < this->slots_size; i++) {
+		if (!setstr_contains(other, this->slots[i].str))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Return true iff both sets contain the same strings.  Sets built from lists
+ * with a different number of duplicates are reported as different, which is
+ * safe for deciding whether a set needs to be replaced.
+ */
+bool
+setstr_equal(setstr_t *this, setstr_t *other) {
+	if (this->size != other->size)
+		return false;
+	if (this->slots_size != other->slots_size)
+		return false;
+	return setstr_subset(this, other) && setstr_subset(other, this);
+}
+
 size_t
 setstr_size(setstr_t *this) {
 	return this->size;
@@ -125,10 +387,14 @@ setstr_size(setstr_t *this) {
  */
 void
 setstr_destroy(setstr_t *this) {
-	if (this->bucket_max != 0) {
-		tommy_hashtable_foreach(&this->hashtable, setstr_obj_free);
-		tommy_hashtable_done(&this->hashtable);
-	}
+	for (size_t i = 0; i < this->slots_size; i++)
+		free(this->slots[i].str);
+	if (this->slots)
+		free(this->slots);
+	if (this->disp)
+		free(this->disp);
+	if (this->prefixes)
+		free(this->prefixes);
 	bzero(this, sizeof(setstr_t));
 }
 
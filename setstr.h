@@ -13,21 +13,45 @@
 
 #include "attrib.h"
 
-#include "tommyhashtbl.h"
-
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 
+typedef struct setstr_prefix {
+	const char *str;
+	size_t len;
+} setstr_prefix_t;
+
+typedef struct setstr_slot {
+	char *str;
+	size_t len;
+	uint64_t hash;
+} setstr_slot_t;
+
 typedef struct setstr {
-	tommy_hashtable hashtable;
-	tommy_count_t bucket_max;
+	/* minimal perfect hash, slots_size == 0 for the empty set */
+	setstr_slot_t *slots;
+	size_t slots_size;
+	uint32_t *disp;
+	size_t disp_size;
+	uint64_t seed;
+	/* for rejecting most absent strings without hashing */
+	uint64_t first[4];
+	size_t minlen;
+	size_t maxlen;
+	bool scoped;
 	size_t size;
+	/* directory entries ending in '/', sorted, none prefix of another */
+	setstr_prefix_t *prefixes;
+	size_t prefixes_size;
 } setstr_t;
 
 int setstr_init(setstr_t *, size_t, char **) NONNULL(1) WUNRES;
 bool setstr_contains(setstr_t *, const char *) NONNULL(1,2) WUNRES;
 bool setstr_contains3(setstr_t *, const char *, const char *)
      NONNULL(1,2) WUNRES;
+bool setstr_contains_path(setstr_t *, const char *) NONNULL(1,2) WUNRES;
+bool setstr_equal(setstr_t *, setstr_t *) NONNULL(1,2) WUNRES;
 size_t setstr_size(setstr_t *) NONNULL(1);
 void setstr_destroy(setstr_t *) NONNULL(1);
 
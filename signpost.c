@@ -0,0 +1,62 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+/*
+ * os_signpost(3) intervals for latency analysis in Instruments.  Every
+ * category is a subsystem of its own logging to the Points of Interest
+ * category, so that the intervals show on the Points of Interest timeline
+ * grouped by subsystem.  The pipeline category carries the stages of an
+ * event that are not specific to a monitor, that is reading audit records.
+ */
+
+#include "signpost.h"
+
+#include "logevt.h"
+
+#include <stddef.h>
+
+os_log_t signpost_logs[SIGNPOST_CATEGORIES];
+
+static const char *subsystems[SIGNPOST_CATEGORIES] = {
+	"ch.roe.xnumon.pipeline",
+	"ch.roe.xnumon.procmon",
+	"ch.roe.xnumon.filemon",
+	"ch.roe.xnumon.sockmon",
+	"ch.roe.xnumon.hackmon",
+};
+
+/*
+ * Must be called before any other thread is started.
+ */
+void
+signpost_init(void) {
+	for (size_t i = 0; i < SIGNPOST_CATEGORIES; i++)
+		signpost_logs[i] = os_log_create(subsystems[i],
+		                                 "PointsOfInterest");
+}
+
+/*
+ * Returns the category for a mask of LOGEVT_FLAG event flags, 0 meaning
+ * process tracking which is always on.
+ */
+int
+signpost_category(int events) {
+	if (events == 0 || (events & LOGEVT_FLAG(LOGEVT_IMAGE_EXEC)) ||
+	    (events & LOGEVT_FLAG(LOGEVT_IMAGE_ENRICH)))
+		return SIGNPOST_PROCMON;
+	if (events & LOGEVT_FILEMON)
+		return SIGNPOST_FILEMON;
+	if (events & (LOGEVT_SOCKMON))
+		return SIGNPOST_SOCKMON;
+	if (events & LOGEVT_HACKMON)
+		return SIGNPOST_HACKMON;
+	return SIGNPOST_PIPELINE;
+}
+
@@ -0,0 +1,53 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef SIGNPOST_H
+#define SIGNPOST_H
+
+#include "attrib.h"
+
+#include <os/log.h>
+#include <os/signpost.h>
+
+/* categories, logged as subsystems ch.roe.xnumon.<category> */
+#define SIGNPOST_PIPELINE       0
+#define SIGNPOST_PROCMON        1
+#define SIGNPOST_FILEMON        2
+#define SIGNPOST_SOCKMON        3
+#define SIGNPOST_HACKMON        4
+#define SIGNPOST_CATEGORIES     5
+
+extern os_log_t signpost_logs[SIGNPOST_CATEGORIES];
+
+void signpost_init(void);
+int signpost_category(int) WUNRES;
+
+/*
+ * Begin or end the interval NAME, which must be a string literal, in
+ * category CAT.  Intervals are identified by the pointer PTR, such that an
+ * interval can end on another thread than it began on.  Costs an
+ * availability check and a load when Instruments is not recording.
+ */
+#define SIGNPOST_INTERVAL(FUNC, CAT, NAME, PTR) \
+	do { \
+		if (__builtin_available(macOS 10.14, *)) { \
+			os_log_t sp_log = signpost_logs[(CAT)]; \
+			if (sp_log && os_signpost_enabled(sp_log)) \
+				FUNC(sp_log, os_signpost_id_make_with_pointer( \
+				     sp_log, (PTR)), NAME); \
+		} \
+	} while (0)
+#define SIGNPOST_BEGIN(CAT, NAME, PTR) \
+	SIGNPOST_INTERVAL(os_signpost_interval_begin, CAT, NAME, PTR)
+#define SIGNPOST_END(CAT, NAME, PTR) \
+	SIGNPOST_INTERVAL(os_signpost_interval_end, CAT, NAME, PTR)
+
+#endif
+
@@ -15,8 +15,15 @@
 #include "sockmon.h"
 
 #include "work.h"
-#include "atomic.h"
+#include "counter.h"
+#include "pool.h"
+#include "time.h"
 
+#include "tommyhash.h"
+#include "tommyhashinc.h"
+#include "tommylist.h"
+
+#include <stdlib.h>
 #include <strings.h>
 #include <assert.h>
 
@@ -24,10 +31,52 @@ static config_t *config;
 
 static uint64_t events_recvd;   /* number of events received */
 static uint64_t events_procd;   /* number of events processed */
-static atomic64_t ooms;         /* counts events impaired due to OOM */
+static counter_t ooms;          /* counts events impaired due to OOM */
+static uint64_t events_folded;  /* events folded into a held event */
+static uint64_t events_early;   /* suppressed before allocating an event */
+static uint64_t sockets_ignored; /* sockets without state kept */
+
+#define SOCKMON_SLABOBJS        64
+
+static pool_t sopool;
+
+/*
+ * Aggregation of socket-connect events:  if config->socket_connect_window is
+ * set, the first connect of a subject image to a given protocol, peer
+ * address and peer port is held back for that many seconds, and all further
+ * connects of the same image to the same destination within the window are
+ * folded into it, counting them and recording the time of the last one.
+ * The held event keeps the subject and timestamp of the first connect.  It
+ * is submitted when its window expires, when the table is full and room is
+ * needed for a new destination, or on shutdown; hence aggregated events are
+ * logged up to socket_connect_window seconds out of timestamp order.
+ *
+ * Socket-accept events are aggregated the same way if
+ * config->socket_accept_window is set, per subject image, protocol, socket
+ * address, socket port and peer address.  The peer port is not part of the
+ * key, since it differs for every connection; the held event keeps the peer
+ * port of the first accept.  Each event type has its own list, such that
+ * both lists are in order of expiry despite different windows.
+ *
+ * Only accessed from the main event loop thread, no locking needed.
+ */
+typedef struct {
+	socket_op_t *so;
+	tommy_node node;                /* aggrs */
+	tommy_node lnode;               /* aggrlist, in order of first event */
+} sockmon_aggr_t;
+
+#define SOCKMON_AGGR_MAX        4096
+
+#define SOCKMON_AGGR_CONNECT    0
+#define SOCKMON_AGGR_ACCEPT     1
+#define SOCKMON_AGGR_LISTS      2
+
+static tommy_hashinc aggrs;
+static tommy_list aggrlist[SOCKMON_AGGR_LISTS];
 
-setstr_t *suppress_socket_op_by_subject_ident;
-setstr_t *suppress_socket_op_by_subject_path;
+setstr_t *_Atomic *suppress_socket_op_by_subject_ident;
+setstr_t *_Atomic *suppress_socket_op_by_subject_path;
 
 static void socket_op_free(socket_op_t *);
 static int socket_op_work(socket_op_t *);
@@ -36,7 +85,7 @@ static socket_op_t *
 socket_op_new(uint64_t code) {
 	socket_op_t *so;
 
-	so = malloc(sizeof(*so));
+	so = pool_alloc(&sopool);
 	if (!so)
 		return NULL;
 	bzero(so, sizeof(*so));
@@ -50,7 +99,7 @@ static void
 socket_op_free(socket_op_t *so) {
 	if (so->subject_image_exec)
 		image_exec_free(so->subject_image_exec);
-	free(so);
+	pool_free(&sopool, so);
 }
 
 /*
@@ -62,12 +111,130 @@ static int
 socket_op_work(socket_op_t *so) {
 	if (so->subject_image_exec && image_exec_match_suppressions(
 	                              so->subject_image_exec,
+	                              SUPPRESS_SOCKET_OP,
 	                              suppress_socket_op_by_subject_ident,
-	                              suppress_socket_op_by_subject_path))
+	                              suppress_socket_op_by_subject_path)) {
+		so->hdr.suppressed = true;
 		return -1;
+	}
 	return 0;
 }
 
+static int
+sockmon_aggr_list(socket_op_t *so) {
+	return so->hdr.code == LOGEVT_SOCKET_ACCEPT ? SOCKMON_AGGR_ACCEPT
+	                                            : SOCKMON_AGGR_CONNECT;
+}
+
+static size_t
+sockmon_aggr_window(int list) {
+	return list == SOCKMON_AGGR_ACCEPT ? config->socket_accept_window
+	                                   : config->socket_connect_window;
+}
+
+static tommy_hash_t
+sockmon_aggr_hash(socket_op_t *so) {
+	uint32_t h;
+
+	h = (uint32_t)tommy_inthash_u64((uintptr_t)so->subject_image_exec) ^
+	    ((uint32_t)so->protocol << 16);
+	if (so->hdr.code == LOGEVT_SOCKET_ACCEPT)
+		return ipaddr_hash(&so->peer_addr, ipaddr_hash(&so->sock_addr,
+		                   h ^ so->sock_port));
+	return ipaddr_hash(&so->peer_addr, h ^ so->peer_port);
+}
+
+static int
+sockmon_aggr_cmp(const void *arg, const void *obj) {
+	socket_op_t *a = (socket_op_t *)arg;
+	socket_op_t *b = ((const sockmon_aggr_t *)obj)->so;
+
+	if (a->hdr.code != b->hdr.code ||
+	    a->subject_image_exec != b->subject_image_exec ||
+	    a->protocol != b->protocol ||
+	    !ipaddr_equal(&a->peer_addr, &b->peer_addr))
+		return 1;
+	if (a->hdr.code == LOGEVT_SOCKET_ACCEPT)
+		return a->sock_port != b->sock_port ||
+		       !ipaddr_equal(&a->sock_addr, &b->sock_addr);
+	return a->peer_port != b->peer_port;
+}
+
+static void
+sockmon_aggr_submit(sockmon_aggr_t *aggr) {
+	tommy_hashinc_remove_existing(&aggrs, &aggr->node);
+	tommy_list_remove_existing(&aggrlist[sockmon_aggr_list(aggr->so)],
+	                           &aggr->lnode);
+	work_submit(aggr->so);
+	free(aggr);
+}
+
+/*
+ * Submit the held connects and accepts whose window has expired at tv, or
+ * all of them if tv is NULL.
+ */
+void
+sockmon_flush(struct timespec *tv) {
+	sockmon_aggr_t *aggr;
+
+	if (!config)
+		return;
+	for (int i = 0; i < SOCKMON_AGGR_LISTS; i++) {
+		size_t window = sockmon_aggr_window(i);
+
+		while (!tommy_list_empty(&aggrlist[i])) {
+			aggr = tommy_list_head(&aggrlist[i])->data;
+			if (tv && !timespec_greater_plus(tv, &aggr->so->hdr.tv,
+			                                 window))
+				break;
+			sockmon_aggr_submit(aggr);
+		}
+	}
+}
+
+/*
+ * Fold so into the held connect to the same destination or the held accept
+ * from the same peer, or hold it for the events to follow.  If the table is
+ * full, the oldest held event of the same type is submitted to make room,
+ * or of the other type if there is none.
+ */
+static void
+sockmon_aggregate(socket_op_t *so) {
+	sockmon_aggr_t *aggr;
+	tommy_hash_t h;
+	int list;
+
+	sockmon_flush(&so->hdr.tv);
+	h = sockmon_aggr_hash(so);
+	aggr = tommy_hashinc_search(&aggrs, sockmon_aggr_cmp, so, h);
+	if (aggr) {
+		aggr->so->count++;
+		aggr->so->last = so->hdr.tv;
+		events_folded++;
+		socket_op_free(so);
+		return;
+	}
+
+	so->count = 1;
+	so->last = so->hdr.tv;
+	list = sockmon_aggr_list(so);
+	if (tommy_hashinc_count(&aggrs) >= SOCKMON_AGGR_MAX) {
+		if (tommy_list_empty(&aggrlist[list]))
+			list = !list;
+		sockmon_aggr_submit(tommy_list_head(&aggrlist[list])->data);
+		list = sockmon_aggr_list(so);
+	}
+	aggr = malloc(sizeof(sockmon_aggr_t));
+	if (!aggr) {
+		counter_inc(&ooms);
+		work_submit(so);
+		return;
+	}
+	aggr->so = so;
+	tommy_hashinc_insert(&aggrs, &aggr->node, aggr, h);
+	tommy_list_insert_tail(&aggrlist[list], &aggr->lnode, aggr);
+}
+
 static void
 log_event_socket_op(struct timespec *tv,
                     audit_proc_t *subject,
@@ -76,13 +243,23 @@ log_event_socket_op(struct timespec *tv,
                     ipaddr_t *peer_addr, uint16_t peer_port,
                     uint64_t eventcode) {
 	socket_op_t *so;
+	image_exec_t *ie;
 
+	/* skip the event early if the verdict of the subject is known */
+	ie = image_exec_by_pid(subject->pid, tv);
+	if (ie && image_exec_suppressed(ie, SUPPRESS_SOCKET_OP)) {
+		image_exec_free(ie);
+		events_early++;
+		return;
+	}
 	so = socket_op_new(eventcode);
 	if (!so) {
-		atomic64_inc(&ooms);
+		if (ie)
+			image_exec_free(ie);
+		counter_inc(&ooms);
 		return;
 	}
-	so->subject_image_exec = image_exec_by_pid(subject->pid, tv);
+	so->subject_image_exec = ie;
 	so->subject = *subject;
 	/* can be 0 if unknown or -1 if raw */
 	so->protocol = protocol;
@@ -97,7 +274,16 @@ log_event_socket_op(struct timespec *tv,
 		so->peer_port = peer_port;
 	}
 	so->hdr.tv = *tv;
-	work_submit(so);
+	so->hdr.affinity = so->subject_image_exec;
+	so->hdr.priority = !so->subject_image_exec ||
+	                   image_exec_settled(so->subject_image_exec);
+	if (((eventcode == LOGEVT_SOCKET_CONNECT &&
+	      config->socket_connect_window > 0) ||
+	     (eventcode == LOGEVT_SOCKET_ACCEPT &&
+	      config->socket_accept_window > 0)) && so->subject_image_exec)
+		sockmon_aggregate(so);
+	else
+		work_submit(so);
 }
 
 static void
@@ -150,6 +336,13 @@ sockmon_socket(struct timespec *tv,
 			return;
 		}
 	}
+	/* bind is the only call on UDP sockets leading to an event */
+	if (protocol == IPPROTO_UDP &&
+	    !LOGEVT_WANT(config->events, LOGEVT_FLAG(LOGEVT_SOCKET_LISTEN))) {
+		procmon_socket_ignore(subject->pid, fd, tv);
+		sockets_ignored++;
+		return;
+	}
 	events_procd++;
 	procmon_socket_create(subject->pid, fd, protocol, tv);
 }
@@ -166,6 +359,15 @@ sockmon_bind(struct timespec *tv,
 	events_recvd++;
 	events_procd++;
 	procmon_socket_bind(&proto, subject->pid, fd, sock_addr, sock_port);
+	/* All events on sockets bound to localhost have a localhost socket
+	 * or peer address, since loopback addresses are only reachable from
+	 * loopback addresses, so none of them can ever be logged */
+	if (proto != 0 && config->suppress_socket_op_localhost &&
+	    ipaddr_is_localhost(sock_addr)) {
+		procmon_socket_ignore(subject->pid, fd, tv);
+		sockets_ignored++;
+		return;
+	}
 	/* Only generate event for UDP; for non-AF_INET/AF_INET6 and raw
 	 * sockets, we do not keep state (proto will be 0) */
 	if (proto != IPPROTO_UDP)
@@ -234,22 +436,46 @@ sockmon_connect(struct timespec *tv,
 	                  LOGEVT_SOCKET_CONNECT);
 }
 
-void
+int
 sockmon_init(config_t *cfg) {
+	if (pool_init(&sopool, "socket_op", sizeof(socket_op_t),
+	              SOCKMON_SLABOBJS) == -1)
+		return -1;
 	config = cfg;
-	ooms = 0;
+	counter_reset(&ooms);
 	events_recvd = 0;
 	events_procd = 0;
+	events_folded = 0;
+	events_early = 0;
+	sockets_ignored = 0;
+	tommy_hashinc_init(&aggrs);
+	for (int i = 0; i < SOCKMON_AGGR_LISTS; i++)
+		tommy_list_init(&aggrlist[i]);
 	suppress_socket_op_by_subject_ident =
 		&cfg->suppress_socket_op_by_subject_ident;
 	suppress_socket_op_by_subject_path =
 		&cfg->suppress_socket_op_by_subject_path;
+	return 0;
 }
 
 void
 sockmon_fini(void) {
+	sockmon_aggr_t *aggr;
+
 	if (!config)
 		return;
+	/* held events are normally flushed before the work stage stops */
+	for (int i = 0; i < SOCKMON_AGGR_LISTS; i++) {
+		while (!tommy_list_empty(&aggrlist[i])) {
+			aggr = tommy_list_head(&aggrlist[i])->data;
+			tommy_hashinc_remove_existing(&aggrs, &aggr->node);
+			tommy_list_remove_existing(&aggrlist[i], &aggr->lnode);
+			socket_op_free(aggr->so);
+			free(aggr);
+		}
+	}
+	tommy_hashinc_done(&aggrs);
+	pool_destroy(&sopool);
 	config = NULL;
 }
 
@@ -259,6 +485,10 @@ sockmon_stats(sockmon_stat_t *st) {
 
 	st->recvd = events_recvd;
 	st->procd = events_procd;
-	st->ooms = (uint64_t)ooms;
+	st->ooms = counter_get(&ooms);
+	st->folded = events_folded;
+	st->early = events_early;
+	st->ignored = sockets_ignored;
+	st->held = tommy_hashinc_count(&aggrs);
 }
 
@@ -26,6 +26,10 @@ typedef struct {
 	uint64_t recvd;
 	uint64_t procd;
 	uint64_t ooms;
+	uint64_t folded;                /* connects/accepts folded */
+	uint32_t held;                  /* connects/accepts waiting for more */
+	uint64_t early;                 /* suppressed by cached verdict */
+	uint64_t ignored;               /* sockets that cannot be logged */
 } sockmon_stat_t;
 
 typedef struct {
@@ -37,6 +41,8 @@ typedef struct {
 	uint16_t sock_port;
 	ipaddr_t peer_addr; /* unused for listen */
 	uint16_t peer_port; /* unused for listen */
+	uint64_t count;     /* aggregated events, 0 if not aggregated */
+	struct timespec last; /* time of last aggregated event */
 } socket_op_t;
 #define socket_listen_t     socket_op_t
 #define socket_accept_t     socket_op_t
@@ -57,7 +63,9 @@ void sockmon_connect(struct timespec *, audit_proc_t *, int,
                      ipaddr_t *, uint16_t)
      NONNULL(1,2,4);
 
-void sockmon_init(config_t *) NONNULL(1);
+void sockmon_flush(struct timespec *);
+
+int sockmon_init(config_t *) WUNRES NONNULL(1);
 void sockmon_fini(void);
 void sockmon_stats(sockmon_stat_t *) NONNULL(1);
 
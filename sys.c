@@ -14,6 +14,8 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <limits.h>
 #include <string.h>
 #include <stdlib.h>
@@ -51,6 +53,25 @@ sys_pidcwd(pid_t pid) {
 	return strdup(vpi.pvi_cdir.vip_path);
 }
 
+/*
+ * Not in the public SDK, see sys/codesign.h in xnu.
+ */
+int csops(pid_t, unsigned int, void *, size_t);
+#define CS_OPS_CDHASH 5
+
+/*
+ * Get the cdhash of the code signature of the image pid is executing, as
+ * validated by the kernel.  Fails for unsigned processes.
+ */
+int
+sys_pidcdhash(pid_t pid, unsigned char *cdhash, size_t sz) {
+	if (pid <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	return csops(pid, CS_OPS_CDHASH, cdhash, sz);
+}
+
 int
 sys_pidbsdinfo(struct timespec *tv, pid_t *ppid, pid_t pid) {
 	struct proc_bsdinfo pbi;
@@ -416,6 +437,92 @@ sys_pidf_close(int fd, const char *fn)
 	close(fd);
 }
 
+/*
+ * Create a non-blocking listening Unix domain socket at path that is only
+ * accessible to root, replacing a stale socket left over from a previous
+ * run.  Returns the listening fd on success, -1 with errno set on errors.
+ */
+int
+sys_unixsock_open(const char *path, int backlog)
+{
+	struct sockaddr_un sun;
+	struct stat ss;
+	mode_t mask;
+	size_t len;
+	int fd, rv, e;
+
+	len = strlen(path);
+	if (len >= sizeof(sun.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	bzero(&sun, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	memcpy(sun.sun_path, path, len + 1);
+
+	if (lstat(path, &ss) == 0 && S_ISSOCK(ss.st_mode))
+		(void)unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+	(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+		goto errout;
+	mask = umask(0077);
+	rv = bind(fd, (struct sockaddr *)&sun, sizeof(sun));
+	umask(mask);
+	if (rv == -1)
+		goto errout;
+	if (listen(fd, backlog) == -1) {
+		e = errno;
+		(void)unlink(path);
+		errno = e;
+		goto errout;
+	}
+	return fd;
+
+errout:
+	e = errno;
+	close(fd);
+	errno = e;
+	return -1;
+}
+
+/*
+ * Accept the next pending client on a listening socket opened with
+ * sys_unixsock_open.  Returns the client fd, or -1 with errno set to EAGAIN
+ * once no more clients are pending, or to another value on errors.
+ */
+int
+sys_unixsock_accept(int fd)
+{
+	int cfd;
+
+	for (;;) {
+		cfd = accept(fd, NULL, NULL);
+		if (cfd != -1)
+			break;
+		if (errno == EINTR || errno == ECONNABORTED)
+			continue;
+		if (errno == EWOULDBLOCK)
+			errno = EAGAIN;
+		return -1;
+	}
+	(void)fcntl(cfd, F_SETFD, FD_CLOEXEC);
+	return cfd;
+}
+
+/*
+ * Close and remove a listening socket opened with sys_unixsock_open.
+ */
+void
+sys_unixsock_close(int fd, const char *path)
+{
+	close(fd);
+	(void)unlink(path);
+}
+
 /*
  * Iterate over all files in a directory hierarchy, calling the callback
  * cb for each file, passing the filename and arg as arguments.  Files and
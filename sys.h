@@ -33,6 +33,7 @@ typedef struct {
 char * sys_pidpath(pid_t) MALLOC;
 char * sys_pidcwd(pid_t) MALLOC;
 int sys_pidbsdinfo(struct timespec *, pid_t *, pid_t) WUNRES;
+int sys_pidcdhash(pid_t, unsigned char *, size_t) NONNULL(2) WUNRES;
 pid_t * sys_pidlist(int *) MALLOC NONNULL(1);
 
 gid_t sys_gidbyname(const char *) NONNULL(1);
@@ -58,6 +59,10 @@ int sys_pidf_open(const char *) NONNULL(1) WUNRES;
 int sys_pidf_write(int) WUNRES;
 void sys_pidf_close(int, const char *) NONNULL(2);
 
+int sys_unixsock_open(const char *, int) NONNULL(1) WUNRES;
+int sys_unixsock_accept(int) WUNRES;
+void sys_unixsock_close(int, const char *) NONNULL(2);
+
 typedef int (*sys_dir_eachfile_cb_t)(const char *, void *) NONNULL(1) WUNRES;
 int sys_dir_eachfile_l(const char *, sys_dir_eachfile_cb_t, void *)
     NONNULL(1,2) WUNRES;
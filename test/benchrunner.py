@@ -0,0 +1,233 @@
+#!/usr/bin/env python3
+# vim: set list et ts=8 sts=4 sw=4 ft=python:
+
+#-
+# xnumon - monitor macOS for malicious activity
+# https://www.roe.ch/xnumon
+#
+# Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+# All rights reserved.
+#
+# Licensed under the Open Software License version 3.0.
+
+# Runs the timeops benchmarks and, given a trace recorded using trace_record,
+# replays the trace through xnumon as fast as it consumes it, then compares
+# the results with a baseline file and fails if any of them regressed by
+# more than the threshold.  Compared are the p99 ns/op of every timeops
+# benchmark, and for the replay the events per second, the p99 usecs spent
+# in every pipeline stage and the peak RSS.  Events per second must not
+# drop, everything else must not grow.
+#
+# The baseline is a flat JSON object of results as written by -u.  Results
+# missing from the baseline or zero in it are reported but not compared,
+# such that new benchmarks do not fail the run before the baseline has been
+# updated.  Baselines are only meaningful on the machine they were recorded
+# on.  The replay runs xnumon as root using the pidfile of the installed
+# xnumon, which therefore must not be running.
+#
+# Usage: benchrunner.py [-hju] [-b baseline] [-T percent] [-n reps]
+#                       [-a audittrail] [-r trace]
+
+import getopt
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+
+TOPDIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+TIMEOPS = os.path.join(TOPDIR, 'timeops')
+XNUMON = os.path.join(TOPDIR, 'xnumon')
+
+STAGES = ['audit', 'workq', 'work', 'reorder', 'logq', 'log', 'total']
+
+REPLAY_CONFIG = """<?xml version="1.0" encoding="UTF-8"?>
+<!DOCTYPE plist PUBLIC "-//Apple//DTD PLIST 1.0//EN" "http://www.apple.com/DTDs/PropertyList-1.0.dtd">
+<plist version="1.0">
+<dict>
+  <key>config_id</key>
+  <string>benchrunner</string>
+  <key>trace_replay</key>
+  <string>%s</string>
+  <key>trace_replay_speed</key>
+  <string>0</string>
+  <key>stats_interval</key>
+  <string>0</string>
+</dict>
+</plist>
+"""
+
+
+def higher_is_better(key):
+    return key.endswith('events_per_second')
+
+
+def run_timeops(reps, audittrail):
+    argv = [TIMEOPS, '-j', '-n', str(reps)]
+    if audittrail:
+        argv += ['-t', audittrail]
+    out = subprocess.check_output(argv).decode(errors='ignore')
+    res = {}
+    for line in out.split('\n'):
+        line = line.strip()
+        if line == '':
+            continue
+        obj = json.loads(line)
+        res['timeops.%s.p99_ns' % obj['name']] = obj['p99']
+    return res
+
+
+def run_replay(trace):
+    """
+    Replay trace through xnumon logging to stdout and return the results
+    from the xnumon-stats event logged at shutdown.
+    """
+    with tempfile.TemporaryDirectory() as tmpdir:
+        cfgpath = os.path.join(tmpdir, 'configuration.plist')
+        with open(cfgpath, 'w') as f:
+            f.write(REPLAY_CONFIG % os.path.abspath(trace))
+        argv = [XNUMON, '-c', cfgpath, '-f', 'stdout', '-l', 'json', '-1']
+        if os.getuid() != 0:
+            argv = ['sudo', '-n'] + argv
+        with open(os.path.join(tmpdir, 'stderr'), 'w+') as errf:
+            t0 = time.time()
+            proc = subprocess.run(argv, stdout=subprocess.PIPE,
+                                  stderr=errf)
+            elapsed = time.time() - t0
+            if proc.returncode != 0:
+                errf.seek(0)
+                sys.stderr.write(errf.read())
+                raise RuntimeError("xnumon exited with %i" %
+                                   proc.returncode)
+    final = None
+    for line in proc.stdout.decode(errors='ignore').split('\n'):
+        try:
+            obj = json.loads(line)
+        except ValueError:
+            continue
+        if obj.get('eventcode') == 1:
+            final = obj
+    if not final:
+        raise RuntimeError("no xnumon-stats event logged at shutdown")
+    res = {}
+    events = sum(final['log_queue']['events'])
+    res['replay.events'] = events
+    res['replay.events_per_second'] = round(events / elapsed, 1)
+    for stage in STAGES:
+        lat = final['pipeline_latency'].get(stage)
+        if lat and lat['count'] > 0:
+            res['replay.%s.p99_us' % stage] = lat['p99']
+    res['replay.rsspeak'] = final['memory']['rsspeak']
+    return res
+
+
+def compare(res, base, threshold):
+    """
+    Returns the list of regressions as (key, baseline, result) tuples.
+    """
+    regressions = []
+    for key in sorted(res.keys()):
+        if key == 'replay.events':
+            continue
+        old = base.get(key)
+        if not old:
+            continue
+        new = res[key]
+        if higher_is_better(key):
+            if new < old * (1 - threshold / 100.0):
+                regressions.append((key, old, new))
+        elif new > old * (1 + threshold / 100.0):
+            regressions.append((key, old, new))
+    return regressions
+
+
+def usage(f):
+    f.write("Usage: benchrunner.py [-hju] [-b baseline] [-T percent] "
+            "[-n reps]\n"
+            "                      [-a audittrail] [-r trace]\n")
+
+
+def main(argv):
+    baseline = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                            'bench.baseline.json')
+    threshold = 10.0
+    reps = 20
+    audittrail = None
+    trace = None
+    update = False
+    as_json = False
+    try:
+        opts, args = getopt.getopt(argv, 'hjub:T:n:a:r:')
+    except getopt.GetoptError as e:
+        sys.stderr.write("%s\n" % e)
+        usage(sys.stderr)
+        return 2
+    for opt, arg in opts:
+        if opt == '-h':
+            usage(sys.stdout)
+            return 0
+        elif opt == '-j':
+            as_json = True
+        elif opt == '-u':
+            update = True
+        elif opt == '-b':
+            baseline = arg
+        elif opt == '-T':
+            threshold = float(arg)
+        elif opt == '-n':
+            reps = int(arg)
+        elif opt == '-a':
+            audittrail = arg
+        elif opt == '-r':
+            trace = arg
+    if args:
+        usage(sys.stderr)
+        return 2
+
+    try:
+        res = run_timeops(reps, audittrail)
+        if trace:
+            res.update(run_replay(trace))
+    except (RuntimeError, subprocess.CalledProcessError) as e:
+        sys.stderr.write("error: %s\n" % e)
+        return 1
+
+    if update:
+        with open(baseline, 'w') as f:
+            json.dump(res, f, sort_keys=True, indent=2)
+            f.write('\n')
+        sys.stderr.write("Wrote baseline %s\n" % baseline)
+        return 0
+
+    try:
+        with open(baseline, 'r') as f:
+            base = json.load(f)
+    except FileNotFoundError:
+        base = {}
+        sys.stderr.write("No baseline %s, not comparing; "
+                         "use -u to record one\n" % baseline)
+
+    if as_json:
+        print(json.dumps(res, sort_keys=True))
+    else:
+        for key in sorted(res.keys()):
+            old = base.get(key)
+            if old:
+                print("%-44s %12s %12s %+7.1f%%" % (key, old, res[key],
+                      (res[key] - old) * 100.0 / old))
+            else:
+                print("%-44s %12s %12s" % (key, '-', res[key]))
+
+    regressions = compare(res, base, threshold)
+    for key, old, new in regressions:
+        sys.stderr.write("regression: %s %s -> %s (threshold %.1f%%)\n" %
+                         (key, old, new, threshold))
+    if regressions:
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
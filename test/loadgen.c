@@ -0,0 +1,363 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+/*
+ * Synthetic load generator for measuring xnumon throughput, driven by
+ * loadrunner.py.  A number of worker threads each perform their share of
+ * the configured rates of fork, fork+exec, connect and launchd plist write
+ * operations per second for the configured duration.  Exec'd children
+ * either exit immediately or stay around for the hold time, which grows the
+ * number of live processes xnumon has to track.  Prints a summary line of
+ * key=value pairs on stdout when done.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <time.h>
+
+#define PLISTDIR HOME"/Library/LaunchAgents"
+#define PLISTS 16                       /* distinct plists per worker */
+
+#define OP_FORK         0
+#define OP_EXEC         1
+#define OP_CONNECT      2
+#define OP_PLIST        3
+#define OPS             4
+
+static const char *opnames[OPS] = {"forks", "execs", "connects", "plists"};
+
+static unsigned int rate[OPS];          /* per second, all workers */
+static unsigned int workers = 4;
+static unsigned int duration = 10;      /* seconds */
+static unsigned int hold = 0;           /* ms exec'd children live */
+static struct sockaddr_in listenaddr;
+
+static atomic_uint_fast64_t done[OPS];
+static atomic_uint_fast64_t errors;
+static atomic_uint_fast64_t late;       /* ops started behind schedule */
+
+static uint64_t
+nsec_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void
+nsec_sleep_until(uint64_t due) {
+	struct timespec ts;
+	uint64_t now;
+
+	while ((now = nsec_now()) < due) {
+		ts.tv_sec = (time_t)((due - now) / 1000000000);
+		ts.tv_nsec = (long)((due - now) % 1000000000);
+		nanosleep(&ts, NULL);
+	}
+}
+
+static void
+reap(int flags) {
+	while (waitpid(-1, NULL, flags) > 0);
+}
+
+static int
+op_fork(void) {
+	pid_t pid;
+
+	pid = fork();
+	if (pid == -1)
+		return -1;
+	if (pid == 0)
+		_exit(0);
+	return 0;
+}
+
+static int
+op_exec(void) {
+	char holdarg[32];
+	pid_t pid;
+
+	snprintf(holdarg, sizeof(holdarg), "%u.%03u", hold / 1000, hold % 1000);
+	pid = fork();
+	if (pid == -1)
+		return -1;
+	if (pid == 0) {
+		if (hold > 0)
+			execl("/bin/sleep", "sleep", holdarg, (char *)NULL);
+		else
+			execl(TESTDIR"/true.dep", "true.dep", (char *)NULL);
+		_exit(1);
+	}
+	return 0;
+}
+
+static int
+op_connect(void) {
+	int fd;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&listenaddr,
+	            sizeof(listenaddr)) == -1) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+static int
+op_plist(unsigned int worker, uint64_t n) {
+	char path[1024];
+	char buf[1024];
+	int fd, len;
+
+	snprintf(path, sizeof(path),
+	         PLISTDIR"/ch.roe.xnumon.loadgen.%u.%u.plist",
+	         worker, (unsigned int)(n % PLISTS));
+	len = snprintf(buf, sizeof(buf),
+	        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	        "<plist version=\"1.0\">\n"
+	        "<dict>\n"
+	        "\t<key>Label</key>\n"
+	        "\t<string>ch.roe.xnumon.loadgen.%u.%u</string>\n"
+	        "\t<key>ProgramArguments</key>\n"
+	        "\t<array>\n"
+	        "\t\t<string>/usr/bin/true</string>\n"
+	        "\t\t<string>%"PRIu64"</string>\n"
+	        "\t</array>\n"
+	        "</dict>\n"
+	        "</plist>\n", worker, (unsigned int)(n % PLISTS), n);
+	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd == -1)
+		return -1;
+	if (write(fd, buf, (size_t)len) != len) {
+		close(fd);
+		return -1;
+	}
+	return close(fd);
+}
+
+static void
+plist_cleanup(void) {
+	char path[1024];
+
+	for (unsigned int w = 0; w < workers; w++) {
+		for (unsigned int i = 0; i < PLISTS; i++) {
+			snprintf(path, sizeof(path), PLISTDIR
+			         "/ch.roe.xnumon.loadgen.%u.%u.plist", w, i);
+			unlink(path);
+		}
+	}
+}
+
+/*
+ * Each worker schedules every operation type at rate / workers per second
+ * and always performs the operation that is due first.
+ */
+static void *
+worker_thread(void *arg) {
+	unsigned int worker = (unsigned int)(uintptr_t)arg;
+	uint64_t interval[OPS], next[OPS], n[OPS];
+	uint64_t start, end, now;
+	int op, rv;
+
+	start = nsec_now();
+	end = start + (uint64_t)duration * 1000000000;
+	for (op = 0; op < OPS; op++) {
+		n[op] = 0;
+		if (rate[op] == 0) {
+			next[op] = UINT64_MAX;
+			continue;
+		}
+		interval[op] = (uint64_t)workers * 1000000000 / rate[op];
+		/* spread the workers evenly across the interval */
+		next[op] = start + interval[op] * worker / workers;
+	}
+
+	for (;;) {
+		op = 0;
+		for (int i = 1; i < OPS; i++) {
+			if (next[i] < next[op])
+				op = i;
+		}
+		if (next[op] >= end)
+			break;
+		now = nsec_now();
+		if (now > next[op] + interval[op])
+			atomic_fetch_add(&late, 1);
+		nsec_sleep_until(next[op]);
+		switch (op) {
+		case OP_FORK:
+			rv = op_fork();
+			break;
+		case OP_EXEC:
+			rv = op_exec();
+			break;
+		case OP_CONNECT:
+			rv = op_connect();
+			break;
+		case OP_PLIST:
+			rv = op_plist(worker, n[op]);
+			break;
+		default:
+			rv = -1;
+			break;
+		}
+		if (rv == -1)
+			atomic_fetch_add(&errors, 1);
+		else
+			atomic_fetch_add(&done[op], 1);
+		n[op]++;
+		next[op] += interval[op];
+		reap(WNOHANG);
+	}
+	return NULL;
+}
+
+static void *
+accept_thread(void *arg) {
+	int lfd = (int)(intptr_t)arg;
+	int fd;
+
+	for (;;) {
+		fd = accept(lfd, NULL, NULL);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+static int
+listener(void) {
+	pthread_t thr;
+	socklen_t len = sizeof(listenaddr);
+	int fd;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+	bzero(&listenaddr, sizeof(listenaddr));
+	listenaddr.sin_family = AF_INET;
+	listenaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *)&listenaddr,
+	         sizeof(listenaddr)) == -1 ||
+	    listen(fd, 1024) == -1 ||
+	    getsockname(fd, (struct sockaddr *)&listenaddr, &len) == -1) {
+		close(fd);
+		return -1;
+	}
+	if (pthread_create(&thr, NULL, accept_thread,
+	                   (void *)(intptr_t)fd) != 0) {
+		close(fd);
+		return -1;
+	}
+	pthread_detach(thr);
+	return 0;
+}
+
+static void
+usage(FILE *f) {
+	fprintf(f, "Usage: loadgen [-h] [-d secs] [-w workers] [-f forks/s] "
+	           "[-e execs/s] [-n connects/s] [-p plists/s] [-H hold ms]\n"
+	           "Defaults: -d 10 -w 4 -f 0 -e 100 -n 0 -p 0 -H 0\n");
+}
+
+int
+main(int argc, char *argv[]) {
+	pthread_t thr[256];
+	uint64_t start, elapsed;
+	int ch;
+
+	rate[OP_EXEC] = 100;
+	while ((ch = getopt(argc, argv, "hd:w:f:e:n:p:H:")) != -1) {
+		switch (ch) {
+		case 'd':
+			duration = (unsigned int)atoi(optarg);
+			break;
+		case 'w':
+			workers = (unsigned int)atoi(optarg);
+			break;
+		case 'f':
+			rate[OP_FORK] = (unsigned int)atoi(optarg);
+			break;
+		case 'e':
+			rate[OP_EXEC] = (unsigned int)atoi(optarg);
+			break;
+		case 'n':
+			rate[OP_CONNECT] = (unsigned int)atoi(optarg);
+			break;
+		case 'p':
+			rate[OP_PLIST] = (unsigned int)atoi(optarg);
+			break;
+		case 'H':
+			hold = (unsigned int)atoi(optarg);
+			break;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 2;
+		}
+	}
+	if (workers == 0 || workers > sizeof(thr) / sizeof(thr[0])) {
+		fprintf(stderr, "workers must be between 1 and %zu\n",
+		                sizeof(thr) / sizeof(thr[0]));
+		return 2;
+	}
+	if (rate[OP_CONNECT] > 0 && listener() == -1) {
+		perror("listener");
+		return 1;
+	}
+
+	start = nsec_now();
+	for (unsigned int i = 0; i < workers; i++) {
+		if (pthread_create(&thr[i], NULL, worker_thread,
+		                   (void *)(uintptr_t)i) != 0) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	for (unsigned int i = 0; i < workers; i++)
+		pthread_join(thr[i], NULL);
+	reap(0);
+	elapsed = nsec_now() - start;
+	if (rate[OP_PLIST] > 0)
+		plist_cleanup();
+
+	printf("loadgen");
+	for (int op = 0; op < OPS; op++)
+		printf(" %s=%"PRIu64, opnames[op], (uint64_t)done[op]);
+	printf(" errors=%"PRIu64" late=%"PRIu64" elapsed_ms=%"PRIu64"\n",
+	       (uint64_t)errors, (uint64_t)late, elapsed / 1000000);
+	return errors > 0 ? 1 : 0;
+}
+
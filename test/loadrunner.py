@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+# vim: set list et ts=8 sts=4 sw=4 ft=python:
+
+#-
+# xnumon - monitor macOS for malicious activity
+# https://www.roe.ch/xnumon
+#
+# Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+# All rights reserved.
+#
+# Licensed under the Open Software License version 3.0.
+
+# Runs the loadgen load generator against a running xnumon and reports the
+# throughput achieved, based on xnumon-stats[1] events requested by sending
+# SIGUSR1 to xnumon periodically during the run.  Like testrunner.py, this
+# reads the logs from /var/log/xnumon.log and requires the json log format
+# in one line mode.
+#
+# Usage: loadrunner.py [-j] [-l logfile] [-i interval] [-- loadgen args]
+
+import getopt
+import json
+import os
+import subprocess
+import sys
+import time
+
+
+EVENTNAMES = [
+    'xnumon-ops',
+    'xnumon-stats',
+    'image-exec',
+    'process-access',
+    'launchd-add',
+    'socket-listen',
+    'socket-accept',
+    'socket-connect',
+    'event-summary',
+    'image-enrich',
+]
+
+
+class StatsTail:
+    """
+    Follows the log file from its current end and returns the xnumon-stats
+    records appended since.
+    """
+    def __init__(self, logfilepath):
+        self._f = open(logfilepath, 'r')
+        self._f.seek(0, os.SEEK_END)
+        self._partial = ''
+
+    def read(self):
+        records = []
+        data = self._partial + self._f.read()
+        lines = data.split('\n')
+        self._partial = lines.pop()
+        for line in lines:
+            line = line.strip()
+            if line == '':
+                continue
+            try:
+                obj = json.loads(line)
+            except:
+                continue
+            if obj.get('eventcode') == 1:
+                records.append(obj)
+        return records
+
+
+class Run:
+    """
+    Drives one load generator run and collects the xnumon-stats samples
+    taken before, during and after the run.
+    """
+    def __init__(self, logfilepath, interval, loadgen_argv):
+        self._tail = StatsTail(logfilepath)
+        self._interval = interval
+        self._argv = loadgen_argv
+        self.samples = []
+
+    def _poke(self):
+        subprocess.call(['sudo', '-n', 'pkill', '-USR1', '-x', 'xnumon'])
+
+    def _sample(self, timeout):
+        """
+        Request a stats event and wait for it to show up in the log.
+        """
+        self._poke()
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            records = self._tail.read()
+            if len(records) > 0:
+                self.samples.extend(records)
+                return records[-1]
+            time.sleep(0.05)
+        return None
+
+    def _drained(self, st):
+        return (st['work_queue']['buckets'] == 0 and
+                st['log_queue']['buckets'] == 0 and
+                st['aupi_cdevq']['buckets'] == 0)
+
+    def run(self, drain_timeout=120):
+        self.baseline = self._sample(10)
+        if not self.baseline:
+            raise RuntimeError("no xnumon-stats event logged; "
+                               "is xnumon running and logging json?")
+        self.t_start = time.time()
+        proc = subprocess.Popen(self._argv, stdout=subprocess.PIPE)
+        while proc.poll() is None:
+            time.sleep(self._interval)
+            self._sample(self._interval)
+        self.loadgen = proc.stdout.read().decode(errors='ignore').strip()
+        self.returncode = proc.returncode
+        self.t_load = time.time()
+        self.final = None
+        deadline = self.t_load + drain_timeout
+        while time.time() < deadline:
+            st = self._sample(self._interval)
+            if st and self._drained(st):
+                self.final = st
+                break
+            time.sleep(self._interval)
+        self.t_drained = time.time()
+        if not self.final:
+            raise RuntimeError("xnumon did not drain its queues within "
+                               "%i seconds" % drain_timeout)
+
+    def _delta(self, path):
+        a = self.baseline
+        b = self.final
+        for key in path:
+            a = a[key]
+            b = b[key]
+        return b - a
+
+    def _peak(self, path):
+        # the baseline sample's high-water marks predate the run
+        peak = 0
+        for st in self.samples[1:]:
+            node = st
+            for key in path:
+                node = node[key]
+            peak = max(peak, node)
+        return peak
+
+    def report(self):
+        """
+        Returns the results as a flat dict suitable for baselines.
+        """
+        elapsed = self.t_drained - self.t_start
+        res = {}
+        res['loadgen'] = self.loadgen
+        res['loadgen_returncode'] = self.returncode
+        res['load_seconds'] = round(self.t_load - self.t_start, 3)
+        res['drain_seconds'] = round(self.t_drained - self.t_load, 3)
+        total = 0
+        for i, name in enumerate(EVENTNAMES):
+            if i >= len(self.final['log_queue']['events']):
+                break
+            n = (self.final['log_queue']['events'][i] -
+                 self.baseline['log_queue']['events'][i])
+            total += n
+            res['events.%s' % name] = n
+        res['events'] = total
+        res['events_per_second'] = round(total / elapsed, 1)
+        res['aupipe_drops'] = self._delta(('aupi_cdevq', 'drop'))
+        res['aupipe_peak'] = self._peak(('aupi_cdevq', 'buckets'))
+        res['work_queue_peak'] = self._peak(('work_queue', 'bucketpeak'))
+        res['work_queue_drops'] = self._delta(('work_queue', 'drop'))
+        res['log_queue_peak'] = self._peak(('log_queue', 'bucketpeak'))
+        res['log_queue_drops'] = self._delta(('log_queue', 'drop'))
+        # cumulative since xnumon start, not just this run
+        lat = self.final.get('pipeline_latency', {}).get('total')
+        if lat:
+            res['lag_p50_us'] = lat['p50']
+            res['lag_p99_us'] = lat['p99']
+        res['samples'] = len(self.samples)
+        return res
+
+
+def usage(f):
+    f.write("Usage: loadrunner.py [-h] [-j] [-l logfile] [-i interval] "
+            "[-- loadgen args]\n")
+
+
+def main(argv):
+    logfile = '/var/log/xnumon.log'
+    interval = 1.0
+    as_json = False
+    try:
+        opts, args = getopt.getopt(argv, 'hjl:i:')
+    except getopt.GetoptError as e:
+        sys.stderr.write("%s\n" % e)
+        usage(sys.stderr)
+        return 2
+    for opt, arg in opts:
+        if opt == '-h':
+            usage(sys.stdout)
+            return 0
+        elif opt == '-j':
+            as_json = True
+        elif opt == '-l':
+            logfile = arg
+        elif opt == '-i':
+            interval = float(arg)
+    loadgen = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                           'loadgen')
+    run = Run(logfile, interval, [loadgen] + args)
+    try:
+        run.run()
+    except RuntimeError as e:
+        sys.stderr.write("error: %s\n" % e)
+        return 1
+    res = run.report()
+    if as_json:
+        print(json.dumps(res, sort_keys=True))
+    else:
+        for key in sorted(res.keys()):
+            print("%-28s %s" % (key, res[key]))
+    if run.returncode != 0:
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
+
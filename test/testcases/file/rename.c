@@ -25,7 +25,7 @@
 
 int
 main(int argc, char *argv[]) {
-	printf("spec:testcase returncode=0\n");
+	printf("spec:testcase returncode=0 maxdelay=1000\n");
 	printf("spec:image-exec "
 	       "subject.pid=%i "
 	       "image.path=%s "
@@ -22,7 +22,7 @@ int
 main(int argc, char *argv[]) {
 	pid_t pid;
 
-	printf("spec:testcase returncode=0\n");
+	printf("spec:testcase returncode=0 maxdelay=1000\n");
 	fflush(stdout);
 
 	pid = fork();
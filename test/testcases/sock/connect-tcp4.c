@@ -23,7 +23,7 @@
 
 int
 main(int argc, char *argv[]) {
-	printf("spec:testcase returncode=0\n");
+	printf("spec:testcase returncode=0 maxdelay=1000\n");
 	printf("spec:socket-connect subject.pid=%i subject.image.path=%s "
 	       "peeraddr="PEERADDR4" peerport=%i proto=tcp\n",
 	       getpid(), getpath(), PEERPORT);
@@ -16,8 +16,10 @@ import datetime
 import hashlib
 import json
 import os
+import re
 import subprocess
 import sys
+import threading
 import time
 
 import haklib.dt
@@ -59,14 +61,64 @@ def tclog(path):
         return path[:-5]
     return path
 
+def eventtime(timestamp):
+    """
+    Returns the datetime of a log record timestamp including the fractional
+    seconds, which haklib.dt.fromiso8601 ignores.
+    """
+    t = haklib.dt.fromiso8601(timestamp)
+    m = re.search(r'\.([0-9]+)', timestamp)
+    if m:
+        t += datetime.timedelta(seconds=float('0.' + m.group(1)))
+    return t
+
+
+class LogTail(threading.Thread):
+    """
+    Follows the log file from its current end in the background and notes
+    the time at which each log record appeared in the file, such that the
+    delay from the logged action to its log record can be measured.  The
+    poll interval bounds the resolution of the measured delays.
+    """
+    POLL_INTERVAL = 0.005
+
+    def __init__(self, logfilepath):
+        super().__init__(daemon=True)
+        self._f = open(logfilepath, 'r')
+        self._f.seek(0, os.SEEK_END)
+        self._partial = ''
+        self._stopping = threading.Event()
+        self.arrivals = {}
+
+    def run(self):
+        while not self._stopping.is_set():
+            data = self._f.read()
+            if data == '':
+                time.sleep(self.POLL_INTERVAL)
+                continue
+            now = haklib.dt.utcnow()
+            lines = (self._partial + data).split('\n')
+            self._partial = lines.pop()
+            for line in lines:
+                line = line.strip()
+                if line != '':
+                    self.arrivals[line] = now
+
+    def stop(self):
+        self._stopping.set()
+        self.join()
+        self._f.close()
+
 
 class Logs:
     """
     Encapsulates log access and spec evaluation against a set of log records.
     """
-    def __init__(self, logfilepath, begin=None, end=None):
+    def __init__(self, logfilepath, begin=None, end=None, arrivals=None):
         self._all_records = []
         self._records_by_eventcode = []
+        if arrivals == None:
+            arrivals = {}
         n = 0
         with open(logfilepath, 'r') as f:
             for line in f:
@@ -91,6 +143,7 @@ class Logs:
                     self._records_by_eventcode.append([])
                 obj['_raw'] = line
                 obj['_n'] = n
+                obj['_arrival'] = arrivals.get(line)
                 self._all_records.append(obj)
                 self._records_by_eventcode[ec].append(obj)
                 n += 1
@@ -179,12 +232,16 @@ class Specs:
             'socket-listen':  5,
             'socket-accept':  6,
             'socket-connect': 7,
+            'event-summary':  8,
+            'image-enrich':   9,
         }
         def __init__(self, spec):
             parts = spec.strip().split(' ')
             header = parts[0].split(':')
             self._wanted = 1
             self.radar = None
+            self.maxdelay = None
+            self.records = []
             if len(header) > 2:
                 flags = header[-2].split(',')
                 if 'absent' in flags:
@@ -199,6 +256,10 @@ class Specs:
             if self._spectype != 'testcase':
                 self._eventcode = self._EVENTMAP[self._spectype]
             self._conditions = [part.split('=') for part in parts[1:]]
+            if self._spectype == 'testcase':
+                for key, value in self._conditions:
+                    if key == 'maxdelay':
+                        self.maxdelay = int(value)
             self._spec = spec
             self._trace = []
 
@@ -214,6 +275,8 @@ class Specs:
                             self._trace.append(msg)
                             print(msg)
                             return False
+                    elif key == 'maxdelay':
+                        continue
                     else:
                         msg = yellow("error") + ": unknown condition %s=%s" % (
                                                                     key, value)
@@ -229,6 +292,7 @@ class Specs:
                 self._trace.append("radared")
                 return None
             if verdict:
+                self.records = results
                 self._trace.append("success")
             else:
                 self._trace.append("failed")
@@ -242,6 +306,25 @@ class Specs:
 
     def __init__(self, specs):
         self._specs = [self.Spec(spec) for spec in specs]
+        self.maxdelay = None
+        for spec in self._specs:
+            if spec.maxdelay != None:
+                self.maxdelay = spec.maxdelay
+
+    def delays(self):
+        """
+        Returns the delays in ms from the action to the log record for all
+        records matched by the specs, as far as the log tail has seen them
+        appear.
+        """
+        delays = []
+        for spec in self._specs:
+            for record in spec.records:
+                if not record['_arrival']:
+                    continue
+                delay = record['_arrival'] - eventtime(record['time'])
+                delays.append(delay.total_seconds() * 1000)
+        return delays
 
     def check(self, ex, logs):
         result = True
@@ -261,7 +344,23 @@ class Specs:
                 print("%s %s" % (green("success"), spec))
                 if spec.radar:
                     success_radars.append(spec.radar)
-        return result, radared_radars, success_radars
+        delays = self.delays()
+        if len(delays) > 0:
+            msg = "delay max %.1f ms over %i records" % (max(delays),
+                                                        len(delays))
+            if self.maxdelay == None:
+                print("%s   %s" % (brightwhite("delay"), msg))
+            elif max(delays) > self.maxdelay:
+                print("%s  %s > maxdelay=%i" % (red("failed"), msg,
+                                                self.maxdelay))
+                result = False
+            else:
+                print("%s %s <= maxdelay=%i" % (green("success"), msg,
+                                                self.maxdelay))
+        elif self.maxdelay != None:
+            print("%s no delay measured for maxdelay=%i" % (
+                  yellow("warning"), self.maxdelay))
+        return result, radared_radars, success_radars, delays
 
     def dump(self, tclogfile):
         with open(tclogfile, 'w') as f:
@@ -303,6 +402,8 @@ class TestSuite:
             self.stderr = self.stderr.decode(errors='ignore').strip()
             self.pid = proc.pid
 
+    LOGFILE = '/var/log/xnumon.log'
+
     def __init__(self):
         self._dt_begin = haklib.dt.utcnow() - datetime.timedelta(seconds=1)
         self._testcases = []
@@ -312,6 +413,9 @@ class TestSuite:
         self.radared_testcases = []
         self.radared_radars = set()
         self.success_radars = set()
+        self.delays = []
+        self._tail = LogTail(self.LOGFILE)
+        self._tail.start()
         self._ipv6 = self._test_ipv6()
         if self._ipv6:
             print("IPv6 connectivity: " + green("available"))
@@ -366,12 +470,14 @@ class TestSuite:
         Evaluate the added tests and their specs against the logs from the
         relevant time window.
         """
-        logfile = '/var/log/xnumon.log'
+        logfile = self.LOGFILE
         self._dt_end = haklib.dt.utcnow() + datetime.timedelta(seconds=1)
         print("waiting for logs to be written")
         time.sleep(1)
+        self._tail.stop()
         print("reading logs from %s..." % logfile)
-        logs = Logs(logfile, begin=self._dt_begin, end=self._dt_end)
+        logs = Logs(logfile, begin=self._dt_begin, end=self._dt_end,
+                    arrivals=self._tail.arrivals)
         print("%i log records within relevant timeframe" % len(logs))
         print()
         outfiles = []
@@ -379,7 +485,10 @@ class TestSuite:
         for path, ex, specs in self._testcases:
             print(brightwhite("testing %s" % tc(path)))
             specs = Specs(specs)
-            verdict, radared_radars, success_radars = specs.check(ex, logs)
+            verdict, radared_radars, success_radars, delays = specs.check(
+                                                                    ex, logs)
+            if len(delays) > 0:
+                self.delays.append((path, max(delays), len(delays)))
             self.radared_radars = self.radared_radars.union(set(radared_radars))
             self.success_radars = self.success_radars.union(set(success_radars))
             if verdict:
@@ -420,6 +529,11 @@ def main(paths):
         #for path in suite.success_testcases:
         #    print("%s" % tc(path))
         print()
+    if len(suite.delays) > 0:
+        print("delays of %i testcases:" % len(suite.delays))
+        for path, delay, n in sorted(suite.delays, key=lambda x: -x[1]):
+            print("%8.1f ms %3i %s" % (delay, n, tc(path)))
+        print()
     if len(suite.success_radars) > 0:
         print("%i radars absent:" % len(suite.success_radars))
         for radar in sorted(list(suite.success_radars)):
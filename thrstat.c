@@ -0,0 +1,156 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "thrstat.h"
+
+#include <mach/mach.h>
+
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <assert.h>
+
+/*
+ * Per-thread CPU time and process-wide memory accounting.  Threads register
+ * themselves with their class when they start; the CPU time of a registered
+ * thread is folded into its class when it exits.  CPU time of threads that
+ * never registered, such as short-lived hashing and preload threads, is
+ * reported as THRSTAT_OTHER, derived from the CPU time of the whole task.
+ */
+
+static const char *classnames[THRSTAT_CLASSES] = {
+	"evtloop", "kextloop", "auring", "work", "bulk", "csig_pool", "log",
+	"logsend", "other"
+};
+
+typedef struct {
+	mach_port_t port;
+	int class;
+	bool used;
+} thrstat_slot_t;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static bool keyed;
+static thrstat_slot_t slots[THRSTAT_MAX];
+static uint64_t exited[THRSTAT_CLASSES];        /* usecs of exited threads */
+
+#define TV_USECS(TV) ((uint64_t)(TV).seconds * 1000000 + \
+                      (uint64_t)(TV).microseconds)
+
+static uint64_t
+thrstat_thread_usecs(mach_port_t port) {
+	thread_basic_info_data_t info;
+	mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+
+	if (thread_info(port, THREAD_BASIC_INFO, (thread_info_t)&info,
+	                &count) != KERN_SUCCESS)
+		return 0;
+	return TV_USECS(info.user_time) + TV_USECS(info.system_time);
+}
+
+/*
+ * Thread-specific data destructor, called on the exiting thread.
+ */
+static void
+thrstat_unregister(void *arg) {
+	thrstat_slot_t *slot = arg;
+
+	pthread_mutex_lock(&mutex);
+	exited[slot->class] += thrstat_thread_usecs(slot->port);
+	(void)mach_port_deallocate(mach_task_self(), slot->port);
+	slot->used = false;
+	pthread_mutex_unlock(&mutex);
+}
+
+static void
+thrstat_init(void) {
+	keyed = pthread_key_create(&key, thrstat_unregister) == 0;
+}
+
+/*
+ * Register the calling thread as belonging to class.  Threads beyond
+ * THRSTAT_MAX are accounted as THRSTAT_OTHER.
+ */
+void
+thrstat_register(int class) {
+	thrstat_slot_t *slot = NULL;
+
+	assert(class >= 0 && class < THRSTAT_OTHER);
+
+	(void)pthread_once(&once, thrstat_init);
+	pthread_mutex_lock(&mutex);
+	for (size_t i = 0; i < THRSTAT_MAX; i++) {
+		if (!slots[i].used) {
+			slot = &slots[i];
+			slot->port = mach_thread_self();
+			slot->class = class;
+			slot->used = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+	if (slot && (!keyed || pthread_setspecific(key, slot) != 0))
+		thrstat_unregister(slot);
+}
+
+void
+thrstat_stats(thrstat_stat_t *st) {
+	struct mach_task_basic_info bi;
+	task_thread_times_info_data_t tti;
+	task_vm_info_data_t vi;
+	mach_msg_type_number_t count;
+	mach_port_t task = mach_task_self();
+	uint64_t total, known = 0;
+
+	assert(st);
+
+	bzero(st, sizeof(thrstat_stat_t));
+	pthread_mutex_lock(&mutex);
+	for (size_t i = 0; i < THRSTAT_MAX; i++) {
+		if (!slots[i].used)
+			continue;
+		st->threads[slots[i].class]++;
+		st->usecs[slots[i].class] +=
+			thrstat_thread_usecs(slots[i].port);
+	}
+	for (size_t i = 0; i < THRSTAT_OTHER; i++) {
+		st->usecs[i] += exited[i];
+		known += st->usecs[i];
+	}
+	pthread_mutex_unlock(&mutex);
+
+	/* task basic info times cover exited threads only */
+	total = 0;
+	count = MACH_TASK_BASIC_INFO_COUNT;
+	if (task_info(task, MACH_TASK_BASIC_INFO, (task_info_t)&bi,
+	              &count) == KERN_SUCCESS) {
+		st->rss = bi.resident_size;
+		st->rsspeak = bi.resident_size_max;
+		total += TV_USECS(bi.user_time) + TV_USECS(bi.system_time);
+	}
+	count = TASK_THREAD_TIMES_INFO_COUNT;
+	if (task_info(task, TASK_THREAD_TIMES_INFO, (task_info_t)&tti,
+	              &count) == KERN_SUCCESS)
+		total += TV_USECS(tti.user_time) + TV_USECS(tti.system_time);
+	count = TASK_VM_INFO_COUNT;
+	if (task_info(task, TASK_VM_INFO, (task_info_t)&vi,
+	              &count) == KERN_SUCCESS)
+		st->footprint = vi.phys_footprint;
+	st->usecs[THRSTAT_OTHER] = total > known ? total - known : 0;
+}
+
+const char *
+thrstat_class_s(int class) {
+	assert(class >= 0 && class < THRSTAT_CLASSES);
+	return classnames[class];
+}
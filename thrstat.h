@@ -0,0 +1,45 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef THRSTAT_H
+#define THRSTAT_H
+
+#include "attrib.h"
+
+#include <stdint.h>
+
+/* thread classes */
+#define THRSTAT_EVTLOOP         0
+#define THRSTAT_KEXTLOOP        1
+#define THRSTAT_AURING          2
+#define THRSTAT_WORK            3
+#define THRSTAT_BULK            4
+#define THRSTAT_CSPOOL          5
+#define THRSTAT_LOG             6
+#define THRSTAT_LOGSEND         7
+#define THRSTAT_OTHER           8       /* unregistered threads */
+#define THRSTAT_CLASSES         9
+
+#define THRSTAT_MAX             64      /* max registered live threads */
+
+typedef struct {
+	uint32_t threads[THRSTAT_CLASSES];      /* live */
+	uint64_t usecs[THRSTAT_CLASSES];        /* user + system cpu time */
+	uint64_t rss;                           /* bytes resident */
+	uint64_t rsspeak;
+	uint64_t footprint;                     /* bytes physical footprint */
+} thrstat_stat_t;
+
+void thrstat_register(int);
+void thrstat_stats(thrstat_stat_t *) NONNULL(1);
+const char * thrstat_class_s(int) WUNRES;
+
+#endif
+
@@ -49,3 +49,44 @@ timespec_nanotime(struct timespec *tv) {
 #endif
 }
 
+/*
+ * Monotonic clock for measuring intervals; not related to wall clock time.
+ */
+int
+timespec_monotime(struct timespec *tv) {
+	return clock_gettime(CLOCK_MONOTONIC, tv);
+}
+
+/*
+ * Monotonic clock in nanoseconds, or 0 on error.
+ */
+uint64_t
+timespec_mononsec(void) {
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+		return 0;
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+void
+timespec_add_msec(struct timespec *tv, size_t ms) {
+	tv->tv_sec += ms / 1000;
+	tv->tv_nsec += (ms % 1000) * 1000000;
+	if (tv->tv_nsec >= 1000000000) {
+		tv->tv_sec++;
+		tv->tv_nsec -= 1000000000;
+	}
+}
+
+/*
+ * Returns the number of nanoseconds from `b' to `a', or 0 if `b' is later than
+ * `a'.
+ */
+uint64_t
+timespec_diff_nsec(struct timespec *a, struct timespec *b) {
+	if (timespec_greater(b, a))
+		return 0;
+	return (uint64_t)(a->tv_sec - b->tv_sec) * 1000000000 +
+	       a->tv_nsec - b->tv_nsec;
+}
@@ -15,12 +15,19 @@
 
 #include <time.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 bool timespec_greater_plus(struct timespec *, struct timespec *, time_t)
      NONNULL(1,2) WUNRES;
 bool timespec_greater(struct timespec *, struct timespec *) NONNULL(1,2) WUNRES;
 bool timespec_equal(struct timespec *, struct timespec *) NONNULL(1,2) WUNRES;
 int timespec_nanotime(struct timespec *) NONNULL(1) WUNRES;
+int timespec_monotime(struct timespec *) NONNULL(1) WUNRES;
+uint64_t timespec_mononsec(void) WUNRES;
+void timespec_add_msec(struct timespec *, size_t) NONNULL(1);
+uint64_t timespec_diff_nsec(struct timespec *, struct timespec *)
+         NONNULL(1,2) WUNRES;
 
 #endif
 
@@ -9,21 +9,50 @@
  */
 
 /*
- * Simple timed execution of different relevant low-level xnumon operations.
- * Used to understand implications of e.g. caching on performance.
+ * Benchmark harness for relevant low-level xnumon operations.  Used to
+ * understand implications of e.g. caching on performance, and to catch
+ * regressions on the hot path before rolling out.
+ *
+ * Each benchmark performs a batch of operations per repetition.  After a
+ * number of warmup repetitions, the time per operation is measured for each
+ * repetition and reported as percentiles over all repetitions, either as a
+ * table or as one JSON object per line for comparing builds.
  */
 
 #include "hashes.h"
 #include "codesign.h"
 #include "cachehash.h"
 #include "cachecsig.h"
+#include "auevent.h"
+#include "auclass.h"
+#include "aev.h"
+#include "proc.h"
+#include "setstr.h"
+#include "queue.h"
+#include "logevt.h"
+#include "logfmt.h"
+#include "logfmtjson.h"
+#include "logfmtyaml.h"
+#include "logfmtxml.h"
+#include "logfmtcbor.h"
+#include "logutl.h"
+#include "config.h"
+#include "time.h"
+#include "attrib.h"
+
+#include "tommylist.h"
+#include "tommyhashinc.h"
+#include "tommyhashtbl.h"
+#include "tommy_ext.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
-#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #ifndef __BSD__
 #include <getopt.h>
@@ -40,269 +69,1158 @@ purge(void) {
 	}
 }
 
-int hashes_flags;
-const char *path;
+typedef struct bench {
+	const char *name;
+	int (*setup)(struct bench *);   /* optional, -1 to skip benchmark */
+	size_t (*run)(struct bench *);  /* returns ops performed, 0 on error */
+	void (*teardown)(struct bench *);       /* optional */
+	logfmt_t *fmt;
+	const char *path;
+	int flags;
+	size_t n;
+	bool fileio;                    /* purge before repetitions if cold */
+} bench_t;
+
+static size_t opt_reps = 20;
+static size_t opt_warmup = 3;
+static bool opt_json = false;
+static bool opt_cold = false;
+static const char *opt_trace = NULL;
 
-#define TIMEIT_INIT	clock_t t0, t1
-#define TIMEIT_START	t0 = clock()
-#define TIMEIT_STOP	t1 = clock()
-#define TIMEIT_RESULT	(double)(t1 - t0) / CLOCKS_PER_SEC
+static config_t bench_cfg;
+static volatile size_t sink;            /* keep results alive */
+
+/*
+ * Hashing and code signature verification of files of different sizes.
+ */
+
+#define PATH_10M        "/usr/sbin/php-fpm"
+#define PATH_1M         "/usr/sbin/coreaudiod"
+#define PATH_100K       "/usr/sbin/mkpassdb"
+#define PATH_10K        "/usr/bin/iotop"
+
+static int
+bench_file_setup(bench_t *b) {
+	return access(b->path, R_OK);
+}
 
-double
-timeit_hashes(void) {
-	TIMEIT_INIT;
+static size_t
+bench_hashes_run(bench_t *b) {
 	hashes_t hashes;
 	off_t size;
 
-	purge();
-	TIMEIT_START;
-	hashes_path(&size, &hashes, hashes_flags, path);
-	TIMEIT_STOP;
+	if (hashes_path(&size, &hashes, b->flags, b->path) == -1)
+		return 0;
+	return 1;
+}
 
-	return TIMEIT_RESULT;
+/*
+ * Code signature verification with the origin classified from the chain, or
+ * with all origin requirements checked in order if b->flags is set.
+ */
+static int
+bench_codesign_setup(bench_t *b) {
+	bench_cfg.codesign_verify_origin = !!b->flags;
+	return access(b->path, R_OK);
 }
 
-double
-timeit_codesign(void) {
-	TIMEIT_INIT;
+static size_t
+bench_codesign_run(bench_t *b) {
 	codesign_t *cs;
 
-	purge();
-	TIMEIT_START;
-	cs = codesign_new(path, -1);
-	TIMEIT_STOP;
+	cs = codesign_new(b->path, -1);
+	if (!cs)
+		return 0;
 	codesign_free(cs);
+	return 1;
+}
 
-	return TIMEIT_RESULT;
+static void
+bench_codesign_teardown(UNUSED bench_t *b) {
+	bench_cfg.codesign_verify_origin = false;
 }
 
-double
-timeit_cachehash_get(void) {
-	TIMEIT_INIT;
-	hashes_t h;
+/*
+ * Hash and code signature cache lookups and insertions.
+ */
+
+static hashes_t *bench_hashes;
+
+static int
+bench_cachehash_setup(bench_t *b) {
 	struct timespec tm;
 
-	bzero(&h, sizeof(hashes_t));
 	bzero(&tm, sizeof(struct timespec));
-	cachehash_init();
-	cachehash_put(0, 0, &tm, &tm, &tm, &h);
-	TIMEIT_START;
-	cachehash_get(&h, 0, 0, &tm, &tm, &tm);
-	TIMEIT_STOP;
-	cachehash_fini();
+	cachehash_init(NULL, 0, CACHEHASH_BUCKETS, LRUCACHE_FLAG_CLOCK);
+	if (b->flags) {
+		hashes_t h;
+
+		bzero(&h, sizeof(hashes_t));
+		for (size_t i = 0; i < b->n; i++)
+			cachehash_put(0, (ino_t)i, &tm, &tm, &tm, &h);
+	}
+	return 0;
+}
+
+static size_t
+bench_cachehash_get_run(bench_t *b) {
+	hashes_t h;
+	struct timespec tm;
 
-	return TIMEIT_RESULT;
+	bzero(&tm, sizeof(struct timespec));
+	for (size_t i = 0; i < b->n; i++)
+		sink += cachehash_get(&h, 0, (ino_t)i, &tm, &tm, &tm);
+	return b->n;
 }
 
-double
-timeit_cachehash_put(void) {
-	TIMEIT_INIT;
+static size_t
+bench_cachehash_put_run(bench_t *b) {
 	hashes_t h;
 	struct timespec tm;
 
 	bzero(&h, sizeof(hashes_t));
 	bzero(&tm, sizeof(struct timespec));
-	cachehash_init();
-	TIMEIT_START;
-	cachehash_put(0, 0, &tm, &tm, &tm, &h);
-	TIMEIT_STOP;
-	cachehash_fini();
+	for (size_t i = 0; i < b->n; i++)
+		cachehash_put(0, (ino_t)i, &tm, &tm, &tm, &h);
+	return b->n;
+}
 
-	return TIMEIT_RESULT;
+static void
+bench_cachehash_teardown(UNUSED bench_t *b) {
+	cachehash_fini();
 }
 
-double
-timeit_cachecsig_get(void) {
-	TIMEIT_INIT;
-	hashes_t h;
+static int
+bench_cachecsig_setup(bench_t *b) {
 	codesign_t *cs;
 
-	cs = codesign_new("/usr/bin/iotop", -1);
-	memset(&h, 0x7F, sizeof(hashes_t));
-	cachecsig_init();
-	cachecsig_put(&h, cs);
+	cs = codesign_new(b->path, -1);
+	if (!cs)
+		return -1;
+	bench_hashes = malloc(b->n * sizeof(hashes_t));
+	if (!bench_hashes) {
+		codesign_free(cs);
+		return -1;
+	}
+	for (size_t i = 0; i < b->n; i++) {
+		memset(&bench_hashes[i], 0x7F, sizeof(hashes_t));
+		memcpy(bench_hashes[i].sha256, &i, sizeof(i));
+	}
+	cachecsig_init(NULL, 0, CACHECSIG_BUCKETS, 0);
+	if (b->flags) {
+		for (size_t i = 0; i < b->n; i++)
+			cachecsig_put(&bench_hashes[i], cs, b->path);
+	}
 	codesign_free(cs);
-	TIMEIT_START;
-	cs = cachecsig_get(&h);
-	TIMEIT_STOP;
-	cachecsig_fini();
+	return 0;
+}
+
+static size_t
+bench_cachecsig_get_run(bench_t *b) {
+	codesign_t *cs;
 
-	return TIMEIT_RESULT;
+	for (size_t i = 0; i < b->n; i++) {
+		cs = cachecsig_get(&bench_hashes[i]);
+		if (!cs)
+			return 0;
+		codesign_free(cs);
+	}
+	return b->n;
 }
 
-double
-timeit_cachecsig_put(void) {
-	TIMEIT_INIT;
-	hashes_t h;
+static size_t
+bench_cachecsig_put_run(bench_t *b) {
 	codesign_t *cs;
 
-	cs = codesign_new("/usr/bin/iotop", -1);
-	memset(&h, 0x7F, sizeof(hashes_t));
-	cachecsig_init();
-	TIMEIT_START;
-	cachecsig_put(&h, cs);
-	TIMEIT_STOP;
+	cs = codesign_new(b->path, -1);
+	if (!cs)
+		return 0;
+	for (size_t i = 0; i < b->n; i++)
+		cachecsig_put(&bench_hashes[i], cs, b->path);
 	codesign_free(cs);
+	return b->n;
+}
+
+static void
+bench_cachecsig_teardown(UNUSED bench_t *b) {
 	cachecsig_fini();
+	free(bench_hashes);
+	bench_hashes = NULL;
+}
+
+/*
+ * Decoding of a recorded audit trace, either using au_read_rec(3) through
+ * auevent_fread or using the buffered zero-copy reader auevent_read, with
+ * the env level given by the AUEVENT_FLAG_ENV_* flags in b->flags.
+ */
 
-	return TIMEIT_RESULT;
+static FILE *bench_trace;
+static off_t bench_tracesz;
+static auevent_typeset_t bench_types;
+
+static int
+bench_trace_setup(UNUSED bench_t *b) {
+	struct stat sb;
+
+	if (!opt_trace)
+		return -1;
+	bench_trace = fopen(opt_trace, "r");
+	if (!bench_trace) {
+		fprintf(stderr, "fopen(%s): %s (%i)\n",
+		                opt_trace, strerror(errno), errno);
+		return -1;
+	}
+	if (fstat(fileno(bench_trace), &sb) == -1) {
+		fclose(bench_trace);
+		return -1;
+	}
+	bench_tracesz = sb.st_size;
+	auevent_typeset_init(&bench_types);
+	auevent_typeset_add(&bench_types, auclass_xnumon_events_procmon);
+	auevent_typeset_add(&bench_types, auclass_xnumon_events_hackmon);
+	auevent_typeset_add(&bench_types, auclass_xnumon_events_filemon);
+	auevent_typeset_add(&bench_types, auclass_xnumon_events_sockmon);
+	return 0;
+}
+
+static size_t
+bench_auevent_fread_run(bench_t *b) {
+	audit_event_t ev;
+	size_t recs = 0;
+
+	rewind(bench_trace);
+	while (ftello(bench_trace) < bench_tracesz) {
+		auevent_create(&ev);
+		if (auevent_fread(&ev, &bench_types, b->flags,
+		                  bench_trace) == -1) {
+			auevent_destroy(&ev);
+			return 0;
+		}
+		auevent_destroy(&ev);
+		recs++;
+	}
+	return recs;
 }
 
-typedef double (*timeit_func)(void);
+static size_t
+bench_auevent_read_run(bench_t *b) {
+	audit_event_t ev;
+	aubuf_t ab;
+	off_t off;
+	ssize_t rv;
+	size_t recs = 0;
+	int fd = fileno(bench_trace);
 
-double
-timeit_average(size_t n, timeit_func func) {
-	double total = 0.0;
-	for (size_t i = 0; i < n; i++) {
-		total += func();
+	if (lseek(fd, 0, SEEK_SET) == -1)
+		return 0;
+	if (aubuf_init(&ab, fd, AUBUF_SIZE) == -1)
+		return 0;
+	for (;;) {
+		auevent_create(&ev);
+		rv = auevent_read(&ev, &bench_types, b->flags, &ab);
+		if (rv == -1) {
+			auevent_destroy(&ev);
+			recs = 0;
+			break;
+		}
+		/* skipped records count, buffer refills do not */
+		if (rv == 1 || (ev.flags & AEFLAG_REJECTED))
+			recs++;
+		auevent_destroy(&ev);
+		off = lseek(fd, 0, SEEK_CUR);
+		if (off == -1 || (off >= bench_tracesz && ab.head == ab.tail))
+			break;
 	}
-	return total / n;
+	aubuf_destroy(&ab);
+	return recs;
 }
 
 static void
-fusage(FILE *f, const char *argv0) {
-	fprintf(f,
-"Usage: %s [-h]\n"
-" -h             print usage\n"
-, argv0);
+bench_trace_teardown(UNUSED bench_t *b) {
+	fclose(bench_trace);
+	bench_trace = NULL;
 }
 
-int
-main(int argc, char *argv[]) {
-	int ch;
-	const char *argv0 = argv[0];
+/*
+ * Filtering of the DYLD_ entries from an exec env token of b->n entries
+ * typical of build environments, one of which is a DYLD_ entry.  The
+ * baseline indexes all strings as au_fetch_tok(3) does before filtering.
+ */
 
-	while ((ch = getopt(argc, argv, "h")) != -1) {
-		switch (ch) {
-			case 'h':
-				fusage(stdout, argv0);
-				exit(EXIT_SUCCESS);
-			case '?':
-				exit(EXIT_FAILURE);
-			default:
-				fusage(stderr, argv0);
-				exit(EXIT_FAILURE);
+#define BENCH_AEV_OPS   1000
+
+static char *bench_env;
+static size_t bench_envsz;
+static char **bench_envv;
+
+static int
+bench_aev_setup(bench_t *b) {
+	char buf[128];
+	char *p;
+	int len;
+
+	bench_env = malloc(b->n * sizeof(buf));
+	bench_envv = malloc(b->n * sizeof(char *));
+	if (!bench_env || !bench_envv) {
+		free(bench_env);
+		free(bench_envv);
+		return -1;
+	}
+	p = bench_env;
+	for (size_t i = 0; i < b->n; i++) {
+		if (i == b->n / 2)
+			len = snprintf(buf, sizeof(buf), "DYLD_LIBRARY_PATH="
+			               "/tmp/build/lib");
+		else
+			len = snprintf(buf, sizeof(buf), "%s_%zu=/Applications/"
+			               "Xcode.app/Contents/Developer/usr/bin",
+			               i % 3 ? "BUILD_SETTING" : "DEVELOPER_DIR",
+			               i);
+		memcpy(p, buf, (size_t)len + 1);
+		p += len + 1;
+	}
+	bench_envsz = (size_t)(p - bench_env);
+	return 0;
+}
+
+static size_t
+bench_aev_buf_run(bench_t *b) {
+	char **env;
+	size_t len;
+
+	for (size_t i = 0; i < BENCH_AEV_OPS; i++) {
+		env = aev_new_prefix_buf(bench_env, bench_envsz, b->n,
+		                         "DYLD_", &len);
+		if (!env || len != bench_envsz)
+			return 0;
+		free(env);
+	}
+	return BENCH_AEV_OPS;
+}
+
+static size_t
+bench_aev_baseline_run(bench_t *b) {
+	char **env;
+	char *p;
+
+	for (size_t i = 0; i < BENCH_AEV_OPS; i++) {
+		p = bench_env;
+		for (size_t j = 0; j < b->n; j++) {
+			bench_envv[j] = p;
+			while (*p != '\0')
+				p++;
+			p++;
 		}
+		env = aev_new_prefix(b->n, bench_envv, "DYLD_");
+		if (!env)
+			return 0;
+		free(env);
 	}
-	argc -= optind;
-	argv += optind;
+	return BENCH_AEV_OPS;
+}
 
-	if (argc > 0) {
-		fusage(stderr, argv0);
-		exit(EXIT_FAILURE);
+static void
+bench_aev_teardown(UNUSED bench_t *b) {
+	free(bench_env);
+	free(bench_envv);
+	bench_env = NULL;
+	bench_envv = NULL;
+}
+
+/*
+ * Process table operations at scale.
+ */
+
+static int
+bench_proctab_setup(bench_t *b) {
+	if (proctab_init() == -1)
+		return -1;
+	if (b->flags) {
+		for (size_t i = 0; i < b->n; i++) {
+			if (!proctab_create((pid_t)(i + 1)))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static size_t
+bench_proctab_find_run(bench_t *b) {
+	size_t pid = 1;
+
+	/* visit all pids in an order unrelated to insertion order */
+	for (size_t i = 0; i < b->n; i++) {
+		pid = (pid * 7919) % b->n + 1;
+		if (!proctab_find((pid_t)pid))
+			return 0;
 	}
+	return b->n;
+}
+
+static size_t
+bench_proctab_cycle_run(bench_t *b) {
+	for (size_t i = 0; i < b->n; i++) {
+		if (!proctab_create((pid_t)(i + 1)))
+			return 0;
+	}
+	for (size_t i = 0; i < b->n; i++) {
+		if (!proctab_find((pid_t)(i + 1)))
+			return 0;
+	}
+	for (size_t i = 0; i < b->n; i++)
+		proctab_remove((pid_t)(i + 1), NULL);
+	return b->n * 3;
+}
+
+static void
+bench_proctab_teardown(UNUSED bench_t *b) {
+	proctab_fini();
+}
 
-	const char *paths[] = {
-#if 1
-		"/usr/sbin/php-fpm",
-#else
-		"/Applications/Microsoft Word.app/Contents/MacOS/Microsoft Word",
-#endif
-		"/usr/sbin/coreaudiod",
-		"/usr/sbin/mkpassdb",
-		"/usr/bin/iotop"
-	};
+/*
+ * The prepq lookup pattern:  entries appended in arrival order to a list
+ * and indexed by pid, looked up by pid and removed while a window of other
+ * entries is pending.
+ */
+
+typedef struct {
+	pid_t pid;
+	tommy_node lnode;
+	tommy_node hnode;
+} bench_pqent_t;
+
+static tommy_list bench_pqlist;
+static tommy_hashinc bench_pqbypid;
+static bench_pqent_t *bench_pqents;
+static pid_t bench_pqnext;
+static size_t bench_pqfree;             /* entry to append next */
+
+#define hashpid(P) tommy_inthash_u32((uint32_t)(P))
+
+static void
+bench_prepq_append(bench_pqent_t *ent, pid_t pid) {
+	ent->pid = pid;
+	tommy_list_insert_tail(&bench_pqlist, &ent->lnode, ent);
+	tommy_hashinc_insert(&bench_pqbypid, &ent->hnode, ent, hashpid(pid));
+}
 
-	double avg;
+static int
+bench_prepq_setup(bench_t *b) {
+	bench_pqents = malloc((b->n + 1) * sizeof(bench_pqent_t));
+	if (!bench_pqents)
+		return -1;
+	tommy_list_init(&bench_pqlist);
+	tommy_hashinc_init(&bench_pqbypid);
+	for (size_t i = 0; i < b->n; i++)
+		bench_prepq_append(&bench_pqents[i], (pid_t)(i + 1));
+	bench_pqnext = (pid_t)(b->n + 1);
+	bench_pqfree = b->n;
+	return 0;
+}
+
+#define BENCH_PREPQ_OPS 100000
 
-	printf("                    10m       1m     100k      10k\n");
-	printf("md5             ");
-	for (int i = 0; i < 4; i++) {
-		path = paths[i];
+static size_t
+bench_prepq_run(bench_t *b) {
+	tommy_node *node;
+	bench_pqent_t *ent;
+	pid_t pid;
 
-		hashes_flags = HASH_MD5;
-		avg = timeit_average(10, timeit_hashes);
-		printf(" %f", avg);
+	for (size_t i = 0; i < BENCH_PREPQ_OPS; i++) {
+		bench_prepq_append(&bench_pqents[bench_pqfree], bench_pqnext);
+		pid = bench_pqnext - (pid_t)b->n;
+		node = tommy_hashinc_bucket(&bench_pqbypid, hashpid(pid));
+		for (; node; node = node->next) {
+			ent = node->data;
+			if (ent->pid == pid)
+				break;
+		}
+		if (!node)
+			return 0;
+		tommy_list_remove_existing(&bench_pqlist, &ent->lnode);
+		tommy_hashinc_remove_existing(&bench_pqbypid, &ent->hnode);
+		bench_pqfree = (size_t)(ent - bench_pqents);
+		bench_pqnext++;
 	}
-	printf("\n");
+	return BENCH_PREPQ_OPS;
+}
 
-	printf("sha1            ");
-	for (int i = 0; i < 4; i++) {
-		path = paths[i];
+static void
+bench_prepq_teardown(UNUSED bench_t *b) {
+	tommy_hashinc_done(&bench_pqbypid);
+	free(bench_pqents);
+	bench_pqents = NULL;
+}
 
-		hashes_flags = HASH_SHA1;
-		avg = timeit_average(10, timeit_hashes);
-		printf(" %f", avg);
+/*
+ * String set lookups of absent and present strings, as used for the
+ * suppression lists.
+ */
+
+static setstr_t bench_set;
+static char **bench_keys;
+
+static int
+bench_setstr_setup(bench_t *b) {
+	char **strings;
+	char buf[64];
+
+	strings = malloc(b->n * sizeof(char *));
+	bench_keys = malloc(b->n * 2 * sizeof(char *));
+	if (!strings || !bench_keys) {
+		free(strings);
+		free(bench_keys);
+		return -1;
+	}
+	for (size_t i = 0; i < b->n * 2; i++) {
+		snprintf(buf, sizeof(buf), "/usr/local/bin/tool%zu", i);
+		bench_keys[i] = strdup(buf);
+		if (!bench_keys[i])
+			return -1;
+		if (i < b->n) {
+			strings[i] = strdup(buf);
+			if (!strings[i])
+				return -1;
+		}
+	}
+	if (b->flags) {
+		/* directory prefixes none of the keys is beneath */
+		for (size_t i = 0; i < b->n / 8; i++) {
+			free(strings[i]);
+			snprintf(buf, sizeof(buf), "/Applications/App%zu/", i);
+			strings[i] = strdup(buf);
+			if (!strings[i])
+				return -1;
+		}
+	}
+	return setstr_init(&bench_set, b->n, strings);
+}
+
+static size_t
+bench_setstr_contains_run(bench_t *b) {
+	for (size_t i = 0; i < b->n * 2; i++)
+		sink += setstr_contains(&bench_set, bench_keys[i]);
+	return b->n * 2;
+}
+
+static size_t
+bench_setstr_contains_path_run(bench_t *b) {
+	for (size_t i = 0; i < b->n * 2; i++)
+		sink += setstr_contains_path(&bench_set, bench_keys[i]);
+	return b->n * 2;
+}
+
+static size_t
+bench_setstr_contains3_run(bench_t *b) {
+	for (size_t i = 0; i < b->n * 2; i++)
+		sink += setstr_contains3(&bench_set, bench_keys[i], "501");
+	return b->n * 2;
+}
+
+static void
+bench_setstr_teardown(bench_t *b) {
+	setstr_destroy(&bench_set);
+	for (size_t i = 0; i < b->n * 2; i++)
+		free(bench_keys[i]);
+	free(bench_keys);
+	bench_keys = NULL;
+}
+
+/*
+ * Baseline for the setstr benchmarks:  the same lookups against a chained
+ * hash table hashing the whole string, as setstr used before it switched to
+ * a perfect hash.
+ */
+
+typedef struct {
+	tommy_hashtable_node h_node;
+	char *str;
+} bench_strtbl_obj_t;
+
+static tommy_hashtable bench_strtbl;
+
+static int
+bench_strtbl_cmp(const void *str, const void *vobj) {
+	return strcmp(((const bench_strtbl_obj_t *)vobj)->str, str);
+}
+
+static int
+bench_strtbl_setup(bench_t *b) {
+	bench_strtbl_obj_t *obj;
+	char buf[64];
+
+	tommy_hashtable_init(&bench_strtbl, bucket_max_for_buckets(b->n));
+	bench_keys = malloc(b->n * 2 * sizeof(char *));
+	if (!bench_keys)
+		return -1;
+	for (size_t i = 0; i < b->n * 2; i++) {
+		snprintf(buf, sizeof(buf), "/usr/local/bin/tool%zu", i);
+		bench_keys[i] = strdup(buf);
+		if (!bench_keys[i])
+			return -1;
+		if (i < b->n) {
+			obj = malloc(sizeof(bench_strtbl_obj_t));
+			if (!obj)
+				return -1;
+			obj->str = bench_keys[i];
+			tommy_hashtable_insert(&bench_strtbl, &obj->h_node, obj,
+			                       tommy_strhash_u32(0, obj->str));
+		}
 	}
-	printf("\n");
+	return 0;
+}
+
+static size_t
+bench_strtbl_contains_run(bench_t *b) {
+	for (size_t i = 0; i < b->n * 2; i++)
+		sink += !!tommy_hashtable_search(&bench_strtbl,
+		        bench_strtbl_cmp, bench_keys[i],
+		        tommy_strhash_u32(0, bench_keys[i]));
+	return b->n * 2;
+}
+
+static void
+bench_strtbl_teardown(bench_t *b) {
+	tommy_hashtable_foreach(&bench_strtbl, free);
+	tommy_hashtable_done(&bench_strtbl);
+	for (size_t i = 0; i < b->n * 2; i++)
+		free(bench_keys[i]);
+	free(bench_keys);
+	bench_keys = NULL;
+}
+
+/*
+ * Queue throughput with b->flags producers enqueueing concurrently into a
+ * small queue drained by a single consumer, as for the log queue.
+ */
+
+#define BENCH_QUEUE_ITEMS       (1 << 20)
+#define BENCH_QUEUE_CAPACITY    1024
+
+static queue_t bench_queue;
+
+static int
+bench_queue_setup(UNUSED bench_t *b) {
+	return queue_init(&bench_queue, BENCH_QUEUE_CAPACITY, QUEUE_BLOCK,
+	                  NULL);
+}
+
+static void *
+bench_queue_producer(void *arg) {
+	size_t n = (size_t)arg;
+
+	for (size_t i = 1; i <= n; i++)
+		(void)queue_enqueue(&bench_queue, (void *)i);
+	return NULL;
+}
 
-	printf("sha256          ");
-	for (int i = 0; i < 4; i++) {
-		path = paths[i];
+static size_t
+bench_queue_run(bench_t *b) {
+	pthread_t thr[16];
+	void *batch[32];
+	size_t producers = (size_t)b->flags;
+	size_t n = BENCH_QUEUE_ITEMS / producers;
+	size_t got = 0;
 
-		hashes_flags = HASH_SHA256;
-		avg = timeit_average(10, timeit_hashes);
-		printf(" %f", avg);
+	for (size_t i = 0; i < producers; i++) {
+		if (pthread_create(&thr[i], NULL, bench_queue_producer,
+		                   (void *)n) != 0) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(EXIT_FAILURE);
+		}
 	}
-	printf("\n");
+	while (got < n * producers)
+		got += queue_dequeue_batch(&bench_queue, batch, 32);
+	for (size_t i = 0; i < producers; i++)
+		pthread_join(thr[i], NULL);
+	return got;
+}
+
+static void
+bench_queue_teardown(UNUSED bench_t *b) {
+	queue_destroy(&bench_queue);
+}
+
+/*
+ * Rendering of an image-exec event with b->n ancestors by each log format.
+ * Like in the log thread, ancestors are rendered in full once and from the
+ * cached fragment afterwards.  With BENCH_LOGFMT_SPEC, through the renderer
+ * returned by logevt_renderers, which is specialized for the format and
+ * mode if built with LOGFMT_SPECIALIZE, and the generic one otherwise.
+ */
 
-	printf("md5+sha1        ");
-	for (int i = 0; i < 4; i++) {
-		path = paths[i];
+#define BENCH_LOGFMT_OPS        1000
+#define BENCH_LOGFMT_MULTILINE  1
+#define BENCH_LOGFMT_SPEC       2
+
+static logfmt_ctx_t bench_ctx;
+static image_exec_t *bench_images;
+static logevt_func_t bench_logevt;
+static char *bench_argv[] = {"/bin/sh", "-c", "exec true", NULL};
+
+static int
+bench_logfmt_setup(bench_t *b) {
+	image_exec_t *ie;
+
+	bench_cfg.logoneline = !(b->flags & BENCH_LOGFMT_MULTILINE);
+	if (b->fmt->lf_init(&bench_cfg) == -1)
+		return -1;
+	logevt_init(&bench_cfg);
+	if (b->flags & BENCH_LOGFMT_SPEC)
+		bench_logevt = logevt_renderers(b->fmt, bench_cfg.logoneline)[
+		               LOGEVT_IMAGE_EXEC];
+	else
+		bench_logevt = logevt_image_exec;
+	logfmt_ctx_init(&bench_ctx);
+	bench_ctx.f = fopen("/dev/null", "w");
+	if (!bench_ctx.f)
+		return -1;
+	bench_images = calloc(b->n + 1, sizeof(image_exec_t));
+	if (!bench_images) {
+		fclose(bench_ctx.f);
+		return -1;
+	}
+	for (size_t i = 0; i <= b->n; i++) {
+		ie = &bench_images[i];
+		ie->hdr.code = LOGEVT_IMAGE_EXEC;
+		if (timespec_nanotime(&ie->hdr.tv) == -1)
+			return -1;
+		ie->flags = EIFLAG_STAT|EIFLAG_HASHES;
+		ie->id = i + 1;
+		ie->pid = (pid_t)(1000 + i);
+		ie->fork_tv = ie->hdr.tv;
+		ie->argv = bench_argv;
+		ie->path = i == b->n ? "/sbin/launchd" : "/bin/sh";
+		ie->cwd = "/Users/user";
+		ie->subject.pid = ie->pid;
+		ie->subject.auid = 501;
+		ie->subject.euid = 501;
+		ie->subject.egid = 20;
+		ie->subject.ruid = 501;
+		ie->subject.rgid = 20;
+		ie->subject.sid = 100001;
+		ie->subject.dev = (dev_t)-1;
+		ie->stat.mode = 0100755;
+		ie->stat.size = 618416;
+		ie->stat.mtime = ie->hdr.tv;
+		ie->stat.ctime = ie->hdr.tv;
+		ie->stat.btime = ie->hdr.tv;
+		memset(&ie->hashes, 0xA5, sizeof(hashes_t));
+		ie->prev = i < b->n ? &bench_images[i + 1] : NULL;
+	}
+	return 0;
+}
 
-		hashes_flags = HASH_MD5_SHA1;
-		avg = timeit_average(10, timeit_hashes);
-		printf(" %f", avg);
+static size_t
+bench_logfmt_run(bench_t *b) {
+	for (size_t i = 0; i < BENCH_LOGFMT_OPS; i++) {
+		if (bench_logevt(b->fmt, &bench_ctx, &bench_images[0]) == -1)
+			return 0;
 	}
-	printf("\n");
+	return BENCH_LOGFMT_OPS;
+}
+
+static void
+bench_logfmt_teardown(bench_t *b) {
+	for (size_t i = 0; i <= b->n; i++)
+		image_exec_frags_free(&bench_images[i]);
+	free(bench_images);
+	bench_images = NULL;
+	fclose(bench_ctx.f);
+	bench_ctx.f = NULL;
+	logfmt_ctx_fini(&bench_ctx);
+	bench_cfg.logoneline = 1;
+}
+
+/*
+ * Scanning of a b->n byte string without bytes to escape for each string
+ * flavour, and hex encoding of b->n bytes, as done by the log formats for
+ * every string and hash value.  Formatting of timestamps from b->n
+ * consecutive seconds, as done for every timestamp value.
+ */
+
+#define BENCH_LOGUTL_OPS        10000
+
+static size_t (*bench_spans[])(const char *) = {
+	logutl_span_json,
+	logutl_span_yaml,
+	logutl_span_xml,
+};
+static char *bench_str;
+
+static int
+bench_logutl_setup(bench_t *b) {
+	static const char env[] = "PATH=/usr/local/bin:/usr/bin:/bin ";
 
-	printf("sha1+sha256     ");
-	for (int i = 0; i < 4; i++) {
-		path = paths[i];
+	bench_str = malloc(2 * b->n + 1);
+	if (!bench_str)
+		return -1;
+	for (size_t i = 0; i < b->n; i++)
+		bench_str[i] = env[i % (sizeof(env) - 1)];
+	bench_str[b->n] = '\0';
+	return 0;
+}
+
+static size_t
+bench_logutl_span_run(bench_t *b) {
+	size_t (*span)(const char *) = bench_spans[b->flags];
+
+	for (size_t i = 0; i < BENCH_LOGUTL_OPS; i++) {
+		if (span(bench_str) != b->n)
+			return 0;
+	}
+	return BENCH_LOGUTL_OPS;
+}
 
-		hashes_flags = HASH_SHA1_SHA256;
-		avg = timeit_average(10, timeit_hashes);
-		printf(" %f", avg);
+static size_t
+bench_logutl_hex_run(bench_t *b) {
+	for (size_t i = 0; i < BENCH_LOGUTL_OPS; i++) {
+		logutl_hex(bench_str + b->n, (unsigned char *)bench_str,
+		           b->n / 2);
+		sink += (size_t)bench_str[b->n];
 	}
-	printf("\n");
+	return BENCH_LOGUTL_OPS;
+}
 
-	printf("md5+sha256      ");
-	for (int i = 0; i < 4; i++) {
-		path = paths[i];
+static size_t
+bench_logutl_timestamp_run(bench_t *b) {
+	logutl_tscache_t tsc;
+	struct timespec tv;
+	char buf[LOGUTL_TIMESTAMPSZ];
 
-		hashes_flags = HASH_MD5_SHA256;
-		avg = timeit_average(10, timeit_hashes);
-		printf(" %f", avg);
+	logutl_tscache_init(&tsc);
+	tv.tv_sec = 1548592496;
+	for (size_t i = 0; i < BENCH_LOGUTL_OPS; i++) {
+		tv.tv_nsec = (long)(i * 99991 % 1000000000);
+		logutl_timestamp(buf, &tv, &tsc);
+		sink += (size_t)buf[28];
+		if (i % 64 == 63)
+			tv.tv_sec = 1548592496 + (time_t)(i / 64 % b->n);
 	}
-	printf("\n");
+	return BENCH_LOGUTL_OPS;
+}
+
+static void
+bench_logutl_teardown(UNUSED bench_t *b) {
+	free(bench_str);
+	bench_str = NULL;
+}
+
+#define BENCH_HASHES(A,F) \
+	{"hashes/" A "/10m", bench_file_setup, bench_hashes_run, NULL, NULL, \
+	 PATH_10M, F, 1, true}, \
+	{"hashes/" A "/1m", bench_file_setup, bench_hashes_run, NULL, NULL, \
+	 PATH_1M, F, 1, true}, \
+	{"hashes/" A "/100k", bench_file_setup, bench_hashes_run, NULL, NULL, \
+	 PATH_100K, F, 1, true}, \
+	{"hashes/" A "/10k", bench_file_setup, bench_hashes_run, NULL, NULL, \
+	 PATH_10K, F, 1, true}
+
+#define BENCH_LOGFMT_FLAGS(N,F,FL) \
+	{"logfmt/" N "/0", bench_logfmt_setup, bench_logfmt_run, \
+	 bench_logfmt_teardown, &F, NULL, FL, 0, false}, \
+	{"logfmt/" N "/8", bench_logfmt_setup, bench_logfmt_run, \
+	 bench_logfmt_teardown, &F, NULL, FL, 8, false}, \
+	{"logfmt/" N "/32", bench_logfmt_setup, bench_logfmt_run, \
+	 bench_logfmt_teardown, &F, NULL, FL, 32, false}
+#define BENCH_LOGFMT(N,F) BENCH_LOGFMT_FLAGS(N,F,0)
 
-	printf("md5+sha1+sha256 ");
-	for (int i = 0; i < 4; i++) {
-		path = paths[i];
+#define BENCH_LOGUTL(N,F) \
+	{"logutl/" N "/64", bench_logutl_setup, bench_logutl_span_run, \
+	 bench_logutl_teardown, NULL, NULL, F, 64, false}, \
+	{"logutl/" N "/4k", bench_logutl_setup, bench_logutl_span_run, \
+	 bench_logutl_teardown, NULL, NULL, F, 4096, false}
 
-		hashes_flags = HASH_MD5_SHA1_SHA256;
-		avg = timeit_average(10, timeit_hashes);
-		printf(" %f", avg);
+static bench_t benches[] = {
+	BENCH_HASHES("md5", HASH_MD5),
+	BENCH_HASHES("sha1", HASH_SHA1),
+	BENCH_HASHES("sha256", HASH_SHA256),
+	BENCH_HASHES("md5+sha1", HASH_MD5_SHA1),
+	BENCH_HASHES("sha1+sha256", HASH_SHA1_SHA256),
+	BENCH_HASHES("md5+sha256", HASH_MD5_SHA256),
+	BENCH_HASHES("md5+sha1+sha256", HASH_MD5_SHA1_SHA256),
+	BENCH_HASHES("sha256tree", HASH_SHA256TREE),
+	BENCH_HASHES("blake3", HASH_BLAKE3),
+	{"codesign/10m", bench_codesign_setup, bench_codesign_run, NULL, NULL,
+	 PATH_10M, 0, 1, true},
+	{"codesign/1m", bench_codesign_setup, bench_codesign_run, NULL, NULL,
+	 PATH_1M, 0, 1, true},
+	{"codesign/100k", bench_codesign_setup, bench_codesign_run, NULL, NULL,
+	 PATH_100K, 0, 1, true},
+	{"codesign/10k", bench_codesign_setup, bench_codesign_run, NULL, NULL,
+	 PATH_10K, 0, 1, true},
+	{"codesign/1m/verify", bench_codesign_setup, bench_codesign_run,
+	 bench_codesign_teardown, NULL, PATH_1M, 1, 1, true},
+	{"codesign/10k/verify", bench_codesign_setup, bench_codesign_run,
+	 bench_codesign_teardown, NULL, PATH_10K, 1, 1, true},
+	{"cachehash/get", bench_cachehash_setup, bench_cachehash_get_run,
+	 bench_cachehash_teardown, NULL, NULL, 1, 10000, false},
+	{"cachehash/put", bench_cachehash_setup, bench_cachehash_put_run,
+	 bench_cachehash_teardown, NULL, NULL, 0, 10000, false},
+	{"cachecsig/get", bench_cachecsig_setup, bench_cachecsig_get_run,
+	 bench_cachecsig_teardown, NULL, PATH_10K, 1, 1000, false},
+	{"cachecsig/put", bench_cachecsig_setup, bench_cachecsig_put_run,
+	 bench_cachecsig_teardown, NULL, PATH_10K, 0, 1000, false},
+	{"auevent/fread", bench_trace_setup, bench_auevent_fread_run,
+	 bench_trace_teardown, NULL, NULL, AUEVENT_FLAG_ENV_DYLD, 0, false},
+	{"auevent/read", bench_trace_setup, bench_auevent_read_run,
+	 bench_trace_teardown, NULL, NULL, AUEVENT_FLAG_ENV_DYLD, 0, false},
+	{"auevent/read/handlers", bench_trace_setup, bench_auevent_read_run,
+	 bench_trace_teardown, NULL, NULL,
+	 AUEVENT_FLAG_ENV_DYLD|AUEVENT_FLAG_HANDLERS, 0, false},
+	{"auevent/read/envnone", bench_trace_setup, bench_auevent_read_run,
+	 bench_trace_teardown, NULL, NULL, 0, 0, false},
+	{"auevent/read/envfull", bench_trace_setup, bench_auevent_read_run,
+	 bench_trace_teardown, NULL, NULL, AUEVENT_FLAG_ENV_FULL, 0, false},
+	{"aev/prefix/32", bench_aev_setup, bench_aev_buf_run,
+	 bench_aev_teardown, NULL, NULL, 0, 32, false},
+	{"aev/prefix/512", bench_aev_setup, bench_aev_buf_run,
+	 bench_aev_teardown, NULL, NULL, 0, 512, false},
+	{"aev/baseline/32", bench_aev_setup, bench_aev_baseline_run,
+	 bench_aev_teardown, NULL, NULL, 0, 32, false},
+	{"aev/baseline/512", bench_aev_setup, bench_aev_baseline_run,
+	 bench_aev_teardown, NULL, NULL, 0, 512, false},
+	{"proctab/find/100k", bench_proctab_setup, bench_proctab_find_run,
+	 bench_proctab_teardown, NULL, NULL, 1, 100000, false},
+	{"proctab/cycle/100k", bench_proctab_setup, bench_proctab_cycle_run,
+	 bench_proctab_teardown, NULL, NULL, 0, 100000, false},
+	{"prepq/lookup/1", bench_prepq_setup, bench_prepq_run,
+	 bench_prepq_teardown, NULL, NULL, 0, 1, false},
+	{"prepq/lookup/16", bench_prepq_setup, bench_prepq_run,
+	 bench_prepq_teardown, NULL, NULL, 0, 16, false},
+	{"prepq/lookup/1024", bench_prepq_setup, bench_prepq_run,
+	 bench_prepq_teardown, NULL, NULL, 0, 1024, false},
+	{"setstr/contains/1k", bench_setstr_setup, bench_setstr_contains_run,
+	 bench_setstr_teardown, NULL, NULL, 0, 1000, false},
+	{"setstr/contains_path/1k", bench_setstr_setup,
+	 bench_setstr_contains_path_run,
+	 bench_setstr_teardown, NULL, NULL, 1, 1000, false},
+	{"setstr/contains3/1k", bench_setstr_setup, bench_setstr_contains3_run,
+	 bench_setstr_teardown, NULL, NULL, 0, 1000, false},
+	{"setstr/baseline/1k", bench_strtbl_setup, bench_strtbl_contains_run,
+	 bench_strtbl_teardown, NULL, NULL, 0, 1000, false},
+	{"queue/producers/1", bench_queue_setup, bench_queue_run,
+	 bench_queue_teardown, NULL, NULL, 1, 0, false},
+	{"queue/producers/4", bench_queue_setup, bench_queue_run,
+	 bench_queue_teardown, NULL, NULL, 4, 0, false},
+	{"queue/producers/16", bench_queue_setup, bench_queue_run,
+	 bench_queue_teardown, NULL, NULL, 16, 0, false},
+	BENCH_LOGFMT("json", logfmtjson),
+	BENCH_LOGFMT("json-seq", logfmtjsonseq),
+	BENCH_LOGFMT("yaml", logfmtyaml),
+	BENCH_LOGFMT("xml", logfmtxml),
+	BENCH_LOGFMT("cbor", logfmtcbor),
+	BENCH_LOGFMT_FLAGS("json/spec", logfmtjson, BENCH_LOGFMT_SPEC),
+	BENCH_LOGFMT_FLAGS("json-multiline", logfmtjson,
+	                   BENCH_LOGFMT_MULTILINE),
+	BENCH_LOGFMT_FLAGS("json-multiline/spec", logfmtjson,
+	                   BENCH_LOGFMT_MULTILINE|BENCH_LOGFMT_SPEC),
+	BENCH_LOGFMT_FLAGS("yaml/spec", logfmtyaml,
+	                   BENCH_LOGFMT_MULTILINE|BENCH_LOGFMT_SPEC),
+	BENCH_LOGFMT_FLAGS("xml/spec", logfmtxml, BENCH_LOGFMT_SPEC),
+	BENCH_LOGFMT_FLAGS("xml-multiline", logfmtxml,
+	                   BENCH_LOGFMT_MULTILINE),
+	BENCH_LOGFMT_FLAGS("xml-multiline/spec", logfmtxml,
+	                   BENCH_LOGFMT_MULTILINE|BENCH_LOGFMT_SPEC),
+	BENCH_LOGUTL("span_json", 0),
+	BENCH_LOGUTL("span_yaml", 1),
+	BENCH_LOGUTL("span_xml", 2),
+	{"logutl/hex/32", bench_logutl_setup, bench_logutl_hex_run,
+	 bench_logutl_teardown, NULL, NULL, 0, 64, false},
+	{"logutl/hex/4k", bench_logutl_setup, bench_logutl_hex_run,
+	 bench_logutl_teardown, NULL, NULL, 0, 8192, false},
+	{"logutl/timestamp/1", NULL, bench_logutl_timestamp_run,
+	 NULL, NULL, NULL, 0, 1, false},
+	{"logutl/timestamp/16", NULL, bench_logutl_timestamp_run,
+	 NULL, NULL, NULL, 0, 16, false},
+};
+#define BENCHES (sizeof(benches)/sizeof(benches[0]))
+
+static int
+double_cmp(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Nearest-rank percentile of n sorted samples.
+ */
+static double
+percentile(const double *v, size_t n, unsigned int pct) {
+	size_t rank = (pct * n + 99) / 100;
+
+	return v[rank > 0 ? rank - 1 : 0];
+}
+
+/*
+ * Run benchmark b and print its results.  Returns 0 on success, 1 if the
+ * benchmark was skipped and -1 on errors.
+ */
+static int
+bench_run(bench_t *b) {
+	double *ns;
+	uint64_t t0, t1;
+	size_t ops = 0;
+
+	if (b->setup && b->setup(b) == -1) {
+		if (!opt_json)
+			printf("%-28s skipped\n", b->name);
+		return 1;
+	}
+	ns = malloc(opt_reps * sizeof(double));
+	if (!ns) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < opt_warmup + opt_reps; i++) {
+		if (b->fileio && opt_cold)
+			purge();
+		t0 = timespec_mononsec();
+		ops = b->run(b);
+		t1 = timespec_mononsec();
+		if (ops == 0) {
+			fprintf(stderr, "%s failed\n", b->name);
+			free(ns);
+			if (b->teardown)
+				b->teardown(b);
+			return -1;
+		}
+		if (i >= opt_warmup)
+			ns[i - opt_warmup] = (double)(t1 - t0) / ops;
 	}
-	printf("\n");
+	if (b->teardown)
+		b->teardown(b);
 
-	printf("codesign        ");
-	for (int i = 0; i < 4; i++) {
-		path = paths[i];
+	qsort(ns, opt_reps, sizeof(double), double_cmp);
+	if (opt_json)
+		printf("{\"name\":\"%s\",\"unit\":\"ns/op\",\"reps\":%zu,"
+		       "\"ops\":%zu,\"min\":%.1f,\"p50\":%.1f,\"p90\":%.1f,"
+		       "\"p99\":%.1f,\"max\":%.1f}\n",
+		       b->name, opt_reps, ops, ns[0],
+		       percentile(ns, opt_reps, 50),
+		       percentile(ns, opt_reps, 90),
+		       percentile(ns, opt_reps, 99),
+		       ns[opt_reps - 1]);
+	else
+		printf("%-28s %8zu %12.1f %12.1f %12.1f %12.1f %12.1f\n",
+		       b->name, ops, ns[0],
+		       percentile(ns, opt_reps, 50),
+		       percentile(ns, opt_reps, 90),
+		       percentile(ns, opt_reps, 99),
+		       ns[opt_reps - 1]);
+	fflush(stdout);
+	free(ns);
+	return 0;
+}
+
+static void
+fusage(FILE *f, const char *argv0) {
+	fprintf(f,
+"Usage: %s [-hjlc] [-n reps] [-w warmup] [-t trace] [filter ...]\n"
+" -h             print usage\n"
+" -j             print results as one JSON object per line\n"
+" -l             list benchmarks\n"
+" -c             purge the buffer cache before file I/O (needs root)\n"
+" -n reps        measured repetitions per benchmark (default: 20)\n"
+" -w warmup      unmeasured repetitions per benchmark (default: 3)\n"
+" -t trace       audit trail file for the auevent benchmarks, as written\n"
+"                to /var/audit or read from /dev/auditpipe\n"
+" filter         only run benchmarks whose name starts with filter\n"
+"\n"
+"Times are in nanoseconds per operation.\n"
+, argv0);
+}
 
-		avg = timeit_average(10, timeit_codesign);
-		printf(" %f", avg);
+static bool
+bench_selected(bench_t *b, int filterc, char *filterv[]) {
+	if (filterc == 0)
+		return true;
+	for (int i = 0; i < filterc; i++) {
+		if (!strncmp(b->name, filterv[i], strlen(filterv[i])))
+			return true;
 	}
-	printf("\n");
+	return false;
+}
+
+int
+main(int argc, char *argv[]) {
+	int ch;
+	const char *argv0 = argv[0];
+	bool list = false;
+	int rv = EXIT_SUCCESS;
 
-	printf("\n");
+	while ((ch = getopt(argc, argv, "hjlcn:w:t:")) != -1) {
+		switch (ch) {
+			case 'h':
+				fusage(stdout, argv0);
+				exit(EXIT_SUCCESS);
+			case 'j':
+				opt_json = true;
+				break;
+			case 'l':
+				list = true;
+				break;
+			case 'c':
+				opt_cold = true;
+				break;
+			case 'n':
+				opt_reps = strtoul(optarg, NULL, 10);
+				if (opt_reps == 0) {
+					fusage(stderr, argv0);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'w':
+				opt_warmup = strtoul(optarg, NULL, 10);
+				break;
+			case 't':
+				opt_trace = optarg;
+				break;
+			case '?':
+				exit(EXIT_FAILURE);
+			default:
+				fusage(stderr, argv0);
+				exit(EXIT_FAILURE);
+		}
+	}
+	argc -= optind;
+	argv += optind;
 
-	printf("cache               get      put\n");
-	printf("stat>hash[sz=0] ");
-	avg = timeit_average(10, timeit_cachehash_get);
-	printf(" %f", avg);
-	avg = timeit_average(10, timeit_cachehash_put);
-	printf(" %f", avg);
-	printf("\n");
+	if (list) {
+		for (size_t i = 0; i < BENCHES; i++) {
+			if (bench_selected(&benches[i], argc, argv))
+				printf("%s\n", benches[i].name);
+		}
+		exit(EXIT_SUCCESS);
+	}
 
-	printf("hash>csig[sz=0] ");
-	avg = timeit_average(10, timeit_cachecsig_get);
-	printf(" %f", avg);
-	avg = timeit_average(10, timeit_cachecsig_put);
-	printf(" %f", avg);
-	printf("\n");
+	/* defaults of config_new without loading a configuration file */
+	bzero(&bench_cfg, sizeof(bench_cfg));
+	bench_cfg.hflags = HASH_SHA256;
+	bench_cfg.codesign = true;
+	bench_cfg.envlevel = ENVLEVEL_DYLD;
+	bench_cfg.omit_apple_hashes = true;
+	bench_cfg.ancestors = SIZE_MAX;
+	bench_cfg.logoneline = 1;
+	hashes_init(HASHES_CHUNKSZ_DEFAULT, false, false, 0);
+	if (codesign_init(&bench_cfg) == -1) {
+		fprintf(stderr, "Failed to initialize codesign\n");
+		exit(EXIT_FAILURE);
+	}
 
+	if (!opt_json)
+		printf("%-28s %8s %12s %12s %12s %12s %12s\n",
+		       "benchmark", "ops", "min", "p50", "p90", "p99", "max");
+	for (size_t i = 0; i < BENCHES; i++) {
+		if (!bench_selected(&benches[i], argc, argv))
+			continue;
+		if (bench_run(&benches[i]) == -1)
+			rv = EXIT_FAILURE;
+	}
 
-	exit(EXIT_SUCCESS);
+	codesign_fini();
+	exit(rv);
 }
 
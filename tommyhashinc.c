@@ -0,0 +1,206 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+/*
+ * Extension to TommyDS, dual-licenced under the licensing terms of xnumon
+ * (OSL 3.0) and TommyDS (2-Clause BSD).
+ */
+
+#include "tommyhashinc.h"
+#include "tommylist.h"
+
+#define TOMMY_HASHINC_STABLE    0
+#define TOMMY_HASHINC_GROW      1
+#define TOMMY_HASHINC_SHRINK    2
+
+void tommy_hashinc_init(tommy_hashinc* hashinc)
+{
+	tommy_uint_t i;
+
+	for (i = 0; i < TOMMY_HASHINC_SEGMENTS; ++i)
+		hashinc->segment[i] = 0;
+	hashinc->bucket_bit = TOMMY_HASHINC_BIT;
+	hashinc->bucket_max = 1 << hashinc->bucket_bit;
+	hashinc->bucket_mask = hashinc->bucket_max - 1;
+	hashinc->segment[0] = tommy_cast(tommy_hashinc_node**, tommy_calloc(hashinc->bucket_max, sizeof(tommy_hashinc_node*)));
+	hashinc->low_mask = hashinc->bucket_mask;
+	hashinc->split = 0;
+	hashinc->state = TOMMY_HASHINC_STABLE;
+	hashinc->count = 0;
+}
+
+void tommy_hashinc_done(tommy_hashinc* hashinc)
+{
+	tommy_uint_t i;
+
+	for (i = 0; i <= hashinc->bucket_bit - TOMMY_HASHINC_BIT; ++i)
+		tommy_free(hashinc->segment[i]);
+}
+
+/*
+ * Move the nodes of bucket split that belong to its new sibling.
+ */
+static void tommy_hashinc_split(tommy_hashinc* hashinc)
+{
+	tommy_hashinc_node** lo = tommy_hashinc_pos(hashinc, hashinc->split);
+	tommy_hashinc_node** hi = tommy_hashinc_pos(hashinc, hashinc->split + hashinc->low_mask + 1);
+	tommy_hashinc_node* j = *lo;
+
+	*lo = 0;
+	while (j) {
+		tommy_hashinc_node* j_next = j->next;
+		tommy_hashinc_node** dst = (j->key & hashinc->bucket_mask) == hashinc->split ? lo : hi;
+		if (*dst)
+			tommy_list_insert_tail_not_empty(*dst, j);
+		else
+			tommy_list_insert_first(dst, j);
+		j = j_next;
+	}
+}
+
+/*
+ * Advance a resize in progress by up to TOMMY_HASHINC_STEP buckets, and
+ * start a new one if the load factor calls for it.
+ */
+static void tommy_hashinc_step(tommy_hashinc* hashinc)
+{
+	tommy_count_t low_max;
+	tommy_uint_t n;
+
+	for (n = 0; n < TOMMY_HASHINC_STEP && hashinc->state != TOMMY_HASHINC_STABLE; ++n) {
+		low_max = hashinc->low_mask + 1;
+		if (hashinc->state == TOMMY_HASHINC_GROW) {
+			tommy_hashinc_split(hashinc);
+			if (++hashinc->split == low_max) {
+				hashinc->low_mask = hashinc->bucket_mask;
+				hashinc->split = 0;
+				hashinc->state = TOMMY_HASHINC_STABLE;
+			}
+		} else {
+			tommy_hashinc_node** hi;
+
+			--hashinc->split;
+			hi = tommy_hashinc_pos(hashinc, hashinc->split + low_max);
+			tommy_list_concat(tommy_hashinc_pos(hashinc, hashinc->split), hi);
+			*hi = 0;
+			if (hashinc->split == 0) {
+				tommy_free(hashinc->segment[hashinc->bucket_bit - TOMMY_HASHINC_BIT]);
+				hashinc->segment[hashinc->bucket_bit - TOMMY_HASHINC_BIT] = 0;
+				--hashinc->bucket_bit;
+				hashinc->bucket_max = low_max;
+				hashinc->bucket_mask = hashinc->low_mask;
+				hashinc->state = TOMMY_HASHINC_STABLE;
+			}
+		}
+	}
+	if (hashinc->state != TOMMY_HASHINC_STABLE)
+		return;
+
+	/* grow if more than 50% full */
+	if (hashinc->count >= hashinc->bucket_max / 2) {
+		hashinc->segment[hashinc->bucket_bit - TOMMY_HASHINC_BIT + 1] = tommy_cast(tommy_hashinc_node**, tommy_calloc(hashinc->bucket_max, sizeof(tommy_hashinc_node*)));
+		hashinc->low_mask = hashinc->bucket_mask;
+		hashinc->split = 0;
+		++hashinc->bucket_bit;
+		hashinc->bucket_max <<= 1;
+		hashinc->bucket_mask = hashinc->bucket_max - 1;
+		hashinc->state = TOMMY_HASHINC_GROW;
+		return;
+	}
+
+	/* shrink if less than 12.5% full */
+	if (hashinc->count <= hashinc->bucket_max / 8 && hashinc->bucket_bit > TOMMY_HASHINC_BIT) {
+		hashinc->low_mask = hashinc->bucket_mask >> 1;
+		hashinc->split = hashinc->low_mask + 1;
+		hashinc->state = TOMMY_HASHINC_SHRINK;
+	}
+}
+
+void tommy_hashinc_insert(tommy_hashinc* hashinc, tommy_hashinc_node* node, void* data, tommy_hash_t hash)
+{
+	tommy_list_insert_tail(tommy_hashinc_bucket_ptr(hashinc, hash), node, data);
+
+	node->key = hash;
+
+	++hashinc->count;
+
+	tommy_hashinc_step(hashinc);
+}
+
+void* tommy_hashinc_remove_existing(tommy_hashinc* hashinc, tommy_hashinc_node* node)
+{
+	tommy_list_remove_existing(tommy_hashinc_bucket_ptr(hashinc, node->key), node);
+
+	--hashinc->count;
+
+	tommy_hashinc_step(hashinc);
+
+	return node->data;
+}
+
+void* tommy_hashinc_remove(tommy_hashinc* hashinc, tommy_search_func* cmp, const void* cmp_arg, tommy_hash_t hash)
+{
+	tommy_hashinc_node** bucket = tommy_hashinc_bucket_ptr(hashinc, hash);
+	tommy_hashinc_node* node = *bucket;
+
+	while (node) {
+		/* same bucket may hold multiple hash values */
+		if (node->key == hash && cmp(cmp_arg, node->data) == 0) {
+			tommy_list_remove_existing(bucket, node);
+
+			--hashinc->count;
+
+			tommy_hashinc_step(hashinc);
+
+			return node->data;
+		}
+		node = node->next;
+	}
+
+	return 0;
+}
+
+void tommy_hashinc_foreach(tommy_hashinc* hashinc, tommy_foreach_func* func)
+{
+	tommy_count_t bucket_max = hashinc->bucket_max;
+	tommy_count_t pos;
+
+	for (pos = 0; pos < bucket_max; ++pos) {
+		tommy_hashinc_node* node = *tommy_hashinc_pos(hashinc, pos);
+
+		while (node) {
+			void* data = node->data;
+			node = node->next;
+			func(data);
+		}
+	}
+}
+
+void tommy_hashinc_foreach_arg(tommy_hashinc* hashinc, tommy_foreach_arg_func* func, void* arg)
+{
+	tommy_count_t bucket_max = hashinc->bucket_max;
+	tommy_count_t pos;
+
+	for (pos = 0; pos < bucket_max; ++pos) {
+		tommy_hashinc_node* node = *tommy_hashinc_pos(hashinc, pos);
+
+		while (node) {
+			void* data = node->data;
+			node = node->next;
+			func(arg, data);
+		}
+	}
+}
+
+tommy_size_t tommy_hashinc_memory_usage(tommy_hashinc* hashinc)
+{
+	return hashinc->bucket_max * (tommy_size_t)sizeof(tommy_hashinc_node*)
+	       + tommy_hashinc_count(hashinc) * (tommy_size_t)sizeof(tommy_hashinc_node);
+}
@@ -0,0 +1,113 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef TOMMYHASHINC_H
+#define TOMMYHASHINC_H
+
+/*
+ * Extension to TommyDS, dual-licenced under the licensing terms of xnumon
+ * (OSL 3.0) and TommyDS (2-Clause BSD).
+ *
+ * Chained hashtable with the interface of tommy_hashdyn, that resizes
+ * incrementally instead of in a single step.  Like tommy_hashdyn, it doubles
+ * at a load factor of 0.5 and halves at 0.125, but using linear hashing:
+ * every insert and remove splits or merges at most TOMMY_HASHINC_STEP
+ * buckets, such that no single operation pays for rehashing the whole table.
+ * Splitting TOMMY_HASHINC_STEP >= 2 buckets per operation guarantees that a
+ * resize completes before the next one is due.
+ *
+ * Buckets live in segments that are never moved:  segment 0 holds the first
+ * 2^TOMMY_HASHINC_BIT buckets, and every further segment k as many buckets
+ * as all segments before it, such that doubling allocates a single segment
+ * and halving frees one.
+ *
+ * While resizing, buckets below split are addressed using bucket_mask and
+ * all others using low_mask; stable tables have low_mask == bucket_mask.
+ */
+
+#include "tommyhash.h"
+
+#define TOMMY_HASHINC_BIT       4
+#define TOMMY_HASHINC_STEP      2
+#define TOMMY_HASHINC_SEGMENTS  (32 - TOMMY_HASHINC_BIT + 1)
+
+typedef tommy_node tommy_hashinc_node;
+
+typedef struct tommy_hashinc_struct {
+	tommy_hashinc_node** segment[TOMMY_HASHINC_SEGMENTS];
+	tommy_uint_t bucket_bit; /* allocated buckets are 2^bucket_bit */
+	tommy_count_t bucket_max;
+	tommy_count_t bucket_mask;
+	tommy_count_t low_mask; /* mask of buckets not yet split or merged */
+	tommy_count_t split; /* buckets below use bucket_mask */
+	tommy_uint_t state;
+	tommy_count_t count;
+} tommy_hashinc;
+
+void tommy_hashinc_init(tommy_hashinc* hashinc);
+void tommy_hashinc_done(tommy_hashinc* hashinc);
+void tommy_hashinc_insert(tommy_hashinc* hashinc, tommy_hashinc_node* node, void* data, tommy_hash_t hash);
+void* tommy_hashinc_remove(tommy_hashinc* hashinc, tommy_search_func* cmp, const void* cmp_arg, tommy_hash_t hash);
+void* tommy_hashinc_remove_existing(tommy_hashinc* hashinc, tommy_hashinc_node* node);
+void tommy_hashinc_foreach(tommy_hashinc* hashinc, tommy_foreach_func* func);
+void tommy_hashinc_foreach_arg(tommy_hashinc* hashinc, tommy_foreach_arg_func* func, void* arg);
+tommy_size_t tommy_hashinc_memory_usage(tommy_hashinc* hashinc);
+
+/*
+ * Bucket at position pos, in segment 0 or in the segment of the most
+ * significant bit of pos.
+ */
+tommy_inline tommy_hashinc_node** tommy_hashinc_pos(tommy_hashinc* hashinc, tommy_count_t pos)
+{
+	tommy_uint_t bsr;
+
+	if (pos < (1U << TOMMY_HASHINC_BIT))
+		return &hashinc->segment[0][pos];
+	bsr = tommy_ilog2_u32(pos);
+	return &hashinc->segment[bsr - TOMMY_HASHINC_BIT + 1][pos - (1U << bsr)];
+}
+
+tommy_inline tommy_hashinc_node** tommy_hashinc_bucket_ptr(tommy_hashinc* hashinc, tommy_hash_t hash)
+{
+	tommy_count_t pos = hash & hashinc->low_mask;
+
+	if (pos < hashinc->split)
+		pos = hash & hashinc->bucket_mask;
+	return tommy_hashinc_pos(hashinc, pos);
+}
+
+/*
+ * Returns the first node of the bucket of hash, which may also contain nodes
+ * with other hashes.
+ */
+tommy_inline tommy_hashinc_node* tommy_hashinc_bucket(tommy_hashinc* hashinc, tommy_hash_t hash)
+{
+	return *tommy_hashinc_bucket_ptr(hashinc, hash);
+}
+
+tommy_inline void* tommy_hashinc_search(tommy_hashinc* hashinc, tommy_search_func* cmp, const void* cmp_arg, tommy_hash_t hash)
+{
+	tommy_hashinc_node* i = tommy_hashinc_bucket(hashinc, hash);
+
+	while (i) {
+		/* same bucket may hold multiple hash values */
+		if (i->key == hash && cmp(cmp_arg, i->data) == 0)
+			return i->data;
+		i = i->next;
+	}
+	return 0;
+}
+
+tommy_inline tommy_count_t tommy_hashinc_count(tommy_hashinc* hashinc)
+{
+	return hashinc->count;
+}
+
+#endif
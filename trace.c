@@ -0,0 +1,387 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#include "trace.h"
+
+#include "time.h"
+#include "minmax.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <assert.h>
+
+/*
+ * Trace files capture the raw input of xnumon, that is the audit(4) records
+ * read from auditpipe(4) and the exec messages read from the kext, so that
+ * a workload can be replayed through the same code paths later, for
+ * debugging and benchmarking.  A trace file is a trace_header_t followed by
+ * records consisting of a trace_rec_t and the payload, in host byte order.
+ * Only audit records that passed the type filter are recorded.  Kext
+ * messages are recorded with a cookie of 0, so that replayed messages are
+ * never acknowledged.
+ *
+ * On replay, a thread reads the trace file and writes the audit records into
+ * a pipe and the kext messages into a datagram socket, which the event loop
+ * reads instead of auditpipe(4) and the kext device.  Records are paced
+ * according to their recorded time scaled by speed percent, or written as
+ * fast as the event loop consumes them if speed is 0.  Once all records
+ * have been written, the audit pipe is closed and the resulting end of file
+ * makes the event loop shut down gracefully.
+ */
+
+static pthread_mutex_t recmutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE *recf = NULL;
+static bool recfailed;
+static uint64_t rect0;
+static uint64_t reclast;
+static uint64_t reccount;
+
+int
+trace_record_open(const char *path) {
+	trace_header_t th;
+
+	assert(!recf);
+	recf = fopen(path, "w");
+	if (!recf)
+		return -1;
+	bzero(&th, sizeof(th));
+	memcpy(th.magic, TRACE_MAGIC, sizeof(th.magic));
+	th.version = TRACE_VERSION;
+	if (fwrite(&th, sizeof(th), 1, recf) != 1) {
+		int e = errno;
+		fclose(recf);
+		recf = NULL;
+		errno = e;
+		return -1;
+	}
+	recfailed = false;
+	rect0 = timespec_mononsec();
+	reclast = 0;
+	reccount = 0;
+	return 0;
+}
+
+/*
+ * Must only be called after all threads recording have stopped.
+ */
+void
+trace_record_close(void) {
+	if (!recf)
+		return;
+	if (fclose(recf) == EOF && !recfailed)
+		fprintf(stderr, "Failed to close trace file: %s (%i)\n",
+		                strerror(errno), errno);
+	recf = NULL;
+	fprintf(stderr, "Recorded %"PRIu64" trace records\n", reccount);
+}
+
+bool
+trace_recording(void) {
+	return recf != NULL;
+}
+
+/*
+ * Append a record to the trace file.  Called from both the main thread and
+ * the kextloop thread.  After the first write error, recording stops.
+ */
+void
+trace_record(uint32_t type, const void *buf, size_t len) {
+	trace_rec_t tr;
+	uint64_t now;
+
+	if (!recf || len > TRACE_RECMAX)
+		return;
+	tr.type = type;
+	tr.len = (uint32_t)len;
+	pthread_mutex_lock(&recmutex);
+	if (recfailed)
+		goto out;
+	now = timespec_mononsec();
+	if (now > rect0)
+		reclast = max(reclast, now - rect0);
+	tr.nsec = reclast;
+	if (fwrite(&tr, sizeof(tr), 1, recf) != 1 ||
+	    (len > 0 && fwrite(buf, len, 1, recf) != 1)) {
+		fprintf(stderr, "Failed to write trace record: %s (%i), "
+		                "recording stopped\n",
+		                strerror(errno), errno);
+		recfailed = true;
+		goto out;
+	}
+	reccount++;
+out:
+	pthread_mutex_unlock(&recmutex);
+}
+
+void
+trace_record_kext(const xnumon_msg_t *msg) {
+	uint64_t buf[XNUMON_MSG_ALIGN(XNUMON_MSG_MAX) / sizeof(uint64_t)];
+	xnumon_msg_t *copy = (xnumon_msg_t *)buf;
+
+	if (!recf || msg->msgsz > XNUMON_MSG_MAX)
+		return;
+	memcpy(buf, msg, msg->msgsz);
+	copy->cookie = 0;
+	trace_record(TRACE_KEXT, buf, msg->msgsz);
+}
+
+static FILE *playf = NULL;
+static int playfd[2] = {-1, -1};        /* audit pipe, kext socket */
+static pthread_t playthr;
+static bool playstarted;
+static unsigned int playspeed;          /* percent, 0 unpaced */
+static atomic_bool playstop;
+
+/*
+ * Open trace file path for replay and return the fds to read the audit
+ * records from in audfd and the kext messages from in kextfd.  If kextfd is
+ * NULL, kext messages in the trace are skipped.  The caller owns the
+ * returned fds.  Nothing is written to them before trace_replay_start.
+ */
+int
+trace_replay_open(const char *path, int *audfd, int *kextfd) {
+	trace_header_t th;
+	int p[2] = {-1, -1};
+	int s[2] = {-1, -1};
+	int bufsz = 256*1024;
+	int e;
+
+	assert(!playf);
+	playf = fopen(path, "r");
+	if (!playf)
+		return -1;
+	if (fread(&th, sizeof(th), 1, playf) != 1 ||
+	    memcmp(th.magic, TRACE_MAGIC, sizeof(th.magic)) ||
+	    th.version != TRACE_VERSION) {
+		fprintf(stderr, "Not a version %i trace file: %s\n",
+		                TRACE_VERSION, path);
+		errno = EINVAL;
+		goto errout;
+	}
+	if (pipe(p) == -1)
+		goto errout;
+	if (kextfd) {
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, s) == -1)
+			goto errout;
+		(void)setsockopt(s[0], SOL_SOCKET, SO_RCVBUF,
+		                 &bufsz, sizeof(bufsz));
+		(void)setsockopt(s[1], SOL_SOCKET, SO_SNDBUF,
+		                 &bufsz, sizeof(bufsz));
+		/* like the kext device with protocol version 2 */
+		if (fcntl(s[0], F_SETFL, O_NONBLOCK) == -1)
+			goto errout;
+		*kextfd = s[0];
+	}
+	*audfd = p[0];
+	playfd[0] = p[1];
+	playfd[1] = s[1];
+	playstarted = false;
+	atomic_store(&playstop, false);
+	return 0;
+
+errout:
+	e = errno;
+	for (int i = 0; i < 2; i++) {
+		if (p[i] != -1)
+			close(p[i]);
+		if (s[i] != -1)
+			close(s[i]);
+	}
+	fclose(playf);
+	playf = NULL;
+	errno = e;
+	return -1;
+}
+
+bool
+trace_replaying(void) {
+	return playf != NULL;
+}
+
+/*
+ * Sleep until monotonic time due, in slices short enough for
+ * trace_replay_stop not to be held up.
+ */
+static void
+trace_replay_sleep(uint64_t due) {
+	struct timespec ts;
+	uint64_t now, ns;
+
+	while (!atomic_load(&playstop) &&
+	       (now = timespec_mononsec()) != 0 && now < due) {
+		ns = min(due - now, (uint64_t)100000000);
+		ts.tv_sec = (time_t)(ns / 1000000000);
+		ts.tv_nsec = (long)(ns % 1000000000);
+		(void)nanosleep(&ts, NULL);
+	}
+}
+
+/*
+ * Errors caused by the event loop having closed its end are not reported.
+ */
+static int
+trace_replay_write(int fd, const void *buf, size_t len) {
+	const char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EPIPE)
+				fprintf(stderr, "write(trace) failed: "
+				                "%s (%i)\n",
+				                strerror(errno), errno);
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+static int
+trace_replay_send(int fd, const void *buf, size_t len) {
+	struct timespec ts = {0, 1000000};
+
+	for (;;) {
+		if (send(fd, buf, len, 0) != -1)
+			return 0;
+		if (errno == EINTR)
+			continue;
+		/* datagram sockets report a full receiver as ENOBUFS */
+		if ((errno == ENOBUFS || errno == EAGAIN) &&
+		    !atomic_load(&playstop)) {
+			(void)nanosleep(&ts, NULL);
+			continue;
+		}
+		if (errno != EPIPE && errno != ECONNREFUSED &&
+		    errno != ENOTCONN)
+			fprintf(stderr, "send(trace) failed: %s (%i)\n",
+			                strerror(errno), errno);
+		return -1;
+	}
+}
+
+static void *
+trace_replay_thread(UNUSED void *arg) {
+	static uint64_t buf[TRACE_RECMAX / sizeof(uint64_t)];
+	trace_rec_t tr;
+	sigset_t set;
+	uint64_t t0, replayed = 0, skipped = 0;
+	int rv;
+
+	/* write errors are handled as errors, not as signals */
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	(void)pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	t0 = timespec_mononsec();
+	while (!atomic_load(&playstop)) {
+		if (fread(&tr, sizeof(tr), 1, playf) != 1) {
+			if (ferror(playf))
+				fprintf(stderr, "Failed to read trace file: "
+				                "%s (%i)\n",
+				                strerror(errno), errno);
+			break;
+		}
+		if (tr.len > TRACE_RECMAX ||
+		    (tr.len > 0 && fread(buf, tr.len, 1, playf) != 1)) {
+			fprintf(stderr, "Truncated trace record\n");
+			break;
+		}
+		if (playspeed > 0)
+			trace_replay_sleep(t0 + tr.nsec * 100 / playspeed);
+		switch (tr.type) {
+		case TRACE_AUDIT:
+			rv = trace_replay_write(playfd[0], buf, tr.len);
+			break;
+		case TRACE_KEXT:
+			if (playfd[1] == -1) {
+				skipped++;
+				continue;
+			}
+			if (trace_replay_send(playfd[1], buf, tr.len) == -1) {
+				/* kextloop is gone, carry on without it */
+				close(playfd[1]);
+				playfd[1] = -1;
+				skipped++;
+				continue;
+			}
+			rv = 0;
+			break;
+		default:
+			skipped++;
+			continue;
+		}
+		if (rv == -1)
+			break;
+		replayed++;
+	}
+	fprintf(stderr, "Replayed %"PRIu64" trace records (%"PRIu64
+	                " skipped) in %"PRIu64" ms\n", replayed, skipped,
+	                (timespec_mononsec() - t0) / 1000000);
+
+	/* end of file on the audit pipe shuts down the event loop */
+	close(playfd[0]);
+	playfd[0] = -1;
+	return NULL;
+}
+
+/*
+ * Start writing the records to the fds returned by trace_replay_open at
+ * speed percent of the recorded pace, or unpaced if speed is 0.
+ */
+int
+trace_replay_start(unsigned int speed) {
+	assert(playf && !playstarted);
+	playspeed = speed;
+	if (pthread_create(&playthr, NULL, trace_replay_thread, NULL) != 0)
+		return -1;
+	playstarted = true;
+	return 0;
+}
+
+/*
+ * Must be called after the event loop has closed its ends of the fds, so
+ * that the replay thread cannot remain blocked writing to them.
+ */
+void
+trace_replay_stop(void) {
+	if (!playf)
+		return;
+	atomic_store(&playstop, true);
+	if (playstarted && pthread_join(playthr, NULL) != 0) {
+		fprintf(stderr, "Failed to join trace replay thread\n");
+		return;
+	}
+	playstarted = false;
+	for (int i = 0; i < 2; i++) {
+		if (playfd[i] != -1) {
+			close(playfd[i]);
+			playfd[i] = -1;
+		}
+	}
+	fclose(playf);
+	playf = NULL;
+}
+
@@ -0,0 +1,53 @@
+/*-
+ * xnumon - monitor macOS for malicious activity
+ * https://www.roe.ch/xnumon
+ *
+ * Copyright (c) 2017-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * All rights reserved.
+ *
+ * Licensed under the Open Software License version 3.0.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "attrib.h"
+#include "kext/xnumon.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC     "XNTRACE"               /* including terminator */
+#define TRACE_VERSION   1
+
+#define TRACE_AUDIT     1                       /* raw audit(4) record */
+#define TRACE_KEXT      2                       /* xnumon_msg_t, no cookie */
+
+#define TRACE_RECMAX    (1024*1024)             /* > MAXAUDITDATA */
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+} trace_header_t;
+
+typedef struct {
+	uint32_t type;
+	uint32_t len;                           /* of the payload following */
+	uint64_t nsec;                          /* since start of recording */
+} trace_rec_t;
+
+int trace_record_open(const char *) NONNULL(1) WUNRES;
+void trace_record_close(void);
+bool trace_recording(void) WUNRES;
+void trace_record(uint32_t, const void *, size_t) NONNULL(2);
+void trace_record_kext(const xnumon_msg_t *) NONNULL(1);
+
+int trace_replay_open(const char *, int *, int *) NONNULL(1,2) WUNRES;
+int trace_replay_start(unsigned int) WUNRES;
+void trace_replay_stop(void);
+bool trace_replaying(void) WUNRES;
+
+#endif
+
@@ -13,64 +13,561 @@
 #include "logevt.h"
 #include "queue.h"
 #include "log.h"
+#include "governor.h"
 #include "policy.h"
+#include "thrstat.h"
+#include "counter.h"
+#include "probes.h"
+#include "signpost.h"
+#include "time.h"
+#include "minmax.h"
+
+#include "tommyhash.h"
+#include "tommyhashinc.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <assert.h>
 
-static queue_t work_queue;
-static pthread_t work_thr;
-static logevt_header_t work_sentinel;
+/*
+ * The work stage runs config->worker_threads worker threads, each with its
+ * own queue.  Work items are assigned to workers by their affinity, such that
+ * all work items referring to the same image are processed by the same worker
+ * in submission order.  Since workers complete items out of order relative to
+ * each other, completed items pass through a reorder buffer that hands them
+ * to the log stage strictly in submission order, which is timestamp order.
+ *
+ * Work items flagged as bulk by the submitter, such as images that need to
+ * be hashed and are larger than config->bulk_threshold, are processed by a
+ * separate lane of config->bulk_threads bulk threads running with utility
+ * disk I/O policy, so that they do not hold up the small items queued behind
+ * them.  To preserve the per-affinity guarantee, the affinity of a bulk item
+ * is pinned to the bulk lane until that item is processed, routing all items
+ * with the same affinity submitted in the meantime to the bulk lane as well.
+ * The reorder buffer merges the lanes back into submission order.
+ *
+ * Items completed behind a bulk item wait in the reorder buffer until the
+ * bulk item is done, out of reach of the bounds of the work queues.  The
+ * number of items in flight, from submission until they are passed on in
+ * order, is therefore bounded by config->queue_capacity as well, with
+ * config->queue_overflow applied at submission.  Since the oldest items in
+ * flight are being processed, drop-oldest drops the item being submitted.
+ *
+ * Work items of the event types in config->priority_events are processed by
+ * a separate priority lane with a worker thread of its own, and bypass the
+ * reorder buffer, such that a burst of other events cannot delay them beyond
+ * the time it takes to process the priority items queued before them.  They
+ * may therefore be logged ahead of events with earlier timestamps.  Only
+ * items flagged as priority by the submitter take the priority lane, that
+ * is, items that do not depend on the processing of earlier items of the
+ * same affinity; others are processed in the normal lanes.
+ *
+ * Completed items pass through the governor on their way to the log stage,
+ * which may suppress them if their image is producing too many events.
+ *
+ * If config->worker_threads_max is larger than config->worker_threads, the
+ * number of workers in the normal lane follows the load.  Once per second,
+ * work_tick looks at the worst lag between event time and dequeue by a normal
+ * worker during the last second and at the depth of the normal queues.  After
+ * WORK_SCALE_UP_SECS consecutive seconds of lag above config->worker_lag_target
+ * with work queued for every worker, a worker is added, up to
+ * config->worker_threads_max.  After WORK_SCALE_DOWN_SECS consecutive seconds
+ * of lag below half the target with fewer items queued than workers, the last
+ * worker is removed, down to config->worker_threads.  A removed worker stops
+ * receiving items, drains its queue and stays parked on its empty queue until
+ * a later change adds it again, such that at most config->worker_threads_max
+ * worker threads are ever created and no per-thread state comes and goes.
+ *
+ * Every change of the number of workers starts a new routing epoch, in which
+ * affinities map to different workers.  To preserve the per-affinity order
+ * across the change, a worker holds back an item of the new epoch until the
+ * worker its affinity was routed to in the previous epoch has processed all
+ * items of the previous epoch.  There is at most one change in progress, that
+ * is, the next change waits until all items of the previous epoch are done.
+ */
+
+typedef struct {
+	queue_t queue;
+	pthread_t thr;
+	bool bulk;
+	atomic_uint_fast64_t lag;       /* nsec, worst since last tick */
+	atomic_size_t inflight[2];      /* items by parity of their epoch */
+	logevt_header_t sentinel;
+} worker_t;
+
+typedef struct {
+	const void *affinity;
+	size_t count;                   /* items in the bulk lane */
+	tommy_node node;
+} work_pin_t;
+
+#define WORK_BATCH 32
+
+static worker_t workers[WORKER_THREADS_MAX];
+static size_t nworkers;                 /* started, nroute plus parked */
+static worker_t bulkers[BULK_THREADS_MAX];
+static size_t nbulkers;
+static worker_t prioworker;
+static bool priolane;
+
+static bool elastic;                    /* number of workers follows load */
+static size_t nroute;                   /* workers receiving items */
+static atomic_size_t route[2];          /* nroute by parity of epoch */
+static uint32_t epoch;                  /* current routing epoch */
+static pthread_mutex_t epoch_mutex;
+static pthread_cond_t epoch_cond;
+static atomic_uint epoch_waiters;
+
+static struct {
+	size_t min;
+	size_t max;
+	uint64_t target;                /* nsec */
+	unsigned int pressured;         /* consecutive seconds */
+	unsigned int calm;              /* consecutive seconds */
+	uint64_t lag;                   /* usec, last tick */
+	uint64_t ups;
+	uint64_t downs;
+	work_scale_t log[WORK_SCALES];
+	size_t next;
+	size_t count;                   /* since last work_peaks_reset */
+} scale;
+
+static pthread_mutex_t submit_mutex;
+static uint64_t submit_seq;             /* next seq to hand out */
+static uint64_t bulked;                 /* items routed to bulk lane */
+static uint64_t prioritized;            /* items routed to priority lane */
+static counter_t failed;                /* le_work failed */
+static counter_t suppressed;            /* le_work suppressed */
+static counter_t filtered;              /* event type not wanted */
+
+static pthread_mutex_t pins_mutex;
+static tommy_hashinc pins;              /* affinities pinned to bulk lane */
+
+static pthread_mutex_t reorder_mutex;
+static tommy_hashinc reorder_buffer;    /* completed, waiting for reorder_seq */
+static uint64_t reorder_seq;            /* next seq to pass to log stage */
+static pthread_cond_t reorder_cond;     /* reorder_seq advanced */
+static size_t reorder_waiters;
+static size_t reorder_peak;             /* since last work_peaks_reset */
+static uint64_t reorder_drops;          /* too many items in flight */
+static uint64_t reorder_blocks;
 
 static config_t *config = NULL;
 
+static int
+work_pin_cmp(const void *arg, const void *obj) {
+	return arg != ((const work_pin_t *)obj)->affinity;
+}
+
+/*
+ * Decide whether a work item goes to the bulk lane, and if so, pin its
+ * affinity to the bulk lane.  Items without affinity are never pinned.
+ * If no pin can be allocated, the item is processed in the normal lane.
+ */
+static bool
+work_pin(logevt_header_t *hdr) {
+	tommy_hash_t h;
+	work_pin_t *pin;
+
+	if (nbulkers == 0 || !hdr->affinity) {
+		hdr->bulk = false;
+		return false;
+	}
+	h = tommy_inthash_u64((uintptr_t)hdr->affinity);
+	pthread_mutex_lock(&pins_mutex);
+	pin = tommy_hashinc_search(&pins, work_pin_cmp, hdr->affinity, h);
+	if (!pin && hdr->bulk) {
+		pin = malloc(sizeof(work_pin_t));
+		if (pin) {
+			pin->affinity = hdr->affinity;
+			pin->count = 0;
+			tommy_hashinc_insert(&pins, &pin->node, pin, h);
+		}
+	}
+	if (pin)
+		pin->count++;
+	pthread_mutex_unlock(&pins_mutex);
+	hdr->bulk = !!pin;
+	return hdr->bulk;
+}
+
+/*
+ * Release the pin held by a work item leaving the bulk lane.
+ */
+static void
+work_unpin(logevt_header_t *hdr) {
+	work_pin_t *pin;
+
+	pthread_mutex_lock(&pins_mutex);
+	pin = tommy_hashinc_search(&pins, work_pin_cmp, hdr->affinity,
+	                           tommy_inthash_u64((uintptr_t)hdr->affinity));
+	assert(pin && pin->count > 0);
+	if (--pin->count == 0) {
+		tommy_hashinc_remove_existing(&pins, &pin->node);
+		free(pin);
+	}
+	pthread_mutex_unlock(&pins_mutex);
+}
+
+/*
+ * Worker that items with the affinity of hdr are routed to in epoch e.  Only
+ * valid while items of epoch e are in flight, or while e is current.
+ */
+static worker_t *
+work_routed(logevt_header_t *hdr, uint32_t e) {
+	size_t n = atomic_load_explicit(&route[e & 1], memory_order_relaxed);
+
+	return &workers[tommy_inthash_u64((uintptr_t)hdr->affinity) % n];
+}
+
+/*
+ * Hold back an item of a new epoch until the worker its affinity was routed
+ * to in the previous epoch has processed all items of the previous epoch.
+ * Once the epoch has moved on past that of hdr, the epoch before it is known
+ * to be done, see work_settled().
+ */
+static void
+work_wait(worker_t *worker, logevt_header_t *hdr) {
+	worker_t *prev;
+	unsigned int p = (hdr->epoch - 1) & 1;
+
+	prev = work_routed(hdr, hdr->epoch - 1);
+	if (prev == worker || atomic_load(&prev->inflight[p]) == 0)
+		return;
+	pthread_mutex_lock(&epoch_mutex);
+	atomic_fetch_add(&epoch_waiters, 1);
+	while (epoch == hdr->epoch && atomic_load(&prev->inflight[p]) > 0)
+		pthread_cond_wait(&epoch_cond, &epoch_mutex);
+	atomic_fetch_sub(&epoch_waiters, 1);
+	pthread_mutex_unlock(&epoch_mutex);
+}
+
+/*
+ * Account for an item of epoch e leaving worker, waking up the workers
+ * holding back items of the next epoch once worker is done with epoch e.
+ */
+static void
+work_release(worker_t *worker, uint32_t e) {
+	if (atomic_fetch_sub(&worker->inflight[e & 1], 1) == 1 &&
+	    atomic_load(&epoch_waiters) > 0) {
+		pthread_mutex_lock(&epoch_mutex);
+		pthread_cond_broadcast(&epoch_cond);
+		pthread_mutex_unlock(&epoch_mutex);
+	}
+}
+
+/*
+ * Track the worst lag between the event and its dequeue by worker.
+ */
+static void
+work_lag(worker_t *worker, logevt_header_t *hdr) {
+	uint64_t since, lag;
+
+	since = hdr->stamp[LOGEVT_STAMP_EVENT] ? hdr->stamp[LOGEVT_STAMP_EVENT]
+	                                       : hdr->stamp[LOGEVT_STAMP_SUBMIT];
+	if (hdr->stamp[LOGEVT_STAMP_WORK] <= since)
+		return;
+	lag = hdr->stamp[LOGEVT_STAMP_WORK] - since;
+	if (lag > atomic_load_explicit(&worker->lag, memory_order_relaxed))
+		atomic_store_explicit(&worker->lag, lag, memory_order_relaxed);
+}
+
+/*
+ * Apply the overflow policy if config->queue_capacity items are in flight.
+ * Returns false if the item being submitted is to be dropped.  Called with
+ * submit_mutex held.
+ */
+static bool
+work_admit(void) {
+	bool admit = true;
+
+	pthread_mutex_lock(&reorder_mutex);
+	if (submit_seq - reorder_seq >= config->queue_capacity) {
+		if (config->queue_overflow == QUEUE_BLOCK) {
+			reorder_blocks++;
+			reorder_waiters++;
+			do {
+				pthread_cond_wait(&reorder_cond,
+				                  &reorder_mutex);
+			} while (submit_seq - reorder_seq >=
+			         config->queue_capacity);
+			reorder_waiters--;
+		} else {
+			reorder_drops++;
+			admit = false;
+		}
+	}
+	pthread_mutex_unlock(&reorder_mutex);
+	return admit;
+}
+
 void
 work_submit(void *data) {
 	logevt_header_t *hdr = data;
+	worker_t *worker;
+	struct timespec now;
+	uint64_t h, age;
 
 	assert(hdr);
 	assert(hdr->le_free);
-	queue_enqueue(&work_queue, &hdr->node, hdr);
+	hdr->stamp[LOGEVT_STAMP_SUBMIT] = timespec_mononsec();
+	if (timespec_nanotime(&now) != -1) {
+		age = timespec_diff_nsec(&now, &hdr->tv);
+		if (age < hdr->stamp[LOGEVT_STAMP_SUBMIT])
+			hdr->stamp[LOGEVT_STAMP_EVENT] =
+				hdr->stamp[LOGEVT_STAMP_SUBMIT] - age;
+	}
+	if (hdr->priority && priolane &&
+	    LOGEVT_WANT(config->priority_events, LOGEVT_FLAG(hdr->code))) {
+		hdr->bulk = false;
+		pthread_mutex_lock(&submit_mutex);
+		prioritized++;
+		pthread_mutex_unlock(&submit_mutex);
+		XNUMON_WORK_ENQUEUE(hdr->code, 1);
+		(void)queue_enqueue(&prioworker.queue, hdr);
+		return;
+	}
+	hdr->priority = false;
+	h = tommy_inthash_u64((uintptr_t)hdr->affinity);
+	pthread_mutex_lock(&submit_mutex);
+	if (!work_admit()) {
+		pthread_mutex_unlock(&submit_mutex);
+		hdr->le_free(hdr);
+		return;
+	}
+	if (work_pin(hdr)) {
+		worker = &bulkers[h % nbulkers];
+		bulked++;
+	} else {
+		worker = &workers[h % nroute];
+		if (elastic) {
+			hdr->epoch = epoch;
+			atomic_fetch_add(&worker->inflight[epoch & 1], 1);
+		}
+	}
+	hdr->seq = submit_seq++;
+	XNUMON_WORK_ENQUEUE(hdr->code, 0);
+	(void)queue_enqueue(&worker->queue, hdr);
+	pthread_mutex_unlock(&submit_mutex);
+}
+
+static int
+work_seq_cmp(const void *arg, const void *obj) {
+	return *(const uint64_t *)arg != ((const logevt_header_t *)obj)->seq;
+}
+
+static void
+work_pass(logevt_header_t *hdr) {
+	if (hdr->discard)
+		hdr->le_free(hdr);
+	else
+		governor_submit(hdr);
+}
+
+/*
+ * Hand a completed work item to the log stage, along with all items that
+ * were completed earlier by other workers and were waiting for this one.
+ * Priority items are passed on right away; the mutex still serializes them
+ * with the other items on their way through the governor.
+ */
+static void
+work_commit(logevt_header_t *hdr) {
+	pthread_mutex_lock(&reorder_mutex);
+	if (hdr->priority) {
+		work_pass(hdr);
+		pthread_mutex_unlock(&reorder_mutex);
+		return;
+	}
+	if (hdr->seq != reorder_seq) {
+		assert(hdr->seq > reorder_seq);
+		tommy_hashinc_insert(&reorder_buffer, &hdr->node, hdr,
+		                     tommy_inthash_u64(hdr->seq));
+		reorder_peak = max(reorder_peak,
+		                   tommy_hashinc_count(&reorder_buffer));
+		pthread_mutex_unlock(&reorder_mutex);
+		return;
+	}
+	do {
+		work_pass(hdr);
+		reorder_seq++;
+		if (tommy_hashinc_count(&reorder_buffer) == 0)
+			break;
+		hdr = tommy_hashinc_remove(&reorder_buffer, work_seq_cmp,
+		                           &reorder_seq,
+		                           tommy_inthash_u64(reorder_seq));
+	} while (hdr);
+	if (reorder_waiters > 0)
+		pthread_cond_signal(&reorder_cond);
+	pthread_mutex_unlock(&reorder_mutex);
+}
+
+/*
+ * Called by the queue for work items dropped due to the overflow policy.
+ * Dropped items still need to pass the reorder buffer to release the items
+ * submitted after them.
+ */
+static void
+work_drop(void *data) {
+	logevt_header_t *hdr = data;
+
+	if (hdr->bulk)
+		work_unpin(hdr);
+	else if (elastic && !hdr->priority)
+		work_release(work_routed(hdr, hdr->epoch), hdr->epoch);
+	hdr->discard = true;
+	work_commit(hdr);
 }
 
 static void *
-work_thread(UNUSED void *arg) {
+work_thread(void *arg) {
+	worker_t *worker = arg;
 	logevt_header_t *hdr;
+	void *batch[WORK_BATCH];
+	size_t n;
+	int cat;
+	bool normal;
 
 #if 0	/* terra pericolosa */
 	(void)policy_thread_sched_standard();
 #endif
-	(void)policy_thread_diskio_standard();
+	if (worker->bulk) {
+		(void)policy_thread_diskio_utility();
+		(void)policy_thread_qos(THRSTAT_BULK);
+		thrstat_register(THRSTAT_BULK);
+	} else {
+		(void)policy_thread_diskio_standard();
+		(void)policy_thread_qos(THRSTAT_WORK);
+		thrstat_register(THRSTAT_WORK);
+	}
 
 	for (;;) {
-		hdr = queue_dequeue(&work_queue);
-		if (hdr == &work_sentinel)
-			break;
-		if (hdr->le_work) {
-			if (hdr->le_work(hdr) == -1) {
-				hdr->le_free(hdr);
-				continue;
+		n = queue_dequeue_batch(&worker->queue, batch, WORK_BATCH);
+		for (size_t i = 0; i < n; i++) {
+			hdr = batch[i];
+			if (hdr == &worker->sentinel)
+				return NULL;
+			XNUMON_WORK_DEQUEUE(hdr->code);
+			cat = signpost_category(LOGEVT_FLAG(hdr->code));
+			SIGNPOST_BEGIN(cat, "work", hdr);
+			normal = elastic && !hdr->bulk && !hdr->priority;
+			if (normal)
+				work_wait(worker, hdr);
+			hdr->stamp[LOGEVT_STAMP_WORK] = timespec_mononsec();
+			if (normal)
+				work_lag(worker, hdr);
+			hdr->suppressed = false;
+			if (hdr->le_work && hdr->le_work(hdr) == -1) {
+				hdr->discard = true;
+				counter_inc(hdr->suppressed ? &suppressed
+				                            : &failed);
+			} else if (!LOGEVT_WANT(config->events,
+			                        LOGEVT_FLAG(hdr->code))) {
+				hdr->discard = true;
+				counter_inc(&filtered);
 			}
+			hdr->stamp[LOGEVT_STAMP_WORKED] = timespec_mononsec();
+			SIGNPOST_END(cat, "work", hdr);
+			XNUMON_WORK_DONE(hdr->code, hdr->discard);
+			if (hdr->bulk)
+				work_unpin(hdr);
+			else if (normal)
+				work_release(worker, hdr->epoch);
+			work_commit(hdr);
 		}
-		if (!LOGEVT_WANT(config->events, LOGEVT_FLAG(hdr->code))) {
-			hdr->le_free(hdr);
-			continue;
-		}
-		log_submit(hdr);
 	}
-	return NULL;
 }
 
-int
-work_init(config_t *cfg) {
-	queue_init(&work_queue);
-	if (pthread_create(&work_thr, NULL, work_thread, NULL) != 0) {
-		queue_destroy(&work_queue);
+static int
+work_start(worker_t *worker, bool bulk) {
+	worker->bulk = bulk;
+	atomic_store(&worker->lag, 0);
+	atomic_store(&worker->inflight[0], 0);
+	atomic_store(&worker->inflight[1], 0);
+	if (queue_init(&worker->queue, config->queue_capacity,
+	               config->queue_overflow, work_drop) == -1)
+		return -1;
+	if (pthread_create(&worker->thr, NULL, work_thread, worker) != 0) {
+		queue_destroy(&worker->queue);
 		return -1;
 	}
+	return 0;
+}
+
+static void
+work_stop(worker_t *worker) {
+	bzero(&worker->sentinel, sizeof(worker->sentinel));
+	queue_enqueue_wait(&worker->queue, &worker->sentinel);
+	if (pthread_join(worker->thr, NULL) != 0) {
+		fprintf(stderr, "Failed to join worker thread - exiting\n");
+		exit(EXIT_FAILURE);
+	}
+	assert(queue_size(&worker->queue) == 0);
+	queue_destroy(&worker->queue);
+}
+
+int
+work_init(config_t *cfg) {
+	assert(cfg->worker_threads > 0);
+	assert(cfg->worker_threads <= WORKER_THREADS_MAX);
+	assert(cfg->bulk_threads <= BULK_THREADS_MAX);
+
 	config = cfg;
+	submit_seq = 0;
+	reorder_seq = 0;
+	reorder_waiters = 0;
+	reorder_peak = 0;
+	reorder_drops = 0;
+	reorder_blocks = 0;
+	bulked = 0;
+	prioritized = 0;
+	counter_reset(&failed);
+	counter_reset(&suppressed);
+	counter_reset(&filtered);
+	nworkers = 0;
+	nbulkers = 0;
+	priolane = false;
+	elastic = cfg->worker_threads_max > cfg->worker_threads;
+	nroute = 0;
+	epoch = 0;
+	atomic_store(&epoch_waiters, 0);
+	bzero(&scale, sizeof(scale));
+	scale.min = cfg->worker_threads;
+	scale.max = elastic ? cfg->worker_threads_max : cfg->worker_threads;
+	scale.target = (uint64_t)cfg->worker_lag_target * 1000000;
+	pthread_mutex_init(&submit_mutex, NULL);
+	pthread_mutex_init(&pins_mutex, NULL);
+	pthread_mutex_init(&reorder_mutex, NULL);
+	pthread_cond_init(&reorder_cond, NULL);
+	pthread_mutex_init(&epoch_mutex, NULL);
+	pthread_cond_init(&epoch_cond, NULL);
+	tommy_hashinc_init(&pins);
+	tommy_hashinc_init(&reorder_buffer);
+	governor_init(cfg);
+	for (; nworkers < cfg->worker_threads; nworkers++) {
+		if (work_start(&workers[nworkers], false) == -1) {
+			work_fini();
+			return -1;
+		}
+	}
+	nroute = nworkers;
+	atomic_store(&route[0], nroute);
+	atomic_store(&route[1], nroute);
+	for (; nbulkers < cfg->bulk_threads; nbulkers++) {
+		if (work_start(&bulkers[nbulkers], true) == -1) {
+			work_fini();
+			return -1;
+		}
+	}
+	if (cfg->priority_events) {
+		if (work_start(&prioworker, false) == -1) {
+			work_fini();
+			return -1;
+		}
+		priolane = true;
+	}
 	return 0;
 }
 
@@ -79,21 +576,239 @@ work_fini(void) {
 	if (!config)
 		return;
 
-	bzero(&work_sentinel, sizeof(work_sentinel));
-	queue_enqueue(&work_queue, &work_sentinel.node, &work_sentinel);
-	if (pthread_join(work_thr, NULL) != 0) {
-		fprintf(stderr, "Failed to join worker thread - exiting\n");
-		exit(EXIT_FAILURE);
+	if (priolane) {
+		work_stop(&prioworker);
+		priolane = false;
 	}
-	assert(queue_size(&work_queue) == 0);
-	queue_destroy(&work_queue);
+	for (size_t i = 0; i < nbulkers; i++)
+		work_stop(&bulkers[i]);
+	nbulkers = 0;
+	for (size_t i = 0; i < nworkers; i++)
+		work_stop(&workers[i]);
+	nworkers = 0;
+	nroute = 0;
+	assert(tommy_hashinc_count(&pins) == 0);
+	assert(tommy_hashinc_count(&reorder_buffer) == 0);
+	assert(reorder_seq == submit_seq);
+	governor_fini();
+	tommy_hashinc_done(&reorder_buffer);
+	tommy_hashinc_done(&pins);
+	pthread_cond_destroy(&epoch_cond);
+	pthread_mutex_destroy(&epoch_mutex);
+	pthread_cond_destroy(&reorder_cond);
+	pthread_mutex_destroy(&reorder_mutex);
+	pthread_mutex_destroy(&pins_mutex);
+	pthread_mutex_destroy(&submit_mutex);
 	config = NULL;
 }
 
+/*
+ * True if the last change of the number of workers is complete, that is, no
+ * items of the epoch before the current one are left on any worker, parked
+ * ones included, such that its parity can be reused by the next epoch.
+ */
+static bool
+work_settled(void) {
+	unsigned int p = (epoch - 1) & 1;
+
+	for (size_t i = 0; i < nworkers; i++) {
+		if (atomic_load(&workers[i].inflight[p]) > 0)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Change the number of workers items are routed to, starting a new epoch.
+ */
+static void
+work_scale(size_t to, uint32_t depth) {
+	work_scale_t *rec;
+	size_t from = nroute;
+
+	if (to > from) {
+		if (from < nworkers) {
+			/* unpark */
+			atomic_store(&workers[from].lag, 0);
+		} else if (work_start(&workers[from], false) == -1) {
+			fprintf(stderr, "Failed to start worker thread\n");
+			return;
+		} else {
+			nworkers++;
+		}
+	}
+	pthread_mutex_lock(&submit_mutex);
+	pthread_mutex_lock(&epoch_mutex);
+	atomic_store_explicit(&route[(epoch + 1) & 1], to,
+	                      memory_order_relaxed);
+	nroute = to;
+	epoch++;
+	pthread_mutex_unlock(&epoch_mutex);
+	pthread_mutex_unlock(&submit_mutex);
+	if (to < from)
+		scale.downs++;
+	else
+		scale.ups++;
+
+	rec = &scale.log[scale.next];
+	if (timespec_nanotime(&rec->tv) == -1)
+		bzero(&rec->tv, sizeof(rec->tv));
+	rec->from = (uint32_t)from;
+	rec->to = (uint32_t)to;
+	rec->depth = depth;
+	rec->lag = scale.lag;
+	scale.next = (scale.next + 1) % WORK_SCALES;
+	if (scale.count < WORK_SCALES)
+		scale.count++;
+}
+
+/*
+ * Called by the event loop every second to adapt the number of workers to
+ * the load.  Main thread only.
+ */
+void
+work_tick(void) {
+	uint64_t lag = 0, wlag;
+	uint32_t depth = 0;
+
+	if (!config || !elastic)
+		return;
+
+	for (size_t i = 0; i < nroute; i++) {
+		wlag = atomic_exchange_explicit(&workers[i].lag, 0,
+		                                memory_order_relaxed);
+		lag = max(lag, wlag);
+		depth += (uint32_t)queue_size(&workers[i].queue);
+	}
+	scale.lag = lag / 1000;
+	if (lag > scale.target && depth >= nroute) {
+		scale.calm = 0;
+		if (++scale.pressured >= WORK_SCALE_UP_SECS &&
+		    nroute < scale.max && work_settled()) {
+			scale.pressured = 0;
+			work_scale(nroute + 1, depth);
+		}
+	} else if (lag <= scale.target / 2 && depth < nroute) {
+		scale.pressured = 0;
+		if (++scale.calm >= WORK_SCALE_DOWN_SECS &&
+		    nroute > scale.min && work_settled()) {
+			scale.calm = 0;
+			work_scale(nroute - 1, depth);
+		}
+	} else {
+		scale.pressured = 0;
+		scale.calm = 0;
+	}
+}
+
+/*
+ * Number of work items submitted so far.
+ */
+uint64_t
+work_submitted(void) {
+	uint64_t seq;
+
+	pthread_mutex_lock(&submit_mutex);
+	seq = submit_seq;
+	pthread_mutex_unlock(&submit_mutex);
+	return seq;
+}
+
+/*
+ * Number of work items passed on to the log stage so far, in order.
+ */
+uint64_t
+work_passed(void) {
+	uint64_t seq;
+
+	pthread_mutex_lock(&reorder_mutex);
+	seq = reorder_seq;
+	pthread_mutex_unlock(&reorder_mutex);
+	return seq;
+}
+
 void
 work_stats(work_stat_t *st) {
 	assert(st);
 
-	st->qsize = queue_size(&work_queue);
+	st->qsize = 0;
+	st->qpeak = 0;
+	st->drops = 0;
+	st->blocks = 0;
+	st->workers = nworkers;
+	for (size_t i = 0; i < nworkers; i++) {
+		st->wqsize[i] = queue_size(&workers[i].queue);
+		st->qsize += st->wqsize[i];
+		st->qpeak = max(st->qpeak,
+		                (uint32_t)queue_peak(&workers[i].queue));
+		st->drops += queue_drops(&workers[i].queue);
+		st->blocks += queue_blocks(&workers[i].queue);
+	}
+	st->bulkers = nbulkers;
+	for (size_t i = 0; i < nbulkers; i++) {
+		st->bqsize[i] = queue_size(&bulkers[i].queue);
+		st->qsize += st->bqsize[i];
+		st->qpeak = max(st->qpeak,
+		                (uint32_t)queue_peak(&bulkers[i].queue));
+		st->drops += queue_drops(&bulkers[i].queue);
+		st->blocks += queue_blocks(&bulkers[i].queue);
+	}
+	st->bulked = bulked;
+	st->pqsize = 0;
+	if (priolane) {
+		st->pqsize = queue_size(&prioworker.queue);
+		st->qsize += st->pqsize;
+		st->qpeak = max(st->qpeak,
+		                (uint32_t)queue_peak(&prioworker.queue));
+		st->drops += queue_drops(&prioworker.queue);
+		st->blocks += queue_blocks(&prioworker.queue);
+	}
+	st->prioritized = prioritized;
+	pthread_mutex_lock(&reorder_mutex);
+	st->rbsize = tommy_hashinc_count(&reorder_buffer);
+	st->rbpeak = (uint32_t)reorder_peak;
+	st->drops += reorder_drops;
+	st->blocks += reorder_blocks;
+	pthread_mutex_unlock(&reorder_mutex);
+	st->workers_min = (uint32_t)scale.min;
+	st->workers_max = (uint32_t)scale.max;
+	st->lag = scale.lag;
+	st->scaleups = scale.ups;
+	st->scaledowns = scale.downs;
+	st->scales = (uint32_t)scale.count;
+	for (size_t i = 0; i < scale.count; i++)
+		st->scale[i] = scale.log[(scale.next + WORK_SCALES -
+		                          scale.count + i) % WORK_SCALES];
+	st->failed = counter_get(&failed);
+	st->suppressed = counter_get(&suppressed);
+	st->filtered = counter_get(&filtered);
 }
 
+/*
+ * Fold the high-water marks reached since work_stats into st and start a new
+ * period, including a new log of scaling decisions.
+ */
+void
+work_peaks_reset(work_stat_t *st) {
+	size_t peak;
+
+	assert(st);
+
+	for (size_t i = 0; i < nworkers; i++) {
+		peak = queue_peak_reset(&workers[i].queue);
+		st->qpeak = max(st->qpeak, (uint32_t)peak);
+	}
+	for (size_t i = 0; i < nbulkers; i++) {
+		peak = queue_peak_reset(&bulkers[i].queue);
+		st->qpeak = max(st->qpeak, (uint32_t)peak);
+	}
+	if (priolane) {
+		peak = queue_peak_reset(&prioworker.queue);
+		st->qpeak = max(st->qpeak, (uint32_t)peak);
+	}
+	pthread_mutex_lock(&reorder_mutex);
+	st->rbpeak = max(st->rbpeak, (uint32_t)reorder_peak);
+	reorder_peak = tommy_hashinc_count(&reorder_buffer);
+	pthread_mutex_unlock(&reorder_mutex);
+	scale.count = 0;
+}
@@ -15,15 +15,54 @@
 #include "attrib.h"
 
 #include <stdint.h>
+#include <time.h>
+
+#define WORK_SCALE_UP_SECS      3       /* lag before adding a worker */
+#define WORK_SCALE_DOWN_SECS    30      /* calm before removing a worker */
+#define WORK_SCALES             32      /* decisions kept per stats period */
+
+typedef struct {
+	struct timespec tv;
+	uint32_t from;
+	uint32_t to;
+	uint32_t depth;                         /* queued in normal lanes */
+	uint64_t lag;                           /* usec */
+} work_scale_t;
 
 typedef struct {
-	uint32_t qsize;
+	uint32_t qsize;                         /* sum over all workers */
+	uint32_t qpeak;                         /* deepest single queue */
+	uint32_t workers;
+	uint32_t wqsize[WORKER_THREADS_MAX];
+	uint32_t workers_min;
+	uint32_t workers_max;
+	uint64_t lag;                           /* usec, worst in last tick */
+	uint64_t scaleups;
+	uint64_t scaledowns;
+	uint32_t scales;
+	work_scale_t scale[WORK_SCALES];        /* oldest first */
+	uint32_t bulkers;
+	uint32_t bqsize[BULK_THREADS_MAX];
+	uint64_t bulked;                        /* routed to bulk lane */
+	uint32_t pqsize;                        /* priority lane */
+	uint64_t prioritized;                   /* routed to priority lane */
+	uint32_t rbsize;                        /* reorder buffer */
+	uint32_t rbpeak;                        /* deepest reorder buffer */
+	uint64_t drops;
+	uint64_t blocks;
+	uint64_t failed;                        /* le_work failed */
+	uint64_t suppressed;                    /* le_work suppressed */
+	uint64_t filtered;                      /* event type not wanted */
 } work_stat_t;
 
 int work_init(config_t *) WUNRES;
 void work_fini(void);
 void work_submit(void *) NONNULL(1);
+uint64_t work_submitted(void) WUNRES;
+uint64_t work_passed(void) WUNRES;
+void work_tick(void);
 void work_stats(work_stat_t *) NONNULL(1);
+void work_peaks_reset(work_stat_t *) NONNULL(1);
 
 #endif
 
@@ -11,15 +11,18 @@
 #include "debug.h"
 #include "config.h"
 #include "evtloop.h"
+#include "cshelper.h"
 #include "sys.h"
 #include "log.h"
 #include "kextctl.h"
 #include "build.h"
 #include "policy.h"
+#include "signpost.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <sys/stat.h>
 #ifndef __BSD__
@@ -32,22 +35,24 @@
  */
 #define XNUMON_PIDFILE "/var/run/xnumon.pid"
 
-#define OPTSTRING "o:l:f:1mdc:Vh"
+#define OPTSTRING "o:l:f:1mdc:SVhX"
 
 static void
 fusage(FILE *f, const char *argv0) {
 	fprintf(f,
-"Usage: %s [-d] [-c cfgfile] [-olf1mVh]\n"
+"Usage: %s [-d] [-c cfgfile] [-olf1mSVh]\n"
 " -d             launchd mode: adapt behaviour to launchd expectations\n"
 " -c cfgfile     load configuration plist from cfgfile instead of from\n"
 "                /Library/Application Support/ch.roe.xnumon/\n"
 "\n"
 " -o key=value   override configuration key of type string with value\n"
-" -l logfmt      use log format: json*, yaml\n"
-" -f logdst      use log destination: file, stdout*, syslog\n"
+" -l logfmt      use log format: json*, yaml, cbor\n"
+" -f logdst      use log destination: file, stdout*, syslog,\n"
+"                tcp://host:port, shm://path, null\n"
 " -1             use compact one-line log format (not compatible w/yaml)\n"
 " -m             use multi-line log format (not compatible w/syslog)\n"
 "\n"
+" -S             print the schema of the flat log events and exit\n"
 " -V             print version and build information and exit\n"
 , argv0);
 }
@@ -72,6 +77,7 @@ main(int argc, char *argv[]) {
 	char *cfgpath = NULL;
 	config_t *cfg;
 	int pidfd = -1;
+	bool helper = false;
 	char *p;
 
 	while ((ch = getopt(argc, argv, OPTSTRING)) != -1) {
@@ -92,6 +98,10 @@ main(int argc, char *argv[]) {
 				exit(EXIT_FAILURE);
 			}
 			break;
+		case 'S':
+			logevt_schema(stdout);
+			exit(EXIT_SUCCESS);
+			break;
 		case 'V':
 			fversion(stdout);
 			exit(EXIT_SUCCESS);
@@ -99,6 +109,10 @@ main(int argc, char *argv[]) {
 		case 'h':
 			fusage(stdout, argv[0]);
 			exit(EXIT_SUCCESS);
+		case 'X':
+			/* undocumented, see cshelper.c */
+			helper = true;
+			break;
 		case '?':
 			exit(EXIT_FAILURE);
 		default:
@@ -111,7 +125,9 @@ main(int argc, char *argv[]) {
 	optind = 1;
 
 	debug_init();
-	fversion(stderr);
+	signpost_init();
+	if (!helper)
+		fversion(stderr);
 	umask(0027);
 	rv = -1;
 
@@ -125,6 +141,11 @@ main(int argc, char *argv[]) {
 	}
 	fprintf(stderr, "Loaded '%s'\n", cfg->path);
 
+	if (helper) {
+		rv = cshelper_serve(cfg);
+		goto errout;
+	}
+
 	while ((ch = getopt(argc, argv, OPTSTRING)) != -1) {
 		switch (ch) {
 		/* handled in second pass */
@@ -138,33 +159,35 @@ main(int argc, char *argv[]) {
 			}
 			*p = '\0';
 			p++;
-			if (config_str(cfg, optarg, p) == -1) {
+			if (config_override(cfg, optarg, p) == -1) {
 				fprintf(stderr, "Option -o invalid value\n");
 				goto errout;
 			}
 			break;
 		case 'l':
-			if (config_str(cfg, "log_format", optarg) == -1) {
+			if (config_override(cfg, "log_format", optarg) == -1) {
 				fprintf(stderr, "Option -l invalid fmt '%s'\n",
 				                optarg);
 				goto errout;
 			}
 			break;
 		case 'f':
-			if (config_str(cfg, "log_destination", optarg) == -1) {
+			if (config_override(cfg, "log_destination",
+			                    optarg) == -1) {
 				fprintf(stderr, "Option -f invalid dst '%s'\n",
 				                optarg);
 				goto errout;
 			}
 			break;
 		case '1':
-			if (config_str(cfg, "log_mode", "oneline") == -1) {
+			if (config_override(cfg, "log_mode", "oneline") == -1) {
 				fprintf(stderr, "Option -1 internal error\n");
 				goto errout;
 			}
 			break;
 		case 'm':
-			if (config_str(cfg, "log_mode", "multiline") == -1) {
+			if (config_override(cfg, "log_mode",
+			                    "multiline") == -1) {
 				fprintf(stderr, "Option -m internal error\n");
 				goto errout;
 			}
@@ -174,8 +197,10 @@ main(int argc, char *argv[]) {
 			break;
 		/* handled in first pass */
 		case 'c':
+		case 'S':
 		case 'V':
 		case 'h':
+		case 'X':
 		case '?':
 		default:
 			break;